@@ -14,40 +14,55 @@
 #include <thread>
 #include "watchman/Logging.h"
 
+// glibc 2.29 can chdir in the child as a spawn file action, which spares
+// us from changing the cwd of the whole process around the spawn.
+#if defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+#define WATCHMAN_SPAWN_ADDCHDIR 1
+#endif
+
 namespace watchman {
 
-ChildProcess::Environment::Environment() {
-  // Construct the map from the current process environment
-  uint32_t nenv, i;
-  const char* eq;
-  const char* ent;
+const std::shared_ptr<const ChildProcess::Environment::Map>&
+ChildProcess::Environment::processEnvironment() {
+  static const std::shared_ptr<const Map> env = [] {
+    // Construct the map from the current process environment
+    uint32_t nenv, i;
+    const char* eq;
+    const char* ent;
 
-  for (i = 0, nenv = 0; environ[i]; i++) {
-    nenv++;
-  }
+    for (i = 0, nenv = 0; environ[i]; i++) {
+      nenv++;
+    }
 
-  map_.reserve(nenv);
+    auto map = std::make_shared<Map>();
+    map->reserve(nenv);
 
-  for (i = 0; environ[i]; i++) {
-    ent = environ[i];
-    eq = strchr(ent, '=');
-    if (!eq) {
-      continue;
-    }
+    for (i = 0; environ[i]; i++) {
+      ent = environ[i];
+      eq = strchr(ent, '=');
+      if (!eq) {
+        continue;
+      }
 
-    // slice name=value into a key and a value string
-    auto key = w_string_piece(ent, eq - ent);
-    auto val = w_string_piece(eq + 1);
+      // slice name=value into a key and a value string
+      auto key = w_string_piece(ent, eq - ent);
+      auto val = w_string_piece(eq + 1);
 
-    // Replace rather than set, just in case we somehow have duplicate
-    // keys in our environment array.
-    map_[key.asWString()] = val.asWString();
-  }
+      // Replace rather than set, just in case we somehow have duplicate
+      // keys in our environment array.
+      (*map)[key.asWString()] = val.asWString();
+    }
+    return std::shared_ptr<const Map>(std::move(map));
+  }();
+  return env;
 }
 
+ChildProcess::Environment::Environment() : base_(processEnvironment()) {}
+
 ChildProcess::Environment::Environment(
     const std::unordered_map<w_string, w_string>& map)
-    : map_(map) {}
+    : base_(std::make_shared<const Map>(map)) {}
 
 /* Constructs an envp array from a hash table.
  * The returned array occupies a single contiguous block of memory
@@ -56,16 +71,30 @@ ChildProcess::Environment::Environment(
  * with posix_spawn() */
 std::unique_ptr<char*, ChildProcess::Deleter>
 ChildProcess::Environment::asEnviron(size_t* env_size) const {
-  size_t len = (1 + map_.size()) * sizeof(char*);
+  // Visits each variable of the environment: those of base_ that haven't
+  // been changed, then those that were set since.
+  auto forEach = [&](auto&& fn) {
+    for (const auto& it : *base_) {
+      if (changes_.find(it.first) == changes_.end()) {
+        fn(it.first, it.second);
+      }
+    }
+    for (const auto& it : changes_) {
+      if (it.second) {
+        fn(it.first, *it.second);
+      }
+    }
+  };
 
   // Make a pass through to compute the required memory size
-  for (const auto& it : map_) {
-    const auto& key = it.first;
-    const auto& val = it.second;
-
+  size_t count = 0;
+  size_t len = 0;
+  forEach([&](const w_string& key, const w_string& val) {
+    ++count;
     // key=value\0
     len += key.size() + 1 + val.size() + 1;
-  }
+  });
+  len += (1 + count) * sizeof(char*);
 
   auto envp = (char**)malloc(len);
   if (!envp) {
@@ -74,12 +103,9 @@ ChildProcess::Environment::asEnviron(size_t* env_size) const {
   auto result = std::unique_ptr<char*, Deleter>(envp, Deleter());
 
   // Now populate
-  auto buf = (char*)(envp + map_.size() + 1);
+  auto buf = (char*)(envp + count + 1);
   size_t i = 0;
-  for (const auto& it : map_) {
-    const auto& key = it.first;
-    const auto& val = it.second;
-
+  forEach([&](const w_string& key, const w_string& val) {
     envp[i++] = buf;
 
     // key=value\0
@@ -94,9 +120,9 @@ ChildProcess::Environment::asEnviron(size_t* env_size) const {
 
     *buf = 0;
     buf++;
-  }
+  });
 
-  envp[map_.size()] = nullptr;
+  envp[count] = nullptr;
 
   if (env_size) {
     *env_size = len;
@@ -105,14 +131,14 @@ ChildProcess::Environment::asEnviron(size_t* env_size) const {
 }
 
 void ChildProcess::Environment::set(const w_string& key, const w_string& val) {
-  map_[key] = val;
+  changes_[key] = val;
 }
 
 void ChildProcess::Environment::setBool(const w_string& key, bool bval) {
   if (bval) {
-    map_[key] = "true";
+    changes_[key] = w_string("true");
   } else {
-    map_.erase(key);
+    unset(key);
   }
 }
 
@@ -124,13 +150,18 @@ void ChildProcess::Environment::set(
 }
 
 void ChildProcess::Environment::unset(const w_string& key) {
-  map_.erase(key);
+  changes_[key] = std::nullopt;
 }
 
 ChildProcess::Options::Options() : inner_(std::make_unique<Inner>()) {
 #ifdef POSIX_SPAWN_CLOEXEC_DEFAULT
   setFlags(POSIX_SPAWN_CLOEXEC_DEFAULT);
 #endif
+#ifdef POSIX_SPAWN_USEVFORK
+  // Don't copy the page tables of a large daemon only to exec right away.
+  // Current glibc always spawns this way; older versions need asking.
+  setFlags(POSIX_SPAWN_USEVFORK);
+#endif
 }
 
 ChildProcess::Options::Inner::Inner() {
@@ -247,9 +278,19 @@ void ChildProcess::Options::nullStdin() {
 }
 
 void ChildProcess::Options::chdir(w_string_piece path) {
-  cwd_ = std::string(path.data(), path.size());
-#ifdef _WIN32
+  std::string cwd(path.data(), path.size());
+#if defined(_WIN32)
+  cwd_ = std::move(cwd);
   posix_spawnattr_setcwd_np(&inner_->attr, cwd_.c_str());
+#elif defined(WATCHMAN_SPAWN_ADDCHDIR)
+  auto err =
+      posix_spawn_file_actions_addchdir_np(&inner_->actions, cwd.c_str());
+  if (err) {
+    throw std::system_error(
+        err, std::generic_category(), "posix_spawn_file_actions_addchdir_np");
+  }
+#else
+  cwd_ = std::move(cwd);
 #endif
 }
 
@@ -284,10 +325,16 @@ ChildProcess::ChildProcess(
   argv.emplace_back(nullptr);
 
 #ifndef _WIN32
-  auto lock = lockCwdMutex();
+  // Without a chdir file action, the cwd of the whole process has to be
+  // switched around the spawn.
+  std::unique_lock<std::mutex> lock;
   char savedCwd[WATCHMAN_NAME_MAX];
-  if (!getcwd(savedCwd, sizeof(savedCwd))) {
-    throw std::system_error(errno, std::generic_category(), "failed to getcwd");
+  if (!options.cwd_.empty()) {
+    lock = lockCwdMutex();
+    if (!getcwd(savedCwd, sizeof(savedCwd))) {
+      throw std::system_error(
+          errno, std::generic_category(), "failed to getcwd");
+    }
   }
   SCOPE_EXIT {
     if (!options.cwd_.empty()) {
@@ -424,6 +471,15 @@ std::unique_ptr<Pipe> ChildProcess::takeStdin() {
   return pipe;
 }
 
+Pipe& ChildProcess::pipe(int targetFd) {
+  auto it = pipes_.find(targetFd);
+  if (it == pipes_.end()) {
+    throw std::logic_error(
+        fmt::format("child process has no pipe for fd {}", targetFd));
+  }
+  return *it->second;
+}
+
 std::pair<std::optional<w_string>, std::optional<w_string>>
 ChildProcess::communicate(pipeWriteCallback writeCallback) {
 #ifdef _WIN32
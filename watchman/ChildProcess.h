@@ -8,7 +8,9 @@
 #pragma once
 
 #include <folly/futures/Future.h>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -51,7 +53,18 @@ class ChildProcess {
     void unset(const w_string& key);
 
    private:
-    std::unordered_map<w_string, w_string> map_;
+    using Map = std::unordered_map<w_string, w_string>;
+
+    // The process environment, parsed on first use and then shared by
+    // every Environment() rather than being parsed again for each spawn.
+    // Watchman doesn't change its own environment once it is running.
+    static const std::shared_ptr<const Map>& processEnvironment();
+
+    // The variables this environment started out with, which may be shared
+    // with other environments, and the changes made since: an unset
+    // variable maps to nullopt.
+    std::shared_ptr<const Map> base_;
+    std::unordered_map<w_string, std::optional<w_string>> changes_;
   };
 
   class Options {
@@ -115,6 +128,8 @@ class ChildProcess {
     std::unique_ptr<Inner> inner_;
     Environment env_;
     std::unordered_map<int, std::unique_ptr<Pipe>> pipes_;
+    // The cwd for the child, when it can't be set by a spawn file action
+    // and the parent has to chdir around the spawn instead.
     std::string cwd_;
 
     friend class ChildProcess;
@@ -155,6 +170,11 @@ class ChildProcess {
   // terminate.
   std::unique_ptr<Pipe> takeStdin();
 
+  // Returns the parent's side of the pipe that was set up as targetFd in
+  // the child, for talking to a long-lived child directly rather than via
+  // communicate().  Throws if there is no such pipe.
+  Pipe& pipe(int targetFd);
+
   // The pipeWriteCallback is called by communicate when it is safe to write
   // data to the pipe.  The callback should then attempt to write to it.
   // The callback must return true when it has nothing more
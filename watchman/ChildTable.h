@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <limits>
+#include <utility>
+#include <vector>
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * A compact map from a child name to the node that owns that name, used for
+ * the files and dirs of a watchman_dir.
+ *
+ * Entries are stored densely in a vector.  Most directories hold only a
+ * handful of entries, and for those a linear scan over the inline keys is
+ * cheaper than hashing and chasing bucket pointers.  Once a table grows past
+ * kIndexThreshold entries an open-addressing index (linear probing over a
+ * power-of-two slot array, with the full hash kept in each slot) is built
+ * alongside the entries and maintained from then on.
+ *
+ * The keys are non-owning w_string_pieces; as with the std::unordered_map
+ * this replaces, the caller must ensure the key storage is kept alive by the
+ * mapped node.
+ *
+ * Iteration order is unspecified, and erase() may reorder the remaining
+ * entries.  Inserting or erasing invalidates iterators and references to
+ * entries, but not the nodes they point to.
+ */
+template <typename Value>
+class ChildTable {
+ public:
+  using key_type = w_string_piece;
+  using mapped_type = Value;
+  using value_type = std::pair<w_string_piece, Value>;
+  using iterator = typename std::vector<value_type>::iterator;
+  using const_iterator = typename std::vector<value_type>::const_iterator;
+
+  // Tables up to this size are searched linearly.
+  static constexpr size_t kIndexThreshold = 32;
+
+  ChildTable() = default;
+  ChildTable(const ChildTable&) = delete;
+  ChildTable& operator=(const ChildTable&) = delete;
+  ChildTable(ChildTable&&) noexcept = default;
+  ChildTable& operator=(ChildTable&&) noexcept = default;
+
+  iterator begin() {
+    return entries_.begin();
+  }
+  iterator end() {
+    return entries_.end();
+  }
+  const_iterator begin() const {
+    return entries_.begin();
+  }
+  const_iterator end() const {
+    return entries_.end();
+  }
+
+  bool empty() const {
+    return entries_.empty();
+  }
+
+  size_t size() const {
+    return entries_.size();
+  }
+
+  bool hasIndex() const {
+    return !slots_.empty();
+  }
+
+  /**
+   * Pre-sizes the entry storage for `n` entries.  The index is still only
+   * built once the table actually outgrows kIndexThreshold (the crawler's
+   * size hints are often generous guesses), but when it is, it is sized for
+   * the reserved capacity so that populating a large directory doesn't need
+   * to rehash.
+   */
+  void reserve(size_t n) {
+    entries_.reserve(n);
+    if (hasIndex() && slots_.size() < slotCountFor(n)) {
+      rebuildIndex(slotCountFor(n));
+    }
+  }
+
+  iterator find(w_string_piece key) {
+    auto pos = lookup(key);
+    return pos == kNotFound ? entries_.end() : entries_.begin() + pos;
+  }
+
+  const_iterator find(w_string_piece key) const {
+    auto pos = lookup(key);
+    return pos == kNotFound ? entries_.end() : entries_.begin() + pos;
+  }
+
+  /**
+   * Returns the value mapped to key, inserting a default constructed value
+   * if there is no such entry.
+   */
+  Value& operator[](w_string_piece key) {
+    auto pos = lookup(key);
+    if (pos != kNotFound) {
+      return entries_[pos].second;
+    }
+    entries_.emplace_back(key, Value{});
+    if (hasIndex()) {
+      if ((entries_.size() + 1) * 4 > slots_.size() * 3) {
+        rebuildIndex(slots_.size() * 2);
+      } else {
+        insertSlot(key.hashValue(), uint32_t(entries_.size() - 1));
+      }
+    } else if (entries_.size() > kIndexThreshold) {
+      rebuildIndex(slotCountFor(entries_.capacity()));
+    }
+    return entries_.back().second;
+  }
+
+  /**
+   * Removes the entry for key, if any.  Returns the number of entries
+   * removed.
+   */
+  size_t erase(w_string_piece key) {
+    if (!hasIndex()) {
+      auto pos = linearLookup(key);
+      if (pos == kNotFound) {
+        return 0;
+      }
+      removeEntry(pos);
+      return 1;
+    }
+
+    auto hash = key.hashValue();
+    auto slot = findSlot(key, hash);
+    if (slot == kNotFound) {
+      return 0;
+    }
+    auto pos = slots_[slot].index;
+    removeSlot(slot);
+
+    auto last = uint32_t(entries_.size() - 1);
+    if (pos != last) {
+      // The last entry is about to move into the vacated position
+      auto lastKey = entries_[last].first;
+      slots_[findSlot(lastKey, lastKey.hashValue())].index = pos;
+    }
+    removeEntry(pos);
+    return 1;
+  }
+
+ private:
+  static constexpr uint32_t kNotFound = std::numeric_limits<uint32_t>::max();
+  static constexpr uint32_t kEmpty = std::numeric_limits<uint32_t>::max();
+
+  struct Slot {
+    uint32_t index{kEmpty};
+    StringHash hash{0};
+  };
+
+  static bool keyEquals(w_string_piece a, w_string_piece b) {
+    return a.size() == b.size() && memcmp(a.data(), b.data(), a.size()) == 0;
+  }
+
+  static size_t slotCountFor(size_t n) {
+    // Aim for a load factor below 3/4
+    size_t slots = 64;
+    while (slots * 3 < n * 4) {
+      slots *= 2;
+    }
+    return slots;
+  }
+
+  uint32_t linearLookup(w_string_piece key) const {
+    for (size_t i = 0; i < entries_.size(); ++i) {
+      if (keyEquals(entries_[i].first, key)) {
+        return uint32_t(i);
+      }
+    }
+    return kNotFound;
+  }
+
+  uint32_t lookup(w_string_piece key) const {
+    if (!hasIndex()) {
+      return linearLookup(key);
+    }
+    auto slot = findSlot(key, key.hashValue());
+    return slot == kNotFound ? kNotFound : slots_[slot].index;
+  }
+
+  // Returns the slot holding key, or kNotFound.
+  uint32_t findSlot(w_string_piece key, StringHash hash) const {
+    size_t mask = slots_.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+      const auto& slot = slots_[i];
+      if (slot.index == kEmpty) {
+        return kNotFound;
+      }
+      if (slot.hash == hash && keyEquals(entries_[slot.index].first, key)) {
+        return uint32_t(i);
+      }
+    }
+  }
+
+  void insertSlot(StringHash hash, uint32_t index) {
+    size_t mask = slots_.size() - 1;
+    size_t i = hash & mask;
+    while (slots_[i].index != kEmpty) {
+      i = (i + 1) & mask;
+    }
+    slots_[i].index = index;
+    slots_[i].hash = hash;
+  }
+
+  // Backward-shift deletion keeps probe sequences intact without tombstones.
+  void removeSlot(size_t hole) {
+    size_t mask = slots_.size() - 1;
+    size_t i = hole;
+    while (true) {
+      i = (i + 1) & mask;
+      if (slots_[i].index == kEmpty) {
+        break;
+      }
+      size_t home = slots_[i].hash & mask;
+      // Move slot i into the hole if its home position does not lie
+      // cyclically within (hole, i].
+      if (((i - home) & mask) >= ((i - hole) & mask)) {
+        slots_[hole] = slots_[i];
+        hole = i;
+      }
+    }
+    slots_[hole] = Slot{};
+  }
+
+  void removeEntry(uint32_t pos) {
+    if (pos != entries_.size() - 1) {
+      entries_[pos] = std::move(entries_.back());
+    }
+    entries_.pop_back();
+  }
+
+  void rebuildIndex(size_t slotCount) {
+    slots_.assign(slotCount, Slot{});
+    for (size_t i = 0; i < entries_.size(); ++i) {
+      insertSlot(entries_[i].first.hashValue(), uint32_t(i));
+    }
+  }
+
+  std::vector<value_type> entries_;
+  std::vector<Slot> slots_;
+};
+
+} // namespace watchman
@@ -8,14 +8,22 @@
 #include "watchman/Client.h"
 
 #include <folly/MapUtil.h>
+#ifndef _WIN32
+#include <folly/executors/CPUThreadPoolExecutor.h>
+#include <folly/executors/thread_factory/NamedThreadFactory.h>
+#include <folly/io/async/EventBaseThread.h>
+#include <folly/io/async/EventHandler.h>
+#endif
 
 #include "watchman/Command.h"
 #include "watchman/Errors.h"
 #include "watchman/Logging.h"
 #include "watchman/MapUtil.h"
+#include "watchman/Metrics.h"
 #include "watchman/Poison.h"
 #include "watchman/QueryableView.h"
 #include "watchman/Shutdown.h"
+#include "watchman/WatchmanConfig.h"
 #include "watchman/root/Root.h"
 #include "watchman/watchman_cmd.h"
 
@@ -81,6 +89,26 @@ void Client::enqueueResponse(UntypedResponse resp) {
   enqueueResponse(std::move(resp).toJson());
 }
 
+bool Client::flushResponses() {
+  if (!stm) {
+    return true;
+  }
+  stm->setNonBlock(false);
+  SCOPE_EXIT {
+    stm->setNonBlock(true);
+  };
+  // Encode everything before writing, so that small responses share a write
+  while (!responses.empty()) {
+    auto encodeResult =
+        writer.pduEncodeToBuffer(this->format, responses.front(), stm.get());
+    responses.pop_front();
+    if (encodeResult.hasError()) {
+      return false;
+    }
+  }
+  return writer.flushToStream(stm.get()).hasValue();
+}
+
 void Client::sendErrorResponse(std::string_view formatted) {
   UntypedResponse resp;
   resp.set("error", typed_string_to_json(formatted));
@@ -146,19 +174,27 @@ bool Client::dispatchCommand(const Command& command, CommandFlags mode) {
       };
 
       sample.set_wall_time_thresh(
-          cfg_get_double("slow_command_log_threshold_seconds", 1.0));
+          cfg_get_snapshot()->slowCommandLogThresholdSeconds);
 
       // TODO: It's silly to convert a Command back into JSON after parsing it.
       // Let's change `func` to take a Command after Command knows what a root
       // path is.
       auto rendered = command.render();
 
+      auto start = std::chrono::steady_clock::now();
       try {
-        enqueueResponse(def->handler(this, rendered));
+        std::optional<json_ref> forwarded;
+        if (def->validator == w_cmd_realpath_root && RootWorker::enabled()) {
+          forwarded = forwardToRootWorker(rendered);
+        }
+        enqueueResponse(
+            forwarded ? std::move(*forwarded) : def->handler(this, rendered));
       } catch (const ErrorResponse& e) {
         sendErrorResponse(e.what());
       } catch (const ResponseWasHandledManually&) {
       }
+      CommandMetrics::get().record(
+          def->name, std::chrono::steady_clock::now() - start);
 
       if (sample.finish()) {
         sample.add_meta("args", std::move(rendered));
@@ -205,14 +241,136 @@ std::string ClientStatus::getName() const {
   return "<unknown>";
 }
 
+#ifndef _WIN32
+/**
+ * Watches the connections of idle clients from a single thread, and services
+ * a client on a bounded pool of worker threads once its socket is readable or
+ * it has been pinged.  This replaces the thread per client when
+ * client_worker_threads is set.
+ *
+ * A client is only watched while it is idle, so at most one worker services it
+ * at a time, and its requests and responses retain their order.
+ */
+class ClientEventLoop {
+ public:
+  explicit ClientEventLoop(size_t numWorkers)
+      : workers_{
+            numWorkers,
+            std::make_unique<folly::NamedThreadFactory>("client")} {}
+
+  void add(std::shared_ptr<UserClient> client) {
+    auto watch = std::make_shared<Watch>(this, std::move(client));
+    evbThread_.getEventBase()->runInEventBaseThread(
+        [watch = std::move(watch)] { watch->arm(); });
+  }
+
+ private:
+  class Watch : public std::enable_shared_from_this<Watch> {
+   public:
+    Watch(ClientEventLoop* loop, std::shared_ptr<UserClient> client)
+        : loop_{loop},
+          client_{std::move(client)},
+          stream_{this, client_->stm->getEvents()},
+          ping_{this, client_->ping.get()} {}
+
+    // Called on the event base thread
+    void arm() {
+      client_->status_.transitionTo(ClientStatus::WAITING_FOR_REQUEST);
+      self_ = shared_from_this();
+      // Output that the client had no room for is sent once it has
+      stream_.registerHandler(
+          client_->hasPendingOutput()
+              ? folly::EventHandler::READ | folly::EventHandler::WRITE
+              : folly::EventHandler::READ);
+      ping_.registerHandler(folly::EventHandler::READ);
+    }
+
+   private:
+    class Handler : public folly::EventHandler {
+     public:
+      Handler(Watch* watch, watchman_event* evt)
+          : folly::EventHandler{
+                watch->loop_->evbThread_.getEventBase(),
+                folly::NetworkSocket::fromFd(evt->system_handle())},
+            watch_{watch} {}
+
+      void handlerReady(uint16_t) noexcept override {
+        watch_->ready(this);
+      }
+
+     private:
+      Watch* watch_;
+    };
+
+    // Called on the event base thread
+    void ready(Handler* handler) {
+      stream_.unregisterHandler();
+      ping_.unregisterHandler();
+      bool readable = handler == &stream_;
+      loop_->workers_.add(
+          [self = std::move(self_), readable] { self->service(readable); });
+    }
+
+    // Called on a worker thread
+    void service(bool readable) {
+      if (w_is_stopping() || !client_->serviceClient(readable, !readable)) {
+        client_->status_.transitionTo(ClientStatus::THREAD_STOPPING);
+        // Disconnect here, rather than on the event base thread
+        client_.reset();
+        return;
+      }
+
+      client_->reader.release();
+      client_->writer.release();
+      loop_->evbThread_.getEventBase()->runInEventBaseThread(
+          [self = shared_from_this()] { self->arm(); });
+    }
+
+    ClientEventLoop* loop_;
+    std::shared_ptr<UserClient> client_;
+    Handler stream_;
+    Handler ping_;
+    // Keeps this alive while it is registered with the event base
+    std::shared_ptr<Watch> self_;
+  };
+
+  folly::EventBaseThread evbThread_{true, nullptr, "client-loop"};
+  folly::CPUThreadPoolExecutor workers_;
+};
+
+namespace {
+
+ClientEventLoop* getClientEventLoop() {
+  static ClientEventLoop* loop = [] {
+    auto numWorkers = cfg_get_int("client_worker_threads", 0);
+    return numWorkers > 0 ? new ClientEventLoop(numWorkers) : nullptr;
+  }();
+  return loop;
+}
+
+} // namespace
+#endif
+
 void UserClient::create(std::unique_ptr<watchman_stream> stm) {
   auto uc = std::make_shared<UserClient>(PrivateBadge{}, std::move(stm));
 
+  uc->stm->setNonBlock(true);
+  uc->client_is_owner = uc->stm->peerIsOwner();
+
+#ifndef _WIN32
+  if (auto* loop = getClientEventLoop()) {
+    loop->add(std::move(uc));
+    return;
+  }
+#endif
+
   // Start a thread for the client.
   //
   // We used to use libevent for this, but we have a low volume of concurrent
   // clients and the json parse/encode APIs are not easily used in a
-  // non-blocking server architecture.
+  // non-blocking server architecture.  When client_worker_threads is set,
+  // idle clients are instead watched by a ClientEventLoop, and their
+  // commands are dispatched on its workers.
   //
   // The thread holds a reference count for its life, so the shared_ptr must be
   // created before the thread is started.
@@ -267,9 +425,44 @@ ClientDebugStatus UserClient::getDebugStatus() const {
     rv.peer->name = peerName_.get();
   }
   rv.since = std::chrono::system_clock::to_time_t(since_);
+  rv.coalesced_notifications =
+      coalescedNotifications_.load(std::memory_order_relaxed);
+  rv.dropped_log_messages =
+      droppedLogMessages_.load(std::memory_order_relaxed);
+  rv.priority = queryPriorityName(getQueryPriority());
   return rv;
 }
 
+QueryPriority UserClient::getQueryPriority() const {
+  if (declaredPriority || !peerPid_) {
+    return Client::getQueryPriority();
+  }
+  Configuration globalConfig;
+  auto classes = globalConfig.get("client_priority_classes");
+  if (!classes || !classes->isObject()) {
+    return QueryPriority::Interactive;
+  }
+  // Match the basename of the program that the peer is running.  This may
+  // briefly block on the ProcessNameCache the first time.
+  auto name = peerName_.get();
+  name = name.substr(0, name.find(' '));
+  if (auto slash = name.rfind('/'); slash != std::string::npos) {
+    name = name.substr(slash + 1);
+  }
+  for (auto& [className, programs] : classes->object()) {
+    auto priority = parseQueryPriority(className.view());
+    if (!priority || !programs.isArray()) {
+      continue;
+    }
+    for (auto& program : programs.array()) {
+      if (program.isString() && program.asString().view() == name) {
+        return *priority;
+      }
+    }
+  }
+  return QueryPriority::Interactive;
+}
+
 void UserClient::vacateStates() {
   while (!states.empty()) {
     auto it = states.begin();
@@ -294,14 +487,48 @@ void UserClient::vacateStates() {
   }
 }
 
+std::optional<json_ref> UserClient::forwardToRootWorker(
+    const json_ref& rendered) {
+  const char* path = json_string_value(rendered.at(1));
+  if (!path) {
+    // Let the command report it
+    return std::nullopt;
+  }
+  if (json_array_size(rendered) > 2) {
+    auto query = rendered.at(2);
+    if (query.isObject() &&
+        query.get_default("shared_memory", json_false()).asBool()) {
+      throw ErrorResponse(
+          "shared_memory can't be used with root_worker_processes");
+    }
+  }
+
+  auto worker = RootWorker::forPath(w_string{path});
+  auto& connection = workerConnections_[worker];
+  if (!connection || connection->closed()) {
+    connection = std::make_unique<RootWorkerConnection>(
+        std::move(worker), [this](json_ref pdu) {
+          relayedResponses_.wlock()->push_back(std::move(pdu));
+          ping->notify();
+        });
+  }
+  auto response = connection->forward(rendered);
+  // Any batches of the results go ahead of the response
+  takeRelayedResponses();
+  return response;
+}
+
+void UserClient::takeRelayedResponses() {
+  std::deque<json_ref> relayed;
+  relayedResponses_.wlock()->swap(relayed);
+  for (auto& pdu : relayed) {
+    enqueueResponse(std::move(pdu));
+  }
+}
+
 void UserClient::clientThread() noexcept {
   status_.transitionTo(ClientStatus::THREAD_STARTED);
 
-  // Keep a persistent vector around so that we can avoid allocating
-  // and releasing heap memory when we collect items from the publisher
-  std::vector<std::shared_ptr<const watchman::Publisher::Item>> pending;
-
-  stm->setNonBlock(true);
   w_set_thread_name(
       "client=",
       unique_id,
@@ -310,183 +537,309 @@ void UserClient::clientThread() noexcept {
       ":pid=",
       stm->getPeerProcessID());
 
-  client_is_owner = stm->peerIsOwner();
-
   EventPoll pfd[2];
   pfd[0].evt = stm->getEvents();
   pfd[1].evt = ping.get();
 
-  bool client_alive = true;
-  while (!w_is_stopping() && client_alive) {
+  while (!w_is_stopping()) {
     // Wait for input from either the client socket or
     // via the ping pipe, which signals that some other
     // thread wants to unilaterally send data to the client
 
     status_.transitionTo(ClientStatus::WAITING_FOR_REQUEST);
-    ignore_result(w_poll_events(pfd, 2, 2000));
+    // The events don't report when the client makes room for more output,
+    // so look again soon while there is output waiting for it
+    ignore_result(w_poll_events(pfd, 2, hasPendingOutput() ? 100 : 2000));
     if (w_is_stopping()) {
       break;
     }
 
-    if (pfd[0].ready) {
-      status_.transitionTo(ClientStatus::DECODING_REQUEST);
-      json_error_t jerr;
-      auto request = reader.decodeNext(stm.get(), &jerr);
-
-      if (!request && errno == EAGAIN) {
-        // That's fine
-      } else if (!request) {
-        // Not so cool
-        if (reader.wpos == reader.rpos) {
-          // If they disconnected in between PDUs, no need to log
-          // any error
-          goto disconnected;
-        }
-        sendErrorResponse(
-            "invalid json at position {}: {}", jerr.position, jerr.text);
-        logf(ERR, "invalid data from client: {}\n", jerr.text);
-
-        goto disconnected;
-      } else if (request) {
-        format = reader.format;
-        status_.transitionTo(ClientStatus::DISPATCHING_COMMAND);
-        dispatchCommand(Command::parse(*request), CMD_DAEMON);
+    if (!serviceClient(pfd[0].ready, pfd[1].ready)) {
+      break;
+    }
+  }
+
+  status_.transitionTo(ClientStatus::THREAD_STOPPING);
+  w_set_thread_name(
+      "NOT_CONN:client=",
+      unique_id,
+      ":stm=",
+      uintptr_t(stm.get()),
+      ":pid=",
+      stm->getPeerProcessID());
+}
+
+// The daemon reads the commands that a client sends ahead of their
+// responses, and responds to them in order
+W_CAP_REG("pipelining")
+
+bool UserClient::serviceClient(bool readable, bool pinged) {
+  bool dispatched = false;
+  if (!serviceOnce(readable, pinged, dispatched)) {
+    return false;
+  }
+  // A client may pipeline its commands, sending the next before it has
+  // read the response to the last.  Those that were read into the buffer
+  // along with the first won't make the socket readable again, so
+  // dispatch them now, in order.
+  while (dispatched && reader.rpos != reader.wpos) {
+    dispatched = false;
+    if (!serviceOnce(true, false, dispatched)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool UserClient::serviceOnce(bool readable, bool pinged, bool& dispatched) {
+  if (readable) {
+    // The request and most of its response are built and torn down
+    // together, so allocate their json values from an arena.
+    std::optional<json_arena_scope> arena;
+    if (cfg_get_snapshot()->jsonArena) {
+      arena.emplace();
+    }
+
+    status_.transitionTo(ClientStatus::DECODING_REQUEST);
+    json_error_t jerr;
+    auto request = reader.decodeNext(stm.get(), &jerr);
+
+    if (!request && errno == EAGAIN) {
+      // That's fine
+    } else if (!request) {
+      // Not so cool
+      if (reader.wpos == reader.rpos) {
+        // If they disconnected in between PDUs, no need to log
+        // any error
+        return false;
       }
+      sendErrorResponse(
+          "invalid json at position {}: {}", jerr.position, jerr.text);
+      logf(ERR, "invalid data from client: {}\n", jerr.text);
+
+      return false;
+    } else if (request) {
+      format = reader.format;
+      status_.transitionTo(ClientStatus::DISPATCHING_COMMAND);
+      dispatchCommand(Command::parse(*request), CMD_DAEMON);
+      dispatched = true;
     }
+  }
 
-    if (pfd[1].ready) {
-      while (ping->testAndClear()) {
-        status_.transitionTo(ClientStatus::PROCESSING_SUBSCRIPTION);
-        // Enqueue refs to pending log payloads
-        pending.clear();
-        getPending(pending, debugSub, errorSub);
-        for (auto& item : pending) {
+  if (pinged) {
+    while (ping->testAndClear()) {
+      status_.transitionTo(ClientStatus::PROCESSING_SUBSCRIPTION);
+      takeRelayedResponses();
+      // Enqueue refs to pending log payloads.  A client that isn't reading
+      // doesn't get them, rather than have them pile up here.
+      pending_.clear();
+      getPending(pending_, debugSub, errorSub);
+      if (isOutputBackedUp()) {
+        droppedLogMessages_.fetch_add(
+            pending_.size(), std::memory_order_relaxed);
+      } else {
+        for (auto& item : pending_) {
           enqueueResponse(json_ref(item->payload));
         }
+      }
 
-        // Maybe we have subscriptions to dispatch?
-        std::vector<w_string> subsToDelete;
-        for (auto& [sub, subStream] : unilateralSub) {
+      // Maybe we have subscriptions to dispatch?
+      std::vector<w_string> subsToDelete;
+      for (auto& [sub, subStream] : unilateralSub) {
+        watchman::log(
+            watchman::DBG, "consider fan out sub ", sub->name, "\n");
+
+        pending_.clear();
+        subStream->getPending(pending_);
+        bool seenSettle = false;
+        for (auto& item : pending_) {
+          auto dumped = json_dumps(item->payload, 0);
           watchman::log(
-              watchman::DBG, "consider fan out sub ", sub->name, "\n");
+              watchman::DBG,
+              "Unilateral payload for sub ",
+              sub->name,
+              " ",
+              dumped,
+              "\n");
+
+          if (item->payload.get_optional("canceled")) {
+            watchman::log(
+                watchman::ERR,
+                "Cancel subscription ",
+                sub->name,
+                " due to root cancellation\n");
+
+            UntypedResponse resp;
+            resp.set(
+                {{"unilateral", json_true()},
+                 {"canceled", json_true()},
+                 {"subscription", w_string_to_json(sub->name)}});
+            if (auto root = item->payload.get_optional("root")) {
+              resp.set("root", *root);
+            }
+            enqueueResponse(std::move(resp));
+            // Remember to cancel this subscription.
+            // We can't do it in this loop because that would
+            // invalidate the iterators and cause a headache.
+            subsToDelete.push_back(sub->name);
+            continue;
+          }
+
+          if (item->payload.get_optional("state-enter") ||
+              item->payload.get_optional("state-leave")) {
+            UntypedResponse resp;
+            resp.insert(
+                item->payload.object().begin(), item->payload.object().end());
+            // We have the opportunity to populate additional response
+            // fields here (since we don't want to block the command).
+            // We don't populate the fat clock for SCM aware queries
+            // because determination of mergeBase could add latency.
+            resp.set(
+                {{"unilateral", json_true()},
+                 {"subscription", w_string_to_json(sub->name)}});
+            enqueueResponse(std::move(resp));
 
-          pending.clear();
-          subStream->getPending(pending);
-          bool seenSettle = false;
-          for (auto& item : pending) {
-            auto dumped = json_dumps(item->payload, 0);
             watchman::log(
                 watchman::DBG,
-                "Unilateral payload for sub ",
+                "Fan out subscription state change for ",
                 sub->name,
-                " ",
-                dumped,
                 "\n");
+            continue;
+          }
 
-            if (item->payload.get_optional("canceled")) {
-              watchman::log(
-                  watchman::ERR,
-                  "Cancel subscription ",
-                  sub->name,
-                  " due to root cancellation\n");
-
-              UntypedResponse resp;
-              resp.set(
-                  {{"unilateral", json_true()},
-                   {"canceled", json_true()},
-                   {"subscription", w_string_to_json(sub->name)}});
-              if (auto root = item->payload.get_optional("root")) {
-                resp.set("root", *root);
-              }
-              enqueueResponse(std::move(resp));
-              // Remember to cancel this subscription.
-              // We can't do it in this loop because that would
-              // invalidate the iterators and cause a headache.
-              subsToDelete.push_back(sub->name);
-              continue;
-            }
-
-            if (item->payload.get_optional("state-enter") ||
-                item->payload.get_optional("state-leave")) {
-              UntypedResponse resp;
-              resp.insert(
-                  item->payload.object().begin(), item->payload.object().end());
-              // We have the opportunity to populate additional response
-              // fields here (since we don't want to block the command).
-              // We don't populate the fat clock for SCM aware queries
-              // because determination of mergeBase could add latency.
-              resp.set(
-                  {{"unilateral", json_true()},
-                   {"subscription", w_string_to_json(sub->name)}});
-              enqueueResponse(std::move(resp));
-
-              watchman::log(
-                  watchman::DBG,
-                  "Fan out subscription state change for ",
-                  sub->name,
-                  "\n");
-              continue;
+          if (!sub->debug_paused && item->payload.get_optional("settled")) {
+            seenSettle = true;
+            // A coalesced run reports the oldest of the settles it covers
+            auto times = item->payload.get_optional("change_times");
+            if (times && !sub->settledChange) {
+              sub->settledChange = ChangeTimes::fromJson(*times);
             }
+            continue;
+          }
 
-            if (!sub->debug_paused && item->payload.get_optional("settled")) {
-              seenSettle = true;
-              continue;
-            }
+          // The changes within the scopes of the subscriptions have been
+          // processed, ahead of the rest of a storm
+          if (!sub->debug_paused && !sub->scopes.empty() &&
+              item->payload.get_optional("prioritized")) {
+            seenSettle = true;
+            continue;
           }
+        }
 
-          if (seenSettle) {
+        if (seenSettle) {
+          if (isOutputBackedUp()) {
+            // Its since clock stays put, so the run after the output
+            // drains reports everything that this one would have
+            coalescedSubscriptions_.insert(sub->name);
+            coalescedNotifications_.fetch_add(1, std::memory_order_relaxed);
+          } else {
+            coalescedSubscriptions_.erase(sub->name);
             sub->processSubscription();
           }
         }
+      }
 
-        for (auto& name : subsToDelete) {
-          unsubByName(name);
-        }
+      for (auto& name : subsToDelete) {
+        unsubByName(name);
       }
     }
+  }
 
-    /* now send our response(s) */
-    while (!responses.empty() && client_alive) {
-      status_.transitionTo(ClientStatus::SENDING_SUBSCRIPTION_RESPONSES);
-      auto& response_to_send = responses.front();
-
-      stm->setNonBlock(false);
-      /* Return the data in the same format that was used to ask for it.
-       * Update client liveness based on send success.
-       */
-      auto encodeResult =
-          writer.pduEncodeToStream(this->format, response_to_send, stm.get());
-      client_alive = encodeResult.hasValue();
-      stm->setNonBlock(true);
+  // The response to a command is waited on by the client, so block until
+  // it is sent; notifications are sent as the client makes room for them
+  if (!sendResponses(dispatched)) {
+    return false;
+  }
+  if (!coalescedSubscriptions_.empty() && !isOutputBackedUp()) {
+    runCoalescedSubscriptions();
+    return sendResponses(false);
+  }
+  return true;
+}
 
-      std::optional<json_ref> subscriptionValue =
-          response_to_send.get_optional("subscription");
-      if (kResponseLogLimit && subscriptionValue &&
-          subscriptionValue->isString() &&
-          json_string_value(*subscriptionValue)) {
-        auto subscriptionName = json_to_w_string(*subscriptionValue);
-        if (auto* sub = folly::get_ptr(subscriptions, subscriptionName)) {
-          if ((*sub)->lastResponses.size() >= kResponseLogLimit) {
-            (*sub)->lastResponses.pop_front();
-          }
-          (*sub)->lastResponses.push_back(ClientSubscription::LoggedResponse{
-              std::chrono::system_clock::now(), response_to_send});
-        }
-      }
+bool UserClient::isOutputBackedUp() const {
+  auto limit = cfg_get_snapshot()->subscriptionOutputLimitBytes;
+  return limit > 0 && writer.pending() > limit;
+}
 
-      responses.pop_front();
+void UserClient::runCoalescedSubscriptions() {
+  std::unordered_set<w_string> names;
+  names.swap(coalescedSubscriptions_);
+  for (auto& name : names) {
+    // It may have been unsubscribed meanwhile
+    if (auto* sub = folly::get_ptr(subscriptions, name)) {
+      log(DBG, "running coalesced subscription ", name, "\n");
+      (*sub)->processSubscription();
     }
   }
+}
 
-disconnected:
-  status_.transitionTo(ClientStatus::THREAD_STOPPING);
-  w_set_thread_name(
-      "NOT_CONN:client=",
-      unique_id,
-      ":stm=",
-      uintptr_t(stm.get()),
-      ":pid=",
-      stm->getPeerProcessID());
+bool UserClient::sendResponses(bool blocking) {
+  if (responses.empty() && writer.pending() == 0) {
+    return true;
+  }
+  if (cfg_get_snapshot()->subscriptionOutputLimitBytes == 0) {
+    blocking = true;
+  }
+
+  /* now send our response(s).  They are encoded into the writer's buffer
+   * and written out together, so that a burst of subscription PDUs costs
+   * one write rather than one each, unless they outgrow the buffer.  If
+   * not blocking, the buffer grows to hold them instead, and whatever the
+   * client has no room for waits there for the next call. */
+  status_.transitionTo(ClientStatus::SENDING_SUBSCRIPTION_RESPONSES);
+  if (blocking) {
+    stm->setNonBlock(false);
+  }
+  SCOPE_EXIT {
+    if (blocking) {
+      stm->setNonBlock(true);
+    }
+  };
+  bool client_alive = true;
+  while (!responses.empty() && client_alive) {
+    auto& response_to_send = responses.front();
+
+    /* Return the data in the same format that was used to ask for it.
+     * Update client liveness based on send success.
+     */
+    auto encodeResult = writer.pduEncodeToBuffer(
+        this->format, response_to_send, blocking ? stm.get() : nullptr);
+    client_alive = encodeResult.hasValue();
+
+    std::optional<json_ref> subscriptionValue =
+        response_to_send.get_optional("subscription");
+    std::shared_ptr<ClientSubscription>* sub = nullptr;
+    if (subscriptionValue && subscriptionValue->isString() &&
+        json_string_value(*subscriptionValue)) {
+      sub = folly::get_ptr(
+          subscriptions, json_to_w_string(*subscriptionValue));
+    }
+    if (kResponseLogLimit && sub) {
+      if ((*sub)->lastResponses.size() >= kResponseLogLimit) {
+        (*sub)->lastResponses.pop_front();
+      }
+      (*sub)->lastResponses.push_back(ClientSubscription::LoggedResponse{
+          std::chrono::system_clock::now(), response_to_send});
+    }
+    // Only a notification has files; state transitions may be queued
+    // ahead of it
+    if (client_alive && sub && (*sub)->undeliveredChange &&
+        response_to_send.get_optional("files")) {
+      (*sub)->root->metrics.changeLatency.settledToDelivered.record(
+          std::chrono::system_clock::now() -
+          (*sub)->undeliveredChange->settled);
+      (*sub)->undeliveredChange.reset();
+    }
+
+    responses.pop_front();
+  }
+
+  if (client_alive) {
+    client_alive = blocking ? writer.flushToStream(stm.get()).hasValue()
+                            : writer.flushAvailable(stm.get()).hasValue();
+  }
+  return client_alive;
 }
 
 } // namespace watchman
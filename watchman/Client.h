@@ -9,20 +9,27 @@
 
 #include <eden/common/utils/ProcessNameCache.h>
 #include <fmt/core.h>
+#include <folly/Synchronized.h>
 
 #include <chrono>
 #include <deque>
+#include <optional>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "watchman/Clock.h"
 #include "watchman/CommandRegistry.h"
 #include "watchman/Logging.h"
+#include "watchman/Metrics.h"
 #include "watchman/PDU.h"
 #include "watchman/PerfSample.h"
+#include "watchman/RootWorker.h"
+#include "watchman/query/Query.h"
 #include "watchman/watchman_stream.h"
 
 namespace watchman {
 
+class ClientEventLoop;
 class ClientStateAssertion;
 class Command;
 class Root;
@@ -40,6 +47,34 @@ class Client : public std::enable_shared_from_this<Client> {
   void enqueueResponse(json_ref resp);
   void enqueueResponse(UntypedResponse resp);
 
+  /**
+   * Writes the queued responses to the client right away, blocking until
+   * the client has read enough of them to make room on the stream, rather
+   * than waiting for the current command to complete.  Returns false if
+   * the client has gone away.  Has no effect in client mode.
+   */
+  bool flushResponses();
+
+  /**
+   * Returns true if the client has closed its connection, so that long
+   * running commands can stop producing a response that nobody will read.
+   * Always false in client mode.
+   */
+  bool hungUp() const {
+    return !client_mode && stm && stm->peerHungUp();
+  }
+
+  // Set by the client-priority command
+  std::optional<QueryPriority> declaredPriority;
+
+  /**
+   * The priority of this client's queries: the one it declared, or else
+   * the one that client_priority_classes gives its process.
+   */
+  virtual QueryPriority getQueryPriority() const {
+    return declaredPriority.value_or(QueryPriority::Interactive);
+  }
+
   const uint64_t unique_id;
   std::unique_ptr<watchman_stream> stm;
   std::unique_ptr<watchman_event> ping;
@@ -64,6 +99,16 @@ class Client : public std::enable_shared_from_this<Client> {
   std::shared_ptr<Publisher::Subscriber> errorSub;
 
  protected:
+  /**
+   * Forwards a command for a root to the worker process that owns the root,
+   * when root_worker_processes is enabled, and returns the worker's
+   * response.  Returns nullopt to run the command here instead.
+   */
+  virtual std::optional<json_ref> forwardToRootWorker(
+      const json_ref& /*rendered*/) {
+    return std::nullopt;
+  }
+
   void sendErrorResponse(std::string_view formatted);
 
   template <typename T, typename... Rest>
@@ -78,6 +123,35 @@ class Client : public std::enable_shared_from_this<Client> {
 
 enum class OnStateTransition { QueryAnyway, DontAdvance };
 
+/**
+ * The results of a subscription query, which other subscriptions whose
+ * queries match the same files may reuse; see Root::sharedSubscriptionResults.
+ * Their fields may differ: the files are rendered with the union of the
+ * fields of the subscriptions known to share them, and then for each
+ * distinct field list by render().
+ */
+struct SharedSubscriptionResults {
+  // The clock that the query was evaluated since
+  ClockSpec::Clock since;
+  ClockSpec clockAtStartOfQuery;
+  bool isFreshInstance;
+  std::optional<json_ref> savedStateInfo;
+  // The fields that the files were rendered with
+  QueryFieldList fieldList;
+  std::vector<json_ref> files;
+
+  // Whether render() can produce the given fields from these results
+  bool covers(const QueryFieldList& fields) const;
+
+  // Returns the file list with just the given fields, in their order.  Each
+  // distinct field list is only rendered once.
+  json_ref render(const QueryFieldList& fields) const;
+
+ private:
+  mutable folly::Synchronized<std::unordered_map<w_string, json_ref>>
+      renderings_;
+};
+
 class UserClient;
 
 class ClientSubscription
@@ -117,11 +191,60 @@ class ClientSubscription
 
   std::deque<LoggedResponse> lastResponses;
 
+  // Set by the "durable" option: when the subscription ends, resumeSince is
+  // remembered by the root, and a later durable subscription of the same
+  // name that doesn't specify since resumes from it.
+  bool durable{false};
+  // The since clock of the latest notification, or its own clock if it was
+  // a fresh instance.  Resuming from it may report that notification's
+  // changes again, but can't miss any that didn't reach the client.
+  std::optional<ClockSpec> resumeSince;
+
+  // Set by the "change_times" option: notifications that follow a settle
+  // include the ChangeTimes of its oldest change
+  bool reportChangeTimes{false};
+  // The times of the oldest change of the settle that this subscription is
+  // being run for, if the IO thread reported them
+  std::optional<ChangeTimes> settledChange;
+  // The times of the notification that was last queued for the client,
+  // until it is sent, when they are recorded in the root's metrics
+  std::optional<ChangeTimes> undeliveredChange;
+
+  // Sets sharedResultsKey, registering our fields with the root so that the
+  // subscription that evaluates the query for the key renders them too
+  void setSharedResultsKey(std::optional<w_string> key);
+
+  // Equal for subscriptions whose queries match the same files since the
+  // same clock, or nullopt if the results can't be shared
+  std::optional<w_string> sharedResultsKey;
+  // The results this subscription last reported, which keeps them available
+  // to the other subscriptions to the same query
+  std::shared_ptr<const SharedSubscriptionResults> lastSharedResults;
+
+  // Sets scopes, registering them with the root so that the IO thread
+  // processes the changes within them ahead of the others
+  void setScopes(std::vector<w_string> dirs);
+
+  // The dirs, as absolute paths, that hold every file that our query can
+  // match, or empty if it may match anywhere in the root.  A subscription
+  // with scopes is notified as soon as the changes within them have been
+  // processed, rather than waiting for the root to settle.
+  std::vector<w_string> scopes;
+
  private:
   ClockSpec runSubscriptionRules(
       UserClient* client,
       const std::shared_ptr<Root>& root);
-  void updateSubscriptionTicks(QueryResult* res);
+  void updateSubscriptionTicks(const ClockSpec& clockAtStartOfQuery);
+  std::shared_ptr<const SharedSubscriptionResults> findSharedResults(
+      const std::shared_ptr<Root>& root,
+      const ClockSpec::Clock& since);
+  // Our fields, followed by the others that the subscriptions with the same
+  // sharedResultsKey need
+  QueryFieldList sharedFieldList(const std::shared_ptr<Root>& root) const;
+  void publishSharedResults(
+      const std::shared_ptr<Root>& root,
+      const std::shared_ptr<const SharedSubscriptionResults>& results);
   void processSubscriptionImpl();
 };
 
@@ -174,12 +297,18 @@ struct ClientDebugStatus : serde::Object {
   std::string state;
   std::optional<PeerInfo> peer;
   std::optional<int64_t> since;
+  int64_t coalesced_notifications = 0;
+  int64_t dropped_log_messages = 0;
+  std::string priority;
 
   template <typename X>
   void map(X& x) {
     x("state", state);
     x("peer", peer);
     x("since", since);
+    x("coalesced_notifications", coalesced_notifications);
+    x("dropped_log_messages", dropped_log_messages);
+    x("priority", priority);
   }
 };
 
@@ -188,7 +317,8 @@ struct ClientDebugStatus : serde::Object {
  * the watchman per-user process.
  *
  * Each UserClient has a corresponding thread that reads and decodes json
- * packets and dispatches the commands that it finds.
+ * packets and dispatches the commands that it finds, unless it is serviced by
+ * a ClientEventLoop.
  */
 class UserClient final : public Client {
  public:
@@ -229,16 +359,85 @@ class UserClient final : public Client {
  private:
   ClientDebugStatus getDebugStatus() const;
 
+  QueryPriority getQueryPriority() const override;
+
+  std::optional<json_ref> forwardToRootWorker(
+      const json_ref& rendered) override;
+
+  // Moves the PDUs relayed from root workers to the response queue
+  void takeRelayedResponses();
+
   // Abandon any states that haven't been explicit vacated.
   void vacateStates();
 
   void clientThread() noexcept;
 
+  /**
+   * Reads and dispatches a request if readable, processes subscription and
+   * log events if pinged, and then sends any queued responses.  Returns false
+   * if the client has disconnected.
+   */
+  bool serviceClient(bool readable, bool pinged);
+
+  /**
+   * One round of serviceClient.  Sets dispatched if it read and dispatched
+   * a request.
+   */
+  bool serviceOnce(bool readable, bool pinged, bool& dispatched);
+
+  /**
+   * Whether more than subscription_output_limit_bytes are waiting to be
+   * written, because the client isn't reading what it is sent.
+   */
+  bool isOutputBackedUp() const;
+
+  /**
+   * Sends the queued responses.  If blocking, waits for the client to read
+   * them; otherwise writes what the client has room for, and leaves the
+   * rest for a later call.  Returns false if the client has disconnected.
+   */
+  bool sendResponses(bool blocking);
+
+  // Runs the subscriptions that were held back while the output was backed
+  // up, once it has drained
+  void runCoalescedSubscriptions();
+
+  // Whether there is output for a later call to serviceClient to send
+  bool hasPendingOutput() const {
+    return writer.pending() > 0 || !coalescedSubscriptions_.empty();
+  }
+
+  friend class ClientEventLoop;
+
   const std::chrono::system_clock::time_point since_;
   const pid_t peerPid_;
   const facebook::eden::ProcessNameHandle peerName_;
 
   ClientStatus status_;
+
+  // The subscriptions that were due to run while the output was backed up.
+  // Each runs once when the output drains, and its notification covers
+  // everything since the last one that it sent, however many settles it
+  // missed.
+  std::unordered_set<w_string> coalescedSubscriptions_;
+  // Counts of the notifications that were coalesced, and of the log
+  // messages that were dropped, while the output was backed up
+  std::atomic<uint64_t> coalescedNotifications_{0};
+  std::atomic<uint64_t> droppedLogMessages_{0};
+
+  // Kept around so that we can avoid allocating and releasing heap memory
+  // when we collect items from the publisher
+  std::vector<std::shared_ptr<const watchman::Publisher::Item>> pending_;
+
+  // The unilateral PDUs that arrived from root workers, and the batches of
+  // streamed queries, to be sent on by the client thread
+  folly::Synchronized<std::deque<json_ref>> relayedResponses_;
+  // The client's connections to the root workers that it sent commands to.
+  // Declared after relayedResponses_, which their threads write to.
+  std::unordered_map<
+      std::shared_ptr<RootWorker>,
+      std::unique_ptr<RootWorkerConnection>>
+      workerConnections_;
 };
 
 } // namespace watchman
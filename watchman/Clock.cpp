@@ -130,7 +130,7 @@ ClockSpec::ClockSpec(const ClockPosition& position)
 QuerySince ClockSpec::evaluate(
     const ClockPosition& position,
     ClockTicks lastAgeOutTick,
-    folly::Synchronized<std::unordered_map<w_string, ClockTicks>>* cursorMap)
+    CursorMap* cursorMap)
     const {
   return folly::variant_match(
       spec,
@@ -167,7 +167,7 @@ QuerySince ClockSpec::evaluate(
         QuerySince::Clock since_clock;
 
         {
-          auto wlock = cursorMap->wlock();
+          auto wlock = cursorMap->shard(named_cursor.cursor).wlock();
           auto& cursors = *wlock;
           auto it = cursors.find(named_cursor.cursor);
 
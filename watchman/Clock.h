@@ -11,12 +11,17 @@
 #include <unordered_map>
 #include <variant>
 #include "watchman/Logging.h"
+#include "watchman/ShardedSynchronized.h"
 
 namespace watchman {
 
 using ClockTicks = uint64_t;
 using ClockRoot = uint64_t;
 
+// Named cursor => the tick at which it was last used
+using CursorMap =
+    ShardedSynchronized<std::unordered_map<w_string, ClockTicks>>;
+
 struct ClockStamp {
   ClockTicks ticks;
   time_t timestamp;
@@ -112,8 +117,7 @@ struct ClockSpec {
   QuerySince evaluate(
       const ClockPosition& position,
       const ClockTicks lastAgeOutTick,
-      folly::Synchronized<std::unordered_map<w_string, ClockTicks>>* cursorMap =
-          nullptr) const;
+      CursorMap* cursorMap = nullptr) const;
 
   /** Initializes some global state needed for clockspec evaluation */
   static void init();
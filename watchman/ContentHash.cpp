@@ -7,11 +7,11 @@
 
 #include "watchman/ContentHash.h"
 #include <fmt/core.h>
-#include <folly/ScopeGuard.h>
+#include <memory>
 #include <string>
+#include "watchman/FairThreadPool.h"
 #include "watchman/Hash.h"
 #include "watchman/Logging.h"
-#include "watchman/ThreadPool.h"
 #include "watchman/fs/FileSystem.h"
 #include "watchman/watchman_stream.h"
 
@@ -46,31 +46,48 @@ std::size_t ContentHashCacheKey::hashValue() const {
 ContentHashCache::ContentHashCache(
     const w_string& rootPath,
     size_t maxItems,
-    std::chrono::milliseconds errorTTL)
-    : cache_(maxItems, errorTTL), rootPath_(rootPath) {}
+    std::chrono::milliseconds errorTTL,
+    std::shared_ptr<ContentHashStore> store)
+    : cache_(maxItems, errorTTL),
+      rootPath_(rootPath),
+      store_(std::move(store)) {}
 
 folly::Future<std::shared_ptr<const Node>> ContentHashCache::get(
-    const ContentHashCacheKey& key) {
-  return cache_.get(
-      key, [this](const ContentHashCacheKey& k) { return computeHash(k); });
+    const ContentHashCacheKey& key,
+    folly::Executor* executor) {
+  return cache_.get(key, [this, executor](const ContentHashCacheKey& k) {
+    return computeHash(k, executor);
+  });
 }
 
-HashValue ContentHashCache::computeHashImmediate(const char* fullPath) {
-  HashValue result;
-  uint8_t buf[8192];
+namespace {
 
-  auto stm = w_stm_open(fullPath, O_RDONLY);
-  if (!stm) {
-    throw std::system_error(
-        errno, std::generic_category(), fmt::format("w_stm_open {}", fullPath));
-  }
+// Files at least this large are read with a larger buffer, and the kernel is
+// told that we will read them sequentially so that it reads further ahead.
+constexpr int64_t kLargeFileSize = 1024 * 1024;
+constexpr size_t kLargeFileBufferSize = 256 * 1024;
 
-#ifndef _WIN32
-  SHA_CTX ctx;
-  SHA1_Init(&ctx);
+// Reads the whole of stm, passing each chunk to update.
+template <typename Update>
+void readContents(watchman_stream& stm, const char* fullPath, Update update) {
+  uint8_t smallBuf[8192];
+  uint8_t* buf = smallBuf;
+  int bufSize = sizeof(smallBuf);
+  std::unique_ptr<uint8_t[]> largeBuf;
+
+  const auto& fd = stm.getFileDescriptor();
+  if (int64_t(fd.getInfo().size) >= kLargeFileSize) {
+    largeBuf = std::make_unique<uint8_t[]>(kLargeFileBufferSize);
+    buf = largeBuf.get();
+    bufSize = int(kLargeFileBufferSize);
+#ifdef POSIX_FADV_SEQUENTIAL
+    // This is only advice; hashing works just the same if it is ignored
+    posix_fadvise(fd.fd(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  }
 
   while (true) {
-    auto n = stm->read(buf, sizeof(buf));
+    auto n = stm.read(buf, bufSize);
     if (n == 0) {
       break;
     }
@@ -80,62 +97,143 @@ HashValue ContentHashCache::computeHashImmediate(const char* fullPath) {
           std::generic_category(),
           fmt::format("while reading from {}", fullPath));
     }
-    SHA1_Update(&ctx, buf, n);
+    update(buf, n);
+  }
+}
+
+} // namespace
+
+namespace {
+
+// Computes a SHA-1 hash with the platform's implementation
+class Sha1Hasher {
+ public:
+#ifndef _WIN32
+  Sha1Hasher() {
+    SHA1_Init(&ctx_);
   }
 
-  SHA1_Final(result.data(), &ctx);
+  void update(const uint8_t* buf, size_t n) {
+    SHA1_Update(&ctx_, buf, n);
+  }
+
+  HashValue finish() {
+    HashValue result;
+    SHA1_Final(result.data(), &ctx_);
+    return result;
+  }
+
+ private:
+  SHA_CTX ctx_;
 #else
   // Use the built-in crypt provider API on windows to avoid introducing a
   // dependency on openssl in the windows build.
-  HCRYPTPROV provider{0};
-  HCRYPTHASH ctx{0};
-
-  if (!CryptAcquireContext(
-          &provider,
-          nullptr,
-          nullptr,
-          PROV_RSA_FULL,
-          CRYPT_VERIFYCONTEXT | CRYPT_SILENT)) {
-    throw std::system_error(
-        GetLastError(), std::system_category(), "CryptAcquireContext");
+  Sha1Hasher() {
+    if (!CryptAcquireContext(
+            &provider_,
+            nullptr,
+            nullptr,
+            PROV_RSA_FULL,
+            CRYPT_VERIFYCONTEXT | CRYPT_SILENT)) {
+      throw std::system_error(
+          GetLastError(), std::system_category(), "CryptAcquireContext");
+    }
+    if (!CryptCreateHash(provider_, CALG_SHA1, 0, 0, &ctx_)) {
+      auto error = GetLastError();
+      CryptReleaseContext(provider_, 0);
+      throw std::system_error(error, std::system_category(), "CryptCreateHash");
+    }
   }
-  SCOPE_EXIT {
-    CryptReleaseContext(provider, 0);
-  };
 
-  if (!CryptCreateHash(provider, CALG_SHA1, 0, 0, &ctx)) {
-    throw std::system_error(
-        GetLastError(), std::system_category(), "CryptCreateHash");
+  ~Sha1Hasher() {
+    CryptDestroyHash(ctx_);
+    CryptReleaseContext(provider_, 0);
   }
-  SCOPE_EXIT {
-    CryptDestroyHash(ctx);
-  };
 
-  while (true) {
-    auto n = stm->read(buf, sizeof(buf));
-    if (n == 0) {
-      break;
-    }
-    if (n < 0) {
+  void update(const uint8_t* buf, size_t n) {
+    if (!CryptHashData(ctx_, buf, DWORD(n), 0)) {
       throw std::system_error(
-          errno,
-          std::generic_category(),
-          fmt::format("while reading from {}", fullPath));
+          GetLastError(), std::system_category(), "CryptHashData");
     }
+  }
 
-    if (!CryptHashData(ctx, buf, n, 0)) {
+  HashValue finish() {
+    HashValue result;
+    DWORD size = result.size();
+    if (!CryptGetHashParam(ctx_, HP_HASHVAL, result.data(), &size, 0)) {
       throw std::system_error(
-          GetLastError(), std::system_category(), "CryptHashData");
+          GetLastError(),
+          std::system_category(),
+          "CryptGetHashParam HP_HASHVAL");
     }
+    return result;
   }
 
-  DWORD size = result.size();
-  if (!CryptGetHashParam(ctx, HP_HASHVAL, result.data(), &size, 0)) {
+ private:
+  HCRYPTPROV provider_{0};
+  HCRYPTHASH ctx_{0};
+#endif
+
+  Sha1Hasher(const Sha1Hasher&) = delete;
+  Sha1Hasher& operator=(const Sha1Hasher&) = delete;
+};
+
+// The header that git hashes ahead of a blob's contents to name the blob
+std::string gitBlobHeader(uint64_t size) {
+  auto header = fmt::format("blob {}", size);
+  header.push_back('\0');
+  return header;
+}
+
+std::unique_ptr<watchman_stream> openForHashing(const char* fullPath) {
+  // We read rather than mmap the file: files in a watched tree are routinely
+  // truncated by whatever is writing them, which would SIGBUS a mapping.
+  auto stm = w_stm_open(fullPath, O_RDONLY);
+  if (!stm) {
     throw std::system_error(
-        GetLastError(), std::system_category(), "CryptGetHashParam HP_HASHVAL");
+        errno, std::generic_category(), fmt::format("w_stm_open {}", fullPath));
   }
-#endif
-  return result;
+  return stm;
+}
+
+} // namespace
+
+HashValue ContentHashCache::computeHashImmediate(const char* fullPath) {
+  auto stm = openForHashing(fullPath);
+  Sha1Hasher hasher;
+  readContents(*stm, fullPath, [&](const uint8_t* buf, int n) {
+    hasher.update(buf, n);
+  });
+  return hasher.finish();
+}
+
+HashValue ContentHashCache::computeGitBlobHashImmediate(const char* fullPath) {
+  auto stm = openForHashing(fullPath);
+  // The header holds the size, so the hash is only good if we read exactly
+  // that much
+  uint64_t size = stm->getFileDescriptor().getInfo().size;
+  Sha1Hasher hasher;
+  auto header = gitBlobHeader(size);
+  hasher.update(reinterpret_cast<const uint8_t*>(header.data()), header.size());
+  uint64_t read = 0;
+  readContents(*stm, fullPath, [&](const uint8_t* buf, int n) {
+    hasher.update(buf, n);
+    read += n;
+  });
+  if (read != size) {
+    throw std::runtime_error(
+        "size changed during hashing; query again to get latest status");
+  }
+  return hasher.finish();
+}
+
+HashValue ContentHashCache::computeGitBlobHash(std::string_view contents) {
+  Sha1Hasher hasher;
+  auto header = gitBlobHeader(contents.size());
+  hasher.update(reinterpret_cast<const uint8_t*>(header.data()), header.size());
+  hasher.update(
+      reinterpret_cast<const uint8_t*>(contents.data()), contents.size());
+  return hasher.finish();
 }
 
 HashValue ContentHashCache::computeHashImmediate(
@@ -159,9 +257,25 @@ HashValue ContentHashCache::computeHashImmediate(
 }
 
 folly::Future<HashValue> ContentHashCache::computeHash(
-    const ContentHashCacheKey& key) const {
-  return folly::via(
-      &getThreadPool(), [key, this] { return computeHashImmediate(key); });
+    const ContentHashCacheKey& key,
+    folly::Executor* executor) const {
+  std::shared_ptr<FairThreadPool::Queue> queue;
+  if (!executor) {
+    queue = getContentHashPool().makeQueue();
+    executor = queue.get();
+  }
+  return folly::via(executor, [key, this] {
+    if (store_) {
+      if (auto hash = store_->lookup(key)) {
+        return *hash;
+      }
+    }
+    auto hash = computeHashImmediate(key);
+    if (store_) {
+      store_->record(key, hash);
+    }
+    return hash;
+  });
 }
 
 const w_string& ContentHashCache::rootPath() const {
@@ -171,4 +285,8 @@ const w_string& ContentHashCache::rootPath() const {
 CacheStats ContentHashCache::stats() const {
   return cache_.stats();
 }
+
+size_t ContentHashCache::shrink(size_t keep) {
+  return cache_.shrink(keep);
+}
 } // namespace watchman
@@ -6,8 +6,12 @@
  */
 
 #pragma once
+#include <folly/Executor.h>
 #include <array>
-#include "watchman/LRUCache.h"
+#include <memory>
+#include <string_view>
+#include "watchman/ContentHashStore.h"
+#include "watchman/ShardedLRUCache.h"
 #include "watchman/watchman_string.h"
 #include "watchman/watchman_system.h"
 
@@ -39,23 +43,29 @@ namespace watchman {
 class ContentHashCache {
  public:
   using HashValue = std::array<uint8_t, 20>;
-  using Node = LRUCache<ContentHashCacheKey, HashValue>::NodeType;
+  using Node = ShardedLRUCache<ContentHashCacheKey, HashValue>::NodeType;
 
   // Construct a cache for a given root, holding the specified
   // maximum number of items, using the configured negative
-  // caching TTL.
+  // caching TTL.  If store is set, it is consulted before
+  // computing a hash and records the hashes that are computed.
   ContentHashCache(
       const w_string& rootPath,
       size_t maxItems,
-      std::chrono::milliseconds errorTTL);
+      std::chrono::milliseconds errorTTL,
+      std::shared_ptr<ContentHashStore> store = nullptr);
 
   // Obtain the content hash for the given input.
   // If the result is in the cache it will return a ready future
   // holding the result.  Otherwise, computeHash will be invoked
   // to populate the cache.  Returns a future with the result
   // of the lookup.
+  // The hash is computed via executor, which should be a queue on
+  // getContentHashPool() that belongs to the request; if it is null,
+  // the lookup gets a queue of its own.
   folly::Future<std::shared_ptr<const Node>> get(
-      const ContentHashCacheKey& key);
+      const ContentHashCacheKey& key,
+      folly::Executor* executor = nullptr);
 
   // Compute the hash value for a given input.
   // This will block the calling thread while the I/O is performed.
@@ -67,9 +77,20 @@ class ContentHashCache {
   // Throws exceptions for any errors that may occur.
   static HashValue computeHashImmediate(const char* fullPath);
 
-  // Compute the hash value for a given input via the thread pool.
+  // Computes the id that git gives a blob holding the contents of the file
+  // at fullPath: the SHA-1 hash of a "blob <size>" header followed by the
+  // contents.  Blocks while the I/O is performed, and throws on error.
+  static HashValue computeGitBlobHashImmediate(const char* fullPath);
+
+  // Computes the id that git gives a blob holding contents, such as the
+  // target of a symlink.
+  static HashValue computeGitBlobHash(std::string_view contents);
+
+  // Compute the hash value for a given input via executor, as for get().
   // Returns a future to operate on the result of this async operation
-  folly::Future<HashValue> computeHash(const ContentHashCacheKey& key) const;
+  folly::Future<HashValue> computeHash(
+      const ContentHashCacheKey& key,
+      folly::Executor* executor = nullptr) const;
 
   // Returns the root path that this cache is associated with
   const w_string& rootPath() const;
@@ -77,8 +98,25 @@ class ContentHashCache {
   // Returns cache statistics
   CacheStats stats() const;
 
+  // Evicts the least recently used entries until at most `keep` remain.
+  // Returns the number of entries that were evicted.
+  size_t shrink(size_t keep);
+
+  // Returns the on-disk store, if there is one
+  const ContentHashStore* store() const {
+    return store_.get();
+  }
+
+  // Writes any hashes buffered by the on-disk store
+  void flushStore() {
+    if (store_) {
+      store_->flush();
+    }
+  }
+
  private:
-  LRUCache<ContentHashCacheKey, HashValue> cache_;
+  ShardedLRUCache<ContentHashCacheKey, HashValue> cache_;
   w_string rootPath_;
+  std::shared_ptr<ContentHashStore> store_;
 };
 } // namespace watchman
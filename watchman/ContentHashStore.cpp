@@ -0,0 +1,348 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ContentHashStore.h"
+#include <fmt/core.h>
+#include <folly/String.h>
+#include <folly/system/MemoryMapping.h>
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+#include "watchman/ContentHash.h"
+#include "watchman/Errors.h"
+#include "watchman/Logging.h"
+
+namespace watchman {
+
+namespace {
+
+constexpr char kMagic[4] = {'W', 'M', 'C', 'H'};
+
+struct Header {
+  char magic[4];
+  uint32_t version;
+};
+
+// Write buffered records once they amount to this many bytes.
+constexpr size_t kFlushThreshold = 64 * 1024;
+
+// Don't bother compacting a log with fewer superseded records than this.
+constexpr size_t kMinSupersededToCompact = 16 * 1024;
+
+template <typename T>
+void put(std::string& buf, const T& value) {
+  buf.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void putName(std::string& buf, w_string_piece name) {
+  put(buf, uint32_t(name.size()));
+  buf.append(name.data(), name.size());
+}
+
+class LogReader {
+ public:
+  explicit LogReader(folly::ByteRange range)
+      : cur_(reinterpret_cast<const char*>(range.begin())),
+        end_(reinterpret_cast<const char*>(range.end())) {}
+
+  bool atEnd() const {
+    return cur_ == end_;
+  }
+
+  size_t remaining() const {
+    return size_t(end_ - cur_);
+  }
+
+  template <typename T>
+  T get() {
+    T value;
+    need(sizeof(value));
+    memcpy(&value, cur_, sizeof(value));
+    cur_ += sizeof(value);
+    return value;
+  }
+
+  w_string_piece getName() {
+    auto len = get<uint32_t>();
+    need(len);
+    w_string_piece result{cur_, len};
+    cur_ += len;
+    return result;
+  }
+
+ private:
+  void need(size_t len) const {
+    if (remaining() < len) {
+      throw std::runtime_error("content hash store is truncated");
+    }
+  }
+
+  const char* cur_;
+  const char* end_;
+};
+
+} // namespace
+
+ContentHashStore::ContentHashStore(
+    const w_string& rootPath,
+    const w_string& path,
+    size_t maxEntries)
+    : rootPath_(rootPath), path_(path), maxEntries_(maxEntries) {}
+
+ContentHashStore::~ContentHashStore() {
+  flush();
+}
+
+std::optional<ContentHashStore::HashValue> ContentHashStore::lookup(
+    const ContentHashCacheKey& key) {
+  auto state = state_.lock();
+  if (!state->loaded) {
+    load(*state);
+  }
+
+  auto it = state->entries.find(key.relativePath);
+  if (it == state->entries.end() || it->second.fileSize != key.fileSize ||
+      it->second.mtimeSec != key.mtime.tv_sec ||
+      it->second.mtimeNsec != key.mtime.tv_nsec) {
+    ++state->stats.misses;
+    return std::nullopt;
+  }
+  ++state->stats.hits;
+  return it->second.hash;
+}
+
+void ContentHashStore::record(
+    const ContentHashCacheKey& key,
+    const HashValue& hash) {
+  auto state = state_.lock();
+  if (!state->loaded) {
+    load(*state);
+  }
+
+  Entry entry{
+      key.fileSize,
+      int64_t(key.mtime.tv_sec),
+      int64_t(key.mtime.tv_nsec),
+      hash,
+      state->nextSeq++};
+  state->entries.insert_or_assign(key.relativePath, entry);
+  ++state->records;
+
+  put(state->pending, entry.fileSize);
+  put(state->pending, entry.mtimeSec);
+  put(state->pending, entry.mtimeNsec);
+  put(state->pending, entry.hash);
+  putName(state->pending, key.relativePath);
+
+  if (state->entries.size() > maxEntries_) {
+    // Leave some headroom so that a full store isn't rewritten for every
+    // new entry.
+    compact(*state, maxEntries_ - maxEntries_ / 4);
+  } else if (
+      state->records - state->entries.size() >=
+      std::max(state->entries.size(), kMinSupersededToCompact)) {
+    compact(*state, maxEntries_);
+  } else if (state->pending.size() >= kFlushThreshold) {
+    flush(*state);
+  }
+}
+
+void ContentHashStore::flush() {
+  auto state = state_.lock();
+  flush(*state);
+}
+
+ContentHashStore::Stats ContentHashStore::getStats() const {
+  auto state = state_.lock();
+  auto stats = state->stats;
+  stats.entries = state->entries.size();
+  return stats;
+}
+
+void ContentHashStore::load(State& state) {
+  state.loaded = true;
+
+  bool valid = false;
+  try {
+    folly::MemoryMapping mapping{path_.c_str()};
+    LogReader reader{mapping.range()};
+
+    auto header = reader.get<Header>();
+    if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+        header.version != kVersion) {
+      throw std::runtime_error("not a compatible content hash store");
+    }
+    if (reader.getName() != rootPath_) {
+      throw std::runtime_error(
+          "content hash store was recorded for a different root");
+    }
+
+    while (!reader.atEnd()) {
+      Entry entry;
+      entry.fileSize = reader.get<uint64_t>();
+      entry.mtimeSec = reader.get<int64_t>();
+      entry.mtimeNsec = reader.get<int64_t>();
+      entry.hash = reader.get<HashValue>();
+      entry.seq = state.nextSeq++;
+      auto name = reader.getName().asWString();
+      state.entries.insert_or_assign(std::move(name), entry);
+      ++state.records;
+    }
+    valid = true;
+  } catch (const std::system_error& exc) {
+    if (exc.code() != error_code::no_such_file_or_directory) {
+      logf(ERR, "failed to load content hashes {}: {}\n", path_, exc.what());
+    }
+  } catch (const std::exception& exc) {
+    // A truncated tail is expected after a crash; keep what we could read
+    // and rewrite the log so that new records aren't appended to garbage.
+    logf(ERR, "failed to load content hashes {}: {}\n", path_, exc.what());
+  }
+
+  if (state.entries.size()) {
+    logf(
+        DBG,
+        "loaded {} content hashes from {}\n",
+        state.entries.size(),
+        path_);
+  }
+
+  if (!valid || state.entries.size() > maxEntries_ ||
+      state.records - state.entries.size() >= kMinSupersededToCompact) {
+    compact(state, maxEntries_);
+  } else {
+    openLog(state);
+  }
+}
+
+void ContentHashStore::compact(State& state, size_t keep) {
+  // Everything pending is also in entries, which we are about to write out.
+  state.pending.clear();
+  state.log.reset();
+
+  if (state.entries.size() > keep) {
+    std::vector<uint64_t> seqs;
+    seqs.reserve(state.entries.size());
+    for (auto& it : state.entries) {
+      seqs.push_back(it.second.seq);
+    }
+    auto cut = seqs.begin() + (seqs.size() - keep);
+    std::nth_element(seqs.begin(), cut, seqs.end());
+    auto minSeq = keep ? *cut : state.nextSeq;
+    for (auto it = state.entries.begin(); it != state.entries.end();) {
+      if (it->second.seq < minSeq) {
+        it = state.entries.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  auto tempPath = fmt::format("{}.tmp", path_);
+  try {
+    auto stm =
+        w_stm_open(tempPath.c_str(), O_WRONLY | O_TRUNC | O_CREAT, 0600);
+    if (!stm) {
+      throw std::system_error(
+          errno,
+          std::generic_category(),
+          fmt::format("unable to open {} for write", tempPath));
+    }
+
+    std::string buf;
+    Header header;
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    put(buf, header);
+    putName(buf, rootPath_);
+    for (auto& [name, entry] : state.entries) {
+      put(buf, entry.fileSize);
+      put(buf, entry.mtimeSec);
+      put(buf, entry.mtimeNsec);
+      put(buf, entry.hash);
+      putName(buf, name);
+    }
+
+    const char* data = buf.data();
+    size_t remaining = buf.size();
+    while (remaining > 0) {
+      auto n = stm->write(data, int(std::min<size_t>(remaining, 1 << 30)));
+      if (n <= 0) {
+        throw std::system_error(
+            errno,
+            std::generic_category(),
+            fmt::format("writing content hashes {}", tempPath));
+      }
+      data += n;
+      remaining -= n;
+    }
+    stm.reset();
+
+#ifdef _WIN32
+    // rename() won't replace an existing file on Windows
+    std::remove(path_.c_str());
+#endif
+    if (std::rename(tempPath.c_str(), path_.c_str()) != 0) {
+      throw std::system_error(
+          errno,
+          std::generic_category(),
+          fmt::format("rename {} -> {}", tempPath, path_));
+    }
+  } catch (const std::exception& exc) {
+    std::remove(tempPath.c_str());
+    logf(ERR, "failed to write content hashes {}: {}\n", path_, exc.what());
+    // Carry on with just the in-memory entries
+    return;
+  }
+
+  state.records = state.entries.size();
+  ++state.stats.compactions;
+  openLog(state);
+}
+
+void ContentHashStore::flush(State& state) {
+  if (state.pending.empty()) {
+    return;
+  }
+  if (!state.log) {
+    state.pending.clear();
+    return;
+  }
+
+  const char* data = state.pending.data();
+  size_t remaining = state.pending.size();
+  while (remaining > 0) {
+    auto n = state.log->write(data, int(remaining));
+    if (n <= 0) {
+      logf(
+          ERR,
+          "failed to append content hashes to {}: {}\n",
+          path_,
+          folly::errnoStr(errno));
+      // The log may now end with a partial record; the next load discards
+      // it and rewrites the log.
+      state.log.reset();
+      break;
+    }
+    data += n;
+    remaining -= n;
+  }
+  state.pending.clear();
+}
+
+void ContentHashStore::openLog(State& state) {
+  state.log = w_stm_open(path_.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0600);
+  if (!state.log) {
+    logf(
+        ERR,
+        "unable to open {} for append: {}\n",
+        path_,
+        folly::errnoStr(errno));
+  }
+}
+
+} // namespace watchman
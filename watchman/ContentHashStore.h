@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/Synchronized.h>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include "watchman/watchman_stream.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+struct ContentHashCacheKey;
+
+/**
+ * An on-disk record of the content hashes computed for the files of a root,
+ * so that they survive a restart of the daemon.
+ *
+ * The store is an append-only log, written next to the global state file,
+ * of (path, size, mtime, hash) records.  It is read into memory the first
+ * time it is consulted; a later record for a path supersedes the earlier
+ * ones.  A hash is only returned for a key whose size and mtime match the
+ * record, exactly as for the in-memory cache.
+ *
+ * New records are buffered and written behind in batches, so a crash may
+ * lose the most recent ones, which is harmless for a cache.  When the log
+ * holds many more records than live entries, or more entries than the
+ * configured cap, it is rewritten with only the newest entries.
+ *
+ * Like ViewSnapshot, the layout is host-endian and versioned; a log that is
+ * unreadable, truncated or from another version is discarded.
+ */
+class ContentHashStore {
+ public:
+  using HashValue = std::array<uint8_t, 20>;
+
+  // Bump this when the on-disk representation changes.
+  static constexpr uint32_t kVersion = 1;
+
+  struct Stats {
+    size_t entries{0};
+    size_t hits{0};
+    size_t misses{0};
+    size_t compactions{0};
+  };
+
+  ContentHashStore(
+      const w_string& rootPath,
+      const w_string& path,
+      size_t maxEntries);
+  ~ContentHashStore();
+
+  ContentHashStore(const ContentHashStore&) = delete;
+  ContentHashStore& operator=(const ContentHashStore&) = delete;
+
+  /** Returns the recorded hash for key, if there is one. */
+  std::optional<HashValue> lookup(const ContentHashCacheKey& key);
+
+  /** Records the hash computed for key. */
+  void record(const ContentHashCacheKey& key, const HashValue& hash);
+
+  /** Writes any buffered records to the log. */
+  void flush();
+
+  Stats getStats() const;
+
+ private:
+  struct Entry {
+    uint64_t fileSize;
+    int64_t mtimeSec;
+    int64_t mtimeNsec;
+    HashValue hash;
+    // Order in which the entry was recorded, used to keep the newest
+    // entries when the store is capped.
+    uint64_t seq;
+  };
+
+  struct State {
+    bool loaded{false};
+    std::unordered_map<w_string, Entry> entries;
+    uint64_t nextSeq{0};
+    // Number of records in the log, including superseded ones.
+    size_t records{0};
+    // Records that have yet to be written.
+    std::string pending;
+    std::unique_ptr<watchman_stream> log;
+    Stats stats;
+  };
+
+  void load(State& state);
+  void compact(State& state, size_t keep);
+  void flush(State& state);
+  void openLog(State& state);
+
+  const w_string rootPath_;
+  const w_string path_;
+  const size_t maxEntries_;
+  folly::Synchronized<State, std::mutex> state_;
+};
+
+} // namespace watchman
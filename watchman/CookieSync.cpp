@@ -16,9 +16,11 @@
 
 namespace watchman {
 
-CookieSync::Cookie::Cookie(uint64_t numCookies) : numPending(numCookies) {}
-
-CookieSync::CookieSync(FileSystem& fs, const w_string& dir) : fileSystem_{fs} {
+CookieSync::CookieSync(
+    FileSystem& fs,
+    const w_string& dir,
+    std::chrono::milliseconds maxCoalesceWait)
+    : fileSystem_{fs}, maxCoalesceWait_{maxCoalesceWait} {
   char hostname[256];
   gethostname(hostname, sizeof(hostname));
   hostname[sizeof(hostname) - 1] = '\0';
@@ -48,13 +50,26 @@ void CookieSync::removeCookieDir(const w_string& dir) {
 
   // Cancel the cookies in the removed directory. These are considered to be
   // serviced.
-  auto cookies = cookies_.wlock();
-  for (const auto& [cookiePath, cookie] : *cookies) {
-    if (cookiePath.piece().startsWith(dir)) {
-      cookie->notify();
-      cookies->erase(cookiePath);
+  std::vector<std::shared_ptr<Cookie>> completed;
+  {
+    auto cookies = cookies_.wlock();
+    auto it = cookies->begin();
+    while (it != cookies->end()) {
+      if (it->first.piece().startsWith(dir)) {
+        if (it->second->notify()) {
+          completed.push_back(it->second);
+        }
+        it = cookies->erase(it);
+      } else {
+        ++it;
+      }
     }
   }
+
+  // Outside of the lock, as this may write the next cookie
+  for (auto& cookie : completed) {
+    cookieDone(cookie);
+  }
 }
 
 void CookieSync::setCookieDir(const w_string& dir) {
@@ -73,11 +88,94 @@ std::vector<w_string> CookieSync::getOutstandingCookieFileList() const {
   return result;
 }
 
+uint64_t CookieSync::getCoalescedSyncCount() const {
+  return batch_.lock()->coalesced;
+}
+
 folly::SemiFuture<CookieSync::SyncResult> CookieSync::sync() {
+  std::shared_ptr<Cookie> cookie;
+  {
+    auto batch = batch_.lock();
+    auto now = std::chrono::steady_clock::now();
+    if (batch->inFlight && now - batch->inFlightSince < maxCoalesceWait_) {
+      // The cookie in flight may have been touched before we got here, so
+      // it can't tell us about the changes made before now.  The one after
+      // it can, and cookieDone writes it as soon as this one is observed.
+      if (batch->next) {
+        ++batch->coalesced;
+      } else {
+        batch->next = std::make_shared<Cookie>();
+      }
+      return resultOf(batch->next);
+    }
+
+    // Nothing is in flight, or it is taking long enough that it may have
+    // been lost.  Write one now, for us and anyone who was waiting.
+    if (batch->next) {
+      ++batch->coalesced;
+      cookie = std::move(batch->next);
+    } else {
+      cookie = std::make_shared<Cookie>();
+    }
+    batch->inFlight = cookie;
+    batch->inFlightSince = now;
+  }
+
+  auto result = resultOf(cookie);
+  try {
+    writeCookie(cookie);
+  } catch (const std::exception&) {
+    // Fail anyone who was sharing it with us
+    cookie->promise.setException(
+        folly::exception_wrapper{std::current_exception()});
+    cookieDone(cookie);
+    throw;
+  }
+  return result;
+}
+
+void CookieSync::cookieDone(const std::shared_ptr<Cookie>& cookie) {
+  auto done = cookie;
+  while (true) {
+    std::shared_ptr<Cookie> next;
+    {
+      auto batch = batch_.lock();
+      if (batch->inFlight != done) {
+        // A later sync gave up on it and wrote another
+        return;
+      }
+      batch->inFlight = nullptr;
+      if (!batch->next) {
+        return;
+      }
+      next = std::move(batch->next);
+      batch->inFlight = next;
+      batch->inFlightSince = std::chrono::steady_clock::now();
+    }
+
+    try {
+      writeCookie(next);
+      return;
+    } catch (const std::exception&) {
+      next->promise.setException(
+          folly::exception_wrapper{std::current_exception()});
+    }
+    // Give whoever arrived while we failed to write that one a chance
+    done = std::move(next);
+  }
+}
+
+folly::SemiFuture<CookieSync::SyncResult> CookieSync::resultOf(
+    const std::shared_ptr<Cookie>& cookie) {
+  return cookie->promise.getSemiFuture().deferValue(
+      [cookie](folly::Unit) { return SyncResult{cookie->fileNames}; });
+}
+
+void CookieSync::writeCookie(const std::shared_ptr<Cookie>& cookie) {
   auto prefixes = cookiePrefix();
   auto serial = serial_++;
 
-  auto cookie = std::make_shared<Cookie>(prefixes.size());
+  cookie->numPending.store(prefixes.size(), std::memory_order_release);
 
   // Even though we only write to the cookie at the end of the function, we
   // need to hold it while the files are written on disk to avoid a race where
@@ -126,12 +224,8 @@ folly::SemiFuture<CookieSync::SyncResult> CookieSync::sync() {
             folly::errnoStr(errCode)));
   }
 
+  cookie->fileNames = std::move(cookieFileNames);
   cookiesLock->insert(pendingCookies.begin(), pendingCookies.end());
-
-  return cookie->promise.getSemiFuture().deferValue(
-      [cookieFileNames = std::move(cookieFileNames)](folly::Unit) mutable {
-        return SyncResult{std::move(cookieFileNames)};
-      });
 }
 
 CookieSync::SyncResult CookieSync::syncToNow(
@@ -158,6 +252,10 @@ CookieSync::SyncResult CookieSync::syncToNow(
       // Success!
       return std::move(result).value();
     }
+    if (!result.hasException<CookieSyncAborted>()) {
+      // The cookie shared with another caller couldn't be written
+      result.throwUnlessValue();
+    }
 
     // Sync was aborted by a recrawl; recompute the timeout
     // and wait again if we still have time
@@ -183,14 +281,17 @@ void CookieSync::abortAllCookies() {
     if (cookie->numPending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
       cookie->promise.setException(
           folly::make_exception_wrapper<CookieSyncAborted>());
+      cookieDone(cookie);
     }
   }
 }
 
-void CookieSync::Cookie::notify() {
+bool CookieSync::Cookie::notify() {
   if (numPending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
     promise.setValue();
+    return true;
   }
+  return false;
 }
 
 void CookieSync::notifyCookie(const w_string& path) {
@@ -213,7 +314,9 @@ void CookieSync::notifyCookie(const w_string& path) {
   }
 
   if (cookie) {
-    cookie->notify();
+    if (cookie->notify()) {
+      cookieDone(cookie);
+    }
 
     // The file may not exist at this point; we're just taking this
     // opportunity to remove it if nothing else has done so already.
@@ -8,6 +8,7 @@
 #pragma once
 #include <folly/Synchronized.h>
 #include <folly/futures/Future.h>
+#include <folly/futures/SharedPromise.h>
 #include "watchman/Cookie.h"
 #include "watchman/fs/FileSystem.h"
 #include "watchman/watchman_string.h"
@@ -26,7 +27,17 @@ class CookieSync {
     std::vector<w_string> cookieFileNames;
   };
 
-  explicit CookieSync(FileSystem& fs, const w_string& dir);
+  /**
+   * A sync that arrives while a cookie is in flight waits for it to be
+   * observed and then shares the next cookie with the others that arrived,
+   * unless the cookie has been in flight for longer than maxCoalesceWait.
+   * Zero disables coalescing.
+   */
+  explicit CookieSync(
+      FileSystem& fs,
+      const w_string& dir,
+      std::chrono::milliseconds maxCoalesceWait = std::chrono::milliseconds{
+          50});
   ~CookieSync();
 
   void setCookieDir(const w_string& dir);
@@ -54,6 +65,9 @@ class CookieSync {
    * Touches a cookie file and returns a Future that will
    * be ready when that cookie file is processed by the IO
    * thread at some future time.
+   * Callers that arrive while a cookie is in flight share the next cookie,
+   * which is written once the in-flight one has been observed, rather than
+   * each writing their own; see the constructor.
    * Important: if you chain a lambda onto the future, it
    * will execute in the context of the IO thread.
    * It is recommended that you minimize the actions performed
@@ -87,17 +101,47 @@ class CookieSync {
   // these has an associated waiting client.
   std::vector<w_string> getOutstandingCookieFileList() const;
 
+  // Returns the number of syncs that shared a cookie file with another.
+  uint64_t getCoalescedSyncCount() const;
+
  private:
   CookieSync(CookieSync&&) = delete;
   CookieSync& operator=(CookieSync&&) = delete;
 
   struct Cookie {
-    folly::Promise<folly::Unit> promise;
-    std::atomic<uint64_t> numPending;
+    folly::SharedPromise<folly::Unit> promise;
+    std::atomic<uint64_t> numPending{0};
+    // Set before the cookie is published in cookies_
+    std::vector<w_string> fileNames;
 
-    explicit Cookie(uint64_t numCookies);
+    // Returns true if this completed the cookie
+    bool notify();
+  };
 
-    void notify();
+  /**
+   * Writes the cookie files for cookie, or throws if none of them could be
+   * written.
+   */
+  void writeCookie(const std::shared_ptr<Cookie>& cookie);
+
+  /**
+   * Called once cookie has completed, successfully or not.  If it was the
+   * one in flight, writes the cookie that the syncs which arrived in the
+   * meantime are waiting for.
+   */
+  void cookieDone(const std::shared_ptr<Cookie>& cookie);
+
+  static folly::SemiFuture<SyncResult> resultOf(
+      const std::shared_ptr<Cookie>& cookie);
+
+  struct CookieBatch {
+    // The cookie most recently written, until it completes
+    std::shared_ptr<Cookie> inFlight;
+    std::chrono::steady_clock::time_point inFlightSince;
+    // The cookie shared by the callers that arrived while it was in flight
+    std::shared_ptr<Cookie> next;
+    // Number of syncs that shared a cookie with an earlier one
+    uint64_t coalesced{0};
   };
 
   struct CookieDirectories {
@@ -109,11 +153,13 @@ class CookieSync {
   };
 
   FileSystem& fileSystem_;
+  const std::chrono::milliseconds maxCoalesceWait_;
 
   folly::Synchronized<CookieDirectories> cookieDirs_;
   // Serial number for cookie filename
   std::atomic<uint32_t> serial_{0};
   using CookieMap = std::unordered_map<w_string, std::shared_ptr<Cookie>>;
   folly::Synchronized<CookieMap> cookies_;
+  folly::Synchronized<CookieBatch, std::mutex> batch_;
 };
 } // namespace watchman
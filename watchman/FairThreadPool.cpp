@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/FairThreadPool.h"
+#include "watchman/Logging.h"
+
+namespace watchman {
+
+FairThreadPool& getContentHashPool() {
+  static FairThreadPool pool;
+  return pool;
+}
+
+FairThreadPool::~FairThreadPool() {
+  stop();
+}
+
+void FairThreadPool::start(size_t numWorkers, size_t maxItems) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!workers_.empty()) {
+    throw std::runtime_error("FairThreadPool already started");
+  }
+  if (stopping_) {
+    throw std::runtime_error("Cannot restart a stopped pool");
+  }
+  maxItems_ = maxItems;
+
+  for (auto i = 0U; i < numWorkers; ++i) {
+    workers_.emplace_back([this, i]() noexcept {
+      w_set_thread_name("FairThreadPool-", i);
+      runWorker();
+    });
+  }
+}
+
+void FairThreadPool::runWorker() {
+  while (true) {
+    folly::Func task;
+    // Keep the queue alive while its task runs: completing a future
+    // that was created with via() can schedule its callbacks on it.
+    std::shared_ptr<Queue> queue;
+
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_.wait(lock, [this] { return stopping_ || !ready_.empty(); });
+      if (stopping_ && ready_.empty()) {
+        return;
+      }
+      queue = std::move(ready_.front());
+      ready_.pop_front();
+      task = std::move(queue->tasks_.front());
+      queue->tasks_.pop_front();
+      --numTasks_;
+      // Go to the back of the line for the next turn
+      if (!queue->tasks_.empty()) {
+        ready_.push_back(queue);
+      }
+    }
+
+    task();
+  }
+}
+
+void FairThreadPool::stop(bool join) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  condition_.notify_all();
+
+  if (join) {
+    for (auto& worker : workers_) {
+      if (worker.joinable()) {
+        worker.join();
+      }
+    }
+  }
+}
+
+void FairThreadPool::Queue::add(folly::Func func) {
+  {
+    std::unique_lock<std::mutex> lock(pool_.mutex_);
+    if (pool_.stopping_) {
+      throw std::runtime_error("cannot add tasks after pool has stopped");
+    }
+    if (pool_.numTasks_ + 1 >= pool_.maxItems_) {
+      throw std::runtime_error("thread pool queue is full");
+    }
+
+    if (tasks_.empty()) {
+      pool_.ready_.push_back(shared_from_this());
+    }
+    tasks_.emplace_back(std::move(func));
+    ++pool_.numTasks_;
+  }
+
+  pool_.condition_.notify_one();
+}
+} // namespace watchman
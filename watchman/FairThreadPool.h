@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <folly/Executor.h>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "watchman/watchman_system.h" // to avoid system header ordering issue on win32
+
+namespace watchman {
+
+// A thread pool that shares its workers fairly between the requests that
+// submit work to it.
+//
+// Each request adds its tasks to its own Queue.  Tasks within a Queue run
+// in FIFO order, but the workers take one task from each Queue that has
+// work in turn, so a request that queues up a great many tasks doesn't
+// hold up a request that queues up a few.
+//
+// There is an upper bound on the number of queued tasks across all of the
+// queues, past which adding a task throws.
+class FairThreadPool {
+ public:
+  class Queue : public folly::Executor,
+                public std::enable_shared_from_this<Queue> {
+   public:
+    explicit Queue(FairThreadPool& pool) : pool_(pool) {}
+
+    // Run a function in the pool, in turn with the other queues.
+    // If the pool has been stopped, throws a runtime_error.
+    void add(folly::Func func) override;
+
+   private:
+    friend class FairThreadPool;
+
+    FairThreadPool& pool_;
+    // Guarded by pool_.mutex_
+    std::deque<folly::Func> tasks_;
+  };
+
+  FairThreadPool() = default;
+  ~FairThreadPool();
+
+  // Start a thread pool with the specified number of worker threads
+  // and the specified upper bound on the number of queued jobs.
+  void start(size_t numWorkers, size_t maxItems);
+
+  // Request that the worker threads terminate.
+  // If `join` is true, wait for the worker threads to terminate.
+  void stop(bool join = true);
+
+  // Returns a new queue on this pool.  A queue must not outlive its pool;
+  // the pool keeps a queue alive while it has tasks queued or running.
+  std::shared_ptr<Queue> makeQueue() {
+    return std::make_shared<Queue>(*this);
+  }
+
+ private:
+  std::vector<std::thread> workers_;
+  // The queues that have tasks, in the order in which they get a turn
+  std::deque<std::shared_ptr<Queue>> ready_;
+  size_t numTasks_{0};
+
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  bool stopping_{false};
+  size_t maxItems_;
+
+  void runWorker();
+};
+
+// Return a reference to the pool that computes content hashes for the
+// watchman process.  It is separate from the shared ThreadPool so that
+// hashing a large number of files can't hold up its other users.
+FairThreadPool& getContentHashPool();
+} // namespace watchman
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/FileColumns.h"
+#include "watchman/watchman_file.h"
+
+namespace watchman {
+
+void FileColumns::set(size_t i, const watchman_file* file) {
+  otimeTicks[i] = file->otime.ticks;
+  ctimeTicks[i] = file->ctime.ticks;
+  size[i] = int64_t(file->stat.size());
+  mtimeSec[i] = int64_t(file->stat.mtime().tv_sec);
+  ctimeSec[i] = int64_t(file->stat.ctime().tv_sec);
+  dtype[i] = uint8_t(file->stat.dtype());
+}
+
+bool ColumnFilter::isUnbounded() const {
+  ColumnFilter unbounded;
+  return dtypes == unbounded.dtypes && minSize == unbounded.minSize &&
+      maxSize == unbounded.maxSize && otimeAfter == unbounded.otimeAfter &&
+      ctimeAfter == unbounded.ctimeAfter &&
+      minMtimeSec == unbounded.minMtimeSec &&
+      minCtimeSec == unbounded.minCtimeSec;
+}
+
+size_t ColumnFilter::scan(
+    const FileColumns& columns,
+    size_t n,
+    uint8_t* matches) const {
+  // Each bound is a separate branch free pass over one or two columns,
+  // which the compiler can vectorize, rather than one pass that branches
+  // on every bound for every row.
+  for (size_t i = 0; i < n; ++i) {
+    matches[i] = (dtypes >> (columns.dtype[i] & 31)) & 1;
+  }
+
+  ColumnFilter unbounded;
+  if (minSize != unbounded.minSize || maxSize != unbounded.maxSize) {
+    const uint8_t dir = uint8_t(DType::Dir);
+    for (size_t i = 0; i < n; ++i) {
+      matches[i] &= uint8_t(
+          (columns.dtype[i] == dir) |
+          ((columns.size[i] >= minSize) & (columns.size[i] <= maxSize)));
+    }
+  }
+  if (otimeAfter != 0) {
+    for (size_t i = 0; i < n; ++i) {
+      matches[i] &= uint8_t(columns.otimeTicks[i] > otimeAfter);
+    }
+  }
+  if (ctimeAfter != 0) {
+    for (size_t i = 0; i < n; ++i) {
+      matches[i] &= uint8_t(columns.ctimeTicks[i] > ctimeAfter);
+    }
+  }
+  if (minMtimeSec != unbounded.minMtimeSec) {
+    for (size_t i = 0; i < n; ++i) {
+      matches[i] &= uint8_t(columns.mtimeSec[i] >= minMtimeSec);
+    }
+  }
+  if (minCtimeSec != unbounded.minCtimeSec) {
+    for (size_t i = 0; i < n; ++i) {
+      matches[i] &= uint8_t(columns.ctimeSec[i] >= minCtimeSec);
+    }
+  }
+
+  size_t count = 0;
+  for (size_t i = 0; i < n; ++i) {
+    count += matches[i];
+  }
+  return count;
+}
+
+} // namespace watchman
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <limits>
+#include "watchman/Clock.h"
+#include "watchman/fs/FileInformation.h"
+
+struct watchman_file;
+
+namespace watchman {
+
+/**
+ * The metadata that queries most often filter on, for the files of one
+ * RecencyIndex chunk, held column by column.  A ColumnFilter is checked
+ * against a whole chunk with a few tight loops over contiguous memory,
+ * before any of the chunk's file nodes is touched.
+ *
+ * Row i describes the chunk's i'th file as it was when it was last
+ * touched, which the view does after each change to a file's stat, otime
+ * or ctime.  The exception is the size of a dir, which isn't counted as a
+ * change, so filters don't trust the sizes of dirs.
+ */
+struct FileColumns {
+  static constexpr size_t kRows = 1024;
+
+  ClockTicks otimeTicks[kRows];
+  ClockTicks ctimeTicks[kRows];
+  int64_t size[kRows];
+  int64_t mtimeSec[kRows];
+  int64_t ctimeSec[kRows];
+  uint8_t dtype[kRows];
+
+  /** Fills row i from file. */
+  void set(size_t i, const watchman_file* file);
+};
+
+/**
+ * Bounds on the columns of a file that hold for every file that a query's
+ * expression may match.  QueryExpr::narrowColumnFilter tightens them for
+ * the terms that it understands; the other terms leave them be, so a file
+ * outside the bounds can't match, but one inside them still has to be
+ * evaluated.
+ */
+struct ColumnFilter {
+  // The files whose types have no bit set here can't match.  Files of
+  // unknown type always might.
+  uint32_t dtypes{~uint32_t(0)};
+  // Inclusive bounds on the size of anything other than a dir
+  int64_t minSize{std::numeric_limits<int64_t>::min()};
+  int64_t maxSize{std::numeric_limits<int64_t>::max()};
+  // The tick values that otime and ctime must exceed
+  ClockTicks otimeAfter{0};
+  ClockTicks ctimeAfter{0};
+  // Inclusive lower bounds on the stat mtime and ctime
+  int64_t minMtimeSec{std::numeric_limits<int64_t>::min()};
+  int64_t minCtimeSec{std::numeric_limits<int64_t>::min()};
+
+  static constexpr uint32_t dtypeBit(DType dtype) {
+    return uint32_t(1) << (uint32_t(dtype) & 31);
+  }
+
+  void allowOnly(DType dtype) {
+    dtypes &= dtypeBit(dtype) | dtypeBit(DType::Unknown);
+  }
+
+  /** Whether no term has narrowed the bounds, so scanning is pointless. */
+  bool isUnbounded() const;
+
+  /**
+   * Sets matches[i], for each of the first n rows of columns, to whether
+   * that row is within the bounds.  Returns the number of rows that are.
+   */
+  size_t scan(const FileColumns& columns, size_t n, uint8_t* matches) const;
+};
+
+} // namespace watchman
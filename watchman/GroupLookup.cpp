@@ -7,6 +7,11 @@
 
 #include "watchman/GroupLookup.h"
 #include <folly/String.h>
+#include <folly/Synchronized.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include "watchman/Logging.h"
 
 #ifndef _WIN32
@@ -19,23 +24,82 @@
 #ifndef _WIN32
 using namespace watchman;
 
-const struct group* w_get_group(const char* group_name) {
-  // This explicit errno statement is necessary to distinguish between the
-  // group not existing and an error.
-  errno = 0;
-  struct group* group = getgrnam(group_name);
-  if (!group) {
-    if (errno == 0) {
+namespace {
+
+// How long a looked up gid is used before it is looked up again
+constexpr std::chrono::minutes kGroupLookupTTL{5};
+
+struct CachedGroup {
+  gid_t gid;
+  std::chrono::steady_clock::time_point fetched;
+  bool refreshing{false};
+};
+
+folly::Synchronized<std::unordered_map<std::string, CachedGroup>>&
+cachedGroups() {
+  // Leaked, as a refresh may still be running at static destruction
+  static auto* groups =
+      new folly::Synchronized<std::unordered_map<std::string, CachedGroup>>;
+  return *groups;
+}
+
+std::optional<gid_t> lookupGroup(const std::string& group_name) {
+  // getgrnam may return a static area, so use the reentrant form; it may
+  // run on a refresh thread while another lookup is in progress.
+  struct group grp;
+  struct group* result = nullptr;
+  std::string buf(1024, '\0');
+  int err;
+  while ((err = getgrnam_r(
+              group_name.c_str(), &grp, buf.data(), buf.size(), &result)) ==
+         ERANGE) {
+    buf.resize(buf.size() * 2);
+  }
+  if (!result) {
+    if (err == 0) {
       logf(ERR, "group '{}' does not exist\n", group_name);
     } else {
       logf(
           ERR,
           "getting gid for '{}' failed: {}\n",
           group_name,
-          folly::errnoStr(errno));
+          folly::errnoStr(err));
+    }
+    return std::nullopt;
+  }
+
+  cachedGroups().wlock()->insert_or_assign(
+      group_name, CachedGroup{grp.gr_gid, std::chrono::steady_clock::now()});
+  return grp.gr_gid;
+}
+
+} // namespace
+
+std::optional<gid_t> w_get_group(const char* group_name) {
+  std::string name{group_name};
+  {
+    auto groups = cachedGroups().wlock();
+    auto it = groups->find(name);
+    if (it != groups->end()) {
+      auto& cached = it->second;
+      if (!cached.refreshing &&
+          std::chrono::steady_clock::now() - cached.fetched > kGroupLookupTTL) {
+        // Keep using the gid we have rather than wait for the directory
+        // service.  A failed refresh keeps it too.
+        cached.refreshing = true;
+        std::thread{[name] {
+          if (!lookupGroup(name)) {
+            auto groups = cachedGroups().wlock();
+            auto it = groups->find(name);
+            if (it != groups->end()) {
+              it->second.refreshing = false;
+            }
+          }
+        }}.detach();
+      }
+      return cached.gid;
     }
-    return nullptr;
   }
-  return group;
+  return lookupGroup(name);
 }
 #endif // ndef _WIN32
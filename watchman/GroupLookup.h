@@ -9,12 +9,18 @@
 
 #ifndef _WIN32
 
-#include <grp.h>
+#include <sys/types.h>
+#include <optional>
+
 /**
- * Gets the group struct for the given group name. The return value may point
- * to a static area so it should be used immediately and not passed to free(3).
+ * Gets the gid of the group with the given name.
+ *
+ * Group lookups can go to a directory service, so the gids are cached.  A gid
+ * that was looked up more than a few minutes ago is still returned, while it
+ * is looked up again in the background; only the first lookup of a group
+ * waits for the directory service.
  *
- * Returns null on failure.
+ * Returns nullopt on failure.
  */
-const struct group* w_get_group(const char* group_name);
+std::optional<gid_t> w_get_group(const char* group_name);
 #endif // _WIN32
@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/HeapProfiler.h"
+#include <fmt/core.h>
+#include <folly/String.h>
+#include <folly/Synchronized.h>
+#include <folly/memory/Malloc.h>
+#include <condition_variable>
+#include <ctime>
+#include <deque>
+#include <thread>
+#include "watchman/Logging.h"
+#include "watchman/Options.h"
+#include "watchman/WatchmanConfig.h"
+#include "watchman/watchman_system.h"
+
+namespace watchman {
+
+namespace {
+
+#if defined(FOLLY_USE_JEMALLOC)
+template <typename T>
+bool readMallctl(const char* name, T& value) {
+  size_t len = sizeof(value);
+  return mallctl(name, &value, &len, nullptr, 0) == 0;
+}
+#endif
+
+bool isProfilingAvailable() {
+#if defined(FOLLY_USE_JEMALLOC)
+  bool prof = false;
+  return folly::usingJEMalloc() && readMallctl("opt.prof", prof) && prof;
+#else
+  return false;
+#endif
+}
+
+class HeapProfileThread {
+ public:
+  ~HeapProfileThread() {
+    stop();
+  }
+
+  void start() {
+    auto state = state_.lock();
+    if (state->running) {
+      return;
+    }
+    state->interval =
+        std::chrono::seconds{cfg_get_int("heap_profile_interval_seconds", 0)};
+    if (state->interval.count() <= 0) {
+      return;
+    }
+    if (!isProfilingAvailable()) {
+      log(ERR,
+          "heap_profile_interval_seconds is set, but jemalloc heap profiling "
+          "is not enabled; set MALLOC_CONF=prof:true to enable it\n");
+      return;
+    }
+    state->maxFiles =
+        std::max<json_int_t>(cfg_get_int("heap_profile_max_files", 8), 1);
+    state->dir = cfg_get_string("heap_profile_dir", "");
+    if (state->dir.empty()) {
+      state->dir =
+          w_string_piece(flags.watchman_state_file).dirName().string();
+    }
+    state->running = true;
+    thread_ = std::thread([this] { loop(); });
+  }
+
+  void stop() {
+    {
+      auto state = state_.lock();
+      if (!state->running) {
+        return;
+      }
+      state->running = false;
+    }
+    cond_.notify_all();
+    thread_.join();
+  }
+
+  json_ref status() const {
+    auto state = state_.lock();
+    std::vector<json_ref> profiles;
+    for (auto it = state->profiles.rbegin(); it != state->profiles.rend();
+         ++it) {
+      profiles.push_back(json_object({
+          {"path", w_string_to_json(w_string{it->path.data(), it->path.size()})},
+          {"time", json_integer(it->time)},
+      }));
+    }
+    return json_object({
+        {"available", json_boolean(isProfilingAvailable())},
+        {"running", json_boolean(state->running)},
+        {"interval_seconds", json_integer(state->interval.count())},
+        {"max_files", json_integer(state->maxFiles)},
+        {"profiles", json_array(std::move(profiles))},
+    });
+  }
+
+ private:
+  struct Profile {
+    std::string path;
+    time_t time;
+  };
+
+  struct State {
+    bool running{false};
+    std::chrono::seconds interval{0};
+    size_t maxFiles{0};
+    std::string dir;
+    // Oldest first
+    std::deque<Profile> profiles;
+    uint64_t dumps{0};
+  };
+
+  void loop() noexcept;
+
+  folly::Synchronized<State, std::mutex> state_;
+  std::condition_variable cond_;
+  std::thread thread_;
+};
+
+bool dumpProfile(const std::string& path) {
+#if defined(FOLLY_USE_JEMALLOC)
+  const char* filename = path.c_str();
+  auto result =
+      mallctl("prof.dump", nullptr, nullptr, &filename, sizeof(filename));
+  if (result != 0) {
+    log(ERR,
+        "failed to dump heap profile to ",
+        path,
+        ": ",
+        folly::errnoStr(result),
+        "\n");
+    return false;
+  }
+  return true;
+#else
+  (void)path;
+  return false;
+#endif
+}
+
+void HeapProfileThread::loop() noexcept {
+  w_set_thread_name("heapprof");
+
+  auto state = state_.lock();
+  while (state->running) {
+    auto interval = state->interval;
+    if (cond_.wait_for(state.as_lock(), interval, [&] {
+          return !state->running;
+        })) {
+      break;
+    }
+
+    // The files form a ring of maxFiles slots, which keeps the space used
+    // bounded across restarts too.
+    auto path = fmt::format(
+        "{}/heap.{}.prof", state->dir, state->dumps++ % state->maxFiles);
+    // Dumping walks every sampled allocation; don't block status meanwhile
+    state.unlock();
+    bool dumped = dumpProfile(path);
+    state = state_.lock();
+
+    if (dumped) {
+      if (state->profiles.size() >= state->maxFiles) {
+        state->profiles.pop_front();
+      }
+      state->profiles.push_back(Profile{std::move(path), time(nullptr)});
+    }
+  }
+}
+
+HeapProfileThread& getHeapProfileThread() {
+  static HeapProfileThread thread;
+  return thread;
+}
+
+} // namespace
+
+std::optional<HeapTotals> getHeapTotals() {
+#if defined(FOLLY_USE_JEMALLOC)
+  if (!folly::usingJEMalloc()) {
+    return std::nullopt;
+  }
+  // jemalloc only refreshes its stats when the epoch is advanced
+  uint64_t epoch = 1;
+  size_t len = sizeof(epoch);
+  mallctl("epoch", &epoch, &len, &epoch, len);
+
+  HeapTotals totals;
+  if (!readMallctl("stats.allocated", totals.allocated) ||
+      !readMallctl("stats.active", totals.active) ||
+      !readMallctl("stats.resident", totals.resident)) {
+    return std::nullopt;
+  }
+  return totals;
+#else
+  return std::nullopt;
+#endif
+}
+
+void startHeapProfiler() {
+  getHeapProfileThread().start();
+}
+
+void stopHeapProfiler() {
+  getHeapProfileThread().stop();
+}
+
+json_ref getHeapProfilerStatus() {
+  return getHeapProfileThread().status();
+}
+
+} // namespace watchman
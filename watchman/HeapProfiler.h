@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include "watchman/thirdparty/jansson/jansson.h"
+
+namespace watchman {
+
+/**
+ * The process-wide heap figures kept by jemalloc.
+ */
+struct HeapTotals {
+  // Bytes allocated by the application
+  size_t allocated{0};
+  // Bytes in pages that hold allocations
+  size_t active{0};
+  // Bytes of physical memory mapped by the allocator
+  size_t resident{0};
+};
+
+/**
+ * Returns the current heap totals, or nullopt when jemalloc is not in use.
+ */
+std::optional<HeapTotals> getHeapTotals();
+
+/**
+ * Starts dumping a jemalloc heap profile every
+ * `heap_profile_interval_seconds`, into a ring of `heap_profile_max_files`
+ * files in `heap_profile_dir`, which defaults to the state dir.  Does
+ * nothing unless the interval is configured and jemalloc was started with
+ * profiling enabled, eg: MALLOC_CONF=prof:true,lg_prof_sample:20.
+ */
+void startHeapProfiler();
+void stopHeapProfiler();
+
+/**
+ * Describes the profiler's configuration and the profiles in its ring,
+ * newest first.
+ */
+json_ref getHeapProfilerStatus();
+
+} // namespace watchman
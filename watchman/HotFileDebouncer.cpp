@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/HotFileDebouncer.h"
+#include <algorithm>
+
+namespace watchman {
+
+bool HotFileDebouncer::admit(
+    const PendingChange& change,
+    Clock::time_point now) {
+  auto [it, inserted] = files_.try_emplace(change.path);
+  auto& file = it->second;
+  if (inserted || file.released || now - file.lastAdmitted >= window_) {
+    if (inserted && files_.size() == 1) {
+      nextSweep_ = now + window_;
+    }
+    if (file.held) {
+      // This change stats the file too
+      file.held.reset();
+      --held_;
+    }
+    file.released = false;
+    file.lastAdmitted = now;
+    return true;
+  }
+
+  ++debounced_;
+  if (file.held) {
+    file.held->now = std::max(file.held->now, change.now);
+    file.held->flags |= change.flags;
+  } else {
+    file.held = change;
+    ++held_;
+    nextSweep_ = std::min(nextSweep_, file.lastAdmitted + window_);
+  }
+  return false;
+}
+
+void HotFileDebouncer::release(
+    File& file,
+    Clock::time_point now,
+    std::vector<PendingChange>& changes) {
+  changes.push_back(std::move(*file.held));
+  file.held.reset();
+  --held_;
+  file.released = true;
+  file.lastAdmitted = now;
+}
+
+std::vector<PendingChange> HotFileDebouncer::takeDue(Clock::time_point now) {
+  std::vector<PendingChange> changes;
+  if (files_.empty() || now < nextSweep_) {
+    return changes;
+  }
+
+  nextSweep_ = now + window_;
+  for (auto it = files_.begin(); it != files_.end();) {
+    auto& file = it->second;
+    auto due = file.lastAdmitted + window_;
+    if (now < due) {
+      if (file.held) {
+        nextSweep_ = std::min(nextSweep_, due);
+      }
+      ++it;
+    } else if (file.held) {
+      release(file, now, changes);
+      ++it;
+    } else {
+      it = files_.erase(it);
+    }
+  }
+  return changes;
+}
+
+std::vector<PendingChange> HotFileDebouncer::takeAll(Clock::time_point now) {
+  std::vector<PendingChange> changes;
+  if (held_ == 0) {
+    return changes;
+  }
+  for (auto& [path, file] : files_) {
+    if (file.held) {
+      release(file, now, changes);
+    }
+  }
+  return changes;
+}
+
+std::optional<HotFileDebouncer::Clock::time_point> HotFileDebouncer::nextDue()
+    const {
+  if (held_ == 0) {
+    return std::nullopt;
+  }
+  return nextSweep_;
+}
+
+void HotFileDebouncer::clear() {
+  files_.clear();
+  held_ = 0;
+}
+
+} // namespace watchman
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+#include "watchman/PendingCollection.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * Limits how often the IO thread stats a file that changes over and over,
+ * such as a build log, a sqlite journal or test output being appended to.
+ *
+ * A file is stat'ed as soon as it changes.  Further changes reported within
+ * the window after that make the file hot: they are held, coalesced into
+ * one, and released once the window has passed.  A hot file is therefore
+ * stat'ed at most once per window, and once more after it goes quiet.
+ * Files that have been quiet for a window are forgotten.
+ *
+ * Not thread safe; owned by the IO thread.
+ */
+class HotFileDebouncer {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit HotFileDebouncer(std::chrono::milliseconds window)
+      : window_{window} {}
+
+  bool enabled() const {
+    return window_.count() > 0;
+  }
+
+  /**
+   * Returns true if `change`, reported at `now`, should be processed now,
+   * and false if it has been held, to be returned by takeDue() or takeAll().
+   * The change that takeDue() or takeAll() returned for a file is always
+   * admitted.
+   */
+  bool admit(const PendingChange& change, Clock::time_point now);
+
+  /**
+   * Returns the held changes whose window has passed by `now`.
+   */
+  std::vector<PendingChange> takeDue(Clock::time_point now);
+
+  /**
+   * Returns every held change, for when a client must observe all of the
+   * changes reported so far.
+   */
+  std::vector<PendingChange> takeAll(Clock::time_point now);
+
+  /**
+   * When takeDue() will next have a change to return, if any are held.
+   */
+  std::optional<Clock::time_point> nextDue() const;
+
+  /**
+   * Forgets every file and drops the held changes, for a recrawl, which
+   * stats every file anyway.
+   */
+  void clear();
+
+  size_t heldCount() const {
+    return held_;
+  }
+
+  size_t trackedCount() const {
+    return files_.size();
+  }
+
+  // The number of changes that have been held over the lifetime of this
+  // debouncer, including those coalesced into another
+  uint64_t debouncedCount() const {
+    return debounced_;
+  }
+
+ private:
+  struct File {
+    // When a change to this file was last admitted
+    Clock::time_point lastAdmitted;
+    std::optional<PendingChange> held;
+    // Whether a held change was released and hasn't been admitted yet
+    bool released{false};
+  };
+
+  void release(
+      File& file,
+      Clock::time_point now,
+      std::vector<PendingChange>& changes);
+
+  std::chrono::milliseconds window_;
+  std::unordered_map<w_string, File> files_;
+  size_t held_{0};
+  uint64_t debounced_{0};
+  // No held change is due before this, and no file can be forgotten
+  Clock::time_point nextSweep_;
+};
+
+} // namespace watchman
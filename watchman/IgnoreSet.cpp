@@ -6,6 +6,9 @@
  */
 
 #include "watchman/IgnoreSet.h"
+#include <string>
+#include "watchman/Logging.h"
+#include "watchman/thirdparty/wildmatch/wildmatch.h"
 
 // The path and everything below it is ignored.
 #define FULL_IGNORE 0x1
@@ -15,17 +18,60 @@
 
 namespace watchman {
 
+namespace {
+bool hasGlobSpecials(w_string_piece text) {
+  for (auto c : text.view()) {
+    switch (c) {
+      case '*':
+      case '?':
+      case '[':
+      case '\\':
+        return true;
+    }
+  }
+  return false;
+}
+} // namespace
+
 void IgnoreSet::add(const w_string& path, bool is_vcs_ignore) {
-  (is_vcs_ignore ? ignore_vcs : ignore_dirs).insert(path);
+  auto& vec = is_vcs_ignore ? vcs_vec : dirs_vec;
+  vec.push_back(path);
+  (is_vcs_ignore ? ignore_vcs : ignore_dirs).insert(vec.back());
 
   tree.insert(path, is_vcs_ignore ? VCS_IGNORE : FULL_IGNORE);
+}
+
+void IgnoreSet::addGlob(const w_string& rootPath, const w_string& pattern) {
+  w_check(
+      globRoot.empty() || globRoot == rootPath,
+      "the ignore globs of a set must share a root");
+  globRoot = rootPath;
+
+  if (!hasGlobSpecials(pattern)) {
+    // Nothing to match; this is just an ignore_dirs entry
+    add(w_string::pathCat({rootPath, pattern}), false);
+    return;
+  }
 
-  if (!is_vcs_ignore) {
-    dirs_vec.push_back(path);
+  w_string_piece piece{pattern};
+  if (piece.startsWith("**/")) {
+    w_string_piece name{piece.data() + 3, piece.size() - 3};
+    if (!name.empty() && !hasGlobSpecials(name) &&
+        memchr(name.data(), '/', name.size()) == nullptr) {
+      glob_names_vec.push_back(name.asWString());
+      glob_names.insert(glob_names_vec.back());
+      return;
+    }
   }
+  globs.push_back(pattern);
 }
 
 bool IgnoreSet::isIgnored(const char* path, uint32_t pathlen) const {
+  return isIgnoredByTree(path, pathlen) ||
+      matchesGlob(w_string_piece{path, pathlen}, true);
+}
+
+bool IgnoreSet::isIgnoredByTree(const char* path, uint32_t pathlen) const {
   const char* skip_prefix;
   uint32_t len;
   auto leaf = tree.longestMatch((const unsigned char*)path, (int)pathlen);
@@ -94,12 +140,66 @@ bool IgnoreSet::isIgnored(const char* path, uint32_t pathlen) const {
 #endif
 }
 
-bool IgnoreSet::isIgnoreVCS(const w_string& path) const {
+bool IgnoreSet::isIgnoreVCS(w_string_piece path) const {
   return ignore_vcs.find(path) != ignore_vcs.end();
 }
 
-bool IgnoreSet::isIgnoreDir(const w_string& path) const {
-  return ignore_dirs.find(path) != ignore_dirs.end();
+bool IgnoreSet::isIgnoreDir(w_string_piece path) const {
+  return ignore_dirs.find(path) != ignore_dirs.end() ||
+      matchesGlob(path, false);
+}
+
+bool IgnoreSet::matchesGlob(w_string_piece path, bool parents) const {
+  if (glob_names.empty() && globs.empty()) {
+    return false;
+  }
+  if (path.size() <= globRoot.size() || !path.startsWith(globRoot) ||
+      !is_slash(path[globRoot.size()])) {
+    return false;
+  }
+
+  // Walk the components below the root once, testing each prefix that
+  // ends at a component boundary; only the whole path unless parents.
+  const char* relative = path.data() + globRoot.size() + 1;
+  const char* end = path.data() + path.size();
+  const char* component = relative;
+  for (const char* pos = relative; pos <= end; ++pos) {
+    if (pos != end && !is_slash(*pos)) {
+      continue;
+    }
+    if (parents || pos == end) {
+      if (glob_names.find(w_string_piece{component, pos}) !=
+          glob_names.end()) {
+        return true;
+      }
+      if (!globs.empty() && matchesGlobPattern(w_string_piece{relative, pos})) {
+        return true;
+      }
+    }
+    component = pos + 1;
+  }
+  return false;
+}
+
+bool IgnoreSet::matchesGlobPattern(w_string_piece relative) const {
+  // wildmatch needs a NUL terminated subject; reuse a buffer so that the
+  // notify and crawler threads don't allocate for every path.
+  thread_local std::string subject;
+  subject.assign(relative.data(), relative.size());
+#ifdef _WIN32
+  for (auto& c : subject) {
+    if (c == '\\') {
+      c = '/';
+    }
+  }
+#endif
+  for (auto& glob : globs) {
+    if (wildmatch(glob.c_str(), subject.c_str(), WM_PATHNAME, 0) ==
+        WM_MATCH) {
+      return true;
+    }
+  }
+  return false;
 }
 
 } // namespace watchman
@@ -21,24 +21,52 @@ class IgnoreSet {
   // or a vcs-style grandchild ignore.
   void add(const w_string& path, bool is_vcs_ignore);
 
+  // Adds a wildmatch pattern, relative to rootPath, to the ignore list.
+  // Paths that match it are fully ignored, as for a non-vcs add().
+  // All of the globs of a set must share the same rootPath.
+  void addGlob(const w_string& rootPath, const w_string& pattern);
+
   // Tests whether path is ignored.
   // Returns true if the path is ignored, false otherwise.
   bool isIgnored(const char* path, uint32_t pathlen) const;
 
   // Test whether path is listed in ignore vcs config
-  bool isIgnoreVCS(const w_string& path) const;
+  bool isIgnoreVCS(w_string_piece path) const;
 
-  // Test whether path is listed in ignore dir config
-  bool isIgnoreDir(const w_string& path) const;
+  // Test whether path is listed in ignore dir config, or matches one of the
+  // ignore globs
+  bool isIgnoreDir(w_string_piece path) const;
 
   const std::vector<w_string>& getIgnoredDirs() const {
     return dirs_vec;
   }
 
+  const std::vector<w_string>& getVcsDirs() const {
+    return vcs_vec;
+  }
+
  private:
-  // if the map has an entry for a given dir, we're ignoring it */
-  std::unordered_set<w_string> ignore_vcs;
-  std::unordered_set<w_string> ignore_dirs;
+  bool isIgnoredByTree(const char* path, uint32_t pathlen) const;
+
+  // Tests whether the path relative to globRoot matches an ignore glob, or
+  // when parents is true, whether any of its leading components do.
+  bool matchesGlob(w_string_piece path, bool parents) const;
+  bool matchesGlobPattern(w_string_piece relative) const;
+
+  // if the map has an entry for a given dir, we're ignoring it.  The
+  // entries refer to the strings held by dirs_vec and vcs_vec, so that
+  // lookups don't need to build a w_string.
+  std::unordered_set<w_string_piece> ignore_vcs;
+  std::unordered_set<w_string_piece> ignore_dirs;
+  std::vector<w_string> vcs_vec;
+  // The globs are split into names that are ignored wherever they appear
+  // in the tree, from patterns like `**/node_modules`, which are looked up
+  // component by component, and everything else, which is matched with
+  // wildmatch.
+  w_string globRoot;
+  std::unordered_set<w_string_piece> glob_names;
+  std::vector<w_string> glob_names_vec;
+  std::vector<w_string> globs;
   /* radix tree containing the same information as the ignore
    * entries above.  This is used only on macOS and Windows because
    * we cannot exclude these dirs using the kernel watching APIs */
@@ -8,17 +8,31 @@
 #include "watchman/InMemoryView.h"
 #include <fmt/core.h>
 #include <folly/ScopeGuard.h>
+#include <folly/executors/CPUThreadPoolExecutor.h>
+#include <folly/executors/thread_factory/NamedThreadFactory.h>
+#include <folly/futures/Future.h>
+#include <folly/system/HardwareConcurrency.h>
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <limits>
 #include <memory>
 #include <thread>
 #include "watchman/Errors.h"
+#include "watchman/FairThreadPool.h"
+#include "watchman/Options.h"
+#include "watchman/ThreadAffinity.h"
 #include "watchman/ThreadPool.h"
+#include "watchman/ThreadUsage.h"
+#include "watchman/Trace.h"
+#include "watchman/fs/FSDetect.h"
+#include "watchman/query/GlobEscaping.h"
 #include "watchman/query/GlobTree.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/QueryContext.h"
 #include "watchman/query/eval.h"
 #include "watchman/root/Root.h"
+#include "watchman/root/reactor.h"
 #include "watchman/thirdparty/wildmatch/wildmatch.h"
 #include "watchman/watcher/Watcher.h"
 #include "watchman/watchman_file.h"
@@ -50,14 +64,26 @@ inline std::string make_path_name(
   result.append(name, nlen);
   return result;
 }
+
+// Evaluates the shards of parallel queries.  Global, like the ParallelWalker
+// executor, so that concurrent queries on many roots share a bounded set of
+// threads.
+folly::Executor::KeepAlive<> getQueryExecutor() {
+  static folly::Executor::KeepAlive<> executor =
+      new folly::CPUThreadPoolExecutor(
+          folly::hardware_concurrency(),
+          std::make_unique<folly::NamedThreadFactory>("query"));
+  return executor;
+}
 } // namespace
 
 InMemoryViewCaches::InMemoryViewCaches(
     const w_string& rootPath,
     size_t maxHashes,
     size_t maxSymlinks,
-    std::chrono::milliseconds errorTTL)
-    : contentHashCache(rootPath, maxHashes, errorTTL),
+    std::chrono::milliseconds errorTTL,
+    std::shared_ptr<ContentHashStore> hashStore)
+    : contentHashCache(rootPath, maxHashes, errorTTL, std::move(hashStore)),
       symlinkTargetCache(rootPath, maxSymlinks, errorTTL) {}
 
 InMemoryFileResult::InMemoryFileResult(
@@ -65,10 +91,22 @@ InMemoryFileResult::InMemoryFileResult(
     InMemoryViewCaches& caches)
     : file_(file), caches_(caches) {}
 
+void InMemoryFileResult::reset(const watchman_file* file) {
+  file_ = file;
+  dirName_.reset();
+  symlinkTarget_.reset();
+  contentSha1_ = Result<FileResult::ContentHash>();
+  clearNeededProperties();
+}
+
 void InMemoryFileResult::batchFetchProperties(
     const std::vector<std::unique_ptr<FileResult>>& files) {
   std::vector<folly::Future<folly::Unit>> readlinkFutures;
   std::vector<folly::Future<folly::Unit>> sha1Futures;
+  // This batch's share of the content hash pool
+  std::shared_ptr<FairThreadPool::Queue> hashQueue;
+  // Symlinks that miss the cache are read a directory at a time
+  SymlinkTargetCache::Batch symlinkBatch(caches_.symlinkTargetCache);
 
   // Since we may initiate some async work in the body of the function
   // below, we need to ensure that we wait for it to complete before
@@ -76,6 +114,7 @@ void InMemoryFileResult::batchFetchProperties(
   // If we fail to do so, the continuation on the futures that we
   // schedule will access invalid memory and we'll all feel bad.
   SCOPE_EXIT {
+    symlinkBatch.dispatch();
     if (!readlinkFutures.empty()) {
       folly::collectAll(readlinkFutures.begin(), readlinkFutures.end()).wait();
     }
@@ -109,7 +148,7 @@ void InMemoryFileResult::batchFetchProperties(
             w_string::pathCat({dir, file->baseName()}), file->file_->otime};
 
         readlinkFutures.emplace_back(
-            caches_.symlinkTargetCache.get(key).thenTry(
+            symlinkBatch.get(key).thenTry(
                 [file](folly::Try<std::shared_ptr<
                            const SymlinkTargetCache::Node>>&& result) {
                   if (result.hasValue()) {
@@ -137,15 +176,24 @@ void InMemoryFileResult::batchFetchProperties(
 
       ContentHashCacheKey key{
           w_string::pathCat({dir, file->baseName()}),
-          size_t(file->file_->stat.size),
-          file->file_->stat.mtime};
+          size_t(file->file_->stat.size()),
+          file->file_->stat.mtime()};
 
-      sha1Futures.emplace_back(caches_.contentHashCache.get(key).thenTry(
-          [file](folly::Try<std::shared_ptr<const ContentHashCache::Node>>&&
-                     result) {
-            file->contentSha1_ =
-                makeResultWith([&] { return result.value()->value(); });
-          }));
+      if (!hashQueue) {
+        hashQueue = getContentHashPool().makeQueue();
+      }
+      auto future = caches_.contentHashCache.get(key, hashQueue.get());
+      ++caches_.contentHashWarmStats.queryLookups;
+      if (future.isReady()) {
+        ++caches_.contentHashWarmStats.queryHits;
+      }
+      sha1Futures.emplace_back(
+          std::move(future)
+              .thenTry([file](folly::Try<std::shared_ptr<
+                                  const ContentHashCache::Node>>&& result) {
+                file->contentSha1_ =
+                    makeResultWith([&] { return result.value()->value(); });
+              }));
     }
 
     file->clearNeededProperties();
@@ -153,29 +201,33 @@ void InMemoryFileResult::batchFetchProperties(
 }
 
 std::optional<FileInformation> InMemoryFileResult::stat() {
-  return file_->stat;
+  return file_->stat.toFileInformation();
 }
 
 std::optional<size_t> InMemoryFileResult::size() {
-  return file_->stat.size;
+  return file_->stat.size();
 }
 
 std::optional<struct timespec> InMemoryFileResult::accessedTime() {
-  return file_->stat.atime;
+  return file_->stat.atime();
 }
 
 std::optional<struct timespec> InMemoryFileResult::modifiedTime() {
-  return file_->stat.mtime;
+  return file_->stat.mtime();
 }
 
 std::optional<struct timespec> InMemoryFileResult::changedTime() {
-  return file_->stat.ctime;
+  return file_->stat.ctime();
 }
 
 w_string_piece InMemoryFileResult::baseName() {
   return file_->getName();
 }
 
+std::optional<w_string_piece> InMemoryFileResult::foldedBaseName() {
+  return file_->getFoldedName();
+}
+
 w_string_piece InMemoryFileResult::dirName() {
   if (!dirName_) {
     dirName_ = file_->parent->getFullPath();
@@ -183,6 +235,13 @@ w_string_piece InMemoryFileResult::dirName() {
   return *dirName_;
 }
 
+w_string_piece InMemoryFileResult::renderDirName(std::string& buffer) {
+  if (dirName_) {
+    return *dirName_;
+  }
+  return file_->parent->renderFullPathToChild(buffer);
+}
+
 std::optional<bool> InMemoryFileResult::exists() {
   return file_->exists;
 }
@@ -195,6 +254,10 @@ std::optional<ClockStamp> InMemoryFileResult::otime() {
   return file_->otime;
 }
 
+std::optional<FileResult::Identity> InMemoryFileResult::identity() {
+  return Identity{file_, file_->ctime.ticks};
+}
+
 std::optional<ResolvedSymlink> InMemoryFileResult::readLink() {
   if (!symlinkTarget_.has_value()) {
     if (!file_->stat.isSymlink()) {
@@ -233,6 +296,26 @@ ViewDatabase::ViewDatabase(const w_string& root_path)
     : rootPath_{root_path},
       rootDir_{std::make_unique<watchman_dir>(root_path, nullptr)} {}
 
+ViewDatabase::~ViewDatabase() {
+  // Tearing down millions of nodes one at a time is expensive; let the arena
+  // drop them all at once instead.
+  arena_.beginBulkRelease();
+  rootDir_.reset();
+}
+
+watchman_dir* ViewDatabase::createChildDir(
+    watchman_dir* parent,
+    w_string_piece child_name) {
+  // Careful! parent->dirs is keyed by non-owning string pieces, so the key
+  // must reference the name stored in the watchman_dir constructed here
+  // rather than the caller's child_name.
+  auto dir =
+      watchman_dir::make(components_.intern(child_name), parent, arena_);
+  auto dir_ptr = dir.get();
+  parent->dirs[dir_ptr->name.piece()] = std::move(dir);
+  return dir_ptr;
+}
+
 watchman_dir* ViewDatabase::resolveDir(const w_string& dir_name, bool create) {
   if (dir_name == rootPath_) {
     return rootDir_.get();
@@ -267,15 +350,7 @@ watchman_dir* ViewDatabase::resolveDir(const w_string& dir_name, bool create) {
       // we have another pending item for the parent.  We'll create the
       // parent dir now and our other machinery will populate its contents
       // later.
-      w_string child_name(dir_component, (uint32_t)(sep - dir_component));
-
-      // Careful! dir->dirs is keyed by non-owning string pieces so the
-      // child_name MUST be stored or otherwise kept alive by the watchman_dir
-      // instance constructed below!
-      auto& new_child = dir->dirs[child_name];
-      new_child.reset(new watchman_dir(child_name, dir));
-
-      child = new_child.get();
+      child = createChildDir(dir, component);
     }
 
     parent = dir;
@@ -295,13 +370,9 @@ watchman_dir* ViewDatabase::resolveDir(const w_string& dir_name, bool create) {
     dir_component = sep + 1;
   }
 
-  w_string child_name(dir_component, (uint32_t)(dir_end - dir_component));
-  // Careful! parent->dirs is keyed by non-owning string pieces so the
-  // child_name MUST be stored or otherwise kept alive by the watchman_dir
-  // instance constructed below!
-  auto& new_child = parent->dirs[child_name];
-  new_child.reset(new watchman_dir(child_name, parent));
-  return new_child.get();
+  return createChildDir(
+      parent,
+      w_string_piece(dir_component, (uint32_t)(dir_end - dir_component)));
 }
 
 const watchman_dir* ViewDatabase::resolveDir(const w_string& dir_name) const {
@@ -350,6 +421,16 @@ const watchman_dir* ViewDatabase::resolveDir(const w_string& dir_name) const {
   return nullptr;
 }
 
+watchman_dir* ViewDatabase::getOrCreateChildDir(
+    watchman_dir* dir,
+    w_string_piece name) {
+  if (auto child = dir->getChildDir(name)) {
+    return child;
+  }
+
+  return createChildDir(dir, name);
+}
+
 watchman_file* ViewDatabase::getOrCreateChildFile(
     Watcher& watcher,
     watchman_dir* dir,
@@ -364,16 +445,154 @@ watchman_file* ViewDatabase::getOrCreateChildFile(
 
   // ... but take the shorter string from inside the file that
   // we create as the key.
-  auto file = watchman_file::make(file_name, dir);
-  auto& file_ptr = dir->files[file->getName()];
-  file_ptr = std::move(file);
+  auto file = watchman_file::make(file_name, dir, arena_, foldNames_);
+  auto file_ptr = file.get();
+  dir->files[file->getName()] = std::move(file);
 
   file_ptr->ctime = ctime;
+  if (suffixIndex_) {
+    suffixIndex_->insert(file_ptr);
+  }
+
+  watcher.startWatchFile(file_ptr);
+
+  return file_ptr;
+}
+
+void ViewDatabase::enableSuffixIndex() {
+  w_check(
+      rootDir_->files.empty() && rootDir_->dirs.empty(),
+      "the suffix index must be enabled before the view is populated");
+  suffixIndex_ = std::make_unique<SuffixIndex>();
+}
+
+void ViewDatabase::enableMtimeIndex() {
+  w_check(
+      rootDir_->files.empty() && rootDir_->dirs.empty(),
+      "the mtime index must be enabled before the view is populated");
+  mtimeIndex_ = std::make_unique<MtimeIndex>();
+}
+
+void ViewDatabase::enableFileBackedNodes(const std::string& path) {
+  w_check(
+      rootDir_->files.empty() && rootDir_->dirs.empty(),
+      "file backed nodes must be enabled before the view is populated");
+  arena_.useBackingFile(path);
+}
+
+void ViewDatabase::enableFileColumns() {
+  w_check(
+      rootDir_->files.empty() && rootDir_->dirs.empty(),
+      "file columns must be enabled before the view is populated");
+  recency_.enableColumns();
+}
+
+void ViewDatabase::enableFoldedNames() {
+  w_check(
+      rootDir_->files.empty() && rootDir_->dirs.empty(),
+      "folded names must be enabled before the view is populated");
+  foldNames_ = true;
+}
+
+void ViewDatabase::eraseChildFile(watchman_file* file) {
+  if (suffixIndex_) {
+    suffixIndex_->erase(file);
+  }
+  if (mtimeIndex_) {
+    mtimeIndex_->erase(file);
+  }
+  file->parent->files.erase(file->getName());
+}
+
+void ViewDatabase::eraseChildDir(watchman_dir* parent, w_string_piece name) {
+  auto dir = parent->getChildDir(name);
+  if (!dir) {
+    return;
+  }
+  if (suffixIndex_) {
+    suffixIndex_->eraseTree(dir);
+  }
+  if (mtimeIndex_) {
+    mtimeIndex_->eraseTree(dir);
+  }
+  parent->dirs.erase(name);
+}
+
+namespace {
+// Frees the empty child dirs of dir, deepest first, so that a chain of
+// dirs that only held each other goes in one pass.
+size_t eraseEmptyDeletedChildDirs(watchman_dir* dir, ClockTicks agedBefore) {
+  size_t erased = 0;
+  std::vector<w_string> names;
+  for (auto& it : dir->dirs) {
+    auto child = it.second.get();
+    erased += eraseEmptyDeletedChildDirs(child, agedBefore);
+    if (!child->files.empty() || !child->dirs.empty()) {
+      continue;
+    }
+    // A dir that was made for a path that is being processed hasn't had
+    // a file marked changed in it yet, so its subtreeTicks is still zero.
+    if (child->subtreeTicks == 0 || child->subtreeTicks > agedBefore) {
+      continue;
+    }
+    // The dir's own entry says whether it exists, and when it was deleted
+    auto entry = dir->getChildFile(child->name);
+    if (entry && (entry->exists || entry->otime.ticks > agedBefore)) {
+      continue;
+    }
+    names.push_back(child->name);
+  }
+  // Erasing reorders the table, so take the names first
+  for (auto& name : names) {
+    dir->dirs.erase(name);
+  }
+  return erased + names.size();
+}
+} // namespace
+
+size_t ViewDatabase::eraseEmptyDeletedDirs(ClockTicks agedBefore) {
+  return eraseEmptyDeletedChildDirs(rootDir_.get(), agedBefore);
+}
 
-  watcher.startWatchFile(file_ptr.get());
+void ViewDatabase::clear() {
+  auto root = rootDir_.get();
+  if (suffixIndex_) {
+    suffixIndex_->eraseTree(root);
+  }
+  if (mtimeIndex_) {
+    mtimeIndex_->eraseTree(root);
+  }
+  // Erasing reorders the tables, so take the names first
+  std::vector<w_string> names;
+  for (auto& it : root->files) {
+    names.push_back(it.second->getName().asWString());
+  }
+  for (auto& name : names) {
+    root->files.erase(name);
+  }
+  names.clear();
+  for (auto& it : root->dirs) {
+    names.push_back(it.second->name);
+  }
+  for (auto& name : names) {
+    root->dirs.erase(name);
+  }
+
+  compactRecencyIndex();
+  compactPathComponents();
+  compactArena();
+}
 
-  return file_ptr.get();
+namespace {
+// Raises subtreeTicks of dir and its ancestors to ticks.  Each dir's value
+// is at least that of its children, so we can stop at the first that is
+// already high enough.
+void noteSubtreeChanged(watchman_dir* dir, ClockTicks ticks) {
+  for (; dir && dir->subtreeTicks < ticks; dir = dir->parent) {
+    dir->subtreeTicks = ticks;
+  }
 }
+} // namespace
 
 void ViewDatabase::markFileChanged(
     Watcher& watcher,
@@ -384,13 +603,35 @@ void ViewDatabase::markFileChanged(
   }
 
   file->otime = otime;
+  noteSubtreeChanged(file->parent, otime.ticks);
+  bool deleted = !file->exists;
+  if (file->in_tombstone_index != deleted) {
+    (deleted ? recency_ : tombstones_).remove(file);
+    file->in_tombstone_index = deleted;
+  }
+  (deleted ? tombstones_ : recency_).touch(file);
+  if (mtimeIndex_) {
+    mtimeIndex_->update(file);
+  }
+}
 
-  if (latestFile_ != file) {
-    // unlink from list
-    file->removeFromFileList();
+void ViewDatabase::markFileChanged(
+    FileListBatch& batch,
+    Watcher& watcher,
+    watchman_file* file,
+    ClockStamp otime) {
+  w_check(
+      file->recencySlot == nullptr,
+      "batched files must not be in the recency index yet");
+  if (file->exists) {
+    watcher.startWatchFile(file);
+  }
 
-    // and move to the head
-    insertAtHeadOfFileList(file);
+  file->otime = otime;
+  noteSubtreeChanged(file->parent, otime.ticks);
+  RecencyIndex::append(batch, file);
+  if (mtimeIndex_) {
+    mtimeIndex_->update(file);
   }
 }
 
@@ -404,6 +645,8 @@ void ViewDatabase::markDirDeleted(
     return;
   }
   dir->last_check_existed = false;
+  // Its entries have to be enumerated again if it comes back
+  dir->crawledMtime = {0, 0};
 
   for (auto& it : dir->files) {
     auto file = it.second.get();
@@ -425,13 +668,56 @@ void ViewDatabase::markDirDeleted(
   }
 }
 
-void ViewDatabase::insertAtHeadOfFileList(struct watchman_file* file) {
-  file->next = latestFile_;
-  if (file->next) {
-    file->next->prev = &file->next;
+size_t ViewDatabase::copyTree(
+    Watcher& watcher,
+    const watchman_dir* src,
+    watchman_dir* dest,
+    ClockStamp otime) {
+  FileListBatch batch;
+  SCOPE_EXIT {
+    spliceAtHeadOfFileList(batch);
+  };
+  return copyTree(batch, watcher, src, dest, otime);
+}
+
+size_t ViewDatabase::copyTree(
+    FileListBatch& batch,
+    Watcher& watcher,
+    const watchman_dir* src,
+    watchman_dir* dest,
+    ClockStamp otime) {
+  size_t copied = 0;
+  for (auto& it : src->files) {
+    auto from = it.second.get();
+    if (!from->exists) {
+      continue;
+    }
+    auto file = getOrCreateChildFile(
+        watcher, dest, from->getName().asWString(), otime);
+    w_check(!file->exists, "copyTree destination already has files");
+    file->stat = from->stat;
+    file->exists = true;
+    file->ctime = otime;
+    if (file->recencySlot) {
+      // A tombstone coming back to life
+      markFileChanged(watcher, file, otime);
+    } else {
+      markFileChanged(batch, watcher, file, otime);
+    }
+    ++copied;
+  }
+
+  for (auto& it : src->dirs) {
+    auto from = it.second.get();
+    if (!from->last_check_existed) {
+      continue;
+    }
+    auto child = getOrCreateChildDir(dest, from->name.piece());
+    child->last_check_existed = true;
+    child->crawledMtime = from->crawledMtime;
+    copied += copyTree(batch, watcher, from, child, otime);
   }
-  latestFile_ = file;
-  file->prev = &latestFile_;
+  return copied;
 }
 
 InMemoryView::PendingChangeLogEntry::PendingChangeLogEntry(
@@ -462,6 +748,58 @@ json_ref InMemoryView::PendingChangeLogEntry::asJsonValue() const {
   });
 }
 
+namespace {
+std::shared_ptr<ContentHashStore> makeContentHashStore(
+    const w_string& rootPath,
+    const Configuration& config) {
+  if (!config.getBool("content_hash_persist", false)) {
+    return nullptr;
+  }
+  auto maxEntries = config.getInt("content_hash_persist_max_entries", 1000000);
+  if (maxEntries <= 0 || flags.dont_save_state ||
+      flags.watchman_state_file.empty()) {
+    return nullptr;
+  }
+  // Kept next to the state file, like the view snapshot
+  auto path = w_string{fmt::format(
+      "{}.content-hash-{:016x}",
+      flags.watchman_state_file,
+      uint64_t(rootPath.hashValue()))};
+  return std::make_shared<ContentHashStore>(
+      rootPath, path, size_t(maxEntries));
+}
+
+// The file that backs the view's nodes for file_backed_view, kept next to
+// the state file like the view snapshot, or empty if there is no state file
+std::string fileBackedViewPath(const w_string& rootPath) {
+  if (flags.watchman_state_file.empty()) {
+    return std::string{};
+  }
+  return fmt::format(
+      "{}.nodes-{:016x}",
+      flags.watchman_state_file,
+      uint64_t(rootPath.hashValue()));
+}
+
+// Reads the CPUs that the cpulist option name gives, or fallback if it
+// isn't set or isn't valid
+std::vector<unsigned> getCpuListOption(
+    const Configuration& config,
+    const char* name,
+    const std::vector<unsigned>& fallback) {
+  auto list = config.getString(name, nullptr);
+  if (!list) {
+    return fallback;
+  }
+  try {
+    return parseCpuList(list);
+  } catch (const std::invalid_argument& exc) {
+    logf(ERR, "ignoring {}: {}\n", name, exc.what());
+    return fallback;
+  }
+}
+} // namespace
+
 InMemoryView::InMemoryView(
     FileSystem& fileSystem,
     const w_string& root_path,
@@ -473,30 +811,153 @@ InMemoryView::InMemoryView(
       view_(folly::in_place, root_path),
       rootNumber_(next_root_number++),
       rootPath_(root_path),
+      ageOutMaxFilesPerStep_(
+          size_t(config_.getInt("gc_max_files_per_step", 16384))),
       watcher_(std::move(watcher)),
+      syncByFlushing_(
+          (watcher_->flags & WATCHER_CAN_SYNC_BY_FLUSHING) &&
+          config_.getBool("sync_by_flushing", false)),
       caches_(
           root_path,
           config_.getInt("content_hash_max_items", 128 * 1024),
           config_.getInt("symlink_target_max_items", 32 * 1024),
           std::chrono::milliseconds(
-              config_.getInt("content_hash_negative_cache_ttl_ms", 2000))),
+              config_.getInt("content_hash_negative_cache_ttl_ms", 2000)),
+          makeContentHashStore(root_path, config_)),
       enableContentCacheWarming_(
           config_.getBool("content_hash_warming", false)),
       maxFilesToWarmInContentCache_(
           size_t(config_.getInt("content_hash_max_warm_per_settle", 1024))),
       syncContentCacheWarming_(
-          config_.getBool("content_hash_warm_wait_before_settle", false)) {
+          config_.getBool("content_hash_warm_wait_before_settle", false)),
+      captureSymlinkTargets_(config_.getBool("symlink_target_capture", false)),
+      enableViewSnapshot_(config_.getBool("view_snapshot", false)),
+      seedSnapshotPath_(config_.getString("view_snapshot_seed", "")),
+      hibernateAge_(config_.getInt("hibernate_age_seconds", 0)),
+      fastRevalidateCrawl_(config_.getBool("fast_revalidate_crawl", false)),
+      viewLockMaxHold_(config_.getInt("view_lock_max_hold_ms", 100)),
+      viewLockMaxHoldItems_(
+          size_t(config_.getInt("view_lock_max_hold_items", 0))),
+      dirScanMinSiblings_(size_t(config_.getInt("dir_scan_min_siblings", 16))),
+      hotFiles_(std::chrono::milliseconds(
+          config_.getInt("hot_file_debounce_ms", 0))),
+      notifySleep_(config_.getInt("notify_sleep_ms", 0)),
+      hintNumFilesPerDir_(
+          uint32_t(config_.getInt("hint_num_files_per_dir", 64))),
+      enableGlobUpperBounds_(config_.getBool("glob_upper_bounds", false)),
+      queryParallelism_(size_t(config_.getInt("query_parallelism", 0))),
+      queryParallelMinFiles_(
+          size_t(config_.getInt("query_parallel_min_files", 65536))),
+      lazyCrawlDepth_(size_t(config_.getInt("lazy_crawl_depth", 0))),
+      partialCrawlQueries_(config_.getBool("partial_crawl_queries", false)),
+      idleCrawl_(
+          w_string_piece(config_.getString("crawl_io_priority", "normal")) ==
+          "idle"),
+      crawlMaxDirsPerSec_(
+          size_t(config_.getInt("crawl_max_dirs_per_sec", 0))),
+      sanityAuditInterval_(config_.getInt("sanity_audit_interval_ms", 0)),
+      sanityAuditDirs_(size_t(config_.getInt("sanity_audit_dirs", 32))) {
   json_int_t in_memory_view_ring_log_size =
       config_.getInt("in_memory_view_ring_log_size", 0);
   if (in_memory_view_ring_log_size) {
     this->processedPaths_ = std::make_unique<RingBuffer<PendingChangeLogEntry>>(
         in_memory_view_ring_log_size);
   }
+  if (partialCrawlQueries_) {
+    // Queries may be issued as soon as the root is watched, before the IO
+    // thread starts crawling it
+    auto frontier = crawlFrontier_.lock();
+    frontier->tracking = true;
+    frontier->dirs.insert(root_path);
+  }
+  if (config_.getBool("file_backed_view", false)) {
+    if (auto path = fileBackedViewPath(root_path); !path.empty()) {
+      try {
+        view_.wlock()->enableFileBackedNodes(path);
+      } catch (const std::exception& exc) {
+        logf(
+            ERR,
+            "keeping the view of {} in memory, as {} could not be used: {}\n",
+            root_path,
+            path,
+            exc.what());
+      }
+    }
+  }
+  if (config_.getBool("suffix_index", false)) {
+    view_.wlock()->enableSuffixIndex();
+  }
+  if (config_.getBool("mtime_index", false)) {
+    view_.wlock()->enableMtimeIndex();
+  }
+  if (config_.getBool("file_columns", false)) {
+    view_.wlock()->enableFileColumns();
+  }
+  const auto caseSensitive = getCaseSensitivityForPath(root_path.c_str());
+#ifndef _WIN32
+  // Only the real filesystem has dirs to open, and looking names up in them
+  // can't check the canonical case of a case insensitive one
+  if (auto dirFdCacheSize = config_.getInt("dir_fd_cache_size", 0);
+      dirFdCacheSize > 0 && &fileSystem_ == &realFileSystem &&
+      caseSensitive == CaseSensitivity::CaseSensitive) {
+    dirFdCache_ = std::make_unique<DirFdCache>(size_t(dirFdCacheSize));
+  }
+#endif
+  if (caseSensitive == CaseSensitivity::CaseInSensitive) {
+    view_.wlock()->enableFoldedNames();
+  }
+  if (auto globs = config_.get("content_hash_warm_globs")) {
+    if (!globs->isArray()) {
+      logf(ERR, "content_hash_warm_globs must be an array of strings\n");
+    } else {
+      for (auto& glob : globs->array()) {
+        if (!glob.isString()) {
+          logf(ERR, "content_hash_warm_globs must be an array of strings\n");
+          continue;
+        }
+        contentHashWarmGlobs_.push_back(json_to_w_string(glob));
+      }
+    }
+    contentHashWarmGlobFlags_ = WM_PATHNAME |
+        (caseSensitive == CaseSensitivity::CaseSensitive ? 0 : WM_CASEFOLD);
+    maxPendingEagerWarm_ =
+        size_t(config_.getInt("content_hash_warm_max_pending", 16384));
+  }
+  // Threads on the NUMA node whose CPUs run the IO thread, which allocates
+  // the view's nodes, reach them without crossing sockets
+  std::vector<unsigned> numaNodeCpus;
+  if (auto node = config_.getInt("numa_node", -1); node >= 0) {
+    numaNodeCpus = getNumaNodeCpus(unsigned(node));
+    if (numaNodeCpus.empty()) {
+      logf(ERR, "ignoring numa_node: node {} has no CPUs\n", node);
+    }
+  }
+  notifyThreadCpus_ =
+      getCpuListOption(config_, "notify_thread_cpus", numaNodeCpus);
+  ioThreadCpus_ = getCpuListOption(config_, "io_thread_cpus", numaNodeCpus);
+  queryWorkerCpus_ =
+      getCpuListOption(config_, "query_worker_cpus", numaNodeCpus);
+  if (auto states = config_.get("background_work_defer_states")) {
+    if (!states->isArray()) {
+      logf(ERR, "background_work_defer_states must be an array of strings\n");
+    } else {
+      for (auto& state : states->array()) {
+        if (!state.isString()) {
+          logf(
+              ERR,
+              "background_work_defer_states must be an array of strings\n");
+          continue;
+        }
+        backgroundWorkDeferStates_.push_back(json_to_w_string(state));
+      }
+    }
+  }
 }
 
 InMemoryView::~InMemoryView() = default;
 
 ClockStamp InMemoryView::ageOutFile(
+    ViewDatabase& view,
     std::unordered_set<w_string>& dirs_to_erase,
     watchman_file* file) {
   auto parent = file->parent;
@@ -513,181 +974,635 @@ ClockStamp InMemoryView::ageOutFile(
   // Remove the entry from the containing file hash; this will free it.
   // We don't need to stop watching it, because we already stopped watching it
   // when we marked it as !exists.
-  parent->files.erase(file->getName());
+  view.eraseChildFile(file);
 
   return ageOutOtime;
 }
 
 void InMemoryView::ageOut(PerfSample& sample, std::chrono::seconds minAge) {
-  uint32_t num_aged_files = 0;
-  uint32_t num_walked = 0;
-  std::unordered_set<w_string> dirs_to_erase;
+  // Start afresh, even if the IO thread is part way through a sweep with a
+  // different minAge, but still let queries in between the steps.
+  auto sweep = ageOutSweep_.lock();
+  sweep->active = false;
+  while (!ageOutStep(*sweep, sample, minAge)) {
+  }
+}
+
+bool InMemoryView::ageOutStep(
+    PerfSample& sample,
+    std::chrono::seconds minAge) {
+  return ageOutStep(*ageOutSweep_.lock(), sample, minAge);
+}
+
+bool InMemoryView::isAgeOutInProgress() const {
+  return ageOutSweep_.lock()->active;
+}
 
-  auto now = std::chrono::system_clock::now();
-  lastAgeOutTimestamp_ = now;
+bool InMemoryView::ageOutStep(
+    AgeOutSweep& sweep,
+    PerfSample& sample,
+    std::chrono::seconds minAge) {
+  if (!sweep.active) {
+    sweep = AgeOutSweep{};
+    sweep.active = true;
+    sweep.started = std::chrono::system_clock::now();
+    lastAgeOutTimestamp_ = sweep.started;
+  }
+  ++sweep.steps;
+
+  size_t walked = 0;
+  bool complete = false;
+  std::unordered_set<w_string> dirs_to_erase;
   auto view = view_.wlock();
+  auto& index = view->getTombstoneIndex();
 
-  watchman_file* file = view->getLatestFile();
-  watchman_file* prior = nullptr;
-  while (file) {
-    ++num_walked;
-    if (file->exists ||
-        std::chrono::system_clock::from_time_t(file->otime.timestamp) + minAge >
-            now) {
-      prior = file;
-      file = file->next;
-      continue;
+  while (true) {
+    if (sweep.nextChunk >= index.chunkCount()) {
+      complete = true;
+      break;
+    }
+    if (ageOutMaxFilesPerStep_ && walked >= ageOutMaxFilesPerStep_) {
+      break;
     }
 
-    auto agedOtime = ageOutFile(dirs_to_erase, file);
+    // Aging out a file frees it, which clears its slot in the tombstone
+    // index; the walk tolerates that.
+    bool tooYoung = !index.forEachOldestFirstInChunk(
+        sweep.nextChunk, [&](watchman_file* file) {
+          ++walked;
+          if (std::chrono::system_clock::from_time_t(file->otime.timestamp) +
+                  minAge >
+              sweep.started) {
+            // Everything after this was deleted more recently still
+            return false;
+          }
 
-    // Revise tick for fresh instance reporting
-    lastAgeOutTick_ = std::max(lastAgeOutTick_, agedOtime.ticks);
+          auto agedOtime = ageOutFile(*view, dirs_to_erase, file);
 
-    num_aged_files++;
+          // Revise tick for fresh instance reporting
+          lastAgeOutTick_ = std::max(lastAgeOutTick_, agedOtime.ticks);
 
-    // Go back to last good file node; we can't trust that the
-    // value of file->next saved before age_out_file is a valid
-    // file node as anything past that point may have also been
-    // aged out along with it.
-    file = prior;
+          ++sweep.files;
+          return true;
+        });
+    if (tooYoung) {
+      complete = true;
+      break;
+    }
+    ++sweep.nextChunk;
   }
+  sweep.walked += walked;
 
+  // The file nodes of these dirs were aged out in this step, under this
+  // hold of the lock, so they can't have come back.
   for (auto& name : dirs_to_erase) {
     auto parent = view->resolveDir(name.dirName(), false);
     if (parent) {
-      parent->dirs.erase(name.baseName());
+      view->eraseChildDir(parent, name.baseName());
     }
   }
-
-  if (num_aged_files + dirs_to_erase.size()) {
-    logf(ERR, "aged {} files, {} dirs\n", num_aged_files, dirs_to_erase.size());
+  sweep.dirs += dirs_to_erase.size();
+
+  size_t released_slabs = 0;
+  size_t released_names = 0;
+  size_t released_slots = 0;
+  if (complete) {
+    // Every change up to lastAgeOutTick_ came before a deletion that was
+    // old enough to age out, so the dirs that those changes left empty can
+    // go too.  There are far fewer dirs than files, so one pass per sweep
+    // is cheap.
+    sweep.dirs += view->eraseEmptyDeletedDirs(lastAgeOutTick_);
+
+    // Now that the nodes are gone, hand back any slabs that were left
+    // empty, along with the names of the dirs that went with them.
+    released_slabs = view->compactArena();
+    released_names = view->compactPathComponents();
+    released_slots = view->compactRecencyIndex();
+    sweep.active = false;
+
+    if (sweep.files + sweep.dirs) {
+      logf(ERR, "aged {} files, {} dirs\n", sweep.files, sweep.dirs);
+    }
   }
+
   sample.add_meta(
       "age_out",
       json_object(
-          {{"walked", json_integer(num_walked)},
-           {"files", json_integer(num_aged_files)},
-           {"dirs", json_integer(dirs_to_erase.size())}}));
+          {{"complete", json_boolean(complete)},
+           {"steps", json_integer(sweep.steps)},
+           {"walked", json_integer(sweep.walked)},
+           {"files", json_integer(sweep.files)},
+           {"dirs", json_integer(sweep.dirs)},
+           {"released_slabs", json_integer(released_slabs)},
+           {"released_names", json_integer(released_names)},
+           {"released_recency_slots", json_integer(released_slots)}}));
+  return complete;
 }
 
-void InMemoryView::timeGenerator(const Query* query, QueryContext* ctx) const {
-  // Walk back in time until we hit the boundary
-  auto view = view_.rlock();
-  ctx->generationStarted();
+namespace {
+// Calls fn on the existing and the deleted files of view, most recently
+// changed first, until fn returns false.
+template <typename Fn>
+void forEachChangedNewestFirst(const ViewDatabase& view, Fn&& fn) {
+  RecencyIndex::Cursor live{view.getRecencyIndex()};
+  RecencyIndex::Cursor deleted{view.getTombstoneIndex()};
+  while (live.file() || deleted.file()) {
+    auto& cursor = !deleted.file() ||
+            (live.file() &&
+             live.file()->otime.ticks >= deleted.file()->otime.ticks)
+        ? live
+        : deleted;
+    if (!fn(cursor.file())) {
+      return;
+    }
+    cursor.next();
+  }
+}
 
-  for (watchman_file* f = view->getLatestFile(); f; f = f->next) {
-    ctx->bumpNumWalked();
-    // Note that we use <= for the time comparisons in here so that we
-    // report the things that changed inclusive of the boundary presented.
-    // This is especially important for clients using the coarse unix
-    // timestamp as the since basis, as they would be much more
-    // likely to miss out on changes if we didn't.
-    if (auto* since_ts = std::get_if<QuerySince::Timestamp>(&ctx->since.since);
-        since_ts && f->otime.timestamp <= since_ts->time) {
-      break;
+// Whether file is in dir or below it.  Following the parents is much
+// cheaper than rendering the file's path to compare with the relative root.
+bool isWithinDir(const watchman_file* file, const watchman_dir* dir) {
+  for (auto parent = file->parent; parent; parent = parent->parent) {
+    if (parent == dir) {
+      return true;
     }
-    if (auto* since_clock = std::get_if<QuerySince::Clock>(&ctx->since.since);
-        since_clock && f->otime.ticks <= since_clock->ticks) {
+  }
+  return false;
+}
+
+// Counts the files that changedSubtreeGenerator would walk below dir,
+// giving up once there are more than limit.
+size_t countChangedSubtreeFiles(
+    const watchman_dir* dir,
+    ClockTicks sinceTicks,
+    size_t limit) {
+  if (dir->subtreeTicks <= sinceTicks) {
+    return 0;
+  }
+  size_t count = dir->files.size();
+  for (auto& it : dir->dirs) {
+    if (count > limit) {
       break;
     }
+    count +=
+        countChangedSubtreeFiles(it.second.get(), sinceTicks, limit - count);
+  }
+  return count;
+}
 
-    if (!ctx->fileMatchesRelativeRoot(f)) {
-      continue;
+// Counts the files below dir, giving up once there are more than limit.
+size_t countSubtreeFiles(const watchman_dir* dir, size_t limit) {
+  size_t count = dir->files.size();
+  for (auto& it : dir->dirs) {
+    if (count > limit) {
+      break;
     }
-
-    w_query_process_file(
-        query, ctx, std::make_unique<InMemoryFileResult>(f, caches_));
+    count += countSubtreeFiles(it.second.get(), limit - count);
   }
+  return count;
 }
 
-void InMemoryView::pathGenerator(const Query* query, QueryContext* ctx) const {
-  w_string_piece relative_root;
-  struct watchman_file* f;
+// The lower bound that the query's expression puts on the mtime of the
+// files it can match, if it has a since mtime term that it must satisfy
+std::optional<int64_t> getMinMtimeSec(const Query* query, QueryContext* ctx) {
+  if (!query->expr) {
+    return std::nullopt;
+  }
+  ColumnFilter filter;
+  query->expr->narrowColumnFilter(ctx, filter);
+  if (filter.minMtimeSec == ColumnFilter{}.minMtimeSec) {
+    return std::nullopt;
+  }
+  return filter.minMtimeSec;
+}
 
-  if (query->relative_root) {
-    relative_root = *query->relative_root;
-  } else {
-    relative_root = rootPath_;
+// Whether the query's expression can only match dirs, as ["type", "d"] can
+bool onlyMatchesDirs(const Query* query, QueryContext* ctx) {
+  if (!query->expr) {
+    return false;
   }
+  ColumnFilter filter;
+  query->expr->narrowColumnFilter(ctx, filter);
+  return (filter.dtypes &
+          ~(ColumnFilter::dtypeBit(DType::Dir) |
+            ColumnFilter::dtypeBit(DType::Unknown))) == 0;
+}
+} // namespace
 
+void InMemoryView::timeGenerator(const Query* query, QueryContext* ctx) const {
+  // Walk back in time until we hit the boundary.  The recency and tombstone
+  // indices are appended to in tick order as changes are processed, so
+  // together they serve as the change log for subscriptions: each run
+  // visits only the files that changed since the subscriber's last tick,
+  // and never wraps.
+  TraceSpan lockSpan{"view.rlock"};
   auto view = view_.rlock();
+  lockSpan.end();
   ctx->generationStarted();
 
-  for (const auto& path : *query->paths) {
-    const watchman_dir* dir;
-    w_string dir_name;
-
-    // Compose path with root
-    auto full_name = w_string::pathCat({relative_root, path.name});
+  auto* since_ts = std::get_if<QuerySince::Timestamp>(&ctx->since.since);
+  auto* since_clock = std::get_if<QuerySince::Clock>(&ctx->since.since);
 
-    // special case of root dir itself
-    if (rootPath_ == full_name) {
-      // dirname on the root is outside the root, which is useless
-      dir = view->resolveDir(full_name);
-      goto is_dir;
+  // A relative_root query only wants the changes under that dir
+  const watchman_dir* anchor = nullptr;
+  if (query->relative_root) {
+    anchor = view->resolveDir(*query->relative_root);
+    if (!anchor) {
+      ctx->recordPlan("since", "changed_subtree", 0);
+      return;
     }
+  }
 
-    // Ideally, we'd just resolve it directly as a dir and be done.
-    // It's not quite so simple though, because we may resolve a dir
-    // that had been deleted and replaced by a file.
-    // We prefer to resolve the parent and walk down.
-    dir_name = full_name.dirName();
-    if (dir_name.empty()) {
-      continue;
-    }
+  std::optional<ClockTicks> sinceTicks;
+  if (since_clock) {
+    sinceTicks = since_clock->ticks;
+  } else if (anchor && !query->limit) {
+    // The change log below is walked until the first file that changed at
+    // or before the timestamp, so the timestamp selects the same files as
+    // that file's tick.  Finding it is only a walk of the newer entries,
+    // and lets the timestamp take the changed subtree walk too.
+    forEachChangedNewestFirst(*view, [&](watchman_file* f) {
+      if (f->otime.timestamp <= since_ts->time) {
+        sinceTicks = f->otime.ticks;
+        return false;
+      }
+      return true;
+    });
+  }
 
-    dir = view->resolveDir(dir_name);
+  std::optional<size_t> logEstimate;
+  if (sinceTicks) {
+    logEstimate = view->getRecencyIndex().countNewerThan(*sinceTicks) +
+        view->getTombstoneIndex().countNewerThan(*sinceTicks);
+  }
 
-    if (!dir) {
-      // Doesn't exist, and never has
-      continue;
+  // The change log covers the whole tree, while a relative_root query only
+  // wants the changes under it; walking that subtree instead, skipping the
+  // parts of it that haven't changed, is cheaper unless the subtree holds
+  // more files in changed dirs than the log holds changes.  A limit wants
+  // the newest changes first, which only the change log can give.
+  if (anchor && sinceTicks && !query->limit) {
+    size_t subtreeEstimate =
+        countChangedSubtreeFiles(anchor, *sinceTicks, *logEstimate);
+    if (subtreeEstimate <= *logEstimate) {
+      ctx->recordPlan("since", "changed_subtree", subtreeEstimate);
+      changedSubtreeGenerator(query, ctx, anchor, *sinceTicks);
+      return;
     }
-
-    if (!dir->files.empty()) {
-      auto file_name = path.name.baseName();
-      f = dir->getChildFile(file_name);
-
-      // If it's a file (but not an existent dir)
-      if (f && (!f->exists || !f->stat.isDir())) {
-        ctx->bumpNumWalked();
-        w_query_process_file(
-            query, ctx, std::make_unique<InMemoryFileResult>(f, caches_));
-        continue;
-      }
+  }
+  ctx->recordPlan(
+      "since",
+      "change_log",
+      logEstimate ? std::optional<int64_t>(*logEstimate) : std::nullopt);
+
+  forEachChangedNewestFirst(*view, [&](watchman_file* f) {
+    if (ctx->limitReached()) {
+      return false;
     }
-
-    // Is it a dir?
-    if (dir->dirs.empty()) {
-      continue;
+    ctx->bumpNumWalked();
+    // Note that we use <= for the time comparisons in here so that we
+    // report the things that changed inclusive of the boundary presented.
+    // This is especially important for clients using the coarse unix
+    // timestamp as the since basis, as they would be much more
+    // likely to miss out on changes if we didn't.
+    if (since_ts && f->otime.timestamp <= since_ts->time) {
+      return false;
+    }
+    if (since_clock && f->otime.ticks <= since_clock->ticks) {
+      return false;
     }
 
-    dir = dir->getChildDir(full_name.baseName());
-  is_dir:
-    // We got a dir; process recursively to specified depth
-    if (dir) {
-      dirGenerator(query, ctx, dir, path.depth);
+    if (!anchor || isWithinDir(f, anchor)) {
+      w_query_process_file(query, ctx, makeFileResult(ctx, f));
     }
-  }
+    return true;
+  });
 }
 
-void InMemoryView::dirGenerator(
+void InMemoryView::changedFilesGenerator(
     const Query* query,
     QueryContext* ctx,
-    const watchman_dir* dir,
-    uint32_t depth) const {
-  for (auto& it : dir->files) {
-    auto file = it.second.get();
-    ctx->bumpNumWalked();
+    ClockTicks sinceTicks) const {
+  TraceSpan lockSpan{"view.rlock"};
+  auto view = view_.rlock();
+  lockSpan.end();
+  ctx->generationStarted();
 
-    w_query_process_file(
-        query, ctx, std::make_unique<InMemoryFileResult>(file, caches_));
+  if (query->relative_root) {
+    ctx->recordPlan("since", "changed_subtree");
+    if (auto dir = view->resolveDir(*query->relative_root)) {
+      changedSubtreeGenerator(query, ctx, dir, sinceTicks);
+    }
+    return;
   }
 
-  if (depth > 0) {
-    for (auto& it : dir->dirs) {
-      const auto child = it.second.get();
-
+  ctx->recordPlan("since", "change_log");
+  forEachChangedNewestFirst(*view, [&](watchman_file* f) {
+    if (f->otime.ticks <= sinceTicks) {
+      return false;
+    }
+    ctx->bumpNumWalked();
+    if (ctx->fileMatchesRelativeRoot(f)) {
+      w_query_process_file(query, ctx, makeFileResult(ctx, f));
+    }
+    return true;
+  });
+}
+
+void InMemoryView::changedSubtreeGenerator(
+    const Query* query,
+    QueryContext* ctx,
+    const watchman_dir* dir,
+    ClockTicks sinceTicks) const {
+  if (dir->subtreeTicks <= sinceTicks) {
+    return;
+  }
+
+  for (auto& it : dir->files) {
+    auto file = it.second.get();
+    ctx->bumpNumWalked();
+    if (file->otime.ticks > sinceTicks) {
+      w_query_process_file(query, ctx, makeFileResult(ctx, file));
+    }
+  }
+
+  for (auto& it : dir->dirs) {
+    changedSubtreeGenerator(query, ctx, it.second.get(), sinceTicks);
+  }
+}
+
+namespace {
+// Orders paths so that a dir is immediately followed by everything under
+// it, by treating '/' as less than any other character.
+bool pathComponentsLess(w_string_piece a, w_string_piece b) {
+  auto len = std::min(a.size(), b.size());
+  for (size_t i = 0; i < len; ++i) {
+    if (a[i] != b[i]) {
+      if (a[i] == '/') {
+        return true;
+      }
+      if (b[i] == '/') {
+        return false;
+      }
+      return static_cast<unsigned char>(a[i]) <
+          static_cast<unsigned char>(b[i]);
+    }
+  }
+  return a.size() < b.size();
+}
+
+// Whether path is below dir; both are relative to the same root, and an
+// empty dir is that root
+bool pathIsBelow(w_string_piece path, w_string_piece dir) {
+  if (dir.empty()) {
+    return !path.empty();
+  }
+  return path.size() > dir.size() && path[dir.size()] == '/' &&
+      path.startsWith(dir);
+}
+
+/**
+ * Resolves dirs relative to the root dir of a view, reusing the lookups of
+ * the leading components that the previous call had in common with this
+ * one.  Resolving a sorted list of paths, whose neighbours tend to share
+ * ancestors, walks each ancestor once rather than once per path.  The
+ * pieces passed to resolve() must remain valid until the next call.
+ */
+class DirResolver {
+ public:
+  explicit DirResolver(const watchman_dir* root) : chain_{root} {}
+
+  // Returns nullptr if there is no such dir.  relPath is empty for the root.
+  const watchman_dir* resolve(w_string_piece relPath) {
+    parts_.clear();
+    if (!relPath.empty()) {
+      relPath.split(parts_, '/');
+    }
+    size_t common = 0;
+    while (common < parts_.size() && common < components_.size() &&
+           parts_[common] == components_[common]) {
+      ++common;
+    }
+    components_.resize(common);
+    chain_.resize(common + 1);
+    for (size_t i = common; i < parts_.size(); ++i) {
+      auto dir = chain_.back();
+      components_.push_back(parts_[i]);
+      chain_.push_back(dir ? dir->getChildDir(parts_[i]) : nullptr);
+    }
+    return chain_.back();
+  }
+
+ private:
+  std::vector<w_string_piece> parts_;
+  // The components of the last path resolved, and the dir that each
+  // prefix of them resolved to; chain_[0] is the root
+  std::vector<w_string_piece> components_;
+  std::vector<const watchman_dir*> chain_;
+};
+} // namespace
+
+void InMemoryView::pathGenerator(const Query* query, QueryContext* ctx) const {
+  w_string_piece relative_root;
+
+  if (query->relative_root) {
+    relative_root = *query->relative_root;
+  } else {
+    relative_root = rootPath_;
+  }
+
+  ctx->recordPlan("path", "lookup");
+
+  // A path resolves to a file, to a dir to walk to its depth, or to nothing
+  struct Target {
+    w_string fullName;
+    // fullName relative to the root of the view
+    w_string_piece name;
+    uint32_t depth;
+    watchman_file* file{nullptr};
+    const watchman_dir* dir{nullptr};
+  };
+  std::vector<Target> targets;
+  targets.reserve(query->paths->size());
+  for (const auto& path : *query->paths) {
+    Target target;
+    // Compose path with root
+    target.fullName = w_string::pathCat({relative_root, path.name});
+    if (target.fullName.size() > rootPath_.size()) {
+      target.name = target.fullName.piece();
+      target.name.advance(rootPath_.size() + 1);
+    }
+    target.depth = path.depth;
+    targets.push_back(std::move(target));
+  }
+
+  // Sort the paths so that those sharing ancestors are resolved together,
+  // and merge repeats; the deepest walk of a dir covers the others.
+  std::sort(targets.begin(), targets.end(), [](const auto& a, const auto& b) {
+    return pathComponentsLess(a.name, b.name);
+  });
+  size_t numUnique = 0;
+  for (size_t i = 0; i < targets.size(); ++i) {
+    if (numUnique > 0 && targets[numUnique - 1].name == targets[i].name) {
+      auto& prior = targets[numUnique - 1];
+      prior.depth = std::max(prior.depth, targets[i].depth);
+      continue;
+    }
+    if (numUnique != i) {
+      targets[numUnique] = std::move(targets[i]);
+    }
+    ++numUnique;
+  }
+  targets.resize(numUnique);
+
+  TraceSpan lockSpan{"view.rlock"};
+  auto view = view_.rlock();
+  lockSpan.end();
+  ctx->generationStarted();
+
+  DirResolver resolver{view->resolveDir(rootPath_)};
+  for (auto& target : targets) {
+    // special case of root dir itself
+    if (target.name.empty()) {
+      // dirname on the root is outside the root, which is useless
+      target.dir = resolver.resolve(target.name);
+      continue;
+    }
+
+    // Ideally, we'd just resolve it directly as a dir and be done.
+    // It's not quite so simple though, because we may resolve a dir
+    // that had been deleted and replaced by a file.
+    // We prefer to resolve the parent and walk down.
+    auto dir = resolver.resolve(target.name.dirName());
+    if (!dir) {
+      // Doesn't exist, and never has
+      continue;
+    }
+
+    if (!dir->files.empty()) {
+      auto f = dir->getChildFile(target.name.baseName());
+
+      // If it's a file (but not an existent dir)
+      if (f && (!f->exists || !f->stat.isDir())) {
+        target.file = f;
+        continue;
+      }
+    }
+
+    // Is it a dir?
+    if (!dir->dirs.empty()) {
+      target.dir = dir->getChildDir(target.name.baseName());
+    }
+  }
+
+  // Drop the targets that the walk of an unbounded ancestor dir covers.
+  // Any others below a dir that is walked mean that the targets overlap.
+  // ancestors holds the dirs being walked that enclose the current target.
+  constexpr uint32_t kUnbounded = std::numeric_limits<uint32_t>::max();
+  bool overlapping = false;
+  std::vector<const Target*> ancestors;
+  std::vector<const Target*> kept;
+  for (const auto& target : targets) {
+    while (!ancestors.empty() &&
+           !pathIsBelow(target.name, ancestors.back()->name)) {
+      ancestors.pop_back();
+    }
+    if (!ancestors.empty()) {
+      if (std::any_of(ancestors.begin(), ancestors.end(), [](auto* a) {
+            return a->depth == kUnbounded;
+          })) {
+        continue;
+      }
+      overlapping = true;
+    }
+    if (target.file || target.dir) {
+      kept.push_back(&target);
+    }
+    if (target.dir) {
+      ancestors.push_back(&target);
+    }
+  }
+
+  // Split the walks into units: a dir's own files, and the walk of each of
+  // its child dirs, so that a single large target can be spread across the
+  // shards too.  Targets that overlap could be emitted by more than one
+  // shard, defeating dedup_results, so they stay serial.
+  if (queryParallelism_ > 1 && !overlapping && !query->limit &&
+      view->getRecencyIndex().getStats().slots >= queryParallelMinFiles_) {
+    struct Unit {
+      const watchman_file* file;
+      const watchman_dir* dir;
+      uint32_t depth;
+    };
+    std::vector<Unit> units;
+    for (auto* target : kept) {
+      if (target->file || target->depth == 0) {
+        units.push_back(Unit{target->file, target->dir, 0});
+        continue;
+      }
+      units.push_back(Unit{nullptr, target->dir, 0});
+      for (auto& it : target->dir->dirs) {
+        units.push_back(Unit{nullptr, it.second.get(), target->depth - 1});
+      }
+    }
+
+    // The units vary a lot in size, so rather than being dealt out up
+    // front, each shard takes the next unit when it finishes its last.
+    size_t numShards = std::min(queryParallelism_, units.size());
+    if (numShards > 1) {
+      std::atomic<size_t> nextUnit{0};
+      generateInShards(ctx, numShards, [&](QueryContext* shardCtx, size_t) {
+        for (auto i = nextUnit++; i < units.size(); i = nextUnit++) {
+          auto& unit = units[i];
+          if (unit.file) {
+            shardCtx->bumpNumWalked();
+            w_query_process_file(
+                query, shardCtx, makeFileResult(shardCtx, unit.file));
+          } else {
+            dirGenerator(query, shardCtx, unit.dir, unit.depth);
+          }
+        }
+      });
+      return;
+    }
+  }
+
+  for (auto* target : kept) {
+    if (ctx->limitReached()) {
+      break;
+    }
+    if (target->file) {
+      ctx->bumpNumWalked();
+      w_query_process_file(query, ctx, makeFileResult(ctx, target->file));
+    } else {
+      // We got a dir; process recursively to specified depth
+      dirGenerator(query, ctx, target->dir, target->depth);
+    }
+  }
+}
+
+void InMemoryView::dirGenerator(
+    const Query* query,
+    QueryContext* ctx,
+    const watchman_dir* dir,
+    uint32_t depth) const {
+  for (auto& it : dir->files) {
+    if (ctx->limitReached()) {
+      return;
+    }
+    auto file = it.second.get();
+    ctx->bumpNumWalked();
+
+    w_query_process_file(query, ctx, makeFileResult(ctx, file));
+  }
+
+  if (depth > 0) {
+    for (auto& it : dir->dirs) {
+      if (ctx->limitReached()) {
+        return;
+      }
+      const auto child = it.second.get();
+
       dirGenerator(query, ctx, child, depth - 1);
     }
   }
@@ -715,6 +1630,9 @@ void InMemoryView::globGeneratorDoublestar(
 
   // First step is to walk the set of files contained in this node
   for (auto& it : dir->files) {
+    if (ctx->limitReached()) {
+      return;
+    }
     auto file = it.second.get();
     auto file_name = file->getName();
 
@@ -729,35 +1647,31 @@ void InMemoryView::globGeneratorDoublestar(
         dir_name, dir_name_len, file_name.data(), file_name.size());
 
     // Now that we have computed the name of this candidate file node,
-    // attempt to match against each of the possible doublestar patterns
-    // in turn.  As soon as any one of them matches we can stop this loop
-    // as it doesn't make a lot of sense to yield multiple results for
-    // the same file.
-    for (const auto& child_node : node->doublestar_children) {
-      matched =
-          wildmatch(
-              child_node->pattern.c_str(),
-              subject.c_str(),
-              ctx->query->glob_flags | WM_PATHNAME |
-                  (ctx->query->case_sensitive == CaseSensitivity::CaseSensitive
-                       ? 0
-                       : WM_CASEFOLD),
-              0) == WM_MATCH;
-
-      if (matched) {
-        w_query_process_file(
-            ctx->query,
-            ctx,
-            std::make_unique<InMemoryFileResult>(file, caches_));
-        // No sense running multiple matches for this same file node
-        // if this one succeeded.
-        break;
-      }
-    }
+    // attempt to match against each of the doublestar patterns that may
+    // match it in turn.  As soon as any one of them matches we can stop
+    // this loop as it doesn't make a lot of sense to yield multiple results
+    // for the same file.
+    node->doublestar_index.forEachCandidate(
+        std::string_view{subject.data(), subject.size()},
+        [&](const GlobTree* child_node) {
+          matched = child_node->matcher.matches(
+              std::string_view{subject.data(), subject.size()});
+
+          if (matched) {
+            w_query_process_file(ctx->query, ctx, makeFileResult(ctx, file));
+            // No sense running multiple matches for this same file node
+            // if this one succeeded.
+            return false;
+          }
+          return true;
+        });
   }
 
   // And now walk down to any dirs; all dirs are eligible
   for (auto& it : dir->dirs) {
+    if (ctx->limitReached()) {
+      return;
+    }
     const auto child = it.second.get();
 
     if (!child->last_check_existed) {
@@ -780,97 +1694,106 @@ void InMemoryView::globGeneratorTree(
     globGeneratorDoublestar(ctx, dir, node, nullptr, 0);
   }
 
+  const bool caseSensitive =
+      ctx->query->case_sensitive == CaseSensitivity::CaseSensitive;
+  // Whether child_node is matched by looking its name up directly, rather
+  // than by walking the entries of dir.
+  auto isDirectLookup = [&](const GlobTree* child_node) {
+    return !child_node->had_specials && caseSensitive;
+  };
+
+  bool needWalk = false;
   for (const auto& child_node : node->children) {
     w_assert(!child_node->is_doublestar, "should not get here with ** glob");
 
-    // If there are child dirs, consider them for recursion.
+    if (ctx->limitReached()) {
+      return;
+    }
+
+    if (!isDirectLookup(child_node.get())) {
+      needWalk = true;
+      continue;
+    }
+
+    w_string_piece component(
+        child_node->pattern.data(), child_node->pattern.size());
+
     // Note that we don't restrict this to !leaf because the user may have
     // set their globs list to something like ["some_dir", "some_dir/file"]
     // and we don't want to preclude matching the latter.
     if (!dir->dirs.empty()) {
-      // Attempt direct lookup if possible
-      if (!child_node->had_specials &&
-          ctx->query->case_sensitive == CaseSensitivity::CaseSensitive) {
-        w_string_piece component(
-            child_node->pattern.data(), child_node->pattern.size());
-        const auto child_dir = dir->getChildDir(component);
-
-        if (child_dir) {
-          globGeneratorTree(ctx, child_node.get(), child_dir);
-        }
-      } else {
-        // Otherwise we have to walk and match
-        for (auto& it : dir->dirs) {
-          const auto child_dir = it.second.get();
-
-          if (!child_dir->last_check_existed) {
-            // Globs can only match files in dirs that exist
-            continue;
-          }
-
-          if (wildmatch(
-                  child_node->pattern.c_str(),
-                  child_dir->name.c_str(),
-                  ctx->query->glob_flags |
-                      (ctx->query->case_sensitive ==
-                               CaseSensitivity::CaseSensitive
-                           ? 0
-                           : WM_CASEFOLD),
-                  0) == WM_MATCH) {
-            globGeneratorTree(ctx, child_node.get(), child_dir);
-          }
-        }
+      const auto child_dir = dir->getChildDir(component);
+      if (child_dir) {
+        globGeneratorTree(ctx, child_node.get(), child_dir);
       }
     }
 
-    // If the node is a leaf we are in a position to match files.
     if (child_node->is_leaf && !dir->files.empty()) {
-      // Attempt direct lookup if possible
-      if (!child_node->had_specials &&
-          ctx->query->case_sensitive == CaseSensitivity::CaseSensitive) {
-        w_string_piece component(
-            child_node->pattern.data(), child_node->pattern.size());
-        auto file = dir->getChildFile(component);
-
-        if (file) {
-          ctx->bumpNumWalked();
-          if (file->exists) {
-            // Globs can only match files that exist
-            w_query_process_file(
-                ctx->query,
-                ctx,
-                std::make_unique<InMemoryFileResult>(file, caches_));
-          }
+      auto file = dir->getChildFile(component);
+      if (file) {
+        ctx->bumpNumWalked();
+        if (file->exists) {
+          // Globs can only match files that exist
+          w_query_process_file(ctx->query, ctx, makeFileResult(ctx, file));
         }
-      } else {
-        for (auto& it : dir->files) {
-          // Otherwise we have to walk and match
-          auto file = it.second.get();
-          auto file_name = file->getName();
-          ctx->bumpNumWalked();
-
-          if (!file->exists) {
-            // Globs can only match files that exist
-            continue;
-          }
+      }
+    }
+  }
 
-          if (wildmatch(
-                  child_node->pattern.c_str(),
-                  file_name.data(),
-                  ctx->query->glob_flags |
-                      (ctx->query->case_sensitive ==
-                               CaseSensitivity::CaseSensitive
-                           ? 0
-                           : WM_CASEFOLD),
-                  0) == WM_MATCH) {
-            w_query_process_file(
-                ctx->query,
-                ctx,
-                std::make_unique<InMemoryFileResult>(file, caches_));
+  if (!needWalk) {
+    return;
+  }
+
+  // Walk the entries of dir once, rather than once per pattern, matching
+  // each against only those patterns that the index says it may match.
+  for (auto& it : dir->dirs) {
+    if (ctx->limitReached()) {
+      return;
+    }
+    const auto child_dir = it.second.get();
+
+    if (!child_dir->last_check_existed) {
+      // Globs can only match files in dirs that exist
+      continue;
+    }
+
+    node->children_index.forEachCandidate(
+        std::string_view{child_dir->name.data(), child_dir->name.size()},
+        [&](const GlobTree* child_node) {
+          if (!isDirectLookup(child_node) &&
+              child_node->matcher.matches(std::string_view{
+                  child_dir->name.data(), child_dir->name.size()})) {
+            globGeneratorTree(ctx, child_node, child_dir);
           }
-        }
-      }
+          return true;
+        });
+  }
+
+  for (auto& it : dir->files) {
+    if (ctx->limitReached()) {
+      return;
+    }
+    auto file = it.second.get();
+    auto file_name = file->getName();
+    ctx->bumpNumWalked();
+
+    if (!file->exists) {
+      // Globs can only match files that exist
+      continue;
     }
+
+    node->children_index.forEachCandidate(
+        std::string_view{file_name.data(), file_name.size()},
+        [&](const GlobTree* child_node) {
+          if (child_node->is_leaf && !isDirectLookup(child_node) &&
+              child_node->matcher.matches(
+                  std::string_view{file_name.data(), file_name.size()})) {
+            w_query_process_file(ctx->query, ctx, makeFileResult(ctx, file));
+            // No sense yielding the same file node more than once
+            return false;
+          }
+          return true;
+        });
   }
 }
 
@@ -892,23 +1815,432 @@ void InMemoryView::globGenerator(const Query* query, QueryContext* ctx) const {
         relative_root);
   }
 
+  if (query->suffixes && suffixGenerator(*view, dir, query, ctx)) {
+    return;
+  }
+  ctx->recordPlan(query->suffixes ? "suffix" : "glob", "glob_tree");
   globGeneratorTree(ctx, query->glob_tree.get(), dir);
 }
 
+bool InMemoryView::suffixGenerator(
+    const ViewDatabase& view,
+    const watchman_dir* dir,
+    const Query* query,
+    QueryContext* ctx) const {
+  auto index = view.getSuffixIndex();
+  if (!index) {
+    return false;
+  }
+
+  // The index is keyed by the text after the last dot.  Suffixes that
+  // contain a dot, or characters that are special in the "**/*.suffix"
+  // patterns of the glob tree, need the tree walk to match the same files.
+  for (auto& suffix : *query->suffixes) {
+    if (suffix.empty() ||
+        std::any_of(
+            suffix.data(), suffix.data() + suffix.size(), [](char c) {
+              return c == '.' || c == '/' || c == '*' || c == '?' ||
+                  c == '[' || c == '\\';
+            })) {
+      return false;
+    }
+  }
+
+  // The index covers the whole tree, so for a relative_root that holds
+  // fewer files than the index holds for the suffixes, the tree walk is
+  // cheaper
+  size_t estimate = 0;
+  for (auto& suffix : *query->suffixes) {
+    if (auto files = index->find(suffix)) {
+      estimate += files->size();
+    }
+  }
+  if (dir != view.getRootDir() &&
+      countSubtreeFiles(dir, estimate) < estimate) {
+    return false;
+  }
+  ctx->recordPlan("suffix", "suffix_index", estimate);
+
+  for (auto& suffix : *query->suffixes) {
+    auto files = index->find(suffix);
+    if (!files) {
+      continue;
+    }
+    for (auto file : *files) {
+      if (ctx->limitReached()) {
+        return true;
+      }
+      ctx->bumpNumWalked();
+
+      if (!file->exists) {
+        // Globs can only match files that exist
+        continue;
+      }
+
+      // The file must be below dir, in dirs that exist
+      bool visible = true;
+      for (auto parent = file->parent; parent != dir;
+           parent = parent->parent) {
+        if (!parent || !parent->last_check_existed) {
+          visible = false;
+          break;
+        }
+      }
+      if (visible) {
+        w_query_process_file(query, ctx, makeFileResult(ctx, file));
+      }
+    }
+  }
+  return true;
+}
+
+bool InMemoryView::wholeNameGenerator(
+    const ViewDatabase& view,
+    const Query* query,
+    QueryContext* ctx) const {
+  if (!query->expr) {
+    return false;
+  }
+  auto names = query->expr->computeWholeNames();
+  // A list longer than the view is cheaper to walk past
+  if (!names || names->size() > view.getRecencyIndex().getStats().slots) {
+    return false;
+  }
+  ctx->recordPlan("all", "wholename_lookup", names->size());
+
+  const auto& base = query->relative_root ? *query->relative_root : rootPath_;
+  auto baseDir = view.resolveDir(base);
+  if (!baseDir) {
+    return true;
+  }
+
+  // Sorted so that neighbouring names share the lookups of their dirs
+  std::sort(
+      names->begin(), names->end(), [](const w_string& a, const w_string& b) {
+        return pathComponentsLess(a.piece(), b.piece());
+      });
+  DirResolver resolver{baseDir};
+  for (auto& name : *names) {
+    if (ctx->limitReached()) {
+      break;
+    }
+    auto baseName = name.piece().baseName();
+    if (baseName.empty()) {
+      continue;
+    }
+    ctx->bumpNumWalked();
+    auto dir = resolver.resolve(name.piece().dirName());
+    auto file = dir ? dir->getChildFile(baseName) : nullptr;
+    // Like the recency index, which holds only the files that exist
+    if (file && file->exists) {
+      w_query_process_file(query, ctx, makeFileResult(ctx, file));
+    }
+  }
+  return true;
+}
+
+std::optional<std::vector<const watchman_dir*>>
+InMemoryView::getGlobUpperBoundDirs(
+    const ViewDatabase& view,
+    const Query* query,
+    QueryContext* ctx) const {
+  // Case insensitive bounds are lower-cased, so they can't be looked up
+  if (!enableGlobUpperBounds_ || !query->expr ||
+      ctx->root->case_sensitive != CaseSensitivity::CaseSensitive) {
+    return std::nullopt;
+  }
+  auto patterns =
+      query->expr->computeGlobUpperBound(CaseSensitivity::CaseSensitive);
+  if (!patterns) {
+    return std::nullopt;
+  }
+
+  std::vector<std::string> literalDirs;
+  for (auto& pattern : *patterns) {
+    auto dir = globLiteralDir(pattern);
+    if (dir.empty()) {
+      return std::nullopt;
+    }
+    literalDirs.push_back(std::move(dir));
+  }
+  // Walk each subtree once, even if several patterns fall within it
+  std::sort(
+      literalDirs.begin(),
+      literalDirs.end(),
+      [](const std::string& a, const std::string& b) {
+        return a.size() < b.size();
+      });
+
+  const auto& base = query->relative_root ? *query->relative_root : rootPath_;
+  std::vector<std::string> walked;
+  std::vector<const watchman_dir*> dirs;
+  for (auto& dir : literalDirs) {
+    bool covered = std::any_of(
+        walked.begin(), walked.end(), [&](const std::string& parent) {
+          return dir.compare(0, parent.size(), parent) == 0 &&
+              (dir.size() == parent.size() || dir[parent.size()] == '/');
+        });
+    if (covered) {
+      continue;
+    }
+    walked.push_back(dir);
+    if (auto resolved = view.resolveDir(w_string::pathCat({base, dir}))) {
+      dirs.push_back(resolved);
+    }
+  }
+  logf(
+      DBG,
+      "walking {} of the {} dirs in the glob upper bound of the query\n",
+      dirs.size(),
+      literalDirs.size());
+  return dirs;
+}
+
+void InMemoryView::subtreeGenerator(
+    const Query* query,
+    QueryContext* ctx,
+    const watchman_dir* dir) const {
+  for (auto& it : dir->files) {
+    if (ctx->limitReached()) {
+      return;
+    }
+    auto file = it.second.get();
+    ctx->bumpNumWalked();
+
+    // Like the recency index, which holds only the files that exist
+    if (file->exists) {
+      w_query_process_file(query, ctx, makeFileResult(ctx, file));
+    }
+  }
+
+  for (auto& it : dir->dirs) {
+    if (ctx->limitReached()) {
+      return;
+    }
+    const auto child = it.second.get();
+    if (child->last_check_existed) {
+      subtreeGenerator(query, ctx, child);
+    }
+  }
+}
+
+void InMemoryView::subdirsGenerator(
+    const Query* query,
+    QueryContext* ctx,
+    const watchman_dir* dir,
+    const std::unordered_set<const watchman_dir*>& vcsDirs) const {
+  if (vcsDirs.count(dir)) {
+    for (auto& it : dir->files) {
+      auto file = it.second.get();
+      ctx->bumpNumWalked();
+      if (file->exists && file->stat.isDir()) {
+        w_query_process_file(query, ctx, makeFileResult(ctx, file));
+      }
+    }
+    return;
+  }
+
+  for (auto& it : dir->dirs) {
+    const auto child = it.second.get();
+    auto file = dir->getChildFile(child->name);
+    ctx->bumpNumWalked();
+    if (file && file->exists) {
+      w_query_process_file(query, ctx, makeFileResult(ctx, file));
+    }
+    if (child->last_check_existed) {
+      subdirsGenerator(query, ctx, child, vcsDirs);
+    }
+  }
+}
+
 void InMemoryView::allFilesGenerator(const Query* query, QueryContext* ctx)
     const {
-  struct watchman_file* f;
+  TraceSpan lockSpan{"view.rlock"};
   auto view = view_.rlock();
+  lockSpan.end();
   ctx->generationStarted();
 
-  for (f = view->getLatestFile(); f; f = f->next) {
+  if (wholeNameGenerator(*view, query, ctx)) {
+    return;
+  }
+
+  // An expression that can only match below a few dirs needn't consider
+  // the files elsewhere
+  if (auto dirs = getGlobUpperBoundDirs(*view, query, ctx)) {
+    ctx->recordPlan("all", "glob_upper_bound");
+    for (auto dir : *dirs) {
+      subtreeGenerator(query, ctx, dir);
+    }
+    return;
+  }
+
+  // Nor need a relative_root query consider the files outside of that dir
+  const watchman_dir* anchor = nullptr;
+  if (query->relative_root) {
+    anchor = view->resolveDir(*query->relative_root);
+    if (!anchor) {
+      ctx->recordPlan("all", "relative_root", 0);
+      return;
+    }
+  }
+
+  // An expression that can only match dirs needn't consider the files at
+  // all, as there are usually far fewer dirs.  That needs a node for every
+  // dir, which lazy crawling hasn't made for the dirs that it deferred.  A
+  // limit wants the newest dirs first, which only the index can give.
+  if (!query->limit && (!lazyCrawling_ || deferredDirs_.rlock()->empty()) &&
+      onlyMatchesDirs(query, ctx)) {
+    std::unordered_set<const watchman_dir*> vcsDirs;
+    for (auto& path : ctx->root->ignore.getVcsDirs()) {
+      if (auto dir = view->resolveDir(path)) {
+        vcsDirs.insert(dir);
+      }
+    }
+    auto dir = anchor ? anchor : view->getRootDir();
+    ctx->recordPlan("all", "dirs");
+    subdirsGenerator(query, ctx, dir, vcsDirs);
+    return;
+  }
+
+  // Only fresh instance queries, which don't report deleted files, walk all
+  // files, so the tombstone index can be left out.
+  const auto& index = view->getRecencyIndex();
+
+  // The index covers the whole tree, so walking the relative root's subtree
+  // is cheaper unless it holds most of the files.  A limit wants the newest
+  // files first, which only the index can give.
+  if (anchor && anchor != view->getRootDir() && !query->limit) {
+    size_t slots = index.getStats().slots;
+    size_t subtreeEstimate = countSubtreeFiles(anchor, slots);
+    if (subtreeEstimate < slots) {
+      ctx->recordPlan("all", "relative_root", subtreeEstimate);
+      subtreeGenerator(query, ctx, anchor);
+      return;
+    }
+  }
+
+  // A since mtime term bounds the files that can match to those the mtime
+  // index holds at or after the timestamp.  A limit wants the newest files
+  // by otime first, which the mtime index can't give.
+  if (auto mtimes = view->getMtimeIndex(); mtimes && !query->limit) {
+    if (auto minMtimeSec = getMinMtimeSec(query, ctx)) {
+      size_t visited =
+          mtimes->forEachSince(*minMtimeSec, [&](watchman_file* f) {
+            ctx->bumpNumWalked();
+            if (!anchor || isWithinDir(f, anchor)) {
+              w_query_process_file(query, ctx, makeFileResult(ctx, f));
+            }
+            return true;
+          });
+      ctx->recordPlan("all", "mtime_index", visited);
+      return;
+    }
+  }
+
+  auto filter = getColumnFilter(index, query, ctx);
+  ctx->recordPlan(
+      "all",
+      filter ? "file_columns" : "recency_index",
+      index.getStats().slots);
+  size_t numShards = std::min(queryParallelism_, index.chunkCount());
+  // A query with a limit stops early, which the shards can't do together
+  if (numShards > 1 && !query->limit &&
+      index.getStats().slots >= queryParallelMinFiles_) {
+    allFilesGeneratorParallel(
+        index, query, ctx, numShards, filter ? &*filter : nullptr, anchor);
+    return;
+  }
+
+  auto visit = [&](watchman_file* f) {
     ctx->bumpNumWalked();
-    if (!ctx->fileMatchesRelativeRoot(f)) {
-      continue;
+    if (!anchor || isWithinDir(f, anchor)) {
+      w_query_process_file(query, ctx, makeFileResult(ctx, f));
     }
+    return !ctx->limitReached();
+  };
+  if (filter) {
+    index.forEachNewestFirstInChunksMatching(
+        0, index.chunkCount(), *filter, visit);
+  } else {
+    index.forEachNewestFirst(visit);
+  }
+}
 
-    w_query_process_file(
-        query, ctx, std::make_unique<InMemoryFileResult>(f, caches_));
+void InMemoryView::allFilesGeneratorParallel(
+    const RecencyIndex& index,
+    const Query* query,
+    QueryContext* ctx,
+    size_t numShards,
+    const ColumnFilter* filter,
+    const watchman_dir* anchor) const {
+  // Shard 0 takes the newest chunks, so merging the shards in order yields
+  // the same newest-first order as a serial walk.
+  size_t chunkCount = index.chunkCount();
+  generateInShards(ctx, numShards, [&](QueryContext* shardCtx, size_t i) {
+    auto visit = [&](watchman_file* f) {
+      shardCtx->bumpNumWalked();
+      if (!anchor || isWithinDir(f, anchor)) {
+        w_query_process_file(query, shardCtx, makeFileResult(shardCtx, f));
+      }
+      return true;
+    };
+    size_t begin = chunkCount - chunkCount * (i + 1) / numShards;
+    size_t end = chunkCount - chunkCount * i / numShards;
+    if (filter) {
+      index.forEachNewestFirstInChunksMatching(begin, end, *filter, visit);
+    } else {
+      index.forEachNewestFirstInChunks(begin, end, visit);
+    }
+  });
+}
+
+std::optional<ColumnFilter> InMemoryView::getColumnFilter(
+    const RecencyIndex& index,
+    const Query* query,
+    QueryContext* ctx) const {
+  if (!index.hasColumns() || !query->expr) {
+    return std::nullopt;
+  }
+  ColumnFilter filter;
+  query->expr->narrowColumnFilter(ctx, filter);
+  if (filter.isUnbounded()) {
+    return std::nullopt;
+  }
+  return filter;
+}
+
+void InMemoryView::generateInShards(
+    QueryContext* ctx,
+    size_t numShards,
+    const std::function<void(QueryContext* shardCtx, size_t i)>&
+        evaluateShard) const {
+  std::vector<std::unique_ptr<QueryContext>> shards;
+  for (size_t i = 0; i < numShards; ++i) {
+    shards.push_back(ctx->makeShard());
+  }
+
+  std::vector<folly::SemiFuture<folly::Unit>> futures;
+  for (size_t i = 1; i < numShards; ++i) {
+    futures.push_back(
+        folly::via(getQueryExecutor(), [this, &evaluateShard, &shards, i] {
+          ScopedThreadAffinity affinity{queryWorkerCpus_};
+          auto before = ThreadUsage::current();
+          evaluateShard(shards[i].get(), i);
+          shards[i]->addOffThreadUsage(ThreadUsage::current() - before);
+        }).semi());
+  }
+  // Rather than idle, the client thread takes the first shard.  Capture any
+  // error so that we don't unwind while the others still reference our
+  // stack.
+  auto first = folly::makeTryWith([&] { evaluateShard(shards[0].get(), 0); });
+  auto rest = folly::collectAll(std::move(futures)).get();
+
+  first.value();
+  for (auto& result : rest) {
+    result.value();
+  }
+  for (auto& shard : shards) {
+    ctx->mergeShard(*shard);
   }
 }
 
@@ -935,38 +2267,64 @@ std::chrono::system_clock::time_point InMemoryView::getLastAgeOutTimeStamp()
 }
 
 void InMemoryView::startThreads(const std::shared_ptr<Root>& root) {
-  // Start a thread to call into the watcher API for filesystem notifications
-  auto self = std::static_pointer_cast<InMemoryView>(shared_from_this());
   logf(DBG, "starting threads for {} {}\n", fmt::ptr(this), rootPath_);
-  std::thread notifyThreadInstance([self, root]() {
+  if (auto reactor = SharedReactor::get()) {
+    startSharedThreads(root, *reactor);
+    return;
+  }
+
+  startNotifyThread(root);
+
+  // And now start the IO thread
+  auto self = std::static_pointer_cast<InMemoryView>(shared_from_this());
+  std::thread ioThreadInstance([self, root]() {
     w_set_thread_name(
-        "notify ", uintptr_t(self.get()), " ", self->rootPath_.view());
+        "io ", uintptr_t(self.get()), " ", self->rootPath_.view());
+    if (!self->ioThreadCpus_.empty() &&
+        !setCurrentThreadAffinity(self->ioThreadCpus_)) {
+      logf(ERR, "unable to pin the IO thread of {}\n", self->rootPath_);
+    }
+    self->ioThreadClock_.attachToCurrentThread();
+    SCOPE_EXIT {
+      self->ioThreadClock_.detach();
+    };
     try {
-      self->notifyThread(root);
+      self->ioThread(root);
     } catch (const std::exception& e) {
       log(ERR, "Exception: ", e.what(), " cancel root\n");
       root->cancel();
     }
     log(DBG, "out of loop\n");
   });
-  notifyThreadInstance.detach();
-
-  // Wait for it to signal that the watcher has been initialized
-  pendingFromWatcher_.lockAndWait(std::chrono::milliseconds(-1) /* infinite */);
+  ioThreadInstance.detach();
+}
 
-  // And now start the IO thread
-  std::thread ioThreadInstance([self, root]() {
+void InMemoryView::startNotifyThread(const std::shared_ptr<Root>& root) {
+  // Start a thread to call into the watcher API for filesystem notifications
+  auto self = std::static_pointer_cast<InMemoryView>(shared_from_this());
+  std::thread notifyThreadInstance([self, root]() {
     w_set_thread_name(
-        "io ", uintptr_t(self.get()), " ", self->rootPath_.view());
+        "notify ", uintptr_t(self.get()), " ", self->rootPath_.view());
+    if (!self->notifyThreadCpus_.empty() &&
+        !setCurrentThreadAffinity(self->notifyThreadCpus_)) {
+      logf(ERR, "unable to pin the notify thread of {}\n", self->rootPath_);
+    }
+    self->notifyThreadClock_.attachToCurrentThread();
+    SCOPE_EXIT {
+      self->notifyThreadClock_.detach();
+    };
     try {
-      self->ioThread(root);
+      self->notifyThread(root);
     } catch (const std::exception& e) {
       log(ERR, "Exception: ", e.what(), " cancel root\n");
       root->cancel();
     }
     log(DBG, "out of loop\n");
   });
-  ioThreadInstance.detach();
+  notifyThreadInstance.detach();
+
+  // Wait for it to signal that the watcher has been initialized
+  pendingFromWatcher_.lockAndWait(std::chrono::milliseconds(-1) /* infinite */);
 }
 
 void InMemoryView::stopThreads() {
@@ -980,6 +2338,191 @@ void InMemoryView::wakeThreads() {
   pendingFromWatcher_.lock()->ping();
 }
 
+bool InMemoryView::recrawlSubtree(const w_string& path) {
+  auto piece = path.piece();
+  if (path.size() <= rootPath_.size() || !piece.startsWith(rootPath_) ||
+      !is_slash(piece[rootPath_.size()])) {
+    return false;
+  }
+  // Crawling it as desynced makes the IO thread abort the pending cookies,
+  // as the watcher may have dropped their notifications too.
+  auto lock = pendingFromWatcher_.lock();
+  lock->add(
+      path,
+      std::chrono::system_clock::now(),
+      W_PENDING_VIA_NOTIFY | W_PENDING_RECURSIVE | W_PENDING_IS_DESYNCED);
+  lock->ping();
+  return true;
+}
+
+namespace {
+
+// Appends the dirs in which the patterns of node may match files, where
+// dir is the path that they're relative to.  Literal components narrow
+// the search; anything else may match anywhere below dir.
+void collectGlobScopes(
+    const GlobTree& node,
+    const w_string& dir,
+    std::vector<w_string>& scopes) {
+  if (node.is_leaf) {
+    scopes.push_back(dir);
+  }
+  bool literal = node.doublestar_children.empty() &&
+      std::none_of(node.children.begin(),
+                   node.children.end(),
+                   [](const auto& child) { return child->had_specials; });
+  if (!literal) {
+    scopes.push_back(dir);
+    return;
+  }
+  for (auto& child : node.children) {
+    collectGlobScopes(
+        *child, w_string::pathCat({dir, child->pattern}), scopes);
+  }
+}
+
+// Whether a and b are the same path or one of them is inside the other
+bool pathsOverlap(w_string_piece a, w_string_piece b) {
+  if (a.size() > b.size()) {
+    std::swap(a, b);
+  }
+  return b.startsWith(a) && (a.size() == b.size() || is_slash(b[a.size()]));
+}
+
+// The dirs in which the query's generators may look for files, mirroring
+// the choice of generators made by the query evaluation
+std::vector<w_string> queryScopes(const Query& query, const w_string& root) {
+  const auto& base = query.relative_root ? *query.relative_root : root;
+  std::vector<w_string> scopes;
+  if (query.paths) {
+    for (auto& path : *query.paths) {
+      scopes.push_back(w_string::pathCat({base, path.name}));
+    }
+  }
+  if (query.glob_tree) {
+    collectGlobScopes(*query.glob_tree, base, scopes);
+  }
+  if (query.since_spec || scopes.empty()) {
+    scopes.push_back(base);
+  }
+  return scopes;
+}
+
+} // namespace
+
+void InMemoryView::crawlDeferredDirs(const Query* query) {
+  std::vector<w_string> toCrawl;
+  {
+    auto deferred = deferredDirs_.wlock();
+    if (deferred->empty()) {
+      return;
+    }
+
+    auto scopes = queryScopes(*query, rootPath_);
+    for (auto it = deferred->begin(); it != deferred->end();) {
+      bool needed = std::any_of(
+          scopes.begin(), scopes.end(), [&](const w_string& scope) {
+            return pathsOverlap(scope, *it);
+          });
+      if (needed) {
+        toCrawl.push_back(*it);
+        it = deferred->erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  if (toCrawl.empty()) {
+    return;
+  }
+
+  log(DBG, "crawling ", toCrawl.size(), " deferred dirs for a query\n");
+  auto [p, f] = folly::makePromiseContract<folly::Unit>();
+  {
+    auto now = std::chrono::system_clock::now();
+    auto pending = pendingFromWatcher_.lock();
+    for (auto& dir : toCrawl) {
+      pending->add(dir, now, W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY);
+    }
+    // Resolved once the crawls, and any they lead to, are done
+    pending->addSync(std::move(p));
+    pending->ping();
+  }
+  std::move(f).get();
+}
+
+void InMemoryView::requestRehydrate() {
+  if (hibernating_.load()) {
+    rehydrateRequested_.store(true);
+    pendingFromWatcher_.lock()->ping();
+  }
+}
+
+void InMemoryView::rehydrate() {
+  if (!hibernating_.load()) {
+    return;
+  }
+  auto [p, f] = folly::makePromiseContract<folly::Unit>();
+  {
+    auto pending = pendingFromWatcher_.lock();
+    // Resolved once the view is back and the held changes are applied
+    pending->addSync(std::move(p));
+    rehydrateRequested_.store(true);
+    pending->ping();
+  }
+  std::move(f).get();
+}
+
+bool InMemoryView::waitUntilCrawledFor(
+    const Query* query,
+    std::chrono::milliseconds timeout) {
+  if (!partialCrawlQueries_) {
+    return false;
+  }
+  auto scopes = queryScopes(*query, rootPath_);
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+
+  auto frontier = crawlFrontier_.lock();
+  while (frontier->tracking) {
+    bool crawled = std::none_of(
+        frontier->dirs.begin(), frontier->dirs.end(), [&](const w_string& dir) {
+          return std::any_of(
+              scopes.begin(), scopes.end(), [&](const w_string& scope) {
+                return pathsOverlap(scope, dir);
+              });
+        });
+    if (crawled) {
+      return true;
+    }
+    // A query waiting on the crawl shouldn't wait at idle priority
+    if (pacingCrawl_.load(std::memory_order_relaxed)) {
+      crawlBoosted_.store(true, std::memory_order_relaxed);
+    }
+    if (crawlFrontierCond_.wait_until(frontier.as_lock(), deadline) ==
+        std::cv_status::timeout) {
+      throw std::system_error(
+          ETIMEDOUT,
+          std::generic_category(),
+          fmt::format(
+              "timed out waiting {} milliseconds for the initial crawl to "
+              "reach the queried dirs",
+              timeout.count()));
+    }
+  }
+  return false;
+}
+
+std::optional<w_string> InMemoryView::getRecentChangeScope() const {
+  auto recent = recentChanges_.rlock();
+  if (!recent->scope ||
+      std::chrono::steady_clock::now() - recent->windowStart >
+          kRecentChangeWindow ||
+      recent->scope->size() <= rootPath_.size()) {
+    return std::nullopt;
+  }
+  return recent->scope;
+}
+
 folly::SemiFuture<folly::Unit> InMemoryView::waitForSettle(
     std::chrono::milliseconds settle_period) {
   auto [p, f] = folly::makePromiseContract<folly::Unit>();
@@ -1008,13 +2551,36 @@ folly::SemiFuture<folly::Unit> InMemoryView::waitForSettle(
 CookieSync::SyncResult InMemoryView::syncToNow(
     const std::shared_ptr<Root>& root,
     std::chrono::milliseconds timeout) {
-  auto syncResult = syncToNowCookies(root, timeout);
+  // A query waiting on a crawl shouldn't wait at idle priority
+  if (pacingCrawl_.load(std::memory_order_relaxed)) {
+    crawlBoosted_.store(true, std::memory_order_relaxed);
+  }
+  // The cookie isn't seen until the view is back
+  requestRehydrate();
+
+  // Until the initial crawl is done, and while a recrawl is pending, a
+  // cookie is what tells us that the crawl has caught up.
+  bool flushOnly = syncByFlushing_ &&
+      root->inner.done_initial.load(std::memory_order_acquire) &&
+      !root->recrawlInfo.rlock()->shouldRecrawl;
+
+  CookieSync::SyncResult syncResult;
+  if (!flushOnly) {
+    syncResult = syncToNowCookies(root, timeout);
+    if (watcher_->flags & WATCHER_CAN_SYNC_BY_FLUSHING) {
+      // The cookie was enough
+      return syncResult;
+    }
+  }
 
   // Some watcher implementations (notably, FSEvents) reorder change events
   // before they're reported, and cookie files are not sufficient. Instead, the
   // watcher supports direct synchronization. Once a cookie file has been
   // observed, ensure that all pending events have been flushed and wait until
   // the pending event queue is fully crawled.
+  //
+  // For WATCHER_CAN_SYNC_BY_FLUSHING watchers, the flush stands in for the
+  // cookie.
   auto result = watcher_->flushPendingEvents();
   if (result.valid()) {
     // The watcher has made all pending events available and inserted a promise
@@ -1039,9 +2605,24 @@ CookieSync::SyncResult InMemoryView::syncToNow(
 
 folly::SemiFuture<CookieSync::SyncResult> InMemoryView::sync(
     const std::shared_ptr<Root>& root) {
+  requestRehydrate();
   return root->cookies.sync();
 }
 
+std::unique_ptr<FileResult> InMemoryView::makeFileResult(
+    QueryContext* ctx,
+    const watchman_file* file) const {
+  // Most candidates are rejected or rendered straight away, so the result
+  // for one is almost always free for the next.  The spare was made by
+  // this view, since a context only ever queries one root.
+  if (auto* spare =
+          dynamic_cast<InMemoryFileResult*>(ctx->spareFile.get())) {
+    spare->reset(file);
+    return std::move(ctx->spareFile);
+  }
+  return std::make_unique<InMemoryFileResult>(file, caches_);
+}
+
 CookieSync::SyncResult InMemoryView::syncToNowCookies(
     const std::shared_ptr<Root>& root,
     std::chrono::milliseconds timeout) {
@@ -1160,6 +2741,27 @@ void InMemoryView::clearWatcherDebugInfo() {
   clearViewDebugInfo();
 }
 
+namespace {
+// The CPUs that threads are pinned to, and the CPU time of the thread that
+// clock reads, if there is one
+json_ref threadDebugInfo(
+    const std::vector<unsigned>& cpus,
+    const ThreadCpuClock* clock) {
+  std::vector<json_ref> pinned;
+  for (auto cpu : cpus) {
+    pinned.push_back(json_integer(cpu));
+  }
+  auto info = json_object({{"cpus", json_array(std::move(pinned))}});
+  if (clock) {
+    auto cpuTime = clock->read();
+    info.set(
+        "cpu_time_us",
+        cpuTime ? json_integer(cpuTime->count()) : json_null());
+  }
+  return info;
+}
+} // namespace
+
 json_ref InMemoryView::getViewDebugInfo() const {
   auto processedPathsResult = json_null();
   if (processedPaths_) {
@@ -1169,16 +2771,193 @@ json_ref InMemoryView::getViewDebugInfo() const {
     }
     processedPathsResult = json_array(std::move(paths));
   }
+  size_t entries = sanityAuditStats_.entries.load();
+  size_t discrepancies = sanityAuditStats_.discrepancies.load();
   return json_object({
       {"processed_paths", processedPathsResult},
+      {"view_lock_holds", viewLockHolds_.rlock()->asJsonValue()},
+      {"hibernating", json_boolean(hibernating_.load())},
+      {"hibernation_count", json_integer(hibernationCount_.load())},
+      {"reparented_dirs", json_integer(reparentedDirs_.load())},
+      {"reparent_fallbacks", json_integer(reparentFallbacks_.load())},
+      {"hot_files",
+       json_object({
+           {"held", json_integer(hotFilesHeld_.load())},
+           {"debounced", json_integer(debouncedChanges_.load())},
+       })},
+      {"prioritized_changes", json_integer(prioritizedChanges_.load())},
+      {"background_work_deferrals",
+       json_integer(backgroundWorkDeferrals_.load())},
+      {"threads",
+       json_object({
+           {"notify",
+            threadDebugInfo(notifyThreadCpus_, &notifyThreadClock_)},
+           {"io", threadDebugInfo(ioThreadCpus_, &ioThreadClock_)},
+           {"query_workers", threadDebugInfo(queryWorkerCpus_, nullptr)},
+       })},
+      {"shared_io", json_boolean(sharedIo_.load())},
+      {"shared_notify", json_boolean(sharedNotify_.load())},
+      {"sanity_audit",
+       json_object({
+           {"passes", json_integer(sanityAuditStats_.passes.load())},
+           {"dirs", json_integer(sanityAuditStats_.dirs.load())},
+           {"entries", json_integer(entries)},
+           {"discrepancies", json_integer(discrepancies)},
+           {"discrepancy_rate",
+            json_real(entries ? double(discrepancies) / entries : 0.0)},
+           {"recrawls", json_integer(sanityAuditStats_.recrawls.load())},
+       })},
+  });
+}
+
+void InMemoryView::ViewLockHolds::record(
+    std::chrono::steady_clock::duration held) {
+  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(held);
+  size_t bucket = 0;
+  for (auto limit = ms.count(); limit > 0 && bucket < kBuckets - 1;
+       limit >>= 1) {
+    ++bucket;
+  }
+  ++counts[bucket];
+  longest = std::max(longest, ms);
+}
+
+json_ref InMemoryView::ViewLockHolds::asJsonValue() const {
+  std::vector<json_ref> buckets;
+  for (size_t i = 0; i < kBuckets; ++i) {
+    auto label = i == kBuckets - 1
+        ? fmt::format(">={}ms", 1 << (i - 1))
+        : fmt::format("<{}ms", 1 << i);
+    buckets.push_back(json_object({
+        {"bucket", typed_string_to_json(label.c_str(), W_STRING_UNICODE)},
+        {"count", json_integer(counts[i])},
+    }));
+  }
+  return json_object({
+      {"histogram", json_array(std::move(buckets))},
+      {"yields", json_integer(yields)},
+      {"longest_ms", json_integer(longest.count())},
+  });
+}
+
+json_ref InMemoryView::getArenaDebugInfo() const {
+  NodeArena::Stats stats;
+  PathComponentTable::Stats names;
+  RecencyIndex::Stats recency;
+  RecencyIndex::Stats tombstones;
+  SuffixIndex::Stats suffixes;
+  MtimeIndex::Stats mtimes;
+  {
+    auto view = view_.rlock();
+    stats = view->getArenaStats();
+    names = view->getPathComponentStats();
+    recency = view->getRecencyStats();
+    tombstones = view->getTombstoneStats();
+    if (auto index = view->getSuffixIndex()) {
+      suffixes = index->getStats();
+    }
+    if (auto index = view->getMtimeIndex()) {
+      mtimes = index->getStats();
+    }
+  }
+  return json_object({
+      {"slabs", json_integer(stats.slabs)},
+      {"reserved_bytes", json_integer(stats.reservedBytes)},
+      {"used_bytes", json_integer(stats.usedBytes)},
+      {"live_nodes", json_integer(stats.liveObjects)},
+      // Includes the embedded names
+      {"bytes_per_node",
+       json_integer(
+           stats.liveObjects ? stats.usedBytes / stats.liveObjects : 0)},
+      {"file_node_bytes", json_integer(sizeof(watchman_file))},
+      {"file_info_bytes", json_integer(sizeof(CompactFileInformation))},
+      {"file_owners", json_integer(FileOwnerTable::get().size())},
+      {"released_slabs", json_integer(stats.releasedSlabs)},
+      {"backing_file_bytes", json_integer(stats.backingFileBytes)},
+      {"dir_names", json_integer(names.components)},
+      {"dir_name_bytes", json_integer(names.bytes)},
+      {"dir_name_hits", json_integer(names.hits)},
+      {"recency_chunks", json_integer(recency.chunks)},
+      {"recency_slots", json_integer(recency.slots)},
+      {"recency_compactions", json_integer(recency.compactions)},
+      {"recency_column_bytes", json_integer(recency.columnBytes)},
+      {"tombstone_chunks", json_integer(tombstones.chunks)},
+      {"tombstone_slots", json_integer(tombstones.slots)},
+      {"suffix_index_suffixes", json_integer(suffixes.suffixes)},
+      {"suffix_index_files", json_integer(suffixes.files)},
+      {"suffix_index_bytes", json_integer(suffixes.bytes)},
+      {"mtime_index_files", json_integer(mtimes.files)},
+      {"mtime_index_bytes", json_integer(mtimes.bytes)},
   });
 }
 
+InMemoryView::MemoryUsage InMemoryView::getMemoryUsage() const {
+  MemoryUsage usage;
+  {
+    auto view = view_.rlock();
+    usage.viewNodes = view->getArenaStats().reservedBytes;
+    usage.pathComponents = view->getPathComponentStats().bytes;
+    usage.indexes = (view->getRecencyStats().chunks +
+                     view->getTombstoneStats().chunks) *
+        sizeof(RecencyIndex::Chunk);
+    usage.indexes += view->getRecencyStats().columnBytes;
+    if (auto index = view->getSuffixIndex()) {
+      usage.indexes += index->getStats().bytes;
+    }
+    if (auto index = view->getMtimeIndex()) {
+      usage.indexes += index->getStats().bytes;
+    }
+  }
+  usage.pending = pendingFromWatcher_.lock()->getPendingItemCount() *
+      sizeof(watchman_pending_fs);
+  usage.caches =
+      caches_.contentHashCache.stats().size * sizeof(ContentHashCache::Node) +
+      caches_.symlinkTargetCache.stats().size *
+          sizeof(SymlinkTargetCache::Node);
+  return usage;
+}
+
+json_ref InMemoryView::relieveMemoryPressure() {
+  auto released = QueryableView::relieveMemoryPressure();
+  // Keep the warmer half of each cache; the rest is recomputed from the
+  // filesystem if it is asked for again
+  auto& hashes = caches_.contentHashCache;
+  auto hashesEvicted = hashes.shrink(hashes.stats().size / 2);
+  auto& links = caches_.symlinkTargetCache;
+  auto linksEvicted = links.shrink(links.stats().size / 2);
+  released.set(
+      {{"content_hashes", json_integer(hashesEvicted)},
+       {"symlink_targets", json_integer(linksEvicted)}});
+  return released;
+}
+
 void InMemoryView::clearViewDebugInfo() {
   if (processedPaths_) {
     processedPaths_->clear();
   }
+  *viewLockHolds_.wlock() = ViewLockHolds{};
+}
+
+namespace {
+ContentHashCacheKey contentHashKeyFor(
+    const watchman_file* f,
+    const w_string& rootPath) {
+  auto dirStr = f->parent->getFullPath();
+  w_string_piece dir(dirStr);
+  dir.advance(rootPath.size());
+
+  // If dirName is the root, dir.size() will now be zero
+  if (dir.size() > 0) {
+    // if not at the root, skip the slash character at the
+    // front of dir
+    dir.advance(1);
+  }
+  return ContentHashCacheKey{
+      w_string::pathCat({dir, f->getName()}),
+      size_t(f->stat.size()),
+      f->stat.mtime()};
 }
+} // namespace
 
 void InMemoryView::warmContentCache() {
   if (!enableContentCacheWarming_) {
@@ -1190,14 +2969,17 @@ void InMemoryView::warmContentCache() {
   size_t n = 0;
   std::deque<folly::Future<std::shared_ptr<const ContentHashCache::Node>>>
       futures;
+  // Warming takes turns with the queries that are waiting on hashes
+  auto hashQueue = getContentHashPool().makeQueue();
 
   {
     // Walk back in time until we hit the boundary, or hit the limit
     // on the number of files we should warm up.
     auto view = view_.rlock();
-    struct watchman_file* f;
-    for (f = view->getLatestFile(); f && n < maxFilesToWarmInContentCache_;
-         f = f->next) {
+    view->getRecencyIndex().forEachNewestFirst([&](watchman_file* f) {
+      if (n >= maxFilesToWarmInContentCache_) {
+        return false;
+      }
       if (f->otime.ticks <= lastWarmedTick_) {
         log(DBG,
             "warmContentCache: stop because file ticks ",
@@ -1205,7 +2987,7 @@ void InMemoryView::warmContentCache() {
             " is <= lastWarmedTick_ ",
             lastWarmedTick_,
             "\n");
-        break;
+        return false;
       }
 
       if (f->exists && f->stat.isFile()) {
@@ -1213,29 +2995,17 @@ void InMemoryView::warmContentCache() {
         // the things we warm up here.  Let's see if we need it before
         // going ahead and adding.
 
-        auto dirStr = f->parent->getFullPath();
-        w_string_piece dir(dirStr);
-        dir.advance(caches_.contentHashCache.rootPath().size());
-
-        // If dirName is the root, dir.size() will now be zero
-        if (dir.size() > 0) {
-          // if not at the root, skip the slash character at the
-          // front of dir
-          dir.advance(1);
-        }
-        ContentHashCacheKey key{
-            w_string::pathCat({dir, f->getName()}),
-            size_t(f->stat.size),
-            f->stat.mtime};
+        auto key = contentHashKeyFor(f, caches_.contentHashCache.rootPath());
 
         log(DBG, "warmContentCache: lookup ", key.relativePath, "\n");
-        auto f = caches_.contentHashCache.get(key);
+        auto future = caches_.contentHashCache.get(key, hashQueue.get());
         if (syncContentCacheWarming_) {
-          futures.emplace_back(std::move(f));
+          futures.emplace_back(std::move(future));
         }
         ++n;
       }
-    }
+      return true;
+    });
 
     lastWarmedTick_ = mostRecentTick_;
   }
@@ -1257,4 +3027,68 @@ void InMemoryView::warmContentCache() {
   }
 }
 
+void InMemoryView::warmMatchingContentCache() {
+  if (contentHashWarmGlobs_.empty()) {
+    return;
+  }
+
+  auto& stats = caches_.contentHashWarmStats;
+  auto hashQueue = getContentHashPool().makeQueue();
+  size_t n = 0;
+  bool full = false;
+
+  {
+    auto view = view_.rlock();
+    view->getRecencyIndex().forEachNewestFirst([&](watchman_file* f) {
+      if (f->otime.ticks <= lastEagerWarmedTick_) {
+        return false;
+      }
+      if (!f->exists || !f->stat.isFile()) {
+        return true;
+      }
+
+      auto key = contentHashKeyFor(f, caches_.contentHashCache.rootPath());
+      bool matched = std::any_of(
+          contentHashWarmGlobs_.begin(),
+          contentHashWarmGlobs_.end(),
+          [&](const w_string& glob) {
+            return wildmatch(
+                       glob.c_str(),
+                       key.relativePath.c_str(),
+                       contentHashWarmGlobFlags_,
+                       0) == WM_MATCH;
+          });
+      if (!matched) {
+        return true;
+      }
+
+      if (stats.pending.load(std::memory_order_relaxed) >=
+          maxPendingEagerWarm_) {
+        full = true;
+        return false;
+      }
+      ++stats.pending;
+      ++stats.queued;
+      caches_.contentHashCache.get(key, hashQueue.get())
+          .thenTry([&stats](auto&&) { --stats.pending; });
+      ++n;
+      return true;
+    });
+
+    // If we ran out of room, walk these files again next time; those that
+    // we already started on will be found in the cache.
+    if (!full) {
+      lastEagerWarmedTick_ = mostRecentTick_;
+    }
+  }
+
+  if (n || full) {
+    logf(
+        DBG,
+        "warmMatchingContentCache: scheduled {} files for hashing{}\n",
+        n,
+        full ? ", the rest must wait for room" : "");
+  }
+}
+
 } // namespace watchman
@@ -7,20 +7,36 @@
 
 #pragma once
 #include <folly/Synchronized.h>
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
 #include "watchman/ContentHash.h"
 #include "watchman/CookieSync.h"
+#include "watchman/HotFileDebouncer.h"
+#include "watchman/IoPriority.h"
+#include "watchman/Metrics.h"
+#include "watchman/MtimeIndex.h"
+#include "watchman/NodeArena.h"
+#include "watchman/PathComponentTable.h"
 #include "watchman/PendingCollection.h"
 #include "watchman/PerfSample.h"
 #include "watchman/QueryableView.h"
+#include "watchman/RecencyIndex.h"
+#include "watchman/SuffixIndex.h"
 #include "watchman/Result.h"
 #include "watchman/RingBuffer.h"
 #include "watchman/SymlinkTargets.h"
+#include "watchman/ThreadUsage.h"
 #include "watchman/WatchmanConfig.h"
+#include "watchman/fs/DirFdCache.h"
 #include "watchman/fs/DirHandle.h"
 #include "watchman/query/FileResult.h"
 #include "watchman/watchman_string.h"
@@ -33,6 +49,8 @@ namespace watchman {
 class FileSystem;
 class RootConfig;
 struct GlobTree;
+struct ReadDirResult;
+class SharedReactor;
 class Watcher;
 
 // Helper struct to hold caches used by the InMemoryView
@@ -40,28 +58,48 @@ struct InMemoryViewCaches {
   ContentHashCache contentHashCache;
   SymlinkTargetCache symlinkTargetCache;
 
+  // How well hashing content_hash_warm_globs files ahead of queries is
+  // keeping up, for debug-contenthash.
+  struct WarmStats {
+    // Lookups started by eager warming, and how many of them are still
+    // in progress
+    std::atomic<size_t> queued{0};
+    std::atomic<size_t> pending{0};
+    // Content hash lookups made by queries, and how many of them found
+    // the hash already computed
+    std::atomic<size_t> queryLookups{0};
+    std::atomic<size_t> queryHits{0};
+  };
+  WarmStats contentHashWarmStats;
+
   InMemoryViewCaches(
       const w_string& rootPath,
       size_t maxHashes,
       size_t maxSymlinks,
-      std::chrono::milliseconds errorTTL);
+      std::chrono::milliseconds errorTTL,
+      std::shared_ptr<ContentHashStore> hashStore = nullptr);
 };
 
 class InMemoryFileResult final : public FileResult {
  public:
   InMemoryFileResult(const watchman_file* file, InMemoryViewCaches& caches);
+  // Makes this a result for `file` as though it had just been constructed
+  void reset(const watchman_file* file);
   std::optional<FileInformation> stat() override;
   std::optional<struct timespec> accessedTime() override;
   std::optional<struct timespec> modifiedTime() override;
   std::optional<struct timespec> changedTime() override;
   std::optional<size_t> size() override;
   w_string_piece baseName() override;
+  std::optional<w_string_piece> foldedBaseName() override;
   w_string_piece dirName() override;
+  w_string_piece renderDirName(std::string& buffer) override;
   std::optional<bool> exists() override;
   std::optional<ResolvedSymlink> readLink() override;
   std::optional<ClockStamp> ctime() override;
   std::optional<ClockStamp> otime() override;
   std::optional<FileResult::ContentHash> getContentSha1() override;
+  std::optional<Identity> identity() override;
   void batchFetchProperties(
       const std::vector<std::unique_ptr<FileResult>>& files) override;
 
@@ -81,11 +119,84 @@ class InMemoryFileResult final : public FileResult {
 class ViewDatabase {
  public:
   explicit ViewDatabase(const w_string& root_path);
+  ~ViewDatabase();
+
+  ViewDatabase(const ViewDatabase&) = delete;
+  ViewDatabase& operator=(const ViewDatabase&) = delete;
 
   watchman_file* getLatestFile() const {
-    return latestFile_;
+    return recency_.newest();
+  }
+
+  /**
+   * The files of the view that exist, ordered by the time we last saw them
+   * change.
+   */
+  const RecencyIndex& getRecencyIndex() const {
+    return recency_;
+  }
+
+  /**
+   * The deleted files of the view, ordered by the time we saw them be
+   * deleted.  These are needed only by since queries, which report
+   * deletions, and by age-out, which prunes the oldest of them; keeping
+   * them apart spares the walks of the existing files from skipping past
+   * them.
+   */
+  const RecencyIndex& getTombstoneIndex() const {
+    return tombstones_;
+  }
+
+  RecencyIndex::Stats getRecencyStats() const {
+    return recency_.getStats();
+  }
+
+  RecencyIndex::Stats getTombstoneStats() const {
+    return tombstones_.getStats();
   }
 
+  /**
+   * Starts maintaining a SuffixIndex of the files in the view.  Must be
+   * called before any files are created.
+   */
+  void enableSuffixIndex();
+
+  /** Returns the SuffixIndex, or nullptr if it isn't enabled. */
+  const SuffixIndex* getSuffixIndex() const {
+    return suffixIndex_.get();
+  }
+
+  /**
+   * Starts maintaining an MtimeIndex of the existing files in the view.
+   * Must be called before any files are created.
+   */
+  void enableMtimeIndex();
+
+  /** Returns the MtimeIndex, or nullptr if it isn't enabled. */
+  const MtimeIndex* getMtimeIndex() const {
+    return mtimeIndex_.get();
+  }
+
+  /**
+   * Makes the arena map the file and dir nodes from a file at path, which
+   * the kernel can page them out to.  Must be called before any files are
+   * created.  Throws std::system_error if the file can't be made.
+   */
+  void enableFileBackedNodes(const std::string& path);
+
+  /**
+   * Makes the recency index keep FileColumns for the files in it.  Must be
+   * called before any files are created.
+   */
+  void enableFileColumns();
+
+  /**
+   * Makes each file node keep a case folded copy of its name, for roots on
+   * case insensitive filesystems.  Must be called before any files are
+   * created.
+   */
+  void enableFoldedNames();
+
   ino_t getRootInode() const {
     return rootInode_;
   }
@@ -94,10 +205,24 @@ class ViewDatabase {
     rootInode_ = ino;
   }
 
+  watchman_dir* getRootDir() {
+    return rootDir_.get();
+  }
+
+  const watchman_dir* getRootDir() const {
+    return rootDir_.get();
+  }
+
   watchman_dir* resolveDir(const w_string& dirname, bool create);
 
   const watchman_dir* resolveDir(const w_string& dirname) const;
 
+  /**
+   * Returns the direct child dir named name if it already exists, else creates
+   * that entry and returns it.
+   */
+  watchman_dir* getOrCreateChildDir(watchman_dir* dir, w_string_piece name);
+
   /**
    * Returns the direct child file named name if it already exists, else creates
    * that entry and returns it.
@@ -108,12 +233,56 @@ class ViewDatabase {
       const w_string& file_name,
       ClockStamp ctime);
 
+  /**
+   * Removes file from its parent dir, which frees the file node.
+   */
+  void eraseChildFile(watchman_file* file);
+
+  /**
+   * Removes the child dir named name from parent, which frees it along with
+   * every node below it.
+   */
+  void eraseChildDir(watchman_dir* parent, w_string_piece name);
+
+  /**
+   * Frees the dirs below the root that have no files or dirs left, aren't
+   * known to exist, and in whose subtree nothing changed after the tick
+   * agedBefore.  Age-out leaves such dirs behind when their own entries
+   * were aged out before their contents, or when a late event for a path
+   * under a deleted dir made them anew.  Returns the number freed.
+   */
+  size_t eraseEmptyDeletedDirs(ClockTicks agedBefore);
+
   /**
    * Updates the otime for the file and bubbles it to the front of recency
    * index.
    */
   void markFileChanged(Watcher& watcher, watchman_file* file, ClockStamp otime);
 
+  /**
+   * A run of new files that a crawl attaches to the recency index in one
+   * step with spliceAtHeadOfFileList.
+   */
+  using FileListBatch = RecencyIndex::Batch;
+
+  /**
+   * Like markFileChanged, but links a newly created file into batch rather
+   * than into the recency index.
+   */
+  void markFileChanged(
+      FileListBatch& batch,
+      Watcher& watcher,
+      watchman_file* file,
+      ClockStamp otime);
+
+  /**
+   * Moves all the files in batch to the recent end of the recency index.
+   * This costs one step per RecencyIndex::kChunkSize files.
+   */
+  void spliceAtHeadOfFileList(FileListBatch& batch) {
+    recency_.splice(batch);
+  }
+
   /**
    * Mark a directory as being removed from the view. Marks the contained set of
    * files as deleted. If recursive is true, is recursively invoked on child
@@ -125,16 +294,95 @@ class ViewDatabase {
       ClockStamp otime,
       bool recursive);
 
+  /**
+   * Gives dest an entry for each existing file and dir below src, with the
+   * stat last recorded for it, as though they had all been created at
+   * otime.  This is how a renamed dir is known at its new path without
+   * being read again.  dest must not hold any existing files, and src is
+   * left as it was for the caller to mark deleted.  Returns the number of
+   * files copied.
+   */
+  size_t copyTree(
+      Watcher& watcher,
+      const watchman_dir* src,
+      watchman_dir* dest,
+      ClockStamp otime);
+
+  /**
+   * Returns arena slabs that no longer hold any nodes to the system.
+   * Intended to be called after age-out has pruned the tree.
+   */
+  size_t compactArena() {
+    return arena_.releaseEmptySlabs();
+  }
+
+  const NodeArena::Stats& getArenaStats() const {
+    return arena_.getStats();
+  }
+
+  /**
+   * Drops interned dir names that are no longer used by any dir.
+   * Returns the number of names released.
+   */
+  size_t compactPathComponents() {
+    return components_.releaseUnused();
+  }
+
+  /**
+   * Reclaims the recency index slots of files that have changed again or
+   * been deleted since.  Returns the number of slots reclaimed.
+   */
+  size_t compactRecencyIndex() {
+    return recency_.compact() + tombstones_.compact();
+  }
+
+  /**
+   * Frees every node below the root dir, and returns the memory that they
+   * and the indexes held to the system.  Used when the view hibernates.
+   */
+  void clear();
+
+  const PathComponentTable::Stats& getPathComponentStats() const {
+    return components_.getStats();
+  }
+
  private:
-  void insertAtHeadOfFileList(struct watchman_file* file);
+  watchman_dir* createChildDir(
+      watchman_dir* parent,
+      w_string_piece child_name);
+
+  size_t copyTree(
+      FileListBatch& batch,
+      Watcher& watcher,
+      const watchman_dir* src,
+      watchman_dir* dest,
+      ClockStamp otime);
 
   const w_string rootPath_;
 
-  /* the most recently changed file */
-  watchman_file* latestFile_ = nullptr;
+  // Shared storage for the names of the dirs below rootDir_.
+  PathComponentTable components_;
+
+  // Storage for every watchman_dir and watchman_file below rootDir_.
+  // Must be declared before rootDir_ so that it outlives the tree.
+  NodeArena arena_;
+
+  // Order the existing and the deleted files by changed time.  Declared
+  // before rootDir_ since the file nodes refer to their slots in them.
+  RecencyIndex recency_;
+  RecencyIndex tombstones_;
 
   std::unique_ptr<watchman_dir> rootDir_;
 
+  // Files by suffix, if enabled by the suffix_index config option.
+  std::unique_ptr<SuffixIndex> suffixIndex_;
+
+  // Existing files by mtime, if enabled by the mtime_index config option.
+  std::unique_ptr<MtimeIndex> mtimeIndex_;
+
+  // Whether file nodes are made with a case folded copy of their name.
+  bool foldNames_{false};
+
   // Inode number for the root dir.  This is used to detect what should
   // be impossible situations, but is needed in practice to workaround
   // eg: BTRFS not delivering all events for subvolumes
@@ -170,6 +418,8 @@ class InMemoryView final : public QueryableView {
   }
 
   void ageOut(PerfSample& sample, std::chrono::seconds minAge) override;
+  bool ageOutStep(PerfSample& sample, std::chrono::seconds minAge) override;
+  bool isAgeOutInProgress() const override;
 
   folly::SemiFuture<folly::Unit> waitForSettle(
       std::chrono::milliseconds settle_period) override;
@@ -197,6 +447,15 @@ class InMemoryView final : public QueryableView {
 
   void allFilesGenerator(const Query* query, QueryContext* ctx) const override;
 
+  bool supportsQueryResultCache() const override {
+    return true;
+  }
+
+  void changedFilesGenerator(
+      const Query* query,
+      QueryContext* ctx,
+      ClockTicks sinceTicks) const override;
+
   /**
    * Returns a SemiFuture that completes when any pending recrawls are
    * completed. The primary use of this is so that "watch-project" doesn't send
@@ -210,8 +469,34 @@ class InMemoryView final : public QueryableView {
   void startThreads(const std::shared_ptr<Root>& root) override;
   void stopThreads() override;
   void wakeThreads() override;
+  bool recrawlSubtree(const w_string& path) override;
+  void crawlDeferredDirs(const Query* query) override;
+  void rehydrate() override;
+  json_ref relieveMemoryPressure() override;
+  bool waitUntilCrawledFor(
+      const Query* query,
+      std::chrono::milliseconds timeout) override;
+  std::optional<w_string> getRecentChangeScope() const override;
+  size_t exportViewSnapshot(const w_string& path) override;
   void clientModeCrawl(const std::shared_ptr<Root>& root);
 
+  /**
+   * The disk I/O priority for reading dirs in a full crawl: idle if
+   * crawl_io_priority asks for it and nothing is waiting on the crawl.
+   */
+  IoPriority crawlIoPriority() const {
+    return idleCrawl_ && !crawlBoosted_.load(std::memory_order_relaxed)
+        ? IoPriority::Idle
+        : IoPriority::Normal;
+  }
+
+  /**
+   * Called before reading each dir in a full crawl, from the IO thread or
+   * the parallel crawl threads.  Applies crawlIoPriority() to the calling
+   * thread and waits as needed to stay within crawl_max_dirs_per_sec.
+   */
+  void paceCrawl();
+
   const w_string& getName() const override;
   const std::shared_ptr<Watcher>& getWatcher() const;
   json_ref getWatcherDebugInfo() const override;
@@ -219,9 +504,48 @@ class InMemoryView final : public QueryableView {
   json_ref getViewDebugInfo() const;
   void clearViewDebugInfo();
 
+  // Reports the memory held by the node arena and the interned dir names of
+  // the ViewDatabase.
+  json_ref getArenaDebugInfo() const;
+
+  /**
+   * Estimates of the bytes held by each part of this view, for attributing
+   * the daemon's heap to roots.  They count the fixed size of each node,
+   * entry and item, so they undercount where those point to strings or
+   * values allocated separately.
+   */
+  struct MemoryUsage {
+    // The node arena
+    size_t viewNodes{0};
+    // The interned dir names
+    size_t pathComponents{0};
+    // The recency, tombstone and suffix indexes
+    size_t indexes{0};
+    // Changes waiting for the IO thread
+    size_t pending{0};
+    // The content hash and symlink target caches
+    size_t caches{0};
+  };
+  MemoryUsage getMemoryUsage() const;
+
+  // The CPU time used by this view's own notify and IO threads, where the
+  // platform can tell; nullopt while they aren't running, or when they are
+  // shared with other roots
+  std::optional<std::chrono::microseconds> getNotifyThreadCpuTime() const {
+    return notifyThreadClock_.read();
+  }
+  std::optional<std::chrono::microseconds> getIoThreadCpuTime() const {
+    return ioThreadClock_.read();
+  }
+
   // If content cache warming is configured, do the warm up now
   void warmContentCache();
 
+  // If content_hash_warm_globs is configured, start hashing the matching
+  // files that changed since the last call.  Called by the IO thread
+  // without the view lock held.
+  void warmMatchingContentCache();
+
   InMemoryViewCaches& debugAccessCaches() const {
     return caches_;
   }
@@ -231,17 +555,128 @@ class InMemoryView final : public QueryableView {
       const std::shared_ptr<Root>& root,
       std::chrono::milliseconds timeout);
 
+  // A result for a candidate file, reusing ctx's spare one when it has one
+  std::unique_ptr<FileResult> makeFileResult(
+      QueryContext* ctx,
+      const watchman_file* file) const;
+
+  // Evaluates the files of index in numShards parallel shards; the guts of
+  // allFilesGenerator for large views.  With filter, the files that it rules
+  // out are skipped, and with anchor, those outside of that dir.
+  void allFilesGeneratorParallel(
+      const RecencyIndex& index,
+      const Query* query,
+      QueryContext* ctx,
+      size_t numShards,
+      const ColumnFilter* filter,
+      const watchman_dir* anchor) const;
+
+  // Returns the bounds that the query's expression puts on the columns of
+  // the files of index, or nullopt if there are no columns or no bounds.
+  std::optional<ColumnFilter> getColumnFilter(
+      const RecencyIndex& index,
+      const Query* query,
+      QueryContext* ctx) const;
+
+  // Calls evaluateShard for each of numShards contexts made by
+  // ctx->makeShard(), the first on the calling thread and the others on the
+  // query executor, then merges them into ctx in order.
+  void generateInShards(
+      QueryContext* ctx,
+      size_t numShards,
+      const std::function<void(QueryContext* shardCtx, size_t i)>&
+          evaluateShard) const;
+
   // Returns the erased file's otime.
   ClockStamp ageOutFile(
+      ViewDatabase& view,
       std::unordered_set<w_string>& dirs_to_erase,
       watchman_file* file);
 
+  /**
+   * The progress of an age-out through the tombstone index.  Nothing but
+   * the position is remembered between steps: the index is in deletion
+   * order, so the sweep visits the oldest tombstones first and ends at the
+   * first one that is too young to age out.
+   */
+  struct AgeOutSweep {
+    bool active{false};
+    std::chrono::system_clock::time_point started;
+    // The tombstone index chunk to visit next.  Compaction of the index
+    // between steps moves files to lower chunks, so some may be passed
+    // over; the next sweep gets them.
+    size_t nextChunk{0};
+    // Totals since the sweep began
+    size_t steps{0};
+    size_t walked{0};
+    size_t files{0};
+    size_t dirs{0};
+  };
+
+  // Visits up to ageOutMaxFilesPerStep_ files of the tombstone index under
+  // the view lock.  Returns true if this completed the sweep.
+  bool ageOutStep(
+      AgeOutSweep& sweep,
+      PerfSample& sample,
+      std::chrono::seconds minAge);
+
+  // globGenerator for suffix generator queries, answered from the suffix
+  // index.  Returns false if the query's suffixes can't be looked up in it.
+  bool suffixGenerator(
+      const ViewDatabase& view,
+      const watchman_dir* dir,
+      const Query* query,
+      QueryContext* ctx) const;
+
   // When a watcher is desynced, it sets the W_PENDING_IS_DESYNCED flag, and the
   // crawler will set these recursively. If one of these flag is set,
   // processPending will return IsDesynced::Yes and it is expected that the
   // caller will abort all pending cookies after processAllPending returns.
   enum class IsDesynced { Yes, No };
 
+  /**
+   * Recursively walks the files under dir that changed after sinceTicks,
+   * skipping subtrees whose subtreeTicks say that nothing in them did.
+   */
+  void changedSubtreeGenerator(
+      const Query* query,
+      QueryContext* ctx,
+      const watchman_dir* dir,
+      ClockTicks sinceTicks) const;
+  /**
+   * allFilesGenerator for queries whose expression can only match a list
+   * of wholenames, answered by looking each of them up.  Returns false if
+   * the expression has no such list, or one too long to be worth it.
+   */
+  bool wholeNameGenerator(
+      const ViewDatabase& view,
+      const Query* query,
+      QueryContext* ctx) const;
+  /**
+   * The dirs below which the glob upper bound of the query's expression
+   * puts every file that it may match, or nullopt if the bound doesn't
+   * narrow the walk below the query's relative root.
+   */
+  std::optional<std::vector<const watchman_dir*>> getGlobUpperBoundDirs(
+      const ViewDatabase& view,
+      const Query* query,
+      QueryContext* ctx) const;
+  /** Recursively walks the existing files under dir */
+  void subtreeGenerator(
+      const Query* query,
+      QueryContext* ctx,
+      const watchman_dir* dir) const;
+  /**
+   * allFilesGenerator for queries whose expression can only match dirs.
+   * Recursively walks the dir nodes under dir, rather than its files.  The
+   * crawler makes no nodes for the dirs in vcsDirs, so their files are
+   * scanned for dirs instead.
+   */
+  void subdirsGenerator(
+      const Query* query,
+      QueryContext* ctx,
+      const watchman_dir* dir,
+      const std::unordered_set<const watchman_dir*>& vcsDirs) const;
   /** Recursively walks files under a specified dir */
   void dirGenerator(
       const Query* query,
@@ -261,25 +696,74 @@ class InMemoryView final : public QueryableView {
 
   void notifyThread(const std::shared_ptr<Root>& root);
 
+  // Starts the watcher, handing what a resumed watcher has replayed to the
+  // IO side through `fromWatcher`.  Returns false, having cancelled the
+  // root, if it could not be started.
+  bool startWatcher(
+      const std::shared_ptr<Root>& root,
+      std::unique_ptr<PendingChanges>& fromWatcher);
+
+  // Called once the watcher has notifications: consumes up to a batch of
+  // them into `fromWatcher` and hands it off to the IO side.
+  void consumeNotifications(
+      const std::shared_ptr<Root>& root,
+      std::unique_ptr<PendingChanges>& fromWatcher);
+
+  // Spawns the notify thread and waits for it to start the watcher.
+  void startNotifyThread(const std::shared_ptr<Root>& root);
+
+  // Drives this root from the SharedReactor's threads.  Defined in
+  // root/reactor.cpp.
+  class ReactorTask;
+  void startSharedThreads(
+      const std::shared_ptr<Root>& root,
+      SharedReactor& reactor);
+
   // BEGIN IOTHREAD
 
   void ioThread(const std::shared_ptr<Root>& root);
 
+  // The longest the IO side waits for changes before checking on the root.
+  std::chrono::milliseconds getBiggestIoTimeout(const Root& root) const;
+
   // Consume entries from `pending` and apply them to the InMemoryView. Any new
   // pending paths generated by processPath will be crawled before
   // processAllPending returns.
+  //
+  // If yieldViewLock is set, it is called between pending items once the
+  // view lock has been held for viewLockMaxHold_ or for viewLockMaxHoldItems_
+  // items, so that queries can run in the middle of a large batch.  It must
+  // release and reacquire the lock and advance the tick, so that the files
+  // changed after a query observed the view are reported to a later query
+  // using that query's clock.  Cookies and syncs are still only resolved
+  // once the whole batch has been applied.
   IsDesynced processAllPending(
       const std::shared_ptr<Root>& root,
       ViewDatabase& view,
-      PendingChanges& pending);
+      PendingChanges& pending,
+      const std::function<void()>& yieldViewLock = nullptr);
 
+  // If parentDir is set, it must be the resolved parent of pending.path and
+  // saves statPath from resolving it again.
   void processPath(
       const std::shared_ptr<Root>& root,
       ViewDatabase& view,
       PendingChanges& coll,
       const PendingChange& pending,
       const FileInformation* pre_stat,
-      std::vector<w_string>& pendingCookies);
+      std::vector<w_string>& pendingCookies,
+      watchman_dir* parentDir = nullptr);
+
+  /**
+   * Reads dirPath once and fills in the stats of those of its children that
+   * are keys of `stats`, for a batch of changes to many siblings.  Only the
+   * DirHandles that report stats alongside names make this worthwhile; once
+   * one doesn't, later scans are skipped.
+   */
+  void scanDirForSiblings(
+      const w_string& dirPath,
+      std::unordered_map<w_string_piece, std::optional<FileInformation>>&
+          stats);
 
   /**
    * Crawl the given directory. Any cookies discovered during the crawl are
@@ -310,6 +794,25 @@ class InMemoryView final : public QueryableView {
       const PendingChange& pending,
       std::vector<w_string>& pendingCookies);
 
+  /**
+   * Populates dir, which must not have any files yet, from a ParallelWalker
+   * result in one pass. This is equivalent to calling statPath for each
+   * entry but skips the work that only matters for nodes we already know
+   * about: resolving the parent from the root, rebuilding the full path
+   * from the parent chain and comparing against the previous stat.
+   * Cookie files are still routed through processPath.
+   */
+  void spliceNewDirEntries(
+      const std::shared_ptr<Root>& root,
+      ViewDatabase& view,
+      PendingChanges& coll,
+      watchman_dir* dir,
+      const w_string& dirPath,
+      ReadDirResult& dirResult,
+      const PendingChange& pending,
+      PendingFlags inheritFlags,
+      std::vector<w_string>& pendingCookies);
+
   /**
    * Called on the IO thread. If `pending` is not in the ignored directory list,
    * lstat() the file and update the InMemoryView. This may insert work into
@@ -321,7 +824,80 @@ class InMemoryView final : public QueryableView {
       ViewDatabase& view,
       PendingChanges& coll,
       const PendingChange& pending,
-      const FileInformation* pre_stat);
+      const FileInformation* pre_stat,
+      watchman_dir* parentDir = nullptr);
+
+  /**
+   * Called on the IO thread for a dir rename that the watcher paired up.
+   * Once a stat of both paths confirms it, the entries below move.from are
+   * copied to move.to from what the view already knows, and marked deleted
+   * at move.from, instead of move.to being crawled.  Otherwise, a recursive
+   * crawl of move.to is queued.  Returns whether the rename was applied.
+   */
+  bool reparentDir(
+      const std::shared_ptr<Root>& root,
+      ViewDatabase& view,
+      PendingChanges& coll,
+      const PendingMove& move);
+
+  /**
+   * Called on the IO thread when statPath sees a symlink change, if
+   * symlink_target_capture is enabled. Reads the target of the link at
+   * `path` and stores it in the symlink target cache under `otime`, so
+   * that queries for symlink_target find it there.
+   */
+  void captureSymlinkTarget(const w_string& path, ClockStamp otime);
+
+  /**
+   * Whether path is lazy_crawl_depth or more levels below the root, and so
+   * is left uncrawled by a lazy crawl.
+   */
+  bool isBeyondLazyCrawlDepth(w_string_piece path) const;
+
+  /**
+   * Called on the IO thread when the root settles: queues the crawl of one
+   * of the dirs whose crawl was deferred, if any remain.
+   */
+  void crawlNextDeferredDir();
+
+  /**
+   * Called on the IO thread when the root settles: once every
+   * sanity_audit_interval_ms, compares the next sanity_audit_dirs dirs of
+   * a rotating walk of the tree with what is on disk, at idle disk I/O
+   * priority, and recrawls those that the view has fallen out of step with.
+   */
+  void auditNextDirs(Root& root);
+
+  /**
+   * Whether the background work of the IO thread, such as age-out, hashing
+   * content ahead of time, crawling deferred dirs and sanity audits, should
+   * wait because one of the states named by background_work_defer_states is
+   * asserted on the root.
+   */
+  bool isBackgroundWorkDeferred(Root& root);
+
+  /**
+   * Compares the entries of dirPath on disk with those in the view, and
+   * appends the subdirs to audit after it to subdirs.  Returns whether any
+   * entry that has been stable for a while differs.
+   */
+  bool auditDir(
+      Root& root,
+      const w_string& dirPath,
+      std::vector<w_string>& subdirs);
+
+  /**
+   * Called on the IO thread as a recursive crawl of path is queued or
+   * finished, to track which dirs the initial crawl has yet to get to.
+   */
+  void addToCrawlFrontier(const w_string& path);
+  void removeFromCrawlFrontier(const w_string& path);
+
+  /**
+   * Stops tracking the crawl frontier, if it is being tracked, and wakes the
+   * queries waiting on it.
+   */
+  void stopTrackingCrawlFrontier();
 
   // END IOTHREAD
 
@@ -345,6 +921,27 @@ class InMemoryView final : public QueryableView {
 
     // When the iothread last processed a pending event from the Watcher.
     std::optional<std::chrono::steady_clock::time_point> lastUnsettle;
+
+    // Recent rate of changes from the Watcher, in changes per second.  Only
+    // sampled when the root uses adaptive settling.
+    double eventRate{0};
+
+    // When false, stepIoThread takes whatever the watcher has queued rather
+    // than waiting for it, for callers that wait for pings and timeouts
+    // themselves.
+    bool waitForEvents{true};
+
+    // Set by stepIoThread once it has taken the watcher's queued changes.
+    bool drained{false};
+
+    // When the oldest of the batches that the notify thread handed over,
+    // and that haven't been processed yet, was handed over.
+    std::optional<std::chrono::system_clock::time_point> handedOff;
+
+    // The times of the oldest change handed over since the root last
+    // settled, reported with the next settle; see ChangeTimes.
+    std::optional<ChangeTimes> changeTimes;
+    bool changeTimesProcessed{false};
   };
 
   // Returns a reference to the ViewDatabase without synchronizing on the mutex.
@@ -365,15 +962,61 @@ class InMemoryView final : public QueryableView {
       PendingCollection& pendingFromWatcher);
 
  private:
+  // Called once stepIoThread has stopped: flushes the caches and persists
+  // or discards the view.
+  void finishIoThread(const std::shared_ptr<Root>& root, IoThreadState& state);
+
   void fullCrawl(
       const std::shared_ptr<Root>& root,
       PendingCollection& pendingFromWatcher,
       PendingChanges& localPending);
 
+  // If view snapshots are enabled, pre-populate `view` from the snapshot
+  // written by a prior instance of the daemon.  Called at the start of the
+  // initial crawl, which then revalidates the loaded nodes.  Returns true if
+  // a snapshot was loaded.
+  bool loadViewSnapshot(ViewDatabase& view);
+
+  // If view_snapshot_seed names a snapshot, pre-populate `view` from it.
+  // Called at the start of the initial crawl when there is no snapshot of
+  // this root's own.  The seeded view is trusted, and is verified by a crawl
+  // that runs after the root is ready.  Returns true if it was loaded.
+  bool loadSeedSnapshot(ViewDatabase& view);
+
+  // If view snapshots are enabled, persist the current view so that it can
+  // be restored by loadViewSnapshot after a restart.  crawled is true if the
+  // view is up to date with everything the IO thread has been given; only
+  // then is the watcher's resume token recorded with it.
+  void saveViewSnapshot(bool crawled);
+
   // Performs settle-time actions.
   // Returns whether the root was reaped and the IO thread should terminate.
   Continue doSettleThings(Root& root, IoThreadState& state);
 
+  /**
+   * Called on the IO thread when the root settles: if no client has used
+   * the root for hibernate_age_seconds, writes the view to
+   * hibernationPath() and frees it.  Returns whether it did.
+   */
+  bool considerHibernate(Root& root);
+
+  /**
+   * Called on the IO thread while the view hibernates, once the watcher's
+   * latest changes are in state.localPending.  Holds on to them until a
+   * client wants the view back, then reloads the view and returns nullopt,
+   * so that the changes are applied on top of it as usual.  Otherwise
+   * returns what the IO thread should do next.
+   */
+  std::optional<Continue> stepHibernating(
+      const std::shared_ptr<Root>& root,
+      IoThreadState& state);
+
+  /** Asks the IO thread to bring the view back, if it is hibernating. */
+  void requestRehydrate();
+
+  /** Where the view is kept while it hibernates, or empty if nowhere. */
+  w_string hibernationPath() const;
+
   FileSystem& fileSystem_;
   const Configuration config_;
 
@@ -388,6 +1031,9 @@ class InMemoryView final : public QueryableView {
   // This is system_clock instead of steady_clock because it's compared with a
   // file's otime.
   std::chrono::system_clock::time_point lastAgeOutTimestamp_{};
+  folly::Synchronized<AgeOutSweep, std::mutex> ageOutSweep_;
+  // How many files one step of an age-out may visit; zero means no limit
+  size_t ageOutMaxFilesPerStep_{16384};
 
   using PendingSettles =
       std::multimap<std::chrono::milliseconds, folly::Promise<folly::Unit>>;
@@ -408,8 +1054,23 @@ class InMemoryView final : public QueryableView {
    */
   PendingCollection pendingFromWatcher_;
 
+  // How long the changes that getRecentChangeScope() covers go back
+  static constexpr std::chrono::seconds kRecentChangeWindow{30};
+  struct RecentChanges {
+    // The deepest directory containing every path notified since
+    // windowStart, not counting cookies
+    std::optional<w_string> scope;
+    std::chrono::steady_clock::time_point windowStart;
+  };
+  // Updated by the IO thread after each batch of notifications.  Read by
+  // the notify thread when a watcher needs a recrawl.
+  folly::Synchronized<RecentChanges> recentChanges_;
+
   std::atomic<bool> stopThreads_{false};
   std::shared_ptr<Watcher> watcher_;
+  // Should syncToNow flush a WATCHER_CAN_SYNC_BY_FLUSHING watcher rather
+  // than write a cookie file?
+  bool syncByFlushing_{false};
 
   // mutable because we pass a reference to other things from inside
   // const methods
@@ -424,6 +1085,177 @@ class InMemoryView final : public QueryableView {
   bool syncContentCacheWarming_{false};
   // Remember what we've already warmed up
   uint32_t lastWarmedTick_{0};
+  // Files matching these patterns are hashed as soon as they change,
+  // rather than when the root settles
+  std::vector<w_string> contentHashWarmGlobs_;
+  // The states, such as hg.update, during which the IO thread defers its
+  // background work; see isBackgroundWorkDeferred
+  std::vector<w_string> backgroundWorkDeferStates_;
+  // How many times the IO thread has deferred its background work
+  std::atomic<uint64_t> backgroundWorkDeferrals_{0};
+  // The CPUs that the notify and IO threads are pinned to, and that the
+  // thread pool workers move to while evaluating query shards for this
+  // root; empty to let them run anywhere
+  std::vector<unsigned> notifyThreadCpus_;
+  std::vector<unsigned> ioThreadCpus_;
+  std::vector<unsigned> queryWorkerCpus_;
+  ThreadCpuClock notifyThreadClock_;
+  ThreadCpuClock ioThreadClock_;
+  int contentHashWarmGlobFlags_{0};
+  // Limit on the eagerly warmed lookups that may be in progress at once
+  size_t maxPendingEagerWarm_{0};
+  // Remember what we've already warmed up eagerly
+  uint32_t lastEagerWarmedTick_{0};
+  // Should statPath read the targets of symlinks as they change?
+  bool captureSymlinkTargets_{false};
+
+#ifndef _WIN32
+  // With dir_fd_cache_size, the dirs that statPath examines files in
+  // relative to; null if disabled.  Only accessed by the IO thread.
+  std::unique_ptr<DirFdCache> dirFdCache_;
+#endif
+  // Whether the stats of the crawl in progress may come from a network
+  // filesystem's cached attributes.  Only used by the IO thread.
+  bool crawlStatsDontSync_{false};
+
+  // Should we persist the view across daemon restarts?
+  bool enableViewSnapshot_{false};
+  // A snapshot exported by another daemon to seed the view from
+  w_string seedSnapshotPath_;
+  // How long a root goes without clients before its view hibernates;
+  // zero never hibernates it
+  std::chrono::seconds hibernateAge_{0};
+  // Whether the view is written out to hibernationPath() and freed.  Only
+  // changed by the IO thread.
+  std::atomic<bool> hibernating_{false};
+  // Set when a client wants a hibernating view back
+  std::atomic<bool> rehydrateRequested_{false};
+  std::atomic<size_t> hibernationCount_{0};
+  // Dir renames applied by reparentDir, and those it left to a crawl
+  std::atomic<size_t> reparentedDirs_{0};
+  std::atomic<size_t> reparentFallbacks_{0};
+
+  // How often the settled IO thread audits a slice of the tree against
+  // the disk, and how many dirs it audits each time; a zero interval turns
+  // auditing off
+  std::chrono::milliseconds sanityAuditInterval_{0};
+  size_t sanityAuditDirs_{32};
+  // The dirs to audit next, in the order of a breadth first walk that
+  // starts again at the root once it is done.  Only used by the IO thread.
+  std::deque<w_string> sanityAuditQueue_;
+  std::chrono::steady_clock::time_point lastSanityAudit_;
+  struct SanityAuditStats {
+    std::atomic<size_t> passes{0};
+    std::atomic<size_t> dirs{0};
+    std::atomic<size_t> entries{0};
+    // Entries that differed from the disk, and the recrawls that followed
+    std::atomic<size_t> discrepancies{0};
+    std::atomic<size_t> recrawls{0};
+  };
+  SanityAuditStats sanityAuditStats_;
+  // Whether this root's threads are those of the SharedReactor, and whether
+  // its watcher is waited on by the reactor rather than a notify thread
+  std::atomic<bool> sharedIo_{false};
+  std::atomic<bool> sharedNotify_{false};
+  // Should recrawls skip enumerating dirs whose mtime is unchanged?
+  bool fastRevalidateCrawl_{false};
+  // How long the IO thread may hold the view lock while processing a batch
+  // before letting queries in; zero holds it for the whole batch
+  std::chrono::milliseconds viewLockMaxHold_{100};
+  // How many pending items the IO thread may process before letting queries
+  // in; zero means no limit
+  size_t viewLockMaxHoldItems_{0};
+  // How many changed siblings make processAllPending read their directory
+  // once for all of their stats; zero stats each one separately
+  size_t dirScanMinSiblings_{16};
+  // Limits how often the IO thread stats files that keep changing; only
+  // used by the IO thread
+  HotFileDebouncer hotFiles_{std::chrono::milliseconds{0}};
+  // Copies of hotFiles_'s counts for getWatcherDebugInfo
+  std::atomic<size_t> hotFilesHeld_{0};
+  std::atomic<uint64_t> debouncedChanges_{0};
+  // Changes within the scopes of subscriptions that processAllPending
+  // processed ahead of the rest of their batch
+  std::atomic<uint64_t> prioritizedChanges_{0};
+  // How long to sleep before processing each batch of notifications; see
+  // processPending
+  std::chrono::milliseconds notifySleep_{0};
+  // The entries that a crawled dir is expected to hold per child dir
+  uint32_t hintNumFilesPerDir_{64};
+  // Cleared once a directory read turns out not to report stats.  Only
+  // accessed by the IO thread.
+  bool dirScanYieldsStats_{true};
+
+  // How long processAllPending held the view lock at a time, counted in
+  // power of two millisecond buckets: <1ms, <2ms, ... <1024ms, >=1024ms
+  struct ViewLockHolds {
+    static constexpr size_t kBuckets = 12;
+    std::array<uint64_t, kBuckets> counts{};
+    // How many times the lock was released in the middle of a batch
+    uint64_t yields{0};
+    std::chrono::milliseconds longest{0};
+
+    void record(std::chrono::steady_clock::duration held);
+    json_ref asJsonValue() const;
+  };
+  folly::Synchronized<ViewLockHolds> viewLockHolds_;
+  // The watcher's resume token as of the last batch of notifications that
+  // was handed off to pendingFromWatcher_.  Guarded by pendingFromWatcher_'s
+  // lock: once that collection is empty and processed, every change up to
+  // this token is reflected in the view.
+  w_string appendedResumeToken_;
+
+  // Whether all-files queries walk only the subtrees that the glob upper
+  // bound of their expression allows
+  bool enableGlobUpperBounds_{false};
+
+  // How many shards to split an all-files or path query into; 0 or 1
+  // evaluate it on the client thread
+  size_t queryParallelism_{0};
+  // Views with fewer files than this are always queried serially
+  size_t queryParallelMinFiles_{65536};
+
+  // The initial crawl leaves dirs this many or more levels below the root
+  // uncrawled and unwatched; zero crawls everything
+  size_t lazyCrawlDepth_{0};
+  // Whether the crawl in progress is deferring dirs per lazyCrawlDepth_.
+  // Only used by the IO thread.
+  bool lazyCrawling_{false};
+  // The dirs whose crawl was deferred, until a query needs one of them or
+  // the IO thread gets to it while the root is settled
+  folly::Synchronized<std::unordered_set<w_string>> deferredDirs_;
+
+  // Whether queries may be answered during the initial crawl, once it has
+  // crawled the dirs they look in
+  bool partialCrawlQueries_{false};
+  // Whether the crawl in progress maintains crawlFrontier_, which is set up
+  // for the initial crawl when the view is created.  Only used by the IO
+  // thread.
+  bool trackingCrawlFrontier_{false};
+  struct CrawlFrontier {
+    // Whether the initial crawl is running and maintaining dirs
+    bool tracking{false};
+    // The dirs queued for a recursive crawl and not yet crawled.  A dir is
+    // fully crawled once neither it, anything below it nor any of its
+    // parents is in here.
+    std::unordered_multiset<w_string> dirs;
+  };
+  folly::Synchronized<CrawlFrontier, std::mutex> crawlFrontier_;
+  // Notified as dirs leave crawlFrontier_
+  std::condition_variable crawlFrontierCond_;
+
+  // Whether full crawls read dirs at idle disk I/O priority
+  bool idleCrawl_{false};
+  // The most dirs per second that a full crawl reads; zero for no limit
+  size_t crawlMaxDirsPerSec_{0};
+  // Whether a full crawl is running, and so subject to the above
+  std::atomic<bool> pacingCrawl_{false};
+  // Set when something waits on the full crawl in progress, which then
+  // runs at full speed until it is done
+  std::atomic<bool> crawlBoosted_{false};
+  // When the next dir read by a paced crawl may start, in steady_clock
+  // nanoseconds
+  std::atomic<int64_t> nextCrawlSlot_{0};
 
   struct PendingChangeLogEntry {
     PendingChangeLogEntry() noexcept {
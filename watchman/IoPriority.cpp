@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/IoPriority.h"
+#include "watchman/Logging.h"
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+namespace watchman {
+
+namespace {
+
+#ifdef __linux__
+// From linux/ioprio.h, which glibc doesn't wrap
+constexpr int kIoprioWhoProcess = 1;
+constexpr int kIoprioClassShift = 13;
+constexpr int kIoprioClassBe = 2;
+constexpr int kIoprioClassIdle = 3;
+// The best effort class defaults to level 4 of 0-7
+constexpr int kIoprioBeDefaultLevel = 4;
+#endif
+
+bool applyIoPriority(IoPriority priority) {
+#if defined(__linux__)
+  int value = priority == IoPriority::Idle
+      ? kIoprioClassIdle << kIoprioClassShift
+      : (kIoprioClassBe << kIoprioClassShift) | kIoprioBeDefaultLevel;
+  // With IOPRIO_WHO_PROCESS, who == 0 means the calling thread
+  return syscall(SYS_ioprio_set, kIoprioWhoProcess, 0, value) == 0;
+#elif defined(__APPLE__)
+  return setiopolicy_np(
+             IOPOL_TYPE_DISK,
+             IOPOL_SCOPE_THREAD,
+             priority == IoPriority::Idle ? IOPOL_THROTTLE : IOPOL_DEFAULT) ==
+      0;
+#else
+  (void)priority;
+  return true;
+#endif
+}
+
+} // namespace
+
+void setThreadIoPriority(IoPriority priority) {
+  thread_local IoPriority current = IoPriority::Normal;
+  if (priority == current) {
+    return;
+  }
+  if (!applyIoPriority(priority)) {
+    logf(DBG, "failed to set the I/O priority of this thread\n");
+    return;
+  }
+  current = priority;
+}
+
+} // namespace watchman
@@ -0,0 +1,26 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+namespace watchman {
+
+enum class IoPriority {
+  Normal,
+  // Only served when the disk would otherwise be idle
+  Idle,
+};
+
+/**
+ * Sets the disk I/O priority of the calling thread: IOPRIO_CLASS_IDLE on
+ * Linux and the throttled I/O policy on macOS.  Elsewhere this does
+ * nothing.  Remembers the priority that it last set on each thread, so
+ * setting the same one again costs no syscall.
+ */
+void setThreadIoPriority(IoPriority priority);
+
+} // namespace watchman
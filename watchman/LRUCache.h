@@ -9,6 +9,7 @@
 #include <fmt/core.h>
 #include <folly/Synchronized.h>
 #include <folly/futures/Future.h>
+#include <atomic>
 #include <chrono>
 #include <deque>
 #include <memory>
@@ -50,6 +51,12 @@ namespace watchman {
  * and its nodes.  Because the cache is LRU it needs to touch
  * a node as part of a lookup to ensure that it will not
  * be evicted prematurely.
+ *
+ * With EvictionPolicy::Clock, the eviction order is only approximately
+ * LRU: a lookup that hits merely marks the node as referenced, which
+ * can be done while holding the lock shared, and eviction gives a
+ * referenced node a second chance by moving it to the back of the line.
+ * See also ShardedLRUCache.
  */
 
 template <typename KeyType, typename ValueType>
@@ -62,6 +69,14 @@ namespace lrucache {
 template <typename Node>
 class TailQHead;
 
+enum class EvictionPolicy {
+  // Evict the least recently used node
+  LRU,
+  // Evict the least recently used node that hasn't been looked up since
+  // it was last considered for eviction
+  Clock,
+};
+
 /** The node tracks the value in the cache.
  * We use a shared_ptr to manage its lifetime safely.
  * Clients of the cache will only ever be handed a
@@ -126,6 +141,10 @@ class Node {
 
   // Time after which this node is to be considered invalid
   std::chrono::steady_clock::time_point deadline_;
+
+  // Set by a lookup under EvictionPolicy::Clock, and cleared when the
+  // node is spared from eviction.
+  mutable std::atomic<bool> referenced_{false};
 };
 
 // A doubly-linked intrusive list through the cache nodes.
@@ -276,8 +295,12 @@ class LRUCache {
   LRUCache(
       size_t maxItems,
       std::chrono::milliseconds errorTTL,
-      std::chrono::milliseconds fetchTimeout = std::chrono::seconds(300))
-      : maxItems_(maxItems), errorTTL_(errorTTL), fetchTimeout_(fetchTimeout) {}
+      std::chrono::milliseconds fetchTimeout = std::chrono::seconds(300),
+      lrucache::EvictionPolicy policy = lrucache::EvictionPolicy::LRU)
+      : maxItems_(maxItems),
+        errorTTL_(errorTTL),
+        fetchTimeout_(fetchTimeout),
+        policy_(policy) {}
 
   LRUCache(
       Configuration&& cfg,
@@ -310,6 +333,10 @@ class LRUCache {
       const KeyType& key,
       std::chrono::steady_clock::time_point now =
           std::chrono::steady_clock::now()) {
+    if (auto node = tryReadOnlyHit(key, now)) {
+      return node;
+    }
+
     auto state = state_.wlock();
     ++state->stats.cacheLoad;
 
@@ -339,7 +366,7 @@ class LRUCache {
     }
 
     if (q == &state->evictionOrder) {
-      q->touch(node.get());
+      touch(node.get(), state);
     }
 
     ++state->stats.cacheHit;
@@ -374,7 +401,11 @@ class LRUCache {
       Func&& getter,
       std::chrono::steady_clock::time_point now =
           std::chrono::steady_clock::now()) {
-    std::shared_ptr<NodeType> node;
+    std::shared_ptr<NodeType> node = tryReadOnlyHit(key, now);
+    if (node) {
+      return folly::makeFuture<std::shared_ptr<const NodeType>>(
+          std::move(node));
+    }
     auto future = folly::Future<std::shared_ptr<const NodeType>>::makeEmpty();
 
     // Only hold the lock on the state while we set up the map entry.
@@ -391,7 +422,7 @@ class LRUCache {
         if (!node->expired(now)) {
           // Only touch successful nodes
           if (q == &state->evictionOrder) {
-            q->touch(node.get());
+            touch(node.get(), state);
           }
 
           if (node->promises_) {
@@ -560,7 +591,26 @@ class LRUCache {
   // Returns cache statistics
   CacheStats stats() const {
     auto state = state_.rlock();
-    return CacheStats(state->stats, state->map.size());
+    auto stats = state->stats;
+    auto sharedHits = sharedHits_.load(std::memory_order_relaxed);
+    stats.cacheHit += sharedHits;
+    stats.cacheLoad += sharedHits;
+    return CacheStats(stats, state->map.size());
+  }
+
+  // Evicts settled items, in eviction order, until at most `keep` remain.
+  // Items with a fetch in flight are left alone.  Returns the number of
+  // items that were evicted.
+  size_t shrink(
+      size_t keep,
+      std::chrono::steady_clock::time_point now =
+          std::chrono::steady_clock::now()) {
+    auto state = state_.wlock();
+    size_t evicted = 0;
+    while (state->map.size() > keep && evictOne(state, now, true)) {
+      ++evicted;
+    }
+    return evicted;
   }
 
   // Purge all of the entries from the cache
@@ -571,9 +621,45 @@ class LRUCache {
     state->lookupOrder.clear();
     state->map.clear();
     state->stats.clear();
+    sharedHits_.store(0, std::memory_order_relaxed);
   }
 
  private:
+  // Under EvictionPolicy::Clock, a lookup that finds a settled node only
+  // needs to mark it as referenced, so try that while holding the lock
+  // shared.  Returns nullptr if the lookup needs the exclusive lock.
+  std::shared_ptr<NodeType> tryReadOnlyHit(
+      const KeyType& key,
+      std::chrono::steady_clock::time_point now) {
+    if (policy_ != lrucache::EvictionPolicy::Clock) {
+      return nullptr;
+    }
+    auto state = state_.rlock();
+    auto it = state->map.find(key);
+    if (it == state->map.end()) {
+      return nullptr;
+    }
+    auto& node = it->second;
+    // Pending and expired nodes are dealt with under the exclusive lock
+    if (node->promises_ || node->expired(now)) {
+      return nullptr;
+    }
+    if (node->value_.hasValue()) {
+      node->referenced_.store(true, std::memory_order_relaxed);
+    }
+    sharedHits_.fetch_add(1, std::memory_order_relaxed);
+    return node;
+  }
+
+  // Record a lookup of a node in the evictionOrder set
+  void touch(NodeType* node, LockedState& state) {
+    if (policy_ == lrucache::EvictionPolicy::Clock) {
+      node->referenced_.store(true, std::memory_order_relaxed);
+    } else {
+      state->evictionOrder.touch(node);
+    }
+  }
+
   // Small helper for creating a new Node.  This checks for capacity
   // and attempts to evict an item to make room if needed.
   // The eviction may fail in some cases, which results in this method
@@ -629,6 +715,15 @@ class LRUCache {
 
     // Second choice is to evict a successful item
     auto node = state->evictionOrder.head();
+    if (policy_ == lrucache::EvictionPolicy::Clock) {
+      // Spare the nodes that were looked up since we last came by.  We
+      // hold the lock exclusively, so nothing can set the bits again
+      // and each node is spared at most once.
+      while (node && node->referenced_.exchange(false)) {
+        state->evictionOrder.touch(node);
+        node = state->evictionOrder.head();
+      }
+    }
     if (node) {
       state->evictionOrder.remove(node);
       // Erase from the map last, as this will invalidate node
@@ -657,6 +752,9 @@ class LRUCache {
   // How long to cache items that have an error Result
   const std::chrono::milliseconds errorTTL_;
   const std::chrono::milliseconds fetchTimeout_;
+  const lrucache::EvictionPolicy policy_;
   folly::Synchronized<State> state_;
+  // Hits served by tryReadOnlyHit, which can't update state_->stats
+  std::atomic<size_t> sharedHits_{0};
 };
 } // namespace watchman
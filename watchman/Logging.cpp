@@ -18,8 +18,10 @@
 #include <fmt/core.h>
 #include <array>
 #include <limits>
+#include <cstdlib>
 #include <optional>
 #include <sstream>
+#include <thread>
 
 #ifdef __APPLE__
 #include <pthread.h>
@@ -103,8 +105,13 @@ Log::Log()
 }
 
 Log& getLog() {
-  static Log log;
-  return log;
+  // Never destroyed, since the stderr writer thread outlives main()
+  static Log* log = [] {
+    auto* log = new Log;
+    std::atexit([] { getLog().flushStdErr(); });
+    return log;
+  }();
+  return *log;
 }
 
 char* Log::timeString(char* buf, size_t bufsize, timeval tv) {
@@ -161,8 +168,12 @@ const char* Log::getThreadName() {
 }
 
 void Log::setStdErrLoggingLevel(LogLevel level) {
-  auto notify = [this]() { doLogToStdErr(); };
+  auto notify = [this]() { wakeStdErrWriter(); };
   auto subs = subscribers_.lock();
+  stdErrLevel_.store(level);
+  // Any messages that the old subscribers didn't get to are discarded
+  // with them
+  stdErrBacklog_.store(0, std::memory_order_relaxed);
   auto& debugSub = subs->debugSub_;
   auto& errorSub = subs->errorSub_;
   switch (level) {
@@ -187,22 +198,96 @@ void Log::setStdErrLoggingLevel(LogLevel level) {
   }
 }
 
+void Log::publish(LogLevel level, Publisher& pub, json_ref&& payload) {
+  auto stdErrLevel = stdErrLevel_.load(std::memory_order_relaxed);
+  bool toStdErr = stdErrLevel != OFF && (level != DBG || stdErrLevel == DBG);
+  if (toStdErr) {
+    // Counted before the enqueue wakes the writer, so that the writer
+    // never sees the message before it is counted
+    stdErrBacklog_.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (!pub.enqueue(std::move(payload))) {
+    if (toStdErr) {
+      stdErrBacklog_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    return;
+  }
+
+  if (level == FATAL || level == ABORT) {
+    // Don't return to the caller; write out the message and die here
+    flushStdErr();
+  }
+}
+
+size_t Log::trimBacklog(size_t keep) {
+  auto skipped = errorPub_->trimBacklog(keep) + debugPub_->trimBacklog(keep);
+  // The stderr writer may have been skipped forward too, leaving it at
+  // most `keep` messages behind at each level
+  auto limit = static_cast<int64_t>(2 * keep);
+  auto backlog = stdErrBacklog_.load(std::memory_order_relaxed);
+  while (backlog > limit &&
+         !stdErrBacklog_.compare_exchange_weak(
+             backlog, limit, std::memory_order_relaxed)) {
+  }
+  return skipped;
+}
+
+void Log::flushStdErr() {
+  doLogToStdErr();
+}
+
+void Log::wakeStdErrWriter() {
+  auto writer = stdErrWriter_.lock();
+  writer->pinged = true;
+  if (!writer->started) {
+    writer->started = true;
+    std::thread{[this] { stdErrWriterLoop(); }}.detach();
+  }
+  stdErrCond_.notify_one();
+}
+
+void Log::stdErrWriterLoop() {
+  w_set_thread_name("logwriter");
+  while (true) {
+    {
+      auto writer = stdErrWriter_.lock();
+      stdErrCond_.wait(writer.as_lock(), [&] { return writer->pinged; });
+      writer->pinged = false;
+    }
+    doLogToStdErr();
+  }
+}
+
 void Log::doLogToStdErr() {
+  std::lock_guard<std::mutex> guard{stdErrWriteMutex_};
   std::vector<std::shared_ptr<const watchman::Publisher::Item>> items;
 
   {
     auto subs = subscribers_.lock();
     getPending(items, subs->errorSub_, subs->debugSub_);
   }
+  if (stdErrBacklog_.fetch_sub(items.size(), std::memory_order_relaxed) <
+      static_cast<int64_t>(items.size())) {
+    stdErrBacklog_.store(0, std::memory_order_relaxed);
+  }
 
   bool doFatal = false;
   bool doAbort = false;
   static w_string kFatal("fatal");
   static w_string kAbort("abort");
 
+  // Write the whole batch at once
+  std::string batch;
+  auto dropped = dropped_.load(std::memory_order_relaxed);
+  if (dropped != reportedDropped_) {
+    batch = fmt::format(
+        "[{} debug log messages were dropped because stderr fell behind]\n",
+        dropped - reportedDropped_);
+    reportedDropped_ = dropped;
+  }
   for (auto& item : items) {
     auto& log = json_to_w_string(item->payload.get("log"));
-    ignore_result(::write(STDERR_FILENO, log.data(), log.size()));
+    batch.append(log.data(), log.size());
 
     auto level = json_to_w_string(item->payload.get("level"));
     if (level == kFatal) {
@@ -211,6 +296,9 @@ void Log::doLogToStdErr() {
       doAbort = true;
     }
   }
+  if (!batch.empty()) {
+    write_stderr(batch);
+  }
 
   if (doFatal || doAbort) {
     log_stack_trace();
@@ -9,6 +9,8 @@
 
 #include <fmt/ranges.h>
 #include <folly/Synchronized.h>
+#include <atomic>
+#include <condition_variable>
 
 #include "watchman/PubSub.h"
 #include "watchman/watchman_preprocessor.h"
@@ -36,13 +38,40 @@ class Log {
 
   void setStdErrLoggingLevel(LogLevel level);
 
+  /**
+   * Writes out everything logged so far, rather than leaving it to the
+   * stderr writer thread.
+   */
+  void flushStdErr();
+
+  /**
+   * The number of debug messages dropped because the stderr writer thread
+   * fell more than `kMaxStdErrBacklog` messages behind.
+   */
+  uint64_t getDroppedCount() const {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Skips the subscribers that are more than `keep` messages behind at a
+   * level forward to the newest `keep`, releasing the older messages.
+   * Returns the number of messages skipped, summed across subscribers.
+   */
+  size_t trimBacklog(size_t keep);
+
+  // Debug messages logged while this many messages are waiting to be
+  // written to stderr are dropped, so that an event storm logged at DBG
+  // can't grow the backlog without bound.
+  static constexpr int64_t kMaxStdErrBacklog = 64 * 1024;
+
   // Build a string and log it
   template <typename... Args>
   void log(LogLevel level, Args&&... args) {
     auto& pub = levelToPub(level);
 
-    // Avoid building the string if there are no subscribers
-    if (!pub.hasSubscribers()) {
+    // Avoid building the string if there are no subscribers, or if it
+    // would be dropped
+    if (!pub.hasSubscribers() || shouldDrop(level)) {
       return;
     }
 
@@ -59,7 +88,7 @@ class Log {
          {"unilateral", json_true()},
          {"level", typed_string_to_json(logLevelToLabel(level))}});
 
-    pub.enqueue(std::move(payload));
+    publish(level, pub, std::move(payload));
   }
 
   // Format a string and log it
@@ -67,8 +96,9 @@ class Log {
   void logf(LogLevel level, fmt::string_view format_str, Args&&... args) {
     auto& pub = levelToPub(level);
 
-    // Avoid building the string if there are no subscribers
-    if (!pub.hasSubscribers()) {
+    // Avoid building the string if there are no subscribers, or if it
+    // would be dropped
+    if (!pub.hasSubscribers() || shouldDrop(level)) {
       return;
     }
 
@@ -87,7 +117,7 @@ class Log {
          {"unilateral", json_true()},
          {"level", typed_string_to_json(logLevelToLabel(level))}});
 
-    pub.enqueue(std::move(payload));
+    publish(level, pub, std::move(payload));
   }
 
   Log();
@@ -113,6 +143,40 @@ class Log {
     return level == DBG ? *debugPub_ : *errorPub_;
   }
 
+  bool shouldDrop(LogLevel level) const {
+    if (level != DBG ||
+        stdErrBacklog_.load(std::memory_order_relaxed) < kMaxStdErrBacklog) {
+      return false;
+    }
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  void publish(LogLevel level, Publisher& pub, json_ref&& payload);
+
+  // Messages are written to stderr by a dedicated thread, in batches, so
+  // that logging threads never block on the write.  The thread is started
+  // by the first message that stderr is subscribed to.
+  struct StdErrWriter {
+    bool started{false};
+    bool pinged{false};
+  };
+  folly::Synchronized<StdErrWriter, std::mutex> stdErrWriter_;
+  std::condition_variable stdErrCond_;
+  // Held while taking a batch of messages and writing it, so that
+  // flushStdErr() sees every message logged before it was called.
+  std::mutex stdErrWriteMutex_;
+  // The level that stderr is subscribed to
+  std::atomic<LogLevel> stdErrLevel_{OFF};
+  // Messages published at the stderr level but not yet written
+  std::atomic<int64_t> stdErrBacklog_{0};
+  mutable std::atomic<uint64_t> dropped_{0};
+  // How much of dropped_ has been reported on stderr.  Guarded by
+  // stdErrWriteMutex_.
+  uint64_t reportedDropped_{0};
+
+  void wakeStdErrWriter();
+  void stdErrWriterLoop();
   void doLogToStdErr();
 };
 
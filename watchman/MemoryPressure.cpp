@@ -0,0 +1,452 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/MemoryPressure.h"
+#include <fmt/core.h>
+#include <folly/Conv.h>
+#include <folly/FileUtil.h>
+#include <folly/String.h>
+#include <folly/Synchronized.h>
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+#include "watchman/Logging.h"
+#include "watchman/PerfSample.h"
+#include "watchman/WatchmanConfig.h"
+#include "watchman/root/Root.h"
+#include "watchman/root/watchlist.h"
+#include "watchman/watchman_system.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <poll.h>
+#include <thread>
+#include "watchman/fs/FileDescriptor.h"
+#include "watchman/fs/Pipe.h"
+#elif defined(__APPLE__)
+#include <dispatch/dispatch.h>
+#endif
+
+namespace watchman {
+
+namespace {
+
+// Log subscribers that are further behind than this are skipped forward
+constexpr size_t kLogBacklogToKeep = 1024;
+
+#ifdef __linux__
+// The PSI trigger fires when tasks stalled on memory for the configured
+// time within a window of this length.  Unprivileged triggers must use a
+// window that is a multiple of 2 seconds.
+constexpr std::chrono::microseconds kPsiWindow = std::chrono::seconds(2);
+
+// Returns the directory of the daemon's cgroup v2, or an empty string if it
+// isn't in one.
+std::string cgroupDir() {
+  std::string data;
+  if (!folly::readFile("/proc/self/cgroup", data)) {
+    return {};
+  }
+  std::vector<folly::StringPiece> lines;
+  folly::split('\n', data, lines);
+  for (auto& line : lines) {
+    // The unified hierarchy is the one with id 0 and no controllers
+    if (line.removePrefix("0::")) {
+      return fmt::format(
+          "/sys/fs/cgroup{}", line == "/" ? std::string{} : line.str());
+    }
+  }
+  return {};
+}
+
+FileDescriptor openPsiTrigger(
+    const std::string& path,
+    const std::string& spec) {
+  FileDescriptor fd(
+      open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC),
+      FileDescriptor::FDType::Generic);
+  if (!fd) {
+    return fd;
+  }
+  // The trigger is the write, including its terminating NUL
+  if (write(fd.fd(), spec.c_str(), spec.size() + 1) < 0) {
+    log(DBG,
+        "unable to set memory pressure trigger on ",
+        path,
+        ": ",
+        folly::errnoStr(errno),
+        "\n");
+    return FileDescriptor();
+  }
+  return fd;
+}
+
+// The counters of a cgroup's memory.events that mean it is being squeezed
+struct MemoryEvents {
+  uint64_t high{0};
+  uint64_t max{0};
+  uint64_t oom{0};
+
+  bool exceeds(const MemoryEvents& other) const {
+    return high > other.high || max > other.max || oom > other.oom;
+  }
+};
+
+// Reads the counters, which also re-arms the poll for the next change.
+std::optional<MemoryEvents> readMemoryEvents(const FileDescriptor& fd) {
+  char buf[512];
+  auto len = pread(fd.fd(), buf, sizeof(buf) - 1, 0);
+  if (len <= 0) {
+    return std::nullopt;
+  }
+  std::vector<folly::StringPiece> lines;
+  folly::split('\n', folly::StringPiece{buf, size_t(len)}, lines);
+  MemoryEvents events;
+  for (auto& line : lines) {
+    folly::StringPiece name, value;
+    if (!folly::split(' ', line, name, value)) {
+      continue;
+    }
+    auto count = folly::tryTo<uint64_t>(value);
+    if (!count) {
+      continue;
+    }
+    if (name == "high") {
+      events.high = *count;
+    } else if (name == "max") {
+      events.max = *count;
+    } else if (name == "oom") {
+      events.oom = *count;
+    }
+  }
+  return events;
+}
+#endif
+
+class MemoryPressureMonitor {
+ public:
+  ~MemoryPressureMonitor() {
+    stop();
+  }
+
+  void start();
+  void stop();
+
+  json_ref status() const {
+    auto state = state_.lock();
+    auto status = json_object({
+        {"running", json_boolean(state->running)},
+        {"signals", json_integer(state->signals)},
+        {"responses", json_integer(state->responses)},
+        {"min_interval_seconds", json_integer(state->minInterval.count())},
+    });
+    if (!state->source.empty()) {
+      status.set(
+          "source",
+          typed_string_to_json(state->source.c_str(), W_STRING_UNICODE));
+    }
+    if (state->lastReleased) {
+      status.set(
+          {{"last_response", json_integer(state->lastResponseTime)},
+           {"last_released", json_ref(*state->lastReleased)}});
+    }
+    return status;
+  }
+
+ private:
+  struct State {
+    bool running{false};
+    // Describes where the signals come from
+    std::string source;
+    std::chrono::seconds minInterval{0};
+    uint64_t signals{0};
+    uint64_t responses{0};
+    std::optional<std::chrono::steady_clock::time_point> lastResponse;
+    time_t lastResponseTime{0};
+    std::optional<json_ref> lastReleased;
+  };
+
+  // Called for each signal; relieves the pressure unless that was done
+  // within the last minInterval.
+  void signal(const char* reason);
+
+#ifdef __linux__
+  void loop() noexcept;
+
+  FileDescriptor psi_;
+  FileDescriptor events_;
+  MemoryEvents lastEvents_;
+  std::optional<Pipe> stopPipe_;
+  std::thread thread_;
+#elif defined(__APPLE__)
+  dispatch_queue_t queue_{nullptr};
+  dispatch_source_t source_{nullptr};
+#endif
+
+  folly::Synchronized<State, std::mutex> state_;
+};
+
+void MemoryPressureMonitor::start() {
+  if (!cfg_get_bool("memory_pressure_relief", false)) {
+    return;
+  }
+  auto state = state_.lock();
+  if (state->running) {
+    return;
+  }
+  state->minInterval = std::chrono::seconds{std::max<json_int_t>(
+      cfg_get_int("memory_pressure_min_interval_seconds", 30), 0)};
+
+#ifdef __linux__
+  auto stall = std::chrono::milliseconds{
+      std::max<json_int_t>(cfg_get_int("memory_pressure_stall_ms", 150), 1)};
+  auto spec = fmt::format(
+      "some {} {}",
+      std::chrono::duration_cast<std::chrono::microseconds>(stall).count(),
+      kPsiWindow.count());
+
+  std::vector<std::string> sources;
+  auto dir = cgroupDir();
+  if (!dir.empty()) {
+    auto path = dir + "/memory.pressure";
+    psi_ = openPsiTrigger(path, spec);
+    if (psi_) {
+      sources.push_back(std::move(path));
+    }
+    path = dir + "/memory.events";
+    events_ = FileDescriptor(
+        open(path.c_str(), O_RDONLY | O_CLOEXEC),
+        FileDescriptor::FDType::Generic);
+    if (events_) {
+      if (auto events = readMemoryEvents(events_)) {
+        lastEvents_ = *events;
+        sources.push_back(std::move(path));
+      } else {
+        events_.close();
+      }
+    }
+  }
+  if (!psi_) {
+    // Not in a cgroup that we can see into; use the system-wide figures
+    psi_ = openPsiTrigger("/proc/pressure/memory", spec);
+    if (psi_) {
+      sources.push_back("/proc/pressure/memory");
+    }
+  }
+  if (sources.empty()) {
+    log(ERR,
+        "memory_pressure_relief is set, but neither PSI nor cgroup memory "
+        "events are available\n");
+    return;
+  }
+  state->source = folly::join(", ", sources);
+  stopPipe_.emplace();
+  state->running = true;
+  thread_ = std::thread([this] { loop(); });
+#elif defined(__APPLE__)
+  queue_ =
+      dispatch_queue_create("watchman.memory-pressure", DISPATCH_QUEUE_SERIAL);
+  source_ = dispatch_source_create(
+      DISPATCH_SOURCE_TYPE_MEMORYPRESSURE,
+      0,
+      DISPATCH_MEMORYPRESSURE_WARN | DISPATCH_MEMORYPRESSURE_CRITICAL,
+      queue_);
+  dispatch_set_context(source_, this);
+  dispatch_source_set_event_handler_f(source_, [](void* context) {
+    static_cast<MemoryPressureMonitor*>(context)->signal("dispatch");
+  });
+  dispatch_resume(source_);
+  state->source = "dispatch";
+  state->running = true;
+#else
+  log(ERR, "memory_pressure_relief is not supported on this platform\n");
+#endif
+}
+
+void MemoryPressureMonitor::stop() {
+  {
+    auto state = state_.lock();
+    if (!state->running) {
+      return;
+    }
+    state->running = false;
+  }
+#ifdef __linux__
+  ignore_result(write(stopPipe_->write.fd(), "X", 1));
+  thread_.join();
+  psi_.close();
+  events_.close();
+  stopPipe_.reset();
+#elif defined(__APPLE__)
+  dispatch_source_cancel(source_);
+  // Wait out a handler that is already running
+  dispatch_sync_f(queue_, nullptr, [](void*) {});
+  dispatch_release(source_);
+  dispatch_release(queue_);
+  source_ = nullptr;
+  queue_ = nullptr;
+#endif
+}
+
+void MemoryPressureMonitor::signal(const char* reason) {
+  {
+    auto state = state_.lock();
+    ++state->signals;
+    auto now = std::chrono::steady_clock::now();
+    if (state->lastResponse &&
+        now < *state->lastResponse + state->minInterval) {
+      return;
+    }
+    state->lastResponse = now;
+  }
+
+  auto released = relieveMemoryPressure(reason);
+
+  auto state = state_.lock();
+  ++state->responses;
+  state->lastResponseTime = time(nullptr);
+  state->lastReleased = std::move(released);
+}
+
+#ifdef __linux__
+void MemoryPressureMonitor::loop() noexcept {
+  w_set_thread_name("mempressure");
+
+  while (true) {
+    pollfd pfd[3];
+    nfds_t n = 0;
+    pfd[n++] = {stopPipe_->read.fd(), POLLIN, 0};
+    std::optional<nfds_t> psiSlot;
+    if (psi_) {
+      psiSlot = n;
+      pfd[n++] = {psi_.fd(), POLLPRI, 0};
+    }
+    std::optional<nfds_t> eventsSlot;
+    if (events_) {
+      eventsSlot = n;
+      pfd[n++] = {events_.fd(), POLLPRI, 0};
+    }
+
+    if (poll(pfd, n, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      log(ERR,
+          "memory pressure monitor: poll failed: ",
+          folly::errnoStr(errno),
+          "\n");
+      return;
+    }
+    if (pfd[0].revents) {
+      return;
+    }
+
+    if (psiSlot) {
+      auto revents = pfd[*psiSlot].revents;
+      if (revents & POLLERR) {
+        // The trigger is destroyed along with its cgroup
+        log(ERR, "memory pressure trigger is no longer valid\n");
+        psi_.close();
+      } else if (revents & POLLPRI) {
+        signal("memory.pressure");
+      }
+    }
+
+    // A change to memory.events is reported as POLLPRI|POLLERR
+    if (eventsSlot && pfd[*eventsSlot].revents) {
+      auto events = readMemoryEvents(events_);
+      if (!events) {
+        log(ERR,
+            "unable to read cgroup memory.events; no longer watching it\n");
+        events_.close();
+      } else {
+        auto squeezed = events->exceeds(lastEvents_);
+        lastEvents_ = *events;
+        if (squeezed) {
+          signal("memory.events");
+        }
+      }
+    }
+  }
+}
+#endif
+
+MemoryPressureMonitor& getMemoryPressureMonitor() {
+  static MemoryPressureMonitor monitor;
+  return monitor;
+}
+
+} // namespace
+
+json_ref relieveMemoryPressure(const char* reason) {
+  std::vector<std::shared_ptr<Root>> roots;
+  {
+    auto map = watched_roots.rlock();
+    for (const auto& it : *map) {
+      roots.push_back(it.second);
+    }
+  }
+
+  PerfSample sample("memory_pressure");
+  std::chrono::seconds minAge{
+      cfg_get_int("memory_pressure_gc_age_seconds", 300)};
+  std::unordered_map<w_string, json_ref> released;
+  json_int_t queryResults = 0;
+  json_int_t contentHashes = 0;
+  json_int_t symlinkTargets = 0;
+  for (const auto& root : roots) {
+    auto rootReleased = root->relieveMemoryPressure(minAge);
+    auto count = [&](const char* key) {
+      auto value = rootReleased.get_optional(key);
+      return value ? value->asInt() : 0;
+    };
+    queryResults += count("query_results");
+    contentHashes += count("content_hashes");
+    symlinkTargets += count("symlink_targets");
+    released.insert_or_assign(root->root_path, std::move(rootReleased));
+  }
+  auto logMessages = getLog().trimBacklog(kLogBacklogToKeep);
+
+  auto result = json_object(
+      {{"reason", typed_string_to_json(reason, W_STRING_UNICODE)},
+       {"roots", json_object(std::move(released))},
+       {"log_messages", json_integer(logMessages)}});
+
+  sample.add_meta("memory_pressure", json_ref(result));
+  sample.finish();
+  sample.force_log();
+  sample.log();
+
+  logf(
+      ERR,
+      "memory pressure ({}): released {} query results, {} content hashes "
+      "and {} symlink targets across {} roots, and {} log messages\n",
+      reason,
+      queryResults,
+      contentHashes,
+      symlinkTargets,
+      roots.size(),
+      logMessages);
+  return result;
+}
+
+void startMemoryPressureMonitor() {
+  getMemoryPressureMonitor().start();
+}
+
+void stopMemoryPressureMonitor() {
+  getMemoryPressureMonitor().stop();
+}
+
+json_ref getMemoryPressureStatus() {
+  return getMemoryPressureMonitor().status();
+}
+
+} // namespace watchman
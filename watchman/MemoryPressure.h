@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include "watchman/thirdparty/jansson/jansson.h"
+
+namespace watchman {
+
+/**
+ * Releases what the daemon can rebuild on demand: the query result caches
+ * and half of the content hash and symlink target caches of every root,
+ * the tombstones older than `memory_pressure_gc_age_seconds`, and the log
+ * messages that subscribers have fallen far behind on.  Returns what was
+ * released, which is also logged.
+ */
+json_ref relieveMemoryPressure(const char* reason);
+
+/**
+ * When `memory_pressure_relief` is enabled, starts watching for the system
+ * running short of memory, and calls relieveMemoryPressure() when it does,
+ * at most once every `memory_pressure_min_interval_seconds`.
+ *
+ * On Linux, the signals are a PSI trigger on the memory.pressure of the
+ * daemon's cgroup, or of the whole system if that isn't available, and the
+ * high and max counters of the cgroup's memory.events.  On macOS, it is
+ * the dispatch memory pressure source.  Elsewhere this does nothing.
+ */
+void startMemoryPressureMonitor();
+void stopMemoryPressureMonitor();
+
+/**
+ * Describes the monitor's signals and the responses it has made.
+ */
+json_ref getMemoryPressureStatus();
+
+} // namespace watchman
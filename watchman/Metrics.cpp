@@ -0,0 +1,323 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/Metrics.h"
+#include <fmt/core.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace watchman {
+
+namespace {
+size_t log2Floor(uint64_t value) {
+  size_t result = 0;
+  while (value >>= 1) {
+    ++result;
+  }
+  return result;
+}
+
+std::string escapeLabelValue(const std::string& value) {
+  std::string result;
+  result.reserve(value.size());
+  for (auto c : value) {
+    switch (c) {
+      case '\\':
+        result += "\\\\";
+        break;
+      case '"':
+        result += "\\\"";
+        break;
+      case '\n':
+        result += "\\n";
+        break;
+      default:
+        result += c;
+    }
+  }
+  return result;
+}
+
+// Renders {a="1",b="2"}, with extra appended, or nothing if there are no
+// labels at all.
+std::string renderLabels(
+    const OpenMetricsWriter::Labels& labels,
+    const std::string& extra = {}) {
+  std::string result;
+  for (auto& [name, value] : labels) {
+    if (!result.empty()) {
+      result += ',';
+    }
+    result += fmt::format("{}=\"{}\"", name, escapeLabelValue(value));
+  }
+  if (!extra.empty()) {
+    if (!result.empty()) {
+      result += ',';
+    }
+    result += extra;
+  }
+  return result.empty() ? result : "{" + result + "}";
+}
+
+std::string formatSeconds(uint64_t us) {
+  return fmt::format("{}", double(us) / 1000000);
+}
+} // namespace
+
+size_t LatencyHistogram::bucketFor(uint64_t us) {
+  if (us < kSubBuckets) {
+    return size_t(us);
+  }
+  auto exponent = log2Floor(us);
+  if (exponent >= kMaxExponent) {
+    return kNumBuckets - 1;
+  }
+  auto sub = (us >> (exponent - kSubBucketBits)) & (kSubBuckets - 1);
+  return kSubBuckets + (exponent - kSubBucketBits) * kSubBuckets + sub;
+}
+
+uint64_t LatencyHistogram::bucketUpperBoundUs(size_t index) {
+  if (index < kSubBuckets) {
+    return index + 1;
+  }
+  if (index >= kNumBuckets - 1) {
+    return std::numeric_limits<uint64_t>::max();
+  }
+  auto exponent = (index - kSubBuckets) / kSubBuckets + kSubBucketBits;
+  auto sub = (index - kSubBuckets) % kSubBuckets;
+  return uint64_t(kSubBuckets + sub + 1) << (exponent - kSubBucketBits);
+}
+
+void LatencyHistogram::record(std::chrono::steady_clock::duration value) {
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(value);
+  recordUs(us.count() > 0 ? uint64_t(us.count()) : 0);
+}
+
+void LatencyHistogram::recordUs(uint64_t us) {
+  counts_[bucketFor(us)].fetch_add(1, std::memory_order_relaxed);
+  sumUs_.fetch_add(us, std::memory_order_relaxed);
+  auto max = maxUs_.load(std::memory_order_relaxed);
+  while (us > max &&
+         !maxUs_.compare_exchange_weak(max, us, std::memory_order_relaxed)) {
+  }
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const {
+  Snapshot result;
+  for (size_t i = 0; i < kNumBuckets; ++i) {
+    result.counts[i] = counts_[i].load(std::memory_order_relaxed);
+    // Summing the buckets keeps the count consistent with them, even while
+    // other threads record values.
+    result.count += result.counts[i];
+  }
+  result.sumUs = sumUs_.load(std::memory_order_relaxed);
+  result.maxUs = maxUs_.load(std::memory_order_relaxed);
+  return result;
+}
+
+uint64_t LatencyHistogram::Snapshot::quantileUs(double q) const {
+  if (count == 0) {
+    return 0;
+  }
+  auto rank = std::max<uint64_t>(
+      1, uint64_t(std::ceil(std::clamp(q, 0.0, 1.0) * double(count))));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kNumBuckets; ++i) {
+    seen += counts[i];
+    if (seen >= rank) {
+      // The largest value recorded is a tighter bound for the last buckets
+      return std::min(bucketUpperBoundUs(i), maxUs);
+    }
+  }
+  return maxUs;
+}
+
+json_ref LatencyHistogram::Snapshot::asJsonValue() const {
+  std::vector<json_ref> buckets;
+  for (size_t i = 0; i < kNumBuckets; ++i) {
+    if (counts[i] == 0) {
+      continue;
+    }
+    auto bound = bucketUpperBoundUs(i);
+    buckets.push_back(json_array(
+        {bound == std::numeric_limits<uint64_t>::max()
+             ? json_null()
+             : json_integer(json_int_t(bound)),
+         json_integer(json_int_t(counts[i]))}));
+  }
+  return json_object({
+      {"count", json_integer(json_int_t(count))},
+      {"sum_us", json_integer(json_int_t(sumUs))},
+      {"max_us", json_integer(json_int_t(maxUs))},
+      {"p50_us", json_integer(json_int_t(quantileUs(0.5)))},
+      {"p90_us", json_integer(json_int_t(quantileUs(0.9)))},
+      {"p99_us", json_integer(json_int_t(quantileUs(0.99)))},
+      // [exclusive upper bound in microseconds, count] of each non-empty
+      // bucket
+      {"buckets", json_array(std::move(buckets))},
+  });
+}
+
+json_ref QueryPhaseHistograms::asJsonValue() const {
+  return json_object({
+      {"elapsed", elapsed.snapshot().asJsonValue()},
+      {"cookie_sync", cookieSync.snapshot().asJsonValue()},
+      {"view_lock_wait", viewLockWait.snapshot().asJsonValue()},
+      {"generation", generation.snapshot().asJsonValue()},
+      {"render", render.snapshot().asJsonValue()},
+      {"cpu", cpu.snapshot().asJsonValue()},
+  });
+}
+
+json_ref ChangeTimes::asJsonValue() const {
+  auto us = [](std::chrono::system_clock::time_point time) {
+    return json_integer(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            time.time_since_epoch())
+            .count());
+  };
+  return json_object({
+      {"changed_us", us(changed)},
+      {"pending_us", us(pending)},
+      {"processed_us", us(processed)},
+      {"settled_us", us(settled)},
+  });
+}
+
+std::optional<ChangeTimes> ChangeTimes::fromJson(const json_ref& value) {
+  if (!value.isObject()) {
+    return std::nullopt;
+  }
+  bool valid = true;
+  auto get = [&](const char* name) {
+    auto field = value.get_optional(name);
+    if (!field || !field->isInt()) {
+      valid = false;
+      return std::chrono::system_clock::time_point{};
+    }
+    return std::chrono::system_clock::time_point{
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(
+            std::chrono::microseconds{field->asInt()})};
+  };
+  ChangeTimes times;
+  times.changed = get("changed_us");
+  times.pending = get("pending_us");
+  times.processed = get("processed_us");
+  times.settled = get("settled_us");
+  if (!valid) {
+    return std::nullopt;
+  }
+  return times;
+}
+
+json_ref ChangeLatencyHistograms::asJsonValue() const {
+  return json_object({
+      {"kernel_to_pending", kernelToPending.snapshot().asJsonValue()},
+      {"pending_to_processed", pendingToProcessed.snapshot().asJsonValue()},
+      {"processed_to_settled", processedToSettled.snapshot().asJsonValue()},
+      {"settled_to_delivered", settledToDelivered.snapshot().asJsonValue()},
+  });
+}
+
+CommandMetrics& CommandMetrics::get() {
+  static CommandMetrics metrics;
+  return metrics;
+}
+
+void CommandMetrics::record(
+    std::string_view command,
+    std::chrono::steady_clock::duration elapsed) {
+  {
+    auto rlock = commands_.rlock();
+    auto it = rlock->find(std::string{command});
+    if (it != rlock->end()) {
+      it->second->record(elapsed);
+      return;
+    }
+  }
+  auto wlock = commands_.wlock();
+  auto& histogram = (*wlock)[std::string{command}];
+  if (!histogram) {
+    histogram = std::make_unique<LatencyHistogram>();
+  }
+  histogram->record(elapsed);
+}
+
+std::map<std::string, LatencyHistogram::Snapshot> CommandMetrics::snapshot()
+    const {
+  std::map<std::string, LatencyHistogram::Snapshot> result;
+  auto rlock = commands_.rlock();
+  for (auto& [name, histogram] : *rlock) {
+    result.emplace(name, histogram->snapshot());
+  }
+  return result;
+}
+
+void OpenMetricsWriter::histogram(
+    const std::string& family,
+    const std::string& help,
+    const std::vector<std::pair<Labels, LatencyHistogram::Snapshot>>&
+        series) {
+  text_ += fmt::format(
+      "# TYPE {} histogram\n# HELP {} {}\n", family, family, help);
+  for (auto& [labels, snapshot] : series) {
+    // Only the buckets up to the last one that is in use; the rest would
+    // all repeat the total.  Values are whole microseconds, so a bucket
+    // holds those up to one less than its upper bound.
+    size_t last = 0;
+    for (size_t i = 0; i < LatencyHistogram::kNumBuckets - 1; ++i) {
+      if (snapshot.counts[i]) {
+        last = i;
+      }
+    }
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i <= last; ++i) {
+      cumulative += snapshot.counts[i];
+      text_ += fmt::format(
+          "{}_bucket{} {}\n",
+          family,
+          renderLabels(
+              labels,
+              fmt::format(
+                  "le=\"{}\"",
+                  formatSeconds(LatencyHistogram::bucketUpperBoundUs(i) - 1))),
+          cumulative);
+    }
+    text_ += fmt::format(
+        "{}_bucket{} {}\n",
+        family,
+        renderLabels(labels, "le=\"+Inf\""),
+        snapshot.count);
+    text_ += fmt::format(
+        "{}_count{} {}\n", family, renderLabels(labels), snapshot.count);
+    text_ += fmt::format(
+        "{}_sum{} {}\n",
+        family,
+        renderLabels(labels),
+        formatSeconds(snapshot.sumUs));
+  }
+}
+
+void OpenMetricsWriter::counter(
+    const std::string& family,
+    const std::string& help,
+    const std::vector<std::pair<Labels, uint64_t>>& series) {
+  text_ += fmt::format(
+      "# TYPE {} counter\n# HELP {} {}\n", family, family, help);
+  for (auto& [labels, value] : series) {
+    text_ +=
+        fmt::format("{}_total{} {}\n", family, renderLabels(labels), value);
+  }
+}
+
+std::string OpenMetricsWriter::finish() {
+  text_ += "# EOF\n";
+  return std::move(text_);
+}
+
+} // namespace watchman
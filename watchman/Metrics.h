@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/Synchronized.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "watchman/thirdparty/jansson/jansson.h"
+
+namespace watchman {
+
+/**
+ * A histogram of durations that can be recorded from any number of threads
+ * without taking a lock.
+ *
+ * Buckets are log-linear in microseconds: each power of two is split into
+ * kSubBuckets equal parts, so that a bucket's bounds are within 25% of one
+ * another from a few microseconds up to days.
+ */
+class LatencyHistogram {
+ public:
+  static constexpr size_t kSubBucketBits = 2;
+  static constexpr size_t kSubBuckets = 1 << kSubBucketBits;
+  // Values of 2^kMaxExponent microseconds (about 12 days) and above go in
+  // the last bucket.
+  static constexpr size_t kMaxExponent = 40;
+  static constexpr size_t kNumBuckets =
+      kSubBuckets + (kMaxExponent - kSubBucketBits) * kSubBuckets + 1;
+
+  struct Snapshot {
+    std::array<uint64_t, kNumBuckets> counts{};
+    uint64_t count{0};
+    uint64_t sumUs{0};
+    uint64_t maxUs{0};
+
+    // Returns the upper bound of the bucket holding the q'th quantile,
+    // where 0 <= q <= 1, or 0 if nothing has been recorded.
+    uint64_t quantileUs(double q) const;
+
+    json_ref asJsonValue() const;
+  };
+
+  void record(std::chrono::steady_clock::duration value);
+  void recordUs(uint64_t us);
+
+  Snapshot snapshot() const;
+
+  static size_t bucketFor(uint64_t us);
+  // The smallest value that falls in a later bucket than index; the last
+  // bucket has no bound and returns UINT64_MAX.
+  static uint64_t bucketUpperBoundUs(size_t index);
+
+ private:
+  std::array<std::atomic<uint64_t>, kNumBuckets> counts_{};
+  std::atomic<uint64_t> sumUs_{0};
+  std::atomic<uint64_t> maxUs_{0};
+};
+
+/**
+ * The durations of the phases of a query, as recorded in its QueryContext.
+ */
+struct QueryPhaseHistograms {
+  LatencyHistogram elapsed;
+  LatencyHistogram cookieSync;
+  LatencyHistogram viewLockWait;
+  LatencyHistogram generation;
+  LatencyHistogram render;
+  // CPU time of each query, rather than its wall time
+  LatencyHistogram cpu;
+
+  json_ref asJsonValue() const;
+};
+
+/**
+ * When the oldest change behind a subscription notification reached each
+ * stage on its way from the watcher to the client.  Carried from the IO
+ * thread to the subscribers in the "settled" payload.
+ */
+struct ChangeTimes {
+  // When the watcher read the change; its PendingChange::now
+  std::chrono::system_clock::time_point changed;
+  // When the notify thread handed it to the IO thread
+  std::chrono::system_clock::time_point pending;
+  // When the IO thread had applied it to the view
+  std::chrono::system_clock::time_point processed;
+  // When the root next settled
+  std::chrono::system_clock::time_point settled;
+
+  // An object of the microseconds since the epoch of each stage
+  json_ref asJsonValue() const;
+  // Returns nullopt unless value is an object made by asJsonValue()
+  static std::optional<ChangeTimes> fromJson(const json_ref& value);
+};
+
+/**
+ * The time taken by each stage between the watcher reading a change and a
+ * subscriber being sent it; see ChangeTimes.  Each is measured by the
+ * oldest change of what passed through the stage at once.
+ */
+struct ChangeLatencyHistograms {
+  // Per batch that the notify thread hands to the IO thread
+  LatencyHistogram kernelToPending;
+  // Per pass of the IO thread over its pending changes
+  LatencyHistogram pendingToProcessed;
+  // Per settle that follows changes
+  LatencyHistogram processedToSettled;
+  // Per subscription notification sent after a settle
+  LatencyHistogram settledToDelivered;
+
+  json_ref asJsonValue() const;
+};
+
+/**
+ * The metrics of a single root, held by the Root.
+ */
+struct RootMetrics {
+  QueryPhaseHistograms queries;
+  // Time taken to compute each subscription notification
+  LatencyHistogram subscriptionNotifications;
+  // Time from a change being read to its notification being sent
+  ChangeLatencyHistograms changeLatency;
+  // Time that heavy queries waited for admission, indexed by QueryPriority
+  std::array<LatencyHistogram, 2> queryAdmissionWait;
+  // Pending items processed by the IO thread
+  std::atomic<uint64_t> events{0};
+};
+
+/**
+ * The metrics of each command that the daemon has run, by command name.
+ * Entries are never removed.
+ */
+class CommandMetrics {
+ public:
+  static CommandMetrics& get();
+
+  void record(std::string_view command, std::chrono::steady_clock::duration);
+
+  // Returns a snapshot of the elapsed time histogram of each command
+  std::map<std::string, LatencyHistogram::Snapshot> snapshot() const;
+
+ private:
+  folly::Synchronized<std::map<std::string, std::unique_ptr<LatencyHistogram>>>
+      commands_;
+};
+
+/**
+ * Renders histograms and counters in the OpenMetrics text format.  Each
+ * family is given with the labels of each of its series.
+ */
+class OpenMetricsWriter {
+ public:
+  using Labels = std::vector<std::pair<std::string, std::string>>;
+
+  void histogram(
+      const std::string& family,
+      const std::string& help,
+      const std::vector<std::pair<Labels, LatencyHistogram::Snapshot>>&
+          series);
+  void counter(
+      const std::string& family,
+      const std::string& help,
+      const std::vector<std::pair<Labels, uint64_t>>& series);
+
+  // Returns the rendered text, terminated by "# EOF"
+  std::string finish();
+
+ private:
+  std::string text_;
+};
+
+} // namespace watchman
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/MtimeIndex.h"
+#include "watchman/watchman_dir.h"
+#include "watchman/watchman_file.h"
+
+namespace watchman {
+
+void MtimeIndex::update(watchman_file* file) {
+  if (!file->exists) {
+    erase(file);
+    return;
+  }
+  auto mtime = int64_t(file->stat.mtime().tv_sec);
+  auto [it, inserted] = keys_.emplace(file, mtime);
+  if (!inserted) {
+    if (it->second == mtime) {
+      return;
+    }
+    files_.erase({it->second, file});
+    it->second = mtime;
+  }
+  files_.emplace(mtime, file);
+}
+
+void MtimeIndex::erase(watchman_file* file) {
+  auto it = keys_.find(file);
+  if (it == keys_.end()) {
+    return;
+  }
+  files_.erase({it->second, file});
+  keys_.erase(it);
+}
+
+void MtimeIndex::eraseTree(const watchman_dir* dir) {
+  for (auto& it : dir->files) {
+    erase(it.second.get());
+  }
+  for (auto& it : dir->dirs) {
+    eraseTree(it.second.get());
+  }
+}
+
+MtimeIndex::Stats MtimeIndex::getStats() const {
+  // Neither container reports its allocations, so estimate them from the
+  // sizes of their nodes and bucket array.
+  constexpr size_t kTreeNodeOverhead = 4 * sizeof(void*);
+  constexpr size_t kHashNodeOverhead = 2 * sizeof(void*);
+
+  Stats stats;
+  stats.files = keys_.size();
+  stats.bytes = files_.size() *
+          (kTreeNodeOverhead + sizeof(std::pair<int64_t, watchman_file*>)) +
+      keys_.bucket_count() * sizeof(void*) +
+      keys_.size() *
+          (kHashNodeOverhead + sizeof(std::pair<watchman_file*, int64_t>));
+  return stats;
+}
+
+} // namespace watchman
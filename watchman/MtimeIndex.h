@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <set>
+#include <unordered_map>
+#include <utility>
+
+struct watchman_dir;
+struct watchman_file;
+
+namespace watchman {
+
+/**
+ * Orders the existing files of a ViewDatabase by the seconds of their stat
+ * mtime, so that queries with a ["since", timestamp, "mtime"] term only
+ * visit the files modified at or after the timestamp, in O(log n + k)
+ * rather than by scanning every file.
+ *
+ * The ViewDatabase updates a file's position each time it marks the file
+ * changed, which is after its new stat has been stored, and removes it when
+ * it is deleted or its node is destroyed.  Deleted files aren't indexed, as
+ * the all-files generator never visits them.
+ *
+ * Not thread safe; the owning ViewDatabase is protected by the view lock.
+ */
+class MtimeIndex {
+ public:
+  struct Stats {
+    // Number of indexed files
+    size_t files{0};
+    // Estimate of the memory held by the index
+    size_t bytes{0};
+  };
+
+  MtimeIndex() = default;
+  MtimeIndex(const MtimeIndex&) = delete;
+  MtimeIndex& operator=(const MtimeIndex&) = delete;
+
+  /**
+   * Indexes file by its current mtime if it exists, moving it if it was
+   * indexed by another, and removes it otherwise.
+   */
+  void update(watchman_file* file);
+
+  void erase(watchman_file* file);
+
+  /** Removes every file of dir and of the dirs below it. */
+  void eraseTree(const watchman_dir* dir);
+
+  /**
+   * Calls func with each file whose mtime is at least minMtimeSec, newest
+   * first, until func returns false.  Returns the number of files visited.
+   */
+  template <typename Func>
+  size_t forEachSince(int64_t minMtimeSec, Func&& func) const {
+    size_t visited = 0;
+    auto stop = files_.lower_bound({minMtimeSec, nullptr});
+    for (auto it = files_.end(); it != stop;) {
+      --it;
+      ++visited;
+      if (!func(it->second)) {
+        break;
+      }
+    }
+    return visited;
+  }
+
+  size_t size() const {
+    return keys_.size();
+  }
+
+  Stats getStats() const;
+
+ private:
+  std::set<std::pair<int64_t, watchman_file*>> files_;
+  // The mtime that each file is indexed by, which its stat no longer holds
+  // once it has changed
+  std::unordered_map<watchman_file*, int64_t> keys_;
+};
+
+} // namespace watchman
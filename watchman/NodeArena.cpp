@@ -0,0 +1,322 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/NodeArena.h"
+#include <fcntl.h>
+#include <folly/Memory.h>
+#include <string.h>
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace watchman {
+
+namespace {
+constexpr size_t roundUp(size_t value, size_t multiple) {
+  return (value + multiple - 1) / multiple * multiple;
+}
+} // namespace
+
+size_t NodeArena::headerSize() {
+  return roundUp(sizeof(Slab), kGranularity);
+}
+
+NodeArena::Slab* NodeArena::slabFor(const void* ptr) noexcept {
+  // Objects always start within the first kSlabSize bytes of their
+  // kSlabSize-aligned slab, even for oversized single object slabs.
+  return reinterpret_cast<Slab*>(
+      reinterpret_cast<uintptr_t>(ptr) & ~uintptr_t(kSlabSize - 1));
+}
+
+NodeArena::~NodeArena() {
+  while (allSlabs_) {
+    freeSlab(allSlabs_);
+  }
+}
+
+void NodeArena::useBackingFile(const std::string& path) {
+#ifdef _WIN32
+  (void)path;
+  throw std::system_error(
+      ENOSYS,
+      std::generic_category(),
+      "file backed node arenas aren't supported on Windows");
+#else
+  if (allSlabs_) {
+    throw std::logic_error(
+        "the backing file must be set before anything is allocated");
+  }
+  backingFile_ = FileDescriptor(
+      ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600),
+      "open node arena backing file",
+      FileDescriptor::FDType::Generic);
+  // Nothing but this arena needs to find it again
+  ::unlink(path.c_str());
+#endif
+}
+
+#ifndef _WIN32
+void* NodeArena::mapSlab(size_t slabBytes, int64_t& fileOffset) {
+  if (slabBytes == kSlabSize && !freeFileOffsets_.empty()) {
+    fileOffset = freeFileOffsets_.back();
+    freeFileOffsets_.pop_back();
+  } else {
+    fileOffset = int64_t(stats_.backingFileBytes);
+    if (::ftruncate(backingFile_.fd(), fileOffset + slabBytes) != 0) {
+      throw std::bad_alloc();
+    }
+    stats_.backingFileBytes += slabBytes;
+  }
+
+  // mmap only promises page alignment, so reserve enough address space to
+  // find a kSlabSize aligned run in it, and give the rest back
+  auto reserved = static_cast<char*>(mmap(
+      nullptr,
+      slabBytes + kSlabSize,
+      PROT_NONE,
+      MAP_PRIVATE | MAP_ANONYMOUS,
+      -1,
+      0));
+  if (reserved == MAP_FAILED) {
+    freeFileOffsets_.push_back(fileOffset);
+    throw std::bad_alloc();
+  }
+  auto aligned = reinterpret_cast<char*>(roundUp(
+      reinterpret_cast<uintptr_t>(reserved), uintptr_t(kSlabSize)));
+  if (aligned != reserved) {
+    munmap(reserved, aligned - reserved);
+  }
+  munmap(aligned + slabBytes, reserved + kSlabSize - aligned);
+
+  auto mem = mmap(
+      aligned,
+      slabBytes,
+      PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_FIXED,
+      backingFile_.fd(),
+      off_t(fileOffset));
+  if (mem == MAP_FAILED) {
+    munmap(aligned, slabBytes);
+    freeFileOffsets_.push_back(fileOffset);
+    throw std::bad_alloc();
+  }
+  return mem;
+}
+
+void NodeArena::unmapSlab(
+    void* mem,
+    size_t slabBytes,
+    int64_t fileOffset) noexcept {
+  munmap(mem, slabBytes);
+#ifdef __linux__
+  // Give the disk space back; the next slab to map this range reads zeros
+  fallocate(
+      backingFile_.fd(),
+      FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+      off_t(fileOffset),
+      off_t(slabBytes));
+#endif
+  // Oversized slabs seldom match in size, so only whole slabs are reused
+  if (slabBytes == kSlabSize) {
+    freeFileOffsets_.push_back(fileOffset);
+  }
+}
+#else
+void* NodeArena::mapSlab(size_t, int64_t&) {
+  throw std::bad_alloc();
+}
+
+void NodeArena::unmapSlab(void*, size_t, int64_t) noexcept {}
+#endif
+
+NodeArena::Slab*
+NodeArena::newSlab(uint32_t sizeClass, size_t objectSize, size_t slabBytes) {
+  int64_t fileOffset = -1;
+  void* mem;
+  if (backingFile_) {
+    mem = mapSlab(slabBytes, fileOffset);
+  } else {
+    mem = folly::aligned_malloc(slabBytes, kSlabSize);
+    if (!mem) {
+      throw std::bad_alloc();
+    }
+  }
+
+  auto slab = new (mem) Slab();
+  slab->fileOffset = fileOffset;
+  slab->arena = this;
+  slab->freeList = nullptr;
+  slab->bump = static_cast<char*>(mem) + headerSize();
+  slab->end = static_cast<char*>(mem) + slabBytes;
+  slab->slabBytes = slabBytes;
+  slab->objectSize = uint32_t(objectSize);
+  slab->liveCount = 0;
+  slab->sizeClass = sizeClass;
+  slab->onFreeList = false;
+  slab->freePrev = nullptr;
+  slab->freeNext = nullptr;
+
+  slab->allPrev = nullptr;
+  slab->allNext = allSlabs_;
+  if (allSlabs_) {
+    allSlabs_->allPrev = slab;
+  }
+  allSlabs_ = slab;
+
+  stats_.slabs++;
+  stats_.reservedBytes += slabBytes;
+  return slab;
+}
+
+void NodeArena::freeSlab(Slab* slab) noexcept {
+  if (slab->onFreeList) {
+    unlinkFree(slab);
+  }
+  if (slab->allPrev) {
+    slab->allPrev->allNext = slab->allNext;
+  } else {
+    allSlabs_ = slab->allNext;
+  }
+  if (slab->allNext) {
+    slab->allNext->allPrev = slab->allPrev;
+  }
+
+  stats_.slabs--;
+  stats_.reservedBytes -= slab->slabBytes;
+
+  auto slabBytes = slab->slabBytes;
+  auto fileOffset = slab->fileOffset;
+  slab->~Slab();
+  if (backingFile_) {
+    unmapSlab(slab, slabBytes, fileOffset);
+  } else {
+    folly::aligned_free(slab);
+  }
+}
+
+void NodeArena::linkFree(Slab* slab) noexcept {
+  auto& head = partial_[slab->sizeClass];
+  slab->freePrev = nullptr;
+  slab->freeNext = head;
+  if (head) {
+    head->freePrev = slab;
+  }
+  head = slab;
+  slab->onFreeList = true;
+}
+
+void NodeArena::unlinkFree(Slab* slab) noexcept {
+  if (slab->freePrev) {
+    slab->freePrev->freeNext = slab->freeNext;
+  } else {
+    partial_[slab->sizeClass] = slab->freeNext;
+  }
+  if (slab->freeNext) {
+    slab->freeNext->freePrev = slab->freePrev;
+  }
+  slab->freePrev = nullptr;
+  slab->freeNext = nullptr;
+  slab->onFreeList = false;
+}
+
+void* NodeArena::allocate(size_t size) {
+  size = std::max(size, sizeof(FreeNode));
+
+  Slab* slab;
+  if (size > kMaxSmallSize) {
+    slab = newSlab(
+        kLargeClass,
+        roundUp(size, kGranularity),
+        roundUp(headerSize() + size, kSlabSize));
+  } else {
+    auto sizeClass = uint32_t((size + kGranularity - 1) / kGranularity - 1);
+    slab = partial_[sizeClass];
+    if (!slab) {
+      slab = newSlab(sizeClass, (sizeClass + 1) * kGranularity, kSlabSize);
+      linkFree(slab);
+    }
+  }
+
+  void* result;
+  if (slab->freeList) {
+    result = slab->freeList;
+    slab->freeList = slab->freeList->next;
+  } else {
+    result = slab->bump;
+    slab->bump += slab->objectSize;
+  }
+  slab->liveCount++;
+
+  if (slab->onFreeList && !slab->freeList &&
+      slab->bump + slab->objectSize > slab->end) {
+    // The slab is now full
+    unlinkFree(slab);
+  }
+
+  stats_.liveObjects++;
+  stats_.usedBytes += slab->objectSize;
+
+  memset(result, 0, slab->objectSize);
+  return result;
+}
+
+void NodeArena::deallocate(void* ptr) noexcept {
+  if (!ptr) {
+    return;
+  }
+  auto slab = slabFor(ptr);
+  auto arena = slab->arena;
+  if (arena->bulkReleasing_) {
+    return;
+  }
+  arena->release(slab, ptr);
+}
+
+bool NodeArena::isBulkReleasing(const void* ptr) noexcept {
+  return slabFor(ptr)->arena->bulkReleasing_;
+}
+
+void NodeArena::release(Slab* slab, void* ptr) noexcept {
+  slab->liveCount--;
+  stats_.liveObjects--;
+  stats_.usedBytes -= slab->objectSize;
+
+  if (slab->sizeClass == kLargeClass) {
+    freeSlab(slab);
+    return;
+  }
+
+  auto node = static_cast<FreeNode*>(ptr);
+  node->next = slab->freeList;
+  slab->freeList = node;
+
+  if (!slab->onFreeList) {
+    linkFree(slab);
+  }
+}
+
+size_t NodeArena::releaseEmptySlabs() noexcept {
+  size_t released = 0;
+  Slab* slab = allSlabs_;
+  while (slab) {
+    auto next = slab->allNext;
+    if (slab->liveCount == 0) {
+      freeSlab(slab);
+      ++released;
+    }
+    slab = next;
+  }
+  stats_.releasedSlabs += released;
+  return released;
+}
+
+} // namespace watchman
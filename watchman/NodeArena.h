@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <array>
+#include <string>
+#include <vector>
+#include "watchman/fs/FileDescriptor.h"
+
+namespace watchman {
+
+/**
+ * A slab allocator for the watchman_file and watchman_dir nodes that make up
+ * a ViewDatabase.
+ *
+ * Allocations are binned into size classes of kGranularity bytes.  Each
+ * size class owns a list of kSlabSize slabs; a slab is carved into equally
+ * sized objects and tracks its own free list, so that a slab whose objects
+ * have all been freed (eg: after age-out) can be handed back to the system
+ * by releaseEmptySlabs().
+ *
+ * Slabs are aligned to kSlabSize, which lets deallocate() find the owning
+ * slab (and arena) from the object pointer alone.  This keeps the deleters
+ * stored alongside every node stateless.
+ *
+ * Slabs normally come from the heap.  useBackingFile() makes them come from
+ * shared mappings of a file instead, so that under memory pressure the kernel
+ * can write the slabs of cold subtrees back to the file and drop them, as it
+ * does with any file's pages, rather than needing swap.  The nodes still
+ * refer to each other by address, so the file is only good while the arena
+ * lives.
+ *
+ * NodeArena is not thread safe; the ViewDatabase that owns it is protected by
+ * the view lock.
+ */
+class NodeArena {
+ public:
+  static constexpr size_t kSlabSize = 64 * 1024;
+  static constexpr size_t kGranularity = 16;
+  // Nodes larger than this get a dedicated slab.
+  static constexpr size_t kMaxSmallSize = 2048;
+  static constexpr size_t kNumSizeClasses = kMaxSmallSize / kGranularity;
+
+  struct Stats {
+    // Number of slabs currently held by the arena.
+    size_t slabs{0};
+    // Bytes obtained from the system allocator for those slabs.
+    size_t reservedBytes{0};
+    // Bytes handed out to live objects, including size-class rounding.
+    size_t usedBytes{0};
+    // Number of live objects.
+    size_t liveObjects{0};
+    // Number of slabs returned to the system by releaseEmptySlabs().
+    size_t releasedSlabs{0};
+    // With a backing file, how far the slabs have extended it.  Freed slabs
+    // leave holes that take no space on disk.
+    size_t backingFileBytes{0};
+  };
+
+  NodeArena() = default;
+  ~NodeArena();
+
+  NodeArena(const NodeArena&) = delete;
+  NodeArena& operator=(const NodeArena&) = delete;
+
+  /**
+   * Returns zero-filled storage for an object of `size` bytes.
+   * Throws std::bad_alloc on failure.
+   */
+  void* allocate(size_t size);
+
+  /**
+   * Returns storage obtained from allocate() on any NodeArena.
+   * During bulk release this is a no-op; the memory is reclaimed when the
+   * arena is destroyed.
+   */
+  static void deallocate(void* ptr) noexcept;
+
+  /**
+   * Returns true if `ptr` belongs to an arena that is being torn down via
+   * beginBulkRelease().  Node destructors use this to skip bookkeeping
+   * (such as recency index maintenance) that is pointless when the whole
+   * view is going away.
+   */
+  static bool isBulkReleasing(const void* ptr) noexcept;
+
+  /**
+   * Called prior to destroying every node in the arena at once.  After this
+   * point deallocate() does not maintain free lists; all slabs are released
+   * together when the arena is destroyed.
+   */
+  void beginBulkRelease() noexcept {
+    bulkReleasing_ = true;
+  }
+
+  /**
+   * Returns slabs holding no live objects to the system allocator.
+   * Returns the number of slabs released.
+   */
+  size_t releaseEmptySlabs() noexcept;
+
+  /**
+   * Makes the arena map its slabs from the file at path, which is created
+   * or truncated, and unlinked straight away so that it never outlives the
+   * arena.  Must be called before anything is allocated.  Throws
+   * std::system_error if the file can't be made, and on Windows, where it
+   * isn't supported.
+   */
+  void useBackingFile(const std::string& path);
+
+  bool isFileBacked() const {
+    return bool(backingFile_);
+  }
+
+  const Stats& getStats() const {
+    return stats_;
+  }
+
+ private:
+  struct FreeNode {
+    FreeNode* next;
+  };
+
+  struct Slab {
+    NodeArena* arena;
+    // Linkage in the list of all slabs owned by the arena.
+    Slab* allPrev;
+    Slab* allNext;
+    // Linkage in the size class list of slabs with free space.
+    Slab* freePrev;
+    Slab* freeNext;
+    FreeNode* freeList;
+    char* bump;
+    char* end;
+    size_t slabBytes;
+    uint32_t objectSize;
+    uint32_t liveCount;
+    uint32_t sizeClass;
+    bool onFreeList;
+    // Where the slab is mapped from in the backing file, if there is one
+    int64_t fileOffset;
+  };
+
+  static size_t headerSize();
+  static Slab* slabFor(const void* ptr) noexcept;
+
+  Slab* newSlab(uint32_t sizeClass, size_t objectSize, size_t slabBytes);
+  // Maps slabBytes of the backing file at a kSlabSize aligned address
+  void* mapSlab(size_t slabBytes, int64_t& fileOffset);
+  void unmapSlab(void* mem, size_t slabBytes, int64_t fileOffset) noexcept;
+  void freeSlab(Slab* slab) noexcept;
+  void linkFree(Slab* slab) noexcept;
+  void unlinkFree(Slab* slab) noexcept;
+  void release(Slab* slab, void* ptr) noexcept;
+
+  // Pseudo size class used for oversized, single object slabs.
+  static constexpr uint32_t kLargeClass = kNumSizeClasses;
+
+  std::array<Slab*, kNumSizeClasses> partial_{};
+  Slab* allSlabs_{nullptr};
+  Stats stats_;
+  bool bulkReleasing_{false};
+
+  FileDescriptor backingFile_;
+  // The offsets of freed kSlabSize slabs of the backing file, which new
+  // slabs reuse before extending it
+  std::vector<int64_t> freeFileOffsets_;
+};
+
+} // namespace watchman
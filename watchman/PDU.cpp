@@ -10,28 +10,43 @@
 #include <folly/String.h>
 #include "watchman/Constants.h"
 #include "watchman/Logging.h"
+#include "watchman/WatchmanConfig.h"
 #include "watchman/bser.h"
 #include "watchman/portability/WinError.h"
 #include "watchman/watchman_stream.h"
 
 namespace watchman {
 
-PduBuffer::PduBuffer()
-    : buf((char*)malloc(WATCHMAN_IO_BUF_SIZE)), allocd(WATCHMAN_IO_BUF_SIZE) {
-  if (!buf) {
-    throw std::bad_alloc();
-  }
-}
+PduBuffer::PduBuffer() = default;
 
 PduBuffer::~PduBuffer() {
   free(buf);
 }
 
+void PduBuffer::ensureBuffer() {
+  if (!buf) {
+    buf = (char*)malloc(WATCHMAN_IO_BUF_SIZE);
+    if (!buf) {
+      throw std::bad_alloc();
+    }
+    allocd = WATCHMAN_IO_BUF_SIZE;
+  }
+}
+
 void PduBuffer::clear() {
   wpos = 0;
   rpos = 0;
 }
 
+void PduBuffer::release() {
+  if (rpos == wpos) {
+    free(buf);
+    buf = nullptr;
+    allocd = 0;
+    clear();
+  }
+}
+
 // Shunt down, return available size
 uint32_t PduBuffer::shuntDown() {
   if (rpos && rpos == wpos) {
@@ -80,7 +95,8 @@ inline PduType PduBuffer::detectPdu() {
   if (memcmp(buf + rpos, BSER_MAGIC, 2) == 0) {
     return is_bser;
   }
-  if (memcmp(buf + rpos, BSER_V2_MAGIC, 2) == 0) {
+  if (memcmp(buf + rpos, BSER_V2_MAGIC, 2) == 0 ||
+      memcmp(buf + rpos, BSER_V2_ZSTD_MAGIC, 2) == 0) {
     return is_bser_v2;
   }
   return is_json_compact;
@@ -198,6 +214,7 @@ std::optional<json_ref> PduBuffer::readBserPdu(
   uint32_t ideal;
   int r;
 
+  bool compressed = memcmp(buf + rpos, BSER_V2_ZSTD_MAGIC, 2) == 0;
   rpos += 2;
 
   // We don't handle EAGAIN cleanly in here
@@ -249,9 +266,12 @@ std::optional<json_ref> PduBuffer::readBserPdu(
     wpos += r;
   }
 
+  // A client that pipelines its commands may already have sent the next
+  // one, so only the val bytes at rpos belong to this PDU
   std::optional<json_ref> obj;
   try {
-    obj = bunser(buf + rpos, buf + wpos);
+    obj = compressed ? bunser_zstd(buf + rpos, buf + rpos + val)
+                     : bunser(buf + rpos, buf + rpos + val);
   } catch (const BserParseError& e) {
     // Deserialization failed. Log the message that failed to deserialize to
     // stderr.
@@ -260,12 +280,11 @@ std::optional<json_ref> PduBuffer::readBserPdu(
         "decoding BSER failed. The first KB of the hex representation of "
         "message follows:\n{:.1024}\n",
         folly::hexlify(folly::ByteRange{
-            reinterpret_cast<const unsigned char*>(buf + rpos), wpos - rpos}));
+            reinterpret_cast<const unsigned char*>(buf + rpos), size_t(val)}));
     *jerr = e.detail;
   }
 
-  // Ensure that we move the read position to the wpos; we consumed it all
-  rpos = wpos;
+  rpos += val;
 
   stm->setNonBlock(true);
   return obj;
@@ -274,6 +293,7 @@ std::optional<json_ref> PduBuffer::readBserPdu(
 bool PduBuffer::readAndDetectPdu(watchman_stream* stm, json_error_t* jerr) {
   PduFormat detected_format;
 
+  ensureBuffer();
   shuntDown();
   detected_format.type = detectPdu();
   if (detected_format.type == need_data) {
@@ -432,6 +452,7 @@ bool PduBuffer::streamN(
 }
 
 bool PduBuffer::streamPdu(watchman_stream* stm, json_error_t* jerr) {
+  ensureBuffer();
   switch (format.type) {
     case is_json_compact:
     case is_json_pretty:
@@ -461,6 +482,7 @@ bool PduBuffer::streamPdu(watchman_stream* stm, json_error_t* jerr) {
 std::optional<json_ref> PduBuffer::decodePdu(
     watchman_stream* stm,
     json_error_t* jerr) {
+  ensureBuffer();
   switch (format.type) {
     case is_json_compact:
       return readJsonPdu(stm, jerr);
@@ -504,6 +526,17 @@ struct jbuffer_write_data {
     return true;
   }
 
+  bool grow() {
+    auto newBuf = (char*)realloc(jr->buf, size_t(jr->allocd) * 2);
+    if (!newBuf) {
+      errno = ENOMEM;
+      return false;
+    }
+    jr->buf = newBuf;
+    jr->allocd *= 2;
+    return true;
+  }
+
   static int write(const char* buffer, size_t size, void* ptr) {
     auto data = (jbuffer_write_data*)ptr;
     return data->write(buffer, size);
@@ -514,9 +547,9 @@ struct jbuffer_write_data {
       // Accumulate in the buffer
       int room = jr->allocd - jr->wpos;
 
-      // No room? send it over the wire
+      // No room? send it over the wire, or make more if there is no wire
       if (!room) {
-        if (!flush()) {
+        if (stm ? !flush() : !grow()) {
           return -1;
         }
         room = jr->allocd - jr->wpos;
@@ -540,66 +573,124 @@ struct jbuffer_write_data {
 
 } // namespace
 
-ResultErrno<folly::Unit> PduBuffer::bserEncodeToStream(
+bool PduBuffer::bserEncodeToBuffer(
     uint32_t bser_version,
     uint32_t bser_capabilities,
     const json_ref& json,
     watchman_stream* stm) {
+  ensureBuffer();
   jbuffer_write_data data = {stm, this};
 
-  int res = w_bser_write_pdu(
-      bser_version, bser_capabilities, jbuffer_write_data::write, json, &data);
-
-  if (res != 0) {
-    return errno;
-  }
-
-  if (!data.flush()) {
-    return errno;
-  }
-
-  return folly::unit;
+  return w_bser_write_pdu(
+             bser_version,
+             bser_capabilities,
+             jbuffer_write_data::write,
+             json,
+             &data,
+             cfg_get_snapshot()->bserZstdMinBytes) == 0;
 }
 
-ResultErrno<folly::Unit> PduBuffer::jsonEncodeToStream(
+bool PduBuffer::jsonEncodeToBuffer(
     const json_ref& json,
     watchman_stream* stm,
     int flags) {
+  ensureBuffer();
   jbuffer_write_data data = {stm, this};
 
-  int res = json_dump_callback(json, jbuffer_write_data::write, &data, flags);
-  if (res != 0) {
-    return errno;
+  if (json_dump_callback(json, jbuffer_write_data::write, &data, flags) != 0) {
+    return false;
   }
+  return data.write("\n", 1) == 0;
+}
 
-  if (data.write("\n", 1) != 0) {
+ResultErrno<folly::Unit> PduBuffer::bserEncodeToStream(
+    uint32_t bser_version,
+    uint32_t bser_capabilities,
+    const json_ref& json,
+    watchman_stream* stm) {
+  if (!bserEncodeToBuffer(bser_version, bser_capabilities, json, stm)) {
     return errno;
   }
+  return flushToStream(stm);
+}
 
-  if (!data.flush()) {
+ResultErrno<folly::Unit> PduBuffer::jsonEncodeToStream(
+    const json_ref& json,
+    watchman_stream* stm,
+    int flags) {
+  if (!jsonEncodeToBuffer(json, stm, flags)) {
     return errno;
   }
-
-  return folly::unit;
+  return flushToStream(stm);
 }
 
 ResultErrno<folly::Unit> PduBuffer::pduEncodeToStream(
     PduFormat format,
     const json_ref& json,
     watchman_stream* stm) {
+  auto res = pduEncodeToBuffer(format, json, stm);
+  if (res.hasError()) {
+    return res;
+  }
+  return flushToStream(stm);
+}
+
+ResultErrno<folly::Unit> PduBuffer::pduEncodeToBuffer(
+    PduFormat format,
+    const json_ref& json,
+    watchman_stream* stm) {
+  bool encoded;
   switch (format.type) {
     case is_json_compact:
-      return jsonEncodeToStream(json, stm, JSON_COMPACT);
+      encoded = jsonEncodeToBuffer(json, stm, JSON_COMPACT);
+      break;
     case is_json_pretty:
-      return jsonEncodeToStream(json, stm, JSON_INDENT(4));
+      encoded = jsonEncodeToBuffer(json, stm, JSON_INDENT(4));
+      break;
     case is_bser:
-      return bserEncodeToStream(1, format.capabilities, json, stm);
+      encoded = bserEncodeToBuffer(1, format.capabilities, json, stm);
+      break;
     case is_bser_v2:
-      return bserEncodeToStream(2, format.capabilities, json, stm);
+      encoded = bserEncodeToBuffer(2, format.capabilities, json, stm);
+      break;
     case need_data:
     default:
       return EINVAL;
   }
+  if (!encoded) {
+    return errno;
+  }
+  return folly::unit;
+}
+
+ResultErrno<folly::Unit> PduBuffer::flushToStream(watchman_stream* stm) {
+  if (!buf) {
+    return folly::unit;
+  }
+  jbuffer_write_data data = {stm, this};
+  if (!data.flush()) {
+    return errno;
+  }
+  return folly::unit;
+}
+
+ResultErrno<folly::Unit> PduBuffer::flushAvailable(watchman_stream* stm) {
+  while (wpos > rpos) {
+    int x = stm->write(buf + rpos, wpos - rpos);
+    if (x < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return folly::unit;
+    }
+    if (x <= 0) {
+      return x == 0 ? EPIPE : errno;
+    }
+    rpos += x;
+  }
+  clear();
+  if (allocd > WATCHMAN_IO_BUF_SIZE) {
+    // Don't hang on to what the buffer grew to while the reader was behind
+    release();
+  }
+  return folly::unit;
 }
 
 /* vim:ts=2:sw=2:et:
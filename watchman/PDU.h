@@ -36,7 +36,7 @@ struct PduFormat {
 
 class PduBuffer {
  public:
-  char* buf;
+  char* buf = nullptr;
   uint32_t allocd = 0;
   uint32_t rpos = 0;
   uint32_t wpos = 0;
@@ -52,6 +52,13 @@ class PduBuffer {
   ~PduBuffer();
 
   void clear();
+
+  /**
+   * Frees the buffer if it holds no unread data, so that idle connections
+   * don't hold on to it.  It is allocated again when next needed.
+   */
+  void release();
+
   ResultErrno<folly::Unit>
   jsonEncodeToStream(const json_ref& json, Stream* stm, int flags);
   ResultErrno<folly::Unit> bserEncodeToStream(
@@ -63,6 +70,31 @@ class PduBuffer {
   ResultErrno<folly::Unit>
   pduEncodeToStream(PduFormat format, const json_ref& json, Stream* stm);
 
+  /**
+   * Like pduEncodeToStream(), but leaves the encoded PDU in the buffer,
+   * writing to stm only as the buffer fills up.  Several PDUs encoded this
+   * way go out together when flushToStream() is called, typically in a
+   * single write.  If stm is null, the buffer grows to hold the PDU
+   * instead.
+   */
+  ResultErrno<folly::Unit>
+  pduEncodeToBuffer(PduFormat format, const json_ref& json, Stream* stm);
+
+  /** Writes out whatever pduEncodeToBuffer() left in the buffer. */
+  ResultErrno<folly::Unit> flushToStream(Stream* stm);
+
+  /**
+   * Writes out as much of what pduEncodeToBuffer() left in the buffer as a
+   * non-blocking stm takes without blocking.  The rest stays in the
+   * buffer, ahead of whatever is encoded next.
+   */
+  ResultErrno<folly::Unit> flushAvailable(Stream* stm);
+
+  /** The encoded bytes that are yet to be written out. */
+  uint32_t pending() const {
+    return wpos - rpos;
+  }
+
   std::optional<json_ref> decodeNext(Stream* stm, json_error_t* jerr);
 
   bool readAndDetectPdu(Stream* stm, json_error_t* jerr);
@@ -70,6 +102,13 @@ class PduBuffer {
   bool streamPdu(Stream* stm, json_error_t* jerr);
 
  private:
+  bool jsonEncodeToBuffer(const json_ref& json, Stream* stm, int flags);
+  bool bserEncodeToBuffer(
+      uint32_t bser_version,
+      uint32_t bser_capabilities,
+      const json_ref& json,
+      Stream* stm);
+  void ensureBuffer();
   uint32_t shuntDown();
   bool fillBuffer(Stream* stm);
   PduType detectPdu();
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/PathComponentTable.h"
+#include <vector>
+
+namespace watchman {
+
+w_string PathComponentTable::intern(w_string_piece name) {
+  auto it = components_.find(name);
+  if (it != components_.end()) {
+    stats_.hits++;
+    return it->second;
+  }
+
+  auto component = name.asWString();
+  // Key by the interned copy, not by the caller's (possibly transient) piece
+  components_[component.piece()] = component;
+  stats_.components++;
+  stats_.bytes += component.size();
+  return component;
+}
+
+size_t PathComponentTable::releaseUnused() {
+  std::vector<w_string> unused;
+  for (auto& it : components_) {
+    if (it.second.useCount() == 1) {
+      unused.push_back(it.second);
+    }
+  }
+  for (auto& component : unused) {
+    // `component` keeps the key storage alive until after the erase
+    components_.erase(component.piece());
+    stats_.components--;
+    stats_.bytes -= component.size();
+  }
+  return unused.size();
+}
+
+} // namespace watchman
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include "watchman/ChildTable.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * Interns the path components (directory basenames) of a ViewDatabase.
+ *
+ * Large trees repeat the same handful of directory names (`src`, `test`,
+ * `node_modules`, ...) many thousands of times.  Rather than each
+ * watchman_dir owning a private copy of its name, intern() hands out a
+ * reference to a single shared w_string per distinct component; the
+ * w_string reference count tracks how many dirs are using it.
+ *
+ * Components that are no longer referenced by any dir are dropped by
+ * releaseUnused(), which the view calls after age-out.
+ *
+ * Like the rest of the ViewDatabase this is protected by the view lock.
+ */
+class PathComponentTable {
+ public:
+  struct Stats {
+    // Number of distinct components held by the table.
+    size_t components{0};
+    // Bytes of component text held by the table.
+    size_t bytes{0};
+    // Number of intern() calls satisfied by an existing component.
+    size_t hits{0};
+  };
+
+  PathComponentTable() = default;
+  PathComponentTable(const PathComponentTable&) = delete;
+  PathComponentTable& operator=(const PathComponentTable&) = delete;
+
+  /**
+   * Returns the shared instance of the component `name`, creating it if
+   * this is the first time it has been seen.
+   */
+  w_string intern(w_string_piece name);
+
+  /**
+   * Drops components that are referenced only by the table.
+   * Returns the number of components released.
+   */
+  size_t releaseUnused();
+
+  const Stats& getStats() const {
+    return stats_;
+  }
+
+ private:
+  // Keyed by a piece of the mapped w_string itself.
+  ChildTable<w_string> components_;
+  Stats stats_;
+};
+
+} // namespace watchman
@@ -7,6 +7,8 @@
 
 #include "watchman/PendingCollection.h"
 #include <folly/Synchronized.h>
+#include <cmath>
+#include <utility>
 #include "watchman/Cookie.h"
 #include "watchman/Logging.h"
 #include "watchman/watchman_dir.h"
@@ -51,20 +53,45 @@ bool is_path_prefix(
 
 } // namespace watchman
 
+namespace {
+// Recycled nodes beyond this many are released, so that a rare storm of
+// changes doesn't pin its peak memory for the lifetime of the root.
+constexpr size_t kMaxFreeItems = 64 * 1024;
+} // namespace
+
+PendingChanges::~PendingChanges() {
+  tree_.clear();
+  for (auto* list : {pending_, stolen_, free_}) {
+    while (list) {
+      delete std::exchange(list, list->next);
+    }
+  }
+}
+
 void PendingChanges::clear() {
-  pending_.reset();
+  freeChain(std::exchange(pending_, nullptr));
+  freeChain(std::exchange(stolen_, nullptr));
   tree_.clear();
   syncs_.clear();
+  moves_.clear();
+  oldestChange_.reset();
+}
+
+void PendingChanges::noteChange(std::chrono::system_clock::time_point now) {
+  if (!oldestChange_ || now < *oldestChange_) {
+    oldestChange_ = now;
+  }
 }
 
 void PendingChanges::add(
     const w_string& path,
     std::chrono::system_clock::time_point now,
     PendingFlags flags) {
+  ++addCount_;
   auto existing = tree_.search(path);
   if (existing) {
     /* Entry already exists: consolidate */
-    consolidateItem(existing->get(), flags);
+    consolidateItem(*existing, flags);
     /* all done */
     return;
   }
@@ -74,14 +101,15 @@ void PendingChanges::add(
   }
 
   // Try to allocate the new node before we prune any children.
-  auto p = std::make_shared<watchman_pending_fs>(path, now, flags);
+  auto p = allocItem(path, now, flags);
+  noteChange(now);
 
   maybePruneObsoletedChildren(path, flags);
 
   logf(DBG, "add_pending: {} {}\n", path, flags.format());
 
   tree_.insert(path, p);
-  linkHead(std::move(p));
+  linkHead(p);
 }
 
 void PendingChanges::add(
@@ -96,42 +124,54 @@ void PendingChanges::addSync(folly::Promise<folly::Unit> promise) {
   syncs_.push_back(std::move(promise));
 }
 
+void PendingChanges::addMove(
+    const w_string& from,
+    const w_string& to,
+    std::chrono::system_clock::time_point now) {
+  logf(DBG, "add_pending_move: {} -> {}\n", from, to);
+  moves_.push_back(PendingMove{from, to, now});
+}
+
 void PendingChanges::append(
-    std::shared_ptr<watchman_pending_fs> chain,
-    std::vector<folly::Promise<folly::Unit>> syncs) {
-  auto p = std::move(chain);
-  while (p) {
+    watchman_pending_fs* chain,
+    std::vector<folly::Promise<folly::Unit>> syncs,
+    std::vector<PendingMove> moves) {
+  for (auto p = chain; p; p = p->next) {
     auto target_p =
         tree_.search((const uint8_t*)p->path.data(), p->path.size());
     if (target_p) {
       /* Entry already exists: consolidate */
-      consolidateItem(target_p->get(), p->flags);
-      p = std::move(p->next);
+      consolidateItem(*target_p, p->flags);
       continue;
     }
 
     if (isObsoletedByContainingDir(p->path)) {
-      p = std::move(p->next);
       continue;
     }
     maybePruneObsoletedChildren(p->path, p->flags);
 
-    auto next = std::move(p->next);
-    tree_.insert(p->path, p);
-    linkHead(std::move(p));
-
-    p = std::move(next);
+    auto item = allocItem(std::move(p->path), p->now, p->flags);
+    noteChange(item->now);
+    tree_.insert(item->path, item);
+    linkHead(item);
   }
 
   syncs_.insert(
       syncs_.end(),
       std::make_move_iterator(syncs.begin()),
       std::make_move_iterator(syncs.end()));
+  moves_.insert(
+      moves_.end(),
+      std::make_move_iterator(moves.begin()),
+      std::make_move_iterator(moves.end()));
 }
 
-std::shared_ptr<watchman_pending_fs> PendingChanges::stealItems() {
+watchman_pending_fs* PendingChanges::stealItems() {
   tree_.clear();
-  return std::move(pending_);
+  oldestChange_.reset();
+  freeChain(stolen_);
+  stolen_ = std::exchange(pending_, nullptr);
+  return stolen_;
 }
 
 std::vector<folly::Promise<folly::Unit>> PendingChanges::stealSyncs() {
@@ -140,8 +180,18 @@ std::vector<folly::Promise<folly::Unit>> PendingChanges::stealSyncs() {
   return syncs;
 }
 
+std::vector<PendingMove> PendingChanges::stealMoves() {
+  std::vector<PendingMove> moves;
+  std::swap(moves, moves_);
+  return moves;
+}
+
 bool PendingChanges::empty() const {
-  return 0 == tree_.size() && syncs_.empty();
+  return 0 == tree_.size() && syncs_.empty() && moves_.empty();
+}
+
+bool PendingChanges::hasSyncs() const {
+  return !syncs_.empty();
 }
 
 uint32_t PendingChanges::getPendingItemCount() const {
@@ -175,7 +225,7 @@ void PendingChanges::maybePruneObsoletedChildren(
     // function for more on that).
 
     auto callback = [&](const w_string& key,
-                        std::shared_ptr<watchman_pending_fs>& p) -> int {
+                        watchman_pending_fs*& p) -> int {
       w_check(
           p,
           "Pending changes should be removed from both the list and the tree.");
@@ -195,10 +245,13 @@ void PendingChanges::maybePruneObsoletedChildren(
             path);
 
         // Unlink the child from the pending index.
-        unlinkItem(p);
+        auto item = p;
+        unlinkItem(item);
 
-        // Remove it from the art tree.
+        // Remove it from the art tree, which destroys the leaf that `key`
+        // and `p` refer to, then recycle the node.
         tree_.erase(key);
+        freeItem(item);
 
         // Stop iteration because we just invalidated the iterator state
         // by modifying the tree mid-iteration.
@@ -272,32 +325,65 @@ bool PendingChanges::isObsoletedByContainingDir(const w_string& path) {
 }
 
 // Helper to doubly-link a pending item to the head of a collection.
-void PendingChanges::linkHead(std::shared_ptr<watchman_pending_fs>&& p) {
-  p->prev.reset();
+void PendingChanges::linkHead(watchman_pending_fs* p) {
+  p->prev = nullptr;
   p->next = pending_;
   if (p->next) {
     p->next->prev = p;
   }
-  pending_ = std::move(p);
+  pending_ = p;
 }
 
 // Helper to un-doubly-link a pending item.
-void PendingChanges::unlinkItem(std::shared_ptr<watchman_pending_fs>& p) {
+void PendingChanges::unlinkItem(watchman_pending_fs* p) {
   if (pending_ == p) {
     pending_ = p->next;
   }
-  auto prev = p->prev.lock();
 
-  if (prev) {
-    prev->next = p->next;
+  if (p->prev) {
+    p->prev->next = p->next;
   }
 
   if (p->next) {
-    p->next->prev = prev;
+    p->next->prev = p->prev;
+  }
+
+  p->next = nullptr;
+  p->prev = nullptr;
+}
+
+watchman_pending_fs* PendingChanges::allocItem(
+    w_string path,
+    std::chrono::system_clock::time_point now,
+    PendingFlags flags) {
+  if (!free_) {
+    return new watchman_pending_fs(std::move(path), now, flags);
   }
+  auto p = std::exchange(free_, free_->next);
+  --numFree_;
+  p->path = std::move(path);
+  p->now = now;
+  p->flags = flags;
+  p->next = nullptr;
+  return p;
+}
+
+void PendingChanges::freeItem(watchman_pending_fs* p) {
+  if (numFree_ >= kMaxFreeItems) {
+    delete p;
+    return;
+  }
+  // Drop the path now rather than holding its memory in the free list.
+  p->path = w_string{};
+  p->prev = nullptr;
+  p->next = std::exchange(free_, p);
+  ++numFree_;
+}
 
-  p->next.reset();
-  p->prev.reset();
+void PendingChanges::freeChain(watchman_pending_fs* chain) {
+  while (chain) {
+    freeItem(std::exchange(chain, chain->next));
+  }
 }
 
 PendingCollectionBase::PendingCollectionBase(std::condition_variable& cond)
@@ -306,16 +392,90 @@ PendingCollectionBase::PendingCollectionBase(std::condition_variable& cond)
 void PendingCollectionBase::ping() {
   pinged_ = true;
   cond_.notify_all();
+  if (pingCallback_) {
+    pingCallback_();
+  }
+}
+
+void PendingCollectionBase::setPingCallback(std::function<void()> callback) {
+  pingCallback_ = std::move(callback);
 }
 
 bool PendingCollectionBase::checkAndResetPinged() {
-  if (pending_ || pinged_) {
+  if (pending_ || !moves_.empty() || !batches_.empty() || pinged_) {
     pinged_ = false;
     return true;
   }
   return false;
 }
 
+std::unique_ptr<PendingChanges> PendingCollectionBase::handOff(
+    std::unique_ptr<PendingChanges> batch) {
+  // The producer's changes count towards the event rate.
+  addCount_ += batch->getPendingItemCount();
+  if (batches_.empty()) {
+    firstHandOff_ = std::chrono::system_clock::now();
+  }
+  batches_.push_back(std::move(batch));
+
+  if (spares_.empty()) {
+    return nullptr;
+  }
+  auto spare = std::move(spares_.back());
+  spares_.pop_back();
+  return spare;
+}
+
+std::optional<std::chrono::system_clock::time_point>
+PendingCollectionBase::swapBatches(
+    std::vector<std::unique_ptr<PendingChanges>>& batches) {
+  // One batch being filled and one being drained is all that double
+  // buffering needs; any more came from a backlog and are released.
+  constexpr size_t kMaxSpares = 2;
+  for (auto& batch : batches) {
+    if (spares_.size() < kMaxSpares) {
+      spares_.push_back(std::move(batch));
+    }
+  }
+  batches.clear();
+  std::swap(batches, batches_);
+  return std::exchange(firstHandOff_, std::nullopt);
+}
+
+bool PendingCollectionBase::empty() const {
+  return PendingChanges::empty() && batches_.empty();
+}
+
+uint32_t PendingCollectionBase::getPendingItemCount() const {
+  auto count = PendingChanges::getPendingItemCount();
+  for (auto& batch : batches_) {
+    count += batch->getPendingItemCount();
+  }
+  return count;
+}
+
+double PendingCollectionBase::sampleEventRate(
+    std::chrono::steady_clock::time_point now) {
+  // How quickly older changes stop contributing to the rate.
+  constexpr std::chrono::duration<double> kRateWindow{1.0};
+
+  if (lastRateSample_) {
+    std::chrono::duration<double> elapsed = now - *lastRateSample_;
+    if (elapsed.count() <= 0) {
+      return eventRate_;
+    }
+    // An exponentially weighted moving average that tolerates irregular
+    // sampling: a sample that covers more time carries more weight.
+    auto rate = (addCount_ - lastRateSampleCount_) / elapsed.count();
+    auto weight = 1 - std::exp(-elapsed / kRateWindow);
+    eventRate_ += weight * (rate - eventRate_);
+  }
+
+  lastRateSample_ = now;
+  lastRateSampleCount_ = addCount_;
+  return eventRate_;
+}
+
 PendingCollection::PendingCollection()
     : folly::Synchronized<PendingCollectionBase, std::mutex>{
           folly::in_place,
@@ -339,5 +499,17 @@ PendingCollection::LockedPtr PendingCollection::lockAndWait(
   return lock;
 }
 
+std::optional<std::chrono::system_clock::time_point>
+PendingCollection::drainInto(LockedPtr lock, PendingChanges& into) {
+  into.append(lock->stealItems(), lock->stealSyncs(), lock->stealMoves());
+  auto handedOff = lock->swapBatches(drained_);
+  lock.unlock();
+
+  for (auto& batch : drained_) {
+    into.append(batch->stealItems(), batch->stealSyncs(), batch->stealMoves());
+  }
+  return handedOff;
+}
+
 /* vim:ts=2:sw=2:et:
  */
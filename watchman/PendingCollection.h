@@ -11,6 +11,9 @@
 #include <folly/futures/Promise.h>
 #include <chrono>
 #include <condition_variable>
+#include <functional>
+#include <memory>
+#include <optional>
 #include "eden/common/utils/OptionSet.h"
 #include "watchman/thirdparty/libart/src/art.h"
 #include "watchman/watchman_string.h"
@@ -91,10 +94,23 @@ struct PendingChange {
   PendingFlags flags;
 };
 
+/**
+ * A watcher's report that the directory at `from` was renamed to `to`, both
+ * below the root.  The IO thread may then move its record of the subtree to
+ * `to` rather than crawling it again; see InMemoryView::reparentDir.  The
+ * watcher still reports both paths as changed, but needn't ask for `to` to
+ * be crawled recursively.
+ */
+struct PendingMove {
+  w_string from;
+  w_string to;
+  std::chrono::system_clock::time_point now;
+};
+
 struct watchman_pending_fs : watchman::PendingChange {
-  // We own the next entry and will destroy that chain when we
-  // are destroyed.
-  std::shared_ptr<watchman_pending_fs> next;
+  // The next entry in the chain.  Nodes are owned by the PendingChanges that
+  // allocated them, which recycles them once they have been consumed.
+  watchman_pending_fs* next{nullptr};
 
   watchman_pending_fs(
       w_string path,
@@ -104,22 +120,28 @@ struct watchman_pending_fs : watchman::PendingChange {
 
  private:
   // Only used for unlinking during pruning.
-  std::weak_ptr<watchman_pending_fs> prev;
+  watchman_pending_fs* prev{nullptr};
   friend class PendingChanges;
 };
 
 /**
  * Holds a linked list of watchman_pending_fs instances and a trie that
  * efficiently prunes redundant changes.
+ *
+ * The list is intrusive and its nodes come from a free list owned by the
+ * collection, so in the steady state of fill, stealItems(), fill again, no
+ * per-change allocation happens beyond the trie's own.
  */
 class PendingChanges {
  public:
   PendingChanges() = default;
+  ~PendingChanges();
   PendingChanges(PendingChanges&&) = delete;
   PendingChanges& operator=(PendingChanges&&) = delete;
 
   /**
-   * Erase all elements from the collection.
+   * Erase all elements from the collection, including the chain returned by
+   * the last stealItems() call.
    *
    * Any pending syncs will be fulfilled with a BrokenPromise error.
    */
@@ -145,44 +167,92 @@ class PendingChanges {
    */
   void addSync(folly::Promise<folly::Unit> promise);
 
+  /**
+   * Add a directory move.  Moves are kept in the order they are added, apart
+   * from the items.
+   */
+  void addMove(
+      const w_string& from,
+      const w_string& to,
+      std::chrono::system_clock::time_point now);
+
   /**
    * Merge the full contents of `chain` into this collection. They are usually
-   * from a stealItems() call.
+   * from a stealItems() call on another collection.
    *
-   * `chain` is consumed -- the links are broken.
+   * The paths are moved out of `chain`, whose nodes stay owned by the
+   * collection that allocated them.
    */
   void append(
-      std::shared_ptr<watchman_pending_fs> chain,
-      std::vector<folly::Promise<folly::Unit>> syncs);
+      watchman_pending_fs* chain,
+      std::vector<folly::Promise<folly::Unit>> syncs,
+      std::vector<PendingMove> moves = {});
 
-  /* Moves the head of the chain of items to the caller.
-   * The tree is cleared and the caller owns the whole chain */
-  std::shared_ptr<watchman_pending_fs> stealItems();
+  /* Moves the head of the chain of items to the caller and clears the tree.
+   * The chain remains owned by this collection: it stays valid, even across
+   * add() calls, until the next stealItems() or clear(), which recycle its
+   * nodes for reuse. */
+  watchman_pending_fs* stealItems();
 
   std::vector<folly::Promise<folly::Unit>> stealSyncs();
 
+  std::vector<PendingMove> stealMoves();
+
   /**
-   * Returns true if there are no items or syncs.
+   * Returns true if there are no items, syncs or moves.
    */
   bool empty() const;
 
+  /**
+   * Returns true if there are sync requests waiting on the items.
+   */
+  bool hasSyncs() const;
+
   /**
    * Returns the number of unique pending items in the collection. Does not
    * include sync requests.
    */
   uint32_t getPendingItemCount() const;
 
+  /**
+   * Returns the earliest `now` of the items added or appended since the
+   * last stealItems() or clear(), which the latency metrics take as when the
+   * oldest of them was reported.
+   */
+  std::optional<std::chrono::system_clock::time_point> oldestChange() const {
+    return oldestChange_;
+  }
+
  protected:
-  art_tree<std::shared_ptr<watchman_pending_fs>, w_string> tree_;
-  std::shared_ptr<watchman_pending_fs> pending_;
+  art_tree<watchman_pending_fs*, w_string> tree_;
+  watchman_pending_fs* pending_{nullptr};
   std::vector<folly::Promise<folly::Unit>> syncs_;
+  std::vector<PendingMove> moves_;
+  // Number of calls to add(), including those that were consolidated with
+  // or obsoleted by an existing entry.
+  uint64_t addCount_{0};
 
  private:
+  inline void noteChange(std::chrono::system_clock::time_point now);
   void maybePruneObsoletedChildren(w_string path, PendingFlags flags);
   inline void consolidateItem(watchman_pending_fs* p, PendingFlags flags);
   bool isObsoletedByContainingDir(const w_string& path);
-  inline void linkHead(std::shared_ptr<watchman_pending_fs>&& p);
-  inline void unlinkItem(std::shared_ptr<watchman_pending_fs>& p);
+  inline void linkHead(watchman_pending_fs* p);
+  inline void unlinkItem(watchman_pending_fs* p);
+
+  watchman_pending_fs* allocItem(
+      w_string path,
+      std::chrono::system_clock::time_point now,
+      PendingFlags flags);
+  void freeItem(watchman_pending_fs* p);
+  void freeChain(watchman_pending_fs* chain);
+
+  // The chain handed out by the last stealItems() call.
+  watchman_pending_fs* stolen_{nullptr};
+  // Recycled nodes, linked through `next`.
+  watchman_pending_fs* free_{nullptr};
+  size_t numFree_{0};
+  std::optional<std::chrono::system_clock::time_point> oldestChange_;
 };
 
 class PendingCollectionBase : public PendingChanges {
@@ -196,15 +266,71 @@ class PendingCollectionBase : public PendingChanges {
    */
   void ping();
 
+  /**
+   * Installs a function that ping() calls, with this collection locked, for
+   * consumers that don't wait in PendingCollection::lockAndWait.  It must
+   * not block or lock the collection.  Pass nullptr to remove it.
+   */
+  void setPingCallback(std::function<void()> callback);
+
   /**
    * Sets the pinged flag to false.
    * Returns true if previously pinged or PendingChanges is non-empty.
    */
   bool checkAndResetPinged();
 
+  /**
+   * Queues `batch`, which the producer filled without holding the lock, for
+   * the consumer to merge.  Returns an empty batch for the producer to fill
+   * next, or nullptr if no drained batch is available for reuse yet.
+   *
+   * Only pointers move here, so the producer never waits on a merge.
+   */
+  std::unique_ptr<PendingChanges> handOff(
+      std::unique_ptr<PendingChanges> batch);
+
+  /**
+   * Swaps the queued batches into `batches`, keeping the drained batches it
+   * held on entry for reuse by handOff().  Returns when the first of the
+   * queued batches was handed off, if any were.  Used by
+   * PendingCollection::drainInto.
+   */
+  std::optional<std::chrono::system_clock::time_point> swapBatches(
+      std::vector<std::unique_ptr<PendingChanges>>& batches);
+
+  /**
+   * Returns true if there are no items, syncs or queued batches.
+   */
+  bool empty() const;
+
+  /**
+   * Returns the number of pending items, including those in queued batches.
+   */
+  uint32_t getPendingItemCount() const;
+
+  /**
+   * Returns the rate, in changes per second, at which changes have recently
+   * been added, smoothed over roughly the last second.  Each call folds the
+   * changes added since the previous call into the estimate, so it should be
+   * called periodically by a single consumer.
+   */
+  double sampleEventRate(std::chrono::steady_clock::time_point now);
+
  private:
   std::condition_variable& cond_;
   bool pinged_{false};
+  std::function<void()> pingCallback_;
+
+  // Batches handed off by the producer and not yet drained
+  std::vector<std::unique_ptr<PendingChanges>> batches_;
+  // Drained batches, ready to be handed back to the producer
+  std::vector<std::unique_ptr<PendingChanges>> spares_;
+  // When the first of batches_ was handed off
+  std::optional<std::chrono::system_clock::time_point> firstHandOff_;
+
+  std::optional<std::chrono::steady_clock::time_point> lastRateSample_;
+  uint64_t lastRateSampleCount_{0};
+  double eventRate_{0};
 };
 
 class PendingCollection
@@ -220,9 +346,28 @@ class PendingCollection
    */
   LockedPtr lockAndWait(std::chrono::milliseconds timeoutms);
 
+  /**
+   * Merges the items and syncs added directly to the collection, then the
+   * batches handed off since the last call, into `into`.  The batches are
+   * merged after `lock` is released, so the producer only ever waits for a
+   * pointer swap.
+   *
+   * Returns when the first of those batches was handed off, so that the
+   * consumer can tell how long the changes waited for it.
+   *
+   * Must only be called by the consumer thread.
+   */
+  std::optional<std::chrono::system_clock::time_point> drainInto(
+      LockedPtr lock,
+      PendingChanges& into);
+
  private:
   // Notified on ping().
   std::condition_variable cond_;
+
+  // The batches taken by the last drainInto call; only the consumer thread
+  // touches these.
+  std::vector<std::unique_ptr<PendingChanges>> drained_;
 };
 
 // Since the tree has no internal knowledge about path structures, when we
@@ -7,88 +7,110 @@
 
 #include "watchman/PubSub.h"
 #include <algorithm>
+#include <atomic>
 #include <iterator>
+#include <limits>
 
 namespace watchman {
 
+namespace {
+// The successors handed over by the Items that are being released on this
+// thread, while an outer ~Item releases the backlog; see ~Item
+thread_local std::vector<std::shared_ptr<Publisher::Item>>* releasing =
+    nullptr;
+} // namespace
+
+Publisher::Item::~Item() {
+  // Releasing the last reference to a long backlog would otherwise recurse
+  // once per Item.  Instead, the outermost ~Item on this thread drops the
+  // successors in a loop, and the Items freed by that hand it their own
+  // successor rather than dropping it themselves.  Each successor is only
+  // ever released by dropping a shared_ptr, so an Item that a reader still
+  // holds outlives the loop, and is freed by whoever lets go of it last.
+  if (!nextOwner_) {
+    return;
+  }
+  if (releasing) {
+    releasing->push_back(std::move(nextOwner_));
+    return;
+  }
+  std::vector<std::shared_ptr<Item>> successors;
+  successors.push_back(std::move(nextOwner_));
+  releasing = &successors;
+  while (!successors.empty()) {
+    auto next = std::move(successors.back());
+    successors.pop_back();
+    // Runs the nested ~Item if this was the last reference
+    next.reset();
+  }
+  releasing = nullptr;
+}
+
+Publisher::Publisher()
+    : tail_(std::make_shared<Item>(0, json_null())),
+      subscribers_(std::make_shared<const SubscriberList>()) {}
+
 Publisher::Subscriber::Subscriber(
     std::shared_ptr<Publisher> pub,
+    std::shared_ptr<const Item> cursor,
     Notifier notify,
     const std::optional<json_ref>& info)
-    : serial_(0),
+    : cursor_(cursor),
+      serial_(cursor->serial),
       publisher_(std::move(pub)),
       notify_(notify),
       info_(std::move(info)) {}
 
 Publisher::Subscriber::~Subscriber() {
-  // In the loop below we may own a reference to some other
-  // Subscriber instance.  That is fine, but we need to take
-  // care: if we end up with the last reference to that subscriber
-  // we will end up calling its destructor and effective recurse
-  // and attempt to acquire the wlock.   We therefore need to
-  // defer releasing any of the shared_ptr's that we lock in
-  // the loop below until after we have released the wlock.
-  std::vector<std::shared_ptr<Subscriber>> subscribers;
+  // Our own weak_ptr has already expired, so pruning the expired entries
+  // removes us.  We must not lock() the others: if we ended up holding the
+  // last reference to one of them, its destructor would run here and try
+  // to acquire writeMutex_ again.
+  std::lock_guard<std::mutex> lock(publisher_->writeMutex_);
+  auto current = publisher_->subscribers_.load(std::memory_order_acquire);
+  auto remaining = std::make_shared<SubscriberList>();
+  remaining->reserve(current->size());
+  std::copy_if(
+      current->begin(),
+      current->end(),
+      std::back_inserter(*remaining),
+      [](const std::weak_ptr<Subscriber>& sub) { return !sub.expired(); });
+  publisher_->subscribers_.store(
+      std::move(remaining), std::memory_order_release);
+}
 
-  {
-    auto wlock = publisher_->state_.wlock();
-    auto it = wlock->subscribers.begin();
-    while (it != wlock->subscribers.end()) {
-      auto sub = it->lock();
-      // Prune vacated weak_ptr's or those that point to us
-      if (!sub || sub.get() == this) {
-        it = wlock->subscribers.erase(it);
-      } else {
-        ++it;
-        // Defer releasing the sub reference until after we've
-        // release the wlock!
-        subscribers.emplace_back(std::move(sub));
-      }
-    }
-    // Take this opportunity to reap anything that is no longer
-    // referenced now that we've removed some subscriber(s)
-    wlock->collectGarbage();
+void Publisher::Subscriber::advanceSerial(uint64_t serial) {
+  auto current = serial_.load(std::memory_order_relaxed);
+  while (current < serial &&
+         !serial_.compare_exchange_weak(
+             current, serial, std::memory_order_release)) {
   }
-
-  // It is now safe for subscribers to be torn down and release
-  // any references we took ownership of in the loop above.
 }
 
 void Publisher::Subscriber::getPending(
     std::vector<std::shared_ptr<const Item>>& pending) {
-  {
-    auto rlock = publisher_->state_.rlock();
-    auto& items = rlock->items;
-
-    if (items.empty()) {
-      return;
+  auto start = pending.size();
+  auto cursor = cursor_.load(std::memory_order_acquire);
+  for (;;) {
+    auto last = cursor;
+    for (auto item = last->next(); item; item = last->next()) {
+      pending.push_back(item);
+      last = std::move(item);
     }
-
-    // First we walk back to find the end of the range that
-    // we have seen previously.
-    int firstIndex;
-    for (firstIndex = int(items.size()) - 1; firstIndex >= 0; --firstIndex) {
-      if (items[firstIndex]->serial <= serial_) {
-        break;
-      }
-    }
-
-    // We found the item before the one we really want, so
-    // increment the index; we'll copy the remaining items.
-    ++firstIndex;
-    bool updated = false;
-
-    while (firstIndex < int(items.size())) {
-      pending.push_back(items[firstIndex]);
-      ++firstIndex;
-      updated = true;
+    if (last == cursor) {
+      return;
     }
 
-    if (updated) {
-      serial_ = pending.back()->serial;
+    // Moving the cursor releases our reference to the items that we have
+    // now consumed.  If trimBacklog moved it since we loaded it, it has
+    // counted some of these items as dropped, so read again from where it
+    // left the cursor rather than delivering them as well.
+    if (cursor_.compare_exchange_strong(
+            cursor, last, std::memory_order_acq_rel)) {
+      advanceSerial(last->serial);
+      return;
     }
-
-    return;
+    pending.erase(pending.begin() + start, pending.end());
   }
 }
 
@@ -107,106 +129,133 @@ void getPending(
 std::shared_ptr<Publisher::Subscriber> Publisher::subscribe(
     Notifier notify,
     const std::optional<json_ref>& info) {
-  auto sub =
-      std::make_shared<Publisher::Subscriber>(shared_from_this(), notify, info);
-  state_.wlock()->subscribers.emplace_back(sub);
+  std::lock_guard<std::mutex> lock(writeMutex_);
+  auto sub = std::make_shared<Publisher::Subscriber>(
+      shared_from_this(), tail_, notify, info);
+
+  auto current = subscribers_.load(std::memory_order_acquire);
+  auto updated = std::make_shared<SubscriberList>(*current);
+  updated->emplace_back(sub);
+  subscribers_.store(std::move(updated), std::memory_order_release);
   return sub;
 }
 
 bool Publisher::hasSubscribers() const {
-  return !state_.rlock()->subscribers.empty();
+  return !subscribers_.load(std::memory_order_acquire)->empty();
 }
 
-void Publisher::state::collectGarbage() {
-  if (items.empty()) {
-    return;
-  }
+bool Publisher::enqueue(json_ref&& payload) {
+  std::shared_ptr<const SubscriberList> subscribers;
 
-  uint64_t minSerial = std::numeric_limits<uint64_t>::max();
-  for (auto& it : subscribers) {
-    auto sub = it.lock();
-    if (sub) {
-      minSerial = std::min(minSerial, sub->getSerial());
+  {
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    subscribers = subscribers_.load(std::memory_order_acquire);
+    if (subscribers->empty()) {
+      return false;
     }
+
+    auto item = std::make_shared<Item>(tail_->serial + 1, std::move(payload));
+    // Subscribers only read nextOwner_ after observing next_, so it must
+    // be in place before next_ is published.
+    tail_->nextOwner_ = item;
+    tail_->next_.store(item.get(), std::memory_order_release);
+    tail_ = std::move(item);
   }
 
-  while (!items.empty() && items.front()->serial < minSerial) {
-    items.pop_front();
+  // and notify them outside of the lock
+  for (auto& sub_ref : *subscribers) {
+    auto sub = sub_ref.lock();
+    if (!sub) {
+      continue;
+    }
+    auto& n = sub->getNotify();
+    if (n) {
+      n();
+    }
   }
+  return true;
 }
 
-bool Publisher::enqueue(json_ref&& payload) {
+size_t Publisher::trimBacklog(size_t keep) {
   std::vector<std::shared_ptr<Subscriber>> subscribers;
-
+  uint64_t tailSerial;
   {
-    auto wlock = state_.wlock();
-
-    // We need to collect live references for the notify portion,
-    // but since we're holding the wlock, take this opportunity to
-    // detect and prune dead subscribers and clean up some garbage.
-    auto it = wlock->subscribers.begin();
-    while (it != wlock->subscribers.end()) {
-      auto sub = it->lock();
-      // Prune vacated weak_ptr's
-      if (!sub) {
-        it = wlock->subscribers.erase(it);
-      } else {
-        ++it;
-        // Remember that live reference so that we can notify
-        // outside of the lock below.
-        subscribers.emplace_back(std::move(sub));
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    tailSerial = tail_->serial;
+    for (auto& sub_ref : *subscribers_.load(std::memory_order_acquire)) {
+      if (auto sub = sub_ref.lock()) {
+        subscribers.push_back(std::move(sub));
       }
     }
-
-    wlock->collectGarbage();
-
-    if (subscribers.empty()) {
-      return false;
-    }
-
-    wlock->items.emplace_back(
-        std::make_shared<Item>(wlock->nextSerial++, std::move(payload)));
   }
 
-  // and notify them outside of the lock
+  size_t skipped = 0;
   for (auto& sub : subscribers) {
-    auto& n = sub->getNotify();
-    if (n) {
-      n();
+    auto cursor = sub->cursor_.load(std::memory_order_acquire);
+    // The subscriber may have read past tailSerial since we sampled it
+    if (cursor->serial + keep >= tailSerial) {
+      continue;
+    }
+    auto target = cursor;
+    for (auto n = tailSerial - cursor->serial - keep; n > 0; --n) {
+      target = target->next();
+    }
+    auto serial = target->serial;
+    auto dropped = serial - cursor->serial;
+    // If getPending moved the cursor meanwhile, the subscriber is reading
+    // and will release the backlog itself
+    if (sub->cursor_.compare_exchange_strong(
+            cursor, std::move(target), std::memory_order_acq_rel)) {
+      sub->advanceSerial(serial);
+      sub->dropped_.fetch_add(dropped, std::memory_order_relaxed);
+      skipped += dropped;
     }
   }
-  return true;
+  return skipped;
 }
 
 json_ref Publisher::getDebugInfo() const {
   auto ret = json_object();
 
-  auto rlock = state_.rlock();
-  ret.set("next_serial", json_integer(rlock->nextSerial));
+  std::vector<std::shared_ptr<Subscriber>> subscribers;
+  std::shared_ptr<const Item> oldest;
+  {
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    ret.set("next_serial", json_integer(tail_->serial + 1));
+    for (auto& sub_ref : *subscribers_.load(std::memory_order_acquire)) {
+      if (auto sub = sub_ref.lock()) {
+        subscribers.push_back(std::move(sub));
+      }
+    }
+  }
 
   std::vector<json_ref> subscribers_arr;
+  uint64_t minSerial = std::numeric_limits<uint64_t>::max();
 
-  for (auto& sub_ref : rlock->subscribers) {
-    auto sub = sub_ref.lock();
-    if (sub) {
-      auto sub_json = json_object({
-          {"serial", json_integer(sub->getSerial())},
-      });
-      if (auto& info = sub->getInfo()) {
-        sub_json.set("info", json_ref(*info));
-      }
-      subscribers_arr.push_back(std::move(sub_json));
-    } else {
-      // This is a subscriber that is now dead. It will be cleaned up the next
-      // time enqueue is called.
+  for (auto& sub : subscribers) {
+    auto cursor = sub->getCursor();
+    if (cursor->serial < minSerial) {
+      minSerial = cursor->serial;
+      oldest = std::move(cursor);
+    }
+
+    auto sub_json = json_object({
+        {"serial", json_integer(sub->getSerial())},
+        {"dropped", json_integer(sub->getDropped())},
+    });
+    if (auto& info = sub->getInfo()) {
+      sub_json.set("info", json_ref(*info));
     }
+    subscribers_arr.push_back(std::move(sub_json));
   }
 
   ret.set("subscribers", json_array(std::move(subscribers_arr)));
 
+  // Every item that has yet to be consumed by the slowest subscriber
   std::vector<json_ref> items_arr;
 
-  for (auto& item : rlock->items) {
+  for (auto item = oldest ? oldest->next() : nullptr; item;
+       item = item->next()) {
     auto item_json = json_object(
         {{"serial", json_integer(item->serial)}, {"payload", item->payload}});
     items_arr.emplace_back(item_json);
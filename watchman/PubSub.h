@@ -6,27 +6,55 @@
  */
 
 #pragma once
-#include <folly/Synchronized.h>
+#include <folly/concurrency/AtomicSharedPtr.h>
 #include "watchman/thirdparty/jansson/jansson.h"
 #include "watchman/watchman_string.h"
 #include "watchman/watchman_system.h"
 
-#include <deque>
+#include <atomic>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <vector>
 
 namespace watchman {
 
+/**
+ * Broadcasts a stream of json payloads to any number of subscribers.
+ *
+ * The stream is a singly linked list of Items that is only ever appended to.
+ * Each subscriber holds a reference to the last Item it consumed and reads
+ * the rest by following the links, so delivery doesn't take any locks or
+ * contend with publishers or other subscribers.  Items are released once
+ * every subscriber has read past them.
+ */
 class Publisher : public std::enable_shared_from_this<Publisher> {
  public:
-  struct Item {
+  class Item {
+   public:
     Item(uint64_t s, json_ref p) : serial{s}, payload{std::move(p)} {}
+    ~Item();
 
-    // copy of nextSerial_ at the time this was created.
-    // The item can be released when all subscribers have
-    // observed this serial number.
+    Item(const Item&) = delete;
+    Item& operator=(const Item&) = delete;
+
+    // Position of this item in the stream.  The item is released
+    // once all subscribers have observed this serial number.
     uint64_t serial;
     json_ref payload;
+
+    // Returns the item that was published after this one, if any.
+    std::shared_ptr<const Item> next() const {
+      return next_.load(std::memory_order_acquire) ? nextOwner_ : nullptr;
+    }
+
+   private:
+    // Set once, by the publisher, before next_ is.
+    std::shared_ptr<Item> nextOwner_;
+    std::atomic<const Item*> next_{nullptr};
+
+    friend class Publisher;
   };
 
   // Generic callback that subscribers can register to arrange
@@ -35,9 +63,16 @@ class Publisher : public std::enable_shared_from_this<Publisher> {
 
   // Each subscriber is represented by one of these
   class Subscriber : public std::enable_shared_from_this<Subscriber> {
+    // The last Item to be consumed by this subscriber, which keeps it and
+    // everything published after it alive.  Written by getPending, and by
+    // trimBacklog to skip the subscriber forward; both compare-and-swap it
+    // so that neither moves it back over the other.
+    folly::atomic_shared_ptr<const Item> cursor_;
     // The serial of the last Item to be consumed by
-    // this subscriber.
-    uint64_t serial_;
+    // this subscriber.  Only ever increases.
+    std::atomic<uint64_t> serial_;
+    // The Items that trimBacklog skipped over before we read them
+    std::atomic<uint64_t> dropped_{0};
     // Subscriber keeps the publisher alive so that no Items are lost
     // if the Publisher is released before all of the subscribers.
     std::shared_ptr<Publisher> publisher_;
@@ -46,19 +81,35 @@ class Publisher : public std::enable_shared_from_this<Publisher> {
     // Information for debugging purposes
     const std::optional<json_ref> info_;
 
+    // Moves serial_ up to serial, unless it is already past it
+    void advanceSerial(uint64_t serial);
+
+    // For trimBacklog
+    friend class Publisher;
+
    public:
     ~Subscriber();
     Subscriber(
         std::shared_ptr<Publisher> pub,
+        std::shared_ptr<const Item> cursor,
         Notifier notify,
         const std::optional<json_ref>& info);
     Subscriber(const Subscriber&) = delete;
 
     // Returns all as yet unseen published items for this subscriber.
+    // Each subscriber must only be read from one thread at a time.
     void getPending(std::vector<std::shared_ptr<const Item>>& pending);
 
     uint64_t getSerial() const {
-      return serial_;
+      return serial_.load(std::memory_order_acquire);
+    }
+
+    uint64_t getDropped() const {
+      return dropped_.load(std::memory_order_relaxed);
+    }
+
+    std::shared_ptr<const Item> getCursor() const {
+      return cursor_.load(std::memory_order_acquire);
     }
 
     Notifier& getNotify() {
@@ -70,9 +121,12 @@ class Publisher : public std::enable_shared_from_this<Publisher> {
     }
   };
 
+  Publisher();
+
   // Register a new subscriber.
   // When the Subscriber object is released, the registration is
-  // automatically removed.
+  // automatically removed.  The subscriber sees the items that are
+  // published after it is registered.
   std::shared_ptr<Subscriber> subscribe(
       Notifier notify,
       const std::optional<json_ref>& info = std::nullopt);
@@ -86,24 +140,28 @@ class Publisher : public std::enable_shared_from_this<Publisher> {
   // Returns true if the item was queued.
   bool enqueue(json_ref&& payload);
 
+  // Moves each subscriber that is more than `keep` items behind forward,
+  // so that it only sees the newest `keep` of its unread items, and the
+  // older ones can be released.  Those subscribers never see the items
+  // that were skipped, so this is only for streams where losing items is
+  // better than holding on to them, such as the log.  Returns the number
+  // of items skipped, summed across the subscribers.
+  size_t trimBacklog(size_t keep);
+
   // Return debugging info useful for state inspection.
   json_ref getDebugInfo() const;
 
  private:
-  struct state {
-    state() = default;
-    state(const state&) = delete;
-    // Serial number to use for the next Item
-    uint64_t nextSerial{1};
-    // The stream of Items
-    std::deque<std::shared_ptr<const Item>> items;
-    // The subscribers
-    std::vector<std::weak_ptr<Subscriber>> subscribers;
-
-    void collectGarbage();
-    void enqueue(json_ref&& payload);
-  };
-  folly::Synchronized<state> state_;
+  using SubscriberList = std::vector<std::weak_ptr<Subscriber>>;
+
+  // Serializes publishers, so that serial numbers follow the order of the
+  // stream, and changes to the subscriber list.  Never taken by readers.
+  mutable std::mutex writeMutex_;
+  // The most recently published Item
+  std::shared_ptr<Item> tail_;
+  // Replaced, rather than modified, when subscribers come and go, so that
+  // publishers can notify a snapshot of it without locking
+  folly::atomic_shared_ptr<const SubscriberList> subscribers_;
 
   friend class Subscriber;
 };
@@ -35,6 +35,13 @@ void QueryableView::allFilesGenerator(const Query*, QueryContext*) const {
   throw QueryExecError("allFilesGenerator not implemented");
 }
 
+void QueryableView::changedFilesGenerator(
+    const Query*,
+    QueryContext*,
+    ClockTicks) const {
+  throw QueryExecError("changedFilesGenerator not implemented");
+}
+
 ClockTicks QueryableView::getLastAgeOutTickValue() const {
   return 0;
 }
@@ -46,6 +53,22 @@ std::chrono::system_clock::time_point QueryableView::getLastAgeOutTimeStamp()
 
 void QueryableView::ageOut(PerfSample&, std::chrono::seconds) {}
 
+bool QueryableView::ageOutStep(
+    PerfSample& sample,
+    std::chrono::seconds minAge) {
+  ageOut(sample, minAge);
+  return true;
+}
+
+bool QueryableView::isAgeOutInProgress() const {
+  return false;
+}
+
+json_ref QueryableView::relieveMemoryPressure() {
+  return json_object(
+      {{"query_results", json_integer(queryResultCache_.clear())}});
+}
+
 bool QueryableView::isVCSOperationInProgress() const {
   static const std::vector<w_string> lockFiles{".hg/wlock", ".git/index.lock"};
   return doAnyOfTheseFilesExist(lockFiles);
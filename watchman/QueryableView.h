@@ -8,10 +8,14 @@
 #pragma once
 
 #include <folly/futures/Future.h>
+#include <chrono>
+#include <optional>
+#include <stdexcept>
 #include <vector>
 #include "watchman/Clock.h"
 #include "watchman/CookieSync.h"
 #include "watchman/PerfSample.h"
+#include "watchman/query/QueryResultCache.h"
 #include "watchman/watchman_string.h"
 
 namespace watchman {
@@ -46,12 +50,38 @@ class QueryableView : public std::enable_shared_from_this<QueryableView> {
 
   virtual void allFilesGenerator(const Query* query, QueryContext* ctx) const;
 
+  /**
+   * Returns true if this view implements changedFilesGenerator(), which
+   * allows the results of fresh instance queries to be cached in
+   * getQueryResultCache().
+   */
+  virtual bool supportsQueryResultCache() const {
+    return false;
+  }
+
+  /**
+   * Walks the files that changed after sinceTicks, whether or not they
+   * still exist, regardless of the since clause of the query.
+   */
+  virtual void changedFilesGenerator(
+      const Query* query,
+      QueryContext* ctx,
+      ClockTicks sinceTicks) const;
+
   virtual ClockPosition getMostRecentRootNumberAndTickValue() const = 0;
   virtual w_string getCurrentClockString() const = 0;
   virtual ClockTicks getLastAgeOutTickValue() const;
   virtual std::chrono::system_clock::time_point getLastAgeOutTimeStamp() const;
   virtual void ageOut(PerfSample& sample, std::chrono::seconds minAge);
 
+  /**
+   * Performs the next bounded step of an age-out, beginning one if none is
+   * in progress, so that the work can be spread over several IO thread
+   * iterations.  Returns true if the age-out is now complete.
+   */
+  virtual bool ageOutStep(PerfSample& sample, std::chrono::seconds minAge);
+  virtual bool isAgeOutInProgress() const;
+
   virtual folly::SemiFuture<folly::Unit> waitForSettle(
       std::chrono::milliseconds settle_period) = 0;
   virtual CookieSync::SyncResult syncToNow(
@@ -89,6 +119,65 @@ class QueryableView : public std::enable_shared_from_this<QueryableView> {
    */
   virtual void wakeThreads() {}
 
+  /**
+   * Asks the view to recrawl the subtree at path, rather than the whole
+   * root.  Returns false if the view can't, in which case the caller should
+   * fall back to a full recrawl.
+   */
+  virtual bool recrawlSubtree(const w_string& /*path*/) {
+    return false;
+  }
+
+  /**
+   * Crawls any directories whose crawl the view deferred and that the
+   * query's generators may need to look in, before the query is evaluated.
+   */
+  virtual void crawlDeferredDirs(const Query* /*query*/) {}
+
+  /**
+   * Brings back the view if it hibernated while its root was idle, before a
+   * query is evaluated against it.
+   */
+  virtual void rehydrate() {}
+
+  /**
+   * Releases what the view can rebuild on demand, because the system is
+   * short of memory.  Returns a description of what was released, for the
+   * log.  The default drops the query result cache.
+   */
+  virtual json_ref relieveMemoryPressure();
+
+  /**
+   * While the initial crawl is running, waits until it has crawled every
+   * directory that the query's generators may look in, and returns true:
+   * the query can then be answered without a cookie sync.  Returns false
+   * if the view doesn't answer queries before its crawl is done, or once
+   * the crawl is done.  Throws std::system_error if timeout passes first.
+   */
+  virtual bool waitUntilCrawledFor(
+      const Query* /*query*/,
+      std::chrono::milliseconds /*timeout*/) {
+    return false;
+  }
+
+  /**
+   * Writes a ViewSnapshot of the view to path, for another daemon watching
+   * a copy of the same tree to seed its view from.  Returns the number of
+   * files written.  Throws if the view can't be exported.
+   */
+  virtual size_t exportViewSnapshot(const w_string& /*path*/) {
+    throw std::runtime_error("this watcher can't export its view");
+  }
+
+  /**
+   * Returns the deepest directory that contains every change this view has
+   * been notified of recently, or nullopt if that is the root itself or the
+   * view doesn't track it.
+   */
+  virtual std::optional<w_string> getRecentChangeScope() const {
+    return std::nullopt;
+  }
+
   virtual const w_string& getName() const = 0;
   virtual json_ref getWatcherDebugInfo() const = 0;
   virtual void clearWatcherDebugInfo() = 0;
@@ -100,7 +189,13 @@ class QueryableView : public std::enable_shared_from_this<QueryableView> {
     return scm_.get();
   }
 
+  QueryResultCache& getQueryResultCache() {
+    return queryResultCache_;
+  }
+
  private:
+  QueryResultCache queryResultCache_;
+
   // The source control system that we detected during initialization
   std::unique_ptr<SCM> scm_;
 };
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/RecencyIndex.h"
+#include "watchman/watchman_file.h"
+
+namespace watchman {
+
+namespace {
+// Don't bother compacting small indices from touch()
+constexpr size_t kMinClearedSlotsToCompact = 4 * RecencyIndex::kChunkSize;
+} // namespace
+
+void RecencyIndex::appendTo(
+    std::vector<std::unique_ptr<Chunk>>& chunks,
+    watchman_file* file,
+    bool columns) {
+  if (chunks.empty() || chunks.back()->used == kChunkSize) {
+    chunks.push_back(std::make_unique<Chunk>());
+    if (columns) {
+      chunks.back()->columns = std::make_unique<FileColumns>();
+    }
+  }
+  auto& chunk = *chunks.back();
+  if (columns) {
+    chunk.columns->set(chunk.used, file);
+  }
+  auto slot = &chunk.files[chunk.used++];
+  *slot = file;
+  file->recencySlot = slot;
+}
+
+void RecencyIndex::enableColumns() {
+  columns_ = true;
+}
+
+void RecencyIndex::touch(watchman_file* file) {
+  if (file->recencySlot) {
+    if (file == newest()) {
+      if (!columns_) {
+        return;
+      }
+      // It may have changed again since it was last touched, so its row
+      // needs refreshing, wherever it is
+      auto& chunk = *chunks_.back();
+      if (file->recencySlot >= chunk.files &&
+          file->recencySlot < chunk.files + chunk.used) {
+        chunk.columns->set(file->recencySlot - chunk.files, file);
+        return;
+      }
+    }
+    *file->recencySlot = nullptr;
+    ++clearedSlots_;
+  }
+  appendTo(chunks_, file, columns_);
+
+  if (clearedSlots_ >= kMinClearedSlotsToCompact &&
+      clearedSlots_ * 2 >= chunks_.size() * kChunkSize) {
+    compact();
+  }
+}
+
+void RecencyIndex::remove(watchman_file* file) {
+  if (file->recencySlot) {
+    *file->recencySlot = nullptr;
+    file->recencySlot = nullptr;
+    ++clearedSlots_;
+  }
+}
+
+void RecencyIndex::append(Batch& batch, watchman_file* file) {
+  appendTo(batch.chunks_, file, false);
+}
+
+void RecencyIndex::splice(Batch& batch) {
+  for (auto& chunk : batch.chunks_) {
+    if (columns_) {
+      // A batch doesn't know which index it is for, so its rows are filled
+      // in as it joins this one
+      chunk->columns = std::make_unique<FileColumns>();
+      for (size_t i = 0; i < chunk->used; ++i) {
+        if (chunk->files[i]) {
+          chunk->columns->set(i, chunk->files[i]);
+        }
+      }
+    }
+    chunks_.push_back(std::move(chunk));
+  }
+  batch.chunks_.clear();
+}
+
+watchman_file* RecencyIndex::newest() const {
+  watchman_file* result = nullptr;
+  forEachNewestFirst([&](watchman_file* file) {
+    result = file;
+    return false;
+  });
+  return result;
+}
+
+size_t RecencyIndex::countNewerThan(ClockTicks ticks) const {
+  // Files are held in the order in which they changed, so the newer files
+  // fill the chunks from the first one that ends with such a file.
+  auto newestIn = [](const Chunk& chunk) -> watchman_file* {
+    for (size_t i = chunk.used; i-- > 0;) {
+      if (chunk.files[i]) {
+        return chunk.files[i];
+      }
+    }
+    return nullptr;
+  };
+  size_t lo = 0;
+  size_t hi = chunks_.size();
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    auto file = newestIn(*chunks_[mid]);
+    if (file && file->otime.ticks > ticks) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  if (lo == chunks_.size()) {
+    return 0;
+  }
+
+  size_t count = 0;
+  const Chunk& first = *chunks_[lo];
+  for (size_t i = 0; i < first.used; ++i) {
+    if (!first.files[i] || first.files[i]->otime.ticks > ticks) {
+      ++count;
+    }
+  }
+  for (size_t c = lo + 1; c < chunks_.size(); ++c) {
+    count += chunks_[c]->used;
+  }
+  return count;
+}
+
+size_t RecencyIndex::compact() {
+  size_t writeChunk = 0;
+  size_t writePos = 0;
+  size_t reclaimed = 0;
+
+  for (size_t c = 0; c < chunks_.size(); ++c) {
+    auto& chunk = *chunks_[c];
+    for (size_t i = 0; i < chunk.used; ++i) {
+      auto file = chunk.files[i];
+      if (!file) {
+        ++reclaimed;
+        continue;
+      }
+      // The write position never passes the read position, so this only
+      // ever moves entries towards the old end.
+      auto& dest = *chunks_[writeChunk];
+      if (columns_) {
+        dest.columns->set(writePos, file);
+      }
+      auto slot = &dest.files[writePos];
+      *slot = file;
+      file->recencySlot = slot;
+      if (++writePos == kChunkSize) {
+        dest.used = kChunkSize;
+        ++writeChunk;
+        writePos = 0;
+      }
+    }
+  }
+
+  if (writePos > 0) {
+    chunks_[writeChunk]->used = uint32_t(writePos);
+    ++writeChunk;
+  }
+  chunks_.resize(writeChunk);
+
+  clearedSlots_ = 0;
+  ++compactions_;
+  return reclaimed;
+}
+
+RecencyIndex::Stats RecencyIndex::getStats() const {
+  Stats stats;
+  stats.chunks = chunks_.size();
+  for (auto& chunk : chunks_) {
+    stats.slots += chunk->used;
+    if (chunk->columns) {
+      stats.columnBytes += sizeof(FileColumns);
+    }
+  }
+  stats.clearedSlots = clearedSlots_;
+  stats.compactions = compactions_;
+  return stats;
+}
+
+} // namespace watchman
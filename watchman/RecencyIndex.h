@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "watchman/FileColumns.h"
+
+struct watchman_file;
+
+namespace watchman {
+
+/**
+ * Orders the files of a ViewDatabase by the time we last observed a change
+ * to them, replacing the intrusive doubly linked list that used to thread
+ * through every watchman_file.
+ *
+ * Files are appended, in the order they are marked changed, to fixed-size
+ * chunks of file pointers; the newest entry is the last slot of the last
+ * chunk.  A since query walks the chunks backwards, which streams through
+ * contiguous memory instead of chasing a pointer per node.
+ *
+ * Each file remembers the address of its slot (watchman_file::recencySlot).
+ * When a file is marked changed again its old slot is cleared and it is
+ * appended afresh; when a file node is destroyed it clears its own slot.
+ * Cleared slots are skipped by iteration and squeezed out by compact(),
+ * which runs during age-out and whenever cleared slots outnumber live ones.
+ *
+ * With enableColumns(), each chunk also keeps FileColumns for its files,
+ * so that forEachNewestFirstInChunksMatching() can skip the files that a
+ * ColumnFilter rules out without touching them.
+ *
+ * Not thread safe; the owning ViewDatabase is protected by the view lock.
+ * Concurrent const access, such as several threads iterating disjoint chunk
+ * ranges under a read lock, is fine.
+ */
+class RecencyIndex {
+ public:
+  static constexpr size_t kChunkSize = 1024;
+
+  struct Chunk {
+    uint32_t used{0};
+    watchman_file* files[kChunkSize];
+    // Only if the index has columns
+    std::unique_ptr<FileColumns> columns;
+  };
+  static_assert(kChunkSize == FileColumns::kRows);
+
+  /**
+   * A run of files kept in change order off to the side of the index, so
+   * that a crawl can attach a whole directory's worth of new files with
+   * splice() rather than one at a time.
+   */
+  class Batch {
+   public:
+    Batch() = default;
+    Batch(const Batch&) = delete;
+    Batch& operator=(const Batch&) = delete;
+
+    bool empty() const {
+      return chunks_.empty();
+    }
+
+   private:
+    friend class RecencyIndex;
+    std::vector<std::unique_ptr<Chunk>> chunks_;
+  };
+
+  struct Stats {
+    // Number of chunks currently allocated.
+    size_t chunks{0};
+    // Number of slots in use, including cleared ones.
+    size_t slots{0};
+    // Number of cleared slots by the last count; see clearedSlots_.
+    size_t clearedSlots{0};
+    // Number of times compact() has been run.
+    size_t compactions{0};
+    // Bytes held by the chunks' FileColumns.
+    size_t columnBytes{0};
+  };
+
+  RecencyIndex() = default;
+  RecencyIndex(const RecencyIndex&) = delete;
+  RecencyIndex& operator=(const RecencyIndex&) = delete;
+
+  /** Starts keeping FileColumns.  Must be called while the index is empty. */
+  void enableColumns();
+
+  bool hasColumns() const {
+    return columns_;
+  }
+
+  /** Makes file the most recently changed file. */
+  void touch(watchman_file* file);
+
+  /**
+   * Appends file, which must not currently be in the index, to batch.
+   * It becomes visible to iteration once the batch is spliced.
+   */
+  static void append(Batch& batch, watchman_file* file);
+
+  /** Moves all of batch's files to the recent end of the index. */
+  void splice(Batch& batch);
+
+  /** Returns the most recently changed file, or nullptr. */
+  watchman_file* newest() const;
+
+  /**
+   * Estimates how many files changed after ticks by searching the chunks
+   * rather than walking them.  Cleared slots among those files are
+   * counted too.
+   */
+  size_t countNewerThan(ClockTicks ticks) const;
+
+  /**
+   * Calls fn on each file, most recently changed first, until fn returns
+   * false.  fn may destroy the file it was passed (age-out does this), but
+   * must not otherwise modify the index.
+   */
+  template <typename Fn>
+  void forEachNewestFirst(Fn&& fn) const {
+    forEachNewestFirstInChunks(0, chunks_.size(), std::forward<Fn>(fn));
+  }
+
+  /** Returns the number of chunks, for use with forEachNewestFirstInChunks */
+  size_t chunkCount() const {
+    return chunks_.size();
+  }
+
+  /**
+   * Like forEachNewestFirst(), but only visits the files held by the chunks
+   * in [beginChunk, endChunk).  Higher chunk numbers hold newer files.
+   */
+  template <typename Fn>
+  void forEachNewestFirstInChunks(size_t beginChunk, size_t endChunk, Fn&& fn)
+      const {
+    for (size_t c = endChunk; c-- > beginChunk;) {
+      const Chunk& chunk = *chunks_[c];
+      for (size_t i = chunk.used; i-- > 0;) {
+        watchman_file* file = chunk.files[i];
+        if (file && !fn(file)) {
+          return;
+        }
+      }
+    }
+  }
+
+  /**
+   * Like forEachNewestFirstInChunks(), but skips the files whose columns
+   * are outside of filter's bounds.  The index must have columns.
+   */
+  template <typename Fn>
+  void forEachNewestFirstInChunksMatching(
+      size_t beginChunk,
+      size_t endChunk,
+      const ColumnFilter& filter,
+      Fn&& fn) const {
+    uint8_t matches[kChunkSize];
+    for (size_t c = endChunk; c-- > beginChunk;) {
+      const Chunk& chunk = *chunks_[c];
+      if (filter.scan(*chunk.columns, chunk.used, matches) == 0) {
+        continue;
+      }
+      for (size_t i = chunk.used; i-- > 0;) {
+        watchman_file* file = chunk.files[i];
+        if (matches[i] && file && !fn(file)) {
+          return;
+        }
+      }
+    }
+  }
+
+  /**
+   * Calls fn on each file held by chunk c, least recently changed first,
+   * until fn returns false.  fn may destroy the file it was passed, but
+   * must not otherwise modify the index.  Returns false if fn did.
+   */
+  template <typename Fn>
+  bool forEachOldestFirstInChunk(size_t c, Fn&& fn) const {
+    const Chunk& chunk = *chunks_[c];
+    for (size_t i = 0; i < chunk.used; ++i) {
+      watchman_file* file = chunk.files[i];
+      if (file && !fn(file)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * Walks the index most recently changed first, one file at a time, so
+   * that it can be merged with the walk of another index.  The index must
+   * not be modified while a Cursor is in use.
+   */
+  class Cursor {
+   public:
+    explicit Cursor(const RecencyIndex& index)
+        : chunks_{index.chunks_}, chunk_{index.chunks_.size()} {
+      next();
+    }
+
+    // The file at the cursor, or nullptr once every file has been visited
+    watchman_file* file() const {
+      return file_;
+    }
+
+    void next() {
+      while (true) {
+        if (slot_ == 0) {
+          if (chunk_ == 0) {
+            file_ = nullptr;
+            return;
+          }
+          --chunk_;
+          slot_ = chunks_[chunk_]->used;
+          continue;
+        }
+        file_ = chunks_[chunk_]->files[--slot_];
+        if (file_) {
+          return;
+        }
+      }
+    }
+
+   private:
+    const std::vector<std::unique_ptr<Chunk>>& chunks_;
+    size_t chunk_;
+    size_t slot_{0};
+    watchman_file* file_{nullptr};
+  };
+
+  /**
+   * Takes file, which must be in this index, out of it.  Used when a file
+   * moves to another index.
+   */
+  void remove(watchman_file* file);
+
+  /**
+   * Squeezes out cleared slots and releases the chunks left empty.
+   * Invalidates nothing but slot addresses, which it fixes up.
+   * Returns the number of slots reclaimed.
+   */
+  size_t compact();
+
+  Stats getStats() const;
+
+ private:
+  static void appendTo(
+      std::vector<std::unique_ptr<Chunk>>& chunks,
+      watchman_file* file,
+      bool columns);
+
+  std::vector<std::unique_ptr<Chunk>> chunks_;
+  bool columns_{false};
+
+  // Slots that we cleared ourselves when re-touching a file.  Files that are
+  // destroyed clear their slots without telling us, so this undercounts
+  // until the next compact().
+  size_t clearedSlots_{0};
+  size_t compactions_{0};
+};
+
+} // namespace watchman
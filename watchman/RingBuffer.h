@@ -8,6 +8,8 @@
 #pragma once
 
 #include <folly/experimental/LockFreeRingBuffer.h>
+#include <atomic>
+#include <memory>
 
 namespace watchman {
 
@@ -53,4 +55,114 @@ class RingBuffer {
   std::atomic<typename folly::LockFreeRingBuffer<T>::Cursor> lastClear_;
 };
 
+/**
+ * Fixed-size, lock-free, single-producer single-consumer queue.
+ *
+ * Unlike RingBuffer, writes never overwrite unread entries: the producer is
+ * told when the queue is full.  Slots are constructed once up front and are
+ * filled and drained in place, so that large entries (such as buffers of raw
+ * kernel events) can be handed between threads without allocating or copying.
+ *
+ * Exactly one thread may call the producer methods (writeSlot, commitWrite)
+ * and exactly one thread may call the consumer methods (readSlot,
+ * commitRead).  The statistics accessors may be called from any thread.
+ */
+template <typename T>
+class SpscRingBuffer {
+ public:
+  explicit SpscRingBuffer(uint32_t capacity)
+      : capacity_{capacity}, slots_{std::make_unique<T[]>(capacity)} {}
+
+  /**
+   * Producer: returns the next free slot, or nullptr if the queue is full.
+   * The slot is not visible to the consumer until commitWrite().
+   */
+  T* writeSlot() {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == capacity_) {
+      fullCount_.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    return &slots_[tail % capacity_];
+  }
+
+  /**
+   * Producer: publishes the slot returned by the last writeSlot().
+   */
+  void commitWrite() {
+    auto tail = tail_.load(std::memory_order_relaxed) + 1;
+    tail_.store(tail, std::memory_order_release);
+
+    auto used = tail - head_.load(std::memory_order_acquire);
+    if (used > highWater_.load(std::memory_order_relaxed)) {
+      highWater_.store(used, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * Consumer: returns the oldest unread slot, or nullptr if the queue is
+   * empty.  The slot remains owned by the consumer until commitRead().
+   */
+  T* readSlot() {
+    auto head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    return &slots_[head % capacity_];
+  }
+
+  /**
+   * Consumer: releases the slot returned by the last readSlot() back to the
+   * producer.
+   */
+  void commitRead() {
+    head_.store(
+        head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  uint32_t capacity() const {
+    return capacity_;
+  }
+
+  // Number of slots currently queued.  Approximate if called concurrently
+  // with the producer or consumer.
+  uint32_t size() const {
+    return uint32_t(
+        tail_.load(std::memory_order_acquire) -
+        head_.load(std::memory_order_acquire));
+  }
+
+  // The largest number of slots that have been queued at once.
+  uint32_t highWaterMark() const {
+    return uint32_t(highWater_.load(std::memory_order_relaxed));
+  }
+
+  // The number of times the producer found the queue full.
+  uint64_t fullCount() const {
+    return fullCount_.load(std::memory_order_relaxed);
+  }
+
+  void resetStats() {
+    highWater_.store(size(), std::memory_order_relaxed);
+    fullCount_.store(0, std::memory_order_relaxed);
+  }
+
+ private:
+  SpscRingBuffer(SpscRingBuffer&&) = delete;
+  SpscRingBuffer(const SpscRingBuffer&) = delete;
+  SpscRingBuffer& operator=(SpscRingBuffer&&) = delete;
+  SpscRingBuffer& operator=(const SpscRingBuffer&) = delete;
+
+  const uint32_t capacity_;
+  std::unique_ptr<T[]> slots_;
+
+  // Monotonic counts of slots written and read.  Keep them on separate cache
+  // lines so that the producer and consumer don't contend.
+  alignas(64) std::atomic<uint64_t> tail_{0};
+  alignas(64) std::atomic<uint64_t> head_{0};
+
+  std::atomic<uint64_t> highWater_{0};
+  std::atomic<uint64_t> fullCount_{0};
+};
+
 } // namespace watchman
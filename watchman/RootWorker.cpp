@@ -0,0 +1,345 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/RootWorker.h"
+#include <fmt/core.h>
+#include <chrono>
+#include <unordered_map>
+#include "watchman/ChildProcess.h"
+#include "watchman/LogConfig.h"
+#include "watchman/Logging.h"
+#include "watchman/Options.h"
+#include "watchman/PDU.h"
+#include "watchman/WatchmanConfig.h"
+#include "watchman/fs/FileSystem.h"
+#include "watchman/sockname.h"
+#include "watchman/watchman_cmd.h"
+#include "watchman/watchman_stream.h"
+#include "watchman/watchman_system.h"
+
+#ifdef __APPLE__
+#include <mach-o/dyld.h> // @manual
+#endif
+
+namespace watchman {
+
+namespace {
+
+// Set in the environment of the workers, so that they watch their roots
+// rather than forwarding the commands for them in turn
+constexpr const char* kWorkerEnvVar = "WATCHMAN_ROOT_WORKER";
+
+// How long a worker gets to start listening on its socket
+constexpr std::chrono::milliseconds kWorkerStartTimeout{10000};
+
+folly::Synchronized<std::unordered_map<w_string, std::shared_ptr<RootWorker>>>&
+allWorkers() {
+  // Leaked, as the workers outlive static destruction
+  static auto* workers = new folly::Synchronized<
+      std::unordered_map<w_string, std::shared_ptr<RootWorker>>>;
+  return *workers;
+}
+
+// Names a file of the worker for rootPath after the daemon's file at path
+std::string workerFileName(const std::string& path, const w_string& rootPath) {
+  return fmt::format("{}.root-{:016x}", path, rootPath.hashValue());
+}
+
+std::string executablePath() {
+#ifdef __APPLE__
+  char path[WATCHMAN_NAME_MAX];
+  uint32_t size = sizeof(path);
+  if (_NSGetExecutablePath(path, &size) == -1) {
+    throw std::runtime_error("_NSGetExecutablePath: path too long");
+  }
+  return path;
+#else
+  return realPath("/proc/self/exe").string();
+#endif
+}
+
+// The PDU format that the daemon and its workers talk to each other in
+const PduFormat kWorkerFormat{is_bser, 0};
+
+} // namespace
+
+bool RootWorker::enabled() {
+#ifdef _WIN32
+  return false;
+#else
+  static const bool enabled = cfg_get_bool("root_worker_processes", false) &&
+      getenv(kWorkerEnvVar) == nullptr;
+  return enabled;
+#endif
+}
+
+std::shared_ptr<RootWorker> RootWorker::forPath(const w_string& path) {
+  auto resolved = realPath(path.c_str());
+  auto workers = allWorkers().wlock();
+  for (auto& [rootPath, worker] : *workers) {
+    if (resolved == rootPath ||
+        (resolved.piece().startsWith(rootPath) &&
+         is_slash(resolved.piece()[rootPath.size()]))) {
+      return worker;
+    }
+  }
+
+  // Give the roots of a project to the same worker, whichever dir in it
+  // they name
+  w_string key = resolved;
+  bool enforcing;
+  auto rootFiles = cfg_compute_root_files(&enforcing);
+  w_string_piece projectRoot = resolved;
+  w_string_piece relPath;
+  if (rootFiles && find_project_root(*rootFiles, projectRoot, relPath)) {
+    key = projectRoot.asWString();
+  }
+
+  auto& worker = (*workers)[key];
+  if (!worker) {
+    worker = std::make_shared<RootWorker>(key);
+  }
+  return worker;
+}
+
+std::vector<std::shared_ptr<RootWorker>> RootWorker::getAll() {
+  std::vector<std::shared_ptr<RootWorker>> result;
+  auto workers = allWorkers().rlock();
+  for (auto& [_, worker] : *workers) {
+    result.push_back(worker);
+  }
+  return result;
+}
+
+std::vector<json_ref> RootWorker::requestAll(const json_ref& pdu) {
+  std::vector<json_ref> responses;
+  for (auto& worker : getAll()) {
+    try {
+      responses.push_back(worker->request(pdu));
+    } catch (const std::exception& exc) {
+      log(DBG, "skipping worker: ", exc.what(), "\n");
+    }
+  }
+  return responses;
+}
+
+RootWorker::RootWorker(w_string rootPath)
+    : rootPath_{std::move(rootPath)},
+      sockName_{workerFileName(get_unix_sock_name(), rootPath_)} {}
+
+RootWorker::~RootWorker() {
+  if (proc_) {
+    proc_->disown();
+  }
+}
+
+std::unique_ptr<Stream> RootWorker::connect() {
+  // It is most likely running already, possibly since before this process
+  auto stm = w_stm_connect_unix(sockName_.c_str(), 0);
+  if (stm.hasValue()) {
+    return std::move(stm).value();
+  }
+
+  std::lock_guard<std::mutex> lock{spawnMutex_};
+  stm = w_stm_connect_unix(sockName_.c_str(), 0);
+  if (stm.hasValue()) {
+    return std::move(stm).value();
+  }
+  spawn();
+
+  auto deadline = std::chrono::steady_clock::now() + kWorkerStartTimeout;
+  while (true) {
+    stm = w_stm_connect_unix(sockName_.c_str(), 100);
+    if (stm.hasValue()) {
+      return std::move(stm).value();
+    }
+    if (proc_->terminated()) {
+      throw std::system_error(
+          stm.error(),
+          std::generic_category(),
+          fmt::format(
+              "the worker for {} exited while starting; see {}",
+              rootPath_,
+              workerFileName(logging::log_name, rootPath_)));
+    }
+    if (std::chrono::steady_clock::now() >= deadline) {
+      throw std::system_error(
+          stm.error(),
+          std::generic_category(),
+          fmt::format("timed out connecting to the worker for {}", rootPath_));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+}
+
+void RootWorker::spawn() {
+  if (proc_) {
+    // Reap the worker that went away
+    proc_->terminated();
+    proc_->disown();
+    proc_.reset();
+  }
+
+  auto exe = executablePath();
+  std::vector<std::string> argStrings{
+      exe,
+      "--foreground",
+      fmt::format("--log-level={}", logging::log_level),
+      fmt::format("--sockname={}", sockName_)};
+  if (logging::log_name != "-") {
+    argStrings.push_back(fmt::format(
+        "--logfile={}", workerFileName(logging::log_name, rootPath_)));
+  }
+  if (!flags.watchman_state_file.empty()) {
+    argStrings.push_back(fmt::format(
+        "--statefile={}",
+        workerFileName(flags.watchman_state_file, rootPath_)));
+  }
+  if (!flags.pid_file.empty()) {
+    argStrings.push_back(fmt::format(
+        "--pidfile={}", workerFileName(flags.pid_file, rootPath_)));
+  }
+  std::vector<std::string_view> args(argStrings.begin(), argStrings.end());
+
+  ChildProcess::Options opts;
+  opts.environment().set(kWorkerEnvVar, "1");
+  opts.setFlags(POSIX_SPAWN_SETPGROUP);
+  opts.nullStdin();
+  opts.chdir("/");
+
+  log(ERR, "spawning a worker for ", rootPath_, " on ", sockName_, "\n");
+  proc_ = std::make_unique<ChildProcess>(args, std::move(opts));
+}
+
+json_ref RootWorker::request(const json_ref& pdu) {
+  auto connected = w_stm_connect_unix(sockName_.c_str(), 0);
+  if (connected.hasError()) {
+    throw std::system_error(
+        connected.error(),
+        std::generic_category(),
+        fmt::format("the worker for {} isn't running", rootPath_));
+  }
+  auto stm = std::move(connected).value();
+  PduBuffer buffer;
+  auto res = buffer.pduEncodeToStream(kWorkerFormat, pdu, stm.get());
+  if (res.hasError()) {
+    throw std::system_error(
+        res.error(),
+        std::generic_category(),
+        fmt::format("sending a command to the worker for {}", rootPath_));
+  }
+  buffer.clear();
+  json_error_t jerr;
+  while (true) {
+    auto response = buffer.decodeNext(stm.get(), &jerr);
+    if (!response) {
+      throw std::runtime_error(fmt::format(
+          "no response from the worker for {}: {}", rootPath_, jerr.text));
+    }
+    // Log PDUs may come first
+    if (!response->get_optional("unilateral")) {
+      return std::move(*response);
+    }
+  }
+}
+
+RootWorkerConnection::RootWorkerConnection(
+    std::shared_ptr<RootWorker> worker,
+    std::function<void(json_ref)> relay)
+    : worker_{std::move(worker)},
+      relay_{std::move(relay)},
+      stm_{worker_->connect()} {
+  stm_->setNonBlock(false);
+  reader_ = std::thread{[this] { readResponses(); }};
+}
+
+RootWorkerConnection::~RootWorkerConnection() {
+  // Closing the connection makes the worker drop the client's
+  // subscriptions and states, and wakes the reader
+  stm_->shutdown();
+  reader_.join();
+}
+
+bool RootWorkerConnection::closed() const {
+  return state_.lock()->closed;
+}
+
+json_ref RootWorkerConnection::forward(const json_ref& pdu) {
+  folly::Promise<json_ref> promise;
+  auto response = promise.getSemiFuture();
+  {
+    auto state = state_.lock();
+    if (state->closed) {
+      throw std::runtime_error(
+          fmt::format("the worker for {} went away", worker_->rootPath()));
+    }
+    state->waiting.push_back(std::move(promise));
+
+    // Written under the lock, so that the responses are in the order of
+    // the promises
+    PduBuffer buffer;
+    auto res = buffer.pduEncodeToStream(kWorkerFormat, pdu, stm_.get());
+    if (res.hasError()) {
+      state->waiting.pop_back();
+      throw std::system_error(
+          res.error(),
+          std::generic_category(),
+          fmt::format(
+              "sending a command to the worker for {}", worker_->rootPath()));
+    }
+  }
+  return std::move(response).get();
+}
+
+void RootWorkerConnection::readResponses() {
+  w_set_thread_name("worker-conn ", worker_->rootPath());
+  PduBuffer buffer;
+  json_error_t jerr;
+  while (true) {
+    auto pdu = buffer.decodeNext(stm_.get(), &jerr);
+    if (!pdu) {
+      break;
+    }
+
+    // The batches of a streamed query come ahead of its trailer, which is
+    // the response
+    auto stream = pdu->get_optional("stream");
+    if (pdu->get_optional("unilateral") ||
+        (stream && json_to_w_string(*stream) != "trailer")) {
+      relay_(std::move(*pdu));
+      continue;
+    }
+
+    folly::Promise<json_ref> promise;
+    {
+      auto state = state_.lock();
+      if (state->waiting.empty()) {
+        log(ERR,
+            "unexpected response from the worker for ",
+            worker_->rootPath(),
+            "\n");
+        continue;
+      }
+      promise = std::move(state->waiting.front());
+      state->waiting.pop_front();
+    }
+    promise.setValue(std::move(*pdu));
+  }
+
+  std::deque<folly::Promise<json_ref>> waiting;
+  {
+    auto state = state_.lock();
+    state->closed = true;
+    waiting.swap(state->waiting);
+  }
+  for (auto& promise : waiting) {
+    promise.setException(std::runtime_error(
+        fmt::format("the worker for {} went away", worker_->rootPath())));
+  }
+}
+
+} // namespace watchman
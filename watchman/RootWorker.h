@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/Synchronized.h>
+#include <folly/futures/Promise.h>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "watchman/thirdparty/jansson/jansson.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+class ChildProcess;
+class Stream;
+
+/**
+ * With root_worker_processes, each watched root belongs to a watchman
+ * daemon of its own.  The daemon that clients connect to spawns these
+ * workers as they are needed, and forwards each root's commands to its
+ * worker.  If a root recrawls endlessly, grows huge or crashes, only its
+ * own worker is affected.
+ *
+ * A RootWorker names one of those processes.  The worker listens on a
+ * socket named after the daemon's own, and keeps its log, state and pid
+ * files next to the daemon's.  A restarted daemon reconnects to the
+ * workers that are still running.
+ */
+class RootWorker {
+ public:
+  /**
+   * Whether this process forwards the commands for roots to workers,
+   * rather than watching the roots itself.
+   */
+  static bool enabled();
+
+  /**
+   * Returns the worker for the root that path is in.  That is the worker
+   * of an enclosing root if there is one, and otherwise the worker for
+   * path's project root.
+   */
+  static std::shared_ptr<RootWorker> forPath(const w_string& path);
+
+  /** Returns the workers that this process has forwarded commands to. */
+  static std::vector<std::shared_ptr<RootWorker>> getAll();
+
+  /**
+   * Sends pdu to each of those workers that is running, and returns their
+   * responses.
+   */
+  static std::vector<json_ref> requestAll(const json_ref& pdu);
+
+  explicit RootWorker(w_string rootPath);
+  ~RootWorker();
+
+  const w_string& rootPath() const {
+    return rootPath_;
+  }
+
+  /**
+   * Connects to the worker, first spawning it if it isn't running.
+   * Throws std::system_error if the worker can't be reached.
+   */
+  std::unique_ptr<Stream> connect();
+
+  /**
+   * Sends pdu to the worker over a connection of its own, and returns the
+   * worker's response.  Unlike connect, doesn't spawn the worker: throws
+   * if it isn't running.
+   */
+  json_ref request(const json_ref& pdu);
+
+ private:
+  void spawn();
+
+  const w_string rootPath_;
+  const std::string sockName_;
+  // Serializes spawning the worker, and guards proc_
+  std::mutex spawnMutex_;
+  std::unique_ptr<ChildProcess> proc_;
+};
+
+/**
+ * A client's connection to a RootWorker.  The client's commands for that
+ * worker's root are forwarded over it, and their responses come back in
+ * order.  Some PDUs are not responses: unilateral PDUs such as
+ * subscription updates, and the batches of a streamed query.  Those are
+ * passed to the relay function as soon as they arrive, on the
+ * connection's own thread.
+ */
+class RootWorkerConnection {
+ public:
+  RootWorkerConnection(
+      std::shared_ptr<RootWorker> worker,
+      std::function<void(json_ref)> relay);
+  ~RootWorkerConnection();
+
+  RootWorkerConnection(const RootWorkerConnection&) = delete;
+  RootWorkerConnection& operator=(const RootWorkerConnection&) = delete;
+
+  /**
+   * Sends the command to the worker and waits for its response.  Throws
+   * if the worker goes away first.
+   */
+  json_ref forward(const json_ref& pdu);
+
+  /** Whether the worker has closed the connection. */
+  bool closed() const;
+
+ private:
+  void readResponses();
+
+  std::shared_ptr<RootWorker> worker_;
+  std::function<void(json_ref)> relay_;
+  std::unique_ptr<Stream> stm_;
+
+  struct State {
+    // Promises for the responses to the forwarded commands, in order
+    std::deque<folly::Promise<json_ref>> waiting;
+    bool closed{false};
+  };
+  folly::Synchronized<State, std::mutex> state_;
+  std::thread reader_;
+};
+
+} // namespace watchman
@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "watchman/Hash.h"
+#include "watchman/LRUCache.h"
+
+namespace watchman {
+
+/**
+ * ShardedLRUCache spreads its keys across a number of independently
+ * locked LRUCache shards, so that concurrent lookups of different keys
+ * rarely contend on the same lock.
+ *
+ * The shards use EvictionPolicy::Clock, so a lookup that hits only takes
+ * its shard's lock shared, and the eviction order is approximately LRU
+ * within each shard rather than exactly LRU across the whole cache.
+ *
+ * The API is that of LRUCache, and the semantics are the same for any
+ * one key.  A cache that is too small to be usefully split is made of a
+ * single shard, so that its size limit is respected exactly.
+ */
+template <typename KeyType, typename ValueType>
+class ShardedLRUCache {
+ public:
+  using Shard = LRUCache<KeyType, ValueType>;
+  using NodeType = typename Shard::NodeType;
+
+  // The most shards that a cache is split into
+  static constexpr size_t kMaxShards = 16;
+  // Don't split a cache into shards with fewer items than this
+  static constexpr size_t kMinItemsPerShard = 1024;
+
+  // As for LRUCache.  maxItems is divided evenly between the shards,
+  // rounding up.
+  ShardedLRUCache(
+      size_t maxItems,
+      std::chrono::milliseconds errorTTL,
+      std::chrono::milliseconds fetchTimeout = std::chrono::seconds(300)) {
+    auto numShards =
+        std::clamp<size_t>(maxItems / kMinItemsPerShard, 1, kMaxShards);
+    auto itemsPerShard = (maxItems + numShards - 1) / numShards;
+    shards_.reserve(numShards);
+    for (size_t i = 0; i < numShards; ++i) {
+      shards_.push_back(std::make_unique<Shard>(
+          itemsPerShard,
+          errorTTL,
+          fetchTimeout,
+          lrucache::EvictionPolicy::Clock));
+    }
+  }
+
+  // No moving or copying
+  ShardedLRUCache(const ShardedLRUCache&) = delete;
+  ShardedLRUCache& operator=(const ShardedLRUCache&) = delete;
+  ShardedLRUCache(ShardedLRUCache&&) = delete;
+  ShardedLRUCache& operator=(ShardedLRUCache&&) = delete;
+
+  std::shared_ptr<const NodeType> get(
+      const KeyType& key,
+      std::chrono::steady_clock::time_point now =
+          std::chrono::steady_clock::now()) {
+    return shardFor(key).get(key, now);
+  }
+
+  template <typename Func>
+  folly::Future<std::shared_ptr<const NodeType>> get(
+      const KeyType& key,
+      Func&& getter,
+      std::chrono::steady_clock::time_point now =
+          std::chrono::steady_clock::now()) {
+    return shardFor(key).get(key, std::forward<Func>(getter), now);
+  }
+
+  std::shared_ptr<const NodeType> set(
+      const KeyType& key,
+      ValueType&& value,
+      std::chrono::steady_clock::time_point now =
+          std::chrono::steady_clock::now()) {
+    return shardFor(key).set(key, std::move(value), now);
+  }
+
+  std::shared_ptr<const NodeType> erase(const KeyType& key) {
+    return shardFor(key).erase(key);
+  }
+
+  size_t size() const {
+    size_t size = 0;
+    for (auto& shard : shards_) {
+      size += shard->size();
+    }
+    return size;
+  }
+
+  // Returns the statistics summed across the shards
+  CacheStats stats() const {
+    lrucache::Stats total;
+    size_t size = 0;
+    for (auto& shard : shards_) {
+      auto stats = shard->stats();
+      total.cacheHit += stats.cacheHit;
+      total.cacheShare += stats.cacheShare;
+      total.cacheMiss += stats.cacheMiss;
+      total.cacheEvict += stats.cacheEvict;
+      total.cacheStore += stats.cacheStore;
+      total.cacheLoad += stats.cacheLoad;
+      total.cacheErase += stats.cacheErase;
+      // The shards are always cleared together
+      total.clearCount = stats.clearCount;
+      size += stats.size;
+    }
+    return CacheStats(total, size);
+  }
+
+  // As for LRUCache.  `keep` is divided evenly between the shards,
+  // rounding up.
+  size_t shrink(size_t keep) {
+    auto keepPerShard = (keep + shards_.size() - 1) / shards_.size();
+    size_t evicted = 0;
+    for (auto& shard : shards_) {
+      evicted += shard->shrink(keepPerShard);
+    }
+    return evicted;
+  }
+
+  void clear() {
+    for (auto& shard : shards_) {
+      shard->clear();
+    }
+  }
+
+  size_t numShards() const {
+    return shards_.size();
+  }
+
+ private:
+  Shard& shardFor(const KeyType& key) {
+    // Mix the hash so that the shard doesn't depend on the same bits that
+    // pick the bucket in the shard's map.
+    auto hash = hash_128_to_64(std::hash<KeyType>{}(key), 0);
+    return *shards_[hash % shards_.size()];
+  }
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+};
+} // namespace watchman
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <folly/Synchronized.h>
+#include <array>
+#include <functional>
+#include "watchman/Hash.h"
+
+namespace watchman {
+
+/**
+ * Splits a container, such as a map or set, across a fixed number of
+ * independently locked shards, picked by the hash of the key, so that
+ * threads working on different keys rarely contend on the same lock.
+ *
+ * Each key lives in exactly one shard, so anything that works on one key
+ * locks only shard(key).  Anything that works on the whole table, such as
+ * listing it, visits the shards one at a time with forEachShard, and so sees
+ * each shard consistently but not the whole table at one instant.
+ */
+template <typename Container, size_t NumShards = 16>
+class ShardedSynchronized {
+ public:
+  using Shard = folly::Synchronized<Container>;
+
+  ShardedSynchronized() = default;
+  ShardedSynchronized(const ShardedSynchronized&) = delete;
+  ShardedSynchronized& operator=(const ShardedSynchronized&) = delete;
+
+  template <typename Key>
+  Shard& shard(const Key& key) {
+    return shards_[shardIndex(key)];
+  }
+
+  template <typename Key>
+  const Shard& shard(const Key& key) const {
+    return shards_[shardIndex(key)];
+  }
+
+  // Calls func with each shard in turn
+  template <typename Func>
+  void forEachShard(Func&& func) {
+    for (auto& shard : shards_) {
+      func(shard);
+    }
+  }
+
+  template <typename Func>
+  void forEachShard(Func&& func) const {
+    for (auto& shard : shards_) {
+      func(shard);
+    }
+  }
+
+  size_t size() const {
+    size_t size = 0;
+    for (auto& shard : shards_) {
+      size += shard.rlock()->size();
+    }
+    return size;
+  }
+
+ private:
+  template <typename Key>
+  static size_t shardIndex(const Key& key) {
+    // Mix the hash so that the shard doesn't depend on the same bits that
+    // pick the bucket in the shard's container, nor on the alignment of a
+    // pointer key.
+    return hash_128_to_64(std::hash<Key>{}(key), 0) % NumShards;
+  }
+
+  std::array<Shard, NumShards> shards_;
+};
+
+} // namespace watchman
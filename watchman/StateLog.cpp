@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/StateLog.h"
+#include <fmt/core.h>
+#include <folly/FileUtil.h>
+#include <folly/String.h>
+#include <string.h>
+#include <algorithm>
+#include <cstdio>
+#include <system_error>
+#include "watchman/Logging.h"
+#include "watchman/bser.h"
+#include "watchman/watchman_system.h"
+#include "watchman/watchman_stream.h"
+
+namespace watchman {
+
+namespace {
+
+// The log isn't worth compacting until it has at least this many
+// superseded records
+constexpr size_t kMinDeadRecords = 64;
+
+int appendToString(const char* buffer, size_t size, void* data) {
+  static_cast<std::string*>(data)->append(buffer, size);
+  return 0;
+}
+
+std::string encodeRecord(const json_ref& record) {
+  std::string out;
+  if (w_bser_write_pdu(1, 0, appendToString, record, &out) != 0) {
+    throw std::runtime_error("failed to encode state record");
+  }
+  return out;
+}
+
+json_ref removalRecord(const w_string& path) {
+  return json_object(
+      {{"path", w_string_to_json(path)}, {"removed", json_true()}});
+}
+
+bool writeAll(watchman_stream& stm, const std::string& data) {
+  const char* pos = data.data();
+  size_t remaining = data.size();
+  while (remaining > 0) {
+    int n = stm.write(pos, int(std::min<size_t>(remaining, 1 << 20)));
+    if (n <= 0) {
+      return false;
+    }
+    pos += n;
+    remaining -= n;
+  }
+  return true;
+}
+
+json_ref loadLog(const std::string& path, const std::string& data) {
+  const char* pos = data.data();
+  const char* end = pos + data.size();
+
+  std::optional<json_ref> header;
+  std::map<w_string, json_ref> roots;
+  while (end - pos >= 2) {
+    if (memcmp(pos, BSER_MAGIC, 2) != 0) {
+      throw std::runtime_error(fmt::format(
+          "{}: bad record at offset {}", path, pos - data.data()));
+    }
+    size_t needed;
+    auto len = bunser_int(pos + 2, end - pos - 2, &needed);
+    if (!len) {
+      if (needed == kDecodeIntFailed) {
+        throw std::runtime_error(fmt::format(
+            "{}: bad record length at offset {}", path, pos - data.data()));
+      }
+      break;
+    }
+    const char* start = pos + 2 + needed;
+    if (*len < 0 || end - start < *len) {
+      break;
+    }
+    auto record = bunser(start, start + *len);
+    pos = start + *len;
+
+    if (!header) {
+      header = std::move(record);
+      continue;
+    }
+    auto rootPath = json_to_w_string(record.get("path"));
+    if (record.get_optional("removed")) {
+      roots.erase(rootPath);
+    } else {
+      roots.insert_or_assign(std::move(rootPath), std::move(record));
+    }
+  }
+  if (pos != end) {
+    logf(
+        ERR,
+        "{}: ignoring {} bytes of a torn record at its end\n",
+        path,
+        end - pos);
+  }
+
+  std::vector<json_ref> watched;
+  watched.reserve(roots.size());
+  for (auto& [_, record] : roots) {
+    watched.push_back(std::move(record));
+  }
+  auto state = json_object({{"watched", json_array(std::move(watched))}});
+  if (header) {
+    if (auto version = header->get_optional("version")) {
+      state.set("version", *version);
+    }
+  }
+  return state;
+}
+
+} // namespace
+
+StateLog::StateLog(std::string path) : path_(std::move(path)) {}
+
+bool StateLog::isLog(std::string_view data) {
+  return data.size() >= 2 && memcmp(data.data(), BSER_MAGIC, 2) == 0;
+}
+
+json_ref StateLog::load(const std::string& path) {
+  std::string data;
+  if (!folly::readFile(path.c_str(), data)) {
+    throw std::system_error(
+        errno, std::generic_category(), fmt::format("unable to read {}", path));
+  }
+  if (isLog(data)) {
+    return loadLog(path, data);
+  }
+
+  json_error_t err;
+  auto state = json_loadb(data.data(), data.size(), 0, &err);
+  if (!state) {
+    throw std::runtime_error(
+        fmt::format("failed to parse json from {}: {}", path, err.text));
+  }
+  return *state;
+}
+
+bool StateLog::save(const std::map<w_string, json_ref>& records) {
+  if (stale_ || dead_ >= std::max(kMinDeadRecords, records.size())) {
+    return compact(records);
+  }
+
+  std::string data;
+  for (const auto& [path, record] : records) {
+    auto encoded = encodeRecord(record);
+    auto& saved = saved_[path];
+    if (saved == encoded) {
+      continue;
+    }
+    if (!saved.empty()) {
+      ++dead_;
+    }
+    data += encoded;
+    saved = std::move(encoded);
+  }
+  for (auto it = saved_.begin(); it != saved_.end();) {
+    if (records.count(it->first)) {
+      ++it;
+      continue;
+    }
+    data += encodeRecord(removalRecord(it->first));
+    // Both the root's record and its removal
+    dead_ += 2;
+    it = saved_.erase(it);
+  }
+
+  if (data.empty()) {
+    return true;
+  }
+  if (!append(data)) {
+    stale_ = true;
+    return false;
+  }
+  return true;
+}
+
+bool StateLog::append(const std::string& data) {
+  auto stm = w_stm_open(path_.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0600);
+  if (!stm) {
+    logf(ERR, "save_state: unable to open {} for append\n", path_);
+    return false;
+  }
+  if (!writeAll(*stm, data)) {
+    logf(ERR, "save_state: failed to append to {}\n", path_);
+    return false;
+  }
+  return true;
+}
+
+bool StateLog::compact(const std::map<w_string, json_ref>& records) {
+  std::unordered_map<w_string, std::string> saved;
+  auto header = json_object(
+      {{"version", typed_string_to_json(PACKAGE_VERSION, W_STRING_UNICODE)}});
+  std::string data = encodeRecord(header);
+  for (const auto& [path, record] : records) {
+    auto encoded = encodeRecord(record);
+    data += encoded;
+    saved.emplace(path, std::move(encoded));
+  }
+
+  auto tempPath = fmt::format("{}.tmp", path_);
+  {
+    auto stm =
+        w_stm_open(tempPath.c_str(), O_WRONLY | O_TRUNC | O_CREAT, 0600);
+    if (!stm) {
+      logf(ERR, "save_state: unable to open {} for write\n", tempPath);
+      return false;
+    }
+    if (!writeAll(*stm, data)) {
+      logf(ERR, "save_state: failed to write {}\n", tempPath);
+      std::remove(tempPath.c_str());
+      return false;
+    }
+  }
+#ifdef _WIN32
+  // rename() won't replace an existing file on Windows
+  std::remove(path_.c_str());
+#endif
+  if (std::rename(tempPath.c_str(), path_.c_str()) != 0) {
+    logf(
+        ERR,
+        "save_state: rename {} -> {}: {}\n",
+        tempPath,
+        path_,
+        folly::errnoStr(errno));
+    std::remove(tempPath.c_str());
+    return false;
+  }
+
+  saved_ = std::move(saved);
+  dead_ = 0;
+  stale_ = false;
+  return true;
+}
+
+} // namespace watchman
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "watchman/thirdparty/jansson/jansson.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * The global state file, as an append only log of BSER PDUs.  Its first
+ * record is a header naming the version of watchman that wrote it; each
+ * record after that either replaces the record of one root or removes it.
+ *
+ * A save appends only the records of the roots that changed since the
+ * previous save, so a change to one trigger doesn't rewrite every root's.
+ * Once the superseded records outnumber the live ones, the next save
+ * compacts the log by writing just the live records to a new file and
+ * renaming it into place.
+ *
+ * A root's record has the shape of an element of the "watched" array of the
+ * JSON state file, with the root's "path" and "triggers", and may carry
+ * more about the root, such as the view snapshot saved alongside it.
+ *
+ * Not thread safe; the state saver thread owns the only instance.
+ */
+class StateLog {
+ public:
+  explicit StateLog(std::string path);
+
+  /**
+   * Makes the log hold records, the record of each root keyed by its path.
+   * Returns false if it couldn't be written, in which case the next save
+   * compacts the log.
+   */
+  bool save(const std::map<w_string, json_ref>& records);
+
+  /**
+   * Reads the state file at path, as written by save() or as a legacy JSON
+   * state file, in the shape of the JSON state file:
+   * {"version": ..., "watched": [...]}.  A torn record at the end of a log,
+   * from a crash in the middle of an append, is ignored.
+   *
+   * Throws std::system_error if the file can't be read, or std::exception
+   * if it is malformed.
+   */
+  static json_ref load(const std::string& path);
+
+  /** Whether data starts like a log, rather than a JSON state file. */
+  static bool isLog(std::string_view data);
+
+  /** The records superseded since the log was last compacted. */
+  size_t deadRecords() const {
+    return dead_;
+  }
+
+ private:
+  bool compact(const std::map<w_string, json_ref>& records);
+  bool append(const std::string& data);
+
+  const std::string path_;
+  // The encoded record of each root, as the log holds it
+  std::unordered_map<w_string, std::string> saved_;
+  size_t dead_{0};
+  // Whether the file may not match saved_, so has to be compacted
+  bool stale_{true};
+};
+
+} // namespace watchman
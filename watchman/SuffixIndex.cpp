@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/SuffixIndex.h"
+#include "watchman/watchman_dir.h"
+#include "watchman/watchman_file.h"
+
+namespace watchman {
+
+void SuffixIndex::insert(watchman_file* file) {
+  auto suffix = file->getName().asLowerCaseSuffix();
+  if (suffix) {
+    files_[*suffix].insert(file);
+  }
+}
+
+void SuffixIndex::erase(watchman_file* file) {
+  auto suffix = file->getName().asLowerCaseSuffix();
+  if (!suffix) {
+    return;
+  }
+  auto it = files_.find(*suffix);
+  if (it == files_.end()) {
+    return;
+  }
+  it->second.erase(file);
+  if (it->second.empty()) {
+    files_.erase(it);
+  }
+}
+
+void SuffixIndex::eraseTree(const watchman_dir* dir) {
+  for (auto& it : dir->files) {
+    erase(it.second.get());
+  }
+  for (auto& it : dir->dirs) {
+    eraseTree(it.second.get());
+  }
+}
+
+const std::unordered_set<watchman_file*>* SuffixIndex::find(
+    const w_string& lowerCaseSuffix) const {
+  auto it = files_.find(lowerCaseSuffix);
+  return it == files_.end() ? nullptr : &it->second;
+}
+
+SuffixIndex::Stats SuffixIndex::getStats() const {
+  // The hash containers don't report their allocations, so estimate them
+  // from the sizes of their nodes and bucket arrays.
+  constexpr size_t kNodeOverhead = 2 * sizeof(void*);
+
+  Stats stats;
+  stats.suffixes = files_.size();
+  stats.bytes = files_.bucket_count() * sizeof(void*);
+  for (auto& it : files_) {
+    stats.files += it.second.size();
+    stats.bytes += kNodeOverhead + sizeof(it) + it.first.size() +
+        it.second.bucket_count() * sizeof(void*) +
+        it.second.size() * (kNodeOverhead + sizeof(watchman_file*));
+  }
+  return stats;
+}
+
+} // namespace watchman
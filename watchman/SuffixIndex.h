@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <unordered_map>
+#include <unordered_set>
+#include "watchman/watchman_string.h"
+
+struct watchman_dir;
+struct watchman_file;
+
+namespace watchman {
+
+/**
+ * Maps each lower-cased file name suffix, as computed by
+ * w_string_piece::asLowerCaseSuffix(), to the files of a ViewDatabase that
+ * have it, so that suffix generator queries only visit matching files.
+ *
+ * A file's name never changes, so files are added once when their node is
+ * created and removed just before the node is destroyed; the ViewDatabase
+ * takes care of both.  Files whose names have no suffix aren't indexed.
+ *
+ * Not thread safe; the owning ViewDatabase is protected by the view lock.
+ */
+class SuffixIndex {
+ public:
+  struct Stats {
+    // Number of distinct suffixes
+    size_t suffixes{0};
+    // Number of indexed files
+    size_t files{0};
+    // Estimate of the memory held by the index
+    size_t bytes{0};
+  };
+
+  SuffixIndex() = default;
+  SuffixIndex(const SuffixIndex&) = delete;
+  SuffixIndex& operator=(const SuffixIndex&) = delete;
+
+  void insert(watchman_file* file);
+  void erase(watchman_file* file);
+
+  /** Removes every file of dir and of the dirs below it. */
+  void eraseTree(const watchman_dir* dir);
+
+  /**
+   * Returns the files whose suffix is lowerCaseSuffix, or nullptr if there
+   * are none.
+   */
+  const std::unordered_set<watchman_file*>* find(
+      const w_string& lowerCaseSuffix) const;
+
+  Stats getStats() const;
+
+ private:
+  std::unordered_map<w_string, std::unordered_set<watchman_file*>> files_;
+};
+
+} // namespace watchman
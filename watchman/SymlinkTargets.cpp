@@ -38,6 +38,12 @@ folly::Future<std::shared_ptr<const Node>> SymlinkTargetCache::get(
       key, [this](const SymlinkTargetCacheKey& k) { return readLink(k); });
 }
 
+void SymlinkTargetCache::set(
+    const SymlinkTargetCacheKey& key,
+    w_string target) {
+  cache_.set(key, std::move(target));
+}
+
 w_string SymlinkTargetCache::readLinkImmediate(
     const SymlinkTargetCacheKey& key) const {
   auto fullPath = w_string::pathCat({rootPath_, key.relativePath});
@@ -52,6 +58,57 @@ folly::Future<w_string> SymlinkTargetCache::readLink(
           [this](SymlinkTargetCacheKey key) { return readLinkImmediate(key); });
 }
 
+SymlinkTargetCache::Batch::Batch(SymlinkTargetCache& cache) : cache_(cache) {}
+
+folly::Future<std::shared_ptr<const Node>> SymlinkTargetCache::Batch::get(
+    const SymlinkTargetCacheKey& key) {
+  return cache_.cache_.get(key, [this](const SymlinkTargetCacheKey& k) {
+    w_string_piece path(k.relativePath);
+    auto& links = pending_[path.dirName().asWString()];
+    links.push_back(PendingLink{path.baseName().asWString(), {}});
+    return links.back().promise.getFuture();
+  });
+}
+
+void SymlinkTargetCache::Batch::dispatch() {
+  for (auto& [dir, links] : pending_) {
+    folly::via(
+        &getThreadPool(),
+        [cache = &cache_, dir = dir, links = std::move(links)]() mutable {
+          cache->readLinksInDir(dir, links);
+        });
+  }
+  pending_.clear();
+}
+
+void SymlinkTargetCache::readLinksInDir(
+    const w_string& dir,
+    std::vector<PendingLink>& links) {
+  auto dirPath = dir.empty() ? rootPath_ : w_string::pathCat({rootPath_, dir});
+#ifndef _WIN32
+  FileDescriptor dirFd;
+  try {
+    dirFd = openFileHandle(dirPath.c_str(), OpenFileHandleOptions::openDir());
+  } catch (const std::exception&) {
+    auto ex = folly::exception_wrapper{std::current_exception()};
+    for (auto& link : links) {
+      link.promise.setException(ex);
+    }
+    return;
+  }
+#endif
+  for (auto& link : links) {
+    link.promise.setWith([&] {
+#ifndef _WIN32
+      return readSymbolicLinkAt(dirFd, link.name.c_str());
+#else
+      auto fullPath = w_string::pathCat({dirPath, link.name});
+      return readSymbolicLink(fullPath.c_str());
+#endif
+    });
+  }
+}
+
 const w_string& SymlinkTargetCache::rootPath() const {
   return rootPath_;
 }
@@ -59,4 +116,8 @@ const w_string& SymlinkTargetCache::rootPath() const {
 CacheStats SymlinkTargetCache::stats() const {
   return cache_.stats();
 }
+
+size_t SymlinkTargetCache::shrink(size_t keep) {
+  return cache_.shrink(keep);
+}
 } // namespace watchman
@@ -6,9 +6,12 @@
  */
 
 #pragma once
+#include <folly/futures/Promise.h>
 #include <string>
+#include <unordered_map>
+#include <vector>
 #include "watchman/Clock.h"
-#include "watchman/LRUCache.h"
+#include "watchman/ShardedLRUCache.h"
 #include "watchman/thirdparty/jansson/jansson.h"
 #include "watchman/watchman_string.h"
 #include "watchman/watchman_system.h"
@@ -38,7 +41,7 @@ struct hash<watchman::SymlinkTargetCacheKey> {
 namespace watchman {
 class SymlinkTargetCache {
  public:
-  using Node = LRUCache<SymlinkTargetCacheKey, w_string>::NodeType;
+  using Node = ShardedLRUCache<SymlinkTargetCacheKey, w_string>::NodeType;
 
   // Construct a cache for a given root, holding the specified
   // maximum number of items, using the configured negative
@@ -56,6 +59,11 @@ class SymlinkTargetCache {
   folly::Future<std::shared_ptr<const Node>> get(
       const SymlinkTargetCacheKey& key);
 
+  // Stores a target that was read outside of the cache, replacing any
+  // existing entry for the key.  The key must not be in the middle of
+  // being looked up by get().
+  void set(const SymlinkTargetCacheKey& key, w_string target);
+
   // Read the symlink target.
   // This will block the calling thread while the I/O is performed.
   // Throws exceptions for any errors that may occur.
@@ -71,8 +79,46 @@ class SymlinkTargetCache {
   // Returns cache statistics
   CacheStats stats() const;
 
+  // Evicts the least recently used entries until at most `keep` remain.
+  // Returns the number of entries that were evicted.
+  size_t shrink(size_t keep);
+
+  // A link that was queued by a Batch, named relative to its directory
+  struct PendingLink {
+    w_string name;
+    folly::Promise<w_string> promise;
+  };
+
+  // Collects the links that miss the cache during one pass over a set of
+  // files, so that they are read by one thread pool task per directory
+  // with readlinkat on the open directory, rather than a task per link.
+  //
+  // The futures returned by get() for links that missed the cache are not
+  // satisfied until dispatch() is called, so callers must dispatch before
+  // waiting on them.
+  class Batch {
+   public:
+    explicit Batch(SymlinkTargetCache& cache);
+
+    // As for SymlinkTargetCache::get(), but a miss is queued rather than
+    // read straight away.
+    folly::Future<std::shared_ptr<const Node>> get(
+        const SymlinkTargetCacheKey& key);
+
+    // Schedules the reads of the queued links
+    void dispatch();
+
+   private:
+    SymlinkTargetCache& cache_;
+    // Queued links, keyed by their directory relative to the root
+    std::unordered_map<w_string, std::vector<PendingLink>> pending_;
+  };
+
  private:
-  LRUCache<SymlinkTargetCacheKey, w_string> cache_;
+  // Reads the given links from one directory, relative to the root
+  void readLinksInDir(const w_string& dir, std::vector<PendingLink>& links);
+
+  ShardedLRUCache<SymlinkTargetCacheKey, w_string> cache_;
   w_string rootPath_;
 };
 } // namespace watchman
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ThreadAffinity.h"
+#include <fmt/core.h>
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace watchman {
+
+namespace {
+
+unsigned parseCpu(std::string_view list, std::string_view number) {
+  unsigned cpu = 0;
+  auto end = number.data() + number.size();
+  auto [ptr, ec] = std::from_chars(number.data(), end, cpu);
+  if (number.empty() || ec != std::errc{} || ptr != end) {
+    throw std::invalid_argument(
+        fmt::format("\"{}\" is not a valid list of CPUs", list));
+  }
+  return cpu;
+}
+
+} // namespace
+
+std::vector<unsigned> parseCpuList(std::string_view list) {
+  std::vector<unsigned> cpus;
+  size_t start = 0;
+  while (true) {
+    auto comma = list.find(',', start);
+    auto range = list.substr(
+        start, comma == std::string_view::npos ? comma : comma - start);
+
+    auto dash = range.find('-');
+    auto first = parseCpu(list, range.substr(0, dash));
+    auto last = dash == std::string_view::npos
+        ? first
+        : parseCpu(list, range.substr(dash + 1));
+    if (last < first) {
+      throw std::invalid_argument(
+          fmt::format("\"{}\" is not a valid list of CPUs", list));
+    }
+    for (auto cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+
+    if (comma == std::string_view::npos) {
+      break;
+    }
+    start = comma + 1;
+  }
+  std::sort(cpus.begin(), cpus.end());
+  cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+  return cpus;
+}
+
+std::vector<unsigned> getNumaNodeCpus(unsigned node) {
+#ifdef __linux__
+  std::ifstream file{
+      fmt::format("/sys/devices/system/node/node{}/cpulist", node)};
+  std::string list;
+  if (!std::getline(file, list)) {
+    return {};
+  }
+  try {
+    return parseCpuList(list);
+  } catch (const std::invalid_argument&) {
+    return {};
+  }
+#else
+  (void)node;
+  return {};
+#endif
+}
+
+std::vector<unsigned> getCurrentThreadAffinity() {
+  std::vector<unsigned> cpus;
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  // pid 0 is the calling thread
+  if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+    return cpus;
+  }
+  for (unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &set)) {
+      cpus.push_back(cpu);
+    }
+  }
+#endif
+  return cpus;
+}
+
+bool setCurrentThreadAffinity(const std::vector<unsigned>& cpus) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (auto cpu : cpus) {
+    if (cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &set);
+    }
+  }
+  return CPU_COUNT(&set) > 0 && sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+  (void)cpus;
+  return false;
+#endif
+}
+
+ScopedThreadAffinity::ScopedThreadAffinity(const std::vector<unsigned>& cpus) {
+  if (cpus.empty()) {
+    return;
+  }
+  auto previous = getCurrentThreadAffinity();
+  if (setCurrentThreadAffinity(cpus)) {
+    previous_ = std::move(previous);
+  }
+}
+
+ScopedThreadAffinity::~ScopedThreadAffinity() {
+  if (!previous_.empty()) {
+    setCurrentThreadAffinity(previous_);
+  }
+}
+
+} // namespace watchman
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <string_view>
+#include <vector>
+
+namespace watchman {
+
+/**
+ * Parses a list of CPU numbers in the format of Linux's cpulist files, such
+ * as "0-3,8,10-11".  Returns them sorted and without duplicates.  Throws
+ * std::invalid_argument if list isn't in that format.
+ */
+std::vector<unsigned> parseCpuList(std::string_view list);
+
+/**
+ * Returns the CPUs of the given NUMA node, or an empty list if there is no
+ * such node or the platform doesn't say.
+ */
+std::vector<unsigned> getNumaNodeCpus(unsigned node);
+
+/**
+ * Returns the CPUs that the calling thread may run on, or an empty list
+ * where the platform can't tell.
+ */
+std::vector<unsigned> getCurrentThreadAffinity();
+
+/**
+ * Restricts the calling thread to cpus.  Returns false, leaving the thread
+ * as it was, if cpus is empty or the platform can't; only Linux can.
+ */
+bool setCurrentThreadAffinity(const std::vector<unsigned>& cpus);
+
+/**
+ * Restricts the calling thread to cpus for as long as it lives, and then
+ * lets the thread run where it could before, for pool workers that take on
+ * a root's work for a while.  Does nothing if cpus is empty.
+ */
+class ScopedThreadAffinity {
+ public:
+  explicit ScopedThreadAffinity(const std::vector<unsigned>& cpus);
+  ~ScopedThreadAffinity();
+
+  ScopedThreadAffinity(const ScopedThreadAffinity&) = delete;
+  ScopedThreadAffinity& operator=(const ScopedThreadAffinity&) = delete;
+
+ private:
+  std::vector<unsigned> previous_;
+};
+
+} // namespace watchman
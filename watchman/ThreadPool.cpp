@@ -10,6 +10,19 @@
 
 namespace watchman {
 
+namespace {
+// The pool and queue of the worker running on this thread, if any
+thread_local const ThreadPool* currentPool = nullptr;
+thread_local size_t currentQueue = 0;
+
+size_t laneForPriority(int8_t priority) {
+  if (priority > folly::Executor::MID_PRI) {
+    return 0;
+  }
+  return priority == folly::Executor::MID_PRI ? 1 : 2;
+}
+} // namespace
+
 ThreadPool& getThreadPool() {
   static ThreadPool pool;
   return pool;
@@ -29,29 +42,89 @@ void ThreadPool::start(size_t numWorkers, size_t maxItems) {
   }
   maxItems_ = maxItems;
 
+  for (auto i = 0U; i < numWorkers; ++i) {
+    queues_.push_back(std::make_unique<Queue>());
+  }
   for (auto i = 0U; i < numWorkers; ++i) {
     workers_.emplace_back([this, i]() noexcept {
       w_set_thread_name("ThreadPool-", i);
-      runWorker();
+      runWorker(i);
     });
   }
 }
 
-void ThreadPool::runWorker() {
+void ThreadPool::runWorker(size_t index) {
+  currentPool = this;
+  currentQueue = index;
+
   while (true) {
     folly::Func task;
+    if (takeTask(index, task)) {
+      task();
+      executed_.fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    ++sleepers_;
+    workAvailable_.wait(lock, [this] { return stopping_ || queued_ > 0; });
+    --sleepers_;
+    if (stopping_ && queued_ == 0) {
+      return;
+    }
+  }
+}
 
-    {
-      std::unique_lock<std::mutex> lock(mutex_);
-      condition_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
-      if (stopping_ && tasks_.empty()) {
-        return;
+bool ThreadPool::takeTask(size_t index, folly::Func& task) {
+  if (queued_ == 0) {
+    return false;
+  }
+  for (size_t lane = 0; lane < kNumPriorities; ++lane) {
+    if (popFrom(*queues_[index], lane, false, task)) {
+      return true;
+    }
+    for (size_t i = 1; i < queues_.size(); ++i) {
+      auto& victim = *queues_[(index + i) % queues_.size()];
+      if (popFrom(victim, lane, true, task)) {
+        steals_.fetch_add(1, std::memory_order_relaxed);
+        return true;
       }
-      task = std::move(tasks_.front());
-      tasks_.pop_front();
     }
+  }
+  return false;
+}
+
+bool ThreadPool::popFrom(
+    Queue& queue,
+    size_t lane,
+    bool steal,
+    folly::Func& task) {
+  {
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    auto& tasks = queue.lanes[lane];
+    if (tasks.empty()) {
+      return false;
+    }
+    // The owner runs its tasks in the order they were added, while a thief
+    // takes from the other end so that the two rarely want the same task.
+    if (steal) {
+      task = std::move(tasks.back());
+      tasks.pop_back();
+    } else {
+      task = std::move(tasks.front());
+      tasks.pop_front();
+    }
+  }
+  taskTaken();
+  return true;
+}
 
-    task();
+void ThreadPool::taskTaken() {
+  --queued_;
+  if (blockedProducers_ > 0) {
+    // Taking the lock orders this with a producer that is about to wait
+    { std::unique_lock<std::mutex> lock(mutex_); }
+    spaceAvailable_.notify_one();
   }
 }
 
@@ -60,28 +133,74 @@ void ThreadPool::stop(bool join) {
     std::unique_lock<std::mutex> lock(mutex_);
     stopping_ = true;
   }
-  condition_.notify_all();
+  workAvailable_.notify_all();
+  spaceAvailable_.notify_all();
 
   if (join) {
     for (auto& worker : workers_) {
-      worker.join();
+      if (worker.joinable()) {
+        worker.join();
+      }
     }
   }
 }
 
 void ThreadPool::add(folly::Func func) {
-  {
+  addWithPriority(std::move(func), folly::Executor::MID_PRI);
+}
+
+void ThreadPool::addWithPriority(folly::Func func, int8_t priority) {
+  if (stopping_) {
+    throw std::runtime_error("cannot add tasks after pool has stopped");
+  }
+  if (queues_.empty()) {
+    throw std::runtime_error("cannot add tasks before pool has started");
+  }
+
+  // A worker that waited for room could be waiting on itself, so the
+  // workers may overfill the pool instead.
+  bool onWorker = currentPool == this;
+  if (!onWorker && queued_ >= maxItems_) {
     std::unique_lock<std::mutex> lock(mutex_);
+    ++blockedProducers_;
+    waits_.fetch_add(1, std::memory_order_relaxed);
+    spaceAvailable_.wait(
+        lock, [this] { return stopping_ || queued_ < maxItems_; });
+    --blockedProducers_;
     if (stopping_) {
       throw std::runtime_error("cannot add tasks after pool has stopped");
     }
-    if (tasks_.size() + 1 >= maxItems_) {
-      throw std::runtime_error("thread pool queue is full");
+  }
+
+  auto index = onWorker ? currentQueue : nextQueue_++ % queues_.size();
+  auto& queue = *queues_[index];
+  {
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    queue.lanes[laneForPriority(priority)].emplace_back(std::move(func));
+    // Counted while the task can't yet be taken, so that queued_ never
+    // drops below the number of tasks in the queues
+    auto queued = ++queued_;
+    auto maxQueued = maxQueued_.load(std::memory_order_relaxed);
+    while (queued > maxQueued &&
+           !maxQueued_.compare_exchange_weak(
+               maxQueued, queued, std::memory_order_relaxed)) {
     }
+  }
 
-    tasks_.emplace_back(std::move(func));
+  if (sleepers_ > 0) {
+    // Taking the lock orders this with a worker that is about to sleep
+    { std::unique_lock<std::mutex> lock(mutex_); }
+    workAvailable_.notify_one();
   }
+}
 
-  condition_.notify_one();
+ThreadPool::Stats ThreadPool::getStats() const {
+  Stats stats;
+  stats.queued = queued_.load();
+  stats.maxQueued = maxQueued_.load(std::memory_order_relaxed);
+  stats.executed = executed_.load(std::memory_order_relaxed);
+  stats.steals = steals_.load(std::memory_order_relaxed);
+  stats.waits = waits_.load(std::memory_order_relaxed);
+  return stats;
 }
 } // namespace watchman
@@ -7,8 +7,11 @@
 
 #pragma once
 #include <folly/Executor.h>
+#include <array>
+#include <atomic>
 #include <condition_variable>
 #include <deque>
+#include <memory>
 #include <mutex>
 #include <thread>
 #include <vector>
@@ -16,49 +19,102 @@
 
 namespace watchman {
 
-// Almost the dumbest possible thread pool implementation.
-// This allows us to set an upper bound on the number of concurrent
-// tasks that are executed in the thread pool.  Contrast with
-// std::async which leaves it to the implementation to decide
-// whether each async invocation spawns a thread or uses a
-// thread pool with an unspecified number of threads.
-// Constraining the concurrency is important for watchman so
-// that we can limit the amount of I/O that we might induce.
-
+// A thread pool with a fixed number of workers, so that we can set an upper
+// bound on the number of concurrent tasks.  Contrast with std::async which
+// leaves it to the implementation to decide whether each async invocation
+// spawns a thread or uses a thread pool with an unspecified number of
+// threads.  Constraining the concurrency is important for watchman so that
+// we can limit the amount of I/O that we might induce.
+//
+// Each worker has its own queue, so that the workers don't all contend on
+// one lock.  Tasks added by a worker go to its own queue, and the others
+// round robin across the queues.  A worker whose queue is empty steals from
+// the others before it sleeps.
+//
+// Tasks have one of three priorities, following folly::Executor: above
+// MID_PRI, MID_PRI (which is what add() uses), and below it.  Workers run
+// the queued tasks of a higher priority first.
 class ThreadPool : public folly::Executor {
  public:
+  static constexpr uint8_t kNumPriorities = 3;
+
+  struct Stats {
+    // The tasks waiting to run
+    size_t queued{0};
+    // The most tasks that have been waiting at once
+    size_t maxQueued{0};
+    uint64_t executed{0};
+    // Tasks run by a worker other than the one whose queue they were on
+    uint64_t steals{0};
+    // Times that add() waited for a full pool to drain
+    uint64_t waits{0};
+  };
+
   ThreadPool() = default;
   ~ThreadPool() override;
 
   // Start a thread pool with the specified number of worker threads
   // and the specified upper bound on the number of queued jobs.
   // The queue limit is intended as a brake in case the system
-  // is under a heavy backlog, and can also help surface issues
-  // where there a task executing in the pool is blocking on
-  // the results of some other task also running in the thread
-  // pool.
+  // is under a heavy backlog.  Once it is reached, add() waits for
+  // the workers to catch up, except on the pool's own workers, where
+  // waiting could deadlock the pool.
   void start(size_t numWorkers, size_t maxItems);
 
-  // Request that the worker threads terminate.
+  // Request that the worker threads terminate once the queued tasks
+  // have run.
   // If `join` is true, wait for the worker threads to terminate.
   void stop(bool join = true);
 
   // Run a function in the thread pool.
   // This queues up the function for asynchronous execution and
   // may return before func has been executed.
-  // If the thread pool has been stopped, throws a runtime_error.
+  // If the thread pool hasn't been started or has been stopped, throws a
+  // runtime_error.
   void add(folly::Func func) override;
 
+  void addWithPriority(folly::Func func, int8_t priority) override;
+
+  uint8_t getNumPriorities() const override {
+    return kNumPriorities;
+  }
+
+  Stats getStats() const;
+
  private:
+  struct Queue {
+    std::mutex mutex;
+    // Indexed by lane; lane 0 holds the highest priority tasks
+    std::array<std::deque<folly::Func>, kNumPriorities> lanes;
+  };
+
+  std::vector<std::unique_ptr<Queue>> queues_;
   std::vector<std::thread> workers_;
-  std::deque<folly::Func> tasks_;
 
+  // Guards sleeping and waking workers and blocked producers; the queues
+  // have locks of their own
   std::mutex mutex_;
-  std::condition_variable condition_;
-  bool stopping_{false};
-  size_t maxItems_;
+  // Signalled when a task is queued or the pool is stopping
+  std::condition_variable workAvailable_;
+  // Signalled when a full pool has room again
+  std::condition_variable spaceAvailable_;
+  std::atomic<bool> stopping_{false};
+  size_t maxItems_{0};
+
+  std::atomic<size_t> queued_{0};
+  std::atomic<size_t> maxQueued_{0};
+  std::atomic<size_t> sleepers_{0};
+  std::atomic<size_t> blockedProducers_{0};
+  std::atomic<size_t> nextQueue_{0};
+  std::atomic<uint64_t> executed_{0};
+  std::atomic<uint64_t> steals_{0};
+  std::atomic<uint64_t> waits_{0};
 
-  void runWorker();
+  void runWorker(size_t index);
+  // Takes the highest priority task, preferring the worker's own queue
+  bool takeTask(size_t index, folly::Func& task);
+  bool popFrom(Queue& queue, size_t lane, bool steal, folly::Func& task);
+  void taskTaken();
 };
 
 // Return a reference to the shared thread pool for the watchman process.
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ThreadUsage.h"
+#include <folly/memory/Malloc.h>
+#include "watchman/watchman_system.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <time.h>
+#endif
+
+namespace watchman {
+
+namespace {
+
+std::chrono::microseconds threadCpuTime() {
+#ifdef _WIN32
+  FILETIME creation, exit, kernel, user;
+  if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+    return std::chrono::microseconds{0};
+  }
+  auto ticks = [](const FILETIME& ft) {
+    return (uint64_t(ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
+  };
+  // FILETIME counts 100ns intervals
+  return std::chrono::microseconds{(ticks(kernel) + ticks(user)) / 10};
+#else
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+    return std::chrono::microseconds{0};
+  }
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::seconds{ts.tv_sec} + std::chrono::nanoseconds{ts.tv_nsec});
+#endif
+}
+
+uint64_t threadAllocatedBytes() {
+#if defined(FOLLY_USE_JEMALLOC)
+  // jemalloc hands out a pointer to the thread's counter, which stays valid
+  // for the life of the thread, so look it up once.
+  thread_local uint64_t* allocated = [] {
+    uint64_t* counter = nullptr;
+    size_t len = sizeof(counter);
+    if (!folly::usingJEMalloc() ||
+        mallctl("thread.allocatedp", &counter, &len, nullptr, 0) != 0) {
+      return static_cast<uint64_t*>(nullptr);
+    }
+    return counter;
+  }();
+  return allocated ? *allocated : 0;
+#else
+  return 0;
+#endif
+}
+
+} // namespace
+
+ThreadUsage ThreadUsage::current() {
+  return ThreadUsage{threadCpuTime(), threadAllocatedBytes()};
+}
+
+void ThreadCpuClock::attachToCurrentThread() {
+#ifdef __linux__
+  clockid_t clock;
+  if (pthread_getcpuclockid(pthread_self(), &clock) == 0) {
+    clock_.store(int64_t(clock), std::memory_order_release);
+  }
+#endif
+}
+
+void ThreadCpuClock::detach() {
+  clock_.store(-1, std::memory_order_release);
+}
+
+std::optional<std::chrono::microseconds> ThreadCpuClock::read() const {
+#ifdef __linux__
+  auto clock = clock_.load(std::memory_order_acquire);
+  struct timespec ts;
+  if (clock == -1 || clock_gettime(clockid_t(clock), &ts) != 0) {
+    return std::nullopt;
+  }
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::seconds{ts.tv_sec} + std::chrono::nanoseconds{ts.tv_nsec});
+#else
+  return std::nullopt;
+#endif
+}
+
+} // namespace watchman
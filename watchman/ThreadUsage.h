@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+namespace watchman {
+
+/**
+ * The resources that a thread has consumed since it started.  Taking the
+ * difference of two samples from the same thread attributes the resources
+ * used between them.
+ */
+struct ThreadUsage {
+  // User and system CPU time
+  std::chrono::microseconds cpuTime{0};
+  // Bytes allocated from the heap.  Only counted when jemalloc is in use,
+  // since no other allocator keeps a cheap per-thread tally.
+  uint64_t allocatedBytes{0};
+
+  /**
+   * Samples the calling thread.  Costs a clock_gettime() call, so it's
+   * cheap enough to call a few times per query but not per file.
+   */
+  static ThreadUsage current();
+
+  ThreadUsage operator-(const ThreadUsage& other) const {
+    return ThreadUsage{
+        cpuTime - other.cpuTime, allocatedBytes - other.allocatedBytes};
+  }
+
+  ThreadUsage& operator+=(const ThreadUsage& other) {
+    cpuTime += other.cpuTime;
+    allocatedBytes += other.allocatedBytes;
+    return *this;
+  }
+};
+
+/**
+ * Reads the CPU time of a long lived thread, such as a root's IO thread,
+ * from other threads, for the debug and metrics commands.  The thread
+ * attaches itself when it starts and detaches before it exits, as the
+ * clock of an exited thread may name another thread.
+ */
+class ThreadCpuClock {
+ public:
+  void attachToCurrentThread();
+  void detach();
+
+  /**
+   * Returns the attached thread's CPU time, or nullopt if no thread is
+   * attached or the platform can't read another thread's clock; only Linux
+   * can.
+   */
+  std::optional<std::chrono::microseconds> read() const;
+
+ private:
+  // The clockid_t of the attached thread, or -1
+  std::atomic<int64_t> clock_{-1};
+};
+
+} // namespace watchman
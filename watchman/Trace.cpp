@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/Trace.h"
+
+#ifdef WATCHMAN_ENABLE_TRACING
+
+#include <folly/Synchronized.h>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include "watchman/Logging.h"
+#include "watchman/RingBuffer.h"
+#include "watchman/WatchmanConfig.h"
+
+namespace watchman {
+
+namespace {
+
+// How many exited threads are kept around, so that the spans of a client
+// connection that has just closed can still be dumped.
+constexpr size_t kRetiredThreads = 16;
+
+struct ThreadTrace {
+  ThreadTrace(uint32_t capacity, std::string name, uint64_t tid)
+      : events{capacity}, name{std::move(name)}, tid{tid} {}
+
+  RingBuffer<TraceEvent> events;
+  const std::string name;
+  const uint64_t tid;
+};
+
+struct TraceRegistry {
+  std::vector<std::shared_ptr<ThreadTrace>> live;
+  std::deque<std::shared_ptr<ThreadTrace>> retired;
+};
+
+folly::Synchronized<TraceRegistry>& registry() {
+  static auto* registry = new folly::Synchronized<TraceRegistry>();
+  return *registry;
+}
+
+uint64_t toNs(std::chrono::steady_clock::time_point time) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             time.time_since_epoch())
+      .count();
+}
+
+/**
+ * Owns the calling thread's buffer and moves it to the retired list when the
+ * thread exits.
+ */
+class ThreadTraceHolder {
+ public:
+  ~ThreadTraceHolder() {
+    if (!trace_) {
+      return;
+    }
+    auto reg = registry().wlock();
+    auto& live = reg->live;
+    for (auto it = live.begin(); it != live.end(); ++it) {
+      if (*it == trace_) {
+        live.erase(it);
+        break;
+      }
+    }
+    reg->retired.push_back(std::move(trace_));
+    if (reg->retired.size() > kRetiredThreads) {
+      reg->retired.pop_front();
+    }
+  }
+
+  // Returns nullptr if tracing has been configured off
+  ThreadTrace* get() {
+    if (!initialized_) {
+      initialized_ = true;
+      auto capacity = cfg_get_int("trace_buffer_size", 16384);
+      if (capacity > 0) {
+        static std::atomic<uint64_t> nextTid{1};
+        trace_ = std::make_shared<ThreadTrace>(
+            uint32_t(capacity),
+            Log::getThreadName(),
+            nextTid.fetch_add(1, std::memory_order_relaxed));
+        registry().wlock()->live.push_back(trace_);
+      }
+    }
+    return trace_.get();
+  }
+
+ private:
+  bool initialized_{false};
+  std::shared_ptr<ThreadTrace> trace_;
+};
+
+thread_local ThreadTraceHolder threadTrace;
+
+void appendEvents(const ThreadTrace& trace, std::vector<json_ref>& events) {
+  auto pid = json_integer(json_int_t(getpid()));
+  events.push_back(json_object({
+      {"name", typed_string_to_json("thread_name")},
+      {"ph", typed_string_to_json("M")},
+      {"pid", pid},
+      {"tid", json_integer(json_int_t(trace.tid))},
+      {"args",
+       json_object({{"name", typed_string_to_json(trace.name)}})},
+  }));
+  for (auto& event : trace.events.readAll()) {
+    events.push_back(json_object({
+        {"name", typed_string_to_json(event.name, W_STRING_UNICODE)},
+        {"ph", typed_string_to_json("X")},
+        {"pid", pid},
+        {"tid", json_integer(json_int_t(trace.tid))},
+        // The trace format is in microseconds
+        {"ts", json_real(double(event.startNs) / 1000)},
+        {"dur", json_real(double(event.durationNs) / 1000)},
+    }));
+  }
+}
+
+} // namespace
+
+void TraceSpan::record(
+    const char* name,
+    std::chrono::steady_clock::time_point start,
+    std::chrono::steady_clock::time_point end) {
+  auto* trace = threadTrace.get();
+  if (!trace) {
+    return;
+  }
+  auto startNs = toNs(start);
+  auto endNs = toNs(end);
+  trace->events.write(
+      TraceEvent{name, startNs, endNs > startNs ? endNs - startNs : 0});
+}
+
+bool isTracingCompiledIn() {
+  return true;
+}
+
+json_ref dumpTraceEvents() {
+  std::vector<std::shared_ptr<ThreadTrace>> traces;
+  {
+    auto reg = registry().rlock();
+    traces.insert(traces.end(), reg->retired.begin(), reg->retired.end());
+    traces.insert(traces.end(), reg->live.begin(), reg->live.end());
+  }
+
+  std::vector<json_ref> events;
+  for (auto& trace : traces) {
+    appendEvents(*trace, events);
+  }
+  return json_array(std::move(events));
+}
+
+void clearTrace() {
+  auto reg = registry().wlock();
+  reg->retired.clear();
+  for (auto& trace : reg->live) {
+    trace->events.clear();
+  }
+}
+
+} // namespace watchman
+
+#else
+
+namespace watchman {
+
+void TraceSpan::record(
+    const char*,
+    std::chrono::steady_clock::time_point,
+    std::chrono::steady_clock::time_point) {}
+
+bool isTracingCompiledIn() {
+  return false;
+}
+
+json_ref dumpTraceEvents() {
+  return json_array(std::vector<json_ref>{});
+}
+
+void clearTrace() {}
+
+} // namespace watchman
+
+#endif
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include "watchman/thirdparty/jansson/jansson.h"
+#include "watchman/watchman_system.h"
+
+namespace watchman {
+
+/**
+ * A completed span, as held in a thread's trace buffer.
+ */
+struct TraceEvent {
+  // Always a string literal, so that recording never allocates
+  const char* name{nullptr};
+  uint64_t startNs{0};
+  uint64_t durationNs{0};
+};
+
+/**
+ * Times the enclosing scope, or up to the call to end(), and records it in
+ * the calling thread's trace buffer.
+ *
+ * Each thread that records a span gets a fixed-size lock-free buffer of the
+ * most recent `trace_buffer_size` spans, so tracing costs two clock reads
+ * and a ring buffer write per span.  When watchman is built without
+ * ENABLE_TRACING this class is empty and compiles away entirely.
+ *
+ * `name` must be a string literal.
+ */
+class TraceSpan {
+ public:
+#ifdef WATCHMAN_ENABLE_TRACING
+  explicit TraceSpan(const char* name)
+      : name_{name}, start_{std::chrono::steady_clock::now()} {}
+
+  ~TraceSpan() {
+    end();
+  }
+
+  void end() {
+    if (name_) {
+      record(name_, start_, std::chrono::steady_clock::now());
+      name_ = nullptr;
+    }
+  }
+#else
+  explicit TraceSpan(const char*) {}
+
+  void end() {}
+#endif
+
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+  static void record(
+      const char* name,
+      std::chrono::steady_clock::time_point start,
+      std::chrono::steady_clock::time_point end);
+
+ private:
+#ifdef WATCHMAN_ENABLE_TRACING
+  const char* name_;
+  std::chrono::steady_clock::time_point start_;
+#endif
+};
+
+/**
+ * Whether this build records spans at all.
+ */
+bool isTracingCompiledIn();
+
+/**
+ * Renders the buffered spans of every thread, including a few threads that
+ * have recently exited, as an array of Chrome trace events.  An object with
+ * this array as its "traceEvents" can be loaded into chrome://tracing or
+ * Perfetto.
+ */
+json_ref dumpTraceEvents();
+
+/**
+ * Forgets the spans recorded so far.
+ */
+void clearTrace();
+
+} // namespace watchman
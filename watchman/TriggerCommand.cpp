@@ -7,11 +7,15 @@
 
 #include "watchman/TriggerCommand.h"
 #include <folly/String.h>
+#include <atomic>
 #include "watchman/Errors.h"
 #include "watchman/PDU.h"
+#include "watchman/PerfSample.h"
 #include "watchman/QueryableView.h"
 #include "watchman/Shutdown.h"
 #include "watchman/UserDir.h"
+#include "watchman/WatchmanConfig.h"
+#include "watchman/bser.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/eval.h"
 #include "watchman/query/parse.h"
@@ -19,10 +23,47 @@
 #include "watchman/sockname.h"
 #include "watchman/watchman_stream.h"
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
 namespace watchman {
 
 namespace {
 
+// How often a persistent worker is checked for having exited, and how
+// often a backlog is retried while the worker isn't reading its stdin
+constexpr int kWorkerPollMs = 1000;
+constexpr int kWorkerBacklogPollMs = 50;
+
+// A worker that exits sooner than this after starting is restarted after
+// a delay that doubles, up to kMaxRestartDelay, each time it does so
+constexpr auto kMinWorkerUptime = std::chrono::seconds(10);
+constexpr auto kMaxRestartDelay = std::chrono::milliseconds(60000);
+
+// How often a running command is checked for having exited, and a batch
+// that is waiting for a free slot is retried
+constexpr int kRunningPollMs = 100;
+
+// The number of trigger commands running across all roots; at most
+// trigger_max_concurrency, when that is set
+std::atomic<json_int_t> runningCommands{0};
+
+bool acquire_slot() {
+  auto limit = cfg_get_int("trigger_max_concurrency", 0);
+  auto running = runningCommands++;
+  if (limit > 0 && running >= limit) {
+    runningCommands--;
+    return false;
+  }
+  return true;
+}
+
+int append_to_string(const char* buffer, size_t size, void* data) {
+  static_cast<std::string*>(data)->append(buffer, size);
+  return 0;
+}
+
 void parse_redirection(
     json_ref trig,
     std::string& name,
@@ -63,24 +104,26 @@ void parse_redirection(
   }
 }
 
-ResultErrno<std::unique_ptr<watchman_stream>> prepare_stdin(
-    TriggerCommand* cmd,
-    QueryResult* res) {
-  char stdin_file_name[WATCHMAN_NAME_MAX];
-
-  if (cmd->stdin_style == trigger_input_style::input_dev_null) {
-    return w_stm_open("/dev/null", O_RDONLY | O_CLOEXEC);
-  }
-
-  // Adjust result to fit within the specified limit
-  if (cmd->max_files_stdin > 0) {
-    auto& fileList = res->resultsArray.results;
-    if (fileList.size() > cmd->max_files_stdin) {
-      fileList.erase(fileList.begin() + cmd->max_files_stdin, fileList.end());
-    }
-  }
+/**
+ * An anonymous file to hold the input of a command.  On Linux this is a
+ * memfd, so that the file list of a frequently run trigger is never written
+ * to disk; elsewhere, or if the kernel lacks memfd, it is an unlinked
+ * temporary file.
+ */
+ResultErrno<std::unique_ptr<watchman_stream>> make_stdin_file() {
+#ifdef MFD_CLOEXEC
+  int memfd = memfd_create("watchman-trigger-stdin", MFD_CLOEXEC);
+  if (memfd != -1) {
+    return w_stm_fdopen(
+        FileDescriptor{memfd, FileDescriptor::FDType::Generic});
+  }
+  logf(
+      DBG,
+      "memfd_create failed, using a temporary file: {}\n",
+      folly::errnoStr(errno));
+#endif
 
-  /* prepare the input stream for the child process */
+  char stdin_file_name[WATCHMAN_NAME_MAX];
   snprintf(
       stdin_file_name,
       sizeof(stdin_file_name),
@@ -100,6 +143,30 @@ ResultErrno<std::unique_ptr<watchman_stream>> prepare_stdin(
   /* unlink the file, we don't need it in the filesystem;
    * we'll pass the fd on to the child as stdin */
   unlink(stdin_file_name); // FIXME: windows path translation
+  return stdin_file;
+}
+
+ResultErrno<std::unique_ptr<watchman_stream>> prepare_stdin(
+    TriggerCommand* cmd,
+    QueryResult* res) {
+  if (cmd->stdin_style == trigger_input_style::input_dev_null) {
+    return w_stm_open("/dev/null", O_RDONLY | O_CLOEXEC);
+  }
+
+  // Adjust result to fit within the specified limit
+  if (cmd->max_files_stdin > 0) {
+    auto& fileList = res->resultsArray.results;
+    if (fileList.size() > cmd->max_files_stdin) {
+      fileList.erase(fileList.begin() + cmd->max_files_stdin, fileList.end());
+    }
+  }
+
+  /* prepare the input stream for the child process */
+  auto stdin_file_res = make_stdin_file();
+  if (stdin_file_res.hasError()) {
+    return stdin_file_res.error();
+  }
+  auto stdin_file = std::move(stdin_file_res).value();
 
   switch (cmd->stdin_style) {
     case input_json: {
@@ -141,6 +208,51 @@ ResultErrno<std::unique_ptr<watchman_stream>> prepare_stdin(
   return stdin_file;
 }
 
+// The options to spawn the command with, other than its stdin
+ChildProcess::Options prepare_options(
+    const std::shared_ptr<Root>& root,
+    TriggerCommand* cmd) {
+  ChildProcess::Options opts;
+  opts.environment() = cmd->env;
+#ifndef _WIN32
+  sigset_t mask;
+  sigemptyset(&mask);
+  opts.setSigMask(mask);
+#endif
+  opts.setFlags(POSIX_SPAWN_SETPGROUP);
+
+  if (!cmd->stdout_name.empty()) {
+    opts.open(STDOUT_FILENO, cmd->stdout_name.c_str(), cmd->stdout_flags, 0666);
+  } else {
+    opts.dup2(FileDescriptor::stdOut(), STDOUT_FILENO);
+  }
+
+  if (!cmd->stderr_name.empty()) {
+    opts.open(STDERR_FILENO, cmd->stderr_name.c_str(), cmd->stderr_flags, 0666);
+  } else {
+    opts.dup2(FileDescriptor::stdErr(), STDERR_FILENO);
+  }
+
+  // Figure out the appropriate cwd
+  w_string working_dir =
+      cmd->query->relative_root ? *cmd->query->relative_root : root->root_path;
+
+  auto cwd = cmd->definition.get_optional("chdir");
+  if (cwd) {
+    auto target = json_to_w_string(*cwd);
+    if (w_string_path_is_absolute(target)) {
+      working_dir = target;
+    } else {
+      working_dir = w_string::pathCat({working_dir, target});
+    }
+  }
+
+  log(DBG, "using ", working_dir, " for working dir\n");
+  opts.chdir(working_dir.c_str());
+
+  return opts;
+}
+
 void spawn_command(
     const std::shared_ptr<Root>& root,
     TriggerCommand* cmd,
@@ -231,53 +343,25 @@ void spawn_command(
 
   cmd->env.setBool("WATCHMAN_FILES_OVERFLOW", file_overflow);
 
-  ChildProcess::Options opts;
-  opts.environment() = cmd->env;
-#ifndef _WIN32
-  sigset_t mask;
-  sigemptyset(&mask);
-  opts.setSigMask(mask);
-#endif
-  opts.setFlags(POSIX_SPAWN_SETPGROUP);
-
+  auto opts = prepare_options(root, cmd);
   opts.dup2(stdin_file->getFileDescriptor(), STDIN_FILENO);
 
-  if (!cmd->stdout_name.empty()) {
-    opts.open(STDOUT_FILENO, cmd->stdout_name.c_str(), cmd->stdout_flags, 0666);
-  } else {
-    opts.dup2(FileDescriptor::stdOut(), STDOUT_FILENO);
-  }
-
-  if (!cmd->stderr_name.empty()) {
-    opts.open(STDERR_FILENO, cmd->stderr_name.c_str(), cmd->stderr_flags, 0666);
-  } else {
-    opts.dup2(FileDescriptor::stdErr(), STDERR_FILENO);
-  }
-
-  // Figure out the appropriate cwd
-  w_string working_dir =
-      cmd->query->relative_root ? *cmd->query->relative_root : root->root_path;
-
-  auto cwd = cmd->definition.get_optional("chdir");
-  if (cwd) {
-    auto target = json_to_w_string(*cwd);
-    if (w_string_path_is_absolute(target)) {
-      working_dir = target;
-    } else {
-      working_dir = w_string::pathCat({working_dir, target});
-    }
-  }
-
-  log(DBG, "using ", working_dir, " for working dir\n");
-  opts.chdir(working_dir.c_str());
-
   try {
     if (cmd->current_proc) {
       cmd->current_proc->kill();
       cmd->current_proc->wait();
     }
+    PerfSample sample("spawn");
     cmd->current_proc = std::make_unique<ChildProcess>(
         json_array(std::move(args)), std::move(opts));
+    if (sample.finish()) {
+      sample.add_meta(
+          "spawn",
+          json_object(
+              {{"trigger", w_string_to_json(cmd->triggername)},
+               {"root", w_string_to_json(root->root_path)}}));
+      sample.log();
+    }
   } catch (const std::exception& exc) {
     log(ERR,
         "trigger ",
@@ -305,6 +389,8 @@ TriggerCommand::TriggerCommand(
       max_files_stdin(0),
       stdout_flags(0),
       stderr_flags(0),
+      persistent(false),
+      persistent_encoding(is_json_compact),
       savedStateFactory_{savedStateFactory},
       ping_(w_event_make_sockets()) {
   auto queryDef = json_object();
@@ -374,6 +460,37 @@ TriggerCommand::TriggerCommand(
   }
   max_files_stdin = ival;
 
+  persistent = trig.get_default("persistent", json_false()).asBool();
+  if (persistent) {
+    if (stdin_style != input_json) {
+      throw CommandValidationError(
+          "persistent triggers must set stdin to an array of field names");
+    }
+    if (append_files) {
+      throw CommandValidationError(
+          "append_files can't be used with persistent triggers");
+    }
+  }
+
+  auto encoding = trig.get_optional("persistent_encoding");
+  if (encoding) {
+    if (!persistent) {
+      throw CommandValidationError(
+          "persistent_encoding is only valid for persistent triggers");
+    }
+    if (!encoding->isString()) {
+      throw CommandValidationError("persistent_encoding must be a string");
+    }
+    const char* str = json_string_value(*encoding);
+    if (!strcmp(str, "json")) {
+      persistent_encoding = is_json_compact;
+    } else if (!strcmp(str, "bser")) {
+      persistent_encoding = is_bser_v2;
+    } else {
+      CommandValidationError::throwf("invalid persistent_encoding {}", str);
+    }
+  }
+
   parse_redirection(trig, stdout_name, &stdout_flags, "stdout");
   parse_redirection(trig, stderr_name, &stderr_flags, "stderr");
 
@@ -404,34 +521,69 @@ void TriggerCommand::run(const std::shared_ptr<Root>& root) {
     log(DBG, "waiting for settle\n");
 
     while (!w_is_stopping() && !stopTrigger_) {
-      ignore_result(w_poll_events(pfd, 1, 86400));
+      // A persistent worker is checked on every wakeup, so that it is
+      // restarted if it exits and so that a backlog is written as the
+      // worker reads it
+      int timeoutms = !persistent
+          ? (current_proc || batchPending_ ? kRunningPollMs : 86400)
+          : workerBacklog_.empty() ? kWorkerPollMs
+                                   : kWorkerBacklogPollMs;
+      ignore_result(w_poll_events(pfd, 1, timeoutms));
       if (w_is_stopping() || stopTrigger_) {
         break;
       }
       while (ping_->testAndClear()) {
         pending.clear();
         subscriber_->getPending(pending);
-        bool seenSettle = false;
         for (auto& item : pending) {
           if (item->payload.get_optional("settled")) {
-            seenSettle = true;
+            noteSettle();
             break;
           }
         }
+      }
 
-        if (seenSettle) {
-          if (!maybeSpawn(root)) {
-            continue;
+      if (persistent) {
+        if (ensureWorker(root) && flushWorker() && batchPending_) {
+          batchPending_ = false;
+          if (maybeSpawn(root)) {
+            flushWorker();
           }
-          waitNoIntr();
         }
+        continue;
+      }
+
+      // Settles seen while the command is still running are merged into
+      // one batch, which is run once it exits
+      waitNoIntr();
+      if (!batchPending_ || current_proc) {
+        continue;
+      }
+      if (!acquire_slot()) {
+        if (!waitingForSlot_) {
+          waitingForSlot_ = true;
+          stats_.wlock()->deferredForConcurrency++;
+        }
+        continue;
+      }
+      waitingForSlot_ = false;
+      holdsSlot_ = true;
+      batchPending_ = false;
+      maybeSpawn(root);
+      if (current_proc) {
+        spawnedAt_ = std::chrono::steady_clock::now();
+        stats_.wlock()->running = true;
+      } else {
+        releaseSlot();
       }
     }
 
     if (current_proc) {
       current_proc->kill();
       current_proc->wait();
+      current_proc.reset();
     }
+    releaseSlot();
   } catch (const std::exception& exc) {
     log(ERR, "Uncaught exception in trigger thread: ", exc.what(), "\n");
   }
@@ -512,7 +664,20 @@ bool TriggerCommand::maybeSpawn(const std::shared_ptr<Root>& root) {
 
     if (!res.resultsArray.results.empty()) {
       didRun = true;
-      spawn_command(root, this, &res, saved_spec.get());
+      auto latency = std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - pendingSince_);
+      {
+        auto stats = stats_.wlock();
+        stats->runs++;
+        stats->lastLatency = latency;
+        stats->maxLatency = std::max(stats->maxLatency, latency);
+        stats->totalLatency += latency;
+      }
+      if (persistent) {
+        sendToWorker(&res, std::move(saved_spec));
+      } else {
+        spawn_command(root, this, &res, saved_spec.get());
+      }
     }
     return didRun;
   } catch (const QueryExecError& e) {
@@ -526,14 +691,214 @@ bool TriggerCommand::maybeSpawn(const std::shared_ptr<Root>& root) {
   }
 }
 
+bool TriggerCommand::ensureWorker(const std::shared_ptr<Root>& root) {
+  if (current_proc && !current_proc->terminated()) {
+    return true;
+  }
+
+  auto now = std::chrono::steady_clock::now();
+  if (current_proc) {
+    auto status = current_proc->wait();
+    current_proc.reset();
+    {
+      auto stats = stats_.wlock();
+      stats->running = false;
+      stats->lastDuration =
+          std::chrono::duration_cast<std::chrono::milliseconds>(
+              now - workerStartedAt_);
+    }
+    log(ERR,
+        "persistent trigger ",
+        root->root_path,
+        ":",
+        triggername,
+        " exited with status ",
+        status,
+        ", restarting it\n");
+    if (now - workerStartedAt_ < kMinWorkerUptime) {
+      restartDelay_ = std::min(
+          std::max(restartDelay_ * 2, std::chrono::milliseconds(1000)),
+          kMaxRestartDelay);
+    } else {
+      restartDelay_ = std::chrono::milliseconds(0);
+    }
+    abandonBacklog();
+  }
+
+  if (now < workerStartedAt_ + restartDelay_) {
+    return false;
+  }
+  workerStartedAt_ = now;
+
+  auto opts = prepare_options(root, this);
+  opts.pipeStdin();
+  try {
+    current_proc =
+        std::make_unique<ChildProcess>(command.value(), std::move(opts));
+    // Writes must not block the trigger thread when the worker is behind
+    current_proc->pipe(STDIN_FILENO).write.setNonBlock();
+  } catch (const std::exception& exc) {
+    log(ERR,
+        "trigger ",
+        root->root_path,
+        ":",
+        triggername,
+        " failed: ",
+        exc.what(),
+        "\n");
+    current_proc.reset();
+    restartDelay_ = std::min(
+        std::max(restartDelay_ * 2, std::chrono::milliseconds(1000)),
+        kMaxRestartDelay);
+    return false;
+  }
+
+  stats_.wlock()->running = true;
+  // We have integration tests that check for this string
+  log(DBG, "posix_spawnp: ", triggername, "\n");
+  return true;
+}
+
+void TriggerCommand::sendToWorker(
+    QueryResult* res,
+    std::unique_ptr<ClockSpec> since) {
+  bool file_overflow = false;
+  if (max_files_stdin > 0) {
+    auto& fileList = res->resultsArray.results;
+    if (fileList.size() > max_files_stdin) {
+      file_overflow = true;
+      fileList.erase(fileList.begin() + max_files_stdin, fileList.end());
+    }
+  }
+
+  auto batch = json_object(
+      {{"clock",
+        w_string_to_json(
+            res->clockAtStartOfQuery.position().toClockString())},
+       {"files_overflow", json_boolean(file_overflow)}});
+  if (const auto* clock =
+          since ? std::get_if<ClockSpec::Clock>(&since->spec) : nullptr) {
+    batch.set("since", w_string_to_json(clock->position.toClockString()));
+  }
+  batch.set("files", std::move(res->resultsArray).toJson());
+
+  if (persistent_encoding == is_bser_v2) {
+    if (w_bser_write_pdu(2, 0, append_to_string, batch, &workerBacklog_) !=
+        0) {
+      log(ERR, "trigger ", triggername, ": failed to encode batch\n");
+      workerBacklog_.clear();
+      return;
+    }
+  } else {
+    workerBacklog_ = json_dumps(batch, JSON_COMPACT);
+    workerBacklog_.push_back('\n');
+  }
+  workerBacklogPos_ = 0;
+  undeliveredSince_ = std::move(since);
+}
+
+bool TriggerCommand::flushWorker() {
+  auto& fd = current_proc->pipe(STDIN_FILENO).write;
+  while (workerBacklogPos_ < workerBacklog_.size()) {
+    auto res = fd.write(
+        workerBacklog_.data() + workerBacklogPos_,
+        int(std::min<size_t>(
+            workerBacklog_.size() - workerBacklogPos_, 1 << 20)));
+    if (res.hasError()) {
+      if (res.error() == std::errc::interrupted) {
+        continue;
+      }
+      if (res.error() == std::errc::resource_unavailable_try_again ||
+          res.error() == std::errc::operation_would_block) {
+        // The worker is behind; try again once it has read some more
+        return false;
+      }
+      log(ERR,
+          "trigger ",
+          triggername,
+          ": failed to write to the persistent command: ",
+          res.error().message(),
+          "\n");
+      // It is restarted and sent the batch again on the next wakeup
+      current_proc->kill();
+      return false;
+    }
+    workerBacklogPos_ += size_t(res.value());
+  }
+
+  workerBacklog_.clear();
+  workerBacklogPos_ = 0;
+  undeliveredSince_.reset();
+  return true;
+}
+
+void TriggerCommand::abandonBacklog() {
+  workerBacklog_.clear();
+  workerBacklogPos_ = 0;
+  if (undeliveredSince_) {
+    query->since_spec = std::move(*undeliveredSince_);
+    undeliveredSince_.reset();
+    if (!batchPending_) {
+      batchPending_ = true;
+      pendingSince_ = std::chrono::steady_clock::now();
+    }
+  }
+}
+
 bool TriggerCommand::waitNoIntr() {
   if (!w_is_stopping() && !stopTrigger_) {
     if (current_proc && current_proc->terminated()) {
       current_proc.reset();
+      releaseSlot();
+      auto stats = stats_.wlock();
+      stats->running = false;
+      stats->lastDuration =
+          std::chrono::duration_cast<std::chrono::milliseconds>(
+              std::chrono::steady_clock::now() - spawnedAt_);
       return true;
     }
   }
   return false;
 }
 
+void TriggerCommand::noteSettle() {
+  auto stats = stats_.wlock();
+  stats->settles++;
+  if (batchPending_) {
+    stats->coalescedSettles++;
+  } else {
+    batchPending_ = true;
+    pendingSince_ = std::chrono::steady_clock::now();
+  }
+}
+
+void TriggerCommand::releaseSlot() {
+  if (holdsSlot_) {
+    holdsSlot_ = false;
+    runningCommands--;
+  }
+}
+
+json_ref TriggerCommand::statsToJson() const {
+  auto stats = stats_.rlock();
+  auto millis = [](std::chrono::milliseconds ms) {
+    return json_integer(ms.count());
+  };
+  return json_object({
+      {"settles", json_integer(stats->settles)},
+      {"coalesced_settles", json_integer(stats->coalescedSettles)},
+      {"deferred_for_concurrency",
+       json_integer(stats->deferredForConcurrency)},
+      {"runs", json_integer(stats->runs)},
+      {"running", json_boolean(stats->running)},
+      {"last_latency_ms", millis(stats->lastLatency)},
+      {"max_latency_ms", millis(stats->maxLatency)},
+      {"mean_latency_ms",
+       millis(
+           stats->runs ? stats->totalLatency / int64_t(stats->runs)
+                       : std::chrono::milliseconds(0))},
+      {"last_duration_ms", millis(stats->lastDuration)},
+  });
+}
+
 } // namespace watchman
@@ -7,9 +7,12 @@
 
 #pragma once
 
+#include <chrono>
 #include <thread>
 
+#include <folly/Synchronized.h>
 #include "watchman/ChildProcess.h"
+#include "watchman/PDU.h"
 #include "watchman/PubSub.h"
 #include "watchman/saved_state/SavedStateInterface.h"
 
@@ -17,7 +20,9 @@ namespace watchman {
 
 class Event;
 class Root;
+struct ClockSpec;
 struct Query;
+struct QueryResult;
 
 enum trigger_input_style { input_dev_null, input_json, input_name_list };
 
@@ -37,6 +42,12 @@ struct TriggerCommand {
   std::string stdout_name;
   std::string stderr_name;
 
+  /* When set, the command is started once and kept running, and each
+   * batch of matching files is written to its stdin as a PDU of this
+   * encoding, rather than spawning the command per batch */
+  bool persistent;
+  PduType persistent_encoding;
+
   /* While we are running, this holds the pid
    * of the running process */
   std::unique_ptr<ChildProcess> current_proc;
@@ -50,7 +61,28 @@ struct TriggerCommand {
   void stop();
   void start(const std::shared_ptr<Root>& root);
 
+  // The scheduling counters reported by trigger-list
+  json_ref statsToJson() const;
+
  private:
+  struct Stats {
+    // Settles seen, and how many of those were merged into a batch that
+    // was already waiting for a previous run or a free slot
+    uint64_t settles{0};
+    uint64_t coalescedSettles{0};
+    // Times a pending batch had to wait for trigger_max_concurrency
+    uint64_t deferredForConcurrency{0};
+    // Commands spawned, or batches sent to a persistent command
+    uint64_t runs{0};
+    bool running{false};
+    // From the first settle of a batch until it was run
+    std::chrono::milliseconds lastLatency{0};
+    std::chrono::milliseconds maxLatency{0};
+    std::chrono::milliseconds totalLatency{0};
+    // How long the last command that exited ran for
+    std::chrono::milliseconds lastDuration{0};
+  };
+
   TriggerCommand(const TriggerCommand&) = delete;
   TriggerCommand(TriggerCommand&&) = delete;
 
@@ -60,12 +92,40 @@ struct TriggerCommand {
   void run(const std::shared_ptr<Root>& root);
   bool maybeSpawn(const std::shared_ptr<Root>& root);
   bool waitNoIntr();
+  void noteSettle();
+  void releaseSlot();
+
+  bool ensureWorker(const std::shared_ptr<Root>& root);
+  void sendToWorker(QueryResult* res, std::unique_ptr<ClockSpec> since);
+  bool flushWorker();
+  void abandonBacklog();
 
   const SavedStateFactory savedStateFactory_;
   std::thread triggerThread_;
   std::shared_ptr<Publisher::Subscriber> subscriber_;
   std::unique_ptr<Event> ping_;
   bool stopTrigger_{false};
+
+  // Persistent mode: the part of the last batch that the worker hasn't
+  // read yet.  No new batch is queried until it has, so that changes
+  // made while the worker is behind are coalesced into one batch.
+  std::string workerBacklog_;
+  size_t workerBacklogPos_{0};
+  // The since clock of the batch in workerBacklog_, restored if the
+  // worker exits before reading all of it so that the files are sent
+  // again to its replacement
+  std::optional<std::unique_ptr<ClockSpec>> undeliveredSince_;
+  // A settle was seen that hasn't been queried for yet, and when the
+  // first such settle was
+  bool batchPending_{false};
+  std::chrono::steady_clock::time_point pendingSince_;
+  // Set while current_proc counts against trigger_max_concurrency
+  bool holdsSlot_{false};
+  bool waitingForSlot_{false};
+  std::chrono::steady_clock::time_point spawnedAt_;
+  folly::Synchronized<Stats> stats_;
+  std::chrono::steady_clock::time_point workerStartedAt_;
+  std::chrono::milliseconds restartDelay_{0};
 };
 
 } // namespace watchman
@@ -0,0 +1,311 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ViewSnapshot.h"
+#include <fmt/core.h>
+#include <folly/ScopeGuard.h>
+#include <folly/system/MemoryMapping.h>
+#include <cstdio>
+#include <string>
+#include "watchman/InMemoryView.h"
+#include "watchman/Options.h"
+#include "watchman/watchman_dir.h"
+#include "watchman/watchman_file.h"
+#include "watchman/watchman_stream.h"
+
+namespace watchman {
+
+namespace {
+
+constexpr char kMagic[4] = {'W', 'M', 'V', 'S'};
+
+// Each node in the tree is introduced by one of these tags.
+// Directories are bracketed by kDir ... kEndDir so that the tree can be
+// reconstructed with a simple stack walk and without materializing any
+// full path strings.
+enum RecordTag : uint8_t {
+  kDir = 'D',
+  kFile = 'F',
+  kEndDir = 'E',
+};
+
+struct Header {
+  char magic[4];
+  uint32_t version;
+  // Guards against reading a snapshot produced by a build with a
+  // different FileInformation layout.
+  uint32_t statSize;
+};
+
+// Flush the staging buffer to the stream once it grows beyond this size.
+constexpr size_t kFlushThreshold = 1024 * 1024;
+
+class SnapshotWriter {
+ public:
+  SnapshotWriter(watchman_stream& stm, const char* path)
+      : stm_(stm), path_(path) {
+    buf_.reserve(kFlushThreshold * 2);
+  }
+
+  template <typename T>
+  void put(const T& value) {
+    buf_.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  void putName(w_string_piece name) {
+    put(uint32_t(name.size()));
+    buf_.append(name.data(), name.size());
+  }
+
+  void maybeFlush() {
+    if (buf_.size() >= kFlushThreshold) {
+      flush();
+    }
+  }
+
+  void flush() {
+    const char* data = buf_.data();
+    size_t remaining = buf_.size();
+    while (remaining > 0) {
+      auto n = stm_.write(data, int(std::min<size_t>(remaining, 1 << 30)));
+      if (n <= 0) {
+        throw std::system_error(
+            errno,
+            std::generic_category(),
+            fmt::format("writing view snapshot {}", path_));
+      }
+      data += n;
+      remaining -= n;
+    }
+    buf_.clear();
+  }
+
+ private:
+  watchman_stream& stm_;
+  const char* path_;
+  std::string buf_;
+};
+
+class SnapshotReader {
+ public:
+  explicit SnapshotReader(folly::ByteRange range)
+      : cur_(reinterpret_cast<const char*>(range.begin())),
+        end_(reinterpret_cast<const char*>(range.end())) {}
+
+  bool atEnd() const {
+    return cur_ == end_;
+  }
+
+  template <typename T>
+  T get() {
+    T value;
+    need(sizeof(value));
+    memcpy(&value, cur_, sizeof(value));
+    cur_ += sizeof(value);
+    return value;
+  }
+
+  w_string_piece getBytes(uint32_t len) {
+    need(len);
+    w_string_piece result{cur_, len};
+    cur_ += len;
+    return result;
+  }
+
+  w_string_piece getName() {
+    return getBytes(get<uint32_t>());
+  }
+
+ private:
+  void need(size_t len) const {
+    if (size_t(end_ - cur_) < len) {
+      throw std::runtime_error("view snapshot is truncated");
+    }
+  }
+
+  const char* cur_;
+  const char* end_;
+};
+
+void writeDir(SnapshotWriter& writer, const watchman_dir* dir, size_t& count) {
+  for (auto& it : dir->files) {
+    auto file = it.second.get();
+    if (!file->exists) {
+      // Deleted nodes only matter for since queries, and every client will
+      // observe a fresh instance after a restart anyway.
+      continue;
+    }
+    writer.put(kFile);
+    writer.putName(file->getName());
+    writer.put(file->stat.toFileInformation());
+    ++count;
+    writer.maybeFlush();
+  }
+
+  for (auto& it : dir->dirs) {
+    auto child = it.second.get();
+    if (!child->last_check_existed) {
+      continue;
+    }
+    writer.put(kDir);
+    writer.putName(child->name);
+    writeDir(writer, child, count);
+    writer.put(kEndDir);
+  }
+}
+
+// Validates the header of the snapshot and returns its resume token, leaving
+// the reader positioned at the first record.  An empty rootPath accepts a
+// snapshot recorded for any root.
+w_string_piece readHeader(SnapshotReader& reader, const w_string& rootPath) {
+  auto header = reader.get<Header>();
+  if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+    throw std::runtime_error("not a view snapshot");
+  }
+  if (header.version != ViewSnapshot::kVersion ||
+      header.statSize != sizeof(FileInformation)) {
+    throw std::runtime_error(fmt::format(
+        "view snapshot version {} (stat size {}) is not compatible with "
+        "version {} (stat size {})",
+        header.version,
+        header.statSize,
+        ViewSnapshot::kVersion,
+        sizeof(FileInformation)));
+  }
+  auto recordedRoot = reader.getName();
+  if (!rootPath.empty() && recordedRoot != rootPath) {
+    throw std::runtime_error("view snapshot was recorded for a different root");
+  }
+  return reader.getName();
+}
+
+} // namespace
+
+w_string ViewSnapshot::pathForRoot(const w_string& rootPath) {
+  if (flags.dont_save_state || flags.watchman_state_file.empty()) {
+    return w_string{};
+  }
+  return w_string{fmt::format(
+      "{}.view-{:016x}",
+      flags.watchman_state_file,
+      uint64_t(rootPath.hashValue()))};
+}
+
+size_t ViewSnapshot::save(
+    const ViewDatabase& view,
+    const w_string& rootPath,
+    const w_string& path,
+    w_string_piece resumeToken) {
+  auto tempPath = fmt::format("{}.tmp", path);
+  auto stm = w_stm_open(tempPath.c_str(), O_WRONLY | O_TRUNC | O_CREAT, 0600);
+  if (!stm) {
+    throw std::system_error(
+        errno,
+        std::generic_category(),
+        fmt::format("unable to open {} for write", tempPath));
+  }
+
+  size_t count = 0;
+  {
+    SnapshotWriter writer{*stm, tempPath.c_str()};
+
+    Header header;
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.statSize = sizeof(FileInformation);
+    writer.put(header);
+    writer.putName(rootPath);
+    writer.putName(resumeToken);
+
+    writeDir(writer, view.getRootDir(), count);
+    writer.flush();
+  }
+  stm.reset();
+
+#ifdef _WIN32
+  // rename() won't replace an existing file on Windows
+  std::remove(path.c_str());
+#endif
+  if (std::rename(tempPath.c_str(), path.c_str()) != 0) {
+    int err = errno;
+    std::remove(tempPath.c_str());
+    throw std::system_error(
+        err,
+        std::generic_category(),
+        fmt::format("rename {} -> {}", tempPath, path));
+  }
+
+  return count;
+}
+
+size_t ViewSnapshot::load(
+    ViewDatabase& view,
+    Watcher& watcher,
+    const w_string& rootPath,
+    const w_string& path,
+    ClockStamp clock) {
+  folly::MemoryMapping mapping{path.c_str()};
+  SnapshotReader reader{mapping.range()};
+
+  readHeader(reader, rootPath);
+
+  // The loaded files all share one clock, so they join the recency index
+  // in one splice rather than one at a time
+  ViewDatabase::FileListBatch batch;
+  SCOPE_EXIT {
+    view.spliceAtHeadOfFileList(batch);
+  };
+
+  size_t count = 0;
+  watchman_dir* dir = view.getRootDir();
+  while (!reader.atEnd()) {
+    switch (reader.get<uint8_t>()) {
+      case kFile: {
+        auto name = reader.getName().asWString();
+        auto stat = reader.get<FileInformation>();
+        auto file = view.getOrCreateChildFile(watcher, dir, name, clock);
+        file->stat = stat;
+        file->exists = true;
+        if (file->recencySlot) {
+          view.markFileChanged(watcher, file, clock);
+        } else {
+          view.markFileChanged(batch, watcher, file, clock);
+        }
+        ++count;
+        break;
+      }
+      case kDir:
+        dir = view.getOrCreateChildDir(dir, reader.getName());
+        break;
+      case kEndDir:
+        if (!dir->parent) {
+          throw std::runtime_error("view snapshot has unbalanced directories");
+        }
+        dir = dir->parent;
+        break;
+      default:
+        throw std::runtime_error("view snapshot contains an unknown record");
+    }
+  }
+
+  return count;
+}
+
+w_string ViewSnapshot::readResumeToken(
+    const w_string& rootPath,
+    const w_string& path) {
+  try {
+    folly::MemoryMapping mapping{path.c_str()};
+    SnapshotReader reader{mapping.range()};
+    return readHeader(reader, rootPath).asWString();
+  } catch (const std::exception&) {
+    // load() reports the problem when the crawl tries to use the snapshot
+    return w_string{};
+  }
+}
+
+} // namespace watchman
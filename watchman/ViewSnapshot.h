@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include "watchman/Clock.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+class ViewDatabase;
+class Watcher;
+
+/**
+ * A ViewSnapshot is a versioned, flat binary image of the directory tree and
+ * cached stat information held by a ViewDatabase.  It is written next to the
+ * global state file when the daemon shuts down and is used to pre-populate the
+ * view when the root is watched again, so that the initial crawl only has to
+ * revalidate what is already known rather than discover everything from
+ * scratch.
+ *
+ * The snapshot intentionally does not preserve clock values: the root number
+ * changes across restarts and so every client will observe a fresh instance
+ * regardless.  Loaded nodes are stamped with the clock passed to load().
+ *
+ * The file layout is host-endian and includes the size of the serialized
+ * structures in its header; a snapshot produced by a different build or
+ * platform is rejected rather than misinterpreted.
+ *
+ * A snapshot may carry the watcher's resume token (see
+ * Watcher::getResumeToken) for the point at which the view was complete, so
+ * that the next instance can replay the changes made since then instead of
+ * crawling.
+ */
+class ViewSnapshot {
+ public:
+  // Bump this when the on-disk representation changes.
+  static constexpr uint32_t kVersion = 2;
+
+  /**
+   * Returns the path of the snapshot file for the root at rootPath, or an
+   * empty string if state saving is disabled for this process.
+   */
+  static w_string pathForRoot(const w_string& rootPath);
+
+  /**
+   * Serialize the existing portion of `view` to `path`.  The file is written
+   * to a temporary name and renamed into place so that a crash mid-write
+   * cannot leave a truncated snapshot behind.
+   *
+   * resumeToken, if not empty, must describe a position in the watcher's
+   * event stream up to which every change is reflected in `view`.
+   *
+   * Returns the number of file nodes that were written.
+   * Throws std::system_error on I/O failure.
+   */
+  static size_t save(
+      const ViewDatabase& view,
+      const w_string& rootPath,
+      const w_string& path,
+      w_string_piece resumeToken = {});
+
+  /**
+   * Populate `view` from the snapshot at `path`.  `view` is expected to be
+   * empty.  Returns the number of file nodes that were loaded.
+   *
+   * The names in a snapshot are relative to its root, so one exported by
+   * another daemon for a copy of the same tree may be loaded by passing an
+   * empty rootPath, which skips the check that it was recorded for this root.
+   *
+   * Throws std::system_error if the file cannot be read, or
+   * std::runtime_error if it is malformed, from a different version or was
+   * recorded for a different root.
+   */
+  static size_t load(
+      ViewDatabase& view,
+      Watcher& watcher,
+      const w_string& rootPath,
+      const w_string& path,
+      ClockStamp clock);
+
+  /**
+   * Returns the resume token stored in the snapshot at `path`, or an empty
+   * string if there is none or the snapshot can't be used for rootPath.
+   * Cheap: only the header is read.
+   */
+  static w_string readResumeToken(
+      const w_string& rootPath,
+      const w_string& path);
+};
+
+} // namespace watchman
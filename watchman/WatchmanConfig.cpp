@@ -9,6 +9,7 @@
 
 #include <folly/ExceptionString.h>
 #include <folly/Synchronized.h>
+#include <folly/concurrency/AtomicSharedPtr.h>
 #include <optional>
 
 #include "watchman/Errors.h"
@@ -23,6 +24,38 @@ struct ConfigState {
   w_string global_config_file_path;
 };
 folly::Synchronized<ConfigState> configState;
+folly::atomic_shared_ptr<const GlobalConfigSnapshot> configSnapshot;
+
+// Republishes the snapshot of state; called with configState write locked,
+// so that snapshots are published in the order of the changes.
+void publishSnapshot(const ConfigState& state) {
+  auto snapshot = std::make_shared<GlobalConfigSnapshot>();
+  if (state.global_cfg) {
+    auto& cfg = *state.global_cfg;
+    if (auto val = cfg.get_optional("slow_command_log_threshold_seconds");
+        val && val->isNumber()) {
+      snapshot->slowCommandLogThresholdSeconds = json_real_value(*val);
+    }
+    if (auto val = cfg.get_optional("json_arena"); val && val->isBool()) {
+      snapshot->jsonArena = val->asBool();
+    }
+    if (auto val = cfg.get_optional("_use_bulkstat"); val && val->isBool()) {
+      snapshot->useBulkstat = val->asBool();
+    }
+    if (auto val = cfg.get_optional("io_uring_statx"); val && val->isBool()) {
+      snapshot->ioUringStatx = val->asBool();
+    }
+    if (auto val = cfg.get_optional("subscription_output_limit_bytes");
+        val && val->isInt() && val->asInt() >= 0) {
+      snapshot->subscriptionOutputLimitBytes = size_t(val->asInt());
+    }
+    if (auto val = cfg.get_optional("bser_zstd_min_bytes");
+        val && val->isInt() && val->asInt() >= 0) {
+      snapshot->bserZstdMinBytes = size_t(val->asInt());
+    }
+  }
+  configSnapshot.store(std::move(snapshot));
+}
 
 std::optional<std::pair<json_ref, w_string>> loadSystemConfig() {
   const char* cfg_file = getenv("WATCHMAN_CONFIG_FILE");
@@ -128,6 +161,7 @@ std::optional<json_ref> loadUserConfig() {
 void cfg_shutdown() {
   auto state = configState.wlock();
   state->global_cfg.reset();
+  publishSnapshot(*state);
 }
 
 w_string cfg_get_global_config_file_path() {
@@ -152,6 +186,7 @@ void cfg_load_global_config_file() {
       json_object_set(*lockedState->global_cfg, key.c_str(), value);
     }
   }
+  publishSnapshot(*lockedState);
 }
 
 void cfg_set_global(const char* name, const json_ref& val) {
@@ -161,6 +196,17 @@ void cfg_set_global(const char* name, const json_ref& val) {
   }
 
   state->global_cfg->set(name, json_ref(val));
+  publishSnapshot(*state);
+}
+
+std::shared_ptr<const GlobalConfigSnapshot> cfg_get_snapshot() {
+  auto snapshot = configSnapshot.load();
+  if (!snapshot) {
+    // Before the global config is first loaded
+    static const auto defaults = std::make_shared<GlobalConfigSnapshot>();
+    return defaults;
+  }
+  return snapshot;
 }
 
 std::optional<json_ref> cfg_get_json(const char* name) {
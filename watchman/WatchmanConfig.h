@@ -7,18 +7,47 @@
 
 #pragma once
 
+#include <memory>
+#include <optional>
 #include "watchman/thirdparty/jansson/jansson.h"
 
 class w_string;
 
+namespace watchman {
+
+/**
+ * The global options that are read for every command or directory that is
+ * opened, resolved whenever the global config changes, so that reading one
+ * takes no lock and no lookup by name.  Values of the wrong type fall back
+ * to the defaults.
+ */
+struct GlobalConfigSnapshot {
+  double slowCommandLogThresholdSeconds{1.0};
+  bool jsonArena{true};
+  // Unset to use the platform's default
+  std::optional<bool> useBulkstat;
+  bool ioUringStatx{false};
+  // Past this many unsent bytes, a client's subscription notifications are
+  // held back and coalesced; 0 to block on the client instead
+  size_t subscriptionOutputLimitBytes{4 * 1024 * 1024};
+  // PDUs at least this big are compressed for clients that can take it
+  size_t bserZstdMinBytes{1024 * 1024};
+};
+
+} // namespace watchman
+
 void cfg_shutdown();
 void cfg_load_global_config_file();
+// Overrides a global option for the rest of the process
+void cfg_set_global(const char* name, const json_ref& val);
 w_string cfg_get_global_config_file_path();
 std::optional<json_ref> cfg_get_json(const char* name);
 const char* cfg_get_string(const char* name, const char* defval);
 json_int_t cfg_get_int(const char* name, json_int_t defval);
 bool cfg_get_bool(const char* name, bool defval);
 double cfg_get_double(const char* name, double defval);
+// Lock free; the snapshot is replaced rather than modified
+std::shared_ptr<const watchman::GlobalConfigSnapshot> cfg_get_snapshot();
 #ifndef _WIN32
 mode_t cfg_get_perms(const char* name, bool write_bits, bool execute_bits);
 #endif
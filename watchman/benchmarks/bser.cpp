@@ -8,6 +8,8 @@
 #include "watchman/bser.h"
 #include <benchmark/benchmark.h>
 #include <fmt/core.h>
+#include <algorithm>
+#include <cstring>
 #include <random>
 #include <vector>
 
@@ -194,6 +196,80 @@ void bser_parse_unpredictable(benchmark::State& state) {
 }
 BENCHMARK(bser_parse_unpredictable);
 
+// A query response with a templated array of numFiles files, like
+// those that fields lists produce
+json_ref templated_query_response(size_t numFiles) {
+  std::vector<json_ref> files;
+  files.reserve(numFiles);
+  for (size_t i = 0; i < numFiles; ++i) {
+    files.push_back(json_object({
+        {"name",
+         typed_string_to_json(
+             fmt::format("dir{}/subdir{}/file{}.js", i / 10000, i / 100, i))},
+        {"size", json_integer(i * 37)},
+        {"mtime_ms", json_integer(1661943594000 + i)},
+        {"exists", json_true()},
+        {"type", typed_string_to_json("f")},
+    }));
+  }
+  auto array = json_array(std::move(files));
+  json_array_set_template_new(
+      array,
+      json_array(
+          {typed_string_to_json("name"),
+           typed_string_to_json("size"),
+           typed_string_to_json("mtime_ms"),
+           typed_string_to_json("exists"),
+           typed_string_to_json("type")}));
+  return json_object({
+      {"version", typed_string_to_json("2023.01.01.00")},
+      {"clock",
+       typed_string_to_json("c:1661943594:3604891:5106627930189791234:22998")},
+      {"is_fresh_instance", json_true()},
+      {"files", std::move(array)},
+  });
+}
+
+// Writes a whole PDU to a sink that, like a PduBuffer, copies it into a
+// fixed size buffer and drops it whenever that fills up
+void bser_write_pdu_templated(benchmark::State& state) {
+  auto response = templated_query_response(state.range(0));
+
+  struct Sink {
+    char buf[128 * 1024];
+    size_t used{0};
+    size_t total{0};
+  } sink;
+  auto dump = [](const char* buffer, size_t size, void* opaque) -> int {
+    auto& sink = *static_cast<Sink*>(opaque);
+    sink.total += size;
+    while (size > 0) {
+      if (sink.used == sizeof(sink.buf)) {
+        sink.used = 0;
+      }
+      auto n = std::min(size, sizeof(sink.buf) - sink.used);
+      memcpy(sink.buf + sink.used, buffer, n);
+      sink.used += n;
+      buffer += n;
+      size -= n;
+    }
+    return 0;
+  };
+
+  for (auto _ : state) {
+    if (w_bser_write_pdu(2, 0, dump, response, &sink)) {
+      throw std::runtime_error("w_bser_write_pdu failed");
+    }
+    benchmark::DoNotOptimize(sink.buf);
+  }
+  state.SetBytesProcessed(sink.total);
+}
+BENCHMARK(bser_write_pdu_templated)
+    ->Arg(10'000)
+    ->Arg(100'000)
+    ->Arg(1'000'000)
+    ->Unit(benchmark::kMillisecond);
+
 } // namespace
 
 int main(int argc, char** argv) {
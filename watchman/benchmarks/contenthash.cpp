@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ContentHash.h"
+#include <benchmark/benchmark.h>
+#include <folly/FileUtil.h>
+#include <folly/testing/TestUtil.h>
+#include <string>
+
+namespace {
+
+using watchman::ContentHashCache;
+
+/**
+ * Hash a file of state.range(0) bytes.  The file is created once and stays
+ * in the page cache, so this measures the hashing and the read overhead
+ * rather than the disk.
+ */
+void content_hash_file(benchmark::State& state) {
+  folly::test::TemporaryDirectory dir{"wm-contenthash"};
+  auto path = (dir.path() / "file").string();
+  std::string contents(state.range(0), 'x');
+  for (size_t i = 0; i < contents.size(); i += 4096) {
+    contents[i] = char(i / 4096);
+  }
+  folly::writeFile(contents, path.c_str());
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        ContentHashCache::computeHashImmediate(path.c_str()));
+  }
+  state.SetBytesProcessed(state.iterations() * contents.size());
+}
+BENCHMARK(content_hash_file)
+    ->Arg(512)
+    ->Arg(4 << 10)
+    ->Arg(64 << 10)
+    ->Arg(1 << 20)
+    ->Arg(16 << 20)
+    ->Arg(256 << 20)
+    ->Unit(benchmark::kMicrosecond);
+
+} // namespace
+
+int main(int argc, char** argv) {
+  ::benchmark::Initialize(&argc, argv);
+  if (::benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+  ::benchmark::RunSpecifiedBenchmarks();
+}
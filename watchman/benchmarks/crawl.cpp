@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/**
+ * Times crawls of a real directory tree with each of the ways that watchman
+ * can read it, and prints a JSON report that can be kept and compared over
+ * time.
+ *
+ * The backends are the serial InMemoryView crawler, crawlerParallel, and a
+ * bare ParallelWalker.  Each can stat entries with fstatat, or with the
+ * io_uring statx or getattrlistbulk paths where the platform has them.
+ * ParallelWalker sizes its executor once per process, so each combination
+ * runs in a child process of its own.  See watchman/docs/benchmarks.md.
+ */
+
+#include <fmt/core.h>
+#include <folly/String.h>
+#include <folly/init/Init.h>
+#include <gflags/gflags.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#include "watchman/ChildProcess.h"
+#include "watchman/InMemoryView.h"
+#include "watchman/WatchmanConfig.h"
+#include "watchman/fs/FileSystem.h"
+#include "watchman/fs/IoUring.h"
+#include "watchman/fs/ParallelWalk.h"
+#include "watchman/root/Root.h"
+#include "watchman/test/lib/FakeWatcher.h"
+
+DEFINE_string(path, "", "The absolute path of the tree to crawl");
+DEFINE_string(
+    backends,
+    "serial,parallel,walker",
+    "Comma separated crawlers to time: serial, parallel (crawlerParallel) "
+    "and walker (a bare ParallelWalker)");
+DEFINE_string(
+    stat,
+    "",
+    "Comma separated ways to stat entries: fstatat, io_uring and bulkstat; "
+    "defaults to those that this platform has");
+DEFINE_string(
+    threads,
+    "0",
+    "Comma separated thread counts for the parallel and walker backends; 0 "
+    "is the hardware concurrency");
+DEFINE_string(
+    cache,
+    "warm",
+    "Comma separated cache modes: warm crawls once before timing, cold "
+    "drops the OS caches before each crawl, which needs root");
+DEFINE_int32(repetitions, 3, "How many timed crawls to run of each kind");
+DEFINE_bool(
+    single,
+    false,
+    "Internal: run exactly the one combination that the flags name");
+
+namespace {
+
+using namespace watchman;
+using namespace std::chrono;
+
+std::vector<std::string> splitList(const std::string& list) {
+  std::vector<std::string> items;
+  folly::split(',', list, items, true);
+  return items;
+}
+
+std::vector<std::string> defaultStatModes() {
+  std::vector<std::string> modes{"fstatat"};
+#ifdef WATCHMAN_HAVE_IO_URING_STATX
+  modes.push_back("io_uring");
+#endif
+#ifdef __APPLE__
+  modes.push_back("bulkstat");
+#endif
+  return modes;
+}
+
+void dropCaches() {
+#ifdef __linux__
+  sync();
+  auto file = fopen("/proc/sys/vm/drop_caches", "w");
+  if (!file) {
+    throw std::system_error(
+        errno, std::generic_category(), "/proc/sys/vm/drop_caches");
+  }
+  fputs("3", file);
+  fclose(file);
+#elif defined(__APPLE__)
+  if (system("purge") != 0) {
+    throw std::runtime_error("purge failed");
+  }
+#else
+  throw std::runtime_error("dropping caches isn't supported here");
+#endif
+}
+
+std::shared_ptr<FileSystem> sharedRealFileSystem() {
+  return std::shared_ptr<FileSystem>{
+      std::shared_ptr<FileSystem>{}, &realFileSystem};
+}
+
+struct WalkCounts {
+  size_t dirs{0};
+  size_t files{0};
+  int64_t bytes{0};
+  size_t errors{0};
+};
+
+WalkCounts walk(size_t threads) {
+  // realFileSystem is a global, so the walker borrows it without owning it
+  std::shared_ptr<FileSystem> fileSystem{
+      std::shared_ptr<FileSystem>{}, &realFileSystem};
+  ParallelWalker walker{
+      std::move(fileSystem), AbsolutePath{FLAGS_path.c_str()}, threads};
+  WalkCounts counts;
+  while (auto result = walker.nextResult()) {
+    ++counts.dirs;
+    counts.files += result->entries.size();
+    for (auto& entry : result->entries) {
+      counts.bytes += entry.stat.size;
+    }
+  }
+  while (walker.nextError()) {
+    ++counts.errors;
+  }
+  return counts;
+}
+
+// The initial crawl of a fresh view of the tree
+void crawlView(bool parallel, size_t threads) {
+  json_ref json = json_object();
+  json_object_set(json, "enable_parallel_crawl", json_boolean(parallel));
+  json_object_set(json, "parallel_crawl_thread_count", json_integer(threads));
+  Configuration config{std::move(json)};
+
+  w_string rootPath{FLAGS_path};
+  auto watcher = std::make_shared<FakeWatcher>(realFileSystem);
+  auto view =
+      std::make_shared<InMemoryView>(realFileSystem, rootPath, config, watcher);
+  auto root = std::make_shared<Root>(
+      realFileSystem,
+      rootPath,
+      "fs_type",
+      w_string_to_json("{}"),
+      config,
+      view,
+      [] {});
+  auto& pending = view->unsafeAccessPendingFromWatcher();
+  pending.lock()->ping();
+  InMemoryView::IoThreadState state{minutes(5)};
+  view->stepIoThread(root, state, pending);
+}
+
+// Runs the one combination named by the flags, and prints its results
+int runSingle() {
+  auto& backend = FLAGS_backends;
+  auto& cache = FLAGS_cache;
+  size_t threads = std::stoul(FLAGS_threads);
+
+  cfg_set_global("io_uring_statx", json_boolean(FLAGS_stat == "io_uring"));
+  cfg_set_global("_use_bulkstat", json_boolean(FLAGS_stat == "bulkstat"));
+
+  auto crawl = [&] {
+    if (backend == "walker") {
+      walk(threads);
+    } else {
+      crawlView(backend == "parallel", threads);
+    }
+  };
+
+  if (cache == "warm") {
+    crawl();
+  }
+  std::vector<double> seconds;
+  for (int32_t i = 0; i < FLAGS_repetitions; ++i) {
+    if (cache == "cold") {
+      dropCaches();
+    }
+    auto start = steady_clock::now();
+    crawl();
+    seconds.push_back(duration<double>(steady_clock::now() - start).count());
+  }
+
+  std::vector<json_ref> times;
+  for (auto s : seconds) {
+    times.push_back(json_real(s));
+  }
+  std::sort(seconds.begin(), seconds.end());
+  auto report = json_object({
+      {"seconds", json_array(std::move(times))},
+      {"min_seconds", json_real(seconds.empty() ? 0 : seconds.front())},
+      {"median_seconds",
+       json_real(seconds.empty() ? 0 : seconds[seconds.size() / 2])},
+  });
+  fmt::print("{}\n", json_dumps(report, 0));
+  return 0;
+}
+
+// Runs one combination in a child process, returning its report with the
+// combination filled in
+json_ref runChild(
+    const char* self,
+    const std::string& backend,
+    const std::string& stat,
+    const std::string& threads,
+    const std::string& cache) {
+  auto repetitions = std::to_string(FLAGS_repetitions);
+  std::vector<std::string> args{
+      self,
+      "--single",
+      "--path=" + FLAGS_path,
+      "--backends=" + backend,
+      "--stat=" + stat,
+      "--threads=" + threads,
+      "--cache=" + cache,
+      "--repetitions=" + repetitions,
+  };
+  ChildProcess::Options opts;
+  opts.nullStdin();
+  opts.pipeStdout();
+  opts.pipeStderr();
+  ChildProcess proc{
+      std::vector<std::string_view>{args.begin(), args.end()},
+      std::move(opts)};
+  auto [out, err] = proc.communicate();
+  auto status = proc.wait();
+
+  std::optional<json_ref> parsed;
+  if (status == 0 && out) {
+    parsed = json_loads(out->c_str(), 0, nullptr);
+  }
+  json_ref report = parsed ? *parsed : json_object();
+  if (!parsed) {
+    report.set(
+        "error",
+        w_string_to_json(
+            err && !err->empty() ? *err : w_string{"the crawl failed"}));
+  }
+  report.set(
+      {{"backend", typed_string_to_json(backend)},
+       {"stat", typed_string_to_json(stat)},
+       {"threads", json_integer(std::stoul(threads))},
+       {"cache", typed_string_to_json(cache)}});
+  return report;
+}
+
+int runAll(const char* self) {
+  auto statModes =
+      FLAGS_stat.empty() ? defaultStatModes() : splitList(FLAGS_stat);
+
+  // Describe the tree, and warm the caches for the first warm run
+  auto counts = walk(0);
+
+  std::vector<json_ref> runs;
+  for (auto& cache : splitList(FLAGS_cache)) {
+    for (auto& backend : splitList(FLAGS_backends)) {
+      for (auto& stat : statModes) {
+        // The serial crawler takes no thread count
+        auto threads = backend == "serial" ? std::vector<std::string>{"1"}
+                                           : splitList(FLAGS_threads);
+        for (auto& count : threads) {
+          fmt::print(
+              stderr, "{} {} {} threads {}\n", cache, backend, stat, count);
+          runs.push_back(runChild(self, backend, stat, count, cache));
+        }
+      }
+    }
+  }
+
+  auto report = json_object({
+      {"path", typed_string_to_json(FLAGS_path)},
+      {"repetitions", json_integer(FLAGS_repetitions)},
+      {"tree",
+       json_object({
+           {"dirs", json_integer(counts.dirs)},
+           {"files", json_integer(counts.files)},
+           {"bytes", json_integer(counts.bytes)},
+           {"errors", json_integer(counts.errors)},
+       })},
+      {"runs", json_array(std::move(runs))},
+  });
+  fmt::print("{}\n", json_dumps(report, JSON_INDENT(2) | JSON_SORT_KEYS));
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  folly::init(&argc, &argv);
+  if (FLAGS_path.empty()) {
+    fmt::print(stderr, "--path is required\n");
+    return 1;
+  }
+  if (FLAGS_single) {
+    return runSingle();
+  }
+  return runAll(argv[0]);
+}
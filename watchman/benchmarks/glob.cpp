@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <benchmark/benchmark.h>
+#include <string>
+#include <vector>
+#include "watchman/query/GlobMatcher.h"
+#include "watchman/thirdparty/wildmatch/wildmatch.h"
+
+namespace {
+
+using namespace watchman;
+
+// Wholename patterns like those of build tools and test runners
+const char* const kPathPatterns[] = {
+    "**/*.js",
+    "**/*.ts",
+    "**/*.tsx",
+    "**/BUCK",
+    "**/package.json",
+    "src/**",
+    "third-party/*",
+    "**/__tests__/*.js",
+};
+
+// Basename patterns like those of match terms
+const char* const kNamePatterns[] = {
+    "*.cpp",
+    "*.h",
+    "test_*",
+    "Makefile",
+    "*.[ch]",
+};
+
+const char* const kExtensions[] = {".js", ".cpp", ".py", ".json", ".md"};
+
+std::vector<std::string> makePaths() {
+  std::vector<std::string> paths;
+  for (size_t i = 0; i < 10000; ++i) {
+    paths.push_back(
+        "project/dir" + std::to_string(i / 100) + "/sub" +
+        std::to_string(i % 7) + "/file" + std::to_string(i) +
+        kExtensions[i % 5]);
+  }
+  return paths;
+}
+
+std::vector<std::string> makeNames() {
+  std::vector<std::string> names;
+  for (size_t i = 0; i < 10000; ++i) {
+    names.push_back("file" + std::to_string(i) + kExtensions[i % 5]);
+  }
+  return names;
+}
+
+template <size_t N>
+void runWildmatch(
+    benchmark::State& state,
+    const char* const (&patterns)[N],
+    const std::vector<std::string>& texts,
+    int flags) {
+  size_t i = 0;
+  for (auto _ : state) {
+    auto& text = texts[i++ % texts.size()];
+    for (auto pattern : patterns) {
+      benchmark::DoNotOptimize(
+          wildmatch(pattern, text.c_str(), flags, nullptr) == WM_MATCH);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * N);
+}
+
+template <size_t N>
+void runCompiled(
+    benchmark::State& state,
+    const char* const (&patterns)[N],
+    const std::vector<std::string>& texts,
+    int flags) {
+  std::vector<GlobMatcher> matchers;
+  for (auto pattern : patterns) {
+    matchers.emplace_back(pattern, flags);
+  }
+  size_t i = 0;
+  for (auto _ : state) {
+    auto& text = texts[i++ % texts.size()];
+    for (auto& matcher : matchers) {
+      benchmark::DoNotOptimize(matcher.matches(text));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * N);
+}
+
+constexpr int kPathFlags = WM_PATHNAME | WM_PERIOD;
+constexpr int kNameFlags = WM_PERIOD;
+
+/**
+ * Matches each path against every wholename pattern with wildmatch, as the
+ * glob generator did before patterns were compiled.
+ */
+void glob_match_paths_wildmatch(benchmark::State& state) {
+  runWildmatch(state, kPathPatterns, makePaths(), kPathFlags);
+}
+BENCHMARK(glob_match_paths_wildmatch);
+
+void glob_match_paths_compiled(benchmark::State& state) {
+  runCompiled(state, kPathPatterns, makePaths(), kPathFlags);
+}
+BENCHMARK(glob_match_paths_compiled);
+
+/**
+ * Matches each basename against every match term pattern.
+ */
+void glob_match_names_wildmatch(benchmark::State& state) {
+  runWildmatch(state, kNamePatterns, makeNames(), kNameFlags);
+}
+BENCHMARK(glob_match_names_wildmatch);
+
+void glob_match_names_compiled(benchmark::State& state) {
+  runCompiled(state, kNamePatterns, makeNames(), kNameFlags);
+}
+BENCHMARK(glob_match_names_compiled);
+
+void glob_match_names_compiled_casefold(benchmark::State& state) {
+  runCompiled(state, kNamePatterns, makeNames(), kNameFlags | WM_CASEFOLD);
+}
+BENCHMARK(glob_match_names_compiled_casefold);
+
+} // namespace
+
+int main(int argc, char** argv) {
+  ::benchmark::Initialize(&argc, argv);
+  if (::benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+  ::benchmark::RunSpecifiedBenchmarks();
+}
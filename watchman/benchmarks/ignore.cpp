@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <benchmark/benchmark.h>
+#include <iterator>
+#include <vector>
+#include "watchman/IgnoreSet.h"
+
+namespace {
+
+using namespace watchman;
+
+// Like the ignore_dirs of a large repo; see IgnoreTest
+const char* const kIgnoreDirs[] = {
+    ".buckd",
+    ".idea",
+    "_build",
+    "buck-cache",
+    "buck-out",
+    "build",
+    "foo/.buckd",
+    "foo/buck-cache",
+    "foo/buck-out",
+    "bar/_build",
+    "bar/buck-cache",
+    "bar/buck-out",
+    "baz/.buckd",
+    "baz/buck-cache",
+    "baz/buck-out",
+    "baz/build",
+    "baz/qux",
+    "baz/focus-out",
+    "baz/tmp",
+    "baz/foo/bar/foo/build",
+    "baz/foo/bar/bar/build",
+    "baz/foo/bar/baz/build",
+    "baz/foo/bar/qux",
+    "baz/foo/baz/foo",
+    "baz/bar/foo/foo/foo/foo/foo/foo",
+    "baz/bar/bar/foo/foo"};
+
+const char* const kIgnoreVcs[] = {".hg", ".svn", ".git"};
+
+void addIgnores(IgnoreSet& ignore, bool withGlobs) {
+  for (auto dir : kIgnoreDirs) {
+    ignore.add(w_string{dir, W_STRING_UNICODE}, false);
+  }
+  for (auto dir : kIgnoreVcs) {
+    ignore.add(w_string{dir, W_STRING_UNICODE}, true);
+  }
+  if (withGlobs) {
+    for (auto glob : {"**/node_modules", "gen/*/out", "**/*.tmp"}) {
+      ignore.addGlob(w_string{""}, w_string{glob, W_STRING_UNICODE});
+    }
+  }
+}
+
+std::vector<w_string> pathsUnder(const char* prefix) {
+  std::vector<w_string> paths;
+  for (size_t i = 0; i < 10000; ++i) {
+    paths.push_back(
+        w_string::build(prefix, "/dir", i / 100, "/file", i, ".cpp"));
+  }
+  return paths;
+}
+
+void runIsIgnored(
+    benchmark::State& state,
+    const IgnoreSet& ignore,
+    const std::vector<w_string>& paths) {
+  size_t i = 0;
+  for (auto _ : state) {
+    auto& path = paths[i++ % paths.size()];
+    benchmark::DoNotOptimize(ignore.isIgnored(path.data(), path.size()));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+/**
+ * Paths under an ignored dir, which match early in the tree walk.
+ */
+void ignore_is_ignored_hit(benchmark::State& state) {
+  IgnoreSet ignore;
+  addIgnores(ignore, state.range(0));
+  runIsIgnored(state, ignore, pathsUnder("baz/buck-out/gen"));
+}
+BENCHMARK(ignore_is_ignored_hit)->Arg(false)->Arg(true);
+
+/**
+ * Paths that share a prefix with ignored dirs but are not ignored, which is
+ * what nearly every path of a crawl looks like.
+ */
+void ignore_is_ignored_miss(benchmark::State& state) {
+  IgnoreSet ignore;
+  addIgnores(ignore, state.range(0));
+  runIsIgnored(state, ignore, pathsUnder("baz/foo/bar/src"));
+}
+BENCHMARK(ignore_is_ignored_miss)->Arg(false)->Arg(true);
+
+} // namespace
+
+int main(int argc, char** argv) {
+  ::benchmark::Initialize(&argc, argv);
+  if (::benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+  ::benchmark::RunSpecifiedBenchmarks();
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <benchmark/benchmark.h>
+#include <fmt/core.h>
+#include <string>
+#include <vector>
+#include "watchman/thirdparty/jansson/jansson.h"
+
+namespace {
+
+/**
+ * The response to a query for the name, size, exists and mtime_ms fields of
+ * every file in a large tree.
+ */
+json_ref query_response() {
+  constexpr size_t kNumFiles = 10000;
+
+  std::vector<json_ref> files;
+  files.reserve(kNumFiles);
+  for (size_t i = 0; i < kNumFiles; ++i) {
+    files.push_back(json_object(
+        {{"name",
+          typed_string_to_json(
+              fmt::format(
+                  "fbcode/watchman/some/deeply/nested/dir{}/file{}.cpp",
+                  i % 97,
+                  i)
+                  .c_str(),
+              W_STRING_UNICODE)},
+         {"size", json_integer(i * 37)},
+         {"exists", json_boolean(i % 10 != 0)},
+         {"mtime_ms", json_integer(1661943594000 + i)}}));
+  }
+  return json_object(
+      {{"version", typed_string_to_json("2022.09.05.00", W_STRING_UNICODE)},
+       {"clock",
+        typed_string_to_json(
+            "c:1661943594:3604891:5106627930189791234:22998",
+            W_STRING_UNICODE)},
+       {"is_fresh_instance", json_true()},
+       {"files", json_array(std::move(files))}});
+}
+
+/**
+ * A query command from a build system, with a large paths list and a large
+ * anyof expression.
+ */
+json_ref query_command() {
+  constexpr size_t kNumTerms = 5000;
+
+  std::vector<json_ref> paths;
+  std::vector<json_ref> terms;
+  paths.reserve(kNumTerms);
+  terms.reserve(kNumTerms + 1);
+  terms.push_back(typed_string_to_json("anyof", W_STRING_UNICODE));
+  for (size_t i = 0; i < kNumTerms; ++i) {
+    paths.push_back(typed_string_to_json(
+        fmt::format("fbcode/project{}/src", i).c_str(), W_STRING_UNICODE));
+    terms.push_back(json_array(
+        {typed_string_to_json("name", W_STRING_UNICODE),
+         typed_string_to_json(
+             fmt::format("project{}/src/module\\{}.h", i % 50, i).c_str(),
+             W_STRING_UNICODE),
+         typed_string_to_json("wholename", W_STRING_UNICODE)}));
+  }
+  return json_array(
+      {typed_string_to_json("query", W_STRING_UNICODE),
+       typed_string_to_json("/data/users/me/fbsource", W_STRING_UNICODE),
+       json_object(
+           {{"path", json_array(std::move(paths))},
+            {"expression", json_array(std::move(terms))},
+            {"fields", json_array({typed_string_to_json("name")})}})});
+}
+
+template <json_ref (*SynthesizeFn)()>
+struct JsonBenchmark {
+  // Synthesized on first use rather than during static initialization, which
+  // may run before jansson's own singletons are set up.
+  static const json_ref& value() {
+    static const json_ref value = SynthesizeFn();
+    return value;
+  }
+
+  static const std::string& text() {
+    static const std::string text = json_dumps(value(), JSON_COMPACT);
+    return text;
+  }
+
+  static void parse(benchmark::State& state) {
+    const auto& input = text();
+    for (auto _ : state) {
+      json_error_t err;
+      benchmark::DoNotOptimize(
+          json_loadb(input.data(), input.size(), 0, &err));
+    }
+    state.SetBytesProcessed(state.iterations() * input.size());
+  }
+
+  static void dump(benchmark::State& state) {
+    const auto& input = value();
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(json_dumps(input, JSON_COMPACT));
+    }
+    state.SetBytesProcessed(state.iterations() * text().size());
+  }
+};
+
+void json_parse_query_response(benchmark::State& state) {
+  JsonBenchmark<query_response>::parse(state);
+}
+BENCHMARK(json_parse_query_response);
+
+void json_parse_query_response_arena(benchmark::State& state) {
+  json_arena_scope arena;
+  JsonBenchmark<query_response>::parse(state);
+}
+BENCHMARK(json_parse_query_response_arena);
+
+void json_dump_query_response(benchmark::State& state) {
+  JsonBenchmark<query_response>::dump(state);
+}
+BENCHMARK(json_dump_query_response);
+
+void json_parse_query_command(benchmark::State& state) {
+  JsonBenchmark<query_command>::parse(state);
+}
+BENCHMARK(json_parse_query_command);
+
+void json_dump_query_command(benchmark::State& state) {
+  JsonBenchmark<query_command>::dump(state);
+}
+BENCHMARK(json_dump_query_command);
+
+} // namespace
+
+int main(int argc, char** argv) {
+  ::benchmark::Initialize(&argc, argv);
+  if (::benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+  ::benchmark::RunSpecifiedBenchmarks();
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <benchmark/benchmark.h>
+#include <string>
+#include <vector>
+#include "watchman/LRUCache.h"
+#include "watchman/ShardedLRUCache.h"
+
+namespace {
+
+using namespace watchman;
+
+constexpr size_t kNumKeys = 64 * 1024;
+
+const std::vector<std::string>& keys() {
+  static const std::vector<std::string> keys = [] {
+    std::vector<std::string> keys;
+    keys.reserve(kNumKeys);
+    for (size_t i = 0; i < kNumKeys; ++i) {
+      keys.push_back("some/deeply/nested/dir/file" + std::to_string(i));
+    }
+    return keys;
+  }();
+  return keys;
+}
+
+template <typename Cache>
+Cache& populated() {
+  static Cache* cache = [] {
+    auto* cache = new Cache(kNumKeys, std::chrono::seconds(1));
+    for (auto& key : keys()) {
+      cache->set(key, true);
+    }
+    return cache;
+  }();
+  return *cache;
+}
+
+/**
+ * Every thread looks up keys that are all in the cache, as concurrent
+ * queries over the same files do.
+ */
+template <typename Cache>
+void lookup_hits(benchmark::State& state) {
+  auto& cache = populated<Cache>();
+  auto& k = keys();
+  size_t i = state.thread_index() * 7919;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(cache.get(k[i++ % kNumKeys]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void lrucache_lookup_hits(benchmark::State& state) {
+  lookup_hits<LRUCache<std::string, bool>>(state);
+}
+BENCHMARK(lrucache_lookup_hits)->ThreadRange(1, 32)->UseRealTime();
+
+void sharded_lrucache_lookup_hits(benchmark::State& state) {
+  lookup_hits<ShardedLRUCache<std::string, bool>>(state);
+}
+BENCHMARK(sharded_lrucache_lookup_hits)->ThreadRange(1, 32)->UseRealTime();
+
+} // namespace
+
+int main(int argc, char** argv) {
+  ::benchmark::Initialize(&argc, argv);
+  if (::benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+  ::benchmark::RunSpecifiedBenchmarks();
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <vector>
+#include "watchman/PendingCollection.h"
+
+namespace {
+
+using namespace watchman;
+
+/**
+ * The paths of count files spread over dirs of 100 files, as a watcher
+ * reports them during a storm of changes such as a checkout.
+ */
+std::vector<w_string> stormPaths(size_t count) {
+  std::vector<w_string> paths;
+  paths.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    paths.push_back(
+        w_string::build("/root/dir", i / 10000, "/sub", i / 100, "/file", i));
+  }
+  return paths;
+}
+
+/**
+ * Add state.range(0) distinct file changes, then take them all, as the
+ * notify and IO threads do.
+ */
+void pending_add_distinct(benchmark::State& state) {
+  auto paths = stormPaths(state.range(0));
+  auto now = std::chrono::system_clock::now();
+
+  for (auto _ : state) {
+    PendingChanges coll;
+    for (auto& path : paths) {
+      coll.add(path, now, W_PENDING_VIA_NOTIFY);
+    }
+    benchmark::DoNotOptimize(coll.stealItems());
+  }
+  state.SetItemsProcessed(state.iterations() * paths.size());
+}
+BENCHMARK(pending_add_distinct)->Arg(1000)->Arg(100000)->Arg(1000000);
+
+/**
+ * Add the same state.range(0) file changes ten times over, so that most adds
+ * consolidate with an existing entry.
+ */
+void pending_add_repeated(benchmark::State& state) {
+  auto paths = stormPaths(state.range(0));
+  auto now = std::chrono::system_clock::now();
+
+  for (auto _ : state) {
+    PendingChanges coll;
+    for (int round = 0; round < 10; ++round) {
+      for (auto& path : paths) {
+        coll.add(path, now, W_PENDING_VIA_NOTIFY);
+      }
+    }
+    benchmark::DoNotOptimize(coll.stealItems());
+  }
+  state.SetItemsProcessed(state.iterations() * paths.size() * 10);
+}
+BENCHMARK(pending_add_repeated)->Arg(1000)->Arg(100000);
+
+/**
+ * Add state.range(0) file changes, then a recursive change of each of
+ * their top-level dirs, which prunes every file below it.
+ */
+void pending_prune_by_recursive_dir(benchmark::State& state) {
+  size_t count = state.range(0);
+  auto paths = stormPaths(count);
+  std::vector<w_string> dirs;
+  for (size_t i = 0; i < count; i += 10000) {
+    dirs.push_back(w_string::build("/root/dir", i / 10000));
+  }
+  auto now = std::chrono::system_clock::now();
+
+  for (auto _ : state) {
+    PendingChanges coll;
+    for (auto& path : paths) {
+      coll.add(path, now, W_PENDING_VIA_NOTIFY);
+    }
+    for (auto& dir : dirs) {
+      coll.add(dir, now, W_PENDING_VIA_NOTIFY | W_PENDING_RECURSIVE);
+    }
+    benchmark::DoNotOptimize(coll.stealItems());
+  }
+  state.SetItemsProcessed(state.iterations() * (paths.size() + dirs.size()));
+}
+BENCHMARK(pending_prune_by_recursive_dir)->Arg(1000)->Arg(100000)->Arg(1000000);
+
+} // namespace
+
+int main(int argc, char** argv) {
+  ::benchmark::Initialize(&argc, argv);
+  if (::benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+  ::benchmark::RunSpecifiedBenchmarks();
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/PubSub.h"
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using watchman::Publisher;
+
+std::vector<std::shared_ptr<Publisher::Subscriber>> subscribe_all(
+    Publisher& pub,
+    size_t count,
+    Publisher::Notifier notify = nullptr) {
+  std::vector<std::shared_ptr<Publisher::Subscriber>> subs;
+  subs.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    subs.push_back(pub.subscribe(notify));
+  }
+  return subs;
+}
+
+/**
+ * Publish one item and have every subscriber consume it, from one thread.
+ */
+void pubsub_publish_and_ack(benchmark::State& state) {
+  auto pub = std::make_shared<Publisher>();
+  auto subs = subscribe_all(*pub, state.range(0));
+  std::vector<std::shared_ptr<const Publisher::Item>> pending;
+  auto payload = json_integer(1);
+
+  for (auto _ : state) {
+    pub->enqueue(json_ref(payload));
+    for (auto& sub : subs) {
+      sub->getPending(pending);
+      pending.clear();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * subs.size());
+}
+BENCHMARK(pubsub_publish_and_ack)->Arg(1)->Arg(16)->Arg(256);
+
+/**
+ * Publish as fast as possible while a pool of threads consumes on behalf of
+ * the subscribers, the way client threads drain their subscriptions.
+ */
+void pubsub_publish_concurrent_ack(benchmark::State& state) {
+  constexpr size_t kReaderThreads = 4;
+
+  auto pub = std::make_shared<Publisher>();
+  auto subs = subscribe_all(*pub, state.range(0));
+  std::atomic<bool> done{false};
+  std::atomic<size_t> acked{0};
+
+  std::vector<std::thread> readers;
+  for (size_t t = 0; t < kReaderThreads; ++t) {
+    readers.emplace_back([&, t] {
+      std::vector<std::shared_ptr<const Publisher::Item>> pending;
+      while (!done.load(std::memory_order_relaxed)) {
+        for (size_t i = t; i < subs.size(); i += kReaderThreads) {
+          subs[i]->getPending(pending);
+          acked.fetch_add(pending.size(), std::memory_order_relaxed);
+          pending.clear();
+        }
+      }
+    });
+  }
+
+  auto payload = json_integer(1);
+  for (auto _ : state) {
+    pub->enqueue(json_ref(payload));
+  }
+
+  done = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["acked"] =
+      benchmark::Counter(acked.load(), benchmark::Counter::kIsRate);
+}
+BENCHMARK(pubsub_publish_concurrent_ack)
+    ->Arg(1)
+    ->Arg(16)
+    ->Arg(256)
+    ->UseRealTime();
+
+} // namespace
+
+int main(int argc, char** argv) {
+  ::benchmark::Initialize(&argc, argv);
+  if (::benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+  ::benchmark::RunSpecifiedBenchmarks();
+}
@@ -0,0 +1,331 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/**
+ * Replays a recorded storm of filesystem events against an InMemoryView
+ * backed by a FakeFileSystem, and reports how quickly the view kept up.
+ *
+ * Record the events by setting `in_memory_view_ring_log_size` in the
+ * .watchmanconfig of the root, large enough to hold the whole storm, then
+ * reproducing the storm and saving `watchman debug-watcher-info <root>`.
+ * See watchman/docs/benchmarks.md.
+ */
+
+#include <fmt/core.h>
+#include <folly/futures/Future.h>
+#include <folly/init/Init.h>
+#include <gflags/gflags.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <optional>
+#include <vector>
+#include "watchman/Constants.h"
+#include "watchman/InMemoryView.h"
+#include "watchman/Metrics.h"
+#include "watchman/query/Query.h"
+#include "watchman/query/eval.h"
+#include "watchman/query/parse.h"
+#include "watchman/root/Root.h"
+#include "watchman/test/lib/FakeFileSystem.h"
+#include "watchman/test/lib/FakeWatcher.h"
+
+DEFINE_string(
+    log,
+    "",
+    "The saved output of `watchman debug-watcher-info`, or just its "
+    "processed_paths array");
+DEFINE_string(
+    recorded_root,
+    "",
+    "The path of the root the log was recorded from, which is stripped from "
+    "the recorded paths");
+DEFINE_double(
+    speed,
+    1.0,
+    "How many times faster than recorded to replay the events; 0 replays "
+    "them as fast as possible");
+DEFINE_int64(
+    initial_files,
+    0,
+    "The number of synthetic files to crawl before the replay, so that the "
+    "view is as large as a real one");
+DEFINE_int32(
+    query_interval_ms,
+    10,
+    "How often to run a since query during the replay, as a subscriber "
+    "would; 0 disables the queries");
+DEFINE_string(
+    config,
+    "{}",
+    "A JSON object of root configuration, such as {\"suffix_index\": true}");
+
+namespace {
+
+using namespace watchman;
+using namespace std::chrono;
+
+const w_string kRootPath{FAKEFS_ROOT "root"};
+
+struct ReplayEvent {
+  enum Kind { File, Dir, Deleted };
+
+  system_clock::duration offset;
+  std::string path;
+  Kind kind;
+  off_t size;
+  time_t mtime;
+};
+
+// Maps a recorded path to a relative one.  The ring log keeps only the tail
+// of long paths, behind "...", so drop the partial component there.
+std::string relativePath(std::string_view path) {
+  auto& root = FLAGS_recorded_root;
+  if (!root.empty() && path.size() > root.size() &&
+      path.substr(0, root.size()) == root && path[root.size()] == '/') {
+    return std::string{path.substr(root.size() + 1)};
+  }
+  if (path.substr(0, 3) == "...") {
+    auto slash = path.find('/');
+    return slash == std::string_view::npos
+        ? std::string{path.substr(3)}
+        : std::string{path.substr(slash + 1)};
+  }
+  while (!path.empty() && path.front() == '/') {
+    path.remove_prefix(1);
+  }
+  return std::string{path};
+}
+
+std::vector<ReplayEvent> loadEvents(const std::string& filename) {
+  auto log = json_load_file(filename.c_str(), 0);
+  if (log.isObject()) {
+    log = log.get("watcher-debug-info").get("view").get("processed_paths");
+  }
+  if (!log.isArray()) {
+    throw std::runtime_error(fmt::format(
+        "{} has no processed_paths; set in_memory_view_ring_log_size when "
+        "recording",
+        filename));
+  }
+
+  std::vector<ReplayEvent> events;
+  std::optional<int64_t> start;
+  for (auto& entry : log.array()) {
+    // Crawls also log the paths they visit; replay only what the watcher
+    // reported.
+    auto flags = entry.get("pending_flags").asString();
+    if (flags.view().find("VIA_NOTIFY") == std::string_view::npos) {
+      continue;
+    }
+    auto path = relativePath(entry.get("path").asString().view());
+    if (path.empty() || path.find(".watchman-cookie-") != std::string::npos) {
+      continue;
+    }
+
+    auto now = entry.get("now").asInt();
+    if (!start) {
+      start = now;
+    }
+    auto kind = ReplayEvent::File;
+    if (entry.get("errcode").asInt() != 0) {
+      kind = ReplayEvent::Deleted;
+    } else if (S_ISDIR(entry.get("mode").asInt())) {
+      kind = ReplayEvent::Dir;
+    }
+    // `now` is in the units of the recording platform's system_clock
+    events.push_back(ReplayEvent{
+        system_clock::duration{now - *start},
+        std::move(path),
+        kind,
+        off_t(entry.get("size").asInt()),
+        time_t(entry.get("mtime").asInt())});
+  }
+  return events;
+}
+
+std::string fakePath(const std::string& relative) {
+  return fmt::format(FAKEFS_ROOT "root/{}", relative);
+}
+
+void applyEvent(FakeFileSystem& fs, const ReplayEvent& event) {
+  auto path = fakePath(event.path);
+  switch (event.kind) {
+    case ReplayEvent::File: {
+      auto fi = fs.fakeFile();
+      fi.size = event.size;
+      fi.mtime.tv_sec = event.mtime;
+      fs.addNode(path.c_str(), fi);
+      break;
+    }
+    case ReplayEvent::Dir:
+      fs.addNode(path.c_str(), fs.fakeDir());
+      break;
+    case ReplayEvent::Deleted:
+      try {
+        fs.removeRecursively(path.c_str());
+      } catch (const std::system_error&) {
+        // Already gone along with its parent
+      }
+      break;
+  }
+}
+
+int replay() {
+  auto events = loadEvents(FLAGS_log);
+  if (events.empty()) {
+    fmt::print(stderr, "{} has no watcher events to replay\n", FLAGS_log);
+    return 1;
+  }
+
+  FakeFileSystem fs;
+  auto watcher = std::make_shared<FakeWatcher>(fs);
+  Configuration config{json_loads(FLAGS_config.c_str(), 0, nullptr)};
+
+  // Everything the storm touches exists before it starts, so that its
+  // changes and deletions apply to something.
+  for (int64_t i = 0; i < FLAGS_initial_files; ++i) {
+    fs.addNode(
+        fakePath(fmt::format("_synthetic/d{}/f{}", i / 100, i)).c_str(),
+        fs.fakeFile());
+  }
+  for (auto& event : events) {
+    if (event.kind != ReplayEvent::Dir) {
+      fs.addNode(fakePath(event.path).c_str(), fs.fakeFile());
+    }
+  }
+
+  auto view = std::make_shared<InMemoryView>(fs, kRootPath, config, watcher);
+  auto root = std::make_shared<Root>(
+      fs, kRootPath, "fs_type", w_string_to_json("{}"), config, view, [] {});
+  auto& pending = view->unsafeAccessPendingFromWatcher();
+
+  // The initial crawl
+  InMemoryView::IoThreadState state{minutes(5)};
+  pending.lock()->ping();
+  auto crawlStart = steady_clock::now();
+  view->stepIoThread(root, state, pending);
+  auto crawlDuration = steady_clock::now() - crawlStart;
+
+  std::atomic<bool> done{false};
+  std::thread ioThread{[&] {
+    while (!done.load(std::memory_order_acquire)) {
+      view->stepIoThread(root, state, pending);
+    }
+  }};
+
+  LatencyHistogram queryLatency;
+  std::thread queryThread;
+  if (FLAGS_query_interval_ms > 0) {
+    queryThread = std::thread{[&] {
+      auto clock = view->getCurrentClockString();
+      while (!done.load(std::memory_order_acquire)) {
+        std::this_thread::sleep_for(milliseconds(FLAGS_query_interval_ms));
+        auto query = parseQuery(
+            root,
+            json_object(
+                {{"since", w_string_to_json(clock)},
+                 {"fields", json_array({w_string_to_json("name")})},
+                 {"sync_timeout", json_integer(0)}}));
+        clock = view->getCurrentClockString();
+        auto queryStart = steady_clock::now();
+        w_query_execute(query.get(), root, nullptr, nullptr);
+        queryLatency.record(steady_clock::now() - queryStart);
+      }
+    }};
+  }
+
+  // Feed the events to the IO thread as the notify thread would, a batch
+  // at a time, at the recorded pace divided by --speed.
+  uint32_t maxDepth = 0;
+  uint64_t depthSum = 0;
+  size_t batches = 0;
+  auto replayStart = steady_clock::now();
+  for (size_t next = 0; next < events.size();) {
+    if (FLAGS_speed > 0) {
+      auto due = replayStart +
+          duration_cast<steady_clock::duration>(
+                     events[next].offset / FLAGS_speed);
+      std::this_thread::sleep_until(due);
+    }
+    auto now = steady_clock::now();
+    auto lock = pending.lock();
+    size_t batchEnd = next;
+    while (batchEnd < events.size() && batchEnd - next < kBatchLimit &&
+           (FLAGS_speed <= 0 ||
+            replayStart +
+                    duration_cast<steady_clock::duration>(
+                        events[batchEnd].offset / FLAGS_speed) <=
+                now)) {
+      applyEvent(fs, events[batchEnd]);
+      lock->add(
+          w_string{fakePath(events[batchEnd].path)},
+          system_clock::now(),
+          W_PENDING_VIA_NOTIFY);
+      ++batchEnd;
+    }
+    auto depth = lock->getPendingItemCount();
+    maxDepth = std::max(maxDepth, depth);
+    depthSum += depth;
+    ++batches;
+    lock->ping();
+    next = batchEnd;
+  }
+  auto fedDuration = steady_clock::now() - replayStart;
+
+  // Wait for the IO thread to process everything that was fed to it
+  auto [promise, future] = folly::makePromiseContract<folly::Unit>();
+  {
+    auto lock = pending.lock();
+    lock->addSync(std::move(promise));
+    lock->ping();
+  }
+  std::move(future).get();
+  auto drainedDuration = steady_clock::now() - replayStart;
+
+  done.store(true, std::memory_order_release);
+  pending.lock()->ping();
+  ioThread.join();
+  if (queryThread.joinable()) {
+    queryThread.join();
+  }
+
+  auto seconds = [](steady_clock::duration d) {
+    return json_real(duration<double>(d).count());
+  };
+  auto drainedSeconds = duration<double>(drainedDuration).count();
+  auto report = json_object({
+      {"events", json_integer(events.size())},
+      {"recorded_seconds",
+       json_real(duration<double>(events.back().offset).count())},
+      {"initial_crawl_seconds", seconds(crawlDuration)},
+      {"feed_seconds", seconds(fedDuration)},
+      {"drain_seconds", seconds(drainedDuration)},
+      {"events_per_second",
+       json_real(drainedSeconds > 0 ? events.size() / drainedSeconds : 0)},
+      {"processed_items",
+       json_integer(root->metrics.events.load(std::memory_order_relaxed))},
+      {"batches", json_integer(batches)},
+      {"max_pending_depth", json_integer(maxDepth)},
+      {"mean_pending_depth", json_real(double(depthSum) / batches)},
+      {"query_latency", queryLatency.snapshot().asJsonValue()},
+      {"view", view->getViewDebugInfo()},
+  });
+  fmt::print("{}\n", json_dumps(report, JSON_INDENT(2) | JSON_SORT_KEYS));
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  folly::init(&argc, &argv);
+  if (FLAGS_log.empty()) {
+    fmt::print(stderr, "--log is required\n");
+    return 1;
+  }
+  return replay();
+}
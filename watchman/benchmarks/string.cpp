@@ -6,6 +6,7 @@
  */
 
 #include <benchmark/benchmark.h>
+#include <string>
 #include "watchman/watchman_string.h"
 
 namespace {
@@ -19,6 +20,15 @@ void string_allocate_and_deallocate(benchmark::State& state) {
 
 BENCHMARK(string_allocate_and_deallocate);
 
+void string_allocate_and_deallocate_short(benchmark::State& state) {
+  char c[] = "index.js";
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(w_string{c, sizeof(c) - 1});
+  }
+}
+
+BENCHMARK(string_allocate_and_deallocate_short);
+
 void string_hash(benchmark::State& state) {
   char c[] = "if there are no branches in the hash function, constant is fine";
   w_string str = c;
@@ -39,6 +49,95 @@ void string_piece_hash(benchmark::State& state) {
 
 BENCHMARK(string_piece_hash);
 
+void string_piece_of_string_hash(benchmark::State& state) {
+  char c[] = "if there are no branches in the hash function, constant is fine";
+  w_string str = c;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(str.piece().hashValue());
+  }
+}
+
+BENCHMARK(string_piece_of_string_hash);
+
+/**
+ * Hash a state.range(0) byte name with each of the candidate hash functions.
+ */
+template <watchman::StringHash (*Hash)(const char*, size_t) noexcept>
+void string_hash_function(benchmark::State& state) {
+  std::string name(state.range(0), 'x');
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Hash(name.data(), name.size()));
+  }
+}
+
+BENCHMARK_TEMPLATE(string_hash_function, watchman::stdStringHash)
+    ->Arg(8)
+    ->Arg(24)
+    ->Arg(100);
+BENCHMARK_TEMPLATE(string_hash_function, watchman::wordStringHash)
+    ->Arg(8)
+    ->Arg(24)
+    ->Arg(100);
+
+/**
+ * Run the byte scans over state.range(0) byte names, scalar and vectorized.
+ * The only separator is the leading one, so the whole path is searched.
+ */
+template <const char* (*Find)(const char*, const char*) noexcept>
+void string_find_last_slash(benchmark::State& state) {
+  std::string path = "/" + std::string(state.range(0) - 1, 'x');
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Find(path.data(), path.data() + path.size()));
+  }
+}
+
+BENCHMARK_TEMPLATE(string_find_last_slash, watchman::findLastSlashScalar)
+    ->Arg(8)
+    ->Arg(24)
+    ->Arg(100);
+BENCHMARK_TEMPLATE(string_find_last_slash, watchman::findLastSlash)
+    ->Arg(8)
+    ->Arg(24)
+    ->Arg(100);
+
+template <bool (*Equal)(const char*, const char*, size_t) noexcept>
+void string_equal_caseless(benchmark::State& state) {
+  std::string lower(state.range(0), 'x');
+  std::string mixed = lower;
+  for (size_t i = 0; i < mixed.size(); i += 2) {
+    mixed[i] = 'X';
+  }
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Equal(lower.data(), mixed.data(), lower.size()));
+  }
+}
+
+BENCHMARK_TEMPLATE(string_equal_caseless, watchman::equalAsciiCaselessScalar)
+    ->Arg(8)
+    ->Arg(24)
+    ->Arg(100);
+BENCHMARK_TEMPLATE(string_equal_caseless, watchman::equalAsciiCaseless)
+    ->Arg(8)
+    ->Arg(24)
+    ->Arg(100);
+
+template <size_t (*Prefix)(const char*, size_t) noexcept>
+void string_ascii_prefix(benchmark::State& state) {
+  std::string name(state.range(0), 'x');
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Prefix(name.data(), name.size()));
+  }
+}
+
+BENCHMARK_TEMPLATE(string_ascii_prefix, watchman::asciiPrefixLengthScalar)
+    ->Arg(8)
+    ->Arg(24)
+    ->Arg(100);
+BENCHMARK_TEMPLATE(string_ascii_prefix, watchman::asciiPrefixLength)
+    ->Arg(8)
+    ->Arg(24)
+    ->Arg(100);
+
 } // namespace
 
 int main(int argc, char** argv) {
@@ -0,0 +1,298 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <benchmark/benchmark.h>
+#include <fmt/core.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "watchman/InMemoryView.h"
+#include "watchman/bser.h"
+#include "watchman/query/Query.h"
+#include "watchman/query/QueryContext.h"
+#include "watchman/query/eval.h"
+#include "watchman/query/parse.h"
+#include "watchman/root/Root.h"
+#include "watchman/test/lib/FakeFileSystem.h"
+#include "watchman/test/lib/FakeWatcher.h"
+#include "watchman/watchman_dir.h"
+#include "watchman/watchman_file.h"
+
+namespace {
+
+using namespace watchman;
+
+constexpr size_t kFilesPerDir = 100;
+constexpr size_t kDirsPerDir = 100;
+
+const char* const kSuffixes[] = {"js", "cpp", "h", "py", "txt"};
+
+/**
+ * The relative path of the i'th file of a synthetic tree, of
+ * kFilesPerDir files per leaf dir under two levels of kDirsPerDir dirs.
+ * One file in five is a .js file.
+ */
+std::string syntheticPath(size_t i) {
+  auto leaf = i / kFilesPerDir;
+  return fmt::format(
+      "d{}/d{}/f{}.{}",
+      leaf / kDirsPerDir,
+      leaf % kDirsPerDir,
+      i % kFilesPerDir,
+      kSuffixes[i % std::size(kSuffixes)]);
+}
+
+/**
+ * Insert state.range(0) files into an empty ViewDatabase, the way the
+ * initial crawl does.
+ */
+void view_database_insert(benchmark::State& state) {
+  FakeFileSystem fs;
+  FakeWatcher watcher{fs};
+  size_t files = state.range(0);
+
+  for (auto _ : state) {
+    auto view = std::make_unique<ViewDatabase>(w_string{FAKEFS_ROOT "root"});
+    ClockStamp stamp{1, 0};
+    for (size_t i = 0; i < files; ++i) {
+      auto path = w_string::build(FAKEFS_ROOT "root/", syntheticPath(i));
+      auto dir = view->resolveDir(path.dirName(), true);
+      auto file =
+          view->getOrCreateChildFile(watcher, dir, path.baseName(), stamp);
+      view->markFileChanged(watcher, file, stamp);
+    }
+    state.PauseTiming();
+    view.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * files);
+}
+BENCHMARK(view_database_insert)
+    ->Arg(10000)
+    ->Arg(100000)
+    ->Arg(1000000)
+    ->Arg(5000000)
+    ->Unit(benchmark::kMillisecond);
+
+/**
+ * Look up files by path in a ViewDatabase of state.range(0) files.
+ */
+void view_database_lookup(benchmark::State& state) {
+  FakeFileSystem fs;
+  FakeWatcher watcher{fs};
+  size_t files = state.range(0);
+
+  ViewDatabase view{w_string{FAKEFS_ROOT "root"}};
+  std::vector<w_string> paths;
+  paths.reserve(files);
+  ClockStamp stamp{1, 0};
+  for (size_t i = 0; i < files; ++i) {
+    auto path = w_string::build(FAKEFS_ROOT "root/", syntheticPath(i));
+    auto dir = view.resolveDir(path.dirName(), true);
+    auto file = view.getOrCreateChildFile(watcher, dir, path.baseName(), stamp);
+    view.markFileChanged(watcher, file, stamp);
+    paths.push_back(std::move(path));
+  }
+
+  // Visit the paths in a scattered order so that the lookups aren't all
+  // served from the same few cache lines.
+  size_t i = 0;
+  for (auto _ : state) {
+    auto& path = paths[(i * 7919) % files];
+    const ViewDatabase& constView = view;
+    auto dir = constView.resolveDir(path.dirName());
+    benchmark::DoNotOptimize(dir->getChildFile(path.baseName()));
+    ++i;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(view_database_lookup)
+    ->Arg(10000)
+    ->Arg(100000)
+    ->Arg(1000000)
+    ->Arg(5000000);
+
+/**
+ * A crawled InMemoryView of a synthetic tree, in which the last 1% of the
+ * files were changed after the crawl.
+ */
+struct CrawledRoot {
+  FakeFileSystem fs;
+  std::shared_ptr<FakeWatcher> watcher = std::make_shared<FakeWatcher>(fs);
+  Configuration config;
+  std::shared_ptr<InMemoryView> view;
+  std::shared_ptr<Root> root;
+  ClockTicks ticksBeforeChanges;
+
+  CrawledRoot(size_t files, bool suffixIndex)
+      : config{makeConfig(suffixIndex)} {
+    const w_string rootPath{FAKEFS_ROOT "root"};
+    for (size_t i = 0; i < files; ++i) {
+      fs.addNode(
+          fmt::format(FAKEFS_ROOT "root/{}", syntheticPath(i)).c_str(),
+          fs.fakeFile());
+    }
+    view = std::make_shared<InMemoryView>(fs, rootPath, config, watcher);
+    root = std::make_shared<Root>(
+        fs, rootPath, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+    auto& pending = view->unsafeAccessPendingFromWatcher();
+    pending.lock()->ping();
+    InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+    view->stepIoThread(root, state, pending);
+
+    ticksBeforeChanges = view->getMostRecentRootNumberAndTickValue().ticks;
+    for (size_t i = files - files / 100; i < files; ++i) {
+      auto path = fmt::format(FAKEFS_ROOT "root/{}", syntheticPath(i));
+      fs.updateMetadata(
+          path.c_str(), [](FileInformation& fi) { fi.size += 1; });
+      pending.lock()->add(w_string{path}, {}, W_PENDING_VIA_NOTIFY);
+    }
+    pending.lock()->ping();
+    view->stepIoThread(root, state, pending);
+  }
+
+  static Configuration makeConfig(bool suffixIndex) {
+    json_ref json = json_object();
+    json_object_set(json, "suffix_index", json_boolean(suffixIndex));
+    return Configuration{std::move(json)};
+  }
+
+  // Crawling the larger trees takes a while, so each is set up once and
+  // shared by every run of the benchmarks that use it.
+  static CrawledRoot& get(size_t files, bool suffixIndex) {
+    static std::map<std::pair<size_t, bool>, std::unique_ptr<CrawledRoot>>
+        roots;
+    auto& root = roots[{files, suffixIndex}];
+    if (!root) {
+      root = std::make_unique<CrawledRoot>(files, suffixIndex);
+    }
+    return *root;
+  }
+};
+
+std::shared_ptr<Query> nameQuery(
+    const std::shared_ptr<Root>& root,
+    std::initializer_list<std::pair<const char*, json_ref>> terms) {
+  auto spec = json_object(terms);
+  json_object_set(spec, "fields", json_array({w_string_to_json("name")}));
+  return parseQuery(root, spec);
+}
+
+/**
+ * A since query that matches the 1% of files changed after the crawl.
+ */
+void query_time_generator(benchmark::State& state) {
+  auto& crawled = CrawledRoot::get(state.range(0), false);
+  auto query = nameQuery(crawled.root, {});
+
+  for (auto _ : state) {
+    QueryContext ctx{query.get(), crawled.root, false};
+    ctx.since = QuerySince::Clock{false, crawled.ticksBeforeChanges};
+    crawled.view->timeGenerator(query.get(), &ctx);
+    benchmark::DoNotOptimize(ctx.resultsArray);
+  }
+}
+BENCHMARK(query_time_generator)
+    ->Arg(10000)
+    ->Arg(100000)
+    ->Arg(1000000)
+    ->Unit(benchmark::kMicrosecond);
+
+/**
+ * A recursive glob that matches a fifth of the files, walking the tree.
+ */
+void query_glob_generator(benchmark::State& state) {
+  auto& crawled = CrawledRoot::get(state.range(0), false);
+  auto query = nameQuery(
+      crawled.root, {{"glob", json_array({w_string_to_json("**/*.js")})}});
+
+  for (auto _ : state) {
+    QueryContext ctx{query.get(), crawled.root, false};
+    crawled.view->globGenerator(query.get(), &ctx);
+    benchmark::DoNotOptimize(ctx.resultsArray);
+  }
+}
+BENCHMARK(query_glob_generator)
+    ->Arg(10000)
+    ->Arg(100000)
+    ->Arg(1000000)
+    ->Unit(benchmark::kMillisecond);
+
+/**
+ * A suffix query that matches a fifth of the files, served from the suffix
+ * index.
+ */
+void query_suffix_generator(benchmark::State& state) {
+  auto& crawled = CrawledRoot::get(state.range(0), true);
+  auto query = nameQuery(
+      crawled.root, {{"suffix", json_array({w_string_to_json("js")})}});
+
+  for (auto _ : state) {
+    QueryContext ctx{query.get(), crawled.root, false};
+    crawled.view->globGenerator(query.get(), &ctx);
+    benchmark::DoNotOptimize(ctx.resultsArray);
+  }
+}
+BENCHMARK(query_suffix_generator)
+    ->Arg(10000)
+    ->Arg(100000)
+    ->Arg(1000000)
+    ->Unit(benchmark::kMillisecond);
+
+/**
+ * Execute a suffix query with several fields and encode the response as
+ * BSER, as the query command does for a BSER client.
+ */
+void query_render_bser(benchmark::State& state) {
+  auto& crawled = CrawledRoot::get(state.range(0), true);
+  auto query = parseQuery(
+      crawled.root,
+      json_object(
+          {{"suffix", json_array({w_string_to_json("js")})},
+           {"fields",
+            json_array(
+                {w_string_to_json("name"),
+                 w_string_to_json("size"),
+                 w_string_to_json("exists"),
+                 w_string_to_json("type")})},
+           {"sync_timeout", json_integer(0)}}));
+  query->bserResultFormat = PduFormat{is_bser_v2, 0};
+
+  bser_ctx_t ctx;
+  ctx.bser_version = 2;
+  ctx.bser_capabilities = 0;
+  ctx.dump = [](const char*, size_t size, void* opaque) -> int {
+    *static_cast<size_t*>(opaque) += size;
+    return 0;
+  };
+
+  size_t bytes = 0;
+  for (auto _ : state) {
+    auto res = w_query_execute(query.get(), crawled.root, nullptr, nullptr);
+    if (w_bser_dump(&ctx, std::move(res.resultsArray).toJson(), &bytes)) {
+      state.SkipWithError("w_bser_dump failed");
+      break;
+    }
+  }
+  state.SetBytesProcessed(bytes);
+}
+BENCHMARK(query_render_bser)
+    ->Arg(10000)
+    ->Arg(100000)
+    ->Arg(1000000)
+    ->Unit(benchmark::kMillisecond);
+
+} // namespace
+
+int main(int argc, char** argv) {
+  ::benchmark::Initialize(&argc, argv);
+  if (::benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+  ::benchmark::RunSpecifiedBenchmarks();
+}
@@ -6,10 +6,15 @@
  */
 
 #include "watchman/bser.h"
+#include <folly/compression/Compression.h>
+#include <folly/io/IOBuf.h>
 #include "watchman/Logging.h"
 #include "watchman/thirdparty/jansson/jansson_private.h"
 
 #include <math.h>
+#include <algorithm>
+#include <string_view>
+#include <unordered_map>
 
 /*
  * This defines a binary serialization of the JSON data objects in this
@@ -42,6 +47,8 @@ namespace {
 #define BSER_TEMPLATE 0x0b
 #define BSER_SKIP 0x0c
 #define BSER_UTF8STRING 0x0d
+#define BSER_COLUMNS 0x0e
+#define BSER_PATH 0x0f
 
 const char bser_true = BSER_TRUE;
 const char bser_false = BSER_FALSE;
@@ -52,6 +59,8 @@ const char bser_object_hdr = BSER_OBJECT;
 const char bser_template_hdr = BSER_TEMPLATE;
 const char bser_utf8string_hdr = BSER_UTF8STRING;
 const char bser_skip = BSER_SKIP;
+const char bser_columns_hdr = BSER_COLUMNS;
+const char bser_path_hdr = BSER_PATH;
 
 constexpr size_t kMaximumContainerSize = std::numeric_limits<uint32_t>::max();
 
@@ -179,6 +188,24 @@ int bser_mixedstring(const bser_ctx_t* ctx, w_string_piece str, void* data) {
   }
 }
 
+int bser_typed_string(
+    const bser_ctx_t* ctx,
+    w_string_piece str,
+    w_string_type_t type,
+    void* data) {
+  switch (type) {
+    case W_STRING_BYTE:
+      return bser_bytestring(ctx, str, data);
+    case W_STRING_UNICODE:
+      return bser_utf8string(ctx, str, data);
+    case W_STRING_MIXED:
+      return bser_mixedstring(ctx, str, data);
+    default:
+      w_assert(false, "unknown string type 0x%02x", type);
+      return -1;
+  }
+}
+
 int bser_array(const bser_ctx_t* ctx, const json_ref& array, void* data);
 
 int bser_template(
@@ -239,6 +266,132 @@ int bser_template(
   return 0;
 }
 
+// Returns the directory part of a path value that the columns encoding may
+// factor out, or an empty piece.  Mixed strings are cleaned up as a whole
+// when they are encoded, so they are left alone.
+std::string_view columnsDirName(const json_ref& val) {
+  if (!val.isString()) {
+    return {};
+  }
+  auto& str = json_to_w_string(val);
+  if (str.type() == W_STRING_MIXED) {
+    return {};
+  }
+  auto view = str.view();
+  auto slash = view.rfind('/');
+  if (slash == std::string_view::npos || slash == 0) {
+    return {};
+  }
+  return view.substr(0, slash);
+}
+
+/**
+ * The columns encoding of a templated array, for peers with
+ * BSER_CAP_COLUMNS:
+ *
+ *   0x0e <array of keys> <int number of objects> <array of directories>
+ *
+ * followed by the values of the first key for every object, then those of
+ * the second key, and so on.  As with templates, 0x0c marks a missing
+ * value.  A string value "dir/base" may instead be encoded as
+ *
+ *   0x0f <int index into the directories> <string "base">
+ *
+ * which decodes to a string of the type of "base".  Only the directories of
+ * at least two values go in the dictionary, in the order first seen.
+ */
+int bser_columns(
+    const bser_ctx_t* ctx,
+    const json_ref& array,
+    const json_ref& templ,
+    void* data) {
+  auto& array_arr = array.array();
+  auto& templ_arr = templ.array();
+
+  // Paths are typically in a handful of directories, so find the ones that
+  // are shared.  This is cheap next to encoding the values.
+  std::vector<std::string_view> seen;
+  std::unordered_map<std::string_view, size_t> dirIds;
+  for (auto& templ_key : templ_arr) {
+    const char* key = json_string_value(templ_key);
+    for (auto& obj : array_arr) {
+      auto val = json_object_get(obj, key);
+      if (!val) {
+        continue;
+      }
+      auto dir = columnsDirName(*val);
+      if (dir.empty()) {
+        continue;
+      }
+      auto [it, inserted] = dirIds.emplace(dir, 0);
+      if (inserted) {
+        seen.push_back(dir);
+      }
+      ++it->second;
+    }
+  }
+  std::vector<std::string_view> dirs;
+  for (auto dir : seen) {
+    auto& id = dirIds[dir];
+    if (id > 1) {
+      id = dirs.size();
+      dirs.push_back(dir);
+    } else {
+      dirIds.erase(dir);
+    }
+  }
+
+  if (ctx->dump(&bser_columns_hdr, sizeof(bser_columns_hdr), data)) {
+    return -1;
+  }
+  if (bser_array(ctx, templ, data)) {
+    return -1;
+  }
+  if (bser_int(ctx, array_arr.size(), data)) {
+    return -1;
+  }
+  if (ctx->dump(&bser_array_hdr, sizeof(bser_array_hdr), data) ||
+      bser_int(ctx, dirs.size(), data)) {
+    return -1;
+  }
+  for (auto dir : dirs) {
+    if (bser_bytestring(ctx, w_string_piece{dir.data(), dir.size()}, data)) {
+      return -1;
+    }
+  }
+
+  for (auto& templ_key : templ_arr) {
+    const char* key = json_string_value(templ_key);
+    for (auto& obj : array_arr) {
+      auto val = json_object_get(obj, key);
+      if (!val) {
+        if (ctx->dump(&bser_skip, sizeof(bser_skip), data)) {
+          return -1;
+        }
+        continue;
+      }
+      auto dir = columnsDirName(*val);
+      auto it = dir.empty() ? dirIds.end() : dirIds.find(dir);
+      if (it == dirIds.end()) {
+        if (w_bser_dump(ctx, *val, data)) {
+          return -1;
+        }
+        continue;
+      }
+      auto& str = json_to_w_string(*val);
+      auto base = str.view().substr(dir.size() + 1);
+      if (ctx->dump(&bser_path_hdr, sizeof(bser_path_hdr), data) ||
+          bser_int(ctx, it->second, data) ||
+          bser_typed_string(
+              ctx, w_string_piece{base.data(), base.size()}, str.type(), data)) {
+        return -1;
+      }
+    }
+  }
+
+  return 0;
+}
+
 int bser_array(const bser_ctx_t* ctx, const json_ref& array, void* data) {
   if (!is_bser_version_supported(ctx)) {
     return -1;
@@ -246,6 +399,10 @@ int bser_array(const bser_ctx_t* ctx, const json_ref& array, void* data) {
 
   auto templ = json_array_get_template(array);
   if (templ && !templ->array().empty()) {
+    if (ctx->bser_version == 2 &&
+        (ctx->bser_capabilities & BSER_CAP_COLUMNS)) {
+      return bser_columns(ctx, array, *templ, data);
+    }
     return bser_template(ctx, array, *templ, data);
   }
 
@@ -318,22 +475,27 @@ int w_bser_dump(const bser_ctx_t* ctx, const json_ref& json, void* data) {
       return bser_int(ctx, json.asInt(), data);
     case JSON_STRING: {
       auto& wstr = json_to_w_string(json);
-      switch (wstr.type()) {
-        case W_STRING_BYTE:
-          return bser_bytestring(ctx, wstr, data);
-        case W_STRING_UNICODE:
-          return bser_utf8string(ctx, wstr, data);
-        case W_STRING_MIXED:
-          return bser_mixedstring(ctx, wstr, data);
-        default:
-          w_assert(false, "unknown string type 0x%02x", wstr.type());
-          return -1;
-      }
+      return bser_typed_string(ctx, wstr, wstr.type(), data);
     }
     case JSON_ARRAY:
       return bser_array(ctx, json, data);
     case JSON_OBJECT:
       return bser_object(ctx, json, data);
+    case JSON_BSER: {
+      auto bser = json_to_bser(json.get());
+      if (bser->bser_version != ctx->bser_version ||
+          bser->bser_capabilities != ctx->bser_capabilities) {
+        // Encoded for a client that speaks a different dialect
+        return w_bser_dump(ctx, bser->decoded(), data);
+      }
+      if (ctx->dump(bser->header.data(), bser->header.size(), data)) {
+        return -1;
+      }
+      if (bser->body.empty()) {
+        return 0;
+      }
+      return ctx->dump(bser->body.data(), bser->body.size(), data);
+    }
     default:
       return -1;
   }
@@ -341,9 +503,207 @@ int w_bser_dump(const bser_ctx_t* ctx, const json_ref& json, void* data) {
 
 namespace {
 
-int measure(const char*, size_t size, void* ptr) {
-  auto tot = (json_int_t*)ptr;
-  *tot += size;
+int append_to_string(const char* buf, size_t size, void* data) {
+  static_cast<std::string*>(data)->append(buf, size);
+  return 0;
+}
+
+} // namespace
+
+BserArrayEncoder::BserArrayEncoder(
+    uint32_t bser_version,
+    uint32_t bser_capabilities,
+    std::optional<json_ref> templ)
+    : ctx_{bser_version, bser_capabilities, append_to_string},
+      templ_{std::move(templ)} {
+  w_check(
+      is_bser_version_supported(&ctx_),
+      "unsupported bser version ",
+      bser_version,
+      "\n");
+}
+
+void BserArrayEncoder::beginElement() {
+  elementStart_ = body_.size();
+}
+
+void BserArrayEncoder::endElement() {
+  ++count_;
+}
+
+void BserArrayEncoder::abortElement() {
+  body_.resize(elementStart_);
+}
+
+void BserArrayEncoder::appendInt(json_int_t value) {
+  bser_int(&ctx_, value, &body_);
+}
+
+void BserArrayEncoder::appendReal(double value) {
+  bser_real(&ctx_, value, &body_);
+}
+
+void BserArrayEncoder::appendBool(bool value) {
+  body_.push_back(value ? bser_true : bser_false);
+}
+
+void BserArrayEncoder::appendNull() {
+  body_.push_back(bser_null);
+}
+
+void BserArrayEncoder::appendString(
+    w_string_piece str,
+    w_string_type_t stringType) {
+  switch (stringType) {
+    case W_STRING_UNICODE:
+      bser_utf8string(&ctx_, str, &body_);
+      break;
+    case W_STRING_MIXED:
+      bser_mixedstring(&ctx_, str, &body_);
+      break;
+    case W_STRING_BYTE:
+    default:
+      bser_bytestring(&ctx_, str, &body_);
+      break;
+  }
+}
+
+void BserArrayEncoder::appendValue(const json_ref& value) {
+  w_bser_dump(&ctx_, value, &body_);
+}
+
+void BserArrayEncoder::append(BserArrayEncoder&& other) {
+  if (body_.empty()) {
+    body_ = std::move(other.body_);
+  } else {
+    body_.append(other.body_);
+  }
+  count_ += other.count_;
+  other.body_.clear();
+  other.count_ = 0;
+}
+
+json_ref BserArrayEncoder::finish() && {
+  std::string header;
+  if (templ_ && !templ_->array().empty()) {
+    header.push_back(bser_template_hdr);
+    bser_array(&ctx_, *templ_, &header);
+  } else {
+    header.push_back(bser_array_hdr);
+  }
+  bser_int(&ctx_, count_, &header);
+
+  return json_make<json_bser_t>(
+      ctx_.bser_version,
+      ctx_.bser_capabilities,
+      std::move(header),
+      std::move(body_),
+      bunser);
+}
+
+namespace {
+
+// Holds an encoding as a chain of blocks, so that it can be encoded once,
+// before its length is known, without copying what has been encoded so far
+// each time it grows
+struct ChainedBuffer {
+  static constexpr size_t kBlockSize = 64 * 1024;
+
+  std::vector<std::string> blocks;
+  size_t size{0};
+
+  static int append(const char* buffer, size_t size, void* ptr) {
+    auto* self = static_cast<ChainedBuffer*>(ptr);
+    self->size += size;
+    while (size > 0) {
+      if (self->blocks.empty() ||
+          self->blocks.back().size() == self->blocks.back().capacity()) {
+        self->blocks.emplace_back();
+        self->blocks.back().reserve(std::max(kBlockSize, size));
+      }
+      auto& block = self->blocks.back();
+      auto n = std::min(size, block.capacity() - block.size());
+      block.append(buffer, n);
+      buffer += n;
+      size -= n;
+    }
+    return 0;
+  }
+
+  int writeTo(json_dump_callback_t dump, void* data) const {
+    for (auto& block : blocks) {
+      if (dump(block.data(), block.size(), data)) {
+        return -1;
+      }
+    }
+    return 0;
+  }
+};
+
+// Compresses an encoding into a zstd frame
+struct ZstdSink {
+  static constexpr size_t kMinRoom = 64 * 1024;
+
+  folly::io::StreamCodec* codec;
+  std::string out;
+  size_t used{0};
+
+  void compress(folly::ByteRange input, folly::io::StreamCodec::FlushOp op) {
+    for (;;) {
+      if (out.size() - used < kMinRoom) {
+        out.resize(std::max(out.size() * 2, used + kMinRoom));
+      }
+      folly::MutableByteRange output{
+          reinterpret_cast<uint8_t*>(out.data()) + used, out.size() - used};
+      bool done = codec->compressStream(input, output, op);
+      used = out.size() - output.size();
+      if (op == folly::io::StreamCodec::FlushOp::NONE ? input.empty()
+                                                        : done) {
+        return;
+      }
+    }
+  }
+
+  static int write(const char* buffer, size_t size, void* ptr) {
+    if (size == 0) {
+      return 0;
+    }
+    static_cast<ZstdSink*>(ptr)->compress(
+        folly::ByteRange{reinterpret_cast<const uint8_t*>(buffer), size},
+        folly::io::StreamCodec::FlushOp::NONE);
+    return 0;
+  }
+};
+
+int bser_write_zstd_pdu(
+    bser_ctx_t* ctx,
+    json_dump_callback_t dump,
+    const ChainedBuffer& body,
+    void* data) {
+  ZstdSink sink;
+  try {
+    auto codec = folly::io::getStreamCodec(folly::io::CodecType::ZSTD);
+    // Records the size in the frame, for bunser_zstd
+    codec->resetStream(uint64_t(body.size));
+    sink.codec = codec.get();
+    if (body.writeTo(ZstdSink::write, &sink)) {
+      return -1;
+    }
+    sink.compress({}, folly::io::StreamCodec::FlushOp::END);
+  } catch (const std::exception& exc) {
+    logf(ERR, "failed to compress a BSER PDU: {}\n", exc.what());
+    return -1;
+  }
+
+  ctx->dump = dump;
+  if (dump(BSER_V2_ZSTD_MAGIC, 2, data) ||
+      dump(
+          (const char*)&ctx->bser_capabilities,
+          sizeof(ctx->bser_capabilities),
+          data) ||
+      bser_int(ctx, sink.used, data) || dump(sink.out.data(), sink.used, data)) {
+    return -1;
+  }
   return 0;
 }
 
@@ -354,19 +714,26 @@ int w_bser_write_pdu(
     const uint32_t bser_capabilities,
     json_dump_callback_t dump,
     const json_ref& json,
-    void* data) {
-  json_int_t m_size = 0;
-  bser_ctx_t ctx{bser_version, bser_capabilities, measure};
+    void* data,
+    size_t zstd_min_size) {
+  bser_ctx_t ctx{bser_version, bser_capabilities, ChainedBuffer::append};
 
   if (!is_bser_version_supported(&ctx)) {
     return -1;
   }
 
-  if (w_bser_dump(&ctx, json, &m_size)) {
+  // Encode the value once, and then write its length ahead of it
+  ChainedBuffer body;
+  if (w_bser_dump(&ctx, json, &body)) {
     return -1;
   }
 
-  // To actually write the contents
+  if (bser_version == 2 && (bser_capabilities & BSER_CAP_ZSTD) &&
+      body.size >= zstd_min_size &&
+      folly::io::hasStreamCodec(folly::io::CodecType::ZSTD)) {
+    return bser_write_zstd_pdu(&ctx, dump, body, data);
+  }
+
   ctx.dump = dump;
 
   if (bser_version == 2) {
@@ -386,15 +753,11 @@ int w_bser_write_pdu(
     }
   }
 
-  if (bser_int(&ctx, m_size, data)) {
+  if (bser_int(&ctx, body.size, data)) {
     return -1;
   }
 
-  if (w_bser_dump(&ctx, json, data)) {
-    return -1;
-  }
-
-  return 0;
+  return body.writeTo(dump, data);
 }
 
 namespace {
@@ -436,9 +799,8 @@ class BserParser {
       case BSER_BYTESTRING:
       case BSER_UTF8STRING: {
         std::string_view str = parseString();
-        return typed_string_to_json(
-            str.data(),
-            str.size(),
+        return parseStringValue(
+            str,
             value_type == BSER_BYTESTRING ? W_STRING_BYTE : W_STRING_UNICODE);
       }
 
@@ -456,6 +818,8 @@ class BserParser {
         return json_array(parseArray());
       case BSER_TEMPLATE:
         return parseTemplate();
+      case BSER_COLUMNS:
+        return parseColumns();
       case BSER_OBJECT:
         return parseObject();
       default:
@@ -586,9 +950,7 @@ class BserParser {
     return parseArray();
   }
 
-  json_ref parseTemplate() {
-    BumpDepth scope{depth};
-
+  std::vector<json_ref> expectTemplateKeys() {
     // Load in the property names template
     auto templ = expectArray();
     if (templ.empty()) {
@@ -605,6 +967,13 @@ class BserParser {
             "template value must be string, was {}", template_key.type());
       }
     }
+    return templ;
+  }
+
+  json_ref parseTemplate() {
+    BumpDepth scope{depth};
+
+    auto templ = expectTemplateKeys();
 
     // And the number of objects
     auto element_count = expectSize("template");
@@ -623,7 +992,7 @@ class BserParser {
 
         assert(template_key.isString());
         item.insert_or_assign(
-            json_string_value(template_key), parseValue(type));
+            json_to_w_string(template_key), parseValue(type));
       }
 
       rv.push_back(json_object(std::move(item)));
@@ -632,6 +1001,67 @@ class BserParser {
     return json_array(std::move(rv));
   }
 
+  // See bser_columns for the layout
+  json_ref parseColumns() {
+    BumpDepth scope{depth};
+
+    auto templ = expectTemplateKeys();
+    auto element_count = expectSize("columns");
+    // Every value takes at least a byte, so a count that the rest of the
+    // document can't hold is bogus; don't allocate for it
+    if (element_count > static_cast<size_t>(end - buf) / templ.size()) {
+      throw BserParseError(
+          "columns of {} objects exceed the document", element_count);
+    }
+
+    expectType({BSER_ARRAY});
+    auto dir_count = expectSize("directories");
+    std::vector<std::string_view> dirs;
+    limitedReservation(dirs, dir_count);
+    for (size_t i = 0; i < dir_count; ++i) {
+      dirs.push_back(expectString());
+    }
+
+    std::vector<std::unordered_map<w_string, json_ref>> items(element_count);
+    std::string path;
+    for (const auto& template_key : templ) {
+      auto& key = json_to_w_string(template_key);
+      for (auto& item : items) {
+        char type = *ensure(1);
+        if (type == BSER_SKIP) {
+          continue;
+        }
+        if (type != BSER_PATH) {
+          item.insert_or_assign(key, parseValue(type));
+          continue;
+        }
+        auto dir = expectSize("directory index");
+        if (dir >= dirs.size()) {
+          throw BserParseError("directory index {} is out of range", dir);
+        }
+        char base_type = expectType({BSER_BYTESTRING, BSER_UTF8STRING});
+        auto base = parseString();
+        path.assign(dirs[dir]);
+        path.push_back('/');
+        path.append(base);
+        item.insert_or_assign(
+            key,
+            typed_string_to_json(
+                path.data(),
+                path.size(),
+                base_type == BSER_BYTESTRING ? W_STRING_BYTE
+                                             : W_STRING_UNICODE));
+      }
+    }
+
+    std::vector<json_ref> rv;
+    rv.reserve(items.size());
+    for (auto& item : items) {
+      rv.push_back(json_object(std::move(item)));
+    }
+    return json_array(std::move(rv));
+  }
+
   json_ref parseObject() {
     BumpDepth scope{depth};
 
@@ -644,19 +1074,45 @@ class BserParser {
       auto key = expectString();
       auto value = expectValue();
 
-      rv.emplace(
-          w_string{
-              key.data(),
-              key.size(),
-              // Hard-coding the string type matches BSER's previous behavior,
-              // but should we respect the type encoded in the BSER document?
-              W_STRING_BYTE},
-          std::move(value));
+      rv.emplace(parseObjectKey(key), std::move(value));
     }
 
     return json_object(std::move(rv));
   }
 
+  json_ref parseStringValue(std::string_view str, w_string_type_t type) {
+    if (str.size() > kMaximumInternedLength) {
+      return typed_string_to_json(str.data(), str.size(), type);
+    }
+    auto& interned = internedValues[type == W_STRING_UNICODE];
+    auto it = interned.find(str);
+    if (it != interned.end()) {
+      return it->second;
+    }
+    auto value = typed_string_to_json(str.data(), str.size(), type);
+    if (interned.size() < kMaximumInternedStrings) {
+      interned.emplace(str, value);
+    }
+    return value;
+  }
+
+  w_string parseObjectKey(std::string_view key) {
+    // Hard-coding the string type matches BSER's previous behavior,
+    // but should we respect the type encoded in the BSER document?
+    if (key.size() > kMaximumInternedLength) {
+      return w_string{key.data(), key.size(), W_STRING_BYTE};
+    }
+    auto it = internedKeys.find(key);
+    if (it != internedKeys.end()) {
+      return it->second;
+    }
+    w_string value{key.data(), key.size(), W_STRING_BYTE};
+    if (internedKeys.size() < kMaximumInternedStrings) {
+      internedKeys.emplace(key, value);
+    }
+    return value;
+  }
+
   struct BumpDepth {
     explicit BumpDepth(size_t& depth) : depth{depth} {
       if (++depth == kMaximumDepth) {
@@ -674,6 +1130,16 @@ class BserParser {
   const char* const start;
   const char* const end;
   size_t depth = 0;
+
+  // Short strings, such as the keys, term names and field names of a
+  // command, tend to repeat throughout a document.  Each is only copied out
+  // of the document once, and its later occurrences share that copy.  The
+  // tables are keyed by pieces of the document.
+  static constexpr size_t kMaximumInternedLength = 32;
+  static constexpr size_t kMaximumInternedStrings = 4096;
+  // Indexed by whether the strings are unicode
+  std::unordered_map<std::string_view, json_ref> internedValues[2];
+  std::unordered_map<std::string_view, w_string> internedKeys;
 };
 
 } // namespace
@@ -734,3 +1200,21 @@ json_ref bunser(const char* buf, const char* end) {
   }
   return BserParser{buf, end}.expectValue();
 }
+
+json_ref bunser_zstd(const char* buf, const char* end) {
+  std::string value;
+  try {
+    auto codec = folly::io::getCodec(folly::io::CodecType::ZSTD);
+    auto frame = folly::IOBuf::wrapBufferAsValue(buf, end - buf);
+    // Don't let a small frame claim an unbounded amount of memory; no PDU
+    // is allowed to be bigger than this uncompressed either
+    auto size = codec->getUncompressedLength(&frame);
+    if (!size || *size > std::numeric_limits<uint32_t>::max()) {
+      throw std::runtime_error("the frame doesn't record a plausible size");
+    }
+    value = codec->uncompress(folly::StringPiece{buf, end}, size);
+  } catch (const std::exception& exc) {
+    throw BserParseError("unable to decompress PDU: {}", exc.what());
+  }
+  return bunser(value.data(), value.data() + value.size());
+}
@@ -8,6 +8,8 @@
 #pragma once
 
 #include <fmt/core.h>
+#include <limits>
+#include <string>
 #include "watchman/thirdparty/jansson/jansson.h"
 
 typedef struct bser_ctx {
@@ -48,19 +50,96 @@ class BserParseTooDeep : public BserParseError {
 
 #define BSER_MAGIC "\x00\x01"
 #define BSER_V2_MAGIC "\x00\x02"
+// A BSERv2 PDU whose value is compressed into a zstd frame; see
+// w_bser_write_pdu
+#define BSER_V2_ZSTD_MAGIC "\x00\x03"
 
 // BSERv2 capabilities. Must be powers of 2.
 #define BSER_CAP_DISABLE_UNICODE 0x1
 #define BSER_CAP_DISABLE_UNICODE_FOR_ERRORS 0x2
+// Templated arrays are encoded column by column, with the directories that
+// their paths share factored out into a dictionary; see bser_columns.
+#define BSER_CAP_COLUMNS 0x4
+// Large PDUs may be sent compressed, introduced by BSER_V2_ZSTD_MAGIC
+#define BSER_CAP_ZSTD 0x8
 
+/**
+ * Writes json as a PDU of the given BSER version.
+ *
+ * The value is encoded once, into memory, and then passed to dump after the
+ * PDU header that gives its length.
+ *
+ * When the version is 2, the capabilities include BSER_CAP_ZSTD, and the
+ * value encodes to at least zstd_min_size bytes, the encoded value is
+ * compressed into a zstd frame.  The PDU then starts with
+ * BSER_V2_ZSTD_MAGIC, and its length is that of the frame.
+ */
 int w_bser_write_pdu(
     const uint32_t bser_version,
     const uint32_t capabilities,
     json_dump_callback_t dump,
     const json_ref& json,
-    void* data);
+    void* data,
+    size_t zstd_min_size = std::numeric_limits<size_t>::max());
 int w_bser_dump(const bser_ctx_t* ctx, const json_ref& json, void* data);
 
+/**
+ * Encodes the elements of a BSER array one at a time as they are produced,
+ * without building json values for them.  With a template, like those
+ * attached by json_array_set_template_new, each element is a row holding
+ * one value per template key and the array is encoded in the compact
+ * template form.
+ *
+ * finish() returns the encoded array as a JSON_BSER value, which
+ * w_bser_dump copies as is when writing it with the same encoding
+ * parameters.
+ */
+class BserArrayEncoder {
+ public:
+  BserArrayEncoder(
+      uint32_t bser_version,
+      uint32_t bser_capabilities,
+      std::optional<json_ref> templ);
+
+  /** Start a new element; values are appended to it until endElement(). */
+  void beginElement();
+  void endElement();
+  /** Discard the values appended since beginElement(). */
+  void abortElement();
+
+  void appendInt(json_int_t value);
+  void appendReal(double value);
+  void appendBool(bool value);
+  void appendNull();
+  void appendString(w_string_piece str, w_string_type_t stringType);
+  void appendValue(const json_ref& value);
+
+  /** Number of completed elements. */
+  size_t size() const {
+    return count_;
+  }
+
+  /** Number of bytes encoded so far. */
+  size_t byteSize() const {
+    return body_.size();
+  }
+
+  /**
+   * Moves the elements of other, which must have been created with the same
+   * parameters, after those of this encoder.
+   */
+  void append(BserArrayEncoder&& other);
+
+  json_ref finish() &&;
+
+ private:
+  bser_ctx_t ctx_;
+  std::optional<json_ref> templ_;
+  std::string body_;
+  size_t elementStart_{0};
+  size_t count_{0};
+};
+
 constexpr size_t kDecodeIntFailed = ~size_t{};
 
 /**
@@ -80,3 +159,9 @@ bunser_int(const char* buf, size_t avail, size_t* needed);
  * Ignores any unused data at the end of the buffer.
  */
 json_ref bunser(const char* buf, const char* end);
+
+/**
+ * Parses the value of a PDU introduced by BSER_V2_ZSTD_MAGIC, given the zstd
+ * frame that follows its length.
+ */
+json_ref bunser_zstd(const char* buf, const char* end);
@@ -5,6 +5,7 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <algorithm>
 #include <unordered_map>
 
 #include <fmt/chrono.h>
@@ -14,12 +15,18 @@
 #include <folly/system/Shell.h>
 
 #include "watchman/Client.h"
+#include "watchman/HeapProfiler.h"
 #include "watchman/InMemoryView.h"
 #include "watchman/LRUCache.h"
 #include "watchman/Logging.h"
+#include "watchman/MemoryPressure.h"
+#include "watchman/Metrics.h"
 #include "watchman/Poison.h"
 #include "watchman/QueryableView.h"
+#include "watchman/ThreadPool.h"
+#include "watchman/Trace.h"
 #include "watchman/root/Root.h"
+#include "watchman/root/watchlist.h"
 #include "watchman/watchman_cmd.h"
 
 namespace watchman {
@@ -27,7 +34,7 @@ namespace {
 
 static UntypedResponse cmd_debug_recrawl(Client* client, const json_ref& args) {
   /* resolve the root */
-  if (json_array_size(args) != 2) {
+  if (json_array_size(args) != 2 && json_array_size(args) != 3) {
     throw ErrorResponse("wrong number of arguments for 'debug-recrawl'");
   }
 
@@ -35,7 +42,21 @@ static UntypedResponse cmd_debug_recrawl(Client* client, const json_ref& args) {
 
   UntypedResponse resp;
 
-  root->scheduleRecrawl("debug-recrawl");
+  if (json_array_size(args) == 3) {
+    // Recrawl only the named subdirectory of the root
+    const auto& jsonPath = args.at(2);
+    auto path = json_string_value(jsonPath);
+    if (!path || w_string_piece{path}.pathIsAbsolute()) {
+      throw ErrorResponse(
+          "invalid value for argument 2, expected a path relative to the root");
+    }
+    auto scope = w_string::pathCat({root->root_path, path});
+    root->scheduleRecrawl("debug-recrawl", scope);
+    resp.set("scope", w_string_to_json(scope));
+  } else {
+    // The whole root, even when scoped_recrawl could pick a subtree
+    root->scheduleRecrawl("debug-recrawl", root->root_path);
+  }
 
   resp.set("recrawl", json_true());
   return resp;
@@ -54,14 +75,15 @@ static UntypedResponse cmd_debug_show_cursors(
 
   UntypedResponse resp;
 
-  auto map = root->inner.cursors.rlock();
   std::unordered_map<w_string, json_ref> cursors;
-  cursors.reserve(map->size());
-  for (const auto& it : *map) {
-    const auto& name = it.first;
-    const auto& ticks = it.second;
-    cursors.insert_or_assign(name, json_integer(ticks));
-  }
+  root->inner.cursors.forEachShard([&](const auto& shard) {
+    auto map = shard.rlock();
+    for (const auto& it : *map) {
+      const auto& name = it.first;
+      const auto& ticks = it.second;
+      cursors.insert_or_assign(name, json_integer(ticks));
+    }
+  });
 
   resp.set("cursors", json_object(std::move(cursors)));
   return resp;
@@ -409,6 +431,440 @@ W_CMD_REG(
     CMD_DAEMON,
     NULL);
 
+static json_ref memoryUsageToJson(const InMemoryView::MemoryUsage& usage) {
+  return json_object({
+      {"view_nodes", json_integer(usage.viewNodes)},
+      {"path_components", json_integer(usage.pathComponents)},
+      {"indexes", json_integer(usage.indexes)},
+      {"pending", json_integer(usage.pending)},
+      {"caches", json_integer(usage.caches)},
+  });
+}
+
+static UntypedResponse cmd_debug_memory(Client*, const json_ref&) {
+  std::vector<std::shared_ptr<Root>> roots;
+  {
+    auto map = watched_roots.rlock();
+    for (const auto& it : *map) {
+      roots.push_back(it.second);
+    }
+  }
+
+  // Don't hold the watched_roots lock while waiting on the view locks
+  std::unordered_map<w_string, json_ref> arenas;
+  InMemoryView::MemoryUsage total;
+  for (const auto& root : roots) {
+    auto view = std::dynamic_pointer_cast<InMemoryView>(root->view());
+    if (!view) {
+      continue;
+    }
+    auto info = view->getArenaDebugInfo();
+    auto usage = view->getMemoryUsage();
+    info.set("by_subsystem", memoryUsageToJson(usage));
+    arenas.insert_or_assign(root->root_path, std::move(info));
+
+    total.viewNodes += usage.viewNodes;
+    total.pathComponents += usage.pathComponents;
+    total.indexes += usage.indexes;
+    total.pending += usage.pending;
+    total.caches += usage.caches;
+  }
+
+  // The PDU buffers of each connection.  These are read without the
+  // clients' cooperation, so they're a snapshot of a moving target.
+  std::vector<json_ref> clients;
+  size_t clientBytes = 0;
+  for (const auto& client : UserClient::getAllClients()) {
+    size_t bytes = client->reader.allocd + client->writer.allocd;
+    clientBytes += bytes;
+    clients.push_back(json_object({
+        {"client_id", json_integer(client->unique_id)},
+        {"pid",
+         json_integer(client->stm ? client->stm->getPeerProcessID() : 0)},
+        {"buffer_bytes", json_integer(bytes)},
+    }));
+  }
+
+  auto summary = memoryUsageToJson(total);
+  summary.set("client_buffers", json_integer(clientBytes));
+  if (auto heap = getHeapTotals()) {
+    size_t attributed = total.viewNodes + total.pathComponents +
+        total.indexes + total.pending + total.caches + clientBytes;
+    summary.set(
+        {{"heap_allocated", json_integer(heap->allocated)},
+         {"heap_active", json_integer(heap->active)},
+         {"heap_resident", json_integer(heap->resident)},
+         // json values, strings held outside the arenas, command state...
+         {"unattributed",
+          json_integer(
+              heap->allocated > attributed ? heap->allocated - attributed
+                                           : 0)}});
+  }
+
+  UntypedResponse resp;
+  resp.set(
+      {{"roots", json_object(std::move(arenas))},
+       {"clients", json_array(std::move(clients))},
+       {"summary", std::move(summary)},
+       {"heap_profiler", getHeapProfilerStatus()},
+       {"memory_pressure", getMemoryPressureStatus()}});
+  return resp;
+}
+W_CMD_REG("debug-memory", cmd_debug_memory, CMD_DAEMON, NULL);
+
+// Responds as though the system were short of memory
+static UntypedResponse cmd_debug_memory_pressure(Client*, const json_ref&) {
+  UntypedResponse resp;
+  resp.set("released", relieveMemoryPressure("debug-memory-pressure"));
+  return resp;
+}
+W_CMD_REG(
+    "debug-memory-pressure",
+    cmd_debug_memory_pressure,
+    CMD_DAEMON,
+    NULL);
+
+struct RootCounters {
+  uint64_t events{0};
+  uint64_t recrawls{0};
+  uint64_t queryResultCacheHits{0};
+  uint64_t queryResultCacheMisses{0};
+  uint64_t parsedQueryCacheHits{0};
+  uint64_t parsedQueryCacheMisses{0};
+  uint64_t contentHashCacheHits{0};
+  uint64_t contentHashCacheMisses{0};
+  // Zero where the platform can't tell, or the threads are shared
+  uint64_t notifyThreadCpuUs{0};
+  uint64_t ioThreadCpuUs{0};
+};
+
+RootCounters getRootCounters(Root& root) {
+  RootCounters counters;
+  counters.events = root.metrics.events.load(std::memory_order_relaxed);
+  counters.recrawls = root.recrawlInfo.rlock()->recrawlCount;
+  auto resultCache = root.view()->getQueryResultCache().getStats();
+  counters.queryResultCacheHits = resultCache.hits;
+  counters.queryResultCacheMisses = resultCache.misses;
+  auto parsedCache = root.parsedQueryCache.getStats();
+  counters.parsedQueryCacheHits = parsedCache.hits;
+  counters.parsedQueryCacheMisses = parsedCache.misses;
+  if (auto view = std::dynamic_pointer_cast<InMemoryView>(root.view())) {
+    auto stats = view->debugAccessCaches().contentHashCache.stats();
+    counters.contentHashCacheHits = stats.cacheHit + stats.cacheShare;
+    counters.contentHashCacheMisses = stats.cacheMiss;
+    counters.notifyThreadCpuUs =
+        view->getNotifyThreadCpuTime().value_or(std::chrono::microseconds{0})
+            .count();
+    counters.ioThreadCpuUs =
+        view->getIoThreadCpuTime().value_or(std::chrono::microseconds{0})
+            .count();
+  }
+  return counters;
+}
+
+std::string renderOpenMetrics(
+    const std::vector<std::shared_ptr<Root>>& roots) {
+  using Labels = OpenMetricsWriter::Labels;
+  OpenMetricsWriter writer;
+
+  std::vector<std::pair<Labels, LatencyHistogram::Snapshot>> commands;
+  for (auto& [name, snapshot] : CommandMetrics::get().snapshot()) {
+    commands.emplace_back(Labels{{"command", name}}, snapshot);
+  }
+  writer.histogram(
+      "watchman_command_duration_seconds",
+      "Time taken to run each command.",
+      commands);
+
+  auto rootLabels = [](const Root& root) {
+    return Labels{{"root", root.root_path.string()}};
+  };
+  auto phase = [&](const char* family,
+                   const char* help,
+                   LatencyHistogram QueryPhaseHistograms::*histogram) {
+    std::vector<std::pair<Labels, LatencyHistogram::Snapshot>> series;
+    for (auto& root : roots) {
+      series.emplace_back(
+          rootLabels(*root), (root->metrics.queries.*histogram).snapshot());
+    }
+    writer.histogram(family, help, series);
+  };
+  phase(
+      "watchman_query_duration_seconds",
+      "Time taken to run each query.",
+      &QueryPhaseHistograms::elapsed);
+  phase(
+      "watchman_query_cookie_sync_seconds",
+      "Time each query waited to sync with the filesystem.",
+      &QueryPhaseHistograms::cookieSync);
+  phase(
+      "watchman_query_view_lock_wait_seconds",
+      "Time each query waited for the view lock.",
+      &QueryPhaseHistograms::viewLockWait);
+  phase(
+      "watchman_query_generation_seconds",
+      "Time each query spent generating candidate files.",
+      &QueryPhaseHistograms::generation);
+  phase(
+      "watchman_query_render_seconds",
+      "Time each query spent rendering its results.",
+      &QueryPhaseHistograms::render);
+  phase(
+      "watchman_query_cpu_seconds",
+      "CPU time used by each query.",
+      &QueryPhaseHistograms::cpu);
+
+  std::vector<std::pair<Labels, LatencyHistogram::Snapshot>> subscriptions;
+  for (auto& root : roots) {
+    subscriptions.emplace_back(
+        rootLabels(*root), root->metrics.subscriptionNotifications.snapshot());
+  }
+  writer.histogram(
+      "watchman_subscription_notification_seconds",
+      "Time taken to compute each subscription notification.",
+      subscriptions);
+
+  auto changeStage = [&](const char* family,
+                         const char* help,
+                         LatencyHistogram ChangeLatencyHistograms::*histogram) {
+    std::vector<std::pair<Labels, LatencyHistogram::Snapshot>> series;
+    for (auto& root : roots) {
+      series.emplace_back(
+          rootLabels(*root),
+          (root->metrics.changeLatency.*histogram).snapshot());
+    }
+    writer.histogram(family, help, series);
+  };
+  changeStage(
+      "watchman_change_kernel_to_pending_seconds",
+      "Time from a change being read from the watcher to its hand off to the IO thread.",
+      &ChangeLatencyHistograms::kernelToPending);
+  changeStage(
+      "watchman_change_pending_to_processed_seconds",
+      "Time from a batch of changes being handed off to the IO thread to it being processed.",
+      &ChangeLatencyHistograms::pendingToProcessed);
+  changeStage(
+      "watchman_change_processed_to_settled_seconds",
+      "Time from a change being processed to the root settling.",
+      &ChangeLatencyHistograms::processedToSettled);
+  changeStage(
+      "watchman_change_settled_to_delivered_seconds",
+      "Time from the root settling to the subscription notification being sent.",
+      &ChangeLatencyHistograms::settledToDelivered);
+
+  std::vector<std::pair<Labels, LatencyHistogram::Snapshot>> admissionWaits;
+  for (auto& root : roots) {
+    for (auto priority : {QueryPriority::Interactive, QueryPriority::Batch}) {
+      auto labels = rootLabels(*root);
+      labels.emplace_back("priority", queryPriorityName(priority));
+      admissionWaits.emplace_back(
+          std::move(labels),
+          root->metrics.queryAdmissionWait[size_t(priority)].snapshot());
+    }
+  }
+  writer.histogram(
+      "watchman_query_admission_wait_seconds",
+      "Time each heavy query waited for its turn, by client priority.",
+      admissionWaits);
+
+  std::vector<RootCounters> counters;
+  for (auto& root : roots) {
+    counters.push_back(getRootCounters(*root));
+  }
+  auto counter = [&](const char* family,
+                     const char* help,
+                     uint64_t RootCounters::*value) {
+    std::vector<std::pair<Labels, uint64_t>> series;
+    for (size_t i = 0; i < roots.size(); ++i) {
+      series.emplace_back(rootLabels(*roots[i]), counters[i].*value);
+    }
+    writer.counter(family, help, series);
+  };
+  counter(
+      "watchman_root_events",
+      "Changes processed by the IO thread.",
+      &RootCounters::events);
+  counter("watchman_root_recrawls", "Recrawls.", &RootCounters::recrawls);
+  counter(
+      "watchman_query_result_cache_hits",
+      "Queries answered from the query result cache.",
+      &RootCounters::queryResultCacheHits);
+  counter(
+      "watchman_query_result_cache_misses",
+      "Queries that missed the query result cache.",
+      &RootCounters::queryResultCacheMisses);
+  counter(
+      "watchman_parsed_query_cache_hits",
+      "Queries whose parse was found in the parsed query cache.",
+      &RootCounters::parsedQueryCacheHits);
+  counter(
+      "watchman_parsed_query_cache_misses",
+      "Queries that had to be parsed.",
+      &RootCounters::parsedQueryCacheMisses);
+  counter(
+      "watchman_content_hash_cache_hits",
+      "Content hashes found in the cache.",
+      &RootCounters::contentHashCacheHits);
+  counter(
+      "watchman_content_hash_cache_misses",
+      "Content hashes that had to be computed.",
+      &RootCounters::contentHashCacheMisses);
+  counter(
+      "watchman_notify_thread_cpu_microseconds",
+      "CPU time used by the root's notify thread.",
+      &RootCounters::notifyThreadCpuUs);
+  counter(
+      "watchman_io_thread_cpu_microseconds",
+      "CPU time used by the root's IO thread.",
+      &RootCounters::ioThreadCpuUs);
+  writer.counter(
+      "watchman_log_messages_dropped",
+      "Debug log messages dropped because stderr fell behind.",
+      {{Labels{}, getLog().getDroppedCount()}});
+
+  auto pool = getThreadPool().getStats();
+  writer.counter(
+      "watchman_thread_pool_tasks",
+      "Tasks run by the shared thread pool.",
+      {{Labels{}, pool.executed}});
+  writer.counter(
+      "watchman_thread_pool_steals",
+      "Tasks that a thread pool worker took from another's queue.",
+      {{Labels{}, pool.steals}});
+  writer.counter(
+      "watchman_thread_pool_waits",
+      "Times a caller waited for the full thread pool to drain.",
+      {{Labels{}, pool.waits}});
+
+  return writer.finish();
+}
+
+static UntypedResponse cmd_debug_metrics(Client*, const json_ref& args) {
+  bool openMetrics = false;
+  if (json_array_size(args) == 2) {
+    auto format = json_string_value(args.at(1));
+    if (!format || w_string_piece{format} != "openmetrics") {
+      throw ErrorResponse(
+          "the argument to 'debug-metrics' must be \"openmetrics\"");
+    }
+    openMetrics = true;
+  } else if (json_array_size(args) != 1) {
+    throw ErrorResponse("wrong number of arguments for 'debug-metrics'");
+  }
+
+  std::vector<std::shared_ptr<Root>> roots;
+  {
+    auto map = watched_roots.rlock();
+    for (const auto& it : *map) {
+      roots.push_back(it.second);
+    }
+  }
+  std::sort(roots.begin(), roots.end(), [](const auto& a, const auto& b) {
+    return a->root_path < b->root_path;
+  });
+
+  UntypedResponse resp;
+  if (openMetrics) {
+    auto text = renderOpenMetrics(roots);
+    resp.set(
+        "openmetrics",
+        typed_string_to_json(text.data(), text.size(), W_STRING_BYTE));
+    return resp;
+  }
+
+  std::unordered_map<w_string, json_ref> commands;
+  for (auto& [name, snapshot] : CommandMetrics::get().snapshot()) {
+    commands.insert_or_assign(
+        w_string{name.data(), name.size()}, snapshot.asJsonValue());
+  }
+
+  std::unordered_map<w_string, json_ref> rootMetrics;
+  for (const auto& root : roots) {
+    auto counters = getRootCounters(*root);
+    rootMetrics.insert_or_assign(
+        root->root_path,
+        json_object({
+            {"query", root->metrics.queries.asJsonValue()},
+            {"subscription_notification",
+             root->metrics.subscriptionNotifications.snapshot().asJsonValue()},
+            {"change_latency", root->metrics.changeLatency.asJsonValue()},
+            {"query_admission_wait",
+             json_object({
+                 {"interactive",
+                  root->metrics
+                      .queryAdmissionWait[size_t(QueryPriority::Interactive)]
+                      .snapshot()
+                      .asJsonValue()},
+                 {"batch",
+                  root->metrics.queryAdmissionWait[size_t(QueryPriority::Batch)]
+                      .snapshot()
+                      .asJsonValue()},
+             })},
+            {"events", json_integer(counters.events)},
+            {"recrawls", json_integer(counters.recrawls)},
+            {"query_result_cache_hits",
+             json_integer(counters.queryResultCacheHits)},
+            {"query_result_cache_misses",
+             json_integer(counters.queryResultCacheMisses)},
+            {"parsed_query_cache_hits",
+             json_integer(counters.parsedQueryCacheHits)},
+            {"parsed_query_cache_misses",
+             json_integer(counters.parsedQueryCacheMisses)},
+            {"content_hash_cache_hits",
+             json_integer(counters.contentHashCacheHits)},
+            {"content_hash_cache_misses",
+             json_integer(counters.contentHashCacheMisses)},
+            {"notify_thread_cpu_us", json_integer(counters.notifyThreadCpuUs)},
+            {"io_thread_cpu_us", json_integer(counters.ioThreadCpuUs)},
+        }));
+  }
+
+  resp.set("commands", json_object(std::move(commands)));
+  resp.set("roots", json_object(std::move(rootMetrics)));
+  resp.set("log_messages_dropped", json_integer(getLog().getDroppedCount()));
+  auto pool = getThreadPool().getStats();
+  resp.set(
+      "thread_pool",
+      json_object({
+          {"queued", json_integer(pool.queued)},
+          {"max_queued", json_integer(pool.maxQueued)},
+          {"executed", json_integer(pool.executed)},
+          {"steals", json_integer(pool.steals)},
+          {"waits", json_integer(pool.waits)},
+      }));
+  return resp;
+}
+W_CMD_REG("debug-metrics", cmd_debug_metrics, CMD_DAEMON, NULL);
+
+// Returns the spans recorded by each thread in the Chrome trace event
+// format; save the response to a file to load it into chrome://tracing.
+// `debug-trace clear` forgets the spans recorded so far.
+static UntypedResponse cmd_debug_trace(Client*, const json_ref& args) {
+  if (!isTracingCompiledIn()) {
+    throw ErrorResponse("this watchman was built without ENABLE_TRACING");
+  }
+
+  if (json_array_size(args) == 2) {
+    auto action = json_string_value(args.at(1));
+    if (!action || w_string_piece{action} != "clear") {
+      throw ErrorResponse("the argument to 'debug-trace' must be \"clear\"");
+    }
+    clearTrace();
+    UntypedResponse resp;
+    resp.set("cleared", json_true());
+    return resp;
+  } else if (json_array_size(args) != 1) {
+    throw ErrorResponse("wrong number of arguments for 'debug-trace'");
+  }
+
+  UntypedResponse resp;
+  resp.set(
+      {{"traceEvents", dumpTraceEvents()},
+       {"displayTimeUnit", typed_string_to_json("ms")}});
+  return resp;
+}
+W_CMD_REG("debug-trace", cmd_debug_trace, CMD_DAEMON, NULL);
+
 void addCacheStats(UntypedResponse& resp, const CacheStats& stats) {
   resp.set(
       {{"cacheHit", json_integer(stats.cacheHit)},
@@ -435,9 +891,28 @@ UntypedResponse debugContentHashCache(Client* client, const json_ref& args) {
     throw ErrorResponse("root is not an InMemoryView watcher");
   }
 
-  auto stats = view->debugAccessCaches().contentHashCache.stats();
+  auto& cache = view->debugAccessCaches().contentHashCache;
   UntypedResponse resp;
-  addCacheStats(resp, stats);
+  addCacheStats(resp, cache.stats());
+  auto& warm = view->debugAccessCaches().contentHashWarmStats;
+  auto queryLookups = warm.queryLookups.load();
+  resp.set(
+      {{"warmQueued", json_integer(warm.queued.load())},
+       {"warmPending", json_integer(warm.pending.load())},
+       {"queryLookups", json_integer(queryLookups)},
+       {"queryHits", json_integer(warm.queryHits.load())},
+       {"warmHitRatio",
+        json_real(
+            queryLookups ? double(warm.queryHits.load()) / queryLookups
+                         : 0.0)}});
+  if (auto* store = cache.store()) {
+    auto stats = store->getStats();
+    resp.set(
+        {{"storeHit", json_integer(stats.hits)},
+         {"storeMiss", json_integer(stats.misses)},
+         {"storeCompactions", json_integer(stats.compactions)},
+         {"storeSize", json_integer(stats.entries)}});
+  }
   return resp;
 }
 W_CMD_REG(
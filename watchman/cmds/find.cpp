@@ -28,6 +28,8 @@ static UntypedResponse cmd_find(Client* client, const json_ref& args) {
     query->sync_timeout = std::chrono::milliseconds(0);
   }
   query->clientPid = client->stm ? client->stm->getPeerProcessID() : 0;
+  query->clientGone = [client] { return client->hungUp(); };
+  query->priority = client->getQueryPriority();
 
   auto res = w_query_execute(query.get(), root, nullptr, getInterface);
   UntypedResponse response;
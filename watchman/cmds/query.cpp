@@ -6,14 +6,148 @@
  */
 
 #include "watchman/query/Query.h"
+#include <fmt/core.h>
+#include <folly/String.h>
 #include "watchman/Client.h"
+#include "watchman/UserDir.h"
+#include "watchman/bser.h"
 #include "watchman/query/eval.h"
 #include "watchman/query/parse.h"
 #include "watchman/saved_state/SavedStateFactory.h"
 #include "watchman/watchman_cmd.h"
+#include "watchman/watchman_stream.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using namespace watchman;
 
+namespace {
+
+/**
+ * Sends the results of a streaming query to the client as a header PDU
+ * followed by PDUs holding batches of files.  Each batch is written and
+ * released before the next one is built, so the client's stream provides
+ * the backpressure.  Returns false if the client went away.
+ */
+bool stream_query_results(
+    Client* client,
+    const Query* query,
+    RenderResult results) {
+  UntypedResponse header;
+  header.set(
+      {{"stream", typed_string_to_json("header", W_STRING_UNICODE)},
+       {"num_files", json_integer(results.results.size())}});
+  client->enqueueResponse(std::move(header));
+  if (!client->flushResponses()) {
+    return false;
+  }
+
+  auto batchSize = *query->streamBatchSize;
+  for (size_t start = 0; start < results.results.size(); start += batchSize) {
+    auto end = std::min(start + batchSize, results.results.size());
+    std::vector<json_ref> batch(
+        std::make_move_iterator(results.results.begin() + start),
+        std::make_move_iterator(results.results.begin() + end));
+    auto files = json_array(std::move(batch));
+    if (results.templ) {
+      json_array_set_template_new(files, json_ref(*results.templ));
+    }
+
+    UntypedResponse response;
+    response.set(
+        {{"stream", typed_string_to_json("files", W_STRING_UNICODE)},
+         {"files", std::move(files)}});
+    client->enqueueResponse(std::move(response));
+    if (!client->flushResponses()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#ifndef _WIN32
+/**
+ * An anonymous file to hold a shared memory result.  On Linux this is a
+ * memfd, which can be sealed so that the client may trust that it won't
+ * change once it has been written.
+ */
+FileDescriptor make_shared_memory_file() {
+#ifdef MFD_ALLOW_SEALING
+  return FileDescriptor(
+      memfd_create("watchman-query", MFD_CLOEXEC | MFD_ALLOW_SEALING),
+      "memfd_create",
+      FileDescriptor::FDType::Generic);
+#else
+  auto templ = fmt::format("{}/wmanshmXXXXXX", getTemporaryDirectory());
+  FileDescriptor fd{
+      mkstemp(templ.data()), "mkstemp", FileDescriptor::FDType::Generic};
+  unlink(templ.c_str());
+  fd.setCloExec();
+  return fd;
+#endif
+}
+#endif
+
+/**
+ * Writes response, as a PDU in the client's format, to an anonymous file,
+ * and sends the client a response holding only the size of that PDU with
+ * the file's descriptor attached.  The client maps the file rather than
+ * reading the response through the socket.
+ */
+void send_shared_memory_result(Client* client, UntypedResponse response) {
+#ifdef _WIN32
+  (void)client;
+  (void)response;
+  throw ErrorResponse("shared_memory is not supported on Windows");
+#else
+  auto file = make_shared_memory_file();
+  {
+    auto stm = w_stm_fdopen(FileDescriptor{
+        ::dup(file.fd()), "dup", FileDescriptor::FDType::Generic});
+    PduBuffer writer;
+    auto result = writer.pduEncodeToStream(
+        client->format, std::move(response).toJson(), stm.get());
+    if (result.hasError()) {
+      throw ErrorResponse(
+          "unable to write the shared memory result: {}",
+          folly::errnoStr(result.error()));
+    }
+  }
+#ifdef F_ADD_SEALS
+  fcntl(
+      file.fd(),
+      F_ADD_SEALS,
+      F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#endif
+  struct stat st;
+  if (fstat(file.fd(), &st) != 0) {
+    throw ErrorResponse(
+        "unable to size the shared memory result: {}",
+        folly::errnoStr(errno));
+  }
+
+  // Make sure that the descriptor goes along with this response
+  if (!client->flushResponses()) {
+    throw ResponseWasHandledManually();
+  }
+  if (!client->stm || !client->stm->attachDescriptor(std::move(file))) {
+    throw ErrorResponse("this connection can't pass descriptors");
+  }
+  UntypedResponse header;
+  header.set(
+      "shared_memory", json_object({{"size", json_integer(st.st_size)}}));
+  client->enqueueResponse(std::move(header));
+  client->flushResponses();
+#endif
+}
+
+} // namespace
+
 /* query /root {query} */
 static UntypedResponse cmd_query(Client* client, const json_ref& args) {
   if (json_array_size(args) != 3) {
@@ -25,9 +159,24 @@ static UntypedResponse cmd_query(Client* client, const json_ref& args) {
   const auto& query_spec = args.at(2);
   auto query = parseQuery(root, query_spec);
   query->clientPid = client->stm ? client->stm->getPeerProcessID() : 0;
+  query->clientGone = [client] { return client->hungUp(); };
+  query->priority = client->getQueryPriority();
 
   if (client->client_mode) {
     query->sync_timeout = std::chrono::milliseconds(0);
+    // There is no stream to send the results over piecemeal, nor a
+    // client to pass a descriptor to
+    query->streamBatchSize.reset();
+    query->sharedMemory = false;
+  }
+  // The response goes back in the format of the request, so BSER clients
+  // can have their results encoded as they are rendered.  Streamed results
+  // are sent in batches, and columns are only encoded once all of the
+  // results are known, so those are kept as json values.
+  if ((client->format.type == is_bser || client->format.type == is_bser_v2) &&
+      !(client->format.capabilities & BSER_CAP_COLUMNS) &&
+      !query->streamBatchSize) {
+    query->bserResultFormat = client->format;
   }
 
   auto res = w_query_execute(query.get(), root, nullptr, getInterface);
@@ -35,14 +184,36 @@ static UntypedResponse cmd_query(Client* client, const json_ref& args) {
   response.set(
       {{"is_fresh_instance", json_boolean(res.isFreshInstance)},
        {"clock", res.clockAtStartOfQuery.toJson()},
-       {"files", std::move(res.resultsArray).toJson()},
        {"debug", res.debugInfo.render()}});
+  if (query->streamBatchSize) {
+    if (!stream_query_results(
+            client, query.get(), std::move(res.resultsArray))) {
+      throw ResponseWasHandledManually();
+    }
+    // The final response is the trailer, sent once the command returns
+    response.set("stream", typed_string_to_json("trailer", W_STRING_UNICODE));
+  } else {
+    response.set("files", std::move(res.resultsArray).toJson());
+  }
   if (res.savedStateInfo) {
     response.set("saved-state-info", std::move(*res.savedStateInfo));
   }
+  if (res.exists) {
+    response.set("exists", json_boolean(*res.exists));
+  }
+  if (res.aggregate) {
+    response.set("aggregate", std::move(*res.aggregate));
+  }
+  if (res.nextPageToken) {
+    response.set("next_page_token", w_string_to_json(*res.nextPageToken));
+  }
 
   add_root_warnings_to_response(response, root);
 
+  if (query->sharedMemory) {
+    send_shared_memory_result(client, std::move(response));
+    throw ResponseWasHandledManually();
+  }
   return response;
 }
 W_CMD_REG(
@@ -51,5 +222,39 @@ W_CMD_REG(
     CMD_DAEMON | CMD_CLIENT | CMD_ALLOW_ANY_USER,
     w_cmd_realpath_root);
 
+/* client-priority ["interactive" | "batch"]
+ * Declares the priority of this connection's queries, or with no argument,
+ * reports it. */
+static UntypedResponse cmd_client_priority(
+    Client* client,
+    const json_ref& args) {
+  auto numArgs = json_array_size(args);
+  if (numArgs > 2) {
+    throw ErrorResponse("wrong number of arguments for 'client-priority'");
+  }
+  if (numArgs == 2) {
+    const auto& name = args.at(1);
+    auto priority =
+        name.isString() ? parseQueryPriority(name.asString().view())
+                        : std::nullopt;
+    if (!priority) {
+      throw ErrorResponse(
+          "client-priority must be \"interactive\" or \"batch\"");
+    }
+    client->declaredPriority = priority;
+  }
+
+  UntypedResponse resp;
+  resp.set(
+      "priority",
+      typed_string_to_json(queryPriorityName(client->getQueryPriority())));
+  return resp;
+}
+W_CMD_REG(
+    "client-priority",
+    cmd_client_priority,
+    CMD_DAEMON | CMD_ALLOW_ANY_USER,
+    NULL);
+
 /* vim:ts=2:sw=2:et:
  */
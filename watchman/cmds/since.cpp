@@ -34,6 +34,8 @@ static UntypedResponse cmd_since(Client* client, const json_ref& args) {
 
   auto query = parseQueryLegacy(root, args, 3, nullptr, clockspec, nullptr);
   query->clientPid = client->stm ? client->stm->getPeerProcessID() : 0;
+  query->clientGone = [client] { return client->hungUp(); };
+  query->priority = client->getQueryPriority();
 
   auto res = w_query_execute(query.get(), root, nullptr, getInterface);
   UntypedResponse response;
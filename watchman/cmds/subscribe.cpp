@@ -6,11 +6,14 @@
  */
 
 #include <folly/MapUtil.h>
+#include <folly/ScopeGuard.h>
+#include <algorithm>
 #include "watchman/Client.h"
 #include "watchman/Errors.h"
 #include "watchman/Logging.h"
 #include "watchman/MapUtil.h"
 #include "watchman/QueryableView.h"
+#include "watchman/query/GlobEscaping.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/eval.h"
 #include "watchman/query/parse.h"
@@ -21,6 +24,44 @@
 
 using namespace watchman;
 
+namespace {
+// How many durable subscriptions' clocks a root remembers
+constexpr size_t kMaxDurableSubscriptions = 1024;
+
+// The dirs that hold every file that query can match, for
+// ClientSubscription::scopes
+std::vector<w_string> computeSubscriptionScopes(
+    const Root& root,
+    const Query& query) {
+  const auto& base =
+      query.relative_root ? *query.relative_root : root.root_path;
+  // Case insensitive bounds are lower-cased, so they can't be compared
+  // with the paths that the watcher reports
+  if (query.expr && root.case_sensitive == CaseSensitivity::CaseSensitive) {
+    auto patterns =
+        query.expr->computeGlobUpperBound(CaseSensitivity::CaseSensitive);
+    if (patterns && !patterns->empty()) {
+      std::vector<w_string> scopes;
+      for (auto& pattern : *patterns) {
+        auto dir = globLiteralDir(pattern);
+        if (dir.empty()) {
+          scopes.clear();
+          break;
+        }
+        scopes.push_back(w_string::pathCat({base, dir}));
+      }
+      if (!scopes.empty()) {
+        return scopes;
+      }
+    }
+  }
+  if (query.relative_root) {
+    return {*query.relative_root};
+  }
+  return {};
+}
+} // namespace
+
 ClientSubscription::ClientSubscription(
     const std::shared_ptr<Root>& root,
     std::weak_ptr<Client> client)
@@ -39,6 +80,113 @@ ClientSubscription::~ClientSubscription() {
   if (client) {
     client->unsubByName(name);
   }
+  if (sharedResultsKey) {
+    setSharedResultsKey(std::nullopt);
+  }
+  if (!scopes.empty()) {
+    setScopes({});
+  }
+  if (durable && resumeSince) {
+    auto clocks = root->durableSubscriptionClocks.wlock();
+    if (clocks->size() >= kMaxDurableSubscriptions &&
+        clocks->find(name) == clocks->end()) {
+      // That subscription's next notification is a fresh instance
+      clocks->erase(clocks->begin());
+    }
+    clocks->insert_or_assign(name, *resumeSince);
+  }
+}
+
+void ClientSubscription::setSharedResultsKey(std::optional<w_string> key) {
+  auto fields = root->sharedSubscriptionFields.wlock();
+  if (sharedResultsKey) {
+    auto it = fields->find(*sharedResultsKey);
+    if (it != fields->end()) {
+      for (auto* field : query->fieldList) {
+        auto count = it->second.find(field);
+        if (count != it->second.end() && --count->second == 0) {
+          it->second.erase(count);
+        }
+      }
+      if (it->second.empty()) {
+        fields->erase(it);
+      }
+    }
+  }
+  sharedResultsKey = std::move(key);
+  if (sharedResultsKey) {
+    auto& counts = (*fields)[*sharedResultsKey];
+    for (auto* field : query->fieldList) {
+      ++counts[field];
+    }
+  }
+}
+
+void ClientSubscription::setScopes(std::vector<w_string> dirs) {
+  auto registered = root->subscriptionScopes.wlock();
+  for (auto& dir : scopes) {
+    auto it = registered->find(dir);
+    if (it != registered->end() && --it->second == 0) {
+      registered->erase(it);
+    }
+  }
+  scopes = std::move(dirs);
+  for (auto& dir : scopes) {
+    ++(*registered)[dir];
+  }
+}
+
+bool SharedSubscriptionResults::covers(const QueryFieldList& fields) const {
+  return std::all_of(fields.begin(), fields.end(), [&](auto* field) {
+    return std::find(fieldList.begin(), fieldList.end(), field) !=
+        fieldList.end();
+  });
+}
+
+json_ref SharedSubscriptionResults::render(
+    const QueryFieldList& fields) const {
+  std::string key;
+  for (auto* field : fields) {
+    key.append(field->name.data(), field->name.size());
+    key.push_back(',');
+  }
+  {
+    auto renderings = renderings_.rlock();
+    auto it = renderings->find(key);
+    if (it != renderings->end()) {
+      return it->second;
+    }
+  }
+
+  std::vector<json_ref> rendered;
+  if (fields.size() == fieldList.size() &&
+      std::equal(fields.begin(), fields.end(), fieldList.begin())) {
+    rendered = files;
+  } else {
+    // The files were rendered as objects holding every field of fieldList,
+    // which is wider than fields
+    rendered.reserve(files.size());
+    for (auto& file : files) {
+      auto& values = file.object();
+      if (fields.size() == 1) {
+        rendered.push_back(values.at(fields.front()->name));
+        continue;
+      }
+      std::unordered_map<w_string, json_ref> value;
+      value.reserve(fields.size());
+      for (auto* field : fields) {
+        value.insert_or_assign(field->name, values.at(field->name));
+      }
+      rendered.push_back(json_object(std::move(value)));
+    }
+  }
+
+  auto arr = json_array(std::move(rendered));
+  if (fields.size() > 1) {
+    json_array_set_template_new(arr, field_list_to_json_name_array(fields));
+  }
+  return renderings_.wlock()->emplace(std::move(key), std::move(arr))
+      .first->second;
 }
 
 bool UserClient::unsubByName(const w_string& name) {
@@ -115,6 +263,10 @@ static std::tuple<sub_action, w_string> get_subscription_action(
 }
 
 void ClientSubscription::processSubscription() {
+  // Only the run that follows a settle reports its change times
+  SCOPE_EXIT {
+    settledChange.reset();
+  };
   try {
     processSubscriptionImpl();
   } catch (const std::system_error& exc) {
@@ -205,20 +357,92 @@ void ClientSubscription::processSubscriptionImpl() {
   }
 }
 
-void ClientSubscription::updateSubscriptionTicks(QueryResult* res) {
+void ClientSubscription::updateSubscriptionTicks(
+    const ClockSpec& clockAtStartOfQuery) {
   // create a new spec that will be used the next time
-  query->since_spec = std::make_unique<ClockSpec>(res->clockAtStartOfQuery);
+  query->since_spec = std::make_unique<ClockSpec>(clockAtStartOfQuery);
+}
+
+std::shared_ptr<const SharedSubscriptionResults>
+ClientSubscription::findSharedResults(
+    const std::shared_ptr<Root>& root,
+    const ClockSpec::Clock& since) {
+  auto current = root->view()->getMostRecentRootNumberAndTickValue();
+  auto sharedResults = root->sharedSubscriptionResults.wlock();
+  auto it = sharedResults->find(*sharedResultsKey);
+  if (it == sharedResults->end()) {
+    return nullptr;
+  }
+  auto results = it->second.lock();
+  if (!results) {
+    sharedResults->erase(it);
+    return nullptr;
+  }
+  // A subscription that joined since the results were produced may need
+  // fields that they weren't rendered with
+  if (!results->covers(query->fieldList)) {
+    return nullptr;
+  }
+  // The results are only the same as ours if they were evaluated since the
+  // same clock, and nothing has changed since they were evaluated
+  const auto& evaluated = results->clockAtStartOfQuery.position();
+  if (results->since.start_time != since.start_time ||
+      results->since.pid != since.pid ||
+      results->since.position.rootNumber != since.position.rootNumber ||
+      results->since.position.ticks != since.position.ticks ||
+      evaluated.rootNumber != current.rootNumber ||
+      evaluated.ticks != current.ticks) {
+    return nullptr;
+  }
+  return results;
+}
+
+QueryFieldList ClientSubscription::sharedFieldList(
+    const std::shared_ptr<Root>& root) const {
+  QueryFieldList fieldList = query->fieldList;
+  auto fields = root->sharedSubscriptionFields.rlock();
+  auto it = fields->find(*sharedResultsKey);
+  if (it != fields->end()) {
+    for (auto& [field, count] : it->second) {
+      if (std::find(fieldList.begin(), fieldList.end(), field) ==
+          fieldList.end()) {
+        fieldList.push_back(field);
+      }
+    }
+  }
+  return fieldList;
+}
+
+void ClientSubscription::publishSharedResults(
+    const std::shared_ptr<Root>& root,
+    const std::shared_ptr<const SharedSubscriptionResults>& results) {
+  auto sharedResults = root->sharedSubscriptionResults.wlock();
+  (*sharedResults)[*sharedResultsKey] = results;
+  // Forget the results of queries that no subscription is waiting on
+  for (auto it = sharedResults->begin(); it != sharedResults->end();) {
+    if (it->second.expired()) {
+      it = sharedResults->erase(it);
+    } else {
+      ++it;
+    }
+  }
 }
 
 std::optional<UntypedResponse> ClientSubscription::buildSubscriptionResults(
     const std::shared_ptr<Root>& root,
     ClockSpec& position,
     OnStateTransition onStateTransition) {
+  auto start = std::chrono::steady_clock::now();
+  SCOPE_EXIT {
+    root->metrics.subscriptionNotifications.record(
+        std::chrono::steady_clock::now() - start);
+  };
+
   auto since_spec = query->since_spec.get();
+  const auto* clock =
+      since_spec ? std::get_if<ClockSpec::Clock>(&since_spec->spec) : nullptr;
 
-  if (const auto* clock = since_spec
-          ? std::get_if<ClockSpec::Clock>(&since_spec->spec)
-          : nullptr) {
+  if (clock) {
     log(DBG,
         "running subscription ",
         name,
@@ -235,41 +459,87 @@ std::optional<UntypedResponse> ClientSubscription::buildSubscriptionResults(
   // We're called by the io thread, so there's little chance that the root
   // could be legitimately blocked by something else.  That means that we
   // can use a short lock_timeout
-  query->lock_timeout =
-      uint32_t(root->config.getInt("subscription_lock_timeout_ms", 100));
+  query->lock_timeout = root->options.subscriptionLockTimeoutMs;
   logf(DBG, "running subscription {} {}\n", name, fmt::ptr(this));
 
+  bool scmAwareQuery = since_spec && since_spec->hasScmParams();
+  // Many clients commonly subscribe to the same query, or to the same
+  // expression with different fields.  After a change they all ask for the
+  // results since the same clock, so only the first of them to run evaluates
+  // the query, rendering the fields that all of them need.  Source control
+  // aware results depend on more than the clock, so aren't shared.
+  bool shareable = sharedResultsKey && clock && !scmAwareQuery &&
+      !since_spec->hasSavedStateParams();
+
   try {
-    auto res = w_query_execute(query.get(), root, time_generator, getInterface);
+    std::shared_ptr<const SharedSubscriptionResults> results;
+    bool mergeBaseChanged = false;
+    if (shareable) {
+      results = findSharedResults(root, *clock);
+    }
 
-    logf(
-        DBG,
-        "subscription {} generated {} results\n",
-        name,
-        res.resultsArray.results.size());
-
-    position = res.clockAtStartOfQuery;
-
-    // An SCM operation was interleaved with the query execution. This could
-    // result in over-reporing query results. Discard our results but, do not
-    // update the clock in order to allow changes to be reported the next time
-    // the query is run.
-    bool scmAwareQuery = since_spec && since_spec->hasScmParams();
-    if (onStateTransition == OnStateTransition::DontAdvance && scmAwareQuery) {
-      if (root->stateTransCount.load() != res.stateTransCountAtStartOfQuery) {
-        log(DBG,
-            "discarding SCM aware query results, SCM activity interleaved\n");
-        return std::nullopt;
+    if (results) {
+      log(DBG,
+          "subscription ",
+          name,
+          " reused the results of another subscription\n");
+    } else {
+      QueryFieldList fieldList =
+          shareable ? sharedFieldList(root) : query->fieldList;
+      std::swap(query->fieldList, fieldList);
+      SCOPE_EXIT {
+        std::swap(query->fieldList, fieldList);
+      };
+      auto res =
+          w_query_execute(query.get(), root, time_generator, getInterface);
+
+      logf(
+          DBG,
+          "subscription {} generated {} results\n",
+          name,
+          res.resultsArray.results.size());
+
+      // An SCM operation was interleaved with the query execution. This could
+      // result in over-reporing query results. Discard our results but, do
+      // not update the clock in order to allow changes to be reported the
+      // next time the query is run.
+      if (onStateTransition == OnStateTransition::DontAdvance &&
+          scmAwareQuery) {
+        if (root->stateTransCount.load() != res.stateTransCountAtStartOfQuery) {
+          log(DBG,
+              "discarding SCM aware query results, SCM activity interleaved\n");
+          position = res.clockAtStartOfQuery;
+          return std::nullopt;
+        }
       }
+
+      mergeBaseChanged = scmAwareQuery &&
+          res.clockAtStartOfQuery.scmMergeBase !=
+              query->since_spec->scmMergeBase;
+
+      auto evaluated = std::make_shared<SharedSubscriptionResults>();
+      evaluated->since = clock ? *clock : ClockSpec::Clock{};
+      evaluated->clockAtStartOfQuery = std::move(res.clockAtStartOfQuery);
+      evaluated->isFreshInstance = res.isFreshInstance;
+      evaluated->savedStateInfo = std::move(res.savedStateInfo);
+      evaluated->fieldList = query->fieldList;
+      evaluated->files = std::move(res.resultsArray.results);
+      results = std::move(evaluated);
+      if (shareable) {
+        publishSharedResults(root, results);
+      }
+    }
+    if (shareable) {
+      lastSharedResults = results;
     }
 
+    position = results->clockAtStartOfQuery;
+
     // We can suppress empty results, unless this is a source code aware query
     // and the mergeBase has changed or this is a fresh instance.
-    bool mergeBaseChanged = scmAwareQuery &&
-        res.clockAtStartOfQuery.scmMergeBase != query->since_spec->scmMergeBase;
-    if (res.resultsArray.results.empty() && !mergeBaseChanged &&
-        !res.isFreshInstance) {
-      updateSubscriptionTicks(&res);
+    if (results->files.empty() && !mergeBaseChanged &&
+        !results->isFreshInstance) {
+      updateSubscriptionTicks(results->clockAtStartOfQuery);
       return std::nullopt;
     }
 
@@ -278,21 +548,29 @@ std::optional<UntypedResponse> ClientSubscription::buildSubscriptionResults(
     // It is way too much of a hassle to try to recreate the clock value if it's
     // not a relative clock spec, and it's only going to happen on the first run
     // anyway, so just skip doing that entirely.
-    if (since_spec &&
-        std::holds_alternative<ClockSpec::Clock>(since_spec->spec)) {
+    if (clock) {
       response.set("since", since_spec->toJson());
     }
-    updateSubscriptionTicks(&res);
+    if (durable) {
+      resumeSince = clock ? *since_spec : results->clockAtStartOfQuery;
+    }
+    updateSubscriptionTicks(results->clockAtStartOfQuery);
 
     response.set(
-        {{"is_fresh_instance", json_boolean(res.isFreshInstance)},
-         {"clock", res.clockAtStartOfQuery.toJson()},
-         {"files", std::move(res.resultsArray).toJson()},
+        {{"is_fresh_instance", json_boolean(results->isFreshInstance)},
+         {"clock", results->clockAtStartOfQuery.toJson()},
+         {"files", results->render(query->fieldList)},
          {"root", w_string_to_json(root->root_path)},
          {"subscription", w_string_to_json(name)},
          {"unilateral", json_true()}});
-    if (res.savedStateInfo) {
-      response.set({{"saved-state-info", std::move(*res.savedStateInfo)}});
+    if (results->savedStateInfo) {
+      response.set({{"saved-state-info", json_ref(*results->savedStateInfo)}});
+    }
+    if (root->adaptive_settle) {
+      response.set(
+          "settle_period",
+          json_integer(
+              root->adaptive_settle_ms.load(std::memory_order_relaxed)));
     }
 
     return response;
@@ -312,6 +590,12 @@ ClockSpec ClientSubscription::runSubscriptionRules(
 
   if (response) {
     add_root_warnings_to_response(*response, root);
+    if (settledChange) {
+      if (reportChangeTimes) {
+        response->set("change_times", settledChange->asJsonValue());
+      }
+      undeliveredChange = settledChange;
+    }
     client->enqueueResponse(std::move(*response));
   }
   return position;
@@ -492,6 +776,18 @@ static UntypedResponse cmd_subscribe(Client* clientbase, const json_ref& args) {
   auto query = parseQuery(root, query_spec);
   query->clientPid = client->stm ? client->stm->getPeerProcessID() : 0;
   query->subscriptionName = json_to_w_string(jname);
+  if (query->limit) {
+    // Each update must report every change since the last one
+    throw ErrorResponse(
+        "limit and exists_only can't be used with subscriptions");
+  }
+  if (query->pageSize || query->pageCursor) {
+    throw ErrorResponse(
+        "page_size and page_token can't be used with subscriptions");
+  }
+  if (query->aggregate) {
+    throw ErrorResponse("aggregate can't be used with subscriptions");
+  }
 
   auto defer_list = query_spec.get_optional("defer");
   if (defer_list && !defer_list->isArray()) {
@@ -515,7 +811,7 @@ static UntypedResponse cmd_subscribe(Client* clientbase, const json_ref& args) {
   // Check for duplicate subscription names. We do this early because
   // constructing a ClientSubscription with a duplicate name isn't safe.
   if (mapContainsAny(client->subscriptions, sub_name)) {
-    if (root->config.getBool("enforce_unique_subscription_names", false)) {
+    if (root->options.enforceUniqueSubscriptionNames) {
       throw ErrorResponse("subscription name '{}' is not unique", sub_name);
     }
     log(ERR, "clobbering existing subscription '", sub_name, "'\n");
@@ -530,6 +826,8 @@ static UntypedResponse cmd_subscribe(Client* clientbase, const json_ref& args) {
 
   sub->name = std::move(sub_name);
   sub->query = query;
+  sub->setSharedResultsKey(QueryResultCache::subscriptionKeyFor(query.get()));
+  sub->setScopes(computeSubscriptionScopes(*root, *query));
 
   auto defer = query_spec.get_default("defer_vcs", json_true());
   if (!defer.isBool()) {
@@ -537,6 +835,33 @@ static UntypedResponse cmd_subscribe(Client* clientbase, const json_ref& args) {
   }
   sub->vcs_defer = defer.asBool();
 
+  auto durable = query_spec.get_default("durable", json_false());
+  if (!durable.isBool()) {
+    throw ErrorResponse("durable must be boolean");
+  }
+  sub->durable = durable.asBool();
+
+  auto changeTimes = query_spec.get_default("change_times", json_false());
+  if (!changeTimes.isBool()) {
+    throw ErrorResponse("change_times must be boolean");
+  }
+  sub->reportChangeTimes = changeTimes.asBool();
+  if (sub->durable) {
+    bool resumed = false;
+    if (!query->since_spec) {
+      auto clocks = root->durableSubscriptionClocks.rlock();
+      auto it = clocks->find(sub->name);
+      if (it != clocks->end()) {
+        query->since_spec = std::make_shared<ClockSpec>(it->second);
+        resumed = true;
+      }
+    }
+    if (query->since_spec) {
+      sub->resumeSince = *query->since_spec;
+    }
+    resp.set("resumed", json_boolean(resumed));
+  }
+
   if (defer_array) {
     for (auto& elt : *defer_array) {
       sub->drop_or_defer[json_to_w_string(elt)] = false;
@@ -80,6 +80,7 @@ static UntypedResponse cmd_trigger_list(Client* client, const json_ref& args) {
   auto arr = root->triggerListToJson();
 
   resp.set("triggers", std::move(arr));
+  resp.set("stats", root->triggerStatsToJson());
   return resp;
 }
 W_CMD_REG("trigger-list", cmd_trigger_list, CMD_DAEMON, w_cmd_realpath_root);
@@ -190,6 +191,7 @@ static UntypedResponse cmd_trigger(Client* client, const json_ref& args) {
   return resp;
 }
 W_CMD_REG("trigger", cmd_trigger, CMD_DAEMON, w_cmd_realpath_root);
+W_CAP_REG("trigger-persistent")
 
 /* vim:ts=2:sw=2:et:
  */
@@ -11,6 +11,9 @@
 #include "watchman/Errors.h"
 #include "watchman/LogConfig.h"
 #include "watchman/QueryableView.h"
+#include "watchman/RootWorker.h"
+#include "watchman/WatchmanConfig.h"
+#include "watchman/fs/FileSystem.h"
 #include "watchman/root/Root.h"
 #include "watchman/root/watchlist.h"
 #include "watchman/watchman_cmd.h"
@@ -116,11 +119,62 @@ static UntypedResponse cmd_watch_delete(Client* client, const json_ref& args) {
 }
 W_CMD_REG("watch-del", cmd_watch_delete, CMD_DAEMON, w_cmd_realpath_root);
 
+/* export-view /root /path/to/snapshot
+ * Writes the root's view to a snapshot that another daemon, watching a copy
+ * of the same tree, can seed its view from with view_snapshot_seed */
+static UntypedResponse cmd_export_view(Client* client, const json_ref& args) {
+  if (json_array_size(args) != 3) {
+    throw ErrorResponse("wrong number of arguments to 'export-view'");
+  }
+  auto path = json_string_value(args.at(2));
+  if (!path || !w_string_piece{path}.pathIsAbsolute()) {
+    throw ErrorResponse(
+        "invalid value for argument 2, expected an absolute path");
+  }
+
+  auto root = resolveRoot(client, args);
+  // The export should include everything the root has been told about
+  root->syncToNow(std::chrono::milliseconds{60000});
+
+  size_t count;
+  try {
+    count = root->view()->exportViewSnapshot(w_string{path});
+  } catch (const std::exception& exc) {
+    throw ErrorResponse(
+        "failed to export the view of {}: {}", root->root_path, exc.what());
+  }
+
+  UntypedResponse resp;
+  resp.set(
+      {{"root", w_string_to_json(root->root_path)},
+       {"path", w_string_to_json(w_string{path})},
+       {"files", json_integer(count)}});
+  return resp;
+}
+W_CMD_REG("export-view", cmd_export_view, CMD_DAEMON, w_cmd_realpath_root);
+
+// With root_worker_processes, the roots are watched by the workers; passes
+// the command on to each of them, and adds the roots in their responses.
+static json_ref merge_worker_roots(json_ref roots, const json_ref& args) {
+  std::vector<json_ref> merged = roots.array();
+  for (auto& response : RootWorker::requestAll(args)) {
+    if (auto workerRoots = response.get_optional("roots")) {
+      for (auto& root : workerRoots->array()) {
+        merged.push_back(root);
+      }
+    }
+  }
+  return json_array(std::move(merged));
+}
+
 /* watch-del-all
  * Stops watching all roots */
-static UntypedResponse cmd_watch_del_all(Client*, const json_ref&) {
+static UntypedResponse cmd_watch_del_all(Client*, const json_ref& args) {
   UntypedResponse resp;
   auto roots = w_root_stop_watch_all();
+  if (RootWorker::enabled()) {
+    roots = merge_worker_roots(std::move(roots), args);
+  }
   resp.set("roots", std::move(roots));
   return resp;
 }
@@ -132,9 +186,12 @@ W_CMD_REG(
 
 /* watch-list
  * Returns a list of watched roots */
-static UntypedResponse cmd_watch_list(Client*, const json_ref&) {
+static UntypedResponse cmd_watch_list(Client*, const json_ref& args) {
   UntypedResponse resp;
   auto root_paths = w_root_watch_list_to_json();
+  if (RootWorker::enabled()) {
+    root_paths = merge_worker_roots(std::move(root_paths), args);
+  }
   resp.set("roots", std::move(root_paths));
   return resp;
 }
@@ -259,6 +316,38 @@ static w_string resolve_projpath(
       root_files_list);
 }
 
+// With share_nested_watches, a watch of a dir inside an existing watch
+// reuses that watch rather than crawling and watching the same files
+// again; the response then has a relative_path, as for watch-project.
+// Returns the path of the enclosing watch, or nullopt to watch the dir
+// that was asked for.
+static std::optional<w_string> resolve_nested_watch(
+    const json_ref& args,
+    w_string& relpath) {
+  if (!cfg_get_bool("share_nested_watches", false)) {
+    return std::nullopt;
+  }
+  const char* path = json_string_value(args.at(1));
+  if (!path) {
+    return std::nullopt;
+  }
+  w_string resolved;
+  try {
+    resolved = realPath(path);
+  } catch (const std::exception&) {
+    // Let root resolution report the problem
+    return std::nullopt;
+  }
+
+  w_string_piece prefix;
+  w_string_piece relpiece;
+  if (!findEnclosingRoot(resolved, prefix, relpiece) || relpiece.empty()) {
+    return std::nullopt;
+  }
+  relpath = relpiece.asWString();
+  return prefix.asWString();
+}
+
 /* watch /root */
 static UntypedResponse cmd_watch(Client* client, const json_ref& args) {
   /* resolve the root */
@@ -266,7 +355,12 @@ static UntypedResponse cmd_watch(Client* client, const json_ref& args) {
     throw ErrorResponse("wrong number of arguments to 'watch'");
   }
 
-  auto root = resolveOrCreateRoot(client, args);
+  w_string rel_path_from_watch;
+  auto enclosing = resolve_nested_watch(args, rel_path_from_watch);
+  auto root = resolveOrCreateRoot(
+      client,
+      enclosing ? json_array({args.at(0), w_string_to_json(*enclosing)})
+                : args);
   root->view()->waitUntilReadyToQuery().get();
 
   UntypedResponse resp;
@@ -282,6 +376,9 @@ static UntypedResponse cmd_watch(Client* client, const json_ref& args) {
          {"watcher", w_string_to_json(root->view()->getName())}});
   }
   add_root_warnings_to_response(resp, root);
+  if (!rel_path_from_watch.empty()) {
+    resp.set("relative_path", w_string_to_json(rel_path_from_watch));
+  }
   return resp;
 }
 W_CMD_REG(
@@ -0,0 +1,357 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+  Drives a running watchman daemon with many concurrent clients, each
+  issuing a weighted mix of clock, query and subscribe commands, and prints
+  a JSON report of the throughput and latency of each command and of the
+  CPU and memory that the daemon used meanwhile.
+
+  Build it like CLI.cpp:
+  $ LDFLAGS=$(pkg-config watchmanclient --libs) \
+      CPPFLAGS=$(pkg-config watchmanclient --cflags) \
+      make LoadGen
+
+  See watchman/docs/benchmarks.md.
+*/
+
+#include <watchman/cppclient/WatchmanClient.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <folly/String.h>
+#include <folly/executors/InlineExecutor.h>
+#include <folly/init/Init.h>
+#include <folly/io/async/ScopedEventBaseThread.h>
+#include <folly/json.h>
+#include <gflags/gflags.h>
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+DEFINE_string(root, "", "The tree to watch and query");
+DEFINE_string(sock, "", "The daemon's socket, if not the default");
+DEFINE_int32(clients, 100, "The number of concurrent client connections");
+DEFINE_int32(
+    io_threads,
+    4,
+    "The number of event base threads that the connections share");
+DEFINE_int32(duration_seconds, 30, "How long to drive the load for");
+DEFINE_string(
+    mix,
+    "clock=5,query=4,subscribe=1",
+    "The relative weights of the commands that each client picks from");
+DEFINE_string(
+    query,
+    R"({"expression": ["suffix", "txt"], "fields": ["name"]})",
+    "The query object of the query and subscribe commands");
+DEFINE_int32(
+    synthetic_files,
+    0,
+    "Creates this many files under <root>/loadgen before starting, 100 to a "
+    "directory; 0 uses the tree as it is");
+DEFINE_int32(
+    touches_per_second,
+    0,
+    "How often to modify one of the synthetic files while the load runs, "
+    "so that subscriptions have changes to deliver");
+
+using namespace watchman;
+using namespace std::chrono;
+
+namespace {
+
+enum Command { Clock, Query, Subscribe, NumCommands };
+constexpr std::array<const char*, NumCommands> kCommandNames{
+    "clock",
+    "query",
+    "subscribe"};
+
+struct Latencies {
+  // In microseconds
+  std::vector<uint32_t> samples;
+  uint64_t errors{0};
+};
+
+// The latencies seen by one client, recorded without locking
+using ClientLatencies = std::array<Latencies, NumCommands>;
+
+std::array<uint32_t, NumCommands> parseMix(const std::string& mix) {
+  std::array<uint32_t, NumCommands> weights{};
+  std::vector<std::string> terms;
+  folly::split(',', mix, terms, true);
+  for (auto& term : terms) {
+    std::string name;
+    uint32_t weight;
+    if (!folly::split('=', term, name, weight)) {
+      throw std::invalid_argument("bad --mix term: " + term);
+    }
+    auto it = std::find(kCommandNames.begin(), kCommandNames.end(), name);
+    if (it == kCommandNames.end()) {
+      throw std::invalid_argument("unknown command in --mix: " + name);
+    }
+    weights[it - kCommandNames.begin()] = weight;
+  }
+  return weights;
+}
+
+std::string syntheticPath(int32_t i) {
+  return folly::to<std::string>(
+      FLAGS_root, "/loadgen/d", i / 100, "/f", i, ".txt");
+}
+
+void createSyntheticTree() {
+  for (int32_t i = 0; i < FLAGS_synthetic_files; ++i) {
+    if (i % 100 == 0) {
+      std::filesystem::create_directories(
+          folly::to<std::string>(FLAGS_root, "/loadgen/d", i / 100));
+    }
+    std::ofstream{syntheticPath(i)} << i << '\n';
+  }
+}
+
+// The daemon's CPU time, in seconds, and resident size, in bytes, or
+// nothing where /proc can't tell us
+struct DaemonUsage {
+  double cpuSeconds{0};
+  uint64_t rssBytes{0};
+};
+
+std::optional<DaemonUsage> sampleDaemon(int64_t pid) {
+#ifdef __linux__
+  std::ifstream stat{folly::to<std::string>("/proc/", pid, "/stat")};
+  std::string line;
+  if (!std::getline(stat, line)) {
+    return std::nullopt;
+  }
+  // The fields after the command name, which may contain spaces
+  std::vector<std::string> fields;
+  folly::split(' ', line.substr(line.rfind(')') + 2), fields);
+  // utime and stime are fields 14 and 15, and rss field 24, counting from 1
+  // with the pid and command name first
+  auto ticks = sysconf(_SC_CLK_TCK);
+  DaemonUsage usage;
+  usage.cpuSeconds =
+      double(std::stoull(fields[11]) + std::stoull(fields[12])) / ticks;
+  usage.rssBytes = std::stoull(fields[21]) * sysconf(_SC_PAGESIZE);
+  return usage;
+#else
+  (void)pid;
+  return std::nullopt;
+#endif
+}
+
+folly::dynamic summarize(Latencies& latencies, double seconds) {
+  auto& samples = latencies.samples;
+  std::sort(samples.begin(), samples.end());
+  auto percentile = [&](double p) {
+    if (samples.empty()) {
+      return 0.0;
+    }
+    auto index = std::min(samples.size() - 1, size_t(p * samples.size()));
+    return samples[index] / 1000.0;
+  };
+  return folly::dynamic::object("count", samples.size())(
+             "errors", latencies.errors)("qps", samples.size() / seconds)(
+             "p50_ms", percentile(0.5))("p99_ms", percentile(0.99))(
+             "p999_ms", percentile(0.999))(
+             "max_ms", samples.empty() ? 0.0 : samples.back() / 1000.0);
+}
+
+void runClient(
+    int32_t id,
+    folly::EventBase* eventBase,
+    const std::array<uint32_t, NumCommands>& weights,
+    const folly::dynamic& query,
+    std::atomic<int32_t>& ready,
+    const std::atomic<bool>& started,
+    const std::atomic<bool>& done,
+    ClientLatencies& latencies) {
+  std::optional<std::string> sock;
+  if (!FLAGS_sock.empty()) {
+    sock = FLAGS_sock;
+  }
+  WatchmanClient client{eventBase, std::move(sock)};
+  WatchPathPtr watchPath;
+  try {
+    client.connect().get();
+    watchPath = client.watch(FLAGS_root).get();
+  } catch (const std::exception&) {
+    ++ready;
+    throw;
+  }
+  ++ready;
+  while (!started.load(std::memory_order_acquire)) {
+    std::this_thread::sleep_for(milliseconds(1));
+  }
+
+  std::mt19937 random{uint32_t(id)};
+  std::discrete_distribution<int> pick{weights.begin(), weights.end()};
+  uint64_t subscriptions = 0;
+  while (!done.load(std::memory_order_relaxed)) {
+    auto command = pick(random);
+    auto start = steady_clock::now();
+    try {
+      switch (command) {
+        case Clock:
+          client.getClock(watchPath).get();
+          break;
+        case Query:
+          client.query(query, watchPath).get();
+          break;
+        case Subscribe: {
+          // A subscription's cost is in setting it up and in its first
+          // result, which the flush waits for
+          auto subscription =
+              client
+                  .subscribe(
+                      query,
+                      watchPath,
+                      &folly::InlineExecutor::instance(),
+                      [](folly::Try<folly::dynamic>&&) {},
+                      folly::to<std::string>(
+                          "loadgen-", id, "-", subscriptions++))
+                  .get();
+          client.flushSubscription(subscription, seconds(60)).get();
+          client.unsubscribe(subscription).get();
+          break;
+        }
+      }
+      latencies[command].samples.push_back(uint32_t(
+          duration_cast<microseconds>(steady_clock::now() - start).count()));
+    } catch (const std::exception&) {
+      ++latencies[command].errors;
+    }
+  }
+  client.close();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  folly::init(&argc, &argv);
+  if (FLAGS_root.empty()) {
+    std::cerr << "--root is required" << std::endl;
+    return 1;
+  }
+  auto weights = parseMix(FLAGS_mix);
+  auto query = folly::parseJson(FLAGS_query);
+
+  if (FLAGS_synthetic_files > 0) {
+    createSyntheticTree();
+  }
+
+  std::vector<std::unique_ptr<folly::ScopedEventBaseThread>> ioThreads;
+  for (int32_t i = 0; i < std::max(1, FLAGS_io_threads); ++i) {
+    ioThreads.push_back(std::make_unique<folly::ScopedEventBaseThread>());
+  }
+
+  // Ask the daemon who it is, so that its usage can be sampled
+  int64_t pid = 0;
+  {
+    std::optional<std::string> sock;
+    if (!FLAGS_sock.empty()) {
+      sock = FLAGS_sock;
+    }
+    WatchmanClient client{ioThreads[0]->getEventBase(), std::move(sock)};
+    client.connect().get();
+    pid = client.run(folly::dynamic::array("get-pid")).get()["pid"].asInt();
+    client.close();
+  }
+
+  // The clients connect before the clock starts
+  std::atomic<int32_t> ready{0};
+  std::atomic<bool> started{false};
+  std::atomic<bool> done{false};
+  std::vector<ClientLatencies> latencies(FLAGS_clients);
+  std::vector<std::thread> clients;
+  for (int32_t i = 0; i < FLAGS_clients; ++i) {
+    clients.emplace_back([&, i] {
+      try {
+        runClient(
+            i,
+            ioThreads[i % ioThreads.size()]->getEventBase(),
+            weights,
+            query,
+            ready,
+            started,
+            done,
+            latencies[i]);
+      } catch (const std::exception& exc) {
+        std::cerr << "client " << i << " failed: " << exc.what() << std::endl;
+      }
+    });
+  }
+
+  while (ready.load() < FLAGS_clients) {
+    std::this_thread::sleep_for(milliseconds(10));
+  }
+
+  auto before = sampleDaemon(pid);
+  auto start = steady_clock::now();
+  started.store(true, std::memory_order_release);
+  uint64_t maxRss = before ? before->rssBytes : 0;
+  int32_t touched = 0;
+  while (steady_clock::now() - start < seconds(FLAGS_duration_seconds)) {
+    std::this_thread::sleep_for(milliseconds(100));
+    for (int32_t i = 0; i < FLAGS_touches_per_second / 10 &&
+         FLAGS_synthetic_files > 0;
+         ++i) {
+      std::ofstream{syntheticPath(touched++ % FLAGS_synthetic_files)}
+          << touched << '\n';
+    }
+    if (auto usage = sampleDaemon(pid)) {
+      maxRss = std::max(maxRss, usage->rssBytes);
+    }
+  }
+  done.store(true, std::memory_order_relaxed);
+  for (auto& client : clients) {
+    client.join();
+  }
+  double elapsed = duration<double>(steady_clock::now() - start).count();
+  auto after = sampleDaemon(pid);
+
+  folly::dynamic commands = folly::dynamic::object;
+  uint64_t total = 0;
+  for (size_t command = 0; command < NumCommands; ++command) {
+    Latencies merged;
+    for (auto& client : latencies) {
+      auto& samples = client[command].samples;
+      merged.samples.insert(
+          merged.samples.end(), samples.begin(), samples.end());
+      merged.errors += client[command].errors;
+    }
+    total += merged.samples.size();
+    commands[kCommandNames[command]] = summarize(merged, elapsed);
+  }
+
+  folly::dynamic daemon = folly::dynamic::object("pid", pid);
+  if (before && after) {
+    auto cpuSeconds = after->cpuSeconds - before->cpuSeconds;
+    daemon["cpu_seconds"] = cpuSeconds;
+    daemon["cpu_cores"] = cpuSeconds / elapsed;
+    daemon["max_rss_bytes"] = maxRss;
+  }
+
+  auto report = folly::dynamic::object("clients", FLAGS_clients)(
+      "mix", FLAGS_mix)("elapsed_seconds", elapsed)(
+      "qps", total / elapsed)("commands", std::move(commands))(
+      "daemon", std::move(daemon));
+  std::cout << folly::toPrettyJson(report) << std::endl;
+  return 0;
+}
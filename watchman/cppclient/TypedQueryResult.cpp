@@ -0,0 +1,552 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "TypedQueryResult.h"
+
+#include <cstring>
+
+#include <fmt/core.h>
+
+#include "WatchmanConnection.h"
+
+namespace watchman {
+
+using namespace folly;
+
+namespace {
+
+constexpr uint8_t kArray = 0x00;
+constexpr uint8_t kObject = 0x01;
+constexpr uint8_t kBytestring = 0x02;
+constexpr uint8_t kInt8 = 0x03;
+constexpr uint8_t kInt16 = 0x04;
+constexpr uint8_t kInt32 = 0x05;
+constexpr uint8_t kInt64 = 0x06;
+constexpr uint8_t kReal = 0x07;
+constexpr uint8_t kTrue = 0x08;
+constexpr uint8_t kFalse = 0x09;
+constexpr uint8_t kNull = 0x0a;
+constexpr uint8_t kTemplate = 0x0b;
+constexpr uint8_t kSkip = 0x0c;
+constexpr uint8_t kUtf8string = 0x0d;
+
+// Reads BSER values in place from a contiguous PDU.  Integers are in the
+// host byte order, as the server encodes them.
+class BserReader {
+ public:
+  BserReader(const uint8_t* data, size_t len) : pos_(data), end_(data + len) {}
+
+  // Skips the PDU header, leaving the reader at the start of its value
+  void readHeader() {
+    need(2);
+    if (pos_[0] != 0 || (pos_[1] != 1 && pos_[1] != 2)) {
+      throw WatchmanError("invalid BSER header");
+    }
+    bool v2 = pos_[1] == 2;
+    pos_ += 2;
+    if (v2) {
+      // The capabilities precede the length
+      need(4);
+      pos_ += 4;
+    }
+    auto len = readInt();
+    if (len < 0 || size_t(len) > size_t(end_ - pos_)) {
+      throw WatchmanError("truncated BSER PDU");
+    }
+    end_ = pos_ + len;
+  }
+
+  uint8_t peek() {
+    need(1);
+    return *pos_;
+  }
+
+  uint8_t next() {
+    need(1);
+    return *pos_++;
+  }
+
+  int64_t readInt() {
+    return readIntOfType(next());
+  }
+
+  int64_t readIntOfType(uint8_t type) {
+    switch (type) {
+      case kInt8:
+        return readRaw<int8_t>();
+      case kInt16:
+        return readRaw<int16_t>();
+      case kInt32:
+        return readRaw<int32_t>();
+      case kInt64:
+        return readRaw<int64_t>();
+      default:
+        throw WatchmanError(
+            fmt::format("expected a BSER integer, found type {}", type));
+    }
+  }
+
+  double readReal() {
+    return readRaw<double>();
+  }
+
+  std::string_view readStringOfType(uint8_t type) {
+    if (type != kBytestring && type != kUtf8string) {
+      throw WatchmanError(
+          fmt::format("expected a BSER string, found type {}", type));
+    }
+    auto len = readInt();
+    if (len < 0) {
+      throw WatchmanError("negative BSER string length");
+    }
+    need(len);
+    std::string_view str{reinterpret_cast<const char*>(pos_), size_t(len)};
+    pos_ += len;
+    return str;
+  }
+
+  std::string_view readString() {
+    return readStringOfType(next());
+  }
+
+  // Reads the count of an array or object whose type byte was consumed
+  size_t readCount() {
+    auto count = readInt();
+    if (count < 0) {
+      throw WatchmanError("negative BSER container size");
+    }
+    return count;
+  }
+
+  void skipOfType(uint8_t type) {
+    switch (type) {
+      case kArray:
+        for (auto n = readCount(); n > 0; --n) {
+          skip();
+        }
+        return;
+      case kObject:
+        for (auto n = readCount(); n > 0; --n) {
+          readString();
+          skip();
+        }
+        return;
+      case kBytestring:
+      case kUtf8string:
+        readStringOfType(type);
+        return;
+      case kInt8:
+      case kInt16:
+      case kInt32:
+      case kInt64:
+        readIntOfType(type);
+        return;
+      case kReal:
+        readReal();
+        return;
+      case kTrue:
+      case kFalse:
+      case kNull:
+      case kSkip:
+        return;
+      case kTemplate: {
+        expect(kArray);
+        auto keys = readCount();
+        for (auto n = keys; n > 0; --n) {
+          readString();
+        }
+        for (auto rows = readCount(); rows > 0; --rows) {
+          for (auto n = keys; n > 0; --n) {
+            skip();
+          }
+        }
+        return;
+      }
+      default:
+        throw WatchmanError(fmt::format("unknown BSER type {}", type));
+    }
+  }
+
+  void skip() {
+    skipOfType(next());
+  }
+
+  dynamic readDynamicOfType(uint8_t type) {
+    switch (type) {
+      case kArray: {
+        auto arr = dynamic::array();
+        for (auto n = readCount(); n > 0; --n) {
+          arr.push_back(readDynamic());
+        }
+        return arr;
+      }
+      case kObject: {
+        auto obj = dynamic::object();
+        for (auto n = readCount(); n > 0; --n) {
+          auto key = readString();
+          obj.insert(std::string{key}, readDynamic());
+        }
+        return obj;
+      }
+      case kBytestring:
+      case kUtf8string:
+        return std::string{readStringOfType(type)};
+      case kInt8:
+      case kInt16:
+      case kInt32:
+      case kInt64:
+        return readIntOfType(type);
+      case kReal:
+        return readReal();
+      case kTrue:
+        return true;
+      case kFalse:
+        return false;
+      case kNull:
+        return nullptr;
+      case kTemplate: {
+        expect(kArray);
+        std::vector<std::string> keys;
+        for (auto n = readCount(); n > 0; --n) {
+          keys.emplace_back(readString());
+        }
+        auto arr = dynamic::array();
+        for (auto rows = readCount(); rows > 0; --rows) {
+          auto obj = dynamic::object();
+          for (auto& key : keys) {
+            if (peek() == kSkip) {
+              ++pos_;
+            } else {
+              obj.insert(key, readDynamic());
+            }
+          }
+          arr.push_back(std::move(obj));
+        }
+        return arr;
+      }
+      default:
+        throw WatchmanError(fmt::format("unknown BSER type {}", type));
+    }
+  }
+
+  dynamic readDynamic() {
+    return readDynamicOfType(next());
+  }
+
+  void expect(uint8_t type) {
+    auto actual = next();
+    if (actual != type) {
+      throw WatchmanError(fmt::format(
+          "expected BSER type {}, found type {}", type, actual));
+    }
+  }
+
+ private:
+  void need(int64_t len) {
+    if (len > end_ - pos_) {
+      throw WatchmanError("truncated BSER PDU");
+    }
+  }
+
+  template <typename T>
+  T readRaw() {
+    need(sizeof(T));
+    T value;
+    memcpy(&value, pos_, sizeof(T));
+    pos_ += sizeof(T);
+    return value;
+  }
+
+  const uint8_t* pos_;
+  const uint8_t* end_;
+};
+
+} // namespace
+
+// Fills in the columns of a TypedQueryResult from its files
+class TypedResultDecoder {
+ public:
+  TypedResultDecoder(TypedQueryResult& result, BserReader& reader)
+      : result_(result), reader_(reader) {}
+
+  void decodeFiles() {
+    auto type = reader_.next();
+    if (type == kTemplate) {
+      decodeTemplate();
+    } else if (type == kArray) {
+      decodeArray();
+    } else {
+      throw WatchmanError(
+          fmt::format("expected an array of files, found type {}", type));
+    }
+  }
+
+ private:
+  void reserve(size_t size) {
+    for (auto& column : result_.columns_) {
+      column.present.reserve(size);
+      switch (column.type) {
+        case FieldType::String:
+          column.strings.reserve(size);
+          break;
+        case FieldType::Integer:
+        case FieldType::Boolean:
+          column.integers.reserve(size);
+          break;
+        case FieldType::Real:
+          column.reals.reserve(size);
+          break;
+      }
+    }
+  }
+
+  // Appends a value that the file doesn't have
+  void appendAbsent(TypedQueryResult::Column& column) {
+    column.present.push_back(false);
+    switch (column.type) {
+      case FieldType::String:
+        column.strings.emplace_back();
+        break;
+      case FieldType::Integer:
+      case FieldType::Boolean:
+        column.integers.push_back(0);
+        break;
+      case FieldType::Real:
+        column.reals.push_back(0);
+        break;
+    }
+  }
+
+  // Reads the next value into column, or marks it absent if it isn't of
+  // the column's type
+  void appendValue(TypedQueryResult::Column& column) {
+    auto type = reader_.next();
+    switch (column.type) {
+      case FieldType::String:
+        if (type == kBytestring || type == kUtf8string) {
+          column.strings.push_back(reader_.readStringOfType(type));
+          column.present.push_back(true);
+          return;
+        }
+        break;
+      case FieldType::Integer:
+        if (type >= kInt8 && type <= kInt64) {
+          column.integers.push_back(reader_.readIntOfType(type));
+          column.present.push_back(true);
+          return;
+        }
+        break;
+      case FieldType::Real:
+        if (type == kReal) {
+          column.reals.push_back(reader_.readReal());
+          column.present.push_back(true);
+          return;
+        }
+        break;
+      case FieldType::Boolean:
+        if (type == kTrue || type == kFalse) {
+          column.integers.push_back(type == kTrue);
+          column.present.push_back(true);
+          return;
+        }
+        break;
+    }
+    reader_.skipOfType(type);
+    appendAbsent(column);
+  }
+
+  void decodeTemplate() {
+    reader_.expect(kArray);
+    // The column that each key of the template fills in, if any
+    std::vector<TypedQueryResult::Column*> columns;
+    for (auto n = reader_.readCount(); n > 0; --n) {
+      auto index = result_.fieldIndex(reader_.readString());
+      columns.push_back(index ? &result_.columns_[*index] : nullptr);
+    }
+    auto rows = reader_.readCount();
+    reserve(rows);
+    for (size_t row = 0; row < rows; ++row) {
+      for (auto* column : columns) {
+        if (!column) {
+          reader_.skip();
+        } else if (reader_.peek() == kSkip) {
+          reader_.next();
+          appendAbsent(*column);
+        } else {
+          appendValue(*column);
+        }
+      }
+      fillMissing(row + 1);
+    }
+    result_.size_ = rows;
+  }
+
+  void decodeArray() {
+    auto rows = reader_.readCount();
+    reserve(rows);
+    for (size_t row = 0; row < rows; ++row) {
+      auto type = reader_.peek();
+      if (type == kObject) {
+        reader_.next();
+        for (auto n = reader_.readCount(); n > 0; --n) {
+          auto index = result_.fieldIndex(reader_.readString());
+          auto* column = index ? &result_.columns_[*index] : nullptr;
+          // Ignore unrequested and repeated keys
+          if (!column || column->present.size() > row) {
+            reader_.skip();
+          } else {
+            appendValue(*column);
+          }
+        }
+      } else if (result_.columns_.size() == 1) {
+        // A query for a single field yields an array of its values
+        appendValue(result_.columns_[0]);
+      } else {
+        throw WatchmanError(
+            fmt::format("expected a file object, found type {}", type));
+      }
+      fillMissing(row + 1);
+    }
+    result_.size_ = rows;
+  }
+
+  // Pads every column that the file didn't mention up to rows values
+  void fillMissing(size_t rows) {
+    for (auto& column : result_.columns_) {
+      if (column.present.size() < rows) {
+        appendAbsent(column);
+      }
+    }
+  }
+
+  TypedQueryResult& result_;
+  BserReader& reader_;
+};
+
+FieldType fieldTypeOf(std::string_view name) {
+  if (name == "exists" || name == "new") {
+    return FieldType::Boolean;
+  }
+  if (name == "size" || name == "mode" || name == "uid" || name == "gid" ||
+      name == "ino" || name == "dev" || name == "nlink") {
+    return FieldType::Integer;
+  }
+  // atime, mtime_ms, ctime_f and so on
+  if (name.size() >= 5 && name.substr(1, 4) == "time" &&
+      (name[0] == 'a' || name[0] == 'm' || name[0] == 'c')) {
+    auto suffix = name.substr(5);
+    if (suffix == "_f") {
+      return FieldType::Real;
+    }
+    if (suffix.empty() || suffix == "_ms" || suffix == "_us" ||
+        suffix == "_ns") {
+      return FieldType::Integer;
+    }
+  }
+  return FieldType::String;
+}
+
+TypedQueryResult TypedQueryResult::parse(
+    std::unique_ptr<IOBuf> pdu,
+    std::vector<std::string> fields) {
+  TypedQueryResult result;
+  // The string views point into the buffer, so it must be contiguous
+  pdu->coalesce();
+  result.buf_ = std::move(pdu);
+  result.fields_ = std::move(fields);
+  for (auto& field : result.fields_) {
+    result.columns_.push_back(Column{fieldTypeOf(field), {}, {}, {}, {}});
+  }
+
+  BserReader reader{result.buf_->data(), result.buf_->length()};
+  reader.readHeader();
+  reader.expect(kObject);
+  for (auto n = reader.readCount(); n > 0; --n) {
+    auto key = reader.readString();
+    if (key == "files") {
+      TypedResultDecoder{result, reader}.decodeFiles();
+    } else {
+      result.response_.insert(std::string{key}, reader.readDynamic());
+    }
+  }
+  if (result.response_.get_ptr("error")) {
+    throw WatchmanResponseError(result.response_);
+  }
+  return result;
+}
+
+std::optional<size_t> TypedQueryResult::fieldIndex(
+    std::string_view name) const {
+  for (size_t i = 0; i < fields_.size(); ++i) {
+    if (fields_[i] == name) {
+      return i;
+    }
+  }
+  return std::nullopt;
+}
+
+const std::vector<std::string_view>& TypedQueryResult::strings(
+    size_t field) const {
+  auto& column = columns_.at(field);
+  if (column.type != FieldType::String) {
+    throw WatchmanError(
+        fmt::format("{} is not a string field", fields_[field]));
+  }
+  return column.strings;
+}
+
+const std::vector<int64_t>& TypedQueryResult::integers(size_t field) const {
+  auto& column = columns_.at(field);
+  if (column.type != FieldType::Integer && column.type != FieldType::Boolean) {
+    throw WatchmanError(
+        fmt::format("{} is not an integer field", fields_[field]));
+  }
+  return column.integers;
+}
+
+const std::vector<double>& TypedQueryResult::reals(size_t field) const {
+  auto& column = columns_.at(field);
+  if (column.type != FieldType::Real) {
+    throw WatchmanError(fmt::format("{} is not a real field", fields_[field]));
+  }
+  return column.reals;
+}
+
+namespace detail {
+bool bserObjectHasKey(
+    const IOBuf& pdu,
+    std::initializer_list<std::string_view> keys) {
+  // Only copy a chained PDU, which the full decode would coalesce anyway
+  IOBuf copy;
+  if (pdu.isChained()) {
+    copy = pdu.cloneCoalescedAsValue();
+  }
+  const auto& buf = pdu.isChained() ? copy : pdu;
+  BserReader reader{buf.data(), buf.length()};
+  try {
+    reader.readHeader();
+    if (reader.next() != kObject) {
+      return false;
+    }
+    for (auto n = reader.readCount(); n > 0; --n) {
+      auto key = reader.readString();
+      for (auto& wanted : keys) {
+        if (key == wanted) {
+          return true;
+        }
+      }
+      reader.skip();
+    }
+  } catch (const WatchmanError&) {
+    // Let the full decode report the problem
+    return true;
+  }
+  return false;
+}
+} // namespace detail
+
+} // namespace watchman
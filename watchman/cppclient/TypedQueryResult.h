@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <folly/dynamic.h>
+#include <folly/io/IOBuf.h>
+
+namespace watchman {
+
+// How the values of a query field are decoded
+enum class FieldType { String, Integer, Real, Boolean };
+
+// The type that watchman renders the named field as.  Fields that this
+// client doesn't know of are assumed to be strings.
+FieldType fieldTypeOf(std::string_view name);
+
+// The files of a query result, decoded from the BSER response straight
+// into one column per requested field rather than into folly::dynamic.
+//
+// String values are views into the response buffer, which the result
+// owns, so they are valid for as long as the TypedQueryResult is.  A
+// file has no value for a field if the server omitted it, or sent a
+// value of another type, such as the error object that content.sha1hex
+// holds when the hash couldn't be computed; has() tells these apart from
+// a legitimately empty or zero value.
+class TypedQueryResult {
+ public:
+  // Decodes pdu, a complete BSER response to a query for the given
+  // fields.  Throws WatchmanError if the response is malformed.
+  static TypedQueryResult parse(
+      std::unique_ptr<folly::IOBuf> pdu,
+      std::vector<std::string> fields);
+
+  // The number of files
+  size_t size() const {
+    return size_;
+  }
+
+  const std::vector<std::string>& fields() const {
+    return fields_;
+  }
+
+  // The index of the named field in fields(), if it was requested
+  std::optional<size_t> fieldIndex(std::string_view name) const;
+
+  FieldType fieldType(size_t field) const {
+    return columns_.at(field).type;
+  }
+
+  bool has(size_t field, size_t file) const {
+    return columns_.at(field).present[file];
+  }
+
+  // The values of a field, one per file.  Each accessor must be used
+  // with fields of the matching type; Boolean fields are held as 0 or 1
+  // by integers().
+  const std::vector<std::string_view>& strings(size_t field) const;
+  const std::vector<int64_t>& integers(size_t field) const;
+  const std::vector<double>& reals(size_t field) const;
+
+  // The rest of the response, such as its clock and is_fresh_instance,
+  // without the files
+  const folly::dynamic& response() const {
+    return response_;
+  }
+
+ private:
+  struct Column {
+    FieldType type;
+    std::vector<std::string_view> strings;
+    std::vector<int64_t> integers;
+    std::vector<double> reals;
+    std::vector<bool> present;
+  };
+
+  TypedQueryResult() = default;
+
+  std::unique_ptr<folly::IOBuf> buf_;
+  std::vector<std::string> fields_;
+  std::vector<Column> columns_;
+  size_t size_{0};
+  folly::dynamic response_ = folly::dynamic::object();
+
+  friend class TypedResultDecoder;
+};
+
+namespace detail {
+// Whether pdu, a complete BSER PDU, is an object with any of keys, which
+// lets a response be routed without decoding it
+bool bserObjectHasKey(
+    const folly::IOBuf& pdu,
+    std::initializer_list<std::string_view> keys);
+} // namespace detail
+
+} // namespace watchman
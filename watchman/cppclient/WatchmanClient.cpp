@@ -128,6 +128,50 @@ SemiFuture<QueryResult> WatchmanClient::query(
           [](folly::dynamic&& res) { return QueryResult{std::move(res)}; });
 }
 
+SemiFuture<QueryResult> WatchmanClient::queryStream(
+    dynamic queryObj,
+    WatchPathPtr path,
+    std::function<void(dynamic&&)> onFiles) {
+  if (path->relativePath_) {
+    queryObj["relative_root"] = *path->relativePath_;
+  }
+  queryObj["stream"] = true;
+  return conn_
+      ->runStreaming(
+          dynamic::array("query", path->root_, std::move(queryObj)), onFiles)
+      .thenValue([onFiles](dynamic&& res) {
+        // A server that doesn't support streaming sends all of the files
+        // in its response
+        if (auto* files = res.get_ptr("files")) {
+          onFiles(std::move(*files));
+          res.erase("files");
+        }
+        return QueryResult{std::move(res)};
+      });
+}
+
+SemiFuture<TypedQueryResult> WatchmanClient::queryTyped(
+    dynamic queryObj,
+    WatchPathPtr path) {
+  if (path->relativePath_) {
+    queryObj["relative_root"] = *path->relativePath_;
+  }
+  std::vector<std::string> fields;
+  if (auto* requested = queryObj.get_ptr("fields")) {
+    for (auto& field : *requested) {
+      fields.push_back(field.asString());
+    }
+  } else {
+    fields = {"name", "exists", "new", "size", "mode"};
+  }
+  return conn_
+      ->runRaw(dynamic::array("query", path->root_, std::move(queryObj)))
+      .thenValue([fields = std::move(fields)](
+                     std::unique_ptr<folly::IOBuf>&& pdu) mutable {
+        return TypedQueryResult::parse(std::move(pdu), std::move(fields));
+      });
+}
+
 SemiFuture<SubscriptionPtr> WatchmanClient::subscribe(
     dynamic query,
     WatchPathPtr path,
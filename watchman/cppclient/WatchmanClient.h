@@ -60,6 +60,7 @@
  *  client.close();
  */
 
+#include "TypedQueryResult.h"
 #include "WatchmanConnection.h"
 
 #include <chrono>
@@ -205,6 +206,29 @@ struct WatchmanClient {
       folly::dynamic queryObj,
       WatchPathPtr path);
 
+  /**
+   * Like query(), but has the matching files sent in batches rather than in
+   * a single response, so that large result sets needn't be held in memory
+   * all at once.  onFiles is called, via the executor passed to the
+   * constructor, with the array of files in each batch as it is received.
+   * The result holds the final response of the query, such as its clock and
+   * is_fresh_instance, but not the files.
+   */
+  folly::SemiFuture<QueryResult> queryStream(
+      folly::dynamic queryObj,
+      WatchPathPtr path,
+      std::function<void(folly::dynamic&&)> onFiles);
+
+  /**
+   * Like query(), but decodes the files straight from the BSER response
+   * into a column per field, without building a folly::dynamic for each
+   * file.  The fields are those of queryObj["fields"], or the server's
+   * defaults if it has none.
+   */
+  folly::SemiFuture<TypedQueryResult> queryTyped(
+      folly::dynamic queryObj,
+      WatchPathPtr path);
+
   /**
    * Establishes a subscription that will trigger callback (via your specified
    * executor) whenever matching files change.
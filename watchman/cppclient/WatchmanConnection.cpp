@@ -6,7 +6,9 @@
  */
 
 #include "WatchmanConnection.h"
+#include "TypedQueryResult.h"
 
+#include <algorithm>
 #include <cstdlib>
 
 #include <fmt/core.h>
@@ -35,6 +37,7 @@ static const std::vector<dynamic> kUnilateralLabels{"subscription", "log"};
 
 static const dynamic kError("error");
 static const dynamic kCapabilities("capabilities");
+static const dynamic kPipelining("pipelining");
 
 // We'll just dispatch bser decodes and callbacks inline unless they
 // give us an alternative environment
@@ -120,6 +123,13 @@ Future<dynamic> WatchmanConnection::connect(folly::dynamic versionArgs) {
   if (!versionArgs.isObject()) {
     throw WatchmanError("versionArgs must be object");
   }
+  // Pipeline commands if the server can take more than one at a time
+  auto& optional = versionArgs.setDefault("optional", dynamic::array());
+  if (optional.isArray() &&
+      std::find(optional.begin(), optional.end(), kPipelining) ==
+          optional.end()) {
+    optional.push_back(kPipelining);
+  }
   versionCmd_ = folly::dynamic::array("version", versionArgs);
 
   auto res = getSockPath().thenValue(
@@ -184,6 +194,9 @@ void WatchmanConnection::connectSuccess() noexcept {
                 shared_this->watchmanResponseToTry(std::move(result)));
             return;
           }
+          auto* pipelining = result[kCapabilities].get_ptr(kPipelining);
+          shared_this->pipelining_ = pipelining && pipelining->isBool() &&
+              pipelining->getBool();
           shared_this->connectPromise_.setValue(std::move(result));
         })
         .thenError(
@@ -204,14 +217,47 @@ void WatchmanConnection::connectErr(
 WatchmanConnection::QueuedCommand::QueuedCommand(const dynamic& command)
     : cmd(command) {}
 
+void WatchmanConnection::QueuedCommand::fail(const exception_wrapper& ex) {
+  if (rawPromise) {
+    if (!rawPromise->isFulfilled()) {
+      rawPromise->setException(ex);
+    }
+  } else if (!promise.isFulfilled()) {
+    promise.setException(ex);
+  }
+}
+
 Future<dynamic> WatchmanConnection::run(const dynamic& command) noexcept {
+  return queueCommand(std::make_shared<QueuedCommand>(command));
+}
+
+Future<dynamic> WatchmanConnection::runStreaming(
+    const dynamic& command,
+    StreamCallback onFiles) noexcept {
+  auto cmd = std::make_shared<QueuedCommand>(command);
+  cmd->onFiles = std::move(onFiles);
+  return queueCommand(std::move(cmd));
+}
+
+Future<std::unique_ptr<IOBuf>> WatchmanConnection::runRaw(
+    const dynamic& command) noexcept {
   auto cmd = std::make_shared<QueuedCommand>(command);
+  cmd->rawPromise.emplace();
+  auto future = cmd->rawPromise->getFuture();
+  // Nothing fulfils the dynamic promise of a raw command
+  (void)queueCommand(std::move(cmd));
+  return future;
+}
+
+Future<dynamic> WatchmanConnection::queueCommand(
+    std::shared_ptr<QueuedCommand> cmd) noexcept {
   if (broken_) {
-    cmd->promise.setException(WatchmanError("The connection was broken"));
+    cmd->fail(
+        make_exception_wrapper<WatchmanError>("The connection was broken"));
     return cmd->promise.getFuture();
   }
   if (!sock_) {
-    cmd->promise.setException(WatchmanError(
+    cmd->fail(make_exception_wrapper<WatchmanError>(
         "No socket (did you call connect() and check result for exceptions?)"));
     return cmd->promise.getFuture();
   }
@@ -219,10 +265,10 @@ Future<dynamic> WatchmanConnection::run(const dynamic& command) noexcept {
   bool shouldWrite;
   {
     std::lock_guard<std::mutex> g(mutex_);
-    // We only need to call sendCommand if we don't have a command in
-    // progress; the completion handler will trigger it once we receive
-    // the response
-    shouldWrite = commandQ_.empty();
+    // Unless we are pipelining, we only need to call sendCommand if we
+    // don't have a command in progress; the completion handler will
+    // trigger it once we receive the response
+    shouldWrite = pipelining_ || commandQ_.empty();
     commandQ_.push_back(cmd);
   }
 
@@ -239,12 +285,11 @@ void WatchmanConnection::failQueuedCommands(folly::exception_wrapper&& ex) {
   std::lock_guard<std::mutex> g(mutex_);
   auto q = commandQ_;
   commandQ_.clear();
+  numSent_ = 0;
 
   broken_ = true;
   for (auto& cmd : q) {
-    if (!cmd->promise.isFulfilled()) {
-      cmd->promise.setException(ex);
-    }
+    cmd->fail(ex);
   }
 
   // If the user has explicitly closed the connection no need for callback
@@ -259,29 +304,43 @@ void WatchmanConnection::failQueuedCommands(folly::exception_wrapper&& ex) {
   }
 }
 
-// Sends the next eligible command to the Watchman service
-void WatchmanConnection::sendCommand(bool pop) {
-  std::shared_ptr<QueuedCommand> cmd;
+// Sends the eligible commands to the Watchman service: the next one, or
+// when pipelining, all that haven't been sent yet.  This only runs on the
+// event base thread, so the commands are written in the order that they
+// were queued, which is the order that the server responds to them in.
+void WatchmanConnection::sendCommand() {
+  if (!sock_) {
+    // Closed since this was scheduled
+    return;
+  }
+  std::vector<std::shared_ptr<QueuedCommand>> cmds;
 
   {
     std::lock_guard<std::mutex> g(mutex_);
-
-    if (pop) {
-      // We finished processing this one, discard it and focus
-      // on the next item, if any.
-      commandQ_.pop_front();
-    }
-    if (commandQ_.empty()) {
-      return;
+    auto limit = pipelining_ ? commandQ_.size()
+                             : std::min<size_t>(commandQ_.size(), 1);
+    for (; numSent_ < limit; ++numSent_) {
+      cmds.push_back(commandQ_[numSent_]);
     }
-    cmd = commandQ_.front();
   }
 
-  sock_->writeChain(this, toBserIOBuf(cmd->cmd, serialization_opts()));
+  for (auto& cmd : cmds) {
+    sock_->writeChain(this, toBserIOBuf(cmd->cmd, serialization_opts()));
+  }
 }
 
 void WatchmanConnection::popAndSendCommand() {
-  sendCommand(/* pop = */ true);
+  {
+    std::lock_guard<std::mutex> g(mutex_);
+    // We finished processing this one, discard it and focus
+    // on the next item, if any.
+    if (!commandQ_.empty()) {
+      commandQ_.pop_front();
+      --numSent_;
+    }
+  }
+  eventBase_->runInEventBaseThread(
+      [shared_this = shared_from_this()] { shared_this->sendCommand(); });
 }
 
 // Called when AsyncSocket::writeChain completes
@@ -364,6 +423,25 @@ void WatchmanConnection::decodeNextResponse() {
     }
 
     try {
+      // Hand the responses of raw commands over undecoded, unless they
+      // are unilateral or errors, which are dispatched as usual below
+      std::shared_ptr<QueuedCommand> rawCmd;
+      {
+        std::lock_guard<std::mutex> g(mutex_);
+        if (!commandQ_.empty() && commandQ_.front()->rawPromise) {
+          rawCmd = commandQ_.front();
+        }
+      }
+      if (rawCmd) {
+        pdu->coalesce();
+        if (!detail::bserObjectHasKey(
+                *pdu, {"subscription", "log", "error"})) {
+          rawCmd->rawPromise->setValue(std::move(pdu));
+          popAndSendCommand();
+          continue;
+        }
+      }
+
       auto decoded = parseBser(pdu.get());
 
       bool is_unilateral = false;
@@ -399,9 +477,31 @@ void WatchmanConnection::decodeNextResponse() {
         cmd = commandQ_.front();
       }
 
+      // The PDUs of a streaming query that precede its final response
+      // hold its header and batches of files
+      if (cmd->onFiles) {
+        auto* kind = decoded.get_ptr("stream");
+        if (kind && kind->isString() && *kind != "trailer" &&
+            !decoded.get_ptr("error")) {
+          if (auto* files = decoded.get_ptr("files")) {
+            (*cmd->onFiles)(std::move(*files));
+          }
+          continue;
+        }
+      }
+
       // Dispatch outside of the lock in case it tries to send another
       // command
-      cmd->promise.setTry(watchmanResponseToTry(std::move(decoded)));
+      if (cmd->rawPromise) {
+        auto result = watchmanResponseToTry(std::move(decoded));
+        cmd->fail(
+            result.hasException()
+                ? result.exception()
+                : make_exception_wrapper<WatchmanError>(
+                      "Unexpected response to a raw command"));
+      } else {
+        cmd->promise.setTry(watchmanResponseToTry(std::move(decoded)));
+      }
 
       // Now we're in a position to send the next queued command.
       // We remove it after dispatching the try above in case that
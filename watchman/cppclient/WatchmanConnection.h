@@ -47,6 +47,7 @@ class WatchmanConnection
       public std::enable_shared_from_this<WatchmanConnection> {
  public:
   using Callback = std::function<void(folly::Try<folly::dynamic>)>;
+  using StreamCallback = std::function<void(folly::dynamic&&)>;
 
   explicit WatchmanConnection(
       folly::EventBase* eventBase,
@@ -69,9 +70,27 @@ class WatchmanConnection
           folly::dynamic::array("relative_root")));
 
   // Issue a watchman command, yielding the results at a later time.
-  // If the connection was terminated, will throw immediately
+  // If the connection was terminated, will throw immediately.
+  // If the server has the "pipelining" capability, which connect() asks
+  // for, the command is sent right away rather than once the responses to
+  // the commands before it have been received.
   folly::Future<folly::dynamic> run(const folly::dynamic& command) noexcept;
 
+  // Issue a query that has its results streamed in batches (it must set
+  // the "stream" option).  onFiles is called, via the cpuExecutor and in
+  // order, with the array of files in each batch as it is received.
+  // Yields the final response, which holds no files, at a later time.
+  folly::Future<folly::dynamic> runStreaming(
+      const folly::dynamic& command,
+      StreamCallback onFiles) noexcept;
+
+  // Issue a command and yield its response as the undecoded BSER PDU,
+  // so that the caller can decode it into something cheaper than
+  // folly::dynamic.  Error responses are still decoded, and yield a
+  // WatchmanResponseError as they do for run().
+  folly::Future<std::unique_ptr<folly::IOBuf>> runRaw(
+      const folly::dynamic& command) noexcept;
+
   // Close the connection.  All queued commands will be cancelled
   void close();
 
@@ -90,13 +109,23 @@ class WatchmanConnection
   struct QueuedCommand {
     folly::dynamic cmd;
     folly::Promise<folly::dynamic> promise;
+    // Set for commands issued by runStreaming()
+    std::optional<StreamCallback> onFiles;
+    // Set for commands issued by runRaw(), which fulfil it instead of
+    // promise
+    std::optional<folly::Promise<std::unique_ptr<folly::IOBuf>>> rawPromise;
 
     explicit QueuedCommand(const folly::dynamic& command);
+
+    void fail(const folly::exception_wrapper& ex);
   };
 
+  folly::Future<folly::dynamic> queueCommand(
+      std::shared_ptr<QueuedCommand> cmd) noexcept;
+
   folly::Future<std::string> getSockPath();
   void failQueuedCommands(folly::exception_wrapper&& ex);
-  void sendCommand(bool pop = false);
+  void sendCommand();
   void popAndSendCommand();
   void decodeNextResponse();
   folly::Try<folly::dynamic> watchmanResponseToTry(folly::dynamic&& value);
@@ -126,7 +155,13 @@ class WatchmanConnection
   folly::dynamic versionCmd_;
   std::shared_ptr<folly::AsyncSocket> sock_;
   std::mutex mutex_;
+  // The commands awaiting a response, in the order they were queued
   std::deque<std::shared_ptr<QueuedCommand>> commandQ_;
+  // How many of commandQ_, from its front, have been sent
+  size_t numSent_{0};
+  // Whether the server accepts another command before it has responded
+  // to the last, so that they needn't wait for a round trip each
+  std::atomic<bool> pipelining_{false};
   folly::IOBufQueue bufQ_{folly::IOBufQueue::cacheChainLength()};
   bool broken_{false};
   bool closing_{false};
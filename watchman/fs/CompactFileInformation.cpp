@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/fs/CompactFileInformation.h"
+#include <limits>
+#include "watchman/Logging.h"
+
+namespace watchman {
+
+namespace {
+constexpr int64_t kNanosPerSecond = 1000000000;
+
+struct LastInterned {
+  const FileOwnerTable* table{nullptr};
+  FileOwnerTable::Owner owner;
+  uint32_t index{0};
+};
+thread_local LastInterned lastInterned;
+
+// The fields of FileInformation that decide the type of the file
+FileInformation typeInformation(uint32_t mode, uint32_t fileAttributes) {
+  FileInformation info;
+  info.mode = mode_t(mode);
+#ifdef _WIN32
+  info.fileAttributes = fileAttributes;
+#else
+  (void)fileAttributes;
+#endif
+  return info;
+}
+} // namespace
+
+FileOwnerTable& FileOwnerTable::get() {
+  static FileOwnerTable table;
+  return table;
+}
+
+FileOwnerTable::FileOwnerTable() {
+  for (auto& chunk : chunks_) {
+    chunk.store(nullptr, std::memory_order_relaxed);
+  }
+  std::lock_guard<std::mutex> lock{mutex_};
+  internLocked(0, 0, 0);
+}
+
+FileOwnerTable::~FileOwnerTable() {
+  for (auto& chunk : chunks_) {
+    delete[] chunk.load(std::memory_order_relaxed);
+  }
+}
+
+uint32_t FileOwnerTable::intern(dev_t dev, uid_t uid, gid_t gid) {
+  // Almost every file of a tree has the same owner as the one before it
+  auto& last = lastInterned;
+  if (last.table == this && last.owner.dev == dev && last.owner.uid == uid &&
+      last.owner.gid == gid) {
+    return last.index;
+  }
+
+  uint32_t index;
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    index = internLocked(dev, uid, gid);
+  }
+  last.table = this;
+  last.owner = Owner{dev, uid, gid};
+  last.index = index;
+  return index;
+}
+
+uint32_t FileOwnerTable::internLocked(dev_t dev, uid_t uid, gid_t gid) {
+  auto [it, inserted] =
+      indices_.emplace(std::make_tuple(dev, uid, gid), uint32_t(0));
+  if (!inserted) {
+    return it->second;
+  }
+
+  auto index = size_.load(std::memory_order_relaxed);
+  if (index == kCapacity) {
+    indices_.erase(it);
+    if (!overflowed_) {
+      overflowed_ = true;
+      logf(
+          ERR,
+          "more than {} distinct (dev, uid, gid) triples have been seen; "
+          "changes to the owner of further files may go unnoticed\n",
+          kCapacity);
+    }
+    return 0;
+  }
+
+  auto& chunk = chunks_[index / kChunkSize];
+  auto entries = chunk.load(std::memory_order_relaxed);
+  if (!entries) {
+    entries = new Owner[kChunkSize];
+    chunk.store(entries, std::memory_order_release);
+  }
+  entries[index % kChunkSize] = Owner{dev, uid, gid};
+  it->second = index;
+  // Publishes the entry to lookup()s from other threads
+  size_.store(index + 1, std::memory_order_release);
+  return index;
+}
+
+int64_t CompactFileInformation::timespecToNs(const struct timespec& ts) {
+  constexpr int64_t maxSeconds =
+      std::numeric_limits<int64_t>::max() / kNanosPerSecond - 1;
+  int64_t seconds = int64_t(ts.tv_sec);
+  if (seconds > maxSeconds) {
+    return std::numeric_limits<int64_t>::max();
+  }
+  if (seconds < -maxSeconds) {
+    return std::numeric_limits<int64_t>::min();
+  }
+  return seconds * kNanosPerSecond + int64_t(ts.tv_nsec);
+}
+
+struct timespec CompactFileInformation::nsToTimespec(int64_t ns) {
+  int64_t seconds = ns / kNanosPerSecond;
+  int64_t nanos = ns % kNanosPerSecond;
+  // tv_nsec is never negative, even for times before the epoch
+  if (nanos < 0) {
+    nanos += kNanosPerSecond;
+    --seconds;
+  }
+  struct timespec ts;
+  ts.tv_sec = decltype(ts.tv_sec)(seconds);
+  ts.tv_nsec = decltype(ts.tv_nsec)(nanos);
+  return ts;
+}
+
+CompactFileInformation& CompactFileInformation::operator=(
+    const FileInformation& info) {
+  size_ = int64_t(info.size);
+  ino_ = uint64_t(info.ino);
+  atimeNs_ = timespecToNs(info.atime);
+  mtimeNs_ = timespecToNs(info.mtime);
+  ctimeNs_ = timespecToNs(info.ctime);
+  mode_ = uint32_t(info.mode);
+  nlink_ = info.nlink > std::numeric_limits<uint32_t>::max()
+      ? std::numeric_limits<uint32_t>::max()
+      : uint32_t(info.nlink);
+  owner_ = FileOwnerTable::get().intern(info.dev, info.uid, info.gid);
+#ifdef _WIN32
+  fileAttributes_ = info.fileAttributes;
+#endif
+  return *this;
+}
+
+FileInformation CompactFileInformation::toFileInformation() const {
+  FileInformation info;
+  info.mode = mode_t(mode_);
+  info.size = off_t(size_);
+  auto& owner = FileOwnerTable::get().lookup(owner_);
+  info.uid = owner.uid;
+  info.gid = owner.gid;
+  info.ino = ino_t(ino_);
+  info.dev = owner.dev;
+  info.nlink = nlink_t(nlink_);
+#ifdef _WIN32
+  info.fileAttributes = fileAttributes_;
+#endif
+  info.atime = atime();
+  info.mtime = mtime();
+  info.ctime = ctime();
+  return info;
+}
+
+#ifdef _WIN32
+#define FILE_ATTRIBUTES fileAttributes_
+#else
+#define FILE_ATTRIBUTES 0
+#endif
+
+DType CompactFileInformation::dtype() const {
+  return typeInformation(mode_, FILE_ATTRIBUTES).dtype();
+}
+
+bool CompactFileInformation::isSymlink() const {
+  return typeInformation(mode_, FILE_ATTRIBUTES).isSymlink();
+}
+
+bool CompactFileInformation::isDir() const {
+  return typeInformation(mode_, FILE_ATTRIBUTES).isDir();
+}
+
+bool CompactFileInformation::isFile() const {
+  return typeInformation(mode_, FILE_ATTRIBUTES).isFile();
+}
+
+#undef FILE_ATTRIBUTES
+
+} // namespace watchman
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include "watchman/fs/FileInformation.h"
+
+namespace watchman {
+
+/**
+ * Interns the (dev, uid, gid) triples of the files that the views hold, so
+ * that each file need only store a small index.  A tree typically has one
+ * device and a handful of owners, so the table stays tiny.
+ *
+ * The table is shared by all roots and entries are never removed.  Lookups
+ * don't take a lock; interning takes one only the first time that a thread
+ * sees a triple other than the one it saw last.
+ */
+class FileOwnerTable {
+ public:
+  struct Owner {
+    dev_t dev{0};
+    uid_t uid{0};
+    gid_t gid{0};
+  };
+
+  // The most distinct triples that are remembered.  Beyond that, files
+  // are recorded with index 0, which is the all-zeros triple.
+  static constexpr uint32_t kChunkSize = 1024;
+  static constexpr uint32_t kMaxChunks = 64;
+  static constexpr uint32_t kCapacity = kChunkSize * kMaxChunks;
+
+  static FileOwnerTable& get();
+
+  FileOwnerTable();
+  ~FileOwnerTable();
+  FileOwnerTable(const FileOwnerTable&) = delete;
+  FileOwnerTable& operator=(const FileOwnerTable&) = delete;
+
+  uint32_t intern(dev_t dev, uid_t uid, gid_t gid);
+
+  const Owner& lookup(uint32_t index) const {
+    return chunks_[index / kChunkSize].load(std::memory_order_acquire)
+        [index % kChunkSize];
+  }
+
+  // The number of distinct triples seen so far
+  size_t size() const {
+    return size_.load(std::memory_order_acquire);
+  }
+
+ private:
+  uint32_t internLocked(dev_t dev, uid_t uid, gid_t gid);
+
+  std::array<std::atomic<Owner*>, kMaxChunks> chunks_;
+  std::atomic<uint32_t> size_{0};
+  std::mutex mutex_;
+  std::map<std::tuple<dev_t, uid_t, gid_t>, uint32_t> indices_;
+  bool overflowed_{false};
+};
+
+/**
+ * The form in which the view keeps the FileInformation of each file.  The
+ * times are held as nanoseconds since the epoch and dev, uid and gid as an
+ * index into the FileOwnerTable, which makes this a little over half the
+ * size of a FileInformation.
+ *
+ * Each field of FileInformation survives the round trip, except that times
+ * outside of the +/- 292 years that 64 bits of nanoseconds can represent
+ * are clamped.
+ */
+class CompactFileInformation {
+ public:
+  CompactFileInformation() = default;
+  explicit CompactFileInformation(const FileInformation& info) {
+    *this = info;
+  }
+  CompactFileInformation& operator=(const FileInformation& info);
+
+  FileInformation toFileInformation() const;
+
+  off_t size() const {
+    return off_t(size_);
+  }
+  ino_t ino() const {
+    return ino_t(ino_);
+  }
+  struct timespec atime() const {
+    return nsToTimespec(atimeNs_);
+  }
+  struct timespec mtime() const {
+    return nsToTimespec(mtimeNs_);
+  }
+  struct timespec ctime() const {
+    return nsToTimespec(ctimeNs_);
+  }
+
+  // These behave as those of FileInformation do.
+  DType dtype() const;
+  bool isSymlink() const;
+  bool isDir() const;
+  bool isFile() const;
+
+  static int64_t timespecToNs(const struct timespec& ts);
+  static struct timespec nsToTimespec(int64_t ns);
+
+ private:
+  int64_t size_{0};
+  uint64_t ino_{0};
+  int64_t atimeNs_{0};
+  int64_t mtimeNs_{0};
+  int64_t ctimeNs_{0};
+  uint32_t mode_{0};
+  uint32_t nlink_{0};
+  // Index of dev, uid and gid in the FileOwnerTable
+  uint32_t owner_{0};
+#ifdef _WIN32
+  uint32_t fileAttributes_{0};
+#endif
+};
+
+} // namespace watchman
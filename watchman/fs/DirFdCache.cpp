@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/fs/DirFdCache.h"
+
+#ifndef _WIN32
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <system_error>
+#include "watchman/fs/FileSystem.h"
+#include "watchman/fs/Statx.h"
+
+namespace watchman {
+
+DirFdCache::DirFdCache(size_t maxDirs) : maxDirs_(maxDirs) {}
+
+const FileDescriptor& DirFdCache::open(const w_string& dir) {
+  auto it = dirs_.find(dir);
+  if (it != dirs_.end()) {
+    lru_.splice(lru_.begin(), lru_, it->second.lru);
+    return it->second.fd;
+  }
+
+  int flags = O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC |
+#ifdef O_PATH
+      O_PATH
+#else
+      O_RDONLY
+#endif
+      ;
+  FileDescriptor fd(
+      ::open(dir.c_str(), flags), "open dir", FileDescriptor::FDType::Generic);
+  struct stat st;
+  if (fstat(fd.system_handle(), &st)) {
+    throw std::system_error(errno, std::generic_category(), "fstat dir");
+  }
+
+  if (dirs_.size() >= maxDirs_ && !lru_.empty()) {
+    dirs_.erase(lru_.back());
+    lru_.pop_back();
+  }
+  lru_.push_front(dir);
+  auto& entry = dirs_[dir];
+  entry.fd = std::move(fd);
+  entry.ino = st.st_ino;
+  entry.lru = lru_.begin();
+  return entry.fd;
+}
+
+FileInformation DirFdCache::statAt(
+    const w_string& dir,
+    w_string_piece name,
+    bool dontSync) {
+  auto& fd = open(dir);
+  std::string nameStr{name.view()};
+#ifdef WATCHMAN_HAVE_STATX
+  return statxAt(fd.system_handle(), nameStr.c_str(), dontSync);
+#else
+  (void)dontSync;
+  struct stat st;
+  if (fstatat(
+          fd.system_handle(), nameStr.c_str(), &st, AT_SYMLINK_NOFOLLOW)) {
+    throw std::system_error(errno, std::generic_category(), "fstatat");
+  }
+  return FileInformation(st);
+#endif
+}
+
+w_string DirFdCache::readLinkAt(const w_string& dir, w_string_piece name) {
+  std::string nameStr{name.view()};
+  return readSymbolicLinkAt(open(dir), nameStr.c_str());
+}
+
+void DirFdCache::invalidate(const w_string& dir) {
+  auto prefix = dir.piece();
+  for (auto it = dirs_.begin(); it != dirs_.end();) {
+    auto name = it->first.piece();
+    if (name == prefix ||
+        (name.startsWith(prefix) && name.size() > prefix.size() &&
+         is_slash(name[prefix.size()]))) {
+      lru_.erase(it->second.lru);
+      it = dirs_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void DirFdCache::invalidateIfReplaced(const w_string& dir, ino_t ino) {
+  auto it = dirs_.find(dir);
+  if (it != dirs_.end() && it->second.ino != ino) {
+    invalidate(dir);
+  }
+}
+
+} // namespace watchman
+
+#endif
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#ifndef _WIN32
+
+#include <list>
+#include <unordered_map>
+#include "watchman/fs/FileDescriptor.h"
+#include "watchman/fs/FileInformation.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * Keeps a bounded number of directories open, so that the files in them can
+ * be examined relative to the directory rather than by their full paths.
+ * Each lookup by full path has the kernel walk every component of the path
+ * again, which adds up over the millions of stats of a crawl.  Directories
+ * are opened with O_PATH where it is available, and the least recently used
+ * one is closed to make room for another.
+ *
+ * An open directory follows its inode, not its name.  Whoever uses the cache
+ * must invalidate a directory when it learns that the directory was deleted,
+ * renamed or replaced; until then, names in it resolve as they did when it
+ * was opened.
+ *
+ * Not thread safe.
+ */
+class DirFdCache {
+ public:
+  explicit DirFdCache(size_t maxDirs);
+
+  /**
+   * lstat()s the file named name in dir.  Throws std::system_error on
+   * failure, including when dir can't be opened.  With dontSync, a network
+   * filesystem may answer from its cached attributes, where statx allows
+   * it.
+   */
+  FileInformation
+  statAt(const w_string& dir, w_string_piece name, bool dontSync = false);
+
+  /**
+   * readlink()s the symlink named name in dir.  Throws std::system_error on
+   * failure.
+   */
+  w_string readLinkAt(const w_string& dir, w_string_piece name);
+
+  /**
+   * Closes dir, and every directory below it, if they are open.
+   */
+  void invalidate(const w_string& dir);
+
+  /**
+   * Closes dir if it is open but is no longer the directory with inode ino.
+   * Its descendants are closed along with it.
+   */
+  void invalidateIfReplaced(const w_string& dir, ino_t ino);
+
+  size_t size() const {
+    return dirs_.size();
+  }
+
+ private:
+  struct OpenDir {
+    FileDescriptor fd;
+    ino_t ino;
+    std::list<w_string>::iterator lru;
+  };
+
+  const FileDescriptor& open(const w_string& dir);
+
+  size_t maxDirs_;
+  std::unordered_map<w_string, OpenDir> dirs_;
+  // Most recently used at the front
+  std::list<w_string> lru_;
+};
+
+} // namespace watchman
+
+#endif
@@ -8,6 +8,7 @@
 #include "watchman/fs/FSDetect.h"
 #include <folly/FileUtil.h>
 #include <folly/String.h>
+#include <string_view>
 #include "watchman/fs/FileDescriptor.h"
 #include "watchman/watchman_system.h"
 
@@ -116,6 +117,54 @@ w_string w_fstype_detect_macos_nfs(w_string fstype, w_string edenfs_indicator) {
   return fstype;
 }
 
+bool fs_type_maintains_dir_mtimes(w_string_piece fs_type) {
+  // The mtimes on these come from a server or a userspace daemon, and may be
+  // cached, coarse or not maintained at all
+  static constexpr std::string_view kUnreliable[] = {
+      "nfs",
+      "nfs4",
+      "cifs",
+      "smb",
+      "smbfs",
+      "afpfs",
+      "webdav",
+      "9p",
+      "vboxsf",
+      "prl_fs",
+      "fuse",
+      "osxfuse",
+      "macfuse",
+      "unknown",
+  };
+  for (auto name : kUnreliable) {
+    if (fs_type.view() == name) {
+      return false;
+    }
+  }
+  return !fs_type.startsWith("fuse.") && !is_edenfs_fs_type(fs_type);
+}
+
+bool is_network_fs_type(w_string_piece fs_type) {
+  static constexpr std::string_view kNetwork[] = {
+      "nfs",
+      "nfs4",
+      "cifs",
+      "smb",
+      "smb3",
+      "smbfs",
+      "afpfs",
+      "webdav",
+      "9p",
+      "ceph",
+  };
+  for (auto name : kNetwork) {
+    if (fs_type.view() == name) {
+      return true;
+    }
+  }
+  return false;
+}
+
 // The primary purpose of checking the filesystem type is to prevent
 // watching filesystems that are known to be problematic, such as
 // network or remote mounted filesystems.  As such, we don't strictly
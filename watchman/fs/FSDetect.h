@@ -29,3 +29,12 @@ std::optional<w_string> find_fstype_in_linux_proc_mounts(
 inline bool is_edenfs_fs_type(w_string_piece fs_type) {
   return fs_type == "edenfs" || fs_type.startsWith("edenfs:");
 }
+
+// Returns false for filesystems that aren't known to update a directory's
+// mtime whenever an entry is added to, removed from or renamed within it,
+// such as network and FUSE filesystems.
+bool fs_type_maintains_dir_mtimes(w_string_piece fs_type);
+
+// Returns true for filesystems whose files live on a server, and whose
+// attributes may be cached by the client.
+bool is_network_fs_type(w_string_piece fs_type);
@@ -297,6 +297,15 @@ FileInformation FileDescriptor::getInfo() const {
   info.size = sinfo.EndOfFile.QuadPart;
   info.nlink = sinfo.NumberOfLinks;
 
+  // The same id that WinDirHandle reads from FileIdExtdDirectoryInfo.
+  // Filesystems that have no 128-bit ids (FAT) fail this, and their dir
+  // listings fall back to a form without ids, so both are left at 0.
+  FILE_ID_INFO idinfo;
+  if (GetFileInformationByHandleEx(
+          (HANDLE)handle(), FileIdInfo, &idinfo, sizeof(idinfo))) {
+    info.ino = foldFileId(idinfo.FileId.Identifier);
+  }
+
   return info;
 #endif
 }
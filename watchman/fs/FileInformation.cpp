@@ -47,6 +47,13 @@ FileInformation::FileInformation(uint32_t dwFileAttributes)
     mode |= _S_IFREG;
   }
 }
+
+ino_t foldFileId(const uint8_t (&id)[16]) {
+  // NTFS ids fit in the low 64 bits; ReFS uses all of them
+  uint32_t words[4];
+  memcpy(words, id, sizeof(words));
+  return words[0] ^ words[1] ^ words[2] ^ words[3];
+}
 #endif
 
 DType FileInformation::dtype() const {
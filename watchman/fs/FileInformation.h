@@ -149,6 +149,15 @@ struct FileInformation {
   static FileInformation makeDeletedFileInformation();
 };
 
+#ifdef _WIN32
+/**
+ * Folds the 128-bit id of a file (FILE_ID_128::Identifier) into an ino_t.
+ * Both the stats read from a dir listing and those read from a file handle
+ * go through this, so that they agree.
+ */
+ino_t foldFileId(const uint8_t (&id)[16]);
+#endif
+
 } // namespace watchman
 
 #ifndef _WIN32
@@ -337,8 +337,12 @@ w_string realPath(const char* path) {
   return handle.getOpenedPath();
 }
 
-w_string readSymbolicLink(const char* path) {
 #ifndef _WIN32
+namespace {
+// Reads a link with `readLink(buf, size)`, falling back to `linkSize()` to
+// size the buffer if the speculative read was truncated.
+template <typename ReadLink, typename LinkSize>
+w_string readSymbolicLinkWith(ReadLink&& readLink, LinkSize&& linkSize) {
   std::string result;
 
   // Speculatively assume that this is large enough to read the
@@ -346,7 +350,7 @@ w_string readSymbolicLink(const char* path) {
   result.resize(256);
 
   for (int retry = 0; retry < 2; ++retry) {
-    auto len = readlink(path, &result[0], result.size());
+    auto len = readLink(&result[0], result.size());
     if (len < 0) {
       throw std::system_error(
           errno, std::generic_category(), "readlink for readSymbolicLink");
@@ -356,25 +360,52 @@ w_string readSymbolicLink(const char* path) {
     }
 
     // Truncated read; we need to figure out the right size to use
-    struct stat st;
-    if (lstat(path, &st)) {
-      throw std::system_error(
-          errno, std::generic_category(), "lstat for readSymbolicLink");
-    }
-
-    result.resize(st.st_size + 1, 0);
+    result.resize(linkSize() + 1, 0);
   }
 
   throw std::system_error(
       E2BIG,
       std::generic_category(),
       "readlink for readSymbolicLink: symlink changed while reading it");
+}
+} // namespace
+#endif
+
+w_string readSymbolicLink(const char* path) {
+#ifndef _WIN32
+  return readSymbolicLinkWith(
+      [&](char* buf, size_t size) { return readlink(path, buf, size); },
+      [&] {
+        struct stat st;
+        if (lstat(path, &st)) {
+          throw std::system_error(
+              errno, std::generic_category(), "lstat for readSymbolicLink");
+        }
+        return size_t(st.st_size);
+      });
 #else
   return openFileHandle(path, OpenFileHandleOptions::queryFileInfo())
       .readSymbolicLink();
 #endif
 }
 
+#ifndef _WIN32
+w_string readSymbolicLinkAt(const FileDescriptor& dir, const char* name) {
+  return readSymbolicLinkWith(
+      [&](char* buf, size_t size) {
+        return readlinkat(dir.system_handle(), name, buf, size);
+      },
+      [&] {
+        struct stat st;
+        if (fstatat(dir.system_handle(), name, &st, AT_SYMLINK_NOFOLLOW)) {
+          throw std::system_error(
+              errno, std::generic_category(), "fstatat for readSymbolicLink");
+        }
+        return size_t(st.st_size);
+      });
+}
+#endif
+
 } // namespace watchman
 
 #ifdef _WIN32
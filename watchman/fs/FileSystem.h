@@ -79,6 +79,12 @@ w_string realPath(const char* path);
 /** equivalent to readlink() */
 w_string readSymbolicLink(const char* path);
 
+#ifndef _WIN32
+/** equivalent to readlinkat(), reading the link named `name` in the
+ * directory opened as `dir` */
+w_string readSymbolicLinkAt(const FileDescriptor& dir, const char* name);
+#endif
+
 } // namespace watchman
 
 #ifdef _WIN32
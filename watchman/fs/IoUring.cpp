@@ -0,0 +1,299 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/fs/IoUring.h"
+
+#ifdef WATCHMAN_HAVE_IO_URING_STATX
+#include <fcntl.h>
+#include <string.h>
+#include <folly/String.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include "watchman/Logging.h"
+
+namespace watchman {
+
+namespace {
+// Directories larger than this are submitted in several rounds
+constexpr uint32_t kRingEntries = 256;
+
+int sys_io_uring_setup(uint32_t entries, struct io_uring_params* p) {
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+int sys_io_uring_enter(
+    int fd,
+    uint32_t toSubmit,
+    uint32_t minComplete,
+    uint32_t flags) {
+  return (int)syscall(
+      __NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+}
+
+uint32_t loadAcquire(const uint32_t* p) {
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+void storeRelease(uint32_t* p, uint32_t v) {
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+void* ringPtr(void* base, uint32_t offset) {
+  return static_cast<char*>(base) + offset;
+}
+} // namespace
+
+IoUringStatx* IoUringStatx::forThisThread() {
+  thread_local std::unique_ptr<IoUringStatx> ring;
+  thread_local bool failed = false;
+
+  if (ring) {
+    return ring->unusable_ ? nullptr : ring.get();
+  }
+  if (failed) {
+    return nullptr;
+  }
+
+  ring = create(sys_io_uring_enter);
+  if (!ring) {
+    failed = true;
+    return nullptr;
+  }
+  return ring.get();
+}
+
+std::unique_ptr<IoUringStatx> IoUringStatx::create(EnterFunc enter) {
+  std::unique_ptr<IoUringStatx> ring(new IoUringStatx(enter));
+  if (!ring->init(kRingEntries)) {
+    return nullptr;
+  }
+  return ring;
+}
+
+bool IoUringStatx::init(uint32_t entries) {
+  struct io_uring_params params {};
+
+  fd_ = sys_io_uring_setup(entries, &params);
+  if (fd_ < 0) {
+    logf(
+        DBG,
+        "io_uring_setup failed: {}, falling back to fstatat\n",
+        folly::errnoStr(errno));
+    fd_ = -1;
+    return false;
+  }
+  fcntl(fd_, F_SETFD, FD_CLOEXEC);
+
+  sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+  cqRingSize_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (singleMmap) {
+    sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+  }
+
+  sqRing_ = mmap(
+      nullptr,
+      sqRingSize_,
+      PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE,
+      fd_,
+      IORING_OFF_SQ_RING);
+  if (sqRing_ == MAP_FAILED) {
+    sqRing_ = nullptr;
+    return false;
+  }
+  if (singleMmap) {
+    cqRing_ = sqRing_;
+  } else {
+    cqRing_ = mmap(
+        nullptr,
+        cqRingSize_,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        fd_,
+        IORING_OFF_CQ_RING);
+    if (cqRing_ == MAP_FAILED) {
+      cqRing_ = nullptr;
+      return false;
+    }
+  }
+
+  sqesSize_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  sqesMem_ = mmap(
+      nullptr,
+      sqesSize_,
+      PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE,
+      fd_,
+      IORING_OFF_SQES);
+  if (sqesMem_ == MAP_FAILED) {
+    sqesMem_ = nullptr;
+    return false;
+  }
+
+  sqHead_ = static_cast<uint32_t*>(ringPtr(sqRing_, params.sq_off.head));
+  sqTail_ = static_cast<uint32_t*>(ringPtr(sqRing_, params.sq_off.tail));
+  sqMask_ =
+      *static_cast<uint32_t*>(ringPtr(sqRing_, params.sq_off.ring_mask));
+  sqArray_ = static_cast<uint32_t*>(ringPtr(sqRing_, params.sq_off.array));
+  sqEntries_ = params.sq_entries;
+  sqes_ = static_cast<struct io_uring_sqe*>(sqesMem_);
+
+  cqHead_ = static_cast<uint32_t*>(ringPtr(cqRing_, params.cq_off.head));
+  cqTail_ = static_cast<uint32_t*>(ringPtr(cqRing_, params.cq_off.tail));
+  cqMask_ =
+      *static_cast<uint32_t*>(ringPtr(cqRing_, params.cq_off.ring_mask));
+  cqes_ =
+      static_cast<struct io_uring_cqe*>(ringPtr(cqRing_, params.cq_off.cqes));
+  return true;
+}
+
+IoUringStatx::~IoUringStatx() {
+  if (sqesMem_) {
+    munmap(sqesMem_, sqesSize_);
+  }
+  if (cqRing_ && cqRing_ != sqRing_) {
+    munmap(cqRing_, cqRingSize_);
+  }
+  if (sqRing_) {
+    munmap(sqRing_, sqRingSize_);
+  }
+  if (fd_ != -1) {
+    close(fd_);
+  }
+}
+
+bool IoUringStatx::submitAndWait(uint32_t toSubmit, uint32_t waitFor) {
+  while (toSubmit > 0 || waitFor > 0) {
+    int res =
+        enter_(fd_, toSubmit, waitFor, waitFor ? IORING_ENTER_GETEVENTS : 0);
+    if (res < 0) {
+      if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+        // EAGAIN/EBUSY mean the kernel didn't accept the submissions, so
+        // there's nothing in flight on their behalf and we can retry.
+        continue;
+      }
+      logf(ERR, "io_uring_enter failed: {}\n", folly::errnoStr(errno));
+      // Stop using this ring altogether; the caller drains the requests
+      // that are already in flight.
+      unusable_ = true;
+      return false;
+    }
+    toSubmit -= std::min(toSubmit, uint32_t(res));
+    // We only loop again to submit whatever the kernel didn't take;
+    // completions are reaped by the caller.
+    waitFor = 0;
+  }
+  return true;
+}
+
+bool IoUringStatx::statAll(
+    int dirFd,
+    const char* const* names,
+    struct statx* bufs,
+    int* results,
+    size_t count) {
+  size_t submitted = 0;
+  size_t completed = 0;
+  bool sawInvalid = false;
+  // The rings are empty between calls, so this is where our requests start
+  uint32_t sqStart = *sqTail_;
+
+  while (completed < count) {
+    // Fill as much of the submission queue as we can.  We never have more
+    // than sqEntries_ requests in flight, which is well below the (twice as
+    // large) completion queue, so the CQ cannot overflow.
+    uint32_t tail = *sqTail_;
+    uint32_t queued = 0;
+    while (submitted < count && submitted - completed < sqEntries_) {
+      uint32_t index = (tail + queued) & sqMask_;
+      auto* sqe = &sqes_[index];
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = IORING_OP_STATX;
+      sqe->fd = dirFd;
+      sqe->addr = uint64_t(uintptr_t(names[submitted]));
+      sqe->len = kStatxMask;
+      sqe->off = uint64_t(uintptr_t(&bufs[submitted]));
+      sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+      sqe->user_data = submitted;
+      sqArray_[index] = index;
+      ++queued;
+      ++submitted;
+    }
+    storeRelease(sqTail_, tail + queued);
+
+    if (!submitAndWait(queued, 1)) {
+      drain(sqStart, completed, results);
+      return false;
+    }
+    completed += reap(results, sawInvalid);
+  }
+
+  if (sawInvalid &&
+      std::all_of(results, results + count, [](int res) {
+        return res == -EINVAL || res == -EOPNOTSUPP;
+      })) {
+    // Kernels older than 5.6 know io_uring but not IORING_OP_STATX
+    logf(DBG, "io_uring doesn't support statx, falling back to fstatat\n");
+    unusable_ = true;
+    return false;
+  }
+  return true;
+}
+
+size_t IoUringStatx::reap(int* results, bool& sawInvalid) {
+  uint32_t head = *cqHead_;
+  uint32_t cqTail = loadAcquire(cqTail_);
+  size_t reaped = 0;
+  while (head != cqTail) {
+    auto& cqe = cqes_[head & cqMask_];
+    results[cqe.user_data] = cqe.res;
+    if (cqe.res == -EINVAL || cqe.res == -EOPNOTSUPP) {
+      sawInvalid = true;
+    }
+    ++head;
+    ++reaped;
+  }
+  storeRelease(cqHead_, head);
+  return reaped;
+}
+
+void IoUringStatx::drain(uint32_t sqStart, size_t completed, int* results) {
+  // The kernel only takes submissions in io_uring_enter, so the ones it
+  // hasn't taken yet can simply be withdrawn
+  uint32_t sqHead = loadAcquire(sqHead_);
+  storeRelease(sqTail_, sqHead);
+
+  // The ones it has taken still point into the caller's names and bufs,
+  // which are reused as soon as we return, so wait for them to complete.
+  // Closing the ring wouldn't help: the kernel cancels its requests in
+  // the background.
+  size_t inFlight = uint32_t(sqHead - sqStart) - completed;
+  bool sawInvalid = false;
+  while (true) {
+    inFlight -= reap(results, sawInvalid);
+    if (inFlight == 0) {
+      return;
+    }
+    int res = enter_(fd_, 0, inFlight, IORING_ENTER_GETEVENTS);
+    if (res < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      logf(
+          FATAL,
+          "io_uring_enter failed with {} statx requests in flight: {}\n",
+          inFlight,
+          folly::errnoStr(errno));
+    }
+  }
+}
+
+} // namespace watchman
+
+#endif
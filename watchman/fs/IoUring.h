@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <sys/stat.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include "watchman/fs/Statx.h"
+
+#if defined(WATCHMAN_HAVE_STATX) && defined(HAVE_LINUX_IO_URING_H)
+#define WATCHMAN_HAVE_IO_URING_STATX 1
+#endif
+
+#ifdef WATCHMAN_HAVE_IO_URING_STATX
+struct io_uring_sqe;
+struct io_uring_cqe;
+#endif
+
+namespace watchman {
+
+#ifdef WATCHMAN_HAVE_IO_URING_STATX
+
+/**
+ * A minimal io_uring used by the directory crawler to issue the statx calls
+ * for a whole directory in a handful of io_uring_enter syscalls rather than
+ * one fstatat per entry.
+ *
+ * We talk to the kernel through the raw io_uring_setup/io_uring_enter
+ * syscalls and the mmapped rings, so there is no liburing dependency.
+ * Rings are per-thread: each crawler or ParallelWalker worker thread owns
+ * one and uses it synchronously, so no locking is required.
+ */
+class IoUringStatx {
+ public:
+  ~IoUringStatx();
+  IoUringStatx(const IoUringStatx&) = delete;
+  IoUringStatx& operator=(const IoUringStatx&) = delete;
+
+  /**
+   * Returns the ring for the calling thread, creating it on first use.
+   * Returns nullptr if io_uring is not available (old kernel, seccomp,
+   * RLIMIT_MEMLOCK...); the failure is remembered so that we don't retry
+   * the setup for every directory.
+   */
+  static IoUringStatx* forThisThread();
+
+  using EnterFunc = int (*)(
+      int fd,
+      uint32_t toSubmit,
+      uint32_t minComplete,
+      uint32_t flags);
+
+  /**
+   * Creates a ring that makes its io_uring_enter calls through `enter`,
+   * or returns nullptr if io_uring is not available.
+   * Exposed for testing, so that a test can make io_uring_enter fail.
+   */
+  static std::unique_ptr<IoUringStatx> create(EnterFunc enter);
+
+  /**
+   * Issues an lstat-equivalent statx of names[i], relative to dirFd and
+   * asking for kStatxMask, for every `i < count`, and waits for them all
+   * to complete.
+   * results[i] receives 0 on success or a negative errno value.
+   * Returns false if the ring failed in a way that means none of the
+   * results can be trusted; the caller should fall back to stat'ing the
+   * entries itself.  Either way, the kernel is done with names and bufs
+   * by the time this returns.
+   */
+  bool statAll(
+      int dirFd,
+      const char* const* names,
+      struct statx* bufs,
+      int* results,
+      size_t count);
+
+ private:
+  explicit IoUringStatx(EnterFunc enter) : enter_(enter) {}
+  bool init(uint32_t entries);
+  bool submitAndWait(uint32_t toSubmit, uint32_t waitFor);
+  size_t reap(int* results, bool& sawInvalid);
+  void drain(uint32_t sqStart, size_t completed, int* results);
+
+  EnterFunc enter_;
+  int fd_{-1};
+
+  void* sqRing_{nullptr};
+  size_t sqRingSize_{0};
+  void* cqRing_{nullptr};
+  size_t cqRingSize_{0};
+  void* sqesMem_{nullptr};
+  size_t sqesSize_{0};
+
+  uint32_t* sqHead_{nullptr};
+  uint32_t* sqTail_{nullptr};
+  uint32_t sqMask_{0};
+  uint32_t* sqArray_{nullptr};
+  uint32_t sqEntries_{0};
+  struct io_uring_sqe* sqes_{nullptr};
+
+  uint32_t* cqHead_{nullptr};
+  uint32_t* cqTail_{nullptr};
+  uint32_t cqMask_{0};
+  struct io_uring_cqe* cqes_{nullptr};
+
+  // Set when the kernel rejects IORING_OP_STATX (pre-5.6 kernels) or
+  // io_uring_enter fails outright
+  bool unusable_{false};
+};
+
+#endif
+
+} // namespace watchman
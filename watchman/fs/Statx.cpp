@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/fs/Statx.h"
+
+#ifdef WATCHMAN_HAVE_STATX
+#include <fcntl.h>
+#include <sys/sysmacros.h>
+#include <system_error>
+
+namespace watchman {
+
+FileInformation fileInformationFromStatx(const struct statx& stx) {
+  FileInformation info;
+  info.mode = stx.stx_mode;
+  info.size = off_t(stx.stx_size);
+  info.uid = stx.stx_uid;
+  info.gid = stx.stx_gid;
+  info.ino = stx.stx_ino;
+  info.dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+  info.nlink = stx.stx_nlink;
+  info.atime.tv_sec = stx.stx_atime.tv_sec;
+  info.atime.tv_nsec = stx.stx_atime.tv_nsec;
+  info.mtime.tv_sec = stx.stx_mtime.tv_sec;
+  info.mtime.tv_nsec = stx.stx_mtime.tv_nsec;
+  info.ctime.tv_sec = stx.stx_ctime.tv_sec;
+  info.ctime.tv_nsec = stx.stx_ctime.tv_nsec;
+  return info;
+}
+
+FileInformation statxAt(int dirFd, const char* name, bool dontSync) {
+  struct statx stx;
+  // glibc emulates statx with fstatat on kernels that predate it
+  if (statx(
+          dirFd,
+          name,
+          AT_SYMLINK_NOFOLLOW | (dontSync ? AT_STATX_DONT_SYNC : 0),
+          kStatxMask,
+          &stx)) {
+    throw std::system_error(errno, std::generic_category(), "statx");
+  }
+  return fileInformationFromStatx(stx);
+}
+
+} // namespace watchman
+
+#endif
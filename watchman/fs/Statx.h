@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <sys/stat.h>
+#include "watchman/fs/FileInformation.h"
+
+#if defined(__linux__) && defined(STATX_BASIC_STATS)
+#define WATCHMAN_HAVE_STATX 1
+#endif
+
+namespace watchman {
+
+#ifdef WATCHMAN_HAVE_STATX
+
+/**
+ * The statx fields that a FileInformation holds: the basic stats, less the
+ * block count that nothing in watchman reports.
+ */
+constexpr unsigned kStatxMask = STATX_BASIC_STATS & ~STATX_BLOCKS;
+
+/** Converts the result of a successful statx into a FileInformation */
+FileInformation fileInformationFromStatx(const struct statx& stx);
+
+/**
+ * statx()s name relative to dirFd without following a symlink, asking for
+ * kStatxMask.  With dontSync, a network filesystem may answer from the
+ * attributes it has cached rather than asking the server.  Throws
+ * std::system_error on failure.
+ */
+FileInformation statxAt(int dirFd, const char* name, bool dontSync);
+
+#endif
+
+} // namespace watchman
@@ -9,11 +9,14 @@
 
 #include <fmt/core.h>
 #include <folly/String.h>
+#include <string>
 #include <system_error>
+#include <vector>
 #include "watchman/Logging.h"
 #include "watchman/WatchmanConfig.h"
 #include "watchman/fs/FileDescriptor.h"
 #include "watchman/fs/FileSystem.h"
+#include "watchman/fs/IoUring.h"
 
 #ifndef _WIN32
 #include <dirent.h>
@@ -72,6 +75,19 @@ class UnixDirHandle : public DirHandle {
 #endif
   DIR* d_{nullptr};
   struct DirEntry ent_;
+#ifdef WATCHMAN_HAVE_IO_URING_STATX
+  // When io_uring statx is enabled, the whole directory is read and
+  // stat'd on the first readDir() call and then replayed from here.
+  bool useIoUring_{false};
+  bool batchLoaded_{false};
+  size_t batchPos_{0};
+  std::string batchNameBuf_;
+  std::vector<const char*> batchNames_;
+  std::vector<struct statx> batchStats_;
+  std::vector<int> batchResults_;
+
+  void loadBatch();
+#endif
 
  public:
   explicit UnixDirHandle(const char* path, bool strict);
@@ -180,7 +196,7 @@ UnixDirHandle::UnixDirHandle(const char* path, bool strict)
 {
 #ifdef HAVE_GETATTRLISTBULK
   dirName_ = path;
-  if (cfg_get_bool("_use_bulkstat", use_bulkstat_by_default())) {
+  if (cfg_get_snapshot()->useBulkstat.value_or(use_bulkstat_by_default())) {
     auto opts = strict ? OpenFileHandleOptions::strictOpenDir()
                        : OpenFileHandleOptions::openDir();
 
@@ -216,7 +232,51 @@ UnixDirHandle::UnixDirHandle(const char* path, bool strict)
         std::generic_category(),
         std::string(strict ? "opendir_nofollow: " : "opendir: ") + path);
   }
+#ifdef WATCHMAN_HAVE_IO_URING_STATX
+  useIoUring_ = cfg_get_snapshot()->ioUringStatx;
+#endif
+}
+
+#ifdef WATCHMAN_HAVE_IO_URING_STATX
+void UnixDirHandle::loadBatch() {
+  batchLoaded_ = true;
+
+  // readdir may reuse its buffer, so copy the names out before we hand
+  // pointers to them to the kernel.
+  std::vector<size_t> offsets;
+  while (true) {
+    errno = 0;
+    auto dent = readdir(d_);
+    if (!dent) {
+      if (errno) {
+        throw std::system_error(errno, std::generic_category(), "readdir");
+      }
+      break;
+    }
+    offsets.push_back(batchNameBuf_.size());
+    batchNameBuf_.append(dent->d_name, strlen(dent->d_name) + 1);
+  }
+
+  batchNames_.reserve(offsets.size());
+  for (auto offset : offsets) {
+    batchNames_.push_back(batchNameBuf_.data() + offset);
+  }
+  batchStats_.resize(batchNames_.size());
+  batchResults_.assign(batchNames_.size(), -ENODATA);
+
+  auto ring = IoUringStatx::forThisThread();
+  if (!ring ||
+      !ring->statAll(
+          dirfd(d_),
+          batchNames_.data(),
+          batchStats_.data(),
+          batchResults_.data(),
+          batchNames_.size())) {
+    // Yield the names without stat info; the caller will stat them
+    batchResults_.assign(batchNames_.size(), -ENODATA);
+  }
 }
+#endif
 
 const DirEntry* UnixDirHandle::readDir() {
 #ifdef HAVE_GETATTRLISTBULK
@@ -227,7 +287,9 @@ const DirEntry* UnixDirHandle::readDir() {
       // Read the next batch of results
       int retcount;
 
-      memset(buf_, 0, sizeof(buf_));
+      // No need to clear buf_ first: FSOPT_PACK_INVAL_ATTRS has the kernel
+      // write every field of each entry that it returns, and we only look
+      // at those entries
       errno = 0;
       retcount = getattrlistbulk(
           fd_.fd(),
@@ -347,16 +409,19 @@ const DirEntry* UnixDirHandle::readDir() {
     ent_.stat.gid = item->gid;
     ent_.stat.mode = item->mode & ~S_IFMT;
     ent_.stat.ino = item->ino;
+    // The link count of every kind of entry, so that these stats compare
+    // equal to lstat's for the same entry.  statPath lstats the entries
+    // that it is notified about, and a mismatch would make the next crawl
+    // report each symlink as changed.
+    ent_.stat.nlink = item->link;
 
     switch (item->objtype) {
       case VREG:
         ent_.stat.mode |= S_IFREG;
         ent_.stat.size = item->file_size;
-        ent_.stat.nlink = item->link;
         break;
       case VDIR:
         ent_.stat.mode |= S_IFDIR;
-        ent_.stat.nlink = item->link;
         break;
       case VLNK:
         ent_.stat.mode |= S_IFLNK;
@@ -383,6 +448,29 @@ const DirEntry* UnixDirHandle::readDir() {
   if (!d_) {
     return nullptr;
   }
+
+#ifdef WATCHMAN_HAVE_IO_URING_STATX
+  if (useIoUring_) {
+    if (!batchLoaded_) {
+      loadBatch();
+    }
+    if (batchPos_ >= batchNames_.size()) {
+      return nullptr;
+    }
+    auto pos = batchPos_++;
+    ent_.d_name = batchNames_[pos];
+    // Errors such as ENOENT for an entry that vanished since readdir are
+    // left for the caller's own stat to discover and report.
+    const auto& stx = batchStats_[pos];
+    ent_.has_stat = batchResults_[pos] == 0 &&
+        (stx.stx_mask & kStatxMask) == kStatxMask;
+    if (ent_.has_stat) {
+      ent_.stat = fileInformationFromStatx(stx);
+    }
+    return &ent_;
+  }
+#endif
+
   errno = 0;
   auto dent = readdir(d_);
   if (!dent) {
@@ -405,7 +493,9 @@ UnixDirHandle::~UnixDirHandle() {
 
 int UnixDirHandle::getFd() const {
 #ifdef HAVE_GETATTRLISTBULK
-  if (cfg_get_bool("_use_bulkstat", use_bulkstat_by_default())) {
+  // Whichever way the constructor opened the dir, even if the config has
+  // changed since
+  if (fd_) {
     return fd_.fd();
   }
 #endif
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/fs/UsnJournal.h"
+#include <string>
+#include <system_error>
+#include <vector>
+
+#ifdef _WIN32
+
+namespace watchman {
+
+namespace {
+
+USN_JOURNAL_DATA_V0 queryJournal(const FileDescriptor& volume) {
+  USN_JOURNAL_DATA_V0 data;
+  DWORD bytes;
+  if (!DeviceIoControl(
+          (HANDLE)volume.handle(),
+          FSCTL_QUERY_USN_JOURNAL,
+          nullptr,
+          0,
+          &data,
+          sizeof(data),
+          &bytes,
+          nullptr)) {
+    throw std::system_error(
+        GetLastError(), std::system_category(), "FSCTL_QUERY_USN_JOURNAL");
+  }
+  return data;
+}
+
+} // namespace
+
+UsnJournal::UsnJournal(const w_string& path) {
+  auto wpath = path.piece().asWideUNC();
+
+  WCHAR mountPoint[MAX_PATH];
+  if (!GetVolumePathNameW(wpath.c_str(), mountPoint, MAX_PATH)) {
+    throw std::system_error(
+        GetLastError(), std::system_category(), "GetVolumePathNameW");
+  }
+  WCHAR volumeName[MAX_PATH];
+  if (!GetVolumeNameForVolumeMountPointW(mountPoint, volumeName, MAX_PATH)) {
+    throw std::system_error(
+        GetLastError(),
+        std::system_category(),
+        "GetVolumeNameForVolumeMountPointW");
+  }
+
+  // The volume itself is opened by its name without the trailing slash
+  std::wstring device{volumeName};
+  if (!device.empty() && device.back() == L'\\') {
+    device.pop_back();
+  }
+  volume_ = FileDescriptor(
+      intptr_t(CreateFileW(
+          device.c_str(),
+          GENERIC_READ,
+          FILE_SHARE_READ | FILE_SHARE_WRITE,
+          nullptr,
+          OPEN_EXISTING,
+          0,
+          nullptr)),
+      FileDescriptor::FDType::Generic);
+  if (!volume_) {
+    throw std::system_error(
+        GetLastError(), std::system_category(), "failed to open the volume");
+  }
+}
+
+UsnJournal::Position UsnJournal::current() const {
+  auto data = queryJournal(volume_);
+  return Position{data.UsnJournalID, data.NextUsn};
+}
+
+bool UsnJournal::canReadFrom(const Position& since) const {
+  auto data = queryJournal(volume_);
+  return data.UsnJournalID == since.journalId && since.usn >= data.FirstUsn &&
+      since.usn <= data.NextUsn;
+}
+
+void UsnJournal::read(
+    const Position& since,
+    USN until,
+    const std::function<void(const Record&)>& onRecord) const {
+  READ_USN_JOURNAL_DATA_V0 request{};
+  request.StartUsn = since.usn;
+  request.ReasonMask = 0xFFFFFFFF;
+  request.ReturnOnlyOnClose = FALSE;
+  request.Timeout = 0;
+  request.BytesToWaitFor = 0;
+  request.UsnJournalID = since.journalId;
+
+  // USN records must be 8 byte aligned
+  std::vector<DWORDLONG> buf(64 * 1024 / sizeof(DWORDLONG));
+  const DWORD bufSize = DWORD(buf.size() * sizeof(DWORDLONG));
+
+  while (request.StartUsn < until) {
+    DWORD bytes;
+    if (!DeviceIoControl(
+            (HANDLE)volume_.handle(),
+            FSCTL_READ_USN_JOURNAL,
+            &request,
+            sizeof(request),
+            buf.data(),
+            bufSize,
+            &bytes,
+            nullptr)) {
+      throw std::system_error(
+          GetLastError(), std::system_category(), "FSCTL_READ_USN_JOURNAL");
+    }
+    if (bytes <= sizeof(USN)) {
+      // Caught up with the journal
+      return;
+    }
+
+    // The output starts with the USN to continue from
+    auto data = reinterpret_cast<const char*>(buf.data());
+    USN next = *reinterpret_cast<const USN*>(data);
+    DWORD offset = sizeof(USN);
+    while (offset < bytes) {
+      auto record = reinterpret_cast<const USN_RECORD_V2*>(data + offset);
+      if (record->Usn >= until) {
+        return;
+      }
+      // Version 2 is what FSCTL_READ_USN_JOURNAL returns for a V0 request
+      if (record->MajorVersion == 2) {
+        onRecord(Record{
+            record->FileReferenceNumber,
+            record->ParentFileReferenceNumber,
+            record->Reason,
+            record->FileAttributes,
+            w_string{
+                reinterpret_cast<const WCHAR*>(
+                    reinterpret_cast<const char*>(record) +
+                    record->FileNameOffset),
+                record->FileNameLength / sizeof(WCHAR)}});
+      }
+      offset += record->RecordLength;
+    }
+    request.StartUsn = next;
+  }
+}
+
+} // namespace watchman
+
+#endif
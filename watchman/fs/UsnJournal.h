@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <functional>
+#include "watchman/fs/FileDescriptor.h"
+#include "watchman/watchman_string.h"
+#include "watchman/watchman_system.h"
+
+#ifdef _WIN32
+
+#include <winioctl.h>
+
+namespace watchman {
+
+/**
+ * Reads the NTFS change journal of the volume holding a path.
+ *
+ * The journal records every change made to the volume, by file reference
+ * number, whether or not anything was watching at the time.  Watchman uses
+ * it to find what changed while it wasn't running.
+ *
+ * Reading the journal requires that the volume has one and that the
+ * process is able to open the volume, which usually means running
+ * elevated.  Every method throws std::system_error on failure.
+ */
+class UsnJournal {
+ public:
+  // A point in a particular instance of a journal.  A journal is recreated
+  // with a new id when it is deleted or disabled, and the oldest records are
+  // discarded as it fills up.
+  struct Position {
+    uint64_t journalId{0};
+    USN usn{0};
+  };
+
+  struct Record {
+    uint64_t fileReference;
+    uint64_t parentFileReference;
+    // USN_REASON_* bits
+    uint32_t reason;
+    uint32_t fileAttributes;
+    // The name of the file within its parent
+    w_string name;
+  };
+
+  // Opens the journal of the volume that holds path.
+  explicit UsnJournal(const w_string& path);
+
+  // Returns the position of the next record to be written.
+  Position current() const;
+
+  // Returns true if every record since `since` is still in the journal.
+  bool canReadFrom(const Position& since) const;
+
+  // Calls onRecord for each record from `since` up to `until`.
+  void read(
+      const Position& since,
+      USN until,
+      const std::function<void(const Record&)>& onRecord) const;
+
+ private:
+  FileDescriptor volume_;
+};
+
+} // namespace watchman
+
+#endif
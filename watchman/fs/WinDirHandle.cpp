@@ -20,10 +20,25 @@ namespace watchman {
 
 namespace {
 class WinDirHandle : public DirHandle {
+  // The ways to list a dir, from the most to the least informative.  Each
+  // one falls back to the next where the OS or filesystem doesn't support
+  // it.
+  enum class Mode {
+    // Win8+, on filesystems with 128-bit file ids (NTFS, ReFS)
+    FileIdExtd,
+    // Win8+
+    FullDirectory,
+    // FindFirstFile
+    Win7,
+  };
+
   std::wstring dirWPath_;
   FileDescriptor h_;
-  bool win7_{false};
-  FILE_FULL_DIR_INFO* info_{nullptr};
+  Mode mode_{Mode::FileIdExtd};
+  // The next entry to decode in buf_, if any
+  char* info_{nullptr};
+  // Each call fills as much of this as it can.  It is not any larger
+  // because SMB servers limit a directory query to 64KB anyway.
   char __declspec(align(8)) buf_[64 * 1024];
   HANDLE hDirFind_{nullptr};
   char nameBuf_[WATCHMAN_NAME_MAX];
@@ -47,7 +62,7 @@ class WinDirHandle : public DirHandle {
     // Use Win7 compatibility mode for readDir()
     if (getenv("WATCHMAN_WIN7_COMPAT") &&
         getenv("WATCHMAN_WIN7_COMPAT")[0] == '1') {
-      win7_ = true;
+      mode_ = Mode::Win7;
     }
 
     ent_ = DirEntry();
@@ -59,27 +74,46 @@ class WinDirHandle : public DirHandle {
   }
 
   const DirEntry* readDir() override {
-    if (win7_) {
-      return readDirWin7();
-    }
-    try {
-      return readDirWin8();
-    } catch (const std::system_error& err) {
-      if (err.code().value() != ERROR_INVALID_PARAMETER) {
-        throw;
+    while (true) {
+      try {
+        switch (mode_) {
+          case Mode::FileIdExtd:
+            return readDirWin8<FILE_ID_EXTD_DIR_INFO>(FileIdExtdDirectoryInfo);
+          case Mode::FullDirectory:
+            return readDirWin8<FILE_FULL_DIR_INFO>(FileFullDirectoryInfo);
+          case Mode::Win7:
+            return readDirWin7();
+        }
+      } catch (const std::system_error& err) {
+        // Not supported here.  That is only ever reported for the first
+        // read, so no entries have been returned yet.
+        auto code = err.code().value();
+        if (mode_ == Mode::Win7 ||
+            (code != ERROR_INVALID_PARAMETER &&
+             code != ERROR_INVALID_FUNCTION && code != ERROR_NOT_SUPPORTED)) {
+          throw;
+        }
+        mode_ = mode_ == Mode::FileIdExtd ? Mode::FullDirectory : Mode::Win7;
       }
-      // Fallback on Win7 implementation. FileFullDirectoryInfo
-      // parameter is not supported before Win8
-      win7_ = true;
-      return readDirWin7();
     }
   }
 
  private:
-  const DirEntry* readDirWin8() {
+  static void setFileId(
+      const FILE_ID_EXTD_DIR_INFO* info,
+      FileInformation& st) {
+    st.ino = foldFileId(info->FileId.Identifier);
+  }
+
+  static void setFileId(const FILE_FULL_DIR_INFO*, FileInformation&) {}
+
+  // Info is FILE_ID_EXTD_DIR_INFO or FILE_FULL_DIR_INFO, whichever infoClass
+  // fills buf_ with
+  template <typename Info>
+  const DirEntry* readDirWin8(FILE_INFO_BY_HANDLE_CLASS infoClass) {
     if (!info_) {
       if (!GetFileInformationByHandleEx(
-              (HANDLE)h_.handle(), FileFullDirectoryInfo, buf_, sizeof(buf_))) {
+              (HANDLE)h_.handle(), infoClass, buf_, sizeof(buf_))) {
         if (GetLastError() == ERROR_NO_MORE_FILES) {
           return nullptr;
         }
@@ -88,15 +122,16 @@ class WinDirHandle : public DirHandle {
             std::system_category(),
             "GetFileInformationByHandleEx");
       }
-      info_ = (FILE_FULL_DIR_INFO*)buf_;
+      info_ = buf_;
     }
+    auto info = reinterpret_cast<const Info*>(info_);
 
     // Decode the item currently pointed at
     DWORD len = WideCharToMultiByte(
         CP_UTF8,
         0,
-        info_->FileName,
-        info_->FileNameLength / sizeof(WCHAR),
+        info->FileName,
+        info->FileNameLength / sizeof(WCHAR),
         nameBuf_,
         sizeof(nameBuf_) - 1,
         nullptr,
@@ -110,16 +145,16 @@ class WinDirHandle : public DirHandle {
     nameBuf_[len] = 0;
 
     // Populate stat info to speed up the crawler() routine
-    ent_.stat = FileInformation(info_->FileAttributes);
-    FILETIME_LARGE_INTEGER_to_timespec(info_->CreationTime, &ent_.stat.ctime);
-    FILETIME_LARGE_INTEGER_to_timespec(info_->LastAccessTime, &ent_.stat.atime);
-    FILETIME_LARGE_INTEGER_to_timespec(info_->LastWriteTime, &ent_.stat.mtime);
-    ent_.stat.size = info_->EndOfFile.QuadPart;
+    ent_.stat = FileInformation(info->FileAttributes);
+    FILETIME_LARGE_INTEGER_to_timespec(info->CreationTime, &ent_.stat.ctime);
+    FILETIME_LARGE_INTEGER_to_timespec(info->LastAccessTime, &ent_.stat.atime);
+    FILETIME_LARGE_INTEGER_to_timespec(info->LastWriteTime, &ent_.stat.mtime);
+    ent_.stat.size = info->EndOfFile.QuadPart;
+    setFileId(info, ent_.stat);
 
     // Advance the pointer to the next entry ready for the next read
-    info_ = info_->NextEntryOffset == 0
-        ? nullptr
-        : (FILE_FULL_DIR_INFO*)(((char*)info_) + info_->NextEntryOffset);
+    info_ = info->NextEntryOffset == 0 ? nullptr
+                                       : info_ + info->NextEntryOffset;
 
     return &ent_;
   }
@@ -140,6 +140,23 @@ int main(int argc, char** argv) {
     LOG(INFO) << "PASS: one-off query saw the touched hit file";
   }
 
+  LOG(INFO) << "Testing typed query";
+  auto typed =
+      c.queryTyped(
+           dynamic::object("expression", dynamic::array("name", "hit"))(
+               "fields", dynamic::array("name", "exists", "size"))(
+               "since", clock_before_hit),
+           current_dir_ptr)
+          .get();
+  auto name = typed.fieldIndex("name");
+  auto exists = typed.fieldIndex("exists");
+  if (typed.size() != 1 || !name || !exists ||
+      typed.strings(*name)[0] != "hit" || !typed.integers(*exists)[0]) {
+    LOG(ERROR) << "FAIL: typed query missed the hit file";
+    return 1;
+  }
+  LOG(INFO) << "PASS: typed query saw the touched hit file";
+
   LOG(INFO) << "Flushing subscription";
   auto flush_res =
       c.flushSubscription(sub, std::chrono::milliseconds(1000)).wait().value();
@@ -3,6 +3,7 @@
 # This source code is licensed under the MIT license found in the
 # LICENSE file in the root directory of this source tree.
 
+import os
 
 from watchman.integration.lib import WatchmanInstance, WatchmanTestCase
 
@@ -36,3 +37,32 @@ class TestBulkStat(WatchmanTestCase.WatchmanTestCase):
             self.touchRelative(root, "foo")
             self.touchRelative(root, "bar")
             self.assertFileList(root, ["foo", "bar"])
+
+    def test_bulkstat_recrawl_unchanged(self) -> None:
+        if os.name == "nt":
+            self.skipTest("non admin symlinks not available")
+        config = {"_use_bulkstat": True}
+        with WatchmanInstance.Instance(config=config) as inst:
+            inst.start()
+            self.getClient(inst, replace_cached=True)
+
+            root = self.mkdtemp()
+            # pyre-fixme[16]: `TestBulkStat` has no attribute `client`.
+            self.client.query("watch", root)
+
+            # Created after the initial crawl, so that they are first
+            # stat'd one at a time rather than by reading their dir
+            self.touchRelative(root, "foo")
+            os.symlink("foo", os.path.join(root, "link"))
+            self.assertFileList(root, ["foo", "link"])
+
+            clock = self.client.query("clock", root)["clock"]
+            self.client.query("debug-recrawl", root)
+            self.touchRelative(root, "bar")
+            self.assertFileList(root, ["bar", "foo", "link"])
+
+            # Reading the dir mustn't disagree with those stats
+            res = self.client.query(
+                "query", root, {"since": clock, "fields": ["name"]}
+            )
+            self.assertFileListsEqual(res["files"], ["bar"])
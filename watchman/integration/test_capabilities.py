@@ -4,6 +4,7 @@
 # This source code is licensed under the MIT license found in the
 # LICENSE file in the root directory of this source tree.
 
+import json
 import os
 import sys
 
@@ -95,19 +96,40 @@ class TestCapabilities(WatchmanTestCase.WatchmanTestCase):
             res, {"version": "3.3", "capabilities": {"relative_root": True}}
         )
 
+    def hasFanotifyWatcher(self) -> bool:
+        # The fanotify watcher is only built against new enough kernel
+        # headers.  Asking for it by name tells whether it was built, even
+        # where it can't start for lack of privileges.
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            json.dump({"watcher": "fanotify"}, f)
+        try:
+            self.watchmanCommand("watch", root)
+        except pywatchman.CommandError as e:
+            return "no watcher named fanotify" not in str(e)
+        self.watchmanCommand("watch-del", root)
+        return True
+
     def test_full_capability_set(self) -> None:
         client = self.getClient()
         res = client.listCapabilities()
 
         expected = {
+            "aggregate",
+            "bser-columns",
             "bser-v2",
+            "bser-zstd",
             "clock-sync-timeout",
+            "cmd-client-priority",
             "cmd-clock",
             "cmd-debug-ageout",
             "cmd-debug-contenthash",
             "cmd-debug-drop-privs",
             "cmd-debug-get-asserted-states",
             "cmd-debug-get-subscriptions",
+            "cmd-debug-memory",
+            "cmd-debug-memory-pressure",
+            "cmd-debug-metrics",
             "cmd-debug-poison",
             "cmd-debug-recrawl",
             "cmd-debug-root-status",
@@ -116,8 +138,10 @@ class TestCapabilities(WatchmanTestCase.WatchmanTestCase):
             "cmd-debug-show-cursors",
             "cmd-debug-status",
             "cmd-debug-symlink-target-cache",
+            "cmd-debug-trace",
             "cmd-debug-watcher-info",
             "cmd-debug-watcher-info-clear",
+            "cmd-export-view",
             "cmd-find",
             "cmd-flush-subscriptions",
             "cmd-get-config",
@@ -150,6 +174,7 @@ class TestCapabilities(WatchmanTestCase.WatchmanTestCase):
             "field-atime_ns",
             "field-atime_us",
             "field-cclock",
+            "field-content.gitsha1hex",
             "field-content.sha1hex",
             "field-ctime",
             "field-ctime_f",
@@ -175,11 +200,16 @@ class TestCapabilities(WatchmanTestCase.WatchmanTestCase):
             "field-type",
             "field-uid",
             "glob_generator",
+            "limit",
+            "order_by",
+            "pipelining",
+            "query_timeout",
             "relative_root",
             "saved-state-local",
             "scm-git",
             "scm-hg",
             "scm-since",
+            "stream",
             "suffix-set",
             "term-allof",
             "term-anyof",
@@ -200,7 +230,9 @@ class TestCapabilities(WatchmanTestCase.WatchmanTestCase):
             "term-suffix",
             "term-true",
             "term-type",
+            "trigger-persistent",
             "watcher-eden",
+            "watcher-poll",
             "wildmatch",
             "wildmatch-multislash",
         }
@@ -213,9 +245,14 @@ class TestCapabilities(WatchmanTestCase.WatchmanTestCase):
             expected.add("cmd-debug-fsevents-inject-drop")
         elif sys.platform == "linux":
             expected.add("watcher-inotify")
+            if self.hasFanotifyWatcher():
+                expected.add("watcher-fanotify")
         elif sys.platform == "win32":
             expected.add("watcher-win32")
 
+        if os.name != "nt":
+            expected.add("shared_memory")
+
         if os.environ.get("TESTING_VIA_BUCK", "0") == "1":
             expected.add("saved-state-manifold")
 
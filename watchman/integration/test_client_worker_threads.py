@@ -0,0 +1,49 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+import os
+
+from watchman.integration.lib import WatchmanInstance, WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestClientWorkerThreads(WatchmanTestCase.WatchmanTestCase):
+    def checkOSApplicability(self) -> None:
+        if os.name == "nt":
+            self.skipTest("client_worker_threads is not supported on Windows")
+
+    def test_more_clients_than_workers(self) -> None:
+        config = {"client_worker_threads": 2}
+        with WatchmanInstance.Instance(config=config) as inst:
+            inst.start()
+            root = self.mkdtemp()
+            self.touchRelative(root, "foo")
+
+            clients = [self.getClient(inst, no_cache=True) for _ in range(8)]
+            for client in clients:
+                self.addCleanup(client.close)
+            clients[0].query("watch", root)
+
+            # Each client keeps its own connection state while idle
+            for i, client in enumerate(clients):
+                client.query("subscribe", root, "sub%d" % i, {"fields": ["name"]})
+                client.receive()
+                client.getSubscription("sub%d" % i, root=root)
+
+            self.touchRelative(root, "bar")
+            for i, client in enumerate(clients):
+                res = client.query(
+                    "query", root, {"fields": ["name"], "expression": ["name", "bar"]}
+                )
+                self.assertEqual(res["files"], ["bar"])
+                # The subscription update is delivered to the client that
+                # subscribed, either before or after the query response
+                while True:
+                    data = client.getSubscription("sub%d" % i, root=root)
+                    if data and any("bar" in d.get("files", []) for d in data):
+                        break
+                    client.receive()
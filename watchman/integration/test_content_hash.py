@@ -9,7 +9,7 @@ import hashlib
 import json
 import os
 
-from watchman.integration.lib import WatchmanTestCase
+from watchman.integration.lib import WatchmanInstance, WatchmanTestCase
 
 
 @WatchmanTestCase.expand_matrix
@@ -140,6 +140,41 @@ class TestContentHash(WatchmanTestCase.WatchmanTestCase):
         )
         self.assertEqual(expect_hex, res["files"][0]["content.sha1hex"])
 
+    def test_contentHashWarmGlobs(self) -> None:
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            f.write(json.dumps({"content_hash_warm_globs": ["**/*.bin"]}))
+
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, [".watchmanconfig"])
+
+        # Only files that change after the crawl, and match, are hashed.
+        # Move the file into place so that it is never seen half-written.
+        os.mkdir(os.path.join(root, "out"))
+        expect_hex = self.write_file_and_hash(os.path.join(root, "foo.tmp"), "hello\n")
+        os.rename(os.path.join(root, "foo.tmp"), os.path.join(root, "out", "foo.bin"))
+        self.write_file_and_hash(os.path.join(root, "bar.txt"), "bar\n")
+
+        def warmed():
+            stats = self.watchmanCommand("debug-contenthash", root)
+            return stats["warmQueued"] >= 1 and stats["warmPending"] == 0
+
+        self.waitFor(warmed)
+        stats = self.watchmanCommand("debug-contenthash", root)
+        self.assertEqual(stats["warmQueued"], 1)
+        self.assertEqual(stats["size"], 1)
+
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {"expression": ["suffix", "bin"], "fields": ["name", "content.sha1hex"]},
+        )
+        self.assertEqual(expect_hex, res["files"][0]["content.sha1hex"])
+        stats = self.watchmanCommand("debug-contenthash", root)
+        self.assertEqual(stats["queryLookups"], 1)
+        self.assertEqual(stats["queryHits"], 1)
+        self.assertEqual(stats["warmHitRatio"], 1.0)
+
     def test_cacheLimit(self) -> None:
         root = self.mkdtemp()
 
@@ -174,3 +209,38 @@ class TestContentHash(WatchmanTestCase.WatchmanTestCase):
         self.assertEqual(stats["cacheMiss"], 2)
         self.assertEqual(stats["cacheStore"], 2)
         self.assertEqual(stats["cacheLoad"], 2)
+
+    def test_persistedAcrossRestart(self) -> None:
+        root = self.mkdtemp()
+        expect_hex = self.write_file_and_hash(os.path.join(root, "foo"), "hello\n")
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            f.write(json.dumps({"content_hash_persist": True}))
+
+        query = {"expression": ["name", "foo"], "fields": ["name", "content.sha1hex"]}
+        inst = WatchmanInstance.Instance()
+        try:
+            inst.start()
+            client = self.getClient(inst, no_cache=True)
+            client.query("watch", root)
+            res = client.query("query", root, query)
+            self.assertEqual(expect_hex, res["files"][0]["content.sha1hex"])
+            stats = client.query("debug-contenthash", root)
+            self.assertEqual(stats["storeMiss"], 1)
+            self.assertEqual(stats["storeSize"], 1)
+
+            # A clean shutdown writes out the hashes
+            client.query("shutdown-server")
+            client.close()
+            inst.proc.wait()
+
+            inst.start()
+            client = self.getClient(inst, no_cache=True)
+            self.addCleanup(client.close)
+            client.query("watch", root)
+            res = client.query("query", root, query)
+            self.assertEqual(expect_hex, res["files"][0]["content.sha1hex"])
+            stats = client.query("debug-contenthash", root)
+            self.assertEqual(stats["storeHit"], 1)
+            self.assertEqual(stats["storeMiss"], 0)
+        finally:
+            inst.stop()
@@ -0,0 +1,53 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+import json
+import os
+import shutil
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestDirFdCache(WatchmanTestCase.WatchmanTestCase):
+    def test_renamedAndReplacedDirs(self) -> None:
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            # Small enough for the crawl to evict dirs too
+            json.dump({"dir_fd_cache_size": 2}, f)
+        files = [".watchmanconfig"]
+        for d in ["a", "b", "c/d"]:
+            os.makedirs(os.path.join(root, d))
+            self.touchRelative(root, d, "file")
+            os.symlink("target", os.path.join(root, d, "link"))
+            files += [d + "/file", d + "/link"]
+
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files + ["a", "b", "c", "c/d"])
+
+        # The names in a renamed dir must not resolve in its old place
+        os.rename(os.path.join(root, "a"), os.path.join(root, "e"))
+        # nor those in a dir that was replaced by another
+        shutil.rmtree(os.path.join(root, "c"))
+        os.makedirs(os.path.join(root, "c"))
+        self.touchRelative(root, "c", "other")
+        self.touchRelative(root, "b", "new")
+
+        self.assertFileList(
+            root,
+            [
+                ".watchmanconfig",
+                "b",
+                "b/file",
+                "b/link",
+                "b/new",
+                "c",
+                "c/other",
+                "e",
+                "e/file",
+                "e/link",
+            ],
+        )
@@ -60,3 +60,31 @@ class TestDirMove(WatchmanTestCase.WatchmanTestCase):
         self.build_under(root, "dir", latency=1)
 
         self.assertFileList(root, ["dir", "dir/a"])
+
+    def test_moveKeepsWatchingSubdirs(self) -> None:
+        root = self.mkdtemp()
+
+        os.makedirs(os.path.join(root, "dir", "sub"))
+        self.touchRelative(root, "dir", "a")
+        self.touchRelative(root, "dir", "sub", "b")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["dir", "dir/a", "dir/sub", "dir/sub/b"])
+        clock = self.watchmanCommand("clock", root)["clock"]
+
+        os.rename(os.path.join(root, "dir"), os.path.join(root, "moved"))
+        self.assertFileList(root, ["moved", "moved/a", "moved/sub", "moved/sub/b"])
+
+        # Changes below the moved dir are seen at their new paths
+        self.touchRelative(root, "moved", "sub", "c")
+        self.assertFileList(
+            root, ["moved", "moved/a", "moved/sub", "moved/sub/b", "moved/sub/c"]
+        )
+
+        res = self.watchmanCommand(
+            "query", root, {"since": clock, "fields": ["name", "exists"]}
+        )
+        changes = {f["name"]: f["exists"] for f in res["files"]}
+        for name in ["dir", "dir/a", "dir/sub", "dir/sub/b"]:
+            self.assertFalse(changes[name], name)
+        for name in ["moved", "moved/a", "moved/sub", "moved/sub/b", "moved/sub/c"]:
+            self.assertTrue(changes[name], name)
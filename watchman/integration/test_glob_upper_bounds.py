@@ -0,0 +1,84 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+import json
+import os
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestGlobUpperBounds(WatchmanTestCase.WatchmanTestCase):
+    def test_boundedQueriesMatchUnbounded(self) -> None:
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            json.dump({"glob_upper_bounds": True}, f)
+        for d in ["src/lib", "src/app", "docs", "odd[dir]"]:
+            os.makedirs(os.path.join(root, d))
+        for name in [
+            "src/lib/a.c",
+            "src/lib/.hidden.c",
+            "src/app/b.c",
+            "src/app/b.h",
+            "docs/c.c",
+            "odd[dir]/d.c",
+            "top.c",
+        ]:
+            self.touchRelative(root, *name.split("/"))
+        self.watchmanCommand("watch", root)
+        self.assertFileList(
+            root,
+            [
+                ".watchmanconfig",
+                "docs",
+                "docs/c.c",
+                "odd[dir]",
+                "odd[dir]/d.c",
+                "src",
+                "src/app",
+                "src/app/b.c",
+                "src/app/b.h",
+                "src/lib",
+                "src/lib/.hidden.c",
+                "src/lib/a.c",
+                "top.c",
+            ],
+        )
+
+        def query(expr, **kwargs):
+            params = {"expression": expr, "fields": ["name"]}
+            params.update(kwargs)
+            return self.watchmanCommand("query", root, params)["files"]
+
+        self.assertFileListsEqual(
+            query(["match", "src/**/*.c", "wholename"]),
+            ["src/lib/a.c", "src/lib/.hidden.c", "src/app/b.c"],
+        )
+        self.assertFileListsEqual(
+            query(
+                [
+                    "anyof",
+                    ["dirname", "docs"],
+                    ["match", "src/app/*.h", "wholename"],
+                ]
+            ),
+            ["docs/c.c", "src/app/b.h"],
+        )
+        self.assertFileListsEqual(
+            query(["allof", ["type", "f"], ["dirname", "odd[dir]"]]),
+            ["odd[dir]/d.c"],
+        )
+        self.assertFileListsEqual(
+            query(["dirname", "lib"], relative_root="src"),
+            ["lib/a.c", "lib/.hidden.c"],
+        )
+        self.assertFileListsEqual(query(["dirname", "missing"]), [])
+
+        # Unbounded prefixes walk everything
+        self.assertFileListsEqual(
+            query(["match", "*.c", "wholename"]),
+            ["top.c"],
+        )
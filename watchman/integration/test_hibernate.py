@@ -0,0 +1,54 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+import json
+import os
+import time
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestHibernate(WatchmanTestCase.WatchmanTestCase):
+    def waitForHibernation(self, root) -> None:
+        # Every command resets the root's idle time, so give it a couple of
+        # idle seconds between looks
+        for _ in range(10):
+            time.sleep(2)
+            info = self.watchmanCommand("debug-watcher-info", root)
+            view = info["watcher-debug-info"]["view"]
+            if view["hibernating"]:
+                return
+        self.fail("the view never hibernated")
+
+    def test_rehydratesOnQuery(self) -> None:
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            json.dump({"hibernate_age_seconds": 1}, f)
+        os.mkdir(os.path.join(root, "dir"))
+        self.touchRelative(root, "dir", "file")
+
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, [".watchmanconfig", "dir", "dir/file"])
+        clock = self.watchmanCommand("clock", root)["clock"]
+
+        self.waitForHibernation(root)
+
+        # Changed while the view was on disk
+        self.touchRelative(root, "dir", "new")
+        os.unlink(os.path.join(root, "dir", "file"))
+
+        self.assertFileList(root, [".watchmanconfig", "dir", "dir/new"])
+        info = self.watchmanCommand("debug-watcher-info", root)
+        view = info["watcher-debug-info"]["view"]
+        self.assertFalse(view["hibernating"])
+        self.assertGreaterEqual(view["hibernation_count"], 1)
+
+        # A clock from before the hibernation sees a fresh instance
+        res = self.watchmanCommand(
+            "query", root, {"since": clock, "fields": ["name"]}
+        )
+        self.assertTrue(res["is_fresh_instance"])
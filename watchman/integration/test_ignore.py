@@ -87,3 +87,44 @@ class TestIgnore(WatchmanTestCase.WatchmanTestCase):
                 "foo",
             ],
         )
+
+    def test_ignore_globs(self) -> None:
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            json.dump({"ignore_globs": ["**/node_modules", "gen/*/out"]}, f)
+        os.makedirs(os.path.join(root, "a", "node_modules", "lib"))
+        os.makedirs(os.path.join(root, "gen", "x", "out"))
+        self.touchRelative(root, "a", "node_modules", "lib", "index.js")
+        self.touchRelative(root, "gen", "x", "out", "bin")
+        self.touchRelative(root, "a", "foo")
+
+        self.watchmanCommand("watch", root)
+        files = [".watchmanconfig", "a", "a/foo", "gen", "gen/x"]
+        self.assertFileList(root, files=files)
+
+        os.makedirs(os.path.join(root, "b", "node_modules"))
+        self.touchRelative(root, "b", "node_modules", "dontlookatme")
+        self.touchRelative(root, "gen", "x", "out", "orme")
+        self.touchRelative(root, "b", "bar")
+        self.assertFileList(root, files=files + ["b", "b/bar"])
+
+    def test_inotify_drops_ignored_events(self) -> None:
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            json.dump({"ignore_dirs": ["build"]}, f)
+        self.touchRelative(root, "foo")
+
+        watch = self.watchmanCommand("watch", root)
+        if watch["watcher"] != "inotify":
+            self.skipTest("only the inotify watcher drops events itself")
+        self.assertFileList(root, files=[".watchmanconfig", "foo"])
+
+        os.mkdir(os.path.join(root, "build"))
+        os.rmdir(os.path.join(root, "build"))
+        self.touchRelative(root, "bar")
+        self.assertFileList(root, files=[".watchmanconfig", "bar", "foo"])
+
+        info = self.watchmanCommand("debug-watcher-info", root)
+        self.assertGreaterEqual(
+            info["watcher-debug-info"]["dropped_ignored_path_count"], 2
+        )
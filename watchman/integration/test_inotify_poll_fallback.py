@@ -0,0 +1,53 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+import json
+import os
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestInotifyPollFallback(WatchmanTestCase.WatchmanTestCase):
+    def test_releasesColdTrees(self) -> None:
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            # The cap runs the root out of watches partway through the crawl
+            json.dump(
+                {
+                    "inotify_poll_fallback": True,
+                    "inotify_max_watches": 8,
+                    "poll_interval_min_ms": 50,
+                    "poll_interval_max_ms": 200,
+                },
+                f,
+            )
+        files = [".watchmanconfig", "cold"]
+        for i in range(20):
+            os.makedirs(os.path.join(root, "cold", str(i)))
+            self.touchRelative(root, "cold", str(i), "file")
+            files += ["cold/%d" % i, "cold/%d/file" % i]
+
+        watch = self.watchmanCommand("watch", root)
+        if watch["watcher"] != "inotify":
+            self.skipTest("only the inotify watcher falls back to polling")
+        self.assertFileList(root, files)
+
+        info = self.watchmanCommand("debug-watcher-info", root)
+        fallback = info["watcher-debug-info"]["poll_fallback"]
+        self.assertGreater(fallback["release_count"], 0)
+        self.assertGreater(fallback["released_watch_count"], 0)
+        self.assertGreater(fallback["polled_tree_count"], 0)
+
+        # Most of the dirs are polled now, and which ones depends on the
+        # order of the crawl, so change all of them; the root itself is
+        # still watched
+        for i in range(20):
+            self.touchRelative(root, "cold", str(i), "new")
+            files.append("cold/%d/new" % i)
+        os.mkdir(os.path.join(root, "cold", "0", "sub"))
+        self.touchRelative(root, "top")
+        self.assertFileList(root, files + ["cold/0/sub", "top"])
@@ -0,0 +1,54 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+import json
+import os
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestLazyCrawl(WatchmanTestCase.WatchmanTestCase):
+    def makeRoot(self):
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            json.dump({"lazy_crawl_depth": 1}, f)
+        for d in ["a/x", "b/y"]:
+            os.makedirs(os.path.join(root, d))
+            self.touchRelative(root, d, "file.c")
+        self.touchRelative(root, "top.c")
+        return root
+
+    def names(self, root, query):
+        query["fields"] = ["name"]
+        return self.watchmanCommand("query", root, query)["files"]
+
+    def test_generatorsCrawlWhatTheyNeed(self) -> None:
+        root = self.makeRoot()
+        self.watchmanCommand("watch", root)
+
+        self.assertFileListsEqual(
+            self.names(root, {"path": ["a/x/file.c"]}), ["a/x/file.c"]
+        )
+        self.assertFileListsEqual(
+            self.names(root, {"glob": ["b/**/*.c"]}), ["b/y/file.c"]
+        )
+        self.assertFileListsEqual(
+            self.names(
+                root,
+                {"relative_root": "a", "expression": ["type", "f"]},
+            ),
+            ["x/file.c"],
+        )
+
+    def test_allFilesCrawlsEverything(self) -> None:
+        root = self.makeRoot()
+        self.watchmanCommand("watch", root)
+
+        self.assertFileListsEqual(
+            self.names(root, {"suffix": ["c"]}),
+            ["a/x/file.c", "b/y/file.c", "top.c"],
+        )
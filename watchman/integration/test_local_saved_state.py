@@ -5,6 +5,7 @@
 # LICENSE file in the root directory of this source tree.
 
 
+import json
 import os
 
 import pywatchman
@@ -274,6 +275,38 @@ o  changeset:
         self.assertSavedStateInfo(res, expected_path, saved_state_rev_feature3)
         self.assertFileListsEqual(res["files"], ["f1", "bar", "car"])
 
+    def test_localSavedStateForFreshInstance(self) -> None:
+        # A clock from before the root was watched again is a fresh instance;
+        # with fresh_instance_saved_state it gets the changes since the saved
+        # state instead of every file
+        with open(os.path.join(self.root, ".watchmanconfig"), "w") as f:
+            json.dump({"fresh_instance_saved_state": True}, f)
+        self.watchmanCommand("watch-del", self.root)
+        self.watchmanCommand("watch", self.root)
+
+        local_storage = self.mkdtemp()
+        saved_state_rev_feature3 = self.saveState(
+            "example_project", "feature3", local_storage
+        )
+        config = {
+            "local-storage-path": local_storage,
+            "project": "example_project",
+            "max-commits": 10,
+        }
+        res = self.watchmanCommand("query", self.root, self.getQuery(config))
+        self.assertCommitIDEquals(res, saved_state_rev_feature3)
+
+        self.watchmanCommand("watch-del", self.root)
+        self.watchmanCommand("watch", self.root)
+        test_query = self.getQuery(config)
+        test_query["since"] = res["clock"]
+        res = self.watchmanCommand("query", self.root, test_query)
+        self.assertFalse(res["is_fresh_instance"])
+        self.assertCommitIDEquals(res, saved_state_rev_feature3)
+        self.assertFileListsEqual(
+            res["files"], [".watchmanconfig", "f1", "bar", "car"]
+        )
+
     def test_localSavedStateLookupSuccessOmitChangedFiles(self) -> None:
         # Local saved state should return the saved state commit id, info, and
         # changed files since the saved state if valid state found within limit.
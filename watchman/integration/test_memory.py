@@ -0,0 +1,33 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestMemory(WatchmanTestCase.WatchmanTestCase):
+    def test_memory_is_attributed_by_root(self) -> None:
+        root = self.mkdtemp()
+        self.touchRelative(root, "foo")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["foo"])
+
+        res = self.watchmanCommand("debug-memory")
+        by_subsystem = res["roots"][root]["by_subsystem"]
+        self.assertGreater(by_subsystem["view_nodes"], 0)
+
+        summary = res["summary"]
+        self.assertGreaterEqual(summary["view_nodes"], by_subsystem["view_nodes"])
+        self.assertGreaterEqual(summary["client_buffers"], 0)
+        self.assertTrue(
+            any(client["buffer_bytes"] >= 0 for client in res["clients"])
+        )
+
+    def test_heap_profiler_is_off_by_default(self) -> None:
+        status = self.watchmanCommand("debug-memory")["heap_profiler"]
+        self.assertFalse(status["running"])
+        self.assertEqual(status["profiles"], [])
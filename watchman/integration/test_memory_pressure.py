@@ -0,0 +1,36 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+import os
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestMemoryPressure(WatchmanTestCase.WatchmanTestCase):
+    def test_relievesWatchedRoots(self) -> None:
+        root = self.mkdtemp()
+        self.touchRelative(root, "a")
+        self.touchRelative(root, "b")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["a", "b"])
+
+        os.unlink(os.path.join(root, "b"))
+        self.assertFileList(root, ["a"])
+
+        res = self.watchmanCommand("debug-memory-pressure")
+        released = res["released"]
+        self.assertEqual(released["reason"], "debug-memory-pressure")
+        self.assertGreaterEqual(len(released["roots"]), 1)
+        for rootReleased in released["roots"].values():
+            self.assertIn("query_results", rootReleased)
+
+        # The view still answers queries afterwards
+        self.touchRelative(root, "c")
+        self.assertFileList(root, ["a", "c"])
+
+        status = self.watchmanCommand("debug-memory")["memory_pressure"]
+        self.assertIn("running", status)
@@ -0,0 +1,93 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestMetrics(WatchmanTestCase.WatchmanTestCase):
+    def test_query_latency_is_recorded(self) -> None:
+        root = self.mkdtemp()
+        self.touchRelative(root, "foo")
+        self.watchmanCommand("watch", root)
+        self.watchmanCommand("query", root, {"fields": ["name"]})
+
+        metrics = self.watchmanCommand("debug-metrics")
+        self.assertGreaterEqual(metrics["commands"]["query"]["count"], 1)
+
+        root_metrics = metrics["roots"][root]
+        elapsed = root_metrics["query"]["elapsed"]
+        self.assertGreaterEqual(elapsed["count"], 1)
+        self.assertEqual(elapsed["count"], sum(b[1] for b in elapsed["buckets"]))
+        self.assertLessEqual(elapsed["p50_us"], elapsed["max_us"])
+        self.assertGreaterEqual(root_metrics["events"], 1)
+
+    def test_query_usage_is_reported(self) -> None:
+        root = self.mkdtemp()
+        self.touchRelative(root, "foo")
+        self.touchRelative(root, "bar")
+        self.watchmanCommand("watch", root)
+
+        res = self.watchmanCommand(
+            "query", root, {"fields": ["name"], "suffix": ["nomatch"]}
+        )
+        usage = res["debug"]["usage"]
+        self.assertEqual(usage["files_rendered"], 0)
+        self.assertGreaterEqual(usage["cpu_time_us"], 0)
+
+        res = self.watchmanCommand("query", root, {"fields": ["name"]})
+        usage = res["debug"]["usage"]
+        self.assertGreaterEqual(usage["files_walked"], 2)
+        self.assertEqual(usage["files_rendered"], len(res["files"]))
+
+    def test_repeated_query_is_parsed_once(self) -> None:
+        root = self.mkdtemp()
+        self.touchRelative(root, "foo.c")
+        self.touchRelative(root, "bar.h")
+        self.watchmanCommand("watch", root)
+
+        def query(request_id):
+            return self.watchmanCommand(
+                "query",
+                root,
+                {
+                    "expression": ["anyof", ["match", "*.c"], ["name", "nope"]],
+                    "fields": ["name"],
+                    "request_id": request_id,
+                },
+            )
+
+        before = self.watchmanCommand("debug-metrics")["roots"][root]
+        self.assertFileListsEqual(query("one")["files"], ["foo.c"])
+        # Only the request_id differs, so the parse is reused
+        self.assertFileListsEqual(query("two")["files"], ["foo.c"])
+
+        after = self.watchmanCommand("debug-metrics")["roots"][root]
+        self.assertEqual(
+            after["parsed_query_cache_misses"] - before["parsed_query_cache_misses"],
+            1,
+        )
+        self.assertEqual(
+            after["parsed_query_cache_hits"] - before["parsed_query_cache_hits"], 1
+        )
+
+    def test_openmetrics(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+        self.watchmanCommand("clock", root)
+
+        text = self.watchmanCommand("debug-metrics", "openmetrics")["openmetrics"]
+        self.assertIn(
+            'watchman_command_duration_seconds_count{command="clock"}', text
+        )
+        self.assertIn("# TYPE watchman_root_events counter", text)
+        self.assertTrue(text.endswith("# EOF\n"))
+
+    def test_bad_format(self) -> None:
+        with self.assertRaises(Exception) as ctx:
+            self.watchmanCommand("debug-metrics", "xml")
+        self.assertIn("openmetrics", str(ctx.exception))
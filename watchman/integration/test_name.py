@@ -144,3 +144,49 @@ class TestNameExpr(WatchmanTestCase.WatchmanTestCase):
         self.assertRegex(
             str(ctx.exception), "Invalid scope 'invalid' for i?name expression"
         )
+
+    def test_wholename_list_lookup(self) -> None:
+        root = self.mkdtemp()
+        os.makedirs(os.path.join(root, "a", "b"))
+        for name in ["one", "two", "three", "four"]:
+            self.touchRelative(root, "a", "b", name)
+        self.touchRelative(root, "top")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(
+            root,
+            ["a", "a/b", "a/b/four", "a/b/one", "a/b/three", "a/b/two", "top"],
+        )
+
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {
+                "expression": [
+                    "anyof",
+                    ["name", ["a/b/one", "a/b/missing", "a/b"], "wholename"],
+                    ["name", "top", "wholename"],
+                ],
+                "fields": ["name"],
+            },
+        )
+        self.assertFileListsEqual(res["files"], ["a/b/one", "a/b", "top"])
+        if not self.isCaseInsensitive():
+            self.assertEqual(
+                [(step["generator"], step["access"]) for step in res["debug"]["plan"]],
+                [("all", "wholename_lookup")],
+            )
+
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {
+                "expression": [
+                    "allof",
+                    ["type", "f"],
+                    ["name", ["b/two", "b", "b/nope"], "wholename"],
+                ],
+                "relative_root": "a",
+                "fields": ["name"],
+            },
+        )
+        self.assertFileListsEqual(res["files"], ["b/two"])
@@ -0,0 +1,49 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+import json
+import os
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestPartialCrawlQueries(WatchmanTestCase.WatchmanTestCase):
+    def test_subtreeQueriesDuringCrawl(self) -> None:
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            # Slow the crawl down enough for the queries to overtake it
+            json.dump(
+                {"partial_crawl_queries": True, "crawl_max_dirs_per_sec": 20}, f
+            )
+        os.makedirs(os.path.join(root, "a"))
+        self.touchRelative(root, "a", "file.c")
+        deep = []
+        for i in range(20):
+            d = "z/%d" % i
+            os.makedirs(os.path.join(root, d))
+            self.touchRelative(root, d, "file.c")
+            deep.append(d + "/file.c")
+
+        self.watchmanCommand("watch", root)
+
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {"relative_root": "a", "expression": ["type", "f"], "fields": ["name"]},
+        )
+        self.assertFileListsEqual(res["files"], ["file.c"])
+
+        res = self.watchmanCommand(
+            "query", root, {"path": ["a"], "fields": ["name"]}
+        )
+        self.assertFileListsEqual(res["files"], ["a", "a/file.c"])
+
+        # A query for the whole root waits for the whole crawl
+        res = self.watchmanCommand(
+            "query", root, {"suffix": ["c"], "fields": ["name"]}
+        )
+        self.assertFileListsEqual(res["files"], ["a/file.c"] + deep)
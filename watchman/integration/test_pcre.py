@@ -5,6 +5,8 @@
 # LICENSE file in the root directory of this source tree.
 
 
+import os
+
 import pywatchman
 from watchman.integration.lib import WatchmanTestCase
 
@@ -73,3 +75,43 @@ class TestPcre(WatchmanTestCase.WatchmanTestCase):
         out = self.watchmanCommand("find", root, "-P", ".*C$")
         self.assertEqual(1, len(out["files"]))
         self.assertFileListsEqual(["foo.c"], [out["files"][0]["name"]])
+
+    def test_anchored_pcre(self) -> None:
+        self.check_pcre()
+
+        root = self.mkdtemp()
+        os.mkdir(os.path.join(root, "src"))
+        os.mkdir(os.path.join(root, "lib"))
+        self.touchRelative(root, "src", "a.c")
+        self.touchRelative(root, "srcs.c")
+        self.touchRelative(root, "lib", "src.c")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["lib", "lib/src.c", "src", "src/a.c", "srcs.c"])
+
+        def query(term, pattern):
+            res = self.watchmanCommand(
+                "query",
+                root,
+                {
+                    "expression": [
+                        "allof",
+                        ["type", "f"],
+                        [term, pattern, "wholename"],
+                    ],
+                    "fields": ["name"],
+                },
+            )
+            return sorted(res["files"])
+
+        self.assertFileListsEqual(["src/a.c"], query("pcre", "^src/.*\\.c$"))
+        self.assertFileListsEqual(["src/a.c", "srcs.c"], query("pcre", "^srcs?"))
+        if not self.isCaseInsensitive():
+            # pcre matches case sensitivity of filesystem
+            self.assertFileListsEqual([], query("pcre", "^SRC/"))
+        self.assertFileListsEqual(["src/a.c"], query("ipcre", "^SRC/"))
+        self.assertFileListsEqual(
+            ["lib/src.c", "src/a.c"], query("pcre", "^(lib|src)/")
+        )
+        self.assertFileListsEqual(
+            ["lib/src.c", "src/a.c"], query("pcre", "^src/|^lib/")
+        )
@@ -0,0 +1,45 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+import pywatchman
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestPipelining(WatchmanTestCase.WatchmanTestCase):
+    def test_responsesInOrder(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+        for i in range(10):
+            self.touchRelative(root, "f%d" % i)
+        self.assertFileList(root, ["f%d" % i for i in range(10)])
+
+        client = self.getClient()
+        # More commands than fit in the window, so that some are sent as
+        # earlier responses are read
+        commands = [
+            ("query", root, {"fields": ["name"], "glob": ["f%d" % (i % 10)]})
+            for i in range(client.pipelineWindow * 3)
+        ]
+        results = client.queryPipelined(commands)
+        self.assertEqual(
+            [r["files"] for r in results],
+            [["f%d" % (i % 10)] for i in range(len(commands))],
+        )
+
+    def test_errorDoesNotLoseResponses(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+        self.touchRelative(root, "111")
+        self.assertFileList(root, ["111"])
+
+        client = self.getClient()
+        query = ("query", root, {"fields": ["name"]})
+        with self.assertRaises(pywatchman.CommandError):
+            client.queryPipelined([query, ("no-such-command",), query])
+
+        # The connection is still in step with its responses
+        self.assertEqual(client.queryPipelined([query])[0]["files"], ["111"])
@@ -0,0 +1,75 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+import json
+import os
+import shutil
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestPollWatcher(WatchmanTestCase.WatchmanTestCase):
+    def makeRoot(self):
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            json.dump(
+                {
+                    "watcher": "poll",
+                    "poll_interval_min_ms": 50,
+                    "poll_interval_max_ms": 200,
+                },
+                f,
+            )
+        return root
+
+    def test_pollSeesChanges(self) -> None:
+        root = self.makeRoot()
+        os.mkdir(os.path.join(root, "dir"))
+        self.touchRelative(root, "dir", "file")
+
+        watch = self.watchmanCommand("watch", root)
+        self.assertEqual(watch["watcher"], "poll")
+        self.assertFileList(root, [".watchmanconfig", "dir", "dir/file"])
+
+        self.touchRelative(root, "dir", "new")
+        os.makedirs(os.path.join(root, "dir", "sub", "deeper"))
+        self.touchRelative(root, "dir", "sub", "deeper", "file")
+        self.assertFileList(
+            root,
+            [
+                ".watchmanconfig",
+                "dir",
+                "dir/file",
+                "dir/new",
+                "dir/sub",
+                "dir/sub/deeper",
+                "dir/sub/deeper/file",
+            ],
+        )
+
+        shutil.rmtree(os.path.join(root, "dir", "sub"))
+        os.unlink(os.path.join(root, "dir", "file"))
+        self.assertFileList(root, [".watchmanconfig", "dir", "dir/new"])
+
+    def test_pollSeesInPlaceModification(self) -> None:
+        root = self.makeRoot()
+        self.touchRelative(root, "file")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, [".watchmanconfig", "file"])
+
+        clock = self.watchmanCommand("clock", root)["clock"]
+        # Doesn't change the dir, so is only seen by rescanning its files
+        with open(os.path.join(root, "file"), "w") as f:
+            f.write("modified")
+
+        def changed():
+            res = self.watchmanCommand(
+                "query", root, {"since": clock, "fields": ["name"]}
+            )
+            return res["files"]
+
+        self.assertWaitForEqual(["file"], changed)
@@ -0,0 +1,81 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+import os
+
+import pywatchman
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestQueryAggregate(WatchmanTestCase.WatchmanTestCase):
+    def makeTree(self, root) -> None:
+        os.makedirs(os.path.join(root, "a", "b"))
+        os.makedirs(os.path.join(root, "c"))
+        for name, size in [
+            ("top.txt", 1),
+            ("a/x.c", 10),
+            ("a/b/y.c", 100),
+            ("a/b/z.h", 1000),
+            ("c/w.TXT", 10000),
+        ]:
+            with open(os.path.join(root, name), "w") as f:
+                f.write("x" * size)
+
+    def test_aggregate(self) -> None:
+        root = self.mkdtemp()
+        self.makeTree(root)
+        self.watchmanCommand("watch", root)
+        self.assertFileList(
+            root,
+            ["top.txt", "a", "a/x.c", "a/b", "a/b/y.c", "a/b/z.h", "c", "c/w.TXT"],
+        )
+
+        def aggregate(spec):
+            res = self.watchmanCommand(
+                "query", root, {"expression": ["type", "f"], "aggregate": spec}
+            )
+            self.assertEqual(res["files"], [])
+            return res["aggregate"]
+
+        self.assertEqual(
+            aggregate({"sum": "size"}), {"count": 5, "size": 11111}
+        )
+        self.assertEqual(
+            aggregate({"group_by": "dirname", "sum": "size"}),
+            {
+                "": {"count": 1, "size": 1},
+                "a": {"count": 1, "size": 10},
+                "a/b": {"count": 2, "size": 1100},
+                "c": {"count": 1, "size": 10000},
+            },
+        )
+        self.assertEqual(
+            aggregate({"group_by": "dirname", "depth": 1}),
+            {"": {"count": 1}, "a": {"count": 3}, "c": {"count": 1}},
+        )
+        self.assertEqual(
+            aggregate({"group_by": "suffix", "sum": "size"}),
+            {
+                "txt": {"count": 2, "size": 10001},
+                "c": {"count": 2, "size": 110},
+                "h": {"count": 1, "size": 1000},
+            },
+        )
+
+    def test_invalid(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+
+        with self.assertRaisesRegex(pywatchman.CommandError, "group_by must be"):
+            self.watchmanCommand(
+                "query", root, {"aggregate": {"group_by": "mtime"}}
+            )
+
+        with self.assertRaisesRegex(pywatchman.CommandError, "can't be used"):
+            self.watchmanCommand(
+                "subscribe", root, "s", {"aggregate": {"sum": "size"}}
+            )
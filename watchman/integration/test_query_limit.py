@@ -0,0 +1,59 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+import pywatchman
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestQueryLimit(WatchmanTestCase.WatchmanTestCase):
+    def test_limit(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+        names = ["f%d.c" % i for i in range(20)] + ["g.h"]
+        for name in names:
+            self.touchRelative(root, name)
+        self.assertFileList(root, names)
+
+        for gen in [{}, {"suffix": ["c"]}, {"glob": ["*.c"]}, {"since": "c:0:0"}]:
+            query = {"expression": ["suffix", "c"], "fields": ["name"], "limit": 5}
+            query.update(gen)
+            res = self.watchmanCommand("query", root, query)
+            self.assertEqual(len(res["files"]), 5, gen)
+            for name in res["files"]:
+                self.assertTrue(name.endswith(".c"), name)
+
+        res = self.watchmanCommand(
+            "query", root, {"fields": ["name"], "limit": 100}
+        )
+        self.assertFileListsEqual(res["files"], names)
+
+    def test_existsOnly(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+        self.touchRelative(root, "a.c")
+        self.assertFileList(root, ["a.c"])
+
+        res = self.watchmanCommand(
+            "query", root, {"expression": ["suffix", "c"], "exists_only": True}
+        )
+        self.assertTrue(res["exists"])
+        self.assertEqual(res["files"], [])
+
+        res = self.watchmanCommand(
+            "query", root, {"expression": ["suffix", "h"], "exists_only": True}
+        )
+        self.assertFalse(res["exists"])
+
+    def test_invalid(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+
+        with self.assertRaisesRegex(pywatchman.CommandError, "limit must be"):
+            self.watchmanCommand("query", root, {"limit": 0})
+
+        with self.assertRaisesRegex(pywatchman.CommandError, "can't be used"):
+            self.watchmanCommand("subscribe", root, "s", {"limit": 1})
@@ -0,0 +1,76 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+import os
+
+import pywatchman
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestQueryOrder(WatchmanTestCase.WatchmanTestCase):
+    def test_orderByName(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+        names = ["f%02d" % i for i in range(25)]
+        for name in names:
+            self.touchRelative(root, name)
+        self.assertFileList(root, names)
+
+        res = self.watchmanCommand(
+            "query", root, {"fields": ["name"], "order_by": "name"}
+        )
+        self.assertEqual(res["files"], names)
+        self.assertNotIn("next_page_token", res)
+
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {"fields": ["name"], "order_by": "name", "order": "desc"},
+        )
+        self.assertEqual(res["files"], list(reversed(names)))
+
+    def test_pages(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+        names = ["f%02d" % i for i in range(25)]
+        for i, name in enumerate(names):
+            self.touchRelative(root, name)
+            # Give every file a distinct mtime, in the reverse of name order
+            os.utime(os.path.join(root, name), (1000 - i, 1000 - i))
+        self.assertFileList(root, names)
+
+        query = {"fields": ["name"], "order_by": "mtime", "page_size": 10}
+        pages = []
+        while True:
+            res = self.watchmanCommand("query", root, query)
+            pages.append(res["files"])
+            if "next_page_token" not in res:
+                break
+            query["page_token"] = res["next_page_token"]
+
+        self.assertEqual([len(page) for page in pages], [10, 10, 5])
+        self.assertEqual(sum(pages, []), list(reversed(names)))
+
+    def test_invalid(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+
+        with self.assertRaisesRegex(pywatchman.CommandError, "order_by must be"):
+            self.watchmanCommand("query", root, {"order_by": "size"})
+
+        with self.assertRaisesRegex(pywatchman.CommandError, "require order_by"):
+            self.watchmanCommand("query", root, {"page_size": 10})
+
+        with self.assertRaisesRegex(pywatchman.CommandError, "invalid page_token"):
+            self.watchmanCommand(
+                "query", root, {"order_by": "name", "page_token": "bogus"}
+            )
+
+        with self.assertRaisesRegex(pywatchman.CommandError, "can't be used"):
+            self.watchmanCommand(
+                "subscribe", root, "s", {"order_by": "name", "page_size": 1}
+            )
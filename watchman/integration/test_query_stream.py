@@ -0,0 +1,54 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+import pywatchman
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestQueryStream(WatchmanTestCase.WatchmanTestCase):
+    def test_query_stream(self) -> None:
+        root = self.mkdtemp()
+        names = ["file%d.txt" % i for i in range(10)]
+        for name in names:
+            self.touchRelative(root, name)
+
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, names)
+
+        client = self.getClient()
+        stream = client.queryStream(
+            root,
+            {
+                "expression": ["type", "f"],
+                "fields": ["name", "exists"],
+                "stream_batch_size": 3,
+            },
+        )
+        files = list(stream)
+        self.assertFileListsEqual([f["name"] for f in files], names)
+        self.assertTrue(all(f["exists"] for f in files))
+        self.assertTrue(stream.trailer["is_fresh_instance"])
+
+        # The clock in the trailer can be used for a follow up query
+        self.touchRelative(root, "extra.txt")
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {"since": stream.trailer["clock"], "fields": ["name"]},
+        )
+        self.assertFileListsEqual(res["files"], ["extra.txt"])
+
+    def test_query_stream_batch_size(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+
+        with self.assertRaises(pywatchman.WatchmanError) as ctx:
+            self.watchmanCommand(
+                "query", root, {"stream": True, "stream_batch_size": 0}
+            )
+        self.assertIn("stream_batch_size", str(ctx.exception))
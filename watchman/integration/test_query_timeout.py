@@ -0,0 +1,45 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+import pywatchman
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestQueryTimeout(WatchmanTestCase.WatchmanTestCase):
+    def test_timeout(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+        self.touchRelative(root, "a.c")
+        self.assertFileList(root, ["a.c"])
+
+        res = self.watchmanCommand(
+            "query", root, {"fields": ["name"], "timeout": 60000}
+        )
+        self.assertFileListsEqual(res["files"], ["a.c"])
+
+        # Waiting for the root to settle takes at least the settle period,
+        # which uses up the whole of the timeout before the query can run
+        with self.assertRaisesRegex(
+            pywatchman.CommandError, "cancelled: timeout of 1ms exceeded"
+        ):
+            self.watchmanCommand(
+                "query",
+                root,
+                {
+                    "fields": ["name"],
+                    "timeout": 1,
+                    "settle_period": 100,
+                    "settle_timeout": 10000,
+                },
+            )
+
+    def test_invalid(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+
+        with self.assertRaisesRegex(pywatchman.CommandError, "timeout must be"):
+            self.watchmanCommand("query", root, {"timeout": 0})
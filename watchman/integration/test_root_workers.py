@@ -0,0 +1,52 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+import os
+
+from watchman.integration.lib import WatchmanInstance, WatchmanTestCase
+from watchman.integration.lib.path_utils import norm_absolute_path
+
+
+@WatchmanTestCase.expand_matrix
+class TestRootWorkers(WatchmanTestCase.WatchmanTestCase):
+    def checkOSApplicability(self) -> None:
+        if os.name == "nt":
+            self.skipTest("root workers need unix domain sockets")
+
+    def test_commandsAreForwarded(self) -> None:
+        config = {"root_worker_processes": True}
+        with WatchmanInstance.Instance(config=config) as inst:
+            inst.start()
+            client = self.getClient(inst, no_cache=True)
+            self.addCleanup(client.close)
+
+            roots = [self.mkdtemp(), self.mkdtemp()]
+            for root in roots:
+                self.touchRelative(root, "foo")
+                client.query("watch", root)
+
+            watched = client.query("watch-list")["roots"]
+            self.assertEqual(
+                sorted(norm_absolute_path(r) for r in watched),
+                sorted(norm_absolute_path(r) for r in roots),
+            )
+
+            for root in roots:
+                res = client.query("query", root, {"fields": ["name"]})
+                self.assertFileListsEqual(res["files"], ["foo"])
+
+            # Subscriptions are relayed from the worker
+            root = roots[0]
+            client.query("subscribe", root, "sub", {"fields": ["name"]})
+            self.touchRelative(root, "bar")
+            dat = self.waitForSub(
+                "sub",
+                root=root,
+                accept=lambda subs: any("bar" in sub["files"] for sub in subs),
+                client=client,
+            )
+            self.assertIsNotNone(dat)
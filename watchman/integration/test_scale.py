@@ -0,0 +1,209 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+"""Measures the daemon against a very large tree, and fails when it has
+regressed beyond a tolerance of a stored baseline.
+
+The suite takes minutes and gigabytes, so it only runs when
+WATCHMAN_SCALE_TEST is set.  See watchman/docs/benchmarks.md.
+"""
+
+import json
+import os
+import shutil
+import tempfile
+import time
+import unittest
+
+import pywatchman
+from watchman.integration.lib import WatchmanInstance
+
+
+# The tree has 100 files per directory, under directories of 100 of those
+FILES_PER_DIR = 100
+
+# Metrics where larger values are regressions, and their units
+METRICS = {
+    "crawl_seconds": "s",
+    "view_bytes_per_file": "B",
+    "since_query_seconds": "s",
+    "recrawl_seconds": "s",
+    "restart_seconds": "s",
+}
+
+
+def env_int(name: str, default: int) -> int:
+    return int(os.environ.get(name, default))
+
+
+def file_path(root: str, i: int) -> str:
+    d = i // FILES_PER_DIR
+    return os.path.join(
+        root, "d%d" % (d // FILES_PER_DIR), "d%d" % d, "f%d.txt" % i
+    )
+
+
+def populate(root: str, num_files: int) -> None:
+    for i in range(num_files):
+        if i % FILES_PER_DIR == 0:
+            os.makedirs(os.path.dirname(file_path(root, i)))
+        with open(file_path(root, i), "w"):
+            pass
+
+
+def load_baselines(path: str, num_files: int):
+    """Returns the baseline recorded for this size of tree, if any"""
+    if not os.path.exists(path):
+        return None
+    with open(path) as f:
+        return json.load(f).get(str(num_files))
+
+
+def record_baselines(path: str, num_files: int, results) -> None:
+    baselines = {}
+    if os.path.exists(path):
+        with open(path) as f:
+            baselines = json.load(f)
+    baselines[str(num_files)] = results
+    with open(path, "w") as f:
+        json.dump(baselines, f, indent=2, sort_keys=True)
+        f.write("\n")
+
+
+@unittest.skipIf(os.name == "nt", "the tree takes too long to build on Windows")
+@unittest.skipUnless(
+    os.environ.get("WATCHMAN_SCALE_TEST"), "set WATCHMAN_SCALE_TEST to run"
+)
+class TestScale(unittest.TestCase):
+    def setUp(self) -> None:
+        self.num_files = env_int("WATCHMAN_SCALE_FILES", 1000000)
+        self.num_changes = min(
+            env_int("WATCHMAN_SCALE_CHANGES", 100000), self.num_files
+        )
+        self.timeout = env_int("WATCHMAN_SCALE_TIMEOUT", 3600)
+        self.tolerance = float(os.environ.get("WATCHMAN_SCALE_TOLERANCE", "1.25"))
+        self.baselines_path = os.environ.get(
+            "WATCHMAN_SCALE_BASELINES",
+            os.path.join(os.path.dirname(__file__), "scale_baselines.json"),
+        )
+
+        base = tempfile.mkdtemp(prefix="watchman-scale")
+        self.addCleanup(shutil.rmtree, base, ignore_errors=True)
+        self.root = os.path.join(os.path.realpath(base), "tree")
+        os.mkdir(self.root)
+        populate(self.root, self.num_files)
+
+    def client(self, inst):
+        client = pywatchman.client(
+            timeout=self.timeout, sockpath=inst.getSockPath()
+        )
+        self.addCleanup(client.close)
+        return client
+
+    def sync(self, client) -> None:
+        # Like WatchmanTestCase.waitForSync; a query waits for the crawl too
+        client.query(
+            "query",
+            self.root,
+            {"expression": ["name", "_bogus_"], "fields": ["name"]},
+        )
+
+    def wait_for_recrawl(self, client, count: int) -> None:
+        deadline = time.time() + self.timeout
+        while time.time() < deadline:
+            status = client.query("debug-root-status", self.root)["root_status"]
+            if status["recrawl_info"]["count"] > count and status["done_initial"]:
+                return
+            time.sleep(0.01)
+        self.fail("the recrawl did not finish in %d seconds" % self.timeout)
+
+    def measure(self):
+        results = {}
+        inst = WatchmanInstance.Instance(start_timeout=self.timeout)
+        inst.start()
+        self.addCleanup(inst.stop)
+        client = self.client(inst)
+
+        start = time.time()
+        client.query("watch", self.root)
+        self.sync(client)
+        results["crawl_seconds"] = time.time() - start
+
+        memory = client.query("debug-memory")
+        view_bytes = memory["roots"][self.root]["by_subsystem"]["view_nodes"]
+        results["view_bytes_per_file"] = view_bytes / self.num_files
+
+        clock = client.query("clock", self.root)["clock"]
+        # Spread the changes over the whole tree
+        stride = self.num_files // self.num_changes
+        for i in range(self.num_changes):
+            with open(file_path(self.root, i * stride), "w") as f:
+                f.write("changed")
+        self.sync(client)
+        start = time.time()
+        res = client.query(
+            "query",
+            self.root,
+            {"since": clock, "expression": ["type", "f"], "fields": ["name"]},
+        )
+        results["since_query_seconds"] = time.time() - start
+        self.assertEqual(self.num_changes, len(res["files"]))
+
+        status = client.query("debug-root-status", self.root)["root_status"]
+        recrawls = status["recrawl_info"]["count"]
+        start = time.time()
+        client.query("debug-recrawl", self.root)
+        self.wait_for_recrawl(client, recrawls)
+        results["recrawl_seconds"] = time.time() - start
+
+        # The state file brings the watch back, and the first query waits
+        # for it to be crawled again
+        client.close()
+        inst.stop()
+        start = time.time()
+        inst.start()
+        client = self.client(inst)
+        client.query("watch", self.root)
+        self.sync(client)
+        results["restart_seconds"] = time.time() - start
+        return results
+
+    def test_scale(self) -> None:
+        results = self.measure()
+        print(json.dumps({"files": self.num_files, "results": results}, indent=2))
+
+        if os.environ.get("WATCHMAN_SCALE_RECORD"):
+            record_baselines(self.baselines_path, self.num_files, results)
+            return
+
+        baseline = load_baselines(self.baselines_path, self.num_files)
+        if baseline is None:
+            self.skipTest(
+                "no baseline for %d files in %s; set WATCHMAN_SCALE_RECORD to "
+                "record one" % (self.num_files, self.baselines_path)
+            )
+
+        regressions = []
+        for metric, unit in METRICS.items():
+            if metric not in baseline:
+                continue
+            limit = baseline[metric] * self.tolerance
+            if results[metric] > limit:
+                regressions.append(
+                    "%s: %.3f%s exceeds %.3f%s, %.2fx the baseline of %.3f%s"
+                    % (
+                        metric,
+                        results[metric],
+                        unit,
+                        limit,
+                        unit,
+                        self.tolerance,
+                        baseline[metric],
+                        unit,
+                    )
+                )
+        if regressions:
+            self.fail("\n".join(regressions))
@@ -0,0 +1,42 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+import os
+
+from watchman.integration.lib import WatchmanInstance, WatchmanTestCase
+from watchman.integration.lib.path_utils import norm_absolute_path, norm_relative_path
+
+
+@WatchmanTestCase.expand_matrix
+class TestShareNestedWatches(WatchmanTestCase.WatchmanTestCase):
+    def test_nested_watch_uses_enclosing_root(self) -> None:
+        config = {"share_nested_watches": True}
+        with WatchmanInstance.Instance(config=config) as inst:
+            inst.start()
+            client = self.getClient(inst, no_cache=True)
+            self.addCleanup(client.close)
+
+            root = self.mkdtemp()
+            os.makedirs(os.path.join(root, "sub", "dir"))
+            self.touchRelative(root, "sub", "dir", "foo")
+
+            res = client.query("watch", root)
+            self.assertNotIn("relative_path", res)
+
+            res = client.query("watch", os.path.join(root, "sub"))
+            self.assertEqual(norm_absolute_path(root), norm_absolute_path(res["watch"]))
+            self.assertEqual("sub", norm_relative_path(res["relative_path"]))
+
+            roots = client.query("watch-list")["roots"]
+            self.assertEqual(len(roots), 1)
+
+            res = client.query(
+                "query",
+                res["watch"],
+                {"relative_root": res["relative_path"], "fields": ["name"]},
+            )
+            self.assertFileListsEqual(res["files"], ["dir", "dir/foo"])
@@ -0,0 +1,39 @@
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+import os
+
+from watchman.integration.lib import WatchmanInstance, WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestSharedIo(WatchmanTestCase.WatchmanTestCase):
+    def test_rootsShareThreads(self) -> None:
+        config = {"shared_io_threads": 2}
+        with WatchmanInstance.Instance(config=config) as inst:
+            inst.start()
+            self.getClient(inst, replace_cached=True)
+
+            # More roots than workers, so that they take turns
+            roots = [self.mkdtemp() for _ in range(5)]
+            for root in roots:
+                self.touchRelative(root, "a")
+                self.watchmanCommand("watch", root)
+            for root in roots:
+                self.assertFileList(root, ["a"])
+
+            for root in roots:
+                self.touchRelative(root, "b")
+                os.unlink(os.path.join(root, "a"))
+            for root in roots:
+                self.assertFileList(root, ["b"])
+
+            info = self.watchmanCommand("debug-watcher-info", roots[0])
+            self.assertTrue(info["watcher-debug-info"]["view"]["shared_io"])
+
+            # A root stops cleanly, and the others carry on
+            self.watchmanCommand("watch-del", roots[0])
+            self.touchRelative(roots[1], "c")
+            self.assertFileList(roots[1], ["b", "c"])
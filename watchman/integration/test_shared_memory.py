@@ -0,0 +1,40 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+import os
+
+import pywatchman
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestSharedMemory(WatchmanTestCase.WatchmanTestCase):
+    def test_querySharedMemory(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+        names = ["f%d" % i for i in range(100)]
+        for name in names:
+            self.touchRelative(root, name)
+        self.assertFileList(root, names)
+
+        client = self.getClient()
+        res = client.querySharedMemory(root, {"fields": ["name"]})
+        self.assertFileListsEqual(res["files"], names)
+        self.assertIn("clock", res)
+        # Whichever way the response came back, no descriptor is left over
+        if isinstance(client.tport, pywatchman.UnixSocketTransport):
+            self.assertEqual(client.tport.descriptors, [])
+
+    def test_errorIsNotShared(self) -> None:
+        if os.name == "nt":
+            self.skipTest("shared_memory is not supported on Windows")
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+
+        with self.assertRaisesRegex(pywatchman.CommandError, "can't be used"):
+            self.watchmanCommand(
+                "query", root, {"shared_memory": True, "stream": True}
+            )
@@ -262,3 +262,24 @@ class TestSince(WatchmanTestCase.WatchmanTestCase):
         self.assertFalse(res["is_fresh_instance"])
         self.assertFileListsEqual(res["files"], ["111", "222"])
         self.assertTrue("warning" not in res)
+
+    def test_scopedRecrawl(self) -> None:
+        root = self.mkdtemp()
+        os.mkdir(os.path.join(root, "sub"))
+        self.touchRelative(root, "sub", "111")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["sub", "sub/111"])
+
+        res = self.watchmanCommand("query", root, {"fields": ["name"]})
+        clock = res["clock"]
+
+        os.unlink(os.path.join(root, "sub", "111"))
+        res = self.watchmanCommand("debug-recrawl", root, "sub")
+        self.assertTrue(res["recrawl"])
+        self.assertEqual(res["scope"], os.path.join(root, "sub"))
+
+        self.touchRelative(root, "222")
+        res = self.watchmanCommand("query", root, {"since": clock, "fields": ["name"]})
+        self.assertFalse(res["is_fresh_instance"])
+        self.assertFileListsEqual(res["files"], ["sub", "sub/111", "222"])
+        self.assertRegex(res["warning"], "Recrawled this watch")
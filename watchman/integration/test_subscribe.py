@@ -896,6 +896,151 @@ class TestSubscribe(WatchmanTestCase.WatchmanTestCase):
 
         client2.close()
 
+    def test_multi_client_same_query(self) -> None:
+        root = self.mkdtemp()
+        self.touchRelative(root, "lemon")
+        self.touchRelative(root, "banana")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files=["lemon", "banana"])
+
+        # Identical queries, apart from options that don't affect the results,
+        # share their evaluation.  Each client still gets its own responses.
+        clients = [self.getClient(no_cache=True) for _ in range(3)]
+        for i, client in enumerate(clients):
+            query = {"fields": ["name"], "expression": ["name", "lemon"]}
+            if i == 1:
+                query["defer_vcs"] = False
+            client.query("subscribe", root, "sub%d" % i, query)
+            dat = self.waitForSub("sub%d" % i, root, remove=True, client=client)
+            self.assertFileListsEqual(dat[0]["files"], ["lemon"])
+
+        other = self.getClient(no_cache=True)
+        other.query(
+            "subscribe",
+            root,
+            "other",
+            {"fields": ["name"], "expression": ["name", "banana"]},
+        )
+        self.waitForSub("other", root, remove=True, client=other)
+
+        for _ in range(2):
+            self.touchRelative(root, "lemon")
+            self.touchRelative(root, "banana")
+
+            for i, client in enumerate(clients):
+                dat = self.waitForSub("sub%d" % i, root, remove=True, client=client)
+                self.assertEqual(dat[0]["subscription"], "sub%d" % i)
+                self.assertFileListsEqual(dat[0]["files"], ["lemon"])
+
+            dat = self.waitForSub("other", root, remove=True, client=other)
+            self.assertFileListsEqual(dat[0]["files"], ["banana"])
+
+        for client in clients + [other]:
+            client.close()
+
+    def test_multi_client_same_expression(self) -> None:
+        root = self.mkdtemp()
+        self.touchRelative(root, "lemon")
+        self.touchRelative(root, "banana")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files=["lemon", "banana"])
+
+        # The same expression with different fields shares the evaluation,
+        # but each subscription gets just the fields that it asked for
+        fieldLists = [["name"], ["name", "exists"], ["exists", "name"]]
+        clients = [self.getClient(no_cache=True) for _ in fieldLists]
+        for i, (client, fields) in enumerate(zip(clients, fieldLists)):
+            query = {"fields": fields, "expression": ["name", "lemon"]}
+            client.query("subscribe", root, "sub%d" % i, query)
+            self.waitForSub("sub%d" % i, root, remove=True, client=client)
+
+        for _ in range(2):
+            self.touchRelative(root, "lemon")
+            self.touchRelative(root, "banana")
+
+            for i, client in enumerate(clients):
+                dat = self.waitForSub("sub%d" % i, root, remove=True, client=client)
+                files = dat[0]["files"]
+                if i == 0:
+                    self.assertEqual(files, ["lemon"])
+                else:
+                    self.assertEqual(files, [{"name": "lemon", "exists": True}])
+
+        for client in clients:
+            client.close()
+
+    def test_durable_resume(self) -> None:
+        root = self.mkdtemp()
+        self.touchRelative(root, "lemon")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files=["lemon"])
+
+        query = {"fields": ["name"], "durable": True}
+        client1 = self.getClient(no_cache=True)
+        res = client1.query("subscribe", root, "durable", query)
+        self.assertFalse(res["resumed"])
+        dat = self.waitForSub("durable", root, remove=True, client=client1)
+        self.assertTrue(dat[0]["is_fresh_instance"])
+
+        self.touchRelative(root, "banana")
+        dat = self.waitForSub("durable", root, remove=True, client=client1)
+        self.assertFileListsEqual(dat[-1]["files"], ["banana"])
+        client1.query("unsubscribe", root, "durable")
+        client1.close()
+
+        # Only what changed since the last notification is reported again
+        self.touchRelative(root, "cherry")
+        client2 = self.getClient(no_cache=True)
+        res = client2.query("subscribe", root, "durable", query)
+        self.assertTrue(res["resumed"])
+        dat = self.waitForSub("durable", root, remove=True, client=client2)
+        self.assertFalse(dat[0]["is_fresh_instance"])
+        self.assertNotIn("lemon", dat[0]["files"])
+        self.assertIn("cherry", dat[0]["files"])
+        client2.close()
+
+    def test_adaptive_settle(self) -> None:
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            f.write(
+                json.dumps(
+                    {"settle_adaptive": True, "settle_min": 10, "settle_max": 200}
+                )
+            )
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files=[".watchmanconfig"])
+
+        self.watchmanCommand("subscribe", root, "sub1", {"fields": ["name"]})
+        self.waitForSub("sub1", root, remove=True)
+
+        self.touchRelative(root, "a")
+        dat = self.waitForSub("sub1", root, remove=True)
+        self.assertIn("settle_period", dat[0])
+        self.assertGreaterEqual(dat[0]["settle_period"], 10)
+        self.assertLessEqual(dat[0]["settle_period"], 200)
+
+    def test_change_times(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files=[])
+
+        self.watchmanCommand(
+            "subscribe", root, "sub1", {"fields": ["name"], "change_times": True}
+        )
+        self.waitForSub("sub1", root, remove=True)
+
+        self.touchRelative(root, "a")
+        dat = self.waitForSub("sub1", root, remove=True)
+        times = dat[-1]["change_times"]
+        self.assertLessEqual(times["changed_us"], times["pending_us"])
+        self.assertLessEqual(times["pending_us"], times["processed_us"])
+        self.assertLessEqual(times["processed_us"], times["settled_us"])
+
+        latency = self.watchmanCommand("debug-metrics")["roots"][root][
+            "change_latency"
+        ]
+        self.assertGreaterEqual(latency["settled_to_delivered"]["count"], 1)
+
     def test_unique_name_warning(self) -> None:
         root = self.mkdtemp()
         with open(os.path.join(root, ".watchmanconfig"), "w") as f:
@@ -0,0 +1,66 @@
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+import json
+import os
+import socket
+import time
+
+from watchman.integration.lib import WatchmanInstance, WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestSubscriptionBackpressure(WatchmanTestCase.WatchmanTestCase):
+    def test_coalescesForSlowReader(self) -> None:
+        if os.name == "nt":
+            self.skipTest("uses a unix domain socket")
+        config = {"subscription_output_limit_bytes": 1}
+        with WatchmanInstance.Instance(config=config) as inst:
+            inst.start()
+            self.getClient(inst, replace_cached=True)
+
+            root = self.mkdtemp()
+            # pyre-fixme[16]: has no attribute `client`.
+            self.client.query("watch", root)
+
+            sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)
+            sock.connect(inst.getUnixSockPath())
+            subscribe = ["subscribe", root, "slow", {"fields": ["name"]}]
+            sock.sendall(json.dumps(subscribe).encode() + b"\n")
+
+            # Each batch's notification is far larger than the socket's
+            # buffers, and this client doesn't read any of them for now
+            prefix = "x" * 240
+            for batch in range(5):
+                for i in range(1000):
+                    self.touchRelative(root, "%s_%d_%d" % (prefix, batch, i))
+                time.sleep(1)
+            last = "%s_%d_%d" % (prefix, 4, 999)
+
+            def coalesced():
+                # pyre-fixme[16]: has no attribute `client`.
+                status = self.client.query("debug-status")
+                return any(
+                    c["coalesced_notifications"] > 0 for c in status["clients"]
+                )
+
+            self.assertWaitFor(coalesced, message="no notifications were coalesced")
+
+            # Once the client reads again, it is told about every file
+            sock.settimeout(30)
+            seen = set()
+            buf = b""
+            while last not in seen:
+                data = sock.recv(1 << 16)
+                self.assertTrue(data, "the daemon hung up")
+                buf += data
+                while b"\n" in buf:
+                    line, buf = buf.split(b"\n", 1)
+                    pdu = json.loads(line)
+                    if pdu.get("subscription") == "slow" and "files" in pdu:
+                        seen.update(pdu["files"])
+            sock.close()
+            self.assertEqual(len(seen), 5000)
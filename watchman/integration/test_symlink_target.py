@@ -0,0 +1,58 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+import os
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestSymlinkTarget(WatchmanTestCase.WatchmanTestCase):
+    def checkOSApplicability(self) -> None:
+        if os.name == "nt":
+            self.skipTest("non admin symlinks not available")
+
+    def test_symlinkTargets(self) -> None:
+        self.checkSymlinkTargets(self.mkdtemp())
+
+    def test_capturedSymlinkTargets(self) -> None:
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            f.write('{"symlink_target_capture": true}')
+        self.checkSymlinkTargets(root, [".watchmanconfig"])
+
+    def checkSymlinkTargets(self, root, extra_files=()) -> None:
+        expected = {"top": "../top-target"}
+        files = []
+        os.symlink(expected["top"], os.path.join(root, "top"))
+        for d in ["a", "b/c"]:
+            os.makedirs(os.path.join(root, d))
+            self.touchRelative(root, d, "file")
+            files.append(d + "/file")
+            for i in range(5):
+                name = "%s/link%d" % (d, i)
+                expected[name] = "target-%s-%d" % (d, i)
+                os.symlink(expected[name], os.path.join(root, name))
+
+        self.watchmanCommand("watch", root)
+        self.assertFileList(
+            root, list(expected) + files + list(extra_files) + ["a", "b", "b/c"]
+        )
+
+        # Twice, so that the second query is answered from the cache
+        for _ in range(2):
+            res = self.watchmanCommand(
+                "query",
+                root,
+                {
+                    "expression": ["type", "l"],
+                    "fields": ["name", "symlink_target"],
+                },
+            )
+            self.assertEqual(
+                {f["name"]: f.get("symlink_target") for f in res["files"]},
+                expected,
+            )
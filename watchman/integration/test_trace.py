@@ -0,0 +1,32 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestTrace(WatchmanTestCase.WatchmanTestCase):
+    def test_query_spans_are_recorded(self) -> None:
+        root = self.mkdtemp()
+        self.touchRelative(root, "foo")
+        self.watchmanCommand("watch", root)
+        self.watchmanCommand("debug-trace", "clear")
+        self.watchmanCommand("query", root, {"fields": ["name"]})
+
+        events = self.watchmanCommand("debug-trace")["traceEvents"]
+        names = {e["name"] for e in events if e["ph"] == "X"}
+        self.assertIn("query.cookieSync", names)
+        self.assertIn("query.generate", names)
+        self.assertIn("query.render", names)
+        for event in events:
+            if event["ph"] == "X":
+                self.assertGreaterEqual(event["dur"], 0)
+
+    def test_bad_argument(self) -> None:
+        with self.assertRaises(Exception) as ctx:
+            self.watchmanCommand("debug-trace", "start")
+        self.assertIn("clear", str(ctx.exception))
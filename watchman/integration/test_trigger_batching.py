@@ -0,0 +1,80 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+import json
+import os
+import os.path
+import sys
+
+from watchman.integration.lib import HELPER_ROOT, WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestTriggerBatching(WatchmanTestCase.WatchmanTestCase):
+    def readRuns(self, log):
+        if not os.path.exists(log):
+            return []
+        with open(log) as f:
+            return [json.loads(line) for line in f]
+
+    def getStats(self, root):
+        return self.watchmanCommand("trigger-list", root)["stats"]["slow"]
+
+    def test_settlesWhileRunningAreMerged(self) -> None:
+        root = self.mkdtemp()
+        log = os.path.join(self.mkdtemp(), "runs.log")
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            json.dump({"settle": 200}, f)
+        self.touchRelative(root, "a.c")
+        self.watchmanCommand("watch", root)
+
+        res = self.watchmanCommand(
+            "trigger",
+            root,
+            {
+                "name": "slow",
+                "expression": ["suffix", "c"],
+                "command": [
+                    sys.executable,
+                    os.path.join(HELPER_ROOT, "trig-slow.py"),
+                    log,
+                    "3",
+                ],
+                "append_files": True,
+            },
+        )
+        self.assertEqual("created", res["disposition"])
+
+        self.assertWaitFor(
+            lambda: self.getStats(root)["running"],
+            message="the trigger runs for the initial files",
+        )
+
+        # Both of these settle while the first run is still going, and so
+        # are run together once it exits
+        self.touchRelative(root, "b.c")
+        self.assertWaitFor(
+            lambda: self.getStats(root)["settles"] >= 2,
+            message="b.c settles",
+        )
+        self.touchRelative(root, "c.c")
+        self.assertWaitFor(
+            lambda: self.getStats(root)["settles"] >= 3,
+            message="c.c settles",
+        )
+        self.assertEqual(1, len(self.readRuns(log)))
+
+        self.assertWaitFor(
+            lambda: len(self.readRuns(log)) == 2,
+            message="the trigger runs again once the first run exits",
+        )
+        self.assertEqual(["b.c", "c.c"], sorted(self.readRuns(log)[1]))
+
+        stats = self.getStats(root)
+        self.assertEqual(2, stats["runs"])
+        self.assertGreaterEqual(stats["coalesced_settles"], 1)
+        self.assertGreater(stats["max_latency_ms"], 0)
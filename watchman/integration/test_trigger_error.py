@@ -87,3 +87,36 @@ class TestTriggerError(WatchmanTestCase.WatchmanTestCase):
             root,
             {"name": "oink", "command": ["cat"], "stderr": "out"},
         )
+
+        self.assertTriggerRegError(
+            "persistent triggers must set stdin to an array of field names",
+            "trigger",
+            root,
+            {"name": "oink", "command": ["cat"], "persistent": True},
+        )
+
+        self.assertTriggerRegError(
+            "append_files can't be used with persistent triggers",
+            "trigger",
+            root,
+            {
+                "name": "oink",
+                "command": ["cat"],
+                "stdin": ["name"],
+                "append_files": True,
+                "persistent": True,
+            },
+        )
+
+        self.assertTriggerRegError(
+            "invalid persistent_encoding lemon",
+            "trigger",
+            root,
+            {
+                "name": "oink",
+                "command": ["cat"],
+                "stdin": ["name"],
+                "persistent": True,
+                "persistent_encoding": "lemon",
+            },
+        )
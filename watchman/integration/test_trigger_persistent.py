@@ -0,0 +1,81 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+import json
+import os
+import os.path
+import signal
+import sys
+import unittest
+
+from watchman.integration.lib import HELPER_ROOT, WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestTriggerPersistent(WatchmanTestCase.WatchmanTestCase):
+    def registerPersistentTrigger(self, root, log):
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            json.dump({"settle": 200}, f)
+        self.watchmanCommand("watch", root)
+        res = self.watchmanCommand(
+            "trigger",
+            root,
+            {
+                "name": "persistent",
+                "expression": ["suffix", "c"],
+                "command": [
+                    sys.executable,
+                    os.path.join(HELPER_ROOT, "trig-persistent.py"),
+                    log,
+                ],
+                "stdin": ["name"],
+                "persistent": True,
+            },
+        )
+        self.assertEqual("created", res["disposition"])
+
+    def readBatches(self, log):
+        if not os.path.exists(log):
+            return []
+        with open(log) as f:
+            return [json.loads(line) for line in f]
+
+    def waitForFile(self, log, name):
+        def delivered():
+            return any(name in batch["files"] for batch in self.readBatches(log))
+
+        self.assertWaitFor(delivered, message="%s should be sent to the worker" % name)
+
+    def test_batchesShareOneProcess(self) -> None:
+        root = self.mkdtemp()
+        log = os.path.join(self.mkdtemp(), "batches.log")
+        self.touchRelative(root, "a.c")
+        self.registerPersistentTrigger(root, log)
+        self.waitForFile(log, "a.c")
+
+        self.touchRelative(root, "b.c")
+        self.waitForFile(log, "b.c")
+
+        batches = self.readBatches(log)
+        self.assertGreaterEqual(len(batches), 2)
+        self.assertEqual(1, len({batch["pid"] for batch in batches}))
+
+    @unittest.skipIf(os.name == "nt", "no SIGKILL on Windows")
+    def test_restartedOnExit(self) -> None:
+        root = self.mkdtemp()
+        log = os.path.join(self.mkdtemp(), "batches.log")
+        self.touchRelative(root, "a.c")
+        self.registerPersistentTrigger(root, log)
+        self.waitForFile(log, "a.c")
+
+        pid = self.readBatches(log)[0]["pid"]
+        os.kill(pid, signal.SIGKILL)
+
+        self.touchRelative(root, "b.c")
+        self.waitForFile(log, "b.c")
+        last = self.readBatches(log)[-1]
+        self.assertNotEqual(pid, last["pid"])
@@ -0,0 +1,66 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+import json
+import os
+import shutil
+
+import pywatchman
+from watchman.integration.lib import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestViewSeed(WatchmanTestCase.WatchmanTestCase):
+    def test_seedFromExportedView(self) -> None:
+        source = self.mkdtemp()
+        for d in ["a", "b/c"]:
+            os.makedirs(os.path.join(source, d))
+            self.touchRelative(source, d, "file")
+        self.touchRelative(source, "gone")
+
+        self.watchmanCommand("watch", source)
+        self.assertFileList(source, ["a", "a/file", "b", "b/c", "b/c/file", "gone"])
+
+        snapshot = os.path.join(self.mkdtemp(), "view")
+        res = self.watchmanCommand("export-view", source, snapshot)
+        self.assertEqual(res["files"], 6)
+
+        # A copy of the tree at another path, which has moved on a little
+        # since the export
+        copy = os.path.join(self.mkdtemp(), "copy")
+        shutil.copytree(source, copy)
+        os.unlink(os.path.join(copy, "gone"))
+        self.touchRelative(copy, "b", "new")
+        with open(os.path.join(copy, ".watchmanconfig"), "w") as f:
+            json.dump({"view_snapshot_seed": snapshot}, f)
+
+        self.watchmanCommand("watch", copy)
+        self.assertFileList(
+            copy,
+            [".watchmanconfig", "a", "a/file", "b", "b/c", "b/c/file", "b/new"],
+        )
+
+        # The verified copy is watched like any other root
+        self.touchRelative(copy, "a", "later")
+        self.assertFileList(
+            copy,
+            [
+                ".watchmanconfig",
+                "a",
+                "a/file",
+                "a/later",
+                "b",
+                "b/c",
+                "b/c/file",
+                "b/new",
+            ],
+        )
+
+    def test_exportNeedsAbsolutePath(self) -> None:
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+        with self.assertRaisesRegex(pywatchman.CommandError, "absolute path"):
+            self.watchmanCommand("export-view", root, "relative/view")
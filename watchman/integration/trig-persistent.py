@@ -0,0 +1,21 @@
+#!/usr/bin/env python
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+import json
+import os
+import sys
+
+
+log_file_name = sys.argv[1]
+
+# Log each batch sent by watchman as a line of JSON tagged with our pid,
+# then wait for the next one
+for line in sys.stdin:
+    batch = json.loads(line)
+    with open(log_file_name, "a") as f:
+        f.write(json.dumps({"pid": os.getpid(), "files": batch["files"]}))
+        f.write("\n")
@@ -0,0 +1,21 @@
+#!/usr/bin/env python
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+import json
+import sys
+import time
+
+
+log_file_name = sys.argv[1]
+seconds = float(sys.argv[2])
+
+# Log the files of this run as a line of JSON, then take a while to exit
+with open(log_file_name, "a") as f:
+    f.write(json.dumps(sys.argv[3:]))
+    f.write("\n")
+
+time.sleep(seconds)
@@ -40,6 +40,17 @@ public interface WatchmanClient {
 
   ListenableFuture<Map<String, Object>> run(List<Object> command);
 
+  /**
+   * Runs {@code query} against the watched root at {@code path}, handing each
+   * file of the result to {@code callback} as it is decoded rather than
+   * collecting them into a list. The result holds the rest of the response,
+   * such as the clock, without {@code files}.
+   */
+  ListenableFuture<Map<String, Object>> query(
+      Path path,
+      Map<String, Object> query,
+      FileCallback callback);
+
   ListenableFuture<Boolean> unsubscribeAll();
 
   void close() throws IOException;
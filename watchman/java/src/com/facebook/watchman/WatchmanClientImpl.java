@@ -199,6 +199,18 @@ public class WatchmanClientImpl implements WatchmanClient {
     return connection.run(command);
   }
 
+  @Override
+  public ListenableFuture<Map<String, Object>> query(
+      Path path,
+      Map<String, Object> query,
+      FileCallback callback) {
+    List<Object> request = ImmutableList.<Object>of(
+        "query",
+        path.toAbsolutePath().toString(),
+        query);
+    return connection.run(request, callback);
+  }
+
   /**
    * unsubscribes from all the subscriptions; convenience method
    */
@@ -21,7 +21,9 @@ import java.util.concurrent.atomic.AtomicBoolean;
 import java.util.concurrent.atomic.AtomicReference;
 
 import com.facebook.watchman.bser.BserDeserializer;
+import com.facebook.watchman.bser.BserFileCursor;
 import com.facebook.watchman.bser.BserSerializer;
+import com.facebook.watchman.bser.BserStreamingDeserializer;
 
 import com.google.common.base.Optional;
 import com.google.common.collect.Queues;
@@ -36,7 +38,7 @@ public class WatchmanConnection {
 
   private final ListeningExecutorService outgoingMessageExecutor;
   private final ExecutorService incomingMessageExecutor;
-  private final Callable<Map<String, Object>> incomingMessageGetter;
+  private final Callable<BserStreamingDeserializer.Response> incomingResponseGetter;
   private final Optional<WatchmanTransport> transport;
   private final OutputStream outgoingMessageStream;
   private final Optional<Callback> unilateralCallback;
@@ -48,12 +50,12 @@ public class WatchmanConnection {
 
   public WatchmanConnection(WatchmanTransport transport) throws IOException {
     this(
-        incomingMessageGetterFromTransport(transport),
+        Optional.<WatchmanTransport>of(transport),
+        incomingResponseGetterFromTransport(transport),
         transport.getOutputStream(),
         Optional.<Collection<String>>absent(),
         Optional.<Callback>absent(),
-        Optional.<WatchmanCommandListener>absent(),
-        Optional.<WatchmanTransport>of(transport));
+        Optional.<WatchmanCommandListener>absent());
   }
 
   public WatchmanConnection(
@@ -61,12 +63,12 @@ public class WatchmanConnection {
       Optional<Collection<String>> unilateralLabels,
       Optional<Callback> unilateralCallback) throws IOException {
     this(
-        incomingMessageGetterFromTransport(transport),
+        Optional.<WatchmanTransport>of(transport),
+        incomingResponseGetterFromTransport(transport),
         transport.getOutputStream(),
         unilateralLabels,
         unilateralCallback,
-        Optional.<WatchmanCommandListener>absent(),
-        Optional.<WatchmanTransport>of(transport));
+        Optional.<WatchmanCommandListener>absent());
   }
 
   public WatchmanConnection(
@@ -75,12 +77,12 @@ public class WatchmanConnection {
       Optional<Callback> unilateralCallback,
       Optional<WatchmanCommandListener> commandListener) throws IOException {
     this(
-        incomingMessageGetterFromTransport(transport),
+        Optional.<WatchmanTransport>of(transport),
+        incomingResponseGetterFromTransport(transport),
         transport.getOutputStream(),
         unilateralLabels,
         unilateralCallback,
-        commandListener,
-        Optional.<WatchmanTransport>of(transport));
+        commandListener);
   }
 
   public WatchmanConnection(
@@ -129,7 +131,23 @@ public class WatchmanConnection {
       Optional<Callback> unilateralCallback,
       Optional<WatchmanCommandListener> commandListener,
       Optional<WatchmanTransport> optionalTransport) {
-    this.incomingMessageGetter = incomingMessageGetter;
+    this(
+        optionalTransport,
+        decodedResponseGetter(incomingMessageGetter),
+        outgoingMessageStream,
+        unilateralLabels,
+        unilateralCallback,
+        commandListener);
+  }
+
+  private WatchmanConnection(
+      Optional<WatchmanTransport> optionalTransport,
+      Callable<BserStreamingDeserializer.Response> incomingResponseGetter,
+      OutputStream outgoingMessageStream,
+      Optional<Collection<String>> unilateralLabels,
+      Optional<Callback> unilateralCallback,
+      Optional<WatchmanCommandListener> commandListener) {
+    this.incomingResponseGetter = incomingResponseGetter;
     this.outgoingMessageStream = outgoingMessageStream;
     this.unilateralLabels = unilateralLabels;
     this.unilateralCallback = unilateralCallback;
@@ -160,6 +178,28 @@ public class WatchmanConnection {
   }
 
   public ListenableFuture<Map<String, Object>> run(final Object command) {
+    return run(command, Optional.<FileCallback>absent());
+  }
+
+  /**
+   * Runs a command whose response has {@code files}, such as a query, and
+   * hands each file to {@code fileCallback} as it is decoded, instead of
+   * decoding them all into the result. The result holds the rest of the
+   * response.
+   *
+   * The callback runs on the thread that reads responses, so responses to
+   * later commands wait for it. If it throws, the command fails with its
+   * exception; the connection carries on.
+   */
+  public ListenableFuture<Map<String, Object>> run(
+      final Object command,
+      FileCallback fileCallback) {
+    return run(command, Optional.of(fileCallback));
+  }
+
+  private ListenableFuture<Map<String, Object>> run(
+      final Object command,
+      Optional<FileCallback> fileCallback) {
     if (! processing.get()) {
       SettableFuture<Map<String, Object>> die = SettableFuture.create();
       die.setException(new WatchmanException("connection closing down"));
@@ -174,6 +214,7 @@ public class WatchmanConnection {
         .latch(latch)
         .resultRef(resultRef)
         .errorRef(errorRef)
+        .fileCallback(fileCallback)
         .build();
     commandQueue.add(queuedCommand);
     return outgoingMessageExecutor.submit(new Callable<Map<String, Object>>() {
@@ -229,12 +270,13 @@ public class WatchmanConnection {
     public void run() {
       while (processing.get()) {
         try {
-          Map<String, Object> deserializedResponse = incomingMessageGetter.call();
-          if (deserializedResponse == null) continue;
+          BserStreamingDeserializer.Response response = incomingResponseGetter.call();
+          if (response == null) continue;
 
-          if (checkMessageUnilateral(deserializedResponse)) {
+          Map<String, Object> fields = response.getFields();
+          if (checkMessageUnilateral(fields)) {
             if (unilateralCallback.isPresent()) {
-              unilateralCallback.get().call(deserializedResponse);
+              unilateralCallback.get().call(response.toMap());
             } else {
               failAllCommands(
                   new Exception("Received unilateral message without any callback registered"));
@@ -244,12 +286,14 @@ public class WatchmanConnection {
           }
 
           QueuedCommand lastCommand = commandQueue.take();
-          if (deserializedResponse.containsKey("error")) {
+          if (fields.containsKey("error")) {
             lastCommand.errorRef().set(new WatchmanException(
-                String.valueOf(deserializedResponse.get("error")),
-                deserializedResponse));
+                String.valueOf(fields.get("error")),
+                response.toMap()));
+          } else if (lastCommand.fileCallback().isPresent()) {
+            streamFiles(response, lastCommand);
           } else {
-            lastCommand.resultRef().set(deserializedResponse);
+            lastCommand.resultRef().set(response.toMap());
           }
           lastCommand.latch().countDown();
         } catch (Exception e) {
@@ -258,6 +302,23 @@ public class WatchmanConnection {
         }
       }
     }
+
+    private void streamFiles(
+        BserStreamingDeserializer.Response response,
+        QueuedCommand command) {
+      // The whole response has been read already, so a callback that throws
+      // fails its own command without leaving the connection mid-message.
+      try {
+        FileCallback fileCallback = command.fileCallback().get();
+        BserFileCursor files = response.files();
+        while (files.next()) {
+          fileCallback.call(files);
+        }
+        command.resultRef().set(response.getFields());
+      } catch (Exception e) {
+        command.errorRef().set(e);
+      }
+    }
   }
 
   @Value.Immutable
@@ -267,6 +328,7 @@ public class WatchmanConnection {
     CountDownLatch latch();
     AtomicReference<Map<String, Object>> resultRef();
     AtomicReference<Exception> errorRef();
+    Optional<FileCallback> fileCallback();
   }
 
   /**
@@ -287,16 +349,28 @@ public class WatchmanConnection {
 
   /**
    * Generates a Callable that can be invoked repeatedly to extract
-   * deserialized messages from watchman's transport.
+   * responses from watchman's transport, with their files still encoded.
    */
-  private static Callable<Map<String, Object>> incomingMessageGetterFromTransport(WatchmanTransport transport)
-      throws IOException {
+  private static Callable<BserStreamingDeserializer.Response> incomingResponseGetterFromTransport(
+      WatchmanTransport transport) throws IOException {
     final InputStream inputStream = transport.getInputStream();
-    final BserDeserializer deserializer = new BserDeserializer(BserDeserializer.KeyOrdering.UNSORTED);
-    return new Callable<Map<String, Object>>() {
+    final BserStreamingDeserializer deserializer =
+        new BserStreamingDeserializer(BserDeserializer.KeyOrdering.UNSORTED);
+    return new Callable<BserStreamingDeserializer.Response>() {
       @Override
-      public Map<String, Object> call() throws Exception {
-        return deserializer.deserialize(inputStream);
+      public BserStreamingDeserializer.Response call() throws Exception {
+        return deserializer.deserializeResponse(inputStream);
+      }
+    };
+  }
+
+  private static Callable<BserStreamingDeserializer.Response> decodedResponseGetter(
+      final Callable<Map<String, Object>> incomingMessageGetter) {
+    return new Callable<BserStreamingDeserializer.Response>() {
+      @Override
+      public BserStreamingDeserializer.Response call() throws Exception {
+        Map<String, Object> message = incomingMessageGetter.call();
+        return message == null ? null : BserStreamingDeserializer.Response.of(message);
       }
     };
   }
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+package com.facebook.watchman;
+
+import java.io.IOException;
+
+import javax.annotation.Nullable;
+
+/**
+ * One file of a query result that is decoded as it is read. The fields are
+ * only decoded when asked for, and only until the next file is read, so copy
+ * out anything that must outlive the call it was handed to.
+ *
+ * When a query asks for a single field, Watchman sends each file as the
+ * value of that field alone, which the getters return for any field name.
+ */
+public interface WatchmanFile {
+  /**
+   * Returns the field as the non-streaming API would have, or {@code null}
+   * if the query didn't ask for it or Watchman sent none for this file.
+   */
+  @Nullable
+  Object get(String field) throws IOException;
+
+  @Nullable
+  String getString(String field) throws IOException;
+
+  long getLong(String field, long defaultValue) throws IOException;
+
+  boolean getBoolean(String field, boolean defaultValue) throws IOException;
+
+  /**
+   * Decodes the whole file: a {@code Map} of its fields, or the value of the
+   * only field of a single-field query.
+   */
+  @Nullable
+  Object getValue() throws IOException;
+}
@@ -107,7 +107,7 @@ public class BserDeserializer implements Deserializer {
     return (Map<String, Object>) deserializeBserValue(inputStream);
   }
 
-  private ByteBuffer readBserBuffer(InputStream inputStream) throws IOException {
+  ByteBuffer readBserBuffer(InputStream inputStream) throws IOException {
     ByteBuffer sniffBuffer = ByteBuffer.allocate(SNIFF_BUFFER_SIZE).order(ByteOrder.nativeOrder());
     Preconditions.checkState(sniffBuffer.hasArray());
 
@@ -178,7 +178,7 @@ public class BserDeserializer implements Deserializer {
     return bserBuffer;
   }
 
-  private int deserializeIntLen(ByteBuffer buffer, byte type) throws IOException {
+  int deserializeIntLen(ByteBuffer buffer, byte type) throws IOException {
     long value = deserializeNumber(buffer, type).longValue();
     if (value > Integer.MAX_VALUE) {
       throw new IOException(
@@ -210,7 +210,7 @@ public class BserDeserializer implements Deserializer {
     }
   }
 
-  private String deserializeString(ByteBuffer buffer) throws IOException {
+  String deserializeString(ByteBuffer buffer) throws IOException {
     byte intType = buffer.get();
     int len = deserializeIntLen(buffer, intType);
 
@@ -249,12 +249,7 @@ public class BserDeserializer implements Deserializer {
     if (numItems == 0) {
       return Collections.emptyMap();
     }
-    Map<String, Object> map;
-    if (keyOrdering == KeyOrdering.UNSORTED) {
-      map = new LinkedHashMap<String, Object>(numItems);
-    } else {
-      map = new TreeMap<String, Object>();
-    }
+    Map<String, Object> map = newObject(numItems);
     for (int i = 0; i < numItems; i++) {
       byte stringType = buffer.get();
       if (stringType != BSER_STRING) {
@@ -270,6 +265,13 @@ public class BserDeserializer implements Deserializer {
     return map;
   }
 
+  Map<String, Object> newObject(int numItems) {
+    if (keyOrdering == KeyOrdering.UNSORTED) {
+      return new LinkedHashMap<String, Object>(numItems);
+    }
+    return new TreeMap<String, Object>();
+  }
+
   private List<Map<String, Object>> deserializeTemplate(ByteBuffer buffer) throws IOException {
     byte arrayType = buffer.get();
     if (arrayType != BSER_ARRAY) {
@@ -299,12 +301,12 @@ public class BserDeserializer implements Deserializer {
   }
 
   @Nullable
-  private Object deserializeRecursive(ByteBuffer buffer) throws IOException {
+  Object deserializeRecursive(ByteBuffer buffer) throws IOException {
     byte type = buffer.get();
     return deserializeRecursiveWithType(buffer, type);
   }
 
-  private Object deserializeRecursiveWithType(ByteBuffer buffer, byte type) throws IOException {
+  Object deserializeRecursiveWithType(ByteBuffer buffer, byte type) throws IOException {
     switch (type) {
       case BSER_INT8:
       case BSER_INT16:
@@ -331,4 +333,72 @@ public class BserDeserializer implements Deserializer {
         throw new IOException(String.format("Unrecognized BSER value type %d", type));
     }
   }
+
+  /**
+   * Moves past a value of the given type without decoding it.
+   */
+  void skipRecursiveWithType(ByteBuffer buffer, byte type) throws IOException {
+    switch (type) {
+      case BSER_INT8:
+      case BSER_INT16:
+      case BSER_INT32:
+      case BSER_INT64:
+        deserializeNumber(buffer, type);
+        return;
+      case BSER_REAL:
+        skipBytes(buffer, 8);
+        return;
+      case BSER_TRUE:
+      case BSER_FALSE:
+      case BSER_NULL:
+      case BSER_SKIP:
+        return;
+      case BSER_STRING: {
+        skipBytes(buffer, deserializeIntLen(buffer, buffer.get()));
+        return;
+      }
+      case BSER_ARRAY: {
+        int numItems = deserializeIntLen(buffer, buffer.get());
+        for (int i = 0; i < numItems; i++) {
+          skipRecursiveWithType(buffer, buffer.get());
+        }
+        return;
+      }
+      case BSER_OBJECT: {
+        int numItems = deserializeIntLen(buffer, buffer.get());
+        for (int i = 0; i < numItems; i++) {
+          skipRecursiveWithType(buffer, buffer.get());
+          skipRecursiveWithType(buffer, buffer.get());
+        }
+        return;
+      }
+      case BSER_TEMPLATE: {
+        byte arrayType = buffer.get();
+        if (arrayType != BSER_ARRAY) {
+          throw new IOException(
+              String.format("Expected ARRAY to follow TEMPLATE, got %d", arrayType));
+        }
+        int numKeys = deserializeIntLen(buffer, buffer.get());
+        for (int i = 0; i < numKeys; i++) {
+          skipRecursiveWithType(buffer, buffer.get());
+        }
+        int numItems = deserializeIntLen(buffer, buffer.get());
+        for (int i = 0; i < numItems; i++) {
+          for (int keyIdx = 0; keyIdx < numKeys; keyIdx++) {
+            skipRecursiveWithType(buffer, buffer.get());
+          }
+        }
+        return;
+      }
+      default:
+        throw new IOException(String.format("Unrecognized BSER value type %d", type));
+    }
+  }
+
+  private static void skipBytes(ByteBuffer buffer, int len) {
+    if (len > buffer.remaining()) {
+      throw new BufferUnderflowException();
+    }
+    buffer.position(buffer.position() + len);
+  }
 }
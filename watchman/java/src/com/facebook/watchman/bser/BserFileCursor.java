@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+package com.facebook.watchman.bser;
+
+// CHECKSTYLE.OFF: AvoidStarImport
+import static com.facebook.watchman.bser.BserConstants.*;
+
+import java.io.IOException;
+
+import java.nio.ByteBuffer;
+
+import java.util.Collections;
+import java.util.HashMap;
+import java.util.Iterator;
+import java.util.List;
+import java.util.Map;
+
+import javax.annotation.Nullable;
+
+import com.facebook.watchman.WatchmanFile;
+
+/**
+ * Pull-style iterator over the files of a query result. Each call to
+ * {@link #next()} moves to the next file, which is then read through the
+ * {@link WatchmanFile} getters:
+ *
+ * <pre>
+ *   BserFileCursor files = response.files();
+ *   while (files.next()) {
+ *     String name = files.getString("name");
+ *   }
+ * </pre>
+ *
+ * A cursor over an encoded response only records where each field of the
+ * current file starts, and decodes a field when it is asked for, so the
+ * files of a large result are never all decoded at once.
+ */
+public abstract class BserFileCursor implements WatchmanFile {
+
+  /**
+   * Moves to the next file, returning {@code false} once there are none left.
+   */
+  public abstract boolean next() throws IOException;
+
+  @Nullable
+  @Override
+  public String getString(String field) throws IOException {
+    Object value = get(field);
+    return value instanceof String ? (String) value : null;
+  }
+
+  @Override
+  public long getLong(String field, long defaultValue) throws IOException {
+    Object value = get(field);
+    return value instanceof Number ? ((Number) value).longValue() : defaultValue;
+  }
+
+  @Override
+  public boolean getBoolean(String field, boolean defaultValue) throws IOException {
+    Object value = get(field);
+    return value instanceof Boolean ? (Boolean) value : defaultValue;
+  }
+
+  /**
+   * Iterates files that have already been decoded.
+   */
+  static BserFileCursor overList(List<?> files) {
+    return new ListCursor(files);
+  }
+
+  static BserFileCursor empty() {
+    return new ListCursor(Collections.emptyList());
+  }
+
+  /**
+   * Iterates the array or template that starts at {@code offset} in
+   * {@code buffer}, which the cursor then owns the position of.
+   */
+  static BserFileCursor overBuffer(
+      BserDeserializer deserializer,
+      ByteBuffer buffer,
+      int offset) throws IOException {
+    return new BufferCursor(deserializer, buffer, offset);
+  }
+
+  private static IllegalStateException noCurrentFile() {
+    return new IllegalStateException("No current file; call next() first");
+  }
+
+  private static final class ListCursor extends BserFileCursor {
+    private final Iterator<?> files;
+    private boolean hasFile;
+    @Nullable
+    private Object file;
+
+    ListCursor(List<?> files) {
+      this.files = files.iterator();
+    }
+
+    @Override
+    public boolean next() {
+      hasFile = files.hasNext();
+      file = hasFile ? files.next() : null;
+      return hasFile;
+    }
+
+    @Nullable
+    @Override
+    public Object get(String field) {
+      if (!hasFile) {
+        throw noCurrentFile();
+      }
+      return file instanceof Map ? ((Map<?, ?>) file).get(field) : file;
+    }
+
+    @Nullable
+    @Override
+    public Object getValue() {
+      if (!hasFile) {
+        throw noCurrentFile();
+      }
+      return file;
+    }
+  }
+
+  private static final class BufferCursor extends BserFileCursor {
+    private final BserDeserializer deserializer;
+    private final ByteBuffer buffer;
+    // The keys of a template, or null when the files are a plain array
+    @Nullable
+    private final String[] keys;
+    @Nullable
+    private final Map<String, Integer> keyIndexes;
+    // Where each value of the current row of a template starts
+    private final int[] valueOffsets;
+    private int filesLeft;
+    private int nextFileOffset;
+    private int fileOffset = -1;
+    // The current element of a plain array, once decoded
+    private boolean fileDecoded;
+    @Nullable
+    private Object decodedFile;
+
+    BufferCursor(
+        BserDeserializer deserializer,
+        ByteBuffer buffer,
+        int offset) throws IOException {
+      this.deserializer = deserializer;
+      this.buffer = buffer;
+      buffer.position(offset);
+      byte type = buffer.get();
+      if (type == BSER_TEMPLATE) {
+        byte arrayType = buffer.get();
+        if (arrayType != BSER_ARRAY) {
+          throw new IOException(
+              String.format("Expected ARRAY to follow TEMPLATE, got %d", arrayType));
+        }
+        List<?> keyList = (List<?>) deserializer.deserializeRecursiveWithType(buffer, arrayType);
+        keys = new String[keyList.size()];
+        keyIndexes = new HashMap<String, Integer>(keys.length * 2);
+        for (int i = 0; i < keys.length; i++) {
+          if (!(keyList.get(i) instanceof String)) {
+            throw new IOException("Expected the keys of a TEMPLATE to be strings");
+          }
+          keys[i] = (String) keyList.get(i);
+          keyIndexes.put(keys[i], i);
+        }
+        valueOffsets = new int[keys.length];
+      } else if (type == BSER_ARRAY) {
+        keys = null;
+        keyIndexes = null;
+        valueOffsets = new int[0];
+      } else {
+        throw new IOException(
+            String.format("Expected files to be an ARRAY or TEMPLATE, got %d", type));
+      }
+      filesLeft = deserializer.deserializeIntLen(buffer, buffer.get());
+      nextFileOffset = buffer.position();
+    }
+
+    @Override
+    public boolean next() throws IOException {
+      fileDecoded = false;
+      decodedFile = null;
+      if (filesLeft == 0) {
+        fileOffset = -1;
+        return false;
+      }
+      filesLeft--;
+      fileOffset = nextFileOffset;
+      buffer.position(fileOffset);
+      if (keys != null) {
+        for (int i = 0; i < keys.length; i++) {
+          valueOffsets[i] = buffer.position();
+          deserializer.skipRecursiveWithType(buffer, buffer.get());
+        }
+      } else {
+        deserializer.skipRecursiveWithType(buffer, buffer.get());
+      }
+      nextFileOffset = buffer.position();
+      return true;
+    }
+
+    @Nullable
+    @Override
+    public Object get(String field) throws IOException {
+      if (fileOffset < 0) {
+        throw noCurrentFile();
+      }
+      if (keys != null) {
+        Integer index = keyIndexes.get(field);
+        return index == null ? null : decodeAt(valueOffsets[index]);
+      }
+      Object file = getValue();
+      return file instanceof Map ? ((Map<?, ?>) file).get(field) : file;
+    }
+
+    @Nullable
+    @Override
+    public Object getValue() throws IOException {
+      if (fileOffset < 0) {
+        throw noCurrentFile();
+      }
+      if (keys != null) {
+        Map<String, Object> file = deserializer.newObject(keys.length);
+        for (int i = 0; i < keys.length; i++) {
+          buffer.position(valueOffsets[i]);
+          byte type = buffer.get();
+          if (type != BSER_SKIP) {
+            file.put(keys[i], deserializer.deserializeRecursiveWithType(buffer, type));
+          }
+        }
+        return file;
+      }
+      if (!fileDecoded) {
+        decodedFile = decodeAt(fileOffset);
+        fileDecoded = true;
+      }
+      return decodedFile;
+    }
+
+    @Nullable
+    private Object decodeAt(int offset) throws IOException {
+      buffer.position(offset);
+      byte type = buffer.get();
+      return type == BSER_SKIP ? null : deserializer.deserializeRecursiveWithType(buffer, type);
+    }
+  }
+}
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+package com.facebook.watchman.bser;
+
+// CHECKSTYLE.OFF: AvoidStarImport
+import static com.facebook.watchman.bser.BserConstants.*;
+
+import java.io.InputStream;
+import java.io.IOException;
+
+import java.nio.BufferUnderflowException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+
+import java.util.LinkedHashMap;
+import java.util.List;
+import java.util.Map;
+
+import javax.annotation.Nullable;
+
+import com.facebook.watchman.bser.BserDeserializer.BserEofException;
+import com.facebook.watchman.bser.BserDeserializer.KeyOrdering;
+
+/**
+ * Decoder for Watchman responses that leaves their {@code files} encoded.
+ *
+ * {@link BserDeserializer} turns a whole response into maps and lists, so a
+ * query result of a million files becomes millions of objects that all live
+ * until the caller is done with them. This decoder reads the response into a
+ * single buffer, decodes every field but {@code files}, and hands out a
+ * {@link BserFileCursor} that decodes the files one at a time as it is
+ * advanced, leaving little for the garbage collector to trace or promote.
+ *
+ * Not thread safe; a response must be decoded by one thread at a time.
+ */
+public class BserStreamingDeserializer {
+  private static final String FILES_KEY = "files";
+
+  private final BserDeserializer deserializer;
+
+  public BserStreamingDeserializer(KeyOrdering keyOrdering) {
+    this.deserializer = new BserDeserializer(keyOrdering);
+  }
+
+  /**
+   * Reads the next response from the stream, which must be a BSER object.
+   */
+  public Response deserializeResponse(InputStream inputStream) throws IOException {
+    ByteBuffer buffer = deserializer.readBserBuffer(inputStream);
+    try {
+      byte type = buffer.get();
+      if (type != BSER_OBJECT) {
+        throw new IOException(
+            String.format("Expected a BSER object response, got %d", type));
+      }
+      int numItems = deserializer.deserializeIntLen(buffer, buffer.get());
+      Map<String, Object> fields = deserializer.newObject(numItems);
+      int filesOffset = -1;
+      for (int i = 0; i < numItems; i++) {
+        byte stringType = buffer.get();
+        if (stringType != BSER_STRING) {
+          throw new IOException(
+              String.format(
+                  "Unrecognized BSER object key type %d, expected string",
+                  stringType));
+        }
+        String key = deserializer.deserializeString(buffer);
+        if (key.equals(FILES_KEY)) {
+          // Walk the files once here, so that a truncated or malformed
+          // response fails now rather than halfway through the caller's
+          // iteration.
+          filesOffset = buffer.position();
+          deserializer.skipRecursiveWithType(buffer, buffer.get());
+        } else {
+          fields.put(key, deserializer.deserializeRecursive(buffer));
+        }
+      }
+      return new Response(deserializer, fields, buffer, filesOffset, null);
+    } catch (BufferUnderflowException e) {
+      throw new BserEofException("Prematurely reached end of BSER buffer", e);
+    }
+  }
+
+  /**
+   * A response with its {@code files} still encoded.
+   */
+  public static final class Response {
+    @Nullable
+    private final BserDeserializer deserializer;
+    private final Map<String, Object> fields;
+    @Nullable
+    private final ByteBuffer buffer;
+    private final int filesOffset;
+    // The response, when it was decoded up front
+    @Nullable
+    private final Map<String, Object> message;
+
+    private Response(
+        @Nullable BserDeserializer deserializer,
+        Map<String, Object> fields,
+        @Nullable ByteBuffer buffer,
+        int filesOffset,
+        @Nullable Map<String, Object> message) {
+      this.deserializer = deserializer;
+      this.fields = fields;
+      this.buffer = buffer;
+      this.filesOffset = filesOffset;
+      this.message = message;
+    }
+
+    /**
+     * Wraps a response that has already been decoded, so that it can be
+     * iterated like one that hasn't.
+     */
+    public static Response of(Map<String, Object> message) {
+      Map<String, Object> fields = message;
+      if (message.containsKey(FILES_KEY)) {
+        fields = new LinkedHashMap<String, Object>(message);
+        fields.remove(FILES_KEY);
+      }
+      return new Response(null, fields, null, -1, message);
+    }
+
+    /**
+     * Every field of the response except {@code files}.
+     */
+    public Map<String, Object> getFields() {
+      return fields;
+    }
+
+    public boolean hasFiles() {
+      return message != null ? message.containsKey(FILES_KEY) : filesOffset >= 0;
+    }
+
+    /**
+     * Returns a new cursor positioned before the first file; a response
+     * without files has none.
+     */
+    public BserFileCursor files() throws IOException {
+      if (message != null) {
+        Object files = message.get(FILES_KEY);
+        return files instanceof List
+            ? BserFileCursor.overList((List<?>) files)
+            : BserFileCursor.empty();
+      }
+      if (filesOffset < 0) {
+        return BserFileCursor.empty();
+      }
+      return BserFileCursor.overBuffer(deserializer, duplicateBuffer(), filesOffset);
+    }
+
+    /**
+     * Decodes the whole response, as {@link BserDeserializer} would have.
+     */
+    public Map<String, Object> toMap() throws IOException {
+      if (message != null) {
+        return message;
+      }
+      if (filesOffset < 0) {
+        return fields;
+      }
+      Map<String, Object> result = deserializer.newObject(fields.size() + 1);
+      result.putAll(fields);
+      ByteBuffer filesBuffer = duplicateBuffer();
+      filesBuffer.position(filesOffset);
+      result.put(FILES_KEY, deserializer.deserializeRecursive(filesBuffer));
+      return result;
+    }
+
+    private ByteBuffer duplicateBuffer() {
+      // duplicate() resets the byte order
+      return buffer.duplicate().order(ByteOrder.nativeOrder());
+    }
+  }
+}
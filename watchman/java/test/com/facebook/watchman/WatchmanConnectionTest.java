@@ -364,5 +364,33 @@ public class WatchmanConnectionTest extends WatchmanTestBase {
           expectedException.get(), e.getCause());
     }
   }
-}
 
+  /**
+   * Test that a command run with a FileCallback hands it each file, and returns the rest of the
+   * response.
+   */
+  @Test
+  public void streamsFilesToCallback() throws Exception {
+    Map<String, Object> mockResponse = new HashMap<>();
+    mockResponse.put("clock", CLOCK);
+    mockResponse.put("files", Arrays.<Object>asList(
+        ImmutableMap.<String, Object>of("name", "foo", "size", 1),
+        ImmutableMap.<String, Object>of("name", "bar", "size", 2)));
+    mObjectQueue.put(mockResponse);
+
+    WatchmanConnection connection = new WatchmanConnection(mIncomingMessageGetter, mOutgoingMessageStream);
+    connection.start();
+    final List<String> names = new ArrayList<>();
+    Map<String, Object> receivedResponse = connection.run(
+        Arrays.asList("query", "/a/b/c"),
+        new FileCallback() {
+          @Override
+          public void call(WatchmanFile file) throws Exception {
+            names.add(file.getString("name") + ":" + file.getLong("size", -1));
+          }
+        }).get();
+
+    Assert.assertEquals(Arrays.asList("foo:1", "bar:2"), names);
+    deepObjectEquals(ImmutableMap.<String, Object>of("clock", CLOCK), receivedResponse);
+  }
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+package com.facebook.watchman.bser;
+
+import static org.hamcrest.Matchers.equalTo;
+import static org.hamcrest.Matchers.is;
+import static org.hamcrest.Matchers.nullValue;
+import static org.junit.Assert.assertThat;
+
+import com.google.common.io.BaseEncoding;
+
+import java.io.ByteArrayInputStream;
+import java.io.InputStream;
+import java.io.IOException;
+
+import java.util.Map;
+
+import org.hamcrest.Matchers;
+
+import org.junit.rules.ExpectedException;
+import org.junit.Rule;
+import org.junit.Test;
+
+@SuppressWarnings("unchecked")
+public class BserStreamingDeserializerTest {
+  @Rule
+  public ExpectedException thrown = ExpectedException.none();
+
+  // {"clock": "c:1:2", "files": [{"name": "fred", "age": 20},
+  //                              {"name": "pete", "age": 30},
+  //                              {"age": 25}]} with the files as a template
+  private static final String TEMPLATE_RESPONSE =
+      "00010343010302020305636C6F636B020305633A313A3202030566696C65730B0003" +
+      "020203046E616D65020303616765030302030466726564031402030470657465031E" +
+      "0C0319";
+
+  // {"files": ["a", "b"], "clock": "c:1:2"}
+  private static final String ARRAY_RESPONSE =
+      "0001032601030202030566696C65730003020203016102030162020305636C6F636B" +
+      "020305633A313A32";
+
+  private static InputStream getByteStream(String base16) {
+    return new ByteArrayInputStream(BaseEncoding.base16().decode(base16));
+  }
+
+  private static BserStreamingDeserializer.Response deserialize(String base16)
+      throws IOException {
+    return new BserStreamingDeserializer(BserDeserializer.KeyOrdering.UNSORTED)
+        .deserializeResponse(getByteStream(base16));
+  }
+
+  @Test
+  public void iterateTemplateRows() throws IOException {
+    BserStreamingDeserializer.Response response = deserialize(TEMPLATE_RESPONSE);
+    assertThat(response.getFields().keySet(), Matchers.contains("clock"));
+    assertThat(response.getFields().get("clock"), equalTo((Object) "c:1:2"));
+    assertThat(response.hasFiles(), is(true));
+
+    BserFileCursor files = response.files();
+    assertThat(files.next(), is(true));
+    // Fields can be read in any order, and more than once
+    assertThat(files.getLong("age", -1), equalTo(20L));
+    assertThat(files.getString("name"), equalTo("fred"));
+    assertThat(files.getString("name"), equalTo("fred"));
+    assertThat(files.get("size"), nullValue());
+
+    assertThat(files.next(), is(true));
+    assertThat(files.getString("name"), equalTo("pete"));
+    assertThat(files.getLong("age", -1), equalTo(30L));
+
+    assertThat(files.next(), is(true));
+    assertThat(files.getString("name"), nullValue());
+    assertThat(files.getLong("age", -1), equalTo(25L));
+    assertThat(
+        (Map<String, Object>) files.getValue(),
+        Matchers.<String, Object>hasEntry("age", (byte) 25));
+
+    assertThat(files.next(), is(false));
+  }
+
+  @Test
+  public void iterateArrayOfValues() throws IOException {
+    BserStreamingDeserializer.Response response = deserialize(ARRAY_RESPONSE);
+    assertThat(response.getFields().keySet(), Matchers.contains("clock"));
+
+    BserFileCursor files = response.files();
+    assertThat(files.next(), is(true));
+    // A single-field query sends the field alone
+    assertThat(files.getString("name"), equalTo("a"));
+    assertThat(files.next(), is(true));
+    assertThat(files.getValue(), equalTo((Object) "b"));
+    assertThat(files.next(), is(false));
+  }
+
+  @Test
+  public void toMapMatchesBserDeserializer() throws IOException {
+    Map<String, Object> expected = new BserDeserializer(BserDeserializer.KeyOrdering.UNSORTED)
+        .deserialize(getByteStream(TEMPLATE_RESPONSE));
+    assertThat(deserialize(TEMPLATE_RESPONSE).toMap(), equalTo(expected));
+  }
+
+  @Test
+  public void decodedResponseIteratesLikeEncodedOne() throws IOException {
+    Map<String, Object> message = new BserDeserializer(BserDeserializer.KeyOrdering.UNSORTED)
+        .deserialize(getByteStream(TEMPLATE_RESPONSE));
+    BserStreamingDeserializer.Response response = BserStreamingDeserializer.Response.of(message);
+    assertThat(response.getFields().keySet(), Matchers.contains("clock"));
+    assertThat(response.toMap(), Matchers.sameInstance(message));
+
+    BserFileCursor files = response.files();
+    assertThat(files.next(), is(true));
+    assertThat(files.getString("name"), equalTo("fred"));
+    assertThat(files.next(), is(true));
+    assertThat(files.next(), is(true));
+    assertThat(files.getLong("age", -1), equalTo(25L));
+    assertThat(files.next(), is(false));
+  }
+
+  @Test
+  public void responseWithoutFilesHasNone() throws IOException {
+    // {"clock": "c:1:2"}
+    BserStreamingDeserializer.Response response = deserialize(
+        "00010313010301020305636C6F636B020305633A313A32");
+    assertThat(response.hasFiles(), is(false));
+    assertThat(response.files().next(), is(false));
+    assertThat(response.toMap().get("clock"), equalTo((Object) "c:1:2"));
+  }
+
+  @Test
+  public void throwIfFilesTruncated() throws IOException {
+    thrown.expect(BserDeserializer.BserEofException.class);
+    thrown.expectMessage("Prematurely reached end of BSER buffer");
+    // {"files": ["a", "b", <missing>]}
+    deserialize("0001031601030102030566696C65730003030203016102030162");
+  }
+
+  @Test
+  public void throwIfNotCurrentFile() throws IOException {
+    thrown.expect(IllegalStateException.class);
+    deserialize(TEMPLATE_RESPONSE).files().get("name");
+  }
+}
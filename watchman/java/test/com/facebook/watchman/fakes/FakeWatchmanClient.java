@@ -13,6 +13,7 @@ import java.util.List;
 import java.util.Map;
 
 import com.facebook.watchman.Callback;
+import com.facebook.watchman.FileCallback;
 import com.facebook.watchman.WatchmanClient;
 
 import com.google.common.util.concurrent.ListenableFuture;
@@ -67,6 +68,12 @@ public class FakeWatchmanClient implements WatchmanClient {
     throw new NotImplementedException();
   }
 
+  @Override
+  public ListenableFuture<Map<String, Object>> query(
+      Path path, Map<String, Object> query, FileCallback callback) {
+    throw new NotImplementedException();
+  }
+
   @Override
   public ListenableFuture<Boolean> unsubscribeAll() {
     throw new NotImplementedException();
@@ -9,6 +9,7 @@
 #include "watchman/Client.h"
 #include "watchman/Errors.h"
 #include "watchman/Logging.h"
+#include "watchman/RootWorker.h"
 #include "watchman/Shutdown.h"
 #include "watchman/root/Root.h"
 #include "watchman/root/resolve.h"
@@ -18,8 +19,12 @@
 
 using namespace watchman;
 
-static UntypedResponse cmd_shutdown(Client*, const json_ref&) {
+static UntypedResponse cmd_shutdown(Client*, const json_ref& args) {
   logf(ERR, "shutdown-server was requested, exiting!\n");
+  if (RootWorker::enabled()) {
+    // The workers go with the daemon that spawned them
+    RootWorker::requestAll(args);
+  }
   w_request_shutdown();
 
   UntypedResponse resp;
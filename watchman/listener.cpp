@@ -124,11 +124,11 @@ static FileDescriptor get_listener_unix_domain_socket(const char* path) {
   }
 
   if (sock_group_name) {
-    const struct group* sock_group = w_get_group(sock_group_name);
-    if (!sock_group) {
+    auto sock_gid = w_get_group(sock_group_name);
+    if (!sock_gid) {
       return FileDescriptor();
     }
-    if (st.st_gid != sock_group->gr_gid) {
+    if (st.st_gid != *sock_gid) {
       watchman::log(
           watchman::ERR,
           "for socket '",
@@ -136,7 +136,7 @@ static FileDescriptor get_listener_unix_domain_socket(const char* path) {
           "', gid ",
           st.st_gid,
           " doesn't match expected gid ",
-          sock_group->gr_gid,
+          *sock_gid,
           " (group name ",
           sock_group_name,
           "). Ensure that you are still a member of group ",
@@ -241,14 +241,287 @@ static void named_pipe_accept_loop_internal(
   logf(ERR, "is_stopping is true, so acceptor is done\n");
 }
 
+namespace {
+
+// NtSetInformationFile, and the FILE_INFORMATION_CLASS with which Windows
+// 8.1 and later can remove a handle's association with a completion port
+constexpr int kFileReplaceCompletionInformation = 61;
+struct FileCompletionInformation {
+  HANDLE port;
+  void* key;
+};
+struct IoStatusBlock {
+  union {
+    LONG status;
+    void* pointer;
+  };
+  ULONG_PTR information;
+};
+using NtSetInformationFileFunc =
+    LONG(NTAPI*)(HANDLE, IoStatusBlock*, void*, ULONG, int);
+
+bool dissociateFromCompletionPort(HANDLE handle) {
+  static const auto func = reinterpret_cast<NtSetInformationFileFunc>(
+      GetProcAddress(GetModuleHandleA("ntdll"), "NtSetInformationFile"));
+  if (!func) {
+    return false;
+  }
+  IoStatusBlock status{};
+  FileCompletionInformation info{nullptr, nullptr};
+  // Negative NTSTATUS values are errors
+  return func(
+             handle,
+             &status,
+             &info,
+             sizeof(info),
+             kFileReplaceCompletionInformation) >= 0;
+}
+
+/**
+ * Accepts named pipe clients from one thread, with win32_concurrent_accepts
+ * ConnectNamedPipe calls posted to an I/O completion port ahead of time.
+ * As each one completes, another is posted in its place, so that a burst
+ * of clients finds instances waiting for it, rather than queueing behind a
+ * thread per instance that has to wake up, hand off its client and create
+ * the next instance.
+ *
+ * The client streams use event signalled overlapped reads and WriteFileEx,
+ * neither of which may post to a port, so each connected instance is
+ * dissociated from the port before it is handed off.  That needs Windows
+ * 8.1, and run() returns false straight away where it isn't available.
+ */
+class NamedPipeAcceptor {
+ public:
+  NamedPipeAcceptor(
+      std::string path,
+      std::shared_ptr<watchman_event> listenerEvent,
+      size_t numAccepts)
+      : path_{std::move(path)},
+        listenerEvent_{std::move(listenerEvent)},
+        accepts_(numAccepts) {}
+
+  NamedPipeAcceptor(const NamedPipeAcceptor&) = delete;
+  NamedPipeAcceptor& operator=(const NamedPipeAcceptor&) = delete;
+
+  ~NamedPipeAcceptor() {
+    if (stopWait_) {
+      // Waits for onStop to finish, if it is running
+      UnregisterWaitEx(stopWait_, INVALID_HANDLE_VALUE);
+    }
+    if (port_) {
+      CloseHandle(port_);
+    }
+  }
+
+  // Accepts clients until the server stops.  Returns false, having
+  // accepted none, if the completion port can't be used.
+  bool run() {
+    port_ = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+    if (!port_) {
+      logf(
+          ERR,
+          "CreateIoCompletionPort failed: {}\n",
+          win32_strerror(GetLastError()));
+      return false;
+    }
+    if (!canDissociate()) {
+      logf(ERR, "this version of Windows can't dissociate pipes from ports\n");
+      return false;
+    }
+    if (!RegisterWaitForSingleObject(
+            &stopWait_,
+            (HANDLE)listenerEvent_->system_handle(),
+            onStop,
+            this,
+            INFINITE,
+            WT_EXECUTEONLYONCE)) {
+      logf(
+          ERR,
+          "RegisterWaitForSingleObject failed: {}\n",
+          win32_strerror(GetLastError()));
+      return false;
+    }
+
+    logf(ERR, "waiting for pipe clients on {}\n", path_);
+    for (auto& accept : accepts_) {
+      post(accept);
+    }
+    while (!w_is_stopping()) {
+      DWORD bytes;
+      ULONG_PTR key;
+      OVERLAPPED* olap = nullptr;
+      BOOL ok = GetQueuedCompletionStatus(port_, &bytes, &key, &olap, INFINITE);
+      if (key == kStopKey) {
+        break;
+      }
+      if (!olap) {
+        logf(
+            ERR,
+            "GetQueuedCompletionStatus failed: {}\n",
+            win32_strerror(GetLastError()));
+        break;
+      }
+
+      // The OVERLAPPED is the first member of its Accept
+      auto& accept = *reinterpret_cast<Accept*>(olap);
+      if (ok) {
+        auto pipe = std::move(accept.pipe);
+        post(accept);
+        handOff(std::move(pipe));
+      } else {
+        // The client went away before we got to it
+        logf(DBG, "ConnectNamedPipe: {}\n", win32_strerror(GetLastError()));
+        accept.pipe.reset();
+        post(accept);
+      }
+      // Try again on any instances that we failed to create earlier
+      for (auto& idle : accepts_) {
+        if (!idle.pipe) {
+          post(idle);
+        }
+      }
+    }
+
+    cancelAll();
+    logf(ERR, "is_stopping is true, so acceptor is done\n");
+    return true;
+  }
+
+ private:
+  struct Accept {
+    // First, so that the OVERLAPPED of a completion leads to its Accept
+    OVERLAPPED olap;
+    // Set while a ConnectNamedPipe is pending on it
+    FileDescriptor pipe;
+  };
+
+  static constexpr ULONG_PTR kAcceptKey = 1;
+  static constexpr ULONG_PTR kStopKey = 2;
+
+  // Whether a pipe instance can be removed from the port again, tried on an
+  // instance that no client knows the name of
+  bool canDissociate() {
+    auto probe = create_pipe_server(
+        fmt::format("{}-probe-{}", path_, GetCurrentProcessId()).c_str());
+    if (!probe) {
+      return false;
+    }
+    return CreateIoCompletionPort(
+               (HANDLE)probe.handle(), port_, kAcceptKey, 0) &&
+        dissociateFromCompletionPort((HANDLE)probe.handle());
+  }
+
+  // Creates a pipe instance and waits for a client to connect to it.
+  // Clients that connect in the meantime are handed off straight away.
+  void post(Accept& accept) {
+    while (!w_is_stopping()) {
+      accept.pipe = create_pipe_server(path_.c_str());
+      if (!accept.pipe) {
+        logf(
+            ERR,
+            "CreateNamedPipe({}) failed: {}\n",
+            path_,
+            win32_strerror(GetLastError()));
+        return;
+      }
+      if (!CreateIoCompletionPort(
+              (HANDLE)accept.pipe.handle(), port_, kAcceptKey, 0)) {
+        logf(
+            ERR,
+            "CreateIoCompletionPort failed: {}\n",
+            win32_strerror(GetLastError()));
+        accept.pipe.reset();
+        return;
+      }
+
+      accept.olap = OVERLAPPED();
+      if (ConnectNamedPipe((HANDLE)accept.pipe.handle(), &accept.olap)) {
+        // Completed, and the completion is on its way to the port
+        return;
+      }
+      auto err = GetLastError();
+      if (err == ERROR_IO_PENDING) {
+        return;
+      }
+      if (err == ERROR_PIPE_CONNECTED) {
+        // Nothing is posted to the port in this case
+        handOff(std::move(accept.pipe));
+        continue;
+      }
+      logf(ERR, "ConnectNamedPipe: {}\n", win32_strerror(err));
+      accept.pipe.reset();
+      return;
+    }
+  }
+
+  void handOff(FileDescriptor pipe) {
+    if (!dissociateFromCompletionPort((HANDLE)pipe.handle())) {
+      logf(ERR, "failed to dissociate a pipe client from the accept port\n");
+      return;
+    }
+    UserClient::create(w_stm_fdopen(std::move(pipe)));
+  }
+
+  // Cancels the pending accepts and waits for their completions, so that
+  // none of them refers to an Accept after it is gone
+  void cancelAll() {
+    size_t pending = 0;
+    for (auto& accept : accepts_) {
+      if (accept.pipe &&
+          (CancelIoEx((HANDLE)accept.pipe.handle(), &accept.olap) ||
+           GetLastError() == ERROR_NOT_FOUND)) {
+        ++pending;
+      }
+    }
+    while (pending > 0) {
+      DWORD bytes;
+      ULONG_PTR key;
+      OVERLAPPED* olap = nullptr;
+      GetQueuedCompletionStatus(port_, &bytes, &key, &olap, 1000);
+      if (olap) {
+        --pending;
+      } else if (key != kStopKey) {
+        // Timed out; give up rather than hang the shutdown
+        break;
+      }
+    }
+    for (auto& accept : accepts_) {
+      accept.pipe.reset();
+    }
+  }
+
+  static void CALLBACK onStop(void* context, BOOLEAN /*timedOut*/) {
+    auto* self = static_cast<NamedPipeAcceptor*>(context);
+    PostQueuedCompletionStatus(self->port_, 0, kStopKey, nullptr);
+  }
+
+  std::string path_;
+  std::shared_ptr<watchman_event> listenerEvent_;
+  std::vector<Accept> accepts_;
+  HANDLE port_{nullptr};
+  HANDLE stopWait_{nullptr};
+};
+
+} // namespace
+
 static void named_pipe_accept_loop() {
   log(DBG, "Starting pipe listener on ", get_named_pipe_sock_path(), "\n");
 
   std::shared_ptr<watchman_event> listener_event = w_event_make_named_pipe();
   w_push_listener_thread_event(listener_event);
 
+  auto numAccepts = cfg_get_int("win32_concurrent_accepts", 32);
+  {
+    NamedPipeAcceptor acceptor{
+        get_named_pipe_sock_path(), listener_event, size_t(numAccepts)};
+    if (acceptor.run()) {
+      return;
+    }
+  }
+  log(ERR, "falling back to a thread per pending pipe accept\n");
+
   std::vector<std::thread> acceptors;
-  for (json_int_t i = 0; i < cfg_get_int("win32_concurrent_accepts", 32); ++i) {
+  for (json_int_t i = 0; i < numAccepts; ++i) {
     acceptors.push_back(std::thread([i, listener_event]() {
       w_set_thread_name("accept", i);
       named_pipe_accept_loop_internal(listener_event);
@@ -370,7 +643,7 @@ class AcceptLoop {
   bool joined_{false};
 };
 
-bool w_start_listener() {
+bool w_start_listener(std::function<void()> onListening) {
 #ifndef _WIN32
   struct sigaction sa;
   sigset_t sigset;
@@ -491,6 +764,10 @@ bool w_start_listener() {
     startSanityCheckThread();
   }
 
+  if (onListening) {
+    onListening();
+  }
+
 #ifdef _WIN32
   // Start the named pipes and join them; this will
   // block until the server is shutdown.
@@ -7,10 +7,17 @@
 
 #pragma once
 
+#include <functional>
 #include "watchman/fs/FileDescriptor.h"
 
 #ifdef __APPLE__
 watchman::FileDescriptor w_get_listener_socket_from_launchd();
 #endif
 void w_listener_prep_inetd();
-bool w_start_listener();
+
+/**
+ * Listens for and serves clients until the server is shut down.
+ * onListening, if set, is called once the listening socket is up, so that
+ * whoever started the server can stop waiting for it.
+ */
+bool w_start_listener(std::function<void()> onListening = nullptr);
@@ -21,7 +21,10 @@
 #include "watchman/Clock.h"
 #include "watchman/Command.h"
 #include "watchman/Connect.h"
+#include "watchman/FairThreadPool.h"
 #include "watchman/GroupLookup.h"
+#include "watchman/HeapProfiler.h"
+#include "watchman/MemoryPressure.h"
 #include "watchman/LogConfig.h"
 #include "watchman/Logging.h"
 #include "watchman/Options.h"
@@ -33,6 +36,7 @@
 #include "watchman/WatchmanConfig.h"
 #include "watchman/fs/DirHandle.h"
 #include "watchman/fs/FileSystem.h"
+#include "watchman/fs/Pipe.h"
 #include "watchman/listener.h"
 #include "watchman/root/watchlist.h"
 #include "watchman/sockname.h"
@@ -77,6 +81,8 @@ const std::string& get_pid_file() {
 } // namespace
 
 W_CAP_REG("bser-v2")
+W_CAP_REG("bser-columns")
+W_CAP_REG("bser-zstd")
 
 /**
  * Log and fatal if Watchman was started with a low priority, which can cause a
@@ -101,7 +107,14 @@ void detect_low_process_priority() {
 #endif
 }
 
-[[noreturn]] static void run_service(ProcessLock::Handle&&) {
+/**
+ * Runs the service in this process.  If ready is set, a byte is written to
+ * it and it is closed once the listener is up, to tell the client that
+ * forked us that it can connect.
+ */
+[[noreturn]] static void run_service(
+    ProcessLock::Handle&&,
+    FileDescriptor ready = FileDescriptor()) {
 #ifndef _WIN32
   // Before we redirect stdin/stdout to the log files, move any inetd-provided
   // socket to a different descriptor number.
@@ -174,13 +187,29 @@ void detect_low_process_priority() {
     watchman::getThreadPool().start(
         cfg_get_int("thread_pool_worker_threads", 16),
         cfg_get_int("thread_pool_max_items", 1024 * 1024));
+    watchman::getContentHashPool().start(
+        cfg_get_int("content_hash_worker_threads", 8),
+        cfg_get_int("thread_pool_max_items", 1024 * 1024));
 
     ClockSpec::init();
+    watchman::startHeapProfiler();
+    SCOPE_EXIT {
+      watchman::stopHeapProfiler();
+    };
+    watchman::startMemoryPressureMonitor();
+    SCOPE_EXIT {
+      watchman::stopMemoryPressureMonitor();
+    };
     w_state_load();
     SCOPE_EXIT {
       w_state_shutdown();
     };
-    res = w_start_listener();
+    res = w_start_listener([&ready] {
+      if (ready) {
+        ignore_result(ready.write("r", 1));
+        ready.close();
+      }
+    });
     w_root_free_watched_roots();
     perf_shutdown();
     cfg_shutdown();
@@ -269,6 +298,12 @@ struct [[nodiscard]] SpawnResult {
    * If status is not Spawned, then this contains the error message.
    */
   std::string reason;
+
+  /**
+   * Where the spawner can tell, becomes readable once the new daemon is
+   * listening, or has exited without getting that far.
+   */
+  FileDescriptor ready;
 };
 } // namespace
 
@@ -290,6 +325,7 @@ static SpawnResult run_service_as_daemon() {
   }
 
   auto& processLock = std::get<ProcessLock>(acquireResult);
+  Pipe ready;
 
   // the double-fork-and-setsid trick establishes a
   // child process that runs in its own process group
@@ -299,8 +335,11 @@ static SpawnResult run_service_as_daemon() {
     // The parent of the first fork is the client
     // process that is being run by the user, and
     // we want to allow that to continue.
-    return SpawnResult::Spawned;
+    SpawnResult result{SpawnResult::Spawned};
+    result.ready = std::move(ready.read);
+    return result;
   }
+  ready.read.close();
   setsid();
   if (fork()) {
     // The parent of the second fork has served its
@@ -313,7 +352,8 @@ static SpawnResult run_service_as_daemon() {
 
   // We are the child. Let's populate the pid file and start listening on the
   // socket.
-  run_service(processLock.writePid(get_pid_file()));
+  run_service(
+      processLock.writePid(get_pid_file()), std::move(ready.write));
 }
 #endif
 
@@ -660,13 +700,13 @@ static void verify_dir_ownership(const std::string& state_dir) {
   }
 
   if (sock_group_name) {
-    const struct group* sock_group = w_get_group(sock_group_name);
-    if (!sock_group) {
+    auto sock_gid = w_get_group(sock_group_name);
+    if (!sock_gid) {
       ret = 1;
       goto bail;
     }
 
-    if (fchown(dir_fd, -1, sock_group->gr_gid) == -1) {
+    if (fchown(dir_fd, -1, *sock_gid) == -1) {
       log(ERR,
           "setting up group '",
           sock_group_name,
@@ -806,7 +846,16 @@ static void setup_sock_name() {
   }
 #endif
   compute_file_name(flags.unix_sock_name, user, "sock", "sockname");
+}
 
+/**
+ * Computes the state and log file names, which only the daemon uses.  A
+ * client that only forwards its command to a running daemon never needs
+ * them, so like the pid file they are left until we are about to start one,
+ * saving each client invocation from checking the state dir for each.
+ */
+static void setup_daemon_file_names() {
+  auto user = computeUserName();
   compute_file_name(flags.watchman_state_file, user, "state", "statefile");
   compute_file_name(
       logging::log_name,
@@ -816,6 +865,37 @@ static void setup_sock_name() {
       /*require_absolute=*/logging::log_name != "-");
 }
 
+/**
+ * Waits for a daemon that we spawned to report that it is listening, so
+ * that the first command is sent as soon as it can be answered, rather than
+ * after polling for the socket.  Returns early if the daemon exits first;
+ * the caller retries the command as before in that case.
+ */
+static void wait_for_listener(
+    const FileDescriptor& ready,
+    std::chrono::milliseconds timeout) {
+#ifndef _WIN32
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  while (true) {
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    if (remaining.count() <= 0) {
+      return;
+    }
+    struct pollfd pfd;
+    pfd.fd = ready.fd();
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (::poll(&pfd, 1, remaining.count()) != -1 || errno != EINTR) {
+      return;
+    }
+  }
+#else
+  (void)ready;
+  (void)timeout;
+#endif
+}
+
 static ResultErrno<folly::Unit> try_command(
     const Command& command,
     int timeout) {
@@ -1006,6 +1086,7 @@ static int inner_main(int argc, char** argv) {
 #endif
 
   if (flags.foreground) {
+    setup_daemon_file_names();
     run_service_in_foreground();
     return 0;
   }
@@ -1022,6 +1103,7 @@ static int inner_main(int argc, char** argv) {
   if (ran.hasError() && should_start(ran.error())) {
     if (flags.no_spawn) {
       if (!flags.no_local) {
+        setup_daemon_file_names();
         if (try_client_mode_command(cmd, !flags.no_pretty)) {
           ran = folly::unit;
         }
@@ -1038,10 +1120,15 @@ static int inner_main(int argc, char** argv) {
       bool spawned = false;
       while (true) {
         if (!spawned) {
+          setup_daemon_file_names();
           auto spawn_result = try_spawn_watchman(daemon_argv);
           switch (spawn_result.status) {
             case SpawnResult::Spawned:
               spawned = true;
+              if (spawn_result.ready) {
+                wait_for_listener(
+                    spawn_result.ready, std::chrono::seconds(10));
+              }
               break;
             case SpawnResult::FailedToLock:
               // Otherwise, it's possible another daemon is still shutting down,
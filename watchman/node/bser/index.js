@@ -80,8 +80,12 @@ Accumulator.prototype.append = function(buf) {
 
 Accumulator.prototype.assertReadableSize = function(size) {
   if (this.readAvail() < size) {
-    throw new Error("wanted to read " + size +
+    var err = new Error("wanted to read " + size +
         " bytes but only have " + this.readAvail());
+    // Lets BunserStream tell a value that hasn't fully arrived yet
+    // apart from a malformed one
+    err.bserNeedsMoreData = true;
+    throw err;
   }
 }
 
@@ -209,6 +213,9 @@ var BSER_FALSE     = 0x09;
 var BSER_NULL      = 0x0a;
 var BSER_TEMPLATE  = 0x0b;
 var BSER_SKIP      = 0x0c;
+var BSER_UTF8STRING = 0x0d;
+var BSER_COLUMNS   = 0x0e;
+var BSER_PATH      = 0x0f;
 
 var ST_NEED_PDU = 0; // Need to read and decode PDU length
 var ST_FILL_PDU = 1; // Know the length, need to read whole content
@@ -265,16 +272,8 @@ BunserBuf.prototype.processLater = function() {
 // can process.
 BunserBuf.prototype.process = function(synchronous) {
   if (this.state == ST_NEED_PDU) {
-    if (this.buf.readAvail() < 2) {
-      return;
-    }
-    // Validate BSER header
-    this.expectCode(0);
-    this.expectCode(1);
-    this.pduLen = this.decodeInt(true /* relaxed */);
+    this.pduLen = this.decodeHeader();
     if (this.pduLen === false) {
-      // Need more data, walk backwards
-      this.buf.readAdvance(-2);
       return;
     }
     // Ensure that we have a big enough buffer to read the rest of the PDU
@@ -302,6 +301,33 @@ BunserBuf.prototype.process = function(synchronous) {
   }
 }
 
+// Validates the header that begins a PDU: the magic, then for BSER v2 the
+// capabilities, and returns the length of the PDU that follows.  Returns
+// false, having consumed nothing, if the header hasn't all arrived yet.
+BunserBuf.prototype.decodeHeader = function() {
+  if (this.buf.readAvail() < 2) {
+    return false;
+  }
+  var start = this.buf.readOffset;
+  this.expectCode(0);
+  var version = this.buf.readInt(1);
+  if (version == 2) {
+    if (this.buf.readAvail() < 4) {
+      this.buf.readAdvance(start - this.buf.readOffset);
+      return false;
+    }
+    this.capabilities = this.buf.readInt(4);
+  } else if (version != 1) {
+    this.raise("unsupported bser version " + version);
+  }
+  var len = this.decodeInt(true /* relaxed */);
+  if (len === false) {
+    // Need more data, walk backwards
+    this.buf.readAdvance(start - this.buf.readOffset);
+  }
+  return len;
+}
+
 BunserBuf.prototype.raise = function(reason) {
   throw new Error(reason + ", in Buffer of length " +
       this.buf.buf.length + " (" + this.buf.readAvail() +
@@ -338,6 +364,7 @@ BunserBuf.prototype.decodeAny = function() {
       this.buf.readAdvance(1);
       return null;
     case BSER_STRING:
+    case BSER_UTF8STRING:
       return this.decodeString();
     case BSER_ARRAY:
       return this.decodeArray();
@@ -345,6 +372,8 @@ BunserBuf.prototype.decodeAny = function() {
       return this.decodeObject();
     case BSER_TEMPLATE:
       return this.decodeTemplate();
+    case BSER_COLUMNS:
+      return this.decodeColumns();
     default:
       this.raise("unhandled bser opcode " + code);
   }
@@ -373,27 +402,77 @@ BunserBuf.prototype.decodeObject = function() {
 }
 
 BunserBuf.prototype.decodeTemplate = function() {
+  var header = this.decodeTemplateHeader();
+  var arr = [];
+  for (var i = 0; i < header.nitems; ++i) {
+    arr.push(this.decodeTemplateRow(header.keys));
+  }
+  return arr;
+}
+
+// Decodes the keys and the number of rows that begin a template
+BunserBuf.prototype.decodeTemplateHeader = function() {
   this.expectCode(BSER_TEMPLATE);
   var keys = this.decodeArray();
   var nitems = this.decodeInt();
+  return {keys: keys, nitems: nitems};
+}
+
+BunserBuf.prototype.decodeTemplateRow = function(keys) {
+  var obj = {};
+  for (var keyidx = 0; keyidx < keys.length; ++keyidx) {
+    if (this.buf.peekInt(1) == BSER_SKIP) {
+      this.buf.readAdvance(1);
+      continue;
+    }
+    var val = this.decodeAny();
+    obj[keys[keyidx]] = val;
+  }
+  return obj;
+}
+
+// Decodes the same objects as a template holding the same values, which
+// are laid out a column at a time instead of a row at a time.  String
+// values may be encoded as BSER_PATH, an index into an array of the
+// directories that the paths among them share, and the rest of the path.
+BunserBuf.prototype.decodeColumns = function() {
+  this.expectCode(BSER_COLUMNS);
+  var keys = this.decodeArray();
+  var nitems = this.decodeInt();
+  var dirs = this.decodeArray();
   var arr = [];
   for (var i = 0; i < nitems; ++i) {
-    var obj = {};
-    for (var keyidx = 0; keyidx < keys.length; ++keyidx) {
-      if (this.buf.peekInt(1) == BSER_SKIP) {
+    arr.push({});
+  }
+  for (var keyidx = 0; keyidx < keys.length; ++keyidx) {
+    for (var i = 0; i < nitems; ++i) {
+      var code = this.buf.peekInt(1);
+      if (code == BSER_SKIP) {
         this.buf.readAdvance(1);
         continue;
       }
-      var val = this.decodeAny();
-      obj[keys[keyidx]] = val;
+      var val;
+      if (code == BSER_PATH) {
+        this.buf.readAdvance(1);
+        var dir = this.decodeInt();
+        if (dir < 0 || dir >= dirs.length) {
+          this.raise("bser directory index " + dir + " is out of range");
+        }
+        val = dirs[dir] + '/' + this.decodeString();
+      } else {
+        val = this.decodeAny();
+      }
+      arr[i][keys[keyidx]] = val;
     }
-    arr.push(obj);
   }
   return arr;
 }
 
 BunserBuf.prototype.decodeString = function() {
-  this.expectCode(BSER_STRING);
+  var code = this.buf.readInt(1);
+  if (code != BSER_STRING && code != BSER_UTF8STRING) {
+    this.raise("expected bser string but got opcode " + code);
+  }
   var len = this.decodeInt();
   return this.buf.readString(len);
 }
@@ -435,6 +514,165 @@ BunserBuf.prototype.decodeInt = function(relaxSizeAsserts) {
   return this.buf.readInt(size);
 }
 
+// A decoder that, unlike BunserBuf, doesn't wait for a whole PDU to
+// arrive before decoding it.  When a PDU is an object, the rows of the
+// templated arrays among its values, such as the files of a query
+// result, are each emitted as a `record` event as soon as their bytes
+// have arrived, and are never accumulated.  The rest of the object is
+// then emitted as a `value` event once the PDU is complete, without the
+// keys whose values were streamed.  Only the rows themselves need to be
+// buffered, so the read buffer stays small however large the PDU is.
+//
+// The record listener is passed the row, the key of the array it is in,
+// and the part of the enclosing object that has been decoded so far.
+// Templates nested more deeply than that, and PDUs that aren't objects,
+// are decoded whole as BunserBuf would.
+function BunserStream() {
+  BunserBuf.call(this);
+  // The PDU object being decoded, its pending key and number of
+  // remaining entries, and the template being streamed, if any
+  this.pdu = null;
+  this.pduKey = null;
+  this.pduEntries = 0;
+  this.template = null;
+}
+util.inherits(BunserStream, BunserBuf);
+exports.BunserStream = BunserStream;
+
+var ST_STREAM_PDU = 2; // Decoding the entries of an object as they arrive
+
+// Returned by attempt() when the value hasn't fully arrived yet
+var NEEDS_MORE_DATA = {};
+
+BunserStream.prototype.append = function(buf) {
+  try {
+    this.buf.append(buf);
+  } catch (err) {
+    this.emit('error', err);
+    return;
+  }
+  this.processLater();
+}
+
+// Calls decode to read a value, rewinding and returning NEEDS_MORE_DATA
+// if it runs out of input before the end of the PDU.
+BunserStream.prototype.attempt = function(decode) {
+  var start = this.buf.readOffset;
+  try {
+    var val = decode.call(this);
+  } catch (err) {
+    if (err.bserNeedsMoreData &&
+        this.buf.writeOffset - start < this.pduLen) {
+      this.buf.readOffset = start;
+      return NEEDS_MORE_DATA;
+    }
+    throw err;
+  }
+  this.pduLen -= this.buf.readOffset - start;
+  return val;
+}
+
+BunserStream.prototype.process = function() {
+  if (this.state == ST_NEED_PDU) {
+    this.pduLen = this.decodeHeader();
+    if (this.pduLen === false) {
+      return;
+    }
+    this.state = ST_FILL_PDU;
+  }
+
+  if (this.state == ST_FILL_PDU) {
+    if (this.buf.readAvail() < 1) {
+      return;
+    }
+    if (this.buf.peekInt(1) != BSER_OBJECT) {
+      // Not something we stream; wait for all of it
+      if (this.buf.readAvail() < this.pduLen) {
+        this.buf.reserve(this.pduLen);
+        return;
+      }
+      var val = this.decodeAny();
+      this.state = ST_NEED_PDU;
+      this.emit('value', val);
+      this.processRest();
+      return;
+    }
+    var nitems = this.attempt(function() {
+      this.expectCode(BSER_OBJECT);
+      return this.decodeInt();
+    });
+    if (nitems === NEEDS_MORE_DATA) {
+      return;
+    }
+    this.pdu = {};
+    this.pduKey = null;
+    this.pduEntries = nitems;
+    this.state = ST_STREAM_PDU;
+  }
+
+  while (this.pduEntries > 0) {
+    if (this.template) {
+      if (this.template.nitems > 0) {
+        var keys = this.template.keys;
+        var row = this.attempt(function() {
+          return this.decodeTemplateRow(keys);
+        });
+        if (row === NEEDS_MORE_DATA) {
+          return;
+        }
+        this.template.nitems--;
+        this.emit('record', row, this.pduKey, this.pdu);
+        continue;
+      }
+      this.template = null;
+      this.pduKey = null;
+      this.pduEntries--;
+      continue;
+    }
+
+    if (this.pduKey === null) {
+      var key = this.attempt(this.decodeString);
+      if (key === NEEDS_MORE_DATA) {
+        return;
+      }
+      this.pduKey = key;
+    }
+
+    if (this.buf.readAvail() < 1) {
+      return;
+    }
+    if (this.buf.peekInt(1) == BSER_TEMPLATE) {
+      var header = this.attempt(this.decodeTemplateHeader);
+      if (header === NEEDS_MORE_DATA) {
+        return;
+      }
+      this.template = header;
+      continue;
+    }
+
+    var val = this.attempt(this.decodeAny);
+    if (val === NEEDS_MORE_DATA) {
+      return;
+    }
+    this.pdu[this.pduKey] = val;
+    this.pduKey = null;
+    this.pduEntries--;
+  }
+
+  var pdu = this.pdu;
+  this.pdu = null;
+  this.state = ST_NEED_PDU;
+  this.emit('value', pdu);
+  this.processRest();
+}
+
+// After a PDU, carry on with the next one, if it has begun to arrive
+BunserStream.prototype.processRest = function() {
+  if (this.buf.readAvail() > 0) {
+    this.processLater();
+  }
+}
+
 // synchronously BSER decode a string and return the value
 function loadFromBuffer(input) {
   var buf = new BunserBuf();
@@ -23,6 +23,22 @@ assert.deepStrictEqual(val, [
   {"age": 25}
 ]);
 
+// The same rows as columns, with the directory of the names factored
+// out, in a BSER v2 PDU with the columns capability
+var columns = "\x0e\x00\x03\x02\x02\x03\x04\x6e\x61\x6d\x65\x02" +
+              "\x03\x03\x61\x67\x65\x03\x03\x00\x03\x01\x02\x03" +
+              "\x03\x64\x69\x72\x0f\x03\x00\x02\x03\x04\x66\x72" +
+              "\x65\x64\x0f\x03\x00\x0d\x03\x04\x70\x65\x74\x65" +
+              "\x0c\x03\x14\x03\x1e\x03\x19";
+val = bser.loadFromBuffer(Buffer.from(
+    "\x00\x02\x04\x00\x00\x00\x03" +
+    String.fromCharCode(columns.length) + columns, 'binary'));
+assert.deepStrictEqual(val, [
+  {"name": "dir/fred", "age": 20},
+  {"name": "dir/pete", "age": 30},
+  {"age": 25}
+]);
+
 function roundtrip(val) {
   var encoded = bser.dumpToBuffer(val);
   var decoded = bser.loadFromBuffer(encoded);
@@ -91,3 +107,44 @@ assert.equal(buffer.toString('hex'), "000105020000000301");
 buffer = bser.dumpToBuffer(1.1);
 assert.equal(buffer.toString('hex'), "00010509000000079a9999999999f13f");
 
+
+// BunserStream emits the rows of the templates of an object as they
+// arrive, however the input is split up, and then the rest of the object
+var streamed = "\x00\x01\x03\x40" +
+               "\x01\x03\x03\x02\x03\x02\x69\x64\x03\x07" +
+               "\x02\x03\x05\x66\x69\x6c\x65\x73" +
+               "\x0b\x00\x03\x02\x02\x03\x04\x6e\x61\x6d\x65\x02" +
+               "\x03\x03\x61\x67\x65\x03\x03\x02\x03\x04\x66\x72" +
+               "\x65\x64\x03\x14\x02\x03\x04\x70\x65\x74\x65\x03" +
+               "\x1e\x0c\x03\x19" +
+               "\x02\x03\x02\x6f\x6b\x08";
+var input = Buffer.concat([Buffer.from(streamed, 'binary'),
+                           bser.dumpToBuffer({after: 1})]);
+
+[1, 2, 7, input.length].forEach(function(chunkSize) {
+  var stream = new bser.BunserStream();
+  var events = [];
+  stream.on('record', function(row, key, partial) {
+    events.push(['record', key, row, Object.assign({}, partial)]);
+  });
+  stream.on('value', function(val) {
+    events.push(['value', val]);
+  });
+  stream.on('error', function(err) {
+    throw err;
+  });
+  for (var i = 0; i < input.length; i += chunkSize) {
+    stream.append(input.slice(i, i + chunkSize));
+  }
+  setImmediate(function() {
+    assert.deepStrictEqual(events, [
+      ['record', 'files', {name: 'fred', age: 20}, {id: 7}],
+      ['record', 'files', {name: 'pete', age: 30}, {id: 7}],
+      ['record', 'files', {age: 25}, {id: 7}],
+      ['value', {id: 7, ok: true}],
+      ['value', {after: 1}],
+    ], 'chunk size ' + chunkSize);
+    // Only the rows were ever buffered, rather than the whole PDU
+    assert.ok(stream.buf.buf.length <= 8192);
+  });
+});
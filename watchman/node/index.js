@@ -75,10 +75,30 @@ Client.prototype.connect = function() {
   var self = this;
 
   function makeSock(sockname) {
-    // bunser will decode the watchman BSER protocol for us
-    self.bunser = new bser.BunserBuf();
+    // bunser will decode the watchman BSER protocol for us.  It emits
+    // the files of each PDU as they arrive, which are passed straight to
+    // the current queryStream once we know that the PDU is one of its
+    // batches, and are otherwise put back into the PDU when it ends.
+    self.bunser = new bser.BunserStream();
+    var pendingRecords = {};
+    self.bunser.on('record', function(row, key, partial) {
+      var cmd = self.currentCommand;
+      if (cmd && cmd.onRecord && key === 'files' && 'stream' in partial) {
+        cmd.onRecord(row);
+        return;
+      }
+      if (!(key in pendingRecords)) {
+        pendingRecords[key] = [];
+      }
+      pendingRecords[key].push(row);
+    });
     // For each decoded line:
     self.bunser.on('value', function(obj) {
+      for (var key in pendingRecords) {
+        obj[key] = pendingRecords[key];
+      }
+      pendingRecords = {};
+
       // Figure out if this is a unliteral response or if it is the
       // response portion of a request-response sequence.  At the time
       // of writing, there are only two possible unilateral responses.
@@ -94,6 +114,15 @@ Client.prototype.connect = function() {
         self.emit(unilateral, obj);
       } else if (self.currentCommand) {
         var cmd = self.currentCommand;
+        if (cmd.onRecord && !('error' in obj)) {
+          // A server that doesn't stream sends the files in its response
+          (obj.files || []).forEach(cmd.onRecord);
+          delete obj.files;
+          if (obj.stream === 'header' || obj.stream === 'files') {
+            // The trailer is still to come
+            return;
+          }
+        }
         self.currentCommand = null;
         if ('error' in obj) {
           var error = new Error(obj.error);
@@ -226,7 +255,10 @@ Client.prototype.command = function(args, done) {
 
   // Queue up the command
   this.commands.push({cmd: args, cb: done});
+  this.connectAndSend();
+}
 
+Client.prototype.connectAndSend = function() {
   // Establish a connection if we don't already have one
   if (!this.socket) {
     if (!this.connecting) {
@@ -241,6 +273,134 @@ Client.prototype.command = function(args, done) {
   this.sendNextCommand();
 }
 
+/**
+ * Issues a query whose matching files are consumed as they arrive, rather
+ * than all at once in a single response:
+ *
+ *   var stream = client.queryStream(root, {expression: ['type', 'f']});
+ *   for await (var file of stream) { ... }
+ *   var response = await stream.response;
+ *
+ * The query is sent with the `stream` option, so that the server sends
+ * the files in batches of `stream_batch_size`, and each file is decoded
+ * as its bytes arrive.  `response` resolves to the rest of the response,
+ * with its `clock` and `is_fresh_instance`, once all of the files have
+ * been received, and rejects if the query fails, as does iterating.
+ *
+ * Reading from the socket pauses while more than `highWaterMark` files,
+ * 10000 by default, are waiting to be consumed.  Other commands are only
+ * answered once the query has completed.
+ */
+Client.prototype.queryStream = function(root, query, options) {
+  var self = this;
+  var highWaterMark = (options && options.highWaterMark) || 10000;
+  var records = [];
+  var head = 0;
+  var waiting = null;
+  var finished = false;
+  var failure = null;
+  var discard = false;
+  var paused = false;
+
+  var resolveResponse, rejectResponse;
+  var response = new Promise(function(resolve, reject) {
+    resolveResponse = resolve;
+    rejectResponse = reject;
+  });
+  // Iterating reports the error as well, so it is fine not to await this
+  response.catch(function() {});
+
+  function wake() {
+    if (!waiting) {
+      return;
+    }
+    var w = waiting;
+    waiting = null;
+    if (head < records.length) {
+      w.resolve({value: take(), done: false});
+    } else if (failure) {
+      w.reject(failure);
+    } else if (finished) {
+      w.resolve({value: undefined, done: true});
+    } else {
+      waiting = w;
+    }
+  }
+
+  function take() {
+    var record = records[head];
+    records[head++] = undefined;
+    if (head == records.length) {
+      records = [];
+      head = 0;
+    }
+    if (paused && records.length - head < highWaterMark / 2) {
+      paused = false;
+      if (self.socket) {
+        self.socket.resume();
+      }
+    }
+    return record;
+  }
+
+  function onRecord(record) {
+    if (discard) {
+      return;
+    }
+    records.push(record);
+    if (!paused && records.length - head >= highWaterMark && self.socket) {
+      paused = true;
+      self.socket.pause();
+    }
+    wake();
+  }
+
+  query = Object.assign({}, query, {stream: true});
+  this.commands.push({
+    cmd: ['query', root, query],
+    onRecord: onRecord,
+    cb: function(error, resp) {
+      if (error) {
+        failure = error;
+        rejectResponse(error);
+      } else {
+        finished = true;
+        resolveResponse(resp);
+      }
+      wake();
+    },
+  });
+  this.connectAndSend();
+
+  var iterator = {
+    response: response,
+    next: function() {
+      return new Promise(function(resolve, reject) {
+        waiting = {resolve: resolve, reject: reject};
+        wake();
+      });
+    },
+    // Called when the consumer stops iterating early.  The rest of the
+    // files still have to be read from the socket, but are dropped.
+    return: function() {
+      discard = true;
+      records = [];
+      head = 0;
+      if (paused) {
+        paused = false;
+        if (self.socket) {
+          self.socket.resume();
+        }
+      }
+      return Promise.resolve({value: undefined, done: true});
+    },
+  };
+  iterator[Symbol.asyncIterator] = function() {
+    return iterator;
+  };
+  return iterator;
+}
+
 var cap_versions = {
     "cmd-watch-del-all": "3.1.1",
     "cmd-watch-project": "3.1",
@@ -4,8 +4,10 @@
 # LICENSE file in the root directory of this source tree.
 
 
+import array
 import inspect
 import math
+import mmap
 import os
 import socket
 import subprocess
@@ -13,7 +15,7 @@ import sys
 import time
 import typing
 
-from . import capabilities, encoding
+from . import capabilities, encoding, pybser
 
 
 # Sometimes it's really hard to get Python extensions to compile,
@@ -307,11 +309,18 @@ class SocketTransport(Transport):
 class UnixSocketTransport(SocketTransport):
     """local unix domain socket transport"""
 
+    # While set, readBytes collects the descriptors that the service
+    # passes along with its responses in descriptors, which the caller
+    # must close
+    acceptDescriptors = False
+
     def __init__(self, sockpath, timeout):
         super(UnixSocketTransport, self).__init__()
         self.sockpath = sockpath
         self.timeout = timeout
 
+        self.descriptors = []
+
         sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
         try:
             sock.settimeout(self.timeout)
@@ -321,6 +330,24 @@ class UnixSocketTransport(SocketTransport):
             sock.close()
             raise SocketConnectError(self.sockpath.unix_domain, e)
 
+    def readBytes(self, size):
+        if not self.acceptDescriptors:
+            return super(UnixSocketTransport, self).readBytes(size)
+        fds = array.array("i")
+        try:
+            buf, ancdata, _flags, _addr = self.sock.recvmsg(
+                size, socket.CMSG_SPACE(fds.itemsize)
+            )
+        except socket.timeout:
+            raise SocketTimeout("timed out waiting for response")
+        for level, kind, data in ancdata:
+            if level == socket.SOL_SOCKET and kind == socket.SCM_RIGHTS:
+                fds.frombytes(data[: len(data) - (len(data) % fds.itemsize)])
+        self.descriptors.extend(fds)
+        if not buf:
+            raise WatchmanError("empty watchman response")
+        return buf
+
 
 class WindowsUnixSocketTransport(SocketTransport):
     """local unix domain socket transport on Windows"""
@@ -722,6 +749,21 @@ class ImmutableBserCodec(BserCodec):
         )
 
 
+class LazyBserCodec(BserCodec):
+    """use the BSER encoding, decoding values using immutable objects, and
+    the files of query results as rows that are only decoded when their
+    fields are accessed"""
+
+    def _loads(self, response):
+        return bser.loads(
+            response,
+            False,
+            value_encoding=self._value_encoding,
+            value_errors=self._value_errors,
+            lazy=True,
+        )
+
+
 class Bser2WithFallbackCodec(BserCodec):
     """use BSER v2 encoding"""
 
@@ -731,7 +773,9 @@ class Bser2WithFallbackCodec(BserCodec):
         )
         bserv2_key = "required"
 
-        self.send(["version", {bserv2_key: ["bser-v2"]}])
+        self.send(
+            ["version", {bserv2_key: ["bser-v2"], "optional": ["bser-columns"]}]
+        )
 
         capabilities = self.receive()
 
@@ -744,6 +788,9 @@ class Bser2WithFallbackCodec(BserCodec):
         if capabilities["capabilities"]["bser-v2"]:
             self.bser_version = 2
             self.bser_capabilities = 0
+            # The files of query results are much smaller as columns
+            if capabilities["capabilities"]["bser-columns"]:
+                self.bser_capabilities |= pybser.BSER_CAP_COLUMNS
         else:
             self.bser_version = 1
             self.bser_capabilities = 0
@@ -789,6 +836,13 @@ class ImmutableBser2Codec(Bser2WithFallbackCodec, ImmutableBserCodec):
     pass
 
 
+class LazyBser2Codec(Bser2WithFallbackCodec, LazyBserCodec):
+    """use the BSER encoding, decoding the files of query results
+    lazily"""
+
+    pass
+
+
 class JsonCodec(Codec):
     """Use json codec.  This is here primarily for testing purposes"""
 
@@ -824,6 +878,38 @@ class JsonCodec(Codec):
         self.transport.write(cmd + b"\n")
 
 
+class QueryStream(object):
+    """Iterates over the files matched by a query that was issued via
+    client.queryStream, as the batches of files that hold them arrive.
+
+    Once the iteration is complete, `trailer` holds the final response
+    of the query, which has the `clock` and `is_fresh_instance` fields.
+    """
+
+    def __init__(self, client, args):
+        self.client = client
+        self.args = args
+        self.trailer = None
+
+    def __iter__(self):
+        while self.trailer is None:
+            res = self.client._receiveResponse(self.args)
+            kind = self.client._getprop(res, "stream")
+            if kind == "header":
+                continue
+            if kind == "files":
+                for f in self.client._getprop(res, "files"):
+                    yield f
+                continue
+            # Either the trailer, or the complete response of a server
+            # that doesn't stream results
+            self.trailer = res
+            files = self.client._getprop(res, "files")
+            if files:
+                for f in files:
+                    yield f
+
+
 class client(object):
     """Handles the communication with the watchman service"""
 
@@ -839,7 +925,9 @@ class client(object):
     unilateral = ["log", "subscription"]
     tport = None
     useImmutableBser = None
+    useLazyBser = None
     pid = None
+    serverCapabilities = None  # Cached by _serverHasCapability
 
     def __init__(
         self,
@@ -850,6 +938,7 @@ class client(object):
         sendEncoding=None,
         recvEncoding=None,
         useImmutableBser=False,
+        useLazyBser=False,
         # use False for these two because None has a special
         # meaning
         valueEncoding=False,
@@ -860,7 +949,9 @@ class client(object):
             sockpath = SockPath(sockpath=sockpath, tcp_address=tcpAddress)
         self.sockpath = sockpath
         self.timeout = timeout
-        self.useImmutableBser = useImmutableBser
+        # Lazy results are immutable too
+        self.useImmutableBser = useImmutableBser or useLazyBser
+        self.useLazyBser = useLazyBser
         self.binpath = _default_binpath(binpath)
 
         if inspect.isclass(transport) and issubclass(transport, Transport):
@@ -922,6 +1013,8 @@ class client(object):
 
     def _parseEncoding(self, enc):
         if enc == "bser":
+            if self.useLazyBser:
+                return self._makeBSERCodec(LazyBser2Codec)
             if self.useImmutableBser:
                 return self._makeBSERCodec(ImmutableBser2Codec)
             return self._makeBSERCodec(Bser2WithFallbackCodec)
@@ -941,6 +1034,11 @@ class client(object):
             return hasattr(result, name)
         return name in result
 
+    def _getprop(self, result, name):
+        if self.useImmutableBser:
+            return getattr(result, name, None)
+        return result.get(name)
+
     def _resolvesockname(self):
         # if invoked via a trigger, watchman will set this env var; we
         # should use it unless explicitly set otherwise
@@ -1032,6 +1130,7 @@ class client(object):
             self.tport = None
             self.recvConn = None
             self.sendConn = None
+            self.serverCapabilities = None
 
     def receive(self):
         """receive the next PDU from the watchman service
@@ -1138,9 +1237,156 @@ class client(object):
 
         log("calling client.query")
         self._connect()
+        self._sendCommand(args)
+        return self._receiveResponse(args)
+
+    # How many commands queryPipelined sends ahead of the response it is
+    # waiting for.  The server stops reading while it writes a response,
+    # so this bounds how much we write while it isn't being read.
+    pipelineWindow = 32
+
+    def queryPipelined(self, commands):
+        """Send several commands to the watchman service and return the
+        list of their responses, in the same order
+
+        If the service supports the `pipelining` capability then each
+        command is sent without waiting for the responses to those before
+        it, so that a batch of small commands costs one round trip rather
+        than one each.  Otherwise they are sent one at a time, as query()
+        would.
+
+        Unilateral responses are buffered as they are for query().  If any
+        command fails, the responses to the rest are still read, and then
+        the CommandError of the first failure is raised.
+        """
+
+        log("calling client.queryPipelined")
+        commands = [tuple(args) for args in commands]
+        if not self._pipelining():
+            return [self.query(*args) for args in commands]
+
+        results = []
+        error = None
+        sent = 0
+        for args in commands:
+            # Keep up to pipelineWindow commands in flight
+            window = len(results) + self.pipelineWindow
+            while sent < min(len(commands), window):
+                self._sendCommand(commands[sent])
+                sent += 1
+            try:
+                results.append(self._receiveResponse(args))
+            except CommandError as ex:
+                results.append(None)
+                error = error or ex
+        if error:
+            raise error
+        return results
+
+    def _pipelining(self):
+        """Whether the service accepts a command before it has responded
+        to the last one"""
+        # The CLI transport runs a single command per connection
+        return self.transport is not CLIProcessTransport and (
+            self._serverHasCapability("pipelining")
+        )
+
+    def _serverHasCapability(self, name):
+        """Whether the service has the named capability, which is only
+        checked once per connection"""
+        self._connect()
+        if self.serverCapabilities is None:
+            self.serverCapabilities = {}
+        if name not in self.serverCapabilities:
+            res = self.capabilityCheck(optional=[name])
+            caps = self._getprop(res, "capabilities")
+            self.serverCapabilities[name] = bool(self._getprop(caps, name))
+        return self.serverCapabilities[name]
+
+    def querySharedMemory(self, root, query):
+        """Send a query to the watchman service and return its response,
+        which the service passes back in shared memory
+
+        Rather than writing a large response to the socket, the service
+        writes it to an anonymous file and passes its descriptor over the
+        unix domain socket, and the response is decoded straight from a
+        mapping of that file.  This falls back to a regular query if the
+        service, transport or codec can't do this.
+        """
+
+        log("calling client.querySharedMemory")
+        self._connect()
+        if not (
+            isinstance(self.tport, UnixSocketTransport)
+            and hasattr(socket, "SCM_RIGHTS")
+            and isinstance(self.recvConn, BserCodec)
+            and self._serverHasCapability("shared_memory")
+        ):
+            return self.query("query", root, query)
+
+        query = dict(query)
+        query["shared_memory"] = True
+        self.tport.acceptDescriptors = True
+        try:
+            res = self.query("query", root, query)
+        finally:
+            self.tport.acceptDescriptors = False
+            fds = self.tport.descriptors
+            self.tport.descriptors = []
+
+        try:
+            info = self._getprop(res, "shared_memory")
+            if info is None or not fds:
+                raise WatchmanError("no shared memory result was received")
+            size = self._getprop(info, "size")
+            # The descriptor came with the response, after any others
+            with mmap.mmap(fds[-1], size, prot=mmap.PROT_READ) as result:
+                return self.recvConn._loads(result)
+        finally:
+            for fd in fds:
+                os.close(fd)
+
+    def queryStream(self, root, query):
+        """Send a query to the watchman service and iterate over its results
+
+        Rather than waiting for the whole response, the service is asked
+        to send the matching files in batches as soon as the query has been
+        evaluated, and the returned QueryStream yields each file as its
+        batch is received.  This avoids holding the encoded response for
+        a large result set in memory on both ends of the connection.
+
+        The QueryStream must be consumed before issuing another command
+        on this client.
+        """
+
+        log("calling client.queryStream")
+        self._connect()
+        query = dict(query)
+        # The CLI only passes the first PDU of a response through
+        if self.transport is not CLIProcessTransport:
+            query["stream"] = True
+        args = ("query", root, query)
+        self._sendCommand(args)
+        return QueryStream(self, args)
+
+    def _sendCommand(self, args):
         try:
             self.sendConn.send(args)
+        except EnvironmentError as ee:
+            raise WatchmanEnvironmentError(
+                "I/O error communicating with watchman daemon",
+                ee.errno,
+                ee.strerror,
+                args,
+            )
+        except WatchmanError as ex:
+            ex.setCommand(args)
+            raise
 
+    def _receiveResponse(self, args):
+        """receive the next PDU that isn't unilateral as the response to
+        the command args"""
+        try:
             res = self.receive()
             while self.isUnilateralResponse(res):
                 res = self.receive()
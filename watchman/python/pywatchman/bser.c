@@ -40,24 +40,17 @@ static void bserobj_dealloc(PyObject* o) {
   PyObject_Del(o);
 }
 
-static PyObject* bserobj_getattrro(PyObject* o, PyObject* name) {
-  bserObject* obj = (bserObject*)o;
+// Finds the index of name in keys, a tuple of bytes or unicode field
+// names.  Returns 1 and sets *index if it is present, and otherwise
+// returns 0 with an exception set.
+static int bser_key_index(PyObject* keys, PyObject* name, Py_ssize_t* index) {
   Py_ssize_t i, n;
   PyObject* name_bytes = NULL;
   PyObject* key_bytes = NULL;
-  PyObject* ret = NULL;
+  int ret = 0;
   const char* namestr;
   const char* keystr;
 
-  if (PyIndex_Check(name)) {
-    i = PyNumber_AsSsize_t(name, PyExc_IndexError);
-    if (i == -1 && PyErr_Occurred()) {
-      goto bail;
-    }
-    ret = PySequence_GetItem(obj->values, i);
-    goto bail;
-  }
-
   // We can be passed in Unicode objects here -- we don't support anything other
   // than UTF-8 for keys.
   if (PyUnicode_Check(name)) {
@@ -78,9 +71,9 @@ static PyObject* bserobj_getattrro(PyObject* o, PyObject* name) {
     namestr += 3;
   }
 
-  n = PyTuple_GET_SIZE(obj->keys);
+  n = PyTuple_GET_SIZE(keys);
   for (i = 0; i < n; i++) {
-    PyObject* key = PyTuple_GET_ITEM(obj->keys, i);
+    PyObject* key = PyTuple_GET_ITEM(keys, i);
 
     if (PyUnicode_Check(key)) {
       key_bytes = PyUnicode_AsUTF8String(key);
@@ -97,7 +90,8 @@ static PyObject* bserobj_getattrro(PyObject* o, PyObject* name) {
     }
 
     if (!strcmp(keystr, namestr)) {
-      ret = PySequence_GetItem(obj->values, i);
+      *index = i;
+      ret = 1;
       goto bail;
     }
     Py_XDECREF(key_bytes);
@@ -112,6 +106,24 @@ bail:
   return ret;
 }
 
+static PyObject* bserobj_getattrro(PyObject* o, PyObject* name) {
+  bserObject* obj = (bserObject*)o;
+  Py_ssize_t i;
+
+  if (PyIndex_Check(name)) {
+    i = PyNumber_AsSsize_t(name, PyExc_IndexError);
+    if (i == -1 && PyErr_Occurred()) {
+      return NULL;
+    }
+    return PySequence_GetItem(obj->values, i);
+  }
+
+  if (!bser_key_index(obj->keys, name, &i)) {
+    return NULL;
+  }
+  return PySequence_GetItem(obj->values, i);
+}
+
 // clang-format off
 static PyMappingMethods bserobj_map = {
   bserobj_tuple_length,     /* mp_length */
@@ -242,6 +254,413 @@ static int bunser_bytestring(
   return 1;
 }
 
+// Advances *ptr past the value it points to, validating it as
+// bser_loads_recursive would but without building any objects.
+static int bunser_skip(const char** ptr, const char* end) {
+  const char* buf = *ptr;
+  const char* start;
+  int64_t nitems, numkeys, i, j, len;
+
+  if (buf >= end) {
+    PyErr_SetString(PyExc_ValueError, "input buffer too small");
+    return 0;
+  }
+
+  switch (buf[0]) {
+    case BSER_INT8:
+    case BSER_INT16:
+    case BSER_INT32:
+    case BSER_INT64:
+      return bunser_int(ptr, end, &len);
+
+    case BSER_REAL:
+      if (buf + 1 + sizeof(double) > end) {
+        PyErr_SetString(
+            PyExc_ValueError, "input buffer too small for real encoding");
+        return 0;
+      }
+      *ptr = buf + 1 + sizeof(double);
+      return 1;
+
+    case BSER_TRUE:
+    case BSER_FALSE:
+    case BSER_NULL:
+      *ptr = buf + 1;
+      return 1;
+
+    case BSER_BYTESTRING:
+    case BSER_UTF8STRING:
+      return bunser_bytestring(ptr, end, &start, &len);
+
+    case BSER_ARRAY:
+      buf++;
+      if (!bunser_int(&buf, end, &nitems)) {
+        return 0;
+      }
+      if (nitems > end - buf) {
+        PyErr_Format(PyExc_ValueError, "document too short for array's size");
+        return 0;
+      }
+      *ptr = buf;
+      for (i = 0; i < nitems; i++) {
+        if (!bunser_skip(ptr, end)) {
+          return 0;
+        }
+      }
+      return 1;
+
+    case BSER_OBJECT:
+      buf++;
+      if (!bunser_int(&buf, end, &nitems)) {
+        return 0;
+      }
+      *ptr = buf;
+      for (i = 0; i < nitems; i++) {
+        if (!bunser_bytestring(ptr, end, &start, &len) ||
+            !bunser_skip(ptr, end)) {
+          return 0;
+        }
+      }
+      return 1;
+
+    case BSER_TEMPLATE:
+      if (buf + 1 >= end || buf[1] != BSER_ARRAY) {
+        PyErr_Format(PyExc_ValueError, "Expect ARRAY to follow TEMPLATE");
+        return 0;
+      }
+      // Count the keys, then skip over them
+      buf += 2;
+      if (!bunser_int(&buf, end, &numkeys)) {
+        return 0;
+      }
+      *ptr = buf;
+      for (i = 0; i < numkeys; i++) {
+        if (!bunser_skip(ptr, end)) {
+          return 0;
+        }
+      }
+      if (!bunser_int(ptr, end, &nitems)) {
+        return 0;
+      }
+      for (i = 0; i < nitems; i++) {
+        for (j = 0; j < numkeys; j++) {
+          if (*ptr >= end) {
+            PyErr_SetString(PyExc_ValueError, "input buffer too small");
+            return 0;
+          }
+          if (**ptr == BSER_SKIP) {
+            *ptr = *ptr + 1;
+          } else if (!bunser_skip(ptr, end)) {
+            return 0;
+          }
+        }
+      }
+      return 1;
+
+    case BSER_COLUMNS:
+      if (buf + 1 >= end || buf[1] != BSER_ARRAY) {
+        PyErr_Format(PyExc_ValueError, "Expect ARRAY to follow COLUMNS");
+        return 0;
+      }
+      buf += 2;
+      if (!bunser_int(&buf, end, &numkeys)) {
+        return 0;
+      }
+      *ptr = buf;
+      for (i = 0; i < numkeys; i++) {
+        if (!bunser_skip(ptr, end)) {
+          return 0;
+        }
+      }
+      // The number of objects, then the directories
+      if (!bunser_int(ptr, end, &nitems) || !bunser_skip(ptr, end)) {
+        return 0;
+      }
+      for (i = 0; i < nitems; i++) {
+        for (j = 0; j < numkeys; j++) {
+          if (*ptr >= end) {
+            PyErr_SetString(PyExc_ValueError, "input buffer too small");
+            return 0;
+          }
+          if (**ptr == BSER_SKIP) {
+            *ptr = *ptr + 1;
+          } else if (**ptr == BSER_PATH) {
+            *ptr = *ptr + 1;
+            if (!bunser_int(ptr, end, &len) || !bunser_skip(ptr, end)) {
+              return 0;
+            }
+          } else if (!bunser_skip(ptr, end)) {
+            return 0;
+          }
+        }
+      }
+      return 1;
+
+    default:
+      PyErr_Format(PyExc_ValueError, "unhandled bser opcode 0x%02x", buf[0]);
+      return 0;
+  }
+}
+
+static Py_ssize_t bserlazyarray_length(PyObject* o) {
+  return ((bserLazyArray*)o)->nitems;
+}
+
+static PyObject* bserlazyarray_item(PyObject* o, Py_ssize_t i) {
+  bserLazyArray* arr = (bserLazyArray*)o;
+  bserLazyRow* row;
+
+  if (i < 0 || i >= arr->nitems) {
+    PyErr_SetString(PyExc_IndexError, "bser lazy array index out of range");
+    return NULL;
+  }
+
+  row = PyObject_New(bserLazyRow, &bserLazyRowType);
+  if (!row) {
+    return NULL;
+  }
+  Py_INCREF(o);
+  row->array = arr;
+  row->row = i;
+  return (PyObject*)row;
+}
+
+// clang-format off
+static PySequenceMethods bserlazyarray_sq = {
+  bserlazyarray_length,      /* sq_length */
+  0,                         /* sq_concat */
+  0,                         /* sq_repeat */
+  bserlazyarray_item,        /* sq_item */
+  0,                         /* sq_ass_item */
+  0,                         /* sq_contains */
+  0,                         /* sq_inplace_concat */
+  0                          /* sq_inplace_repeat */
+};
+// clang-format on
+
+static void bserlazyarray_dealloc(PyObject* o) {
+  bserLazyArray* arr = (bserLazyArray*)o;
+
+  Py_CLEAR(arr->buf);
+  Py_CLEAR(arr->keys);
+  Py_CLEAR(arr->value_encoding);
+  Py_CLEAR(arr->value_errors);
+  PyMem_Free(arr->rows);
+  arr->rows = NULL;
+  PyObject_Del(o);
+}
+
+// clang-format off
+PyTypeObject bserLazyArrayType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "bser_lazy_array",         /* tp_name */
+  sizeof(bserLazyArray),     /* tp_basicsize */
+  0,                         /* tp_itemsize */
+  bserlazyarray_dealloc,     /* tp_dealloc */
+  0,                         /* tp_print */
+  0,                         /* tp_getattr */
+  0,                         /* tp_setattr */
+  0,                         /* tp_compare */
+  0,                         /* tp_repr */
+  0,                         /* tp_as_number */
+  &bserlazyarray_sq,         /* tp_as_sequence */
+  0,                         /* tp_as_mapping */
+  0,                         /* tp_hash  */
+  0,                         /* tp_call */
+  0,                         /* tp_str */
+  0,                         /* tp_getattro */
+  0,                         /* tp_setattro */
+  0,                         /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,        /* tp_flags */
+  "lazily decoded bser template array", /* tp_doc */
+};
+// clang-format on
+
+// Decodes the value of field keyidx of a row, skipping over the fields
+// before it.  The row was validated when the array was created.
+static PyObject* bserlazyrow_field(bserLazyRow* row, Py_ssize_t keyidx) {
+  bserLazyArray* arr = row->array;
+  const char* ptr = PyBytes_AS_STRING(arr->buf) + arr->rows[row->row];
+  const char* end = PyBytes_AS_STRING(arr->buf) + PyBytes_GET_SIZE(arr->buf);
+  unser_ctx_t ctx = {0};
+  Py_ssize_t i;
+
+  if (keyidx < 0 || keyidx >= PyTuple_GET_SIZE(arr->keys)) {
+    PyErr_SetString(PyExc_IndexError, "bserobject index out of range");
+    return NULL;
+  }
+
+  for (i = 0; i < keyidx; i++) {
+    if (*ptr == BSER_SKIP) {
+      ptr++;
+    } else if (!bunser_skip(&ptr, end)) {
+      return NULL;
+    }
+  }
+
+  if (*ptr == BSER_SKIP) {
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+
+  if (arr->value_encoding) {
+    ctx.value_encoding = PyBytes_AS_STRING(arr->value_encoding);
+    ctx.value_errors = PyBytes_AS_STRING(arr->value_errors);
+  }
+  ctx.bser_version = arr->bser_version;
+  ctx.bser_capabilities = arr->bser_capabilities;
+  ctx.is_lazy = 1;
+  ctx.lazy_buf = arr->buf;
+  return bser_loads_recursive(&ptr, end, &ctx);
+}
+
+static Py_ssize_t bserlazyrow_length(PyObject* o) {
+  return PyTuple_GET_SIZE(((bserLazyRow*)o)->array->keys);
+}
+
+static PyObject* bserlazyrow_item(PyObject* o, Py_ssize_t i) {
+  return bserlazyrow_field((bserLazyRow*)o, i);
+}
+
+static PyObject* bserlazyrow_getattrro(PyObject* o, PyObject* name) {
+  bserLazyRow* row = (bserLazyRow*)o;
+  Py_ssize_t i;
+
+  if (PyIndex_Check(name)) {
+    i = PyNumber_AsSsize_t(name, PyExc_IndexError);
+    if (i == -1 && PyErr_Occurred()) {
+      return NULL;
+    }
+    return bserlazyrow_field(row, i);
+  }
+
+  if (!bser_key_index(row->array->keys, name, &i)) {
+    return NULL;
+  }
+  return bserlazyrow_field(row, i);
+}
+
+// clang-format off
+static PySequenceMethods bserlazyrow_sq = {
+  bserlazyrow_length,        /* sq_length */
+  0,                         /* sq_concat */
+  0,                         /* sq_repeat */
+  bserlazyrow_item,          /* sq_item */
+  0,                         /* sq_ass_item */
+  0,                         /* sq_contains */
+  0,                         /* sq_inplace_concat */
+  0                          /* sq_inplace_repeat */
+};
+
+static PyMappingMethods bserlazyrow_map = {
+  bserlazyrow_length,        /* mp_length */
+  bserlazyrow_getattrro,     /* mp_subscript */
+  0                          /* mp_ass_subscript */
+};
+// clang-format on
+
+static void bserlazyrow_dealloc(PyObject* o) {
+  bserLazyRow* row = (bserLazyRow*)o;
+
+  Py_CLEAR(row->array);
+  PyObject_Del(o);
+}
+
+// clang-format off
+PyTypeObject bserLazyRowType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "bser_lazy_row",           /* tp_name */
+  sizeof(bserLazyRow),       /* tp_basicsize */
+  0,                         /* tp_itemsize */
+  bserlazyrow_dealloc,       /* tp_dealloc */
+  0,                         /* tp_print */
+  0,                         /* tp_getattr */
+  0,                         /* tp_setattr */
+  0,                         /* tp_compare */
+  0,                         /* tp_repr */
+  0,                         /* tp_as_number */
+  &bserlazyrow_sq,           /* tp_as_sequence */
+  &bserlazyrow_map,          /* tp_as_mapping */
+  0,                         /* tp_hash  */
+  0,                         /* tp_call */
+  0,                         /* tp_str */
+  bserlazyrow_getattrro,     /* tp_getattro */
+  0,                         /* tp_setattro */
+  0,                         /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,        /* tp_flags */
+  "lazily decoded bserobj tuple", /* tp_doc */
+};
+// clang-format on
+
+// Builds a bserLazyArray of the nitems rows of a template with the given
+// keys, whose first row *ptr points to.  Each row is validated and its
+// offset recorded, and *ptr is left after the last row.
+static PyObject* bunser_lazy_template(
+    const char** ptr,
+    const char* end,
+    const unser_ctx_t* ctx,
+    PyObject* keys,
+    int64_t nitems) {
+  const char* base = PyBytes_AS_STRING(ctx->lazy_buf);
+  Py_ssize_t numkeys = PyTuple_GET_SIZE(keys);
+  bserLazyArray* arr;
+  int64_t i;
+  Py_ssize_t keyidx;
+
+  if (numkeys > 0 && nitems > end - *ptr) {
+    // Each row consumes at least one byte per key
+    PyErr_Format(PyExc_ValueError, "document too short for template's size");
+    return NULL;
+  }
+
+  arr = PyObject_New(bserLazyArray, &bserLazyArrayType);
+  if (!arr) {
+    return NULL;
+  }
+  Py_INCREF(ctx->lazy_buf);
+  arr->buf = ctx->lazy_buf;
+  Py_INCREF(keys);
+  arr->keys = keys;
+  arr->value_encoding = NULL;
+  arr->value_errors = NULL;
+  arr->bser_version = ctx->bser_version;
+  arr->bser_capabilities = ctx->bser_capabilities;
+  arr->nitems = (Py_ssize_t)nitems;
+  arr->rows = PyMem_New(Py_ssize_t, nitems > 0 ? (size_t)nitems : 1);
+  if (!arr->rows) {
+    Py_DECREF(arr);
+    return PyErr_NoMemory();
+  }
+
+  if (ctx->value_encoding) {
+    arr->value_encoding = PyBytes_FromString(ctx->value_encoding);
+    arr->value_errors = PyBytes_FromString(ctx->value_errors);
+    if (!arr->value_encoding || !arr->value_errors) {
+      Py_DECREF(arr);
+      return NULL;
+    }
+  }
+
+  for (i = 0; i < nitems; i++) {
+    arr->rows[i] = (Py_ssize_t)(*ptr - base);
+    for (keyidx = 0; keyidx < numkeys; keyidx++) {
+      if (*ptr >= end) {
+        PyErr_SetString(PyExc_ValueError, "input buffer too small");
+        Py_DECREF(arr);
+        return NULL;
+      }
+      if (**ptr == BSER_SKIP) {
+        *ptr = *ptr + 1;
+      } else if (!bunser_skip(ptr, end)) {
+        Py_DECREF(arr);
+        return NULL;
+      }
+    }
+  }
+
+  return (PyObject*)arr;
+}
+
 static PyObject*
 bunser_array(const char** ptr, const char* end, const unser_ctx_t* ctx) {
   const char* buf = *ptr;
@@ -438,6 +857,12 @@ bunser_template(const char** ptr, const char* end, const unser_ctx_t* ctx) {
     return NULL;
   }
 
+  if (ctx->is_lazy) {
+    arrval = bunser_lazy_template(ptr, end, ctx, keys, nitems);
+    Py_DECREF(keys);
+    return arrval;
+  }
+
   arrval = PyList_New((Py_ssize_t)nitems);
   if (!arrval) {
     Py_DECREF(keys);
@@ -506,6 +931,216 @@ bunser_template(const char** ptr, const char* end, const unser_ctx_t* ctx) {
   return arrval;
 }
 
+// Decodes a BSER_PATH value of a BSER_COLUMNS: a directory index and a
+// string, which are joined into the string "dir/base" of the type of base.
+static PyObject* bunser_path(
+    const char** ptr,
+    const char* end,
+    const unser_ctx_t* ctx,
+    const char** dirs,
+    const int64_t* dirlens,
+    int64_t numdirs) {
+  const char* base;
+  int64_t dir, baselen;
+  char basetype;
+  PyObject* joined;
+  PyObject* res;
+
+  *ptr = *ptr + 1;
+  if (!bunser_int(ptr, end, &dir)) {
+    return NULL;
+  }
+  if (dir < 0 || dir >= numdirs) {
+    PyErr_Format(PyExc_ValueError, "directory index out of range");
+    return NULL;
+  }
+  if (*ptr >= end ||
+      (**ptr != BSER_BYTESTRING && **ptr != BSER_UTF8STRING)) {
+    PyErr_Format(PyExc_ValueError, "Expect STRING to follow PATH");
+    return NULL;
+  }
+  basetype = **ptr;
+  if (!bunser_bytestring(ptr, end, &base, &baselen)) {
+    return NULL;
+  }
+
+  joined = PyBytes_FromStringAndSize(NULL, dirlens[dir] + 1 + baselen);
+  if (!joined) {
+    return NULL;
+  }
+  memcpy(PyBytes_AS_STRING(joined), dirs[dir], dirlens[dir]);
+  PyBytes_AS_STRING(joined)[dirlens[dir]] = '/';
+  memcpy(PyBytes_AS_STRING(joined) + dirlens[dir] + 1, base, baselen);
+
+  if (basetype == BSER_UTF8STRING) {
+    res = PyUnicode_Decode(
+        PyBytes_AS_STRING(joined), PyBytes_GET_SIZE(joined), "utf-8", "strict");
+  } else if (ctx->value_encoding != NULL) {
+    res = PyUnicode_Decode(
+        PyBytes_AS_STRING(joined),
+        PyBytes_GET_SIZE(joined),
+        ctx->value_encoding,
+        ctx->value_errors);
+  } else {
+    return joined;
+  }
+  Py_DECREF(joined);
+  return res;
+}
+
+// A BSER_COLUMNS decodes to the same list of objects as the BSER_TEMPLATE
+// holding the same values.  The values are laid out column by column, so
+// all of the objects are created up front.  See bser_columns in the
+// watchman source for the layout.
+static PyObject*
+bunser_columns(const char** ptr, const char* end, const unser_ctx_t* ctx) {
+  const char* buf = *ptr;
+  int64_t nitems, numdirs, i;
+  int mutable = ctx->is_mutable;
+  PyObject* arrval = NULL;
+  PyObject* keys;
+  Py_ssize_t numkeys, keyidx;
+  const char** dirs = NULL;
+  int64_t* dirlens = NULL;
+  unser_ctx_t keys_ctx = {0};
+  if (mutable) {
+    keys_ctx.is_mutable = 1;
+    keys_ctx.value_encoding = "utf-8";
+    keys_ctx.value_errors = "strict";
+  }
+
+  if (buf + 1 >= end) {
+    PyErr_SetString(
+        PyExc_ValueError, "input buffer to small for columns encoding");
+    return NULL;
+  }
+  if (buf[1] != BSER_ARRAY) {
+    PyErr_Format(PyExc_ValueError, "Expect ARRAY to follow COLUMNS");
+    return NULL;
+  }
+  *ptr = buf + 1;
+
+  keys = bunser_array(ptr, end, &keys_ctx);
+  if (!keys) {
+    return NULL;
+  }
+  numkeys = PySequence_Length(keys);
+  if (numkeys == 0) {
+    PyErr_Format(PyExc_ValueError, "columns require a non-empty key set");
+    goto fail;
+  }
+
+  if (!bunser_int(ptr, end, &nitems)) {
+    goto fail;
+  }
+  // Every value takes at least a byte of the input
+  if (nitems < 0 || nitems > (end - *ptr) / numkeys) {
+    PyErr_Format(PyExc_ValueError, "document too short for columns' size");
+    goto fail;
+  }
+
+  if (*ptr >= end || **ptr != BSER_ARRAY) {
+    PyErr_Format(PyExc_ValueError, "Expect ARRAY of directories");
+    goto fail;
+  }
+  *ptr = *ptr + 1;
+  if (!bunser_int(ptr, end, &numdirs)) {
+    goto fail;
+  }
+  if (numdirs < 0 || numdirs > end - *ptr) {
+    PyErr_Format(PyExc_ValueError, "document too short for directories");
+    goto fail;
+  }
+  dirs = PyMem_New(const char*, numdirs + 1);
+  dirlens = PyMem_New(int64_t, numdirs + 1);
+  if (!dirs || !dirlens) {
+    PyErr_NoMemory();
+    goto fail;
+  }
+  for (i = 0; i < numdirs; i++) {
+    if (*ptr >= end ||
+        (**ptr != BSER_BYTESTRING && **ptr != BSER_UTF8STRING)) {
+      PyErr_Format(PyExc_ValueError, "directories must be strings");
+      goto fail;
+    }
+    if (!bunser_bytestring(ptr, end, &dirs[i], &dirlens[i])) {
+      goto fail;
+    }
+  }
+
+  arrval = PyList_New((Py_ssize_t)nitems);
+  if (!arrval) {
+    goto fail;
+  }
+  for (i = 0; i < nitems; i++) {
+    PyObject* row;
+    if (mutable) {
+      row = PyDict_New();
+    } else {
+      bserObject* obj = PyObject_New(bserObject, &bserObjectType);
+      row = (PyObject*)obj;
+      if (obj) {
+        obj->keys = keys;
+        Py_INCREF(obj->keys);
+        obj->values = PyTuple_New(numkeys);
+        if (!obj->values) {
+          Py_DECREF(row);
+          row = NULL;
+        }
+      }
+    }
+    if (!row) {
+      goto fail;
+    }
+    PyList_SET_ITEM(arrval, i, row);
+  }
+
+  for (keyidx = 0; keyidx < numkeys; keyidx++) {
+    for (i = 0; i < nitems; i++) {
+      PyObject* row = PyList_GET_ITEM(arrval, i);
+      PyObject* ele;
+
+      if (*ptr >= end) {
+        PyErr_SetString(PyExc_ValueError, "input buffer too small");
+        goto fail;
+      }
+
+      if (**ptr == BSER_SKIP) {
+        *ptr = *ptr + 1;
+        ele = Py_None;
+        Py_INCREF(ele);
+      } else if (**ptr == BSER_PATH) {
+        ele = bunser_path(ptr, end, ctx, dirs, dirlens, numdirs);
+      } else {
+        ele = bser_loads_recursive(ptr, end, ctx);
+      }
+
+      if (!ele) {
+        goto fail;
+      }
+
+      if (mutable) {
+        PyDict_SetItem(row, PyList_GET_ITEM(keys, keyidx), ele);
+        Py_DECREF(ele);
+      } else {
+        PyTuple_SET_ITEM(((bserObject*)row)->values, keyidx, ele);
+      }
+    }
+  }
+
+  PyMem_Free(dirs);
+  PyMem_Free(dirlens);
+  Py_DECREF(keys);
+  return arrval;
+
+fail:
+  PyMem_Free(dirs);
+  PyMem_Free(dirlens);
+  Py_XDECREF(arrval);
+  Py_DECREF(keys);
+  return NULL;
+}
+
 PyObject* bser_loads_recursive(
     const char** ptr,
     const char* end,
@@ -610,6 +1245,9 @@ PyObject* bser_loads_recursive(
     case BSER_TEMPLATE:
       return bunser_template(ptr, end, ctx);
 
+    case BSER_COLUMNS:
+      return bunser_columns(ptr, end, ctx);
+
     default:
       PyErr_Format(PyExc_ValueError, "unhandled bser opcode 0x%02x", buf[0]);
   }
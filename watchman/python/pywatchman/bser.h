@@ -28,6 +28,11 @@ extern "C" {
 #define BSER_TEMPLATE 0x0b
 #define BSER_SKIP 0x0c
 #define BSER_UTF8STRING 0x0d
+#define BSER_COLUMNS 0x0e
+#define BSER_PATH 0x0f
+
+// BSERv2 capabilities
+#define BSER_CAP_COLUMNS 0x4
 
 // An immutable object representation of BSER_OBJECT.
 // Rather than build a hash table, key -> value are obtained
@@ -49,12 +54,46 @@ typedef struct {
 
 extern PyTypeObject bserObjectType;
 
+// A lazily decoded BSER_TEMPLATE, produced by loads(lazy=True).
+// Rather than decoding every value up front, the input is validated
+// and the offset of each row recorded; the values of a row are only
+// decoded when they are accessed through a bserLazyRow.  This is much
+// cheaper for the common case of a large query result of which only
+// one or two fields of most files are ever read.
+typedef struct {
+  PyObject_HEAD
+  PyObject *buf;            // bytes holding the whole PDU
+  PyObject *keys;           // tuple of field names
+  PyObject *value_encoding; // bytes, or NULL to leave values as bytes
+  PyObject *value_errors;   // bytes, or NULL
+  uint32_t bser_version;
+  uint32_t bser_capabilities;
+  Py_ssize_t nitems;
+  Py_ssize_t *rows;         // offset of each row into buf
+} bserLazyArray;
+
+// A row of a bserLazyArray, which decodes its values on every access,
+// and otherwise behaves like a bserObject.
+typedef struct {
+  PyObject_HEAD
+  bserLazyArray *array;
+  Py_ssize_t row;
+} bserLazyRow;
+// clang-format on
+
+extern PyTypeObject bserLazyArrayType;
+extern PyTypeObject bserLazyRowType;
+
 typedef struct loads_ctx {
   int is_mutable;
   const char* value_encoding;
   const char* value_errors;
   uint32_t bser_version;
   uint32_t bser_capabilities;
+  // When set, templates are decoded into a bserLazyArray referencing
+  // lazy_buf, which must be a bytes object holding the input.
+  int is_lazy;
+  PyObject* lazy_buf;
 } unser_ctx_t;
 
 int bunser_int(const char** ptr, const char* end, int64_t* val);
@@ -479,37 +479,53 @@ static PyObject* bser_pdu_len(PyObject* self, PyObject* args) {
 
 static PyObject* bser_loads(PyObject* self, PyObject* args, PyObject* kw) {
   const char* data = NULL;
-  Py_ssize_t datalen = 0;
+  Py_buffer view;
   const char* start;
   const char* end;
   int64_t expected_len;
   off_t position;
   PyObject* mutable_obj = NULL;
+  PyObject* lazy_obj = NULL;
+  PyObject* res;
   const char* value_encoding = NULL;
   const char* value_errors = NULL;
   unser_ctx_t ctx = {1, 0};
 
   static char* kw_list[] = {
-      "buf", "mutable", "value_encoding", "value_errors", NULL};
+      "buf", "mutable", "value_encoding", "value_errors", "lazy", NULL};
 
   (void)self;
 
   if (!PyArg_ParseTupleAndKeywords(
           args,
           kw,
-          "s#|Ozz:loads",
+          // Any buffer, such as an mmap of a shared memory result
+          "s*|OzzO:loads",
           kw_list,
-          &start,
-          &datalen,
+          &view,
           &mutable_obj,
           &value_encoding,
-          &value_errors)) {
+          &value_errors,
+          &lazy_obj)) {
     return NULL;
   }
+  start = view.buf;
 
   if (mutable_obj) {
     ctx.is_mutable = PyObject_IsTrue(mutable_obj) > 0 ? 1 : 0;
   }
+  if (lazy_obj && PyObject_IsTrue(lazy_obj) > 0) {
+    // Lazy results are immutable, and decode from a copy of the input
+    // that they keep alive, since buf may be a mutable buffer.
+    ctx.is_mutable = 0;
+    ctx.is_lazy = 1;
+    ctx.lazy_buf = PyBytes_FromStringAndSize(start, view.len);
+    if (!ctx.lazy_buf) {
+      PyBuffer_Release(&view);
+      return NULL;
+    }
+    start = PyBytes_AS_STRING(ctx.lazy_buf);
+  }
   ctx.value_encoding = value_encoding;
   if (value_encoding == NULL) {
     ctx.value_errors = NULL;
@@ -519,7 +535,7 @@ static PyObject* bser_loads(PyObject* self, PyObject* args, PyObject* kw) {
     ctx.value_errors = value_errors;
   }
   data = start;
-  end = data + datalen;
+  end = data + view.len;
 
   if (!_pdu_info_helper(
           data,
@@ -528,6 +544,8 @@ static PyObject* bser_loads(PyObject* self, PyObject* args, PyObject* kw) {
           &ctx.bser_capabilities,
           &expected_len,
           &position)) {
+    Py_XDECREF(ctx.lazy_buf);
+    PyBuffer_Release(&view);
     return NULL;
   }
 
@@ -535,10 +553,15 @@ static PyObject* bser_loads(PyObject* self, PyObject* args, PyObject* kw) {
   // Verify
   if (expected_len + data != end) {
     PyErr_SetString(PyExc_ValueError, "bser data len != header len");
+    Py_XDECREF(ctx.lazy_buf);
+    PyBuffer_Release(&view);
     return NULL;
   }
 
-  return bser_loads_recursive(&data, end, &ctx);
+  res = bser_loads_recursive(&data, end, &ctx);
+  Py_XDECREF(ctx.lazy_buf);
+  PyBuffer_Release(&view);
+  return res;
 }
 
 static PyObject* bser_load(PyObject* self, PyObject* args, PyObject* kw) {
@@ -551,21 +574,23 @@ static PyObject* bser_load(PyObject* self, PyObject* args, PyObject* kw) {
   PyObject* mutable_obj = NULL;
   PyObject* value_encoding = NULL;
   PyObject* value_errors = NULL;
+  PyObject* lazy_obj = NULL;
 
   static char* kw_list[] = {
-      "fp", "mutable", "value_encoding", "value_errors", NULL};
+      "fp", "mutable", "value_encoding", "value_errors", "lazy", NULL};
 
   (void)self;
 
   if (!PyArg_ParseTupleAndKeywords(
           args,
           kw,
-          "O|OOO:load",
+          "O|OOOO:load",
           kw_list,
           &fp,
           &mutable_obj,
           &value_encoding,
-          &value_errors)) {
+          &value_errors,
+          &lazy_obj)) {
     return NULL;
   }
 
@@ -596,6 +621,9 @@ static PyObject* bser_load(PyObject* self, PyObject* args, PyObject* kw) {
   if (value_errors) {
     PyDict_SetItemString(load_method_kwargs, "value_errors", value_errors);
   }
+  if (lazy_obj) {
+    PyDict_SetItemString(load_method_kwargs, "lazy", lazy_obj);
+  }
   string = PyObject_Call(load_method, load_method_args, load_method_kwargs);
   Py_DECREF(load_method_kwargs);
   Py_DECREF(load_method_args);
@@ -634,6 +662,8 @@ PyMODINIT_FUNC PyInit_bser(void) {
 
   mod = PyModule_Create(&bser_module);
   PyType_Ready(&bserObjectType);
+  PyType_Ready(&bserLazyArrayType);
+  PyType_Ready(&bserLazyRowType);
 
   return mod;
 }
@@ -642,6 +672,8 @@ PyMODINIT_FUNC PyInit_bser(void) {
 PyMODINIT_FUNC initbser(void) {
   (void)Py_InitModule("bser", bser_methods);
   PyType_Ready(&bserObjectType);
+  PyType_Ready(&bserLazyArrayType);
+  PyType_Ready(&bserLazyRowType);
 }
 #endif // PY_MAJOR_VERSION >= 3
 
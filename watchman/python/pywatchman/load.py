@@ -40,7 +40,9 @@ def _read_bytes(fp, buf):
     return offset
 
 
-def load(fp, mutable: bool = True, value_encoding=None, value_errors=None):
+def load(
+    fp, mutable: bool = True, value_encoding=None, value_errors=None, lazy=False
+):
     """Deserialize a BSER-encoded blob.
 
     @param fp: The file-object to deserialize.
@@ -57,6 +59,11 @@ def load(fp, mutable: bool = True, value_encoding=None, value_errors=None):
                          The other most common argument is 'surrogateescape' on
                          Python 3. If value_encoding is None, this is ignored.
     @type value_errors: str
+
+    @param lazy: Whether to decode templated arrays, such as the files of a
+                 query result, lazily: the values of each row are only
+                 decoded when they are accessed.  Implies mutable=False.
+    @type lazy: bool
     """
     buf = ctypes.create_string_buffer(8192)
     SNIFF_BUFFER_SIZE = len(EMPTY_HEADER)
@@ -88,4 +95,5 @@ def load(fp, mutable: bool = True, value_encoding=None, value_errors=None):
         mutable,
         value_encoding,
         value_errors,
+        lazy,
     )
@@ -25,6 +25,11 @@ BSER_NULL = b"\x0a"
 BSER_TEMPLATE = b"\x0b"
 BSER_SKIP = b"\x0c"
 BSER_UTF8STRING = b"\x0d"
+BSER_COLUMNS = b"\x0e"
+BSER_PATH = b"\x0f"
+
+# BSERv2 capabilities
+BSER_CAP_COLUMNS = 0x4
 
 STRING_TYPES = (str, bytes)
 unicode = str
@@ -409,6 +414,58 @@ class Bunser(object):
             arr.append(obj)
         return arr, pos
 
+    def unser_path(self, buf, pos, dirs):
+        dir_idx, pos = self.unser_int(buf, pos + 1)
+        if not 0 <= dir_idx < len(dirs):
+            raise ValueError("Invalid bser directory index %d" % dir_idx)
+        base_type = _buf_pos(buf, pos)
+        if base_type != BSER_BYTESTRING and base_type != BSER_UTF8STRING:
+            raise ValueError("Expect STRING to follow PATH")
+        str_len, pos = self.unser_int(buf, pos + 1)
+        base = struct.unpack_from(tobytes(str_len) + b"s", buf, pos)[0]
+        path = dirs[dir_idx] + b"/" + base
+        if base_type == BSER_UTF8STRING:
+            path = path.decode("utf-8")
+        elif self.value_encoding is not None:
+            path = path.decode(self.value_encoding, self.value_errors)
+        return path, pos + str_len
+
+    def unser_columns(self, buf, pos):
+        val_type = _buf_pos(buf, pos + 1)
+        if val_type != BSER_ARRAY:
+            raise RuntimeError("Expect ARRAY to follow COLUMNS")
+        # force UTF-8 on keys
+        keys_bunser = Bunser(mutable=self.mutable, value_encoding="utf-8")
+        keys, pos = keys_bunser.unser_array(buf, pos + 1)
+        nitems, pos = self.unser_int(buf, pos)
+        # The directories are joined to the names as bytes
+        dirs_bunser = Bunser(mutable=True)
+        dirs, pos = dirs_bunser.unser_array(buf, pos)
+        dirs = [d.encode("utf-8") if isinstance(d, str) else d for d in dirs]
+
+        columns = []
+        for _ in keys:
+            column = []
+            for _ in range(nitems):
+                val_type = _buf_pos(buf, pos)
+                if val_type == BSER_SKIP:
+                    pos += 1
+                    ele = None
+                elif val_type == BSER_PATH:
+                    ele, pos = self.unser_path(buf, pos, dirs)
+                else:
+                    ele, pos = self.loads_recursive(buf, pos)
+                column.append(ele)
+            columns.append(column)
+
+        arr = []
+        for vals in zip(*columns):
+            if self.mutable:
+                arr.append(dict(zip(keys, vals)))
+            else:
+                arr.append(_BunserDict(keys, list(vals)))
+        return arr, pos
+
     def loads_recursive(self, buf, pos):
         val_type = _buf_pos(buf, pos)
         if (
@@ -437,6 +494,8 @@ class Bunser(object):
             return self.unser_object(buf, pos)
         elif val_type == BSER_TEMPLATE:
             return self.unser_template(buf, pos)
+        elif val_type == BSER_COLUMNS:
+            return self.unser_columns(buf, pos)
         else:
             raise ValueError(
                 "unhandled bser opcode 0x%s"
@@ -472,7 +531,9 @@ def pdu_len(buf):
     return info[2] + info[3]
 
 
-def loads(buf, mutable: bool = True, value_encoding=None, value_errors=None):
+def loads(
+    buf, mutable: bool = True, value_encoding=None, value_errors=None, lazy=False
+):
     """Deserialize a BSER-encoded blob.
 
     @param buf: The buffer to deserialize.
@@ -489,6 +550,13 @@ def loads(buf, mutable: bool = True, value_encoding=None, value_errors=None):
                          The other most common argument is 'surrogateescape' on
                          Python 3. If value_encoding is None, this is ignored.
     @type value_errors: str
+
+    @param lazy: Whether to decode templated arrays, such as the files of a
+                 query result, lazily: the values of each row are only
+                 decoded when they are accessed.  Implies mutable=False.
+    @type lazy: bool
+                 This implementation has no lazy mode, and decodes the
+                 result as if mutable=False.
     """
 
     info = _pdu_info_helper(buf)
@@ -501,13 +569,17 @@ def loads(buf, mutable: bool = True, value_encoding=None, value_errors=None):
         )
 
     bunser = Bunser(
-        mutable=mutable, value_encoding=value_encoding, value_errors=value_errors
+        mutable=mutable and not lazy,
+        value_encoding=value_encoding,
+        value_errors=value_errors,
     )
 
     return bunser.loads_recursive(buf, pos)[0]
 
 
-def load(fp, mutable: bool = True, value_encoding=None, value_errors=None):
+def load(
+    fp, mutable: bool = True, value_encoding=None, value_errors=None, lazy=False
+):
     from . import load
 
-    return load.load(fp, mutable, value_encoding, value_errors)
+    return load.load(fp, mutable, value_encoding, value_errors, lazy)
@@ -7,6 +7,7 @@
 
 import asyncio
 import os
+import socket
 import subprocess
 import typing
 
@@ -19,8 +20,11 @@ except ImportError:
     from pywatchman import pybser as bser
 
 
-# 2 bytes marker, 1 byte int size, 8 bytes int64 value
-SNIFF_LEN = 13
+# The initial size of the receive buffer, which grows to fit the largest PDU
+RECV_BUF_SIZE = 64 * 1024
+
+# The number of bytes of a BSER int with the given type byte
+BSER_INT_SIZES = {0x03: 1, 0x04: 2, 0x05: 4, 0x06: 8}
 
 
 # TODO: Fix this when https://github.com/python/asyncio/issues/281 is resolved.
@@ -78,6 +82,13 @@ class AsyncTransport(object):
         """Read 'size' bytes from the transport."""
         raise NotImplementedError()
 
+    async def readinto(self, buf):
+        """Read up to len(buf) bytes from the transport into the writable
+        buffer 'buf', and return how many were read."""
+        res = await self.read(len(buf))
+        buf[: len(res)] = res
+        return len(res)
+
     async def write(self, buf):
         """Write 'buf' bytes to the transport."""
         raise NotImplementedError()
@@ -92,28 +103,39 @@ class AsyncUnixSocketTransport(AsyncTransport):
 
     def __init__(self):
         self.sockname = None
-        self.reader = None
-        self.writer = None
+        self.sock = None
 
     async def activate(self, **kwargs):
         # Requires keyword-argument 'sockname'
-        reader, writer = await asyncio.open_unix_connection(kwargs["sockname"])
-        self.reader = reader
-        self.writer = writer
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        sock.setblocking(False)
+        try:
+            await asyncio.get_running_loop().sock_connect(sock, kwargs["sockname"])
+        except BaseException:
+            sock.close()
+            raise
+        self.sock = sock
 
     async def write(self, data):
-        self.writer.write(data)
-        await self.writer.drain()
+        await asyncio.get_running_loop().sock_sendall(self.sock, data)
 
     async def read(self, size):
-        res = await self.reader.read(size)
+        res = await asyncio.get_running_loop().sock_recv(self.sock, size)
         if not len(res):
             raise ConnectionResetError("connection closed")
         return res
 
+    async def readinto(self, buf):
+        # Reads straight into buf, rather than into a new bytes object that
+        # then has to be copied
+        res = await asyncio.get_running_loop().sock_recv_into(self.sock, buf)
+        if not res:
+            raise ConnectionResetError("connection closed")
+        return res
+
     def close(self):
-        if self.writer:
-            self.writer.close()
+        if self.sock:
+            self.sock.close()
 
 
 class AsyncCodec(object):
@@ -138,21 +160,59 @@ class AsyncCodec(object):
 # This requires BSERv2 support of the server, but doesn't gracefully check
 # for the requisite capability being present in older versions.
 class AsyncBserCodec(AsyncCodec):
-    """Use the BSER encoding."""
+    """Use the BSER encoding.
+
+    PDUs are read into a single receive buffer that is reused for every
+    PDU, and decoded from it without being copied.  Whatever is read past
+    the end of a PDU is kept for the next one, so that a burst of small
+    notifications takes few reads.
+    """
+
+    def __init__(self, transport):
+        super(AsyncBserCodec, self).__init__(transport)
+        self.buf = bytearray(RECV_BUF_SIZE)
+        # The start of the next PDU, and the end of what has been read
+        self.start = 0
+        self.end = 0
+
+    async def _fill(self, size):
+        """Read until the buffer holds at least 'size' bytes of the next
+        PDU."""
+        if self.start + size > len(self.buf):
+            pending = self.end - self.start
+            if size > len(self.buf):
+                # Replaced rather than resized, since a bytearray can't be
+                # resized while memoryviews of it are around
+                buf = bytearray(max(size, 2 * len(self.buf)))
+                buf[:pending] = memoryview(self.buf)[self.start : self.end]
+                self.buf = buf
+            else:
+                self.buf[:pending] = self.buf[self.start : self.end]
+            self.start = 0
+            self.end = pending
+        while self.end - self.start < size:
+            self.end += await self.transport.readinto(memoryview(self.buf)[self.end :])
+
+    async def _header_len(self):
+        """Return the length of the header of the next PDU, which is the
+        magic, the capabilities for BSERv2, and the length as an int."""
+        await self._fill(2)
+        pos = 6 if self.buf[self.start + 1] == 2 else 2
+        await self._fill(pos + 1)
+        int_size = BSER_INT_SIZES.get(self.buf[self.start + pos])
+        if int_size is None:
+            raise WatchmanError("invalid watchman response header")
+        return pos + 1 + int_size
 
     async def receive(self):
-        sniff = await self.transport.read(SNIFF_LEN)
-        if not sniff:
-            raise WatchmanError("empty watchman response")
-        _1, _2, elen = bser.pdu_info(sniff)
-        rlen = len(sniff)
-        buf = bytearray(elen)
-        buf[:rlen] = sniff
-        while elen > rlen:
-            b = await self.transport.read(elen - rlen)
-            buf[rlen : rlen + len(b)] = b
-            rlen += len(b)
-        response = bytes(buf)
+        hlen = await self._header_len()
+        await self._fill(hlen)
+        _1, _2, elen = bser.pdu_info(bytes(self.buf[self.start : self.start + hlen]))
+        await self._fill(elen)
+        response = memoryview(self.buf)[self.start : self.start + elen]
+        self.start += elen
+        if self.start == self.end:
+            self.start = self.end = 0
         try:
             res = self._loads(response)
             return res
@@ -177,6 +237,44 @@ class ReceiveLoopError(Exception):
     pass
 
 
+class AsyncQueryStream(object):
+    """Iterates asynchronously over the files matched by a query that was
+    issued via AIOClient.query_stream, as the batches of files that hold
+    them arrive.
+
+    Once the iteration is complete, `trailer` holds the final response
+    of the query, which has the `clock` and `is_fresh_instance` fields.
+    """
+
+    def __init__(self, client, args):
+        self.client = client
+        self.args = args
+        self.trailer = None
+
+    def __aiter__(self):
+        return self._files()
+
+    async def _files(self):
+        while self.trailer is None:
+            try:
+                res = await self.client.receive_bilateral_response()
+            except CommandError as ex:
+                ex.setCommand(self.args)
+                raise ex
+            kind = res.get("stream")
+            if kind == "header":
+                continue
+            if kind == "files":
+                for f in res["files"]:
+                    yield f
+                continue
+            # Either the trailer, or the complete response of a server
+            # that doesn't stream results
+            self.trailer = res
+            for f in res.get("files") or ():
+                yield f
+
+
 class AIOClient(object):
     """Create and manage an asyncio Watchman connection.
 
@@ -231,6 +329,26 @@ class AIOClient(object):
             ex.setCommand(args)
             raise ex
 
+    async def query_stream(self, root, query):
+        """Send a query to the Watchman service and return an
+        AsyncQueryStream over its results.
+
+        Rather than waiting for the whole response, the service is asked
+        to send the matching files in batches as soon as the query has been
+        evaluated, and the stream yields each file as its batch is
+        received.
+
+        The stream must be consumed before issuing another command on this
+        client.
+        """
+
+        self._check_receive_loop()
+        query = dict(query)
+        query["stream"] = True
+        args = ("query", root, query)
+        await self.connection.send(args)
+        return AsyncQueryStream(self, args)
+
     async def capability_check(self, optional=None, required=None):
         """Perform a server capability check."""
 
@@ -259,7 +377,7 @@ class AIOClient(object):
     async def pop_log(self):
         """Get one log from the log queue."""
         self._check_receive_loop()
-        res = self.log_queue.get()
+        res = await self.log_queue.get()
         self._check_error(res)
         return res
 
@@ -364,6 +364,77 @@ class TestBSERDump(unittest.TestCase):
         for i in range(0, len(exp)):
             self.assertItemAttributes(exp[i], res[i])
 
+    def test_template_lazy(self):
+        # The template of test_template, followed by a nested template
+        # in the last row
+        templ = (
+            b"\x00\x01\x03\x34"
+            + b"\x0b\x00\x03\x02\x02\x03\x04\x6e\x61\x6d\x65\x02"
+            + b"\x03\x03\x61\x67\x65\x03\x03\x02\x03\x04\x66\x72"
+            + b"\x65\x64\x03\x14\x02\x03\x04\x70\x65\x74\x65\x03"
+            + b"\x1e\x0c\x0b\x00\x03\x01\x02\x03\x01\x78\x03\x02"
+            + b"\x03\x01\x03\x02"
+        )
+        exp = [
+            {"name": "fred", "age": 20},
+            {"name": "pete", "age": 30},
+            {"name": None, "age": [{"x": 1}, {"x": 2}]},
+        ]
+        res = self.bser_mod.loads(templ, lazy=True, value_encoding="utf-8")
+        self.assertEqual(len(exp), len(res))
+        for i in range(0, len(exp)):
+            self.assertEqual(exp[i]["name"], res[i].name)
+            self.assertEqual(exp[i]["name"], res[i]["name"])
+            self.assertEqual(exp[i]["name"], res[i][0])
+        self.assertEqual(20, res[0].st_age)
+        self.assertEqual([1, 2], [row.x for row in res[2].age])
+        self.assertEqual(["fred", "pete", None], [row.name for row in res])
+
+        fp = FakeFile(templ)
+        res = self.bser_mod.load(fp, lazy=True)
+        self.assertEqual(b"pete", res[1].name)
+
+        # Truncated input is rejected up front rather than on access.
+        # pybser reports it as an IndexError.
+        truncated = b"\x00\x01\x03\x27" + templ[4:43]
+        self.assertRaises(
+            (ValueError, IndexError), self.bser_mod.loads, truncated, lazy=True
+        )
+
+    def test_columns(self):
+        # The rows of test_template as columns, with the directory of the
+        # names factored out, as the daemon sends them to clients with the
+        # columns capability
+        columns = (
+            b"\x0e\x00\x03\x02\x02\x03\x04\x6e\x61\x6d\x65\x02"
+            + b"\x03\x03\x61\x67\x65\x03\x03\x00\x03\x01\x02\x03"
+            + b"\x03\x64\x69\x72\x0f\x03\x00\x02\x03\x04\x66\x72"
+            + b"\x65\x64\x0f\x03\x00\x0d\x03\x04\x70\x65\x74\x65"
+            + b"\x0c\x03\x14\x03\x1e\x03\x19"
+        )
+        enc = b"\x00\x01\x03" + bytes([len(columns)]) + columns
+        dec = self.bser_mod.loads(enc)
+        exp = [
+            {"name": b"dir/fred", "age": 20},
+            {"name": "dir/pete", "age": 30},
+            {"name": None, "age": 25},
+        ]
+        self.assertEqual(exp, dec)
+        res = self.bser_mod.loads(enc, False)
+        for i in range(0, len(exp)):
+            self.assertItemAttributes(exp[i], res[i])
+
+        res = self.bser_mod.loads(enc, lazy=True, value_encoding="utf-8")
+        self.assertEqual(["dir/fred", "dir/pete", None], [row.name for row in res])
+
+        # A directory that isn't in the dictionary is rejected
+        bogus = columns.replace(b"\x0f\x03\x00\x02", b"\x0f\x03\x01\x02")
+        self.assertRaises(
+            ValueError,
+            self.bser_mod.loads,
+            b"\x00\x01\x03" + bytes([len(bogus)]) + bogus,
+        )
+
     def test_pdu_info(self):
         enc = self.bser_mod.dumps(1)
         DEFAULT_BSER_VERSION = 1
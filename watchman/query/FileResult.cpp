@@ -11,6 +11,14 @@ namespace watchman {
 
 FileResult::~FileResult() {}
 
+w_string_piece FileResult::renderDirName(std::string&) {
+  return dirName();
+}
+
+std::optional<w_string_piece> FileResult::foldedBaseName() {
+  return std::nullopt;
+}
+
 std::optional<DType> FileResult::dtype() {
   auto statInfo = stat();
   if (!statInfo.has_value()) {
@@ -7,7 +7,9 @@
 
 #pragma once
 
+#include <functional>
 #include <optional>
+#include <string>
 #include <vector>
 #include "watchman/Clock.h"
 #include "watchman/fs/FileInformation.h"
@@ -45,9 +47,17 @@ class FileResult {
 
   // Returns the name of the file in its containing dir
   virtual w_string_piece baseName() = 0;
+  // Returns baseName() with its ASCII letters lower cased, if the
+  // implementation keeps such a copy, so that case insensitive terms
+  // needn't fold the name for every evaluation.
+  virtual std::optional<w_string_piece> foldedBaseName();
   // Returns the name of the containing dir relative to the
   // VFS root
   virtual w_string_piece dirName() = 0;
+  // Like dirName(), but implementations that would otherwise need to
+  // allocate may render the name into buffer instead.  The result is valid
+  // until buffer is next modified.
+  virtual w_string_piece renderDirName(std::string& buffer);
 
   // Maybe return the file existence status.
   // Returns folly::none if the information is not currently known.
@@ -75,6 +85,34 @@ class FileResult {
   // on linux).
   virtual std::optional<DType> dtype();
 
+  /**
+   * Tells the files of a view apart without computing their names, for
+   * as long as a query runs.  The node alone could be freed and reused for
+   * another file between generators; that file would have been created
+   * at a later tick.
+   */
+  struct Identity {
+    const void* node;
+    ClockTicks created;
+
+    bool operator==(const Identity& other) const {
+      return node == other.node && created == other.created;
+    }
+
+    struct Hash {
+      size_t operator()(const Identity& identity) const {
+        return std::hash<const void*>()(identity.node) ^
+            std::hash<ClockTicks>()(identity.created);
+      }
+    };
+  };
+
+  // Returns the identity of the file, or nullopt if the view doesn't keep
+  // a node for it.
+  virtual std::optional<Identity> identity() {
+    return std::nullopt;
+  }
+
   // A bitset of Property values
   using Properties = uint_least16_t;
 
@@ -39,4 +39,30 @@ w_string convertNoEscapeGlobToGlob(w_string_piece noescapePattern) {
   }
   return w_string{pattern};
 }
+
+std::string globLiteralDir(std::string_view pattern) {
+  std::string dir;
+  while (true) {
+    auto slash = pattern.find('/');
+    if (slash == std::string_view::npos) {
+      return dir;
+    }
+    std::string component;
+    for (size_t i = 0; i < slash; ++i) {
+      char c = pattern[i];
+      if (c == '*' || c == '?' || c == '[') {
+        return dir;
+      }
+      if (c == '\\' && i + 1 < slash) {
+        c = pattern[++i];
+      }
+      component.push_back(c);
+    }
+    if (!dir.empty()) {
+      dir.push_back('/');
+    }
+    dir.append(component);
+    pattern.remove_prefix(slash + 1);
+  }
+}
 } // namespace watchman
@@ -7,6 +7,8 @@
 
 #pragma once
 
+#include <string>
+#include <string_view>
 #include "watchman/watchman_string.h"
 
 namespace watchman {
@@ -22,4 +24,12 @@ w_string convertLiteralPathToGlob(w_string_piece literal);
  * can be used without the `noescape` flag.
  */
 w_string convertNoEscapeGlobToGlob(w_string_piece noescapePattern);
+
+/**
+ * The leading components of a glob pattern that contain no wildcards, less
+ * its last component, unescaped.  Every path that the pattern matches is
+ * below this dir, which is empty if the pattern's first component has a
+ * wildcard or is its last.
+ */
+std::string globLiteralDir(std::string_view pattern);
 } // namespace watchman
@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/GlobMatcher.h"
+#include <cstring>
+#include "watchman/thirdparty/wildmatch/wildmatch.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+namespace {
+
+// Literal text is matched by a plain compare.  A run of slashes in a pattern
+// matches a single slash, so those are left to wildmatch too.
+bool isLiteral(std::string_view text, bool component) {
+  return text.find_first_of("*?[\\") == std::string_view::npos &&
+      text.find("//") == std::string_view::npos &&
+      (!component || text.find('/') == std::string_view::npos);
+}
+
+} // namespace
+
+GlobMatcher::GlobMatcher(std::string_view pattern, int flags)
+    : pattern_(pattern), flags_(flags) {
+  std::string_view view{pattern_};
+  if ((flags_ & WM_PATHNAME) && view.substr(0, 3) == "**/" &&
+      classify(view.substr(3), true)) {
+    underDoublestar_ = true;
+  } else if (!classify(view, false)) {
+    shape_ = Shape::General;
+    // Anything that may be special ends the literal text.  So does '/',
+    // because a run of slashes matches any other run of slashes, and a
+    // slash next to a "**" may match nothing at all.
+    auto first = view.find_first_of("*?[]\\/");
+    if (first == std::string_view::npos) {
+      literal_ = suffix_ = pattern_;
+    } else {
+      auto last = view.find_last_of("*?[]\\/");
+      literal_ = view.substr(0, first);
+      suffix_ = view.substr(last + 1);
+    }
+  }
+
+  // The literal text of a case insensitive pattern is kept lower cased, so
+  // that it compares directly with an already folded name.
+  if (flags_ & WM_CASEFOLD) {
+    foldAsciiCase(literal_.data(), literal_.data(), literal_.size());
+    foldAsciiCase(suffix_.data(), suffix_.data(), suffix_.size());
+  }
+}
+
+// Sets the shape, if pattern has one.  component says that pattern follows
+// a "**/", and must match a single path component.
+bool GlobMatcher::classify(std::string_view pattern, bool component) {
+  if (isLiteral(pattern, component)) {
+    shape_ = Shape::Literal;
+    literal_ = pattern;
+    return true;
+  }
+
+  if (pattern.size() > 1 && pattern[0] == '*' &&
+      isLiteral(pattern.substr(1), true)) {
+    shape_ = Shape::Suffix;
+    literal_ = pattern.substr(1);
+    return true;
+  }
+
+  auto text = pattern;
+  while (!text.empty() && text.back() == '*') {
+    text.remove_suffix(1);
+  }
+  auto stars = pattern.size() - text.size();
+  if (stars == 0 || stars > 2 || !isLiteral(text, component)) {
+    return false;
+  }
+  if (stars == 1) {
+    starMatchesSlash_ = !(flags_ & WM_PATHNAME);
+  } else if (component) {
+    return false;
+  } else if (
+      (flags_ & WM_PATHNAME) && !text.empty() && text.back() != '/') {
+    // wildmatch rejects a "**" that isn't a whole path component
+    return false;
+  } else {
+    starMatchesSlash_ = true;
+  }
+  shape_ = Shape::Prefix;
+  literal_ = text;
+  return true;
+}
+
+bool GlobMatcher::matches(std::string_view text, bool textIsFolded) const {
+  if (shape_ == Shape::General) {
+    return matchesGeneral(text, textIsFolded);
+  }
+  if (!underDoublestar_) {
+    return matchesShape(text, textIsFolded, true);
+  }
+
+  // The "**/" may match nothing, or any run of directories.
+  auto slash = text.rfind('/');
+  if (slash == std::string_view::npos) {
+    return matchesShape(text, textIsFolded, true);
+  }
+  if (flags_ & WM_PERIOD) {
+    // wildmatch won't let the "**" begin with a period, nor any directory
+    // or the last component begin with one, unless the shape itself does.
+    if (text[0] == '.') {
+      return false;
+    }
+    bool shapeBeginsWithPeriod = shape_ != Shape::Suffix &&
+        !literal_.empty() && literal_[0] == '.';
+    if (!shapeBeginsWithPeriod && text.find("/.") != std::string_view::npos) {
+      return false;
+    }
+  }
+  return matchesShape(text.substr(slash + 1), textIsFolded, false);
+}
+
+bool GlobMatcher::matchesShape(
+    std::string_view text,
+    bool textIsFolded,
+    bool checkLeadingPeriod) const {
+  switch (shape_) {
+    case Shape::Literal:
+      return text.size() == literal_.size() &&
+          literalEquals(text.data(), literal_, textIsFolded);
+
+    case Shape::Prefix: {
+      if (text.size() < literal_.size() ||
+          !literalEquals(text.data(), literal_, textIsFolded)) {
+        return false;
+      }
+      auto rest = text.substr(literal_.size());
+      if (!starMatchesSlash_ && rest.find('/') != std::string_view::npos) {
+        return false;
+      }
+      if (flags_ & WM_PERIOD) {
+        // A leading star doesn't match a leading period, and with
+        // WM_PATHNAME, neither does a star that follows a slash.
+        if (literal_.empty()) {
+          return !checkLeadingPeriod || text.empty() || text[0] != '.';
+        }
+        if ((flags_ & WM_PATHNAME) && literal_.back() == '/' &&
+            !rest.empty() && rest[0] == '.') {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    case Shape::Suffix:
+      if (text.size() < literal_.size() ||
+          !literalEquals(
+              text.data() + text.size() - literal_.size(),
+              literal_,
+              textIsFolded)) {
+        return false;
+      }
+      if ((flags_ & WM_PATHNAME) &&
+          text.find('/') != std::string_view::npos) {
+        return false;
+      }
+      return !(flags_ & WM_PERIOD) || !checkLeadingPeriod || text[0] != '.';
+
+    case Shape::General:
+      break;
+  }
+  return matchesGeneral(text, textIsFolded);
+}
+
+bool GlobMatcher::matchesGeneral(std::string_view text, bool textIsFolded)
+    const {
+  if (literal_.size() > text.size() || suffix_.size() > text.size() ||
+      !literalEquals(text.data(), literal_, textIsFolded) ||
+      !literalEquals(
+          text.data() + text.size() - suffix_.size(), suffix_, textIsFolded)) {
+    return false;
+  }
+  return wildmatch(pattern_.c_str(), text.data(), flags_, nullptr) == WM_MATCH;
+}
+
+bool GlobMatcher::literalEquals(
+    const char* text,
+    const std::string& literal,
+    bool textIsFolded) const {
+  if (!(flags_ & WM_CASEFOLD) || textIsFolded) {
+    return memcmp(text, literal.data(), literal.size()) == 0;
+  }
+  return equalAsciiCaseless(text, literal.data(), literal.size());
+}
+
+} // namespace watchman
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+
+namespace watchman {
+
+// A glob pattern compiled for the wildmatch flags that it is matched with.
+//
+// Nearly every pattern that clients send has one of a handful of shapes: a
+// literal name ("BUCK"), literal text before a trailing star ("src/*",
+// "dir/**"), literal text after a leading star ("*.cpp"), or one of those
+// single component shapes below a leading "**/" ("**/*.cpp", "**/BUCK").
+// Those are classified when the pattern is compiled, and matched with string
+// compares that give the same answers as wildmatch, down to its treatment of
+// WM_PERIOD and WM_PATHNAME.  Any other pattern is matched with wildmatch,
+// once the literal text at either end of it has ruled out most names.
+class GlobMatcher {
+ public:
+  enum class Shape {
+    // The pattern is literal text
+    Literal,
+    // Literal text followed by "*" or "**"
+    Prefix,
+    // "*" followed by literal text
+    Suffix,
+    // Anything else, matched by wildmatch
+    General,
+  };
+
+  // Matches only the empty string, until assigned a compiled pattern
+  GlobMatcher() = default;
+
+  // flags are the WM_ flags of wildmatch
+  GlobMatcher(std::string_view pattern, int flags);
+
+  // Returns true if wildmatch would match text against the pattern.
+  // textIsFolded says that text is already lower cased, so that a
+  // WM_CASEFOLD pattern can compare it directly with its own lower cased
+  // literal text.  wildmatch takes C strings, so text must be followed by a
+  // NUL, as the names of files and the w_strings of paths are.
+  bool matches(std::string_view text, bool textIsFolded = false) const;
+
+  Shape shape() const {
+    return shape_;
+  }
+
+  // Whether the shape follows a leading "**/", which matches any number of
+  // directories
+  bool isUnderDoublestar() const {
+    return underDoublestar_;
+  }
+
+  const std::string& pattern() const {
+    return pattern_;
+  }
+
+ private:
+  bool classify(std::string_view pattern, bool component);
+
+  // Matches text against the shape, without regard to underDoublestar_.
+  // checkLeadingPeriod is false for the last component of a path under
+  // "**/", whose leading period is checked along with the others.
+  bool matchesShape(
+      std::string_view text,
+      bool textIsFolded,
+      bool checkLeadingPeriod) const;
+  bool matchesGeneral(std::string_view text, bool textIsFolded) const;
+  bool literalEquals(
+      const char* text,
+      const std::string& literal,
+      bool textIsFolded) const;
+
+  std::string pattern_;
+  int flags_{0};
+  Shape shape_{Shape::General};
+  bool underDoublestar_{false};
+  // For Prefix, whether the star may match a '/'
+  bool starMatchesSlash_{false};
+  // The literal text of the shape.  For General, the literal text that any
+  // matching name must begin with, and suffix_ the text it must end with.
+  // Both are lower cased for WM_CASEFOLD.
+  std::string literal_;
+  std::string suffix_;
+};
+
+} // namespace watchman
@@ -9,15 +9,65 @@
 
 #include <fmt/core.h>
 #include <folly/Range.h>
+#include "watchman/thirdparty/wildmatch/wildmatch.h"
 
 namespace watchman {
 
+void GlobPatternIndex::add(const GlobTree* node) {
+  // The literal text at the end of the pattern.  Cutting at any character
+  // that may be special is conservative: the tail may come out shorter
+  // than it could, never longer.
+  std::string_view pattern = node->pattern;
+  auto special = pattern.find_last_of("*?[]\\");
+  auto tail =
+      special == std::string_view::npos ? pattern : pattern.substr(special + 1);
+
+  if (auto ext = extensionOf(tail)) {
+    byExtension_[lowered(*ext)].push_back(node);
+  } else {
+    others_.push_back(node);
+  }
+}
+
+std::optional<std::string_view> GlobPatternIndex::extensionOf(
+    std::string_view name) {
+  auto dot = name.rfind('.');
+  if (dot == std::string_view::npos) {
+    return std::nullopt;
+  }
+  return name.substr(dot + 1);
+}
+
+std::string GlobPatternIndex::lowered(std::string_view text) {
+  std::string result{text};
+  for (auto& c : result) {
+    if (c >= 'A' && c <= 'Z') {
+      c = c - 'A' + 'a';
+    }
+  }
+  return result;
+}
+
 GlobTree::GlobTree(const char* pattern, uint32_t pattern_len)
     : pattern(pattern, pattern_len),
       is_leaf(0),
       had_specials(0),
       is_doublestar(0) {}
 
+void GlobTree::buildIndexes(int flags) {
+  for (auto& child : children) {
+    child->matcher = GlobMatcher{child->pattern, flags};
+    children_index.add(child.get());
+    child->buildIndexes(flags);
+  }
+  // The doublestar patterns take the rest of the glob, so they have no
+  // children of their own.
+  for (auto& child : doublestar_children) {
+    child->matcher = GlobMatcher{child->pattern, flags | WM_PATHNAME};
+    doublestar_index.add(child.get());
+  }
+}
+
 std::vector<std::string> GlobTree::unparse() const {
   std::vector<std::string> result;
   unparse_into(result, "");
@@ -8,11 +8,66 @@
 #pragma once
 
 #include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
+#include "watchman/query/GlobMatcher.h"
 
 namespace watchman {
 
+struct GlobTree;
+
+/**
+ * Narrows down which of a set of glob patterns can match a name, so that a
+ * directory entry needn't be matched against every one of them.
+ *
+ * A name can only match a pattern that ends in literal text if the name
+ * ends in that text too, and so has the same extension: the text after
+ * the last '.'.  Patterns are grouped by the extension of their literal
+ * tail; those without one may match any name.  The candidates still have
+ * to be matched with wildmatch.
+ */
+class GlobPatternIndex {
+ public:
+  void add(const GlobTree* node);
+
+  // Calls func(node) for each node whose pattern may match name, until
+  // func returns false.
+  template <typename Func>
+  void forEachCandidate(std::string_view name, Func&& func) const {
+    if (auto ext = extensionOf(name)) {
+      auto it = byExtension_.find(lowered(*ext));
+      if (it != byExtension_.end()) {
+        for (auto* node : it->second) {
+          if (!func(node)) {
+            return;
+          }
+        }
+      }
+    }
+    for (auto* node : others_) {
+      if (!func(node)) {
+        return;
+      }
+    }
+  }
+
+  bool empty() const {
+    return byExtension_.empty() && others_.empty();
+  }
+
+ private:
+  static std::optional<std::string_view> extensionOf(std::string_view name);
+  // Extensions are compared case-insensitively, so that the index also
+  // serves WM_CASEFOLD matches.
+  static std::string lowered(std::string_view text);
+
+  std::unordered_map<std::string, std::vector<const GlobTree*>> byExtension_;
+  std::vector<const GlobTree*> others_;
+};
+
 /**
  * A node in the tree of node matching rules.
  */
@@ -28,8 +83,20 @@ struct GlobTree {
   unsigned had_specials : 1; // if false, can do simple string compare
   unsigned is_doublestar : 1; // pattern begins with **
 
+  // Indexes of children and doublestar_children, built by buildIndexes()
+  GlobPatternIndex children_index;
+  GlobPatternIndex doublestar_index;
+  // The pattern compiled by the parent's buildIndexes()
+  GlobMatcher matcher;
+
   GlobTree(const char* pattern, uint32_t pattern_len);
 
+  // Builds the indexes of this node and its descendants, and compiles their
+  // patterns, once all of the globs have been added.  flags are the
+  // wildmatch flags of the query; doublestar patterns are matched against
+  // whole relative paths, so they are compiled with WM_PATHNAME as well.
+  void buildIndexes(int flags);
+
   // Produces a list of globs from the glob tree, effectively
   // performing the reverse of the original parsing operation.
   std::vector<std::string> unparse() const;
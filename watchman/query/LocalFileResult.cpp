@@ -6,10 +6,23 @@
  */
 
 #include "watchman/query/LocalFileResult.h"
+#include <folly/ScopeGuard.h>
+#include <folly/futures/Future.h>
+#include <unordered_map>
 #include "watchman/ContentHash.h"
+#include "watchman/ThreadPool.h"
+#include "watchman/WatchmanConfig.h"
+#include "watchman/fs/FileDescriptor.h"
+#include "watchman/fs/IoUring.h"
 
 namespace watchman {
 
+namespace {
+// Batches smaller than this are stat'd on the query thread, and larger
+// directories are split into tasks of this size
+constexpr size_t kStatTaskSize = 256;
+} // namespace
+
 LocalFileResult::LocalFileResult(
     w_string fullPath,
     ClockStamp clock,
@@ -112,33 +125,156 @@ std::optional<FileResult::ContentHash> LocalFileResult::getContentSha1() {
   return contentSha1_.value();
 }
 
+void LocalFileResult::statInDir(
+    const w_string& dirPath,
+    LocalFileResult* const* files,
+    size_t count) {
+#ifndef _WIN32
+  // A case insensitive root needs each name checked against its canonical
+  // case, which getInfo() does
+  if (files[0]->caseSensitivity_ == CaseSensitivity::CaseSensitive) {
+    FileDescriptor dir;
+    try {
+      auto options = OpenFileHandleOptions::queryFileInfo();
+      options.caseSensitive = CaseSensitivity::CaseSensitive;
+      dir = openFileHandle(dirPath.c_str(), options);
+    } catch (const std::exception&) {
+      // Treat any error as effectively deleted, as getInfo() does
+      for (size_t i = 0; i < count; ++i) {
+        files[i]->exists_ = false;
+        files[i]->info_ = FileInformation::makeDeletedFileInformation();
+      }
+      return;
+    }
+
+#ifdef WATCHMAN_HAVE_IO_URING_STATX
+    if (cfg_get_snapshot()->ioUringStatx) {
+      if (auto ring = IoUringStatx::forThisThread()) {
+        // The base names are the tails of the full paths, so they are
+        // NUL terminated
+        std::vector<const char*> names;
+        names.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+          names.push_back(files[i]->baseName().data());
+        }
+        std::vector<struct statx> bufs(count);
+        std::vector<int> results(count);
+        if (ring->statAll(
+                dir.fd(), names.data(), bufs.data(), results.data(), count)) {
+          for (size_t i = 0; i < count; ++i) {
+            if (results[i] == 0 &&
+                (bufs[i].stx_mask & kStatxMask) == kStatxMask) {
+              files[i]->exists_ = true;
+              files[i]->info_ = fileInformationFromStatx(bufs[i]);
+            } else {
+              files[i]->exists_ = false;
+              files[i]->info_ = FileInformation::makeDeletedFileInformation();
+            }
+          }
+          return;
+        }
+      }
+    }
+#endif
+
+    for (size_t i = 0; i < count; ++i) {
+      auto* file = files[i];
+      struct stat st;
+      if (fstatat(
+              dir.fd(), file->baseName().data(), &st, AT_SYMLINK_NOFOLLOW)) {
+        file->exists_ = false;
+        file->info_ = FileInformation::makeDeletedFileInformation();
+      } else {
+        file->exists_ = true;
+        file->info_ = FileInformation(st);
+      }
+    }
+    return;
+  }
+#endif
+  (void)dirPath;
+  for (size_t i = 0; i < count; ++i) {
+    files[i]->getInfo();
+  }
+}
+
+void LocalFileResult::fetchOtherProperties() {
+  if (neededProperties() & FileResult::Property::SymlinkTarget) {
+    ResolvedSymlink target = NotSymlink{};
+    // If this file is not a symlink then we immediately yield a "not a
+    // symlink" rather than propagating an error. This behavior is relied
+    // upon by the field rendering code and checked in test_symlink.py.
+    if (info_->isSymlink()) {
+      target = readSymbolicLink(fullPath_.c_str());
+    }
+    symlinkTarget_ = target;
+  }
+
+  if (neededProperties() & FileResult::Property::ContentSha1) {
+    // TODO: find a way to reference a ContentHashCache instance
+    // that will work with !InMemoryView based views.
+    contentSha1_ = makeResultWith([&] {
+      return ContentHashCache::computeHashImmediate(fullPath_.c_str());
+    });
+  }
+
+  clearNeededProperties();
+}
+
 void LocalFileResult::batchFetchProperties(
     const std::vector<std::unique_ptr<FileResult>>& files) {
+  // SCM queries can yield tens of thousands of files, so rather than stat
+  // them one at a time, group them by directory so that each directory is
+  // opened once.
+  std::unordered_map<w_string_piece, std::vector<LocalFileResult*>> byDir;
+  size_t toStat = 0;
   for (auto& f : files) {
     auto localFile = dynamic_cast<LocalFileResult*>(f.get());
-    localFile->getInfo();
-
-    if (localFile->neededProperties() & FileResult::Property::SymlinkTarget) {
-      ResolvedSymlink target = NotSymlink{};
-      // If this file is not a symlink then we immediately yield a "not a
-      // symlink" rather than propagating an error. This behavior is relied
-      // upon by the field rendering code and checked in test_symlink.py.
-      if (localFile->info_->isSymlink()) {
-        target = readSymbolicLink(localFile->fullPath_.c_str());
-      }
-      localFile->symlinkTarget_ = target;
+    if (!localFile->info_.has_value()) {
+      byDir[localFile->dirName()].push_back(localFile);
+      ++toStat;
     }
+  }
 
-    if (localFile->neededProperties() & FileResult::Property::ContentSha1) {
-      // TODO: find a way to reference a ContentHashCache instance
-      // that will work with !InMemoryView based views.
-      localFile->contentSha1_ = makeResultWith([&] {
-        return ContentHashCache::computeHashImmediate(
-            localFile->fullPath_.c_str());
-      });
+  // The work for each chunk of a directory: stat its files, and then fetch
+  // whatever else they need
+  auto fetch = [](w_string dirPath, LocalFileResult* const* chunk, size_t n) {
+    statInDir(dirPath, chunk, n);
+    for (size_t i = 0; i < n; ++i) {
+      chunk[i]->fetchOtherProperties();
     }
+  };
 
-    localFile->clearNeededProperties();
+  if (toStat < kStatTaskSize) {
+    for (auto& [dir, dirFiles] : byDir) {
+      fetch(dir.asWString(), dirFiles.data(), dirFiles.size());
+    }
+  } else {
+    std::vector<folly::Future<folly::Unit>> futures;
+    // The tasks refer to the files and to byDir, so wait for them even if
+    // we are throwing an exception
+    SCOPE_EXIT {
+      folly::collectAll(futures.begin(), futures.end()).wait();
+    };
+    for (auto& [dir, dirFiles] : byDir) {
+      auto dirPath = dir.asWString();
+      for (size_t i = 0; i < dirFiles.size(); i += kStatTaskSize) {
+        auto n = std::min(kStatTaskSize, dirFiles.size() - i);
+        futures.push_back(folly::via(
+            &getThreadPool(),
+            [fetch, dirPath, chunk = dirFiles.data() + i, n] {
+              fetch(dirPath, chunk, n);
+            }));
+      }
+    }
+  }
+
+  // Files that already had their stat information still need the rest
+  for (auto& f : files) {
+    auto localFile = dynamic_cast<LocalFileResult*>(f.get());
+    if (localFile->neededProperties() != FileResult::Property::None) {
+      localFile->fetchOtherProperties();
+    }
   }
 }
 
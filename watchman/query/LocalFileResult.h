@@ -63,11 +63,20 @@ class LocalFileResult : public FileResult {
   // Returns the SHA-1 hash of the file contents
   std::optional<FileResult::ContentHash> getContentSha1() override;
 
+  // Stats the files a directory at a time, on the thread pool when there
+  // are enough of them to be worth spreading out.
   void batchFetchProperties(
       const std::vector<std::unique_ptr<FileResult>>& files) override;
 
  private:
   void getInfo();
+  // Stats files that share the directory dirPath, opening it only once
+  static void statInDir(
+      const w_string& dirPath,
+      LocalFileResult* const* files,
+      size_t count);
+  // Fetches the properties other than the stat information
+  void fetchOtherProperties();
   w_string getFullPath();
 
   bool exists_{true};
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/ParsedQueryCache.h"
+#include "watchman/query/Query.h"
+
+namespace watchman {
+
+std::shared_ptr<const Query> ParsedQueryCache::lookup(const w_string& key) {
+  auto state = state_.wlock();
+  auto it = state->entries.find(key);
+  if (it == state->entries.end()) {
+    ++state->misses;
+    return nullptr;
+  }
+  ++state->hits;
+  state->order.splice(state->order.begin(), state->order, it->second.second);
+  return it->second.first;
+}
+
+void ParsedQueryCache::store(
+    const w_string& key,
+    std::shared_ptr<const Query> query,
+    size_t maxEntries) {
+  auto state = state_.wlock();
+  auto it = state->entries.find(key);
+  if (it != state->entries.end()) {
+    state->order.erase(it->second.second);
+    state->entries.erase(it);
+  }
+  state->order.push_front(key);
+  state->entries.emplace(
+      key, std::make_pair(std::move(query), state->order.begin()));
+
+  while (state->entries.size() > maxEntries) {
+    state->entries.erase(state->order.back());
+    state->order.pop_back();
+  }
+}
+
+size_t ParsedQueryCache::clear() {
+  auto state = state_.wlock();
+  auto cleared = state->entries.size();
+  state->entries.clear();
+  state->order.clear();
+  return cleared;
+}
+
+ParsedQueryCache::Stats ParsedQueryCache::getStats() const {
+  auto state = state_.rlock();
+  Stats stats;
+  stats.hits = state->hits;
+  stats.misses = state->misses;
+  stats.entries = state->entries.size();
+  return stats;
+}
+
+} // namespace watchman
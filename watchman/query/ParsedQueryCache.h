@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/Synchronized.h>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+struct Query;
+
+/**
+ * Remembers the queries that were recently parsed for a root, so that a
+ * client that sends the same large expression over and over doesn't have
+ * it parsed, and its patterns compiled, each time.
+ *
+ * The key is the canonical JSON of the query without the options that only
+ * apply to one request, such as since and request_id; see parseQuery().
+ * Entries are immutable: each request copies its entry, sharing the parsed
+ * expression and glob tree, and then applies its own options to the copy.
+ * This class is thread safe.
+ */
+class ParsedQueryCache {
+ public:
+  struct Stats {
+    size_t hits{0};
+    size_t misses{0};
+    size_t entries{0};
+  };
+
+  /**
+   * Returns the query cached for key, counting a hit and making it the
+   * most recently used, or else nullptr, counting a miss.
+   */
+  std::shared_ptr<const Query> lookup(const w_string& key);
+
+  /**
+   * Stores query for key, evicting the least recently used entries beyond
+   * maxEntries.
+   */
+  void store(
+      const w_string& key,
+      std::shared_ptr<const Query> query,
+      size_t maxEntries);
+
+  /** Drops every entry, returning how many there were. */
+  size_t clear();
+
+  Stats getStats() const;
+
+ private:
+  struct State {
+    // Most recently used first
+    std::list<w_string> order;
+    std::unordered_map<
+        w_string,
+        std::pair<std::shared_ptr<const Query>, std::list<w_string>::iterator>>
+        entries;
+    size_t hits{0};
+    size_t misses{0};
+  };
+  folly::Synchronized<State> state_;
+};
+
+} // namespace watchman
@@ -6,11 +6,17 @@
  */
 
 #include "watchman/query/Query.h"
+#include <cstdio>
+#include <fmt/core.h>
+#include <folly/String.h>
+#include "watchman/Errors.h"
 #include "watchman/query/GlobTree.h"
 #include "watchman/query/QueryExpr.h"
 
 namespace watchman {
 
+Query::Query() = default;
+Query::Query(const Query&) = default;
 Query::~Query() = default;
 
 bool Query::isFieldRequested(w_string_piece name) const {
@@ -22,4 +28,73 @@ bool Query::isFieldRequested(w_string_piece name) const {
   return false;
 }
 
+bool QueryOrder::before(const QueryOrderKey& a, const QueryOrderKey& b) const {
+  const auto& lhs = descending ? b : a;
+  const auto& rhs = descending ? a : b;
+  if (field == MTime) {
+    // Files with the same mtime are ordered by name, so that the order,
+    // and hence the page boundaries, are well defined
+    if (lhs.mtime.tv_sec != rhs.mtime.tv_sec) {
+      return lhs.mtime.tv_sec < rhs.mtime.tv_sec;
+    }
+    if (lhs.mtime.tv_nsec != rhs.mtime.tv_nsec) {
+      return lhs.mtime.tv_nsec < rhs.mtime.tv_nsec;
+    }
+  }
+  return lhs.name < rhs.name;
+}
+
+namespace {
+const char* orderName(const QueryOrder& order) {
+  if (order.field == QueryOrder::MTime) {
+    return order.descending ? "mtime:desc" : "mtime:asc";
+  }
+  return order.descending ? "name:desc" : "name:asc";
+}
+} // namespace
+
+// A token is "<clock>|<order>|<mtime sec>.<mtime nsec>|<hex encoded name>";
+// the name may hold any bytes, while clock strings never contain '|'.
+w_string QueryPageCursor::toToken(const QueryOrder& order) const {
+  auto name = folly::hexlify(
+      folly::ByteRange{
+          reinterpret_cast<const uint8_t*>(after.name.data()),
+          after.name.size()});
+  return w_string{fmt::format(
+      "{}|{}|{}.{}|{}",
+      clock.view(),
+      orderName(order),
+      after.mtime.tv_sec,
+      after.mtime.tv_nsec,
+      name)};
+}
+
+QueryPageCursor QueryPageCursor::fromToken(
+    w_string_piece token,
+    const QueryOrder& order) {
+  std::vector<folly::StringPiece> parts;
+  folly::split('|', folly::StringPiece{token.data(), token.size()}, parts);
+  if (parts.size() != 4 || !parts[0].startsWith("c:")) {
+    throw QueryParseError("invalid page_token");
+  }
+  if (parts[1] != folly::StringPiece{orderName(order)}) {
+    throw QueryParseError(
+        "page_token was returned by a query with a different order");
+  }
+
+  QueryPageCursor cursor;
+  cursor.clock = w_string{parts[0].data(), parts[0].size()};
+  long long sec;
+  long nsec;
+  std::string name;
+  if (sscanf(parts[2].str().c_str(), "%lld.%ld", &sec, &nsec) != 2 ||
+      !folly::unhexlify(parts[3], name)) {
+    throw QueryParseError("invalid page_token");
+  }
+  cursor.after.mtime.tv_sec = sec;
+  cursor.after.mtime.tv_nsec = nsec;
+  cursor.after.name = w_string{name.data(), name.size()};
+  return cursor;
+}
+
 } // namespace watchman
@@ -7,12 +7,18 @@
 
 #pragma once
 
+#include <chrono>
+#include <functional>
 #include <optional>
 #include "watchman/Clock.h"
+#include "watchman/PDU.h"
 #include "watchman/fs/FileSystem.h"
+#include "watchman/query/QueryAdmission.h"
 #include "watchman/thirdparty/jansson/jansson.h"
 #include "watchman/watchman_string.h"
 
+class BserArrayEncoder;
+
 namespace watchman {
 
 class FileResult;
@@ -23,6 +29,13 @@ class QueryExpr;
 struct QueryFieldRenderer {
   w_string name;
   std::optional<json_ref> (*make)(FileResult* file, const QueryContext* ctx);
+  // Optional; appends the value that make would produce straight to a BSER
+  // encoder.  Returns false, having appended nothing, if data needs to be
+  // loaded first.
+  bool (*encode)(
+      FileResult* file,
+      const QueryContext* ctx,
+      BserArrayEncoder& out){nullptr};
 };
 
 class QueryFieldList : public std::vector<QueryFieldRenderer*> {
@@ -40,6 +53,54 @@ struct QueryPath {
   int depth;
 };
 
+// The position of a file in the order requested by "order_by"
+struct QueryOrderKey {
+  w_string name;
+  struct timespec mtime {};
+};
+
+struct QueryOrder {
+  enum Field { Name, MTime };
+  Field field{Name};
+  bool descending{false};
+
+  /** Returns true if a comes before b in this order. */
+  bool before(const QueryOrderKey& a, const QueryOrderKey& b) const;
+};
+
+// Where a "page_token" says that the next page starts
+struct QueryPageCursor {
+  // The clock of the first page, which every later page carries along
+  w_string clock;
+  // The last file of the previous page; the page holds the files after it
+  QueryOrderKey after;
+
+  /**
+   * Renders this cursor as the opaque "page_token" that a client passes
+   * back to get the next page of a query with the specified order.
+   */
+  w_string toToken(const QueryOrder& order) const;
+
+  /**
+   * Parses a token returned by toToken().  Throws QueryParseError if it
+   * is malformed or was made for a different order.
+   */
+  static QueryPageCursor fromToken(
+      w_string_piece token,
+      const QueryOrder& order);
+};
+
+// Set by the "aggregate" option
+struct QueryAggregate {
+  enum GroupBy { None, DirName, Suffix };
+  GroupBy groupBy{None};
+  // For DirName grouping, files are grouped by at most this many leading
+  // components of their directory.  Unlimited if not set.
+  std::optional<uint32_t> depth;
+  // Whether to total the size of the files in each group
+  bool sumSize{false};
+};
+
 struct Query {
   CaseSensitivity case_sensitive = CaseSensitivity::CaseInSensitive;
   bool fail_if_no_saved_state = false;
@@ -56,10 +117,16 @@ struct Query {
 
   std::optional<std::vector<QueryPath>> paths;
 
-  std::unique_ptr<GlobTree> glob_tree;
+  // Shared with the copies made of a cached parse; see ParsedQueryCache
+  std::shared_ptr<GlobTree> glob_tree;
   // Additional flags to pass to wildmatch in the glob_generator
   int glob_flags = 0;
 
+  // The lower-cased suffixes of the suffix generator, which sets up
+  // glob_tree to match them.  Views that index files by suffix can use
+  // these to answer the query without walking the tree.
+  std::optional<std::vector<w_string>> suffixes;
+
   struct SettleTimeouts {
     std::chrono::milliseconds settle_period;
     std::chrono::milliseconds settle_timeout;
@@ -81,25 +148,79 @@ struct Query {
 
   uint32_t lock_timeout = 0;
 
+  /**
+   * Set by the "timeout" option: how long the query may run, from when it
+   * starts executing, before it is abandoned with an error.  Its checks
+   * are made while it generates and renders results, so waiting for
+   * settling or syncing is bounded by their own timeouts instead.
+   */
+  std::optional<std::chrono::milliseconds> timeout;
+
+  /**
+   * Set by the commands that run the query for a client: returns true once
+   * the client has hung up, so that the query can be abandoned.
+   */
+  std::function<bool()> clientGone;
+
+  // The priority of the client that issued the query
+  QueryPriority priority{QueryPriority::Interactive};
+
   // We can't (and mustn't!) evaluate the clockspec
   // fully until we execute query, because we have
   // to evaluate named cursors and determine fresh
   // instance at the time we execute
-  std::unique_ptr<ClockSpec> since_spec;
+  std::shared_ptr<ClockSpec> since_spec;
 
-  std::unique_ptr<QueryExpr> expr;
+  // Shared with the copies made of a cached parse, and evaluated by
+  // concurrent shards, so terms must not keep state between files
+  std::shared_ptr<QueryExpr> expr;
 
   // The query that we parsed into this struct
   std::optional<json_ref> query_spec;
 
   QueryFieldList fieldList;
 
+  // When set to a BSER format, the results are encoded in that format as
+  // they are rendered instead of being built up as json values.  Set by
+  // commands whose response goes straight back to a BSER client.
+  std::optional<PduFormat> bserResultFormat;
+
+  // When set by the "stream" option, the query command sends its results
+  // as a sequence of PDUs holding at most this many files each.
+  std::optional<size_t> streamBatchSize;
+
+  // When set by the "shared_memory" option, the query command writes its
+  // response to an anonymous file and passes its descriptor to the client.
+  bool sharedMemory{false};
+
+  // When set by the "limit" or "exists_only" options, the generators stop
+  // once this many files have matched, and no more are rendered.
+  std::optional<size_t> limit;
+  // Set by "exists_only": the matching file is counted but not rendered,
+  // and the response reports whether there was one.
+  bool existsOnly{false};
+
+  // Set by "order_by": the results are sorted in this order.
+  std::optional<QueryOrder> order;
+  // Set by "page_size": only the first this many files of the order are
+  // rendered, and the response has a token for the page after them.
+  std::optional<size_t> pageSize;
+  // Set by "page_token": the page starts after the file it names.
+  std::optional<QueryPageCursor> pageCursor;
+
+  // When set, the files that match are counted into groups rather than
+  // rendered, and the response holds a summary of each group.
+  std::optional<QueryAggregate> aggregate;
+
   std::optional<w_string> request_id;
   std::optional<w_string> subscriptionName;
   pid_t clientPid{0};
 
   bool alwaysIncludeDirectories{false};
 
+  Query();
+  // Copies share the parsed expression and glob tree
+  Query(const Query&);
   ~Query();
 
   /** Returns true if the supplied name is contained in
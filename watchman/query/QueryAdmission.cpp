@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/QueryAdmission.h"
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+namespace watchman {
+
+namespace {
+// How often a waiting query checks whether it has been cancelled
+constexpr std::chrono::milliseconds kCancelCheckPeriod{100};
+
+size_t indexOf(QueryPriority priority) {
+  return static_cast<size_t>(priority);
+}
+} // namespace
+
+const char* queryPriorityName(QueryPriority priority) {
+  switch (priority) {
+    case QueryPriority::Interactive:
+      return "interactive";
+    case QueryPriority::Batch:
+      return "batch";
+  }
+  return "<unknown>";
+}
+
+std::optional<QueryPriority> parseQueryPriority(std::string_view name) {
+  if (name == "interactive") {
+    return QueryPriority::Interactive;
+  }
+  if (name == "batch") {
+    return QueryPriority::Batch;
+  }
+  return std::nullopt;
+}
+
+QueryAdmission::Ticket::Ticket(Ticket&& other) noexcept
+    : admission_{std::exchange(other.admission_, nullptr)},
+      priority_{other.priority_} {}
+
+QueryAdmission::Ticket& QueryAdmission::Ticket::operator=(
+    Ticket&& other) noexcept {
+  if (this != &other) {
+    if (admission_) {
+      admission_->release(priority_);
+    }
+    admission_ = std::exchange(other.admission_, nullptr);
+    priority_ = other.priority_;
+  }
+  return *this;
+}
+
+QueryAdmission::Ticket::~Ticket() {
+  if (admission_) {
+    admission_->release(priority_);
+  }
+}
+
+bool QueryAdmission::canAdmit(QueryPriority priority, size_t slots) const {
+  size_t running = running_[0] + running_[1];
+  if (running >= slots) {
+    return false;
+  }
+  if (priority == QueryPriority::Interactive) {
+    return true;
+  }
+  // Interactive queries go first, and one slot is kept for them
+  auto batchSlots = slots > 1 ? slots - 1 : slots;
+  return waiting_[indexOf(QueryPriority::Interactive)].empty() &&
+      running_[indexOf(QueryPriority::Batch)] < batchSlots;
+}
+
+QueryAdmission::Ticket QueryAdmission::admit(
+    QueryPriority priority,
+    size_t slots,
+    const std::function<void()>& checkCancelled) {
+  auto index = indexOf(priority);
+  std::unique_lock<std::mutex> lock{mutex_};
+  auto& queue = waiting_[index];
+  auto id = nextId_++;
+  auto me = queue.insert(queue.end(), id);
+
+  auto admitted = [&] {
+    return queue.front() == id && canAdmit(priority, slots);
+  };
+  while (!admitted()) {
+    cond_.wait_for(lock, kCancelCheckPeriod);
+    if (admitted()) {
+      break;
+    }
+    lock.unlock();
+    try {
+      checkCancelled();
+    } catch (...) {
+      lock.lock();
+      queue.erase(me);
+      // Those behind us may be able to run now
+      cond_.notify_all();
+      throw;
+    }
+    lock.lock();
+  }
+
+  queue.erase(me);
+  ++running_[index];
+  // Another slot may be free for the query behind us
+  cond_.notify_all();
+  return Ticket{this, priority};
+}
+
+void QueryAdmission::release(QueryPriority priority) {
+  {
+    std::lock_guard<std::mutex> guard{mutex_};
+    --running_[indexOf(priority)];
+  }
+  cond_.notify_all();
+}
+
+QueryAdmission::Stats QueryAdmission::getStats() const {
+  std::lock_guard<std::mutex> guard{mutex_};
+  Stats stats;
+  stats.running = running_[0] + running_[1];
+  for (size_t i = 0; i < kNumQueryPriorities; ++i) {
+    stats.waiting[i] = waiting_[i].size();
+  }
+  return stats;
+}
+
+} // namespace watchman
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string_view>
+
+namespace watchman {
+
+/**
+ * How urgently a client wants its queries answered.  Interactive clients,
+ * such as editors, are waiting on the answer; batch clients, such as code
+ * indexers and CI scanners, issue large queries and can wait their turn.
+ */
+enum class QueryPriority : uint8_t {
+  Interactive,
+  Batch,
+};
+
+constexpr size_t kNumQueryPriorities = 2;
+
+const char* queryPriorityName(QueryPriority priority);
+
+/** Parses "interactive" or "batch". */
+std::optional<QueryPriority> parseQueryPriority(std::string_view name);
+
+/**
+ * Limits how many heavy queries run against a root at once, so that a
+ * burst of them from batch clients can't take all of the CPU and the view
+ * lock away from interactive ones.
+ *
+ * A query that has to wait for a slot is admitted once one frees up,
+ * interactive queries before batch ones, and otherwise in the order that
+ * they arrived.  Batch queries only ever hold slots - 1 of the slots, if
+ * there are more than one, so that an interactive query need not wait for
+ * batch queries to finish.  This class is thread safe.
+ */
+class QueryAdmission {
+ public:
+  /** Releases the slot that it holds, if any, when destroyed. */
+  class Ticket {
+   public:
+    Ticket() = default;
+    Ticket(Ticket&& other) noexcept;
+    Ticket& operator=(Ticket&& other) noexcept;
+    ~Ticket();
+
+   private:
+    friend class QueryAdmission;
+    Ticket(QueryAdmission* admission, QueryPriority priority)
+        : admission_{admission}, priority_{priority} {}
+
+    QueryAdmission* admission_{nullptr};
+    QueryPriority priority_{QueryPriority::Interactive};
+  };
+
+  /**
+   * Waits until a query of the given priority may run alongside the other
+   * heavy queries, of which at most `slots` may run at once.  Calls
+   * checkCancelled every so often while it waits, which may throw to give
+   * up the query's place in line.
+   */
+  Ticket admit(
+      QueryPriority priority,
+      size_t slots,
+      const std::function<void()>& checkCancelled);
+
+  struct Stats {
+    size_t running{0};
+    std::array<size_t, kNumQueryPriorities> waiting{};
+  };
+  Stats getStats() const;
+
+ private:
+  void release(QueryPriority priority);
+
+  // Whether the query at the head of the queue of `priority` may run
+  bool canAdmit(QueryPriority priority, size_t slots) const;
+
+  mutable std::mutex mutex_;
+  std::condition_variable cond_;
+  std::array<size_t, kNumQueryPriorities> running_{};
+  // The ids of the waiting queries, by priority, in the order they arrived
+  std::array<std::list<uint64_t>, kNumQueryPriorities> waiting_;
+  uint64_t nextId_{0};
+};
+
+} // namespace watchman
@@ -7,6 +7,12 @@
 
 #include "watchman/query/QueryContext.h"
 
+#include <folly/executors/CPUThreadPoolExecutor.h>
+#include <folly/executors/thread_factory/NamedThreadFactory.h>
+#include <folly/system/HardwareConcurrency.h>
+#include <algorithm>
+
+#include "watchman/Errors.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/eval.h"
 #include "watchman/query/parse.h"
@@ -18,6 +24,20 @@ using namespace watchman;
 namespace {
 
 constexpr size_t kMaximumRenderBatchSize = 1024;
+// How many full render batches a query may have fetching while it carries
+// on matching files, before it waits for the oldest
+constexpr size_t kMaximumRenderBatchesInFlight = 4;
+
+// Fetches the properties of full render batches.  Not the shared IO pool,
+// whose tasks the fetches themselves may block on.  Global, like the query
+// executor, so that concurrent queries share a bounded set of threads.
+folly::Executor::KeepAlive<> getRenderFetchExecutor() {
+  static folly::Executor::KeepAlive<> executor =
+      new folly::CPUThreadPoolExecutor(
+          folly::hardware_concurrency(),
+          std::make_unique<folly::NamedThreadFactory>("renderfetch"));
+  return executor;
+}
 
 std::optional<json_ref> file_result_to_json(
     const QueryFieldList& fieldList,
@@ -28,24 +48,55 @@ std::optional<json_ref> file_result_to_json(
   }
   std::unordered_map<w_string, json_ref> value;
   value.reserve(fieldList.size());
+  bool needData = false;
 
   for (auto& f : fieldList) {
     auto ele = f->make(file.get(), ctx);
     if (!ele.has_value()) {
-      // Need data to be loaded
-      return std::nullopt;
+      // Need data to be loaded.  Keep going so that the remaining fields
+      // record what they need too and a single batch fetch covers them all.
+      needData = true;
+      continue;
+    }
+    if (!needData) {
+      value.insert_or_assign(f->name, std::move(ele.value()));
     }
-    value.insert_or_assign(f->name, std::move(ele.value()));
+  }
+  if (needData) {
+    return std::nullopt;
   }
   return json_object(std::move(value));
 }
 
+// Returns the first `depth` components of the relative path dir
+w_string_piece leadingComponents(w_string_piece dir, uint32_t depth) {
+  if (depth == 0) {
+    return w_string_piece{};
+  }
+  for (size_t i = 0; i < dir.size(); ++i) {
+    if (dir[i] == '/' && --depth == 0) {
+      return w_string_piece{dir.data(), i};
+    }
+  }
+  return dir;
+}
+
 } // namespace
 
 void QueryContext::resetWholeName() {
   wholename_.reset();
 }
 
+bool QueryContext::insertDedup() {
+  auto id = file->identity();
+  if (id && !dedupIdentities.insert(*id).second) {
+    return false;
+  }
+  // The name is needed for the deduped names anyway, and catches the same
+  // file produced by a generator whose results have no identity
+  return dedup.insert(getWholeName()).second;
+}
+
 const w_string& QueryContext::getWholeName() {
   if (!wholename_) {
     wholename_ = computeWholeName(file.get());
@@ -54,6 +105,11 @@ const w_string& QueryContext::getWholeName() {
 }
 
 w_string QueryContext::computeWholeName(FileResult* file) const {
+  auto name = renderWholeName(file);
+  return w_string{name.data(), name.size()};
+}
+
+w_string_piece QueryContext::renderWholeName(FileResult* file) const {
   uint32_t name_start;
 
   if (query->relative_root) {
@@ -65,12 +121,16 @@ w_string QueryContext::computeWholeName(FileResult* file) const {
   }
 
   // Record the name relative to the root
-  auto parent = file->dirName();
+  auto parent = file->renderDirName(pathBuffer_);
   if (name_start > parent.size()) {
-    return file->baseName().asWString();
+    return file->baseName();
   }
   parent.advance(name_start);
-  return w_string::build(parent, "/", file->baseName());
+  auto baseName = file->baseName();
+  nameBuffer_.assign(parent.data(), parent.size());
+  nameBuffer_.push_back('/');
+  nameBuffer_.append(baseName.data(), baseName.size());
+  return nameBuffer_;
 }
 
 bool QueryContext::dirMatchesRelativeRoot(w_string_piece fullDirectoryPath) {
@@ -97,12 +157,50 @@ bool QueryContext::fileMatchesRelativeRoot(w_string_piece fullFilePath) {
 }
 
 bool QueryContext::fileMatchesRelativeRoot(const watchman_file* f) {
-  // getFullPath() allocates memory; avoid it with this cheap test
+  // Rendering the path isn't free; avoid it with this cheap test
   if (!query->relative_root) {
     return true;
   }
 
-  return dirMatchesRelativeRoot(f->parent->getFullPath());
+  return dirMatchesRelativeRoot(
+      f->parent->renderFullPathToChild(pathBuffer_));
+}
+
+QueryCancellation::QueryCancellation(
+    const Query& query,
+    std::chrono::steady_clock::time_point started)
+    : timeout_{query.timeout}, clientGone_{query.clientGone} {
+  if (timeout_) {
+    deadline_ = started + *timeout_;
+  }
+}
+
+std::shared_ptr<QueryCancellation> QueryCancellation::make(
+    const Query& query,
+    std::chrono::steady_clock::time_point started) {
+  if (!query.timeout && !query.clientGone) {
+    return nullptr;
+  }
+  return std::make_shared<QueryCancellation>(query, started);
+}
+
+void QueryCancellation::check() {
+  auto reason = reason_.load(std::memory_order_acquire);
+  if (reason == Reason::None) {
+    if (deadline_ && std::chrono::steady_clock::now() >= *deadline_) {
+      reason = Reason::TimedOut;
+    } else if (clientGone_ && clientGone_()) {
+      reason = Reason::ClientGone;
+    } else {
+      return;
+    }
+    reason_.store(reason, std::memory_order_release);
+  }
+  if (reason == Reason::TimedOut) {
+    QueryExecError::throwf(
+        "cancelled: timeout of {}ms exceeded", timeout_->count());
+  }
+  throw QueryExecError("cancelled: the client hung up");
 }
 
 QueryContext::QueryContext(
@@ -112,7 +210,87 @@ QueryContext::QueryContext(
     : created(std::chrono::steady_clock::now()),
       query(q),
       root(root),
-      disableFreshInstance{disableFreshInstance} {}
+      disableFreshInstance{disableFreshInstance},
+      cancellation_{QueryCancellation::make(*q, created)},
+      threadUsageAtStart_{ThreadUsage::current()} {}
+
+QueryContext::~QueryContext() {
+  // A query that failed may still have batches fetching, and they can reach
+  // the root and view through their files
+  for (auto& batch : inFlightRenderBatches_) {
+    batch.fetched.wait();
+  }
+}
+
+void QueryContext::updateUsage() {
+  auto used = ThreadUsage::current() - threadUsageAtStart_;
+  used += offThreadUsage_;
+
+  auto locked = usage.wlock();
+  locked->cpuTime = used.cpuTime;
+  locked->allocatedBytes = used.allocatedBytes;
+  locked->filesWalked = numWalked_;
+  locked->filesRendered = numResults();
+  locked->bytesEncoded = encodedResults_ ? encodedResults_->byteSize() : 0;
+}
+
+std::unique_ptr<QueryContext> QueryContext::makeShard() const {
+  auto shard =
+      std::make_unique<QueryContext>(query, root, disableFreshInstance);
+  shard->clockAtStartOfQuery = clockAtStartOfQuery;
+  shard->lastAgeOutTickValueAtStartOfQuery = lastAgeOutTickValueAtStartOfQuery;
+  shard->since = since;
+  shard->recordResultNames = recordResultNames;
+  shard->recordCandidateNames = recordCandidateNames;
+  shard->cancellation_ = cancellation_;
+  if (bserFormat_) {
+    shard->encodeResultsAsBser(*bserFormat_);
+  }
+  return shard;
+}
+
+void QueryContext::mergeShard(QueryContext& shard) {
+  resultsArray.insert(
+      resultsArray.end(),
+      std::make_move_iterator(shard.resultsArray.begin()),
+      std::make_move_iterator(shard.resultsArray.end()));
+  shard.resultsArray.clear();
+  if (encodedResults_) {
+    encodedResults_->append(std::move(*shard.encodedResults_));
+  }
+  resultNames.insert(
+      resultNames.end(),
+      std::make_move_iterator(shard.resultNames.begin()),
+      std::make_move_iterator(shard.resultNames.end()));
+  shard.resultNames.clear();
+  candidateNames.merge(shard.candidateNames);
+
+  // The shards saw disjoint files, so their names can't collide
+  dedup.merge(shard.dedup);
+  dedupIdentities.merge(shard.dedupIdentities);
+  num_deduped += shard.num_deduped;
+  namesToLog.insert(
+      namesToLog.end(),
+      std::make_move_iterator(shard.namesToLog.begin()),
+      std::make_move_iterator(shard.namesToLog.end()));
+  shard.namesToLog.clear();
+  numWalked_ += shard.numWalked_;
+  numMatched_ += shard.numMatched_;
+  offThreadUsage_ += shard.offThreadUsage_;
+
+  for (auto& file : shard.evalBatch_) {
+    evalBatch_.emplace_back(std::move(file));
+  }
+  shard.evalBatch_.clear();
+  for (auto& file : shard.renderBatch_) {
+    renderBatch_.emplace_back(std::move(file));
+  }
+  shard.renderBatch_.clear();
+  for (auto& batch : shard.inFlightRenderBatches_) {
+    inFlightRenderBatches_.emplace_back(std::move(batch));
+  }
+  shard.inFlightRenderBatches_.clear();
+}
 
 void QueryContext::addToEvalBatch(std::unique_ptr<FileResult>&& file) {
   evalBatch_.emplace_back(std::move(file));
@@ -129,6 +307,7 @@ void QueryContext::fetchEvalBatchNow() {
   if (evalBatch_.empty()) {
     return;
   }
+  checkCancelledNow();
   evalBatch_.front()->batchFetchProperties(evalBatch_);
 
   auto toProcess = std::move(evalBatch_);
@@ -141,6 +320,13 @@ void QueryContext::fetchEvalBatchNow() {
 }
 
 RenderResult QueryContext::renderResults() {
+  if (encodedResults_) {
+    RenderResult result;
+    result.encoded = std::move(*encodedResults_).finish();
+    encodedResults_.reset();
+    return result;
+  }
+
   std::optional<json_ref> templ;
   if (query->fieldList.size() > 1) {
     // build a template for the serializer
@@ -149,40 +335,348 @@ RenderResult QueryContext::renderResults() {
   return RenderResult{std::move(resultsArray), std::move(templ)};
 }
 
+void QueryContext::encodeResultsAsBser(PduFormat format) {
+  std::optional<json_ref> templ;
+  if (query->fieldList.size() > 1) {
+    templ = field_list_to_json_name_array(query->fieldList);
+  }
+  bserFormat_ = format;
+  encodedResults_ = std::make_unique<BserArrayEncoder>(
+      format.type == is_bser_v2 ? 2 : 1, format.capabilities, templ);
+}
+
+size_t QueryContext::numResults() const {
+  return resultsArray.size() + (encodedResults_ ? encodedResults_->size() : 0);
+}
+
+bool QueryContext::encodeResult(FileResult* file) {
+  auto& out = *encodedResults_;
+  out.beginElement();
+  bool needData = false;
+  for (auto& f : query->fieldList) {
+    // Keep going when data is missing so that the remaining fields record
+    // what they need too, as in file_result_to_json()
+    if (f->encode) {
+      needData |= !f->encode(file, this, out);
+      continue;
+    }
+    auto value = f->make(file, this);
+    if (!value.has_value()) {
+      needData = true;
+    } else if (!needData) {
+      out.appendValue(*value);
+    }
+  }
+  if (needData) {
+    out.abortElement();
+    return false;
+  }
+  out.endElement();
+  return true;
+}
+
+bool QueryContext::limitReached() const {
+  return query->limit && numMatched_ >= *query->limit;
+}
+
 void QueryContext::maybeRender(std::unique_ptr<FileResult>&& file) {
+  if (query->limit) {
+    // Files that were deferred for fetching may match after the
+    // generators have stopped; any beyond the limit are dropped.
+    if (numMatched_ >= *query->limit) {
+      return;
+    }
+    ++numMatched_;
+    if (query->existsOnly) {
+      return;
+    }
+  }
+
+  if (query->order) {
+    addToOrder(std::move(file));
+    return;
+  }
+
+  if (query->aggregate) {
+    if (!aggregateResult(file.get())) {
+      addToRenderBatch(std::move(file));
+    }
+    return;
+  }
+
+  if (encodedResults_) {
+    if (!encodeResult(file.get())) {
+      addToRenderBatch(std::move(file));
+    }
+    return;
+  }
+
   auto maybeRendered = file_result_to_json(query->fieldList, file, this);
   if (maybeRendered.has_value()) {
-    resultsArray.push_back(std::move(maybeRendered.value()));
+    addResult(std::move(maybeRendered.value()), file.get());
     return;
   }
 
   addToRenderBatch(std::move(file));
 }
 
+bool QueryContext::aggregateResult(FileResult* file) {
+  const auto& agg = *query->aggregate;
+  int64_t size = 0;
+  if (agg.sumSize) {
+    auto fileSize = file->size();
+    if (!fileSize.has_value()) {
+      return false;
+    }
+    size = *fileSize;
+  }
+
+  w_string_piece name;
+  std::optional<w_string> suffix;
+  switch (agg.groupBy) {
+    case QueryAggregate::None:
+      break;
+    case QueryAggregate::DirName:
+      name = renderWholeName(file).dirName();
+      if (agg.depth) {
+        name = leadingComponents(name, *agg.depth);
+      }
+      break;
+    case QueryAggregate::Suffix:
+      suffix = file->baseName().asLowerCaseSuffix();
+      if (suffix) {
+        name = suffix->piece();
+      }
+      break;
+  }
+
+  if (!lastAggregateKey_ || lastAggregateKey_->piece() != name) {
+    auto it = aggregates.try_emplace(name.asWString()).first;
+    lastAggregateKey_ = &it->first;
+    lastAggregateGroup_ = &it->second;
+  }
+  lastAggregateGroup_->count++;
+  lastAggregateGroup_->size += size;
+  return true;
+}
+
+json_ref QueryContext::renderAggregates() const {
+  auto render = [&](const AggregateGroup& group) {
+    auto summary = json_object({{"count", json_integer(group.count)}});
+    if (query->aggregate->sumSize) {
+      summary.set("size", json_integer(group.size));
+    }
+    return summary;
+  };
+
+  if (query->aggregate->groupBy == QueryAggregate::None) {
+    return render(
+        aggregates.empty() ? AggregateGroup{} : aggregates.begin()->second);
+  }
+  std::unordered_map<w_string, json_ref> groups;
+  groups.reserve(aggregates.size());
+  for (const auto& [name, group] : aggregates) {
+    groups.emplace(name, render(group));
+  }
+  return json_object(std::move(groups));
+}
+
+void QueryContext::addToOrder(std::unique_ptr<FileResult>&& file) {
+  QueryOrderKey key;
+  if (query->order->field == QueryOrder::MTime) {
+    auto mtime = file->modifiedTime();
+    if (!mtime.has_value()) {
+      orderBatch_.emplace_back(std::move(file));
+      if (orderBatch_.size() >= kMaximumRenderBatchSize) {
+        auto toOrder = std::move(orderBatch_);
+        toOrder.front()->batchFetchProperties(toOrder);
+        for (auto& f : toOrder) {
+          addToOrder(std::move(f));
+        }
+      }
+      return;
+    }
+    key.mtime = *mtime;
+  }
+  key.name = computeWholeName(file.get());
+  insertOrdered(std::move(key), std::move(file));
+}
+
+void QueryContext::insertOrdered(
+    QueryOrderKey key,
+    std::unique_ptr<FileResult>&& file) {
+  const auto& order = *query->order;
+  if (query->pageCursor && !order.before(query->pageCursor->after, key)) {
+    // On or before a page that the client already has
+    return;
+  }
+
+  ordered_.emplace_back(std::move(key), std::move(file));
+  if (!query->pageSize) {
+    // Everything is rendered, so there is nothing to select; the files
+    // are sorted once they have all been seen
+    return;
+  }
+
+  auto cmp = [&](const auto& a, const auto& b) {
+    return order.before(a.first, b.first);
+  };
+  std::push_heap(ordered_.begin(), ordered_.end(), cmp);
+  if (ordered_.size() > *query->pageSize + 1) {
+    std::pop_heap(ordered_.begin(), ordered_.end(), cmp);
+    ordered_.pop_back();
+  }
+}
+
+void QueryContext::renderOrderedResults() {
+  if (!query->order) {
+    return;
+  }
+  while (!orderBatch_.empty()) {
+    auto toOrder = std::move(orderBatch_);
+    toOrder.front()->batchFetchProperties(toOrder);
+    for (auto& file : toOrder) {
+      addToOrder(std::move(file));
+    }
+  }
+
+  const auto& order = *query->order;
+  auto cmp = [&](const auto& a, const auto& b) {
+    return order.before(a.first, b.first);
+  };
+  std::sort(ordered_.begin(), ordered_.end(), cmp);
+  if (query->pageSize && ordered_.size() > *query->pageSize) {
+    ordered_.resize(*query->pageSize);
+    QueryPageCursor next;
+    // Every page carries the clock of the first, so that a since query
+    // from it covers whatever changed while the client was paging
+    next.clock = query->pageCursor
+        ? query->pageCursor->clock
+        : clockAtStartOfQuery.position().toClockString();
+    next.after = ordered_.back().first;
+    nextPageToken = next.toToken(order);
+  }
+
+  // Rendering may need data to be loaded, and files deferred to the render
+  // batch would come out of order.  So render the page in passes, fetching
+  // what the files that couldn't be rendered need between them, and only
+  // add the results once they have all been rendered.
+  std::vector<std::optional<json_ref>> rendered(ordered_.size());
+  while (true) {
+    std::vector<size_t> missing;
+    for (size_t i = 0; i < ordered_.size(); ++i) {
+      if (!rendered[i]) {
+        rendered[i] =
+            file_result_to_json(query->fieldList, ordered_[i].second, this);
+        if (!rendered[i]) {
+          missing.push_back(i);
+        }
+      }
+    }
+    if (missing.empty()) {
+      break;
+    }
+    std::vector<std::unique_ptr<FileResult>> batch;
+    batch.reserve(missing.size());
+    for (auto i : missing) {
+      batch.emplace_back(std::move(ordered_[i].second));
+    }
+    batch.front()->batchFetchProperties(batch);
+    for (size_t j = 0; j < missing.size(); ++j) {
+      ordered_[missing[j]].second = std::move(batch[j]);
+    }
+  }
+
+  for (size_t i = 0; i < ordered_.size(); ++i) {
+    addResult(std::move(*rendered[i]), ordered_[i].second.get());
+  }
+  ordered_.clear();
+}
+
+void QueryContext::addResult(json_ref&& rendered, FileResult* file) {
+  resultsArray.push_back(std::move(rendered));
+  if (recordResultNames) {
+    resultNames.push_back(computeWholeName(file));
+  }
+}
+
 void QueryContext::addToRenderBatch(std::unique_ptr<FileResult>&& file) {
   renderBatch_.emplace_back(std::move(file));
   // TODO: maybe allow passing this number in via the query?
   if (renderBatch_.size() >= kMaximumRenderBatchSize) {
-    fetchRenderBatchNow();
+    dispatchRenderBatch();
+  }
+}
+
+void QueryContext::dispatchRenderBatch() {
+  checkCancelledNow();
+  auto files = std::make_shared<std::vector<std::unique_ptr<FileResult>>>(
+      std::move(renderBatch_));
+  renderBatch_.clear();
+  auto fetched = folly::via(getRenderFetchExecutor(), [files] {
+    files->front()->batchFetchProperties(*files);
+  });
+  inFlightRenderBatches_.push_back({std::move(files), std::move(fetched)});
+  renderInFlightBatches(kMaximumRenderBatchesInFlight);
+}
+
+void QueryContext::renderInFlightBatches(size_t maxInFlight) {
+  // Render whichever batches have been fetched, in the order they finished
+  // rather than the order they were dispatched
+  for (auto it = inFlightRenderBatches_.begin();
+       it != inFlightRenderBatches_.end();) {
+    if (!it->fetched.isReady()) {
+      ++it;
+      continue;
+    }
+    auto batch = std::move(*it);
+    it = inFlightRenderBatches_.erase(it);
+    std::move(batch.fetched).get();
+    renderFetchedBatch(*batch.files);
+  }
+  while (inFlightRenderBatches_.size() > maxInFlight) {
+    checkCancelledNow();
+    auto batch = std::move(inFlightRenderBatches_.front());
+    inFlightRenderBatches_.pop_front();
+    std::move(batch.fetched).get();
+    renderFetchedBatch(*batch.files);
   }
 }
 
 bool QueryContext::fetchRenderBatchNow() {
+  renderInFlightBatches(0);
   if (renderBatch_.empty()) {
     return true;
   }
+  checkCancelledNow();
   renderBatch_.front()->batchFetchProperties(renderBatch_);
 
   auto toProcess = std::move(renderBatch_);
+  renderBatch_.clear();
+  renderFetchedBatch(toProcess);
+  return renderBatch_.empty();
+}
 
-  for (auto& file : toProcess) {
+void QueryContext::renderFetchedBatch(
+    std::vector<std::unique_ptr<FileResult>>& files) {
+  for (auto& file : files) {
+    if (query->aggregate) {
+      if (!aggregateResult(file.get())) {
+        renderBatch_.emplace_back(std::move(file));
+      }
+      continue;
+    }
+    if (encodedResults_) {
+      if (!encodeResult(file.get())) {
+        renderBatch_.emplace_back(std::move(file));
+      }
+      continue;
+    }
     auto maybeRendered = file_result_to_json(query->fieldList, file, this);
     if (maybeRendered.has_value()) {
-      resultsArray.push_back(std::move(maybeRendered.value()));
+      addResult(std::move(maybeRendered.value()), file.get());
     } else {
       renderBatch_.emplace_back(std::move(file));
     }
   }
-
-  return renderBatch_.empty();
 }
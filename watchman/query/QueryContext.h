@@ -7,9 +7,20 @@
 
 #pragma once
 
+#include <folly/Synchronized.h>
 #include <folly/stop_watch.h>
+#include <folly/futures/Future.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <string>
 #include <unordered_set>
 #include "watchman/Clock.h"
+#include "watchman/PDU.h"
+#include "watchman/ThreadUsage.h"
+#include "watchman/bser.h"
+#include "watchman/query/FileResult.h"
+#include "watchman/query/Query.h"
 #include "watchman/query/QueryExpr.h"
 #include "watchman/query/QueryResult.h"
 
@@ -24,12 +35,49 @@ class Root;
 enum class QueryContextState {
   NotStarted,
   WaitingForCookieSync,
+  WaitingForAdmission,
   WaitingForViewLock,
   Generating,
   Rendering,
   Completed,
 };
 
+/**
+ * Decides when a query's results are no longer wanted: once its timeout has
+ * passed, or once the client that asked for them has hung up.  Shared by the
+ * shards of a query, so that they all stop once one of them notices.
+ */
+class QueryCancellation {
+ public:
+  QueryCancellation(
+      const Query& query,
+      std::chrono::steady_clock::time_point started);
+
+  /**
+   * Returns a cancellation for the query, or nullptr if it has neither a
+   * timeout nor a client to watch.
+   */
+  static std::shared_ptr<QueryCancellation> make(
+      const Query& query,
+      std::chrono::steady_clock::time_point started);
+
+  /**
+   * Throws QueryExecError if the query has been cancelled.  This reads the
+   * clock and may poll the client's connection, so callers should only
+   * check every so often.
+   */
+  void check();
+
+ private:
+  std::optional<std::chrono::milliseconds> timeout_;
+  std::optional<std::chrono::steady_clock::time_point> deadline_;
+  std::function<bool()> clientGone_;
+
+  enum class Reason : uint8_t { None, TimedOut, ClientGone };
+  // Why the query was cancelled, once it has been
+  std::atomic<Reason> reason_{Reason::None};
+};
+
 // Holds state for the execution of a query
 struct QueryContext : QueryContextBase {
   std::chrono::time_point<std::chrono::steady_clock> created;
@@ -49,9 +97,32 @@ struct QueryContext : QueryContextBase {
     state = QueryContextState::Generating;
   }
 
+  // The resources used by the query so far, as of the last call to
+  // updateUsage(), so that root status can report them while it runs.
+  folly::Synchronized<QueryResourceUsage> usage;
+
+  /**
+   * Brings `usage` up to date with the resources used by the calling
+   * thread since this context was created, and those that merged shards
+   * used on other threads.  Must be called on the thread that created
+   * this context.
+   */
+  void updateUsage();
+
+  /**
+   * Records resources that were used evaluating this context on a thread
+   * other than the one that created it.
+   */
+  void addOffThreadUsage(const ThreadUsage& used) {
+    offThreadUsage_ += used;
+  }
+
   const Query* query;
   std::shared_ptr<Root> root;
   std::unique_ptr<FileResult> file;
+  // The last file that w_query_process_file() neither deferred nor kept,
+  // for the generator to reuse rather than allocate another
+  std::unique_ptr<FileResult> spareFile;
   QuerySince since;
 
   // Rendered results
@@ -60,6 +131,10 @@ struct QueryContext : QueryContextBase {
   // When deduping the results, set<wholename> of
   // the files held in results
   std::unordered_set<w_string> dedup;
+  // And the identities of those that have one, which are checked first so
+  // that a duplicate's name needn't be computed
+  std::unordered_set<FileResult::Identity, FileResult::Identity::Hash>
+      dedupIdentities;
 
   // When unconditional_log_if_results_contain_file_prefixes is set
   // and one of those prefixes matches a file in the generated results,
@@ -70,19 +145,62 @@ struct QueryContext : QueryContextBase {
   // How many times we suppressed a result due to dedup checking
   uint32_t num_deduped{0};
 
+  // How the view ran each of the generators, in the order that they ran
+  std::vector<GeneratorPlan> plan;
+
+  void recordPlan(
+      const char* generator,
+      const char* access,
+      std::optional<int64_t> estimate = std::nullopt) {
+    plan.push_back(GeneratorPlan{generator, access, estimate});
+  }
+
   // Disable fresh instance queries
   bool disableFreshInstance{false};
 
+  // Used by the query result cache.  When recordResultNames is set, the
+  // wholename of each entry of resultsArray is appended to resultNames in
+  // step with it.  When recordCandidateNames is set, the wholename of each
+  // file passed to w_query_process_file() is added to candidateNames.
+  bool recordResultNames{false};
+  bool recordCandidateNames{false};
+  std::vector<w_string> resultNames;
+  std::unordered_set<w_string> candidateNames;
+
   QueryContext(
       const Query* q,
       const std::shared_ptr<Root>& root,
       bool disableFreshInstance);
+  ~QueryContext() override;
   QueryContext(const QueryContext&) = delete;
   QueryContext& operator=(const QueryContext&) = delete;
 
   // Increment numWalked_ by the specified amount
   inline void bumpNumWalked(int64_t amount = 1) {
     numWalked_ += amount;
+    checkCancelled();
+  }
+
+  /**
+   * Throws QueryExecError if the query's results are no longer wanted.
+   * Cheap enough to call for every file: the query's cancellation is only
+   * consulted every kCancelCheckInterval calls.
+   */
+  inline void checkCancelled() {
+    if (cancellation_ && --cancelCheckCountdown_ == 0) {
+      cancelCheckCountdown_ = kCancelCheckInterval;
+      cancellation_->check();
+    }
+  }
+
+  /**
+   * Like checkCancelled(), but consults the cancellation right away.  For
+   * use before steps that can take a while, such as batch fetches.
+   */
+  void checkCancelledNow() {
+    if (cancellation_) {
+      cancellation_->check();
+    }
   }
 
   int64_t getNumWalked() const {
@@ -91,6 +209,12 @@ struct QueryContext : QueryContextBase {
 
   void resetWholeName();
 
+  /**
+   * Adds the current file to the dedup sets.  Returns false if it was
+   * already there.
+   */
+  bool insertDedup();
+
   /**
    * Returns a shared reference to the wholename
    * of the file.  The caller must not delref
@@ -122,13 +246,78 @@ struct QueryContext : QueryContextBase {
   void addToRenderBatch(std::unique_ptr<FileResult>&& file);
 
   // Perform a batch load of the items in the render batch,
-  // and attempt to render those items again.
+  // and attempt to render those items again.  Waits for and renders
+  // the batches that addToRenderBatch() is still fetching first.
   // Returns true if the render batch is empty after rendering
   // the items, false if still more data is needed.
   bool fetchRenderBatchNow();
 
   w_string computeWholeName(FileResult* file) const;
 
+  /**
+   * Like computeWholeName(), but renders the name into a buffer owned by
+   * this context.  The returned piece is valid until the next call.
+   */
+  w_string_piece renderWholeName(FileResult* file) const;
+
+  /**
+   * Encode the results in the specified BSER format as they are rendered,
+   * rather than building json values for them in resultsArray.
+   * renderResults() then returns them as a single pre-encoded value.
+   */
+  void encodeResultsAsBser(PduFormat format);
+
+  /** The number of results rendered so far. */
+  size_t numResults() const;
+
+  /**
+   * Whether as many files have matched as the query's limit allows, so
+   * that generators can stop producing candidates.  Always false for
+   * queries without a limit.
+   */
+  bool limitReached() const;
+
+  /**
+   * For queries with an order_by, sorts the files that matched and renders
+   * those of the requested page into resultsArray, in order.  Sets
+   * nextPageToken if more files follow the page.  Must be called once the
+   * eval batch has been fetched, before the render batch is.
+   */
+  void renderOrderedResults();
+
+  struct AggregateGroup {
+    int64_t count{0};
+    int64_t size{0};
+  };
+  // For queries with an aggregate, the groups that matching files were
+  // counted into, keyed by name.  Without a group_by there is a single
+  // group with an empty name.
+  std::unordered_map<w_string, AggregateGroup> aggregates;
+
+  /** Returns the summary of `aggregates` for the query's response. */
+  json_ref renderAggregates() const;
+
+  // Set by renderOrderedResults() when the query has a page_size and there
+  // are more files after this page
+  std::optional<w_string> nextPageToken;
+
+  /**
+   * Returns a context for evaluating a subset of this query's candidates on
+   * another thread.  It shares the query, root and the since/clock state of
+   * this context but has its own results, dedup set and batches.
+   * The subsets given to the shards of a query must be disjoint.
+   */
+  std::unique_ptr<QueryContext> makeShard() const;
+
+  /**
+   * Moves the results and counters of a context returned by makeShard()
+   * into this one, after the results that this context already holds.
+   * Files that the shard deferred for batch fetching are added to our
+   * batches, and the shard's in-flight render batches to ours, to be
+   * fetched by fetchEvalBatchNow() and fetchRenderBatchNow() as usual.
+   */
+  void mergeShard(QueryContext& shard);
+
   // Returns true if the filename associated with `f` matches
   // the relative_root constraint set on the query.
   // Delegates to dirMatchesRelativeRoot().
@@ -147,11 +336,54 @@ struct QueryContext : QueryContextBase {
   bool dirMatchesRelativeRoot(w_string_piece fullDirectoryPath);
 
  private:
+  void addResult(json_ref&& rendered, FileResult* file);
+
+  // Renders file as the next element of encodedResults_.  Returns false if
+  // data needs to be loaded first.
+  bool encodeResult(FileResult* file);
+
+  // Counts file into its group in aggregates.  Returns false if data needs
+  // to be loaded first.
+  bool aggregateResult(FileResult* file);
+
+  // The group that aggregateResult() last counted a file into; files
+  // usually arrive a directory at a time, so this saves most lookups
+  const w_string* lastAggregateKey_{nullptr};
+  AggregateGroup* lastAggregateGroup_{nullptr};
+
+  // Adds a file that matched a query with an order_by to ordered_, or to
+  // orderBatch_ if its sort key needs data to be loaded first
+  void addToOrder(std::unique_ptr<FileResult>&& file);
+  void insertOrdered(QueryOrderKey key, std::unique_ptr<FileResult>&& file);
+
+  // Set by encodeResultsAsBser()
+  std::optional<PduFormat> bserFormat_;
+  std::unique_ptr<BserArrayEncoder> encodedResults_;
+
   std::optional<w_string> wholename_;
 
+  // Scratch space for rendering dir names while computing wholenames and
+  // checking the relative_root, so that doing so doesn't allocate per file.
+  mutable std::string pathBuffer_;
+  // Scratch space for renderWholeName()
+  mutable std::string nameBuffer_;
+
   // Number of files considered as part of running this query
   int64_t numWalked_{0};
 
+  // Null if the query can't be cancelled.  Shared with our shards.
+  std::shared_ptr<QueryCancellation> cancellation_;
+  static constexpr uint32_t kCancelCheckInterval = 256;
+  uint32_t cancelCheckCountdown_{kCancelCheckInterval};
+
+  // Number of files passed to maybeRender(), when the query has a limit
+  size_t numMatched_{0};
+
+  // The calling thread's usage when this context was created, and the
+  // usage of other threads since; see updateUsage()
+  ThreadUsage threadUsageAtStart_;
+  ThreadUsage offThreadUsage_;
+
   // Files for which we encountered NeedMoreData and that we
   // will re-evaluate once we have enough of them accumulated
   // to batch fetch the required data
@@ -162,6 +394,31 @@ struct QueryContext : QueryContextBase {
   // expression and are just pending data to be loaded
   // for rendering the result fields.
   std::vector<std::unique_ptr<FileResult>> renderBatch_;
+
+  // Full render batches whose properties are being fetched on another
+  // thread while we carry on matching files
+  struct InFlightRenderBatch {
+    std::shared_ptr<std::vector<std::unique_ptr<FileResult>>> files;
+    folly::Future<folly::Unit> fetched;
+  };
+  std::deque<InFlightRenderBatch> inFlightRenderBatches_;
+
+  // Starts fetching the full render batch on another thread
+  void dispatchRenderBatch();
+  // Renders the in-flight batches that have been fetched, and then waits
+  // for the oldest until no more than maxInFlight remain
+  void renderInFlightBatches(size_t maxInFlight);
+  // Renders files whose properties were fetched, returning those that
+  // still need more to the render batch
+  void renderFetchedBatch(std::vector<std::unique_ptr<FileResult>>& files);
+
+  // For queries with an order_by, the files that matched, held until they
+  // can be sorted.  With a page_size this is a max-heap of the first
+  // page_size + 1 files in the order, the extra one telling us whether
+  // there's another page.
+  std::vector<std::pair<QueryOrderKey, std::unique_ptr<FileResult>>> ordered_;
+  // Matched files whose mtime needs to be loaded before they can be ordered
+  std::vector<std::unique_ptr<FileResult>> orderBatch_;
 };
 
 } // namespace watchman
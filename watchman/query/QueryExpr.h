@@ -10,6 +10,7 @@
 #include <optional>
 #include <vector>
 #include "watchman/Clock.h"
+#include "watchman/FileColumns.h"
 #include "watchman/fs/FileDescriptor.h"
 #include "watchman/watchman_string.h"
 
@@ -43,11 +44,39 @@ enum AggregateOp {
   AllOf,
 };
 
+/**
+ * A rough ranking of the cost of evaluating a term against one file.
+ * The terms of allof and anyof are evaluated cheapest first, so that terms
+ * which only look at the basename get to settle the result before terms that
+ * need to render the wholename, run a pattern or fetch metadata.
+ */
+enum class EvaluationCost {
+  // The result doesn't depend on the file
+  Constant,
+  // Compares the basename
+  BaseName,
+  // Needs the file type, which is usually known without a stat
+  FileType,
+  // Matches a pattern against the basename
+  BaseNamePattern,
+  // Needs the wholename, which is rendered on demand
+  WholeName,
+  // Needs stat information, clocks or other data that may need fetching
+  Metadata,
+};
+
 class QueryExpr {
  public:
   virtual ~QueryExpr() = default;
   virtual EvaluateResult evaluate(QueryContextBase* ctx, FileResult* file) = 0;
 
+  /**
+   * Returns the cost of evaluating this expression, used to order the terms
+   * of allof and anyof.  Reordering is only sound because evaluate() has no
+   * side effects beyond recording which FileResult properties it needs.
+   */
+  virtual EvaluationCost evaluationCost() const = 0;
+
   // If OTHER can be aggregated with THIS, returns a new expression instance
   // representing the combined state.  Op provides information on the containing
   // query and can be used to determine how aggregation is done.
@@ -77,6 +106,23 @@ class QueryExpr {
    */
   virtual std::optional<std::vector<std::string>> computeGlobUpperBound(
       CaseSensitivity) const = 0;
+
+  /**
+   * Tightens filter so that it holds for every file that this expression
+   * may match, as far as the columns can tell.  Expressions that the
+   * columns can't bound, which is most of them, leave it be.
+   */
+  virtual void narrowColumnFilter(QueryContextBase*, ColumnFilter&) const {}
+
+  /**
+   * Returns the wholenames, case sensitively, that are the only ones that
+   * this expression may match, so that they can be looked up rather than
+   * searched for.  As with computeGlobUpperBound, nullopt means that it may
+   * match other names, and an empty vector that it can't match any.
+   */
+  virtual std::optional<std::vector<w_string>> computeWholeNames() const {
+    return std::nullopt;
+  }
 };
 
 } // namespace watchman
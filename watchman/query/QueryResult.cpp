@@ -10,6 +10,9 @@
 namespace watchman {
 
 json_ref RenderResult::toJson() && {
+  if (encoded) {
+    return std::move(*encoded);
+  }
   auto arr = json_array(std::move(results));
   if (templ) {
     json_array_set_template_new(arr, std::move(*templ));
@@ -17,13 +20,40 @@ json_ref RenderResult::toJson() && {
   return arr;
 }
 
+json_ref QueryResourceUsage::render() const {
+  return json_object({
+      {"cpu_time_us", json_integer(cpuTime.count())},
+      {"allocated_bytes", json_integer(allocatedBytes)},
+      {"files_walked", json_integer(filesWalked)},
+      {"files_rendered", json_integer(filesRendered)},
+      {"bytes_encoded", json_integer(bytesEncoded)},
+  });
+}
+
+json_ref GeneratorPlan::render() const {
+  auto result = json_object({
+      {"generator", typed_string_to_json(generator)},
+      {"access", typed_string_to_json(access)},
+  });
+  if (estimate) {
+    result.set("estimate", json_integer(*estimate));
+  }
+  return result;
+}
+
 json_ref QueryDebugInfo::render() const {
   std::vector<json_ref> arr;
   for (auto& fn : cookieFileNames) {
     arr.push_back(w_string_to_json(fn));
   }
+  std::vector<json_ref> steps;
+  for (auto& step : plan) {
+    steps.push_back(step.render());
+  }
   return json_object({
       {"cookie_files", json_array(std::move(arr))},
+      {"usage", usage.render()},
+      {"plan", json_array(std::move(steps))},
   });
 }
 
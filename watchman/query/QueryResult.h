@@ -7,6 +7,8 @@
 
 #pragma once
 
+#include <chrono>
+#include <optional>
 #include <unordered_set>
 #include <vector>
 #include "watchman/Clock.h"
@@ -15,8 +17,44 @@
 
 namespace watchman {
 
+/**
+ * What executing a query cost the daemon, so that load can be attributed to
+ * the clients issuing the queries.
+ */
+struct QueryResourceUsage {
+  // CPU time of the executing threads, including any query threads that
+  // generated candidates in parallel
+  std::chrono::microseconds cpuTime{0};
+  // Bytes allocated by those threads; 0 unless jemalloc is in use
+  uint64_t allocatedBytes{0};
+  int64_t filesWalked{0};
+  int64_t filesRendered{0};
+  // Size of the results when they were encoded as BSER while rendering
+  // them, and 0 otherwise
+  int64_t bytesEncoded{0};
+
+  json_ref render() const;
+};
+
+/**
+ * How the view produced the candidates of one of a query's generators.
+ */
+struct GeneratorPlan {
+  // "since", "suffix", "glob", "path" or "all"
+  const char* generator;
+  // The index or walk that the view chose, such as "change_log"
+  const char* access;
+  // The number of files that the view expected that to visit, if it
+  // estimated it
+  std::optional<int64_t> estimate;
+
+  json_ref render() const;
+};
+
 struct QueryDebugInfo {
   std::vector<w_string> cookieFileNames;
+  QueryResourceUsage usage;
+  std::vector<GeneratorPlan> plan;
 
   json_ref render() const;
 };
@@ -24,6 +62,9 @@ struct QueryDebugInfo {
 struct RenderResult {
   std::vector<json_ref> results;
   std::optional<json_ref> templ;
+  // Set instead of results when the query encoded its results as BSER
+  // while rendering them; see Query::bserResultFormat.
+  std::optional<json_ref> encoded;
 
   json_ref toJson() &&;
 };
@@ -37,6 +78,12 @@ struct QueryResult {
   uint32_t stateTransCountAtStartOfQuery;
   std::optional<json_ref> savedStateInfo;
   QueryDebugInfo debugInfo;
+  // Only populated for exists_only queries: whether any file matched
+  std::optional<bool> exists;
+  // Only populated for queries with a page_size, when there is another page
+  std::optional<w_string> nextPageToken;
+  // Only populated for queries with an aggregate: the summary of the groups
+  std::optional<json_ref> aggregate;
 };
 
 } // namespace watchman
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/QueryResultCache.h"
+#include "watchman/query/Query.h"
+
+namespace watchman {
+
+namespace {
+// Query options that control how the query waits, is logged or is sent,
+// but not which results it produces
+constexpr const char* kIgnoredKeys[] = {
+    "request_id",
+    "sync_timeout",
+    "lock_timeout",
+    "timeout",
+    "settle_period",
+    "settle_timeout",
+    "stream",
+    "stream_batch_size",
+    "shared_memory",
+};
+
+// Subscription options that control when results are sent, but not which
+// files match since a given clock.  The fields are rendered separately for
+// each distinct field list; see SharedSubscriptionResults.
+constexpr const char* kIgnoredSubscriptionKeys[] = {
+    "since",
+    "defer",
+    "drop",
+    "defer_vcs",
+    "durable",
+    "fields",
+};
+
+w_string normalizedSpec(const json_ref& querySpec, bool isSubscription) {
+  auto spec = querySpec.object();
+  for (auto key : kIgnoredKeys) {
+    spec.erase(w_string{key});
+  }
+  if (isSubscription) {
+    for (auto key : kIgnoredSubscriptionKeys) {
+      spec.erase(w_string{key});
+    }
+  }
+  return w_string{json_dumps(
+      json_object(std::move(spec)), JSON_COMPACT | JSON_SORT_KEYS)};
+}
+} // namespace
+
+std::optional<w_string> QueryResultCache::keyFor(const Query* query) {
+  if (!query->query_spec || !query->query_spec->isObject()) {
+    return std::nullopt;
+  }
+  // Only fresh instance queries of all files are cached: since queries
+  // already only walk the files that changed, and the other generators
+  // would need their own change tracking.
+  if (query->since_spec || query->paths || query->glob_tree ||
+      query->empty_on_fresh_instance || query->omit_changed_files ||
+      query->bench_iterations > 0) {
+    return std::nullopt;
+  }
+
+  return normalizedSpec(*query->query_spec, false);
+}
+
+std::optional<w_string> QueryResultCache::subscriptionKeyFor(
+    const Query* query) {
+  if (!query->query_spec || !query->query_spec->isObject() ||
+      query->bench_iterations > 0) {
+    return std::nullopt;
+  }
+  return normalizedSpec(*query->query_spec, true);
+}
+
+std::shared_ptr<const QueryResultCache::Entry> QueryResultCache::lookup(
+    const w_string& key,
+    ClockRoot rootNumber,
+    ClockTicks lastAgeOutTickValue) {
+  auto state = state_.wlock();
+  auto it = state->entries.find(key);
+  if (it == state->entries.end() ||
+      it->second.first->position.rootNumber != rootNumber ||
+      it->second.first->position.ticks < lastAgeOutTickValue) {
+    ++state->misses;
+    return nullptr;
+  }
+  ++state->hits;
+  return it->second.first;
+}
+
+void QueryResultCache::store(
+    const w_string& key,
+    std::shared_ptr<const Entry> entry,
+    size_t maxEntries) {
+  auto state = state_.wlock();
+  auto it = state->entries.find(key);
+  if (it != state->entries.end()) {
+    state->order.erase(it->second.second);
+    state->entries.erase(it);
+  }
+  state->order.push_front(key);
+  state->entries.emplace(
+      key, std::make_pair(std::move(entry), state->order.begin()));
+
+  while (state->entries.size() > maxEntries) {
+    state->entries.erase(state->order.back());
+    state->order.pop_back();
+  }
+}
+
+size_t QueryResultCache::clear() {
+  auto state = state_.wlock();
+  auto cleared = state->entries.size();
+  state->entries.clear();
+  state->order.clear();
+  return cleared;
+}
+
+QueryResultCache::Stats QueryResultCache::getStats() const {
+  auto state = state_.rlock();
+  Stats stats;
+  stats.hits = state->hits;
+  stats.misses = state->misses;
+  stats.entries = state->entries.size();
+  return stats;
+}
+
+} // namespace watchman
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/Synchronized.h>
+#include <list>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+#include "watchman/Clock.h"
+#include "watchman/thirdparty/jansson/jansson.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+struct Query;
+
+/**
+ * Remembers the results of recent fresh instance queries, so that when the
+ * same query is repeated only the files that changed since the cached
+ * results were produced need to be evaluated again.
+ *
+ * Entries are immutable once stored; a query that brings an entry up to
+ * date stores a new one in its place.  This class is thread safe.
+ */
+class QueryResultCache {
+ public:
+  struct Entry {
+    // The clock at the start of the query that produced these results
+    ClockPosition position;
+    // The wholenames and rendered results of the matching files, in the
+    // newest first order that the all files generator produces them
+    std::vector<std::pair<w_string, json_ref>> results;
+  };
+
+  struct Stats {
+    size_t hits{0};
+    size_t misses{0};
+    size_t entries{0};
+  };
+
+  /**
+   * Returns the key under which the results of query may be cached, or
+   * nullopt if the query can't be answered from the cache.  Options that
+   * affect how the query is run rather than what it returns, such as
+   * sync_timeout and request_id, are not part of the key.
+   */
+  static std::optional<w_string> keyFor(const Query* query);
+
+  /**
+   * Returns a key that is equal for subscription queries that match the
+   * same files when run since the same clock.  Like keyFor(), options that
+   * don't affect which files match, including the subscription's defer and
+   * drop policies, its initial since clock and its fields, are not part of
+   * the key.
+   */
+  static std::optional<w_string> subscriptionKeyFor(const Query* query);
+
+  /**
+   * Returns the entry cached for key, counting a hit, or else nullptr,
+   * counting a miss.  An entry is only usable if it was produced from the
+   * same view instance (rootNumber) and no files have been aged out of the
+   * view since, as the removal of those files can't be observed by walking
+   * the changed files.
+   */
+  std::shared_ptr<const Entry> lookup(
+      const w_string& key,
+      ClockRoot rootNumber,
+      ClockTicks lastAgeOutTickValue);
+
+  /**
+   * Stores entry for key, evicting the least recently stored entries beyond
+   * maxEntries.
+   */
+  void store(
+      const w_string& key,
+      std::shared_ptr<const Entry> entry,
+      size_t maxEntries);
+
+  /**
+   * Drops every entry, returning how many there were.  The next run of
+   * each query is evaluated in full.
+   */
+  size_t clear();
+
+  Stats getStats() const;
+
+ private:
+  struct State {
+    // Most recently stored first
+    std::list<w_string> order;
+    std::unordered_map<
+        w_string,
+        std::pair<std::shared_ptr<const Entry>, std::list<w_string>::iterator>>
+        entries;
+    size_t hits{0};
+    size_t misses{0};
+  };
+  folly::Synchronized<State> state_;
+};
+
+} // namespace watchman
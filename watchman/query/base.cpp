@@ -9,6 +9,7 @@
 #include "watchman/query/QueryExpr.h"
 #include "watchman/query/TermRegistry.h"
 
+#include <algorithm>
 #include <memory>
 #include <queue>
 #include <unordered_set>
@@ -41,9 +42,17 @@ class NotExpr : public QueryExpr {
 
     const auto& other = term.at(1);
     auto other_expr = parseQueryExpr(query, other);
+    if (auto inner = dynamic_cast<NotExpr*>(other_expr.get())) {
+      // ["not", ["not", expr]] is just expr
+      return std::move(inner->expr);
+    }
     return std::make_unique<NotExpr>(std::move(other_expr));
   }
 
+  EvaluationCost evaluationCost() const override {
+    return expr->evaluationCost();
+  }
+
   std::optional<std::vector<std::string>> computeGlobUpperBound(
       CaseSensitivity) const override {
     // We can't negate globs, so return an unbounded result regardless of what
@@ -64,6 +73,10 @@ class TrueExpr : public QueryExpr {
     return std::make_unique<TrueExpr>();
   }
 
+  EvaluationCost evaluationCost() const override {
+    return EvaluationCost::Constant;
+  }
+
   std::optional<std::vector<std::string>> computeGlobUpperBound(
       CaseSensitivity) const override {
     // We will match every path --> unbounded.
@@ -83,11 +96,19 @@ class FalseExpr : public QueryExpr {
     return std::make_unique<FalseExpr>();
   }
 
+  EvaluationCost evaluationCost() const override {
+    return EvaluationCost::Constant;
+  }
+
   std::optional<std::vector<std::string>> computeGlobUpperBound(
       CaseSensitivity) const override {
     // We will not match any path --> bounded by an empty list of globs.
     return std::vector<std::string>{};
   }
+
+  std::optional<std::vector<w_string>> computeWholeNames() const override {
+    return std::vector<w_string>{};
+  }
 };
 
 W_TERM_PARSER(false, FalseExpr::parse);
@@ -96,9 +117,45 @@ class ListExpr : public QueryExpr {
   bool allof;
   std::vector<std::unique_ptr<QueryExpr>> exprs;
 
+  // Appends parsed to list, combining it with the previous term where the
+  // terms know how to aggregate, and splicing in the terms of nested lists
+  // of the same kind.
+  static void appendTerm(
+      std::vector<std::unique_ptr<QueryExpr>>& list,
+      std::unique_ptr<QueryExpr> parsed,
+      bool allof) {
+    if (auto nested = dynamic_cast<ListExpr*>(parsed.get());
+        nested && nested->allof == allof) {
+      for (auto& expr : nested->exprs) {
+        appendTerm(list, std::move(expr), allof);
+      }
+      return;
+    }
+
+    if (!list.empty()) {
+      // Try to aggregate with previous expression
+      auto op = allof ? AggregateOp::AllOf : AggregateOp::AnyOf;
+      auto aggExpr = list.back().get()->aggregate(parsed.get(), op);
+      if (aggExpr) {
+        list.back() = std::move(aggExpr);
+        return;
+      }
+    }
+    list.emplace_back(std::move(parsed));
+  }
+
  public:
   ListExpr(bool isAll, std::vector<std::unique_ptr<QueryExpr>> exprs)
-      : allof(isAll), exprs(std::move(exprs)) {}
+      : allof(isAll), exprs(std::move(exprs)) {
+    // Evaluate the cheapest terms first: a cheap term that settles the
+    // result saves us from rendering names or fetching data for the rest.
+    // The sort is stable so that terms of equal cost keep the order in
+    // which they were written.
+    std::stable_sort(
+        this->exprs.begin(), this->exprs.end(), [](auto& a, auto& b) {
+          return a->evaluationCost() < b->evaluationCost();
+        });
+  }
 
   EvaluateResult evaluate(QueryContextBase* ctx, FileResult* file) override {
     bool needData = false;
@@ -151,20 +208,7 @@ class ListExpr : public QueryExpr {
 
     for (size_t i = 0; i < n; i++) {
       const auto& exp = term.at(i + 1);
-
-      auto op = allof ? AggregateOp::AllOf : AggregateOp::AnyOf;
-      auto parsed = parseQueryExpr(query, exp);
-      if (list.empty()) {
-        list.emplace_back(std::move(parsed));
-      } else {
-        // Try to aggregate with previous expression
-        auto aggExpr = list.back().get()->aggregate(parsed.get(), op);
-        if (aggExpr) {
-          list.back() = std::move(aggExpr);
-        } else {
-          list.emplace_back(std::move(parsed));
-        }
-      }
+      appendTerm(list, parseQueryExpr(query, exp), allof);
     }
 
     return std::make_unique<ListExpr>(allof, std::move(list));
@@ -181,6 +225,49 @@ class ListExpr : public QueryExpr {
     return parse(query, term, false);
   }
 
+  EvaluationCost evaluationCost() const override {
+    // Sorted cheapest first, so the last term is the most expensive
+    return exprs.empty() ? EvaluationCost::Constant
+                         : exprs.back()->evaluationCost();
+  }
+
+  void narrowColumnFilter(QueryContextBase* ctx, ColumnFilter& filter)
+      const override {
+    // A file outside the bounds of any term of an allof can't match it.
+    // The bounds of an anyof would be the union of its terms' bounds, which
+    // rarely excludes anything.
+    if (allof) {
+      for (auto& expr : exprs) {
+        expr->narrowColumnFilter(ctx, filter);
+      }
+    }
+  }
+
+  std::optional<std::vector<w_string>> computeWholeNames() const override {
+    if (allof) {
+      // Any term's names bound the whole list; the fewest are cheapest to
+      // look up
+      std::optional<std::vector<w_string>> fewest;
+      for (auto& expr : exprs) {
+        auto names = expr->computeWholeNames();
+        if (names && (!fewest || names->size() < fewest->size())) {
+          fewest = std::move(names);
+        }
+      }
+      return fewest;
+    }
+
+    std::unordered_set<w_string> unionOfNames;
+    for (auto& expr : exprs) {
+      auto names = expr->computeWholeNames();
+      if (!names) {
+        return std::nullopt;
+      }
+      unionOfNames.insert(names->begin(), names->end());
+    }
+    return std::vector<w_string>(unionOfNames.begin(), unionOfNames.end());
+  }
+
   std::optional<std::vector<std::string>> computeGlobUpperBound(
       CaseSensitivity caseSensitive) const override {
     if (allof) {
@@ -137,6 +137,10 @@ class DirNameExpr : public QueryExpr {
     return parse(query, term, CaseSensitivity::CaseInSensitive);
   }
 
+  EvaluationCost evaluationCost() const override {
+    return EvaluationCost::WholeName;
+  }
+
   std::optional<std::vector<std::string>> computeGlobUpperBound(
       CaseSensitivity outputCaseSensitive) const override {
     // We could leverage the depth parameter to generate a depth bound, e.g. `*`
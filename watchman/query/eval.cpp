@@ -8,15 +8,19 @@
 #include "watchman/query/eval.h"
 #include <fmt/chrono.h>
 #include <folly/ScopeGuard.h>
+#include <atomic>
 #include "watchman/CommandRegistry.h"
 #include "watchman/Errors.h"
 #include "watchman/PerfSample.h"
 #include "watchman/QueryableView.h"
+#include "watchman/ThreadPool.h"
+#include "watchman/Trace.h"
 #include "watchman/WatchmanConfig.h"
 #include "watchman/query/GlobTree.h"
 #include "watchman/query/LocalFileResult.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/QueryContext.h"
+#include "watchman/query/QueryResultCache.h"
 #include "watchman/root/Root.h"
 #include "watchman/saved_state/SavedStateInterface.h"
 #include "watchman/scm/SCM.h"
@@ -45,6 +49,81 @@ const std::vector<w_string>& getUnconditionalLogFilePrefixes() {
       computeUnconditionalLogFilePrefixes();
   return names;
 }
+
+// Whether the query's clock is from an earlier instance of the root, or too
+// old for the view to tell what changed since, as of now
+bool isFreshInstance(const ClockSpec& since, Root& root) {
+  // Evaluating a named cursor would move it
+  if (!std::holds_alternative<ClockSpec::Clock>(since.spec)) {
+    return false;
+  }
+  auto view = root.view();
+  return since
+      .evaluate(
+          view->getMostRecentRootNumberAndTickValue(),
+          view->getLastAgeOutTickValue())
+      .is_fresh_instance();
+}
+
+// Whether the query may have to walk every file of the root: one with
+// neither a since clock nor a path or glob generator to narrow it
+bool isHeavyQuery(const Query& query) {
+  return !query.since_spec && !query.paths && !query.glob_tree;
+}
+
+// Asks the SCM for the files changed since mergeBase right away, and returns
+// a generator that produces them once they are known.  Nothing the SCM
+// reports depends on the view, so the subprocess runs while the query waits
+// to settle and sync.
+QueryGenerator scmChangedFilesGenerator(
+    const Query* query,
+    const std::shared_ptr<Root>& root,
+    const w_string& mergeBase,
+    const std::optional<w_string>& requestId) {
+  // The SCM caches its answer by clock.  A query that syncs would have
+  // asked with the clock after its sync, which no earlier answer can be
+  // cached under, so give it a key of its own.
+  auto clock = root->view()->getCurrentClockString();
+  if (query->sync_timeout.count()) {
+    static std::atomic<uint64_t> syncedLookups{0};
+    clock = w_string{fmt::format(
+        "{}:{}", clock, syncedLookups.fetch_add(1, std::memory_order_relaxed))};
+  }
+  auto changedFiles = std::make_shared<folly::Future<std::vector<w_string>>>(
+      folly::via(&getThreadPool(), [root, mergeBase, clock, requestId] {
+        return root->view()->getSCM()->getFilesChangedSinceMergeBaseWith(
+            mergeBase.piece(), clock, requestId);
+      }));
+
+  return [changedFiles](
+             const Query* q,
+             const std::shared_ptr<Root>& r,
+             QueryContext* c) {
+    auto position = c->clockAtStartOfQuery.position();
+    ClockStamp clock{position.ticks, ::time(nullptr)};
+    for (const auto& path : changedFiles->wait().value()) {
+      if (c->limitReached()) {
+        break;
+      }
+      auto fullPath = w_string::pathCat({r->root_path, path});
+      if (!c->fileMatchesRelativeRoot(fullPath)) {
+        continue;
+      }
+      // Note well!  At the time of writing the LocalFileResult class
+      // assumes that removed entries must have been regular files.
+      // We don't have enough information returned from
+      // getFilesChangedSinceMergeBaseWith() to distinguish between
+      // deleted files and deleted symlinks.  Also, it is not possible
+      // to see a directory returned from that call; we're only going
+      // to enumerate !dirs for this case.
+      w_query_process_file(
+          q,
+          c,
+          std::make_unique<LocalFileResult>(
+              fullPath, clock, r->case_sensitive));
+    }
+  };
+}
 } // namespace
 
 /* Query evaluator */
@@ -54,34 +133,40 @@ void w_query_process_file(
     std::unique_ptr<FileResult> file) {
   // TODO: Should this be implicit by assigning a file to the QueryContext? It
   // could be cleared when resetting the file.
+  ctx->checkCancelled();
   ctx->resetWholeName();
   ctx->file = std::move(file);
   SCOPE_EXIT {
-    ctx->file.reset();
+    // Null if a batch took it
+    ctx->spareFile = std::move(ctx->file);
   };
 
+  if (ctx->recordCandidateNames) {
+    ctx->candidateNames.insert(ctx->getWholeName());
+  }
+
   // For fresh instances, only return files that currently exist
   // TODO: shift this clause to execute_common and generate
   // a wrapped query: ["allof", "exists", EXPR] and execute that
   // instead of query->expr so that the lazy evaluation logic can
   // be automatically applied and avoid fetching the exists flag
   // for every file.  See also related TODO in batchFetchNow.
-  if (!ctx->disableFreshInstance &&
+  bool needExists = !ctx->disableFreshInstance &&
       std::holds_alternative<QuerySince::Clock>(ctx->since.since) &&
-      std::get<QuerySince::Clock>(ctx->since.since).is_fresh_instance) {
-    auto exists = ctx->file->exists();
-    if (!exists.has_value()) {
-      // Reconsider this one later
-      ctx->addToEvalBatch(std::move(ctx->file));
-      return;
-    }
-    if (!exists.value()) {
+      std::get<QuerySince::Clock>(ctx->since.since).is_fresh_instance;
+  std::optional<bool> exists;
+  if (needExists) {
+    exists = ctx->file->exists();
+    if (exists.has_value() && !exists.value()) {
       return;
     }
   }
 
   // We produce an output for this file if there is no expression,
   // or if the expression matched.
+  // If we don't know yet whether the file exists we still evaluate the
+  // expression: it may rule the file out without fetching anything, and if
+  // not, the data that it needs is fetched in the same batch.
   if (query->expr) {
     auto match = query->expr->evaluate(ctx, ctx->file.get());
 
@@ -94,15 +179,16 @@ void w_query_process_file(
     }
   }
 
-  if (ctx->query->dedup_results) {
-    auto name = ctx->getWholeName();
+  if (needExists && !exists.has_value()) {
+    // Reconsider this one later
+    ctx->addToEvalBatch(std::move(ctx->file));
+    return;
+  }
 
-    auto inserted = ctx->dedup.insert(name);
-    if (!inserted.second) {
-      // Already present in the results, no need to emit it again
-      ctx->num_deduped++;
-      return;
-    }
+  if (ctx->query->dedup_results && !ctx->insertDedup()) {
+    // Already present in the results, no need to emit it again
+    ctx->num_deduped++;
+    return;
   }
 
   auto logPrefixes = getUnconditionalLogFilePrefixes();
@@ -163,6 +249,7 @@ static void execute_common(
 
   if (ctx->query->dedup_results) {
     ctx->dedup.reserve(64);
+    ctx->dedupIdentities.reserve(64);
   }
 
   // isFreshInstance is also later set by the value in ctx after generator
@@ -175,24 +262,45 @@ static void execute_common(
     if (!generator) {
       generator = default_generators;
     }
+    TraceSpan span{"query.generate"};
+    // Settling and syncing may have taken up the query's time already
+    ctx->checkCancelledNow();
     generator(ctx->query, ctx->root, ctx);
   }
   ctx->generationDuration = ctx->stopWatch.lap();
+  ctx->updateUsage();
   ctx->state = QueryContextState::Rendering;
 
   // We may have some file results pending re-evaluation,
   // so make sure that we process them before we get to
   // the render phase below.
+  TraceSpan renderSpan{"query.render"};
   ctx->fetchEvalBatchNow();
+  ctx->renderOrderedResults();
   while (!ctx->fetchRenderBatchNow()) {
     // Depending on the implementation of the query terms and
     // the field renderers, we may need to do a couple of fetches
     // to get all that we need, so we loop until we get them all.
   }
 
+  renderSpan.end();
   ctx->renderDuration = ctx->stopWatch.lap();
+  ctx->updateUsage();
+  res->debugInfo.usage = ctx->usage.copy();
+  res->debugInfo.plan = std::move(ctx->plan);
   ctx->state = QueryContextState::Completed;
 
+  // Leave the bench_iterations runs, which have no sample, out of it
+  if (sample) {
+    auto& metrics = ctx->root->metrics.queries;
+    metrics.elapsed.record(std::chrono::steady_clock::now() - ctx->created);
+    metrics.cookieSync.record(ctx->cookieSyncDuration.load());
+    metrics.viewLockWait.record(ctx->viewLockWaitDuration.load());
+    metrics.generation.record(ctx->generationDuration.load());
+    metrics.render.record(ctx->renderDuration.load());
+    metrics.cpu.record(res->debugInfo.usage.cpuTime);
+  }
+
   // For Eden instances it is possible that when running the query it was
   // discovered that it is actually a fresh instance [e.g. mount generation
   // changes or journal truncation]; update res to match
@@ -225,8 +333,9 @@ static void execute_common(
     auto meta = json_object({
         {"fresh_instance", json_boolean(res->isFreshInstance)},
         {"num_deduped", json_integer(ctx->num_deduped)},
-        {"num_results", json_integer(ctx->resultsArray.size())},
+        {"num_results", json_integer(ctx->numResults())},
         {"num_walked", json_integer(ctx->getNumWalked())},
+        {"usage", res->debugInfo.usage.render()},
     });
     if (ctx->query->query_spec) {
       meta.set("query", json_ref(*ctx->query->query_spec));
@@ -237,6 +346,92 @@ static void execute_common(
 
   res->resultsArray = ctx->renderResults();
   res->dedupedFileNames = std::move(ctx->dedup);
+  if (ctx->query->existsOnly) {
+    res->exists = ctx->limitReached();
+  }
+  res->nextPageToken = std::move(ctx->nextPageToken);
+  if (ctx->query->aggregate) {
+    res->aggregate = ctx->renderAggregates();
+  }
+}
+
+// Runs a fresh instance query of all files, starting from the results that a
+// previous run of the same query left in the view's query result cache, if
+// any, so that only the files that changed since then need to be evaluated.
+static void execute_cached(
+    QueryContext* ctx,
+    PerfSample* sample,
+    QueryResult* res,
+    const w_string& key,
+    size_t maxEntries) {
+  auto& cache = ctx->root->view()->getQueryResultCache();
+  auto position = ctx->clockAtStartOfQuery.position();
+  auto cached = cache.lookup(
+      key, position.rootNumber, ctx->lastAgeOutTickValueAtStartOfQuery);
+
+  auto stats = cache.getStats();
+  sample->add_meta(
+      "query_result_cache",
+      json_object({
+          {"hit", json_boolean(cached != nullptr)},
+          {"hits", json_integer(stats.hits)},
+          {"misses", json_integer(stats.misses)},
+          {"entries", json_integer(stats.entries)},
+      }));
+
+  QueryGenerator generator;
+  ctx->recordResultNames = true;
+  if (cached) {
+    // Re-evaluate the files that changed since the cached results were
+    // produced; the results for the other files still hold.
+    ctx->recordCandidateNames = true;
+    generator = [sinceTicks = cached->position.ticks](
+                    const Query* q,
+                    const std::shared_ptr<Root>& r,
+                    QueryContext* c) {
+      r->view()->changedFilesGenerator(q, c, sinceTicks);
+    };
+  }
+  execute_common(ctx, sample, res, generator);
+
+  auto& results = res->resultsArray.results;
+  w_check(
+      results.size() == ctx->resultNames.size(),
+      "every result should have a recorded name");
+
+  std::shared_ptr<const QueryResultCache::Entry> entry;
+  if (cached && ctx->candidateNames.empty()) {
+    entry = std::move(cached);
+  } else {
+    auto updated = std::make_shared<QueryResultCache::Entry>();
+    updated->position = position;
+    updated->results.reserve(
+        results.size() + (cached ? cached->results.size() : 0));
+    // The changed files are the newest, so they go first
+    for (size_t i = 0; i < results.size(); ++i) {
+      updated->results.emplace_back(
+          std::move(ctx->resultNames[i]), std::move(results[i]));
+    }
+    if (cached) {
+      for (auto& result : cached->results) {
+        if (ctx->candidateNames.count(result.first) == 0) {
+          updated->results.push_back(result);
+        }
+      }
+    }
+    cache.store(key, updated, maxEntries);
+    entry = std::move(updated);
+  }
+
+  results.clear();
+  results.reserve(entry->results.size());
+  res->dedupedFileNames.clear();
+  for (auto& result : entry->results) {
+    results.push_back(result.second);
+    if (ctx->query->dedup_results) {
+      res->dedupedFileNames.insert(result.first);
+    }
+  }
 }
 
 // Capability indicating support for scm-aware since queries
@@ -273,6 +468,22 @@ QueryResult w_query_execute(
     resultClock.scmMergeBaseWith = query->since_spec->scmMergeBaseWith;
     resultClock.scmMergeBase =
         scm->mergeBaseWith(resultClock.scmMergeBaseWith, requestId);
+    auto mergeBaseStats = SCM::getMergeBaseCacheStats();
+    auto mergeBaseLookups = mergeBaseStats.cacheHit +
+        mergeBaseStats.cacheShare + mergeBaseStats.cacheMiss;
+    sample.add_meta(
+        "scm_mergebase_cache",
+        json_object(
+            {{"hits", json_integer(mergeBaseStats.cacheHit)},
+             {"shares", json_integer(mergeBaseStats.cacheShare)},
+             {"misses", json_integer(mergeBaseStats.cacheMiss)},
+             {"hit_ratio",
+              json_real(
+                  mergeBaseLookups
+                      ? double(mergeBaseStats.cacheHit +
+                               mergeBaseStats.cacheShare) /
+                          mergeBaseLookups
+                      : 0.0)}}));
     // Always update the saved state storage type and key, but conditionally
     // update the saved state commit id below based on wether the mergebase has
     // changed.
@@ -282,7 +493,17 @@ QueryResult w_query_execute(
       resultClock.savedStateConfig = query->since_spec->savedStateConfig;
     }
 
-    if (resultClock.scmMergeBase != query->since_spec->scmMergeBase) {
+    bool mergeBaseChanged =
+        resultClock.scmMergeBase != query->since_spec->scmMergeBase;
+    // A clock from an earlier instance of the root would get every file.  A
+    // client with a saved state can instead be told what changed since the
+    // saved state, just as when the merge base moves.
+    bool freshInstanceFromSavedState = !mergeBaseChanged &&
+        query->since_spec->hasSavedStateParams() &&
+        root->options.freshInstanceSavedState &&
+        isFreshInstance(*query->since_spec, *root);
+
+    if (mergeBaseChanged || freshInstanceFromSavedState) {
       // The merge base is different, so on the assumption that a lot of
       // things have changed between the prior and current state of
       // the world, we're just going to ask the SCM to tell us about
@@ -292,23 +513,51 @@ QueryResult w_query_execute(
       if (query->since_spec->hasSavedStateParams()) {
         // Find the most recent saved state to the new mergebase and return
         // changed files since that saved state, if available.
-        auto savedStateInterface = savedStateFactory(
-            query->since_spec->savedStateStorageType.value(),
-            query->since_spec->savedStateConfig.value(),
-            scm,
-            root->config,
-            [root](PerfSample& sample) {
-              root->addPerfSampleMetadata(sample);
-            });
-        auto savedStateResult = savedStateInterface->getMostRecentSavedState(
-            resultClock.scmMergeBase ? resultClock.scmMergeBase->piece()
-                                     : w_string_piece{});
-        res.savedStateInfo = savedStateResult.savedStateInfo;
-        if (!savedStateResult.commitId.empty()) {
-          resultClock.savedStateCommitId = savedStateResult.commitId;
+        auto& storageType = query->since_spec->savedStateStorageType.value();
+        auto& savedStateConfig = query->since_spec->savedStateConfig.value();
+        auto lookupCommitId = resultClock.scmMergeBase
+            ? resultClock.scmMergeBase->piece()
+            : w_string_piece{};
+        // The prefetcher may have found it when the working copy moved
+        auto savedStateResult = root->savedStatePrefetcher.lookup(
+            storageType,
+            savedStateConfig,
+            lookupCommitId,
+            root->options.savedStatePrefetchMaxAge);
+        sample.add_meta(
+            "saved_state_prefetched",
+            json_boolean(savedStateResult.has_value()));
+        if (!savedStateResult) {
+          auto savedStateInterface = savedStateFactory(
+              storageType,
+              savedStateConfig,
+              scm,
+              root->config,
+              [root](PerfSample& sample) {
+                root->addPerfSampleMetadata(sample);
+              });
+          savedStateResult =
+              savedStateInterface->getMostRecentSavedState(lookupCommitId);
+          root->savedStatePrefetcher.record(
+              savedStateFactory,
+              storageType,
+              savedStateConfig,
+              resultClock.scmMergeBaseWith,
+              lookupCommitId,
+              *savedStateResult);
+        }
+        res.savedStateInfo = savedStateResult->savedStateInfo;
+        if (!savedStateResult->commitId.empty()) {
+          resultClock.savedStateCommitId = savedStateResult->commitId;
           // Modify the mergebase to be the saved state mergebase so we can
           // return changed files since the saved state.
-          modifiedMergebase = savedStateResult.commitId;
+          modifiedMergebase = savedStateResult->commitId;
+        } else if (freshInstanceFromSavedState) {
+          // Nothing to offer in place of the fresh instance, so leave the
+          // client's saved state as it was
+          resultClock.savedStateCommitId =
+              query->since_spec->savedStateCommitId;
+          modifiedMergebase = std::nullopt;
         } else {
           // Setting the saved state commit id to the empty string alerts the
           // client that the mergebase changed, yet no saved state was
@@ -325,39 +574,11 @@ QueryResult w_query_execute(
       // case.
       if (modifiedMergebase) {
         disableFreshInstance = true;
-        generator = [root, modifiedMergebase, requestId](
-                        const Query* q,
-                        const std::shared_ptr<Root>& r,
-                        QueryContext* c) {
-          auto position = c->clockAtStartOfQuery.position();
-          auto changedFiles =
-              root->view()->getSCM()->getFilesChangedSinceMergeBaseWith(
-                  modifiedMergebase ? modifiedMergebase->piece()
-                                    : w_string_piece{},
-                  position.toClockString(),
-                  requestId);
-
-          ClockStamp clock{position.ticks, ::time(nullptr)};
-          for (const auto& path : changedFiles) {
-            auto fullPath = w_string::pathCat({r->root_path, path});
-            if (!c->fileMatchesRelativeRoot(fullPath)) {
-              continue;
-            }
-            // Note well!  At the time of writing the LocalFileResult class
-            // assumes that removed entries must have been regular files.
-            // We don't have enough information returned from
-            // getFilesChangedSinceMergeBaseWith() to distinguish between
-            // deleted files and deleted symlinks.  Also, it is not possible
-            // to see a directory returned from that call; we're only going
-            // to enumerate !dirs for this case.
-            w_query_process_file(
-                q,
-                c,
-                std::make_unique<LocalFileResult>(
-                    fullPath, clock, r->case_sensitive));
-          }
-        };
-      } else if (query->fail_if_no_saved_state) {
+        if (!query->omit_changed_files) {
+          generator = scmChangedFilesGenerator(
+              query, root, *modifiedMergebase, requestId);
+        }
+      } else if (mergeBaseChanged && query->fail_if_no_saved_state) {
         throw QueryExecError(
             "The merge base changed but no corresponding saved state was "
             "found for the new merge base. fail_if_no_saved_state was set "
@@ -383,9 +604,9 @@ QueryResult w_query_execute(
   // Track the query against the root.
   // This is to enable the `watchman debug-status` diagnostic command.
   // It promises only to read the read-only fields in ctx and ctx.query.
-  root->queries.wlock()->insert(&ctx);
+  root->queries.shard(&ctx).wlock()->insert(&ctx);
   SCOPE_EXIT {
-    root->queries.wlock()->erase(&ctx);
+    root->queries.shard(&ctx).wlock()->erase(&ctx);
   };
   if (query->settle_timeouts) {
     auto future = root->waitForSettle(query->settle_timeouts->settle_period);
@@ -398,16 +619,40 @@ QueryResult w_query_execute(
           query->settle_timeouts->settle_timeout);
     }
   }
+  // An idle root's view may have been written out to disk
+  root->view()->rehydrate();
+  // A lazily crawled view may not have crawled the dirs we need yet
+  root->view()->crawlDeferredDirs(query);
+
   if (query->sync_timeout.count()) {
     ctx.state = QueryContextState::WaitingForCookieSync;
     ctx.stopWatch.reset();
+    TraceSpan span{"query.cookieSync"};
     try {
-      auto result = root->syncToNow(query->sync_timeout);
-      res.debugInfo.cookieFileNames = std::move(result.cookieFileNames);
+      // During the initial crawl, the query may be answered as of the crawl
+      // of the dirs it looks in, if those are done already
+      if (!root->view()->waitUntilCrawledFor(query, query->sync_timeout)) {
+        auto result = root->syncToNow(query->sync_timeout);
+        res.debugInfo.cookieFileNames = std::move(result.cookieFileNames);
+      }
     } catch (const std::exception& exc) {
       QueryExecError::throwf("synchronization failed: {}", exc.what());
     }
     ctx.cookieSyncDuration = ctx.stopWatch.lap();
+    ctx.updateUsage();
+  }
+
+  // Heavy queries take turns, interactive ones first
+  QueryAdmission::Ticket admission;
+  if (root->options.heavyQuerySlots > 0 && isHeavyQuery(*query)) {
+    ctx.state = QueryContextState::WaitingForAdmission;
+    auto waitStarted = std::chrono::steady_clock::now();
+    admission = root->queryAdmission.admit(
+        query->priority, root->options.heavyQuerySlots, [&] {
+          ctx.checkCancelledNow();
+        });
+    root->metrics.queryAdmissionWait[size_t(query->priority)].record(
+        std::chrono::steady_clock::now() - waitStarted);
   }
 
   /* The first stage of execution is generation.
@@ -439,6 +684,34 @@ QueryResult w_query_execute(
                                       &root->inner.cursors)
                                 : QuerySince{};
 
+  if (query->pageCursor) {
+    // A page token is only good for as long as the view that it pages
+    // through; once the root has been recrawled, the client must start over
+    ClockSpec pageClock{w_string_to_json(query->pageCursor->clock)};
+    auto pageSince = pageClock.evaluate(
+        ctx.clockAtStartOfQuery.position(),
+        ctx.lastAgeOutTickValueAtStartOfQuery);
+    if (pageSince.is_fresh_instance()) {
+      throw QueryExecError(
+          "page_token is from an earlier instance of this root; "
+          "start again from the first page");
+    }
+  }
+
+  auto resultCacheSize = root->options.queryResultCacheSize;
+  // The cache holds every result, in no particular order, so queries with
+  // a limit, an order or an aggregate bypass it
+  if (resultCacheSize > 0 && !generator && !query->limit && !query->order &&
+      !query->aggregate && !ctx.disableFreshInstance &&
+      !ctx.since.is_timestamp() && ctx.since.is_fresh_instance() &&
+      root->view()->supportsQueryResultCache()) {
+    auto key = QueryResultCache::keyFor(query);
+    if (key) {
+      execute_cached(&ctx, &sample, &res, *key, resultCacheSize);
+      return res;
+    }
+  }
+
   if (query->bench_iterations > 0) {
     for (uint32_t i = 0; i < query->bench_iterations; ++i) {
       QueryContext c{query, root, ctx.disableFreshInstance};
@@ -449,6 +722,11 @@ QueryResult w_query_execute(
     }
   }
 
+  // Ordered results are rendered once they have been sorted, which the
+  // encoder, appending each file as it matches, can't do
+  if (query->bserResultFormat && !query->order) {
+    ctx.encodeResultsAsBser(*query->bserResultFormat);
+  }
   execute_common(&ctx, &sample, &res, generator);
   return res;
 }
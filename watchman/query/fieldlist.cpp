@@ -6,10 +6,15 @@
  */
 
 #include "watchman/CommandRegistry.h"
+#include "watchman/ContentHash.h"
 #include "watchman/Errors.h"
+#include "watchman/QueryableView.h"
+#include "watchman/bser.h"
 #include "watchman/query/FileResult.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/QueryContext.h"
+#include "watchman/root/Root.h"
+#include "watchman/scm/Git.h"
 #include "watchman/watchman_time.h"
 
 namespace watchman {
@@ -20,6 +25,15 @@ std::optional<json_ref> make_name(FileResult* file, const QueryContext* ctx) {
   return w_string_to_json(ctx->computeWholeName(file));
 }
 
+bool encode_name(
+    FileResult* file,
+    const QueryContext* ctx,
+    BserArrayEncoder& out) {
+  // Same type as the w_string that computeWholeName() builds
+  out.appendString(ctx->renderWholeName(file), W_STRING_BYTE);
+  return true;
+}
+
 std::optional<json_ref> make_symlink(FileResult* file, const QueryContext*) {
   auto target = file->readLink();
   if (!target.has_value()) {
@@ -32,21 +46,29 @@ std::optional<json_ref> make_symlink(FileResult* file, const QueryContext*) {
   }
 }
 
-std::optional<json_ref> make_sha1_hex(FileResult* file, const QueryContext*) {
+json_ref hash_to_hex(const FileResult::ContentHash& hash) {
+  char buf[40];
+  static const char* hexDigit = "0123456789abcdef";
+  for (size_t i = 0; i < hash.size(); ++i) {
+    auto& digit = hash[i];
+    buf[(i * 2) + 0] = hexDigit[digit >> 4];
+    buf[(i * 2) + 1] = hexDigit[digit & 0xf];
+  }
+  return w_string_to_json(w_string(buf, sizeof(buf), W_STRING_UNICODE));
+}
+
+// Renders the hash that compute returns, or nullopt if it returns nullopt
+// because data still needs to be loaded, reporting errors as make_sha1_hex
+// always has.
+template <typename Compute>
+std::optional<json_ref> render_hash(Compute compute) {
   try {
-    auto hash = file->getContentSha1();
+    auto hash = compute();
     if (!hash.has_value()) {
       // Need to load it still
       return std::nullopt;
     }
-    char buf[40];
-    static const char* hexDigit = "0123456789abcdef";
-    for (size_t i = 0; i < hash->size(); ++i) {
-      auto& digit = (*hash)[i];
-      buf[(i * 2) + 0] = hexDigit[digit >> 4];
-      buf[(i * 2) + 1] = hexDigit[digit & 0xf];
-    }
-    return w_string_to_json(w_string(buf, sizeof(buf), W_STRING_UNICODE));
+    return hash_to_hex(*hash);
   } catch (const std::system_error& exc) {
     auto errcode = exc.code();
     if (errcode == error_code::no_such_file_or_directory ||
@@ -66,6 +88,54 @@ std::optional<json_ref> make_sha1_hex(FileResult* file, const QueryContext*) {
   }
 }
 
+std::optional<json_ref> make_sha1_hex(FileResult* file, const QueryContext*) {
+  return render_hash([&] { return file->getContentSha1(); });
+}
+
+// The id of the blob that git would store the file's contents as.  Files
+// that are unchanged since git last hashed them are answered from the
+// index without reading them; the rest are read and hashed.
+std::optional<json_ref> make_git_sha1_hex(
+    FileResult* file,
+    const QueryContext* ctx) {
+  auto exists = file->exists();
+  if (!exists) {
+    return std::nullopt;
+  }
+  if (!*exists) {
+    // Deleted files have no hash
+    return json_null();
+  }
+  auto info = file->stat();
+  if (!info) {
+    return std::nullopt;
+  }
+  if (info->isDir()) {
+    return json_null();
+  }
+  if (info->isSymlink() && !file->readLink()) {
+    return std::nullopt;
+  }
+
+  return render_hash([&]() -> std::optional<FileResult::ContentHash> {
+    auto name = ctx->computeWholeName(file);
+    if (auto* git = dynamic_cast<const Git*>(ctx->root->view()->getSCM())) {
+      if (auto blobId = git->getIndexedBlobId(name, *info)) {
+        return *blobId;
+      }
+    }
+    if (info->isSymlink()) {
+      auto target = file->readLink();
+      auto* text = target ? std::get_if<w_string>(&*target) : nullptr;
+      if (text) {
+        return ContentHashCache::computeGitBlobHash(text->view());
+      }
+    }
+    auto fullPath = w_string::pathCat({ctx->root->root_path, name});
+    return ContentHashCache::computeGitBlobHashImmediate(fullPath.c_str());
+  });
+}
+
 std::optional<json_ref> make_size(FileResult* file, const QueryContext*) {
   auto size = file->size();
   if (!size.has_value()) {
@@ -74,6 +144,15 @@ std::optional<json_ref> make_size(FileResult* file, const QueryContext*) {
   return json_integer(size.value());
 }
 
+bool encode_size(FileResult* file, const QueryContext*, BserArrayEncoder& out) {
+  auto size = file->size();
+  if (!size.has_value()) {
+    return false;
+  }
+  out.appendInt(size.value());
+  return true;
+}
+
 std::optional<json_ref> make_exists(FileResult* file, const QueryContext*) {
   auto exists = file->exists();
   if (!exists.has_value()) {
@@ -82,46 +161,92 @@ std::optional<json_ref> make_exists(FileResult* file, const QueryContext*) {
   return json_boolean(exists.value());
 }
 
-std::optional<json_ref> make_new(FileResult* file, const QueryContext* ctx) {
-  bool is_new = false;
+bool encode_exists(
+    FileResult* file,
+    const QueryContext*,
+    BserArrayEncoder& out) {
+  auto exists = file->exists();
+  if (!exists.has_value()) {
+    return false;
+  }
+  out.appendBool(exists.value());
+  return true;
+}
 
+std::optional<bool> is_new(FileResult* file, const QueryContext* ctx) {
   auto* since_clock = std::get_if<QuerySince::Clock>(&ctx->since.since);
   if (since_clock && since_clock->is_fresh_instance) {
-    is_new = true;
-  } else {
-    auto ctime = file->ctime();
-    if (!ctime.has_value()) {
-      // Reconsider this one later
-      return std::nullopt;
-    }
-    if (since_clock) {
-      is_new = ctime->ticks > since_clock->ticks;
-    } else {
-      auto& since_ts = std::get<QuerySince::Timestamp>(ctx->since.since);
-      is_new = since_ts.time > ctime->timestamp;
-    }
+    return true;
+  }
+
+  auto ctime = file->ctime();
+  if (!ctime.has_value()) {
+    // Reconsider this one later
+    return std::nullopt;
+  }
+  if (since_clock) {
+    return ctime->ticks > since_clock->ticks;
+  }
+  auto& since_ts = std::get<QuerySince::Timestamp>(ctx->since.since);
+  return since_ts.time > ctime->timestamp;
+}
+
+std::optional<json_ref> make_new(FileResult* file, const QueryContext* ctx) {
+  auto result = is_new(file, ctx);
+  if (!result.has_value()) {
+    return std::nullopt;
   }
+  return json_boolean(*result);
+}
 
-  return json_boolean(is_new);
+bool encode_new(
+    FileResult* file,
+    const QueryContext* ctx,
+    BserArrayEncoder& out) {
+  auto result = is_new(file, ctx);
+  if (!result.has_value()) {
+    return false;
+  }
+  out.appendBool(*result);
+  return true;
 }
 
-#define MAKE_CLOCK_FIELD(name, member)                      \
-  static std::optional<json_ref> make_##name(               \
-      FileResult* file, const QueryContext* ctx) {          \
-    char buf[128];                                          \
-    auto clock = file->member();                            \
-    if (!clock.has_value()) {                               \
-      /* need to load data */                               \
-      return std::nullopt;                                  \
-    }                                                       \
-    if (clock_id_string(                                    \
-            ctx->clockAtStartOfQuery.position().rootNumber, \
-            clock->ticks,                                   \
-            buf,                                            \
-            sizeof(buf))) {                                 \
-      return typed_string_to_json(buf, W_STRING_UNICODE);   \
-    }                                                       \
-    return json_null();                                     \
+#define MAKE_CLOCK_FIELD(name, member)                                    \
+  static std::optional<json_ref> make_##name(                             \
+      FileResult* file, const QueryContext* ctx) {                        \
+    char buf[128];                                                        \
+    auto clock = file->member();                                          \
+    if (!clock.has_value()) {                                             \
+      /* need to load data */                                             \
+      return std::nullopt;                                                \
+    }                                                                     \
+    if (clock_id_string(                                                  \
+            ctx->clockAtStartOfQuery.position().rootNumber,               \
+            clock->ticks,                                                 \
+            buf,                                                          \
+            sizeof(buf))) {                                               \
+      return typed_string_to_json(buf, W_STRING_UNICODE);                 \
+    }                                                                     \
+    return json_null();                                                   \
+  }                                                                       \
+  static bool encode_##name(                                              \
+      FileResult* file, const QueryContext* ctx, BserArrayEncoder& out) { \
+    char buf[128];                                                        \
+    auto clock = file->member();                                          \
+    if (!clock.has_value()) {                                             \
+      /* need to load data */                                             \
+      return false;                                                       \
+    }                                                                     \
+    if (clock_id_string(                                                  \
+            ctx->clockAtStartOfQuery.position().rootNumber,               \
+            clock->ticks,                                                 \
+            buf,                                                          \
+            sizeof(buf))) {                                               \
+      out.appendString(buf, W_STRING_UNICODE);                            \
+    } else {                                                              \
+      out.appendNull();                                                   \
+    }                                                                     \
+    return true;                                                          \
   }
 MAKE_CLOCK_FIELD(cclock, ctime)
 MAKE_CLOCK_FIELD(oclock, otime)
@@ -133,39 +258,71 @@ static_assert(
     sizeof(json_int_t) >= sizeof(time_t),
     "json_int_t isn't large enough to hold a time_t");
 
-#define MAKE_INT_FIELD(name, member)           \
-  static std::optional<json_ref> make_##name(  \
-      FileResult* file, const QueryContext*) { \
-    auto stat = file->stat();                  \
-    if (!stat.has_value()) {                   \
-      /* need to load data */                  \
-      return std::nullopt;                     \
-    }                                          \
-    return json_integer(stat->member);         \
-  }
-
-#define MAKE_TIME_INT_FIELD(name, member, scale)                  \
-  static std::optional<json_ref> make_##name(                     \
-      FileResult* file, const QueryContext*) {                    \
-    auto spec = file->member();                                   \
-    if (!spec.has_value()) {                                      \
-      /* need to load data */                                     \
-      return std::nullopt;                                        \
-    }                                                             \
-    return json_integer(                                          \
-        ((int64_t)spec->tv_sec * scale) +                         \
-        ((int64_t)spec->tv_nsec * scale / WATCHMAN_NSEC_IN_SEC)); \
-  }
-
-#define MAKE_TIME_DOUBLE_FIELD(name, member)               \
-  static std::optional<json_ref> make_##name(              \
-      FileResult* file, const QueryContext*) {             \
-    auto spec = file->member();                            \
-    if (!spec.has_value()) {                               \
-      /* need to load data */                              \
-      return std::nullopt;                                 \
-    }                                                      \
-    return json_real(spec->tv_sec + 1e-9 * spec->tv_nsec); \
+#define MAKE_INT_FIELD(name, member)                                  \
+  static std::optional<json_ref> make_##name(                         \
+      FileResult* file, const QueryContext*) {                        \
+    auto stat = file->stat();                                         \
+    if (!stat.has_value()) {                                          \
+      /* need to load data */                                         \
+      return std::nullopt;                                            \
+    }                                                                 \
+    return json_integer(stat->member);                                \
+  }                                                                   \
+  static bool encode_##name(                                          \
+      FileResult* file, const QueryContext*, BserArrayEncoder& out) { \
+    auto stat = file->stat();                                         \
+    if (!stat.has_value()) {                                          \
+      /* need to load data */                                         \
+      return false;                                                   \
+    }                                                                 \
+    out.appendInt(stat->member);                                      \
+    return true;                                                      \
+  }
+
+#define TIME_INT_VALUE(spec, scale)   \
+  (((int64_t)(spec).tv_sec * scale) + \
+   ((int64_t)(spec).tv_nsec * scale / WATCHMAN_NSEC_IN_SEC))
+
+#define MAKE_TIME_INT_FIELD(name, member, scale)                      \
+  static std::optional<json_ref> make_##name(                         \
+      FileResult* file, const QueryContext*) {                        \
+    auto spec = file->member();                                       \
+    if (!spec.has_value()) {                                          \
+      /* need to load data */                                         \
+      return std::nullopt;                                            \
+    }                                                                 \
+    return json_integer(TIME_INT_VALUE(*spec, scale));                \
+  }                                                                   \
+  static bool encode_##name(                                          \
+      FileResult* file, const QueryContext*, BserArrayEncoder& out) { \
+    auto spec = file->member();                                       \
+    if (!spec.has_value()) {                                          \
+      /* need to load data */                                         \
+      return false;                                                   \
+    }                                                                 \
+    out.appendInt(TIME_INT_VALUE(*spec, scale));                      \
+    return true;                                                      \
+  }
+
+#define MAKE_TIME_DOUBLE_FIELD(name, member)                          \
+  static std::optional<json_ref> make_##name(                         \
+      FileResult* file, const QueryContext*) {                        \
+    auto spec = file->member();                                       \
+    if (!spec.has_value()) {                                          \
+      /* need to load data */                                         \
+      return std::nullopt;                                            \
+    }                                                                 \
+    return json_real(spec->tv_sec + 1e-9 * spec->tv_nsec);            \
+  }                                                                   \
+  static bool encode_##name(                                          \
+      FileResult* file, const QueryContext*, BserArrayEncoder& out) { \
+    auto spec = file->member();                                       \
+    if (!spec.has_value()) {                                          \
+      /* need to load data */                                         \
+      return false;                                                   \
+    }                                                                 \
+    out.appendReal(spec->tv_sec + 1e-9 * spec->tv_nsec);              \
+    return true;                                                      \
   }
 
 /* For each type (e.g. "m"), define fields
@@ -194,36 +351,37 @@ MAKE_INT_FIELD(nlink, nlink)
 
 // clang-format off
 #define MAKE_TIME_FIELD_DEFS(type) \
-  { #type "time", make_##type##time}, \
-  { #type "time_ms", make_##type##time_ms},\
-  { #type "time_us", make_##type##time_us}, \
-  { #type "time_ns", make_##type##time_ns}, \
-  { #type "time_f", make_##type##time_f}
+  { #type "time", make_##type##time, encode_##type##time}, \
+  { #type "time_ms", make_##type##time_ms, encode_##type##time_ms},\
+  { #type "time_us", make_##type##time_us, encode_##type##time_us}, \
+  { #type "time_ns", make_##type##time_ns, encode_##type##time_ns}, \
+  { #type "time_f", make_##type##time_f, encode_##type##time_f}
 // clang-format on
 
-std::optional<json_ref> make_type_field(FileResult* file, const QueryContext*) {
+// Returns the letter that the type field reports for file
+std::optional<char> file_type_letter(FileResult* file) {
   auto dtype = file->dtype();
   if (dtype.has_value()) {
     switch (*dtype) {
       case DType::Regular:
-        return typed_string_to_json("f", W_STRING_UNICODE);
+        return 'f';
       case DType::Dir:
-        return typed_string_to_json("d", W_STRING_UNICODE);
+        return 'd';
       case DType::Symlink:
-        return typed_string_to_json("l", W_STRING_UNICODE);
+        return 'l';
       case DType::Block:
-        return typed_string_to_json("b", W_STRING_UNICODE);
+        return 'b';
       case DType::Char:
-        return typed_string_to_json("c", W_STRING_UNICODE);
+        return 'c';
       case DType::Fifo:
-        return typed_string_to_json("p", W_STRING_UNICODE);
+        return 'p';
       case DType::Socket:
-        return typed_string_to_json("s", W_STRING_UNICODE);
+        return 's';
       case DType::Whiteout:
         // Whiteout shouldn't generally be visible to userspace,
         // and we don't have a defined letter code for it, so
         // treat it as "who knows!?"
-        return typed_string_to_json("?", W_STRING_UNICODE);
+        return '?';
       case DType::Unknown:
       default:
           // Not enough info; fall through and use the full stat data
@@ -239,34 +397,54 @@ std::optional<json_ref> make_type_field(FileResult* file, const QueryContext*) {
 
   auto stat = optionalStat.value();
   if (stat.isFile()) {
-    return typed_string_to_json("f", W_STRING_UNICODE);
+    return 'f';
   }
   if (stat.isDir()) {
-    return typed_string_to_json("d", W_STRING_UNICODE);
+    return 'd';
   }
   if (stat.isSymlink()) {
-    return typed_string_to_json("l", W_STRING_UNICODE);
+    return 'l';
   }
 #ifndef _WIN32
   if (S_ISBLK(stat.mode)) {
-    return typed_string_to_json("b", W_STRING_UNICODE);
+    return 'b';
   }
   if (S_ISCHR(stat.mode)) {
-    return typed_string_to_json("c", W_STRING_UNICODE);
+    return 'c';
   }
   if (S_ISFIFO(stat.mode)) {
-    return typed_string_to_json("p", W_STRING_UNICODE);
+    return 'p';
   }
   if (S_ISSOCK(stat.mode)) {
-    return typed_string_to_json("s", W_STRING_UNICODE);
+    return 's';
   }
 #endif
 #ifdef S_ISDOOR
   if (S_ISDOOR(stat.mode)) {
-    return typed_string_to_json("D", W_STRING_UNICODE);
+    return 'D';
   }
 #endif
-  return typed_string_to_json("?", W_STRING_UNICODE);
+  return '?';
+}
+
+std::optional<json_ref> make_type_field(FileResult* file, const QueryContext*) {
+  auto letter = file_type_letter(file);
+  if (!letter.has_value()) {
+    return std::nullopt;
+  }
+  return typed_string_to_json(&*letter, 1, W_STRING_UNICODE);
+}
+
+bool encode_type_field(
+    FileResult* file,
+    const QueryContext*,
+    BserArrayEncoder& out) {
+  auto letter = file_type_letter(file);
+  if (!letter.has_value()) {
+    return false;
+  }
+  out.appendString(w_string_piece{&*letter, 1}, W_STRING_UNICODE);
+  return true;
 }
 
 // Helper to construct the list of field defs
@@ -274,30 +452,35 @@ std::unordered_map<w_string, QueryFieldRenderer> build_defs() {
   struct {
     const char* name;
     std::optional<json_ref> (*make)(FileResult* file, const QueryContext* ctx);
+    bool (*encode)(
+        FileResult* file,
+        const QueryContext* ctx,
+        BserArrayEncoder& out);
   } defs[] = {
-      {"name", make_name},
-      {"symlink_target", make_symlink},
-      {"exists", make_exists},
-      {"size", make_size},
-      {"mode", make_mode},
-      {"uid", make_uid},
-      {"gid", make_gid},
+      {"name", make_name, encode_name},
+      {"symlink_target", make_symlink, nullptr},
+      {"exists", make_exists, encode_exists},
+      {"size", make_size, encode_size},
+      {"mode", make_mode, encode_mode},
+      {"uid", make_uid, encode_uid},
+      {"gid", make_gid, encode_gid},
       MAKE_TIME_FIELD_DEFS(a),
       MAKE_TIME_FIELD_DEFS(m),
       MAKE_TIME_FIELD_DEFS(c),
-      {"ino", make_ino},
-      {"dev", make_dev},
-      {"nlink", make_nlink},
-      {"new", make_new},
-      {"oclock", make_oclock},
-      {"cclock", make_cclock},
-      {"type", make_type_field},
-      {"content.sha1hex", make_sha1_hex},
+      {"ino", make_ino, encode_ino},
+      {"dev", make_dev, encode_dev},
+      {"nlink", make_nlink, encode_nlink},
+      {"new", make_new, encode_new},
+      {"oclock", make_oclock, encode_oclock},
+      {"cclock", make_cclock, encode_cclock},
+      {"type", make_type_field, encode_type_field},
+      {"content.sha1hex", make_sha1_hex, nullptr},
+      {"content.gitsha1hex", make_git_sha1_hex, nullptr},
   };
   std::unordered_map<w_string, QueryFieldRenderer> map;
   for (auto& def : defs) {
     w_string name(def.name, W_STRING_UNICODE);
-    map.emplace(name, QueryFieldRenderer{name, def.make});
+    map.emplace(name, QueryFieldRenderer{name, def.make, def.encode});
   }
 
   return map;
@@ -188,6 +188,10 @@ void parse_globs(Query* res, const json_ref& query) {
       throw QueryParseError("failed to compile multi-glob");
     }
   }
+  res->glob_tree->buildIndexes(
+      res->glob_flags |
+      (res->case_sensitive == CaseSensitivity::CaseInSensitive ? WM_CASEFOLD
+                                                               : 0));
 }
 
 static w_string parse_suffix(const json_ref& ele) {
@@ -225,6 +229,7 @@ void parse_suffixes(Query* res, const json_ref& query) {
   // Suffix queries are defined as being case insensitive
   res->glob_flags = WM_CASEFOLD;
   res->glob_tree = folly::make_unique<GlobTree>("", 0);
+  res->suffixes.emplace();
 
   for (auto& ele : suffixArray) {
     if (!ele.isString()) {
@@ -236,7 +241,9 @@ void parse_suffixes(Query* res, const json_ref& query) {
     if (!add_glob(res->glob_tree.get(), pattern)) {
       throw QueryParseError("failed to compile multi-glob");
     }
+    res->suffixes->push_back(std::move(suff));
   }
+  res->glob_tree->buildIndexes(res->glob_flags);
 }
 
 } // namespace watchman
@@ -12,6 +12,8 @@
 #include "watchman/query/QueryExpr.h"
 #include "watchman/query/TermRegistry.h"
 
+#include <algorithm>
+#include <limits>
 #include <memory>
 
 namespace watchman {
@@ -123,11 +125,46 @@ class SizeExpr : public QueryExpr {
     return std::make_unique<SizeExpr>(comp);
   }
 
+  EvaluationCost evaluationCost() const override {
+    return EvaluationCost::Metadata;
+  }
+
   std::optional<std::vector<std::string>> computeGlobUpperBound(
       CaseSensitivity) const override {
     // `size` doesn't constrain the path.
     return std::nullopt;
   }
+
+  void narrowColumnFilter(QueryContextBase*, ColumnFilter& filter)
+      const override {
+    constexpr auto kMax = std::numeric_limits<int64_t>::max();
+    constexpr auto kMin = std::numeric_limits<int64_t>::min();
+    int64_t operand = comp.operand;
+    switch (comp.op) {
+      case W_QUERY_ICMP_EQ:
+        filter.minSize = std::max(filter.minSize, operand);
+        filter.maxSize = std::min(filter.maxSize, operand);
+        break;
+      case W_QUERY_ICMP_GT:
+        if (operand < kMax) {
+          filter.minSize = std::max(filter.minSize, operand + 1);
+        }
+        break;
+      case W_QUERY_ICMP_GE:
+        filter.minSize = std::max(filter.minSize, operand);
+        break;
+      case W_QUERY_ICMP_LT:
+        if (operand > kMin) {
+          filter.maxSize = std::min(filter.maxSize, operand - 1);
+        }
+        break;
+      case W_QUERY_ICMP_LE:
+        filter.maxSize = std::min(filter.maxSize, operand);
+        break;
+      case W_QUERY_ICMP_NE:
+        break;
+    }
+  }
 };
 W_TERM_PARSER(size, SizeExpr::parse);
 
@@ -5,12 +5,17 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <cctype>
+#include <cstring>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <vector>
 #include "GlobEscaping.h"
 #include "watchman/CommandRegistry.h"
 #include "watchman/Errors.h"
 #include "watchman/query/FileResult.h"
+#include "watchman/query/GlobMatcher.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/QueryExpr.h"
 #include "watchman/query/TermRegistry.h"
@@ -57,35 +62,58 @@ w_string_piece trimGlobAfterDoubleStar(w_string_piece pattern) {
   }
   return pattern;
 }
-} // namespace
-class WildMatchExpr : public QueryExpr {
+
+// One pattern of a WildMatchExpr
+struct WildMatchPattern {
   std::string pattern;
   CaseSensitivity caseSensitive;
-  bool wholename;
   bool noescape;
-  bool includedotfiles;
+  GlobMatcher matcher;
 
- public:
-  WildMatchExpr(
+  WildMatchPattern(
       const char* pat,
       CaseSensitivity caseSensitive,
-      bool wholename,
       bool noescape,
-      bool includedotfiles)
+      bool includedotfiles,
+      bool wholename)
       : pattern(pat),
         caseSensitive(caseSensitive),
-        wholename(wholename),
         noescape(noescape),
-        includedotfiles(includedotfiles) {}
+        matcher(
+            pattern,
+            (includedotfiles ? 0 : WM_PERIOD) | (noescape ? WM_NOESCAPE : 0) |
+                (caseSensitive == CaseSensitivity::CaseInSensitive
+                     ? WM_CASEFOLD
+                     : 0) |
+                (wholename ? WM_PATHNAME : 0)) {}
+};
+} // namespace
+
+// Matches the basename or wholename against a set of patterns, any one of
+// which may match.  The match terms of an anyof that share a scope are
+// aggregated into one expression, so that the name is rendered once.  Each
+// pattern is compiled to a GlobMatcher, so that the common shapes never
+// run wildmatch at all.
+class WildMatchExpr : public QueryExpr {
+  std::vector<WildMatchPattern> patterns;
+  bool wholename;
+
+ public:
+  WildMatchExpr(std::vector<WildMatchPattern> patterns, bool wholename)
+      : patterns(std::move(patterns)), wholename(wholename) {}
 
   EvaluateResult evaluate(QueryContextBase* ctx, FileResult* file) override {
     w_string_piece str;
-    bool res;
+
+    // On case insensitive roots the view keeps the folded basename, which
+    // the case insensitive patterns match in place of the name.
+    std::optional<w_string_piece> folded;
 
     if (wholename) {
       str = ctx->getWholeName();
     } else {
       str = file->baseName();
+      folded = file->foldedBaseName();
     }
 
 #ifdef _WIN32
@@ -94,17 +122,31 @@ class WildMatchExpr : public QueryExpr {
     str = normBuf;
 #endif
 
-    res =
-        wildmatch(
-            pattern.c_str(),
-            str.data(),
-            (includedotfiles ? 0 : WM_PERIOD) | (noescape ? WM_NOESCAPE : 0) |
-                (wholename ? WM_PATHNAME : 0) |
-                (caseSensitive == CaseSensitivity::CaseInSensitive ? WM_CASEFOLD
-                                                                   : 0),
-            0) == WM_MATCH;
+    for (auto& pattern : patterns) {
+      bool useFolded =
+          folded && pattern.caseSensitive == CaseSensitivity::CaseInSensitive;
+      auto name = useFolded ? *folded : str;
+      if (pattern.matcher.matches(name.view(), useFolded)) {
+        return true;
+      }
+    }
+    return false;
+  }
 
-    return res;
+  std::unique_ptr<QueryExpr> aggregate(
+      const QueryExpr* other,
+      const AggregateOp op) const override {
+    if (op != AggregateOp::AnyOf) {
+      return nullptr;
+    }
+    auto otherExpr = dynamic_cast<const WildMatchExpr*>(other);
+    if (otherExpr == nullptr || otherExpr->wholename != wholename) {
+      return nullptr;
+    }
+    auto combined = patterns;
+    combined.insert(
+        combined.end(), otherExpr->patterns.begin(), otherExpr->patterns.end());
+    return std::make_unique<WildMatchExpr>(std::move(combined), wholename);
   }
 
   static std::unique_ptr<QueryExpr>
@@ -164,12 +206,11 @@ class WildMatchExpr : public QueryExpr {
           "Invalid scope '{}' for {} expression", scope, which);
     }
 
-    return std::make_unique<WildMatchExpr>(
-        pattern,
-        case_sensitive,
-        !strcmp(scope, "wholename"),
-        noescape,
-        includedotfiles);
+    std::vector<WildMatchPattern> patterns;
+    bool wholename = !strcmp(scope, "wholename");
+    patterns.emplace_back(
+        pattern, case_sensitive, noescape, includedotfiles, wholename);
+    return std::make_unique<WildMatchExpr>(std::move(patterns), wholename);
   }
   static std::unique_ptr<QueryExpr> parseMatch(
       Query* query,
@@ -182,19 +223,39 @@ class WildMatchExpr : public QueryExpr {
     return parse(query, term, CaseSensitivity::CaseInSensitive);
   }
 
+  EvaluationCost evaluationCost() const override {
+    return wholename ? EvaluationCost::WholeName
+                     : EvaluationCost::BaseNamePattern;
+  }
+
   std::optional<std::vector<std::string>> computeGlobUpperBound(
       CaseSensitivity outputCaseSensitive) const override {
-    if (caseSensitive == CaseSensitivity::CaseInSensitive &&
+    if (!wholename) {
+      // basename matches don't bound the prefix, so they're not very useful.
+      return std::nullopt;
+    }
+    std::vector<std::string> result;
+    for (auto& pattern : patterns) {
+      auto bound = patternUpperBound(pattern, outputCaseSensitive);
+      if (!bound) {
+        return std::nullopt;
+      }
+      result.push_back(std::move(*bound));
+    }
+    return result;
+  }
+
+ private:
+  static std::optional<std::string> patternUpperBound(
+      const WildMatchPattern& pattern,
+      CaseSensitivity outputCaseSensitive) {
+    if (pattern.caseSensitive == CaseSensitivity::CaseInSensitive &&
         outputCaseSensitive != CaseSensitivity::CaseInSensitive) {
       // The caller asked for a case-sensitive upper bound, so treat imatch as
       // unbounded.
       return std::nullopt;
     }
-    if (!wholename) {
-      // basename matches don't bound the prefix, so they're not very useful.
-      return std::nullopt;
-    }
-    w_string outputPattern{pattern};
+    w_string outputPattern{pattern.pattern};
     if (outputPattern.piece().startsWith("**")) {
       // This pattern doesn't bound the prefix, so just report it as unbounded.
       return std::nullopt;
@@ -202,11 +263,10 @@ class WildMatchExpr : public QueryExpr {
     if (outputCaseSensitive == CaseSensitivity::CaseInSensitive) {
       outputPattern = outputPattern.piece().asLowerCase();
     }
-    if (noescape) {
+    if (pattern.noescape) {
       outputPattern = convertNoEscapeGlobToGlob(outputPattern);
     }
-    return std::vector<std::string>{
-        trimGlobAfterDoubleStar(outputPattern).string()};
+    return trimGlobAfterDoubleStar(outputPattern).string();
   }
 };
 W_TERM_PARSER(match, WildMatchExpr::parseMatch);
@@ -13,42 +13,61 @@
 #include "watchman/query/TermRegistry.h"
 
 #include <unordered_set>
+#include <vector>
 
 using namespace watchman;
 
 class NameExpr : public QueryExpr {
   w_string name;
-  std::unordered_set<w_string> set;
+  // name lower cased, when matching case insensitively
+  w_string foldedName;
+  // The names to match, lower cased when matching case insensitively, and
+  // the set of them that is searched.  The set's pieces point into names so
+  // that a name can be looked up without copying it into a w_string.
+  std::vector<w_string> names;
+  std::unordered_set<w_string_piece> set;
   CaseSensitivity caseSensitive;
   bool wholename;
   explicit NameExpr(
-      std::unordered_set<w_string>&& set,
+      std::unordered_set<w_string>&& uniqueNames,
       CaseSensitivity caseSensitive,
       bool wholename)
-      : set(std::move(set)),
+      : names(uniqueNames.begin(), uniqueNames.end()),
         caseSensitive(caseSensitive),
-        wholename(wholename) {}
+        wholename(wholename) {
+    set.reserve(names.size());
+    for (const auto& n : names) {
+      set.insert(n.piece());
+    }
+  }
 
  public:
   EvaluateResult evaluate(QueryContextBase* ctx, FileResult* file) override {
+    const bool caseless = caseSensitive == CaseSensitivity::CaseInSensitive;
+    // On case insensitive roots the view keeps the folded basename.
+    auto folded =
+        caseless && !wholename ? file->foldedBaseName() : std::nullopt;
+
     if (!set.empty()) {
-      bool matched;
-      w_string str;
+      if (folded) {
+        return set.count(*folded) > 0;
+      }
 
+      w_string_piece str;
       if (wholename) {
         str = ctx->getWholeName();
-        if (caseSensitive == CaseSensitivity::CaseInSensitive) {
-          str = str.piece().asLowerCase();
-        }
       } else {
-        str = caseSensitive == CaseSensitivity::CaseInSensitive
-            ? file->baseName().asLowerCase()
-            : file->baseName().asWString();
+        str = file->baseName();
       }
+      if (caseless) {
+        auto lower = str.asLowerCase();
+        return set.count(lower.piece()) > 0;
+      }
+      return set.count(str) > 0;
+    }
 
-      matched = set.find(str) != set.end();
-
-      return matched;
+    if (folded) {
+      return *folded == foldedName;
     }
 
     w_string_piece str;
@@ -59,7 +78,7 @@ class NameExpr : public QueryExpr {
       str = file->baseName();
     }
 
-    if (caseSensitive == CaseSensitivity::CaseInSensitive) {
+    if (caseless) {
       return w_string_equal_caseless(str, name);
     }
     return str == name;
@@ -135,6 +154,9 @@ class NameExpr : public QueryExpr {
 
     if (pattern) {
       data->name = json_to_w_string(name).normalizeSeparators();
+      if (caseSensitive == CaseSensitivity::CaseInSensitive) {
+        data->foldedName = data->name.piece().asLowerCase(data->name.type());
+      }
     }
 
     return std::unique_ptr<QueryExpr>(data);
@@ -151,6 +173,10 @@ class NameExpr : public QueryExpr {
     return parse(query, term, CaseSensitivity::CaseInSensitive);
   }
 
+  EvaluationCost evaluationCost() const override {
+    return wholename ? EvaluationCost::WholeName : EvaluationCost::BaseName;
+  }
+
   std::optional<std::vector<std::string>> computeGlobUpperBound(
       CaseSensitivity outputCaseSensitive) const override {
     if (caseSensitive == CaseSensitivity::CaseInSensitive &&
@@ -164,8 +190,8 @@ class NameExpr : public QueryExpr {
       return std::nullopt;
     }
     std::unordered_set<std::string> globUpperBound;
-    if (!set.empty()) {
-      for (const auto& s : set) {
+    if (!names.empty()) {
+      for (const auto& s : names) {
         w_string outputPattern = convertLiteralPathToGlob(s);
         if (outputCaseSensitive == CaseSensitivity::CaseInSensitive) {
           outputPattern = outputPattern.piece().asLowerCase();
@@ -182,6 +208,16 @@ class NameExpr : public QueryExpr {
     return std::vector<std::string>(
         globUpperBound.begin(), globUpperBound.end());
   }
+
+  std::optional<std::vector<w_string>> computeWholeNames() const override {
+    if (!wholename || caseSensitive == CaseSensitivity::CaseInSensitive) {
+      return std::nullopt;
+    }
+    if (!names.empty()) {
+      return names;
+    }
+    return std::vector<w_string>{name};
+  }
 };
 
 W_TERM_PARSER(name, NameExpr::parseName);
@@ -176,6 +176,18 @@ void parse_sync(Query* res, const json_ref& query) {
       parse_nonnegative_integer("sync_timeout", sync_timeout)};
 }
 
+W_CAP_REG("query_timeout")
+
+void parse_timeout(Query* res, const json_ref& query) {
+  auto timeout = query.get_optional("timeout");
+  if (timeout) {
+    if (!timeout->isInt() || timeout->asInt() <= 0) {
+      throw QueryParseError("timeout must be an integer value > 0");
+    }
+    res->timeout = std::chrono::milliseconds{timeout->asInt()};
+  }
+}
+
 void parse_lock_timeout(Query* res, const json_ref& query) {
   auto lock_timeout = query.get_default(
       "lock_timeout",
@@ -234,6 +246,159 @@ void parse_always_include_directories(Query* res, const json_ref& query) {
       parse_bool_param(query, "always_include_directories", false);
 }
 
+W_CAP_REG("stream")
+
+void parse_stream(Query* res, const json_ref& query) {
+  if (!parse_bool_param(query, "stream", false)) {
+    return;
+  }
+  auto batch_size = query.get_default("stream_batch_size", json_integer(1024));
+  if (!batch_size.isInt() || batch_size.asInt() <= 0) {
+    throw QueryParseError("stream_batch_size must be an integer value > 0");
+  }
+  res->streamBatchSize = batch_size.asInt();
+}
+
+#ifndef _WIN32
+W_CAP_REG("shared_memory")
+#endif
+
+void parse_shared_memory(Query* res, const json_ref& query) {
+  res->sharedMemory = parse_bool_param(query, "shared_memory", false);
+  if (res->sharedMemory && res->streamBatchSize) {
+    throw QueryParseError("shared_memory and stream can't be used together");
+  }
+}
+
+W_CAP_REG("limit")
+
+void parse_limit(Query* res, const json_ref& query) {
+  auto limit = query.get_optional("limit");
+  if (limit) {
+    if (!limit->isInt() || limit->asInt() <= 0) {
+      throw QueryParseError("limit must be an integer value > 0");
+    }
+    res->limit = limit->asInt();
+  }
+  res->existsOnly = parse_bool_param(query, "exists_only", false);
+  if (res->existsOnly) {
+    res->limit = 1;
+  }
+}
+
+W_CAP_REG("order_by")
+
+void parse_order(Query* res, const json_ref& query) {
+  auto order_by = query.get_optional("order_by");
+  if (!order_by) {
+    if (query.get_optional("page_size")) {
+      throw QueryParseError("page_size and page_token require order_by");
+    }
+    return;
+  }
+
+  QueryOrder order;
+  auto field = order_by->isString() ? json_to_w_string(*order_by) : w_string();
+  if (field == "name") {
+    order.field = QueryOrder::Name;
+  } else if (field == "mtime") {
+    order.field = QueryOrder::MTime;
+  } else {
+    throw QueryParseError("order_by must be one of \"name\" or \"mtime\"");
+  }
+  auto order_dir = query.get_default("order", w_string_to_json("asc"));
+  auto direction =
+      order_dir.isString() ? json_to_w_string(order_dir) : w_string();
+  if (direction == "desc") {
+    order.descending = true;
+  } else if (direction != "asc") {
+    throw QueryParseError("order must be one of \"asc\" or \"desc\"");
+  }
+  res->order = order;
+
+  if (res->limit) {
+    // The generators stop at the first matches, which needn't be the
+    // first in the order; page_size gives the first N in order instead.
+    throw QueryParseError(
+        "limit and exists_only can't be used with order_by; use page_size");
+  }
+
+  auto page_size = query.get_optional("page_size");
+  if (page_size) {
+    if (!page_size->isInt() || page_size->asInt() <= 0) {
+      throw QueryParseError("page_size must be an integer value > 0");
+    }
+    res->pageSize = page_size->asInt();
+  }
+}
+
+// Parsed separately from the order, as each page has its own token
+void parse_page_token(Query* res, const json_ref& query) {
+  auto page_token = query.get_optional("page_token");
+  if (!page_token) {
+    return;
+  }
+  if (!res->order) {
+    throw QueryParseError("page_size and page_token require order_by");
+  }
+  if (!page_token->isString()) {
+    throw QueryParseError("page_token must be a string");
+  }
+  res->pageCursor =
+      QueryPageCursor::fromToken(json_to_w_string(*page_token), *res->order);
+}
+
+W_CAP_REG("aggregate")
+
+void parse_aggregate(Query* res, const json_ref& query) {
+  auto aggregate = query.get_optional("aggregate");
+  if (!aggregate) {
+    return;
+  }
+  if (!aggregate->isObject()) {
+    throw QueryParseError("aggregate must be an object");
+  }
+
+  QueryAggregate agg;
+  auto group_by = aggregate->get_optional("group_by");
+  if (group_by) {
+    auto name = group_by->isString() ? json_to_w_string(*group_by) : w_string();
+    if (name == "dirname") {
+      agg.groupBy = QueryAggregate::DirName;
+    } else if (name == "suffix") {
+      agg.groupBy = QueryAggregate::Suffix;
+    } else {
+      throw QueryParseError(
+          "aggregate group_by must be one of \"dirname\" or \"suffix\"");
+    }
+  }
+
+  auto depth = aggregate->get_optional("depth");
+  if (depth) {
+    if (agg.groupBy != QueryAggregate::DirName) {
+      throw QueryParseError("aggregate depth requires group_by dirname");
+    }
+    if (!depth->isInt() || depth->asInt() < 0) {
+      throw QueryParseError("aggregate depth must be an integer value >= 0");
+    }
+    agg.depth = depth->asInt();
+  }
+
+  auto sum = aggregate->get_optional("sum");
+  if (sum) {
+    if (!sum->isString() || json_to_w_string(*sum) != "size") {
+      throw QueryParseError("aggregate sum must be \"size\"");
+    }
+    agg.sumSize = true;
+  }
+
+  if (res->limit || res->order) {
+    throw QueryParseError(
+        "aggregate can't be used with limit, exists_only or order_by");
+  }
+  res->aggregate = agg;
+}
+
 void parse_benchmark(Query* res, const json_ref& query) {
   // Preserve behavior by supporting a boolean value. Also support int values.
   auto bench = query.get_optional("bench");
@@ -259,24 +424,59 @@ void parse_case_sensitive(
                                        : CaseSensitivity::CaseInSensitive;
 }
 
-} // namespace
+// The options that only apply to the request that carries them.  They are
+// left out of the ParsedQueryCache key, and parsed for every request by
+// parse_request_options.
+constexpr const char* kRequestKeys[] = {
+    "since",
+    "request_id",
+    "sync_timeout",
+    "settle_period",
+    "settle_timeout",
+    "lock_timeout",
+    "timeout",
+    "stream",
+    "stream_batch_size",
+    "shared_memory",
+    "page_token",
+};
+
+w_string parsedQueryKey(const json_ref& query) {
+  auto spec = query.object();
+  for (auto key : kRequestKeys) {
+    spec.erase(w_string{key});
+  }
+  return w_string{json_dumps(
+      json_object(std::move(spec)), JSON_COMPACT | JSON_SORT_KEYS)};
+}
 
-std::shared_ptr<Query> parseQuery(
+void parse_request_options(Query* res, const json_ref& query) {
+  parse_sync(res, query);
+  parse_lock_timeout(res, query);
+  parse_timeout(res, query);
+  parse_stream(res, query);
+  parse_shared_memory(res, query);
+  parse_page_token(res, query);
+  parse_since(res, query);
+  parse_request_id(res, query);
+}
+
+// Parses everything but the request options
+void parse_query_body(
+    Query* res,
     const std::shared_ptr<Root>& root,
     const json_ref& query) {
-  auto result = std::make_shared<Query>();
-  auto res = result.get();
-
   parse_benchmark(res, query);
   parse_case_sensitive(res, root, query);
-  parse_sync(res, query);
   parse_dedup(res, query);
-  parse_lock_timeout(res, query);
   parse_relative_root(root, res, query);
   parse_empty_on_fresh_instance(res, query);
   parse_fail_if_no_saved_state(res, query);
   parse_omit_changed_files(res, query);
   parse_always_include_directories(res, query);
+  parse_limit(res, query);
+  parse_order(res, query);
+  parse_aggregate(res, query);
 
   /* Look for path generators */
   parse_paths(res, query);
@@ -287,16 +487,36 @@ std::shared_ptr<Query> parseQuery(
   /* Look for suffix generators */
   parse_suffixes(res, query);
 
-  /* Look for since generator */
-  parse_since(res, query);
-
   parse_query_expression(res, query);
 
-  parse_request_id(res, query);
-
   parse_field_list(query.get_optional("fields"), &res->fieldList);
+}
+
+} // namespace
+
+std::shared_ptr<Query> parseQuery(
+    const std::shared_ptr<Root>& root,
+    const json_ref& query) {
+  auto cacheSize = root->options.parsedQueryCacheSize;
+  std::optional<w_string> key;
+  std::shared_ptr<const Query> parsed;
+  if (cacheSize > 0 && query.isObject()) {
+    key = parsedQueryKey(query);
+    parsed = root->parsedQueryCache.lookup(*key);
+  }
+  if (!parsed) {
+    auto body = std::make_shared<Query>();
+    parse_query_body(body.get(), root, query);
+    if (key) {
+      root->parsedQueryCache.store(*key, body, cacheSize);
+    }
+    parsed = std::move(body);
+  }
 
-  res->query_spec = query;
+  // The copy shares the parsed expression and glob tree
+  auto result = std::make_shared<Query>(*parsed);
+  parse_request_options(result.get(), query);
+  result->query_spec = query;
 
   return result;
 }
@@ -6,7 +6,10 @@
  */
 
 #include <fmt/core.h>
+#include <cctype>
+#include <cstring>
 #include <memory>
+#include <string>
 #include "watchman/Errors.h"
 #include "watchman/fs/FileSystem.h"
 #include "watchman/query/FileResult.h"
@@ -21,22 +24,122 @@
 
 using namespace watchman;
 
+namespace {
+struct MatchDataDeleter {
+  void operator()(pcre2_match_data* matchData) const {
+    pcre2_match_data_free(matchData);
+  }
+};
+
+// Query shards may evaluate the same expression on several threads at once,
+// so match data can't live in the expression.  We only look at the return
+// code, so a single-pair ovector is enough for any pattern.
+pcre2_match_data* getMatchDataForThisThread() {
+  thread_local std::unique_ptr<pcre2_match_data, MatchDataDeleter> matchData{
+      pcre2_match_data_create(1, nullptr)};
+  if (!matchData) {
+    throw std::bad_alloc();
+  }
+  return matchData.get();
+}
+
+bool isPrefixLiteral(char c) {
+  return isalnum((unsigned char)c) || (c && strchr("_-/,=@%!:~ ", c));
+}
+
+// Returns literal text that any name matched by pattern must begin with,
+// or an empty string if we can't easily tell.  Only patterns anchored with
+// '^' and without top-level alternation have one; the text ends at the
+// first character that might be special.  When caseless, the prefix is
+// lowercased.
+std::string anchoredLiteralPrefix(const char* pattern, bool caseless) {
+  if (pattern[0] != '^') {
+    return {};
+  }
+
+  // Look for a '|' outside of any group, which would make the anchor apply
+  // to only one of the alternatives.
+  int depth = 0;
+  for (const char* pos = pattern; *pos; ++pos) {
+    switch (*pos) {
+      case '\\':
+        if (pos[1] == 'Q') {
+          // Quoted text runs to \E; don't bother parsing it
+          return {};
+        }
+        if (pos[1]) {
+          ++pos;
+        }
+        break;
+      case '[':
+        // Skip the class, allowing for a ']' as its first member
+        ++pos;
+        if (*pos == '^') {
+          ++pos;
+        }
+        if (*pos == ']') {
+          ++pos;
+        }
+        while (*pos && *pos != ']') {
+          if (*pos == '[' && pos[1] == ':') {
+            // POSIX classes contain a ']' of their own
+            return {};
+          }
+          if (*pos == '\\' && pos[1]) {
+            ++pos;
+          }
+          ++pos;
+        }
+        if (!*pos) {
+          return {};
+        }
+        break;
+      case '(':
+        ++depth;
+        break;
+      case ')':
+        --depth;
+        break;
+      case '|':
+        if (depth == 0) {
+          return {};
+        }
+        break;
+    }
+  }
+
+  std::string prefix;
+  const char* pos = pattern + 1;
+  while (isPrefixLiteral(*pos)) {
+    prefix.push_back(caseless ? char(tolower((unsigned char)*pos)) : *pos);
+    ++pos;
+  }
+  if (!prefix.empty() && *pos && strchr("?*+{", *pos)) {
+    // The quantifier applies to the last character
+    prefix.pop_back();
+  }
+  return prefix;
+}
+} // namespace
+
 class PcreExpr : public QueryExpr {
   pcre2_code* re;
-  pcre2_match_data* matchData;
   bool wholename;
+  bool caseless;
+  // Literal text that matching names begin with; see anchoredLiteralPrefix
+  std::string prefix;
 
  public:
-  explicit PcreExpr(pcre2_code* re, pcre2_match_data* matchData, bool wholename)
-      : re(re), matchData(matchData), wholename(wholename) {}
+  PcreExpr(pcre2_code* re, bool wholename, bool caseless, std::string prefix)
+      : re(re),
+        wholename(wholename),
+        caseless(caseless),
+        prefix(std::move(prefix)) {}
 
   ~PcreExpr() override {
     if (re) {
       pcre2_code_free(re);
     }
-    if (matchData) {
-      pcre2_match_data_free(matchData);
-    }
   }
 
   EvaluateResult evaluate(QueryContextBase* ctx, FileResult* file) override {
@@ -49,7 +152,9 @@ class PcreExpr : public QueryExpr {
       str = file->baseName();
     }
 
-    logf(ERR, "NAME: {}\n", str);
+    if (!hasPrefix(str)) {
+      return false;
+    }
 
     rc = pcre2_match(
         re,
@@ -57,14 +162,29 @@ class PcreExpr : public QueryExpr {
         str.size(),
         0,
         0,
-        matchData,
+        getMatchDataForThisThread(),
         nullptr);
-    logf(ERR, "RC: {}\n", rc);
     // Errors are either PCRE2_ERROR_NOMATCH or non actionable. Thus only match
     // when we get a positive return value.
     return rc >= 0;
   }
 
+  // Rules out most names that can't match without running the regex
+  bool hasPrefix(w_string_piece str) const {
+    if (str.size() < prefix.size()) {
+      return false;
+    }
+    if (!caseless) {
+      return memcmp(str.data(), prefix.data(), prefix.size()) == 0;
+    }
+    for (size_t i = 0; i < prefix.size(); ++i) {
+      if (tolower((unsigned char)str[i]) != prefix[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
   static std::unique_ptr<QueryExpr>
   parse(Query*, const json_ref& term, CaseSensitivity caseSensitive) {
     const char *pattern, *scope = "basename";
@@ -95,8 +215,6 @@ class PcreExpr : public QueryExpr {
           fmt::format("Invalid scope '{}' for {} expression", scope, which));
     }
 
-    logf(ERR, "PATTERN: {}\n", pattern);
-
     auto re = pcre2_compile(
         reinterpret_cast<const unsigned char*>(pattern),
         PCRE2_ZERO_TERMINATED,
@@ -122,13 +240,17 @@ class PcreExpr : public QueryExpr {
           pattern));
     }
 
-    auto matchData = pcre2_match_data_create_from_pattern(re, nullptr);
-    if (!matchData) {
-      throw std::bad_alloc();
-    }
+    // Compile the pattern to machine code where PCRE2 supports it;
+    // pcre2_match uses the JIT code when there is some, and otherwise
+    // falls back to the interpreter, so a failure here is harmless.
+    pcre2_jit_compile(re, PCRE2_JIT_COMPLETE);
 
+    bool caseless = caseSensitive == CaseSensitivity::CaseInSensitive;
     return std::make_unique<PcreExpr>(
-        re, matchData, !strcmp(scope, "wholename"));
+        re,
+        !strcmp(scope, "wholename"),
+        caseless,
+        anchoredLiteralPrefix(pattern, caseless));
   }
   static std::unique_ptr<QueryExpr> parsePcre(
       Query* query,
@@ -141,6 +263,11 @@ class PcreExpr : public QueryExpr {
     return parse(query, term, CaseSensitivity::CaseInSensitive);
   }
 
+  EvaluationCost evaluationCost() const override {
+    return wholename ? EvaluationCost::WholeName
+                     : EvaluationCost::BaseNamePattern;
+  }
+
   std::optional<std::vector<std::string>> computeGlobUpperBound(
       CaseSensitivity) const override {
     // We could, in principle, try to reverse-engineer the expression into a
@@ -13,6 +13,7 @@
 
 #include <folly/Overload.h>
 
+#include <algorithm>
 #include <memory>
 
 using namespace watchman;
@@ -161,11 +162,48 @@ class SinceExpr : public QueryExpr {
     return std::make_unique<SinceExpr>(std::move(spec), selected_field);
   }
 
+  EvaluationCost evaluationCost() const override {
+    return EvaluationCost::Metadata;
+  }
+
   std::optional<std::vector<std::string>> computeGlobUpperBound(
       CaseSensitivity) const override {
     // `since` doesn't constrain the path.
     return std::nullopt;
   }
+
+  void narrowColumnFilter(QueryContextBase* ctx, ColumnFilter& filter)
+      const override {
+    auto since = spec->evaluate(
+        ctx->clockAtStartOfQuery.position(),
+        ctx->lastAgeOutTickValueAtStartOfQuery);
+
+    // The columns hold the clocks' ticks but not their timestamps
+    switch (field) {
+      case since_what::SINCE_OCLOCK:
+      case since_what::SINCE_CCLOCK: {
+        auto* since_clock = std::get_if<QuerySince::Clock>(&since.since);
+        if (!since_clock || since_clock->is_fresh_instance) {
+          return;
+        }
+        auto& after = field == since_what::SINCE_OCLOCK ? filter.otimeAfter
+                                                        : filter.ctimeAfter;
+        after = std::max(after, ClockTicks(since_clock->ticks));
+        return;
+      }
+      case since_what::SINCE_MTIME:
+      case since_what::SINCE_CTIME: {
+        auto* since_ts = std::get_if<QuerySince::Timestamp>(&since.since);
+        if (!since_ts) {
+          return;
+        }
+        auto& min = field == since_what::SINCE_MTIME ? filter.minMtimeSec
+                                                     : filter.minCtimeSec;
+        min = std::max(min, int64_t(since_ts->time));
+        return;
+      }
+    }
+  }
 };
 W_TERM_PARSER(since, SinceExpr::parse);
 
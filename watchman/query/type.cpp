@@ -103,11 +103,45 @@ class TypeExpr : public QueryExpr {
     return std::make_unique<TypeExpr>(arg);
   }
 
+  EvaluationCost evaluationCost() const override {
+    return EvaluationCost::FileType;
+  }
+
   std::optional<std::vector<std::string>> computeGlobUpperBound(
       CaseSensitivity) const override {
     // `type` doesn't constrain the path.
     return std::nullopt;
   }
+
+  void narrowColumnFilter(QueryContextBase*, ColumnFilter& filter)
+      const override {
+    switch (arg) {
+      case 'b':
+        filter.allowOnly(DType::Block);
+        break;
+      case 'c':
+        filter.allowOnly(DType::Char);
+        break;
+      case 'p':
+        filter.allowOnly(DType::Fifo);
+        break;
+      case 's':
+        filter.allowOnly(DType::Socket);
+        break;
+      case 'd':
+        filter.allowOnly(DType::Dir);
+        break;
+      case 'f':
+        filter.allowOnly(DType::Regular);
+        break;
+      case 'l':
+        filter.allowOnly(DType::Symlink);
+        break;
+      default:
+        // Doors have no dtype of their own
+        break;
+    }
+  }
 };
 W_TERM_PARSER(type, TypeExpr::parse);
 
@@ -7,16 +7,22 @@
 
 #pragma once
 
+#include <algorithm>
+#include <chrono>
 #include <memory>
 #include <unordered_map>
 #include "watchman/Clock.h"
 #include "watchman/CookieSync.h"
 #include "watchman/IgnoreSet.h"
+#include "watchman/Metrics.h"
 #include "watchman/PendingCollection.h"
 #include "watchman/PubSub.h"
 #include "watchman/Serde.h"
 #include "watchman/WatchmanConfig.h"
 #include "watchman/fs/FileSystem.h"
+#include "watchman/query/ParsedQueryCache.h"
+#include "watchman/query/QueryAdmission.h"
+#include "watchman/saved_state/SavedStatePrefetcher.h"
 #include "watchman/thirdparty/jansson/jansson.h"
 #include "watchman/watchman_string.h"
 
@@ -30,6 +36,8 @@ class Root;
 struct TriggerCommand;
 class QueryableView;
 struct QueryContext;
+struct SharedSubscriptionResults;
+struct QueryFieldRenderer;
 class PerfSample;
 
 enum ClientStateDisposition {
@@ -90,6 +98,50 @@ class ClientStateAssertions {
           states_;
 };
 
+/**
+ * Chooses the settle period from the rate at which changes are arriving.
+ *
+ * A quiet root settles after `minimum` so that single file saves are
+ * reported promptly.  As the rate approaches `busyRate` changes per second,
+ * the settle period grows towards `maximum`, so that subscribers are not
+ * woken repeatedly in the middle of a large operation such as a rebase.
+ */
+struct AdaptiveSettle {
+  std::chrono::milliseconds minimum;
+  std::chrono::milliseconds maximum;
+  double busyRate;
+
+  std::chrono::milliseconds periodFor(double eventsPerSecond) const {
+    auto fraction = std::clamp(eventsPerSecond / busyRate, 0.0, 1.0);
+    return minimum +
+        std::chrono::milliseconds{static_cast<int64_t>(
+            fraction * (maximum - minimum).count())};
+  }
+};
+
+/**
+ * The options of a root that are read each time a query, subscription or
+ * recrawl runs, resolved when the root is watched so that reading one is a
+ * field load rather than a lookup by name under the global config lock.
+ * A root's configuration doesn't change while it is watched.
+ */
+struct RootOptions {
+  bool freshInstanceSavedState;
+  std::chrono::seconds savedStatePrefetchMaxAge;
+  // Zero disables the query result cache
+  size_t queryResultCacheSize;
+  // Zero disables the parsed query cache
+  size_t parsedQueryCacheSize;
+  uint32_t subscriptionLockTimeoutMs;
+  bool enforceUniqueSubscriptionNames;
+  bool suppressRecrawlWarnings;
+  bool scopedRecrawl;
+  // How many heavy queries may run at once; zero doesn't limit them
+  size_t heavyQuerySlots;
+
+  explicit RootOptions(const Configuration& config);
+};
+
 class RootConfig {
  public:
   /* path to root */
@@ -137,6 +189,11 @@ struct RootQueryInfo : serde::Object {
   int64_t generation_duration_milliseconds;
   int64_t render_duration_milliseconds;
   int64_t view_lock_wait_duration_milliseconds;
+  int64_t cpu_time_microseconds;
+  int64_t allocated_bytes;
+  int64_t files_walked;
+  int64_t files_rendered;
+  int64_t bytes_encoded;
   w_string state;
   int64_t client_pid;
   std::optional<w_string> request_id;
@@ -151,6 +208,11 @@ struct RootQueryInfo : serde::Object {
     x("render-duration-milliseconds", render_duration_milliseconds);
     x("view-lock-wait-duration-milliseconds",
       view_lock_wait_duration_milliseconds);
+    x("cpu-time-microseconds", cpu_time_microseconds);
+    x("allocated-bytes", allocated_bytes);
+    x("files-walked", files_walked);
+    x("files-rendered", files_rendered);
+    x("bytes-encoded", bytes_encoded);
     x("state", state);
     x("client-pid", client_pid);
     x("request-id", request_id);
@@ -168,6 +230,7 @@ struct RootDebugStatus : serde::Object {
   std::vector<w_string> cookie_prefix;
   std::vector<w_string> cookie_dir;
   std::vector<w_string> cookie_list;
+  uint64_t coalesced_cookie_count;
   RootRecrawlInfo recrawl_info;
   std::vector<RootQueryInfo> queries;
   bool done_initial;
@@ -185,6 +248,7 @@ struct RootDebugStatus : serde::Object {
     x("cookie_prefix", cookie_prefix);
     x("cookie_dir", cookie_dir);
     x("cookie_list", cookie_list);
+    x("coalesced_cookie_count", coalesced_cookie_count);
     x("recrawl_info", recrawl_info);
     x("queries", queries);
     x("done_initial", done_initial);
@@ -224,8 +288,19 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
   /* config options loaded via json file */
   std::optional<json_ref> config_file;
   Configuration config;
+  const RootOptions options;
 
   const std::chrono::milliseconds trigger_settle{0};
+  /**
+   * When set, the settle period adapts to the recent event rate rather than
+   * always being trigger_settle.
+   */
+  const std::optional<AdaptiveSettle> adaptive_settle;
+  /**
+   * The settle period most recently chosen by adaptive_settle, in
+   * milliseconds.  Reported in subscription responses.
+   */
+  std::atomic<int64_t> adaptive_settle_ms{0};
   /**
    * Don't GC more often than this.
    *
@@ -241,6 +316,42 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
   // Stream of broadcast unilateral items emitted by this root
   std::shared_ptr<Publisher> unilateralResponses;
 
+  // The most recent results of each distinct subscription query, by
+  // ClientSubscription::sharedResultsKey.  Held weakly: the subscriptions
+  // that reported the results keep them alive.
+  folly::Synchronized<std::unordered_map<
+      w_string,
+      std::weak_ptr<const SharedSubscriptionResults>>>
+      sharedSubscriptionResults;
+  // For each ClientSubscription::sharedResultsKey, the fields that the
+  // subscriptions with that key render, with how many of them want each
+  folly::Synchronized<std::unordered_map<
+      w_string,
+      std::unordered_map<QueryFieldRenderer*, size_t>>>
+      sharedSubscriptionFields;
+  // Where each durable subscription, by name, resumes from when it is made
+  // again; see ClientSubscription::resumeSince
+  folly::Synchronized<std::unordered_map<w_string, ClockSpec>>
+      durableSubscriptionClocks;
+  // The dirs that active subscriptions are confined to, with how many of
+  // them are confined to each.  The IO thread processes the changes within
+  // these first; see ClientSubscription::setScopes
+  folly::Synchronized<std::unordered_map<w_string, size_t>>
+      subscriptionScopes;
+
+  // Saved states found for this root's scm-aware queries, refreshed when
+  // the working copy moves
+  SavedStatePrefetcher savedStatePrefetcher;
+
+  // Latency histograms and counters reported by `debug-metrics`
+  RootMetrics metrics;
+
+  // Takes turns among the heavy queries, when heavy_query_slots is set
+  QueryAdmission queryAdmission;
+
+  // Recently parsed queries, when parsed_query_cache_size is set
+  ParsedQueryCache parsedQueryCache;
+
   struct RecrawlInfo {
     /* how many times we've had to recrawl */
     uint64_t recrawlCount = 0;
@@ -282,7 +393,7 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
     std::atomic<bool> cancelled{false};
 
     /* map of cursor name => last observed tick value */
-    folly::Synchronized<std::unordered_map<w_string, ClockTicks>> cursors;
+    CursorMap cursors;
 
     /// Set by connection threads and read on the iothread.
     std::atomic<std::chrono::steady_clock::time_point> last_cmd_timestamp{
@@ -294,10 +405,11 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
 
   // For debugging and diagnostic purposes, this set references
   // all outstanding query contexts that are executing against this root.
-  // If is only safe to read the query contexts while the queries.rlock()
-  // is held, and even then it is only really safe to read fields that
-  // are not changed by the query exection.
-  folly::Synchronized<std::unordered_set<QueryContext*>> queries;
+  // It is sharded by context so that concurrent queries don't contend on
+  // it as they start and finish.  It is only safe to read a query context
+  // while its shard's rlock() is held, and even then it is only really safe
+  // to read fields that are not changed by the query exection.
+  ShardedSynchronized<std::unordered_set<QueryContext*>> queries;
 
   /**
    * Returns the view with which this Root was constructed.
@@ -316,12 +428,22 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
       SaveGlobalStateHook saveGlobalStateHook);
   ~Root();
 
+  // Called by the IO thread when it settles; performs the next step of an
+  // age-out once gc_interval has passed since the last one began.
   void considerAgeOut();
   void performAgeOut(std::chrono::seconds min_age);
+  // Called when the system is short of memory; trims the view's caches
+  // and ages out the tombstones older than min_age, or gc_age if that is
+  // sooner, rather than waiting for the next age-out.  Returns a
+  // description of what was released.
+  json_ref relieveMemoryPressure(std::chrono::seconds min_age);
   folly::SemiFuture<folly::Unit> waitForSettle(
       std::chrono::milliseconds settle_period);
   CookieSync::SyncResult syncToNow(std::chrono::milliseconds timeout);
   void scheduleRecrawl(const char* why);
+  // Recrawls only the subtree at scope, falling back to the whole root if
+  // scope is the root or the view can't recrawl a subtree.
+  void scheduleRecrawl(const char* why, const w_string& scope);
   void recrawlTriggered(const char* why);
 
   // Requests cancellation of the root.
@@ -335,6 +457,8 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
   void stopThreads();
   bool stopWatch();
   json_ref triggerListToJson() const;
+  // The scheduling counters of each trigger, keyed by trigger name
+  json_ref triggerStatsToJson() const;
 
   static std::vector<RootDebugStatus> getStatusForAllRoots();
   RootDebugStatus getStatus() const;
@@ -347,6 +471,10 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
   }
 
  private:
+  void scheduleFullRecrawl(const char* why);
+  // Forgets the named cursors that predate the last age-out.
+  void ageOutCursors();
+
   const std::shared_ptr<QueryableView> view_;
 
   /// A hook that allows saving Watchman's state after key operations. Usually
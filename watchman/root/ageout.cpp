@@ -5,6 +5,7 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <algorithm>
 #include "watchman/QueryableView.h"
 #include "watchman/root/Root.h"
 
@@ -15,13 +16,23 @@ void Root::considerAgeOut() {
     return;
   }
 
-  auto now = std::chrono::system_clock::now();
-  if (now <= view()->getLastAgeOutTimeStamp() + gc_interval) {
-    // Don't check too often
-    return;
+  auto view = this->view();
+  if (!view->isAgeOutInProgress()) {
+    auto now = std::chrono::system_clock::now();
+    if (now <= view->getLastAgeOutTimeStamp() + gc_interval) {
+      // Don't check too often
+      return;
+    }
   }
 
-  performAgeOut(gc_age);
+  watchman::PerfSample sample("age_out");
+  if (view->ageOutStep(sample, gc_age)) {
+    ageOutCursors();
+  }
+  if (sample.finish()) {
+    addPerfSampleMetadata(sample);
+    sample.log();
+  }
 }
 
 void Root::performAgeOut(std::chrono::seconds min_age) {
@@ -33,23 +44,39 @@ void Root::performAgeOut(std::chrono::seconds min_age) {
   watchman::PerfSample sample("age_out");
 
   view()->ageOut(sample, std::chrono::seconds(min_age));
+  ageOutCursors();
+
+  if (sample.finish()) {
+    addPerfSampleMetadata(sample);
+    sample.log();
+  }
+}
+
+json_ref Root::relieveMemoryPressure(std::chrono::seconds min_age) {
+  auto released = view()->relieveMemoryPressure();
+  // An age-out changes what clients see, so leave it alone if the root
+  // has age-outs turned off
+  if (gc_interval.count() != 0) {
+    auto age = std::min(min_age, gc_age);
+    performAgeOut(age);
+    released.set("tombstone_age_seconds", json_integer(age.count()));
+  }
+  return released;
+}
 
-  // Age out cursors too.
-  {
-    auto cursors = inner.cursors.wlock();
+void Root::ageOutCursors() {
+  auto lastAgeOutTick = view()->getLastAgeOutTickValue();
+  inner.cursors.forEachShard([&](auto& shard) {
+    auto cursors = shard.wlock();
     auto it = cursors->begin();
     while (it != cursors->end()) {
-      if (it->second < view()->getLastAgeOutTickValue()) {
+      if (it->second < lastAgeOutTick) {
         it = cursors->erase(it);
       } else {
         ++it;
       }
     }
-  }
-  if (sample.finish()) {
-    addPerfSampleMetadata(sample);
-    sample.log();
-  }
+  });
 }
 
 /* vim:ts=2:sw=2:et:
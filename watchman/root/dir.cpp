@@ -6,15 +6,30 @@
  */
 
 #include "watchman/watchman_dir.h"
+#include "watchman/NodeArena.h"
 #include "watchman/watchman_file.h"
 
 void watchman_dir::Deleter::operator()(watchman_file* file) const {
   free_file_node(file);
 }
 
+void watchman_dir::DirDeleter::operator()(watchman_dir* dir) const {
+  dir->~watchman_dir();
+  watchman::NodeArena::deallocate(dir);
+}
+
 watchman_dir::watchman_dir(w_string name, watchman_dir* parent)
     : name(std::move(name)), parent(parent) {}
 
+std::unique_ptr<watchman_dir, watchman_dir::DirDeleter> watchman_dir::make(
+    w_string name,
+    watchman_dir* parent,
+    watchman::NodeArena& arena) {
+  auto mem = arena.allocate(sizeof(watchman_dir));
+  return std::unique_ptr<watchman_dir, DirDeleter>(
+      new (mem) watchman_dir(std::move(name), parent));
+}
+
 w_string watchman_dir::getFullPath() const {
   return getFullPathToChild(w_string_piece());
 }
@@ -35,36 +50,50 @@ watchman_dir* watchman_dir::getChildDir(w_string_piece name) const {
   return it->second.get();
 }
 
-w_string watchman_dir::getFullPathToChild(w_string_piece extra) const {
+uint32_t watchman_dir::fullPathLength(w_string_piece child) const {
   uint32_t length = 0;
-  if (extra.size()) {
-    length = extra.size() + 1 /* separator */;
+  if (child.size()) {
+    length = child.size() + 1 /* separator */;
   }
   for (const watchman_dir* d = this; d; d = d->parent) {
     length += d->name.size() + 1 /* separator OR final NUL terminator */;
   }
+  return length - 1;
+}
 
-  auto* s = watchman::StringHeader::alloc(length - 1, W_STRING_BYTE);
-
-  char* buf = s->buf();
-  char* end = buf + s->len;
-
-  *end = 0;
-  if (extra.size()) {
-    end -= extra.size();
-    memcpy(end, extra.data(), extra.size());
+void watchman_dir::writeFullPathToChild(char* end, w_string_piece child)
+    const {
+  if (child.size()) {
+    end -= child.size();
+    memcpy(end, child.data(), child.size());
   }
   for (const watchman_dir* d = this; d; d = d->parent) {
-    if (d != this || (extra.size())) {
+    if (d != this || (child.size())) {
       --end;
       *end = '/';
     }
     end -= d->name.size();
     memcpy(end, d->name.data(), d->name.size());
   }
+}
+
+w_string watchman_dir::getFullPathToChild(w_string_piece extra) const {
+  auto* s = watchman::StringHeader::alloc(fullPathLength(extra), W_STRING_BYTE);
+
+  char* end = s->buf() + s->len;
+  *end = 0;
+  writeFullPathToChild(end, extra);
 
   return w_string{s};
 }
 
+w_string_piece watchman_dir::renderFullPathToChild(
+    std::string& buffer,
+    w_string_piece child) const {
+  buffer.resize(fullPathLength(child));
+  writeFullPathToChild(&buffer[0] + buffer.size(), child);
+  return w_string_piece(buffer.data(), buffer.size());
+}
+
 /* vim:ts=2:sw=2:et:
  */
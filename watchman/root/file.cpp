@@ -6,37 +6,51 @@
  */
 
 #include "watchman/watchman_file.h"
+#include <algorithm>
+#include "watchman/NodeArena.h"
 #ifdef __APPLE__
 #include <sys/attr.h> // @manual
 #endif
 
-void watchman_file::removeFromFileList() {
-  if (next) {
-    next->prev = prev;
-  }
-  // file->prev points to the address of either
-  // `previous_file->next` OR `root->inner.latest_file`.
-  // This next assignment is therefore fixing up either
-  // the linkage from the prior file node or from the
-  // head of the list.
-  if (prev) {
-    *prev = next;
+void watchman_file::removeFromRecencyIndex() {
+  // The RecencyIndex skips cleared slots and reclaims them when it next
+  // compacts itself.
+  if (recencySlot) {
+    *recencySlot = nullptr;
+    recencySlot = nullptr;
   }
 }
 
 /* We embed our name string in the tail end of the struct that we're
  * allocating here.  This turns out to be more memory efficient due
- * to the way that the allocator bins sizeof(watchman_file); there's
+ * to the way that the arena bins sizeof(watchman_file); there's
  * a bit of unusable space after the end of the structure that happens
  * to be about the right size to fit a typical filename.
  * Embedding the name in the end allows us to make the most of this
  * memory and free up the separate heap allocation for file_name.
+ * With foldCase, a lower cased copy of the name follows it, unless the
+ * name is already lower case.
  */
 std::unique_ptr<watchman_file, watchman_dir::Deleter> watchman_file::make(
     const w_string& name,
-    watchman_dir* parent) {
-  auto file = (watchman_file*)calloc(
-      1, sizeof(watchman_file) + sizeof(uint32_t) + name.size() + 1);
+    watchman_dir* parent,
+    watchman::NodeArena& arena,
+    bool foldCase) {
+  auto folded = FoldedName::None;
+  if (foldCase) {
+    folded = std::any_of(
+                 name.data(),
+                 name.data() + name.size(),
+                 [](char c) { return c >= 'A' && c <= 'Z'; })
+        ? FoldedName::Stored
+        : FoldedName::SameAsName;
+  }
+  size_t nameSize = name.size() + 1;
+
+  // The arena hands out zero-filled storage
+  auto file = (watchman_file*)arena.allocate(
+      sizeof(watchman_file) + sizeof(uint32_t) +
+      (folded == FoldedName::Stored ? 2 * nameSize : nameSize));
   std::unique_ptr<watchman_file, watchman_dir::Deleter> filePtr(
       file, watchman_dir::Deleter());
 
@@ -46,20 +60,29 @@ std::unique_ptr<watchman_file, watchman_dir::Deleter> watchman_file::make(
   auto data = (char*)(lenPtr + 1);
   memcpy(data, name.data(), name.size());
   data[name.size()] = 0;
+  if (folded == FoldedName::Stored) {
+    watchman::foldAsciiCase(name.data(), data + nameSize, name.size());
+    data[nameSize + name.size()] = 0;
+  }
 
   file->parent = parent;
+  file->folded_name = folded;
   file->exists = true;
 
   return filePtr;
 }
 
 watchman_file::~watchman_file() {
-  removeFromFileList();
+  // When the entire view is being torn down there is no point in keeping
+  // the recency index consistent.
+  if (!watchman::NodeArena::isBulkReleasing(this)) {
+    removeFromRecencyIndex();
+  }
 }
 
 void free_file_node(struct watchman_file* file) {
   file->~watchman_file();
-  free(file);
+  watchman::NodeArena::deallocate(file);
 }
 
 /* vim:ts=2:sw=2:et:
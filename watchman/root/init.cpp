@@ -21,6 +21,29 @@ namespace {
 /// Idle out watches that haven't had activity in several days
 inline constexpr json_int_t kDefaultReapAge = 86400 * 5;
 inline constexpr json_int_t kDefaultSettlePeriod = 20;
+inline constexpr json_int_t kDefaultAdaptiveSettleMax = 500;
+inline constexpr double kDefaultSettleBusyRate = 500;
+
+std::optional<AdaptiveSettle> computeAdaptiveSettle(
+    const Configuration& config) {
+  if (!config.getBool("settle_adaptive", false)) {
+    return std::nullopt;
+  }
+  auto settle = config.getInt("settle", kDefaultSettlePeriod);
+  auto minimum = config.getInt("settle_min", settle);
+  auto maximum = std::max(
+      minimum,
+      config.getInt(
+          "settle_max", std::max(settle, kDefaultAdaptiveSettleMax)));
+  auto busyRate = config.getDouble("settle_busy_rate", kDefaultSettleBusyRate);
+  if (busyRate <= 0) {
+    busyRate = kDefaultSettleBusyRate;
+  }
+  return AdaptiveSettle{
+      std::chrono::milliseconds{minimum},
+      std::chrono::milliseconds{maximum},
+      busyRate};
+}
 } // namespace
 
 void ClientStateAssertions::queueAssertion(
@@ -216,6 +239,23 @@ IgnoreSet computeIgnoreSet(
     }
   }
 
+  if (auto globs = config.get("ignore_globs")) {
+    if (!globs->isArray()) {
+      logf(ERR, "ignore_globs must be an array of strings\n");
+    } else {
+      for (auto& jglob : globs->array()) {
+        if (!jglob.isString()) {
+          logf(ERR, "ignore_globs must be an array of strings\n");
+          continue;
+        }
+
+        auto pattern = json_to_w_string(jglob);
+        result.addGlob(root_path, pattern);
+        logf(DBG, "ignoring paths matching {}\n", pattern);
+      }
+    }
+  }
+
   auto ignores = getIgnoreVcs(config);
   for (auto& jignore : ignores.array()) {
     if (!jignore.isString()) {
@@ -235,6 +275,25 @@ IgnoreSet computeIgnoreSet(
   return result;
 }
 
+RootOptions::RootOptions(const Configuration& config)
+    : freshInstanceSavedState(
+          config.getBool("fresh_instance_saved_state", false)),
+      savedStatePrefetchMaxAge(
+          config.getInt("saved_state_prefetch_max_age_seconds", 600)),
+      queryResultCacheSize(size_t(std::max<json_int_t>(
+          config.getInt("query_result_cache_size", 0), 0))),
+      parsedQueryCacheSize(size_t(std::max<json_int_t>(
+          config.getInt("parsed_query_cache_size", 32), 0))),
+      subscriptionLockTimeoutMs(
+          uint32_t(config.getInt("subscription_lock_timeout_ms", 100))),
+      enforceUniqueSubscriptionNames(
+          config.getBool("enforce_unique_subscription_names", false)),
+      suppressRecrawlWarnings(
+          config.getBool("suppress_recrawl_warnings", false)),
+      scopedRecrawl(config.getBool("scoped_recrawl", false)),
+      heavyQuerySlots(size_t(
+          std::max<json_int_t>(config.getInt("heavy_query_slots", 0), 0))) {}
+
 Root::Root(
     FileSystem& fileSystem,
     const w_string& root_path,
@@ -246,11 +305,16 @@ Root::Root(
     : RootConfig{root_path, fs_type, getCaseSensitivityForPath(root_path.c_str()), computeIgnoreSet(root_path, config_)},
       cookies(
           fileSystem,
-          computeCookieDir(root_path, config_, case_sensitive, ignore)),
-      enable_parallel_crawl{config_.getBool("enable_parallel_crawl", false)},
+          computeCookieDir(root_path, config_, case_sensitive, ignore),
+          std::chrono::milliseconds(
+              config_.getInt("cookie_coalesce_ms", 50))),
+      enable_parallel_crawl{config_.getBool("enable_parallel_crawl", true)},
       config_file(std::move(config_file)),
       config(std::move(config_)),
+      options(config),
       trigger_settle(int(config.getInt("settle", kDefaultSettlePeriod))),
+      adaptive_settle(computeAdaptiveSettle(config)),
+      adaptive_settle_ms(trigger_settle.count()),
       gc_interval(
           int(config.getInt("gc_interval_seconds", DEFAULT_GC_INTERVAL))),
       gc_age(int(config.getInt("gc_age_seconds", DEFAULT_GC_AGE))),
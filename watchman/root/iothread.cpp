@@ -6,9 +6,21 @@
  */
 
 #include <fmt/chrono.h>
+#include <folly/ScopeGuard.h>
+#include <algorithm>
 #include <chrono>
+#include <cstdio>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include "watchman/Errors.h"
 #include "watchman/InMemoryView.h"
+#include "watchman/Shutdown.h"
+#include "watchman/Trace.h"
+#include "watchman/ViewSnapshot.h"
+#include "watchman/fs/FSDetect.h"
+#include "watchman/fs/FileSystem.h"
 #include "watchman/fs/ParallelWalk.h"
 #include "watchman/root/Root.h"
 #include "watchman/root/warnerr.h"
@@ -18,7 +30,20 @@
 
 namespace watchman {
 
+namespace {
+// How often the IO thread looks again at whether it may resume the
+// background work that it deferred during an asserted state
+constexpr std::chrono::milliseconds kBackgroundWorkDeferRecheck{1000};
+} // namespace
+
 folly::SemiFuture<folly::Unit> InMemoryView::waitUntilReadyToQuery() {
+  // Queries wait for the parts of the initial crawl that they need
+  if (crawlFrontier_.lock()->tracking) {
+    return folly::makeSemiFuture();
+  }
+  if (pacingCrawl_.load(std::memory_order_relaxed)) {
+    crawlBoosted_.store(true, std::memory_order_relaxed);
+  }
   auto [p, f] = folly::makePromiseContract<folly::Unit>();
   auto pending = pendingFromWatcher_.lock();
   pending->addSync(std::move(p));
@@ -33,6 +58,7 @@ void InMemoryView::fullCrawl(
   root->recrawlInfo.wlock()->crawlStart = std::chrono::steady_clock::now();
 
   PerfSample sample("full-crawl");
+  TraceSpan span{"fullCrawl"};
 
   auto view = view_.wlock();
   // Ensure that we observe these files with a new, distinct clock,
@@ -40,11 +66,67 @@ void InMemoryView::fullCrawl(
   // can get stuck with an empty view until another change is observed
   mostRecentTick_.fetch_add(1, std::memory_order_acq_rel);
 
+  bool resumed = false;
+  bool seeded = false;
+  if (root->recrawlInfo.rlock()->recrawlCount == 0) {
+    // When the watcher is replaying the changes made since the snapshot was
+    // taken there is no need to revalidate the loaded nodes.
+    bool loaded = loadViewSnapshot(*view);
+    resumed = loaded && watcher_->resumed();
+    // A view exported by another daemon is answered from straight away, and
+    // verified once the root is ready
+    if (!loaded) {
+      seeded = resumed = loadSeedSnapshot(*view);
+    }
+  }
+
   fullCrawlStatCount_ = std::make_shared<std::atomic<size_t>>(0);
   root->recrawlInfo.wlock()->statCount = fullCrawlStatCount_;
+#ifndef _WIN32
+  if (dirFdCache_) {
+    // A recrawl may be because notifications were lost, including the ones
+    // that would have told us that an open dir was renamed or deleted
+    dirFdCache_->invalidate(root->root_path);
+  }
+#endif
 
   auto start = std::chrono::system_clock::now();
-  pendingFromWatcher.lock()->add(root->root_path, start, W_PENDING_RECURSIVE);
+  if (resumed) {
+    try {
+      auto st = fileSystem_.getFileInformation(
+          root->root_path.c_str(), root->case_sensitive);
+      view->setRootInode(st.ino);
+      logf(ERR, "resuming {} from the view snapshot\n", root->root_path);
+    } catch (const std::system_error& exc) {
+      logf(
+          ERR,
+          "failed to stat {}, crawling it instead of resuming: {}\n",
+          root->root_path,
+          exc.what());
+      resumed = false;
+    }
+  }
+  bool initialCrawl =
+      !resumed && root->recrawlInfo.rlock()->recrawlCount == 0;
+  // Queries for the dirs crawled so far may be answered during the initial
+  // crawl; a recrawl replaces what they would have seen.
+  trackingCrawlFrontier_ = initialCrawl && partialCrawlQueries_;
+  if (!trackingCrawlFrontier_) {
+    stopTrackingCrawlFrontier();
+  }
+  if (!resumed) {
+    pendingFromWatcher.lock()->add(
+        root->root_path, start, W_PENDING_RECURSIVE);
+  }
+  // Only the initial crawl is lazy; a recrawl crawls everything again
+  lazyCrawling_ = initialCrawl && lazyCrawlDepth_ > 0;
+  // The server's attributes were just listed along with the dirs, so the
+  // initial crawl needn't ask for each file's again.  A recrawl may be
+  // looking for changes that the cache hasn't seen yet.
+  crawlStatsDontSync_ = initialCrawl && is_network_fs_type(root->fs_type) &&
+      config_.getBool("crawl_stat_dont_sync", true);
+  crawlBoosted_.store(false, std::memory_order_relaxed);
+  pacingCrawl_.store(true, std::memory_order_relaxed);
   while (true) {
     // There is the potential for a subtle race condition here.  Since we now
     // coalesce overlaps we must consume our outstanding set before we merge
@@ -53,15 +135,34 @@ void InMemoryView::fullCrawl(
     // translates to a two level loop; the outer loop sweeps in data from
     // inotify, then the inner loop processes it and any dirs that we pick up
     // from recursive processing.
-    {
-      auto lock = pendingFromWatcher.lock();
-      localPending.append(lock->stealItems(), lock->stealSyncs());
-    }
+    pendingFromWatcher.drainInto(pendingFromWatcher.lock(), localPending);
     if (localPending.empty()) {
       break;
     }
 
-    (void)processAllPending(root, *view, localPending);
+    if (!trackingCrawlFrontier_) {
+      (void)processAllPending(root, *view, localPending);
+      continue;
+    }
+    // Let the queries that may be answered already read the view
+    (void)processAllPending(root, *view, localPending, [&] {
+      view.unlock();
+      view = view_.wlock();
+      // Whatever a query saw in the meantime is as of the previous tick
+      mostRecentTick_.fetch_add(1, std::memory_order_acq_rel);
+    });
+  }
+
+  if (trackingCrawlFrontier_) {
+    trackingCrawlFrontier_ = false;
+    stopTrackingCrawlFrontier();
+  }
+  lazyCrawling_ = false;
+  crawlStatsDontSync_ = false;
+  pacingCrawl_.store(false, std::memory_order_relaxed);
+  setThreadIoPriority(IoPriority::Normal);
+  if (auto deferred = deferredDirs_.rlock()->size()) {
+    logf(ERR, "deferred crawling {} dirs until they are needed\n", deferred);
   }
 
   auto recrawlInfo = root->recrawlInfo.wlock();
@@ -70,6 +171,9 @@ void InMemoryView::fullCrawl(
   recrawlInfo->statCount = nullptr;
   fullCrawlStatCount_ = nullptr;
   root->inner.done_initial.store(true, std::memory_order_release);
+  // The crawl touched every file; only hash the ones that change after it
+  // ahead of time.
+  lastEagerWarmedTick_ = mostRecentTick_;
 
   // There is no need to hold locks while logging, and abortAllCookies resolves
   // a Promise which can run arbitrary code, so locks must be released here.
@@ -79,6 +183,14 @@ void InMemoryView::fullCrawl(
 
   root->cookies.abortAllCookies();
 
+  if (seeded) {
+    // Nothing watches the seeded dirs yet, and the tree may differ from the
+    // one the seed was exported from.  Crawling it like any other change
+    // adds the watches and fixes up the view, without holding off queries.
+    pendingFromWatcher.lock()->add(
+        root->root_path, std::chrono::system_clock::now(), W_PENDING_RECURSIVE);
+  }
+
   root->addPerfSampleMetadata(sample);
 
   sample.finish();
@@ -88,6 +200,19 @@ void InMemoryView::fullCrawl(
   logf(ERR, "{}crawl complete\n", recrawlCount ? "re" : "");
 }
 
+bool InMemoryView::isBackgroundWorkDeferred(Root& root) {
+  if (backgroundWorkDeferStates_.empty()) {
+    return false;
+  }
+  auto asserted = root.assertedStates.rlock();
+  for (auto& name : backgroundWorkDeferStates_) {
+    if (asserted->isStateAsserted(name)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 InMemoryView::Continue InMemoryView::doSettleThings(
     Root& root,
     IoThreadState& state) {
@@ -99,14 +224,40 @@ InMemoryView::Continue InMemoryView::doSettleThings(
             std::chrono::steady_clock::now() - *state.lastUnsettle)
       : std::chrono::milliseconds{0};
 
-  warmContentCache();
+  // While a state such as hg.update is asserted, leave the disk to it
+  bool deferBackgroundWork = isBackgroundWorkDeferred(root);
+  if (deferBackgroundWork) {
+    backgroundWorkDeferrals_.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    warmContentCache();
+    // Catch up on anything that had to wait for room while we were busy
+    warmMatchingContentCache();
+    crawlNextDeferredDir();
+    auditNextDirs(root);
+    caches_.contentHashCache.flushStore();
+  }
 
-  root.unilateralResponses->enqueue(json_object({{"settled", json_true()}}));
+  auto settled = json_object({{"settled", json_true()}});
+  if (state.changeTimes && state.changeTimesProcessed) {
+    // Tell the subscribers how long the oldest change they are about to
+    // report took to get here
+    state.changeTimes->settled = std::chrono::system_clock::now();
+    root.metrics.changeLatency.processedToSettled.record(
+        state.changeTimes->settled - state.changeTimes->processed);
+    settled.set("change_times", state.changeTimes->asJsonValue());
+    state.changeTimes.reset();
+    state.changeTimesProcessed = false;
+  }
+  root.unilateralResponses->enqueue(std::move(settled));
 
   if (root.considerReap()) {
     root.stopWatch();
     return Continue::Stop;
   }
+  if (considerHibernate(root)) {
+    state.currentTimeout = state.biggestTimeout;
+    return Continue::Continue;
+  }
 
   std::optional<std::chrono::milliseconds> nextPendingSettle;
 
@@ -131,10 +282,276 @@ InMemoryView::Continue InMemoryView::doSettleThings(
         std::min(state.biggestTimeout, state.currentTimeout * 2);
   }
 
+  if (deferBackgroundWork) {
+    // Look again soon, so that the work resumes shortly after the state is
+    // left
+    state.currentTimeout =
+        std::min(state.currentTimeout, kBackgroundWorkDeferRecheck);
+    return Continue::Continue;
+  }
+
   root.considerAgeOut();
+  if (isAgeOutInProgress()) {
+    // Come back for the next step soon, unless something else needs doing
+    state.currentTimeout = std::min(state.currentTimeout, root.trigger_settle);
+  }
+  if (sanityAuditInterval_.count() > 0) {
+    // Come back for the next slice of the audit
+    state.currentTimeout = std::min(state.currentTimeout, sanityAuditInterval_);
+  }
   return Continue::Continue;
 }
 
+void InMemoryView::paceCrawl() {
+  if (!pacingCrawl_.load(std::memory_order_relaxed)) {
+    setThreadIoPriority(IoPriority::Normal);
+    return;
+  }
+  setThreadIoPriority(crawlIoPriority());
+  if (crawlMaxDirsPerSec_ == 0 ||
+      crawlBoosted_.load(std::memory_order_relaxed)) {
+    return;
+  }
+
+  // Take the next free slot, spaced evenly across the second, and wait
+  // for it to come around
+  const int64_t interval = 1'000'000'000 / int64_t(crawlMaxDirsPerSec_);
+  const int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::steady_clock::now().time_since_epoch())
+                          .count();
+  auto slot = nextCrawlSlot_.load(std::memory_order_relaxed);
+  int64_t mine;
+  do {
+    mine = std::max(slot, now);
+  } while (!nextCrawlSlot_.compare_exchange_weak(
+      slot, mine + interval, std::memory_order_relaxed));
+  if (mine > now) {
+    std::this_thread::sleep_for(std::chrono::nanoseconds(mine - now));
+  }
+}
+
+void InMemoryView::crawlNextDeferredDir() {
+  w_string dir;
+  {
+    auto deferred = deferredDirs_.wlock();
+    if (deferred->empty()) {
+      return;
+    }
+    dir = *deferred->begin();
+    deferred->erase(deferred->begin());
+  }
+  // The root will settle again once this is done, and we'll take the next
+  logf(DBG, "crawling deferred dir {} while idle\n", dir);
+  auto pending = pendingFromWatcher_.lock();
+  pending->add(
+      dir,
+      std::chrono::system_clock::now(),
+      W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY);
+  pending->ping();
+}
+
+void InMemoryView::auditNextDirs(Root& root) {
+  if (sanityAuditInterval_.count() == 0 ||
+      hibernating_.load(std::memory_order_acquire)) {
+    return;
+  }
+  auto now = std::chrono::steady_clock::now();
+  if (now - lastSanityAudit_ < sanityAuditInterval_) {
+    return;
+  }
+  lastSanityAudit_ = now;
+
+  // This is background work, so it shouldn't compete with anyone's I/O
+  setThreadIoPriority(IoPriority::Idle);
+  SCOPE_EXIT {
+    setThreadIoPriority(IoPriority::Normal);
+  };
+
+  std::vector<w_string> subdirs;
+  for (size_t i = 0; i < sanityAuditDirs_; ++i) {
+    if (sanityAuditQueue_.empty()) {
+      if (i > 0) {
+        // Start the next pass at the next interval
+        break;
+      }
+      sanityAuditQueue_.push_back(rootPath_);
+      ++sanityAuditStats_.passes;
+    }
+    auto dirPath = std::move(sanityAuditQueue_.front());
+    sanityAuditQueue_.pop_front();
+
+    subdirs.clear();
+    if (auditDir(root, dirPath, subdirs)) {
+      ++sanityAuditStats_.recrawls;
+      // Anything below it is recrawled too, so there's no need to audit it
+      root.scheduleRecrawl("sanity audit found the view out of date", dirPath);
+      continue;
+    }
+    for (auto& subdir : subdirs) {
+      sanityAuditQueue_.push_back(std::move(subdir));
+    }
+  }
+}
+
+bool InMemoryView::auditDir(
+    Root& root,
+    const w_string& dirPath,
+    std::vector<w_string>& subdirs) {
+  TraceSpan span{"auditDir"};
+  if (lazyCrawlDepth_ > 0 && deferredDirs_.rlock()->count(dirPath)) {
+    return false;
+  }
+
+  // Changes made in the last couple of seconds may still be on their way
+  // from the watcher, so they aren't held against the view.  A dir whose
+  // entries changed recently is left for the next pass.
+  const time_t stableBefore = time(nullptr) - 2 -
+      std::chrono::duration_cast<std::chrono::seconds>(root.trigger_settle)
+          .count();
+  auto isRecent = [&](const FileInformation& st) {
+    return st.ctime.tv_sec >= stableBefore || st.mtime.tv_sec >= stableBefore;
+  };
+
+  std::unordered_map<w_string, FileInformation> onDisk;
+  try {
+    if (isRecent(
+            fileSystem_.getFileInformation(
+                dirPath.c_str(), root.case_sensitive))) {
+      return false;
+    }
+    auto osdir = fileSystem_.openDir(dirPath.c_str());
+    while (const DirEntry* dirent = osdir->readDir()) {
+      if (dirent->d_name[0] == '.' &&
+          (!strcmp(dirent->d_name, ".") || !strcmp(dirent->d_name, ".."))) {
+        continue;
+      }
+      w_string name{dirent->d_name, W_STRING_BYTE};
+      if (dirent->has_stat) {
+        onDisk.emplace(std::move(name), dirent->stat);
+        continue;
+      }
+      try {
+        auto st = fileSystem_.getFileInformation(
+            w_string::pathCat({dirPath, name}).c_str(), root.case_sensitive);
+        onDisk.emplace(std::move(name), st);
+      } catch (const std::system_error&) {
+        // It went away while we were looking
+      }
+    }
+  } catch (const std::system_error& err) {
+    // Gone or unreadable, which the watcher or the parent's audit will see
+    logf(DBG, "sanity audit couldn't read {}: {}\n", dirPath, err.what());
+    return false;
+  }
+
+  // Whether the view should hold name at all
+  auto isTracked = [&](const w_string& fullPath) {
+    return !root.cookies.isCookiePrefix(fullPath) &&
+        !root.ignore.isIgnoreDir(fullPath);
+  };
+
+  size_t entries = 0;
+  size_t discrepancies = 0;
+  {
+    auto view = view_.rlock();
+    auto* dir = view->resolveDir(dirPath);
+    if (!dir || !dir->last_check_existed) {
+      // Never crawled, or deleted; the parent's audit covers it
+      return false;
+    }
+
+    for (auto& [name, st] : onDisk) {
+      auto fullPath = w_string::pathCat({dirPath, name});
+      if (!isTracked(fullPath) || isRecent(st)) {
+        continue;
+      }
+      ++entries;
+      auto* file = dir->getChildFile(name);
+      bool differs = !file || !file->exists ||
+          file->stat.isDir() != st.isDir() ||
+          file->stat.isSymlink() != st.isSymlink() ||
+          // A dir's own size and times change with its entries, which are
+          // audited in their own right
+          (!st.isDir() &&
+           (file->stat.size() != st.size ||
+            file->stat.mtime().tv_sec != st.mtime.tv_sec ||
+            file->stat.mtime().tv_nsec != st.mtime.tv_nsec));
+      if (differs) {
+        logf(DBG, "sanity audit: {} differs from the view\n", fullPath);
+        ++discrepancies;
+      } else if (
+          st.isDir() && !root.ignore.isIgnoreVCS(fullPath) &&
+          !root.ignore.isIgnoreVCS(dirPath)) {
+        subdirs.push_back(std::move(fullPath));
+      }
+    }
+
+    std::unordered_set<w_string_piece> namesOnDisk;
+    namesOnDisk.reserve(onDisk.size());
+    for (auto& entry : onDisk) {
+      namesOnDisk.insert(entry.first.piece());
+    }
+    for (auto& it : dir->files) {
+      auto* file = it.second.get();
+      if (!file->exists || namesOnDisk.count(file->getName())) {
+        continue;
+      }
+      auto fullPath = dir->getFullPathToChild(file->getName());
+      if (!isTracked(fullPath)) {
+        continue;
+      }
+      ++entries;
+      logf(DBG, "sanity audit: {} is gone from disk\n", fullPath);
+      ++discrepancies;
+    }
+  }
+
+  ++sanityAuditStats_.dirs;
+  sanityAuditStats_.entries += entries;
+  sanityAuditStats_.discrepancies += discrepancies;
+  if (discrepancies > 0) {
+    log(ERR,
+        "sanity audit found ",
+        discrepancies,
+        " of ",
+        entries,
+        " entries of ",
+        dirPath,
+        " out of date in the view\n");
+    return true;
+  }
+  return false;
+}
+
+void InMemoryView::addToCrawlFrontier(const w_string& path) {
+  crawlFrontier_.lock()->dirs.insert(path);
+}
+
+void InMemoryView::removeFromCrawlFrontier(const w_string& path) {
+  {
+    auto frontier = crawlFrontier_.lock();
+    auto it = frontier->dirs.find(path);
+    if (it == frontier->dirs.end()) {
+      return;
+    }
+    frontier->dirs.erase(it);
+  }
+  crawlFrontierCond_.notify_all();
+}
+
+void InMemoryView::stopTrackingCrawlFrontier() {
+  {
+    auto frontier = crawlFrontier_.lock();
+    if (!frontier->tracking) {
+      return;
+    }
+    frontier->tracking = false;
+    frontier->dirs.clear();
+  }
+  // Whoever is waiting falls back to waiting for the whole crawl
+  crawlFrontierCond_.notify_all();
+}
+
 void InMemoryView::clientModeCrawl(const std::shared_ptr<Root>& root) {
   PendingChanges pending;
   fullCrawl(root, pendingFromWatcher_, pending);
@@ -158,12 +575,303 @@ std::chrono::milliseconds getBiggestTimeout(const Root& root) {
 
 } // namespace
 
+std::chrono::milliseconds InMemoryView::getBiggestIoTimeout(
+    const Root& root) const {
+  auto biggestTimeout = getBiggestTimeout(root);
+  if (hibernateAge_.count() != 0) {
+    // Wake up in time to notice that the root has gone idle
+    biggestTimeout =
+        std::min<std::chrono::milliseconds>(biggestTimeout, hibernateAge_);
+  }
+  return biggestTimeout;
+}
+
 void InMemoryView::ioThread(const std::shared_ptr<Root>& root) {
-  IoThreadState state{getBiggestTimeout(*root)};
+  IoThreadState state{getBiggestIoTimeout(*root)};
   state.currentTimeout = root->trigger_settle;
 
   while (Continue::Continue == stepIoThread(root, state, pendingFromWatcher_)) {
   }
+
+  finishIoThread(root, state);
+}
+
+void InMemoryView::finishIoThread(
+    const std::shared_ptr<Root>& root,
+    IoThreadState& state) {
+  caches_.contentHashCache.flushStore();
+  if (hibernating_.load(std::memory_order_acquire)) {
+    // The view is on disk rather than in memory.  It is only as up to date
+    // as the moment it hibernated, but the crawl after a restart
+    // revalidates whatever a snapshot holds.
+    auto path = hibernationPath();
+    auto snapshot = ViewSnapshot::pathForRoot(rootPath_);
+    if (enableViewSnapshot_ && w_is_stopping() && !snapshot.empty()) {
+#ifdef _WIN32
+      std::remove(snapshot.c_str());
+#endif
+      std::rename(path.c_str(), snapshot.c_str());
+    }
+    std::remove(path.c_str());
+    return;
+  }
+  // A view with deferred dirs is incomplete, and a snapshot of it would be
+  // resumed without them
+  saveViewSnapshot(
+      root->inner.done_initial.load(std::memory_order_acquire) &&
+      !root->recrawlInfo.rlock()->shouldRecrawl &&
+      state.localPending.empty() && hotFiles_.heldCount() == 0 &&
+      deferredDirs_.rlock()->empty());
+}
+
+bool InMemoryView::loadViewSnapshot(ViewDatabase& view) {
+  if (!enableViewSnapshot_) {
+    return false;
+  }
+  auto path = ViewSnapshot::pathForRoot(rootPath_);
+  if (path.empty()) {
+    return false;
+  }
+
+  PerfSample sample("load-view-snapshot");
+  try {
+    auto count = ViewSnapshot::load(
+        view,
+        *watcher_,
+        rootPath_,
+        path,
+        getClock(std::chrono::system_clock::now()));
+    sample.add_meta(
+        "view_snapshot",
+        json_object(
+            {{"path", w_string_to_json(path)},
+             {"files", json_integer(count)}}));
+    sample.finish();
+    sample.force_log();
+    sample.log();
+    logf(ERR, "loaded {} files from view snapshot {}\n", count, path);
+    return true;
+  } catch (const std::system_error& exc) {
+    if (exc.code() != error_code::no_such_file_or_directory) {
+      logf(ERR, "failed to load view snapshot {}: {}\n", path, exc.what());
+    }
+  } catch (const std::exception& exc) {
+    // Anything that was loaded before the error is harmless: the crawl that
+    // follows will revalidate every node and mark the stragglers deleted.
+    logf(ERR, "failed to load view snapshot {}: {}\n", path, exc.what());
+  }
+  return false;
+}
+
+bool InMemoryView::loadSeedSnapshot(ViewDatabase& view) {
+  if (seedSnapshotPath_.empty()) {
+    return false;
+  }
+
+  PerfSample sample("load-seed-snapshot");
+  try {
+    // The seed was recorded for the root on another host, or at another path
+    auto count = ViewSnapshot::load(
+        view,
+        *watcher_,
+        w_string{},
+        seedSnapshotPath_,
+        getClock(std::chrono::system_clock::now()));
+    sample.add_meta(
+        "view_snapshot",
+        json_object(
+            {{"path", w_string_to_json(seedSnapshotPath_)},
+             {"files", json_integer(count)}}));
+    sample.finish();
+    sample.force_log();
+    sample.log();
+    logf(
+        ERR,
+        "seeded {} files from view snapshot {}\n",
+        count,
+        seedSnapshotPath_);
+    return true;
+  } catch (const std::exception& exc) {
+    // As with our own snapshot, the crawl that follows revalidates anything
+    // that was loaded before the error.
+    logf(
+        ERR,
+        "failed to load seed view snapshot {}, crawling instead: {}\n",
+        seedSnapshotPath_,
+        exc.what());
+  }
+  return false;
+}
+
+size_t InMemoryView::exportViewSnapshot(const w_string& path) {
+  // No resume token: it describes this host's watcher, not the importer's
+  auto view = view_.rlock();
+  return ViewSnapshot::save(*view, rootPath_, path);
+}
+
+void InMemoryView::saveViewSnapshot(bool crawled) {
+  if (!enableViewSnapshot_) {
+    return;
+  }
+  auto path = ViewSnapshot::pathForRoot(rootPath_);
+  if (path.empty()) {
+    return;
+  }
+
+  // Only persist the view when the whole daemon is going away; a root that
+  // is being removed by watch-del or reaping has no use for a snapshot.
+  if (!w_is_stopping()) {
+    std::remove(path.c_str());
+    return;
+  }
+
+  // The token is only good if every notification received up to it has
+  // made it into the view.
+  w_string resumeToken;
+  {
+    auto lock = pendingFromWatcher_.lock();
+    if (crawled && lock->empty()) {
+      resumeToken = appendedResumeToken_;
+    }
+  }
+
+  try {
+    auto view = view_.rlock();
+    auto count = ViewSnapshot::save(*view, rootPath_, path, resumeToken);
+    logf(DBG, "saved {} files to view snapshot {}\n", count, path);
+  } catch (const std::exception& exc) {
+    logf(ERR, "failed to save view snapshot {}: {}\n", path, exc.what());
+  }
+}
+
+w_string InMemoryView::hibernationPath() const {
+  auto path = ViewSnapshot::pathForRoot(rootPath_);
+  if (path.empty()) {
+    return path;
+  }
+  return w_string{fmt::format("{}.hibernated", path)};
+}
+
+bool InMemoryView::considerHibernate(Root& root) {
+  if (hibernateAge_.count() == 0 ||
+      hibernating_.load(std::memory_order_acquire)) {
+    return false;
+  }
+  auto lastCmd = root.inner.last_cmd_timestamp.load(std::memory_order_acquire);
+  if (std::chrono::steady_clock::now() < lastCmd + hibernateAge_) {
+    return false;
+  }
+  // Triggers and subscriptions evaluate every change against the view
+  if (!root.triggers.rlock()->empty() ||
+      root.unilateralResponses->hasSubscribers()) {
+    return false;
+  }
+  if (!deferredDirs_.rlock()->empty() || isAgeOutInProgress()) {
+    return false;
+  }
+  auto path = hibernationPath();
+  if (path.empty()) {
+    return false;
+  }
+
+  auto view = view_.wlock();
+  // Announce the hibernation before looking at the clients again: a client
+  // that resolved the root since then either shows up here, or sees the
+  // flag when it asks for the view and waits for it to be rehydrated.
+  hibernating_.store(true);
+  if (root.inner.last_cmd_timestamp.load() != lastCmd) {
+    hibernating_.store(false);
+    return false;
+  }
+
+  PerfSample sample("hibernate-view");
+  size_t count;
+  try {
+    count = ViewSnapshot::save(*view, rootPath_, path);
+  } catch (const std::exception& exc) {
+    logf(ERR, "failed to hibernate {}: {}\n", rootPath_, exc.what());
+    hibernating_.store(false);
+    return false;
+  }
+  view->clear();
+  ++hibernationCount_;
+
+  sample.add_meta(
+      "hibernate",
+      json_object(
+          {{"path", w_string_to_json(path)}, {"files", json_integer(count)}}));
+  sample.finish();
+  sample.force_log();
+  sample.log();
+  logf(
+      ERR,
+      "root {} has had no activity in {}, hibernated its view of {} files "
+      "to {}\n",
+      rootPath_,
+      hibernateAge_,
+      count,
+      path);
+  return true;
+}
+
+std::optional<InMemoryView::Continue> InMemoryView::stepHibernating(
+    const std::shared_ptr<Root>& root,
+    IoThreadState& state) {
+  // The watcher's changes pile up in localPending until the view is back
+  state.currentTimeout = state.biggestTimeout;
+  bool recrawl = root->recrawlInfo.rlock()->shouldRecrawl;
+  // A sync is a client waiting on the view, perhaps one that raced with
+  // the hibernation
+  bool wanted = rehydrateRequested_.exchange(false) ||
+      state.localPending.hasSyncs() || recrawl;
+  if (!wanted) {
+    if (root->considerReap()) {
+      root->stopWatch();
+      return Continue::Stop;
+    }
+    return Continue::Continue;
+  }
+
+  auto path = hibernationPath();
+  PerfSample sample("rehydrate-view");
+  {
+    auto view = view_.wlock();
+    // The reloaded files carry no history, so clients whose clocks predate
+    // the hibernation see a fresh instance, as they would after an age-out
+    auto now = std::chrono::system_clock::now();
+    lastAgeOutTick_ =
+        mostRecentTick_.fetch_add(1, std::memory_order_acq_rel) + 1;
+    lastAgeOutTimestamp_ = now;
+    try {
+      auto count =
+          ViewSnapshot::load(*view, *watcher_, rootPath_, path, getClock(now));
+      sample.add_meta(
+          "rehydrate",
+          json_object(
+              {{"path", w_string_to_json(path)},
+               {"files", json_integer(count)}}));
+      logf(ERR, "rehydrated {} files of {} from {}\n", count, rootPath_, path);
+    } catch (const std::exception& exc) {
+      logf(
+          ERR,
+          "failed to rehydrate {} from {}, recrawling: {}\n",
+          rootPath_,
+          path,
+          exc.what());
+      recrawl = true;
+    }
+    hibernating_.store(false, std::memory_order_release);
+  }
+  std::remove(path.c_str());
+  if (recrawl) {
+    root->scheduleRecrawl("rehydrating a hibernated view");
+  }
+  sample.finish();
+  sample.force_log();
+  sample.log();
+
+  // Carry on with the changes that were held while it hibernated
+  return std::nullopt;
 }
 
 InMemoryView::Continue InMemoryView::stepIoThread(
@@ -179,6 +887,11 @@ InMemoryView::Continue InMemoryView::stepIoThread(
     // Reduce sleep timeout to the settle duration ready for the next loop
     // through.
     state.currentTimeout = root->trigger_settle;
+    if (root->adaptive_settle) {
+      state.currentTimeout = root->adaptive_settle->periodFor(state.eventRate);
+      root->adaptive_settle_ms.store(
+          state.currentTimeout.count(), std::memory_order_relaxed);
+    }
   };
 
   if (!root->inner.done_initial.load(std::memory_order_acquire)) {
@@ -192,12 +905,35 @@ InMemoryView::Continue InMemoryView::stepIoThread(
   // Wait for the notify thread to give us pending items, or for
   // the settle period to expire
   {
-    logf(DBG, "poll_events timeout={}ms\n", state.currentTimeout);
-    auto targetPendingLock =
-        pendingFromWatcher.lockAndWait(state.currentTimeout);
+    auto timeout = state.waitForEvents ? state.currentTimeout
+                                       : std::chrono::milliseconds{0};
+    // Wake up in time to release the hot files that are due
+    if (auto due = hotFiles_.nextDue()) {
+      auto untilDue = std::chrono::ceil<std::chrono::milliseconds>(
+          *due - std::chrono::steady_clock::now());
+      timeout = std::clamp(untilDue, std::chrono::milliseconds{0}, timeout);
+    }
+    logf(DBG, "poll_events timeout={}ms\n", timeout);
+    auto targetPendingLock = pendingFromWatcher.lockAndWait(timeout);
     logf(DBG, " ... wake up\n");
-    state.localPending.append(
-        targetPendingLock->stealItems(), targetPendingLock->stealSyncs());
+    if (root->adaptive_settle) {
+      state.eventRate = targetPendingLock->sampleEventRate(
+          std::chrono::steady_clock::now());
+    }
+    auto handedOff = pendingFromWatcher.drainInto(
+        std::move(targetPendingLock), state.localPending);
+    state.drained = true;
+    if (handedOff) {
+      if (!state.handedOff) {
+        state.handedOff = handedOff;
+      }
+      if (!state.changeTimes) {
+        state.changeTimes = ChangeTimes{};
+        state.changeTimes->changed =
+            state.localPending.oldestChange().value_or(*handedOff);
+        state.changeTimes->pending = *handedOff;
+      }
+    }
   }
 
   if (root->inner.cancelled.load(std::memory_order_acquire)) {
@@ -206,6 +942,12 @@ InMemoryView::Continue InMemoryView::stepIoThread(
     return Continue::Stop;
   }
 
+  if (hibernating_.load(std::memory_order_acquire)) {
+    if (auto result = stepHibernating(root, state)) {
+      return *result;
+    }
+  }
+
   // Has a Watcher indicated this root needs a recrawl?
   // TODO: scheduleRecrawl should be replaced with a regular event published in
   // the PendingCollection.
@@ -213,6 +955,12 @@ InMemoryView::Continue InMemoryView::stepIoThread(
     auto info = root->recrawlInfo.wlock();
     info->recrawlCount++;
     root->inner.done_initial.store(false, std::memory_order_release);
+    // The crawl stats the hot files along with everything else
+    hotFiles_.clear();
+    // The recrawl reports everything as a fresh instance
+    state.handedOff.reset();
+    state.changeTimes.reset();
+    state.changeTimesProcessed = false;
     // Now that done_initial is false, the next pass will recrawl.
     return Continue::Continue;
   }
@@ -224,8 +972,17 @@ InMemoryView::Continue InMemoryView::stepIoThread(
       root->inner.done_initial.load(std::memory_order_acquire),
       "A full crawl should not be pending at this point in the loop.");
 
+  // Hot files that have had their window get their final stat
+  if (hotFiles_.enabled()) {
+    for (auto& change : hotFiles_.takeDue(std::chrono::steady_clock::now())) {
+      state.localPending.add(change.path, change.now, change.flags);
+    }
+    hotFilesHeld_.store(hotFiles_.heldCount(), std::memory_order_relaxed);
+  }
+
   // Waiting for an event timed out or we were woken with a ping, so still
-  // consider the root settled.
+  // consider the root settled.  That includes while hot files are held, so
+  // that a file being appended to doesn't hold back subscribers.
   if (state.localPending.empty()) {
     return doSettleThings(*root, state);
   }
@@ -239,33 +996,133 @@ InMemoryView::Continue InMemoryView::stepIoThread(
   //
   // Careful with this knob: it adds latency to every query by delaying cookie
   // processing.
-  auto notify_sleep_ms = config_.getInt("notify_sleep_ms", 0);
-  if (notify_sleep_ms) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(notify_sleep_ms));
+  if (notifySleep_.count()) {
+    std::this_thread::sleep_for(notifySleep_);
   }
 
+  TraceSpan lockSpan{"view.wlock"};
   auto view = view_.wlock();
+  lockSpan.end();
 
   mostRecentTick_.fetch_add(1, std::memory_order_acq_rel);
 
-  auto isDesynced = processAllPending(root, *view, state.localPending);
+  auto eventsBefore = root->metrics.events.load(std::memory_order_relaxed);
+  auto isDesynced = processAllPending(root, *view, state.localPending, [&] {
+    view.unlock();
+    TraceSpan relockSpan{"view.wlock"};
+    view = view_.wlock();
+    relockSpan.end();
+    // Whatever a query saw in the meantime is as of the previous tick
+    mostRecentTick_.fetch_add(1, std::memory_order_acq_rel);
+  });
   if (isDesynced == IsDesynced::Yes) {
     logf(ERR, "recrawl complete, aborting all pending cookies\n");
     root->cookies.abortAllCookies();
   }
+  view.unlock();
+
+  auto processed = std::chrono::system_clock::now();
+  if (state.handedOff) {
+    root->metrics.changeLatency.pendingToProcessed.record(
+        processed - *state.handedOff);
+    state.handedOff.reset();
+  }
+  if (state.changeTimes && !state.changeTimesProcessed) {
+    state.changeTimes->processed = processed;
+    state.changeTimesProcessed = true;
+  }
+
+  // Start hashing the hot files that just changed, so that they are ready
+  // by the time someone asks for them.  The next settle catches up on
+  // those that were deferred.
+  if (!isBackgroundWorkDeferred(*root)) {
+    warmMatchingContentCache();
+  }
 
   // Always mark unsettled after processing events because settle durations
-  // should only include idle time, not time spent processing events.
-  markUnsettled(state);
+  // should only include idle time, not time spent processing events.  A
+  // pass in which every change was held for a hot file processed nothing.
+  if (!hotFiles_.enabled() ||
+      root->metrics.events.load(std::memory_order_relaxed) != eventsBefore) {
+    markUnsettled(state);
+  }
   return Continue::Continue;
 }
 
+namespace {
+
+// Returns the deepest directory that contains both a and b.
+w_string commonAncestor(const w_string& a, const w_string& b) {
+  std::string_view av = a.view();
+  std::string_view bv = b.view();
+  size_t len = std::min(av.size(), bv.size());
+  size_t i = 0;
+  while (i < len && av[i] == bv[i]) {
+    ++i;
+  }
+  if (i == av.size() && (i == bv.size() || is_slash(bv[i]))) {
+    return a;
+  }
+  if (i == bv.size() && is_slash(av[i])) {
+    return b;
+  }
+  // Back up to the last separator that they share
+  while (i > 0 && !is_slash(av[i - 1])) {
+    --i;
+  }
+  return w_string{av.substr(0, i > 0 ? i - 1 : 0)};
+}
+
+// Whether path is strictly below dir.
+bool isBelow(w_string_piece path, w_string_piece dir) {
+  return path.size() > dir.size() && is_slash(path[dir.size()]) &&
+      path.startsWith(dir);
+}
+
+// Whether dir, or any dir below it, holds a file that exists.
+bool hasExistingFiles(const watchman_dir* dir) {
+  for (auto& it : dir->files) {
+    if (it.second->exists) {
+      return true;
+    }
+  }
+  for (auto& it : dir->dirs) {
+    if (hasExistingFiles(it.second.get())) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Whether HotFileDebouncer may hold a change: a plain notification that
+// one path changed, rather than a crawl, a cookie or the root itself.
+bool isDebounceable(
+    const Root& root,
+    const w_string& rootPath,
+    const PendingChange& pending) {
+  return (pending.flags & W_PENDING_VIA_NOTIFY) &&
+      !(pending.flags & W_PENDING_RECURSIVE) &&
+      !(pending.flags & W_PENDING_NONRECURSIVE_SCAN) &&
+      !(pending.flags & W_PENDING_CRAWL_ONLY) &&
+      !(pending.flags & W_PENDING_IS_DESYNCED) && pending.path != rootPath &&
+      !root.cookies.isCookiePrefix(pending.path);
+}
+
+} // namespace
+
 InMemoryView::IsDesynced InMemoryView::processAllPending(
     const std::shared_ptr<Root>& root,
     ViewDatabase& view,
-    PendingChanges& coll) {
+    PendingChanges& coll,
+    const std::function<void()>& yieldViewLock) {
+  TraceSpan span{"processAllPending"};
   auto desyncState = IsDesynced::No;
 
+  // Checking the clock after every item would add up over a large batch
+  constexpr size_t kItemsPerClockCheck = 64;
+  size_t itemsHeld = 0;
+  auto lockAcquired = std::chrono::steady_clock::now();
+
   // Don't resolve any of these until any recursive crawls are done.
   std::vector<std::vector<folly::Promise<folly::Unit>>> allSyncs;
 
@@ -277,7 +1134,69 @@ InMemoryView::IsDesynced InMemoryView::processAllPending(
   // to all pending change events.
   std::vector<w_string> pendingCookies;
 
-  while (!coll.empty()) {
+  // The deepest directory containing the notified paths in this batch
+  std::optional<w_string> notifiedScope;
+
+  // Changes within the scopes of subscriptions go first, so that those
+  // subscriptions needn't wait for the rest of a storm
+  std::vector<w_string> priorityScopes;
+  {
+    auto scopes = root->subscriptionScopes.rlock();
+    for (auto& [scope, count] : *scopes) {
+      priorityScopes.push_back(scope);
+    }
+  }
+  auto isPriority = [&](const watchman_pending_fs& pending) {
+    if (root->cookies.isCookiePrefix(pending.path)) {
+      return false;
+    }
+    for (auto& scope : priorityScopes) {
+      if (pending.path == scope || isBelow(pending.path, scope)) {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  auto yieldNow = [&] {
+    {
+      auto holds = viewLockHolds_.wlock();
+      holds->record(std::chrono::steady_clock::now() - lockAcquired);
+      ++holds->yields;
+    }
+    yieldViewLock();
+    lockAcquired = std::chrono::steady_clock::now();
+    itemsHeld = 0;
+  };
+
+  // A stolen batch, grouped by parent directory, with the groups of
+  // priority changes first
+  struct PendingInDir {
+    watchman_pending_fs* pending;
+    std::string_view dir;
+    bool priority;
+  };
+  std::vector<PendingInDir> batch;
+  std::unordered_map<w_string_piece, std::optional<FileInformation>> scanned;
+
+  // Set once the held hot files have been released for a waiting client
+  bool releasedHotFiles = false;
+
+  while (true) {
+    if (coll.empty()) {
+      // A cookie or sync is a client waiting to observe every change so far
+      if (releasedHotFiles || hotFiles_.heldCount() == 0 ||
+          (pendingCookies.empty() && allSyncs.empty())) {
+        break;
+      }
+      for (auto& change :
+           hotFiles_.takeAll(std::chrono::steady_clock::now())) {
+        coll.add(change.path, change.now, change.flags);
+      }
+      releasedHotFiles = true;
+      continue;
+    }
+
     logf(
         DBG,
         "processing {} events in {}\n",
@@ -286,40 +1205,211 @@ InMemoryView::IsDesynced InMemoryView::processAllPending(
 
     auto pending = coll.stealItems();
     auto syncs = coll.stealSyncs();
+    auto moves = coll.stealMoves();
     if (syncs.empty()) {
       w_check(
-          pending != nullptr,
+          pending != nullptr || !moves.empty(),
           "coll.stealItems() and coll.size() did not agree about its size");
     } else {
       allSyncs.push_back(std::move(syncs));
     }
 
-    while (pending) {
-      if (!stopThreads_.load(std::memory_order_acquire)) {
-        if (pending->flags & W_PENDING_IS_DESYNCED) {
-          // The watcher is desynced but some cookies might be written to disk
-          // while the recursive crawl is ongoing. We are going to specifically
-          // ignore these cookies during that recursive crawl to avoid a race
-          // condition where cookies might be seen before some files have been
-          // observed as changed on disk. Due to this, and the fact that cookies
-          // notifications might simply have been dropped by the watcher, we
-          // need to abort the pending cookies to force them to be recreated on
-          // disk, and thus re-seen.
-          if (pending->flags & W_PENDING_CRAWL_ONLY) {
-            desyncState = IsDesynced::Yes;
+    // Renames go first, so that the changes that come with them find the
+    // view as it is now.  A change reported below a dir before it moved is
+    // looked at again at its new path, as the copied entry has the old stat.
+    std::vector<const PendingMove*> applied;
+    for (auto& move : moves) {
+      if (!stopThreads_.load(std::memory_order_acquire) &&
+          reparentDir(root, view, coll, move)) {
+        applied.push_back(&move);
+      }
+    }
+    if (!applied.empty()) {
+      for (auto p = pending; p; p = p->next) {
+        std::optional<w_string> path;
+        for (auto move : applied) {
+          auto& current = path ? *path : p->path;
+          if (isBelow(current, move->from)) {
+            path = w_string::build(
+                move->to, current.view().substr(move->from.size()));
+          }
+        }
+        if (path) {
+          coll.add(*path, p->now, p->flags);
+        }
+      }
+    }
+
+    // Group the changes by parent directory, keeping their order within
+    // each, so that a directory is resolved once for all of its changed
+    // children and read once when many of them changed.
+    batch.clear();
+    size_t numPriority = 0;
+    for (auto p = pending; p; p = p->next) {
+      bool priority = !priorityScopes.empty() && isPriority(*p);
+      numPriority += priority;
+      batch.push_back(
+          PendingInDir{p, p->path.piece().dirName().view(), priority});
+    }
+    std::stable_sort(
+        batch.begin(),
+        batch.end(),
+        [](const PendingInDir& a, const PendingInDir& b) {
+          if (a.priority != b.priority) {
+            return a.priority;
+          }
+          return a.dir < b.dir;
+        });
+    prioritizedChanges_.fetch_add(numPriority, std::memory_order_relaxed);
+
+    for (size_t begin = 0, end; begin < batch.size(); begin = end) {
+      // Once the priority changes have been processed, let the
+      // subscriptions that they concern see them before the rest, with
+      // the clock of this much of the batch
+      if (begin == numPriority && begin > 0 &&
+          !stopThreads_.load(std::memory_order_acquire)) {
+        root->unilateralResponses->enqueue(
+            json_object({{"prioritized", json_true()}}));
+        if (yieldViewLock) {
+          yieldNow();
+        }
+      }
+
+      end = begin + 1;
+      while (end < batch.size() && batch[end].dir == batch[begin].dir &&
+             batch[end].priority == batch[begin].priority) {
+        ++end;
+      }
+
+      // Only a group of plain changes is handled entirely by statPath.
+      // Crawls, cookies and the root itself find their dirs their own way.
+      bool watcherReportsStats =
+          watcher_->flags & WATCHER_REPORTS_FILE_INFORMATION;
+      size_t needStat = 0;
+      bool statOnly = true;
+      for (size_t i = begin; i < end && statOnly; ++i) {
+        auto& p = *batch[i].pending;
+        statOnly = !(p.flags & W_PENDING_CRAWL_ONLY) && p.path != rootPath_ &&
+            !root->cookies.isCookiePrefix(p.path);
+        if (!watcherReportsStats || !(p.flags & W_PENDING_VIA_NOTIFY)) {
+          ++needStat;
+        }
+      }
+
+      watchman_dir* parentDir = nullptr;
+      scanned.clear();
+      if (statOnly && end - begin > 1 &&
+          !stopThreads_.load(std::memory_order_acquire)) {
+        auto dirPath = batch[begin].pending->path.dirName();
+        if (!root->ignore.isIgnoreDir(dirPath)) {
+          parentDir = view.resolveDir(dirPath, true);
+          if (dirScanMinSiblings_ && needStat >= dirScanMinSiblings_ &&
+              dirScanYieldsStats_) {
+            for (size_t i = begin; i < end; ++i) {
+              scanned.emplace(
+                  batch[i].pending->path.piece().baseName(), std::nullopt);
+            }
+            scanDirForSiblings(dirPath, scanned);
+          }
+        }
+      }
+
+      for (size_t i = begin; i < end; ++i) {
+        auto* pending = batch[i].pending;
+        if (!stopThreads_.load(std::memory_order_acquire)) {
+          if (pending->flags & W_PENDING_IS_DESYNCED) {
+            // The watcher is desynced but some cookies might be written to
+            // disk while the recursive crawl is ongoing. We are going to
+            // specifically ignore these cookies during that recursive crawl to
+            // avoid a race condition where cookies might be seen before some
+            // files have been observed as changed on disk. Due to this, and
+            // the fact that cookies notifications might simply have been
+            // dropped by the watcher, we need to abort the pending cookies to
+            // force them to be recreated on disk, and thus re-seen.
+            if (pending->flags & W_PENDING_CRAWL_ONLY) {
+              desyncState = IsDesynced::Yes;
+            }
+          }
+
+          if ((pending->flags & W_PENDING_VIA_NOTIFY) &&
+              !root->cookies.isCookiePrefix(pending->path)) {
+            auto dir = pending->path.dirName();
+            notifiedScope =
+                notifiedScope ? commonAncestor(*notifiedScope, dir) : dir;
+          }
+
+          std::optional<FileInformation> reportedStat;
+          if (watcherReportsStats && (pending->flags & W_PENDING_VIA_NOTIFY)) {
+            reportedStat = watcher_->takeReportedStat(pending->path);
+          }
+          const FileInformation* preStat =
+              reportedStat ? &*reportedStat : nullptr;
+          if (!preStat && !scanned.empty()) {
+            auto it = scanned.find(pending->path.piece().baseName());
+            if (it != scanned.end() && it->second) {
+              preStat = &*it->second;
+            }
+          }
+
+          // A hot file is held until its window has passed
+          bool held = hotFiles_.enabled() &&
+              isDebounceable(*root, rootPath_, *pending) &&
+              !hotFiles_.admit(*pending, std::chrono::steady_clock::now());
+          if (!held) {
+            root->metrics.events.fetch_add(1, std::memory_order_relaxed);
+
+            // processPath may insert new pending items into `coll`
+            processPath(
+                root,
+                view,
+                coll,
+                *pending,
+                preStat,
+                pendingCookies,
+                parentDir);
           }
         }
 
-        // processPath may insert new pending items into `coll`
-        processPath(root, view, coll, *pending, nullptr, pendingCookies);
+        if (yieldViewLock && i + 1 < batch.size()) {
+          ++itemsHeld;
+          bool yield =
+              viewLockMaxHoldItems_ && itemsHeld >= viewLockMaxHoldItems_;
+          if (!yield && viewLockMaxHold_.count() > 0 &&
+              itemsHeld % kItemsPerClockCheck == 0) {
+            yield = std::chrono::steady_clock::now() - lockAcquired >=
+                viewLockMaxHold_;
+          }
+          if (yield) {
+            yieldNow();
+            // Others may have aged the dir out of the view meanwhile
+            parentDir = nullptr;
+          }
+        }
       }
+    }
+  }
 
-      // TODO: Document that continuing to run this loop when stopThreads_ is
-      // true fixes a stack overflow when pending is long.
-      pending = std::move(pending->next);
+  hotFilesHeld_.store(hotFiles_.heldCount(), std::memory_order_relaxed);
+  debouncedChanges_.store(
+      hotFiles_.debouncedCount(), std::memory_order_relaxed);
+
+  if (yieldViewLock) {
+    viewLockHolds_.wlock()->record(
+        std::chrono::steady_clock::now() - lockAcquired);
+  }
+
+  if (notifiedScope) {
+    auto now = std::chrono::steady_clock::now();
+    auto recent = recentChanges_.wlock();
+    if (!recent->scope || now - recent->windowStart > kRecentChangeWindow) {
+      recent->scope = std::move(notifiedScope);
+      recent->windowStart = now;
+    } else {
+      recent->scope = commonAncestor(*recent->scope, *notifiedScope);
     }
   }
 
+  TraceSpan cookieSpan{"notifyCookies"};
   for (auto& pendingCookie : pendingCookies) {
     if (processedPaths_) {
       // Record a fake entry to indicate when we unblocked the cookie in the
@@ -345,13 +1435,122 @@ InMemoryView::IsDesynced InMemoryView::processAllPending(
   return desyncState;
 }
 
+bool InMemoryView::reparentDir(
+    const std::shared_ptr<Root>& root,
+    ViewDatabase& view,
+    PendingChanges& coll,
+    const PendingMove& move) {
+  TraceSpan span{"reparentDir"};
+  auto& from = move.from;
+  auto& to = move.to;
+
+  // Renames that don't involve a dir we know about, or that cross into or
+  // out of the parts of the tree we don't watch, are left to the changes
+  // that the watcher reports along with them.
+  if (!isBelow(from, rootPath_) || !isBelow(to, rootPath_) ||
+      isBelow(from, to) || isBelow(to, from) ||
+      root->ignore.isIgnoreDir(from) || root->ignore.isIgnoreDir(to)) {
+    return false;
+  }
+  auto srcParent = view.resolveDir(from.dirName(), false);
+  if (!srcParent) {
+    return false;
+  }
+  auto srcFile = srcParent->getChildFile(from.baseName());
+  auto srcDir = srcParent->getChildDir(from.baseName());
+  if (!srcFile || !srcFile->exists || !srcDir || !srcDir->last_check_existed) {
+    return false;
+  }
+
+  auto fallback = [&](const char* why) {
+    logf(DBG, "crawling {} rather than reparenting {}: {}\n", to, from, why);
+    reparentFallbacks_.fetch_add(1, std::memory_order_relaxed);
+    coll.add(to, move.now, W_PENDING_VIA_NOTIFY | W_PENDING_RECURSIVE);
+    return false;
+  };
+
+  if (lazyCrawling_ ||
+      !root->inner.done_initial.load(std::memory_order_acquire)) {
+    return fallback("the view is incomplete");
+  }
+  if (root->ignore.isIgnoreVCS(to.dirName()) ||
+      root->cookies.isCookieDir(to) || root->cookies.isCookieDir(from)) {
+    return fallback("the destination isn't crawled");
+  }
+
+  auto destParent = view.resolveDir(to.dirName(), false);
+  if (destParent) {
+    auto destFile = destParent->getChildFile(to.baseName());
+    auto destDir = destParent->getChildDir(to.baseName());
+    if ((destFile && destFile->exists) ||
+        (destDir && hasExistingFiles(destDir))) {
+      return fallback("the destination is already populated");
+    }
+  }
+
+  // Make sure that the dir at `to` is the one that was at `from`, and that
+  // it isn't at `from` any more.  Filesystems without inode numbers report
+  // zero, and then only the second part can be checked.
+  auto ino = srcFile->stat.ino();
+  FileInformation st;
+  try {
+    st = fileSystem_.getFileInformation(to.c_str(), root->case_sensitive);
+  } catch (const std::system_error&) {
+    return fallback("the destination can't be examined");
+  }
+  if (!st.isDir() || (ino != 0 && st.ino != ino)) {
+    return fallback("the destination is a different dir");
+  }
+  try {
+    auto old =
+        fileSystem_.getFileInformation(from.c_str(), root->case_sensitive);
+    if (ino == 0 || old.ino == ino) {
+      return fallback("the source is still there");
+    }
+  } catch (const std::system_error&) {
+    // It's gone, as expected
+  }
+
+  auto clock = getClock(move.now);
+  if (!destParent) {
+    destParent = view.resolveDir(to.dirName(), true);
+  }
+  auto destFile =
+      view.getOrCreateChildFile(*watcher_, destParent, to.baseName(), clock);
+  destFile->stat = st;
+  destFile->exists = true;
+  destFile->ctime = clock;
+  view.markFileChanged(*watcher_, destFile, clock);
+
+  auto destDir = view.getOrCreateChildDir(destParent, to.baseName().piece());
+  destDir->last_check_existed = true;
+  destDir->crawledMtime = srcDir->crawledMtime;
+  auto copied = view.copyTree(*watcher_, srcDir, destDir, clock);
+
+  // The old paths stay behind as tombstones, for since queries to report
+  srcFile->exists = false;
+  view.markFileChanged(*watcher_, srcFile, clock);
+  view.markDirDeleted(*watcher_, srcDir, clock, true);
+#ifndef _WIN32
+  if (dirFdCache_) {
+    dirFdCache_->invalidate(from);
+  }
+#endif
+
+  logf(DBG, "reparented {} -> {} with {} files\n", from, to, copied);
+  reparentedDirs_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
 void InMemoryView::processPath(
     const std::shared_ptr<Root>& root,
     ViewDatabase& view,
     PendingChanges& coll,
     const PendingChange& pending,
     const FileInformation* pre_stat,
-    std::vector<w_string>& pendingCookies) {
+    std::vector<w_string>& pendingCookies,
+    watchman_dir* parentDir) {
+  TraceSpan span{"processPath"};
   w_check(
       pending.path.size() >= rootPath_.size(),
       "full_path must be a descendant of the root directory\n",
@@ -401,10 +1600,73 @@ void InMemoryView::processPath(
     return;
   }
 
+  // These are rewritten when the working copy moves to another commit, or
+  // when the operation that moves it finishes.
+  static const w_string_piece kWorkingCopyStateFiles[] = {
+      "dirstate", "wlock", "index", "index.lock", "HEAD"};
+  if (root->ignore.isIgnoreVCS(pending.path.piece().dirName())) {
+    auto name = pending.path.piece().baseName();
+    if (std::find(
+            std::begin(kWorkingCopyStateFiles),
+            std::end(kWorkingCopyStateFiles),
+            name) != std::end(kWorkingCopyStateFiles)) {
+      root->savedStatePrefetcher.schedule(root);
+    }
+  }
+
   if (pending.path == rootPath_ || (pending.flags & W_PENDING_CRAWL_ONLY)) {
     crawler(root, view, coll, pending, pendingCookies);
   } else {
-    statPath(*root, root->cookies, view, coll, pending, pre_stat);
+    statPath(*root, root->cookies, view, coll, pending, pre_stat, parentDir);
+  }
+}
+
+void InMemoryView::scanDirForSiblings(
+    const w_string& dirPath,
+    std::unordered_map<w_string_piece, std::optional<FileInformation>>&
+        stats) {
+  TraceSpan span{"scanDirForSiblings"};
+  std::unique_ptr<DirHandle> osdir;
+  try {
+    osdir = fileSystem_.openDir(dirPath.c_str());
+  } catch (const std::system_error& err) {
+    // statPath will look at each of them and handle the error
+    logf(
+        DBG,
+        "failed to open {} to stat its children: {}\n",
+        dirPath,
+        err.what());
+    return;
+  }
+
+  size_t found = 0;
+  size_t withoutStat = 0;
+  try {
+    while (const DirEntry* dirent = osdir->readDir()) {
+      if (dirent->d_name[0] == '.' &&
+          (!strcmp(dirent->d_name, ".") || !strcmp(dirent->d_name, ".."))) {
+        continue;
+      }
+      if (!dirent->has_stat) {
+        ++withoutStat;
+        continue;
+      }
+      auto it = stats.find(w_string_piece{dirent->d_name});
+      if (it != stats.end()) {
+        it->second = dirent->stat;
+        if (++found == stats.size()) {
+          break;
+        }
+      }
+    }
+  } catch (const std::system_error& exc) {
+    logf(DBG, "error while reading {}: {}\n", dirPath, exc.what());
+    return;
+  }
+
+  if (found == 0 && withoutStat > 0) {
+    logf(DBG, "reading {} didn't report stats; no longer scanning\n", dirPath);
+    dirScanYieldsStats_ = false;
   }
 }
 
@@ -427,11 +1689,28 @@ void InMemoryView::crawler(
     PendingChanges& coll,
     const PendingChange& pending,
     std::vector<w_string>& pendingCookies) {
+  TraceSpan span{"crawler"};
   bool recursive = pending.flags.contains(W_PENDING_RECURSIVE);
   bool stat_all = pending.flags.contains(W_PENDING_NONRECURSIVE_SCAN);
 
   auto dir = view.resolveDir(pending.path, true);
 
+  // Once this returns, the dirs below this one are queued in turn, or
+  // crawled already by crawlerParallel
+  SCOPE_EXIT {
+    if (trackingCrawlFrontier_ && pending.flags.contains(W_PENDING_RECURSIVE)) {
+      removeFromCrawlFrontier(pending.path);
+    }
+  };
+
+  if (lazyCrawlDepth_ > 0) {
+    // Crawled now, for whatever reason, so no longer deferred
+    auto deferred = deferredDirs_.wlock();
+    if (!deferred->empty()) {
+      deferred->erase(pending.path);
+    }
+  }
+
   // Detect root directory replacement.
   // The inode number check is handled more generally by the sister code
   // in stat.cpp.  We need to special case it for the root because we never
@@ -468,11 +1747,18 @@ void InMemoryView::crawler(
           "getFileInformation",
           err.code());
       view.markDirDeleted(*watcher_, dir, getClock(pending.now), true);
+#ifndef _WIN32
+      if (dirFdCache_) {
+        dirFdCache_->invalidate(pending.path);
+      }
+#endif
       return;
     }
   }
 
-  if (recursive &&
+  // The parallel crawler walks the whole tree, so isn't used while dirs
+  // are being deferred
+  if (recursive && !lazyCrawling_ &&
       root->enable_parallel_crawl.load(std::memory_order_acquire)) {
     return crawlerParallel(root, view, coll, pending, pendingCookies);
   }
@@ -487,6 +1773,7 @@ void InMemoryView::crawler(
    * so the operations are rolled together in our abstraction */
   std::unique_ptr<DirHandle> osdir;
 
+  paceCrawl();
   try {
     osdir = watcher_->startWatchDir(root, path.c_str());
   } catch (const std::system_error& err) {
@@ -494,9 +1781,48 @@ void InMemoryView::crawler(
     handle_open_errno(
         *root, dir->getFullPath(), pending.now, "opendir", err.code());
     view.markDirDeleted(*watcher_, dir, getClock(pending.now), true);
+#ifndef _WIN32
+    if (dirFdCache_) {
+      dirFdCache_->invalidate(path);
+    }
+#endif
     return;
   }
 
+  // A recrawl can trust a dir's previous enumeration if the dir's mtime
+  // hasn't moved since; only its subdirs need to be revalidated.
+  std::optional<struct timespec> dirMtime;
+  if (fastRevalidateCrawl_ && recursive &&
+      fs_type_maintains_dir_mtimes(root->fs_type)) {
+    try {
+      dirMtime =
+          fileSystem_.getFileInformation(path.c_str(), root->case_sensitive)
+              .mtime;
+    } catch (const std::system_error& err) {
+      logf(DBG, "failed to stat {}, enumerating it: {}\n", path, err.what());
+    }
+    if (dirMtime && dir->crawledMtime.tv_sec != 0 &&
+        dir->crawledMtime.tv_sec == dirMtime->tv_sec &&
+        dir->crawledMtime.tv_nsec == dirMtime->tv_nsec) {
+      osdir.reset();
+      logf(DBG, "{} is unchanged, revalidating only its subdirs\n", path);
+      for (auto& it : dir->files) {
+        auto file = it.second.get();
+        if (!file->exists || !file->stat.isDir()) {
+          continue;
+        }
+        PendingFlags newFlags = W_PENDING_RECURSIVE;
+        if (pending.flags & W_PENDING_IS_DESYNCED) {
+          newFlags.set(W_PENDING_IS_DESYNCED);
+        }
+        PendingChange subdirPending{
+            dir->getFullPathToChild(file->getName()), pending.now, newFlags};
+        processPath(root, view, coll, subdirPending, nullptr, pendingCookies);
+      }
+      return;
+    }
+  }
+
   if (dir->files.empty()) {
     // Pre-size our hash(es) if we can, so that we can avoid collisions
     // and re-hashing during initial crawl
@@ -510,12 +1836,9 @@ void InMemoryView::crawler(
 #endif
     // st.st_nlink is usually number of dirs + 2 (., ..).
     // If it is less than 2 then it doesn't follow that convention.
-    // We just pass it through for the dir size hint and the hash
-    // table implementation will round that up to the next power of 2
-    apply_dir_size_hint(
-        dir,
-        num_dirs,
-        uint32_t(root->config.getInt("hint_num_files_per_dir", 64)));
+    // We just pass it through for the dir size hint; the child tables
+    // only build a hash index once a dir has enough entries to need one
+    apply_dir_size_hint(dir, num_dirs, hintNumFilesPerDir_);
   }
 
   /* flag for delete detection */
@@ -568,6 +1891,15 @@ void InMemoryView::crawler(
             pendingCookies);
       }
     }
+    if (dirMtime) {
+      // An entry added within the same tick as this mtime wouldn't move it,
+      // so only trust mtimes that are safely in the past.
+      if (dirMtime->tv_sec + 2 > time(nullptr)) {
+        dir->crawledMtime = {0, 0};
+      } else {
+        dir->crawledMtime = *dirMtime;
+      }
+    }
   } catch (const std::system_error& exc) {
     log(ERR,
         "Error while reading dir ",
@@ -575,6 +1907,7 @@ void InMemoryView::crawler(
         ": ",
         exc.what(),
         ", re-adding to pending list to re-assess\n");
+    dir->crawledMtime = {0, 0};
     coll.add(path, pending.now, {});
   }
   osdir.reset();
@@ -610,10 +1943,11 @@ class CrawlerFileSystem : public FileSystem {
       return nullptr;
     }
     if ((root_->root_path != fullPath &&
-         root_->ignore.isIgnoreVCS(fullPath.dirName())) &&
+         root_->ignore.isIgnoreVCS(fullPath.piece().dirName())) &&
         !root_->cookies.isCookieDir(fullPath)) {
       return nullptr;
     }
+    view_.paceCrawl();
     // Use watcher->startWatchDir to ensure side effects are applied
     // in the right order (ex. inotify_add_watch before opendir).
     // This requires startWatchDir to be thread-safe.
@@ -633,10 +1967,12 @@ class CrawlerFileSystem : public FileSystem {
   CrawlerFileSystem(
       FileSystem& fileSystem,
       std::shared_ptr<Root> root,
-      std::shared_ptr<Watcher> watcher)
+      std::shared_ptr<Watcher> watcher,
+      InMemoryView& view)
       : fileSystem_{fileSystem},
         root_{std::move(root)},
-        watcher_{std::move(watcher)} {}
+        watcher_{std::move(watcher)},
+        view_{view} {}
 
   CrawlerFileSystem() = delete;
   CrawlerFileSystem(CrawlerFileSystem&&) = delete;
@@ -648,6 +1984,7 @@ class CrawlerFileSystem : public FileSystem {
   FileSystem& fileSystem_;
   std::shared_ptr<Root> root_;
   std::shared_ptr<Watcher> watcher_;
+  InMemoryView& view_;
 };
 
 } // namespace
@@ -658,6 +1995,7 @@ void InMemoryView::crawlerParallel(
     PendingChanges& coll,
     const PendingChange& pending,
     std::vector<w_string>& pendingCookies) {
+  TraceSpan span{"crawlerParallel"};
   w_assert(
       pending.flags.contains(W_PENDING_RECURSIVE),
       "crawlerParallel requires W_PENDING_RECURSIVE");
@@ -674,7 +2012,7 @@ void InMemoryView::crawlerParallel(
   // (via W_PENDING_RECURSIVE), and avoid extra syscalls.
 
   std::shared_ptr<CrawlerFileSystem> fs =
-      std::make_shared<CrawlerFileSystem>(fileSystem_, root, watcher_);
+      std::make_shared<CrawlerFileSystem>(fileSystem_, root, watcher_, *this);
   size_t threadCountHint = config_.getInt("parallel_crawl_thread_count", 0);
   ParallelWalker walker{std::move(fs), path, threadCountHint};
 
@@ -692,6 +2030,20 @@ void InMemoryView::crawlerParallel(
     if (dirView->files.empty()) {
       dirView->files.reserve(dirResult.entries.size());
       dirView->dirs.reserve(dirResult.subdirCount);
+
+      // Nothing to compare against or delete; this is the common case
+      // during the initial crawl.
+      spliceNewDirEntries(
+          root,
+          view,
+          coll,
+          dirView,
+          dirPath,
+          dirResult,
+          pending,
+          inheritFlags,
+          pendingCookies);
+      continue;
     }
     for (auto& it : dirView->files) {
       auto fileView = it.second.get();
@@ -765,6 +2117,68 @@ void InMemoryView::crawlerParallel(
   }
 }
 
+void InMemoryView::spliceNewDirEntries(
+    const std::shared_ptr<Root>& root,
+    ViewDatabase& view,
+    PendingChanges& coll,
+    watchman_dir* dir,
+    const w_string& dirPath,
+    ReadDirResult& dirResult,
+    const PendingChange& pending,
+    PendingFlags inheritFlags,
+    std::vector<w_string>& pendingCookies) {
+  auto clock = getClock(pending.now);
+  size_t statCount = 0;
+
+  // Link the new files among themselves and attach them to the recency
+  // index once at the end, rather than one at a time.
+  ViewDatabase::FileListBatch batch;
+  SCOPE_EXIT {
+    view.spliceAtHeadOfFileList(batch);
+  };
+
+  for (auto& entry : dirResult.entries) {
+    w_string name{entry.name.c_str(), W_STRING_BYTE};
+    auto fullPath = w_string::build(dirPath, "/", name);
+
+    // Cookies need their special handling, and a dir node may already have
+    // been created for this name (by resolveDir on a deeper path) without
+    // a file node; leave both to the general path.
+    if (root->cookies.isCookiePrefix(fullPath) ||
+        dir->dirs.find(name) != dir->dirs.end()) {
+      processPath(
+          root,
+          view,
+          coll,
+          PendingChange{std::move(fullPath), pending.now, inheritFlags},
+          &entry.stat,
+          pendingCookies);
+      continue;
+    }
+    if (root->ignore.isIgnoreDir(fullPath)) {
+      logf(DBG, "{} matches ignore_dir rules\n", fullPath);
+      continue;
+    }
+
+    if (processedPaths_) {
+      processedPaths_->write(PendingChangeLogEntry{
+          PendingChange{std::move(fullPath), pending.now, inheritFlags},
+          std::error_code{},
+          entry.stat});
+    }
+    ++statCount;
+
+    // New nodes start out existing, with their ctime set to clock
+    auto file = view.getOrCreateChildFile(*watcher_, dir, name, clock);
+    file->stat = entry.stat;
+    view.markFileChanged(batch, *watcher_, file, clock);
+  }
+
+  if (fullCrawlStatCount_) {
+    fullCrawlStatCount_->fetch_add(statCount, std::memory_order_release);
+  }
+}
+
 namespace {
 bool did_file_change(
     const FileInformation* saved,
@@ -809,13 +2223,58 @@ bool did_file_change(
 }
 } // namespace
 
+bool InMemoryView::isBeyondLazyCrawlDepth(w_string_piece path) const {
+  if (path.size() <= rootPath_.size()) {
+    return false;
+  }
+  path.advance(rootPath_.size());
+  size_t depth =
+      std::count_if(path.data(), path.data() + path.size(), is_slash);
+  return depth >= lazyCrawlDepth_;
+}
+
+void InMemoryView::captureSymlinkTarget(
+    const w_string& path,
+    ClockStamp otime) {
+  auto& cache = caches_.symlinkTargetCache;
+  w_string_piece relative(path);
+  relative.advance(cache.rootPath().size());
+  if (relative.size() > 0) {
+    // Skip the slash that follows the root
+    relative.advance(1);
+  }
+
+  // The view lock is held, so no query can be looking up this key yet:
+  // the otime in it was only just assigned.
+  try {
+    w_string target;
+#ifndef _WIN32
+    if (dirFdCache_) {
+      target = dirFdCache_->readLinkAt(
+          path.piece().dirName().asWString(), path.piece().baseName());
+    } else
+#endif
+    {
+      target = readSymbolicLink(path.c_str());
+    }
+    cache.set(
+        SymlinkTargetCacheKey{relative.asWString(), otime}, std::move(target));
+  } catch (const std::exception& exc) {
+    // The query will read it for itself, and report the error then
+    log(DBG, "failed to capture symlink target of ", path, ": ", exc.what(), "
+");
+  }
+}
+
 void InMemoryView::statPath(
     const RootConfig& root,
     const CookieSync& cookies,
     ViewDatabase& view,
     PendingChanges& coll,
     const PendingChange& pending,
-    const FileInformation* pre_stat) {
+    const FileInformation* pre_stat,
+    watchman_dir* parentDir) {
+  TraceSpan span{"statPath"};
   bool recursive = pending.flags.contains(W_PENDING_RECURSIVE);
   const bool via_notify = pending.flags.contains(W_PENDING_VIA_NOTIFY);
   const PendingFlags desynced_flag = pending.flags & W_PENDING_IS_DESYNCED;
@@ -833,7 +2292,9 @@ void InMemoryView::statPath(
   auto dir_name = pending.path.dirName();
   auto file_name = pending.path.baseName();
   w_check(!dir_name.empty(), "must have dir_name");
-  auto parentDir = view.resolveDir(dir_name, true);
+  if (!parentDir) {
+    parentDir = view.resolveDir(dir_name, true);
+  }
 
   auto file = parentDir->getChildFile(file_name);
 
@@ -850,7 +2311,17 @@ void InMemoryView::statPath(
     errcode = make_error_code(error_code::no_such_file_or_directory);
   } else {
     try {
-      st = fileSystem_.getFileInformation(path.c_str(), root.case_sensitive);
+#ifndef _WIN32
+      if (dirFdCache_) {
+        st = dirFdCache_->statAt(
+            dir_name.asWString(),
+            file_name,
+            crawlStatsDontSync_ && !via_notify);
+      } else
+#endif
+      {
+        st = fileSystem_.getFileInformation(path.c_str(), root.case_sensitive);
+      }
       log(DBG,
           "getFileInformation(",
           path,
@@ -877,6 +2348,17 @@ void InMemoryView::statPath(
   if (processedPaths_) {
     processedPaths_->write(PendingChangeLogEntry{pending, errcode, st});
   }
+#ifndef _WIN32
+  if (dirFdCache_ && dir_ent) {
+    // Names in a dir that was deleted, renamed over or replaced by a file
+    // must not be looked up in its old inode
+    if (errcode || !st.isDir()) {
+      dirFdCache_->invalidate(path);
+    } else {
+      dirFdCache_->invalidateIfReplaced(path, st.ino);
+    }
+  }
+#endif
   if (fullCrawlStatCount_) {
     // Not using loaded value - load can be relaxed - no need for acq_rel
     fullCrawlStatCount_->fetch_add(1, std::memory_order_release);
@@ -969,7 +2451,20 @@ void InMemoryView::statPath(
        * to crawl it again */
       recursive = true;
     }
-    if (!file->exists || via_notify || did_file_change(&file->stat, &st)) {
+    auto saved = file->stat.toFileInformation();
+    bool changed = !file->exists || did_file_change(&saved, &st);
+    // A repeated notification for a file whose inode and timestamps are as
+    // we last saw them describes a change that we've already observed.
+    // Timestamps without sub-second precision can't tell two changes in
+    // the same second apart, so those notifications are always believed.
+    bool redundant_notify = via_notify && !changed &&
+        (watcher_->flags & WATCHER_MAY_REPEAT_NOTIFICATIONS) &&
+        (st.mtime.tv_nsec != 0 || st.ctime.tv_nsec != 0);
+    // Before marking the file changed, so that its file columns see the new
+    // stat
+    bool ino_changed = file->stat.ino() != st.ino;
+    file->stat = st;
+    if (changed || (via_notify && !redundant_notify)) {
       logf(
           DBG,
           "file changed exists={} via_notify={} stat-changed={} isdir={} size={} {}\n",
@@ -982,17 +2477,19 @@ void InMemoryView::statPath(
       file->exists = true;
       view.markFileChanged(*watcher_, file, getClock(pending.now));
 
+      if (captureSymlinkTargets_ && st.isSymlink()) {
+        captureSymlinkTarget(path, file->otime);
+      }
+
       // If the inode number changed then we definitely need to recursively
       // examine any children because we cannot assume that the kernel will
       // have given us the correct hints about this change.  BTRFS is one
       // example of a filesystem where this has been observed to happen.
-      if (file->stat.ino != st.ino) {
+      if (ino_changed) {
         recursive = true;
       }
     }
 
-    memcpy(&file->stat, &st, sizeof(file->stat));
-
     if (st.isDir()) {
       if (dir_ent == NULL) {
         recursive = true;
@@ -1001,6 +2498,13 @@ void InMemoryView::statPath(
         dir_ent->last_check_existed = true;
       }
 
+      if (recursive && lazyCrawling_ && isBeyondLazyCrawlDepth(pending.path) &&
+          !cookies.isCookieDir(pending.path)) {
+        // Leave it for a query that needs it, or for when we're idle
+        deferredDirs_.wlock()->insert(pending.path);
+        return;
+      }
+
       // Don't recurse if our parent is an ignore dir or via crawlerParallel
       // (already recursive)
       if (!viaPwalk &&
@@ -1011,6 +2515,9 @@ void InMemoryView::statPath(
         if (recursive) {
           /* we always need to crawl if we're recursive, this can happen when a
            * directory is created */
+          if (trackingCrawlFrontier_) {
+            addToCrawlFrontier(pending.path);
+          }
           coll.add(
               pending.path,
               pending.now,
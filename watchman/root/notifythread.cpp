@@ -7,18 +7,25 @@
 
 #include "watchman/Constants.h"
 #include "watchman/InMemoryView.h"
+#include "watchman/Trace.h"
+#include "watchman/ViewSnapshot.h"
 #include "watchman/root/Root.h"
 #include "watchman/watcher/Watcher.h"
 
 namespace watchman {
 
-// we want to consume inotify events as quickly as possible
-// to minimize the risk that the kernel event buffer overflows,
-// so we do this as a blocking thread that reads the inotify
-// descriptor and then queues the filesystem IO work until after
-// we have drained the inotify descriptor
-void InMemoryView::notifyThread(const std::shared_ptr<Root>& root) {
-  PendingChanges fromWatcher;
+bool InMemoryView::startWatcher(
+    const std::shared_ptr<Root>& root,
+    std::unique_ptr<PendingChanges>& fromWatcher) {
+  if (enableViewSnapshot_) {
+    auto path = ViewSnapshot::pathForRoot(rootPath_);
+    if (!path.empty()) {
+      if (auto token = ViewSnapshot::readResumeToken(rootPath_, path);
+          !token.empty()) {
+        watcher_->resumeFrom(token);
+      }
+    }
+  }
 
   if (!watcher_->start(root)) {
     logf(
@@ -27,12 +34,83 @@ void InMemoryView::notifyThread(const std::shared_ptr<Root>& root) {
         root->root_path,
         root->failure_reason ? *root->failure_reason : w_string{});
     root->cancel();
-    return;
+    return false;
   }
 
   // signal that we're done here, so that we can start the
   // io thread after this point
-  pendingFromWatcher_.lock()->ping();
+  if (watcher_->resumed()) {
+    // The initial crawl doesn't walk the tree when the watcher is replaying
+    // the changes made while we weren't running, so hand it what has been
+    // replayed so far before it starts.
+    while (fromWatcher->getPendingItemCount() < WATCHMAN_BATCH_LIMIT &&
+           watcher_->waitNotify(0)) {
+      if (watcher_->consumeNotify(root, *fromWatcher).cancelSelf) {
+        root->cancel();
+        return false;
+      }
+    }
+  }
+
+  {
+    auto lock = pendingFromWatcher_.lock();
+    if (!fromWatcher->empty()) {
+      fromWatcher = lock->handOff(std::move(fromWatcher));
+    }
+    // The crawl that follows picks up everything before this point
+    appendedResumeToken_ = watcher_->getResumeToken();
+    lock->ping();
+  }
+  return true;
+}
+
+void InMemoryView::consumeNotifications(
+    const std::shared_ptr<Root>& root,
+    std::unique_ptr<PendingChanges>& fromWatcher) {
+  if (!fromWatcher) {
+    // The IO thread hasn't drained a batch for us to reuse yet
+    fromWatcher = std::make_unique<PendingChanges>();
+  }
+  do {
+    TraceSpan span{"consumeNotify"};
+    auto resultFlags = watcher_->consumeNotify(root, *fromWatcher);
+    span.end();
+
+    if (resultFlags.cancelSelf) {
+      root->cancel();
+      break;
+    }
+    if (fromWatcher->getPendingItemCount() >= WATCHMAN_BATCH_LIMIT) {
+      break;
+    }
+  } while (watcher_->waitNotify(0));
+
+  if (fromWatcher && !fromWatcher->empty()) {
+    if (auto oldest = fromWatcher->oldestChange()) {
+      root->metrics.changeLatency.kernelToPending.record(
+          std::chrono::system_clock::now() - *oldest);
+    }
+    TraceSpan lockSpan{"pendingFromWatcher.lock"};
+    auto lock = pendingFromWatcher_.lock();
+    lockSpan.end();
+    fromWatcher = lock->handOff(std::move(fromWatcher));
+    appendedResumeToken_ = watcher_->getResumeToken();
+    lock->ping();
+  }
+}
+
+// we want to consume inotify events as quickly as possible
+// to minimize the risk that the kernel event buffer overflows,
+// so we do this as a blocking thread that reads the inotify
+// descriptor and then queues the filesystem IO work until after
+// we have drained the inotify descriptor
+void InMemoryView::notifyThread(const std::shared_ptr<Root>& root) {
+  // Filled without holding any lock, then handed off to the IO thread whole.
+  auto fromWatcher = std::make_unique<PendingChanges>();
+
+  if (!startWatcher(root, fromWatcher)) {
+    return;
+  }
 
   while (!stopThreads_.load(std::memory_order_acquire)) {
     // big number because not all watchers can deal with
@@ -40,23 +118,7 @@ void InMemoryView::notifyThread(const std::shared_ptr<Root>& root) {
     if (!watcher_->waitNotify(86400)) {
       continue;
     }
-    do {
-      auto resultFlags = watcher_->consumeNotify(root, fromWatcher);
-
-      if (resultFlags.cancelSelf) {
-        root->cancel();
-        break;
-      }
-      if (fromWatcher.getPendingItemCount() >= WATCHMAN_BATCH_LIMIT) {
-        break;
-      }
-    } while (watcher_->waitNotify(0));
-
-    if (!fromWatcher.empty()) {
-      auto lock = pendingFromWatcher_.lock();
-      lock->append(fromWatcher.stealItems(), fromWatcher.stealSyncs());
-      lock->ping();
-    }
+    consumeNotifications(root, fromWatcher);
   }
 }
 } // namespace watchman
@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/root/reactor.h"
+#include <folly/executors/thread_factory/NamedThreadFactory.h>
+#include <folly/io/async/AsyncTimeout.h>
+#include <folly/io/async/EventHandler.h>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "watchman/InMemoryView.h"
+#include "watchman/Logging.h"
+#include "watchman/WatchmanConfig.h"
+#include "watchman/root/Root.h"
+#include "watchman/watcher/Watcher.h"
+
+namespace watchman {
+
+SharedReactor::SharedReactor(size_t numWorkers)
+    : workers_{numWorkers, std::make_unique<folly::NamedThreadFactory>("io")} {}
+
+SharedReactor* SharedReactor::get() {
+  static SharedReactor* reactor = [] {
+    auto numWorkers = cfg_get_int("shared_io_threads", 0);
+    return numWorkers > 0 ? new SharedReactor(numWorkers) : nullptr;
+  }();
+  return reactor;
+}
+
+/**
+ * Does the work of a root's notify and IO threads on the SharedReactor.
+ *
+ * The notify side runs on the event base thread whenever one of the
+ * watcher's fds is readable.  The IO side runs on a worker whenever the
+ * pending collection is pinged or the settle timeout expires; running_ and
+ * wanted_ keep it to one worker at a time, and a ping that arrives while a
+ * step runs is followed by another step, just as lockAndWait would have
+ * returned immediately on the IO thread.
+ */
+class InMemoryView::ReactorTask
+    : public std::enable_shared_from_this<InMemoryView::ReactorTask> {
+ public:
+  ReactorTask(
+      SharedReactor& reactor,
+      std::shared_ptr<Root> root,
+      std::shared_ptr<InMemoryView> view)
+      : reactor_{reactor},
+        root_{std::move(root)},
+        view_{std::move(view)},
+        state_{view_->getBiggestIoTimeout(*root_)},
+        timer_{this} {
+    state_.currentTimeout = root_->trigger_settle;
+    state_.waitForEvents = false;
+  }
+
+  // `fromWatcher` is null if the watcher is waited on by a notify thread.
+  void start(
+      std::unique_ptr<PendingChanges> fromWatcher,
+      std::vector<int> notifyFds) {
+    self_ = shared_from_this();
+    fromWatcher_ = std::move(fromWatcher);
+
+    std::weak_ptr<ReactorTask> weak = self_;
+    view_->pendingFromWatcher_.lock()->setPingCallback([weak] {
+      if (auto self = weak.lock()) {
+        self->wake(false);
+      }
+    });
+
+    reactor_.getEventBase()->runInEventBaseThread(
+        [self = self_, notifyFds = std::move(notifyFds)] {
+          for (auto fd : notifyFds) {
+            auto& handler = self->handlers_.emplace_back(
+                std::make_unique<NotifyHandler>(self.get(), fd));
+            handler->registerHandler(
+                folly::EventHandler::READ | folly::EventHandler::PERSIST);
+          }
+        });
+
+    // The watcher has pinged already, before there was a callback to hear it
+    wake(false);
+  }
+
+ private:
+  class NotifyHandler : public folly::EventHandler {
+   public:
+    NotifyHandler(ReactorTask* task, int fd)
+        : folly::EventHandler{
+              task->reactor_.getEventBase(),
+              folly::NetworkSocket::fromFd(fd)},
+          task_{task} {}
+
+    void handlerReady(uint16_t) noexcept override {
+      task_->notifyReady();
+    }
+
+   private:
+    ReactorTask* task_;
+  };
+
+  class Timer : public folly::AsyncTimeout {
+   public:
+    explicit Timer(ReactorTask* task)
+        : folly::AsyncTimeout{task->reactor_.getEventBase()}, task_{task} {}
+
+    void timeoutExpired() noexcept override {
+      // A step that started since this was scheduled has rescheduled it
+      if (generation == task_->generation_.load(std::memory_order_acquire)) {
+        task_->wake(true);
+      }
+    }
+
+    uint64_t generation{0};
+
+   private:
+    ReactorTask* task_;
+  };
+
+  // Called on the event base thread
+  void notifyReady() {
+    if (view_->stopThreads_.load(std::memory_order_acquire)) {
+      return;
+    }
+    try {
+      view_->consumeNotifications(root_, fromWatcher_);
+    } catch (const std::exception& e) {
+      log(ERR, "Exception: ", e.what(), " cancel root\n");
+      root_->cancel();
+    }
+  }
+
+  // Called on any thread, sometimes with the pending collection locked.
+  // timedOut is set when the settle timeout expired rather than the
+  // collection being pinged.
+  void wake(bool timedOut) {
+    std::lock_guard<std::mutex> guard{mutex_};
+    if (finished_) {
+      return;
+    }
+    if (running_) {
+      // The step that is running reschedules the timeout when it finishes
+      if (!timedOut) {
+        wanted_ = true;
+      }
+      return;
+    }
+    running_ = true;
+    reactor_.getWorkers().add([self = shared_from_this()] { self->step(); });
+  }
+
+  // Called on a worker
+  void step() {
+    auto generation = generation_.fetch_add(1, std::memory_order_acq_rel) + 1;
+
+    // Crawls return before taking the watcher's changes, which the IO
+    // thread would then have waited for, so carry on until they're taken
+    auto result = Continue::Continue;
+    bool threw = false;
+    state_.drained = false;
+    try {
+      while (!state_.drained && result == Continue::Continue) {
+        result =
+            view_->stepIoThread(root_, state_, view_->pendingFromWatcher_);
+      }
+    } catch (const std::exception& e) {
+      log(ERR, "Exception: ", e.what(), " cancel root\n");
+      root_->cancel();
+      threw = true;
+    }
+    if (threw || result == Continue::Stop) {
+      finish(!threw);
+      return;
+    }
+
+    reactor_.getEventBase()->runInEventBaseThread(
+        [self = shared_from_this(),
+         timeout = state_.currentTimeout,
+         generation] {
+          if (generation !=
+              self->generation_.load(std::memory_order_acquire)) {
+            return;
+          }
+          self->timer_.generation = generation;
+          self->timer_.scheduleTimeout(timeout);
+        });
+
+    std::lock_guard<std::mutex> guard{mutex_};
+    running_ = false;
+    if (std::exchange(wanted_, false)) {
+      running_ = true;
+      reactor_.getWorkers().add([self = shared_from_this()] { self->step(); });
+    }
+  }
+
+  // Called on a worker once the IO side has stopped
+  void finish(bool clean) {
+    if (clean) {
+      view_->finishIoThread(root_, state_);
+    }
+    view_->pendingFromWatcher_.lock()->setPingCallback(nullptr);
+    {
+      std::lock_guard<std::mutex> guard{mutex_};
+      finished_ = true;
+      running_ = false;
+    }
+    generation_.fetch_add(1, std::memory_order_acq_rel);
+
+    reactor_.getEventBase()->runInEventBaseThread(
+        [self = shared_from_this()] {
+          self->timer_.cancelTimeout();
+          // Their destructors unregister them
+          self->handlers_.clear();
+          self->self_.reset();
+        });
+  }
+
+  SharedReactor& reactor_;
+  std::shared_ptr<Root> root_;
+  std::shared_ptr<InMemoryView> view_;
+
+  // Only used on a worker, by one step at a time
+  IoThreadState state_;
+
+  // Only used on the event base thread
+  std::unique_ptr<PendingChanges> fromWatcher_;
+  std::vector<std::unique_ptr<NotifyHandler>> handlers_;
+  Timer timer_;
+
+  // Advanced by each step, so that a timeout scheduled for an earlier step
+  // doesn't start another
+  std::atomic<uint64_t> generation_{0};
+
+  std::mutex mutex_;
+  bool running_{false};
+  bool wanted_{false};
+  bool finished_{false};
+
+  // Keeps this alive until the IO side has stopped
+  std::shared_ptr<ReactorTask> self_;
+};
+
+void InMemoryView::startSharedThreads(
+    const std::shared_ptr<Root>& root,
+    SharedReactor& reactor) {
+  auto self = std::static_pointer_cast<InMemoryView>(shared_from_this());
+  sharedIo_.store(true, std::memory_order_release);
+
+  std::unique_ptr<PendingChanges> fromWatcher;
+  auto notifyFds = watcher_->getNotifyFds();
+  if (notifyFds.empty()) {
+    startNotifyThread(root);
+  } else {
+    sharedNotify_.store(true, std::memory_order_release);
+    // If the watcher doesn't start the root is cancelled, and the first step
+    // stops straight away.
+    fromWatcher = std::make_unique<PendingChanges>();
+    if (!startWatcher(root, fromWatcher)) {
+      notifyFds.clear();
+    }
+  }
+
+  auto task = std::make_shared<ReactorTask>(reactor, root, self);
+  task->start(std::move(fromWatcher), std::move(notifyFds));
+}
+
+} // namespace watchman
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/executors/CPUThreadPoolExecutor.h>
+#include <folly/io/async/EventBaseThread.h>
+
+namespace watchman {
+
+/**
+ * When shared_io_threads is set, the roots are driven by the threads of a
+ * single SharedReactor rather than by a notify thread and an IO thread each.
+ *
+ * One event base thread waits on the notification fds of every root whose
+ * watcher exposes them, and on each root's settle timeout, and a pool of
+ * shared_io_threads workers runs the IO steps of the roots that have work.
+ * A root is stepped by at most one worker at a time, so its changes are
+ * applied in the order they were observed.  A root whose watcher needs
+ * waitNotify() to be called keeps a notify thread of its own.
+ */
+class SharedReactor {
+ public:
+  explicit SharedReactor(size_t numWorkers);
+
+  /**
+   * Returns the process's reactor, or nullptr if shared_io_threads is not
+   * set.
+   */
+  static SharedReactor* get();
+
+  folly::EventBase* getEventBase() {
+    return evbThread_.getEventBase();
+  }
+
+  folly::CPUThreadPoolExecutor& getWorkers() {
+    return workers_;
+  }
+
+ private:
+  folly::EventBaseThread evbThread_{true, nullptr, "reactor"};
+  folly::CPUThreadPoolExecutor workers_;
+};
+
+} // namespace watchman
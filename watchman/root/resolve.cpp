@@ -6,7 +6,8 @@
  */
 
 #include <fmt/core.h>
-#include <folly/String.h>
+#include <folly/Synchronized.h>
+#include <unordered_map>
 #include "watchman/Errors.h"
 #include "watchman/InMemoryView.h"
 #include "watchman/fs/FSDetect.h"
@@ -109,20 +110,82 @@ static void check_allowed_fs(const char* filename, const w_string& fs_type) {
   }
 }
 
+// The .watchmanconfig files parsed so far, by path.  A root that is watched
+// again, say after it was reaped, reuses the parsed config if the file
+// hasn't changed since.
+struct LoadedRootConfig {
+  struct timespec mtime;
+  off_t size;
+  json_ref config;
+};
+folly::Synchronized<std::unordered_map<std::string, LoadedRootConfig>>
+    loadedRootConfigs;
+
 std::optional<json_ref> load_root_config(const char* path) {
   char cfgfilename[WATCHMAN_NAME_MAX];
   snprintf(cfgfilename, sizeof(cfgfilename), "%s/.watchmanconfig", path);
 
-  if (!w_path_exists(cfgfilename)) {
-    if (errno == ENOENT) {
-      return std::nullopt;
+  FileInformation st;
+  try {
+    st = getFileInformation(cfgfilename);
+  } catch (const std::system_error& exc) {
+    loadedRootConfigs.wlock()->erase(cfgfilename);
+    if (exc.code() != error_code::no_such_file_or_directory) {
+      logf(ERR, "{} is not accessible: {}\n", cfgfilename, exc.what());
     }
-    logf(
-        ERR, "{} is not accessible: {}\n", cfgfilename, folly::errnoStr(errno));
     return std::nullopt;
   }
 
-  return json_load_file(cfgfilename, 0);
+  {
+    auto loaded = loadedRootConfigs.rlock();
+    auto it = loaded->find(cfgfilename);
+    if (it != loaded->end() && it->second.size == st.size &&
+        it->second.mtime.tv_sec == st.mtime.tv_sec &&
+        it->second.mtime.tv_nsec == st.mtime.tv_nsec) {
+      return it->second.config;
+    }
+  }
+
+  auto config = json_load_file(cfgfilename, 0);
+  loadedRootConfigs.wlock()->insert_or_assign(
+      cfgfilename, LoadedRootConfig{st.mtime, st.size, config});
+  return config;
+}
+
+// Roots that commands have resolved to, by the path they named.  An entry is
+// only good while the set of watched roots is as it was when the entry was
+// made; it saves checking the path again on every command.
+struct ResolvedRoot {
+  std::weak_ptr<Root> root;
+  uint64_t generation;
+};
+constexpr size_t kMaxResolvedRoots = 4096;
+folly::Synchronized<std::unordered_map<w_string, ResolvedRoot>> resolvedRoots;
+
+std::shared_ptr<Root> lookupResolvedRoot(const w_string& filename) {
+  auto resolved = resolvedRoots.rlock();
+  auto it = resolved->find(filename);
+  if (it == resolved->end() ||
+      it->second.generation !=
+          watched_roots_generation.load(std::memory_order_acquire)) {
+    return nullptr;
+  }
+  auto root = it->second.root.lock();
+  if (!root || root->inner.cancelled) {
+    return nullptr;
+  }
+  return root;
+}
+
+void recordResolvedRoot(
+    const w_string& filename,
+    const std::shared_ptr<Root>& root,
+    uint64_t generation) {
+  auto resolved = resolvedRoots.wlock();
+  if (resolved->size() >= kMaxResolvedRoots) {
+    resolved->clear();
+  }
+  resolved->insert_or_assign(filename, ResolvedRoot{root, generation});
 }
 
 } // namespace
@@ -148,6 +211,16 @@ root_resolve(const char* filename_cstr, bool auto_watch, bool* created) {
     throw RootResolveError("cannot watch \"/\"");
   }
 
+  // Recorded before looking the root up, so that a root that is added or
+  // removed meanwhile invalidates what we record
+  auto generation = watched_roots_generation.load(std::memory_order_acquire);
+  w_string filenameStr{filename_cstr, W_STRING_BYTE};
+  if (auto cached = lookupResolvedRoot(filenameStr)) {
+    // Sequentially consistent, as InMemoryView::considerHibernate relies on
+    cached->inner.last_cmd_timestamp.store(std::chrono::steady_clock::now());
+    return cached;
+  }
+
   w_string root_str;
 
   try {
@@ -204,8 +277,8 @@ root_resolve(const char* filename_cstr, bool auto_watch, bool* created) {
     // lock and the worst case side effect is that we (safely) decide to reap
     // at the same instant that a new command comes in.  The reap intervals
     // are typically on the order of days.
-    root->inner.last_cmd_timestamp.store(
-        std::chrono::steady_clock::now(), std::memory_order_release);
+    root->inner.last_cmd_timestamp.store(std::chrono::steady_clock::now());
+    recordResolvedRoot(filenameStr, root, generation);
     return root;
   }
 
@@ -254,6 +327,7 @@ root_resolve(const char* filename_cstr, bool auto_watch, bool* created) {
     } else {
       existing = root;
       *created = true;
+      watched_roots_generation.fetch_add(1, std::memory_order_acq_rel);
     }
   }
 
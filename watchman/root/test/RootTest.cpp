@@ -23,4 +23,15 @@ TEST(RootTest, IgnoreSet_includes_ignore_vcs_if_no_ignore_dirs) {
   EXPECT_TRUE(ignores.isIgnoreVCS(w_string{"root/.hg"}));
 }
 
+TEST(RootTest, IgnoreSet_includes_ignore_globs) {
+  json_ref val = json_object({
+      {"ignore_globs", json_array({w_string_to_json("**/node_modules")})},
+  });
+  Configuration config(val);
+
+  auto ignores = computeIgnoreSet(w_string{"root"}, config);
+  EXPECT_TRUE(ignores.isIgnoreDir(w_string{"root/a/node_modules"}));
+  EXPECT_FALSE(ignores.isIgnoreDir(w_string{"root/a"}));
+}
+
 } // namespace
@@ -17,24 +17,64 @@ void Root::recrawlTriggered(const char* why) {
   log(ERR, root_path, ": ", why, ": tree recrawl triggered\n");
 }
 
+namespace {
+void noteRecrawl(
+    Root::RecrawlInfo& info,
+    const RootOptions& options,
+    const char* why) {
+  info.recrawlCount++;
+  info.reason = why;
+  if (!options.suppressRecrawlWarnings) {
+    info.warning = w_string::build(
+        "Recrawled this watch ",
+        info.recrawlCount,
+        " times, most recently because:\n",
+        why,
+        "To resolve, please review the information on\n",
+        cfg_get_trouble_url(),
+        "#recrawl");
+  }
+}
+} // namespace
+
 void Root::scheduleRecrawl(const char* why) {
+  if (options.scopedRecrawl) {
+    if (auto scope = view()->getRecentChangeScope()) {
+      scheduleRecrawl(why, *scope);
+      return;
+    }
+  }
+  scheduleFullRecrawl(why);
+}
+
+void Root::scheduleRecrawl(const char* why, const w_string& scope) {
   {
     auto info = recrawlInfo.wlock();
+    if (info->shouldRecrawl) {
+      // The whole tree is going to be recrawled anyway
+      return;
+    }
+    if (scope != root_path && view()->recrawlSubtree(scope)) {
+      noteRecrawl(*info, options, why);
+      log(ERR,
+          root_path,
+          ": ",
+          why,
+          ": scheduling a recrawl of ",
+          scope,
+          "\n");
+      return;
+    }
+  }
+  scheduleFullRecrawl(why);
+}
 
-    if (!info->shouldRecrawl) {
-      info->recrawlCount++;
-      info->reason = why;
-      if (!config.getBool("suppress_recrawl_warnings", false)) {
-        info->warning = w_string::build(
-            "Recrawled this watch ",
-            info->recrawlCount,
-            " times, most recently because:\n",
-            why,
-            "To resolve, please review the information on\n",
-            cfg_get_trouble_url(),
-            "#recrawl");
-      }
+void Root::scheduleFullRecrawl(const char* why) {
+  {
+    auto info = recrawlInfo.wlock();
 
+    if (!info->shouldRecrawl) {
+      noteRecrawl(*info, options, why);
       log(ERR, root_path, ": ", why, ": scheduling a tree recrawl\n");
     }
     info->shouldRecrawl = true;
@@ -20,6 +20,7 @@ namespace watchman {
 folly::Synchronized<std::unordered_map<w_string, std::shared_ptr<Root>>>
     watched_roots;
 std::atomic<long> live_roots{0};
+std::atomic<uint64_t> watched_roots_generation{0};
 
 bool Root::removeFromWatched() {
   auto map = watched_roots.wlock();
@@ -31,6 +32,7 @@ bool Root::removeFromWatched() {
   // another, so make sure we're removing the right object
   if (it->second.get() == this) {
     map->erase(it);
+    watched_roots_generation.fetch_add(1, std::memory_order_acq_rel);
     return true;
   }
   return false;
@@ -187,8 +189,8 @@ RootDebugStatus Root::getStatus() const {
   }
 
   std::vector<RootQueryInfo> query_info;
-  {
-    auto locked = queries.rlock();
+  queries.forEachShard([&](const auto& shard) {
+    auto locked = shard.rlock();
     for (auto& ctx : *locked) {
       auto elapsed = now - ctx->created;
 
@@ -200,6 +202,9 @@ RootDebugStatus Root::getStatus() const {
         case QueryContextState::WaitingForCookieSync:
           queryState = "WaitingForCookieSync";
           break;
+        case QueryContextState::WaitingForAdmission:
+          queryState = "WaitingForAdmission";
+          break;
         case QueryContextState::WaitingForViewLock:
           queryState = "WaitingForViewLock";
           break;
@@ -225,6 +230,14 @@ RootDebugStatus Root::getStatus() const {
       info.render_duration_milliseconds = ctx->renderDuration.load().count();
       info.view_lock_wait_duration_milliseconds =
           ctx->viewLockWaitDuration.load().count();
+      {
+        auto usage = ctx->usage.rlock();
+        info.cpu_time_microseconds = usage->cpuTime.count();
+        info.allocated_bytes = usage->allocatedBytes;
+        info.files_walked = usage->filesWalked;
+        info.files_rendered = usage->filesRendered;
+        info.bytes_encoded = usage->bytesEncoded;
+      }
       info.state = queryState;
       info.client_pid = ctx->query->clientPid;
       info.request_id = ctx->query->request_id;
@@ -235,7 +248,7 @@ RootDebugStatus Root::getStatus() const {
 
       query_info.push_back(std::move(info));
     }
-  }
+  });
 
   std::vector<w_string> cookiePrefix;
   for (const auto& name : cookies.cookiePrefix()) {
@@ -258,6 +271,7 @@ RootDebugStatus Root::getStatus() const {
   obj.cookie_prefix = cookiePrefix;
   obj.cookie_dir = cookieDirs;
   obj.cookie_list = cookie_array;
+  obj.coalesced_cookie_count = cookies.getCoalescedSyncCount();
   obj.recrawl_info = std::move(recrawl_info);
   obj.queries = std::move(query_info);
   obj.done_initial = inner.done_initial;
@@ -280,6 +294,15 @@ json_ref Root::triggerListToJson() const {
   return json_array(std::move(arr));
 }
 
+json_ref Root::triggerStatsToJson() const {
+  auto obj = json_object();
+  auto map = triggers.rlock();
+  for (const auto& it : *map) {
+    obj.set(it.first, it.second->statsToJson());
+  }
+  return obj;
+}
+
 void w_root_free_watched_roots() {
   int last, interval;
   time_t started;
@@ -22,6 +22,10 @@ extern std::atomic<long> live_roots;
 extern folly::Synchronized<std::unordered_map<w_string, std::shared_ptr<Root>>>
     watched_roots;
 
+// Bumped whenever a root is added to or removed from watched_roots, so that
+// anything derived from the set of watched roots can tell when to redo it.
+extern std::atomic<uint64_t> watched_roots_generation;
+
 bool findEnclosingRoot(
     const w_string& fileName,
     w_string_piece& prefix,
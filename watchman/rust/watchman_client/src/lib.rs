@@ -90,6 +90,7 @@ pub mod prelude {
 
 use prelude::*;
 
+
 #[derive(Error, Debug)]
 pub enum ConnectionLost {
     #[error("Client task exited")]
@@ -408,6 +409,9 @@ struct SendRequest {
     buf: Vec<u8>,
     /// to pass the response back to the requstor
     tx: tokio::sync::oneshot::Sender<Result<Bytes, String>>,
+    /// For a streaming query, to pass the PDUs that precede the
+    /// final response back to the requestor
+    stream: Option<UnboundedSender<Bytes>>,
 }
 
 impl SendRequest {
@@ -587,6 +591,10 @@ impl ClientTask {
             #[serde(default)]
             pub canceled: bool,
         }
+        #[derive(Deserialize, Debug)]
+        pub struct StreamKind {
+            pub stream: Option<String>,
+        }
 
         if let Ok(unilateral) = bunser::<Unilateral>(&pdu) {
             if let Some(subscription) = self.subscriptions.get_mut(&unilateral.subscription) {
@@ -604,6 +612,21 @@ impl ClientTask {
                 }
             }
         } else if self.waiting_response {
+            let front = self
+                .request_queue
+                .front()
+                .expect("waiting_response is only true when request_queue is not empty");
+            if let Some(stream) = &front.stream {
+                if let Ok(StreamKind { stream: Some(kind) }) = bunser(&pdu) {
+                    if kind != "trailer" {
+                        // If the QueryStream was dropped the rest of its
+                        // results are discarded
+                        let _ = stream.send(pdu);
+                        return Ok(());
+                    }
+                }
+            }
+
             let request = self
                 .request_queue
                 .pop_front()
@@ -649,10 +672,25 @@ impl ClientInner {
     where
         Request: serde::Serialize + std::fmt::Debug,
         Response: serde::de::DeserializeOwned,
+    {
+        let rx = self.send_request(&request, None).await?;
+        let pdu_data = receive_response(rx).await?;
+        decode_response(&pdu_data, &request)
+    }
+
+    /// Serializes the request and asks the client task to send it for us,
+    /// returning the channel on which its response will be delivered.
+    async fn send_request<Request>(
+        &mut self,
+        request: &Request,
+        stream: Option<UnboundedSender<Bytes>>,
+    ) -> Result<tokio::sync::oneshot::Receiver<Result<Bytes, String>>, Error>
+    where
+        Request: serde::Serialize + std::fmt::Debug,
     {
         // Step 1: serialize into a bser byte buffer
         let mut request_data = vec![];
-        serde_bser::ser::serialize(&mut request_data, &request).map_err(|source| {
+        serde_bser::ser::serialize(&mut request_data, request).map_err(|source| {
             Error::Serialize {
                 source: source.into(),
             }
@@ -664,36 +702,51 @@ impl ClientInner {
             .send(TaskItem::QueueRequest(SendRequest {
                 buf: request_data,
                 tx,
+                stream,
             }))
             .await
             .map_err(|_| ConnectionLost::ClientTaskExited)?;
+        Ok(rx)
+    }
+}
 
-        // Step 3: wait for the client task to give us the response
-        let pdu_data = rx
-            .await
-            .map_err(|_| ConnectionLost::ClientTaskExited)?
-            .map_err(ConnectionLost::Error)?;
-
-        // Step 4: sniff for an error response in the deserialized data
-        use serde::Deserialize;
-        #[derive(Deserialize, Debug)]
-        struct MaybeError {
-            #[serde(default)]
-            error: Option<String>,
-        }
+/// Waits for the client task to give us the response to a request.
+async fn receive_response(
+    rx: tokio::sync::oneshot::Receiver<Result<Bytes, String>>,
+) -> Result<Bytes, Error> {
+    // Step 3: wait for the client task to give us the response
+    let pdu_data = rx
+        .await
+        .map_err(|_| ConnectionLost::ClientTaskExited)?
+        .map_err(ConnectionLost::Error)?;
+    Ok(pdu_data)
+}
 
-        // Step 5: deserialize into the caller-desired format
-        let maybe_err: MaybeError = bunser(&pdu_data)?;
-        if let Some(message) = maybe_err.error {
-            return Err(Error::WatchmanServerError {
-                message,
-                command: format!("{:#?}", request),
-            });
-        }
+/// Decodes the response to request.
+fn decode_response<Request, Response>(pdu_data: &[u8], request: &Request) -> Result<Response, Error>
+where
+    Request: std::fmt::Debug,
+    Response: serde::de::DeserializeOwned,
+{
+    // Step 4: sniff for an error response in the deserialized data
+    use serde::Deserialize;
+    #[derive(Deserialize, Debug)]
+    struct MaybeError {
+        #[serde(default)]
+        error: Option<String>,
+    }
 
-        let response: Response = bunser(&pdu_data)?;
-        Ok(response)
+    // Step 5: deserialize into the caller-desired format
+    let maybe_err: MaybeError = bunser(pdu_data)?;
+    if let Some(message) = maybe_err.error {
+        return Err(Error::WatchmanServerError {
+            message,
+            command: format!("{:#?}", request),
+        });
     }
+
+    let response: Response = bunser(pdu_data)?;
+    Ok(response)
 }
 
 /// Returned by [Subscription::next](struct.Subscription.html#method.next)
@@ -826,6 +879,231 @@ where
     }
 }
 
+/// A handle to a query initiated via `Client::query_stream`.
+/// Repeatedly call `QueryStream::next().await` to yield the batches of
+/// matching files as they are received, and then `QueryStream::finish`
+/// to obtain the clock and fresh instance status of the results.
+pub struct QueryStream<F>
+where
+    F: serde::de::DeserializeOwned + std::fmt::Debug + Clone + QueryFieldList,
+{
+    request: QueryRequest,
+    batches: UnboundedReceiver<Bytes>,
+    response: Option<tokio::sync::oneshot::Receiver<Result<Bytes, String>>>,
+    trailer: Option<QueryStreamTrailer>,
+    _phantom: PhantomData<F>,
+}
+
+impl<F> QueryStream<F>
+where
+    F: serde::de::DeserializeOwned + std::fmt::Debug + Clone + QueryFieldList,
+{
+    /// Yield the next batch of matching files, or `None` once all of
+    /// them have been yielded.
+    /// An error is generated if the query failed or the client was
+    /// disconnected from the server.
+    #[allow(clippy::should_implement_trait)]
+    pub async fn next(&mut self) -> Result<Option<Vec<F>>, Error> {
+        while let Some(batch) = self.next_batch().await? {
+            let mut files = vec![];
+            batch.for_each_file(|file: F| files.push(file))?;
+            if !files.is_empty() {
+                return Ok(Some(files));
+            }
+        }
+        Ok(None)
+    }
+
+    /// Like `next`, but yields the undecoded batch, so that its files can
+    /// be visited one at a time with `QueryBatch::for_each_file` rather
+    /// than collected into a `Vec`.
+    pub async fn next_batch(&mut self) -> Result<Option<QueryBatch>, Error> {
+        // The batches are delivered until the final response arrives
+        if let Some(pdu) = self.batches.recv().await {
+            return Ok(Some(QueryBatch { pdu }));
+        }
+
+        let rx = match self.response.take() {
+            Some(rx) => rx,
+            None => return Ok(None),
+        };
+        let pdu_data = receive_response(rx).await?;
+        self.trailer = Some(decode_response(&pdu_data, &self.request)?);
+
+        // A server that doesn't support streaming sends all of the
+        // files in its response
+        Ok(Some(QueryBatch { pdu: pdu_data }))
+    }
+
+    /// Consume any remaining batches and return the final response
+    /// to the query.
+    pub async fn finish(mut self) -> Result<QueryStreamTrailer, Error> {
+        while self.next().await?.is_some() {}
+        self.trailer
+            .ok_or_else(|| ConnectionLost::Error("the query has already failed".to_string()).into())
+    }
+}
+
+/// A batch of files received by a `QueryStream`, as yielded by
+/// `QueryStream::next_batch`.
+///
+/// The batch holds the PDU as it was read from the connection.  Its files
+/// are only decoded by `for_each_file`, one at a time, so a file type whose
+/// fields borrow from the batch avoids copying the names and hashes out of
+/// the read buffer:
+///
+/// ```ignore
+/// #[derive(Deserialize)]
+/// struct File<'a> {
+///     #[serde(borrow)]
+///     name: &'a str,
+///     size: u64,
+/// }
+///
+/// while let Some(batch) = stream.next_batch().await? {
+///     batch.for_each_file(|file: File| total += file.size)?;
+/// }
+/// ```
+///
+/// The fields requested from the server are those of the `F` that the
+/// stream was created with, so `File` must not need any others.  Names
+/// containing escapes or invalid UTF-8 can't be borrowed as `&str`; use
+/// `Cow<'a, str>` or `&'a [u8]` if that is possible in the root.
+pub struct QueryBatch {
+    pdu: Bytes,
+}
+
+impl QueryBatch {
+    /// Decode the files of this batch in order, passing each to `f` as soon
+    /// as it has been decoded.  Nothing is accumulated, so memory use is
+    /// bounded by the size of the batch itself.
+    pub fn for_each_file<'a, T, C>(&'a self, f: C) -> Result<(), Error>
+    where
+        T: serde::Deserialize<'a>,
+        C: FnMut(T),
+    {
+        use serde::de::DeserializeSeed;
+
+        let seed = BatchSeed {
+            f,
+            _phantom: PhantomData,
+        };
+        serde_bser::de::Deserializer::new(SliceRead::new(self.pdu.as_ref()))
+            .and_then(|mut de| {
+                seed.deserialize(&mut de)?;
+                de.end()
+            })
+            .map_err(|source| Error::Deserialize {
+                source: source.into(),
+                data: self.pdu.to_vec(),
+            })
+    }
+}
+
+/// Visits the response object of a batch, deserializing its `files` with
+/// `FilesSeed` and skipping everything else.
+struct BatchSeed<T, C> {
+    f: C,
+    _phantom: PhantomData<fn(T)>,
+}
+
+impl<'de, T, C> serde::de::DeserializeSeed<'de> for BatchSeed<T, C>
+where
+    T: serde::Deserialize<'de>,
+    C: FnMut(T),
+{
+    type Value = ();
+
+    fn deserialize<D>(self, deserializer: D) -> Result<(), D::Error>
+    where
+        D: serde::Deserializer<'de>,
+    {
+        deserializer.deserialize_map(self)
+    }
+}
+
+impl<'de, T, C> serde::de::Visitor<'de> for BatchSeed<T, C>
+where
+    T: serde::Deserialize<'de>,
+    C: FnMut(T),
+{
+    type Value = ();
+
+    fn expecting(&self, formatter: &mut std::fmt::Formatter) -> std::fmt::Result {
+        formatter.write_str("a query response")
+    }
+
+    fn visit_map<A>(mut self, mut map: A) -> Result<(), A::Error>
+    where
+        A: serde::de::MapAccess<'de>,
+    {
+        #[derive(serde::Deserialize)]
+        #[serde(field_identifier, rename_all = "lowercase")]
+        enum Field {
+            Files,
+            #[serde(other)]
+            Other,
+        }
+
+        while let Some(key) = map.next_key::<Field>()? {
+            match key {
+                Field::Files => map.next_value_seed(FilesSeed {
+                    f: &mut self.f,
+                    _phantom: PhantomData,
+                })?,
+                Field::Other => {
+                    map.next_value::<serde::de::IgnoredAny>()?;
+                }
+            }
+        }
+        Ok(())
+    }
+}
+
+/// Deserializes the elements of the `files` array one at a time, passing
+/// each to the callback.
+struct FilesSeed<'c, T, C> {
+    f: &'c mut C,
+    _phantom: PhantomData<fn(T)>,
+}
+
+impl<'de, 'c, T, C> serde::de::DeserializeSeed<'de> for FilesSeed<'c, T, C>
+where
+    T: serde::Deserialize<'de>,
+    C: FnMut(T),
+{
+    type Value = ();
+
+    fn deserialize<D>(self, deserializer: D) -> Result<(), D::Error>
+    where
+        D: serde::Deserializer<'de>,
+    {
+        deserializer.deserialize_seq(self)
+    }
+}
+
+impl<'de, 'c, T, C> serde::de::Visitor<'de> for FilesSeed<'c, T, C>
+where
+    T: serde::Deserialize<'de>,
+    C: FnMut(T),
+{
+    type Value = ();
+
+    fn expecting(&self, formatter: &mut std::fmt::Formatter) -> std::fmt::Result {
+        formatter.write_str("an array of files")
+    }
+
+    fn visit_seq<A>(self, mut seq: A) -> Result<(), A::Error>
+    where
+        A: serde::de::SeqAccess<'de>,
+    {
+        while let Some(file) = seq.next_element::<T>()? {
+            (self.f)(file);
+        }
+        Ok(())
+    }
+}
+
 impl Client {
     /// This method will send a request to the watchman server
     /// and wait for its response.
@@ -1020,6 +1298,7 @@ impl Client {
             QueryRequestCommon {
                 relative_root: root.relative.clone(),
                 fields: F::field_list(),
+                stream: false,
                 ..query
             },
         );
@@ -1029,6 +1308,48 @@ impl Client {
         Ok(response)
     }
 
+    /// This is like `query`, except that rather than waiting for all
+    /// of the results to arrive in a single response, the server sends
+    /// the matching files in batches that are yielded by the returned
+    /// `QueryStream` as they are received.
+    /// This avoids holding the complete result set in memory at once on
+    /// either side of the connection, which can matter for queries that
+    /// match a large number of files.
+    ///
+    /// Commands issued on this client after the `QueryStream` are only
+    /// answered once all of its batches have been received.
+    pub async fn query_stream<F>(
+        &self,
+        root: &ResolvedRoot,
+        query: QueryRequestCommon,
+    ) -> Result<QueryStream<F>, Error>
+    where
+        F: serde::de::DeserializeOwned + std::fmt::Debug + Clone + QueryFieldList,
+    {
+        let request = QueryRequest(
+            "query",
+            root.root.clone(),
+            QueryRequestCommon {
+                relative_root: root.relative.clone(),
+                fields: F::field_list(),
+                stream: true,
+                ..query
+            },
+        );
+
+        let (tx, batches) = tokio::sync::mpsc::unbounded_channel();
+        let mut inner = self.inner.lock().await;
+        let response = inner.send_request(&request, Some(tx)).await?;
+
+        Ok(QueryStream {
+            request,
+            batches,
+            response: Some(response),
+            trailer: None,
+            _phantom: PhantomData,
+        })
+    }
+
     /// Create a Subscription that will yield file changes as they occur in
     /// real time.
     /// The `F` type is a struct defined by the
@@ -1236,6 +1557,60 @@ mod tests {
         assert!(r1.is_err());
     }
 
+    #[test]
+    fn test_query_batch_for_each_file() {
+        #[derive(Serialize)]
+        struct Batch {
+            version: &'static str,
+            files: Vec<Entry>,
+        }
+
+        #[derive(Serialize)]
+        struct Entry {
+            name: &'static str,
+            size: u64,
+        }
+
+        #[derive(Deserialize)]
+        struct File<'a> {
+            #[serde(borrow)]
+            name: &'a str,
+            size: u64,
+        }
+
+        let mut buf = vec![];
+        serde_bser::ser::serialize(
+            &mut buf,
+            Batch {
+                version: "1.0",
+                files: vec![
+                    Entry {
+                        name: "a",
+                        size: 1,
+                    },
+                    Entry {
+                        name: "b/c",
+                        size: 2,
+                    },
+                ],
+            },
+        )
+        .expect("Failed to write to a Vec");
+
+        let batch = QueryBatch {
+            pdu: Bytes::from(buf),
+        };
+        let mut files = vec![];
+        batch
+            .for_each_file(|file: File<'_>| files.push((file.name, file.size)))
+            .unwrap();
+        assert_eq!(files, vec![("a", 1), ("b/c", 2)]);
+
+        // The names point into the batch rather than into copies
+        let pdu = batch.pdu.as_ptr_range();
+        assert!(files.iter().all(|(name, _)| pdu.contains(&name.as_ptr())));
+    }
+
     #[test]
     fn test_bounds() {
         fn assert_bounds<T: std::error::Error + Sync + Send + 'static>() {}
@@ -398,6 +398,17 @@ pub struct QueryRequestCommon {
     /// transitions.
     #[serde(default, skip_serializing_if = "is_false")]
     pub always_include_directories: bool,
+
+    /// Set by `Client::query_stream` to have the server send the matching
+    /// files in batches rather than in a single response.
+    #[doc(hidden)]
+    #[serde(default, skip_serializing_if = "is_false")]
+    pub stream: bool,
+
+    /// When using `Client::query_stream`, the maximum number of files
+    /// that the server sends in each batch.  The server defaults to 1024.
+    #[serde(skip_serializing_if = "Option::is_none")]
+    pub stream_batch_size: Option<i64>,
 }
 
 #[derive(Deserialize, Clone, Debug)]
@@ -450,6 +461,30 @@ where
     pub debug: Option<QueryDebugInfo>,
 }
 
+/// The final response to a query issued via `Client::query_stream`,
+/// which is received after all of the matching files.
+#[derive(Deserialize, Clone, Debug)]
+pub struct QueryStreamTrailer {
+    /// The version of the watchman server
+    pub version: String,
+    /// As for [QueryResult](struct.QueryResult.html#structfield.is_fresh_instance),
+    /// if true you MUST arrange to forget about any files that were not
+    /// yielded by the stream.
+    #[serde(default)]
+    pub is_fresh_instance: bool,
+
+    /// The clock value at the time that these results were generated
+    pub clock: Clock,
+
+    /// When using source control aware queries with saved
+    /// state configuration, this field holds metadata from
+    /// the save state storage engine.
+    #[serde(rename = "saved-state-info")]
+    pub saved_state_info: Option<Value>,
+
+    pub debug: Option<QueryDebugInfo>,
+}
+
 #[derive(Serialize, Default, Clone, Debug)]
 pub struct SubscribeRequest {
     /// If set, enables the use of the `since` generator and specifies the last
@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/saved_state/SavedStatePrefetcher.h"
+#include <fmt/core.h>
+#include <algorithm>
+#include "watchman/Logging.h"
+#include "watchman/PerfSample.h"
+#include "watchman/QueryableView.h"
+#include "watchman/ThreadPool.h"
+#include "watchman/root/Root.h"
+#include "watchman/scm/SCM.h"
+
+namespace watchman {
+
+std::string SavedStatePrefetcher::lookupKey(
+    w_string_piece storageType,
+    const json_ref& savedStateConfig) {
+  return fmt::format(
+      "{}:{}",
+      storageType,
+      json_dumps(savedStateConfig, JSON_COMPACT | JSON_SORT_KEYS));
+}
+
+std::optional<SavedStatePrefetcher::Result> SavedStatePrefetcher::lookup(
+    w_string_piece storageType,
+    const json_ref& savedStateConfig,
+    w_string_piece commitId,
+    std::chrono::seconds maxAge) {
+  auto key = fmt::format(
+      "{}:{}", lookupKey(storageType, savedStateConfig), commitId);
+  auto now = std::chrono::steady_clock::now();
+
+  auto state = state_.wlock();
+  auto it = state->results.find(key);
+  if (it == state->results.end() || now - it->second.found > maxAge) {
+    ++state->stats.misses;
+    return std::nullopt;
+  }
+  ++state->stats.hits;
+  return it->second.result;
+}
+
+void SavedStatePrefetcher::store(
+    State& state,
+    const std::string& key,
+    w_string_piece commitId,
+    const Result& result) {
+  if (result.commitId.empty()) {
+    // Nothing was found, perhaps only for now; leave it to the next query
+    // to look again.
+    return;
+  }
+  auto resultKey = fmt::format("{}:{}", key, commitId);
+  auto [it, inserted] = state.results.insert_or_assign(
+      resultKey, CachedResult{result, std::chrono::steady_clock::now()});
+  if (!inserted) {
+    return;
+  }
+  state.resultOrder.push_back(it->first);
+  while (state.resultOrder.size() > kMaxResults) {
+    state.results.erase(state.resultOrder.front());
+    state.resultOrder.pop_front();
+  }
+}
+
+void SavedStatePrefetcher::record(
+    SavedStateFactory factory,
+    w_string_piece storageType,
+    const json_ref& savedStateConfig,
+    const w_string& mergeBaseWith,
+    w_string_piece commitId,
+    const Result& result) {
+  auto key = lookupKey(storageType, savedStateConfig);
+
+  auto state = state_.wlock();
+  store(*state, key, commitId, result);
+
+  // Move the lookup to the back, so that the least recently used one is
+  // forgotten first.
+  auto& lookups = state->lookups;
+  auto it = std::find_if(lookups.begin(), lookups.end(), [&](auto& lookup) {
+    return lookup.key == key && lookup.mergeBaseWith == mergeBaseWith;
+  });
+  if (it != lookups.end()) {
+    lookups.erase(it);
+  }
+  lookups.push_back(Lookup{
+      factory,
+      storageType.asWString(),
+      savedStateConfig,
+      mergeBaseWith,
+      std::move(key)});
+  if (lookups.size() > kMaxLookups) {
+    lookups.pop_front();
+  }
+}
+
+void SavedStatePrefetcher::schedule(const std::shared_ptr<Root>& root) {
+  {
+    auto state = state_.wlock();
+    if (state->lookups.empty()) {
+      return;
+    }
+    if (state->running) {
+      state->rerun = true;
+      return;
+    }
+    state->running = true;
+  }
+
+  try {
+    // The root owns this, so holding a reference to it keeps this alive
+    getThreadPool().addWithPriority(
+        [this, root] { prefetch(root); }, folly::Executor::LO_PRI);
+  } catch (const std::exception& exc) {
+    logf(ERR, "failed to schedule saved state prefetch: {}\n", exc.what());
+    state_.wlock()->running = false;
+  }
+}
+
+void SavedStatePrefetcher::prefetch(const std::shared_ptr<Root>& root) {
+  while (true) {
+    auto lookups = state_.rlock()->lookups;
+    auto view = root->view();
+    auto scm = view->getSCM();
+
+    // In the middle of an update or rebase the working copy isn't where it
+    // will end up; the lock's removal schedules another prefetch.
+    if (scm && !view->isVCSOperationInProgress()) {
+      for (auto& lookup : lookups) {
+        try {
+          auto mergeBase = scm->mergeBaseWith(lookup.mergeBaseWith);
+          auto savedStateInterface = lookup.factory(
+              lookup.storageType,
+              lookup.savedStateConfig,
+              scm,
+              root->config,
+              [root](PerfSample& sample) {
+                root->addPerfSampleMetadata(sample);
+              });
+          auto result =
+              savedStateInterface->getMostRecentSavedState(mergeBase);
+
+          auto state = state_.wlock();
+          store(*state, lookup.key, mergeBase, result);
+          ++state->stats.prefetched;
+        } catch (const std::exception& exc) {
+          logf(
+              ERR,
+              "failed to prefetch the saved state for {}: {}\n",
+              lookup.mergeBaseWith,
+              exc.what());
+        }
+      }
+    }
+
+    auto state = state_.wlock();
+    if (!state->rerun) {
+      state->running = false;
+      return;
+    }
+    state->rerun = false;
+  }
+}
+
+SavedStatePrefetcher::Stats SavedStatePrefetcher::getStats() const {
+  return state_.rlock()->stats;
+}
+
+} // namespace watchman
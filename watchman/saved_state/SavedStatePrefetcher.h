@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/Synchronized.h>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include "watchman/saved_state/SavedStateInterface.h"
+#include "watchman/thirdparty/jansson/jansson.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+class Root;
+
+/**
+ * Caches the saved states found for a root's scm-aware queries and
+ * refreshes them in the background when the working copy moves, so that
+ * the first query after a rebase or update doesn't wait on the saved state
+ * storage.
+ *
+ * Each distinct saved state lookup that a query makes is remembered, up to
+ * kMaxLookups of them.  When the IO thread sees the SCM's dirstate change,
+ * schedule() arranges for a thread pool worker to compute the new merge
+ * base for each remembered lookup and resolve its saved state.  Queries
+ * consult lookup() before asking the storage themselves.
+ *
+ * Only found saved states are cached, and only for a bounded time, so that
+ * a saved state that is published later is still noticed.
+ */
+class SavedStatePrefetcher {
+ public:
+  using Result = SavedStateInterface::SavedStateResult;
+
+  // How many distinct lookups are remembered
+  static constexpr size_t kMaxLookups = 8;
+  // How many results are cached
+  static constexpr size_t kMaxResults = 64;
+
+  struct Stats {
+    size_t hits{0};
+    size_t misses{0};
+    size_t prefetched{0};
+  };
+
+  // Returns the saved state cached for commitId, if one was found no more
+  // than maxAge ago.
+  std::optional<Result> lookup(
+      w_string_piece storageType,
+      const json_ref& savedStateConfig,
+      w_string_piece commitId,
+      std::chrono::seconds maxAge);
+
+  // Records the result of a query's own saved state lookup for commitId,
+  // and remembers the lookup so that it is refreshed by later prefetches.
+  // mergeBaseWith is the query's scm merge base target.
+  void record(
+      SavedStateFactory factory,
+      w_string_piece storageType,
+      const json_ref& savedStateConfig,
+      const w_string& mergeBaseWith,
+      w_string_piece commitId,
+      const Result& result);
+
+  // Called when the working copy may have moved; prefetches the remembered
+  // lookups on the thread pool.  Cheap when there is nothing to prefetch
+  // or a prefetch is already running.
+  void schedule(const std::shared_ptr<Root>& root);
+
+  Stats getStats() const;
+
+ private:
+  struct Lookup {
+    SavedStateFactory factory;
+    w_string storageType;
+    json_ref savedStateConfig;
+    w_string mergeBaseWith;
+    // storageType and savedStateConfig, serialized
+    std::string key;
+  };
+
+  struct CachedResult {
+    Result result;
+    std::chrono::steady_clock::time_point found;
+  };
+
+  struct State {
+    std::deque<Lookup> lookups;
+    std::unordered_map<std::string, CachedResult> results;
+    // Keys of results, oldest first
+    std::deque<std::string> resultOrder;
+    bool running{false};
+    // Set when the working copy moved while a prefetch was running
+    bool rerun{false};
+    Stats stats;
+  };
+
+  static std::string lookupKey(
+      w_string_piece storageType,
+      const json_ref& savedStateConfig);
+  static void store(
+      State& state,
+      const std::string& key,
+      w_string_piece commitId,
+      const Result& result);
+  void prefetch(const std::shared_ptr<Root>& root);
+
+  folly::Synchronized<State> state_;
+};
+
+} // namespace watchman
@@ -7,10 +7,12 @@
 
 #include "watchman/scm/Git.h"
 #include <fmt/core.h>
+#include <folly/FileUtil.h>
 #include <folly/String.h>
 #include "watchman/ChildProcess.h"
 #include "watchman/CommandRegistry.h"
 #include "watchman/Logging.h"
+#include "watchman/PerfSample.h"
 #include "watchman/fs/FileSystem.h"
 
 // Capability indicating support for the git SCM
@@ -37,7 +39,16 @@ GitResult runGit(
     std::vector<std::string_view> cmdline,
     ChildProcess::Options options,
     std::string_view description) {
+  PerfSample sample("spawn");
   ChildProcess proc{cmdline, std::move(options)};
+  if (sample.finish()) {
+    sample.add_meta(
+        "spawn",
+        json_object(
+            {{"command", typed_string_to_json(cmdline[0])},
+             {"description", typed_string_to_json(description)}}));
+    sample.log();
+  }
   auto outputs = proc.communicate();
   auto status = proc.wait();
   if (status) {
@@ -64,20 +75,43 @@ GitResult runGit(
   }
 }
 
+bool isObjectId(std::string_view text) {
+  return text.size() == 40 &&
+      std::all_of(text.begin(), text.end(), [](char c) {
+           return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+         });
+}
+
+std::string_view trimNewline(std::string_view text) {
+  while (!text.empty() && (text.back() == '\n' || text.back() == '\r')) {
+    text.remove_suffix(1);
+  }
+  return text;
+}
+
 } // namespace
 
 namespace watchman {
 
 Git::Git(w_string_piece rootPath, w_string_piece scmRoot)
     : SCM(rootPath, scmRoot),
-      indexPath_(fmt::format("{}/.git/index", getSCMRoot())),
+      gitDir_(fmt::format("{}/.git", getSCMRoot())),
+      indexPath_(fmt::format("{}/index", gitDir_)),
       commitsPrior_(Configuration(), "scm_git_commits_prior", 32, 10),
-      mergeBases_(Configuration(), "scm_git_mergebase", 32, 10),
       filesChangedSinceMergeBaseWith_(
           Configuration(),
           "scm_git_files_since_mergebase",
           32,
-          10) {}
+          10) {
+  const auto& root = getRootPath();
+  const auto& scmRoot = getSCMRoot();
+  if (root.size() > scmRoot.size() + 1) {
+    rootPrefix_ = std::string{root.view().substr(scmRoot.size() + 1)};
+    // The index names files with forward slashes on every platform
+    std::replace(rootPrefix_.begin(), rootPrefix_.end(), '\\', '/');
+    rootPrefix_.push_back('/');
+  }
+}
 
 ChildProcess::Options Git::makeGitOptions(
     const std::optional<w_string>& requestId) const {
@@ -106,38 +140,171 @@ struct timespec Git::getIndexMtime() const {
   }
 }
 
+std::shared_ptr<const GitIndex> Git::getIndex() const {
+  auto now = std::chrono::steady_clock::now();
+  {
+    auto state = indexState_.rlock();
+    if (now - state->checked < std::chrono::seconds{1}) {
+      return state->index;
+    }
+  }
+
+  auto state = indexState_.wlock();
+  if (now - state->checked < std::chrono::seconds{1}) {
+    return state->index;
+  }
+  state->checked = now;
+  try {
+    auto info =
+        getFileInformation(indexPath_.c_str(), CaseSensitivity::CaseSensitive);
+    if (state->index && int64_t(info.size) == state->size &&
+        info.mtime.tv_sec == state->mtime.tv_sec &&
+        info.mtime.tv_nsec == state->mtime.tv_nsec) {
+      return state->index;
+    }
+    std::string contents;
+    if (!folly::readFile(indexPath_.c_str(), contents)) {
+      throw std::system_error(
+          errno, std::generic_category(), "reading the git index");
+    }
+    state->index = std::make_shared<const GitIndex>(contents, info.mtime);
+    state->mtime = info.mtime;
+    state->size = int64_t(info.size);
+  } catch (const std::exception& exc) {
+    logf(DBG, "unable to read {}: {}\n", indexPath_, exc.what());
+    state->index = nullptr;
+  }
+  return state->index;
+}
+
+std::optional<GitIndex::BlobId> Git::getIndexedBlobId(
+    w_string_piece path,
+    const FileInformation& info) const {
+  auto index = getIndex();
+  if (!index) {
+    return std::nullopt;
+  }
+  if (rootPrefix_.empty()) {
+    return index->lookup(path, info);
+  }
+  return index->lookup(w_string::build(rootPrefix_, path), info);
+}
+
+std::optional<std::string> Git::resolveRef(std::string_view name) const {
+  if (isObjectId(name)) {
+    return std::string{name};
+  }
+
+  std::string contents;
+  if (name == "HEAD") {
+    if (!folly::readFile(fmt::format("{}/HEAD", gitDir_).c_str(), contents)) {
+      return std::nullopt;
+    }
+    auto head = trimNewline(contents);
+    if (isObjectId(head)) {
+      // Detached
+      return std::string{head};
+    }
+    constexpr std::string_view kRefPrefix = "ref: ";
+    if (head.substr(0, kRefPrefix.size()) != kRefPrefix) {
+      return std::nullopt;
+    }
+    name = head.substr(kRefPrefix.size());
+    if (name.substr(0, 5) != "refs/") {
+      return std::nullopt;
+    }
+  }
+
+  // The same search order as git rev-parse, less the refs/remotes/<name>/HEAD
+  // symbolic ref.
+  std::vector<std::string> candidates;
+  if (name.substr(0, 5) == "refs/") {
+    candidates.emplace_back(name);
+  } else {
+    for (auto prefix :
+         {"", "refs/", "refs/tags/", "refs/heads/", "refs/remotes/"}) {
+      candidates.push_back(fmt::format("{}{}", prefix, name));
+    }
+  }
+  std::string packed;
+  bool readPacked = false;
+  for (auto& ref : candidates) {
+    if (ref.find("..") != std::string::npos) {
+      return std::nullopt;
+    }
+    std::string loose;
+    if (folly::readFile(fmt::format("{}/{}", gitDir_, ref).c_str(), loose)) {
+      auto id = trimNewline(loose);
+      if (isObjectId(id)) {
+        return std::string{id};
+      }
+      // Symbolic, or not a ref at all
+      return std::nullopt;
+    }
+
+    if (!readPacked) {
+      readPacked = true;
+      folly::readFile(fmt::format("{}/packed-refs", gitDir_).c_str(), packed);
+    }
+    // Lines are "<id> <ref>", interspersed with comments and the "^<id>"
+    // lines that peel annotated tags.
+    std::string_view rest{packed};
+    while (!rest.empty()) {
+      auto eol = rest.find('\n');
+      auto line = trimNewline(rest.substr(0, eol));
+      rest = eol == std::string_view::npos ? std::string_view{}
+                                           : rest.substr(eol + 1);
+      if (line.size() == 41 + ref.size() && line[40] == ' ' &&
+          line.substr(41) == ref && isObjectId(line.substr(0, 40))) {
+        return std::string{line.substr(0, 40)};
+      }
+    }
+  }
+  return std::nullopt;
+}
+
 w_string Git::mergeBaseWith(
     w_string_piece commitId,
     const std::optional<w_string>& requestId) const {
-  auto mtime = getIndexMtime();
-  auto key = fmt::format("{}:{}:{}", commitId, mtime.tv_sec, mtime.tv_nsec);
   auto commit = std::string{commitId.view()};
 
-  return mergeBases_
-      .get(
-          key,
-          [this, commit, requestId](const std::string&) {
-            auto result = runGit(
-                {gitExecutablePath(), "merge-base", commit, "HEAD"},
-                makeGitOptions(requestId),
-                "query for the merge base");
+  // When both sides resolve to object ids the merge base can never change,
+  // so the cache entry doesn't need to expire whenever the index is
+  // rewritten.  Ask git about the HEAD we resolved so that the result
+  // matches the key even if HEAD moves in the meantime.
+  std::string key;
+  std::string head = "HEAD";
+  auto commitObject = resolveRef(commit);
+  auto headObject = commitObject ? resolveRef("HEAD") : std::nullopt;
+  if (headObject) {
+    key = fmt::format("{}:{}:{}", getSCMRoot(), *commitObject, *headObject);
+    commit = *commitObject;
+    head = *headObject;
+  } else {
+    auto mtime = getIndexMtime();
+    key = fmt::format(
+        "{}:{}:{}:{}", getSCMRoot(), commitId, mtime.tv_sec, mtime.tv_nsec);
+  }
 
-            auto output = std::string{result.output.view()};
-            if (!output.empty() && output.back() == '\n') {
-              output.pop_back();
-            }
+  return cachedMergeBase(key, [this, commit, head, requestId] {
+    auto result = runGit(
+        {gitExecutablePath(), "merge-base", commit, head},
+        makeGitOptions(requestId),
+        "query for the merge base");
 
-            if (output.size() != 40) {
-              SCMError::throwf(
-                  "expected merge base to be a 40 character string, got {}",
-                  output);
-            }
+    auto output = std::string{result.output.view()};
+    if (!output.empty() && output.back() == '\n') {
+      output.pop_back();
+    }
 
-            // TODO: is w_string(s.c_str()) safe?
-            return folly::makeFuture(w_string(output.c_str()));
-          })
-      .get()
-      ->value();
+    if (output.size() != 40) {
+      SCMError::throwf(
+          "expected merge base to be a 40 character string, got {}", output);
+    }
+
+    // TODO: is w_string(s.c_str()) safe?
+    return w_string(output.c_str());
+  });
 }
 
 std::vector<w_string> Git::getFilesChangedSinceMergeBaseWith(
@@ -183,9 +350,15 @@ std::vector<w_string> Git::getCommitsPriorToAndIncluding(
     w_string_piece commitId,
     int numCommits,
     const std::optional<w_string>& requestId) const {
-  auto mtime = getIndexMtime();
-  auto key = fmt::format(
-      "{}:{}:{}:{}", commitId, numCommits, mtime.tv_sec, mtime.tv_nsec);
+  std::string key;
+  if (auto commit = resolveRef(commitId.view())) {
+    // The history of a commit never changes
+    key = fmt::format("{}:{}", *commit, numCommits);
+  } else {
+    auto mtime = getIndexMtime();
+    key = fmt::format(
+        "{}:{}:{}:{}", commitId, numCommits, mtime.tv_sec, mtime.tv_nsec);
+  }
   auto commitCopy = std::string{commitId.view()};
 
   return commitsPrior_
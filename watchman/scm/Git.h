@@ -7,10 +7,16 @@
 
 #pragma once
 
+#include <folly/Synchronized.h>
 #include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
 #include <vector>
 #include "watchman/ChildProcess.h"
 #include "watchman/LRUCache.h"
+#include "watchman/scm/GitIndex.h"
 #include "watchman/scm/SCM.h"
 
 namespace watchman {
@@ -34,16 +40,46 @@ class Git : public SCM {
       int numCommits,
       const std::optional<w_string>& requestId = std::nullopt) const override;
 
+  /**
+   * Returns the blob id that the index records for the file at path,
+   * relative to the watched root, if info shows that the file hasn't
+   * changed since git hashed it.  The index is read again when it changes,
+   * which is checked for at most once a second; an index that is a little
+   * out of date only means that a file's stat data is less likely to match.
+   */
+  std::optional<GitIndex::BlobId> getIndexedBlobId(
+      w_string_piece path,
+      const FileInformation& info) const;
+
  private:
+  std::string gitDir_;
   std::string indexPath_;
   mutable LRUCache<std::string, std::vector<w_string>> commitsPrior_;
-  mutable LRUCache<std::string, w_string> mergeBases_;
   mutable LRUCache<std::string, std::vector<w_string>>
       filesChangedSinceMergeBaseWith_;
+  // The watched root relative to the top of the working tree, with a
+  // trailing slash, or empty if they are the same
+  std::string rootPrefix_;
+
+  struct IndexState {
+    // nullptr if the index couldn't be read
+    std::shared_ptr<const GitIndex> index;
+    struct timespec mtime {};
+    int64_t size{-1};
+    std::chrono::steady_clock::time_point checked;
+  };
+  mutable folly::Synchronized<IndexState> indexState_;
 
   ChildProcess::Options makeGitOptions(
       const std::optional<w_string>& requestId) const;
   struct timespec getIndexMtime() const;
+  std::shared_ptr<const GitIndex> getIndex() const;
+
+  // Resolves name, which may be an object id, HEAD or a ref, to an object
+  // id by reading the repository's files rather than running git.  Returns
+  // nullopt for anything but the simple cases, such as symbolic refs other
+  // than HEAD, revision expressions or a linked worktree.
+  std::optional<std::string> resolveRef(std::string_view name) const;
 };
 
 } // namespace watchman
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/scm/GitIndex.h"
+#include <fmt/core.h>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace watchman {
+
+namespace {
+
+// Entry flags
+constexpr uint16_t kExtendedFlag = 0x4000;
+constexpr uint16_t kStageMask = 0x3000;
+constexpr uint16_t kNameMask = 0x0fff;
+// Extended entry flags
+constexpr uint16_t kSkipWorktreeFlag = 0x4000;
+constexpr uint16_t kIntentToAddFlag = 0x2000;
+
+// File types of the mode field
+constexpr uint32_t kTypeMask = 0170000;
+constexpr uint32_t kTypeRegular = 0100000;
+constexpr uint32_t kTypeSymlink = 0120000;
+
+class Reader {
+ public:
+  explicit Reader(std::string_view data) : data_{data} {}
+
+  size_t offset() const {
+    return offset_;
+  }
+
+  void need(size_t n) const {
+    if (data_.size() - offset_ < n) {
+      throw std::runtime_error("git index is truncated");
+    }
+  }
+
+  uint16_t u16() {
+    need(2);
+    auto p = reinterpret_cast<const uint8_t*>(data_.data() + offset_);
+    offset_ += 2;
+    return uint16_t((p[0] << 8) | p[1]);
+  }
+
+  uint32_t u32() {
+    need(4);
+    auto p = reinterpret_cast<const uint8_t*>(data_.data() + offset_);
+    offset_ += 4;
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) |
+        (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+  }
+
+  std::string_view bytes(size_t n) {
+    need(n);
+    auto result = data_.substr(offset_, n);
+    offset_ += n;
+    return result;
+  }
+
+  // Returns the bytes up to the next NUL, and skips over the NUL
+  std::string_view cstring() {
+    auto end = data_.find('\0', offset_);
+    if (end == std::string_view::npos) {
+      throw std::runtime_error("git index is truncated");
+    }
+    auto result = data_.substr(offset_, end - offset_);
+    offset_ = end + 1;
+    return result;
+  }
+
+  // The variable length integer of the version 4 path prefix compression
+  size_t varint() {
+    need(1);
+    uint8_t c = data_[offset_++];
+    size_t value = c & 0x7f;
+    while (c & 0x80) {
+      need(1);
+      c = data_[offset_++];
+      value = ((value + 1) << 7) | (c & 0x7f);
+    }
+    return value;
+  }
+
+  void skipTo(size_t offset) {
+    if (offset > data_.size()) {
+      throw std::runtime_error("git index is truncated");
+    }
+    offset_ = offset;
+  }
+
+ private:
+  std::string_view data_;
+  size_t offset_{0};
+};
+
+} // namespace
+
+GitIndex::GitIndex(std::string_view data, struct timespec indexMtime)
+    : indexMtime_{indexMtime} {
+  Reader reader{data};
+  if (reader.bytes(4) != "DIRC") {
+    throw std::runtime_error("not a git index");
+  }
+  auto version = reader.u32();
+  if (version < 2 || version > 4) {
+    throw std::runtime_error(
+        fmt::format("unsupported git index version {}", version));
+  }
+  auto count = reader.u32();
+  entries_.reserve(count);
+
+  std::string name;
+  for (uint32_t i = 0; i < count; ++i) {
+    auto start = reader.offset();
+    Entry entry;
+    reader.u32(); // ctime seconds
+    reader.u32(); // ctime nanoseconds
+    entry.mtime.tv_sec = reader.u32();
+    entry.mtime.tv_nsec = reader.u32();
+    reader.u32(); // dev
+    entry.ino = reader.u32();
+    auto mode = reader.u32();
+    reader.u32(); // uid
+    reader.u32(); // gid
+    entry.size = reader.u32();
+    auto blobId = reader.bytes(entry.blobId.size());
+    std::memcpy(entry.blobId.data(), blobId.data(), blobId.size());
+    auto flags = reader.u16();
+    uint16_t extendedFlags = 0;
+    if (flags & kExtendedFlag) {
+      if (version < 3) {
+        throw std::runtime_error("extended flags in a version 2 git index");
+      }
+      extendedFlags = reader.u16();
+    }
+
+    if (version == 4) {
+      auto strip = reader.varint();
+      if (strip > name.size()) {
+        throw std::runtime_error("malformed path in git index");
+      }
+      name.resize(name.size() - strip);
+      name.append(reader.cstring());
+    } else {
+      auto nameLength = flags & kNameMask;
+      if (nameLength < kNameMask) {
+        name.assign(reader.bytes(nameLength));
+      } else {
+        name.assign(reader.cstring());
+      }
+      // Entries are padded with 1 to 8 NULs to a multiple of 8 bytes
+      auto length = reader.offset() - start;
+      if (nameLength < kNameMask) {
+        length += 1;
+      }
+      reader.skipTo(start + ((length + 7) & ~size_t(7)));
+    }
+
+    auto type = mode & kTypeMask;
+    if ((flags & kStageMask) != 0 ||
+        (extendedFlags & (kSkipWorktreeFlag | kIntentToAddFlag)) ||
+        (type != kTypeRegular && type != kTypeSymlink)) {
+      continue;
+    }
+    entry.isSymlink = type == kTypeSymlink;
+    entries_.insert_or_assign(w_string{name.data(), name.size()}, entry);
+  }
+}
+
+std::optional<GitIndex::BlobId> GitIndex::lookup(
+    w_string_piece path,
+    const FileInformation& info) const {
+  auto it = entries_.find(w_string{path.data(), path.size()});
+  if (it == entries_.end()) {
+    return std::nullopt;
+  }
+  const auto& entry = it->second;
+  if (entry.isSymlink != info.isSymlink() ||
+      (!entry.isSymlink && !info.isFile())) {
+    return std::nullopt;
+  }
+  // Git doesn't record nanoseconds on every platform
+  if (entry.mtime.tv_sec != uint32_t(info.mtime.tv_sec) ||
+      (entry.mtime.tv_nsec != 0 &&
+       entry.mtime.tv_nsec != info.mtime.tv_nsec) ||
+      entry.size != uint32_t(info.size)) {
+    return std::nullopt;
+  }
+  // Some filesystems, and Windows, don't report a stable inode number
+  if (entry.ino != 0 && info.ino != 0 && entry.ino != uint32_t(info.ino)) {
+    return std::nullopt;
+  }
+  // Racily clean: git may have hashed the file just before a change that
+  // left its mtime and size the same
+  if (entry.mtime.tv_sec >= indexMtime_.tv_sec) {
+    return std::nullopt;
+  }
+  return entry.blobId;
+}
+
+} // namespace watchman
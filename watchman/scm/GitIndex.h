@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include "watchman/fs/FileInformation.h"
+#include "watchman/watchman_string.h"
+#include "watchman/watchman_system.h"
+
+namespace watchman {
+
+/**
+ * The tracked files of a git index (.git/index), with the stat data and
+ * blob id that git recorded for each when it last hashed it.  Versions 2, 3
+ * and 4 of the format are understood; only the entries of files at stage 0
+ * that are expected in the working tree are kept.  Immutable once read.
+ */
+class GitIndex {
+ public:
+  using BlobId = std::array<uint8_t, 20>;
+
+  struct Entry {
+    struct timespec mtime;
+    // The low 32 bits of the size and inode number, as git keeps them
+    uint32_t size;
+    uint32_t ino;
+    bool isSymlink;
+    BlobId blobId;
+  };
+
+  /**
+   * Parses the contents of an index file, whose own mtime is indexMtime.
+   * Throws std::runtime_error if it is malformed.
+   */
+  GitIndex(std::string_view data, struct timespec indexMtime);
+
+  /**
+   * Returns the blob id of the file at path, relative to the top of the
+   * working tree, if the index has it and info matches the stat data
+   * recorded with it, so that the file can't have changed since git hashed
+   * it.  An entry that was written in the same second as the index, or
+   * later, may not have caught a change made just after it was hashed, so
+   * is never trusted.
+   */
+  std::optional<BlobId> lookup(
+      w_string_piece path,
+      const FileInformation& info) const;
+
+  size_t size() const {
+    return entries_.size();
+  }
+
+ private:
+  std::unordered_map<w_string, Entry> entries_;
+  struct timespec indexMtime_;
+};
+
+} // namespace watchman
@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/scm/HgCommandServer.h"
+#include <fmt/core.h>
+#include <folly/String.h>
+#include <system_error>
+#include "watchman/Logging.h"
+#include "watchman/fs/Pipe.h"
+#include "watchman/scm/SCM.h"
+
+namespace watchman {
+
+namespace {
+
+// The channels that the server sends messages on; see
+// https://www.mercurial-scm.org/wiki/CommandServer
+constexpr char kOutputChannel = 'o';
+constexpr char kErrorChannel = 'e';
+constexpr char kResultChannel = 'r';
+constexpr char kInputChannel = 'I';
+constexpr char kLineInputChannel = 'L';
+
+void appendBigEndian32(std::string& buf, uint32_t value) {
+  buf.push_back(char((value >> 24) & 0xff));
+  buf.push_back(char((value >> 16) & 0xff));
+  buf.push_back(char((value >> 8) & 0xff));
+  buf.push_back(char(value & 0xff));
+}
+
+uint32_t parseBigEndian32(const char* buf) {
+  auto bytes = reinterpret_cast<const unsigned char*>(buf);
+  return (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) |
+      (uint32_t(bytes[2]) << 8) | uint32_t(bytes[3]);
+}
+
+} // namespace
+
+HgCommandServer::HgCommandServer(
+    std::vector<std::string> serverCommand,
+    std::function<ChildProcess::Options()> makeOptions)
+    : serverCommand_(std::move(serverCommand)),
+      makeOptions_(std::move(makeOptions)) {}
+
+HgCommandServer::~HgCommandServer() {
+  stop();
+}
+
+std::optional<HgCommandServer::Result> HgCommandServer::run(
+    const std::vector<std::string_view>& args,
+    const struct timespec& dirStateMtime) {
+  std::unique_lock<std::mutex> lock{mutex_, std::try_to_lock};
+  if (!lock.owns_lock()) {
+    return std::nullopt;
+  }
+
+  if (proc_ && (dirStateMtime.tv_sec != startedDirStateMtime_.tv_sec ||
+                dirStateMtime.tv_nsec != startedDirStateMtime_.tv_nsec)) {
+    logf(DBG, "dirstate changed; restarting the hg command server\n");
+    stop();
+  }
+  if (!proc_) {
+    start();
+    startedDirStateMtime_ = dirStateMtime;
+  }
+
+  try {
+    return runCommand(args);
+  } catch (const std::exception& exc) {
+    logf(
+        ERR,
+        "hg command server failed running {}: {}; restarting it\n",
+        folly::join(" ", args),
+        exc.what());
+    stop();
+    throw;
+  }
+}
+
+std::string HgCommandServer::encodeRunCommand(
+    const std::vector<std::string_view>& args) {
+  auto joined = folly::join('\0', args);
+  std::string request = "runcommand\n";
+  appendBigEndian32(request, uint32_t(joined.size()));
+  request.append(joined);
+  return request;
+}
+
+void HgCommandServer::start() {
+  std::vector<std::string_view> cmdline;
+  for (auto& arg : serverCommand_) {
+    cmdline.emplace_back(arg);
+  }
+  proc_ = std::make_unique<ChildProcess>(cmdline, makeOptions_());
+
+  try {
+    // The server introduces itself with its capabilities
+    auto [channel, size] = readHeader();
+    if (channel != kOutputChannel) {
+      throw std::runtime_error(
+          fmt::format("unexpected hello on channel '{}'", channel));
+    }
+    auto hello = readData(size);
+    if (hello.find("runcommand") == std::string::npos) {
+      throw std::runtime_error(
+          fmt::format("server doesn't support runcommand: {}", hello));
+    }
+  } catch (const std::exception& exc) {
+    stop();
+    SCMError::throwf("failed to start the hg command server: {}", exc.what());
+  }
+}
+
+void HgCommandServer::stop() {
+  if (!proc_) {
+    return;
+  }
+  // Closing stdin asks the server to exit; kill it in case it doesn't.
+  proc_->pipe(STDIN_FILENO).write.close();
+  proc_->kill();
+  proc_->wait();
+  proc_.reset();
+}
+
+HgCommandServer::Result HgCommandServer::runCommand(
+    const std::vector<std::string_view>& args) {
+  writeAll(encodeRunCommand(args));
+
+  Result result;
+  std::string output;
+  std::string error;
+  while (true) {
+    auto [channel, size] = readHeader();
+    switch (channel) {
+      case kOutputChannel:
+        output.append(readData(size));
+        break;
+      case kErrorChannel:
+        error.append(readData(size));
+        break;
+      case kResultChannel: {
+        auto data = readData(size);
+        if (data.size() != 4) {
+          throw std::runtime_error("malformed result message");
+        }
+        result.status = int(parseBigEndian32(data.data()));
+        result.output = w_string{output.data(), output.size()};
+        result.error = w_string{error.data(), error.size()};
+        return result;
+      }
+      case kInputChannel:
+      case kLineInputChannel: {
+        // We have nothing to say; an empty reply is end of input
+        std::string reply;
+        appendBigEndian32(reply, 0);
+        writeAll(reply);
+        break;
+      }
+      default:
+        if (isupper((unsigned char)channel)) {
+          // The protocol says that unknown required channels are fatal
+          throw std::runtime_error(
+              fmt::format("unsupported required channel '{}'", channel));
+        }
+        // Others, such as debug output, can be skipped
+        readData(size);
+        break;
+    }
+  }
+}
+
+std::pair<char, uint32_t> HgCommandServer::readHeader() {
+  char header[5];
+  readExactly(header, sizeof(header));
+  return {header[0], parseBigEndian32(header + 1)};
+}
+
+std::string HgCommandServer::readData(uint32_t size) {
+  std::string data;
+  data.resize(size);
+  readExactly(data.data(), size);
+  return data;
+}
+
+void HgCommandServer::readExactly(char* buf, size_t size) {
+  // The pipes that ChildProcess sets up are blocking
+  auto& fd = proc_->pipe(STDOUT_FILENO).read;
+  while (size > 0) {
+    auto res = fd.read(buf, int(std::min<size_t>(size, 1 << 20)));
+    if (res.hasError()) {
+      if (res.error() == std::errc::interrupted) {
+        continue;
+      }
+      throw std::system_error(res.error(), "reading from hg command server");
+    }
+    if (res.value() == 0) {
+      throw std::runtime_error("hg command server exited");
+    }
+    buf += res.value();
+    size -= res.value();
+  }
+}
+
+void HgCommandServer::writeAll(std::string_view data) {
+  auto& fd = proc_->pipe(STDIN_FILENO).write;
+  while (!data.empty()) {
+    auto res =
+        fd.write(data.data(), int(std::min<size_t>(data.size(), 1 << 20)));
+    if (res.hasError()) {
+      if (res.error() == std::errc::interrupted) {
+        continue;
+      }
+      throw std::system_error(res.error(), "writing to hg command server");
+    }
+    data.remove_prefix(size_t(res.value()));
+  }
+}
+
+} // namespace watchman
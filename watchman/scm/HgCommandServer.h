@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "watchman/ChildProcess.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * A long-lived `hg serve --cmdserver pipe` child that runs hg commands, so
+ * that each command doesn't pay for starting a new Python interpreter.
+ *
+ * The server runs one command at a time.  Rather than queueing behind a
+ * slow command, run() returns nullopt when the server is busy and the
+ * caller runs a fresh hg instead.
+ *
+ * The server is started on first use and restarted if it fails, if it
+ * breaks the protocol, or if the dirstate has changed since it started,
+ * so that it never answers from a stale view of the repository.
+ */
+class HgCommandServer {
+ public:
+  struct Result {
+    // The command's exit status
+    int status{0};
+    w_string output;
+    w_string error;
+  };
+
+  // serverCommand is the command line that starts the server, and
+  // makeOptions returns the options to start it with; they must pipe stdin
+  // and stdout.
+  HgCommandServer(
+      std::vector<std::string> serverCommand,
+      std::function<ChildProcess::Options()> makeOptions);
+  ~HgCommandServer();
+
+  HgCommandServer(const HgCommandServer&) = delete;
+  HgCommandServer& operator=(const HgCommandServer&) = delete;
+
+  // Runs hg with args, which don't include the hg executable itself.
+  // dirStateMtime identifies the state of the repository.  Returns nullopt
+  // if the server is busy, and throws if it can't be started or fails.
+  std::optional<Result> run(
+      const std::vector<std::string_view>& args,
+      const struct timespec& dirStateMtime);
+
+  // Encodes a runcommand request for args.  Public for testing.
+  static std::string encodeRunCommand(
+      const std::vector<std::string_view>& args);
+
+ private:
+  void start();
+  void stop();
+  Result runCommand(const std::vector<std::string_view>& args);
+
+  // Reads the header of the next message from the server.
+  std::pair<char, uint32_t> readHeader();
+  void readExactly(char* buf, size_t size);
+  std::string readData(uint32_t size);
+  void writeAll(std::string_view data);
+
+  const std::vector<std::string> serverCommand_;
+  const std::function<ChildProcess::Options()> makeOptions_;
+
+  std::mutex mutex_;
+  std::unique_ptr<ChildProcess> proc_;
+  struct timespec startedDirStateMtime_ {};
+};
+
+} // namespace watchman
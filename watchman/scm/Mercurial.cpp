@@ -7,6 +7,7 @@
 
 #include "Mercurial.h"
 #include <fmt/core.h>
+#include <folly/FileUtil.h>
 #include <folly/String.h>
 #include <chrono>
 #include <cmath>
@@ -14,6 +15,7 @@
 #include "watchman/ChildProcess.h"
 #include "watchman/CommandRegistry.h"
 #include "watchman/Logging.h"
+#include "watchman/PerfSample.h"
 #include "watchman/fs/FileSystem.h"
 #include "watchman/sockname.h"
 
@@ -29,6 +31,13 @@ void replaceEmbeddedNulls(std::string& str) {
   std::replace(str.begin(), str.end(), '\0', '\n');
 }
 
+bool isNodeId(std::string_view text) {
+  return text.size() == 40 &&
+      std::all_of(text.begin(), text.end(), [](char c) {
+           return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+         });
+}
+
 std::string hgExecutablePath() {
   auto hg = getenv("EDEN_HG_BINARY");
   if (hg && strlen(hg) > 0) {
@@ -37,6 +46,23 @@ std::string hgExecutablePath() {
   return "hg";
 }
 
+[[noreturn]] void throwCommandFailed(
+    const std::vector<std::string_view>& cmdline,
+    std::string_view description,
+    std::string_view stdoutView,
+    std::string_view stderrView) {
+  auto output = std::string{stdoutView};
+  auto error = std::string{stderrView};
+  replaceEmbeddedNulls(output);
+  replaceEmbeddedNulls(error);
+  SCMError::throwf(
+      "failed to {}\ncmd = {}\nstdout = {}\nstderr = {}",
+      description,
+      folly::join(" ", cmdline),
+      output,
+      error);
+}
+
 struct MercurialResult {
   w_string output;
 };
@@ -45,22 +71,24 @@ MercurialResult runMercurial(
     std::vector<std::string_view> cmdline,
     ChildProcess::Options options,
     std::string_view description) {
+  PerfSample sample("spawn");
   ChildProcess proc{cmdline, std::move(options)};
+  if (sample.finish()) {
+    sample.add_meta(
+        "spawn",
+        json_object(
+            {{"command", typed_string_to_json(cmdline[0])},
+             {"description", typed_string_to_json(description)}}));
+    sample.log();
+  }
   auto outputs = proc.communicate();
   auto status = proc.wait();
   if (status) {
-    auto output =
-        std::string{outputs.first ? outputs.first->view() : std::string_view{}};
-    auto error = std::string{
-        outputs.second ? outputs.second->view() : std::string_view{}};
-    replaceEmbeddedNulls(output);
-    replaceEmbeddedNulls(error);
-    SCMError::throwf(
-        "failed to {}\ncmd = {}\nstdout = {}\nstderr = {}",
+    throwCommandFailed(
+        cmdline,
         description,
-        folly::join(" ", cmdline),
-        output,
-        error);
+        outputs.first ? outputs.first->view() : std::string_view{},
+        outputs.second ? outputs.second->view() : std::string_view{});
   }
 
   if (outputs.first) {
@@ -74,9 +102,9 @@ MercurialResult runMercurial(
 
 namespace watchman {
 
-ChildProcess::Options Mercurial::makeHgOptions(
+void Mercurial::setHgEnvironment(
+    ChildProcess::Options& opt,
     const std::optional<w_string>& requestId) const {
-  ChildProcess::Options opt;
   // Ensure that the hgrc doesn't mess with the behavior
   // of the commands that we're runing.
   opt.environment().set("HGPLAIN", w_string("1"));
@@ -115,7 +143,12 @@ ChildProcess::Options Mercurial::makeHgOptions(
   // Ensure that mercurial uses this path to communicate with us,
   // rather than whatever is hardcoded in its config.
   opt.environment().set("WATCHMAN_SOCK", get_sock_name_legacy());
+}
 
+ChildProcess::Options Mercurial::makeHgOptions(
+    const std::optional<w_string>& requestId) const {
+  ChildProcess::Options opt;
+  setHgEnvironment(opt, requestId);
   opt.nullStdin();
   opt.pipeStdout();
   opt.pipeStderr();
@@ -124,16 +157,73 @@ ChildProcess::Options Mercurial::makeHgOptions(
   return opt;
 }
 
+ChildProcess::Options Mercurial::makeCommandServerOptions() const {
+  ChildProcess::Options opt;
+  setHgEnvironment(opt, std::nullopt);
+  opt.pipeStdin();
+  opt.pipeStdout();
+  // The commands' stderr arrives on the 'e' channel; this is only the
+  // server's own, which nobody reads.
+#ifndef _WIN32
+  opt.open(STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+#endif
+  opt.chdir(getRootPath());
+
+  return opt;
+}
+
+w_string Mercurial::runHg(
+    std::vector<std::string_view> args,
+    const std::optional<w_string>& requestId,
+    std::string_view description) const {
+  auto hg = hgExecutablePath();
+
+  // The request id is passed to hg in its environment, which is fixed for
+  // the lifetime of the server, so requests that carry one use a fresh hg.
+  if (commandServer_ && !(requestId && !requestId->empty())) {
+    std::optional<HgCommandServer::Result> result;
+    try {
+      result = commandServer_->run(args, getDirStateMtime());
+    } catch (const std::exception& exc) {
+      logf(
+          ERR,
+          "hg command server is unavailable, running hg instead: {}\n",
+          exc.what());
+    }
+    if (result) {
+      if (result->status) {
+        std::vector<std::string_view> cmdline{hg};
+        cmdline.insert(cmdline.end(), args.begin(), args.end());
+        throwCommandFailed(
+            cmdline, description, result->output.view(), result->error.view());
+      }
+      return result->output;
+    }
+  }
+
+  args.insert(args.begin(), hg);
+  return runMercurial(std::move(args), makeHgOptions(requestId), description)
+      .output;
+}
+
 Mercurial::Mercurial(w_string_piece rootPath, w_string_piece scmRoot)
     : SCM(rootPath, scmRoot),
       dirStatePath_(fmt::format("{}/.hg/dirstate", getSCMRoot())),
       commitsPrior_(Configuration(), "scm_hg_commits_prior", 32, 10),
-      mergeBases_(Configuration(), "scm_hg_mergebase", 32, 10),
       filesChangedSinceMergeBaseWith_(
           Configuration(),
           "scm_hg_files_since_mergebase",
           32,
-          10) {}
+          10) {
+#ifndef _WIN32
+  if (cfg_get_bool("scm_hg_command_server", false)) {
+    commandServer_ = std::make_unique<HgCommandServer>(
+        std::vector<std::string>{
+            hgExecutablePath(), "serve", "--cmdserver", "pipe"},
+        [this] { return makeCommandServerOptions(); });
+  }
+#endif
+}
 
 struct timespec Mercurial::getDirStateMtime() const {
   try {
@@ -151,39 +241,78 @@ struct timespec Mercurial::getDirStateMtime() const {
   }
 }
 
+std::optional<std::string> Mercurial::getWorkingCopyParent() const {
+  // Both dirstate formats begin with the binary node ids of the parents;
+  // v2 puts them after a marker line.
+  constexpr std::string_view kV2Marker = "dirstate-v2\n";
+  constexpr size_t kNodeLen = 20;
+  std::string header;
+  if (!folly::readFile(
+          dirStatePath_.c_str(), header, kV2Marker.size() + kNodeLen)) {
+    return std::nullopt;
+  }
+  std::string_view node{header};
+  if (node.substr(0, kV2Marker.size()) == kV2Marker) {
+    node.remove_prefix(kV2Marker.size());
+  }
+  if (node.size() < kNodeLen) {
+    return std::nullopt;
+  }
+  node = node.substr(0, kNodeLen);
+  if (std::all_of(node.begin(), node.end(), [](char c) { return c == 0; })) {
+    // The null revision, as in a fresh repository
+    return std::nullopt;
+  }
+  std::string hex;
+  hex.reserve(kNodeLen * 2);
+  for (auto c : node) {
+    hex.append(fmt::format("{:02x}", (unsigned char)c));
+  }
+  return hex;
+}
+
 w_string Mercurial::mergeBaseWith(
     w_string_piece commitId,
     const std::optional<w_string>& requestId) const {
-  auto mtime = getDirStateMtime();
-  auto key = fmt::format("{}:{}:{}", commitId, mtime.tv_sec, mtime.tv_nsec);
   auto commit = std::string{commitId.view()};
 
-  return mergeBases_
-      .get(
-          key,
-          [this, commit, requestId](const std::string&) {
-            auto revset = fmt::format("ancestor(.,{})", commit);
-            auto result = runMercurial(
-                {hgExecutablePath(), "log", "-T", "{node}", "-r", revset},
-                makeHgOptions(requestId),
-                "query for the merge base");
-
-            if (result.output.empty()) {
-              SCMError::throwf(
-                  "no output was returned from `hg log -T{{node}} -r {}",
-                  revset);
-            }
-
-            if (result.output.size() != 40) {
-              SCMError::throwf(
-                  "expected merge base to be a 40 character string, got {}",
-                  result.output.view());
-            }
-
-            return folly::makeFuture(result.output);
-          })
-      .get()
-      ->value();
+  // A merge base between two node ids never changes, so when commitId is
+  // one the cache entry only needs to change when the working copy moves
+  // to another commit, rather than whenever the dirstate is written.  Ask
+  // hg about the parent we read so that the result matches the key.
+  std::string key;
+  std::string parent = ".";
+  auto workingCopyParent =
+      isNodeId(commit) ? getWorkingCopyParent() : std::nullopt;
+  if (workingCopyParent) {
+    key = fmt::format("{}:{}:{}", getSCMRoot(), commit, *workingCopyParent);
+    parent = *workingCopyParent;
+  } else {
+    auto mtime = getDirStateMtime();
+    key = fmt::format(
+        "{}:{}:{}:{}", getSCMRoot(), commitId, mtime.tv_sec, mtime.tv_nsec);
+  }
+
+  return cachedMergeBase(key, [this, commit, parent, requestId] {
+    auto revset = fmt::format("ancestor({},{})", parent, commit);
+    auto output = runHg(
+        {"log", "-T", "{node}", "-r", revset},
+        requestId,
+        "query for the merge base");
+
+    if (output.empty()) {
+      SCMError::throwf(
+          "no output was returned from `hg log -T{{node}} -r {}", revset);
+    }
+
+    if (output.size() != 40) {
+      SCMError::throwf(
+          "expected merge base to be a 40 character string, got {}",
+          output.view());
+    }
+
+    return output;
+  });
 }
 
 std::vector<w_string> Mercurial::getFilesChangedSinceMergeBaseWith(
@@ -203,9 +332,8 @@ std::vector<w_string> Mercurial::getFilesChangedSinceMergeBaseWith(
           key,
           [this, commit = std::move(commitCopy), requestId](
               const std::string&) {
-            auto result = runMercurial(
-                {hgExecutablePath(),
-                 "--traceback",
+            auto output = runHg(
+                {"--traceback",
                  "status",
                  "-n",
                  "--rev",
@@ -213,11 +341,11 @@ std::vector<w_string> Mercurial::getFilesChangedSinceMergeBaseWith(
                  // The "" argument at the end causes paths to be printed out
                  // relative to the cwd (set to root path above).
                  ""},
-                makeHgOptions(requestId),
+                requestId,
                 "query for files changed since merge base");
 
             std::vector<w_string> lines;
-            result.output.piece().split(lines, '\n');
+            output.piece().split(lines, '\n');
             return folly::makeFuture(lines);
           })
       .get()
@@ -227,17 +355,11 @@ std::vector<w_string> Mercurial::getFilesChangedSinceMergeBaseWith(
 time_point<system_clock> Mercurial::getCommitDate(
     w_string_piece commitId,
     const std::optional<w_string>& requestId) const {
-  auto result = runMercurial(
-      {hgExecutablePath(),
-       "--traceback",
-       "log",
-       "-r",
-       commitId.data(),
-       "-T",
-       "{date}\n"},
-      makeHgOptions(requestId),
+  auto output = runHg(
+      {"--traceback", "log", "-r", commitId.view(), "-T", "{date}\n"},
+      requestId,
       "get commit date");
-  return Mercurial::convertCommitDate(result.output.c_str());
+  return Mercurial::convertCommitDate(output.c_str());
 }
 
 time_point<system_clock> Mercurial::convertCommitDate(const char* commitDate) {
@@ -265,19 +387,13 @@ std::vector<w_string> Mercurial::getCommitsPriorToAndIncluding(
               const std::string&) {
             auto revset = fmt::format(
                 "reverse(last(_firstancestors({}), {}))\n", commit, numCommits);
-            auto result = runMercurial(
-                {hgExecutablePath(),
-                 "--traceback",
-                 "log",
-                 "-r",
-                 revset,
-                 "-T",
-                 "{node}\n"},
-                makeHgOptions(requestId),
+            auto output = runHg(
+                {"--traceback", "log", "-r", revset, "-T", "{node}\n"},
+                requestId,
                 "get prior commits");
 
             std::vector<w_string> lines;
-            w_string_piece(result.output).split(lines, '\n');
+            w_string_piece(output).split(lines, '\n');
             return folly::makeFuture(lines);
           })
       .get()
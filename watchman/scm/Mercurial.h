@@ -8,9 +8,11 @@
 #pragma once
 #include "watchman/watchman_system.h"
 
+#include <memory>
 #include <string>
 #include "watchman/ChildProcess.h"
 #include "watchman/LRUCache.h"
+#include "watchman/scm/HgCommandServer.h"
 #include "watchman/scm/SCM.h"
 
 namespace watchman {
@@ -39,14 +41,31 @@ class Mercurial : public SCM {
  private:
   std::string dirStatePath_;
   mutable LRUCache<std::string, std::vector<w_string>> commitsPrior_;
-  mutable LRUCache<std::string, w_string> mergeBases_;
   mutable LRUCache<std::string, std::vector<w_string>>
       filesChangedSinceMergeBaseWith_;
 
+  // Used in place of a fresh hg for each command when
+  // scm_hg_command_server is enabled
+  mutable std::unique_ptr<HgCommandServer> commandServer_;
+
   // Returns options for invoking hg
   ChildProcess::Options makeHgOptions(
       const std::optional<w_string>& requestId) const;
+  // Returns options for starting the command server
+  ChildProcess::Options makeCommandServerOptions() const;
+  void setHgEnvironment(
+      ChildProcess::Options& opt,
+      const std::optional<w_string>& requestId) const;
+  // Runs hg with args, through the command server when possible, and
+  // returns its output.  Throws SCMError if the command fails.
+  w_string runHg(
+      std::vector<std::string_view> args,
+      const std::optional<w_string>& requestId,
+      std::string_view description) const;
   struct timespec getDirStateMtime() const;
+  // Returns the node id of the working copy's first parent, read from the
+  // dirstate, or nullopt if it can't be read.
+  std::optional<std::string> getWorkingCopyParent() const;
 };
 
 } // namespace watchman
@@ -22,6 +22,33 @@ SCM::~SCM() {}
 SCM::SCM(w_string_piece rootPath, w_string_piece scmRoot)
     : rootPath_(rootPath.asWString()), scmRoot_(scmRoot.asWString()) {}
 
+namespace {
+LRUCache<std::string, w_string>& mergeBaseCache() {
+  static LRUCache<std::string, w_string> cache(
+      Configuration(), "scm_mergebase", 256, 10);
+  return cache;
+}
+} // namespace
+
+w_string SCM::cachedMergeBase(
+    const std::string& key,
+    std::function<w_string()> compute) {
+  return mergeBaseCache()
+      .get(
+          key,
+          [compute = std::move(compute)](const std::string&) {
+            // makeFutureWith turns an exception into an errored entry, so
+            // that it is cached for the error TTL like any other result.
+            return folly::makeFutureWith(compute);
+          })
+      .get()
+      ->value();
+}
+
+CacheStats SCM::getMergeBaseCacheStats() {
+  return mergeBaseCache().stats();
+}
+
 const w_string& SCM::getRootPath() const {
   return rootPath_;
 }
@@ -8,9 +8,12 @@
 #pragma once
 
 #include <chrono>
+#include <functional>
 #include <optional>
+#include <string>
 #include <vector>
 #include "watchman/Errors.h"
+#include "watchman/LRUCache.h"
 #include "watchman/watchman_string.h"
 #include "watchman/watchman_system.h"
 
@@ -37,6 +40,16 @@ class SCM {
   // rootPath may be a child directory of the true SCM root.
   SCM(w_string_piece rootPath, w_string_piece scmRoot);
 
+  // Returns the merge base cached for key, calling compute to produce it
+  // if there is none.  The cache is shared by all SCM instances, so that
+  // the roots of one repository and the queries and subscriptions on them
+  // share the result, and concurrent lookups of a key wait for a single
+  // computation.  key must include the SCM root and whatever identifies
+  // the revisions involved.
+  static w_string cachedMergeBase(
+      const std::string& key,
+      std::function<w_string()> compute);
+
  public:
   virtual ~SCM();
 
@@ -48,6 +61,9 @@ class SCM {
   // in setting up the SCM instance.
   static std::unique_ptr<SCM> scmForPath(w_string_piece rootPath);
 
+  // Returns the statistics of the shared merge base cache
+  static CacheStats getMergeBaseCacheStats();
+
   // Returns the root path provided during construction
   const w_string& getRootPath() const;
 
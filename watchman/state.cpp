@@ -8,13 +8,22 @@
 #include "watchman/state.h"
 #include <folly/String.h>
 #include <folly/Synchronized.h>
+#include <folly/executors/InlineExecutor.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <string_view>
 #include "watchman/Errors.h"
 #include "watchman/Logging.h"
 #include "watchman/Options.h"
 #include "watchman/PDU.h"
+#include "watchman/PerfSample.h"
 #include "watchman/QueryableView.h"
 #include "watchman/Shutdown.h"
+#include "watchman/StateLog.h"
 #include "watchman/TriggerCommand.h"
+#include "watchman/ViewSnapshot.h"
+#include "watchman/WatchmanConfig.h"
 #include "watchman/root/Root.h"
 #include "watchman/root/resolve.h"
 #include "watchman/root/watchlist.h"
@@ -40,6 +49,8 @@ struct state {
 folly::Synchronized<state, std::mutex> saveState;
 std::condition_variable stateCond;
 std::thread state_saver_thread;
+// Only used by the state saver thread
+std::unique_ptr<StateLog> stateLog;
 } // namespace
 
 static bool do_state_save();
@@ -81,9 +92,14 @@ bool w_state_load() {
 
   state_saver_thread = std::thread(state_saver);
 
+  // Logged once every restored root has crawled and settled; see
+  // w_root_load_state
+  auto sample = std::make_unique<PerfSample>("startup");
+  auto loadStart = std::chrono::steady_clock::now();
+
   std::optional<json_ref> state;
   try {
-    state = json_load_file(flags.watchman_state_file.c_str(), 0);
+    state = StateLog::load(flags.watchman_state_file);
   } catch (const std::system_error& exc) {
     if (exc.code() == watchman::error_code::no_such_file_or_directory) {
       // No need to alarm anyone if we've never written a state file
@@ -91,31 +107,35 @@ bool w_state_load() {
     }
     logf(
         ERR,
-        "failed to load json from {}: {}\n",
+        "failed to load state from {}: {}\n",
         flags.watchman_state_file,
         folly::exceptionStr(exc).toStdString());
     return false;
   } catch (const std::exception& exc) {
     logf(
         ERR,
-        "failed to parse json from {}: {}\n",
+        "failed to parse state from {}: {}\n",
         flags.watchman_state_file,
         folly::exceptionStr(exc).toStdString());
     return false;
   }
 
-  if (!w_root_load_state(state.value())) {
+  sample->add_meta(
+      "state_load_ms",
+      json_integer(std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - loadStart)
+                       .count()));
+
+  if (!w_root_load_state(state.value(), std::move(sample))) {
     return false;
   }
 
   return true;
 }
 
-static bool do_state_save() {
+static bool do_state_save_json(const json_ref& state) {
   PduBuffer buffer;
 
-  auto state = json_object();
-
   auto file = w_stm_open(
       flags.watchman_state_file.c_str(), O_WRONLY | O_TRUNC | O_CREAT, 0600);
   if (!file) {
@@ -128,6 +148,12 @@ static bool do_state_save() {
     return false;
   }
 
+  buffer.jsonEncodeToStream(state, file.get(), JSON_INDENT(4));
+  return true;
+}
+
+static bool do_state_save() {
+  auto state = json_object();
   state.set("version", typed_string_to_json(PACKAGE_VERSION, W_STRING_UNICODE));
 
   /* now ask the different subsystems to fill out the state */
@@ -135,9 +161,23 @@ static bool do_state_save() {
     return false;
   }
 
-  /* we've prepared what we're going to save, so write it out */
-  buffer.jsonEncodeToStream(state, file.get(), JSON_INDENT(4));
-  return true;
+  if (std::string_view{cfg_get_string("state_file_format", "bser")} ==
+      "json") {
+    // Whatever is written next has to be a full log
+    stateLog.reset();
+    return do_state_save_json(state);
+  }
+
+  if (!stateLog) {
+    stateLog = std::make_unique<StateLog>(flags.watchman_state_file);
+  }
+  std::map<w_string, json_ref> records;
+  auto watched = state.get("watched");
+  for (size_t i = 0; i < json_array_size(watched); ++i) {
+    const auto& obj = watched.at(i);
+    records.emplace(json_to_w_string(obj.get("path")), obj);
+  }
+  return stateLog->save(records);
 }
 
 /** Arranges for the state to be saved.
@@ -170,6 +210,15 @@ bool w_root_save_state(json_ref& state) {
       auto triggers = root->triggerListToJson();
       json_object_set_new(obj, "triggers", std::move(triggers));
 
+      // So that whoever reads the state knows which snapshot to warm the
+      // root's view from
+      if (root->config.getBool("view_snapshot", false)) {
+        auto snapshot = ViewSnapshot::pathForRoot(root->root_path);
+        if (!snapshot.empty()) {
+          obj.set("view_snapshot", w_string_to_json(snapshot));
+        }
+      }
+
       watched_dirs.push_back(std::move(obj));
     }
   }
@@ -179,79 +228,238 @@ bool w_root_save_state(json_ref& state) {
   return result;
 }
 
-bool w_root_load_state(const json_ref& state) {
-  size_t i;
+namespace {
 
-  auto watched = state.get_optional("watched");
-  if (!watched) {
-    return true;
-  }
+/**
+ * Re-creates the watch and triggers described by obj, an element of the
+ * "watched" array of the state file.  Returns the root if this created it.
+ */
+std::shared_ptr<Root> restoreRoot(const json_ref& obj) {
+  bool created = false;
+  size_t j;
 
-  if (!watched->isArray()) {
-    return false;
+  auto triggers = obj.get("triggers");
+  auto path = json_object_get(obj, "path");
+  const char* filename = path ? json_string_value(*path) : nullptr;
+
+  std::shared_ptr<Root> root;
+  try {
+    root = root_resolve(filename, true, &created);
+  } catch (const std::exception&) {
+    return nullptr;
   }
 
-  for (i = 0; i < json_array_size(*watched); i++) {
-    const auto& obj = watched->at(i);
-    bool created = false;
-    size_t j;
+  {
+    auto wlock = root->triggers.wlock();
+    auto& map = *wlock;
+
+    /* re-create the trigger configuration */
+    for (j = 0; j < json_array_size(triggers); j++) {
+      const auto& tobj = triggers.at(j);
 
-    auto triggers = obj.get("triggers");
-    auto path = json_object_get(obj, "path");
-    const char* filename = path ? json_string_value(*path) : nullptr;
+      // Legacy rules format
+      auto rarray = tobj.get_optional("rules");
+      if (rarray) {
+        continue;
+      }
 
-    std::shared_ptr<Root> root;
-    try {
-      root = root_resolve(filename, true, &created);
-    } catch (const std::exception&) {
-      continue;
+      try {
+        auto cmd = std::make_unique<TriggerCommand>(getInterface, root, tobj);
+        cmd->start(root);
+        auto& mapEntry = map[cmd->triggername];
+        mapEntry = std::move(cmd);
+      } catch (const std::exception& exc) {
+        watchman::log(
+            watchman::ERR,
+            "loading trigger for ",
+            root->root_path,
+            ": ",
+            exc.what(),
+            "\n");
+      }
     }
+  }
 
-    {
-      auto wlock = root->triggers.wlock();
-      auto& map = *wlock;
+  if (!created) {
+    return nullptr;
+  }
 
-      /* re-create the trigger configuration */
-      for (j = 0; j < json_array_size(triggers); j++) {
-        const auto& tobj = triggers.at(j);
+  try {
+    root->view()->startThreads(root);
+  } catch (const std::exception& e) {
+    watchman::log(
+        watchman::ERR,
+        "root_start(",
+        root->root_path,
+        ") failed: ",
+        e.what(),
+        "\n");
+    root->cancel();
+    return nullptr;
+  }
+  return root;
+}
 
-        // Legacy rules format
-        auto rarray = tobj.get_optional("rules");
-        if (rarray) {
-          continue;
-        }
+struct RestoredRoot {
+  std::weak_ptr<Root> root;
+  std::chrono::milliseconds watcherInit;
+  // Ready once the root has settled; writes settleMs first
+  folly::Future<folly::Unit> settled;
+  // Milliseconds from the start of the restore until the root first
+  // settled, or -1 if it hasn't
+  std::shared_ptr<std::atomic<int64_t>> settleMs;
+};
 
-        try {
-          auto cmd = std::make_unique<TriggerCommand>(getInterface, root, tobj);
-          cmd->start(root);
-          auto& mapEntry = map[cmd->triggername];
-          mapEntry = std::move(cmd);
-        } catch (const std::exception& exc) {
-          watchman::log(
-              watchman::ERR,
-              "loading trigger for ",
-              root->root_path,
-              ": ",
-              exc.what(),
-              "\n");
-        }
+/**
+ * Waits for each restored root to settle for the first time, then logs the
+ * startup sample with the time each took to crawl and settle.  Holds only
+ * weak references, so that a root can be reaped or cancelled meanwhile.
+ */
+void logStartupSample(
+    std::unique_ptr<PerfSample> sample,
+    std::vector<RestoredRoot> restored) noexcept {
+  w_set_thread_name("startupperf");
+
+  using namespace std::chrono;
+  // Don't keep waiting on a tree that never stops changing
+  auto deadline = steady_clock::now() + minutes{10};
+
+  std::vector<json_ref> roots;
+  int64_t maxCrawlMs = 0;
+  int64_t maxSettleMs = 0;
+  for (auto& r : restored) {
+    auto timeout = duration_cast<milliseconds>(deadline - steady_clock::now());
+    if (timeout.count() > 0) {
+      try {
+        std::move(r.settled).get(timeout);
+      } catch (const std::exception&) {
+        // Timed out, or the root went away before it settled
       }
     }
+    auto settleMs = r.settleMs->load(std::memory_order_acquire);
+    bool settled = settleMs >= 0;
 
-    if (created) {
-      try {
-        root->view()->startThreads(root);
-      } catch (const std::exception& e) {
-        watchman::log(
-            watchman::ERR,
-            "root_start(",
-            root->root_path,
-            ") failed: ",
-            e.what(),
-            "\n");
-        root->cancel();
+    auto root = r.root.lock();
+    if (!root) {
+      continue;
+    }
+    auto obj = json_object(
+        {{"path", w_string_to_json(root->root_path)},
+         {"watcher_init_ms", json_integer(r.watcherInit.count())},
+         {"settled", json_boolean(settled)}});
+    {
+      auto info = root->recrawlInfo.rlock();
+      if (info->crawlFinish > info->crawlStart) {
+        auto crawlMs =
+            duration_cast<milliseconds>(info->crawlFinish - info->crawlStart)
+                .count();
+        obj.set("crawl_ms", json_integer(crawlMs));
+        maxCrawlMs = std::max(maxCrawlMs, crawlMs);
       }
     }
+    if (settled) {
+      obj.set("first_settle_ms", json_integer(settleMs));
+      maxSettleMs = std::max(maxSettleMs, settleMs);
+    }
+    roots.push_back(std::move(obj));
+  }
+
+  sample->add_meta("max_crawl_ms", json_integer(maxCrawlMs));
+  sample->add_meta("max_first_settle_ms", json_integer(maxSettleMs));
+  sample->add_meta("roots", json_array(std::move(roots)));
+  sample->finish();
+  // Once per process, so it is always worth having
+  sample->force_log();
+  sample->log();
+}
+
+} // namespace
+
+bool w_root_load_state(
+    const json_ref& state,
+    std::unique_ptr<PerfSample> sample) {
+  auto watched = state.get_optional("watched");
+  if (!watched) {
+    return true;
+  }
+
+  if (!watched->isArray()) {
+    return false;
+  }
+
+  // Creating a watcher can take a while, for instance when it has to talk
+  // to EdenFS, and the daemon doesn't serve clients until every root has
+  // been restored.  The crawls themselves already happen on each root's own
+  // IO thread.
+  size_t numRoots = json_array_size(*watched);
+  size_t concurrency = std::min(
+      numRoots,
+      size_t(std::max<json_int_t>(
+          cfg_get_int("state_load_concurrency", 8), 1)));
+
+  auto restoreStart = std::chrono::steady_clock::now();
+  std::atomic<size_t> nextRoot{0};
+  folly::Synchronized<std::vector<RestoredRoot>, std::mutex> restored;
+
+  auto restoreRoots = [&] {
+    while (true) {
+      auto i = nextRoot.fetch_add(1, std::memory_order_relaxed);
+      if (i >= numRoots) {
+        return;
+      }
+      auto start = std::chrono::steady_clock::now();
+      auto root = restoreRoot(watched->at(i));
+      if (!root) {
+        continue;
+      }
+      auto watcherInit = std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - start);
+      auto settleMs = std::make_shared<std::atomic<int64_t>>(-1);
+      // Runs on the root's IO thread, at the moment that it settles
+      auto settled =
+          root->waitForSettle(root->trigger_settle)
+              .via(&folly::InlineExecutor::instance())
+              .thenValue([settleMs, restoreStart](folly::Unit) {
+                settleMs->store(
+                    std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now() - restoreStart)
+                        .count(),
+                    std::memory_order_release);
+              });
+      restored.lock()->push_back(RestoredRoot{
+          root, watcherInit, std::move(settled), std::move(settleMs)});
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < concurrency; ++i) {
+    threads.emplace_back([&, i]() noexcept {
+      w_set_thread_name("staterestore ", i);
+      restoreRoots();
+    });
+  }
+  restoreRoots();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  auto restoreMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - restoreStart);
+  logf(
+      DBG,
+      "restored {} roots in {}ms using {} threads\n",
+      numRoots,
+      restoreMs.count(),
+      std::max<size_t>(concurrency, 1));
+
+  if (sample) {
+    sample->add_meta("restore_ms", json_integer(restoreMs.count()));
+    sample->add_meta("restore_concurrency", json_integer(concurrency));
+    std::thread(
+        logStartupSample,
+        std::move(sample),
+        std::move(*restored.lock()))
+        .detach();
   }
 
   return true;
@@ -7,11 +7,22 @@
 
 #pragma once
 
+#include <memory>
 #include "watchman/thirdparty/jansson/jansson.h"
 
+namespace watchman {
+class PerfSample;
+}
+
 void w_state_shutdown();
 void w_state_save();
 bool w_state_load();
 
 bool w_root_save_state(json_ref& state);
-bool w_root_load_state(const json_ref& state);
+/**
+ * Restores the watches recorded in state.  If sample is set, it is logged
+ * once the restored roots have crawled and settled.
+ */
+bool w_root_load_state(
+    const json_ref& state,
+    std::unique_ptr<watchman::PerfSample> sample = nullptr);
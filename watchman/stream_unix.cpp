@@ -7,7 +7,9 @@
 
 #include <folly/SocketAddress.h>
 #include <folly/net/NetworkSocket.h>
+#include <cstring>
 #include <memory>
+#include <optional>
 #include "watchman/Constants.h"
 #include "watchman/Logging.h"
 #include "watchman/fs/FileDescriptor.h"
@@ -119,6 +121,8 @@ class UnixStream : public watchman_stream {
 #endif
   bool credvalid{false};
   bool blocking_{false};
+  // Sent along with the next write
+  std::optional<FileDescriptor> attached_;
 
   explicit UnixStream(FileDescriptor&& descriptor)
       : fd(std::move(descriptor)), evt(fd.system_handle()) {
@@ -190,7 +194,7 @@ class UnixStream : public watchman_stream {
         if (pfd.revents & (POLLERR | POLLHUP)) {
           break;
         }
-        auto x = fd.write(buf, size);
+        auto x = writeSome(buf, size);
         if (x.hasError()) {
 #ifdef _WIN32
           errno = map_win32_err(x.error().value());
@@ -211,7 +215,7 @@ class UnixStream : public watchman_stream {
       }
       return wrote == 0 ? -1 : wrote;
     }
-    auto x = fd.write(buf, size);
+    auto x = writeSome(buf, size);
     if (x.hasError()) {
 #ifdef _WIN32
       errno = map_win32_err(x.error().value());
@@ -224,6 +228,57 @@ class UnixStream : public watchman_stream {
     return x.value();
   }
 
+  bool attachDescriptor(FileDescriptor&& descriptor) override {
+#ifdef SCM_RIGHTS
+    attached_ = std::move(descriptor);
+    return true;
+#else
+    (void)descriptor;
+    return false;
+#endif
+  }
+
+  // Writes some of buf, along with the attached descriptor if there is one
+  Result<int, std::error_code> writeSome(const void* buf, int size) {
+#ifdef SCM_RIGHTS
+    if (attached_ && size > 0) {
+      struct iovec iov;
+      iov.iov_base = const_cast<void*>(buf);
+      iov.iov_len = size;
+
+      union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+      } control;
+      memset(&control, 0, sizeof(control));
+
+      struct msghdr msg;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = control.buf;
+      msg.msg_controllen = sizeof(control.buf);
+
+      auto* cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+      int sent = attached_->fd();
+      memcpy(CMSG_DATA(cmsg), &sent, sizeof(sent));
+
+      auto result = ::sendmsg(fd.fd(), &msg, 0);
+      if (result == -1) {
+        return Result<int, std::error_code>(
+            std::error_code(errno, std::generic_category()));
+      }
+      // The descriptor went with the first byte; the peer has its own copy
+      attached_.reset();
+      return Result<int, std::error_code>(int(result));
+    }
+#endif
+    return fd.write(buf, size);
+  }
+
   watchman_event* getEvents() override {
     return &evt;
   }
@@ -245,6 +300,24 @@ class UnixStream : public watchman_stream {
 #endif
   }
 
+  bool peerHungUp() override {
+    // A peer that has only shut down its writes is still waiting for our
+    // response, so look for the connection being closed altogether
+    struct pollfd pfd;
+    pfd.fd = fd.system_handle();
+    pfd.events = POLLIN;
+#ifdef _WIN32
+    if (WSAPoll(&pfd, 1, 0) <= 0) {
+      return false;
+    }
+#else
+    if (poll(&pfd, 1, 0) <= 0) {
+      return false;
+    }
+#endif
+    return (pfd.revents & (POLLERR | POLLHUP)) != 0;
+  }
+
   bool shutdown() override {
     return ::shutdown(
         fd.system_handle(),
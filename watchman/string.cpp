@@ -5,13 +5,23 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <folly/lang/Bits.h>
 #include <stdarg.h>
 #include <new>
 #include <ostream>
 #include <stdexcept>
+#include <utility>
 #include "watchman/thirdparty/jansson/utf.h"
 #include "watchman/watchman_string.h"
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define WATCHMAN_STRING_SSE2 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define WATCHMAN_STRING_NEON 1
+#endif
+
 // Filename mapping and handling strategy
 // We'll track the utf-8 rendition of the underlying filesystem names
 // in the watchman datastructures.  We'll convert to Wide Char at the
@@ -39,12 +49,220 @@ static void w_string_delref(StringHeader* str);
 static StringHeader*
 w_string_new_len_typed(const char* str, uint32_t len, w_string_type_t type);
 
+// byte scans
+
+namespace {
+
+template <bool kStopAtDot>
+inline bool isScanStop(char c) {
+  return is_slash(c) || (kStopAtDot && c == '.');
+}
+
+template <bool kStopAtDot>
+const char* findLastStopScalar(const char* begin, const char* end) {
+  while (end != begin) {
+    --end;
+    if (isScanStop<kStopAtDot>(*end)) {
+      return end;
+    }
+  }
+  return nullptr;
+}
+
+inline char foldAscii(char c) {
+  return c >= 'A' && c <= 'Z' ? static_cast<char>(c | 0x20) : c;
+}
+
+#if defined(WATCHMAN_STRING_SSE2)
+
+using Vec = __m128i;
+
+inline Vec load(const char* p) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+inline void store(char* p, Vec v) {
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v);
+}
+
+template <bool kStopAtDot>
+inline unsigned stopMask(Vec v) {
+  Vec m = _mm_cmpeq_epi8(v, _mm_set1_epi8('/'));
+#ifdef _WIN32
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+#endif
+  if (kStopAtDot) {
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('.')));
+  }
+  return static_cast<unsigned>(_mm_movemask_epi8(m));
+}
+
+// Index of the highest lane set in a non-zero stopMask.
+inline size_t lastLane(unsigned mask) {
+  return folly::findLastSet(mask) - 1;
+}
+
+inline Vec foldAscii(Vec v) {
+  // Bias the bytes so that 'A'..'Z' are the 26 smallest signed values;
+  // SSE2 has no unsigned byte compare.
+  Vec biased = _mm_sub_epi8(v, _mm_set1_epi8(static_cast<char>('A' + 128)));
+  Vec upper = _mm_cmplt_epi8(biased, _mm_set1_epi8(-128 + 26));
+  return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+inline bool allEqual(Vec a, Vec b) {
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) == 0xffff;
+}
+
+inline bool allAscii(Vec v) {
+  return _mm_movemask_epi8(v) == 0;
+}
+
+#elif defined(WATCHMAN_STRING_NEON)
+
+using Vec = uint8x16_t;
+
+inline Vec load(const char* p) {
+  return vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+}
+
+inline void store(char* p, Vec v) {
+  vst1q_u8(reinterpret_cast<uint8_t*>(p), v);
+}
+
+template <bool kStopAtDot>
+inline uint64_t stopMask(Vec v) {
+  Vec m = vceqq_u8(v, vdupq_n_u8('/'));
+#ifdef _WIN32
+  m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('\\')));
+#endif
+  if (kStopAtDot) {
+    m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('.')));
+  }
+  // NEON has no movemask; narrowing each 16 bit pair by 4 leaves one
+  // nibble per lane.
+  return vget_lane_u64(
+      vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+}
+
+inline size_t lastLane(uint64_t mask) {
+  return (folly::findLastSet(mask) - 1) / 4;
+}
+
+inline Vec foldAscii(Vec v) {
+  Vec upper = vcltq_u8(vsubq_u8(v, vdupq_n_u8('A')), vdupq_n_u8(26));
+  return vorrq_u8(v, vandq_u8(upper, vdupq_n_u8(0x20)));
+}
+
+inline bool allEqual(Vec a, Vec b) {
+  return vminvq_u8(vceqq_u8(a, b)) == 0xff;
+}
+
+inline bool allAscii(Vec v) {
+  return vmaxvq_u8(v) < 0x80;
+}
+
+#endif
+
+#if defined(WATCHMAN_STRING_SSE2) || defined(WATCHMAN_STRING_NEON)
+#define WATCHMAN_STRING_VECTOR 1
+constexpr size_t kVecBytes = 16;
+#endif
+
+template <bool kStopAtDot>
+const char* findLastStop(const char* begin, const char* end) {
+#ifdef WATCHMAN_STRING_VECTOR
+  while (static_cast<size_t>(end - begin) >= kVecBytes) {
+    end -= kVecBytes;
+    auto mask = stopMask<kStopAtDot>(load(end));
+    if (mask) {
+      return end + lastLane(mask);
+    }
+  }
+#endif
+  return findLastStopScalar<kStopAtDot>(begin, end);
+}
+
+} // namespace
+
+const char* watchman::findLastSlash(
+    const char* begin,
+    const char* end) noexcept {
+  return findLastStop<false>(begin, end);
+}
+
+const char* watchman::findLastSlashScalar(
+    const char* begin,
+    const char* end) noexcept {
+  return findLastStopScalar<false>(begin, end);
+}
+
+bool watchman::equalAsciiCaseless(
+    const char* a,
+    const char* b,
+    size_t len) noexcept {
+  size_t i = 0;
+#ifdef WATCHMAN_STRING_VECTOR
+  for (; i + kVecBytes <= len; i += kVecBytes) {
+    if (!allEqual(foldAscii(load(a + i)), foldAscii(load(b + i)))) {
+      return false;
+    }
+  }
+#endif
+  return equalAsciiCaselessScalar(a + i, b + i, len - i);
+}
+
+bool watchman::equalAsciiCaselessScalar(
+    const char* a,
+    const char* b,
+    size_t len) noexcept {
+  for (size_t i = 0; i < len; ++i) {
+    if (foldAscii(a[i]) != foldAscii(b[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+size_t watchman::asciiPrefixLength(const char* str, size_t len) noexcept {
+  size_t i = 0;
+#ifdef WATCHMAN_STRING_VECTOR
+  for (; i + kVecBytes <= len; i += kVecBytes) {
+    if (!allAscii(load(str + i))) {
+      break;
+    }
+  }
+#endif
+  return i + asciiPrefixLengthScalar(str + i, len - i);
+}
+
+size_t watchman::asciiPrefixLengthScalar(const char* str, size_t len) noexcept {
+  size_t i = 0;
+  while (i < len && static_cast<unsigned char>(str[i]) < 0x80) {
+    ++i;
+  }
+  return i;
+}
+
+void watchman::foldAsciiCase(const char* src, char* dst, size_t len) noexcept {
+  size_t i = 0;
+#ifdef WATCHMAN_STRING_VECTOR
+  for (; i + kVecBytes <= len; i += kVecBytes) {
+    store(dst + i, foldAscii(load(src + i)));
+  }
+#endif
+  for (; i < len; ++i) {
+    dst[i] = foldAscii(src[i]);
+  }
+}
+
 // string piece
 
 w_string_piece::w_string_piece(w_string_piece&& other) noexcept
-    : str_(other.str_), len_(other.len_) {
+    : str_(other.str_), len_(other.len_), whole_(other.whole_) {
   other.str_ = nullptr;
   other.len_ = 0;
+  other.whole_ = nullptr;
 }
 
 w_string w_string_piece::asWString(w_string_type_t stringType) const {
@@ -56,12 +274,8 @@ w_string w_string_piece::asLowerCase(w_string_type_t stringType) const {
   // allocation.
 
   uint32_t len = size();
-  return w_string::generate(len, stringType, [&](char* buf) {
-    for (uint32_t i = 0; i < len; ++i) {
-      // TODO: `tolower` depends on locale.
-      buf[i] = static_cast<char>(tolower(static_cast<unsigned char>(str_[i])));
-    }
-  });
+  return w_string::generate(
+      len, stringType, [&](char* buf) { foldAsciiCase(str_, buf, len); });
 }
 
 std::optional<w_string> w_string_piece::asLowerCaseSuffix(
@@ -76,7 +290,12 @@ std::optional<w_string> w_string_piece::asLowerCaseSuffix(
 
 w_string w_string_piece::asUTF8Clean() const {
   w_string s(str_, len_, W_STRING_UNICODE);
-  utf8_fix_string(const_cast<char*>(s.data()), s.size());
+  // Most paths are plain ASCII; only the tail from the first high byte
+  // needs checking.
+  size_t ascii = asciiPrefixLength(str_, len_);
+  if (ascii < len_) {
+    utf8_fix_string(const_cast<char*>(s.data()) + ascii, len_ - ascii);
+  }
   return s;
 }
 
@@ -133,22 +352,20 @@ w_string_piece w_string_piece::dirName() const {
   if (len_ == 0) {
     return {};
   }
-  const char* const e = str_ + len_;
-  for (auto end = e - 1; end >= str_; --end) {
-    if (is_slash(*end)) {
-      /* found the end of the parent dir */
+  auto end = findLastSlash(str_, str_ + len_);
+  if (!end) {
+    return {};
+  }
+  /* found the end of the parent dir */
 #ifdef _WIN32
-      if (end > str_ && end[-1] == ':') {
-        // Special case for "C:\"; we want to keep the
-        // trailing slash for this case so that we continue
-        // to consider it an absolute path
-        return w_string_piece(str_, 1 + end - str_);
-      }
-#endif
-      return w_string_piece(str_, end - str_);
-    }
+  if (end > str_ && end[-1] == ':') {
+    // Special case for "C:\"; we want to keep the
+    // trailing slash for this case so that we continue
+    // to consider it an absolute path
+    return w_string_piece(str_, 1 + end - str_);
   }
-  return {};
+#endif
+  return w_string_piece(str_, end - str_);
 }
 
 w_string_piece w_string_piece::baseName() const {
@@ -156,22 +373,20 @@ w_string_piece w_string_piece::baseName() const {
     return *this;
   }
   const char* const e = str_ + len_;
-  for (auto end = e - 1; end >= str_; --end) {
-    if (is_slash(*end)) {
-      /* found the end of the parent dir */
+  auto end = findLastSlash(str_, e);
+  if (!end) {
+    return *this;
+  }
+  /* found the end of the parent dir */
 #ifdef _WIN32
-      if (end == e && end > str_ && end[-1] == ':') {
-        // Special case for "C:\"; we want the baseName to
-        // be this same component so that we continue
-        // to consider it an absolute path
-        return *this;
-      }
-#endif
-      return w_string_piece(end + 1, e - (end + 1));
-    }
+  if (end == e && end > str_ && end[-1] == ':') {
+    // Special case for "C:\"; we want the baseName to
+    // be this same component so that we continue
+    // to consider it an absolute path
+    return *this;
   }
-
-  return *this;
+#endif
+  return w_string_piece(end + 1, e - (end + 1));
 }
 
 w_string_piece w_string_piece::suffix() const {
@@ -179,15 +394,11 @@ w_string_piece w_string_piece::suffix() const {
     return {};
   }
   const char* const e = str_ + len_;
-  for (auto end = e - 1; end >= str_; --end) {
-    if (is_slash(*end)) {
-      return {};
-    }
-    if (*end == '.') {
-      return w_string_piece(end + 1, e - (end + 1));
-    }
+  auto end = findLastStop</*kStopAtDot=*/true>(str_, e);
+  if (!end || *end != '.') {
+    return {};
   }
-  return {};
+  return w_string_piece(end + 1, e - (end + 1));
 }
 
 bool w_string_piece::startsWith(w_string_piece prefix) const {
@@ -201,20 +412,7 @@ bool w_string_piece::startsWithCaseInsensitive(w_string_piece prefix) const {
   if (prefix.size() > size()) {
     return false;
   }
-
-  auto me = str_;
-  auto pref = prefix.str_;
-
-  const char* const end = prefix.str_ + prefix.len_;
-  while (pref < end) {
-    // TODO: `tolower` depends on locale.
-    if (tolower((uint8_t)*me) != tolower((uint8_t)*pref)) {
-      return false;
-    }
-    ++pref;
-    ++me;
-  }
-  return true;
+  return equalAsciiCaseless(str_, prefix.str_, prefix.len_);
 }
 
 // string
@@ -331,7 +529,7 @@ void w_string::reset() noexcept {
   }
 }
 
-inline uint32_t hash_string(const char* str, size_t len) {
+StringHash watchman::stdStringHash(const char* str, size_t len) noexcept {
   // Watchman used to use Bob Jenkins's lookup3. Many good hash functions exist,
   // but, empirically, the standard library's are faster than lookup3 and
   // convenient.
@@ -345,14 +543,148 @@ inline uint32_t hash_string(const char* str, size_t len) {
   return (hash >> 32) ^ hash;
 }
 
-StringHash w_string::computeAndStoreHash() const noexcept {
-  StringHash hash = hash_string(str_->buf(), str_->len);
+namespace {
+
+constexpr uint64_t kHashMultiplier = 0x9e3779b97f4a7c15ull;
+
+inline uint64_t loadWord(const char* p) {
+  uint64_t word;
+  memcpy(&word, p, sizeof(word));
+  return word;
+}
+
+inline uint64_t hashRound(uint64_t hash, uint64_t word) {
+  return (((hash << 5) | (hash >> 59)) ^ word) * kHashMultiplier;
+}
+
+} // namespace
+
+StringHash watchman::wordStringHash(const char* str, size_t len) noexcept {
+  const char* p = str;
+  const char* const end = str + len;
+  uint64_t hash = len * kHashMultiplier;
+
+  if (len >= 32) {
+    uint64_t lanes[4] = {hash, hash + 1, hash + 2, hash + 3};
+    while (end - p >= 32) {
+      for (size_t i = 0; i < 4; ++i) {
+        lanes[i] = hashRound(lanes[i], loadWord(p + i * 8));
+      }
+      p += 32;
+    }
+    hash = hashRound(
+        hashRound(hashRound(lanes[0], lanes[1]), lanes[2]), lanes[3]);
+  }
+  for (; end - p >= 8; p += 8) {
+    hash = hashRound(hash, loadWord(p));
+  }
+  if (p != end) {
+    uint64_t tail = 0;
+    memcpy(&tail, p, end - p);
+    hash = hashRound(hash, tail);
+  }
+
+  // The rounds only carry entropy upwards; MurmurHash3's finalizer spreads
+  // it over every bit before we fold it to 32.
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ull;
+  hash ^= hash >> 33;
+  return StringHash(hash >> 32) ^ StringHash(hash);
+}
+
+namespace {
 
-  str_->_hval.store(hash, std::memory_order_release);
-  str_->set_hval_computed();
+inline StringHash hash_string(const char* str, size_t len) {
+  return wordStringHash(str, len);
+}
+
+StringHash storeHash(const StringHeader* str, StringHash hash) {
+  // The header is shared and immutable apart from these atomics.
+  auto* header = const_cast<StringHeader*>(str);
+  header->_hval.store(hash, std::memory_order_release);
+  header->set_hval_computed();
   return hash;
 }
 
+/**
+ * Storage blocks of kSmallStorageSize bytes released by this thread and not
+ * yet reused.  Blocks are interchangeable between threads, so a string may
+ * be freed into a different thread's cache than the one it came from.
+ */
+class SmallStorageCache {
+ public:
+  ~SmallStorageCache() {
+    while (head_) {
+      free(std::exchange(head_, head_->next));
+    }
+    // Strings released by later thread_local destructors go straight to free
+    capacity_ = 0;
+  }
+
+  void* pop() noexcept {
+    if (!head_) {
+      return nullptr;
+    }
+    --size_;
+    return std::exchange(head_, head_->next);
+  }
+
+  bool push(void* storage) noexcept {
+    if (size_ >= capacity_) {
+      return false;
+    }
+    head_ = new (storage) Block{head_};
+    ++size_;
+    return true;
+  }
+
+ private:
+  struct Block {
+    Block* next;
+  };
+  Block* head_{nullptr};
+  size_t size_{0};
+  // At most 64 KiB per thread
+  size_t capacity_{1024};
+};
+
+thread_local SmallStorageCache smallStorage;
+
+} // namespace
+
+void* StringHeader::allocStorage(size_t size) {
+  void* s = nullptr;
+  if (size <= kSmallStorageSize) {
+    s = smallStorage.pop();
+    if (!s) {
+      // Always allocate the full block so that any small string can reuse it
+      s = malloc(kSmallStorageSize);
+    }
+  } else {
+    s = malloc(size);
+  }
+  if (!s) {
+    throw std::bad_alloc{};
+  }
+  return s;
+}
+
+void StringHeader::destroy(StringHeader* str) noexcept {
+  // `len` only ever shrinks, so storage that looks small now is at least
+  // kSmallStorageSize bytes.
+  bool small = sizeof(StringHeader) + str->len + 1 <= kSmallStorageSize;
+  str->~StringHeader();
+  if (!small || !smallStorage.push(str)) {
+    free(str);
+  }
+}
+
+StringHash w_string::computeAndStoreHash() const noexcept {
+  return storeHash(str_, hash_string(str_->buf(), str_->len));
+}
+
 static inline uint32_t checked_len(size_t len) {
   if (len > UINT32_MAX) {
     throw std::range_error("string length exceeds UINT32_MAX");
@@ -464,6 +796,12 @@ w_string w_string::pathCat(std::initializer_list<w_string_piece> elems) {
 }
 
 StringHash w_string_piece::hashValue() const noexcept {
+  if (whole_) {
+    if (whole_->has_hval()) {
+      return whole_->_hval.load(std::memory_order_acquire);
+    }
+    return storeHash(whole_, hash_string(data(), size()));
+  }
   return hash_string(data(), size());
 }
 
@@ -573,26 +911,16 @@ w_string_new_len_typed(const char* str, uint32_t len, w_string_type_t type) {
 
 void w_string_delref(StringHeader* str) {
   if (str->decref()) {
-    // Call the destructor.  We can't use regular delete because
-    // we allocated with malloc().
-    str->~StringHeader();
-    free(str);
+    // We can't use regular delete because we allocated with malloc().
+    StringHeader::destroy(str);
   }
 }
 
 bool w_string_equal_caseless(w_string_piece a, w_string_piece b) {
-  uint32_t i;
-
   if (a.size() != b.size()) {
     return false;
   }
-  for (i = 0; i < a.size(); i++) {
-    // TODO: `tolower` depends on locale.
-    if (tolower((uint8_t)a[i]) != tolower((uint8_t)b[i])) {
-      return false;
-    }
-  }
-  return true;
+  return equalAsciiCaseless(a.data(), b.data(), a.size());
 }
 
 bool w_string_piece::hasSuffix(w_string_piece suffix) const {
@@ -609,8 +937,7 @@ bool w_string_piece::hasSuffix(w_string_piece suffix) const {
   }
 
   for (i = 0; i < suffix.size(); i++) {
-    // TODO: `tolower` depends on locale.
-    if (tolower((uint8_t)str_[base + i]) != suffix[i]) {
+    if (foldAscii(str_[base + i]) != suffix[i]) {
       return false;
     }
   }
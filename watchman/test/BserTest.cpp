@@ -7,6 +7,7 @@
 
 #include "watchman/bser.h"
 #include <folly/ScopeGuard.h>
+#include <folly/compression/Compression.h>
 #include <folly/logging/xlog.h>
 #include <folly/portability/GTest.h>
 #include "watchman/thirdparty/jansson/jansson_private.h"
@@ -311,6 +312,190 @@ TEST(Bser, bser_tests) {
   check_bser_typed_strings();
 }
 
+TEST(Bser, array_encoder_matches_json_encoding) {
+  auto templ = json_array(
+      {typed_string_to_json("name", W_STRING_UNICODE),
+       typed_string_to_json("size", W_STRING_UNICODE),
+       typed_string_to_json("exists", W_STRING_UNICODE)});
+
+  for (uint32_t version : {1, 2}) {
+    BserArrayEncoder encoder{version, 0, templ};
+    std::vector<json_ref> rows;
+    for (int i = 0; i < 3; ++i) {
+      encoder.beginElement();
+      encoder.appendString(w_string_piece{"dir/file"}, W_STRING_BYTE);
+      encoder.appendInt(i * 100000);
+      if (i == 1) {
+        // Elements can be abandoned part way through
+        encoder.abortElement();
+        continue;
+      }
+      encoder.appendBool(i == 0);
+      encoder.endElement();
+      rows.push_back(json_object(
+          {{"name", typed_string_to_json("dir/file")},
+           {"size", json_integer(i * 100000)},
+           {"exists", json_boolean(i == 0)}}));
+    }
+
+    BserArrayEncoder shard{version, 0, templ};
+    shard.beginElement();
+    shard.appendString(w_string_piece{"other"}, W_STRING_UNICODE);
+    shard.appendNull();
+    shard.appendReal(1.5);
+    shard.endElement();
+    rows.push_back(json_object(
+        {{"name", typed_string_to_json("other", W_STRING_UNICODE)},
+         {"size", json_null()},
+         {"exists", json_real(1.5)}}));
+    encoder.append(std::move(shard));
+    EXPECT_EQ(3, encoder.size());
+
+    auto expected = json_array(std::move(rows));
+    json_array_set_template_new(expected, json_ref(templ));
+    auto encoded = std::move(encoder).finish();
+    EXPECT_EQ(JSON_BSER, encoded.type());
+
+    // Copied as is for the dialect it was encoded in
+    EXPECT_EQ(*bdumps(version, 0, expected), *bdumps(version, 0, encoded));
+
+    // and re-encoded for any other
+    uint32_t otherVersion = version == 1 ? 2 : 1;
+    auto reencoded = bdumps(otherVersion, 0, encoded);
+    ASSERT_TRUE(reencoded);
+    EXPECT_TRUE(json_equal(
+        expected,
+        bunser(reencoded->data(), reencoded->data() + reencoded->size())));
+  }
+}
+
+TEST(Bser, columns_factor_out_shared_directories) {
+  auto templ = json_array(
+      {typed_string_to_json("name", W_STRING_UNICODE),
+       typed_string_to_json("size", W_STRING_UNICODE)});
+  std::vector<json_ref> rows;
+  for (int i = 0; i < 100; ++i) {
+    auto name = fmt::format("some/deep/directory/file{}", i);
+    rows.push_back(json_object(
+        {{"name",
+          typed_string_to_json(
+              name.data(),
+              name.size(),
+              i % 2 ? W_STRING_BYTE : W_STRING_UNICODE)},
+         {"size", json_integer(i)}}));
+  }
+  rows.push_back(json_object({{"name", typed_string_to_json("top")}}));
+  rows.push_back(json_object(
+      {{"name", typed_string_to_json("lonely/file")},
+       {"size", json_null()}}));
+  auto json = json_array(std::move(rows));
+  json_array_set_template_new(json, json_ref(templ));
+
+  auto templated = bdumps(2, 0, json);
+  auto columns = bdumps(2, BSER_CAP_COLUMNS, json);
+  ASSERT_TRUE(templated);
+  ASSERT_TRUE(columns);
+  EXPECT_EQ('\x0e', (*columns)[0]);
+  EXPECT_LT(columns->size() * 2, templated->size());
+
+  auto decoded = bunser(columns->data(), columns->data() + columns->size());
+  EXPECT_TRUE(json_equal(
+      bunser(templated->data(), templated->data() + templated->size()),
+      decoded));
+  EXPECT_EQ(W_STRING_BYTE, json_to_w_string(decoded.at(1).get("name")).type());
+  EXPECT_EQ(
+      W_STRING_UNICODE, json_to_w_string(decoded.at(2).get("name")).type());
+
+  // Only BSERv2 has capabilities
+  EXPECT_EQ(*bdumps(1, 0, json), *bdumps(1, BSER_CAP_COLUMNS, json));
+
+  // Out of range directories are rejected
+  auto bogus = S("\x0e\x00\x03\x01\x02\x03\x01n\x03\x01\x00\x03\x00"
+                 "\x0f\x03\x00\x02\x03\x01"
+                 "f");
+  EXPECT_THROW(
+      bunser(bogus.data(), bogus.data() + bogus.size()), BserParseError);
+}
+
+TEST(Bser, zstd_compresses_large_pdus) {
+  if (!folly::io::hasStreamCodec(folly::io::CodecType::ZSTD)) {
+    GTEST_SKIP() << "folly was built without zstd";
+  }
+  std::vector<json_ref> names;
+  for (int i = 0; i < 1000; ++i) {
+    auto name = fmt::format("some/deep/directory/file{}", i);
+    names.push_back(typed_string_to_json(name.data(), name.size()));
+  }
+  auto json = json_array(std::move(names));
+
+  std::string small;
+  ASSERT_EQ(
+      0,
+      w_bser_write_pdu(2, BSER_CAP_ZSTD, dump_to_string, json, &small, 1 << 20));
+  EXPECT_EQ(*bdumps_pdu(2, BSER_CAP_ZSTD, json), small);
+
+  std::string large;
+  ASSERT_EQ(
+      0, w_bser_write_pdu(2, BSER_CAP_ZSTD, dump_to_string, json, &large, 1024));
+  ASSERT_EQ(S(BSER_V2_ZSTD_MAGIC), large.substr(0, 2));
+  EXPECT_LT(large.size() * 4, small.size());
+  uint32_t capabilities;
+  memcpy(&capabilities, large.data() + 2, sizeof(capabilities));
+  EXPECT_EQ(BSER_CAP_ZSTD, capabilities);
+
+  size_t needed;
+  auto len = bunser_int(large.data() + 6, large.size() - 6, &needed);
+  ASSERT_TRUE(len);
+  ASSERT_EQ(large.size(), 6 + needed + size_t(*len));
+  EXPECT_TRUE(json_equal(
+      json, bunser_zstd(large.data() + 6 + needed, large.data() + large.size())));
+
+  // Only clients that asked for it get compressed PDUs
+  std::string plain;
+  ASSERT_EQ(0, w_bser_write_pdu(2, 0, dump_to_string, json, &plain, 0));
+  EXPECT_EQ(S(BSER_V2_MAGIC), plain.substr(0, 2));
+
+  auto bogus = S("not a zstd frame");
+  EXPECT_THROW(
+      bunser_zstd(bogus.data(), bogus.data() + bogus.size()), BserParseError);
+}
+
+TEST(Bser, bunser_shares_repeated_short_strings) {
+  std::string longName(64, 'x');
+  auto json = json_array(
+      {json_array(
+           {typed_string_to_json("name", W_STRING_UNICODE),
+            typed_string_to_json(longName.data(), longName.size())}),
+       json_array(
+           {typed_string_to_json("name", W_STRING_UNICODE),
+            typed_string_to_json(longName.data(), longName.size()),
+            typed_string_to_json("name", W_STRING_BYTE)}),
+       json_object({{"path", typed_string_to_json("a")}}),
+       json_object({{"path", typed_string_to_json("b")}})});
+
+  for (uint32_t version : {1, 2}) {
+    auto dumped = bdumps(version, 0, json);
+    ASSERT_TRUE(dumped);
+    auto decoded = bunser(dumped->data(), dumped->data() + dumped->size());
+    EXPECT_TRUE(json_equal(json, decoded));
+
+    auto first = decoded.at(0);
+    auto second = decoded.at(1);
+    EXPECT_EQ(first.at(0).get(), second.at(0).get());
+    EXPECT_NE(first.at(1).get(), second.at(1).get());
+    if (version == 2) {
+      // Byte and unicode strings aren't interchangeable
+      EXPECT_NE(second.at(0).get(), second.at(2).get());
+      EXPECT_EQ(W_STRING_BYTE, json_to_w_string(second.at(2)).type());
+    }
+
+    auto firstKeys = decoded.at(2).object();
+    auto secondKeys = decoded.at(3).object();
+    EXPECT_EQ(
+        firstKeys.begin()->first.data(), secondKeys.begin()->first.data());
+  }
+}
+
 TEST(Bser, bunser_int_returns_needed) {
   size_t needed;
 
@@ -13,6 +13,7 @@
 #include <stdexcept>
 #include <string>
 #include "watchman/LRUCache.h"
+#include "watchman/ShardedLRUCache.h"
 
 using namespace watchman;
 
@@ -151,6 +152,98 @@ TEST(CacheTest, future) {
       << "cache should still be full (no excess) but has " << cache.size();
 }
 
+TEST(CacheTest, clock) {
+  LRUCache<std::string, bool> cache(
+      3,
+      kErrorTTL,
+      std::chrono::seconds(300),
+      lrucache::EvictionPolicy::Clock);
+
+  cache.set("a", true);
+  cache.set("b", true);
+  cache.set("c", true);
+  EXPECT_TRUE(cache.get("a")) << "a is now referenced";
+
+  cache.set("d", true);
+  EXPECT_TRUE(cache.get("a")) << "a was spared";
+  EXPECT_EQ(cache.get("b"), nullptr) << "b was the oldest unreferenced item";
+
+  // a was referenced again above, but c and d only when inserted
+  cache.set("e", true);
+  EXPECT_EQ(cache.get("c"), nullptr) << "c was evicted";
+  EXPECT_TRUE(cache.get("a"));
+  EXPECT_TRUE(cache.get("d"));
+  EXPECT_EQ(cache.size(), 3);
+
+  auto stats = cache.stats();
+  EXPECT_EQ(stats.cacheLoad, 6);
+  EXPECT_EQ(stats.cacheHit, 4);
+  EXPECT_EQ(stats.cacheMiss, 2);
+}
+
+TEST(CacheTest, sharded) {
+  using Cache = ShardedLRUCache<int, int>;
+
+  Cache small(5, kErrorTTL);
+  EXPECT_EQ(small.numShards(), 1) << "too small to split";
+  for (int i = 0; i < 6; ++i) {
+    small.set(i, i * 2);
+  }
+  EXPECT_EQ(small.size(), 5) << "limit is exact with one shard";
+
+  Cache cache(Cache::kMaxShards * Cache::kMinItemsPerShard, kErrorTTL);
+  EXPECT_EQ(cache.numShards(), Cache::kMaxShards);
+  for (int i = 0; i < 1000; ++i) {
+    cache.set(i, i * 2);
+  }
+  for (int i = 0; i < 1000; ++i) {
+    auto node = cache.get(i);
+    ASSERT_TRUE(node) << i;
+    EXPECT_EQ(node->value(), i * 2);
+  }
+  EXPECT_EQ(cache.get(1000), nullptr);
+  EXPECT_EQ(cache.erase(7)->value(), 14);
+  EXPECT_EQ(cache.get(7), nullptr);
+
+  auto stats = cache.stats();
+  EXPECT_EQ(stats.size, 999);
+  EXPECT_EQ(stats.cacheStore, 1000);
+  EXPECT_EQ(stats.cacheLoad, 1002);
+  EXPECT_EQ(stats.cacheHit, 1000);
+  EXPECT_EQ(stats.cacheMiss, 2);
+  EXPECT_EQ(stats.cacheErase, 1);
+
+  cache.clear();
+  EXPECT_EQ(cache.size(), 0);
+  EXPECT_EQ(cache.stats().clearCount, 1);
+}
+
+TEST(CacheTest, shrink) {
+  LRUCache<int, bool> cache(10, kErrorTTL);
+  for (int i = 0; i < 10; ++i) {
+    cache.set(i, true);
+  }
+  EXPECT_TRUE(cache.get(0)) << "0 is now the most recently used";
+
+  EXPECT_EQ(cache.shrink(4), 6);
+  EXPECT_EQ(cache.size(), 4);
+  EXPECT_TRUE(cache.get(0)) << "the recently used items are kept";
+  EXPECT_EQ(cache.get(1), nullptr);
+  EXPECT_EQ(cache.shrink(4), 0) << "already small enough";
+  EXPECT_EQ(cache.stats().cacheEvict, 6);
+
+  ShardedLRUCache<int, int> sharded(
+      ShardedLRUCache<int, int>::kMaxShards *
+          ShardedLRUCache<int, int>::kMinItemsPerShard,
+      kErrorTTL);
+  for (int i = 0; i < 1000; ++i) {
+    sharded.set(i, i);
+  }
+  auto evicted = sharded.shrink(500);
+  EXPECT_EQ(sharded.size(), 1000 - evicted);
+  EXPECT_LE(sharded.size(), 500 + sharded.numShards());
+}
+
 int main(int argc, char* argv[]) {
   testing::InitGoogleTest(&argc, argv);
   folly::init(&argc, &argv);
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ChildTable.h"
+#include <folly/portability/GTest.h>
+#include <deque>
+#include <memory>
+#include <string>
+
+using namespace watchman;
+
+namespace {
+
+using Table = ChildTable<std::unique_ptr<int>>;
+
+// The table keys are non-owning, so keep the names alive here
+std::deque<std::string> makeNames(size_t n) {
+  std::deque<std::string> names;
+  for (size_t i = 0; i < n; ++i) {
+    names.push_back("file" + std::to_string(i));
+  }
+  return names;
+}
+
+void insertAll(Table& table, const std::deque<std::string>& names) {
+  for (size_t i = 0; i < names.size(); ++i) {
+    table[w_string_piece(names[i])] = std::make_unique<int>(int(i));
+  }
+}
+
+void expectAll(const Table& table, const std::deque<std::string>& names) {
+  EXPECT_EQ(names.size(), table.size());
+  for (size_t i = 0; i < names.size(); ++i) {
+    auto it = table.find(w_string_piece(names[i]));
+    ASSERT_NE(it, table.end()) << names[i];
+    EXPECT_EQ(int(i), *it->second);
+  }
+}
+
+} // namespace
+
+TEST(ChildTableTest, small_table_uses_linear_scan) {
+  Table table;
+  EXPECT_TRUE(table.empty());
+  auto names = makeNames(Table::kIndexThreshold);
+  insertAll(table, names);
+  EXPECT_FALSE(table.hasIndex());
+  expectAll(table, names);
+  EXPECT_EQ(table.end(), table.find("nope"));
+
+  EXPECT_EQ(1, table.erase(w_string_piece(names[3])));
+  EXPECT_EQ(0, table.erase(w_string_piece(names[3])));
+  EXPECT_EQ(table.end(), table.find(w_string_piece(names[3])));
+  EXPECT_EQ(names.size() - 1, table.size());
+}
+
+TEST(ChildTableTest, operator_brackets_finds_existing) {
+  Table table;
+  std::string name("a");
+  table[w_string_piece(name)] = std::make_unique<int>(1);
+  EXPECT_EQ(1, *table[w_string_piece(name)]);
+  EXPECT_EQ(1, table.size());
+}
+
+TEST(ChildTableTest, grows_an_index) {
+  Table table;
+  auto names = makeNames(1000);
+  insertAll(table, names);
+  EXPECT_TRUE(table.hasIndex());
+  expectAll(table, names);
+  EXPECT_EQ(table.end(), table.find("nope"));
+
+  size_t seen = 0;
+  for (auto& it : table) {
+    EXPECT_NE(nullptr, it.second);
+    ++seen;
+  }
+  EXPECT_EQ(names.size(), seen);
+}
+
+TEST(ChildTableTest, erase_with_index) {
+  Table table;
+  auto names = makeNames(500);
+  insertAll(table, names);
+
+  // Remove every other entry, working from both ends so that entries
+  // are moved around in the dense storage
+  for (size_t i = 0; i < names.size(); ++i) {
+    if (i % 2 == 0) {
+      EXPECT_EQ(1, table.erase(w_string_piece(names[i])));
+    }
+  }
+  for (size_t i = 0; i < names.size(); ++i) {
+    auto it = table.find(w_string_piece(names[i]));
+    if (i % 2 == 0) {
+      EXPECT_EQ(table.end(), it) << names[i];
+    } else {
+      ASSERT_NE(table.end(), it) << names[i];
+      EXPECT_EQ(int(i), *it->second);
+    }
+  }
+  EXPECT_EQ(names.size() / 2, table.size());
+
+  // Everything can be re-added
+  insertAll(table, names);
+  expectAll(table, names);
+}
+
+TEST(ChildTableTest, reserve_defers_index) {
+  Table table;
+  table.reserve(200);
+  EXPECT_FALSE(table.hasIndex());
+  auto names = makeNames(200);
+  insertAll(table, names);
+  expectAll(table, names);
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/fs/CompactFileInformation.h"
+#include <folly/portability/GTest.h>
+#include <string.h>
+
+using namespace watchman;
+
+TEST(CompactFileInformationTest, is_smaller_than_file_information) {
+  EXPECT_LT(sizeof(CompactFileInformation), sizeof(FileInformation));
+}
+
+TEST(CompactFileInformationTest, zeroed_storage_is_empty) {
+  alignas(CompactFileInformation) char storage[sizeof(CompactFileInformation)];
+  memset(storage, 0, sizeof(storage));
+  auto info =
+      reinterpret_cast<CompactFileInformation*>(storage)->toFileInformation();
+  EXPECT_EQ(0, info.size);
+  EXPECT_EQ(0, info.dev);
+  EXPECT_EQ(0, info.uid);
+  EXPECT_EQ(0, info.gid);
+  EXPECT_EQ(0, info.mtime.tv_sec);
+  EXPECT_EQ(0, info.mtime.tv_nsec);
+}
+
+TEST(CompactFileInformationTest, round_trips) {
+  FileInformation info;
+  info.mode = S_IFREG | 0644;
+  info.size = 123456789;
+  info.uid = 1000;
+  info.gid = 100;
+  info.ino = 987654321;
+  info.dev = 42;
+  info.nlink = 2;
+  info.atime = {1600000000, 1};
+  info.mtime = {1600000001, 999999999};
+  info.ctime = {1600000002, 500};
+
+  CompactFileInformation compact{info};
+  EXPECT_TRUE(compact.isFile());
+  EXPECT_FALSE(compact.isDir());
+  EXPECT_EQ(info.size, compact.size());
+  EXPECT_EQ(info.ino, compact.ino());
+
+  auto back = compact.toFileInformation();
+  EXPECT_EQ(info.mode, back.mode);
+  EXPECT_EQ(info.size, back.size);
+  EXPECT_EQ(info.uid, back.uid);
+  EXPECT_EQ(info.gid, back.gid);
+  EXPECT_EQ(info.ino, back.ino);
+  EXPECT_EQ(info.dev, back.dev);
+  EXPECT_EQ(info.nlink, back.nlink);
+  EXPECT_EQ(info.atime.tv_sec, back.atime.tv_sec);
+  EXPECT_EQ(info.atime.tv_nsec, back.atime.tv_nsec);
+  EXPECT_EQ(info.mtime.tv_sec, back.mtime.tv_sec);
+  EXPECT_EQ(info.mtime.tv_nsec, back.mtime.tv_nsec);
+  EXPECT_EQ(info.ctime.tv_sec, back.ctime.tv_sec);
+  EXPECT_EQ(info.ctime.tv_nsec, back.ctime.tv_nsec);
+}
+
+TEST(CompactFileInformationTest, times_before_the_epoch) {
+  struct timespec ts = {-2, 250000000};
+  auto ns = CompactFileInformation::timespecToNs(ts);
+  EXPECT_EQ(-1750000000, ns);
+  auto back = CompactFileInformation::nsToTimespec(ns);
+  EXPECT_EQ(-2, back.tv_sec);
+  EXPECT_EQ(250000000, back.tv_nsec);
+}
+
+TEST(CompactFileInformationTest, owners_are_shared) {
+  auto& table = FileOwnerTable::get();
+  auto a = table.intern(7, 501, 20);
+  auto size = table.size();
+  EXPECT_EQ(a, table.intern(7, 501, 20));
+  auto b = table.intern(7, 502, 20);
+  EXPECT_NE(a, b);
+  EXPECT_EQ(a, table.intern(7, 501, 20));
+  EXPECT_EQ(size + 1, table.size());
+
+  auto& owner = table.lookup(b);
+  EXPECT_EQ(7, owner.dev);
+  EXPECT_EQ(502, owner.uid);
+  EXPECT_EQ(20, owner.gid);
+}
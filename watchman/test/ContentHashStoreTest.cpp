@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ContentHashStore.h"
+#include <folly/portability/GTest.h>
+#include <folly/testing/TestUtil.h>
+#include <filesystem>
+#include "watchman/ContentHash.h"
+
+using namespace watchman;
+
+namespace {
+
+ContentHashCacheKey makeKey(const char* path, size_t size, time_t mtime) {
+  return ContentHashCacheKey{w_string{path}, size, {mtime, 0}};
+}
+
+ContentHashStore::HashValue makeHash(uint8_t seed) {
+  ContentHashStore::HashValue hash{};
+  hash[0] = seed;
+  return hash;
+}
+
+class ContentHashStoreTest : public testing::Test {
+ protected:
+  folly::test::TemporaryDirectory dir;
+  w_string path{(dir.path() / "content-hash").string().c_str()};
+  w_string root{"/some/root"};
+};
+
+} // namespace
+
+TEST_F(ContentHashStoreTest, survives_reopening) {
+  {
+    ContentHashStore store{root, path, 100};
+    EXPECT_FALSE(store.lookup(makeKey("foo", 1, 2)));
+    store.record(makeKey("foo", 1, 2), makeHash(1));
+    store.record(makeKey("bar", 1, 2), makeHash(2));
+  }
+
+  ContentHashStore store{root, path, 100};
+  EXPECT_EQ(makeHash(1), store.lookup(makeKey("foo", 1, 2)));
+  EXPECT_EQ(makeHash(2), store.lookup(makeKey("bar", 1, 2)));
+  // The hash only applies to the same size and mtime
+  EXPECT_FALSE(store.lookup(makeKey("foo", 1, 3)));
+  EXPECT_FALSE(store.lookup(makeKey("foo", 2, 2)));
+  EXPECT_EQ(0, store.getStats().compactions);
+}
+
+TEST_F(ContentHashStoreTest, ignores_other_roots) {
+  {
+    ContentHashStore store{root, path, 100};
+    store.record(makeKey("foo", 1, 2), makeHash(1));
+  }
+
+  ContentHashStore store{w_string{"/other/root"}, path, 100};
+  EXPECT_FALSE(store.lookup(makeKey("foo", 1, 2)));
+}
+
+TEST_F(ContentHashStoreTest, keeps_newest_entries_when_capped) {
+  ContentHashStore store{root, path, 8};
+  for (uint8_t i = 0; i < 20; ++i) {
+    auto name = fmt::format("file{}", i);
+    store.record(makeKey(name.c_str(), 1, 2), makeHash(i));
+  }
+
+  auto stats = store.getStats();
+  EXPECT_LE(stats.entries, 8);
+  EXPECT_GT(stats.compactions, 0);
+  EXPECT_EQ(makeHash(19), store.lookup(makeKey("file19", 1, 2)));
+  EXPECT_FALSE(store.lookup(makeKey("file0", 1, 2)));
+}
+
+TEST_F(ContentHashStoreTest, recovers_from_truncated_log) {
+  {
+    ContentHashStore store{root, path, 100};
+    store.record(makeKey("foo", 1, 2), makeHash(1));
+    store.record(makeKey("bar", 1, 2), makeHash(2));
+  }
+  auto size = std::filesystem::file_size(path.c_str());
+  std::filesystem::resize_file(path.c_str(), size - 1);
+
+  {
+    ContentHashStore store{root, path, 100};
+    EXPECT_EQ(makeHash(1), store.lookup(makeKey("foo", 1, 2)));
+    EXPECT_FALSE(store.lookup(makeKey("bar", 1, 2)));
+    // The log was rewritten, so new records are readable
+    EXPECT_EQ(1, store.getStats().compactions);
+    store.record(makeKey("baz", 1, 2), makeHash(3));
+  }
+
+  ContentHashStore store{root, path, 100};
+  EXPECT_EQ(makeHash(3), store.lookup(makeKey("baz", 1, 2)));
+}
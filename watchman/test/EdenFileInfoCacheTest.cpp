@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/watcher/EdenFileInfoCache.h"
+#include <folly/portability/GTest.h>
+
+using namespace watchman;
+
+namespace {
+
+FileInformation makeStat(off_t size) {
+  FileInformation stat;
+  stat.size = size;
+  return stat;
+}
+
+} // namespace
+
+TEST(EdenFileInfoCacheTest, entries_are_kept_until_invalidated) {
+  EdenFileInfoCache cache{100};
+  ClockPosition start{1, 10};
+  cache.reset(start);
+
+  cache.setStat("dir/a", makeStat(1), start);
+  cache.setSha1("dir/a", EdenFileInfoCache::Sha1{1}, start);
+  cache.setDType("dir/b", DType::Regular, start);
+
+  auto a = cache.get("dir/a");
+  ASSERT_TRUE(a);
+  EXPECT_EQ(1, a->stat->size);
+  EXPECT_EQ(1, (*a->sha1)[0]);
+  EXPECT_FALSE(a->dtype);
+  EXPECT_EQ(DType::Regular, *cache.get("dir/b")->dtype);
+  EXPECT_FALSE(cache.get("dir/c"));
+
+  // Nothing changed
+  ClockPosition next{1, 12};
+  cache.invalidate(start, next, {});
+  EXPECT_TRUE(cache.get("dir/a"));
+
+  cache.invalidate(next, ClockPosition{1, 15}, {"dir/a"});
+  EXPECT_FALSE(cache.get("dir/a"));
+  EXPECT_TRUE(cache.get("dir/b"));
+
+  auto stats = cache.getStats();
+  EXPECT_EQ(1, stats.entries);
+  EXPECT_EQ(1, stats.invalidated);
+  EXPECT_EQ(1, stats.resets);
+}
+
+TEST(EdenFileInfoCacheTest, changes_forget_the_tree_and_its_parents) {
+  EdenFileInfoCache cache{100};
+  ClockPosition start{1, 10};
+  cache.reset(start);
+  for (auto name : {"", "a", "a/b", "a/b/c", "a/b/d", "a/bb", "a/b.txt", "e"}) {
+    cache.setStat(name, makeStat(1), start);
+  }
+
+  cache.invalidate(start, ClockPosition{1, 11}, {"a/b"});
+  EXPECT_FALSE(cache.get(""));
+  EXPECT_FALSE(cache.get("a"));
+  EXPECT_FALSE(cache.get("a/b"));
+  EXPECT_FALSE(cache.get("a/b/c"));
+  EXPECT_FALSE(cache.get("a/b/d"));
+  EXPECT_TRUE(cache.get("a/bb"));
+  EXPECT_TRUE(cache.get("a/b.txt"));
+  EXPECT_TRUE(cache.get("e"));
+}
+
+TEST(EdenFileInfoCacheTest, unknown_changes_empty_the_cache) {
+  EdenFileInfoCache cache{100};
+  ClockPosition start{1, 10};
+  cache.reset(start);
+  cache.setStat("a", makeStat(1), start);
+
+  // A gap between the cache's position and the changes
+  cache.invalidate(ClockPosition{1, 11}, ClockPosition{1, 12}, {});
+  EXPECT_FALSE(cache.get("a"));
+
+  cache.setStat("a", makeStat(1), ClockPosition{1, 12});
+  EXPECT_TRUE(cache.get("a"));
+
+  // A new mount generation
+  cache.invalidate(ClockPosition{2, 1}, ClockPosition{2, 2}, {});
+  EXPECT_FALSE(cache.get("a"));
+}
+
+TEST(EdenFileInfoCacheTest, stale_fetches_are_dropped) {
+  EdenFileInfoCache cache{100};
+  ClockPosition start{1, 10};
+  cache.reset(start);
+
+  // Another query moved the cache on while this one was fetching
+  cache.invalidate(start, ClockPosition{1, 11}, {"a"});
+  cache.setStat("a", makeStat(1), start);
+  EXPECT_FALSE(cache.get("a"));
+
+  // Moving back is ignored
+  cache.invalidate(start, start, {});
+  EXPECT_EQ(11, cache.position()->ticks);
+}
+
+TEST(EdenFileInfoCacheTest, full_cache_is_emptied) {
+  EdenFileInfoCache cache{2};
+  ClockPosition start{1, 10};
+  cache.reset(start);
+  cache.setStat("a", makeStat(1), start);
+  cache.setStat("b", makeStat(1), start);
+  cache.setSha1("b", EdenFileInfoCache::Sha1{}, start);
+  EXPECT_EQ(2, cache.getStats().entries);
+
+  cache.setStat("c", makeStat(1), start);
+  EXPECT_EQ(1, cache.getStats().entries);
+  EXPECT_TRUE(cache.get("c"));
+}
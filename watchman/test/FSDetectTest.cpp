@@ -132,3 +132,28 @@ TEST(FSType, fstype_two_entries) {
       find_fstype_in_linux_proc_mounts(
           "/data/users/wez/fbsourcenoslash", mount_data_btrfs));
 }
+
+TEST(FSType, maintains_dir_mtimes) {
+  EXPECT_TRUE(fs_type_maintains_dir_mtimes("btrfs"));
+  EXPECT_TRUE(fs_type_maintains_dir_mtimes("ext4"));
+  EXPECT_TRUE(fs_type_maintains_dir_mtimes("apfs"));
+  EXPECT_TRUE(fs_type_maintains_dir_mtimes("NTFS"));
+  EXPECT_FALSE(fs_type_maintains_dir_mtimes("nfs"));
+  EXPECT_FALSE(fs_type_maintains_dir_mtimes("cifs"));
+  EXPECT_FALSE(fs_type_maintains_dir_mtimes("fuse"));
+  EXPECT_FALSE(fs_type_maintains_dir_mtimes("fuse.squashfuse_ll"));
+  EXPECT_FALSE(fs_type_maintains_dir_mtimes("edenfs:abc"));
+  EXPECT_FALSE(fs_type_maintains_dir_mtimes("unknown"));
+}
+
+TEST(FSType, is_network_fs_type) {
+  EXPECT_TRUE(is_network_fs_type("nfs"));
+  EXPECT_TRUE(is_network_fs_type("nfs4"));
+  EXPECT_TRUE(is_network_fs_type("cifs"));
+  EXPECT_TRUE(is_network_fs_type("9p"));
+  EXPECT_FALSE(is_network_fs_type("ext4"));
+  EXPECT_FALSE(is_network_fs_type("apfs"));
+  EXPECT_FALSE(is_network_fs_type("fuse"));
+  EXPECT_FALSE(is_network_fs_type("edenfs:abc"));
+  EXPECT_FALSE(is_network_fs_type("unknown"));
+}
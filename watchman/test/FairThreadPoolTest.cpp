@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/FairThreadPool.h"
+#include <folly/portability/GTest.h>
+#include <future>
+#include <string>
+
+using namespace watchman;
+
+TEST(FairThreadPool, queues_take_turns) {
+  FairThreadPool pool;
+  pool.start(1, 1024);
+
+  // Hold the only worker so that everything below is queued up before
+  // any of it runs.
+  std::promise<void> release;
+  auto released = release.get_future().share();
+  auto blocker = pool.makeQueue();
+  blocker->add([released] { released.wait(); });
+
+  std::mutex mutex;
+  std::string order;
+  auto record = [&](char c) {
+    return [&, c] {
+      std::lock_guard<std::mutex> lock(mutex);
+      order.push_back(c);
+    };
+  };
+
+  auto big = pool.makeQueue();
+  auto small = pool.makeQueue();
+  for (int i = 0; i < 4; ++i) {
+    big->add(record('b'));
+  }
+  small->add(record('s'));
+  small->add(record('s'));
+
+  release.set_value();
+  pool.stop();
+
+  EXPECT_EQ("bsbsbb", order);
+}
+
+TEST(FairThreadPool, bounds_queued_tasks) {
+  FairThreadPool pool;
+  pool.start(1, 3);
+
+  std::promise<void> started;
+  std::promise<void> release;
+  auto released = release.get_future().share();
+  auto queue = pool.makeQueue();
+  auto other = pool.makeQueue();
+  queue->add([&started, released] {
+    started.set_value();
+    released.wait();
+  });
+  // A running task no longer counts against the limit
+  started.get_future().wait();
+  queue->add([] {});
+  other->add([] {});
+  // The limit applies across all of the queues
+  EXPECT_THROW(other->add([] {}), std::runtime_error);
+
+  release.set_value();
+  pool.stop();
+  EXPECT_THROW(queue->add([] {}), std::runtime_error);
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/scm/GitIndex.h"
+#include <folly/portability/GTest.h>
+#include <string>
+
+using namespace watchman;
+
+namespace {
+
+struct TestEntry {
+  std::string name;
+  uint32_t mtime;
+  uint32_t size;
+  uint32_t mode{0100644};
+  uint16_t stage{0};
+  uint8_t idByte;
+};
+
+void put16(std::string& out, uint16_t value) {
+  out.push_back(char(value >> 8));
+  out.push_back(char(value));
+}
+
+void put32(std::string& out, uint32_t value) {
+  put16(out, uint16_t(value >> 16));
+  put16(out, uint16_t(value));
+}
+
+// Builds an index in the format that git writes
+std::string makeIndex(uint32_t version, const std::vector<TestEntry>& entries) {
+  std::string out = "DIRC";
+  put32(out, version);
+  put32(out, uint32_t(entries.size()));
+  std::string previous;
+  for (auto& entry : entries) {
+    auto start = out.size();
+    put32(out, entry.mtime); // ctime
+    put32(out, 0);
+    put32(out, entry.mtime);
+    put32(out, 0);
+    put32(out, 1); // dev
+    put32(out, 0); // ino
+    put32(out, entry.mode);
+    put32(out, 0); // uid
+    put32(out, 0); // gid
+    put32(out, entry.size);
+    out.append(20, char(entry.idByte));
+    put16(out, uint16_t((entry.stage << 12) | entry.name.size()));
+    if (version == 4) {
+      // Strip the whole of the previous name; a single byte varint
+      out.push_back(char(previous.size()));
+      out.append(entry.name);
+      out.push_back('\0');
+      previous = entry.name;
+    } else {
+      out.append(entry.name);
+      auto length = out.size() - start;
+      out.append(8 - (length % 8), '\0');
+    }
+  }
+  return out;
+}
+
+FileInformation fileInfo(uint32_t mtime, uint32_t size) {
+  FileInformation info;
+  info.mode = S_IFREG | 0644;
+  info.mtime.tv_sec = mtime;
+  info.mtime.tv_nsec = 0;
+  info.size = size;
+  return info;
+}
+
+GitIndex::BlobId blobId(uint8_t byte) {
+  GitIndex::BlobId id;
+  id.fill(byte);
+  return id;
+}
+
+} // namespace
+
+TEST(GitIndex, finds_unchanged_files) {
+  for (uint32_t version : {2, 3, 4}) {
+    GitIndex index{
+        makeIndex(
+            version,
+            {{"a.txt", 100, 5, 0100644, 0, 1},
+             {"dir/b.txt", 100, 7, 0100644, 0, 2},
+             {"dir/conflict", 100, 7, 0100644, 2, 3},
+             {"submodule", 100, 0, 0160000, 0, 4}}),
+        timespec{200, 0}};
+    EXPECT_EQ(2, index.size()) << "version " << version;
+
+    EXPECT_EQ(blobId(1), index.lookup("a.txt", fileInfo(100, 5)));
+    EXPECT_EQ(blobId(2), index.lookup("dir/b.txt", fileInfo(100, 7)));
+    // Changed since git hashed it
+    EXPECT_FALSE(index.lookup("a.txt", fileInfo(101, 5)));
+    EXPECT_FALSE(index.lookup("a.txt", fileInfo(100, 6)));
+    EXPECT_FALSE(index.lookup("untracked", fileInfo(100, 5)));
+  }
+}
+
+TEST(GitIndex, racily_clean_entries_are_not_trusted) {
+  GitIndex index{
+      makeIndex(2, {{"a.txt", 100, 5, 0100644, 0, 1}}), timespec{100, 5}};
+  EXPECT_FALSE(index.lookup("a.txt", fileInfo(100, 5)));
+}
+
+TEST(GitIndex, rejects_malformed_data) {
+  EXPECT_THROW(GitIndex("DIRX", timespec{}), std::runtime_error);
+  auto data = makeIndex(2, {{"a.txt", 100, 5, 0100644, 0, 1}});
+  data.resize(data.size() - 12);
+  EXPECT_THROW(GitIndex(data, timespec{}), std::runtime_error);
+}
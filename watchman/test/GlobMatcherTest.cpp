@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/GlobMatcher.h"
+#include <folly/portability/GTest.h>
+#include <string>
+#include <vector>
+#include "watchman/thirdparty/wildmatch/wildmatch.h"
+
+using namespace watchman;
+
+namespace {
+
+using Shape = GlobMatcher::Shape;
+
+// Every string of up to maxLength characters from a small alphabet that
+// exercises case folding, periods and slashes
+std::vector<std::string> allTexts(size_t maxLength) {
+  std::vector<std::string> texts{""};
+  for (size_t start = 0; start < texts.size(); ++start) {
+    if (texts[start].size() == maxLength) {
+      continue;
+    }
+    for (char c : {'a', 'B', '.', '/'}) {
+      texts.push_back(texts[start] + c);
+    }
+  }
+  return texts;
+}
+
+} // namespace
+
+TEST(GlobMatcher, classifies_common_shapes) {
+  struct Case {
+    const char* pattern;
+    int flags;
+    Shape shape;
+    bool underDoublestar;
+  };
+  for (auto& c : std::vector<Case>{
+           {"BUCK", 0, Shape::Literal, false},
+           {"src/main.cpp", WM_PATHNAME, Shape::Literal, false},
+           {"*.cpp", 0, Shape::Suffix, false},
+           {"test_*", 0, Shape::Prefix, false},
+           {"src/*", WM_PATHNAME, Shape::Prefix, false},
+           {"src/**", WM_PATHNAME, Shape::Prefix, false},
+           {"**/*.cpp", WM_PATHNAME, Shape::Suffix, true},
+           {"**/BUCK", WM_PATHNAME, Shape::Literal, true},
+           {"**/*", WM_PATHNAME, Shape::Prefix, true},
+           // "**" is just a star without WM_PATHNAME
+           {"**/*.cpp", 0, Shape::General, false},
+           {"src/**/*.cpp", WM_PATHNAME, Shape::General, false},
+           {"*.[ch]", 0, Shape::General, false},
+           {"src**", WM_PATHNAME, Shape::General, false},
+           {"a//b", WM_PATHNAME, Shape::General, false},
+           {"\\*.cpp", 0, Shape::General, false},
+       }) {
+    GlobMatcher matcher{c.pattern, c.flags};
+    EXPECT_EQ(matcher.shape(), c.shape) << c.pattern;
+    EXPECT_EQ(matcher.isUnderDoublestar(), c.underDoublestar) << c.pattern;
+  }
+}
+
+TEST(GlobMatcher, agrees_with_wildmatch) {
+  const char* const patterns[] = {
+      "",     "a",      "a.B",     ".a",    "a/",    "a/B",  "/a",
+      "*",    "**",     "***",     "a*",    "a/*",   "a/**", ".*",
+      "B**",  "*a",     "*.a",     "*/a",   "*a*",   "a?",   "[a.]*",
+      "**/",  "**/a",   "**/*",    "**/*.a", "**/.a", "**/a*", "**/.*",
+      "**/**", "**/a/*", "a/**/B", "a//B",  "A",     "*A",   "**/*A",
+  };
+  auto texts = allTexts(5);
+  for (int flags = 0; flags < 16; ++flags) {
+    for (auto pattern : patterns) {
+      GlobMatcher matcher{pattern, flags};
+      for (auto& text : texts) {
+        bool expected =
+            wildmatch(pattern, text.c_str(), flags, nullptr) == WM_MATCH;
+        ASSERT_EQ(matcher.matches(text), expected)
+            << "pattern [" << pattern << "] text [" << text << "] flags "
+            << flags;
+      }
+    }
+  }
+}
+
+TEST(GlobMatcher, folded_text_compares_directly) {
+  GlobMatcher matcher{"*.CPP", WM_CASEFOLD};
+  EXPECT_TRUE(matcher.matches("main.cpp", true));
+  EXPECT_TRUE(matcher.matches("MAIN.Cpp"));
+  // The caller promised folded text, so no folding is done
+  EXPECT_FALSE(matcher.matches("main.Cpp", true));
+}
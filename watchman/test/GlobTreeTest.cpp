@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/GlobTree.h"
+#include <folly/portability/GTest.h>
+#include <cstring>
+
+using namespace watchman;
+
+namespace {
+
+std::unique_ptr<GlobTree> node(const char* pattern) {
+  return std::make_unique<GlobTree>(pattern, uint32_t(strlen(pattern)));
+}
+
+std::vector<std::string> candidates(
+    const GlobPatternIndex& index,
+    std::string_view name) {
+  std::vector<std::string> result;
+  index.forEachCandidate(name, [&](const GlobTree* child) {
+    result.push_back(child->pattern);
+    return true;
+  });
+  return result;
+}
+
+} // namespace
+
+TEST(GlobTree, index_groups_patterns_by_extension) {
+  std::vector<std::unique_ptr<GlobTree>> nodes;
+  GlobPatternIndex index;
+  for (auto pattern : {"*.cpp", "*.H", "foo", "*", "[a.]*", "\\*.txt"}) {
+    nodes.push_back(node(pattern));
+    index.add(nodes.back().get());
+  }
+
+  using V = std::vector<std::string>;
+  EXPECT_EQ(candidates(index, "main.cpp"), (V{"*.cpp", "foo", "*", "[a.]*"}));
+  // Extensions are compared without regard to case
+  EXPECT_EQ(candidates(index, "a.h"), (V{"*.H", "foo", "*", "[a.]*"}));
+  EXPECT_EQ(candidates(index, "Makefile"), (V{"foo", "*", "[a.]*"}));
+  EXPECT_EQ(candidates(index, "a.txt"), (V{"\\*.txt", "foo", "*", "[a.]*"}));
+}
+
+TEST(GlobTree, index_stops_when_asked) {
+  auto a = node("*.c");
+  auto b = node("*");
+  GlobPatternIndex index;
+  EXPECT_TRUE(index.empty());
+  index.add(a.get());
+  index.add(b.get());
+  EXPECT_FALSE(index.empty());
+
+  size_t calls = 0;
+  index.forEachCandidate("x.c", [&](const GlobTree*) {
+    ++calls;
+    return false;
+  });
+  EXPECT_EQ(calls, 1);
+}
+
+TEST(GlobTree, build_indexes_covers_descendants) {
+  GlobTree root("", 0);
+  root.children.push_back(node("src"));
+  auto& src = root.children.back();
+  src->children.push_back(node("*.rs"));
+  src->doublestar_children.push_back(node("**/*.py"));
+  src->doublestar_children.back()->is_doublestar = true;
+  root.buildIndexes(0);
+
+  using V = std::vector<std::string>;
+  EXPECT_EQ(candidates(root.children_index, "src"), (V{"src"}));
+  EXPECT_EQ(candidates(src->children_index, "lib.rs"), (V{"*.rs"}));
+  EXPECT_EQ(candidates(src->children_index, "lib.py"), V{});
+  EXPECT_EQ(candidates(src->doublestar_index, "a/b.py"), (V{"**/*.py"}));
+
+  // Doublestar patterns are compiled to match whole relative paths
+  EXPECT_TRUE(src->children[0]->matcher.matches("lib.rs"));
+  EXPECT_TRUE(src->doublestar_children[0]->matcher.matches("a/b.py"));
+  EXPECT_TRUE(src->doublestar_children[0]->matcher.matches("b.py"));
+  EXPECT_FALSE(src->doublestar_children[0]->matcher.matches("a/b.pyc"));
+}
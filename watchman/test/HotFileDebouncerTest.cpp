@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/HotFileDebouncer.h"
+#include <folly/portability/GTest.h>
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+namespace {
+
+PendingChange change(const char* path, PendingFlags flags = {}) {
+  return PendingChange{
+      w_string{path}, std::chrono::system_clock::now(), flags};
+}
+
+class HotFileDebouncerTest : public testing::Test {
+ protected:
+  HotFileDebouncer debouncer{100ms};
+  HotFileDebouncer::Clock::time_point start{
+      HotFileDebouncer::Clock::now()};
+};
+
+} // namespace
+
+TEST_F(HotFileDebouncerTest, first_change_is_admitted) {
+  EXPECT_TRUE(debouncer.admit(change("a"), start));
+  EXPECT_TRUE(debouncer.admit(change("b"), start));
+  EXPECT_EQ(0, debouncer.heldCount());
+  EXPECT_FALSE(debouncer.nextDue().has_value());
+}
+
+TEST_F(HotFileDebouncerTest, repeated_changes_are_coalesced) {
+  EXPECT_TRUE(debouncer.admit(change("log"), start));
+  EXPECT_FALSE(
+      debouncer.admit(change("log", W_PENDING_VIA_NOTIFY), start + 10ms));
+  EXPECT_FALSE(
+      debouncer.admit(change("log", W_PENDING_RECURSIVE), start + 20ms));
+  EXPECT_EQ(1, debouncer.heldCount());
+  EXPECT_EQ(2, debouncer.debouncedCount());
+  ASSERT_TRUE(debouncer.nextDue().has_value());
+  EXPECT_EQ(start + 100ms, *debouncer.nextDue());
+
+  EXPECT_TRUE(debouncer.takeDue(start + 50ms).empty());
+
+  auto due = debouncer.takeDue(start + 100ms);
+  ASSERT_EQ(1, due.size());
+  EXPECT_EQ(w_string{"log"}, due[0].path);
+  EXPECT_TRUE(due[0].flags & W_PENDING_VIA_NOTIFY);
+  EXPECT_TRUE(due[0].flags & W_PENDING_RECURSIVE);
+  EXPECT_EQ(0, debouncer.heldCount());
+
+  // The released change goes through, and starts another window
+  EXPECT_TRUE(debouncer.admit(due[0], start + 100ms));
+  EXPECT_FALSE(debouncer.admit(change("log"), start + 150ms));
+  EXPECT_EQ(1, debouncer.takeDue(start + 200ms).size());
+}
+
+TEST_F(HotFileDebouncerTest, change_after_the_window_is_admitted) {
+  EXPECT_TRUE(debouncer.admit(change("log"), start));
+  EXPECT_FALSE(debouncer.admit(change("log"), start + 10ms));
+  // Stat'ing it now covers the held change too
+  EXPECT_TRUE(debouncer.admit(change("log"), start + 100ms));
+  EXPECT_EQ(0, debouncer.heldCount());
+  EXPECT_TRUE(debouncer.takeDue(start + 200ms).empty());
+}
+
+TEST_F(HotFileDebouncerTest, take_all_releases_everything) {
+  EXPECT_TRUE(debouncer.admit(change("a"), start));
+  EXPECT_TRUE(debouncer.admit(change("b"), start));
+  EXPECT_FALSE(debouncer.admit(change("a"), start + 1ms));
+  EXPECT_FALSE(debouncer.admit(change("b"), start + 1ms));
+  EXPECT_EQ(2, debouncer.takeAll(start + 2ms).size());
+  EXPECT_EQ(0, debouncer.heldCount());
+  EXPECT_FALSE(debouncer.nextDue().has_value());
+}
+
+TEST_F(HotFileDebouncerTest, quiet_files_are_forgotten) {
+  EXPECT_TRUE(debouncer.admit(change("a"), start));
+  EXPECT_TRUE(debouncer.admit(change("b"), start + 50ms));
+  EXPECT_EQ(2, debouncer.trackedCount());
+  debouncer.takeDue(start + 100ms);
+  EXPECT_EQ(1, debouncer.trackedCount());
+  debouncer.takeDue(start + 200ms);
+  EXPECT_EQ(0, debouncer.trackedCount());
+}
+
+TEST_F(HotFileDebouncerTest, clear_drops_held_changes) {
+  EXPECT_TRUE(debouncer.admit(change("a"), start));
+  EXPECT_FALSE(debouncer.admit(change("a"), start + 1ms));
+  debouncer.clear();
+  EXPECT_EQ(0, debouncer.heldCount());
+  EXPECT_EQ(0, debouncer.trackedCount());
+  EXPECT_TRUE(debouncer.admit(change("a"), start + 2ms));
+}
@@ -107,6 +107,45 @@ TEST(Ignore, correctness) {
   run_correctness_test(&state, tests, sizeof(tests) / sizeof(tests[0]));
 }
 
+TEST(Ignore, globs) {
+  IgnoreSet state;
+  init_state(&state);
+  for (auto glob : {"**/node_modules", "gen/*/out", "**/*.tmp", "plain"}) {
+    state.addGlob(w_string{"root"}, w_string{glob, W_STRING_UNICODE});
+  }
+
+  static const struct test_case tests[] = {
+      {"root/node_modules", true},
+      {"root/a/b/node_modules", true},
+      {"root/a/node_modules/lib/index.js", true},
+      {"root/a/node_modules_cache", false},
+      {"root/a/my_node_modules/x", false},
+      {"root/gen/x/out", true},
+      {"root/gen/x/out/file", true},
+      {"root/gen/x/y/out", false},
+      {"root/gen/out", false},
+      {"root/a/b.tmp", true},
+      {"root/a/b.tmp/c", true},
+      {"root/a/b.tmpl", false},
+      {"root/plain", true},
+      {"root/plain/x", true},
+      {"root/plainly", false},
+      {"node_modules", false},
+      {"other/node_modules", false},
+      {"build/lower", true},
+  };
+  run_correctness_test(&state, tests, std::size(tests));
+
+  // isIgnoreDir only considers the path itself; the crawl never reaches
+  // the descendants of an ignored dir.
+  EXPECT_TRUE(state.isIgnoreDir("root/a/node_modules"));
+  EXPECT_FALSE(state.isIgnoreDir("root/a/node_modules/lib"));
+  EXPECT_TRUE(state.isIgnoreDir("root/gen/x/out"));
+  EXPECT_TRUE(state.isIgnoreDir("root/plain"));
+  EXPECT_FALSE(state.isIgnoreDir("root/a"));
+  EXPECT_TRUE(state.isIgnoreDir("build"));
+}
+
 // Load up the words data file and build a list of strings from that list.
 // Each of those strings is prefixed with the supplied string.
 // If there are fewer than limit entries available in the data file, we will
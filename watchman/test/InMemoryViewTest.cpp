@@ -6,12 +6,19 @@
  */
 
 #include "watchman/InMemoryView.h"
+#include <fmt/core.h>
 #include <folly/executors/ManualExecutor.h>
 #include <folly/portability/GTest.h>
+#include <algorithm>
+#include <limits>
+#include "watchman/Errors.h"
+#include "watchman/PerfSample.h"
 #include "watchman/fs/FSDetect.h"
 #include "watchman/query/GlobTree.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/QueryContext.h"
+#include "watchman/query/eval.h"
+#include "watchman/query/parse.h"
 #include "watchman/root/Root.h"
 #include "watchman/test/lib/FakeFileSystem.h"
 #include "watchman/test/lib/FakeWatcher.h"
@@ -81,6 +88,321 @@ TEST_P(InMemoryViewTest, drive_initial_crawl) {
   EXPECT_STREQ("dir/file.txt", ctx.resultsArray.at(1).asCString());
 }
 
+TEST_P(InMemoryViewTest, initial_crawl_links_every_file_into_recency_index) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a/one.txt",
+      FAKEFS_ROOT "root/a/two.txt",
+      FAKEFS_ROOT "root/a/b/three.txt",
+      FAKEFS_ROOT "root/c/four.txt",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  auto& viewdb = view->unsafeAccessViewDatabase();
+  size_t count = 0;
+  viewdb.getRecencyIndex().forEachNewestFirst([&](watchman_file* file) {
+    EXPECT_NE(nullptr, file->recencySlot);
+    EXPECT_EQ(file, *file->recencySlot);
+    ++count;
+    return true;
+  });
+  // a, a/b, c and the four files
+  EXPECT_EQ(7, count);
+}
+
+TEST_P(InMemoryViewTest, crawled_files_are_spliced_into_recency_index_in_order) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a/one.txt",
+      FAKEFS_ROOT "root/c/four.txt",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+  auto beforeCrawl = view->getMostRecentRootNumberAndTickValue();
+
+  fs.defineContents({
+      FAKEFS_ROOT "root/c/five.txt",
+      FAKEFS_ROOT "root/c/d/six.txt",
+  });
+  pending.lock()->add(
+      FAKEFS_ROOT "root/c", {}, W_PENDING_VIA_NOTIFY | W_PENDING_RECURSIVE);
+  pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  auto& viewdb = view->unsafeAccessViewDatabase();
+  std::vector<std::string> crawled;
+  ClockTicks lastTicks = std::numeric_limits<ClockTicks>::max();
+  size_t count = 0;
+  viewdb.getRecencyIndex().forEachNewestFirst([&](watchman_file* file) {
+    EXPECT_NE(nullptr, file->recencySlot);
+    EXPECT_EQ(file, *file->recencySlot);
+    // Newest first, with the files of the crawl as new as its changes
+    EXPECT_LE(file->otime.ticks, lastTicks);
+    lastTicks = file->otime.ticks;
+    if (file->otime.ticks > beforeCrawl.ticks) {
+      crawled.push_back(file->getName().string());
+    }
+    ++count;
+    return true;
+  });
+  // a, c, c/d and the four files
+  EXPECT_EQ(7, count);
+  std::sort(crawled.begin(), crawled.end());
+  for (auto name : {"d", "five.txt", "six.txt"}) {
+    EXPECT_TRUE(std::binary_search(crawled.begin(), crawled.end(), name))
+        << name;
+  }
+}
+
+TEST_P(InMemoryViewTest, parallel_all_files_query_matches_serial_order) {
+  // Enough files for the recency index to span several chunks
+  for (size_t i = 0; i < 3 * RecencyIndex::kChunkSize; ++i) {
+    fs.addNode(
+        fmt::format(FAKEFS_ROOT "root/{}/f{}.txt", i % 2 ? "odd" : "even", i)
+            .c_str(),
+        fs.fakeFile());
+  }
+
+  json_ref json = json_object();
+  json_object_set(json, "enable_parallel_crawl", json_boolean(GetParam()));
+  json_object_set(json, "query_parallelism", json_integer(4));
+  json_object_set(json, "query_parallel_min_files", json_integer(0));
+  Configuration parallelConfig{std::move(json)};
+  auto parallelView =
+      std::make_shared<InMemoryView>(fs, root_path, parallelConfig, watcher);
+  auto& parallelPending = parallelView->unsafeAccessPendingFromWatcher();
+  parallelPending.lock()->ping();
+
+  auto root = std::make_shared<Root>(
+      fs,
+      root_path,
+      "fs_type",
+      w_string_to_json("{}"),
+      parallelConfig,
+      parallelView,
+      [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(
+      Continue::Continue,
+      parallelView->stepIoThread(root, state, parallelPending));
+
+  auto oddDir = w_string::pathCat({root_path, "odd"});
+  std::vector<w_string> expected;
+  parallelView->unsafeAccessViewDatabase().getRecencyIndex().forEachNewestFirst(
+      [&](watchman_file* file) {
+        if (file->parent->getFullPath() == oddDir) {
+          expected.push_back(w_string::build("odd/", file->getName()));
+        }
+        return true;
+      });
+  ASSERT_EQ(3 * RecencyIndex::kChunkSize / 2, expected.size());
+
+  // A relative_root would be walked as a subtree, so filter by expression
+  auto query = parseQuery(
+      root,
+      json_object(
+          {{"expression",
+            json_array(
+                {typed_string_to_json("dirname"),
+                 typed_string_to_json("odd")})},
+           {"fields", json_array({w_string_to_json("name")})},
+           {"dedup_results", json_true()}}));
+
+  QueryContext ctx{query.get(), root, false};
+  parallelView->allFilesGenerator(query.get(), &ctx);
+
+  ASSERT_EQ(expected.size(), ctx.resultsArray.size());
+  for (size_t i = 0; i < expected.size(); ++i) {
+    EXPECT_EQ(expected[i], ctx.resultsArray.at(i).asString());
+  }
+  EXPECT_EQ(expected.size(), ctx.dedup.size());
+  // Every file and directory in the view was considered
+  EXPECT_EQ(3 * RecencyIndex::kChunkSize + 2, ctx.getNumWalked());
+}
+
+TEST_P(InMemoryViewTest, suffix_generator_uses_suffix_index) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a.js",
+      FAKEFS_ROOT "root/dir/B.JS",
+      FAKEFS_ROOT "root/dir/c.ts",
+      FAKEFS_ROOT "root/dir/sub/d.js",
+      FAKEFS_ROOT "root/dir/sub/e.css",
+  });
+
+  json_ref json = json_object();
+  json_object_set(json, "enable_parallel_crawl", json_boolean(GetParam()));
+  json_object_set(json, "suffix_index", json_true());
+  Configuration indexConfig{std::move(json)};
+  auto indexView =
+      std::make_shared<InMemoryView>(fs, root_path, indexConfig, watcher);
+  auto& indexPending = indexView->unsafeAccessPendingFromWatcher();
+  indexPending.lock()->ping();
+
+  auto root = std::make_shared<Root>(
+      fs,
+      root_path,
+      "fs_type",
+      w_string_to_json("{}"),
+      indexConfig,
+      indexView,
+      [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(
+      Continue::Continue, indexView->stepIoThread(root, state, indexPending));
+
+  auto index = indexView->unsafeAccessViewDatabase().getSuffixIndex();
+  ASSERT_NE(nullptr, index);
+  // a.js, B.JS, c.ts, d.js and e.css
+  EXPECT_EQ(5, index->getStats().files);
+
+  auto runQuery = [&](int64_t expectedWalked) {
+    auto query = parseQuery(
+        root,
+        json_object(
+            {{"suffix", json_array({w_string_to_json("js")})},
+             {"fields", json_array({w_string_to_json("name")})}}));
+    QueryContext ctx{query.get(), root, false};
+    indexView->globGenerator(query.get(), &ctx);
+    std::vector<std::string> names;
+    for (auto& name : ctx.resultsArray) {
+      names.push_back(name.asString().string());
+    }
+    std::sort(names.begin(), names.end());
+    // Only the js files were considered
+    EXPECT_EQ(expectedWalked, ctx.getNumWalked());
+    return names;
+  };
+
+  EXPECT_EQ(
+      (std::vector<std::string>{"a.js", "dir/B.JS", "dir/sub/d.js"}),
+      runQuery(3));
+
+  // Files in deleted dirs are no longer matched, like the glob walk
+  fs.removeRecursively(FAKEFS_ROOT "root/dir/sub");
+  indexPending.lock()->add(
+      FAKEFS_ROOT "root/dir/sub",
+      {},
+      W_PENDING_VIA_NOTIFY | W_PENDING_NONRECURSIVE_SCAN);
+  indexPending.lock()->ping();
+  EXPECT_EQ(
+      Continue::Continue, indexView->stepIoThread(root, state, indexPending));
+
+  EXPECT_EQ((std::vector<std::string>{"a.js", "dir/B.JS"}), runQuery(3));
+}
+
+TEST_P(InMemoryViewTest, query_result_cache_reevaluates_changed_files) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a.txt",
+      FAKEFS_ROOT "root/dir/b.txt",
+      FAKEFS_ROOT "root/dir/c.txt",
+  });
+
+  json_ref json = json_object();
+  json_object_set(json, "enable_parallel_crawl", json_boolean(GetParam()));
+  json_object_set(json, "query_result_cache_size", json_integer(4));
+  Configuration cacheConfig{std::move(json)};
+  auto cacheView =
+      std::make_shared<InMemoryView>(fs, root_path, cacheConfig, watcher);
+  auto& cachePending = cacheView->unsafeAccessPendingFromWatcher();
+  cachePending.lock()->ping();
+
+  auto root = std::make_shared<Root>(
+      fs,
+      root_path,
+      "fs_type",
+      w_string_to_json("{}"),
+      cacheConfig,
+      cacheView,
+      [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(
+      Continue::Continue, cacheView->stepIoThread(root, state, cachePending));
+
+  auto runQuery = [&](const char* requestId) {
+    auto query = parseQuery(
+        root,
+        json_object(
+            {{"expression",
+              json_array(
+                  {typed_string_to_json("type"), typed_string_to_json("f")})},
+             {"fields", json_array({w_string_to_json("name")})},
+             {"request_id", typed_string_to_json(requestId)},
+             {"sync_timeout", json_integer(0)}}));
+    auto res = w_query_execute(query.get(), root, nullptr, nullptr);
+    EXPECT_TRUE(res.isFreshInstance);
+    std::vector<std::string> names;
+    for (auto& name : res.resultsArray.results) {
+      names.push_back(name.asString().string());
+    }
+    std::sort(names.begin(), names.end());
+    return names;
+  };
+
+  EXPECT_EQ(
+      (std::vector<std::string>{"a.txt", "dir/b.txt", "dir/c.txt"}),
+      runQuery("1"));
+  auto& cache = cacheView->getQueryResultCache();
+  EXPECT_EQ(0, cache.getStats().hits);
+  EXPECT_EQ(1, cache.getStats().misses);
+
+  // The request id doesn't change the results, so this is a hit
+  EXPECT_EQ(
+      (std::vector<std::string>{"a.txt", "dir/b.txt", "dir/c.txt"}),
+      runQuery("2"));
+  EXPECT_EQ(1, cache.getStats().hits);
+
+  // Removed files drop out of the cached results and new ones are added
+  fs.removeRecursively(FAKEFS_ROOT "root/dir/b.txt");
+  fs.defineContents({FAKEFS_ROOT "root/dir/d.txt"});
+  cachePending.lock()->add(
+      FAKEFS_ROOT "root/dir/b.txt", {}, W_PENDING_VIA_NOTIFY);
+  cachePending.lock()->add(
+      FAKEFS_ROOT "root/dir/d.txt", {}, W_PENDING_VIA_NOTIFY);
+  cachePending.lock()->ping();
+  EXPECT_EQ(
+      Continue::Continue, cacheView->stepIoThread(root, state, cachePending));
+
+  EXPECT_EQ(
+      (std::vector<std::string>{"a.txt", "dir/c.txt", "dir/d.txt"}),
+      runQuery("3"));
+  EXPECT_EQ(2, cache.getStats().hits);
+  EXPECT_EQ(1, cache.getStats().entries);
+}
+
+TEST_P(InMemoryViewTest, query_stops_once_client_hangs_up) {
+  for (int i = 0; i < 1000; ++i) {
+    fs.addNode(
+        fmt::format(FAKEFS_ROOT "root/f{}.txt", i).c_str(), fs.fakeFile());
+  }
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  // The client is still there for the first check, and gone by the second
+  int checks = 0;
+  Query query;
+  query.fieldList.add("name");
+  query.clientGone = [&] { return ++checks > 1; };
+
+  QueryContext ctx{&query, root, false};
+  EXPECT_THROW(view->allFilesGenerator(&query, &ctx), QueryExecError);
+  EXPECT_EQ(2, checks);
+  EXPECT_LT(ctx.numResults(), 1000);
+}
+
 TEST_P(InMemoryViewTest, respond_to_watcher_events) {
   getLog().setStdErrLoggingLevel(DBG);
 
@@ -269,7 +591,7 @@ TEST_P(
     const auto& viewdb = view->unsafeAccessViewDatabase();
     auto* dir = viewdb.resolveDir(FAKEFS_ROOT "root");
     auto* file = dir->getChildFile("file.txt");
-    return file->stat.size;
+    return file->stat.size();
   });
 
   // Have Watcher publish change to "/root" but this watcher does not have
@@ -350,7 +672,7 @@ TEST_P(
     const auto& viewdb = view->unsafeAccessViewDatabase();
     auto* dir = viewdb.resolveDir(FAKEFS_ROOT "root/dir");
     auto* file = dir->getChildFile("file.txt");
-    return file->stat.size;
+    return file->stat.size();
   });
 
   // Have Watcher publish its change events but this watcher does not have
@@ -416,7 +738,7 @@ TEST_P(
     const auto& viewdb = view->unsafeAccessViewDatabase();
     auto* dir = viewdb.resolveDir(FAKEFS_ROOT "root/dir");
     auto* file = dir->getChildFile("file.txt");
-    EXPECT_EQ(100, file->stat.size);
+    EXPECT_EQ(100, file->stat.size());
   });
 
   executor.drain();
@@ -524,6 +846,558 @@ TEST_P(InMemoryViewTest, directory_removal_does_not_report_parent) {
   // notification from the watcher for that directory.
 }
 
+TEST_P(
+    InMemoryViewTest,
+    relative_root_since_query_skips_unchanged_subtrees) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/top/a/x.txt",
+      FAKEFS_ROOT "root/top/b/y.txt",
+      FAKEFS_ROOT "root/other/1.txt",
+      FAKEFS_ROOT "root/other/2.txt",
+      FAKEFS_ROOT "root/other/3.txt",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  auto beforeChanges = view->getMostRecentRootNumberAndTickValue();
+
+  // The changes outside of top make the change log longer than the changed
+  // parts of top, so that the subtree is walked
+  for (auto path :
+       {FAKEFS_ROOT "root/top/b/y.txt",
+        FAKEFS_ROOT "root/other/1.txt",
+        FAKEFS_ROOT "root/other/2.txt",
+        FAKEFS_ROOT "root/other/3.txt"}) {
+    fs.updateMetadata(path, [&](FileInformation& fi) { fi.size = 100; });
+    pending.lock()->add(path, {}, W_PENDING_VIA_NOTIFY);
+  }
+  pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  auto& db = view->unsafeAccessViewDatabase();
+  auto changed = db.resolveDir(w_string{FAKEFS_ROOT "root/top/b"});
+  auto unchanged = db.resolveDir(w_string{FAKEFS_ROOT "root/top/a"});
+  ASSERT_TRUE(changed && unchanged);
+  EXPECT_GT(changed->subtreeTicks, beforeChanges.ticks);
+  EXPECT_LE(unchanged->subtreeTicks, beforeChanges.ticks);
+  EXPECT_EQ(changed->subtreeTicks, changed->parent->subtreeTicks);
+
+  auto topDir = w_string::pathCat({root_path, "top"});
+  Query query;
+  query.fieldList.add("name");
+  query.relative_root = topDir;
+  query.relative_root_slash = w_string::build(topDir, "/");
+
+  QueryContext ctx{&query, root, false};
+  ctx.since = QuerySince::Clock{false, beforeChanges.ticks};
+  view->timeGenerator(&query, &ctx);
+
+  ASSERT_EQ(1, ctx.resultsArray.size());
+  EXPECT_EQ("b/y.txt", ctx.resultsArray.at(0).asString());
+  ASSERT_EQ(1, ctx.plan.size());
+  EXPECT_STREQ("changed_subtree", ctx.plan[0].access);
+  // The entries of top and b were walked, but not those of a
+  EXPECT_EQ(3, ctx.getNumWalked());
+}
+
+TEST_P(InMemoryViewTest, relative_root_all_files_query_walks_only_subtree) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/top/a/x.txt",
+      FAKEFS_ROOT "root/top/y.txt",
+      FAKEFS_ROOT "root/other/1.txt",
+      FAKEFS_ROOT "root/other/2.txt",
+      FAKEFS_ROOT "root/other/3.txt",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  auto topDir = w_string::pathCat({root_path, "top"});
+  Query query;
+  query.fieldList.add("name");
+  query.relative_root = topDir;
+  query.relative_root_slash = w_string::build(topDir, "/");
+
+  QueryContext ctx{&query, root, false};
+  view->allFilesGenerator(&query, &ctx);
+
+  std::vector<std::string> names;
+  for (auto& name : ctx.resultsArray) {
+    names.push_back(name.asString().string());
+  }
+  std::sort(names.begin(), names.end());
+  EXPECT_EQ((std::vector<std::string>{"a", "a/x.txt", "y.txt"}), names);
+  // Only the entries below top were walked
+  EXPECT_EQ(3, ctx.getNumWalked());
+}
+
+TEST_P(InMemoryViewTest, dir_only_query_walks_only_dirs) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/.git/HEAD",
+      FAKEFS_ROOT "root/.git/objects/ab/cdef",
+      FAKEFS_ROOT "root/a/b/1.txt",
+      FAKEFS_ROOT "root/a/b/2.txt",
+      FAKEFS_ROOT "root/a/3.txt",
+      FAKEFS_ROOT "root/4.txt",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  auto query = parseQuery(
+      root,
+      json_object(
+          {{"expression",
+            json_array(
+                {typed_string_to_json("type"), typed_string_to_json("d")})},
+           {"fields", json_array({w_string_to_json("name")})}}));
+
+  QueryContext ctx{query.get(), root, false};
+  view->allFilesGenerator(query.get(), &ctx);
+
+  std::vector<std::string> names;
+  for (auto& name : ctx.resultsArray) {
+    names.push_back(name.asString().string());
+  }
+  std::sort(names.begin(), names.end());
+  // The crawler makes no node for .git/objects, but it is still found
+  EXPECT_EQ(
+      (std::vector<std::string>{".git", ".git/objects", "a", "a/b"}), names);
+  ASSERT_EQ(1, ctx.plan.size());
+  EXPECT_STREQ("dirs", ctx.plan[0].access);
+  // The dirs of the root and a, and the entries of .git, were walked
+  EXPECT_EQ(5, ctx.getNumWalked());
+}
+
+TEST_P(InMemoryViewTest, dir_only_query_walks_only_dirs_below_relative_root) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a/b/c/1.txt",
+      FAKEFS_ROOT "root/a/d/2.txt",
+      FAKEFS_ROOT "root/e/f/3.txt",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  auto query = parseQuery(
+      root,
+      json_object(
+          {{"expression",
+            json_array(
+                {typed_string_to_json("type"), typed_string_to_json("d")})},
+           {"relative_root", typed_string_to_json("a")},
+           {"fields", json_array({w_string_to_json("name")})}}));
+
+  QueryContext ctx{query.get(), root, false};
+  view->allFilesGenerator(query.get(), &ctx);
+
+  std::vector<std::string> names;
+  for (auto& name : ctx.resultsArray) {
+    names.push_back(name.asString().string());
+  }
+  std::sort(names.begin(), names.end());
+  EXPECT_EQ((std::vector<std::string>{"b", "b/c", "d"}), names);
+  ASSERT_EQ(1, ctx.plan.size());
+  EXPECT_STREQ("dirs", ctx.plan[0].access);
+  // The dirs of a and b, but nothing outside of a, were walked
+  EXPECT_EQ(3, ctx.getNumWalked());
+}
+
+TEST_P(InMemoryViewTest, path_query_merges_nested_paths_and_runs_in_shards) {
+  for (size_t i = 0; i < 40; ++i) {
+    fs.addNode(
+        fmt::format(FAKEFS_ROOT "root/d{}/sub{}/f{}.txt", i % 4, i % 3, i)
+            .c_str(),
+        fs.fakeFile());
+  }
+
+  json_ref json = json_object();
+  json_object_set(json, "enable_parallel_crawl", json_boolean(GetParam()));
+  json_object_set(json, "query_parallelism", json_integer(4));
+  json_object_set(json, "query_parallel_min_files", json_integer(0));
+  Configuration parallelConfig{std::move(json)};
+  auto parallelView =
+      std::make_shared<InMemoryView>(fs, root_path, parallelConfig, watcher);
+  auto& parallelPending = parallelView->unsafeAccessPendingFromWatcher();
+  parallelPending.lock()->ping();
+
+  auto root = std::make_shared<Root>(
+      fs,
+      root_path,
+      "fs_type",
+      w_string_to_json("{}"),
+      parallelConfig,
+      parallelView,
+      [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(
+      Continue::Continue,
+      parallelView->stepIoThread(root, state, parallelPending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.dedup_results = true;
+  query.paths.emplace();
+  // d1/sub0 is covered by the unbounded walk of d1, and d3 is repeated
+  query.paths->emplace_back(QueryPath{"d3", -1});
+  query.paths->emplace_back(QueryPath{"d1/sub0", -1});
+  query.paths->emplace_back(QueryPath{"d1", -1});
+  query.paths->emplace_back(QueryPath{"d3", 0});
+  query.paths->emplace_back(QueryPath{"missing", -1});
+
+  QueryContext ctx{&query, root, false};
+  parallelView->pathGenerator(&query, &ctx);
+
+  std::vector<std::string> names;
+  for (auto& result : ctx.resultsArray) {
+    names.push_back(result.asString().string());
+  }
+  std::sort(names.begin(), names.end());
+
+  std::vector<std::string> expected;
+  for (size_t i = 0; i < 40; ++i) {
+    if (i % 4 == 1 || i % 4 == 3) {
+      expected.push_back(fmt::format("d{}/sub{}", i % 4, i % 3));
+      expected.push_back(fmt::format("d{}/sub{}/f{}.txt", i % 4, i % 3, i));
+    }
+  }
+  std::sort(expected.begin(), expected.end());
+  expected.erase(std::unique(expected.begin(), expected.end()), expected.end());
+
+  EXPECT_EQ(expected, names);
+  EXPECT_EQ(0, ctx.num_deduped);
+}
+
+TEST_P(InMemoryViewTest, overlapping_path_query_targets_are_deduped) {
+  for (size_t i = 0; i < 12; ++i) {
+    fs.addNode(
+        fmt::format(FAKEFS_ROOT "root/d/sub{}/f{}.txt", i % 3, i).c_str(),
+        fs.fakeFile());
+  }
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  // The walk of d to depth 1 also reaches everything in d/sub0, so the
+  // targets overlap and are walked serially
+  Query query;
+  query.fieldList.add("name");
+  query.dedup_results = true;
+  query.paths.emplace();
+  query.paths->emplace_back(QueryPath{"d/sub0", 0});
+  query.paths->emplace_back(QueryPath{"d", 1});
+
+  QueryContext ctx{&query, root, false};
+  view->pathGenerator(&query, &ctx);
+
+  std::vector<std::string> names;
+  for (auto& result : ctx.resultsArray) {
+    names.push_back(result.asString().string());
+  }
+  std::sort(names.begin(), names.end());
+
+  std::vector<std::string> expected{"d/sub0", "d/sub1", "d/sub2"};
+  for (size_t i = 0; i < 12; ++i) {
+    expected.push_back(fmt::format("d/sub{}/f{}.txt", i % 3, i));
+  }
+  std::sort(expected.begin(), expected.end());
+
+  EXPECT_EQ(expected, names);
+  // The four files of d/sub0 were generated twice
+  EXPECT_EQ(4, ctx.num_deduped);
+}
+
+TEST_P(InMemoryViewTest, many_changed_siblings_are_stated_by_one_dir_read) {
+  FakeFileSystem::Flags flags;
+  flags.includeReadDirStat = true;
+  FakeFileSystem scanFs{flags};
+  for (size_t i = 0; i < 6; ++i) {
+    scanFs.addNode(
+        fmt::format(FAKEFS_ROOT "root/dir/f{}.txt", i).c_str(),
+        scanFs.fakeFile());
+  }
+
+  json_ref json = json_object();
+  json_object_set(json, "enable_parallel_crawl", json_boolean(GetParam()));
+  json_object_set(json, "dir_scan_min_siblings", json_integer(4));
+  Configuration scanConfig{std::move(json)};
+  auto scanWatcher = std::make_shared<FakeWatcher>(scanFs);
+  auto scanView = std::make_shared<InMemoryView>(
+      scanFs, root_path, scanConfig, scanWatcher);
+  auto& scanPending = scanView->unsafeAccessPendingFromWatcher();
+  scanPending.lock()->ping();
+
+  auto root = std::make_shared<Root>(
+      scanFs,
+      root_path,
+      "fs_type",
+      w_string_to_json("{}"),
+      scanConfig,
+      scanView,
+      [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(
+      Continue::Continue, scanView->stepIoThread(root, state, scanPending));
+
+  // Grow every file but the last, which is removed
+  for (size_t i = 0; i < 5; ++i) {
+    scanFs.updateMetadata(
+        fmt::format(FAKEFS_ROOT "root/dir/f{}.txt", i).c_str(),
+        [&](FileInformation& fi) { fi.size = 100 + i; });
+  }
+  scanFs.removeRecursively(FAKEFS_ROOT "root/dir/f5.txt");
+  auto statsBefore = scanFs.getFileInformationCount();
+  {
+    auto lock = scanPending.lock();
+    for (size_t i = 0; i < 6; ++i) {
+      lock->add(
+          w_string::build(FAKEFS_ROOT "root/dir/f", i, ".txt"),
+          {},
+          W_PENDING_VIA_NOTIFY);
+    }
+    lock->ping();
+  }
+  EXPECT_EQ(
+      Continue::Continue, scanView->stepIoThread(root, state, scanPending));
+  // The read of dir reported the others, so only f5.txt, which it no longer
+  // lists, was stated on its own
+  EXPECT_EQ(1, scanFs.getFileInformationCount() - statsBefore);
+
+  const auto& viewdb = scanView->unsafeAccessViewDatabase();
+  auto* dir = viewdb.resolveDir(FAKEFS_ROOT "root/dir");
+  ASSERT_NE(nullptr, dir);
+  for (size_t i = 0; i < 5; ++i) {
+    auto* file = dir->getChildFile(w_string::build("f", i, ".txt").piece());
+    ASSERT_NE(nullptr, file);
+    EXPECT_TRUE(file->exists);
+    EXPECT_EQ(100 + i, file->stat.size());
+  }
+  auto* removed = dir->getChildFile("f5.txt");
+  ASSERT_NE(nullptr, removed);
+  EXPECT_FALSE(removed->exists);
+}
+
+TEST_P(InMemoryViewTest, renamed_dir_is_reparented_rather_than_crawled) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a/one.txt",
+      FAKEFS_ROOT "root/a/b/two.txt",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+  auto beforeMove = view->getMostRecentRootNumberAndTickValue();
+
+  fs.rename(FAKEFS_ROOT "root/a", FAKEFS_ROOT "root/c");
+  // Never reported, so only a crawl of c/b would find it
+  fs.addNode(FAKEFS_ROOT "root/c/b/three.txt", fs.fakeFile());
+  {
+    auto lock = pending.lock();
+    lock->addMove(FAKEFS_ROOT "root/a", FAKEFS_ROOT "root/c", {});
+    lock->add(FAKEFS_ROOT "root/a", {}, W_PENDING_VIA_NOTIFY);
+    lock->add(FAKEFS_ROOT "root/c", {}, W_PENDING_VIA_NOTIFY);
+    lock->ping();
+  }
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  const auto& viewdb = view->unsafeAccessViewDatabase();
+  auto* c = viewdb.resolveDir(FAKEFS_ROOT "root/c");
+  ASSERT_NE(nullptr, c);
+  auto* one = c->getChildFile("one.txt");
+  ASSERT_NE(nullptr, one);
+  EXPECT_TRUE(one->exists);
+  EXPECT_GT(one->otime.ticks, beforeMove.ticks);
+  auto* b = viewdb.resolveDir(FAKEFS_ROOT "root/c/b");
+  ASSERT_NE(nullptr, b);
+  auto* two = b->getChildFile("two.txt");
+  ASSERT_NE(nullptr, two);
+  EXPECT_TRUE(two->exists);
+  EXPECT_EQ(nullptr, b->getChildFile("three.txt"));
+
+  // The old paths remain, as deletions for since queries to report
+  auto* a = viewdb.resolveDir(FAKEFS_ROOT "root/a");
+  ASSERT_NE(nullptr, a);
+  EXPECT_FALSE(a->last_check_existed);
+  auto* oldOne = a->getChildFile("one.txt");
+  ASSERT_NE(nullptr, oldOne);
+  EXPECT_FALSE(oldOne->exists);
+  EXPECT_GT(oldOne->otime.ticks, beforeMove.ticks);
+  EXPECT_FALSE(viewdb.getRootDir()->getChildFile("a")->exists);
+
+  EXPECT_EQ(1, view->getViewDebugInfo().get("reparented_dirs").asInt());
+}
+
+TEST_P(InMemoryViewTest, sanity_audit_recrawls_dirs_that_missed_changes) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a/one.txt",
+      FAKEFS_ROOT "root/b/two.txt",
+  });
+
+  json_ref json = json_object();
+  json_object_set(json, "enable_parallel_crawl", json_boolean(GetParam()));
+  json_object_set(json, "sanity_audit_interval_ms", json_integer(1));
+  Configuration auditConfig{std::move(json)};
+  auto auditView =
+      std::make_shared<InMemoryView>(fs, root_path, auditConfig, watcher);
+  auto& auditPending = auditView->unsafeAccessPendingFromWatcher();
+  auditPending.lock()->ping();
+
+  auto root = std::make_shared<Root>(
+      fs,
+      root_path,
+      "fs_type",
+      w_string_to_json("{}"),
+      auditConfig,
+      auditView,
+      [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(
+      Continue::Continue, auditView->stepIoThread(root, state, auditPending));
+
+  // Change the tree without telling the watcher
+  fs.addNode(FAKEFS_ROOT "root/a/new.txt", fs.fakeFile());
+  fs.updateMetadata(
+      FAKEFS_ROOT "root/b/two.txt", [&](FileInformation& fi) { fi.size = 5; });
+
+  // Settling audits the whole of this small tree, and queues recrawls of
+  // the dirs that differ, which the next step carries out
+  auditPending.lock()->ping();
+  EXPECT_EQ(
+      Continue::Continue, auditView->stepIoThread(root, state, auditPending));
+  EXPECT_EQ(
+      Continue::Continue, auditView->stepIoThread(root, state, auditPending));
+
+  const auto& viewdb = auditView->unsafeAccessViewDatabase();
+  auto* added = viewdb.resolveDir(FAKEFS_ROOT "root/a")->getChildFile("new.txt");
+  ASSERT_NE(nullptr, added);
+  EXPECT_TRUE(added->exists);
+  auto* grown = viewdb.resolveDir(FAKEFS_ROOT "root/b")->getChildFile("two.txt");
+  ASSERT_NE(nullptr, grown);
+  EXPECT_EQ(5, grown->stat.size());
+
+  auto stats = auditView->getViewDebugInfo().get("sanity_audit");
+  EXPECT_EQ(1, stats.get("passes").asInt());
+  EXPECT_EQ(3, stats.get("dirs").asInt());
+  EXPECT_EQ(5, stats.get("entries").asInt());
+  EXPECT_EQ(2, stats.get("discrepancies").asInt());
+  EXPECT_EQ(2, stats.get("recrawls").asInt());
+}
+
+TEST_P(InMemoryViewTest, sanity_audit_skips_recent_changes) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/a/one.txt",
+      FAKEFS_ROOT "root/b/two.txt",
+  });
+
+  json_ref json = json_object();
+  json_object_set(json, "enable_parallel_crawl", json_boolean(GetParam()));
+  json_object_set(json, "sanity_audit_interval_ms", json_integer(1));
+  Configuration auditConfig{std::move(json)};
+  auto auditView =
+      std::make_shared<InMemoryView>(fs, root_path, auditConfig, watcher);
+  auto& auditPending = auditView->unsafeAccessPendingFromWatcher();
+  auditPending.lock()->ping();
+
+  auto root = std::make_shared<Root>(
+      fs,
+      root_path,
+      "fs_type",
+      w_string_to_json("{}"),
+      auditConfig,
+      auditView,
+      [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(
+      Continue::Continue, auditView->stepIoThread(root, state, auditPending));
+
+  // A change that the watcher may not have reported yet
+  fs.updateMetadata(FAKEFS_ROOT "root/b/two.txt", [&](FileInformation& fi) {
+    fi.size = 5;
+    fi.mtime.tv_sec = time(nullptr);
+  });
+
+  auditPending.lock()->ping();
+  EXPECT_EQ(
+      Continue::Continue, auditView->stepIoThread(root, state, auditPending));
+
+  // two.txt was left alone rather than recrawled
+  const auto& viewdb = auditView->unsafeAccessViewDatabase();
+  auto* two = viewdb.resolveDir(FAKEFS_ROOT "root/b")->getChildFile("two.txt");
+  ASSERT_NE(nullptr, two);
+  EXPECT_EQ(0, two->stat.size());
+
+  auto stats = auditView->getViewDebugInfo().get("sanity_audit");
+  EXPECT_EQ(3, stats.get("dirs").asInt());
+  // a, b and a/one.txt
+  EXPECT_EQ(3, stats.get("entries").asInt());
+  EXPECT_EQ(0, stats.get("discrepancies").asInt());
+  EXPECT_EQ(0, stats.get("recrawls").asInt());
+}
+
+TEST_P(InMemoryViewTest, age_out_frees_dirs_left_empty) {
+  fs.defineContents({
+      FAKEFS_ROOT "root/dir/foo/file.txt",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  fs.removeRecursively(FAKEFS_ROOT "root/dir/foo");
+  pending.lock()->add(
+      FAKEFS_ROOT "root/dir/foo",
+      {},
+      W_PENDING_VIA_NOTIFY | W_PENDING_NONRECURSIVE_SCAN);
+  pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  PerfSample sample("age_out");
+  view->ageOut(sample, std::chrono::seconds(0));
+  const auto& viewdb = view->unsafeAccessViewDatabase();
+  EXPECT_EQ(nullptr, viewdb.resolveDir(FAKEFS_ROOT "root/dir/foo"));
+
+  // A late event for a path under the deleted dir makes its node anew,
+  // without an entry for it in dir
+  pending.lock()->add(
+      FAKEFS_ROOT "root/dir/foo/late.txt", {}, W_PENDING_VIA_NOTIFY);
+  pending.lock()->ping();
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+  auto* foo = viewdb.resolveDir(FAKEFS_ROOT "root/dir/foo");
+  ASSERT_NE(nullptr, foo);
+  EXPECT_EQ(nullptr, viewdb.resolveDir(FAKEFS_ROOT "root/dir")
+                         ->getChildFile("foo"));
+
+  // Aging out the late file leaves the node empty, so it goes too, while
+  // dir, which still exists, stays
+  view->ageOut(sample, std::chrono::seconds(0));
+  EXPECT_EQ(nullptr, viewdb.resolveDir(FAKEFS_ROOT "root/dir/foo"));
+  EXPECT_NE(nullptr, viewdb.resolveDir(FAKEFS_ROOT "root/dir"));
+}
+
 INSTANTIATE_TEST_CASE_P(
     InMemoryViewTests,
     InMemoryViewTest,
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/fs/IoUring.h"
+#include <folly/portability/GTest.h>
+
+#ifdef WATCHMAN_HAVE_IO_URING_STATX
+#include <fcntl.h>
+#include <folly/File.h>
+#include <folly/FileUtil.h>
+#include <folly/testing/TestUtil.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace watchman;
+
+namespace {
+
+constexpr size_t kFiles = 8;
+// How many of the statx requests the kernel takes before io_uring_enter
+// fails
+constexpr uint32_t kTaken = 4;
+
+int enterCalls = 0;
+
+int sysEnter(int fd, uint32_t toSubmit, uint32_t minComplete, uint32_t flags) {
+  return (int)syscall(
+      __NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+}
+
+// Takes only some of the requests, then fails the call that would submit
+// the rest, leaving the first ones in flight
+int failingEnter(
+    int fd,
+    uint32_t toSubmit,
+    uint32_t minComplete,
+    uint32_t flags) {
+  switch (++enterCalls) {
+    case 1:
+      return sysEnter(fd, std::min(toSubmit, kTaken), 0, 0);
+    case 2:
+      errno = EIO;
+      return -1;
+    default:
+      return sysEnter(fd, toSubmit, minComplete, flags);
+  }
+}
+
+class IoUringTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    for (size_t i = 0; i < kFiles; ++i) {
+      names.push_back(std::to_string(i));
+      // Each file's size tells us which result it is
+      folly::writeFile(
+          std::string(i, 'x'), (dir.path() / names.back()).string().c_str());
+    }
+    for (auto& name : names) {
+      namePtrs.push_back(name.c_str());
+    }
+    dirFile = folly::File(dir.path().string(), O_RDONLY | O_DIRECTORY);
+  }
+
+  folly::test::TemporaryDirectory dir;
+  std::vector<std::string> names;
+  std::vector<const char*> namePtrs;
+  folly::File dirFile;
+};
+
+} // namespace
+
+TEST_F(IoUringTest, stats_every_name) {
+  auto ring = IoUringStatx::create(sysEnter);
+  if (!ring) {
+    GTEST_SKIP() << "io_uring isn't available here";
+  }
+  std::vector<struct statx> bufs(kFiles);
+  std::vector<int> results(kFiles, -ENODATA);
+  ASSERT_TRUE(ring->statAll(
+      dirFile.fd(), namePtrs.data(), bufs.data(), results.data(), kFiles));
+  for (size_t i = 0; i < kFiles; ++i) {
+    EXPECT_EQ(0, results[i]) << i;
+    EXPECT_EQ(i, bufs[i].stx_size) << i;
+  }
+}
+
+TEST_F(IoUringTest, failed_enter_drains_requests_in_flight) {
+  enterCalls = 0;
+  auto ring = IoUringStatx::create(failingEnter);
+  if (!ring) {
+    GTEST_SKIP() << "io_uring isn't available here";
+  }
+  std::vector<struct statx> bufs(kFiles);
+  std::vector<int> results(kFiles, -ENODATA);
+  EXPECT_FALSE(ring->statAll(
+      dirFile.fd(), namePtrs.data(), bufs.data(), results.data(), kFiles));
+
+  // The requests the kernel took have completed by the time statAll
+  // returns, so the buffers are free to reuse
+  for (size_t i = 0; i < kTaken; ++i) {
+    EXPECT_EQ(0, results[i]) << i;
+    EXPECT_EQ(i, bufs[i].stx_size) << i;
+  }
+  // and the ones it didn't take are never submitted
+  for (size_t i = kTaken; i < kFiles; ++i) {
+    EXPECT_EQ(-ENODATA, results[i]) << i;
+  }
+
+  // The ring is empty again, so the next call only sees its own requests
+  std::vector<struct statx> moreBufs(kFiles);
+  std::vector<int> moreResults(kFiles, -ENODATA);
+  ASSERT_TRUE(ring->statAll(
+      dirFile.fd(),
+      namePtrs.data(),
+      moreBufs.data(),
+      moreResults.data(),
+      kFiles));
+  for (size_t i = 0; i < kFiles; ++i) {
+    EXPECT_EQ(0, moreResults[i]) << i;
+    EXPECT_EQ(i, moreBufs[i].stx_size) << i;
+  }
+  for (size_t i = kTaken; i < kFiles; ++i) {
+    EXPECT_EQ(-ENODATA, results[i]) << i;
+  }
+}
+
+#endif
@@ -6,6 +6,7 @@
  */
 
 #include <gtest/gtest.h>
+#include <thread>
 #include "watchman/thirdparty/jansson/jansson_private.h"
 
 namespace {
@@ -62,4 +63,43 @@ TEST(JsonTest, too_deep_parse_tree) {
   json_loads(document.c_str(), JSON_DECODE_ANY, &err);
 }
 
+TEST(JsonTest, arena_values_outlive_scope) {
+  std::vector<json_ref> kept;
+  {
+    json_arena_scope arena;
+    for (int i = 0; i < 10000; ++i) {
+      auto value = json_object(
+          {{"name", typed_string_to_json(fmt::format("file{}", i).c_str())},
+           {"size", json_integer(i)}});
+      EXPECT_TRUE(value.get()->in_arena);
+      if (i % 100 == 0) {
+        kept.push_back(std::move(value));
+      }
+    }
+  }
+  EXPECT_FALSE(json_object().get()->in_arena);
+
+  ASSERT_EQ(100, kept.size());
+  for (size_t i = 0; i < kept.size(); ++i) {
+    EXPECT_EQ(i * 100, kept[i].get("size").asInt());
+  }
+}
+
+TEST(JsonTest, arena_values_released_on_other_thread) {
+  std::vector<json_ref> values;
+  {
+    json_arena_scope arena;
+    {
+      json_arena_scope nested;
+      values.push_back(json_array({json_real(1.5)}));
+    }
+    auto parsed = json_loads("{\"a\": [1, \"two\"]}", 0, nullptr);
+    values.push_back(parsed.value());
+  }
+  std::thread([values = std::move(values)]() mutable {
+    EXPECT_EQ("two", values[1].get("a").at(1).asString());
+    values.clear();
+  }).join();
+}
+
 } // namespace
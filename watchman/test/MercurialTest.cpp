@@ -16,3 +16,10 @@ TEST(Mercurial, convertCommitDate) {
   auto expected = 1529420960;
   EXPECT_EQ(result, expected);
 }
+
+TEST(Mercurial, encodeRunCommand) {
+  using namespace std::string_literals;
+  auto request =
+      watchman::HgCommandServer::encodeRunCommand({"log", "-r", "."});
+  EXPECT_EQ(request, "runcommand\n\0\0\0\x08log\0-r\0."s);
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/Metrics.h"
+#include <folly/portability/GTest.h>
+
+using namespace watchman;
+
+TEST(MetricsTest, buckets_bound_their_values) {
+  for (uint64_t us :
+       {0ull, 1ull, 3ull, 4ull, 7ull, 8ull, 9ull, 1000ull, 1023ull, 1024ull,
+        123456789ull}) {
+    auto bucket = LatencyHistogram::bucketFor(us);
+    EXPECT_LT(us, LatencyHistogram::bucketUpperBoundUs(bucket)) << us;
+    if (bucket > 0) {
+      EXPECT_GE(us, LatencyHistogram::bucketUpperBoundUs(bucket - 1)) << us;
+    }
+  }
+}
+
+TEST(MetricsTest, buckets_are_contiguous) {
+  for (size_t i = 0; i < LatencyHistogram::kNumBuckets - 1; ++i) {
+    auto bound = LatencyHistogram::bucketUpperBoundUs(i);
+    EXPECT_EQ(i, LatencyHistogram::bucketFor(bound - 1));
+    EXPECT_EQ(i + 1, LatencyHistogram::bucketFor(bound));
+  }
+  EXPECT_EQ(
+      LatencyHistogram::kNumBuckets - 1,
+      LatencyHistogram::bucketFor(uint64_t(1) << 50));
+}
+
+TEST(MetricsTest, quantiles) {
+  LatencyHistogram histogram;
+  EXPECT_EQ(0, histogram.snapshot().quantileUs(0.5));
+
+  for (uint64_t us = 1; us <= 100; ++us) {
+    histogram.recordUs(us * 1000);
+  }
+  auto snapshot = histogram.snapshot();
+  EXPECT_EQ(100, snapshot.count);
+  EXPECT_EQ(5050000, snapshot.sumUs);
+  EXPECT_EQ(100000, snapshot.maxUs);
+
+  // Within the 25% resolution of the buckets
+  auto p50 = snapshot.quantileUs(0.5);
+  EXPECT_GE(p50, 50000);
+  EXPECT_LE(p50, 62500);
+  EXPECT_EQ(100000, snapshot.quantileUs(1.0));
+}
+
+TEST(MetricsTest, open_metrics) {
+  LatencyHistogram histogram;
+  histogram.recordUs(2);
+  histogram.recordUs(5);
+
+  OpenMetricsWriter writer;
+  writer.histogram(
+      "watchman_test_seconds",
+      "A test",
+      {{{{"command", "q\"uery"}}, histogram.snapshot()}});
+  writer.counter("watchman_test_events", "Events", {{{}, 42}});
+  auto text = writer.finish();
+
+  EXPECT_NE(std::string::npos, text.find("# TYPE watchman_test_seconds "));
+  EXPECT_NE(
+      std::string::npos,
+      text.find(
+          "watchman_test_seconds_bucket{command=\"q\\\"uery\",le=\"2e-06\"} 1\n"));
+  EXPECT_NE(
+      std::string::npos,
+      text.find(
+          "watchman_test_seconds_bucket{command=\"q\\\"uery\",le=\"+Inf\"} 2\n"));
+  EXPECT_NE(
+      std::string::npos,
+      text.find("watchman_test_seconds_count{command=\"q\\\"uery\"} 2\n"));
+  EXPECT_NE(std::string::npos, text.find("watchman_test_events_total 42\n"));
+  EXPECT_EQ(text.size() - 6, text.rfind("# EOF\n"));
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/MtimeIndex.h"
+#include <folly/portability/GTest.h>
+#include <vector>
+#include "watchman/NodeArena.h"
+#include "watchman/watchman_dir.h"
+#include "watchman/watchman_file.h"
+
+using namespace watchman;
+
+namespace {
+
+class MtimeIndexTest : public testing::Test {
+ protected:
+  watchman_dir* makeDir(watchman_dir* parent, const char* name) {
+    auto dir = watchman_dir::make(w_string{name}, parent, arena);
+    auto ptr = dir.get();
+    parent->dirs[ptr->name.piece()] = std::move(dir);
+    return ptr;
+  }
+
+  watchman_file* makeFile(watchman_dir* parent, const char* name, int mtime) {
+    auto file = watchman_file::make(w_string{name}, parent, arena);
+    auto ptr = file.get();
+    parent->files[ptr->getName()] = std::move(file);
+    touch(ptr, mtime);
+    return ptr;
+  }
+
+  void touch(watchman_file* file, int mtime) {
+    FileInformation info;
+    info.mtime.tv_sec = mtime;
+    file->stat = info;
+    file->exists = true;
+    index.update(file);
+  }
+
+  std::vector<watchman_file*> since(int64_t mtime) const {
+    std::vector<watchman_file*> files;
+    index.forEachSince(mtime, [&](watchman_file* file) {
+      files.push_back(file);
+      return true;
+    });
+    return files;
+  }
+
+  NodeArena arena;
+  MtimeIndex index;
+  watchman_dir root{w_string{"/root"}, nullptr};
+};
+
+} // namespace
+
+TEST_F(MtimeIndexTest, visits_files_since_newest_first) {
+  auto a = makeFile(&root, "a", 100);
+  auto b = makeFile(&root, "b", 200);
+  auto c = makeFile(&root, "c", 300);
+
+  EXPECT_EQ((std::vector<watchman_file*>{c, b, a}), since(0));
+  EXPECT_EQ((std::vector<watchman_file*>{c, b}), since(200));
+  EXPECT_EQ((std::vector<watchman_file*>{c}), since(201));
+  EXPECT_TRUE(since(301).empty());
+}
+
+TEST_F(MtimeIndexTest, stops_when_asked) {
+  makeFile(&root, "a", 100);
+  makeFile(&root, "b", 200);
+  auto c = makeFile(&root, "c", 300);
+
+  std::vector<watchman_file*> files;
+  auto visited = index.forEachSince(0, [&](watchman_file* file) {
+    files.push_back(file);
+    return false;
+  });
+  EXPECT_EQ(1, visited);
+  EXPECT_EQ((std::vector<watchman_file*>{c}), files);
+}
+
+TEST_F(MtimeIndexTest, moves_changed_files) {
+  auto a = makeFile(&root, "a", 100);
+  auto b = makeFile(&root, "b", 200);
+
+  touch(a, 300);
+  EXPECT_EQ((std::vector<watchman_file*>{a, b}), since(0));
+  EXPECT_EQ((std::vector<watchman_file*>{a}), since(250));
+
+  // Going back in time, as a checkout can, moves it back too
+  touch(a, 50);
+  EXPECT_EQ((std::vector<watchman_file*>{b, a}), since(0));
+  EXPECT_EQ(2, index.size());
+}
+
+TEST_F(MtimeIndexTest, removes_deleted_files) {
+  auto a = makeFile(&root, "a", 100);
+  auto b = makeFile(&root, "b", 200);
+
+  a->exists = false;
+  index.update(a);
+  EXPECT_EQ((std::vector<watchman_file*>{b}), since(0));
+
+  index.erase(b);
+  EXPECT_TRUE(since(0).empty());
+  EXPECT_EQ(0, index.getStats().files);
+
+  // Erasing a file that isn't indexed is harmless
+  index.erase(a);
+}
+
+TEST_F(MtimeIndexTest, erases_trees) {
+  auto sub = makeDir(&root, "sub");
+  auto deeper = makeDir(sub, "deeper");
+  auto a = makeFile(&root, "a", 100);
+  makeFile(sub, "b", 200);
+  makeFile(deeper, "c", 300);
+
+  index.eraseTree(sub);
+  EXPECT_EQ((std::vector<watchman_file*>{a}), since(0));
+
+  index.eraseTree(&root);
+  EXPECT_TRUE(since(0).empty());
+  EXPECT_EQ(0, index.size());
+}
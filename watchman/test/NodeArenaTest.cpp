@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/NodeArena.h"
+#include <folly/portability/GTest.h>
+#include <folly/portability/Unistd.h>
+#include <folly/testing/TestUtil.h>
+#include <string.h>
+#include <vector>
+
+using namespace watchman;
+
+TEST(NodeArenaTest, allocations_are_zeroed_and_distinct) {
+  NodeArena arena;
+  auto a = static_cast<char*>(arena.allocate(100));
+  auto b = static_cast<char*>(arena.allocate(100));
+  EXPECT_NE(a, b);
+  for (size_t i = 0; i < 100; ++i) {
+    EXPECT_EQ(0, a[i]);
+  }
+  memset(a, 'a', 100);
+  memset(b, 'b', 100);
+  EXPECT_EQ('a', a[99]);
+
+  auto& stats = arena.getStats();
+  EXPECT_EQ(2, stats.liveObjects);
+  EXPECT_EQ(1, stats.slabs);
+  EXPECT_EQ(2 * 112, stats.usedBytes);
+
+  NodeArena::deallocate(a);
+  NodeArena::deallocate(b);
+  EXPECT_EQ(0, stats.liveObjects);
+  EXPECT_EQ(0, stats.usedBytes);
+}
+
+TEST(NodeArenaTest, freed_storage_is_reused) {
+  NodeArena arena;
+  auto a = arena.allocate(64);
+  NodeArena::deallocate(a);
+  auto b = arena.allocate(64);
+  EXPECT_EQ(a, b);
+  NodeArena::deallocate(b);
+}
+
+TEST(NodeArenaTest, release_empty_slabs) {
+  NodeArena arena;
+  std::vector<void*> ptrs;
+  // Enough to span several slabs
+  for (size_t i = 0; i < 4 * NodeArena::kSlabSize / 256; ++i) {
+    ptrs.push_back(arena.allocate(256));
+  }
+  auto& stats = arena.getStats();
+  auto slabs = stats.slabs;
+  EXPECT_GE(slabs, 4);
+
+  // Keep the first allocation alive; everything else goes away
+  for (size_t i = 1; i < ptrs.size(); ++i) {
+    NodeArena::deallocate(ptrs[i]);
+  }
+  EXPECT_EQ(slabs - 1, arena.releaseEmptySlabs());
+  EXPECT_EQ(1, stats.slabs);
+  EXPECT_EQ(1, stats.liveObjects);
+
+  // The slab that survived is still usable
+  auto p = arena.allocate(256);
+  EXPECT_EQ(1, stats.slabs);
+  NodeArena::deallocate(p);
+  NodeArena::deallocate(ptrs[0]);
+  EXPECT_EQ(1, arena.releaseEmptySlabs());
+  EXPECT_EQ(0, stats.reservedBytes);
+}
+
+TEST(NodeArenaTest, large_allocations) {
+  NodeArena arena;
+  auto big = static_cast<char*>(arena.allocate(NodeArena::kSlabSize * 2));
+  memset(big, 'x', NodeArena::kSlabSize * 2);
+  EXPECT_EQ(1, arena.getStats().slabs);
+  NodeArena::deallocate(big);
+  EXPECT_EQ(0, arena.getStats().slabs);
+}
+
+TEST(NodeArenaTest, bulk_release) {
+  NodeArena arena;
+  auto a = arena.allocate(32);
+  EXPECT_FALSE(NodeArena::isBulkReleasing(a));
+  arena.beginBulkRelease();
+  EXPECT_TRUE(NodeArena::isBulkReleasing(a));
+  NodeArena::deallocate(a);
+  // Bookkeeping is skipped; the slab is reclaimed by the destructor
+  EXPECT_EQ(1, arena.getStats().liveObjects);
+}
+
+#ifndef _WIN32
+TEST(NodeArenaTest, backing_file) {
+  folly::test::TemporaryDirectory dir;
+  auto path = (dir.path() / "nodes").string();
+  NodeArena arena;
+  arena.useBackingFile(path);
+  EXPECT_TRUE(arena.isFileBacked());
+  // Unlinked once opened
+  EXPECT_NE(0, access(path.c_str(), F_OK));
+
+  auto a = static_cast<char*>(arena.allocate(100));
+  auto big = static_cast<char*>(arena.allocate(NodeArena::kSlabSize * 2));
+  memset(a, 'a', 100);
+  memset(big, 'x', NodeArena::kSlabSize * 2);
+  auto& stats = arena.getStats();
+  EXPECT_EQ(2, stats.slabs);
+  EXPECT_EQ(NodeArena::kSlabSize * 4, stats.backingFileBytes);
+
+  NodeArena::deallocate(a);
+  NodeArena::deallocate(big);
+  EXPECT_EQ(1, arena.releaseEmptySlabs());
+  EXPECT_EQ(0, stats.slabs);
+
+  // The range of the freed slab is mapped again rather than extending the
+  // file
+  auto b = static_cast<char*>(arena.allocate(100));
+  for (size_t i = 0; i < 100; ++i) {
+    EXPECT_EQ(0, b[i]);
+  }
+  EXPECT_EQ(NodeArena::kSlabSize * 4, stats.backingFileBytes);
+  NodeArena::deallocate(b);
+}
+#endif
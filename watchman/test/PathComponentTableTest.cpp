@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/PathComponentTable.h"
+#include <folly/portability/GTest.h>
+#include <string.h>
+
+using namespace watchman;
+
+TEST(PathComponentTableTest, repeated_names_share_storage) {
+  PathComponentTable table;
+  auto a = table.intern("node_modules");
+  auto b = table.intern(w_string("node_modules"));
+  EXPECT_EQ(a, b);
+  EXPECT_EQ(a.data(), b.data());
+
+  auto c = table.intern("src");
+  EXPECT_NE(a.data(), c.data());
+
+  auto& stats = table.getStats();
+  EXPECT_EQ(2, stats.components);
+  EXPECT_EQ(strlen("node_modules") + strlen("src"), stats.bytes);
+  EXPECT_EQ(1, stats.hits);
+}
+
+TEST(PathComponentTableTest, release_unused) {
+  PathComponentTable table;
+  auto keep = table.intern("keep");
+  table.intern("drop");
+  EXPECT_EQ(2, table.getStats().components);
+
+  EXPECT_EQ(1, table.releaseUnused());
+  EXPECT_EQ(1, table.getStats().components);
+  EXPECT_EQ(0, table.releaseUnused());
+
+  // The survivor is still shared
+  EXPECT_EQ(keep.data(), table.intern("keep").data());
+
+  keep.reset();
+  EXPECT_EQ(1, table.releaseUnused());
+  EXPECT_EQ(0, table.getStats().components);
+}
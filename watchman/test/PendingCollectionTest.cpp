@@ -10,7 +10,9 @@
 
 #include <folly/logging/xlog.h>
 #include <folly/portability/GTest.h>
+#include <algorithm>
 #include <chrono>
+#include <deque>
 
 using namespace watchman;
 
@@ -62,7 +64,7 @@ size_t process_items(PendingCollection::LockedPtr& coll) {
   auto item = coll->stealItems();
   while (item) {
     drained++;
-    item = std::move(item->next);
+    item = item->next;
   }
   return drained;
 }
@@ -160,7 +162,7 @@ class NaivePendingCollection {
       const w_string& path,
       std::chrono::system_clock::time_point now,
       PendingFlags flags) {
-    for (std::shared_ptr<watchman_pending_fs> p = head_; p; p = p->next) {
+    for (auto p = head_; p; p = p->next) {
       if (path.piece().startsWith(p->path) &&
           watchman::is_path_prefix(path, p->path)) {
         if ((p->flags & (W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY)) ==
@@ -170,7 +172,7 @@ class NaivePendingCollection {
       }
     }
 
-    for (std::shared_ptr<watchman_pending_fs> p = head_; p; p = p->next) {
+    for (auto p = head_; p; p = p->next) {
       if (p->path == path) {
         // consolidateItem
         p->flags.set(
@@ -185,7 +187,7 @@ class NaivePendingCollection {
     // maybePruneObsoletedChildren
     if ((flags & (W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY)) ==
         W_PENDING_RECURSIVE) {
-      std::shared_ptr<watchman_pending_fs>* prev = &head_;
+      watchman_pending_fs** prev = &head_;
       auto p = head_;
       while (p) {
         if (watchman::is_path_prefix(p->path, path)) {
@@ -198,7 +200,7 @@ class NaivePendingCollection {
       }
     }
 
-    auto p = std::make_shared<watchman_pending_fs>(path, now, flags);
+    auto p = &nodes_.emplace_back(path, now, flags);
     p->next = head_;
     head_ = p;
   }
@@ -211,12 +213,13 @@ class NaivePendingCollection {
     return i;
   }
 
-  std::shared_ptr<watchman_pending_fs> stealItems() {
+  watchman_pending_fs* stealItems() {
     return std::exchange(head_, nullptr);
   }
 
  private:
-  std::shared_ptr<watchman_pending_fs> head_;
+  std::deque<watchman_pending_fs> nodes_;
+  watchman_pending_fs* head_{nullptr};
 };
 
 using PCTypes = ::testing::Types<PendingChanges, NaivePendingCollection>;
@@ -394,3 +397,122 @@ TYPED_TEST(PendingCollectionFixture, real_example) {
   ASSERT_NE(nullptr, item);
   EXPECT_EQ(nullptr, item->next);
 }
+
+TEST(Pending, stolen_items_outlive_adds_and_are_recycled) {
+  PendingChanges coll;
+  auto now = std::chrono::system_clock::now();
+  coll.add(w_string{"foo"}, now, {});
+  coll.add(w_string{"bar"}, now, {});
+
+  // Adding while walking the stolen chain doesn't disturb it
+  std::vector<watchman_pending_fs*> stolen;
+  for (auto item = coll.stealItems(); item; item = item->next) {
+    stolen.push_back(item);
+    coll.add(w_string::build(item->path.view(), "/child"), now, {});
+  }
+  ASSERT_EQ(2u, stolen.size());
+  EXPECT_EQ(w_string{"bar"}, stolen[0]->path);
+  EXPECT_EQ(w_string{"foo"}, stolen[1]->path);
+
+  // The next steal recycles the first chain's nodes for new items
+  auto item = coll.stealItems();
+  ASSERT_NE(nullptr, item);
+  EXPECT_EQ(w_string{"foo/child"}, item->path);
+  coll.add(w_string{"baz"}, now, {});
+  item = coll.stealItems();
+  ASSERT_NE(nullptr, item);
+  EXPECT_EQ(w_string{"baz"}, item->path);
+  EXPECT_NE(stolen.end(), std::find(stolen.begin(), stolen.end(), item));
+
+  // append copies the changes out of another collection's chain
+  PendingChanges other;
+  other.add(w_string{"qux"}, now, W_PENDING_RECURSIVE);
+  coll.add(w_string{"qux/quux"}, now, {});
+  coll.append(other.stealItems(), other.stealSyncs());
+  item = coll.stealItems();
+  ASSERT_NE(nullptr, item);
+  EXPECT_EQ(nullptr, item->next);
+  EXPECT_EQ(w_string{"qux"}, item->path);
+  EXPECT_EQ(W_PENDING_RECURSIVE, item->flags);
+}
+
+TEST(Pending, handed_off_batches_are_drained_and_reused) {
+  PendingCollection coll;
+  PendingChanges local;
+  auto now = std::chrono::system_clock::now();
+
+  auto batch = std::make_unique<PendingChanges>();
+  batch->add(w_string{"foo/bar"}, now, W_PENDING_VIA_NOTIFY);
+  auto first = batch.get();
+  {
+    auto lock = coll.lock();
+    lock->add(w_string{"foo"}, now, W_PENDING_RECURSIVE);
+    EXPECT_EQ(nullptr, lock->handOff(std::move(batch)));
+    EXPECT_EQ(2, lock->getPendingItemCount());
+    EXPECT_TRUE(lock->checkAndResetPinged());
+  }
+
+  // Direct adds are merged first, so the recursive dir obsoletes the file
+  coll.drainInto(coll.lock(), local);
+  EXPECT_TRUE(coll.lock()->empty());
+  auto item = local.stealItems();
+  ASSERT_NE(nullptr, item);
+  EXPECT_EQ(nullptr, item->next);
+  EXPECT_EQ(w_string{"foo"}, item->path);
+
+  // Once drained, the batch is handed back to the producer for reuse
+  batch = std::make_unique<PendingChanges>();
+  batch->add(w_string{"baz"}, now, W_PENDING_VIA_NOTIFY);
+  EXPECT_EQ(nullptr, coll.lock()->handOff(std::move(batch)));
+  coll.drainInto(coll.lock(), local);
+  batch = std::make_unique<PendingChanges>();
+  batch->add(w_string{"qux"}, now, W_PENDING_VIA_NOTIFY);
+  EXPECT_EQ(first, coll.lock()->handOff(std::move(batch)).get());
+}
+
+TEST(Pending, oldest_change_is_tracked_until_drained) {
+  PendingCollection coll;
+  PendingChanges local;
+  auto now = std::chrono::system_clock::now();
+  auto earlier = now - std::chrono::seconds{1};
+
+  auto batch = std::make_unique<PendingChanges>();
+  EXPECT_FALSE(batch->oldestChange());
+  batch->add(w_string{"foo"}, now, W_PENDING_VIA_NOTIFY);
+  batch->add(w_string{"bar"}, earlier, W_PENDING_VIA_NOTIFY);
+  EXPECT_EQ(earlier, batch->oldestChange());
+
+  auto beforeHandOff = std::chrono::system_clock::now();
+  (void)coll.lock()->handOff(std::move(batch));
+  auto handedOff = coll.drainInto(coll.lock(), local);
+  ASSERT_TRUE(handedOff);
+  EXPECT_GE(*handedOff, beforeHandOff);
+  EXPECT_EQ(earlier, local.oldestChange());
+
+  // Nothing was handed off since
+  EXPECT_FALSE(coll.drainInto(coll.lock(), local));
+
+  (void)local.stealItems();
+  EXPECT_FALSE(local.oldestChange());
+}
+
+TEST(Pending, event_rate_tracks_recent_changes) {
+  PendingCollection coll;
+  auto lock = coll.lock();
+  auto start = std::chrono::steady_clock::now();
+  auto now = std::chrono::system_clock::now();
+
+  EXPECT_EQ(0, lock->sampleEventRate(start));
+
+  // A sustained 1000 changes per second converges on that rate
+  auto when = start;
+  for (int i = 0; i < 5000; ++i) {
+    lock->add(w_string::build("file", i), now, {});
+    when += std::chrono::milliseconds{1};
+    lock->sampleEventRate(when);
+  }
+  EXPECT_NEAR(1000, lock->sampleEventRate(when), 10);
+
+  // and decays once the changes stop
+  EXPECT_LT(lock->sampleEventRate(when + std::chrono::seconds{5}), 10);
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/PubSub.h"
+#include <folly/portability/GTest.h>
+#include <thread>
+
+using namespace watchman;
+
+namespace {
+
+std::vector<int64_t> pendingSerials(Publisher::Subscriber& sub) {
+  std::vector<std::shared_ptr<const Publisher::Item>> pending;
+  sub.getPending(pending);
+  std::vector<int64_t> values;
+  for (auto& item : pending) {
+    values.push_back(item->payload.asInt());
+  }
+  return values;
+}
+
+} // namespace
+
+TEST(PubSub, enqueue_requires_subscribers) {
+  auto pub = std::make_shared<Publisher>();
+  EXPECT_FALSE(pub->hasSubscribers());
+  EXPECT_FALSE(pub->enqueue(json_integer(1)));
+
+  auto sub = pub->subscribe(nullptr);
+  EXPECT_TRUE(pub->hasSubscribers());
+  EXPECT_TRUE(pub->enqueue(json_integer(2)));
+
+  sub.reset();
+  EXPECT_FALSE(pub->hasSubscribers());
+}
+
+TEST(PubSub, each_subscriber_sees_every_item_once) {
+  auto pub = std::make_shared<Publisher>();
+  int notified = 0;
+  auto fast = pub->subscribe([&notified] { ++notified; });
+  auto slow = pub->subscribe(nullptr);
+
+  pub->enqueue(json_integer(1));
+  pub->enqueue(json_integer(2));
+  EXPECT_EQ(notified, 2);
+  EXPECT_EQ(pendingSerials(*fast), (std::vector<int64_t>{1, 2}));
+  EXPECT_TRUE(pendingSerials(*fast).empty());
+
+  // Subscribers only see what was published after they subscribed
+  auto late = pub->subscribe(nullptr);
+  pub->enqueue(json_integer(3));
+  EXPECT_EQ(pendingSerials(*fast), (std::vector<int64_t>{3}));
+  EXPECT_EQ(pendingSerials(*slow), (std::vector<int64_t>{1, 2, 3}));
+  EXPECT_EQ(pendingSerials(*late), (std::vector<int64_t>{3}));
+  EXPECT_EQ(slow->getSerial(), 3);
+}
+
+TEST(PubSub, trim_backlog_skips_lagging_subscribers) {
+  auto pub = std::make_shared<Publisher>();
+  auto slow = pub->subscribe(nullptr);
+  auto fast = pub->subscribe(nullptr);
+  for (int i = 1; i <= 10; ++i) {
+    pub->enqueue(json_integer(i));
+  }
+  EXPECT_EQ(pendingSerials(*fast).size(), 10);
+  pub->enqueue(json_integer(11));
+
+  EXPECT_EQ(pub->trimBacklog(3), 8);
+  EXPECT_EQ(slow->getDropped(), 8);
+  EXPECT_EQ(fast->getDropped(), 0);
+  EXPECT_EQ(pendingSerials(*slow), (std::vector<int64_t>{9, 10, 11}));
+  EXPECT_EQ(pendingSerials(*fast), (std::vector<int64_t>{11}));
+  EXPECT_EQ(pub->trimBacklog(3), 0);
+}
+
+TEST(PubSub, releases_long_backlog) {
+  auto pub = std::make_shared<Publisher>();
+  auto sub = pub->subscribe(nullptr);
+  for (int i = 0; i < 1000000; ++i) {
+    pub->enqueue(json_integer(i));
+  }
+  // Dropping the only cursor into the backlog must not recurse per item
+  sub.reset();
+}
+
+TEST(PubSub, concurrent_publish_and_consume) {
+  constexpr int kItems = 100000;
+  auto pub = std::make_shared<Publisher>();
+  std::vector<std::shared_ptr<Publisher::Subscriber>> subs;
+  for (int i = 0; i < 4; ++i) {
+    subs.push_back(pub->subscribe(nullptr));
+  }
+
+  std::vector<std::thread> readers;
+  for (auto& sub : subs) {
+    readers.emplace_back([&sub] {
+      int64_t expected = 0;
+      while (expected < kItems) {
+        for (auto value : pendingSerials(*sub)) {
+          ASSERT_EQ(value, expected);
+          ++expected;
+        }
+      }
+    });
+  }
+
+  for (int i = 0; i < kItems; ++i) {
+    pub->enqueue(json_integer(i));
+  }
+  for (auto& reader : readers) {
+    reader.join();
+  }
+}
+
+TEST(PubSub, trim_backlog_races_with_consume) {
+  constexpr int kItems = 100000;
+  auto pub = std::make_shared<Publisher>();
+  auto sub = pub->subscribe(nullptr);
+
+  std::atomic<bool> done{false};
+  std::thread trimmer([&] {
+    while (!done.load(std::memory_order_relaxed)) {
+      pub->trimBacklog(8);
+    }
+  });
+  std::thread publisher([&] {
+    for (int i = 0; i < kItems; ++i) {
+      pub->enqueue(json_integer(i));
+    }
+  });
+
+  // The newest item is never trimmed, so the reader always gets to it
+  int64_t last = -1;
+  int64_t delivered = 0;
+  while (last < kItems - 1) {
+    for (auto value : pendingSerials(*sub)) {
+      EXPECT_GT(value, last);
+      last = value;
+      ++delivered;
+    }
+  }
+  publisher.join();
+  done.store(true, std::memory_order_relaxed);
+  trimmer.join();
+
+  // Every item is either delivered or counted as dropped, never both
+  EXPECT_EQ(delivered + int64_t(sub->getDropped()), kItems);
+}
+
+/* vim:ts=2:sw=2:et:
+ */
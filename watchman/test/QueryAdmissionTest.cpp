@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/QueryAdmission.h"
+#include <folly/portability/GTest.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+namespace {
+void notCancelled() {}
+
+void waitForWaiters(
+    QueryAdmission& admission,
+    size_t interactive,
+    size_t batch) {
+  for (;;) {
+    auto stats = admission.getStats();
+    if (stats.waiting[0] == interactive && stats.waiting[1] == batch) {
+      return;
+    }
+    std::this_thread::sleep_for(1ms);
+  }
+}
+} // namespace
+
+TEST(QueryAdmission, interactive_goes_before_batch) {
+  QueryAdmission admission;
+  auto held = std::make_unique<QueryAdmission::Ticket>(
+      admission.admit(QueryPriority::Interactive, 1, notCancelled));
+
+  std::mutex mutex;
+  std::string order;
+  auto run = [&](QueryPriority priority, char c) {
+    return std::thread{[&, priority, c] {
+      auto ticket = admission.admit(priority, 1, notCancelled);
+      std::lock_guard<std::mutex> lock(mutex);
+      order.push_back(c);
+    }};
+  };
+
+  auto batch = run(QueryPriority::Batch, 'b');
+  waitForWaiters(admission, 0, 1);
+  auto interactive = run(QueryPriority::Interactive, 'i');
+  waitForWaiters(admission, 1, 1);
+
+  held.reset();
+  batch.join();
+  interactive.join();
+  EXPECT_EQ("ib", order);
+}
+
+TEST(QueryAdmission, batch_leaves_a_slot_for_interactive) {
+  QueryAdmission admission;
+  auto first = admission.admit(QueryPriority::Batch, 2, notCancelled);
+
+  std::atomic<bool> admitted{false};
+  std::thread second{[&] {
+    auto ticket = admission.admit(QueryPriority::Batch, 2, notCancelled);
+    admitted = true;
+  }};
+  waitForWaiters(admission, 0, 1);
+  EXPECT_FALSE(admitted);
+
+  // The slot that batch queries can't take is there for interactive ones
+  auto interactive =
+      admission.admit(QueryPriority::Interactive, 2, notCancelled);
+  EXPECT_EQ(2, admission.getStats().running);
+
+  first = QueryAdmission::Ticket{};
+  second.join();
+  EXPECT_TRUE(admitted);
+}
+
+TEST(QueryAdmission, cancelled_waiter_gives_up_its_place) {
+  QueryAdmission admission;
+  auto held = admission.admit(QueryPriority::Interactive, 1, notCancelled);
+
+  std::atomic<bool> cancel{false};
+  std::thread waiter{[&] {
+    EXPECT_THROW(
+        admission.admit(
+            QueryPriority::Batch,
+            1,
+            [&] {
+              if (cancel) {
+                throw std::runtime_error("cancelled");
+              }
+            }),
+        std::runtime_error);
+  }};
+  waitForWaiters(admission, 0, 1);
+  cancel = true;
+  waiter.join();
+
+  auto stats = admission.getStats();
+  EXPECT_EQ(1, stats.running);
+  EXPECT_EQ(0, stats.waiting[1]);
+}
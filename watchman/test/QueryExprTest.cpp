@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include "watchman/query/FileResult.h"
+#include "watchman/query/Query.h"
+#include "watchman/query/QueryExpr.h"
+#include "watchman/query/TermRegistry.h"
+#include "watchman/thirdparty/jansson/jansson.h"
+
+using namespace watchman;
+
+namespace {
+
+// Records which accessors the expression under test used
+class FakeFileResult : public FileResult {
+ public:
+  explicit FakeFileResult(
+      w_string_piece baseName,
+      std::optional<w_string_piece> foldedBaseName = std::nullopt)
+      : baseName_(baseName), foldedBaseName_(foldedBaseName) {}
+
+  std::optional<FileInformation> stat() override {
+    ++statCalls;
+    return std::nullopt;
+  }
+  std::optional<struct timespec> accessedTime() override {
+    return std::nullopt;
+  }
+  std::optional<struct timespec> modifiedTime() override {
+    return std::nullopt;
+  }
+  std::optional<struct timespec> changedTime() override {
+    return std::nullopt;
+  }
+  std::optional<size_t> size() override {
+    return std::nullopt;
+  }
+  w_string_piece baseName() override {
+    return baseName_;
+  }
+  std::optional<w_string_piece> foldedBaseName() override {
+    ++foldedCalls;
+    return foldedBaseName_;
+  }
+  w_string_piece dirName() override {
+    return "dir";
+  }
+  std::optional<bool> exists() override {
+    return true;
+  }
+  std::optional<ResolvedSymlink> readLink() override {
+    return std::nullopt;
+  }
+  std::optional<ClockStamp> ctime() override {
+    return std::nullopt;
+  }
+  std::optional<ClockStamp> otime() override {
+    return std::nullopt;
+  }
+  std::optional<ContentHash> getContentSha1() override {
+    return std::nullopt;
+  }
+  std::optional<DType> dtype() override {
+    ++dtypeCalls;
+    return DType::Regular;
+  }
+  void batchFetchProperties(
+      const std::vector<std::unique_ptr<FileResult>>&) override {}
+
+  size_t statCalls{0};
+  size_t dtypeCalls{0};
+  size_t foldedCalls{0};
+
+ private:
+  w_string_piece baseName_;
+  std::optional<w_string_piece> foldedBaseName_;
+};
+
+class FakeQueryContext : public QueryContextBase {
+ public:
+  explicit FakeQueryContext(w_string wholeName)
+      : wholeName_(std::move(wholeName)) {}
+
+  const w_string& getWholeName() override {
+    ++wholeNameCalls;
+    return wholeName_;
+  }
+
+  size_t wholeNameCalls{0};
+
+ private:
+  w_string wholeName_;
+};
+
+std::unique_ptr<QueryExpr> parseExpr(const char* expression_json) {
+  json_error_t err{};
+  auto expression = json_loads(expression_json, JSON_DECODE_ANY, &err);
+  if (!expression.has_value()) {
+    ADD_FAILURE() << "JSON parse error in fixture: " << err.text;
+    return nullptr;
+  }
+  Query query;
+  query.case_sensitive = CaseSensitivity::CaseSensitive;
+  return parseQueryExpr(&query, *expression);
+}
+
+} // namespace
+
+TEST(QueryExprTest, allof_evaluates_cheap_terms_first) {
+  auto expr = parseExpr(R"([
+    "allof",
+    ["match", "dir/**", "wholename"],
+    ["type", "f"],
+    ["suffix", "js"]
+  ])");
+  ASSERT_TRUE(expr);
+  EXPECT_EQ(EvaluationCost::WholeName, expr->evaluationCost());
+
+  // The suffix term rules the file out before the others run
+  FakeFileResult file{"foo.txt"};
+  FakeQueryContext ctx{w_string{"dir/foo.txt"}};
+  EXPECT_EQ(EvaluateResult{false}, expr->evaluate(&ctx, &file));
+  EXPECT_EQ(0, file.dtypeCalls);
+  EXPECT_EQ(0, ctx.wholeNameCalls);
+
+  FakeFileResult js{"foo.js"};
+  FakeQueryContext jsCtx{w_string{"dir/foo.js"}};
+  EXPECT_EQ(EvaluateResult{true}, expr->evaluate(&jsCtx, &js));
+  EXPECT_EQ(1, js.dtypeCalls);
+  EXPECT_EQ(1, jsCtx.wholeNameCalls);
+}
+
+TEST(QueryExprTest, anyof_short_circuits_on_cheap_match) {
+  auto expr = parseExpr(R"([
+    "anyof",
+    ["match", "other/**", "wholename"],
+    ["suffix", "js"]
+  ])");
+  ASSERT_TRUE(expr);
+
+  FakeFileResult file{"foo.js"};
+  FakeQueryContext ctx{w_string{"dir/foo.js"}};
+  EXPECT_EQ(EvaluateResult{true}, expr->evaluate(&ctx, &file));
+  EXPECT_EQ(0, ctx.wholeNameCalls);
+}
+
+TEST(QueryExprTest, nested_lists_and_double_negation_are_flattened) {
+  auto expr = parseExpr(R"([
+    "allof",
+    ["allof", ["match", "dir/**", "wholename"], ["type", "f"]],
+    ["not", ["not", ["suffix", "js"]]]
+  ])");
+  ASSERT_TRUE(expr);
+
+  // Once flattened the suffix term sorts ahead of the nested list's terms
+  FakeFileResult file{"foo.txt"};
+  FakeQueryContext ctx{w_string{"dir/foo.txt"}};
+  EXPECT_EQ(EvaluateResult{false}, expr->evaluate(&ctx, &file));
+  EXPECT_EQ(0, file.dtypeCalls);
+  EXPECT_EQ(0, ctx.wholeNameCalls);
+
+  auto suffix = parseExpr(R"( ["not", ["not", ["suffix", "js"]]] )");
+  ASSERT_TRUE(suffix);
+  EXPECT_EQ(EvaluationCost::BaseName, suffix->evaluationCost());
+}
+
+TEST(QueryExprTest, anyof_match_terms_are_aggregated) {
+  auto expr = parseExpr(R"([
+    "anyof",
+    ["match", "*.cpp"],
+    ["imatch", "*.H"],
+    ["match", "src/**/*.rs", "wholename"],
+    ["match", "**/BUCK", "wholename"],
+    ["match", "README"]
+  ])");
+  ASSERT_TRUE(expr);
+
+  auto matches = [&](const char* baseName, const char* wholeName) {
+    FakeFileResult file{baseName};
+    FakeQueryContext ctx{w_string{wholeName}};
+    return expr->evaluate(&ctx, &file) == EvaluateResult{true};
+  };
+  EXPECT_TRUE(matches("foo.cpp", "dir/foo.cpp"));
+  EXPECT_TRUE(matches("foo.h", "dir/foo.h"));
+  EXPECT_TRUE(matches("README", "dir/README"));
+  EXPECT_TRUE(matches("lib.rs", "src/lib.rs"));
+  EXPECT_TRUE(matches("lib.rs", "src/a/b/lib.rs"));
+  EXPECT_TRUE(matches("BUCK", "BUCK"));
+  EXPECT_TRUE(matches("BUCK", "a/BUCK"));
+  EXPECT_FALSE(matches("foo.cpp.orig", "dir/foo.cpp.orig"));
+  EXPECT_FALSE(matches("lib.rs", "test/lib.rs"));
+  EXPECT_FALSE(matches("readme", "dir/readme"));
+  EXPECT_FALSE(matches("BUCK.v2", "a/BUCK.v2"));
+
+  // The basename terms settle the result without rendering the wholename
+  FakeFileResult file{"foo.cpp"};
+  FakeQueryContext ctx{w_string{"dir/foo.cpp"}};
+  EXPECT_EQ(EvaluateResult{true}, expr->evaluate(&ctx, &file));
+  EXPECT_EQ(0, ctx.wholeNameCalls);
+}
+
+TEST(QueryExprTest, case_insensitive_terms_use_the_folded_base_name) {
+  auto iname = parseExpr(R"(["iname", "ReadMe.MD"])");
+  auto inameSet = parseExpr(R"(["iname", ["x.c", "README.md"]])");
+  auto imatch = parseExpr(R"(["imatch", "READ*.Md"])");
+  auto name = parseExpr(R"(["name", "README.md"])");
+  ASSERT_TRUE(iname && inameSet && imatch && name);
+
+  FakeQueryContext ctx{w_string{"dir/README.md"}};
+  for (auto* expr : {iname.get(), inameSet.get(), imatch.get()}) {
+    FakeFileResult folded{"README.md", w_string_piece{"readme.md"}};
+    EXPECT_EQ(EvaluateResult{true}, expr->evaluate(&ctx, &folded));
+    EXPECT_EQ(1, folded.foldedCalls);
+
+    // Without a folded copy, the terms fold the name themselves
+    FakeFileResult plain{"README.md"};
+    EXPECT_EQ(EvaluateResult{true}, expr->evaluate(&ctx, &plain));
+
+    FakeFileResult other{"README.txt", w_string_piece{"readme.txt"}};
+    EXPECT_EQ(EvaluateResult{false}, expr->evaluate(&ctx, &other));
+  }
+
+  // Case sensitive terms have no use for it
+  FakeFileResult file{"README.md", w_string_piece{"readme.md"}};
+  EXPECT_EQ(EvaluateResult{true}, name->evaluate(&ctx, &file));
+  EXPECT_EQ(0, file.foldedCalls);
+}
@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/RecencyIndex.h"
+#include <fmt/core.h>
+#include <folly/portability/GTest.h>
+#include <algorithm>
+#include <list>
+#include <random>
+#include "watchman/NodeArena.h"
+#include "watchman/watchman_file.h"
+
+using namespace watchman;
+
+namespace {
+
+using FilePtr = std::unique_ptr<watchman_file, watchman_dir::Deleter>;
+
+std::vector<watchman_file*> newestFirst(const RecencyIndex& index) {
+  std::vector<watchman_file*> result;
+  index.forEachNewestFirst([&](watchman_file* file) {
+    result.push_back(file);
+    return true;
+  });
+  return result;
+}
+
+class RecencyIndexTest : public testing::Test {
+ protected:
+  FilePtr makeFile(const char* name) {
+    return watchman_file::make(w_string{name}, nullptr, arena);
+  }
+
+  NodeArena arena;
+  RecencyIndex index;
+};
+
+} // namespace
+
+TEST_F(RecencyIndexTest, touch_moves_to_front) {
+  auto a = makeFile("a");
+  auto b = makeFile("b");
+  auto c = makeFile("c");
+  EXPECT_EQ(nullptr, index.newest());
+
+  index.touch(a.get());
+  index.touch(b.get());
+  index.touch(c.get());
+  EXPECT_EQ(
+      (std::vector<watchman_file*>{c.get(), b.get(), a.get()}),
+      newestFirst(index));
+
+  index.touch(a.get());
+  EXPECT_EQ(a.get(), index.newest());
+  EXPECT_EQ(
+      (std::vector<watchman_file*>{a.get(), c.get(), b.get()}),
+      newestFirst(index));
+
+  // Touching the newest file again doesn't use another slot
+  auto slots = index.getStats().slots;
+  index.touch(a.get());
+  EXPECT_EQ(slots, index.getStats().slots);
+}
+
+TEST_F(RecencyIndexTest, destroyed_files_are_skipped_and_reclaimed) {
+  auto a = makeFile("a");
+  auto b = makeFile("b");
+  auto c = makeFile("c");
+  index.touch(a.get());
+  index.touch(b.get());
+  index.touch(c.get());
+  index.touch(a.get());
+
+  b.reset();
+  EXPECT_EQ(
+      (std::vector<watchman_file*>{a.get(), c.get()}), newestFirst(index));
+
+  // One slot cleared by the re-touch of a, one by destroying b
+  EXPECT_EQ(2, index.compact());
+  EXPECT_EQ(2, index.getStats().slots);
+  EXPECT_EQ(
+      (std::vector<watchman_file*>{a.get(), c.get()}), newestFirst(index));
+
+  // Slot addresses were fixed up by compact()
+  index.touch(c.get());
+  EXPECT_EQ(
+      (std::vector<watchman_file*>{c.get(), a.get()}), newestFirst(index));
+}
+
+TEST_F(RecencyIndexTest, batch_splices_at_recent_end) {
+  auto a = makeFile("a");
+  auto b = makeFile("b");
+  auto c = makeFile("c");
+  index.touch(a.get());
+
+  RecencyIndex::Batch batch;
+  RecencyIndex::append(batch, b.get());
+  RecencyIndex::append(batch, c.get());
+  EXPECT_FALSE(batch.empty());
+  EXPECT_EQ(std::vector<watchman_file*>{a.get()}, newestFirst(index));
+
+  index.splice(batch);
+  EXPECT_TRUE(batch.empty());
+  EXPECT_EQ(
+      (std::vector<watchman_file*>{c.get(), b.get(), a.get()}),
+      newestFirst(index));
+
+  // Spliced in a partially filled chunk; compaction copes with the gap
+  index.touch(a.get());
+  index.compact();
+  EXPECT_EQ(
+      (std::vector<watchman_file*>{a.get(), c.get(), b.get()}),
+      newestFirst(index));
+}
+
+TEST_F(RecencyIndexTest, matches_list_model) {
+  constexpr size_t kFiles = 3 * RecencyIndex::kChunkSize + 17;
+  std::vector<FilePtr> files;
+  for (size_t i = 0; i < kFiles; ++i) {
+    files.push_back(makeFile(fmt::format("f{}", i).c_str()));
+  }
+
+  std::list<watchman_file*> model;
+  auto touch = [&](watchman_file* file) {
+    index.touch(file);
+    model.remove(file);
+    model.push_front(file);
+  };
+
+  std::mt19937 rng(0);
+  for (auto& file : files) {
+    touch(file.get());
+  }
+  for (size_t i = 0; i < 10 * kFiles; ++i) {
+    if (i % kFiles == 0) {
+      index.compact();
+    }
+    auto pos = rng() % files.size();
+    if (!files[pos]) {
+      continue;
+    }
+    if (rng() % 50 == 0) {
+      model.remove(files[pos].get());
+      files[pos].reset();
+    } else {
+      touch(files[pos].get());
+    }
+  }
+
+  EXPECT_GE(index.getStats().compactions, 10);
+  EXPECT_EQ(
+      std::vector<watchman_file*>(model.begin(), model.end()),
+      newestFirst(index));
+  index.compact();
+  EXPECT_EQ(model.size(), index.getStats().slots);
+  EXPECT_EQ(
+      std::vector<watchman_file*>(model.begin(), model.end()),
+      newestFirst(index));
+}
+
+TEST_F(RecencyIndexTest, chunk_ranges_partition_newest_first_order) {
+  std::vector<FilePtr> files;
+  for (size_t i = 0; i < 2 * RecencyIndex::kChunkSize + 5; ++i) {
+    files.push_back(makeFile(fmt::format("f{}", i).c_str()));
+    index.touch(files.back().get());
+  }
+  ASSERT_EQ(3, index.chunkCount());
+
+  std::vector<watchman_file*> walked;
+  for (size_t end = index.chunkCount(); end > 0; --end) {
+    index.forEachNewestFirstInChunks(end - 1, end, [&](watchman_file* file) {
+      walked.push_back(file);
+      return true;
+    });
+  }
+  EXPECT_EQ(newestFirst(index), walked);
+}
+
+TEST_F(RecencyIndexTest, cursor_walks_newest_first) {
+  std::vector<FilePtr> files;
+  for (size_t i = 0; i < RecencyIndex::kChunkSize + 2; ++i) {
+    files.push_back(makeFile(fmt::format("f{}", i).c_str()));
+    index.touch(files.back().get());
+  }
+  index.touch(files[0].get());
+  files[1].reset();
+
+  std::vector<watchman_file*> walked;
+  for (RecencyIndex::Cursor cursor{index}; cursor.file(); cursor.next()) {
+    walked.push_back(cursor.file());
+  }
+  EXPECT_EQ(newestFirst(index), walked);
+
+  RecencyIndex empty;
+  EXPECT_EQ(nullptr, RecencyIndex::Cursor{empty}.file());
+}
+
+TEST_F(RecencyIndexTest, files_move_between_indices) {
+  auto a = makeFile("a");
+  auto b = makeFile("b");
+  index.touch(a.get());
+  index.touch(b.get());
+
+  RecencyIndex other;
+  index.remove(a.get());
+  EXPECT_EQ(nullptr, a->recencySlot);
+  other.touch(a.get());
+  EXPECT_EQ((std::vector<watchman_file*>{b.get()}), newestFirst(index));
+  EXPECT_EQ((std::vector<watchman_file*>{a.get()}), newestFirst(other));
+  EXPECT_EQ(1, index.compact());
+}
+
+TEST_F(RecencyIndexTest, chunks_walk_oldest_first) {
+  auto a = makeFile("a");
+  auto b = makeFile("b");
+  auto c = makeFile("c");
+  index.touch(a.get());
+  index.touch(b.get());
+  index.touch(c.get());
+
+  std::vector<watchman_file*> walked;
+  EXPECT_FALSE(index.forEachOldestFirstInChunk(0, [&](watchman_file* file) {
+    walked.push_back(file);
+    return file != b.get();
+  }));
+  EXPECT_EQ((std::vector<watchman_file*>{a.get(), b.get()}), walked);
+}
+
+TEST_F(RecencyIndexTest, columns_skip_files_outside_filter) {
+  index.enableColumns();
+  auto small = makeFile("small");
+  auto big = makeFile("big");
+  auto dir = makeFile("dir");
+
+  FileInformation st;
+  st.mode = S_IFREG | 0644;
+  st.size = 10;
+  small->stat = st;
+  st.size = 1000;
+  big->stat = st;
+  st.mode = S_IFDIR | 0755;
+  dir->stat = st;
+  index.touch(small.get());
+  index.touch(big.get());
+  index.touch(dir.get());
+  EXPECT_LT(0, index.getStats().columnBytes);
+
+  auto matching = [&](const ColumnFilter& filter) {
+    std::vector<watchman_file*> result;
+    index.forEachNewestFirstInChunksMatching(
+        0, index.chunkCount(), filter, [&](watchman_file* file) {
+          result.push_back(file);
+          return true;
+        });
+    return result;
+  };
+
+  ColumnFilter filter;
+  filter.maxSize = 100;
+  // The size of a dir isn't trusted
+  EXPECT_EQ(
+      (std::vector<watchman_file*>{dir.get(), small.get()}), matching(filter));
+
+  filter.allowOnly(DType::Regular);
+  EXPECT_EQ((std::vector<watchman_file*>{small.get()}), matching(filter));
+
+  // Touching a file refreshes its row
+  st.mode = S_IFREG | 0644;
+  st.size = 50;
+  big->stat = st;
+  index.touch(big.get());
+  EXPECT_EQ(
+      (std::vector<watchman_file*>{big.get(), small.get()}), matching(filter));
+}
+
+TEST_F(RecencyIndexTest, counts_files_newer_than_ticks) {
+  std::vector<FilePtr> files;
+  for (size_t i = 0; i < 3 * RecencyIndex::kChunkSize; ++i) {
+    files.push_back(makeFile("f"));
+    files.back()->otime.ticks = i + 1;
+    index.touch(files.back().get());
+  }
+  EXPECT_EQ(0, index.countNewerThan(3 * RecencyIndex::kChunkSize));
+  EXPECT_EQ(10, index.countNewerThan(3 * RecencyIndex::kChunkSize - 10));
+  EXPECT_EQ(
+      RecencyIndex::kChunkSize + 5,
+      index.countNewerThan(2 * RecencyIndex::kChunkSize - 5));
+  EXPECT_EQ(3 * RecencyIndex::kChunkSize, index.countNewerThan(0));
+}
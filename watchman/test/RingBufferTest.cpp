@@ -7,6 +7,8 @@
 
 #include <folly/portability/GTest.h>
 
+#include <thread>
+
 #include "watchman/RingBuffer.h"
 
 using namespace watchman;
@@ -40,3 +42,60 @@ TEST(RingBufferTest, writes_can_be_cleared) {
   EXPECT_EQ(1, result.size());
   EXPECT_EQ(5, result[0]);
 }
+
+TEST(SpscRingBufferTest, fifo_until_full) {
+  SpscRingBuffer<int> rb{2};
+  EXPECT_EQ(nullptr, rb.readSlot());
+
+  *rb.writeSlot() = 1;
+  rb.commitWrite();
+  *rb.writeSlot() = 2;
+  rb.commitWrite();
+  EXPECT_EQ(nullptr, rb.writeSlot());
+  EXPECT_EQ(1, rb.fullCount());
+  EXPECT_EQ(2, rb.size());
+
+  EXPECT_EQ(1, *rb.readSlot());
+  rb.commitRead();
+
+  // Wrap around
+  *rb.writeSlot() = 3;
+  rb.commitWrite();
+  EXPECT_EQ(2, *rb.readSlot());
+  rb.commitRead();
+  EXPECT_EQ(3, *rb.readSlot());
+  rb.commitRead();
+  EXPECT_EQ(nullptr, rb.readSlot());
+
+  EXPECT_EQ(2, rb.highWaterMark());
+  rb.resetStats();
+  EXPECT_EQ(0, rb.highWaterMark());
+  EXPECT_EQ(0, rb.fullCount());
+}
+
+TEST(SpscRingBufferTest, concurrent_producer_and_consumer) {
+  SpscRingBuffer<int> rb{8};
+  constexpr int kCount = 100000;
+
+  std::thread producer([&] {
+    for (int i = 0; i < kCount; ++i) {
+      int* slot;
+      while (!(slot = rb.writeSlot())) {
+        std::this_thread::yield();
+      }
+      *slot = i;
+      rb.commitWrite();
+    }
+  });
+
+  for (int i = 0; i < kCount; ++i) {
+    int* slot;
+    while (!(slot = rb.readSlot())) {
+      std::this_thread::yield();
+    }
+    ASSERT_EQ(i, *slot);
+    rb.commitRead();
+  }
+  producer.join();
+  EXPECT_LE(rb.highWaterMark(), 8);
+}
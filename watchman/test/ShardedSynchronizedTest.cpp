@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ShardedSynchronized.h"
+#include <folly/portability/GTest.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using namespace watchman;
+
+TEST(ShardedSynchronizedTest, keys_stay_in_their_shard) {
+  ShardedSynchronized<std::unordered_map<std::string, int>> table;
+  for (int i = 0; i < 100; ++i) {
+    auto key = std::to_string(i);
+    (*table.shard(key).wlock())[key] = i;
+  }
+  EXPECT_EQ(100, table.size());
+
+  for (int i = 0; i < 100; ++i) {
+    auto key = std::to_string(i);
+    auto shard = table.shard(key).rlock();
+    auto it = shard->find(key);
+    ASSERT_NE(it, shard->end());
+    EXPECT_EQ(i, it->second);
+  }
+
+  size_t used = 0;
+  size_t total = 0;
+  table.forEachShard([&](const auto& shard) {
+    auto size = shard.rlock()->size();
+    used += size > 0;
+    total += size;
+  });
+  EXPECT_EQ(100, total);
+  EXPECT_GT(used, 1) << "keys are spread across shards";
+}
+
+TEST(ShardedSynchronizedTest, concurrent_pointer_keys) {
+  ShardedSynchronized<std::unordered_set<const int*>> table;
+  constexpr int kThreads = 8;
+  constexpr int kPerThread = 1000;
+  std::vector<int> values(kThreads * kPerThread);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < kPerThread; ++i) {
+        const int* key = &values[t * kPerThread + i];
+        table.shard(key).wlock()->insert(key);
+        if (i % 2) {
+          table.shard(key).wlock()->erase(key);
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(kThreads * kPerThread / 2, table.size());
+}
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/StateLog.h"
+#include <folly/FileUtil.h>
+#include <folly/portability/GTest.h>
+#include <folly/testing/TestUtil.h>
+
+using namespace watchman;
+
+namespace {
+
+json_ref makeRecord(const char* path, const char* trigger) {
+  return json_object(
+      {{"path", typed_string_to_json(path)},
+       {"triggers",
+        json_array({json_object({{"name", typed_string_to_json(trigger)}})})}});
+}
+
+std::vector<std::string> watchedTriggers(const json_ref& state) {
+  std::vector<std::string> result;
+  auto watched = state.get("watched");
+  for (size_t i = 0; i < json_array_size(watched); ++i) {
+    const auto& obj = watched.at(i);
+    result.push_back(
+        json_to_w_string(obj.get("path")).string() + ":" +
+        json_to_w_string(obj.get("triggers").at(0).get("name")).string());
+  }
+  return result;
+}
+
+size_t fileSize(const std::string& path) {
+  std::string data;
+  EXPECT_TRUE(folly::readFile(path.c_str(), data));
+  return data.size();
+}
+
+class StateLogTest : public testing::Test {
+ protected:
+  folly::test::TemporaryDirectory dir;
+  std::string path{(dir.path() / "state").string()};
+};
+
+} // namespace
+
+TEST_F(StateLogTest, replays_changes) {
+  StateLog log{path};
+  std::map<w_string, json_ref> records{
+      {w_string{"/a"}, makeRecord("/a", "one")},
+      {w_string{"/b"}, makeRecord("/b", "two")}};
+  ASSERT_TRUE(log.save(records));
+
+  records.insert_or_assign(w_string{"/b"}, makeRecord("/b", "three"));
+  records.erase(w_string{"/a"});
+  records.emplace(w_string{"/c"}, makeRecord("/c", "four"));
+  ASSERT_TRUE(log.save(records));
+
+  EXPECT_EQ(
+      (std::vector<std::string>{"/b:three", "/c:four"}),
+      watchedTriggers(StateLog::load(path)));
+}
+
+TEST_F(StateLogTest, appends_only_what_changed) {
+  StateLog log{path};
+  std::map<w_string, json_ref> records{
+      {w_string{"/a"}, makeRecord("/a", "one")},
+      {w_string{"/b"}, makeRecord("/b", "two")}};
+  ASSERT_TRUE(log.save(records));
+  auto size = fileSize(path);
+
+  // Nothing changed, so nothing is written
+  ASSERT_TRUE(log.save(records));
+  EXPECT_EQ(size, fileSize(path));
+
+  records.insert_or_assign(w_string{"/b"}, makeRecord("/b", "three"));
+  ASSERT_TRUE(log.save(records));
+  auto grown = fileSize(path);
+  EXPECT_GT(grown, size);
+  // Only /b's record was appended
+  EXPECT_LT(grown - size, size);
+  EXPECT_EQ(1, log.deadRecords());
+}
+
+TEST_F(StateLogTest, compacts_superseded_records) {
+  StateLog log{path};
+  std::map<w_string, json_ref> records{
+      {w_string{"/a"}, makeRecord("/a", "initial")}};
+  ASSERT_TRUE(log.save(records));
+  auto size = fileSize(path);
+
+  for (int i = 0; i < 100; ++i) {
+    records.insert_or_assign(
+        w_string{"/a"}, makeRecord("/a", i % 2 ? "initial" : "changed"));
+    ASSERT_TRUE(log.save(records));
+  }
+  EXPECT_LT(log.deadRecords(), 100);
+  EXPECT_LT(fileSize(path), 100 * size);
+  EXPECT_EQ(
+      (std::vector<std::string>{"/a:initial"}),
+      watchedTriggers(StateLog::load(path)));
+}
+
+TEST_F(StateLogTest, ignores_torn_final_record) {
+  StateLog log{path};
+  std::map<w_string, json_ref> records{
+      {w_string{"/a"}, makeRecord("/a", "one")}};
+  ASSERT_TRUE(log.save(records));
+  auto size = fileSize(path);
+
+  records.emplace(w_string{"/b"}, makeRecord("/b", "two"));
+  ASSERT_TRUE(log.save(records));
+
+  std::string data;
+  ASSERT_TRUE(folly::readFile(path.c_str(), data));
+  data.resize(size + (data.size() - size) / 2);
+  ASSERT_TRUE(folly::writeFile(data, path.c_str()));
+
+  EXPECT_EQ(
+      (std::vector<std::string>{"/a:one"}),
+      watchedTriggers(StateLog::load(path)));
+}
+
+TEST_F(StateLogTest, loads_legacy_json) {
+  ASSERT_TRUE(folly::writeFile(
+      std::string{
+          R"({"version": "1", "watched": [)"
+          R"({"path": "/a", "triggers": [{"name": "one"}]}]})"},
+      path.c_str()));
+  EXPECT_FALSE(StateLog::isLog("{"));
+
+  auto state = StateLog::load(path);
+  EXPECT_EQ(
+      (std::vector<std::string>{"/a:one"}), watchedTriggers(state));
+
+  // The first save after a load rewrites the file as a log
+  StateLog log{path};
+  std::map<w_string, json_ref> records{
+      {w_string{"/a"}, state.get("watched").at(0)}};
+  ASSERT_TRUE(log.save(records));
+  std::string data;
+  ASSERT_TRUE(folly::readFile(path.c_str(), data));
+  EXPECT_TRUE(StateLog::isLog(data));
+  EXPECT_EQ(
+      (std::vector<std::string>{"/a:one"}),
+      watchedTriggers(StateLog::load(path)));
+}
@@ -7,6 +7,8 @@
 
 #include <folly/portability/GTest.h>
 #include <string>
+#include <unordered_set>
+#include <vector>
 #include "watchman/watchman_string.h"
 
 TEST(String, fmt) {
@@ -339,6 +341,52 @@ TEST(String, piece_and_string_should_have_same_hash) {
       w_string{"foobar"}.hashValue(), w_string_piece{"foobar"}.hashValue());
 }
 
+TEST(String, piece_of_string_reuses_its_hash) {
+  w_string str{"some/path/name.txt"};
+  auto piece = str.piece();
+  EXPECT_EQ(str.hashValue(), piece.hashValue());
+
+  // A piece hashed first stores the hash for the string to reuse
+  w_string other{"another/name.txt"};
+  auto expected = w_string_piece{"another/name.txt"}.hashValue();
+  EXPECT_EQ(expected, other.piece().hashValue());
+  EXPECT_EQ(expected, other.hashValue());
+
+  // Advancing a piece leaves the string's hash behind
+  piece.advance(5);
+  EXPECT_EQ(w_string_piece{"path/name.txt"}.hashValue(), piece.hashValue());
+}
+
+TEST(String, hash_distinguishes_lengths_and_tails) {
+  std::vector<std::string> inputs;
+  for (size_t len = 0; len <= 70; ++len) {
+    inputs.emplace_back(len, 'a');
+    inputs.emplace_back(std::string(len, 'a') + "b");
+  }
+  std::unordered_set<watchman::StringHash> hashes;
+  for (auto& input : inputs) {
+    hashes.insert(watchman::wordStringHash(input.data(), input.size()));
+  }
+  EXPECT_EQ(inputs.size(), hashes.size());
+}
+
+TEST(String, short_strings_reuse_storage) {
+  std::vector<w_string> strings;
+  for (int round = 0; round < 3; ++round) {
+    for (int i = 0; i < 2000; ++i) {
+      strings.push_back(w_string::build("f", i, ".js"));
+    }
+    for (int i = 0; i < 2000; ++i) {
+      EXPECT_EQ(w_string::build("f", i, ".js"), strings[i]);
+    }
+    strings.clear();
+  }
+
+  // A string shortened after allocation is still released correctly
+  auto joined = w_string::pathCat({"", "a", "", "b"});
+  EXPECT_EQ(w_string{"a/b"}, joined);
+}
+
 TEST(String, split) {
   {
     std::vector<std::string> expected{"a", "b", "c"};
@@ -452,6 +500,60 @@ TEST(String, contains) {
   EXPECT_FALSE(haystack.contains("watchman2"));
 }
 
+TEST(String, byte_scans_match_scalar_across_lengths) {
+  // Cover the lengths either side of a 16 byte vector, with the
+  // interesting byte at every position.
+  for (size_t len = 0; len <= 40; ++len) {
+    std::string path(len, 'a');
+    EXPECT_EQ(
+        nullptr, watchman::findLastSlash(path.data(), path.data() + len));
+    EXPECT_EQ(len, watchman::asciiPrefixLength(path.data(), len));
+    for (size_t pos = 0; pos < len; ++pos) {
+      std::string slashed = path;
+      slashed[pos] = '/';
+      auto begin = slashed.data();
+      EXPECT_EQ(begin + pos, watchman::findLastSlash(begin, begin + len));
+      EXPECT_EQ(
+          watchman::findLastSlashScalar(begin, begin + len),
+          watchman::findLastSlash(begin, begin + len));
+
+      std::string upper = path;
+      upper[pos] = 'A';
+      EXPECT_TRUE(watchman::equalAsciiCaseless(path.data(), upper.data(), len));
+      upper[pos] = 'B';
+      EXPECT_FALSE(
+          watchman::equalAsciiCaseless(path.data(), upper.data(), len));
+
+      std::string high = path;
+      high[pos] = '\xc3';
+      EXPECT_EQ(pos, watchman::asciiPrefixLength(high.data(), len));
+    }
+  }
+}
+
+TEST(String, path_helpers_on_long_paths) {
+  w_string_piece path{"some/fairly/long/directory/name/with/a/file.Txt"};
+  EXPECT_EQ(
+      w_string_piece{"some/fairly/long/directory/name/with/a"}, path.dirName());
+  EXPECT_EQ(w_string_piece{"file.Txt"}, path.baseName());
+  EXPECT_EQ(w_string_piece{"Txt"}, path.suffix());
+  EXPECT_TRUE(path.hasSuffix("txt"));
+  w_string_piece undotted{"some/dotted.dir/longer_file_name"};
+  EXPECT_EQ(w_string_piece{}, undotted.suffix());
+  EXPECT_TRUE(w_string_equal_caseless(
+      "Some/Fairly/Long/Directory/Name/With/A/FILE.txt", path));
+  EXPECT_FALSE(w_string_equal_caseless(
+      "some/fairly/long/directory/name/with/a/file.Tx_", path));
+  EXPECT_TRUE(path.startsWithCaseInsensitive("SOME/FAIRLY/LONG/Dir"));
+  EXPECT_EQ(
+      w_string("some/fairly/long/directory/name/with/a/file.txt"),
+      path.asLowerCase());
+  w_string_piece invalid{"long/name/caf\x80/and/more/than/16/bytes"};
+  EXPECT_EQ(
+      w_string("long/name/caf?/and/more/than/16/bytes"),
+      invalid.asUTF8Clean());
+}
+
 TEST(String, allocate_many_sizes) {
   // This strange test relies on ASAN to assert that our allocation size math is
   // correct.
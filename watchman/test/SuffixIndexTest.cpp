@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/SuffixIndex.h"
+#include <folly/portability/GTest.h>
+#include "watchman/NodeArena.h"
+#include "watchman/watchman_dir.h"
+#include "watchman/watchman_file.h"
+
+using namespace watchman;
+
+namespace {
+
+class SuffixIndexTest : public testing::Test {
+ protected:
+  watchman_dir* makeDir(watchman_dir* parent, const char* name) {
+    auto dir = watchman_dir::make(w_string{name}, parent, arena);
+    auto ptr = dir.get();
+    parent->dirs[ptr->name.piece()] = std::move(dir);
+    return ptr;
+  }
+
+  watchman_file* makeFile(watchman_dir* parent, const char* name) {
+    auto file = watchman_file::make(w_string{name}, parent, arena);
+    auto ptr = file.get();
+    parent->files[ptr->getName()] = std::move(file);
+    index.insert(ptr);
+    return ptr;
+  }
+
+  size_t count(const char* suffix) const {
+    auto files = index.find(w_string{suffix});
+    return files ? files->size() : 0;
+  }
+
+  NodeArena arena;
+  SuffixIndex index;
+  watchman_dir root{w_string{"/root"}, nullptr};
+};
+
+} // namespace
+
+TEST_F(SuffixIndexTest, indexes_by_lower_case_suffix) {
+  auto a = makeFile(&root, "a.js");
+  auto b = makeFile(&root, "B.JS");
+  makeFile(&root, "c.tar.gz");
+  makeFile(&root, "Makefile");
+
+  EXPECT_EQ(2, count("js"));
+  EXPECT_EQ(1, index.find(w_string{"js"})->count(a));
+  EXPECT_EQ(1, index.find(w_string{"js"})->count(b));
+  EXPECT_EQ(1, count("gz"));
+  EXPECT_EQ(0, count("tar.gz"));
+
+  auto stats = index.getStats();
+  EXPECT_EQ(2, stats.suffixes);
+  EXPECT_EQ(3, stats.files);
+  EXPECT_LT(0, stats.bytes);
+
+  index.erase(a);
+  index.erase(b);
+  EXPECT_EQ(nullptr, index.find(w_string{"js"}));
+  EXPECT_EQ(1, index.getStats().suffixes);
+}
+
+TEST_F(SuffixIndexTest, erase_tree_removes_nested_files) {
+  auto dir = makeDir(&root, "dir");
+  auto sub = makeDir(dir, "sub");
+  makeFile(&root, "top.js");
+  makeFile(dir, "mid.js");
+  makeFile(sub, "leaf.js");
+  makeFile(sub, "leaf.css");
+  EXPECT_EQ(3, count("js"));
+
+  index.eraseTree(dir);
+  EXPECT_EQ(1, count("js"));
+  EXPECT_EQ(0, count("css"));
+  EXPECT_EQ(1, index.getStats().files);
+}
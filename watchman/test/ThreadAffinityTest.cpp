@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ThreadAffinity.h"
+#include <folly/portability/GTest.h>
+#include <stdexcept>
+
+using namespace watchman;
+
+using Cpus = std::vector<unsigned>;
+
+TEST(ThreadAffinityTest, parses_cpu_lists) {
+  EXPECT_EQ((Cpus{3}), parseCpuList("3"));
+  EXPECT_EQ((Cpus{0, 1, 2, 3, 8, 10, 11}), parseCpuList("0-3,8,10-11"));
+  // Sorted, without duplicates
+  EXPECT_EQ((Cpus{1, 2, 4}), parseCpuList("4,1-2,2"));
+}
+
+TEST(ThreadAffinityTest, rejects_malformed_cpu_lists) {
+  for (auto list : {"", ",", "1,", "a", "1-", "-1", "3-1", "1 ,2", "1--2"}) {
+    EXPECT_THROW(parseCpuList(list), std::invalid_argument) << list;
+  }
+}
+
+TEST(ThreadAffinityTest, scoped_affinity_is_restored) {
+  auto original = getCurrentThreadAffinity();
+  if (original.empty()) {
+    GTEST_SKIP() << "thread affinity isn't supported here";
+  }
+  {
+    ScopedThreadAffinity pinned{Cpus{original.front()}};
+    EXPECT_EQ((Cpus{original.front()}), getCurrentThreadAffinity());
+  }
+  EXPECT_EQ(original, getCurrentThreadAffinity());
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ThreadPool.h"
+#include <folly/portability/GTest.h>
+#include <future>
+#include <string>
+
+using namespace watchman;
+
+TEST(ThreadPool, runs_higher_priorities_first) {
+  ThreadPool pool;
+  pool.start(1, 1024);
+
+  // Hold the only worker so that everything below is queued up before
+  // any of it runs.
+  std::promise<void> release;
+  auto released = release.get_future().share();
+  pool.add([released] { released.wait(); });
+
+  std::mutex mutex;
+  std::string order;
+  auto record = [&](char c) {
+    return [&, c] {
+      std::lock_guard<std::mutex> lock(mutex);
+      order.push_back(c);
+    };
+  };
+
+  pool.addWithPriority(record('l'), folly::Executor::LO_PRI);
+  pool.add(record('m'));
+  pool.addWithPriority(record('h'), folly::Executor::HI_PRI);
+  pool.add(record('m'));
+
+  release.set_value();
+  pool.stop();
+
+  EXPECT_EQ("hmml", order);
+  EXPECT_EQ(5, pool.getStats().executed);
+}
+
+TEST(ThreadPool, idle_workers_steal_queued_tasks) {
+  ThreadPool pool;
+  pool.start(2, 1024);
+
+  // Tasks added by a worker go to its own queue, so while it waits for
+  // them, only the other worker can run them.
+  std::promise<bool> done;
+  pool.add([&] {
+    auto first = std::make_shared<std::promise<void>>();
+    auto second = std::make_shared<std::promise<void>>();
+    auto firstDone = first->get_future();
+    auto secondDone = second->get_future();
+    pool.add([first] { first->set_value(); });
+    pool.add([second] { second->set_value(); });
+    auto timeout = std::chrono::seconds(10);
+    done.set_value(
+        firstDone.wait_for(timeout) == std::future_status::ready &&
+        secondDone.wait_for(timeout) == std::future_status::ready);
+  });
+
+  EXPECT_TRUE(done.get_future().get());
+  pool.stop();
+  // The first task may have been stolen too
+  EXPECT_LE(2, pool.getStats().steals);
+}
+
+TEST(ThreadPool, waits_for_room_when_full) {
+  ThreadPool pool;
+  pool.start(1, 2);
+
+  std::promise<void> started;
+  std::promise<void> release;
+  auto released = release.get_future().share();
+  pool.add([&started, released] {
+    started.set_value();
+    released.wait();
+  });
+  // A running task no longer counts against the limit
+  started.get_future().wait();
+  std::atomic<int> ran{0};
+  pool.add([&] { ++ran; });
+  pool.add([&] { ++ran; });
+
+  auto producer = std::async(std::launch::async, [&] {
+    pool.add([&] { ++ran; });
+  });
+  while (pool.getStats().waits == 0) {
+    std::this_thread::yield();
+  }
+  EXPECT_EQ(
+      std::future_status::timeout,
+      producer.wait_for(std::chrono::milliseconds(10)));
+
+  release.set_value();
+  producer.get();
+  pool.stop();
+  EXPECT_EQ(3, ran);
+  EXPECT_EQ(2, pool.getStats().maxQueued);
+  EXPECT_THROW(pool.add([] {}), std::runtime_error);
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ThreadUsage.h"
+#include <folly/portability/GTest.h>
+#include <atomic>
+#include <thread>
+
+using namespace watchman;
+using namespace std::chrono;
+
+namespace {
+
+void spin(milliseconds howLong) {
+  auto deadline = steady_clock::now() + howLong;
+  while (steady_clock::now() < deadline) {
+  }
+}
+
+} // namespace
+
+TEST(ThreadUsageTest, counts_cpu_time_of_the_calling_thread) {
+  auto before = ThreadUsage::current();
+  spin(milliseconds(20));
+  auto used = ThreadUsage::current() - before;
+  EXPECT_GE(used.cpuTime, milliseconds(10));
+}
+
+TEST(ThreadUsageTest, does_not_count_other_threads) {
+  auto before = ThreadUsage::current();
+  std::thread other{[] { spin(milliseconds(50)); }};
+  other.join();
+  auto used = ThreadUsage::current() - before;
+  EXPECT_LT(used.cpuTime, milliseconds(40));
+}
+
+TEST(ThreadUsageTest, cpu_clock_reads_another_thread) {
+  ThreadCpuClock clock;
+  EXPECT_EQ(std::nullopt, clock.read());
+
+  std::atomic<bool> attached{false};
+  std::atomic<bool> done{false};
+  std::thread other{[&] {
+    clock.attachToCurrentThread();
+    attached = true;
+    spin(milliseconds(20));
+    while (!done) {
+    }
+    clock.detach();
+  }};
+  while (!attached) {
+  }
+  spin(milliseconds(20));
+  auto used = clock.read();
+  done = true;
+  other.join();
+
+#ifdef __linux__
+  ASSERT_TRUE(used.has_value());
+  EXPECT_GE(*used, milliseconds(10));
+#endif
+  EXPECT_EQ(std::nullopt, clock.read());
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+
+#include <thread>
+
+#include "watchman/Logging.h"
+#include "watchman/Trace.h"
+
+using namespace watchman;
+
+#ifdef WATCHMAN_ENABLE_TRACING
+
+namespace {
+
+std::vector<json_ref> spansNamed(const char* name) {
+  std::vector<json_ref> result;
+  auto events = dumpTraceEvents();
+  for (auto& event : events.array()) {
+    if (event.get("ph").asString() == "X" &&
+        event.get("name").asString() == name) {
+      result.push_back(event);
+    }
+  }
+  return result;
+}
+
+} // namespace
+
+TEST(TraceTest, spans_of_exited_threads_are_dumped) {
+  clearTrace();
+
+  std::thread thread{[] {
+    w_set_thread_name("tracetest");
+    TraceSpan outer{"outer"};
+    { TraceSpan inner{"inner"}; }
+    TraceSpan ended{"ended"};
+    ended.end();
+  }};
+  thread.join();
+
+  auto outer = spansNamed("outer");
+  auto inner = spansNamed("inner");
+  ASSERT_EQ(1, outer.size());
+  ASSERT_EQ(1, inner.size());
+  EXPECT_EQ(1, spansNamed("ended").size());
+
+  EXPECT_EQ(outer[0].get("tid").asInt(), inner[0].get("tid").asInt());
+  EXPECT_LE(
+      json_real_value(outer[0].get("ts")),
+      json_real_value(inner[0].get("ts")));
+  EXPECT_GE(
+      json_real_value(outer[0].get("dur")),
+      json_real_value(inner[0].get("dur")));
+
+  bool named = false;
+  auto events = dumpTraceEvents();
+  for (auto& event : events.array()) {
+    if (event.get("ph").asString() == "M" &&
+        event.get("tid").asInt() == outer[0].get("tid").asInt()) {
+      named = event.get("args").get("name").asString() == "tracetest";
+    }
+  }
+  EXPECT_TRUE(named);
+
+  clearTrace();
+  EXPECT_EQ(0, spansNamed("outer").size());
+}
+
+#endif
@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/experimental/bser/Bser.h>
+#include <folly/portability/GTest.h>
+
+#include <map>
+
+#include "watchman/cppclient/TypedQueryResult.h"
+#include "watchman/cppclient/WatchmanConnection.h"
+
+using namespace watchman;
+using folly::dynamic;
+
+namespace {
+
+std::unique_ptr<folly::IOBuf> encode(
+    const dynamic& response,
+    const folly::bser::serialization_opts& opts = {}) {
+  return folly::bser::toBserIOBuf(response, opts);
+}
+
+} // namespace
+
+TEST(TypedQueryResultTest, decodes_columns_of_each_type) {
+  auto response = dynamic::object("clock", "c:123:4")(
+      "is_fresh_instance", true)(
+      "files",
+      dynamic::array(
+          dynamic::object("name", "a")("size", 10)("exists", true)(
+              "mtime_f", 1.5),
+          dynamic::object("name", "b")("size", 0)("exists", false)(
+              "mtime_f", 2.0)));
+  auto result = TypedQueryResult::parse(
+      encode(response), {"name", "size", "exists", "mtime_f"});
+
+  ASSERT_EQ(2, result.size());
+  auto name = *result.fieldIndex("name");
+  auto size = *result.fieldIndex("size");
+  auto exists = *result.fieldIndex("exists");
+  auto mtime = *result.fieldIndex("mtime_f");
+  EXPECT_EQ(FieldType::String, result.fieldType(name));
+  EXPECT_EQ(FieldType::Integer, result.fieldType(size));
+  EXPECT_EQ(FieldType::Boolean, result.fieldType(exists));
+  EXPECT_EQ(FieldType::Real, result.fieldType(mtime));
+
+  EXPECT_EQ("a", result.strings(name)[0]);
+  EXPECT_EQ("b", result.strings(name)[1]);
+  EXPECT_EQ(10, result.integers(size)[0]);
+  // A legitimate zero is still present
+  EXPECT_EQ(0, result.integers(size)[1]);
+  EXPECT_TRUE(result.has(size, 1));
+  EXPECT_EQ(1, result.integers(exists)[0]);
+  EXPECT_EQ(0, result.integers(exists)[1]);
+  EXPECT_TRUE(result.has(exists, 1));
+  EXPECT_EQ(1.5, result.reals(mtime)[0]);
+
+  EXPECT_FALSE(result.fieldIndex("mode"));
+  EXPECT_THROW(result.integers(name), WatchmanError);
+
+  // The rest of the response is kept, without the files
+  EXPECT_EQ("c:123:4", result.response()["clock"].getString());
+  EXPECT_TRUE(result.response()["is_fresh_instance"].getBool());
+  EXPECT_EQ(nullptr, result.response().get_ptr("files"));
+}
+
+TEST(TypedQueryResultTest, missing_and_mistyped_values_are_absent) {
+  auto response = dynamic::object(
+      "files",
+      dynamic::array(
+          // symlink_target is null for files that aren't symlinks
+          dynamic::object("name", "a")("symlink_target", nullptr)(
+              "content.sha1hex", "da39a3ee"),
+          // A deleted file, with no hash or symlink_target at all
+          dynamic::object("name", "b"),
+          // The hash couldn't be computed, and there is a key that wasn't
+          // asked for
+          dynamic::object("name", "c")("symlink_target", "a")(
+              "content.sha1hex", dynamic::object("error", "EACCES"))(
+              "size", 3)));
+  auto result = TypedQueryResult::parse(
+      encode(response), {"name", "symlink_target", "content.sha1hex"});
+
+  ASSERT_EQ(3, result.size());
+  auto name = *result.fieldIndex("name");
+  auto target = *result.fieldIndex("symlink_target");
+  auto hash = *result.fieldIndex("content.sha1hex");
+
+  // Every column has a value for every file, present or not
+  EXPECT_EQ(3, result.strings(name).size());
+  EXPECT_EQ(3, result.strings(target).size());
+  EXPECT_EQ(3, result.strings(hash).size());
+
+  EXPECT_FALSE(result.has(target, 0));
+  EXPECT_TRUE(result.has(hash, 0));
+  EXPECT_EQ("da39a3ee", result.strings(hash)[0]);
+
+  EXPECT_TRUE(result.has(name, 1));
+  EXPECT_FALSE(result.has(target, 1));
+  EXPECT_FALSE(result.has(hash, 1));
+  EXPECT_EQ("", result.strings(hash)[1]);
+
+  EXPECT_TRUE(result.has(target, 2));
+  EXPECT_EQ("a", result.strings(target)[2]);
+  EXPECT_FALSE(result.has(hash, 2));
+  EXPECT_EQ("c", result.strings(name)[2]);
+}
+
+TEST(TypedQueryResultTest, decodes_templates_with_skipped_values) {
+  auto response = dynamic::object(
+      "files",
+      dynamic::array(
+          dynamic::object("name", "a")("size", 1)("mode", 0644),
+          dynamic::object("name", "b")));
+  auto keys = dynamic::array("name", "size", "mode");
+  folly::bser::serialization_opts opts;
+  // Files missing a key are encoded with a skip in its place
+  opts.templates = std::map<const dynamic*, const dynamic*>{
+      {&response["files"], &keys}};
+  auto result =
+      TypedQueryResult::parse(encode(response, opts), {"name", "size"});
+
+  ASSERT_EQ(2, result.size());
+  auto name = *result.fieldIndex("name");
+  auto size = *result.fieldIndex("size");
+  EXPECT_EQ("a", result.strings(name)[0]);
+  EXPECT_EQ("b", result.strings(name)[1]);
+  EXPECT_TRUE(result.has(size, 0));
+  EXPECT_EQ(1, result.integers(size)[0]);
+  EXPECT_FALSE(result.has(size, 1));
+}
+
+TEST(TypedQueryResultTest, decodes_a_single_field_as_values) {
+  auto response =
+      dynamic::object("files", dynamic::array("a", "b", dynamic::array()));
+  auto result = TypedQueryResult::parse(encode(response), {"name"});
+
+  ASSERT_EQ(3, result.size());
+  EXPECT_EQ("a", result.strings(0)[0]);
+  EXPECT_EQ("b", result.strings(0)[1]);
+  EXPECT_FALSE(result.has(0, 2));
+}
+
+TEST(TypedQueryResultTest, reports_errors) {
+  auto error = dynamic::object("error", "unable to resolve root");
+  EXPECT_THROW(
+      TypedQueryResult::parse(encode(error), {"name"}), WatchmanResponseError);
+
+  auto pdu = encode(dynamic::object("files", dynamic::array("a", "b")));
+  pdu->coalesce();
+  pdu->trimEnd(2);
+  EXPECT_THROW(
+      TypedQueryResult::parse(std::move(pdu), {"name"}), WatchmanError);
+}
+
+TEST(TypedQueryResultTest, field_types) {
+  EXPECT_EQ(FieldType::Boolean, fieldTypeOf("new"));
+  EXPECT_EQ(FieldType::Integer, fieldTypeOf("ino"));
+  EXPECT_EQ(FieldType::Integer, fieldTypeOf("mtime"));
+  EXPECT_EQ(FieldType::Integer, fieldTypeOf("ctime_ns"));
+  EXPECT_EQ(FieldType::Real, fieldTypeOf("atime_f"));
+  EXPECT_EQ(FieldType::String, fieldTypeOf("type"));
+  EXPECT_EQ(FieldType::String, fieldTypeOf("cclock"));
+}
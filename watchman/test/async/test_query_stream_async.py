@@ -0,0 +1,43 @@
+#!/usr/bin/env python3
+# vim:ts=4:sw=4:et:
+# Copyright (c) Meta Platforms, Inc. and affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+
+import asyncio
+import os
+import tempfile
+import unittest
+
+import AsyncWatchmanTestCase
+
+
+class TestQueryStream(AsyncWatchmanTestCase.AsyncWatchmanTestCase):
+    @unittest.skipIf(os.name == "nt", "not supported on windows")
+    def test_query_stream(self):
+        root = tempfile.mkdtemp()
+        names = ["f%d" % i for i in range(3000)]
+        for name in names:
+            self.touch_relative(root, name)
+
+        self.watchman_command("watch", root)
+        self.assert_root_file_set(root, files=names)
+
+        async def collect():
+            stream = await self.client.query_stream(
+                root, {"expression": ["exists"], "fields": ["name"]}
+            )
+            files = [f async for f in stream]
+            return files, stream.trailer
+
+        files, trailer = self.loop.run_until_complete(
+            asyncio.wait_for(collect(), 10)
+        )
+        self.assert_file_sets_equal(files, names)
+        self.assertEqual(len(files), len(names))
+        self.assertIn("clock", trailer)
+
+        # The client is usable for regular commands afterwards
+        self.assert_root_file_set(root, files=names)
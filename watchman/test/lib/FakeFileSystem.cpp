@@ -189,6 +189,7 @@ std::unique_ptr<DirHandle> FakeFileSystem::openDir(
 FileInformation FakeFileSystem::getFileInformation(
     const char* path,
     CaseSensitivity caseSensitive) {
+  fileInformationCount_.fetch_add(1, std::memory_order_relaxed);
   auto root = root_.rlock();
   return withPath(
       *root,
@@ -232,7 +233,6 @@ void FakeFileSystem::addNode(const char* path, const FileInformation& fi) {
 
   auto piece = parseAbsolute(path);
   while (!piece.empty()) {
-    fmt::print("piece = {}\n", piece);
     size_t idx = piece.find('/');
     folly::StringPiece this_level;
     if (idx == folly::StringPiece::npos) {
@@ -291,6 +291,34 @@ void FakeFileSystem::removeRecursively(const char* path) {
   });
 }
 
+void FakeFileSystem::rename(const char* from, const char* to) {
+  auto fromPair = parseAbsoluteBasename(from);
+  auto& fromName = fromPair.second;
+  auto toPair = parseAbsoluteBasename(to);
+  auto& toName = toPair.second;
+  auto root = root_.wlock();
+  auto node = withPath(*root, fromPair.first, "rename", [&](FakeInode& parent) {
+    auto it = parent.children.find(fromName.str());
+    if (it == parent.children.end()) {
+      throw std::system_error(
+          ENOENT,
+          std::generic_category(),
+          fmt::format("{} does not exist", from));
+    }
+    FakeInode moved = std::move(it->second);
+    parent.children.erase(it);
+    return moved;
+  });
+  withPath(*root, toPair.first, "rename", [&](FakeInode& parent) {
+    if (!parent.children.emplace(toName.str(), std::move(node)).second) {
+      throw std::system_error(
+          EEXIST,
+          std::generic_category(),
+          fmt::format("{} already exists", to));
+    }
+  });
+}
+
 FileInformation FakeFileSystem::fakeDir() {
   FileInformation fi{};
   fi.mode = S_IFDIR;
@@ -59,6 +59,14 @@ class FakeFileSystem final : public FileSystem {
 
   void touch(const char* path) override;
 
+  /**
+   * The number of getFileInformation() calls so far, including those that
+   * failed.
+   */
+  size_t getFileInformationCount() const {
+    return fileInformationCount_.load(std::memory_order_relaxed);
+  }
+
   // Modify the FS structure
 
   void defineContents(std::initializer_list<const char*> paths);
@@ -71,12 +79,20 @@ class FakeFileSystem final : public FileSystem {
 
   void removeRecursively(const char* path);
 
+  /**
+   * Moves the node at from, along with everything below it, to the path to,
+   * whose parent must exist and which must not.  The nodes keep their
+   * metadata, as a rename keeps the inodes.
+   */
+  void rename(const char* from, const char* to);
+
   FileInformation fakeDir();
   FileInformation fakeFile();
 
  private:
   const Flags flags_;
   std::atomic<ino_t> inodeNumber_{1};
+  std::atomic<size_t> fileInformationCount_{0};
   folly::Synchronized<FakeInode> root_;
 };
 
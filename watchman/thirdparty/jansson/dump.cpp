@@ -66,10 +66,12 @@ static int dump_indent(
 
 static int dump_string(
     const char* str,
+    size_t len,
     json_dump_callback_t dump,
     void* data,
     size_t flags) {
   const char *pos, *end;
+  const char* limit = str + len;
   int32_t codepoint;
 
   if (dump("\"", 1, data))
@@ -82,6 +84,13 @@ static int dump_string(
     int length;
 
     while (*end) {
+      /* pass runs of characters that need no escaping through in bulk */
+      size_t run = jsonp_plain_prefix(pos, limit, flags & JSON_ESCAPE_SLASH);
+      if (run) {
+        pos = end = pos + run;
+        continue;
+      }
+
       end = utf8_iterate(pos, &codepoint);
       if (!end) {
         return -1;
@@ -215,8 +224,14 @@ static int do_dump(
       return dump(buffer, size, data);
     }
 
-    case JSON_STRING:
-      return dump_string(json_string_value(json), dump, data, flags);
+    case JSON_STRING: {
+      auto& str = json_to_w_string(json);
+      return dump_string(str.c_str(), str.size(), dump, data, flags);
+    }
+
+    case JSON_BSER:
+      return do_dump(
+          json_to_bser(json.get())->decoded(), flags, depth, dump, data);
 
     case JSON_ARRAY: {
       auto& arr = json.array();
@@ -294,7 +309,12 @@ static int do_dump(
         while (sorted_it != items.end()) {
           auto next = std::next(sorted_it);
 
-          dump_string((*sorted_it)->first.c_str(), dump, data, flags);
+          dump_string(
+              (*sorted_it)->first.c_str(),
+              (*sorted_it)->first.size(),
+              dump,
+              data,
+              flags);
           if (dump(separator, separator_length, data) ||
               do_dump((*sorted_it)->second, flags, depth + 1, dump, data)) {
             return -1;
@@ -317,7 +337,7 @@ static int do_dump(
         while (it != object->map.end()) {
           auto next = std::next(it);
 
-          dump_string(it->first.c_str(), dump, data, flags);
+          dump_string(it->first.c_str(), it->first.size(), dump, data, flags);
           if (dump(separator, separator_length, data) ||
               do_dump(it->second, flags, depth + 1, dump, data)) {
             return -1;
@@ -373,7 +393,8 @@ int json_dump_callback(
     void* data,
     size_t flags) {
   if (!(flags & JSON_ENCODE_ANY)) {
-    if (!json.isArray() && !json.isObject())
+    // JSON_BSER values are only produced for arrays
+    if (!json.isArray() && !json.isObject() && json.type() != JSON_BSER)
       return -1;
   }
 
@@ -31,11 +31,16 @@ enum json_type : char {
   JSON_REAL,
   JSON_TRUE,
   JSON_FALSE,
-  JSON_NULL
+  JSON_NULL,
+  // A value that has already been serialized as BSER; see
+  // BserArrayEncoder in watchman/bser.h
+  JSON_BSER
 };
 
 struct json_t {
   json_type type;
+  // Set if this value was carved out of a json_arena_scope block
+  bool in_arena{false};
   std::atomic<size_t> refcount;
 
   explicit json_t(json_type type);
@@ -209,6 +214,49 @@ class json_ref {
   json_int_t asInt() const;
 };
 
+/* request-scoped allocation */
+
+/**
+ * While a json_arena_scope is alive, the json values created on the current
+ * thread are carved out of large blocks instead of being allocated one at a
+ * time. This takes most of the allocator traffic, and the contention between
+ * client threads, out of decoding a request and rendering its response.
+ *
+ * Values remain reference counted and may safely outlive the scope.  Each
+ * block is released when the last value in it is.  That means one long
+ * lived value pins its whole block, so scopes should cover short-lived work
+ * such as a single command.  Scopes nest and must be destroyed on the thread
+ * that created them.
+ */
+class json_arena_scope {
+ public:
+  json_arena_scope();
+  ~json_arena_scope();
+
+  json_arena_scope(const json_arena_scope&) = delete;
+  json_arena_scope& operator=(const json_arena_scope&) = delete;
+
+  /**
+   * DO NOT USE. Returns size bytes from the innermost scope on this thread,
+   * or nullptr if there is none or size is too large for a block.
+   */
+  static void* allocate(size_t size);
+
+  /**
+   * DO NOT USE. Releases memory returned by allocate().  May be called from
+   * any thread.
+   */
+  static void deallocate(void* ptr);
+
+ private:
+  void retireBlock();
+
+  json_arena_scope* previous_;
+  char* block_{nullptr};
+  size_t used_{0};
+  size_t allocations_{0};
+};
+
 /* construction, destruction, reference counting */
 
 json_ref json_object();
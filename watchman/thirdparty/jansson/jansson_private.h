@@ -9,7 +9,11 @@
 #define JANSSON_PRIVATE_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 #include <algorithm>
+#include <new>
+#include <string>
 #include <unordered_map>
 #include <vector>
 #include "jansson.h"
@@ -49,6 +53,56 @@ struct json_integer_t : json_t {
   json_integer_t(json_int_t value);
 };
 
+struct json_bser_t : json_t {
+  // The encoding parameters that the bytes were produced with
+  uint32_t bser_version;
+  uint32_t bser_capabilities;
+  // The serialized value is header followed by body
+  std::string header;
+  std::string body;
+  // Parses the serialized value, for consumers that need it as json values
+  // or in another encoding.  Provided by the producer because jansson
+  // doesn't depend on the BSER implementation.
+  json_ref (*decode)(const char* buf, const char* end);
+
+  json_bser_t(
+      uint32_t bser_version,
+      uint32_t bser_capabilities,
+      std::string header,
+      std::string body,
+      json_ref (*decode)(const char* buf, const char* end));
+
+  json_ref decoded() const;
+};
+
+/**
+ * Allocates and constructs a json value, from the innermost json_arena_scope
+ * on this thread if there is one.  All refcounted values must be created
+ * this way so that json_ref::json_delete can release them.
+ */
+template <typename T, typename... Args>
+json_ref json_make(Args&&... args) {
+  static_assert(alignof(T) <= alignof(std::max_align_t));
+  void* mem = json_arena_scope::allocate(sizeof(T));
+  bool in_arena = mem != nullptr;
+  if (!in_arena) {
+    mem = ::operator new(sizeof(T));
+  }
+  T* value;
+  try {
+    value = new (mem) T(std::forward<Args>(args)...);
+  } catch (...) {
+    if (in_arena) {
+      json_arena_scope::deallocate(mem);
+    } else {
+      ::operator delete(mem);
+    }
+    throw;
+  }
+  value->in_arena = in_arena;
+  return json_ref::takeOwnership(value);
+}
+
 inline json_object_t* json_to_object(const json_t* json) {
   return static_cast<json_object_t*>(const_cast<json_t*>(json));
 }
@@ -69,6 +123,10 @@ inline json_integer_t* json_to_integer(const json_t* json) {
   return static_cast<json_integer_t*>(const_cast<json_t*>(json));
 }
 
+inline json_bser_t* json_to_bser(const json_t* json) {
+  return static_cast<json_bser_t*>(const_cast<json_t*>(json));
+}
+
 void jsonp_error_init(json_error_t* error, const char* source);
 void jsonp_error_set_source(json_error_t* error, const char* source);
 void jsonp_error_set(
@@ -86,6 +144,44 @@ void jsonp_error_vset(
     const char* msg,
     va_list ap);
 
+/* Returns the length of the longest prefix of [str, end) that consists of
+   printable ASCII characters other than '"', '\\' and, if escape_slash is
+   set, '/'.  Those characters stand for themselves in JSON strings, so the
+   lexer and dumper can pass their runs through as is.  Scans a word at a
+   time. */
+inline size_t
+jsonp_plain_prefix(const char* str, const char* end, bool escape_slash) {
+  constexpr uint64_t kOnes = 0x0101010101010101ULL;
+  constexpr uint64_t kHighBits = 0x8080808080808080ULL;
+  auto has_zero_byte = [](uint64_t v) { return (v - kOnes) & ~v & kHighBits; };
+
+  const char* pos = str;
+  while (end - pos >= 8) {
+    uint64_t word;
+    memcpy(&word, pos, sizeof(word));
+    uint64_t special = (word & kHighBits) |
+        ((word - 0x20 * kOnes) & ~word & kHighBits) |
+        has_zero_byte(word ^ ('"' * kOnes)) |
+        has_zero_byte(word ^ ('\\' * kOnes));
+    if (escape_slash) {
+      special |= has_zero_byte(word ^ ('/' * kOnes));
+    }
+    if (special) {
+      break;
+    }
+    pos += 8;
+  }
+  while (pos < end) {
+    unsigned char c = *pos;
+    if (c < 0x20 || c >= 0x80 || c == '"' || c == '\\' ||
+        (escape_slash && c == '/')) {
+      break;
+    }
+    ++pos;
+  }
+  return pos - str;
+}
+
 /* Locale independent string<->double conversions */
 int jsonp_strtod(std::string& strbuffer, double* out);
 int jsonp_dtostr(char* buffer, size_t size, double value);
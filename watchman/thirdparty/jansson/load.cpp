@@ -56,9 +56,18 @@ namespace {
 // let's limit container depth.
 constexpr size_t kMaximumDepth = 1000;
 
+typedef struct {
+  const char* data;
+  size_t len;
+  size_t pos;
+} buffer_data_t;
+
 typedef struct {
   get_func get;
   void* data;
+  /* Set when data is a buffer_data_t, which lets the lexer consume runs of
+     plain string characters without calling get for each of them */
+  buffer_data_t* buffer_source;
   char buffer[5];
   size_t buffer_pos;
   int state;
@@ -164,6 +173,7 @@ error_set(json_error_t* error, const lex_t* lex, const char* msg, ...) {
 static void stream_init(stream_t* stream, get_func get, void* data) {
   stream->get = get;
   stream->data = data;
+  stream->buffer_source = nullptr;
   stream->buffer[0] = '\0';
   stream->buffer_pos = 0;
 
@@ -284,6 +294,25 @@ static void lex_save_cached(lex_t* lex) {
   }
 }
 
+/* Saves the run of plain characters that follows in a string, taking them
+   straight from the buffer that the stream reads from, if any */
+static void lex_save_plain_run(lex_t* lex) {
+  stream_t* stream = &lex->stream;
+  buffer_data_t* source = stream->buffer_source;
+  if (!source || stream->state != STREAM_STATE_OK ||
+      stream->buffer[stream->buffer_pos]) {
+    return;
+  }
+
+  const char* start = source->data + source->pos;
+  size_t run = jsonp_plain_prefix(start, source->data + source->len, false);
+  lex->saved_text.append(start, run);
+  source->pos += run;
+  /* the run holds no newlines or multi-byte sequences */
+  stream->position += run;
+  stream->column += run;
+}
+
 /* assumes that str points to 'u' plus at least 4 valid hex digits */
 static int32_t decode_unicode_escape(const char* str) {
   int i;
@@ -309,7 +338,7 @@ static int32_t decode_unicode_escape(const char* str) {
 
 static void lex_scan_string(lex_t* lex, json_error_t* error) {
   int c;
-  const char* p;
+  const char *p, *p_end;
   char* t;
   int i;
 
@@ -352,8 +381,10 @@ static void lex_scan_string(lex_t* lex, json_error_t* error) {
         error_set(error, lex, "invalid escape");
         goto out;
       }
-    } else
+    } else {
+      lex_save_plain_run(lex);
       c = lex_get_save(lex, error);
+    }
   }
 
   /* the actual value is at most of the same length as the source
@@ -370,6 +401,7 @@ static void lex_scan_string(lex_t* lex, json_error_t* error) {
 
   /* + 1 to skip the " */
   p = lex->saved_text.c_str() + 1;
+  p_end = lex->saved_text.c_str() + lex->saved_text.size();
 
   while (*p != '"') {
     if (*p == '\\') {
@@ -447,8 +479,13 @@ static void lex_scan_string(lex_t* lex, json_error_t* error) {
         t++;
         p++;
       }
-    } else
-      *(t++) = *(p++);
+    } else {
+      /* copy up to the next escape or the closing quote in one go */
+      size_t run = 1 + jsonp_plain_prefix(p + 1, p_end, false);
+      memcpy(t, p, run);
+      t += run;
+      p += run;
+    }
   }
   *t = '\0';
   lex->token = TOKEN_STRING;
@@ -849,12 +886,6 @@ json_loads(const char* string, size_t flags, json_error_t* error) {
   return parse_json(&lex, flags, error);
 }
 
-typedef struct {
-  const char* data;
-  size_t len;
-  size_t pos;
-} buffer_data_t;
-
 static int buffer_get(void* data) {
   char c;
   auto stream = (buffer_data_t*)data;
@@ -887,6 +918,7 @@ std::optional<json_ref> json_loadb(
 
   if (lex_init(&lex, buffer_get, (void*)&stream_data))
     return std::nullopt;
+  lex.stream.buffer_source = &stream_data;
 
   return parse_json(&lex, flags, error);
 }
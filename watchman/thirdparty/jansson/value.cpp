@@ -11,6 +11,8 @@
 #include "jansson.h"
 #include "jansson_private.h"
 
+#include <folly/Memory.h>
+
 #include <algorithm>
 #include <cmath>
 #include <string>
@@ -38,6 +40,8 @@ const char* getTypeName(json_type t) {
       return "false";
     case JSON_NULL:
       return "null";
+    case JSON_BSER:
+      return "bser";
   }
   return "<unknown>";
 }
@@ -135,7 +139,7 @@ json_object_t::json_object_t(std::unordered_map<w_string, json_ref> values)
     : json_t{JSON_OBJECT}, map{std::move(values)} {}
 
 json_ref json_object(std::unordered_map<w_string, json_ref> values) {
-  return json_ref::takeOwnership(new json_object_t(std::move(values)));
+  return json_make<json_object_t>(std::move(values));
 }
 
 json_ref json_object(
@@ -151,7 +155,7 @@ json_ref json_object(
 }
 
 json_ref json_object() {
-  return json_ref::takeOwnership(new json_object_t{{}});
+  return json_make<json_object_t>(std::unordered_map<w_string, json_ref>{});
 }
 
 size_t json_object_size(const json_ref& json) {
@@ -309,11 +313,11 @@ const std::vector<json_ref>& json_ref::array() const {
 }
 
 json_ref json_array(std::vector<json_ref> values) {
-  return json_ref::takeOwnership(new json_array_t(std::move(values)));
+  return json_make<json_array_t>(std::move(values));
 }
 
 json_ref json_array(std::initializer_list<json_ref> values) {
-  return json_ref::takeOwnership(new json_array_t(std::move(values)));
+  return json_make<json_array_t>(std::move(values));
 }
 
 int json_array_set_template(const json_ref& json, const json_ref& templ) {
@@ -375,7 +379,7 @@ json_string_t::json_string_t(w_string str)
     : json_t(JSON_STRING), value(std::move(str)) {}
 
 json_ref w_string_to_json(w_string str) {
-  return json_ref::takeOwnership(new json_string_t(str));
+  return json_make<json_string_t>(str);
 }
 
 const char* json_string_value(const json_ref& json) {
@@ -405,7 +409,7 @@ json_integer_t::json_integer_t(json_int_t value)
     : json_t(JSON_INTEGER), value(value) {}
 
 json_ref json_integer(json_int_t value) {
-  return json_ref::takeOwnership(new json_integer_t(value));
+  return json_make<json_integer_t>(value);
 }
 
 json_int_t json_integer_value(const json_ref& json) {
@@ -433,7 +437,7 @@ json_ref json_real(double value) {
   if (!std::isfinite(value)) {
     throw std::domain_error("Numeric JSON values must be finite");
   }
-  return json_ref::takeOwnership(new json_real_t(value));
+  return json_make<json_real_t>(value);
 }
 
 double json_real_value(const json_ref& json) {
@@ -448,6 +452,32 @@ static int json_real_equal(const json_ref& real1, const json_ref& real2) {
   return json_real_value(real1) == json_real_value(real2);
 }
 
+/*** pre-encoded bser ***/
+
+json_bser_t::json_bser_t(
+    uint32_t bser_version,
+    uint32_t bser_capabilities,
+    std::string header,
+    std::string body,
+    json_ref (*decode)(const char* buf, const char* end))
+    : json_t(JSON_BSER),
+      bser_version(bser_version),
+      bser_capabilities(bser_capabilities),
+      header(std::move(header)),
+      body(std::move(body)),
+      decode(decode) {}
+
+json_ref json_bser_t::decoded() const {
+  std::string bytes = header + body;
+  return decode(bytes.data(), bytes.data() + bytes.size());
+}
+
+static int json_bser_equal(const json_ref& bser1, const json_ref& bser2) {
+  return json_equal(
+      json_to_bser(bser1.get())->decoded(),
+      json_to_bser(bser2.get())->decoded());
+}
+
 /*** number ***/
 
 double json_number_value(const json_ref& json) {
@@ -475,22 +505,40 @@ json_ref json_null() {
 
 /*** deletion ***/
 
+namespace {
+
+template <typename T>
+void json_destroy(json_t* json) {
+  bool in_arena = json->in_arena;
+  static_cast<T*>(json)->~T();
+  if (in_arena) {
+    json_arena_scope::deallocate(json);
+  } else {
+    ::operator delete(json);
+  }
+}
+
+} // namespace
+
 void json_ref::json_delete(json_t* json) {
   switch (json->type) {
     case JSON_OBJECT:
-      delete (json_object_t*)json;
+      json_destroy<json_object_t>(json);
       break;
     case JSON_ARRAY:
-      delete (json_array_t*)json;
+      json_destroy<json_array_t>(json);
       break;
     case JSON_STRING:
-      delete (json_string_t*)json;
+      json_destroy<json_string_t>(json);
       break;
     case JSON_INTEGER:
-      delete (json_integer_t*)json;
+      json_destroy<json_integer_t>(json);
       break;
     case JSON_REAL:
-      delete (json_real_t*)json;
+      json_destroy<json_real_t>(json);
+      break;
+    case JSON_BSER:
+      json_destroy<json_bser_t>(json);
       break;
     case JSON_TRUE:
     case JSON_FALSE:
@@ -499,6 +547,129 @@ void json_ref::json_delete(json_t* json) {
   }
 }
 
+/*** arena ***/
+
+namespace {
+
+// Blocks are aligned to their size so that the block holding a value can be
+// found from its address alone.
+constexpr size_t kArenaBlockSize = 64 * 1024;
+constexpr size_t kArenaAlignment = alignof(std::max_align_t);
+// Larger values are rare and are allocated individually
+constexpr size_t kArenaMaxAllocation = 1024;
+
+struct json_arena_block {
+  // Starts out biased by kArenaBlockSize, which is more than the number of
+  // values that can fit in a block, so that allocating from a block doesn't
+  // need to touch this atomic.  When the block is retired from its scope,
+  // the bias is replaced by the number of values that were allocated.  The
+  // last value to be freed, or the retirement, releases the block.
+  std::atomic<size_t> live;
+};
+
+constexpr size_t kArenaHeaderSize =
+    (sizeof(json_arena_block) + kArenaAlignment - 1) & ~(kArenaAlignment - 1);
+
+thread_local json_arena_scope* current_arena = nullptr;
+
+// Released blocks are kept for reuse by the thread that released them, as
+// allocating suitably aligned blocks from the system is relatively slow.
+class json_arena_block_cache {
+ public:
+  ~json_arena_block_cache() {
+    for (auto* block : blocks_) {
+      folly::aligned_free(block);
+    }
+    // Values may still be released during thread exit, after this point
+    destroyed = true;
+  }
+
+  void* take() {
+    if (destroyed || blocks_.empty()) {
+      return folly::aligned_malloc(kArenaBlockSize, kArenaBlockSize);
+    }
+    void* block = blocks_.back();
+    blocks_.pop_back();
+    return block;
+  }
+
+  void give(void* block) {
+    if (!destroyed && blocks_.size() < kMaxBlocks) {
+      blocks_.push_back(block);
+    } else {
+      folly::aligned_free(block);
+    }
+  }
+
+ private:
+  static constexpr size_t kMaxBlocks = 16;
+  static thread_local bool destroyed;
+  std::vector<void*> blocks_;
+};
+
+thread_local bool json_arena_block_cache::destroyed = false;
+
+thread_local json_arena_block_cache block_cache;
+
+json_arena_block* json_arena_block_of(void* ptr) {
+  return reinterpret_cast<json_arena_block*>(
+      reinterpret_cast<uintptr_t>(ptr) & ~(kArenaBlockSize - 1));
+}
+
+void json_arena_release(json_arena_block* block, size_t count) {
+  if (block->live.fetch_sub(count, std::memory_order_acq_rel) == count) {
+    block->~json_arena_block();
+    block_cache.give(block);
+  }
+}
+
+} // namespace
+
+json_arena_scope::json_arena_scope()
+    : previous_{std::exchange(current_arena, this)} {}
+
+json_arena_scope::~json_arena_scope() {
+  assert(current_arena == this);
+  retireBlock();
+  current_arena = previous_;
+}
+
+void* json_arena_scope::allocate(size_t size) {
+  auto* arena = current_arena;
+  if (!arena || size > kArenaMaxAllocation) {
+    return nullptr;
+  }
+  size = (size + kArenaAlignment - 1) & ~(kArenaAlignment - 1);
+  if (!arena->block_ || arena->used_ + size > kArenaBlockSize) {
+    arena->retireBlock();
+    void* mem = block_cache.take();
+    if (!mem) {
+      throw std::bad_alloc();
+    }
+    new (mem) json_arena_block{{kArenaBlockSize}};
+    arena->block_ = static_cast<char*>(mem);
+    arena->used_ = kArenaHeaderSize;
+    arena->allocations_ = 0;
+  }
+  void* result = arena->block_ + arena->used_;
+  arena->used_ += size;
+  ++arena->allocations_;
+  return result;
+}
+
+void json_arena_scope::deallocate(void* ptr) {
+  json_arena_release(json_arena_block_of(ptr), 1);
+}
+
+void json_arena_scope::retireBlock() {
+  if (block_) {
+    json_arena_release(
+        reinterpret_cast<json_arena_block*>(block_),
+        kArenaBlockSize - allocations_);
+    block_ = nullptr;
+  }
+}
+
 /*** equality ***/
 
 int json_equal(const json_ref& json1, const json_ref& json2) {
@@ -524,6 +695,9 @@ int json_equal(const json_ref& json1, const json_ref& json2) {
   if (json1.isDouble())
     return json_real_equal(json1, json2);
 
+  if (json1.type() == JSON_BSER)
+    return json_bser_equal(json1, json2);
+
   return 0;
 }
 
@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/watcher/DirPoller.h"
+#include <algorithm>
+#include <vector>
+#include "watchman/Constants.h"
+#include "watchman/Logging.h"
+#include "watchman/PendingCollection.h"
+#include "watchman/WatchmanConfig.h"
+#include "watchman/fs/FileSystem.h"
+#include "watchman/root/Root.h"
+
+namespace watchman {
+
+namespace {
+
+// After its entries change, a dir's files are rescanned on this many more
+// polls, for the modifications that tend to follow
+constexpr int kHotPolls = 3;
+
+} // namespace
+
+DirPoller::DirPoller(const Configuration& config)
+    : minInterval_(std::chrono::milliseconds(std::max<json_int_t>(
+          config.getInt("poll_interval_min_ms", 1000), 1))),
+      maxInterval_(std::max(
+          minInterval_,
+          Clock::duration(std::chrono::milliseconds(
+              config.getInt("poll_interval_max_ms", 60000))))),
+      pollsPerSecond_(double(std::max<json_int_t>(
+          config.getInt("poll_dirs_per_second", 1000), 0))),
+      tokens_(pollsPerSecond_),
+      refilled_(Clock::now()) {}
+
+void DirPoller::add(const w_string& path, const FileInformation& st) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  addLocked(path, Fingerprint{st});
+}
+
+void DirPoller::add(const w_string& path) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  addLocked(path, Fingerprint{});
+}
+
+void DirPoller::addLocked(
+    const w_string& path,
+    const Fingerprint& fingerprint) {
+  auto [it, inserted] = dirs_.try_emplace(path);
+  auto& dir = it->second;
+  dir.fingerprint = fingerprint;
+  if (inserted) {
+    dir.interval = minInterval_;
+    dir.scheduled = schedule_.end();
+    scheduleLocked(dir, path, Clock::now() + minInterval_);
+    cond_.notify_all();
+  }
+}
+
+void DirPoller::scheduleLocked(
+    Dir& dir,
+    const w_string& path,
+    Clock::time_point due) {
+  if (dir.scheduled != schedule_.end()) {
+    schedule_.erase(dir.scheduled);
+  }
+  dir.scheduled = schedule_.emplace(due, path);
+}
+
+void DirPoller::removeTree(const w_string& path) {
+  std::lock_guard<std::mutex> lock{mutex_};
+  removeTreeLocked(path);
+}
+
+void DirPoller::removeTreeLocked(const w_string& path) {
+  auto prefix = path.piece();
+  for (auto it = dirs_.begin(); it != dirs_.end();) {
+    auto name = it->first.piece();
+    if (name == prefix ||
+        (name.startsWith(prefix) && name.size() > prefix.size() &&
+         is_slash(name[prefix.size()]))) {
+      if (it->second.scheduled != schedule_.end()) {
+        schedule_.erase(it->second.scheduled);
+      }
+      it = dirs_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+size_t DirPoller::size() const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return dirs_.size();
+}
+
+void DirPoller::refillLocked(Clock::time_point now) {
+  if (pollsPerSecond_ > 0) {
+    std::chrono::duration<double> elapsed = now - refilled_;
+    tokens_ =
+        std::min(pollsPerSecond_, tokens_ + elapsed.count() * pollsPerSecond_);
+  }
+  refilled_ = now;
+}
+
+DirPoller::Clock::time_point DirPoller::nextPollLocked() const {
+  if (schedule_.empty()) {
+    return Clock::time_point::max();
+  }
+  auto next = schedule_.begin()->first;
+  if (pollsPerSecond_ > 0 && tokens_ < 1) {
+    auto refill = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>((1 - tokens_) / pollsPerSecond_));
+    next = std::max(next, refilled_ + refill);
+  }
+  return next;
+}
+
+DirPoller::Clock::time_point DirPoller::nextPoll() const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  return nextPollLocked();
+}
+
+void DirPoller::poll(const Root& root, PendingChanges& coll) {
+  std::vector<w_string> due;
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    auto now = Clock::now();
+    refillLocked(now);
+    while (!schedule_.empty() && schedule_.begin()->first <= now &&
+           due.size() < WATCHMAN_BATCH_LIMIT) {
+      if (pollsPerSecond_ > 0) {
+        if (tokens_ < 1) {
+          ++deferredCount_;
+          break;
+        }
+        tokens_ -= 1;
+      }
+      auto& path = schedule_.begin()->second;
+      dirs_[path].scheduled = schedule_.end();
+      due.push_back(path);
+      schedule_.erase(schedule_.begin());
+    }
+  }
+
+  // Stat'd without the lock, so that the crawler can keep adding dirs
+  std::vector<std::optional<FileInformation>> stats;
+  stats.reserve(due.size());
+  for (auto& path : due) {
+    try {
+      stats.emplace_back(getFileInformation(path.c_str(), root.case_sensitive));
+    } catch (const std::system_error& exc) {
+      logf(DBG, "poll: failed to stat {}: {}\n", path, exc.what());
+      stats.emplace_back(std::nullopt);
+    }
+  }
+
+  auto now = std::chrono::system_clock::now();
+  std::lock_guard<std::mutex> lock{mutex_};
+  for (size_t i = 0; i < due.size(); ++i) {
+    auto& path = due[i];
+    auto it = dirs_.find(path);
+    if (it == dirs_.end() || it->second.scheduled != schedule_.end()) {
+      // Removed, or added again by a crawl, while we weren't looking
+      continue;
+    }
+    ++pollCount_;
+    auto& st = stats[i];
+    if (!st || !st->isDir()) {
+      // Gone, or replaced by a file; the IO thread works out which, and
+      // the crawl of anything that took its place adds it again
+      coll.add(path, now, W_PENDING_VIA_NOTIFY);
+      removeTreeLocked(path);
+      continue;
+    }
+
+    auto& dir = it->second;
+    Fingerprint fingerprint{*st};
+    bool rescan;
+    if (!(fingerprint == dir.fingerprint)) {
+      dir.fingerprint = fingerprint;
+      dir.interval = minInterval_;
+      dir.hotPolls = kHotPolls;
+      rescan = true;
+    } else if (dir.hotPolls > 0) {
+      --dir.hotPolls;
+      rescan = true;
+    } else {
+      rescan = dir.interval >= maxInterval_;
+      dir.interval = std::min(dir.interval * 2, maxInterval_);
+    }
+    if (root.cookies.isCookieDir(path)) {
+      // sync_to_now waits for the poll that finds its cookie
+      dir.interval = minInterval_;
+    }
+
+    if (rescan) {
+      ++rescanCount_;
+      coll.add(path, now, W_PENDING_VIA_NOTIFY | W_PENDING_NONRECURSIVE_SCAN);
+    }
+    scheduleLocked(dir, path, Clock::now() + dir.interval);
+  }
+}
+
+bool DirPoller::wait(Clock::time_point deadline) {
+  std::unique_lock<std::mutex> lock{mutex_};
+  while (!stopped_) {
+    auto now = Clock::now();
+    refillLocked(now);
+    auto next = nextPollLocked();
+    if (next <= now) {
+      return true;
+    }
+    if (now >= deadline) {
+      return false;
+    }
+    cond_.wait_until(lock, std::min(next, deadline));
+  }
+  return false;
+}
+
+void DirPoller::stop() {
+  std::lock_guard<std::mutex> lock{mutex_};
+  stopped_ = true;
+  cond_.notify_all();
+}
+
+json_ref DirPoller::getDebugInfo() const {
+  std::lock_guard<std::mutex> lock{mutex_};
+  size_t hot = 0;
+  size_t cold = 0;
+  for (auto& [_, dir] : dirs_) {
+    if (dir.hotPolls > 0) {
+      ++hot;
+    } else if (dir.interval >= maxInterval_) {
+      ++cold;
+    }
+  }
+  return json_object({
+      {"dir_count", json_integer(dirs_.size())},
+      {"hot_dir_count", json_integer(hot)},
+      {"cold_dir_count", json_integer(cold)},
+      {"poll_count", json_integer(pollCount_)},
+      {"rescan_count", json_integer(rescanCount_)},
+      {"deferred_count", json_integer(deferredCount_)},
+  });
+}
+
+void DirPoller::clearDebugInfo() {
+  std::lock_guard<std::mutex> lock{mutex_};
+  pollCount_ = 0;
+  rescanCount_ = 0;
+  deferredCount_ = 0;
+}
+
+} // namespace watchman
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include "watchman/fs/FileInformation.h"
+#include "watchman/thirdparty/jansson/jansson.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+class Configuration;
+class PendingChanges;
+class Root;
+
+/**
+ * Notices the changes to a set of dirs by polling them, for watchers that
+ * can't be told about them.
+ *
+ * Each dir is fingerprinted, and a poll rescans its entries only if its
+ * fingerprint changed.  Each dir has its own poll interval:
+ * poll_interval_min_ms once it changes, doubling with each poll that finds
+ * it unchanged, up to poll_interval_max_ms.  Modifying a file in place
+ * doesn't change its dir, so a dir's files are also rescanned on the few
+ * polls after a change, and on each poll once the dir has gone cold.
+ * poll_dirs_per_second bounds the polls of all of the dirs; dirs that come
+ * due beyond it wait their turn.
+ *
+ * Thread safe.
+ */
+class DirPoller {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit DirPoller(const Configuration& config);
+
+  /**
+   * Starts polling the dir at path, or refreshes its fingerprint if it is
+   * already polled.  Without st, the dir's first poll rescans it.
+   */
+  void add(const w_string& path, const FileInformation& st);
+  void add(const w_string& path);
+
+  /** Stops polling path and the dirs beneath it. */
+  void removeTree(const w_string& path);
+
+  size_t size() const;
+
+  /**
+   * Polls the dirs that are due, as far as the budget allows, and adds
+   * the changes it finds to coll.
+   */
+  void poll(const Root& root, PendingChanges& coll);
+
+  /** When the next dir is due, allowing for the budget. */
+  Clock::time_point nextPoll() const;
+
+  /**
+   * Waits until a dir is due, until deadline or until stop() is called.
+   * Returns whether a dir is due.
+   */
+  bool wait(Clock::time_point deadline);
+
+  void stop();
+
+  json_ref getDebugInfo() const;
+  void clearDebugInfo();
+
+ private:
+  /**
+   * What a poll compares to tell whether a dir's entries changed.  Adding,
+   * removing or renaming an entry moves the dir's mtime, and replacing the
+   * dir changes its inode.  A default Fingerprint matches no dir.
+   */
+  struct Fingerprint {
+    struct timespec mtime {
+      0, 0
+    };
+    off_t size{0};
+    ino_t ino{0};
+
+    Fingerprint() = default;
+    explicit Fingerprint(const FileInformation& st)
+        : mtime(st.mtime), size(st.size), ino(st.ino) {}
+
+    bool operator==(const Fingerprint& other) const {
+      return mtime.tv_sec == other.mtime.tv_sec &&
+          mtime.tv_nsec == other.mtime.tv_nsec && size == other.size &&
+          ino == other.ino;
+    }
+  };
+
+  using Schedule = std::multimap<Clock::time_point, w_string>;
+
+  struct Dir {
+    Fingerprint fingerprint;
+    Clock::duration interval;
+    int hotPolls{0};
+    // Its place in the schedule, or end() while it is being polled
+    Schedule::iterator scheduled;
+  };
+
+  // The following are guarded by mutex_
+  void addLocked(const w_string& path, const Fingerprint& fingerprint);
+  void scheduleLocked(Dir& dir, const w_string& path, Clock::time_point due);
+  void removeTreeLocked(const w_string& path);
+  void refillLocked(Clock::time_point now);
+  Clock::time_point nextPollLocked() const;
+
+  const Clock::duration minInterval_;
+  const Clock::duration maxInterval_;
+  // Zero for no limit
+  const double pollsPerSecond_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable cond_;
+  std::unordered_map<w_string, Dir> dirs_;
+  Schedule schedule_;
+  // The polls that may be made before the budget is spent, and when that
+  // was last worked out
+  double tokens_;
+  Clock::time_point refilled_;
+  bool stopped_{false};
+
+  size_t pollCount_{0};
+  size_t rescanCount_{0};
+  size_t deferredCount_{0};
+};
+
+} // namespace watchman
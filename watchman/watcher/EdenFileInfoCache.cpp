@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/watcher/EdenFileInfoCache.h"
+
+namespace watchman {
+
+namespace {
+
+bool samePosition(const ClockPosition& a, const ClockPosition& b) {
+  return a.rootNumber == b.rootNumber && a.ticks == b.ticks;
+}
+
+} // namespace
+
+EdenFileInfoCache::EdenFileInfoCache(size_t maxEntries)
+    : maxEntries_{maxEntries} {}
+
+std::optional<ClockPosition> EdenFileInfoCache::position() const {
+  return state_.rlock()->position;
+}
+
+void EdenFileInfoCache::forget(State& state, std::string_view name) {
+  auto& entries = state.entries;
+  if (name.empty()) {
+    // Everything is below the root
+    entries.clear();
+    return;
+  }
+
+  // The files below name sort between "name/" and "name0"
+  std::string prefix{name};
+  prefix.push_back('/');
+  auto begin = entries.lower_bound(prefix);
+  prefix.back() = '/' + 1;
+  entries.erase(begin, entries.lower_bound(prefix));
+
+  for (;;) {
+    auto it = entries.find(name);
+    if (it != entries.end()) {
+      entries.erase(it);
+    }
+    if (name.empty()) {
+      break;
+    }
+    auto slash = name.rfind('/');
+    name = slash == std::string_view::npos ? std::string_view{}
+                                           : name.substr(0, slash);
+  }
+}
+
+void EdenFileInfoCache::invalidate(
+    const ClockPosition& from,
+    const ClockPosition& to,
+    const std::vector<std::string>& changedNames) {
+  auto state = state_.wlock();
+  auto& position = state->position;
+  if (position && position->rootNumber == to.rootNumber &&
+      position->ticks >= to.ticks) {
+    return;
+  }
+
+  if (!position || position->rootNumber != from.rootNumber ||
+      position->ticks < from.ticks) {
+    // The changes between our position and `from` are unknown
+    state->entries.clear();
+    ++state->stats.resets;
+  } else {
+    auto before = state->entries.size();
+    for (auto& name : changedNames) {
+      forget(*state, name);
+    }
+    state->stats.invalidated += before - state->entries.size();
+  }
+  position = to;
+}
+
+void EdenFileInfoCache::reset(const ClockPosition& to) {
+  auto state = state_.wlock();
+  state->entries.clear();
+  state->position = to;
+  ++state->stats.resets;
+}
+
+std::optional<EdenFileInfoCache::Entry> EdenFileInfoCache::get(
+    std::string_view name) {
+  auto state = state_.wlock();
+  auto it = state->entries.find(name);
+  if (it == state->entries.end()) {
+    ++state->stats.misses;
+    return std::nullopt;
+  }
+  ++state->stats.hits;
+  return it->second;
+}
+
+template <typename Func>
+void EdenFileInfoCache::update(
+    std::string_view name,
+    const ClockPosition& fetchedAt,
+    Func&& func) {
+  auto state = state_.wlock();
+  if (!state->position || !samePosition(*state->position, fetchedAt)) {
+    return;
+  }
+  auto it = state->entries.find(name);
+  if (it == state->entries.end()) {
+    if (state->entries.size() >= maxEntries_) {
+      state->entries.clear();
+      ++state->stats.resets;
+    }
+    it = state->entries.emplace(std::string{name}, Entry{}).first;
+  }
+  func(it->second);
+}
+
+void EdenFileInfoCache::setDType(
+    std::string_view name,
+    DType dtype,
+    const ClockPosition& fetchedAt) {
+  update(name, fetchedAt, [&](Entry& entry) { entry.dtype = dtype; });
+}
+
+void EdenFileInfoCache::setStat(
+    std::string_view name,
+    const FileInformation& stat,
+    const ClockPosition& fetchedAt) {
+  update(name, fetchedAt, [&](Entry& entry) { entry.stat = stat; });
+}
+
+void EdenFileInfoCache::setSha1(
+    std::string_view name,
+    const Sha1& sha1,
+    const ClockPosition& fetchedAt) {
+  update(name, fetchedAt, [&](Entry& entry) { entry.sha1 = sha1; });
+}
+
+EdenFileInfoCache::Stats EdenFileInfoCache::getStats() const {
+  auto state = state_.rlock();
+  auto stats = state->stats;
+  stats.entries = state->entries.size();
+  return stats;
+}
+
+} // namespace watchman
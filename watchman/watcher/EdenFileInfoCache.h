@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/Synchronized.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <array>
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "watchman/Clock.h"
+#include "watchman/fs/FileInformation.h"
+
+namespace watchman {
+
+/**
+ * Remembers the attributes of files that EdenFS reported for a root, so that
+ * queries that ask for the same files before they change don't ask EdenFS
+ * again.
+ *
+ * The cache is valid at a journal position.  Before using it for a query,
+ * the caller brings it up to the query's position by passing the names that
+ * the journal reports as changed since then to invalidate(), which forgets
+ * those files, the files below them, and the dirs above them, whose own
+ * attributes change with their entries.  Anything it can't account for,
+ * such as a new mount generation, empties the cache with reset().
+ *
+ * Names are relative to the root, with "" for the root itself.  Thread safe.
+ */
+class EdenFileInfoCache {
+ public:
+  using Sha1 = std::array<uint8_t, 20>;
+
+  struct Entry {
+    // From getEntryInformation, when only the type was asked for
+    std::optional<DType> dtype;
+    // From getFileInformation
+    std::optional<FileInformation> stat;
+    std::optional<Sha1> sha1;
+  };
+
+  struct Stats {
+    size_t entries{0};
+    size_t hits{0};
+    size_t misses{0};
+    // Entries forgotten because the journal reported them changed
+    size_t invalidated{0};
+    // Times the whole cache was emptied
+    size_t resets{0};
+  };
+
+  /**
+   * Holds at most maxEntries files; once full, it is emptied and refilled
+   * by the files that queries go on to ask for.
+   */
+  explicit EdenFileInfoCache(size_t maxEntries);
+
+  size_t maxEntries() const {
+    return maxEntries_;
+  }
+
+  /** The position the cache is valid at, if it has been given one. */
+  std::optional<ClockPosition> position() const;
+
+  /**
+   * Brings the cache from `from` to `to`, forgetting changedNames.  Does
+   * nothing if it is already at or past `to`, and empties the cache if it
+   * isn't at or past `from`.
+   */
+  void invalidate(
+      const ClockPosition& from,
+      const ClockPosition& to,
+      const std::vector<std::string>& changedNames);
+
+  /** Empties the cache, which is then valid at `to`. */
+  void reset(const ClockPosition& to);
+
+  std::optional<Entry> get(std::string_view name);
+
+  /**
+   * Records what EdenFS reported for name, asked after the cache was
+   * brought to fetchedAt.  Dropped if the cache has moved since, as a change
+   * made between the fetch and the move may not have been invalidated.
+   */
+  void setDType(
+      std::string_view name,
+      DType dtype,
+      const ClockPosition& fetchedAt);
+  void setStat(
+      std::string_view name,
+      const FileInformation& stat,
+      const ClockPosition& fetchedAt);
+  void setSha1(
+      std::string_view name,
+      const Sha1& sha1,
+      const ClockPosition& fetchedAt);
+
+  Stats getStats() const;
+
+ private:
+  struct State {
+    std::optional<ClockPosition> position;
+    std::map<std::string, Entry, std::less<>> entries;
+    Stats stats;
+  };
+
+  template <typename Func>
+  void update(
+      std::string_view name,
+      const ClockPosition& fetchedAt,
+      Func&& func);
+  static void forget(State& state, std::string_view name);
+
+  const size_t maxEntries_;
+  folly::Synchronized<State> state_;
+};
+
+} // namespace watchman
@@ -7,7 +7,9 @@
 
 #pragma once
 #include <folly/futures/Future.h>
+#include <optional>
 #include <stdexcept>
+#include <vector>
 #include "watchman/PendingCollection.h"
 #include "watchman/fs/DirHandle.h"
 #include "watchman/thirdparty/jansson/jansson.h"
@@ -40,6 +42,17 @@ class Watcher : public std::enable_shared_from_this<Watcher> {
 #define WATCHER_HAS_PER_FILE_NOTIFICATIONS 1
   // if the watcher is comprised of multiple watchers
 #define WATCHER_HAS_SPLIT_WATCH 4
+  // if the watcher may notify about a change again after it has been
+  // observed, so that a notification for a file whose stat is unchanged
+  // carries no news
+#define WATCHER_MAY_REPEAT_NOTIFICATIONS 8
+  // if the watcher's notifications carry the file information of the
+  // changed files; see takeReportedStat()
+#define WATCHER_REPORTS_FILE_INFORMATION 16
+  // if flushPendingEvents() alone synchronizes with the filesystem: once
+  // its future is ready, every change made before it was called has been
+  // processed, so no cookie file is needed
+#define WATCHER_CAN_SYNC_BY_FLUSHING 32
   unsigned flags;
 
   Watcher(const char* name, unsigned flags);
@@ -66,11 +79,50 @@ class Watcher : public std::enable_shared_from_this<Watcher> {
    *
    * Otherwise, this watcher does not require flushing, and a cookie file event
    * is considered sufficient synchronization.
+   *
+   * Watchers with WATCHER_CAN_SYNC_BY_FLUSHING return a valid SemiFuture that
+   * may be used in place of a cookie file; see `sync_by_flushing`.
    */
   virtual folly::SemiFuture<folly::Unit> flushPendingEvents() {
     return folly::SemiFuture<folly::Unit>::makeEmpty();
   }
 
+  /**
+   * Returns an opaque token identifying the position in the watcher's event
+   * stream up to which notifications have been consumed, or an empty string
+   * if this watcher cannot replay its events after a restart.
+   */
+  virtual w_string getResumeToken() const {
+    return w_string{};
+  }
+
+  /**
+   * Asks the watcher to replay the events since a token returned by
+   * getResumeToken() in a prior instance of the daemon.  Called before
+   * start(); the watcher may ignore the token if it can't honor it.
+   */
+  virtual void resumeFrom(w_string_piece /*token*/) {}
+
+  /**
+   * Returns true if start() began replaying events from the token passed to
+   * resumeFrom(), in which case the changes made while the daemon wasn't
+   * running are reported as notifications.
+   */
+  virtual bool resumed() const {
+    return false;
+  }
+
+  /**
+   * For watchers with WATCHER_REPORTS_FILE_INFORMATION: returns the file
+   * information that came with the most recent notification for path, to
+   * spare the IO thread a stat, or nullopt if there was none.  A reported
+   * stat is only returned once.
+   */
+  virtual std::optional<FileInformation> takeReportedStat(
+      const w_string& /*path*/) {
+    return std::nullopt;
+  }
+
   // Initiate an OS-level watch on the provided file
   virtual bool startWatchFile(watchman_file* file);
 
@@ -97,6 +149,16 @@ class Watcher : public std::enable_shared_from_this<Watcher> {
    */
   virtual bool waitNotify(int timeoutms) = 0;
 
+  /**
+   * Returns the fds that are readable whenever waitNotify() would return
+   * true, so that an event loop shared by many roots can wait on them in
+   * place of calling waitNotify() from a thread of this root's own.  Empty
+   * if waitNotify() has to be called, which is the default.
+   */
+  virtual std::vector<int> getNotifyFds() {
+    return {};
+  }
+
   struct ConsumeNotifyRet {
     // Should the watch be cancelled?
     bool cancelSelf;
@@ -20,11 +20,13 @@
 #include <thrift/lib/cpp2/async/RocketClientChannel.h>
 #include <algorithm>
 #include <chrono>
+#include <deque>
 #include <iterator>
 #include <thread>
 #include "eden/fs/service/gen-cpp2/StreamingEdenService.h"
 #include "watchman/ChildProcess.h"
 #include "watchman/Errors.h"
+#include "watchman/Hash.h"
 #include "watchman/LRUCache.h"
 #include "watchman/QueryableView.h"
 #include "watchman/ThreadPool.h"
@@ -37,6 +39,7 @@
 #include "watchman/root/Root.h"
 #include "watchman/scm/SCM.h"
 #include "watchman/thirdparty/wildmatch/wildmatch.h"
+#include "watchman/watcher/EdenFileInfoCache.h"
 #include "watchman/watcher/Watcher.h"
 #include "watchman/watcher/WatcherRegistry.h"
 
@@ -85,6 +88,63 @@ SyncBehavior getSyncBehavior() {
   return sync;
 }
 
+/**
+ * How the file information lookups of a batch are split up: each Thrift
+ * call asks about at most chunkSize files, and up to maxOutstanding calls
+ * are in flight on the channel at once.
+ */
+struct FetchChunking {
+  size_t chunkSize;
+  size_t maxOutstanding;
+};
+
+/**
+ * Calls fetch() for each chunk of names, which returns a SemiFuture of the
+ * results for that chunk, and apply(begin, end, results) with the results
+ * of names[begin, end) as each chunk completes, in order, while the later
+ * chunks are still in flight.
+ */
+template <typename Fetch, typename Apply>
+void fetchInChunks(
+    const std::vector<std::string>& names,
+    const FetchChunking& chunking,
+    Fetch fetch,
+    Apply apply) {
+  using Results =
+      typename decltype(fetch(std::vector<std::string>{}))::value_type;
+  struct Chunk {
+    size_t begin;
+    size_t end;
+    folly::Future<Results> results;
+  };
+
+  folly::DrivableExecutor* executor =
+      folly::EventBaseManager::get()->getEventBase();
+  auto chunkSize = std::max<size_t>(chunking.chunkSize, 1);
+  auto maxOutstanding = std::max<size_t>(chunking.maxOutstanding, 1);
+
+  std::deque<Chunk> outstanding;
+  auto applyOldest = [&] {
+    auto chunk = std::move(outstanding.front());
+    outstanding.pop_front();
+    apply(chunk.begin, chunk.end, std::move(chunk.results).getVia(executor));
+  };
+
+  for (size_t begin = 0; begin < names.size(); begin += chunkSize) {
+    auto end = std::min(begin + chunkSize, names.size());
+    if (outstanding.size() >= maxOutstanding) {
+      applyOldest();
+    }
+    std::vector<std::string> chunkNames(
+        names.begin() + begin, names.begin() + end);
+    outstanding.push_back(
+        Chunk{begin, end, fetch(chunkNames).via(executor)});
+  }
+  while (!outstanding.empty()) {
+    applyOldest();
+  }
+}
+
 } // namespace
 
 namespace watchman {
@@ -198,17 +258,93 @@ class GetJournalPositionCallback : public folly::HHWheelTimer::Callback {
   std::string mountPoint_;
 };
 
+/**
+ * Brings cache up to position, the journal position at which a query
+ * started, by forgetting the files that the journal reports as changed
+ * since the cache's own position.  When there are more of those than the
+ * cache could hold, or they can't be listed, the cache is emptied instead.
+ */
+void syncFileInfoCache(
+    StreamingEdenServiceAsyncClient* client,
+    const std::string& mountPoint,
+    EdenFileInfoCache& cache,
+    const ClockPosition& position) {
+  auto from = cache.position();
+  if (from && from->rootNumber == position.rootNumber &&
+      from->ticks >= position.ticks) {
+    return;
+  }
+  if (!from || from->rootNumber != position.rootNumber) {
+    cache.reset(position);
+    return;
+  }
+
+  JournalPosition fromPosition;
+  fromPosition.mountGeneration() = from->rootNumber;
+  fromPosition.sequenceNumber() = from->ticks;
+
+  StreamChangesSinceParams params;
+  params.mountPoint() = mountPoint;
+  params.fromPosition() = fromPosition;
+
+  try {
+    auto [changesSince, stream] = client->sync_streamChangesSince(params);
+    ClockPosition to(
+        *changesSince.toPosition()->mountGeneration(),
+        *changesSince.toPosition()->sequenceNumber());
+
+    std::vector<std::string> names;
+    bool complete = true;
+    std::move(stream).subscribeInline(
+        [&](folly::Try<ChangedFileResult>&& changeTry) {
+          if (changeTry.hasException()) {
+            complete = false;
+            return false;
+          }
+          if (!changeTry.hasValue()) {
+            // End of the stream.
+            return false;
+          }
+          if (names.size() == cache.maxEntries()) {
+            complete = false;
+            return false;
+          }
+          names.push_back(*changeTry.value().name());
+          return true;
+        });
+
+    if (complete) {
+      cache.invalidate(*from, to, names);
+    } else {
+      cache.reset(position);
+    }
+  } catch (const std::exception& ex) {
+    log(DBG,
+        "emptying the file information cache, as its changes could not be "
+        "listed: ",
+        ex.what(),
+        "\n");
+    cache.reset(position);
+  }
+}
+
 class EdenFileResult : public FileResult {
  public:
   EdenFileResult(
       const w_string& rootPath,
       std::shared_ptr<apache::thrift::RequestChannel> thriftChannel,
+      const FetchChunking& chunking,
+      std::shared_ptr<EdenFileInfoCache> fileInfoCache,
+      const ClockPosition& queryPosition,
       const w_string& fullName,
       ClockTicks* ticks = nullptr,
       bool isNew = false,
       DType dtype = DType::Unknown)
       : rootPath_(rootPath),
         thriftChannel_{std::move(thriftChannel)},
+        chunking_(chunking),
+        fileInfoCache_{std::move(fileInfoCache)},
+        queryPosition_(queryPosition),
         fullName_(fullName),
         dtype_(dtype) {
     otime_.ticks = ctime_.ticks = 0;
@@ -372,6 +508,20 @@ class EdenFileResult : public FileResult {
 
     std::vector<EdenFileResult*> getSymlinkFiles;
 
+    auto client = getEdenClient(thriftChannel_);
+
+    // The cache's position once it has been brought up to this query; what
+    // this batch fetches is recorded against it.
+    std::optional<ClockPosition> cachedAt;
+    if (fileInfoCache_) {
+      syncFileInfoCache(
+          client.get(),
+          std::string{rootPath_.view()},
+          *fileInfoCache_,
+          queryPosition_);
+      cachedAt = fileInfoCache_->position();
+    }
+
     for (auto& f : files) {
       auto& edenFile = dynamic_cast<EdenFileResult&>(*f);
 
@@ -393,15 +543,17 @@ class EdenFileResult : public FileResult {
         getSymlinkFiles.emplace_back(&edenFile);
       }
 
-      if (edenFile.neededProperties() &
-          (FileResult::Property::FileDType | FileResult::Property::CTime |
-           FileResult::Property::OTime | FileResult::Property::Exists |
-           FileResult::Property::Size | FileResult::Property::StatTimeStamps |
-           FileResult::Property::FullFileInformation)) {
+      auto needed = edenFile.neededProperties();
+      if (cachedAt) {
+        needed = edenFile.applyCachedInformation(
+            fileInfoCache_->get(relName.view()), needed);
+      }
+
+      if (needed & kFileInformationProperties) {
         getFileInformationFiles.emplace_back(&edenFile);
         getFileInformationNames.emplace_back(relName.data(), relName.size());
 
-        if (edenFile.neededProperties() &
+        if (needed &
             ~(FileResult::Property::FileDType | FileResult::Property::Exists)) {
           // We could maintain two lists and call both getFileInformation and
           // getEntryInformation in parallel, but in practice the set of
@@ -410,7 +562,7 @@ class EdenFileResult : public FileResult {
         }
       }
 
-      if (edenFile.neededProperties() & FileResult::Property::ContentSha1) {
+      if (needed & FileResult::Property::ContentSha1) {
         getShaFiles.emplace_back(&edenFile);
         getShaNames.emplace_back(relName.data(), relName.size());
       }
@@ -422,41 +574,83 @@ class EdenFileResult : public FileResult {
       edenFile.clearNeededProperties();
     }
 
-    auto client = getEdenClient(thriftChannel_);
     loadFileInformation(
         client.get(),
         rootPath_,
         getFileInformationNames,
         getFileInformationFiles,
-        onlyEntryInfoNeeded);
+        onlyEntryInfoNeeded,
+        chunking_);
+    if (cachedAt) {
+      for (size_t i = 0; i < getFileInformationFiles.size(); ++i) {
+        auto* edenFile = getFileInformationFiles[i];
+        if (!edenFile->exists_.value_or(false)) {
+          // Errors, such as the file not existing, aren't remembered
+          continue;
+        }
+        if (edenFile->stat_) {
+          fileInfoCache_->setStat(
+              getFileInformationNames[i], *edenFile->stat_, *cachedAt);
+        } else if (edenFile->dtype_ != DType::Unknown) {
+          fileInfoCache_->setDType(
+              getFileInformationNames[i], edenFile->dtype_, *cachedAt);
+        }
+      }
+    }
 
     // TODO: add eden bulk readlink call
     loadSymlinkTargets(client.get(), getSymlinkFiles);
 
     if (!getShaFiles.empty()) {
-      std::vector<SHA1Result> sha1s;
-      client->sync_getSHA1(
-          sha1s, std::string{rootPath_.view()}, getShaNames, getSyncBehavior());
-
-      if (sha1s.size() != getShaFiles.size()) {
-        log(ERR,
-            "Requested SHA-1 of ",
-            getShaFiles.size(),
-            " but Eden returned ",
-            sha1s.size(),
-            " results -- ignoring");
-      } else {
-        auto sha1Iter = sha1s.begin();
-        for (auto& edenFile : getShaFiles) {
-          edenFile->sha1_ = *sha1Iter++;
-        }
-      }
+      auto mountPoint = std::string{rootPath_.view()};
+      fetchInChunks(
+          getShaNames,
+          chunking_,
+          [&](const std::vector<std::string>& names) {
+            return client->semifuture_getSHA1(
+                mountPoint, names, getSyncBehavior());
+          },
+          [&](size_t begin, size_t end, std::vector<SHA1Result>&& sha1s) {
+            if (sha1s.size() != end - begin) {
+              log(ERR,
+                  "Requested SHA-1 of ",
+                  end - begin,
+                  " but Eden returned ",
+                  sha1s.size(),
+                  " results -- ignoring");
+              return;
+            }
+            auto sha1Iter = sha1s.begin();
+            for (size_t i = begin; i < end; ++i) {
+              auto& sha1 = *sha1Iter++;
+              if (cachedAt && sha1.getType() == SHA1Result::Type::sha1) {
+                auto& hash = sha1.get_sha1();
+                EdenFileInfoCache::Sha1 cached;
+                if (hash.size() == cached.size()) {
+                  std::copy(hash.begin(), hash.end(), cached.begin());
+                  fileInfoCache_->setSha1(getShaNames[i], cached, *cachedAt);
+                }
+              }
+              getShaFiles[i]->sha1_ = std::move(sha1);
+            }
+          });
     }
   }
 
  private:
+  // The properties that getFileInformation or getEntryInformation supply
+  static constexpr FileResult::Properties kFileInformationProperties =
+      FileResult::Property::FileDType | FileResult::Property::CTime |
+      FileResult::Property::OTime | FileResult::Property::Exists |
+      FileResult::Property::Size | FileResult::Property::StatTimeStamps |
+      FileResult::Property::FullFileInformation;
+
   w_string rootPath_;
   std::shared_ptr<apache::thrift::RequestChannel> thriftChannel_;
+  FetchChunking chunking_;
+  // Null unless eden_file_info_cache_size is set
+  std::shared_ptr<EdenFileInfoCache> fileInfoCache_;
+  ClockPosition queryPosition_;
   w_string fullName_;
   std::optional<FileInformation> stat_;
   std::optional<bool> exists_;
@@ -490,40 +684,46 @@ class EdenFileResult : public FileResult {
       const w_string& rootPath,
       const std::vector<std::string>& names,
       const std::vector<EdenFileResult*>& outFiles,
-      bool onlyEntryInfoNeeded) {
+      bool onlyEntryInfoNeeded,
+      const FetchChunking& chunking) {
     w_assert(
         names.size() == outFiles.size(), "names.size must == outFiles.size");
     if (names.empty()) {
       return;
     }
 
-    auto applyResults = [&](const auto& edenInfo) {
-      if (names.size() != edenInfo.size()) {
+    auto applyResults = [&](size_t begin, size_t end, const auto& edenInfo) {
+      if (end - begin != edenInfo.size()) {
         log(ERR,
             "Requested file information of ",
-            names.size(),
+            end - begin,
             " files but Eden returned information for ",
             edenInfo.size(),
             " files. Treating missing entries as missing files.");
       }
 
       auto infoIter = edenInfo.begin();
-      for (auto& edenFileResult : outFiles) {
+      for (size_t i = begin; i < end; ++i) {
         if (infoIter == edenInfo.end()) {
-          edenFileResult->setExists(false);
+          outFiles[i]->setExists(false);
         } else {
-          edenFileResult->applyInformationOrError(*infoIter);
+          outFiles[i]->applyInformationOrError(*infoIter);
           ++infoIter;
         }
       }
     };
 
+    auto mountPoint = std::string{rootPath.view()};
     if (onlyEntryInfoNeeded) {
-      std::vector<EntryInformationOrError> info;
       try {
-        client->sync_getEntryInformation(
-            info, std::string{rootPath.view()}, names, getSyncBehavior());
-        applyResults(info);
+        fetchInChunks(
+            names,
+            chunking,
+            [&](const std::vector<std::string>& chunk) {
+              return client->semifuture_getEntryInformation(
+                  mountPoint, chunk, getSyncBehavior());
+            },
+            applyResults);
         return;
       } catch (const TApplicationException& ex) {
         if (TApplicationException::UNKNOWN_METHOD != ex.getType()) {
@@ -535,10 +735,48 @@ class EdenFileResult : public FileResult {
       }
     }
 
-    std::vector<FileInformationOrError> info;
-    client->sync_getFileInformation(
-        info, std::string{rootPath.view()}, names, getSyncBehavior());
-    applyResults(info);
+    fetchInChunks(
+        names,
+        chunking,
+        [&](const std::vector<std::string>& chunk) {
+          return client->semifuture_getFileInformation(
+              mountPoint, chunk, getSyncBehavior());
+        },
+        applyResults);
+  }
+
+  /**
+   * Fills in what entry remembers of the file, and returns the properties
+   * of needed that are still to be fetched.
+   */
+  FileResult::Properties applyCachedInformation(
+      const std::optional<EdenFileInfoCache::Entry>& entry,
+      FileResult::Properties needed) {
+    if (!entry) {
+      return needed;
+    }
+    if (needed & kFileInformationProperties) {
+      if (entry->stat) {
+        stat_ = *entry->stat;
+        setExists(true);
+        needed &= ~kFileInformationProperties;
+      } else if (
+          entry->dtype &&
+          !(needed & kFileInformationProperties &
+            ~(FileResult::Property::FileDType |
+              FileResult::Property::Exists))) {
+        dtype_ = *entry->dtype;
+        setExists(true);
+        needed &= ~kFileInformationProperties;
+      }
+    }
+    if ((needed & FileResult::Property::ContentSha1) && entry->sha1) {
+      SHA1Result sha1;
+      sha1.set_sha1(std::string{entry->sha1->begin(), entry->sha1->end()});
+      sha1_ = std::move(sha1);
+      needed &= ~FileResult::Property::ContentSha1;
+    }
+    return needed;
   }
 
   void applyInformationOrError(const EntryInformationOrError& infoOrErr) {
@@ -699,6 +937,58 @@ std::vector<NameAndDType> globNameAndDType(
   }
 }
 
+/**
+ * Identifies the result of a glob: the same set of patterns, with the same
+ * options, evaluated at the same journal position, matches the same files.
+ */
+struct GlobCacheKey {
+  // Sorted, without duplicates
+  std::vector<std::string> globs;
+  bool includeDotfiles;
+  ClockRoot mountGeneration;
+  ClockTicks sequenceNumber;
+
+  GlobCacheKey(
+      std::vector<std::string> globPatterns,
+      bool includeDotfiles,
+      const ClockPosition& position)
+      : globs{std::move(globPatterns)},
+        includeDotfiles{includeDotfiles},
+        mountGeneration{position.rootNumber},
+        sequenceNumber{position.ticks} {
+    std::sort(globs.begin(), globs.end());
+    globs.erase(std::unique(globs.begin(), globs.end()), globs.end());
+  }
+
+  bool operator==(const GlobCacheKey& other) const {
+    return includeDotfiles == other.includeDotfiles &&
+        mountGeneration == other.mountGeneration &&
+        sequenceNumber == other.sequenceNumber && globs == other.globs;
+  }
+
+  std::size_t hashValue() const {
+    auto hash = hash_128_to_64(mountGeneration, sequenceNumber);
+    hash = hash_128_to_64(hash, includeDotfiles);
+    for (auto& glob : globs) {
+      hash = hash_128_to_64(hash, std::hash<std::string>{}(glob));
+    }
+    return hash;
+  }
+};
+
+} // namespace watchman
+
+namespace std {
+template <>
+struct hash<watchman::GlobCacheKey> {
+  std::size_t operator()(const watchman::GlobCacheKey& key) const {
+    return key.hashValue();
+  }
+};
+} // namespace std
+
+namespace watchman {
+
 namespace {
 
 /**
@@ -745,7 +1035,24 @@ class EdenView final : public QueryableView {
             "eden_file_count_threshold_for_fresh_instance",
             10000)),
         enableGlobUpperBounds_(
-            config.getBool("eden_enable_glob_upper_bounds", false)) {}
+            config.getBool("eden_enable_glob_upper_bounds", false)),
+        fileInfoChunking_{
+            static_cast<size_t>(
+                config.getInt("eden_file_info_chunk_size", 1024)),
+            static_cast<size_t>(
+                config.getInt("eden_file_info_max_outstanding_chunks", 4))},
+        globCacheEnabled_{config.getInt("eden_glob_cache_size", 0) > 0},
+        // Errors aren't cached; the next identical glob asks again
+        globCache_{
+            static_cast<size_t>(std::max<json_int_t>(
+                config.getInt("eden_glob_cache_size", 0), 1)),
+            std::chrono::milliseconds(0)} {
+    auto fileInfoCacheSize = config.getInt("eden_file_info_cache_size", 0);
+    if (fileInfoCacheSize > 0) {
+      fileInfoCache_ = std::make_shared<EdenFileInfoCache>(
+          static_cast<size_t>(fileInfoCacheSize));
+    }
+  }
 
   void timeGenerator(const Query* /*query*/, QueryContext* ctx) const override {
     ctx->generationStarted();
@@ -767,6 +1074,9 @@ class EdenView final : public QueryableView {
 
     auto isFreshInstance = ctx->since.is_fresh_instance();
     for (auto& item : fileInfo) {
+      if (ctx->limitReached()) {
+        break;
+      }
       // a file is considered new if it was present in the created files
       // set returned from eden.
       bool isNew = createdFileNames.find(item.name) != createdFileNames.end();
@@ -774,6 +1084,9 @@ class EdenView final : public QueryableView {
       auto file = make_unique<EdenFileResult>(
           rootPath_,
           thriftChannel_,
+          fileInfoChunking_,
+          fileInfoCache_,
+          ctx->clockAtStartOfQuery.position(),
           w_string::pathCat({mountPoint_, item.name}),
           &resultTicks,
           isNew,
@@ -847,22 +1160,21 @@ class EdenView final : public QueryableView {
       QueryContext* ctx,
       bool includeDotfiles,
       bool includeDir = true) const {
-    auto client = getEdenClient(thriftChannel_);
-
-    auto fileInfo = globNameAndDType(
-        client.get(),
-        mountPoint_,
-        globStrings,
-        includeDotfiles,
-        splitGlobPattern_);
+    auto fileInfo = cachedGlobNameAndDType(ctx, globStrings, includeDotfiles);
 
     // Filter out any ignored files
     filterOutPaths(fileInfo, ctx);
 
     for (auto& item : fileInfo) {
+      if (ctx->limitReached()) {
+        break;
+      }
       auto file = make_unique<EdenFileResult>(
           rootPath_,
           thriftChannel_,
+          fileInfoChunking_,
+          fileInfoCache_,
+          ctx->clockAtStartOfQuery.position(),
           w_string::pathCat({mountPoint_, item.name}),
           /*ticks=*/nullptr,
           /*isNew=*/false,
@@ -998,7 +1310,32 @@ class EdenView final : public QueryableView {
   }
 
   json_ref getWatcherDebugInfo() const override {
-    return json_null();
+    if (!globCacheEnabled_ && !fileInfoCache_) {
+      return json_null();
+    }
+    auto info = json_object();
+    if (globCacheEnabled_) {
+      auto stats = globCache_.stats();
+      info.set(
+          "glob_cache",
+          json_object(
+              {{"hits", json_integer(stats.cacheHit)},
+               {"shares", json_integer(stats.cacheShare)},
+               {"misses", json_integer(stats.cacheMiss)},
+               {"size", json_integer(stats.size)}}));
+    }
+    if (fileInfoCache_) {
+      auto stats = fileInfoCache_->getStats();
+      info.set(
+          "file_info_cache",
+          json_object(
+              {{"hits", json_integer(stats.hits)},
+               {"misses", json_integer(stats.misses)},
+               {"invalidated", json_integer(stats.invalidated)},
+               {"resets", json_integer(stats.resets)},
+               {"size", json_integer(stats.entries)}}));
+    }
+    return info;
   }
 
   void clearWatcherDebugInfo() override {}
@@ -1174,14 +1511,49 @@ class EdenView final : public QueryableView {
     }
 
     auto globPatterns = getGlobPatternsForAllFiles(ctx);
+    return cachedGlobNameAndDType(
+        ctx, std::move(globPatterns), /*includeDotfiles=*/true);
+  }
 
-    auto client = getEdenClient(thriftChannel_);
-    return globNameAndDType(
-        client.get(),
-        mountPoint_,
+  /**
+   * globNameAndDType, answered from globCache_ when the same glob has
+   * already been evaluated at the journal position at which this query
+   * started.  Any change to the working copy advances the journal, so a
+   * cached result is never reused after one.  Identical globs that arrive
+   * while one is outstanding wait for its result instead of asking EdenFS
+   * again.
+   */
+  std::vector<NameAndDType> cachedGlobNameAndDType(
+      QueryContext* ctx,
+      std::vector<std::string> globPatterns,
+      bool includeDotfiles) const {
+    auto glob = [this](const std::vector<std::string>& patterns, bool dots) {
+      auto client = getEdenClient(thriftChannel_);
+      return globNameAndDType(
+          client.get(), mountPoint_, patterns, dots, splitGlobPattern_);
+    };
+    if (!globCacheEnabled_) {
+      return glob(globPatterns, includeDotfiles);
+    }
+
+    GlobCacheKey key{
         std::move(globPatterns),
-        /*includeDotfiles=*/true,
-        splitGlobPattern_);
+        includeDotfiles,
+        ctx->clockAtStartOfQuery.position()};
+    auto future = folly::Future<
+        std::shared_ptr<const GlobCache::NodeType>>::makeEmpty();
+    try {
+      future = globCache_.get(key, [&](const GlobCacheKey& missing) {
+        return folly::makeFutureWith(
+            [&] { return glob(missing.globs, missing.includeDotfiles); });
+      });
+    } catch (const std::exception&) {
+      // Every entry is still being fetched, so there is no room for this
+      // one; don't let that hold up the query.
+      return glob(key.globs, key.includeDotfiles);
+    }
+    // A copy, which the caller filters
+    return std::move(future).get()->value();
   }
 
   struct GetAllChangesSinceResult {
@@ -1351,6 +1723,12 @@ class EdenView final : public QueryableView {
   bool splitGlobPattern_;
   unsigned int thresholdForFreshInstance_;
   bool enableGlobUpperBounds_;
+  FetchChunking fileInfoChunking_;
+  using GlobCache = LRUCache<GlobCacheKey, std::vector<NameAndDType>>;
+  bool globCacheEnabled_;
+  mutable GlobCache globCache_;
+  // Null unless eden_file_info_cache_size is set
+  std::shared_ptr<EdenFileInfoCache> fileInfoCache_;
 };
 
 #ifdef _WIN32
@@ -0,0 +1,423 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/String.h>
+#include <atomic>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include "watchman/FlagMap.h"
+#include "watchman/InMemoryView.h"
+#include "watchman/fs/FSDetect.h"
+#include "watchman/fs/FileDescriptor.h"
+#include "watchman/fs/Pipe.h"
+#include "watchman/root/Root.h"
+#include "watchman/watcher/Watcher.h"
+#include "watchman/watcher/WatcherRegistry.h"
+
+#if defined(HAVE_FANOTIFY_INIT) && defined(HAVE_SYS_FANOTIFY_H)
+#include <fcntl.h>
+#include <sys/fanotify.h>
+#endif
+
+// FAN_REPORT_DFID_NAME and FAN_MARK_FILESYSTEM need Linux 5.9 headers
+#if defined(HAVE_FANOTIFY_INIT) && defined(HAVE_SYS_FANOTIFY_H) && \
+    defined(FAN_REPORT_DFID_NAME) && defined(FAN_MARK_FILESYSTEM)
+
+using namespace watchman;
+
+#define WATCHMAN_FANOTIFY_MASK                                           \
+  (FAN_ATTRIB | FAN_CREATE | FAN_DELETE | FAN_DELETE_SELF | FAN_MODIFY | \
+   FAN_MOVE_SELF | FAN_MOVED_FROM | FAN_MOVED_TO | FAN_ONDIR)
+
+namespace {
+
+const struct flag_map fanflags[] = {
+    {FAN_MODIFY, "FAN_MODIFY"},
+    {FAN_ATTRIB, "FAN_ATTRIB"},
+    {FAN_MOVED_FROM, "FAN_MOVED_FROM"},
+    {FAN_MOVED_TO, "FAN_MOVED_TO"},
+    {FAN_CREATE, "FAN_CREATE"},
+    {FAN_DELETE, "FAN_DELETE"},
+    {FAN_DELETE_SELF, "FAN_DELETE_SELF"},
+    {FAN_MOVE_SELF, "FAN_MOVE_SELF"},
+    {FAN_Q_OVERFLOW, "FAN_Q_OVERFLOW"},
+    {FAN_ONDIR, "FAN_ONDIR"},
+    {0, nullptr},
+};
+
+// Changes to the namespace that can invalidate cached dir handle -> path
+// mappings when they happen to a dir.
+constexpr uint64_t kDirNamespaceChange = FAN_MOVED_FROM | FAN_MOVED_TO |
+    FAN_DELETE | FAN_MOVE_SELF | FAN_DELETE_SELF;
+
+// Bound the handle cache so that a filesystem-wide mark on a busy
+// filesystem can't grow it without limit.
+constexpr size_t kMaxCachedDirs = 64 * 1024;
+
+std::string handleKey(const struct file_handle* fh) {
+  std::string key(
+      reinterpret_cast<const char*>(&fh->handle_type), sizeof(fh->handle_type));
+  key.append(
+      reinterpret_cast<const char*>(fh->f_handle), size_t(fh->handle_bytes));
+  return key;
+}
+
+} // namespace
+
+/**
+ * A watcher that uses a single filesystem-wide fanotify mark rather than a
+ * watch per directory.
+ *
+ * Events identify the containing dir by file handle plus the entry name
+ * (FAN_REPORT_DFID_NAME).  Handles are resolved to paths via
+ * open_by_handle_at and cached; events outside of the watched root are
+ * discarded here, since the mark covers the whole filesystem.
+ *
+ * Both the filesystem mark and open_by_handle_at need CAP_SYS_ADMIN and
+ * CAP_DAC_READ_SEARCH respectively, so this watcher is not auto-selected;
+ * set `"watcher": "fanotify"` to opt in.
+ */
+struct FanotifyWatcher : public Watcher {
+  FileDescriptor fanFd_;
+  // Any fd on the watched filesystem; used to resolve file handles.
+  FileDescriptor mountFd_;
+  Pipe terminatePipe_;
+
+  const w_string rootPath_;
+  const w_string rootPathSlash_;
+
+  // Only accessed by the notify thread.
+  std::unordered_map<std::string, w_string> dirCache_;
+
+  std::atomic<uint64_t> totalEventsSeen_ = 0;
+  std::atomic<uint64_t> outsideRootEvents_ = 0;
+  std::atomic<uint64_t> unresolvedEvents_ = 0;
+  std::atomic<uint64_t> dirCacheMisses_ = 0;
+
+  // Events carry a file handle and a name, so are larger and more variable
+  // than inotify events; this holds a few thousand of them.
+  char ibuf[1024 * 1024];
+
+  FanotifyWatcher(const w_string& rootPath, const Configuration& config);
+
+  std::unique_ptr<DirHandle> startWatchDir(
+      const std::shared_ptr<Root>& root,
+      const char* path) override;
+
+  Watcher::ConsumeNotifyRet consumeNotify(
+      const std::shared_ptr<Root>& root,
+      PendingChanges& coll) override;
+
+  bool waitNotify(int timeoutms) override;
+  void stopThreads() override;
+
+  json_ref getDebugInfo() override;
+  void clearDebugInfo() override;
+
+ private:
+  // Processes the information records of a single event.  Returns true if
+  // the root directory was removed and the watch needs to be cancelled.
+  bool processEvent(
+      const std::shared_ptr<Root>& root,
+      PendingChanges& coll,
+      const struct fanotify_event_metadata* meta,
+      std::chrono::system_clock::time_point now);
+
+  // Returns the current path of the dir identified by fh, or nullopt if it
+  // no longer exists.
+  std::optional<w_string> resolveDir(struct file_handle* fh);
+
+  bool isWithinRoot(const w_string& path) const {
+    return path == rootPath_ || path.piece().startsWith(rootPathSlash_);
+  }
+};
+
+FanotifyWatcher::FanotifyWatcher(
+    const w_string& rootPath,
+    const Configuration&)
+    : Watcher("fanotify", WATCHER_HAS_PER_FILE_NOTIFICATIONS),
+      rootPath_(rootPath),
+      rootPathSlash_(w_string::build(rootPath, "/")) {
+  fanFd_ = FileDescriptor(
+      fanotify_init(
+          FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_REPORT_DFID_NAME,
+          O_RDONLY | O_LARGEFILE),
+      FileDescriptor::FDType::Generic);
+  if (fanFd_.fd() == -1) {
+    throw std::system_error(errno, std::generic_category(), "fanotify_init");
+  }
+
+  mountFd_ = FileDescriptor(
+      open(rootPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC),
+      FileDescriptor::FDType::Generic);
+  if (mountFd_.fd() == -1) {
+    throw std::system_error(errno, std::generic_category(), "open root");
+  }
+
+  // Fail up front, rather than on the first event, if we can't resolve
+  // handles (eg: the filesystem doesn't support them, or we lack
+  // CAP_DAC_READ_SEARCH).
+  {
+    alignas(struct file_handle) char buf[sizeof(struct file_handle) +
+                                         MAX_HANDLE_SZ];
+    auto fh = reinterpret_cast<struct file_handle*>(buf);
+    fh->handle_bytes = MAX_HANDLE_SZ;
+    int mountId;
+    if (name_to_handle_at(AT_FDCWD, rootPath.c_str(), fh, &mountId, 0) == -1) {
+      throw std::system_error(
+          errno, std::generic_category(), "name_to_handle_at");
+    }
+    if (!resolveDir(fh)) {
+      throw std::system_error(
+          errno, std::generic_category(), "open_by_handle_at");
+    }
+  }
+
+  if (fanotify_mark(
+          fanFd_.fd(),
+          FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+          WATCHMAN_FANOTIFY_MASK,
+          AT_FDCWD,
+          rootPath.c_str()) == -1) {
+    throw std::system_error(errno, std::generic_category(), "fanotify_mark");
+  }
+}
+
+std::unique_ptr<DirHandle> FanotifyWatcher::startWatchDir(
+    const std::shared_ptr<Root>&,
+    const char* path) {
+  // The filesystem mark already covers every dir; there's nothing to
+  // register.
+  return openDir(path);
+}
+
+std::optional<w_string> FanotifyWatcher::resolveDir(struct file_handle* fh) {
+  auto key = handleKey(fh);
+  auto it = dirCache_.find(key);
+  if (it != dirCache_.end()) {
+    return it->second;
+  }
+  dirCacheMisses_.fetch_add(1, std::memory_order_relaxed);
+
+  FileDescriptor dirFd(
+      open_by_handle_at(mountFd_.fd(), fh, O_PATH | O_CLOEXEC),
+      FileDescriptor::FDType::Generic);
+  if (dirFd.fd() == -1) {
+    // ESTALE: the dir has since been deleted
+    return std::nullopt;
+  }
+
+  char procPath[64];
+  snprintf(procPath, sizeof(procPath), "/proc/self/fd/%d", dirFd.fd());
+  char buf[WATCHMAN_NAME_MAX];
+  auto len = readlink(procPath, buf, sizeof(buf));
+  if (len <= 0 || size_t(len) >= sizeof(buf)) {
+    return std::nullopt;
+  }
+  w_string path(buf, size_t(len), W_STRING_BYTE);
+
+  if (dirCache_.size() >= kMaxCachedDirs) {
+    dirCache_.clear();
+  }
+  dirCache_.emplace(std::move(key), path);
+  return path;
+}
+
+bool FanotifyWatcher::processEvent(
+    const std::shared_ptr<Root>& root,
+    PendingChanges& coll,
+    const struct fanotify_event_metadata* meta,
+    std::chrono::system_clock::time_point now) {
+  char flags_label[128];
+  w_expand_flags(fanflags, meta->mask, flags_label, sizeof(flags_label));
+  logf(DBG, "fanotify: mask={:x} {}\n", meta->mask, flags_label);
+
+  if (meta->mask & FAN_Q_OVERFLOW) {
+    /* we missed something, will need to re-crawl */
+    root->scheduleRecrawl("FAN_Q_OVERFLOW");
+    return false;
+  }
+
+  auto info = reinterpret_cast<const char*>(meta) + meta->metadata_len;
+  auto end = reinterpret_cast<const char*>(meta) + meta->event_len;
+  while (info < end) {
+    auto fid = reinterpret_cast<const struct fanotify_event_info_fid*>(info);
+    info += fid->hdr.len;
+    if (fid->hdr.len == 0) {
+      break;
+    }
+    if (fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME &&
+        fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID) {
+      continue;
+    }
+
+    auto fh = reinterpret_cast<struct file_handle*>(
+        const_cast<unsigned char*>(fid->handle));
+    const char* name = "";
+    if (fid->hdr.info_type == FAN_EVENT_INFO_TYPE_DFID_NAME) {
+      name = reinterpret_cast<const char*>(fh->f_handle + fh->handle_bytes);
+    }
+
+    auto dir_name = resolveDir(fh);
+    if (!dir_name) {
+      // The dir is already gone; the change to its parent covers this.
+      unresolvedEvents_.fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+    if (!isWithinRoot(*dir_name)) {
+      outsideRootEvents_.fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+
+    w_string path = (name[0] == 0 || !strcmp(name, "."))
+        ? *dir_name
+        : w_string::pathCat({*dir_name, w_string_piece(name)});
+
+    if (meta->mask & (FAN_DELETE_SELF | FAN_MOVE_SELF)) {
+      if (path == rootPath_) {
+        logf(
+            ERR,
+            "root dir {} has been (re)moved, canceling watch\n",
+            rootPath_);
+        return true;
+      }
+      // We need to examine the parent and potentially crawl down
+      path = path.dirName();
+    }
+
+    PendingFlags pending_flags = W_PENDING_VIA_NOTIFY;
+    bool namespaceChange = (meta->mask &
+                            (FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM |
+                             FAN_MOVED_TO)) != 0;
+    if (namespaceChange) {
+      pending_flags.set(W_PENDING_RECURSIVE);
+    }
+
+    logf(DBG, "add_pending for fanotify mask={:x} {}\n", meta->mask, path);
+    coll.add(path, now, pending_flags);
+
+    if (namespaceChange && path != rootPath_) {
+      // As with inotify, the dir containing a created or removed entry
+      // needs to be rescanned too.
+      coll.add(path.dirName(), now, W_PENDING_VIA_NOTIFY);
+    }
+  }
+
+  if ((meta->mask & FAN_ONDIR) && (meta->mask & kDirNamespaceChange)) {
+    // Dirs below the one that moved or went away now have different (or
+    // no) paths
+    dirCache_.clear();
+  }
+  return false;
+}
+
+Watcher::ConsumeNotifyRet FanotifyWatcher::consumeNotify(
+    const std::shared_ptr<Root>& root,
+    PendingChanges& coll) {
+  auto n = read(fanFd_.fd(), ibuf, sizeof(ibuf));
+  if (n == -1) {
+    if (errno == EINTR || errno == EAGAIN) {
+      return {false};
+    }
+    logf(
+        FATAL,
+        "read({}, {}): error {}\n",
+        fanFd_.fd(),
+        sizeof(ibuf),
+        folly::errnoStr(errno));
+  }
+
+  logf(DBG, "fanotify read: returned {}.\n", n);
+  auto now = std::chrono::system_clock::now();
+
+  bool cancel = false;
+  size_t eventsSeen = 0;
+  auto len = n;
+  for (auto meta = reinterpret_cast<struct fanotify_event_metadata*>(ibuf);
+       FAN_EVENT_OK(meta, len);
+       meta = FAN_EVENT_NEXT(meta, len)) {
+    if (meta->vers != FANOTIFY_METADATA_VERSION) {
+      logf(
+          ERR,
+          "fanotify metadata version mismatch: got {}, expected {}\n",
+          meta->vers,
+          FANOTIFY_METADATA_VERSION);
+      root->scheduleRecrawl("fanotify version mismatch");
+      break;
+    }
+    cancel |= processEvent(root, coll, meta, now);
+    ++eventsSeen;
+  }
+
+  // Relaxed because we don't really care exactly when the value is visible.
+  totalEventsSeen_.fetch_add(eventsSeen, std::memory_order_relaxed);
+  return {cancel};
+}
+
+bool FanotifyWatcher::waitNotify(int timeoutms) {
+  struct pollfd pfd[2];
+  pfd[0].fd = fanFd_.fd();
+  pfd[0].events = POLLIN;
+  pfd[1].fd = terminatePipe_.read.fd();
+  pfd[1].events = POLLIN;
+
+  int n = poll(pfd, std::size(pfd), timeoutms);
+
+  if (n > 0) {
+    if (pfd[1].revents) {
+      // We were signalled via signalThreads
+      return false;
+    }
+    return pfd[0].revents != 0;
+  }
+  return false;
+}
+
+void FanotifyWatcher::stopThreads() {
+  ignore_result(write(terminatePipe_.write.fd(), "X", 1));
+}
+
+json_ref FanotifyWatcher::getDebugInfo() {
+  return json_object({
+      {"total_event_count", json_integer(totalEventsSeen_.load())},
+      {"outside_root_event_count", json_integer(outsideRootEvents_.load())},
+      {"unresolved_event_count", json_integer(unresolvedEvents_.load())},
+      {"dir_cache_misses", json_integer(dirCacheMisses_.load())},
+  });
+}
+
+void FanotifyWatcher::clearDebugInfo() {
+  totalEventsSeen_.store(0, std::memory_order_release);
+  outsideRootEvents_.store(0, std::memory_order_release);
+  unresolvedEvents_.store(0, std::memory_order_release);
+  dirCacheMisses_.store(0, std::memory_order_release);
+}
+
+namespace {
+std::shared_ptr<QueryableView> detectFanotify(
+    const w_string& root_path,
+    const w_string& fstype,
+    const Configuration& config) {
+  if (is_edenfs_fs_type(fstype)) {
+    throw std::runtime_error("cannot watch EdenFS file systems with fanotify");
+  }
+  return std::make_shared<InMemoryView>(
+      realFileSystem,
+      root_path,
+      config,
+      std::make_shared<FanotifyWatcher>(root_path, config));
+}
+} // namespace
+
+// Lower priority than inotify: only used when explicitly requested.
+static WatcherRegistry reg("fanotify", detectFanotify, -1);
+
+#endif // HAVE_FANOTIFY_INIT
+
+/* vim:ts=2:sw=2:et:
+ */
@@ -6,11 +6,15 @@
  */
 
 #include "watchman/watcher/fsevents.h"
+#include <folly/Conv.h>
 #include <folly/String.h>
 #include <folly/Synchronized.h>
+#include <algorithm>
 #include <condition_variable>
 #include <iterator>
 #include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include "watchman/Client.h"
 #include "watchman/FlagMap.h"
@@ -40,6 +44,69 @@ struct CFDeleter {
 template <typename T>
 using unique_ref = std::unique_ptr<std::remove_pointer_t<T>, CFDeleter>;
 
+w_string uuidToHex(CFUUIDRef uuid) {
+  auto bytes = CFUUIDGetUUIDBytes(uuid);
+  auto hex = folly::hexlify(folly::ByteRange{
+      reinterpret_cast<const uint8_t*>(&bytes), sizeof(bytes)});
+  return w_string{hex.data(), hex.size()};
+}
+
+// Returns the dirs named by fsevents_stream_partitions that can be given a
+// stream of their own: existing, unignored top-level dirs of the root.  The
+// main stream has to exclude each of them, so there are at most
+// kMaxExclusions.
+std::vector<w_string> getPartitionDirs(const std::shared_ptr<Root>& root) {
+  std::vector<w_string> dirs;
+  auto partitions = root->config.get("fsevents_stream_partitions");
+  if (!partitions) {
+    return dirs;
+  }
+  if (!partitions->isArray()) {
+    logf(ERR, "fsevents_stream_partitions must be an array of strings\n");
+    return dirs;
+  }
+  for (auto& jname : partitions->array()) {
+    if (!jname.isString()) {
+      logf(ERR, "fsevents_stream_partitions must be an array of strings\n");
+      continue;
+    }
+    auto name = json_to_w_string(jname);
+    if (name.empty() || name.view().find('/') != std::string_view::npos) {
+      logf(
+          ERR,
+          "fsevents_stream_partitions: {} is not a top-level dir name\n",
+          name);
+      continue;
+    }
+    auto path = w_string::pathCat({root->root_path, name});
+    struct stat st;
+    if (root->ignore.isIgnoreDir(path) || stat(path.c_str(), &st) != 0 ||
+        !S_ISDIR(st.st_mode)) {
+      logf(
+          ERR,
+          "fsevents_stream_partitions: not partitioning {}, which is not "
+          "a watched dir\n",
+          path);
+      continue;
+    }
+    if (std::find(dirs.begin(), dirs.end(), path) != dirs.end()) {
+      continue;
+    }
+    if (dirs.size() == kMaxExclusions) {
+      logf(
+          ERR,
+          "fsevents_stream_partitions: only the first {} dirs are given "
+          "streams of their own\n",
+          kMaxExclusions);
+      break;
+    }
+    dirs.push_back(std::move(path));
+  }
+  return dirs;
+}
+
+void drainQueue(void*) {}
+
 } // namespace
 
 struct FSEventsStream {
@@ -52,6 +119,11 @@ struct FSEventsStream {
   bool inject_drop{false};
   bool event_id_wrapped{false};
   unique_ref<CFUUIDRef> uuid;
+  // The dir that the stream watches
+  w_string path;
+  // Set for the streams of fsevents_stream_partitions, which deliver on this
+  // queue, and otherwise null for a stream on the fsevents thread's run loop.
+  dispatch_queue_t queue{nullptr};
 
   FSEventsStream(
       const std::shared_ptr<Root>& root,
@@ -65,8 +137,15 @@ FSEventsStream::~FSEventsStream() {
   if (stream) {
     FSEventStreamStop(stream);
     FSEventStreamInvalidate(stream);
+    if (queue) {
+      // Wait out a callback that is already running on the queue
+      dispatch_sync_f(queue, nullptr, drainQueue);
+    }
     FSEventStreamRelease(stream);
   }
+  if (queue) {
+    dispatch_release(queue);
+  }
 }
 
 static const flag_map kflags[] = {
@@ -185,7 +264,9 @@ void FSEventsWatcher::fse_callback(
         log_drop_event(
             root, eventFlags[i] & kFSEventStreamEventFlagKernelDropped);
 
-        if (watcher->attemptResyncOnDrop_) {
+        // Only the main stream resyncs; a partition's stream reports the
+        // drop, below, and its dir is rescanned.
+        if (watcher->attemptResyncOnDrop_ && !stream->queue) {
         // fseventsd has a reliable journal so we can attempt to resync.
         do_resync:
           if (stream->event_id_wrapped) {
@@ -243,7 +324,7 @@ void FSEventsWatcher::fse_callback(
         break;
       }
     }
-  } else if (watcher->attemptResyncOnDrop_) {
+  } else if (watcher->attemptResyncOnDrop_ && !stream->queue) {
     // This stream has already lost sync and our policy is to resync
     // for ourselves.  This is most likely a spurious callback triggered
     // after we'd taken action above.  We just ignore further events
@@ -261,6 +342,7 @@ propagate:
       // The docs say to ignore this event; it's just a marker informing
       // us that a resync completed.  Take this opportunity to log how
       // many events were replayed to catch up.
+      watcher->replayingHistory_.store(false, std::memory_order_release);
       logf(
           ERR,
           "Historical resync completed at event id {} (caught "
@@ -274,6 +356,19 @@ propagate:
       stream->event_id_wrapped = true;
     }
 
+    if (stream->queue &&
+        (eventFlags[i] &
+         (kFSEventStreamEventFlagUserDropped |
+          kFSEventStreamEventFlagKernelDropped))) {
+      // Report the drop against the partition's dir, so that consumeNotify
+      // rescans that dir rather than recrawling the whole root.
+      items.emplace_back(
+          w_string{stream->path},
+          eventFlags[i] | kFSEventStreamEventFlagMustScanSubDirs,
+          eventIds[i]);
+      continue;
+    }
+
     uint32_t len = strlen(path);
     while (path[len - 1] == '/') {
       len--;
@@ -283,7 +378,7 @@ propagate:
       continue;
     }
 
-    items.emplace_back(w_string(path, len), eventFlags[i]);
+    items.emplace_back(w_string(path, len), eventFlags[i], eventIds[i]);
     if (!stream->lost_sync) {
       stream->last_good = eventIds[i];
     }
@@ -305,7 +400,8 @@ std::unique_ptr<FSEventsStream> FSEventsWatcher::fse_stream_make(
     const std::shared_ptr<Root>& root,
     FSEventsWatcher* watcher,
     FSEventStreamEventId since,
-    std::optional<w_string>& failure_reason) {
+    std::optional<w_string>& failure_reason,
+    const w_string* partition) {
   auto ctx = FSEventStreamContext();
   unique_ref<CFMutableArrayRef> parray;
   unique_ref<CFStringRef> cpath;
@@ -347,21 +443,33 @@ std::unique_ptr<FSEventsStream> FSEventsWatcher::fse_stream_make(
           "fsevents journal is not available for dev_t=", st.st_dev, "\n");
       return nullptr;
     }
-    // Compare the UUID with that of the current stream
-    if (!watcher->stream_->uuid) {
-      failure_reason = w_string(
-          "fsevents journal was not available for prior stream",
-          W_STRING_UNICODE);
-      return nullptr;
-    }
+    if (!watcher->stream_) {
+      // Replaying after a restart; compare the UUID with the one that the
+      // event id was recorded against.
+      if (!watcher->resumeFrom_ ||
+          uuidToHex(fse_stream->uuid.get()) != watcher->resumeFrom_->first) {
+        failure_reason = w_string(
+            "fsevents journal UUID changed since the event id was saved",
+            W_STRING_UNICODE);
+        return nullptr;
+      }
+    } else {
+      // Compare the UUID with that of the current stream
+      if (!watcher->stream_->uuid) {
+        failure_reason = w_string(
+            "fsevents journal was not available for prior stream",
+            W_STRING_UNICODE);
+        return nullptr;
+      }
 
-    a = CFUUIDGetUUIDBytes(fse_stream->uuid.get());
-    b = CFUUIDGetUUIDBytes(watcher->stream_->uuid.get());
+      a = CFUUIDGetUUIDBytes(fse_stream->uuid.get());
+      b = CFUUIDGetUUIDBytes(watcher->stream_->uuid.get());
 
-    if (memcmp(&a, &b, sizeof(a)) != 0) {
-      failure_reason =
-          w_string("fsevents journal UUID is different", W_STRING_UNICODE);
-      return nullptr;
+      if (memcmp(&a, &b, sizeof(a)) != 0) {
+        failure_reason =
+            w_string("fsevents journal UUID is different", W_STRING_UNICODE);
+        return nullptr;
+      }
     }
   }
 
@@ -373,11 +481,14 @@ std::unique_ptr<FSEventsStream> FSEventsWatcher::fse_stream_make(
     return nullptr;
   }
 
-  if (auto subdir = watcher->subdir) {
+  if (partition) {
+    path = *partition;
+  } else if (auto subdir = watcher->subdir) {
     path = *subdir;
   } else {
     path = root->root_path;
   }
+  fse_stream->path = path;
 
   cpath.reset(CFStringCreateWithBytes(
       nullptr,
@@ -400,7 +511,12 @@ std::unique_ptr<FSEventsStream> FSEventsWatcher::fse_stream_make(
       path,
       latency);
 
-  flags = kFSEventStreamCreateFlagNoDefer | kFSEventStreamCreateFlagWatchRoot;
+  flags = kFSEventStreamCreateFlagNoDefer;
+  if (!partition) {
+    // A partition's dir being moved or removed is reported by its own
+    // stream, and handled like any other change.
+    flags |= kFSEventStreamCreateFlagWatchRoot;
+  }
   if (watcher->hasFileWatching_) {
     flags |= kFSEventStreamCreateFlagFileEvents;
   }
@@ -412,14 +528,46 @@ std::unique_ptr<FSEventsStream> FSEventsWatcher::fse_stream_make(
     return nullptr;
   }
 
-  FSEventStreamScheduleWithRunLoop(
-      fse_stream->stream, CFRunLoopGetCurrent(), kCFRunLoopDefaultMode);
+  if (partition) {
+    auto label = fmt::format("watchman fsevents {}", path);
+    fse_stream->queue = dispatch_queue_create(label.c_str(), nullptr);
+    if (!fse_stream->queue) {
+      failure_reason =
+          w_string("dispatch_queue_create failed", W_STRING_UNICODE);
+      return nullptr;
+    }
+    FSEventStreamSetDispatchQueue(fse_stream->stream, fse_stream->queue);
+  } else {
+    FSEventStreamScheduleWithRunLoop(
+        fse_stream->stream, CFRunLoopGetCurrent(), kCFRunLoopDefaultMode);
+  }
 
+  // The main stream leaves the partitions to their own streams, so those
+  // exclusions come before any ignored dirs.
+  std::vector<w_string> exclusions;
+  if (!partition) {
+    exclusions = watcher->partitionDirs_;
+  }
   if (root->config.getBool("_use_fsevents_exclusions", true)) {
-    auto& dirs_vec = root->ignore.getIgnoredDirs();
+    for (const auto& path : root->ignore.getIgnoredDirs()) {
+      if (partition) {
+        if (!path.piece().startsWith(*partition) ||
+            path.size() <= partition->size() ||
+            path.data()[partition->size()] != '/') {
+          continue;
+        }
+      } else if (const auto& subdir = watcher->subdir) {
+        if (!path.piece().startsWith(*subdir)) {
+          continue;
+        }
+        logf(DBG, "Adding exclusion: {} for subdir: {}\n", path, *subdir);
+      }
+      exclusions.push_back(path);
+    }
+  }
 
-    size_t nitems = std::min(dirs_vec.size(), kMaxExclusions);
-    size_t appended = 0;
+  if (!exclusions.empty()) {
+    size_t nitems = std::min(exclusions.size(), kMaxExclusions);
 
     unique_ref<CFMutableArrayRef> ignarray{
         CFArrayCreateMutable(nullptr, 0, &kCFTypeArrayCallBacks)};
@@ -429,14 +577,8 @@ std::unique_ptr<FSEventsStream> FSEventsWatcher::fse_stream_make(
       return nullptr;
     }
 
-    for (const auto& path : dirs_vec) {
-      if (const auto& subdir = watcher->subdir) {
-        if (!path.piece().startsWith(*subdir)) {
-          continue;
-        }
-        logf(DBG, "Adding exclusion: {} for subdir: {}\n", path, *subdir);
-      }
-
+    for (size_t i = 0; i < nitems; ++i) {
+      const auto& path = exclusions[i];
       unique_ref<CFStringRef> ignpath{CFStringCreateWithBytes(
           nullptr,
           (const UInt8*)path.data(),
@@ -451,19 +593,12 @@ std::unique_ptr<FSEventsStream> FSEventsWatcher::fse_stream_make(
       }
 
       CFArrayAppendValue(ignarray.get(), ignpath.get());
-
-      appended++;
-      if (appended == nitems) {
-        break;
-      }
     }
 
-    if (appended != 0) {
-      if (!FSEventStreamSetExclusionPaths(fse_stream->stream, ignarray.get())) {
-        failure_reason =
-            w_string("FSEventStreamSetExclusionPaths failed", W_STRING_UNICODE);
-        return nullptr;
-      }
+    if (!FSEventStreamSetExclusionPaths(fse_stream->stream, ignarray.get())) {
+      failure_reason =
+          w_string("FSEventStreamSetExclusionPaths failed", W_STRING_UNICODE);
+      return nullptr;
     }
   }
 
@@ -498,11 +633,48 @@ void FSEventsWatcher::FSEventsThread(const std::shared_ptr<Root>& root) {
           CFRunLoopGetCurrent(), fdsrc.get(), kCFRunLoopDefaultMode);
     }
 
-    stream_ = fse_stream_make(
-        root, this, kFSEventStreamEventIdSinceNow, root->failure_reason);
+    if (!subdir) {
+      partitionDirs_ = getPartitionDirs(root);
+    }
+
+    if (resumeFrom_ && partitionDirs_.empty()) {
+      auto since = resumeFrom_->second;
+      std::optional<w_string> failure_reason;
+      if (since > FSEventsGetCurrentEventId()) {
+        // The event ids were reset or wrapped
+        failure_reason = w_string(
+            "the event id is ahead of the fsevents journal", W_STRING_UNICODE);
+      } else {
+        stream_ = fse_stream_make(root, this, since, failure_reason);
+      }
+      if (stream_) {
+        logf(ERR, "replaying fsevents from event id {}\n", since);
+        consumedEventId_.store(since, std::memory_order_release);
+        replayingHistory_.store(true, std::memory_order_release);
+        resumed_.store(true, std::memory_order_release);
+      } else {
+        logf(
+            ERR,
+            "unable to replay fsevents from event id {}, crawling instead: "
+            "{}\n",
+            since,
+            failure_reason ? *failure_reason : w_string{});
+      }
+    }
+
     if (!stream_) {
-      logf(ERR, "fse_thread failed: fse_stream_make");
-      return;
+      // Changes from here on are reported, and the crawl finds the rest.
+      consumedEventId_.store(
+          FSEventsGetCurrentEventId(), std::memory_order_release);
+      stream_ = fse_stream_make(
+          root, this, kFSEventStreamEventIdSinceNow, root->failure_reason);
+      if (!stream_) {
+        logf(ERR, "fse_thread failed: fse_stream_make");
+        return;
+      }
+    }
+    if (stream_->uuid) {
+      journalUuid_ = uuidToHex(stream_->uuid.get());
     }
 
     if (!FSEventStreamStart(stream_->stream)) {
@@ -516,6 +688,25 @@ void FSEventsWatcher::FSEventsThread(const std::shared_ptr<Root>& root) {
       return;
     }
 
+    for (auto& dir : partitionDirs_) {
+      auto partition = fse_stream_make(
+          root,
+          this,
+          kFSEventStreamEventIdSinceNow,
+          root->failure_reason,
+          &dir);
+      if (!partition || !FSEventStreamStart(partition->stream)) {
+        if (!root->failure_reason) {
+          root->failure_reason = w_string::build(
+              "FSEventStreamStart failed for partition ", dir, "\n");
+        }
+        logf(ERR, "fse_thread failed: partition {}\n", dir);
+        return;
+      }
+      logf(DBG, "watching {} with a stream of its own\n", dir);
+      partitions_.push_back(std::move(partition));
+    }
+
     // Signal to fsevents_root_start that we're done initializing
     fseCond_.notify_one();
   }
@@ -523,6 +714,10 @@ void FSEventsWatcher::FSEventsThread(const std::shared_ptr<Root>& root) {
   // Process the events stream until we get signalled to quit
   CFRunLoopRun();
 
+  for (auto& partition : partitions_) {
+    FSEventStreamStop(partition->stream);
+  }
+
   logf(DBG, "fse_thread done\n");
 }
 
@@ -532,10 +727,14 @@ FSEventsWatcher::FSEventsWatcher(
     std::optional<w_string> dir)
     : Watcher(
           hasFileWatching ? "fsevents" : "dirfsevents",
-          hasFileWatching ? WATCHER_HAS_PER_FILE_NOTIFICATIONS : 0),
+          hasFileWatching ? WATCHER_HAS_PER_FILE_NOTIFICATIONS |
+                  WATCHER_MAY_REPEAT_NOTIFICATIONS
+                          : 0),
       attemptResyncOnDrop_{config.getBool("fsevents_try_resync", false)},
       hasFileWatching_{hasFileWatching},
       enableStreamFlush_{config.getBool("fsevents_enable_stream_flush", true)},
+      dirBatchThreshold_{size_t(
+          config.getInt("fsevents_dir_batch_threshold", 64))},
       subdir{std::move(dir)} {
   // TODO: Add ring buffer logging for events in the shared kqueue+fsevents
   // logger.
@@ -643,6 +842,9 @@ folly::SemiFuture<folly::Unit> FSEventsWatcher::flushPendingEvents() {
 
   // Ensure all events queued by FSEvents are pushed into wlock->items.
   FSEventStreamFlushSync(stream_->stream);
+  for (auto& partition : partitions_) {
+    FSEventStreamFlushSync(partition->stream);
+  }
 
   // Now return a Future that is fulfilled when all of the items have been
   // processed by InMemoryView.
@@ -692,6 +894,20 @@ Watcher::ConsumeNotifyRet FSEventsWatcher::consumeNotify(
 
   auto now = std::chrono::system_clock::now();
 
+  // Plain file level events, by parent dir, and the dirs whose entries are
+  // known to have changed.  These are added once the batch has been seen,
+  // so that a dir with many changed files is scanned once, with the bulk
+  // stat of its entries, rather than having each file stat'd on its own.
+  std::unordered_map<w_string, std::vector<w_string>> fileEventsByDir;
+  std::unordered_set<w_string> changedDirs;
+  auto consumedEventId = consumedEventId_.load(std::memory_order_acquire);
+
+  // The two halves of a dir rename arrive as consecutive events, the old
+  // path first.  The IO thread confirms the pairing before relying on it.
+  constexpr FSEventStreamEventFlags kDirRenamed =
+      kFSEventStreamEventFlagItemRenamed | kFSEventStreamEventFlagItemIsDir;
+  const watchman_fsevent* renamedDir = nullptr;
+
   for (auto& vec : items) {
     for (auto& item : vec) {
       w_expand_flags(kflags, item.flags, flags_label, sizeof(flags_label));
@@ -701,19 +917,34 @@ Watcher::ConsumeNotifyRet FSEventsWatcher::consumeNotify(
           item.path,
           item.flags,
           flags_label);
+      consumedEventId = std::max(consumedEventId, item.eventId);
+
+      if ((item.flags & kFSEventStreamEventFlagEventIdsWrapped) &&
+          replayingHistory_.load(std::memory_order_acquire)) {
+        // The history can't be trusted to cover the time the daemon was
+        // down.
+        root->scheduleRecrawl("fsevents event ids wrapped during replay");
+      }
 
       if (item.flags &
           (kFSEventStreamEventFlagUserDropped |
            kFSEventStreamEventFlagKernelDropped)) {
-        if (!subdir) {
-          root->scheduleRecrawl(flags_label);
-          break;
-        } else {
+        if (subdir) {
           w_assert(
               item.flags & kFSEventStreamEventFlagMustScanSubDirs,
               "dropped events should specify kFSEventStreamEventFlagMustScanSubDirs");
           auto reason = fmt::format("{}: {}", *subdir, flags_label);
           root->recrawlTriggered(reason.c_str());
+        } else if (
+            std::find(
+                partitionDirs_.begin(), partitionDirs_.end(), item.path) !=
+            partitionDirs_.end()) {
+          // Only a partition's stream lost sync, so only its dir is rescanned
+          auto reason = fmt::format("{}: {}", item.path, flags_label);
+          root->recrawlTriggered(reason.c_str());
+        } else {
+          root->scheduleRecrawl(flags_label);
+          break;
         }
       }
 
@@ -750,11 +981,27 @@ Watcher::ConsumeNotifyRet FSEventsWatcher::consumeNotify(
         continue;
       }
 
+      bool moveTarget = false;
+      if ((item.flags & kDirRenamed) == kDirRenamed) {
+        if (renamedDir && item.eventId == renamedDir->eventId + 1) {
+          coll.addMove(renamedDir->path, item.path, now);
+          moveTarget = true;
+          renamedDir = nullptr;
+        } else {
+          renamedDir = &item;
+        }
+      } else {
+        renamedDir = nullptr;
+      }
+
       PendingFlags flags = W_PENDING_VIA_NOTIFY;
 
-      if (item.flags &
-          (kFSEventStreamEventFlagMustScanSubDirs |
-           kFSEventStreamEventFlagItemRenamed)) {
+      if (item.flags & kFSEventStreamEventFlagMustScanSubDirs) {
+        flags.set(W_PENDING_RECURSIVE);
+      } else if (moveTarget) {
+        // The IO thread moves what it knew of the old path here, and
+        // queues a crawl itself if it can't.
+      } else if (item.flags & kFSEventStreamEventFlagItemRenamed) {
         flags.set(W_PENDING_RECURSIVE);
       } else if (item.flags & kFSEventStreamEventFlagItemRenamed) {
         // FSEvents does not reliably report the individual files renamed in the
@@ -770,7 +1017,17 @@ Watcher::ConsumeNotifyRet FSEventsWatcher::consumeNotify(
         flags.set(W_PENDING_IS_DESYNCED);
       }
 
-      coll.add(item.path, now, flags);
+      // Cookies must arrive as notifications to be seen, and the contents
+      // of VCS dirs are never scanned, so those are never batched.
+      if (hasFileWatching_ && flags.asRaw() == W_PENDING_VIA_NOTIFY.asRaw() &&
+          item.path.size() > root->root_path.size() &&
+          (item.flags & kFSEventStreamEventFlagItemIsFile) &&
+          !root->cookies.isCookiePrefix(item.path) &&
+          !root->ignore.isIgnoreVCS(item.path.piece().dirName())) {
+        fileEventsByDir[item.path.dirName()].push_back(item.path);
+      } else {
+        coll.add(item.path, now, flags);
+      }
 
       if (hasFileWatching_ && item.path.size() > root->root_path.size() &&
           (item.flags &
@@ -789,18 +1046,69 @@ Watcher::ConsumeNotifyRet FSEventsWatcher::consumeNotify(
         // Watchman does not guarantee minimal notifications, but limiting
         // the event types above should avoid unnecessary results in
         // queries.
-        coll.add(item.path.dirName(), now, W_PENDING_VIA_NOTIFY);
+        changedDirs.insert(item.path.dirName());
       }
     }
   }
 
+  for (auto& dir : changedDirs) {
+    coll.add(dir, now, W_PENDING_VIA_NOTIFY);
+  }
+  for (auto& [dir, paths] : fileEventsByDir) {
+    if (dirBatchThreshold_ && paths.size() >= dirBatchThreshold_) {
+      coll.add(dir, now, W_PENDING_VIA_NOTIFY | W_PENDING_NONRECURSIVE_SCAN);
+      continue;
+    }
+    for (auto& path : paths) {
+      coll.add(path, now, W_PENDING_VIA_NOTIFY);
+    }
+  }
+
   for (auto& sync : syncs) {
     coll.addSync(std::move(sync));
   }
+  consumedEventId_.store(consumedEventId, std::memory_order_release);
 
   return {cancelSelf};
 }
 
+w_string FSEventsWatcher::getResumeToken() const {
+  if (journalUuid_.empty()) {
+    // Without a journal there is no history to replay
+    return w_string{};
+  }
+  if (!partitionDirs_.empty()) {
+    // The streams deliver independently, so the latest event id consumed
+    // from one of them says nothing of what the others have yet to deliver.
+    return w_string{};
+  }
+  return w_string::build(
+      "fsevents:",
+      journalUuid_,
+      ":",
+      consumedEventId_.load(std::memory_order_acquire));
+}
+
+void FSEventsWatcher::resumeFrom(w_string_piece token) {
+  std::vector<std::string_view> parts;
+  folly::split(':', token.view(), parts);
+  if (parts.size() != 3 || parts[0] != "fsevents") {
+    logf(ERR, "ignoring resume token {} from another watcher\n", token);
+    return;
+  }
+  auto since = folly::tryTo<FSEventStreamEventId>(parts[2]);
+  if (!since) {
+    logf(ERR, "ignoring malformed resume token {}\n", token);
+    return;
+  }
+  resumeFrom_ =
+      std::make_pair(w_string{parts[1].data(), parts[1].size()}, *since);
+}
+
+bool FSEventsWatcher::resumed() const {
+  return resumed_.load(std::memory_order_acquire);
+}
+
 void FSEventsWatcher::stopThreads() {
   write(fsePipe_.write.fd(), "X", 1);
 }
@@ -820,9 +1128,14 @@ json_ref FSEventsWatcher::getDebugInfo() {
     }
     events = json_array(std::move(elements));
   }
+  std::vector<json_ref> partitions;
+  for (auto& dir : partitionDirs_) {
+    partitions.push_back(w_string_to_json(dir));
+  }
   return json_object({
       {"events", events},
       {"total_event_count", json_integer(totalEventsSeen_.load())},
+      {"partitions", json_array(std::move(partitions))},
   });
 }
 
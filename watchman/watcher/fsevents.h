@@ -8,6 +8,7 @@
 #pragma once
 
 #include <optional>
+#include <vector>
 #include "watchman/RingBuffer.h"
 #include "watchman/fs/Pipe.h"
 #include "watchman/watcher/Watcher.h"
@@ -25,9 +26,13 @@ struct FSEventsLogEntry;
 struct watchman_fsevent {
   w_string path;
   FSEventStreamEventFlags flags;
+  FSEventStreamEventId eventId;
 
-  watchman_fsevent(w_string&& path, FSEventStreamEventFlags flags)
-      : path(std::move(path)), flags(flags) {}
+  watchman_fsevent(
+      w_string&& path,
+      FSEventStreamEventFlags flags,
+      FSEventStreamEventId eventId = 0)
+      : path(std::move(path)), flags(flags), eventId(eventId) {}
 };
 
 class FSEventsWatcher : public Watcher {
@@ -57,6 +62,11 @@ class FSEventsWatcher : public Watcher {
 
   bool waitNotify(int timeoutms) override;
   void stopThreads() override;
+
+  w_string getResumeToken() const override;
+  void resumeFrom(w_string_piece token) override;
+  bool resumed() const override;
+
   void FSEventsThread(const std::shared_ptr<Root>& root);
 
   json_ref getDebugInfo() override;
@@ -71,7 +81,8 @@ class FSEventsWatcher : public Watcher {
       const std::shared_ptr<Root>& root,
       FSEventsWatcher* watcher,
       FSEventStreamEventId since,
-      std::optional<w_string>& failure_reason);
+      std::optional<w_string>& failure_reason,
+      const w_string* partition = nullptr);
   static void fse_callback(
       ConstFSEventStreamRef,
       void* clientCallBackInfo,
@@ -94,11 +105,32 @@ class FSEventsWatcher : public Watcher {
   folly::Synchronized<Items, std::mutex> items_;
 
   std::unique_ptr<FSEventsStream> stream_;
+  // The top-level dirs named by fsevents_stream_partitions, and the streams
+  // that watch them, each delivering on a dispatch queue of its own rather
+  // than the run loop of the fsevents thread.  The main stream excludes
+  // these dirs.  Set before start() returns, and not changed after that.
+  std::vector<w_string> partitionDirs_;
+  std::vector<std::unique_ptr<FSEventsStream>> partitions_;
   const bool attemptResyncOnDrop_{false};
   const bool hasFileWatching_{false};
   const bool enableStreamFlush_{true};
+  // When at least this many files in one dir change in a batch, the dir is
+  // scanned instead; zero disables this.
+  const size_t dirBatchThreshold_{0};
   std::optional<w_string> subdir{std::nullopt};
 
+  // The journal UUID and event id to replay from, set by resumeFrom()
+  std::optional<std::pair<w_string, FSEventStreamEventId>> resumeFrom_;
+  // The UUID of the fseventsd journal for the root's device, as hex.  Set
+  // before start() returns, and not changed after that.
+  w_string journalUuid_;
+  // Set if the stream was created to replay from resumeFrom_
+  std::atomic<bool> resumed_{false};
+  // Set until the stream has caught up with the replayed history
+  std::atomic<bool> replayingHistory_{false};
+  // The latest event id seen by consumeNotify
+  std::atomic<FSEventStreamEventId> consumedEventId_{0};
+
   // Incremented in fse_callback
   std::atomic<size_t> totalEventsSeen_{0};
   /**
@@ -7,7 +7,12 @@
 
 #include <folly/String.h>
 #include <folly/Synchronized.h>
+#include <algorithm>
 #include <atomic>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 #include "watchman/Constants.h"
 #include "watchman/Errors.h"
 #include "watchman/FlagMap.h"
@@ -16,8 +21,10 @@
 #include "watchman/RingBuffer.h"
 #include "watchman/fs/FSDetect.h"
 #include "watchman/fs/FileDescriptor.h"
+#include "watchman/fs/FileSystem.h"
 #include "watchman/fs/Pipe.h"
 #include "watchman/root/Root.h"
+#include "watchman/watcher/DirPoller.h"
 #include "watchman/watcher/Watcher.h"
 #include "watchman/watcher/WatcherRegistry.h"
 
@@ -119,6 +126,40 @@ struct InotifyLogEntry {
 };
 static_assert(64 == sizeof(InotifyLogEntry));
 
+/**
+ * State shared across the events of a single batched consumeNotify() call.
+ */
+struct InotifyBatch {
+  // Names of the dirs referenced by the batch, resolved under a single
+  // acquisition of the maps lock.
+  std::unordered_map<int, w_string> wd_to_name;
+  // Pending changes produced by the batch, coalesced by name.
+  std::unordered_map<w_string, PendingFlags> changes;
+  // Number of add() calls that were folded into an existing change.
+  size_t coalesced{0};
+  // Dir renames paired up by the batch, as (from, to).
+  std::vector<std::pair<w_string, w_string>> moves;
+
+  void add(const w_string& name, PendingFlags flags) {
+    auto [it, inserted] = changes.try_emplace(name, flags);
+    if (!inserted) {
+      it->second.set(flags);
+      ++coalesced;
+    }
+  }
+};
+
+/**
+ * A buffer of raw events handed from the reader thread to the notify thread.
+ */
+struct InotifyChunk {
+  size_t len{0};
+  size_t events{0};
+  // read() only ever returns whole events, and this is big enough for a
+  // couple of hundred of them even at the maximum name length.
+  char buf[64 * 1024];
+};
+
 } // namespace
 
 struct InotifyWatcher : public Watcher {
@@ -137,15 +178,80 @@ struct InotifyWatcher : public Watcher {
    */
   std::atomic<uint64_t> totalEventsSeen_ = 0;
 
+  /**
+   * When set, consumeNotify drains everything that is currently readable
+   * from the inotify fd into ibuf before processing it as a single batch.
+   * Controlled by the `inotify_batch_events` configuration option.
+   */
+  const bool batchEvents_;
+
+  /**
+   * When `inotify_reader_thread` is enabled, a dedicated reader thread owns
+   * infd.  It does nothing but copy raw events into readerRing_, so that the
+   * kernel queue keeps draining even while the notify thread is blocked on
+   * the pending collection.  The notify thread consumes the ring and is woken
+   * via readerReady_.
+   */
+  std::unique_ptr<SpscRingBuffer<InotifyChunk>> readerRing_;
+  Pipe readerReady_;
+  // Events sitting in readerRing_, and the most there have ever been.
+  std::atomic<uint64_t> queuedEvents_ = 0;
+  std::atomic<uint64_t> queuedEventsHighWater_ = 0;
+
+  // Counters for batched mode, published for getDebugInfo.
+  std::atomic<uint64_t> batches_ = 0;
+  std::atomic<uint64_t> batchReads_ = 0;
+  std::atomic<uint64_t> coalescedEvents_ = 0;
+  std::atomic<uint64_t> largestBatch_ = 0;
+
+  // Events for ignored paths that were dropped rather than queued, by
+  // whether the path itself or one of its parents is ignored.
+  std::atomic<uint64_t> droppedIgnoredPath_ = 0;
+  std::atomic<uint64_t> droppedIgnoredParent_ = 0;
+
+  /**
+   * Promises from flushPendingEvents(), waiting for the notify thread to
+   * read the inotify fd until it is empty.  flushPipe_ wakes the notify
+   * thread when one is added.
+   */
+  folly::Synchronized<std::vector<folly::Promise<folly::Unit>>> flushes_;
+  Pipe flushPipe_;
+  std::atomic<uint64_t> flushCount_ = 0;
+
   struct maps {
     /* map of active watch descriptor to name of the corresponding dir */
     std::unordered_map<int, w_string> wd_to_name;
     /* map of inotify cookie to corresponding name */
     std::unordered_map<uint32_t, pending_move> move_map;
+    /* with poller_: the read in which each wd last had an event, and the
+     * reads counted so far */
+    std::unordered_map<int, uint64_t> wd_last_event;
+    uint64_t read_seq{0};
+    /* with poller_: wds that were given up, whose events may still be
+     * queued */
+    std::unordered_set<int> released_wds;
   };
 
   folly::Synchronized<maps> maps;
 
+  /**
+   * Set by `inotify_poll_fallback`.  Once inotify_add_watch runs out of
+   * watches, the watches of the least recently changed subtrees are given
+   * up, and those subtrees are polled instead.  So are any dirs that still
+   * can't be watched after that.
+   */
+  std::unique_ptr<DirPoller> poller_;
+  // The dirs whose whole subtrees are polled rather than watched
+  folly::Synchronized<std::unordered_set<w_string>> polledTrees_;
+  // Serializes giving up watches
+  std::mutex releaseMutex_;
+  // Wakes the notify thread when dirs are added to poller_
+  Pipe pollerReady_;
+  std::atomic<uint64_t> releaseCount_ = 0;
+  std::atomic<uint64_t> releasedWatches_ = 0;
+  // Set by `inotify_max_watches`.  0 leaves only the kernel's limit.
+  size_t maxWatches_{0};
+
   // Make the buffer big enough for 16k entries, which
   // happens to be the default fs.inotify.max_queued_events
   char ibuf
@@ -161,17 +267,79 @@ struct InotifyWatcher : public Watcher {
       const std::shared_ptr<Root>& root,
       PendingChanges& coll) override;
 
+  bool start(const std::shared_ptr<Root>& root) override;
+
   bool waitNotify(int timeoutms) override;
 
+  std::vector<int> getNotifyFds() override;
+
+  folly::SemiFuture<folly::Unit> flushPendingEvents() override;
+
   // Process a single inotify event and add it to the pending collection if
   // needed. Returns true if the root directory was removed and the watch needs
   // to be cancelled.
+  //
+  // If batch is not null, dir names are resolved via the batch where
+  // possible and changes are accumulated in the batch rather than coll.
   bool process_inotify_event(
       const std::shared_ptr<Root>& root,
       PendingChanges& coll,
       struct inotify_event* ine,
+      std::chrono::system_clock::time_point now,
+      InotifyBatch* batch = nullptr);
+
+  // Returns true, and counts the event as dropped, if name is ignored.
+  bool dropIgnored(const Root& root, const w_string& name);
+
+  // Whether name is in one of polledTrees_.
+  bool isPolled(const Root& root, const w_string& name);
+
+  // Starts polling the subtree at name instead of watching it.
+  void pollTree(const w_string& name, const FileInformation* st);
+
+  // inotify_add_watch, but fails with ENOSPC once maxWatches_ are held.
+  int addWatch(const char* path);
+
+  // Adds a watch for name, giving up the watches of cold subtrees first if
+  // there is no room for it.  Returns -1 with errno set if it still fails.
+  int addWatchReleasing(const Root& root, const w_string& name);
+
+  // Gives up the watches of the least recently changed subtrees, other
+  // than those containing keep, and polls those subtrees instead.
+  void releaseColdTrees(const Root& root, const w_string& keep);
+
+  // Notes the wds that had events in the n bytes of raw events in buf.
+  void noteEventWds(const char* buf, size_t n);
+
+  // Processes the n bytes of raw events in buf.  Returns true if the watch
+  // needs to be cancelled.
+  bool processEvents(
+      const std::shared_ptr<Root>& root,
+      PendingChanges& coll,
+      char* buf,
+      size_t n,
+      std::chrono::system_clock::time_point now);
+
+  // Processes the chunks queued by the reader thread.
+  bool consumeReaderChunks(
+      const std::shared_ptr<Root>& root,
+      PendingChanges& coll,
       std::chrono::system_clock::time_point now);
 
+  void readerThread(const std::shared_ptr<Root>& root);
+  json_ref getReaderDebugInfo() const;
+  json_ref getPollFallbackDebugInfo() const;
+
+  // Reads as many events as are immediately available into ibuf.
+  // Returns the number of bytes read, or -1 with errno set on error.
+  ssize_t drainEvents();
+
+  // Returns true if reading infd would not block.
+  bool eventsReadable();
+
+  // Takes the promises queued by flushPendingEvents().
+  std::vector<folly::Promise<folly::Unit>> takeFlushes();
+
   void stopThreads() override;
 
   json_ref getDebugInfo() override;
@@ -179,7 +347,20 @@ struct InotifyWatcher : public Watcher {
 };
 
 InotifyWatcher::InotifyWatcher(const Configuration& config)
-    : Watcher("inotify", WATCHER_HAS_PER_FILE_NOTIFICATIONS) {
+    : Watcher("inotify", WATCHER_HAS_PER_FILE_NOTIFICATIONS),
+      batchEvents_(config.getBool("inotify_batch_events", false)) {
+  if (config.getBool("inotify_reader_thread", false)) {
+    auto chunks = config.getInt("inotify_reader_ring_chunks", 64);
+    readerRing_ = std::make_unique<SpscRingBuffer<InotifyChunk>>(
+        uint32_t(std::max<json_int_t>(chunks, 2)));
+  } else {
+    // The kernel queues an event before the syscall that caused it returns,
+    // so once the fd has been read until it is empty, every change made
+    // before then has been seen.  With a reader thread, it owns the fd and
+    // the events may still be sitting in its ring.
+    flags |= WATCHER_CAN_SYNC_BY_FLUSHING;
+  }
+
 #ifdef HAVE_INOTIFY_INIT1
   infd = FileDescriptor(
       inotify_init1(IN_CLOEXEC), FileDescriptor::FDType::Generic);
@@ -196,6 +377,12 @@ InotifyWatcher::InotifyWatcher(const Configuration& config)
     wlock->wd_to_name.reserve(config.getInt(CFG_HINT_NUM_DIRS, HINT_NUM_DIRS));
   }
 
+  if (config.getBool("inotify_poll_fallback", false)) {
+    poller_ = std::make_unique<DirPoller>(config);
+  }
+  maxWatches_ =
+      size_t(std::max<json_int_t>(config.getInt("inotify_max_watches", 0), 0));
+
   json_int_t inotify_ring_log_size = config.getInt("inotify_ring_log_size", 0);
   if (inotify_ring_log_size) {
     ringBuffer_ =
@@ -204,7 +391,7 @@ InotifyWatcher::InotifyWatcher(const Configuration& config)
 }
 
 std::unique_ptr<DirHandle> InotifyWatcher::startWatchDir(
-    const std::shared_ptr<Root>&,
+    const std::shared_ptr<Root>& root,
     const char* path) {
   // Carry out our very strict opendir first to ensure that we're not
   // traversing symlinks in the context of this root
@@ -212,9 +399,25 @@ std::unique_ptr<DirHandle> InotifyWatcher::startWatchDir(
 
   w_string dir_name(path, W_STRING_BYTE);
 
+  if (poller_ && isPolled(*root, dir_name)) {
+    auto st = getFileInformation(path, root->case_sensitive);
+    poller_->add(dir_name, st);
+    ignore_result(write(pollerReady_.write.fd(), "X", 1));
+    return osdir;
+  }
+
   // The directory might be different since the last time we looked at it, so
   // call inotify_add_watch unconditionally.
-  int newwd = inotify_add_watch(infd.fd(), path, WATCHMAN_INOTIFY_MASK);
+  int newwd = addWatch(path);
+  if (newwd == -1 && poller_ && (errno == ENOSPC || errno == ENOMEM)) {
+    newwd = addWatchReleasing(*root, dir_name);
+    if (newwd == -1 && (errno == ENOSPC || errno == ENOMEM)) {
+      log(ERR, "out of inotify watches; polling ", dir_name, " instead\n");
+      auto st = getFileInformation(path, root->case_sensitive);
+      pollTree(dir_name, &st);
+      return osdir;
+    }
+  }
   if (newwd == -1) {
     int err = errno;
     throw std::system_error(err, inotify_category(), "inotify_add_watch");
@@ -234,7 +437,16 @@ bool InotifyWatcher::process_inotify_event(
     const std::shared_ptr<Root>& root,
     PendingChanges& coll,
     struct inotify_event* ine,
-    std::chrono::system_clock::time_point now) {
+    std::chrono::system_clock::time_point now,
+    InotifyBatch* batch) {
+  auto addPending = [&](const w_string& path, PendingFlags flags) {
+    if (batch) {
+      batch->add(path, flags);
+    } else {
+      coll.add(path, now, flags);
+    }
+  };
+
   char flags_label[128];
   w_expand_flags(inflags, ine->mask, flags_label, sizeof(flags_label));
 
@@ -259,7 +471,14 @@ bool InotifyWatcher::process_inotify_event(
     PendingFlags pending_flags = W_PENDING_VIA_NOTIFY;
     std::optional<w_string> dir_name;
 
-    {
+    if (batch) {
+      auto it = batch->wd_to_name.find(ine->wd);
+      if (it != batch->wd_to_name.end()) {
+        dir_name = it->second;
+      }
+    }
+    if (!dir_name) {
+      // Not batched, or the wd was added by an earlier event in this batch
       auto rlock = maps.rlock();
       auto it = rlock->wd_to_name.find(ine->wd);
       if (it != rlock->wd_to_name.end()) {
@@ -297,15 +516,46 @@ bool InotifyWatcher::process_inotify_event(
     }
 
     if (ine->len > 0 &&
-        (ine->mask & (IN_MOVED_TO | IN_ISDIR)) == (IN_MOVED_FROM | IN_ISDIR)) {
+        (ine->mask & (IN_MOVED_TO | IN_ISDIR)) == (IN_MOVED_TO | IN_ISDIR)) {
       auto wlock = maps.wlock();
       auto it = wlock->move_map.find(ine->cookie);
       if (it != wlock->move_map.end()) {
-        auto& old = it->second;
+        auto old = std::move(it->second);
+        wlock->move_map.erase(it);
+
+        // Our watches moved along with the dirs, so rename them to match.
+        // inotify_add_watch on the moved dir below returns its existing wd.
+        auto rename = [&](std::unordered_map<int, w_string>& names) {
+          for (auto& it : names) {
+            auto& dir = it.second;
+            if (dir == old.name) {
+              dir = name;
+            } else if (
+                dir.size() > old.name.size() &&
+                dir.piece().startsWith(old.name) &&
+                dir.data()[old.name.size()] == '/') {
+              dir = w_string::build(name, dir.view().substr(old.name.size()));
+            }
+          }
+        };
+        rename(wlock->wd_to_name);
+        if (batch) {
+          rename(batch->wd_to_name);
+          batch->moves.emplace_back(old.name, name);
+        } else {
+          coll.addMove(old.name, name, now);
+        }
+
         int wd =
             inotify_add_watch(infd.fd(), name.c_str(), WATCHMAN_INOTIFY_MASK);
         if (wd == -1) {
-          if (errno == ENOSPC || errno == ENOMEM) {
+          if ((errno == ENOSPC || errno == ENOMEM) && poller_) {
+            log(ERR,
+                "out of inotify watches; polling ",
+                name,
+                " instead\n");
+            pollTree(name, nullptr);
+          } else if (errno == ENOSPC || errno == ENOMEM) {
             // Limits exceeded, no recovery from our perspective
             set_poison_state(
                 name,
@@ -356,18 +606,24 @@ bool InotifyWatcher::process_inotify_event(
         pending_flags.set(W_PENDING_RECURSIVE);
       }
 
-      logf(
-          DBG,
-          "add_pending for inotify mask={:x} {}\n",
-          ine->mask,
-          name.c_str());
-      coll.add(name, now, pending_flags);
-
-      if (ine->mask & (IN_CREATE | IN_DELETE)) {
-        // When a directory's child is created or unlinked, inotify does not
-        // tell us its parent has also changed. It should be rescanned, so
-        // synthesize an event for the IO thread here.
-        coll.add(name.dirName(), now, W_PENDING_VIA_NOTIFY);
+      // The kernel can't filter a dir's events by the child's name, so
+      // changes to ignored children, such as a build creating and removing
+      // buck-out, still reach us.  Drop them here, as the other watchers
+      // do, rather than queueing them for the IO thread to discard.
+      if (!dropIgnored(*root, name)) {
+        logf(
+            DBG,
+            "add_pending for inotify mask={:x} {}\n",
+            ine->mask,
+            name.c_str());
+        addPending(name, pending_flags);
+
+        if (ine->mask & (IN_CREATE | IN_DELETE)) {
+          // When a directory's child is created or unlinked, inotify does not
+          // tell us its parent has also changed. It should be rescanned, so
+          // synthesize an event for the IO thread here.
+          addPending(name.dirName(), W_PENDING_VIA_NOTIFY);
+        }
       }
 
       // The kernel removed the wd -> name mapping, so let's update
@@ -379,10 +635,19 @@ bool InotifyWatcher::process_inotify_event(
             ine->mask,
             ine->wd,
             dir_name.value());
+        if (batch) {
+          batch->wd_to_name.erase(ine->wd);
+        }
         auto wlock = maps.wlock();
         wlock->wd_to_name.erase(ine->wd);
+        wlock->wd_last_event.erase(ine->wd);
       }
 
+    } else if (poller_ && maps.rlock()->released_wds.count(ine->wd)) {
+      // Queued before we gave up its watch; its first poll rescans it
+      if (ine->mask & IN_IGNORED) {
+        maps.wlock()->released_wds.erase(ine->wd);
+      }
     } else if ((ine->mask & (IN_MOVE_SELF | IN_IGNORED)) == 0) {
       // If we can't resolve the dir, and this isn't notification
       // that it has gone away, then we want to recrawl to fix
@@ -399,37 +664,410 @@ bool InotifyWatcher::process_inotify_event(
   return false;
 }
 
-Watcher::ConsumeNotifyRet InotifyWatcher::consumeNotify(
-    const std::shared_ptr<Root>& root,
-    PendingChanges& coll) {
-  int n = read(infd.fd(), &ibuf, sizeof(ibuf));
-  if (n == -1) {
-    if (errno == EINTR) {
-      return {false};
+bool InotifyWatcher::dropIgnored(const Root& root, const w_string& name) {
+  if (!root.ignore.isIgnored(name.data(), name.size())) {
+    return false;
+  }
+  if (root.ignore.isIgnoreDir(name)) {
+    droppedIgnoredPath_.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    droppedIgnoredParent_.fetch_add(1, std::memory_order_relaxed);
+  }
+  logf(DBG, "dropping inotify event for ignored {}\n", name);
+  return true;
+}
+
+ssize_t InotifyWatcher::drainEvents() {
+  // The caller has already seen the fd become readable, so the first read
+  // won't block.
+  ssize_t n = read(infd.fd(), ibuf, sizeof(ibuf));
+  if (n <= 0) {
+    return n;
+  }
+  batchReads_.fetch_add(1, std::memory_order_relaxed);
+
+  // Keep reading while there's room for at least one maximally sized event
+  // and more events are queued.
+  constexpr size_t kMaxEventSize = sizeof(struct inotify_event) + NAME_MAX + 1;
+  while (sizeof(ibuf) - size_t(n) >= kMaxEventSize) {
+    struct pollfd pfd;
+    pfd.fd = infd.fd();
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & POLLIN)) {
+      break;
+    }
+    auto more = read(infd.fd(), ibuf + n, sizeof(ibuf) - n);
+    if (more <= 0) {
+      // Don't lose the events we already have; any error will be
+      // reported by the next consumeNotify.
+      break;
     }
-    logf(
-        FATAL,
-        "read({}, {}): error {}\n",
-        infd.fd(),
-        sizeof(ibuf),
-        folly::errnoStr(errno));
+    batchReads_.fetch_add(1, std::memory_order_relaxed);
+    n += more;
   }
+  return n;
+}
 
-  logf(DBG, "inotify read: returned {}.\n", n);
-  auto now = std::chrono::system_clock::now();
+bool InotifyWatcher::eventsReadable() {
+  struct pollfd pfd;
+  pfd.fd = infd.fd();
+  pfd.events = POLLIN;
+  return poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN);
+}
+
+std::vector<folly::Promise<folly::Unit>> InotifyWatcher::takeFlushes() {
+  // Discard the wakeups; we're about to take everything they announced
+  char discard[64];
+  while (read(flushPipe_.read.fd(), discard, sizeof(discard)) > 0) {
+  }
+
+  std::vector<folly::Promise<folly::Unit>> flushes;
+  std::swap(flushes, *flushes_.lock());
+  return flushes;
+}
+
+folly::SemiFuture<folly::Unit> InotifyWatcher::flushPendingEvents() {
+  if (readerRing_) {
+    return folly::SemiFuture<folly::Unit>::makeEmpty();
+  }
 
+  auto [p, f] = folly::makePromiseContract<folly::Unit>();
+  flushes_.lock()->push_back(std::move(p));
+  flushCount_.fetch_add(1, std::memory_order_relaxed);
+  // If the pipe is full the notify thread already has a wakeup pending, so
+  // errors are not interesting.
+  ignore_result(write(flushPipe_.write.fd(), "X", 1));
+  return std::move(f);
+}
+
+bool InotifyWatcher::processEvents(
+    const std::shared_ptr<Root>& root,
+    PendingChanges& coll,
+    char* buf,
+    size_t n,
+    std::chrono::system_clock::time_point now) {
   struct inotify_event* ine;
   bool cancel = false;
   size_t eventsSeen = 0;
-  for (char* iptr = ibuf; iptr < ibuf + n; iptr += sizeof(*ine) + ine->len) {
-    ine = (struct inotify_event*)iptr;
+  if (batchEvents_) {
+    InotifyBatch batch;
+    {
+      auto rlock = maps.rlock();
+      for (char* iptr = buf; iptr < buf + n; iptr += sizeof(*ine) + ine->len) {
+        ine = (struct inotify_event*)iptr;
+        if (ine->wd == -1 || batch.wd_to_name.count(ine->wd)) {
+          continue;
+        }
+        auto it = rlock->wd_to_name.find(ine->wd);
+        if (it != rlock->wd_to_name.end()) {
+          batch.wd_to_name.emplace(ine->wd, it->second);
+        }
+      }
+    }
+
+    for (char* iptr = buf; iptr < buf + n; iptr += sizeof(*ine) + ine->len) {
+      ine = (struct inotify_event*)iptr;
+
+      cancel |= process_inotify_event(root, coll, ine, now, &batch);
+      ++eventsSeen;
+    }
+
+    // The renames go first, so that the IO thread applies them before it
+    // looks at what changed below them.
+    for (auto& [from, to] : batch.moves) {
+      coll.addMove(from, to, now);
+    }
+    for (auto& [name, flags] : batch.changes) {
+      coll.add(name, now, flags);
+    }
 
-    cancel |= process_inotify_event(root, coll, ine, now);
-    ++eventsSeen;
+    batches_.fetch_add(1, std::memory_order_relaxed);
+    coalescedEvents_.fetch_add(batch.coalesced, std::memory_order_relaxed);
+    if (eventsSeen > largestBatch_.load(std::memory_order_relaxed)) {
+      // Only the notify thread writes this, so there's no need for a CAS
+      largestBatch_.store(eventsSeen, std::memory_order_relaxed);
+    }
+  } else {
+    for (char* iptr = buf; iptr < buf + n; iptr += sizeof(*ine) + ine->len) {
+      ine = (struct inotify_event*)iptr;
+
+      cancel |= process_inotify_event(root, coll, ine, now);
+      ++eventsSeen;
+    }
+  }
+
+  if (poller_) {
+    noteEventWds(buf, n);
   }
 
   // Relaxed because we don't really care exactly when the value is visible.
   totalEventsSeen_.fetch_add(eventsSeen, std::memory_order_relaxed);
+  return cancel;
+}
+
+void InotifyWatcher::noteEventWds(const char* buf, size_t n) {
+  // Once per read rather than once per event, to keep the lock cold
+  auto wlock = maps.wlock();
+  auto seq = ++wlock->read_seq;
+  const struct inotify_event* ine;
+  for (const char* iptr = buf; iptr < buf + n;
+       iptr += sizeof(*ine) + ine->len) {
+    ine = (const struct inotify_event*)iptr;
+    if (wlock->wd_to_name.count(ine->wd)) {
+      wlock->wd_last_event[ine->wd] = seq;
+    }
+  }
+}
+
+bool InotifyWatcher::isPolled(const Root& root, const w_string& name) {
+  auto polled = polledTrees_.rlock();
+  if (polled->empty()) {
+    return false;
+  }
+  w_string_piece dir = name;
+  while (dir.size() > root.root_path.size()) {
+    if (polled->count(dir.asWString())) {
+      return true;
+    }
+    dir = dir.dirName();
+  }
+  return false;
+}
+
+void InotifyWatcher::pollTree(const w_string& name, const FileInformation* st) {
+  polledTrees_.wlock()->insert(name);
+  if (st) {
+    poller_->add(name, *st);
+  } else {
+    poller_->add(name);
+  }
+  ignore_result(write(pollerReady_.write.fd(), "X", 1));
+}
+
+int InotifyWatcher::addWatch(const char* path) {
+  if (maxWatches_ && maps.rlock()->wd_to_name.size() >= maxWatches_) {
+    errno = ENOSPC;
+    return -1;
+  }
+  return inotify_add_watch(infd.fd(), path, WATCHMAN_INOTIFY_MASK);
+}
+
+int InotifyWatcher::addWatchReleasing(const Root& root, const w_string& name) {
+  std::lock_guard<std::mutex> lock{releaseMutex_};
+  // Another thread may have made room while we waited for the lock
+  int wd = addWatch(name.c_str());
+  if (wd == -1 && (errno == ENOSPC || errno == ENOMEM)) {
+    releaseColdTrees(root, name);
+    wd = addWatch(name.c_str());
+  }
+  return wd;
+}
+
+void InotifyWatcher::releaseColdTrees(const Root& root, const w_string& keep) {
+  // Each watched dir's subtree: the last read in which any of its dirs had
+  // an event, and how many watches it holds
+  struct Tree {
+    uint64_t lastEvent{0};
+    size_t watches{0};
+    bool hasCookieDir{false};
+  };
+
+  std::vector<w_string> names;
+  std::unordered_map<w_string_piece, Tree> trees;
+  {
+    auto rlock = maps.rlock();
+    names.reserve(rlock->wd_to_name.size());
+    trees.reserve(rlock->wd_to_name.size());
+    for (auto& [wd, name] : rlock->wd_to_name) {
+      auto it = rlock->wd_last_event.find(wd);
+      uint64_t lastEvent = it == rlock->wd_last_event.end() ? 0 : it->second;
+      names.push_back(name);
+      bool cookieDir = root.cookies.isCookieDir(name);
+
+      w_string_piece dir = names.back();
+      while (dir.size() >= root.root_path.size()) {
+        auto& tree = trees[dir];
+        tree.lastEvent = std::max(tree.lastEvent, lastEvent);
+        ++tree.watches;
+        tree.hasCookieDir |= cookieDir;
+        if (dir.size() == root.root_path.size()) {
+          break;
+        }
+        dir = dir.dirName();
+      }
+    }
+  }
+
+  auto contains = [](w_string_piece dir, w_string_piece name) {
+    return name == dir ||
+        (name.startsWith(dir) && name.size() > dir.size() &&
+         is_slash(name[dir.size()]));
+  };
+
+  std::vector<std::pair<w_string_piece, const Tree*>> candidates;
+  for (auto& [dir, tree] : trees) {
+    if (dir.size() > root.root_path.size() && !tree.hasCookieDir &&
+        !contains(dir, keep)) {
+      candidates.emplace_back(dir, &tree);
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(), [](auto& a, auto& b) {
+    if (a.second->lastEvent != b.second->lastEvent) {
+      return a.second->lastEvent < b.second->lastEvent;
+    }
+    return a.second->watches > b.second->watches;
+  });
+
+  // Make room for a good number of dirs, so that a growing tree doesn't
+  // come back here for each of them
+  size_t target = std::max<size_t>(64, names.size() / 20);
+  size_t freed = 0;
+  std::unordered_set<w_string_piece> released;
+  auto isReleased = [&](w_string_piece name) {
+    w_string_piece dir = name;
+    while (dir.size() > root.root_path.size()) {
+      if (released.count(dir)) {
+        return true;
+      }
+      dir = dir.dirName();
+    }
+    return false;
+  };
+  // Subtrees no bigger than what is still needed are preferred, so that one
+  // cold giant doesn't go to the poller when a few small ones would do
+  for (bool capped : {true, false}) {
+    for (auto& [dir, tree] : candidates) {
+      if (freed >= target) {
+        break;
+      }
+      if ((capped && tree->watches > target - freed) || isReleased(dir)) {
+        continue;
+      }
+      released.insert(dir);
+      freed += tree->watches;
+    }
+  }
+  if (released.empty()) {
+    return;
+  }
+
+  // Polled before the watches go, so that no dir in them is watched again
+  // in the meantime
+  {
+    auto polled = polledTrees_.wlock();
+    for (auto& dir : released) {
+      polled->insert(dir.asWString());
+    }
+  }
+
+  std::vector<w_string> unwatched;
+  {
+    auto wlock = maps.wlock();
+    for (auto it = wlock->wd_to_name.begin();
+         it != wlock->wd_to_name.end();) {
+      if (isReleased(it->second)) {
+        inotify_rm_watch(infd.fd(), it->first);
+        wlock->wd_last_event.erase(it->first);
+        wlock->released_wds.insert(it->first);
+        unwatched.push_back(it->second);
+        it = wlock->wd_to_name.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  // Not fingerprinted, so that their first polls rescan them for whatever
+  // changed since their watches went
+  for (auto& name : unwatched) {
+    poller_->add(name);
+  }
+  ignore_result(write(pollerReady_.write.fd(), "X", 1));
+
+  releaseCount_.fetch_add(1, std::memory_order_relaxed);
+  releasedWatches_.fetch_add(unwatched.size(), std::memory_order_relaxed);
+  log(ERR,
+      "out of inotify watches; polling ",
+      released.size(),
+      " subtrees holding ",
+      unwatched.size(),
+      " dirs instead\n");
+}
+
+bool InotifyWatcher::consumeReaderChunks(
+    const std::shared_ptr<Root>& root,
+    PendingChanges& coll,
+    std::chrono::system_clock::time_point now) {
+  // Discard the wakeups; we're about to consume everything they announced
+  char discard[64];
+  while (read(readerReady_.read.fd(), discard, sizeof(discard)) > 0) {
+  }
+
+  bool cancel = false;
+  // Bound the work so that a producer that keeps up with us can't keep us
+  // from returning to the notify thread, which flushes to the IO thread.
+  for (uint32_t i = 0; i < readerRing_->capacity(); ++i) {
+    auto chunk = readerRing_->readSlot();
+    if (!chunk) {
+      break;
+    }
+    cancel |= processEvents(root, coll, chunk->buf, chunk->len, now);
+    queuedEvents_.fetch_sub(chunk->events, std::memory_order_relaxed);
+    readerRing_->commitRead();
+  }
+  return cancel;
+}
+
+Watcher::ConsumeNotifyRet InotifyWatcher::consumeNotify(
+    const std::shared_ptr<Root>& root,
+    PendingChanges& coll) {
+  bool cancel = false;
+  auto now = std::chrono::system_clock::now();
+  if (readerRing_) {
+    cancel = consumeReaderChunks(root, coll, now);
+  } else {
+    // Taken before reading, so that the events that were queued before each
+    // flush was asked for are all read below.
+    auto flushes = takeFlushes();
+
+    // Without a flush, we're here because the fd is readable.  With one, or
+    // when the poller is due, it may not be, and the fd blocks.
+    bool readable = (flushes.empty() && !poller_) || eventsReadable();
+    while (readable) {
+      ssize_t n = batchEvents_ ? drainEvents()
+                               : read(infd.fd(), &ibuf, sizeof(ibuf));
+      if (n == -1) {
+        if (errno == EINTR) {
+          // Try the flushes again on the next call
+          auto wlock = flushes_.lock();
+          wlock->insert(
+              wlock->begin(),
+              std::make_move_iterator(flushes.begin()),
+              std::make_move_iterator(flushes.end()));
+          ignore_result(write(flushPipe_.write.fd(), "X", 1));
+          return {cancel};
+        }
+        logf(
+            FATAL,
+            "read({}, {}): error {}\n",
+            infd.fd(),
+            sizeof(ibuf),
+            folly::errnoStr(errno));
+      }
+
+      logf(DBG, "inotify read: returned {}.\n", n);
+      now = std::chrono::system_clock::now();
+      cancel |= processEvents(root, coll, ibuf, n, now);
+
+      // A flush reads until the fd is empty
+      readable = !flushes.empty() && eventsReadable();
+    }
+
+    // The IO thread resolves these once it has processed everything that
+    // was added to coll before them.
+    for (auto& flush : flushes) {
+      coll.addSync(std::move(flush));
+    }
+  }
 
   // It is possible that we can accumulate a set of pending_move
   // structs in move_map.  This happens when a directory is moved
@@ -457,15 +1095,39 @@ Watcher::ConsumeNotifyRet InotifyWatcher::consumeNotify(
     }
   }
 
+  if (poller_) {
+    poller_->poll(*root, coll);
+  }
+
   return {cancel};
 }
 
 bool InotifyWatcher::waitNotify(int timeoutms) {
-  struct pollfd pfd[2];
-  pfd[0].fd = infd.fd();
+  if (readerRing_ && readerRing_->size() > 0) {
+    return true;
+  }
+  if (poller_) {
+    auto untilPoll = poller_->nextPoll() - DirPoller::Clock::now();
+    if (untilPoll <= DirPoller::Clock::duration::zero()) {
+      return true;
+    }
+    auto ms = std::chrono::ceil<std::chrono::milliseconds>(untilPoll);
+    if (ms.count() < timeoutms) {
+      timeoutms = int(ms.count());
+    }
+  }
+
+  struct pollfd pfd[4];
+  // With a reader thread, it owns infd and tells us when it has queued
+  // events for us.
+  pfd[0].fd = readerRing_ ? readerReady_.read.fd() : infd.fd();
   pfd[0].events = POLLIN;
   pfd[1].fd = terminatePipe_.read.fd();
   pfd[1].events = POLLIN;
+  pfd[2].fd = flushPipe_.read.fd();
+  pfd[2].events = POLLIN;
+  pfd[3].fd = pollerReady_.read.fd();
+  pfd[3].events = POLLIN;
 
   int n = poll(pfd, std::size(pfd), timeoutms);
 
@@ -474,9 +1136,114 @@ bool InotifyWatcher::waitNotify(int timeoutms) {
       // We were signalled via signalThreads
       return false;
     }
-    return pfd[0].revents != 0;
+    if (pfd[0].revents != 0 || pfd[2].revents != 0) {
+      return true;
+    }
+    if (pfd[3].revents) {
+      // Dirs were added to the poller; the next wait allows for them
+      char discard[64];
+      while (read(pollerReady_.read.fd(), discard, sizeof(discard)) > 0) {
+      }
+    }
   }
-  return false;
+  return poller_ && poller_->nextPoll() <= DirPoller::Clock::now();
+}
+
+std::vector<int> InotifyWatcher::getNotifyFds() {
+  // The reader thread and the poller need waitNotify's timeouts
+  if (readerRing_ || poller_) {
+    return {};
+  }
+  return {infd.fd(), flushPipe_.read.fd()};
+}
+
+bool InotifyWatcher::start(const std::shared_ptr<Root>& root) {
+  if (!readerRing_) {
+    return true;
+  }
+
+  auto self = std::dynamic_pointer_cast<InotifyWatcher>(shared_from_this());
+  std::thread thread([self, root]() noexcept {
+    try {
+      self->readerThread(root);
+    } catch (const std::exception& e) {
+      logf(ERR, "uncaught exception in inotify reader: {}\n", e.what());
+      root->cancel();
+    }
+  });
+  // The thread holds a reference to the watcher and winds down when
+  // stopThreads() is called, so there's nothing to join.
+  thread.detach();
+  return true;
+}
+
+void InotifyWatcher::readerThread(const std::shared_ptr<Root>& root) {
+  w_set_thread_name("inotifyrd ", root->root_path.view());
+
+  while (true) {
+    struct pollfd pfd[2];
+    pfd[0].fd = infd.fd();
+    pfd[0].events = POLLIN;
+    pfd[1].fd = terminatePipe_.read.fd();
+    pfd[1].events = POLLIN;
+
+    if (poll(pfd, std::size(pfd), -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      logf(FATAL, "inotify reader poll: error {}\n", folly::errnoStr(errno));
+    }
+    if (pfd[1].revents) {
+      // We were signalled via stopThreads
+      break;
+    }
+    if (!pfd[0].revents) {
+      continue;
+    }
+
+    auto chunk = readerRing_->writeSlot();
+    if (!chunk) {
+      // The notify thread has fallen behind; leave the events in the kernel
+      // queue until it catches up.  The ring counts these stalls.
+      /* sleep override */ std::this_thread::sleep_for(
+          std::chrono::milliseconds(1));
+      continue;
+    }
+
+    auto n = read(infd.fd(), chunk->buf, sizeof(chunk->buf));
+    if (n == -1) {
+      if (errno == EINTR || errno == EAGAIN) {
+        continue;
+      }
+      logf(
+          FATAL,
+          "read({}, {}): error {}\n",
+          infd.fd(),
+          sizeof(chunk->buf),
+          folly::errnoStr(errno));
+    }
+
+    chunk->len = size_t(n);
+    chunk->events = 0;
+    struct inotify_event* ine;
+    for (char* iptr = chunk->buf; iptr < chunk->buf + n;
+         iptr += sizeof(*ine) + ine->len) {
+      ine = (struct inotify_event*)iptr;
+      ++chunk->events;
+    }
+    auto queued = chunk->events +
+        queuedEvents_.fetch_add(chunk->events, std::memory_order_relaxed);
+    if (queued > queuedEventsHighWater_.load(std::memory_order_relaxed)) {
+      queuedEventsHighWater_.store(queued, std::memory_order_relaxed);
+    }
+
+    readerRing_->commitWrite();
+    // Wake the notify thread.  If the pipe is full it already has a wakeup
+    // pending, so errors are not interesting.
+    ignore_result(write(readerReady_.write.fd(), "X", 1));
+  }
+
+  logf(DBG, "inotify reader done\n");
 }
 
 void InotifyWatcher::stopThreads() {
@@ -495,6 +1262,46 @@ json_ref InotifyWatcher::getDebugInfo() {
   return json_object({
       {"events", events},
       {"total_event_count", json_integer(totalEventsSeen_.load())},
+      {"batch_events", json_boolean(batchEvents_)},
+      {"batch_count", json_integer(batches_.load())},
+      {"batch_read_count", json_integer(batchReads_.load())},
+      {"coalesced_event_count", json_integer(coalescedEvents_.load())},
+      {"largest_batch", json_integer(largestBatch_.load())},
+      {"dropped_ignored_path_count",
+       json_integer(droppedIgnoredPath_.load())},
+      {"dropped_ignored_parent_count",
+       json_integer(droppedIgnoredParent_.load())},
+      {"flush_count", json_integer(flushCount_.load())},
+      {"reader", getReaderDebugInfo()},
+      {"poll_fallback", getPollFallbackDebugInfo()},
+  });
+}
+
+json_ref InotifyWatcher::getPollFallbackDebugInfo() const {
+  if (!poller_) {
+    return json_null();
+  }
+  return json_object({
+      {"release_count", json_integer(releaseCount_.load())},
+      {"released_watch_count", json_integer(releasedWatches_.load())},
+      {"polled_tree_count", json_integer(polledTrees_.rlock()->size())},
+      {"poller", poller_->getDebugInfo()},
+  });
+}
+
+json_ref InotifyWatcher::getReaderDebugInfo() const {
+  if (!readerRing_) {
+    return json_null();
+  }
+  return json_object({
+      {"chunk_bytes", json_integer(sizeof(InotifyChunk::buf))},
+      {"ring_capacity", json_integer(readerRing_->capacity())},
+      {"ring_size", json_integer(readerRing_->size())},
+      {"ring_high_water", json_integer(readerRing_->highWaterMark())},
+      {"ring_full_count", json_integer(readerRing_->fullCount())},
+      {"queued_events", json_integer(queuedEvents_.load())},
+      {"queued_events_high_water",
+       json_integer(queuedEventsHighWater_.load())},
   });
 }
 
@@ -503,9 +1310,27 @@ void InotifyWatcher::clearDebugInfo() {
   // totalEventsSeen_ could be stored directly if ringBuffer_ is null, or as the
   // difference between currentHead() - lastClear_ if not null.
   totalEventsSeen_.store(0, std::memory_order_release);
+  batches_.store(0, std::memory_order_release);
+  batchReads_.store(0, std::memory_order_release);
+  coalescedEvents_.store(0, std::memory_order_release);
+  largestBatch_.store(0, std::memory_order_release);
+  droppedIgnoredPath_.store(0, std::memory_order_release);
+  droppedIgnoredParent_.store(0, std::memory_order_release);
+  flushCount_.store(0, std::memory_order_release);
+  if (readerRing_) {
+    readerRing_->resetStats();
+    queuedEventsHighWater_.store(
+        queuedEvents_.load(std::memory_order_relaxed),
+        std::memory_order_release);
+  }
   if (ringBuffer_) {
     ringBuffer_->clear();
   }
+  if (poller_) {
+    releaseCount_.store(0, std::memory_order_release);
+    releasedWatches_.store(0, std::memory_order_release);
+    poller_->clearDebugInfo();
+  }
 }
 
 namespace {
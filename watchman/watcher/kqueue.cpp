@@ -6,9 +6,11 @@
  */
 
 #include "kqueue.h"
+#include <fmt/core.h>
 #include <folly/String.h>
 #include <folly/Synchronized.h>
 #include <array>
+#include <vector>
 #include "watchman/FlagMap.h"
 #include "watchman/InMemoryView.h"
 #include "watchman/fs/FileDescriptor.h"
@@ -44,6 +46,32 @@ void* make_udata(bool is_dir) {
   }
 }
 
+// The number of watch descriptors held by all KQueueWatchers
+std::atomic<size_t> totalWatches{0};
+
+bool isOutOfDescriptors(int err) {
+  return err == EMFILE || err == ENFILE;
+}
+
+// Without configuration, leave a quarter of the descriptor limit for
+// clients, state files and everything else.  Returns 0 for no limit.
+size_t defaultWatchBudget() {
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) != 0 ||
+      limit.rlim_cur == RLIM_INFINITY) {
+    return 0;
+  }
+  return static_cast<size_t>(limit.rlim_cur) / 4 * 3;
+}
+
+size_t configuredWatchBudget(const Configuration& config) {
+  auto budget = config.getInt("kqueue_watch_budget", 0);
+  if (budget > 0) {
+    return static_cast<size_t>(budget);
+  }
+  return defaultWatchBudget();
+}
+
 } // namespace
 
 static const struct flag_map kflags[] = {
@@ -63,14 +91,101 @@ KQueueWatcher::KQueueWatcher(
     bool recursive)
     : Watcher("kqueue", 0),
       maps_(maps(config.getInt(CFG_HINT_NUM_DIRS, HINT_NUM_DIRS))),
-      recursive_(recursive) {
+      recursive_(recursive),
+      watchBudget_(configuredWatchBudget(config)) {
   kq_fd = FileDescriptor(kqueue(), "kqueue", FileDescriptor::FDType::Generic);
   kq_fd.setCloExec();
 }
 
+bool KQueueWatcher::addWatch(
+    maps& m,
+    const w_string& name,
+    FileDescriptor& fd,
+    bool isFile) {
+  if (watchBudget_ && totalWatches.load() >= watchBudget_) {
+    return false;
+  }
+  // Replacing a watch must not leave the old descriptor's mapping behind
+  removeWatch(m, name);
+
+  m.fd_to_name[fd.fd()] = name;
+  m.name_to_fd[name] = std::move(fd);
+  if (isFile) {
+    m.files.insert(name);
+  }
+  ++totalWatches;
+  return true;
+}
+
+void KQueueWatcher::removeWatch(maps& m, const w_string& name) {
+  auto it = m.name_to_fd.find(name);
+  if (it == m.name_to_fd.end()) {
+    return;
+  }
+  // Closing the descriptor also removes its kevent registration
+  m.fd_to_name.erase(it->second.fd());
+  m.files.erase(name);
+  m.name_to_fd.erase(it);
+  --totalWatches;
+}
+
+void KQueueWatcher::switchToDirsOnly(maps& m) {
+  if (dirsOnly_.exchange(true)) {
+    return;
+  }
+  logf(
+      ERR,
+      "kqueue: {} watches are in use, reaching the budget of {}; releasing "
+      "{} file watches and watching only directories from now on.  "
+      "Consider raising kern.maxfilesperproc or kqueue_watch_budget\n",
+      totalWatches.load(),
+      watchBudget_,
+      m.files.size());
+  auto files = std::move(m.files);
+  m.files.clear();
+  for (auto& name : files) {
+    removeWatch(m, name);
+  }
+}
+
+void KQueueWatcher::unwatchTree(const w_string& path) {
+  auto wlock = maps_.wlock();
+  std::vector<w_string> names;
+  for (auto& [name, fd] : wlock->name_to_fd) {
+    w_string_piece piece{name};
+    if (piece == path ||
+        (piece.startsWith(path) && is_slash(piece[path.size()]))) {
+      names.push_back(name);
+    }
+  }
+  for (auto& name : names) {
+    removeWatch(*wlock, name);
+  }
+}
+
+size_t KQueueWatcher::watchCount() {
+  return totalWatches.load();
+}
+
+json_ref KQueueWatcher::getDebugInfo() {
+  auto rlock = maps_.rlock();
+  return json_object({
+      {"watch_count", json_integer(rlock->name_to_fd.size())},
+      {"file_watch_count", json_integer(rlock->files.size())},
+      {"total_watch_count", json_integer(totalWatches.load())},
+      {"watch_budget", json_integer(watchBudget_)},
+      {"dirs_only", json_boolean(dirsOnly_.load())},
+  });
+}
+
 bool KQueueWatcher::startWatchFile(struct watchman_file* file) {
   struct kevent k;
 
+  if (recursive_ && dirsOnly_.load()) {
+    // Its directory is rescanned when it changes
+    return true;
+  }
+
   auto full_name = file->parent->getFullPathToChild(file->getName());
   {
     auto rlock = maps_.rlock();
@@ -92,6 +207,10 @@ bool KQueueWatcher::startWatchFile(struct watchman_file* file) {
   auto rawFd = fdHolder.fd();
 
   if (rawFd == -1) {
+    if (isOutOfDescriptors(errno)) {
+      switchToDirsOnly(*maps_.wlock());
+      return true;
+    }
     watchman::log(
         watchman::ERR,
         "failed to open ",
@@ -118,6 +237,9 @@ bool KQueueWatcher::startWatchFile(struct watchman_file* file) {
       return false;
     }
     isDir = S_ISDIR(st.st_mode);
+    if (!isDir && dirsOnly_.load()) {
+      return true;
+    }
   }
 
   memset(&k, 0, sizeof(k));
@@ -132,8 +254,12 @@ bool KQueueWatcher::startWatchFile(struct watchman_file* file) {
 
   {
     auto wlock = maps_.wlock();
-    wlock->name_to_fd[full_name] = std::move(fdHolder);
-    wlock->fd_to_name[rawFd] = full_name;
+    if (!addWatch(*wlock, full_name, fdHolder, !isDir)) {
+      switchToDirsOnly(*wlock);
+      if (!isDir || !addWatch(*wlock, full_name, fdHolder, false)) {
+        return true;
+      }
+    }
   }
 
   if (kevent(kq_fd.fd(), &k, 1, nullptr, 0, 0)) {
@@ -145,9 +271,7 @@ bool KQueueWatcher::startWatchFile(struct watchman_file* file) {
         full_name.c_str(),
         folly::errnoStr(errno),
         "\n");
-    auto wlock = maps_.wlock();
-    wlock->name_to_fd.erase(full_name);
-    wlock->fd_to_name.erase(rawFd);
+    removeWatch(*maps_.wlock(), full_name);
   } else {
     watchman::log(
         watchman::DBG, "kevent file ", full_name, " -> ", rawFd, "\n");
@@ -167,6 +291,13 @@ std::unique_ptr<DirHandle> KQueueWatcher::startWatchDir(
   FileDescriptor fdHolder(
       open(path, O_NOFOLLOW | O_EVTONLY | O_CLOEXEC),
       FileDescriptor::FDType::Generic);
+  if (fdHolder.fd() == -1 && isOutOfDescriptors(errno) && !dirsOnly_.load()) {
+    // Make room by giving up the file watches
+    switchToDirsOnly(*maps_.wlock());
+    fdHolder = FileDescriptor(
+        open(path, O_NOFOLLOW | O_EVTONLY | O_CLOEXEC),
+        FileDescriptor::FDType::Generic);
+  }
   auto rawFd = fdHolder.fd();
   if (rawFd == -1) {
     // directory got deleted between opendir and open
@@ -206,16 +337,24 @@ std::unique_ptr<DirHandle> KQueueWatcher::startWatchDir(
   // otherwise we can get a wakeup and not know what it is
   {
     auto wlock = maps_.wlock();
-    wlock->name_to_fd[dir_name] = std::move(fdHolder);
-    wlock->fd_to_name[rawFd] = dir_name;
+    if (!addWatch(*wlock, dir_name, fdHolder, false)) {
+      switchToDirsOnly(*wlock);
+      if (!addWatch(*wlock, dir_name, fdHolder, false)) {
+        throw std::system_error(
+            EMFILE,
+            std::generic_category(),
+            fmt::format(
+                "kqueue watch budget of {} is spent, can't watch {}",
+                watchBudget_,
+                path));
+      }
+    }
   }
 
   if (kevent(kq_fd.fd(), &k, 1, nullptr, 0, 0)) {
     logf(DBG, "kevent EV_ADD dir {} failed: {}", path, folly::errnoStr(errno));
 
-    auto wlock = maps_.wlock();
-    wlock->name_to_fd.erase(dir_name);
-    wlock->fd_to_name.erase(rawFd);
+    removeWatch(*maps_.wlock(), dir_name);
   } else {
     watchman::log(watchman::DBG, "kevent dir ", dir_name, " -> ", rawFd, "\n");
   }
@@ -247,6 +386,8 @@ Watcher::ConsumeNotifyRet KQueueWatcher::consumeNotify(
   }
 
   auto now = std::chrono::system_clock::now();
+  bool dirsOnly = dirsOnly_.load();
+  std::vector<w_string> changed;
   for (int i = 0; n > 0 && i < n; i++) {
     uint32_t fflags = keventbuf[i].fflags;
     bool is_dir = is_udata_dir(keventbuf[i].udata);
@@ -286,15 +427,26 @@ Watcher::ConsumeNotifyRet KQueueWatcher::consumeNotify(
       memset(&k, 0, sizeof(k));
       EV_SET(&k, fd, EVFILT_VNODE, EV_DELETE, 0, 0, nullptr);
       kevent(kq_fd.fd(), &k, 1, nullptr, 0, 0);
-      wlock->name_to_fd.erase(path);
-      wlock->fd_to_name.erase(fd);
+      removeWatch(*wlock, path);
     }
 
     // TODO: W_PENDING_VIA_NOTIFY should always be set
-    coll.add(
-        path,
-        now,
-        is_dir ? PendingFlags{} : (W_PENDING_RECURSIVE | W_PENDING_VIA_NOTIFY));
+    PendingFlags pendingFlags{};
+    if (!is_dir) {
+      pendingFlags = W_PENDING_RECURSIVE | W_PENDING_VIA_NOTIFY;
+    } else if (dirsOnly) {
+      // The files in it aren't watched, so look at each of them
+      pendingFlags = W_PENDING_NONRECURSIVE_SCAN;
+    }
+    coll.add(path, now, pendingFlags);
+    if (onChange_) {
+      changed.push_back(std::move(path));
+    }
+  }
+
+  // Outside of the maps lock, as the hook may start or stop watches
+  for (auto& path : changed) {
+    onChange_(path);
   }
 
   return {false};
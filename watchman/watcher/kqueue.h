@@ -5,6 +5,9 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <atomic>
+#include <functional>
+#include <unordered_set>
 #include "watchman/Constants.h"
 #include "watchman/fs/FileDescriptor.h"
 #include "watchman/fs/Pipe.h"
@@ -16,6 +19,14 @@ namespace watchman {
 
 class Configuration;
 
+/**
+ * kqueue needs an open descriptor for every file and directory that it
+ * watches, and descriptors are a per-process resource shared by every root.
+ * All KQueueWatchers draw on a common budget; once it is spent a watcher
+ * releases its file watches and watches only directories, rescanning a
+ * directory's entries whenever it changes.  Modifications of existing files
+ * are then only noticed when something also changes their directory.
+ */
 struct KQueueWatcher : public Watcher {
   FileDescriptor kq_fd;
   Pipe terminatePipe_;
@@ -24,6 +35,8 @@ struct KQueueWatcher : public Watcher {
     std::unordered_map<w_string, FileDescriptor> name_to_fd;
     /* map of active watch descriptor to name of the corresponding item */
     std::unordered_map<int, w_string> fd_to_name;
+    /* the names in name_to_fd that are watched as files */
+    std::unordered_set<w_string> files;
 
     explicit maps(json_int_t sizeHint) {
       name_to_fd.reserve(sizeHint);
@@ -33,6 +46,13 @@ struct KQueueWatcher : public Watcher {
   folly::Synchronized<maps> maps_;
   bool recursive_;
 
+  // The number of descriptors that all KQueueWatchers may hold
+  const size_t watchBudget_;
+  // Set once the budget ran out; only directories are watched after that
+  std::atomic<bool> dirsOnly_{false};
+  // Called with the path of each change that consumeNotify reports
+  std::function<void(const w_string& path)> onChange_;
+
   struct kevent keventbuf[WATCHMAN_BATCH_LIMIT];
 
   explicit KQueueWatcher(
@@ -52,6 +72,22 @@ struct KQueueWatcher : public Watcher {
 
   bool waitNotify(int timeoutms) override;
   void stopThreads() override;
+
+  json_ref getDebugInfo() override;
+
+  // Stops watching path and everything below it.
+  void unwatchTree(const w_string& path);
+
+  // Returns the number of descriptors all KQueueWatchers are holding.
+  static size_t watchCount();
+
+ private:
+  // Adds a watch to the maps, taking ownership of fd, and accounts for it
+  // in the budget.  Returns false, leaving fd alone, if the budget is spent.
+  bool addWatch(maps& m, const w_string& name, FileDescriptor& fd, bool isFile);
+  void removeWatch(maps& m, const w_string& name);
+  // Releases every file watch; called once the budget is spent.
+  void switchToDirsOnly(maps& m);
 };
 
 } // namespace watchman
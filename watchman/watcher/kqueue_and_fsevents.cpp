@@ -8,6 +8,7 @@
 #include <folly/Synchronized.h>
 #include <condition_variable>
 #include <mutex>
+#include <string_view>
 #include "watchman/Client.h"
 #include "watchman/InMemoryView.h"
 #include "watchman/root/Root.h"
@@ -81,6 +82,11 @@ class PendingEventsCond {
  *
  * The kqueue watches are used on the root directory and all the files at the
  * root, while the fsevents one is used on the subdirectories.
+ *
+ * With a kqueue_and_fsevents_churn_threshold, the subdirectories start out
+ * on a recursive kqueue watcher instead, which is cheap for trees that
+ * rarely change, and a subdirectory moves to its own fsevents stream once it
+ * sees that many changes in a minute, or once kqueue runs out of watches.
  */
 class KQueueAndFSEventsWatcher : public Watcher {
  public:
@@ -120,14 +126,32 @@ class KQueueAndFSEventsWatcher : public Watcher {
   std::shared_ptr<PendingEventsCond> pendingCondition_;
 
   folly::Synchronized<std::optional<w_string>> injectedRecrawl_;
-};
 
-KQueueAndFSEventsWatcher::KQueueAndFSEventsWatcher(
-    const w_string& root_path,
-    const Configuration& config)
-    : Watcher("kqueue+fsevents", WATCHER_HAS_SPLIT_WATCH),
-      kqueueWatcher_(std::make_shared<KQueueWatcher>(root_path, config, false)),
-      pendingCondition_(std::make_shared<PendingEventsCond>()) {}
+  const w_string rootPath_;
+  // Events per minute that move a top-level directory to fsevents; 0 puts
+  // every top-level directory on fsevents from the start
+  const json_int_t churnThreshold_;
+  // Watches the top-level directories that aren't on fsevents
+  std::shared_ptr<KQueueWatcher> subtreeKqueue_;
+
+  struct Churn {
+    json_int_t events{0};
+    std::chrono::steady_clock::time_point windowStart;
+  };
+  // Recent events per top-level directory watched by subtreeKqueue_.  Only
+  // touched by the notify thread.
+  std::unordered_map<w_string, Churn> churn_;
+
+  // Returns the top-level directory that path is in or is.
+  std::optional<w_string> topLevelDir(const w_string& path) const;
+  void recordChange(const w_string& path);
+  bool isOnFSEvents(const w_string& dir) const;
+  // Starts a FSEventsWatcher for the top-level directory dir, if it doesn't
+  // have one already, and releases its kqueue watches.
+  void watchWithFSEvents(
+      const std::shared_ptr<Root>& root,
+      const w_string& dir);
+};
 
 namespace {
 bool startThread(
@@ -155,8 +179,96 @@ bool startThread(
 }
 } // namespace
 
+KQueueAndFSEventsWatcher::KQueueAndFSEventsWatcher(
+    const w_string& root_path,
+    const Configuration& config)
+    : Watcher("kqueue+fsevents", WATCHER_HAS_SPLIT_WATCH),
+      kqueueWatcher_(std::make_shared<KQueueWatcher>(root_path, config, false)),
+      pendingCondition_(std::make_shared<PendingEventsCond>()),
+      rootPath_(root_path),
+      churnThreshold_(config.getInt("kqueue_and_fsevents_churn_threshold", 0)) {
+  if (churnThreshold_ > 0) {
+    subtreeKqueue_ = std::make_shared<KQueueWatcher>(root_path, config, true);
+    // consumeNotify runs on the notify thread, so this does too
+    subtreeKqueue_->onChange_ = [this](const w_string& path) {
+      recordChange(path);
+    };
+  }
+}
+
+std::optional<w_string> KQueueAndFSEventsWatcher::topLevelDir(
+    const w_string& path) const {
+  std::string_view view = path.view();
+  std::string_view root = rootPath_.view();
+  if (view.size() <= root.size() + 1 || view.substr(0, root.size()) != root ||
+      !is_slash(view[root.size()])) {
+    return std::nullopt;
+  }
+  auto end = view.find('/', root.size() + 1);
+  if (end == std::string_view::npos) {
+    return path;
+  }
+  return w_string{view.substr(0, end)};
+}
+
+void KQueueAndFSEventsWatcher::recordChange(const w_string& path) {
+  auto dir = topLevelDir(path);
+  if (!dir) {
+    return;
+  }
+  auto now = std::chrono::steady_clock::now();
+  auto& churn = churn_[*dir];
+  if (now - churn.windowStart > std::chrono::minutes(1)) {
+    churn.events = 0;
+    churn.windowStart = now;
+  }
+  ++churn.events;
+}
+
+bool KQueueAndFSEventsWatcher::isOnFSEvents(const w_string& dir) const {
+  auto rlock = fseventWatchers_.rlock();
+  return rlock->find(dir) != rlock->end();
+}
+
+void KQueueAndFSEventsWatcher::watchWithFSEvents(
+    const std::shared_ptr<Root>& root,
+    const w_string& dir) {
+  {
+    auto wlock = fseventWatchers_.wlock();
+    if (wlock->find(dir) != wlock->end()) {
+      return;
+    }
+    logf(
+        DBG,
+        "Creating a new FSEventsWatcher for top-level directory {}\n",
+        dir);
+    root->cookies.addCookieDir(dir);
+    auto [it, _] = wlock->emplace(
+        dir,
+        std::make_shared<FSEventsWatcher>(
+            false, root->config, std::optional(dir)));
+    const auto& watcher = it->second;
+    if (!watcher->start(root)) {
+      throw std::runtime_error("couldn't start fsEvent");
+    }
+    if (!startThread(root, watcher, pendingCondition_)) {
+      throw std::runtime_error("couldn't start fsEvent");
+    }
+  }
+
+  // The fsevents stream is running, so nothing is missed by dropping the
+  // kqueue watches now; a change seen by both is merely reported twice.
+  if (subtreeKqueue_) {
+    subtreeKqueue_->unwatchTree(dir);
+  }
+}
+
+
 bool KQueueAndFSEventsWatcher::start(const std::shared_ptr<Root>& root) {
   root->cookies.addCookieDir(root->root_path);
+  if (subtreeKqueue_ && !startThread(root, subtreeKqueue_, pendingCondition_)) {
+    return false;
+  }
   return startThread(root, kqueueWatcher_, pendingCondition_);
 }
 
@@ -190,29 +302,30 @@ std::unique_ptr<DirHandle> KQueueAndFSEventsWatcher::startWatchDir(
     logf(DBG, "Watching root directory with kqueue\n");
     // This is the root, let's watch it with kqueue.
     kqueueWatcher_->startWatchDir(root, path);
-  } else {
+  } else if (subtreeKqueue_) {
     w_string fullPath{path};
-    if (root->root_path == fullPath.dirName()) {
-      auto wlock = fseventWatchers_.wlock();
-      if (wlock->find(fullPath) == wlock->end()) {
+    auto dir = topLevelDir(fullPath);
+    if (dir && !isOnFSEvents(*dir)) {
+      try {
+        return subtreeKqueue_->startWatchDir(root, path);
+      } catch (const std::system_error& err) {
+        if (err.code() != std::error_code(EMFILE, std::generic_category())) {
+          throw;
+        }
         logf(
-            DBG,
-            "Creating a new FSEventsWatcher for top-level directory {}\n",
-            fullPath);
-        root->cookies.addCookieDir(fullPath);
-        auto [it, _] = wlock->emplace(
+            ERR,
+            "kqueue can't watch {}: {}; moving {} to fsevents\n",
             fullPath,
-            std::make_shared<FSEventsWatcher>(
-                false, root->config, std::optional(fullPath)));
-        const auto& watcher = it->second;
-        if (!watcher->start(root)) {
-          throw std::runtime_error("couldn't start fsEvent");
-        }
-        if (!startThread(root, watcher, pendingCondition_)) {
-          throw std::runtime_error("couldn't start fsEvent");
-        }
+            err.what(),
+            *dir);
+        watchWithFSEvents(root, *dir);
       }
     }
+  } else {
+    w_string fullPath{path};
+    if (root->root_path == fullPath.dirName()) {
+      watchWithFSEvents(root, fullPath);
+    }
   }
 
   return openDir(path);
@@ -224,6 +337,13 @@ bool KQueueAndFSEventsWatcher::startWatchFile(struct watchman_file* file) {
     return kqueueWatcher_->startWatchFile(file);
   }
 
+  if (subtreeKqueue_) {
+    auto dir = topLevelDir(file->parent->getFullPath());
+    if (dir && !isOnFSEvents(*dir)) {
+      return subtreeKqueue_->startWatchFile(file);
+    }
+  }
+
   // FSEvent by default watches all the files recursively, we don't need to do
   // anything.
   return true;
@@ -264,6 +384,28 @@ Watcher::ConsumeNotifyRet KQueueAndFSEventsWatcher::consumeNotify(
     }
   }
 
+  if (subtreeKqueue_) {
+    subtreeKqueue_->consumeNotify(root, coll);
+
+    std::vector<w_string> churning;
+    for (auto it = churn_.begin(); it != churn_.end();) {
+      if (it->second.events >= churnThreshold_) {
+        churning.push_back(it->first);
+        it = churn_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    for (auto& dir : churning) {
+      logf(
+          DBG,
+          "{} saw {} changes within a minute, moving it to fsevents\n",
+          dir,
+          churnThreshold_);
+      watchWithFSEvents(root, dir);
+    }
+  }
+
   return kqueueWatcher_->consumeNotify(root, coll);
 }
 
@@ -279,6 +421,9 @@ void KQueueAndFSEventsWatcher::stopThreads() {
       fsevent->stopThreads();
     }
   }
+  if (subtreeKqueue_) {
+    subtreeKqueue_->stopThreads();
+  }
   kqueueWatcher_->stopThreads();
 }
 
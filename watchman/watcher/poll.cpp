@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <string_view>
+#include "watchman/InMemoryView.h"
+#include "watchman/fs/FileSystem.h"
+#include "watchman/root/Root.h"
+#include "watchman/watcher/DirPoller.h"
+#include "watchman/watcher/Watcher.h"
+#include "watchman/watcher/WatcherRegistry.h"
+
+namespace watchman {
+
+namespace {
+
+/**
+ * Watches a root by polling its dirs, for filesystems whose changes the
+ * kernel can't report, such as NFS and CIFS mounts that other hosts
+ * modify.  Each dir is added to the poller as it is crawled.
+ */
+class PollWatcher : public Watcher {
+ public:
+  explicit PollWatcher(const Configuration& config)
+      : Watcher("poll", 0), poller_(config) {}
+
+  std::unique_ptr<DirHandle> startWatchDir(
+      const std::shared_ptr<Root>& root,
+      const char* path) override {
+    // Fingerprinted before it is read, so that a change made while it is
+    // being read shows up in the next poll
+    auto st = getFileInformation(path, root->case_sensitive);
+    auto osdir = openDir(path);
+    poller_.add(w_string{path, W_STRING_BYTE}, st);
+    return osdir;
+  }
+
+  Watcher::ConsumeNotifyRet consumeNotify(
+      const std::shared_ptr<Root>& root,
+      PendingChanges& coll) override {
+    poller_.poll(*root, coll);
+    return {false};
+  }
+
+  bool waitNotify(int timeoutms) override {
+    return poller_.wait(
+        DirPoller::Clock::now() + std::chrono::milliseconds(timeoutms));
+  }
+
+  void stopThreads() override {
+    poller_.stop();
+  }
+
+  json_ref getDebugInfo() override {
+    return poller_.getDebugInfo();
+  }
+
+  void clearDebugInfo() override {
+    poller_.clearDebugInfo();
+  }
+
+ private:
+  DirPoller poller_;
+};
+
+std::shared_ptr<QueryableView> detectPoll(
+    const w_string& root_path,
+    const w_string& /*fstype*/,
+    const Configuration& config) {
+  // Only when asked for by name: a kernel watcher always does better where
+  // there is one
+  if (std::string_view{config.getString("watcher", "auto")} != "poll") {
+    throw std::runtime_error("only used when configured as the watcher");
+  }
+  return std::make_shared<InMemoryView>(
+      realFileSystem,
+      root_path,
+      config,
+      std::make_shared<PollWatcher>(config));
+}
+
+} // namespace
+
+static WatcherRegistry reg("poll", detectPoll, -100);
+
+} // namespace watchman
+
+/* vim:ts=2:sw=2:et:
+ */
@@ -5,20 +5,27 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <folly/Conv.h>
+#include <folly/ScopeGuard.h>
+#include <folly/String.h>
 #include <folly/Synchronized.h>
 #include "watchman/InMemoryView.h"
 #include "watchman/fs/FileDescriptor.h"
+#include "watchman/fs/UsnJournal.h"
+#include "watchman/fs/WindowsTime.h"
 #include "watchman/portability/WinError.h"
 #include "watchman/root/Root.h"
 #include "watchman/watcher/Watcher.h"
 #include "watchman/watcher/WatcherRegistry.h"
 
 #include <algorithm>
+#include <atomic>
 #include <condition_variable>
 #include <iterator>
 #include <list>
 #include <mutex>
 #include <tuple>
+#include <unordered_map>
 
 using namespace watchman;
 
@@ -28,9 +35,15 @@ namespace {
 
 constexpr DWORD kNetworkBufSize = 64 * 1024;
 
+// Reported stats that the IO thread hasn't taken, because the path was
+// pruned or ignored, are forgotten once there are this many.
+constexpr size_t kMaxReportedStats = 64 * 1024;
+
 struct Item {
   w_string path;
   PendingFlags flags;
+  // For the new name of a renamed dir, its old name
+  w_string movedFrom;
 
   Item(w_string&& path, PendingFlags flags)
       : path(std::move(path)), flags(flags) {}
@@ -38,14 +51,52 @@ struct Item {
 
 } // namespace
 
+// One of the buffers that ReadDirectoryChanges fills.  Several reads are
+// kept outstanding so that the OS always has somewhere to put changes while
+// a completed buffer is being decoded; they complete in the order they were
+// issued.
+struct ChangesRead {
+  std::vector<uint8_t> buf;
+  OVERLAPPED olap;
+  // Whether the read was issued with ReadDirectoryChangesExW and so returns
+  // FILE_NOTIFY_EXTENDED_INFORMATION records
+  bool extended{false};
+  bool outstanding{false};
+};
+
 struct WinWatcher : public Watcher {
   HANDLE ping{INVALID_HANDLE_VALUE};
-  HANDLE olapEvent{INVALID_HANDLE_VALUE};
+  std::vector<HANDLE> olapEvents;
   FileDescriptor dir_handle;
 
   std::condition_variable cond;
   folly::Synchronized<std::list<Item>, std::mutex> changedItems;
 
+  // The file information that came with the most recent notification for
+  // each path, from ReadDirectoryChangesExW
+  folly::Synchronized<std::unordered_map<w_string, FileInformation>>
+      reportedStats;
+
+  std::atomic<uint64_t> overflows{0};
+  std::atomic<uint64_t> readCount{0};
+  std::atomic<uint64_t> statsTaken{0};
+  std::atomic<bool> useExtendedInfo{false};
+
+  // The change journal of the root's volume, if win32_usn_journal is set
+  // and it can be read
+  std::unique_ptr<UsnJournal> journal;
+  // Set by resumeFrom()
+  std::optional<UsnJournal::Position> resumePosition;
+  std::atomic<bool> replayedJournal{false};
+  // Journal positions up to which every change is known to have made it
+  // into changedItems (promoted), and out of it (consumed).  The former is
+  // guarded by changedItems' lock; the latter belongs to the notify thread.
+  std::optional<UsnJournal::Position> promotedPosition;
+  std::optional<UsnJournal::Position> consumedPosition;
+  // Sampled by readChangesThread when it is idle; promoted at the next idle
+  // period, by which time every change made before it has been reported.
+  std::optional<UsnJournal::Position> idlePosition;
+
   explicit WinWatcher(const w_string& root_path, const Configuration& config);
   ~WinWatcher();
 
@@ -61,10 +112,41 @@ struct WinWatcher : public Watcher {
   bool start(const std::shared_ptr<Root>& root) override;
   void stopThreads() override;
   void readChangesThread(const std::shared_ptr<Root>& root);
+
+  std::optional<FileInformation> takeReportedStat(
+      const w_string& path) override;
+
+  json_ref getDebugInfo() override;
+  void clearDebugInfo() override;
+
+  w_string getResumeToken() const override;
+  void resumeFrom(w_string_piece token) override;
+  bool resumed() const override;
+
+ private:
+  bool startReadChangesThread(const std::shared_ptr<Root>& root);
+  bool replayJournal(
+      const std::shared_ptr<Root>& root,
+      const UsnJournal::Position& since,
+      USN until);
+  std::optional<w_string> pathForFileReference(uint64_t fileReference);
+  bool issueRead(ChangesRead& read, DWORD size, DWORD filter);
+  void decodeChanges(
+      const std::shared_ptr<Root>& root,
+      const ChangesRead& read,
+      std::list<Item>& items,
+      std::unordered_map<w_string, std::optional<FileInformation>>& stats);
 };
 
 WinWatcher::WinWatcher(const w_string& root_path, const Configuration& config)
-    : Watcher("win32", WATCHER_HAS_PER_FILE_NOTIFICATIONS) {
+    : Watcher(
+          "win32",
+          WATCHER_HAS_PER_FILE_NOTIFICATIONS |
+              (config.getBool("win32_rdcw_extended_info", true)
+                   ? WATCHER_REPORTS_FILE_INFORMATION
+                   : 0)) {
+  useExtendedInfo = flags & WATCHER_REPORTS_FILE_INFORMATION;
+
   auto wpath = root_path.piece().asWideUNC();
 
   // Create an overlapped handle so that we can avoid blocking forever
@@ -92,11 +174,31 @@ WinWatcher::WinWatcher(const w_string& root_path, const Configuration& config)
         std::string("failed to create event: ") +
         win32_strerror(GetLastError()));
   }
-  olapEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
-  if (!olapEvent) {
-    throw std::runtime_error(
-        std::string("failed to create event: ") +
-        win32_strerror(GetLastError()));
+  auto bufCount =
+      std::max<json_int_t>(1, config.getInt("win32_rdcw_buf_count", 4));
+  for (json_int_t i = 0; i < bufCount; ++i) {
+    auto olapEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    if (!olapEvent) {
+      throw std::runtime_error(
+          std::string("failed to create event: ") +
+          win32_strerror(GetLastError()));
+    }
+    olapEvents.push_back(olapEvent);
+  }
+
+  if (config.getBool("win32_usn_journal", false)) {
+    try {
+      journal = std::make_unique<UsnJournal>(root_path);
+      // Make sure that it can actually be read
+      journal->current();
+    } catch (const std::system_error& exc) {
+      logf(
+          ERR,
+          "unable to read the change journal for {}: {}\n",
+          root_path,
+          exc.what());
+      journal.reset();
+    }
   }
 }
 
@@ -104,7 +206,7 @@ WinWatcher::~WinWatcher() {
   if (ping != INVALID_HANDLE_VALUE) {
     CloseHandle(ping);
   }
-  if (olapEvent != INVALID_HANDLE_VALUE) {
+  for (auto olapEvent : olapEvents) {
     CloseHandle(olapEvent);
   }
 }
@@ -113,11 +215,160 @@ void WinWatcher::stopThreads() {
   SetEvent(ping);
 }
 
+bool WinWatcher::issueRead(ChangesRead& read, DWORD size, DWORD filter) {
+  ResetEvent(read.olap.hEvent);
+  read.extended = useExtendedInfo.load(std::memory_order_relaxed);
+  if (read.extended) {
+    if (ReadDirectoryChangesExW(
+            (HANDLE)dir_handle.handle(),
+            read.buf.data(),
+            size,
+            TRUE,
+            filter,
+            nullptr,
+            &read.olap,
+            nullptr,
+            ReadDirectoryNotifyExtendedInformation)) {
+      read.outstanding = true;
+      return true;
+    }
+    DWORD err = GetLastError();
+    if (err != ERROR_INVALID_FUNCTION && err != ERROR_NOT_SUPPORTED) {
+      return false;
+    }
+    // Older versions of Windows and some filesystems can't report the
+    // extended information; the IO thread will stat the files instead.
+    logf(
+        ERR,
+        "ReadDirectoryChangesExW: {}, falling back to ReadDirectoryChangesW\n",
+        win32_strerror(err));
+    useExtendedInfo = false;
+    read.extended = false;
+  }
+
+  if (!ReadDirectoryChangesW(
+          (HANDLE)dir_handle.handle(),
+          read.buf.data(),
+          size,
+          TRUE,
+          filter,
+          nullptr,
+          &read.olap,
+          nullptr)) {
+    return false;
+  }
+  read.outstanding = true;
+  return true;
+}
+
+void WinWatcher::decodeChanges(
+    const std::shared_ptr<Root>& root,
+    const ChangesRead& read,
+    std::list<Item>& items,
+    std::unordered_map<w_string, std::optional<FileInformation>>& stats) {
+  const char* entry = reinterpret_cast<const char*>(read.buf.data());
+  // The old name of a rename, which the next record gives the new name of
+  w_string renamedFrom;
+
+  while (true) {
+    DWORD action;
+    DWORD nextEntryOffset;
+    const WCHAR* fileName;
+    DWORD fileNameLength;
+    std::optional<FileInformation> st;
+    // Without the extended records, we can't tell dirs from files here;
+    // the IO thread ignores a rename of anything that isn't a dir it knows.
+    bool isDir = true;
+
+    if (read.extended) {
+      auto notify =
+          reinterpret_cast<const FILE_NOTIFY_EXTENDED_INFORMATION*>(entry);
+      action = notify->Action;
+      nextEntryOffset = notify->NextEntryOffset;
+      fileName = notify->FileName;
+      fileNameLength = notify->FileNameLength;
+      isDir = notify->FileAttributes & FILE_ATTRIBUTE_DIRECTORY;
+
+      // Only files are worth reporting: a directory is scanned when it
+      // changes, and a stat is the only way to tell that something that was
+      // removed is gone.
+      if (!(notify->FileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
+          action != FILE_ACTION_REMOVED &&
+          action != FILE_ACTION_RENAMED_OLD_NAME) {
+        st.emplace(notify->FileAttributes);
+        FILETIME_LARGE_INTEGER_to_timespec(notify->CreationTime, &st->ctime);
+        FILETIME_LARGE_INTEGER_to_timespec(notify->LastAccessTime, &st->atime);
+        FILETIME_LARGE_INTEGER_to_timespec(
+            notify->LastModificationTime, &st->mtime);
+        st->size = notify->FileSize.QuadPart;
+      }
+    } else {
+      auto notify = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(entry);
+      action = notify->Action;
+      nextEntryOffset = notify->NextEntryOffset;
+      fileName = notify->FileName;
+      fileNameLength = notify->FileNameLength;
+    }
+
+    // FileNameLength is in BYTES, but FileName is WCHAR
+    DWORD n_chars = fileNameLength / sizeof(fileName[0]);
+    w_string name(fileName, n_chars);
+
+    auto full = w_string::pathCat({root->root_path, name});
+
+    if (!root->ignore.isIgnored(full.data(), full.size())) {
+      // If we have a delete or rename-away it may be part of
+      // a recursive tree remove or rename.  In that situation
+      // the notifications that we'll receive from the OS will
+      // be from the leaves and bubble up to the root of the
+      // delete/rename.  We want to flag those paths for recursive
+      // analysis so that we can prune children from the trie
+      // that is built when we pass this to the pending list
+      // later.  We don't do that here in this thread because
+      // we're trying to minimize latency in this context.
+      items.emplace_back(
+          w_string{full},
+          (action == FILE_ACTION_REMOVED ||
+           action == FILE_ACTION_RENAMED_OLD_NAME)
+              ? W_PENDING_RECURSIVE
+              : 0);
+      // The latest notification wins, including one that carries nothing
+      stats[full] = st;
+
+      if (action == FILE_ACTION_RENAMED_NEW_NAME && !renamedFrom.empty() &&
+          isDir) {
+        items.back().movedFrom = std::move(renamedFrom);
+      }
+
+      if (!name.empty() &&
+          (action == FILE_ACTION_ADDED || action == FILE_ACTION_REMOVED ||
+           action == FILE_ACTION_RENAMED_OLD_NAME ||
+           action == FILE_ACTION_RENAMED_NEW_NAME)) {
+        // ReadDirectoryChangesW provides change events when the child
+        // entry list changes, but may not provide a notification for the
+        // parent when its mtime changes. It should be rescanned, so
+        // synthesize an event for the IO thread here.
+        items.emplace_back(full.dirName(), PendingFlags{});
+      }
+    }
+
+    if (action == FILE_ACTION_RENAMED_OLD_NAME) {
+      renamedFrom = std::move(full);
+    } else {
+      renamedFrom = w_string();
+    }
+
+    // Advance to next item
+    if (nextEntryOffset == 0) {
+      break;
+    }
+    entry += nextEntryOffset;
+  }
+}
+
 void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
-  std::vector<uint8_t> buf;
-  auto olap = OVERLAPPED();
-  BOOL initiate_read = true;
-  HANDLE handles[2] = {olapEvent, ping};
+  std::vector<ChangesRead> reads(olapEvents.size());
+  size_t next = 0;
   DWORD bytes;
 
   w_set_thread_name("readchange ", root->root_path.view());
@@ -135,30 +386,38 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
       FILE_NOTIFY_CHANGE_ATTRIBUTES | FILE_NOTIFY_CHANGE_SIZE |
       FILE_NOTIFY_CHANGE_LAST_WRITE;
 
+  for (size_t i = 0; i < reads.size(); ++i) {
+    reads[i].olap = OVERLAPPED();
+    reads[i].olap.hEvent = olapEvents[i];
+    reads[i].buf.resize(size);
+  }
+
+  // The OS writes into the buffers of outstanding reads, so they must be
+  // cancelled and waited out before the buffers go away.
+  SCOPE_EXIT {
+    CancelIoEx((HANDLE)dir_handle.handle(), nullptr);
+    for (auto& read : reads) {
+      if (read.outstanding) {
+        GetOverlappedResult(
+            (HANDLE)dir_handle.handle(), &read.olap, &bytes, TRUE);
+      }
+    }
+  };
+
   // Block until winmatch_root_st is waiting for our initialization
   {
     auto wlock = changedItems.lock();
 
-    olap.hEvent = olapEvent;
-
-    buf.resize(size);
-
-    if (!ReadDirectoryChangesW(
-            (HANDLE)dir_handle.handle(),
-            &buf[0],
-            size,
-            TRUE,
-            filter,
-            nullptr,
-            &olap,
-            nullptr)) {
-      DWORD err = GetLastError();
-      logf(
-          ERR,
-          "ReadDirectoryChangesW: failed, cancel watch. {}\n",
-          win32_strerror(err));
-      root->cancel();
-      return;
+    for (auto& read : reads) {
+      if (!issueRead(read, size, filter)) {
+        DWORD err = GetLastError();
+        logf(
+            ERR,
+            "ReadDirectoryChangesW: failed, cancel watch. {}\n",
+            win32_strerror(err));
+        root->cancel();
+        return;
+      }
     }
     // Signal that we are done with init.  We MUST do this AFTER our first
     // successful ReadDirectoryChangesW, otherwise there is a race condition
@@ -167,33 +426,32 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
     logf(DBG, "ReadDirectoryChangesW signalling as init done\n");
     cond.notify_one();
   }
-  initiate_read = false;
 
   std::list<Item> items;
+  std::unordered_map<w_string, std::optional<FileInformation>> stats;
 
   // The mutex must not be held when we enter the loop
   while (!root->inner.cancelled) {
-    if (initiate_read) {
-      if (!ReadDirectoryChangesW(
-              (HANDLE)dir_handle.handle(),
-              &buf[0],
-              size,
-              TRUE,
-              filter,
-              nullptr,
-              &olap,
-              nullptr)) {
+    bool failed = false;
+    for (auto& read : reads) {
+      if (!read.outstanding && !issueRead(read, size, filter)) {
         DWORD err = GetLastError();
         logf(
             ERR,
             "ReadDirectoryChangesW: failed, cancel watch. {}\n",
             win32_strerror(err));
         root->cancel();
+        failed = true;
         break;
-      } else {
-        initiate_read = false;
       }
     }
+    if (failed) {
+      break;
+    }
+
+    // The reads complete in the order they were issued
+    auto& read = reads[next];
+    HANDLE handles[2] = {read.olap.hEvent, ping};
 
     watchman::log(watchman::DBG, "waiting for change notifications\n");
     DWORD status = WaitForMultipleObjects(
@@ -210,9 +468,11 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
     watchman::log(watchman::DBG, "wait returned with status ", status, "\n");
 
     if (status == WAIT_OBJECT_0) {
+      read.outstanding = false;
+      readCount.fetch_add(1, std::memory_order_relaxed);
       bytes = 0;
       if (!GetOverlappedResult(
-              (HANDLE)dir_handle.handle(), &olap, &bytes, FALSE)) {
+              (HANDLE)dir_handle.handle(), &read.olap, &bytes, FALSE)) {
         DWORD err = GetLastError();
         logf(
             ERR,
@@ -231,78 +491,63 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
               "with smaller buffer\n",
               root->root_path);
           size = kNetworkBufSize;
-          initiate_read = true;
           continue;
         }
 
         if (err == ERROR_NOTIFY_ENUM_DIR) {
+          overflows.fetch_add(1, std::memory_order_relaxed);
           root->scheduleRecrawl("ERROR_NOTIFY_ENUM_DIR");
         } else {
           logf(ERR, "Cancelling watch for {}\n", root->root_path);
           root->cancel();
           break;
         }
+      } else if (bytes == 0) {
+        // The OS ran out of room for the changes and discarded them
+        overflows.fetch_add(1, std::memory_order_relaxed);
+        root->scheduleRecrawl("ReadDirectoryChangesW buffer overflow");
       } else {
-        PFILE_NOTIFY_INFORMATION notify = (PFILE_NOTIFY_INFORMATION)buf.data();
-
-        while (true) {
-          // FileNameLength is in BYTES, but FileName is WCHAR
-          DWORD n_chars = notify->FileNameLength / sizeof(notify->FileName[0]);
-          w_string name(notify->FileName, n_chars);
-
-          auto full = w_string::pathCat({root->root_path, name});
-
-          if (!root->ignore.isIgnored(full.data(), full.size())) {
-            // If we have a delete or rename-away it may be part of
-            // a recursive tree remove or rename.  In that situation
-            // the notifications that we'll receive from the OS will
-            // be from the leaves and bubble up to the root of the
-            // delete/rename.  We want to flag those paths for recursive
-            // analysis so that we can prune children from the trie
-            // that is built when we pass this to the pending list
-            // later.  We don't do that here in this thread because
-            // we're trying to minimize latency in this context.
-            items.emplace_back(
-                w_string{full},
-                (notify->Action == FILE_ACTION_REMOVED ||
-                 notify->Action == FILE_ACTION_RENAMED_OLD_NAME)
-                    ? W_PENDING_RECURSIVE
-                    : 0);
-
-            if (!name.empty() &&
-                (notify->Action == FILE_ACTION_ADDED ||
-                 notify->Action == FILE_ACTION_REMOVED ||
-                 notify->Action == FILE_ACTION_RENAMED_OLD_NAME ||
-                 notify->Action == FILE_ACTION_RENAMED_NEW_NAME)) {
-              // ReadDirectoryChangesW provides change events when the child
-              // entry list changes, but may not provide a notification for the
-              // parent when its mtime changes. It should be rescanned, so
-              // synthesize an event for the IO thread here.
-              items.emplace_back(full.dirName(), PendingFlags{});
-            }
-          }
-
-          // Advance to next item
-          if (notify->NextEntryOffset == 0) {
-            break;
-          }
-          notify =
-              (PFILE_NOTIFY_INFORMATION)(notify->NextEntryOffset + (char*)notify);
-        }
-
-        ResetEvent(olapEvent);
-        initiate_read = true;
+        decodeChanges(root, read, items, stats);
       }
+      next = (next + 1) % reads.size();
     } else if (status == WAIT_OBJECT_0 + 1) {
       logf(ERR, "signalled\n");
       break;
     } else if (status == WAIT_TIMEOUT) {
+      if (items.empty() && journal) {
+        try {
+          auto position = journal->current();
+          auto wlock = changedItems.lock();
+          if (idlePosition) {
+            promotedPosition = idlePosition;
+          }
+          idlePosition = position;
+        } catch (const std::system_error& exc) {
+          logf(DBG, "FSCTL_QUERY_USN_JOURNAL: {}\n", exc.what());
+        }
+      }
       if (!items.empty()) {
         watchman::log(
             watchman::DBG,
             "timed out waiting for changes, and we have ",
             items.size(),
             " items; move and notify\n");
+        {
+          // Publish the stats first, so that they are there by the time the
+          // IO thread gets to the items.
+          auto reported = reportedStats.wlock();
+          if (reported->size() > kMaxReportedStats) {
+            reported->clear();
+          }
+          for (auto& [path, st] : stats) {
+            if (st) {
+              reported->insert_or_assign(path, *st);
+            } else {
+              reported->erase(path);
+            }
+          }
+        }
+        stats.clear();
         auto wlock = changedItems.lock();
         wlock->splice(wlock->end(), items);
         cond.notify_one();
@@ -317,6 +562,187 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
 }
 
 bool WinWatcher::start(const std::shared_ptr<Root>& root) {
+  if (!journal) {
+    return startReadChangesThread(root);
+  }
+
+  // Changes made before this point are found by the crawl, or by replaying
+  // the journal up to the point at which ReadDirectoryChanges took over.
+  std::optional<UsnJournal::Position> startPosition;
+  try {
+    startPosition = journal->current();
+  } catch (const std::system_error& exc) {
+    logf(ERR, "FSCTL_QUERY_USN_JOURNAL: {}\n", exc.what());
+  }
+
+  if (!startReadChangesThread(root)) {
+    return false;
+  }
+
+  if (resumePosition && startPosition) {
+    try {
+      auto until = journal->current();
+      if (replayJournal(root, *resumePosition, until.usn)) {
+        startPosition = until;
+        replayedJournal = true;
+      }
+    } catch (const std::system_error& exc) {
+      logf(
+          ERR,
+          "unable to replay the change journal for {}, crawling instead: "
+          "{}\n",
+          root->root_path,
+          exc.what());
+      // Whatever was replayed is harmless; the crawl revalidates it
+    }
+  }
+
+  auto wlock = changedItems.lock();
+  promotedPosition = startPosition;
+  consumedPosition = startPosition;
+  return true;
+}
+
+bool WinWatcher::replayJournal(
+    const std::shared_ptr<Root>& root,
+    const UsnJournal::Position& since,
+    USN until) {
+  if (!journal->canReadFrom(since)) {
+    logf(
+        ERR,
+        "the change journal for {} no longer goes back to USN {}, "
+        "crawling instead\n",
+        root->root_path,
+        since.usn);
+    return false;
+  }
+
+  // The journal identifies files by reference number and names them within
+  // their parent.  Resolving the parent's current path places each change
+  // where the file is now; files whose parent is gone are gone too, and the
+  // records for the removal of the parent cover them.
+  std::unordered_map<uint64_t, std::optional<w_string>> dirPaths;
+  std::unordered_map<w_string, PendingFlags> changes;
+  size_t records = 0;
+
+  journal->read(since, until, [&](const UsnJournal::Record& record) {
+    ++records;
+    auto it = dirPaths.find(record.parentFileReference);
+    if (it == dirPaths.end()) {
+      it = dirPaths
+               .emplace(
+                   record.parentFileReference,
+                   pathForFileReference(record.parentFileReference))
+               .first;
+    }
+    if (!it->second) {
+      return;
+    }
+    auto& dirPath = *it->second;
+    if (!dirPath.piece().startsWithCaseInsensitive(root->root_path) ||
+        (dirPath.size() > root->root_path.size() &&
+         !is_slash(dirPath.data()[root->root_path.size()]))) {
+      // Another part of the volume
+      return;
+    }
+
+    // Spell the root the way the root does
+    auto relative = dirPath.view().substr(
+        std::min(dirPath.size(), root->root_path.size() + 1));
+    auto dir = relative.empty()
+        ? root->root_path
+        : w_string::pathCat({root->root_path, relative});
+    auto full = w_string::pathCat({dir, record.name});
+    if (root->ignore.isIgnored(full.data(), full.size())) {
+      return;
+    }
+
+    PendingFlags flags;
+    if (record.reason &
+        (USN_REASON_FILE_DELETE | USN_REASON_RENAME_OLD_NAME)) {
+      flags.set(W_PENDING_RECURSIVE);
+    }
+    changes[full].set(flags);
+    if (record.reason &
+        (USN_REASON_FILE_CREATE | USN_REASON_FILE_DELETE |
+         USN_REASON_RENAME_OLD_NAME | USN_REASON_RENAME_NEW_NAME)) {
+      // As with ReadDirectoryChangesW, the parent's entries changed
+      changes.try_emplace(dir);
+    }
+  });
+
+  std::list<Item> items;
+  for (auto& [path, flags] : changes) {
+    items.emplace_back(w_string{path}, flags);
+  }
+  logf(
+      ERR,
+      "replayed {} change journal records for {}: {} paths changed\n",
+      records,
+      root->root_path,
+      items.size());
+
+  auto wlock = changedItems.lock();
+  wlock->splice(wlock->end(), items);
+  cond.notify_one();
+  return true;
+}
+
+std::optional<w_string> WinWatcher::pathForFileReference(
+    uint64_t fileReference) {
+  FILE_ID_DESCRIPTOR desc{};
+  desc.dwSize = sizeof(desc);
+  desc.Type = FileIdType;
+  desc.FileId.QuadPart = fileReference;
+
+  FileDescriptor fd(
+      intptr_t(OpenFileById(
+          (HANDLE)dir_handle.handle(),
+          &desc,
+          FILE_READ_ATTRIBUTES,
+          FILE_SHARE_READ | FILE_SHARE_DELETE | FILE_SHARE_WRITE,
+          nullptr,
+          FILE_FLAG_BACKUP_SEMANTICS)),
+      FileDescriptor::FDType::Generic);
+  if (!fd) {
+    return std::nullopt;
+  }
+  try {
+    return fd.getOpenedPath();
+  } catch (const std::system_error&) {
+    return std::nullopt;
+  }
+}
+
+w_string WinWatcher::getResumeToken() const {
+  if (!consumedPosition) {
+    return w_string{};
+  }
+  return w_string::build(
+      "usn:", consumedPosition->journalId, ":", consumedPosition->usn);
+}
+
+void WinWatcher::resumeFrom(w_string_piece token) {
+  std::vector<std::string_view> parts;
+  folly::split(':', token.view(), parts);
+  if (parts.size() != 3 || parts[0] != "usn") {
+    logf(ERR, "ignoring resume token {} from another watcher\n", token);
+    return;
+  }
+  auto journalId = folly::tryTo<uint64_t>(parts[1]);
+  auto usn = folly::tryTo<USN>(parts[2]);
+  if (!journalId || !usn) {
+    logf(ERR, "ignoring malformed resume token {}\n", token);
+    return;
+  }
+  resumePosition = UsnJournal::Position{*journalId, *usn};
+}
+
+bool WinWatcher::resumed() const {
+  return replayedJournal.load(std::memory_order_acquire);
+}
+
+bool WinWatcher::startReadChangesThread(const std::shared_ptr<Root>& root) {
   // Spin up the changes reading thread; it owns a ref on the root
 
   try {
@@ -381,6 +807,7 @@ Watcher::ConsumeNotifyRet WinWatcher::consumeNotify(
   {
     auto wlock = changedItems.lock();
     std::swap(items, *wlock);
+    consumedPosition = promotedPosition;
   }
 
   auto now = std::chrono::system_clock::now();
@@ -393,6 +820,9 @@ Watcher::ConsumeNotifyRet WinWatcher::consumeNotify(
         " ",
         item.flags.format(),
         "\n");
+    if (!item.movedFrom.empty()) {
+      coll.addMove(item.movedFrom, item.path, now);
+    }
     coll.add(item.path, now, W_PENDING_VIA_NOTIFY | item.flags);
   }
 
@@ -400,6 +830,35 @@ Watcher::ConsumeNotifyRet WinWatcher::consumeNotify(
   return {false};
 }
 
+std::optional<FileInformation> WinWatcher::takeReportedStat(
+    const w_string& path) {
+  auto reported = reportedStats.wlock();
+  auto it = reported->find(path);
+  if (it == reported->end()) {
+    return std::nullopt;
+  }
+  auto st = it->second;
+  reported->erase(it);
+  statsTaken.fetch_add(1, std::memory_order_relaxed);
+  return st;
+}
+
+json_ref WinWatcher::getDebugInfo() {
+  return json_object({
+      {"buffer_count", json_integer(olapEvents.size())},
+      {"extended_info", json_boolean(useExtendedInfo.load())},
+      {"read_count", json_integer(readCount.load())},
+      {"overflow_count", json_integer(overflows.load())},
+      {"reported_stats_used", json_integer(statsTaken.load())},
+  });
+}
+
+void WinWatcher::clearDebugInfo() {
+  readCount.store(0, std::memory_order_release);
+  overflows.store(0, std::memory_order_release);
+  statsTaken.store(0, std::memory_order_release);
+}
+
 bool WinWatcher::waitNotify(int timeoutms) {
   auto wlock = changedItems.lock();
   if (!wlock->empty()) {
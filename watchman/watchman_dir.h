@@ -6,9 +6,16 @@
  */
 
 #pragma once
-#include <unordered_map>
+#include <memory>
+#include <string>
+#include "watchman/ChildTable.h"
+#include "watchman/Clock.h"
 #include "watchman/watchman_string.h"
 
+namespace watchman {
+class NodeArena;
+}
+
 struct watchman_file;
 
 struct watchman_dir {
@@ -22,18 +29,41 @@ struct watchman_dir {
   struct Deleter {
     void operator()(watchman_file*) const;
   };
-  std::unordered_map<w_string_piece, std::unique_ptr<watchman_file, Deleter>>
-      files;
+  watchman::ChildTable<std::unique_ptr<watchman_file, Deleter>> files;
 
   /* child dirs contained in this dir (keyed by dir->name) */
-  std::unordered_map<w_string_piece, std::unique_ptr<watchman_dir>> dirs;
+  struct DirDeleter {
+    void operator()(watchman_dir*) const;
+  };
+  watchman::ChildTable<std::unique_ptr<watchman_dir, DirDeleter>> dirs;
 
   // If we think this dir was deleted, we'll avoid recursing
   // to its children when processing deletes.
   bool last_check_existed{true};
 
+  // The mtime of this dir when its entries were last enumerated, or zero if
+  // that mtime was too recent to tell later changes apart from it.  Lets a
+  // fast_revalidate_crawl skip enumerating dirs whose entries are unchanged.
+  struct timespec crawledMtime {
+    0, 0
+  };
+
+  // The highest otime tick of any file in this dir's subtree, deleted
+  // files included, so that queries with a since clock can skip subtrees in
+  // which nothing has changed.  Always at least that of every child dir.
+  // Aging files out doesn't lower it, so it may overstate how recently the
+  // subtree changed, which only costs a walk that finds nothing.
+  watchman::ClockTicks subtreeTicks{0};
+
   watchman_dir(w_string name, watchman_dir* parent);
 
+  /**
+   * Allocates a child dir node from arena.  The returned node must be owned
+   * by the `dirs` map of its parent so that it is released via DirDeleter.
+   */
+  static std::unique_ptr<watchman_dir, DirDeleter>
+  make(w_string name, watchman_dir* parent, watchman::NodeArena& arena);
+
   watchman_dir* getChildDir(w_string_piece name) const;
 
   /**
@@ -59,4 +89,21 @@ struct watchman_dir {
    * the path to the child.
    */
   w_string getFullPathToChild(w_string_piece child) const;
+
+  /**
+   * Like getFullPathToChild(), but renders the path into buffer, replacing
+   * its contents, and returns a piece covering it.  Callers that build many
+   * paths (eg: while evaluating a query) can reuse the same buffer and avoid
+   * allocating a string for each one.  The returned piece is valid until
+   * buffer is next modified.
+   */
+  w_string_piece renderFullPathToChild(
+      std::string& buffer,
+      w_string_piece child = w_string_piece()) const;
+
+ private:
+  uint32_t fullPathLength(w_string_piece child) const;
+  // Writes the path backwards from end, which must have room for
+  // fullPathLength(child) bytes before it.
+  void writeFullPathToChild(char* end, w_string_piece child) const;
 };
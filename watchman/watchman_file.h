@@ -8,17 +8,16 @@
 #pragma once
 
 #include "watchman/Clock.h"
-#include "watchman/fs/FileInformation.h"
+#include "watchman/fs/CompactFileInformation.h"
 #include "watchman/watchman_dir.h"
 
 struct watchman_file {
   /* the parent dir */
   watchman_dir* parent;
 
-  /* linkage to files ordered by changed time.
-   * prev points to the address of `next` in the
-   * previous file node, or the head of the list. */
-  struct watchman_file **prev, *next;
+  /* our entry in the view's RecencyIndex, which orders files by
+   * changed time, or nullptr if we are not in it */
+  struct watchman_file** recencySlot;
 
   /* the time we last observed a change to this file */
   watchman::ClockStamp otime;
@@ -31,10 +30,24 @@ struct watchman_file {
   bool exists;
   /* whether we think this file might not exist */
   bool maybe_deleted;
+  /* whether recencySlot is in the view's tombstone index rather than
+   * its recency index */
+  bool in_tombstone_index;
+
+  /* whether make() kept a case folded copy of our name; see
+   * getFoldedName() */
+  enum class FoldedName : uint8_t {
+    None,
+    // The name has no upper case letters, so it is its own folded copy
+    SameAsName,
+    // The folded copy follows the name
+    Stored,
+  };
+  FoldedName folded_name;
 
   /* cache stat results so we can tell if an entry
    * changed */
-  watchman::FileInformation stat;
+  watchman::CompactFileInformation stat;
 
   inline w_string_piece getName() const {
     uint32_t len;
@@ -42,7 +55,22 @@ struct watchman_file {
     return w_string_piece(reinterpret_cast<const char*>(this + 1) + 4, len);
   }
 
-  void removeFromFileList();
+  /* our name with its ASCII letters lower cased, for the case insensitive
+   * query terms, if this node was made with foldCase */
+  inline std::optional<w_string_piece> getFoldedName() const {
+    switch (folded_name) {
+      case FoldedName::None:
+        return std::nullopt;
+      case FoldedName::SameAsName:
+        return getName();
+      case FoldedName::Stored:
+        break;
+    }
+    auto name = getName();
+    return w_string_piece(name.data() + name.size() + 1, name.size());
+  }
+
+  void removeFromRecencyIndex();
 
   watchman_file() = delete;
   watchman_file(const watchman_file&) = delete;
@@ -51,7 +79,9 @@ struct watchman_file {
 
   static std::unique_ptr<watchman_file, watchman_dir::Deleter> make(
       const w_string& name,
-      watchman_dir* parent);
+      watchman_dir* parent,
+      watchman::NodeArena& arena,
+      bool foldCase = false);
 };
 
 void free_file_node(struct watchman_file* file);
@@ -36,6 +36,23 @@ class Stream {
   virtual bool peerIsOwner() = 0;
   virtual pid_t getPeerProcessID() const = 0;
   virtual const FileDescriptor& getFileDescriptor() const = 0;
+
+  /**
+   * Passes fd to the peer along with the data of the next write(), as
+   * SCM_RIGHTS ancillary data.  Returns false, leaving fd unsent, if the
+   * stream can't pass descriptors.
+   */
+  virtual bool attachDescriptor(FileDescriptor&& /* fd */) {
+    return false;
+  }
+
+  /**
+   * Returns true if the peer has closed the connection, without reading
+   * anything.  Streams that can't tell return false.
+   */
+  virtual bool peerHungUp() {
+    return false;
+  }
 };
 
 struct EventPoll {
@@ -77,6 +77,12 @@ struct StringHeader {
     refcnt.fetch_add(kRefIncrement, std::memory_order_relaxed);
   }
 
+  // Returns the current number of references.  Only meaningful when the
+  // caller can exclude concurrent copies of the string.
+  size_t refcount() const {
+    return (refcnt.load(std::memory_order_acquire) & kRefMask) / kRefIncrement;
+  }
+
   // Returns true if this was the final reference, indicating the string
   // should be destroyed.
   bool decref() {
@@ -101,14 +107,17 @@ struct StringHeader {
    * Allocates storage for length + 1 bytes.
    */
   static StringHeader* alloc(uint32_t length, w_string_type_t type) {
-    void* s = malloc(sizeof(StringHeader) + length + 1);
-    if (!s) {
-      throw std::bad_alloc{};
-    }
+    void* s = allocStorage(sizeof(StringHeader) + length + 1);
     new (s) StringHeader(type, length);
     return static_cast<StringHeader*>(s);
   }
 
+  /**
+   * Destroys a header returned by alloc() and releases its storage.  `len`
+   * may have been reduced since it was allocated, but never increased.
+   */
+  static void destroy(StringHeader* str) noexcept;
+
   char* buf() {
     return reinterpret_cast<char*>(this + 1);
   }
@@ -117,13 +126,55 @@ struct StringHeader {
     return reinterpret_cast<const char*>(this + 1);
   }
 
+  /**
+   * Storage for headers whose strings fit in this many bytes, which covers
+   * most file names, is recycled through a small per-thread cache rather
+   * than going back to malloc each time.
+   */
+  static constexpr size_t kSmallStorageSize = 64;
+
   static constexpr uint8_t kTypeMask = 3ull;
   static constexpr size_t kHasHval = 1ull << 2ull;
   static constexpr size_t kRefShift = 3ull;
   static constexpr size_t kRefIncrement = 1ull << kRefShift;
   static constexpr size_t kRefMask = ~(kRefIncrement - 1);
+
+ private:
+  static void* allocStorage(size_t size);
 };
 
+/**
+ * The hash functions that w_string can use, exposed so that they can be
+ * benchmarked against each other.  wordStringHash is the one in use.
+ *
+ * stdStringHash folds the standard library's hash to 32 bits.
+ * wordStringHash mixes in eight bytes at a time, over four independent lanes
+ * for longer strings so that the multiplies can overlap.
+ */
+StringHash stdStringHash(const char* str, size_t len) noexcept;
+StringHash wordStringHash(const char* str, size_t len) noexcept;
+
+/**
+ * The byte scans behind the path and case insensitive helpers.  Each one
+ * uses SSE2 or NEON where available, 16 bytes at a time; the scalar versions
+ * are exposed so that they can be tested and benchmarked against them.
+ *
+ * findLastSlash returns the last path separator in [begin, end), or nullptr.
+ * equalAsciiCaseless compares len bytes, folding only the ASCII letters.
+ * asciiPrefixLength returns the length of the leading run of 7-bit bytes.
+ * foldAsciiCase copies len bytes from src to dst, lower casing ASCII letters.
+ */
+const char* findLastSlash(const char* begin, const char* end) noexcept;
+const char* findLastSlashScalar(const char* begin, const char* end) noexcept;
+bool equalAsciiCaseless(const char* a, const char* b, size_t len) noexcept;
+bool equalAsciiCaselessScalar(
+    const char* a,
+    const char* b,
+    size_t len) noexcept;
+size_t asciiPrefixLength(const char* str, size_t len) noexcept;
+size_t asciiPrefixLengthScalar(const char* str, size_t len) noexcept;
+void foldAsciiCase(const char* src, char* dst, size_t len) noexcept;
+
 } // namespace watchman
 
 /**
@@ -155,9 +206,17 @@ class w_string;
  * of the valid region. */
 class w_string_piece {
   using StringHash = watchman::StringHash;
+  using StringHeader = watchman::StringHeader;
 
   const char* str_;
   size_t len_;
+  // The string that this piece covers the whole of, if any, whose cached
+  // hash value hashValue() can reuse.
+  const StringHeader* whole_{nullptr};
+
+  explicit w_string_piece(const StringHeader* whole)
+      : str_{whole->buf()}, len_{whole->len}, whole_{whole} {}
+  friend class w_string;
 
  public:
   w_string_piece() : str_{nullptr}, len_{0} {}
@@ -210,6 +269,9 @@ class w_string_piece {
     }
     str_ += n;
     len_ -= n;
+    if (n) {
+      whole_ = nullptr;
+    }
   }
 
   /** Return a copy of the string as a w_string */
@@ -280,7 +342,8 @@ class w_string_piece {
   bool startsWith(w_string_piece prefix) const;
   bool startsWithCaseInsensitive(w_string_piece prefix) const;
 
-  // Compute a hash value for this piece
+  // Compute a hash value for this piece, or reuse that of the w_string it
+  // was taken from
   StringHash hashValue() const noexcept;
 
 #ifdef _WIN32
@@ -359,6 +422,14 @@ class w_string {
    */
   void reset() noexcept;
 
+  /**
+   * Returns the number of w_string instances sharing this string's storage,
+   * or 0 for the null string.
+   */
+  size_t useCount() const noexcept {
+    return str_ ? str_->refcount() : 0;
+  }
+
   StringHash hashValue() const noexcept {
     if (str_) {
       if (str_->has_hval()) {
@@ -398,7 +469,7 @@ class w_string {
     if (str_ == nullptr) {
       return w_string_piece();
     }
-    return w_string_piece(data(), size());
+    return w_string_piece(str_);
   }
 
   operator w_string_piece() const noexcept {